@@ -14,7 +14,7 @@ if(NOT SDL3_USABLE)
     FetchContent_Declare(
         SDL3
         GIT_REPOSITORY https://github.com/libsdl-org/SDL.git
-        GIT_TAG release-3.2.14
+        GIT_TAG release-3.4.0
         GIT_SHALLOW TRUE
         GIT_PROGRESS TRUE
     )
@@ -93,7 +93,7 @@ if(NOT SDL3_USABLE)
     file(WRITE "${SDL3_CONFIG_DIR}/SDL3Config.cmake" "
 # SDL3 Config file for FetchContent usage
 set(SDL3_FOUND TRUE)
-set(SDL3_VERSION \"3.2.14\")
+set(SDL3_VERSION \"3.4.0\")
 set(SDL3_INCLUDE_DIRS \"${sdl3_SOURCE_DIR}/include\" \"${sdl3_BINARY_DIR}/include\")
 set(SDL3_LIBRARIES SDL3-static)
 
@@ -113,7 +113,7 @@ endif()
     # Create version file
     file(WRITE "${SDL3_CONFIG_DIR}/SDL3ConfigVersion.cmake" "
 # SDL3 version file for FetchContent usage
-set(PACKAGE_VERSION \"3.2.14\")
+set(PACKAGE_VERSION \"3.4.0\")
 
 # Check whether the requested PACKAGE_FIND_VERSION is compatible
 if(\"\${PACKAGE_VERSION}\" VERSION_LESS \"\${PACKAGE_FIND_VERSION}\")
@@ -5,18 +5,48 @@ include(ExternalProject)
 if(NAGI_LLM_ENABLE_BITNET)
     set(BITNET_PREFIX ${CMAKE_BINARY_DIR}/_deps/bitnet)
 
-    if(CMAKE_SYSTEM_PROCESSOR MATCHES "^(aarch64|arm64)")
+    # Lookup-table kernels: TL1 needs NEON (ARM), TL2 needs AVX2 (x86),
+    # I2_S runs everywhere. AUTO picks from the build host's CPU.
+    set(BITNET_KERNEL "AUTO" CACHE STRING "BitNet kernels: AUTO, TL1, TL2 or I2_S")
+    set_property(CACHE BITNET_KERNEL PROPERTY STRINGS AUTO TL1 TL2 I2_S)
+
+    set(BITNET_KERNEL_SELECTED ${BITNET_KERNEL})
+    if(BITNET_KERNEL STREQUAL "AUTO")
+        if(CMAKE_SYSTEM_PROCESSOR MATCHES "^(aarch64|arm64)")
+            set(BITNET_KERNEL_SELECTED TL1)
+            message(STATUS "BitNet: ARM platform detected")
+        else()
+            include(CheckCSourceRuns)
+            check_c_source_runs("
+                int main(void) { __builtin_cpu_init(); return !__builtin_cpu_supports(\"avx2\"); }
+            " BITNET_HOST_AVX2)
+            if(BITNET_HOST_AVX2)
+                set(BITNET_KERNEL_SELECTED TL2)
+                message(STATUS "BitNet: x86 platform with AVX2 detected")
+            else()
+                set(BITNET_KERNEL_SELECTED I2_S)
+                message(STATUS "BitNet: x86 platform without AVX2 detected")
+            endif()
+        endif()
+    endif()
+
+    if(BITNET_KERNEL_SELECTED STREQUAL "TL1")
         set(BITNET_ARM_TL1 ON)
         set(BITNET_X86_TL2 OFF)
-        message(STATUS "BitNet: ARM platform detected, enabling TL1 kernels")
-    else()
+    elseif(BITNET_KERNEL_SELECTED STREQUAL "TL2")
         set(BITNET_ARM_TL1 OFF)
         set(BITNET_X86_TL2 ON)
-        message(STATUS "BitNet: x86 platform detected, enabling TL2 kernels")
+    else()
+        set(BITNET_KERNEL_SELECTED I2_S)
+        set(BITNET_ARM_TL1 OFF)
+        set(BITNET_X86_TL2 OFF)
     endif()
+    string(TOLOWER ${BITNET_KERNEL_SELECTED} BITNET_KERNEL_NAME)
+    message(STATUS "BitNet: enabling ${BITNET_KERNEL_SELECTED} kernels")
 
     message(STATUS "Configuring for BitNet/ChatML prompts.")
     target_compile_definitions(nagi-llm PRIVATE
+        NAGI_BITNET_KERNEL="${BITNET_KERNEL_NAME}"
         START_OF_SYSTEM=""
         END_OF_SYSTEM=""
         START_OF_USER="<|start_header_id|>user<|end_header_id|>\\n"
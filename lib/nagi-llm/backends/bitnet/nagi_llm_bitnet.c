@@ -14,13 +14,55 @@
 #include "nagi_llm_bitnet.h"
 #include "../../include/nagi_llm_context.h"
 #include "../../include/llm_utils.h"
+#include "../../include/llm_log.h"
 #include "../llama_common.h"
 #include "llama.h"
 
 /* Forward declarations */
 static int bitnet_init(nagi_llm_t *llm, const char *model_path, const nagi_llm_config_t *config);
 static void bitnet_shutdown(nagi_llm_t *llm);
-static const char *bitnet_extract_words(nagi_llm_t *llm, const char *input);
+
+/* Lookup-table kernels compiled into the BitNet libraries (AddBitNet.cmake) */
+#ifndef NAGI_BITNET_KERNEL
+#define NAGI_BITNET_KERNEL "i2_s"
+#endif
+
+/*
+ * Check the CPU against the kernels the libraries were built with
+ * TL2 needs AVX2 and TL1 NEON; a CPU without them would die on the first
+ * illegal instruction, so init fails instead. Returns 1 if they can run.
+ */
+static int bitnet_cpu_check(nagi_llm_t *llm)
+{
+    int known = 0, avx2 = 0, avx512 = 0, neon = 0;
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+    __builtin_cpu_init();
+    avx2 = __builtin_cpu_supports("avx2") != 0;
+    avx512 = __builtin_cpu_supports("avx512f") != 0;
+    known = 1;
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+    neon = 1;
+    known = 1;
+#endif
+
+    if (llm->config.verbose) {
+        llm_log(LLM_LOG_DEBUG, "BitNet: %s kernels, CPU:%s%s%s%s\n", NAGI_BITNET_KERNEL,
+                               avx2 ? " AVX2" : "", avx512 ? " AVX-512" : "", neon ? " NEON" : "",
+                               known ? "" : " features unknown");
+    }
+    if (!known) return 1;
+
+    if (strcmp(NAGI_BITNET_KERNEL, "tl2") == 0 && !avx2) {
+        fprintf(stderr, "BitNet: TL2 kernels need AVX2, rebuild with -DBITNET_KERNEL=I2_S\n");
+        return 0;
+    }
+    if (strcmp(NAGI_BITNET_KERNEL, "tl1") == 0 && !neon) {
+        fprintf(stderr, "BitNet: TL1 kernels need NEON, rebuild with -DBITNET_KERNEL=I2_S\n");
+        return 0;
+    }
+    return 1;
+}
 
 /*
  * Initialize the BitNet backend (similar to llamacpp but with BitNet-specific settings)
@@ -31,6 +73,7 @@ static int bitnet_init(nagi_llm_t *llm, const char *model_path, const nagi_llm_c
 
     struct llama_model_params model_params;
     struct llama_context_params ctx_params;
+    int numa;
     
     if (llm->state && llm->state->initialized) {
         fprintf(stderr, "BitNet: Already initialized\n");
@@ -53,21 +96,31 @@ static int bitnet_init(nagi_llm_t *llm, const char *model_path, const nagi_llm_c
         llm->config.model_path[NAGI_LLM_MAX_MODEL_PATH - 1] = '\0';
     }
 
+    if (!bitnet_cpu_check(llm)) {
+        free(state);
+        llm->state = NULL;
+        return 0;
+    }
+
     /* Initialize llama.cpp backend */
     llama_backend_init();
+    numa = llama_common_numa_begin(llm);
 
     /* Load model */
     model_params = llama_model_default_params();
     model_params.n_gpu_layers = 0;  /* BitNet works best on CPU */
-    model_params.use_mmap = true;
-    model_params.use_mlock = false;
+    model_params.use_mmap = llm->config.use_mmap != 0;
+    model_params.use_mlock = llm->config.use_mlock != 0;
+    model_params.progress_callback = llama_common_load_progress;
+    model_params.progress_callback_user_data = llm;
 
-    printf("BitNet: Loading model from %s...\n", llm->config.model_path);
+    llm_log(LLM_LOG_INFO, "BitNet: Loading model from %s...\n", llm->config.model_path);
     state->model = llama_model_load_from_file(llm->config.model_path, model_params);
     if (!state->model) {
         fprintf(stderr, "BitNet: Failed to load model: %s\n", llm->config.model_path);
         free(state);
         llm->state = NULL;
+        llama_common_numa_end(numa);
         return 0;
     }
 
@@ -76,9 +129,9 @@ static int bitnet_init(nagi_llm_t *llm, const char *model_path, const nagi_llm_c
     ctx_params.n_ctx = llm->config.context_size;
     ctx_params.n_batch = llm->config.batch_size;
     ctx_params.n_ubatch = llm->config.u_batch_size;
-    ctx_params.n_threads = llm->config.n_threads;
-    ctx_params.n_threads_batch = llm->config.n_threads;
+    llama_cpu_threads(llm, &ctx_params);
     ctx_params.n_seq_max = llm->config.n_seq_max;
+    llama_common_kv_layout(llm, state->model, &ctx_params);
 
     state->ctx = llama_init_from_model(state->model, ctx_params);
     if (!state->ctx) {
@@ -86,41 +139,37 @@ static int bitnet_init(nagi_llm_t *llm, const char *model_path, const nagi_llm_c
         llama_model_free(state->model);
         free(state);
         llm->state = NULL;
+        llama_common_numa_end(numa);
         return 0;
     }
+    llama_set_abort_callback(state->ctx, llama_common_abort, llm);
 
-    /* Random seed for variety */
-    uint32_t seed = (uint32_t)time(NULL) ^ (uint32_t)((uintptr_t)state);
-    
-    /* Create sampler for extraction/semantic (deterministic) */
-    state->sampler = llama_sampler_chain_init(llama_sampler_chain_default_params());
-    llama_sampler_chain_add(state->sampler, llama_sampler_init_top_k(llm->config.top_k));
-    llama_sampler_chain_add(state->sampler, llama_sampler_init_top_p(llm->config.top_p, 1));
-    llama_sampler_chain_add(state->sampler, llama_sampler_init_temp(llm->config.temperature));
-    llama_sampler_chain_add(state->sampler, llama_sampler_init_dist(seed));
-
-    /* Create sampler for response generation (creative with randomized temperature) */
-    float creative_temp = llm->config.temperature_creative_base + 
-                         ((float)(seed % 100) / 100.0f) * llm->config.temperature_creative_offset;
-    state->sampler_creative = llama_sampler_chain_init(llama_sampler_chain_default_params());
-    llama_sampler_chain_add(state->sampler_creative, llama_sampler_init_top_k(40));
-    llama_sampler_chain_add(state->sampler_creative, llama_sampler_init_top_p(0.9f, 1));
-    llama_sampler_chain_add(state->sampler_creative, llama_sampler_init_temp(creative_temp));
-    llama_sampler_chain_add(state->sampler_creative, llama_sampler_init_dist(seed + 1));
-    
-    if (llm->config.verbose) {
-        printf("BitNet Sampler: seed=%u, creative_temp=%.2f\n", seed, creative_temp);
+    /* Token buffer and batches reused by every request */
+    if (!llama_common_arena_init(llm)) {
+        fprintf(stderr, "BitNet: Failed to allocate work buffers\n");
+        llama_free(state->ctx);
+        llama_model_free(state->model);
+        free(state);
+        llm->state = NULL;
+        llama_common_numa_end(numa);
+        return 0;
     }
 
+    llama_common_samplers_init(llm);
+    llama_huge_pages(llm);
+    llama_common_numa_end(numa);
+
     state->initialized = 1;
     state->seq_counter = 0;
+    llama_common_context_attach(llm);
 
     if (llm->config.verbose) {
-        printf("BitNet: Initialized successfully\n");
-        printf("  Context size: %d\n", llm->config.context_size);
-        printf("  Batch size: %d\n", llm->config.batch_size);
-        printf("  Threads: %d\n", llm->config.n_threads);
-        printf("  Sequences: %d\n", llm->config.n_seq_max);
+        llm_log(LLM_LOG_DEBUG, "BitNet: Initialized successfully\n");
+        llm_log(LLM_LOG_DEBUG, "  Context size: %d\n", llm->config.context_size);
+        llm_log(LLM_LOG_DEBUG, "  Batch size: %d\n", llm->config.batch_size);
+        llm_log(LLM_LOG_DEBUG, "  Threads: %d generation, %d batch\n",
+                               ctx_params.n_threads, ctx_params.n_threads_batch);
+        llm_log(LLM_LOG_DEBUG, "  Sequences: %d\n", llm->config.n_seq_max);
     }
 
     return 1;
@@ -139,12 +188,21 @@ static void bitnet_shutdown(nagi_llm_t *llm)
         fprintf(stderr, "BitNet: Shutting down\n");
     }
 
+    llama_common_context_detach(llm);
+
     if (state->sampler) {
         llama_sampler_free(state->sampler);
     }
     if (state->sampler_creative) {
         llama_sampler_free(state->sampler_creative);
     }
+    if (state->grammar_sampler_combined) {
+        llama_sampler_free(state->grammar_sampler_combined);
+    }
+    if (state->grammar_sampler) {
+        llama_sampler_free(state->grammar_sampler);
+    }
+    llama_common_arena_free(state);
     if (state->ctx) {
         llama_free(state->ctx);
     }
@@ -158,491 +216,10 @@ static void bitnet_shutdown(nagi_llm_t *llm)
     llm->state = NULL;
 
     if (llm->config.verbose) {
-        printf("BitNet: Shutdown complete\n");
+        llm_log(LLM_LOG_DEBUG, "BitNet: Shutdown complete\n");
     }
 }
 
-/*
- * Extract verb and noun from user input (same as llamacpp)
- */
-static const char *bitnet_extract_words(nagi_llm_t *llm, const char *input)
-{
-    static char response_buf[NAGI_LLM_MAX_RESPONSE_SIZE];
-    char prompt[NAGI_LLM_MAX_PROMPT_SIZE];
-    char piece[64];
-    int n_tokens, n_prompt_tokens;
-    int current_seq;
-    int response_len, gen_count, max_extract_tokens;
-    llama_token *tokens;
-
-    if (!nagi_llm_ready(llm)) return input;
-    if (!input || input[0] == '\0') return input;
-
-    /* Extract game verbs for vocabulary hint */
-    const char *verbs = extract_game_verbs(llm);
-
-    /* Build extraction prompt with vocabulary context */
-    if (verbs && verbs[0] != '\0' && llm->extraction_prompt_template) {
-        snprintf(prompt, sizeof(prompt), llm->extraction_prompt_template,
-                 verbs, verbs, verbs, input);
-    } else if (llm->extraction_prompt_simple) {
-        snprintf(prompt, sizeof(prompt), llm->extraction_prompt_simple, input);
-    } else {
-        return input;
-    }
-
-    llm_state_t *state = llm->state;
-    int seq_capacity = llm->config.n_seq_max > 0 ? llm->config.n_seq_max : 1;
-    current_seq = (state->seq_counter++) % seq_capacity;
-
-    if (llm->config.verbose) {
-        printf("\n=== BitNet Extraction ===\n");
-        printf("Input: \"%s\"\n", input);
-        printf("Using sequence ID: %d\n", current_seq);
-    }
-
-    /* Clear KV cache for this sequence */
-    llama_kv_cache_seq_rm(state->ctx, current_seq, -1, -1);
-
-    /* Tokenize prompt */
-    n_tokens = llama_n_ctx(state->ctx);
-    tokens = (llama_token *)malloc(n_tokens * sizeof(llama_token));
-    n_prompt_tokens = LLAMA_TOKENIZE(state->model,
-                                     prompt, (int)strlen(prompt),
-                                     tokens, n_tokens);
-    if (n_prompt_tokens < 0) {
-        free(tokens);
-        return input;
-    }
-
-    /* Process prompt in batches */
-    struct llama_batch batch = llama_batch_init(llm->config.batch_size, 0, seq_capacity);
-    for (int i = 0; i < n_prompt_tokens; i += llm->config.batch_size) {
-        int n_eval = n_prompt_tokens - i;
-        if (n_eval > llm->config.batch_size) n_eval = llm->config.batch_size;
-
-        batch.n_tokens = n_eval;
-        for (int k = 0; k < n_eval; k++) {
-            batch.token[k] = tokens[i + k];
-            batch.pos[k] = i + k;
-            batch.n_seq_id[k] = 1;
-            batch.seq_id[k][0] = current_seq;
-            batch.logits[k] = false;
-        }
-        if (i + n_eval == n_prompt_tokens) {
-            batch.logits[n_eval - 1] = true;
-        }
-
-        if (llama_decode(state->ctx, batch) != 0) {
-            llama_batch_free(batch);
-            free(tokens);
-            return input;
-        }
-    }
-    llama_batch_free(batch);
-    free(tokens);
-
-    /* Generate response (extract English words) */
-    response_len = 0;
-    gen_count = 0;
-    max_extract_tokens = 10;
-    struct llama_batch batch_gen = llama_batch_init(1, 0, seq_capacity);
-
-    while (response_len < (int)sizeof(response_buf) - 1 && gen_count < max_extract_tokens) {
-        llama_token new_token = llama_sampler_sample(state->sampler, state->ctx, -1);
-        llama_sampler_accept(state->sampler, new_token);
-
-        if (LLAMA_IS_EOG(state->model, new_token)) {
-            break;
-        }
-
-        int piece_len = LLAMA_TOKEN_TO_PIECE(state->model,
-                                             new_token, piece, sizeof(piece));
-        if (piece_len > 0 && response_len + piece_len < (int)sizeof(response_buf) - 1) {
-            memcpy(response_buf + response_len, piece, piece_len);
-            response_len += piece_len;
-
-            if (strchr(piece, '\n') != NULL) {
-                break;
-            }
-        }
-
-        batch_gen.n_tokens = 1;
-        batch_gen.token[0] = new_token;
-        batch_gen.pos[0] = n_prompt_tokens + gen_count;
-        batch_gen.n_seq_id[0] = 1;
-        batch_gen.seq_id[0][0] = current_seq;
-        batch_gen.logits[0] = true;
-
-        if (llama_decode(state->ctx, batch_gen) != 0) {
-            break;
-        }
-        gen_count++;
-    }
-
-    llama_batch_free(batch_gen);
-    response_buf[response_len] = '\0';
-
-    /* Normalize: trim whitespace and lowercase */
-    char *trimmed = response_buf;
-    while (*trimmed == ' ' || *trimmed == '\n' || *trimmed == '\r' || *trimmed == '\t') {
-        trimmed++;
-    }
-    char *end = trimmed + strlen(trimmed) - 1;
-    while (end > trimmed && (*end == ' ' || *end == '\n' || *end == '\r' || *end == '\t')) {
-        *end-- = '\0';
-    }
-
-    /* Convert to lowercase */
-    for (int i = 0; trimmed[i]; i++) {
-        trimmed[i] = tolower((unsigned char)trimmed[i]);
-    }
-
-    if (llm->config.verbose) {
-        printf("Extracted: \"%s\"\n", trimmed);
-        printf("===================\n\n");
-    }
-
-    /* Copy trimmed result back to start of buffer */
-    if (trimmed != response_buf) {
-        memmove(response_buf, trimmed, strlen(trimmed) + 1);
-    }
-
-    return response_buf;
-}
-
-/*
- * Semantic matching - uses LLM to determine if input matches expected command
- * Same approach as llamacpp backend
- */
-static int bitnet_matches_expected(nagi_llm_t *llm, const char *input,
-                                   const int *expected_word_ids, int expected_count)
-{
-    llm_state_t *state = llm->state;
-    char prompt[NAGI_LLM_MAX_PROMPT_SIZE];
-    char expected_command[256];
-    char response_buf[256];
-    char piece[64];
-    int n_tokens, n_prompt_tokens;
-    int current_seq;
-    int response_len, gen_count;
-    llama_token *tokens;
-    
-    if (!nagi_llm_ready(llm)) return 0;
-    if (expected_count == 0) return 0;
-
-    /* Build expected command string from word IDs */
-    expected_command[0] = '\0';
-    for (int i = 0; i < expected_count; i++) {
-        int word_id = expected_word_ids[i];
-        const char *word_str = get_word_string(llm, word_id);
-
-        if (word_str) {
-            if (expected_command[0] != '\0') {
-                strcat(expected_command, " ");
-            }
-            strcat(expected_command, word_str);
-        }
-    }
-
-    if (expected_command[0] == '\0') return 0;
-
-    /* Build semantic matching prompt */
-    snprintf(prompt, sizeof(prompt),
-        SEMANTIC_MATCHING_PROMPT,
-        expected_command, input);
-
-    /* Use rotating sequence IDs to avoid KV cache conflicts */
-    int seq_capacity = llm->config.n_seq_max > 0 ? llm->config.n_seq_max : 1;
-    current_seq = (state->seq_counter++) % seq_capacity;
-
-    if (llm->config.verbose) {
-        printf("\n=== BitNet Semantic Matching ===\n");
-        printf("User input: \"%s\"\n", input);
-        printf("Expected: \"%s\"\n", expected_command);
-        printf("Using sequence ID: %d\n", current_seq);
-    }
-
-    /* Clear KV cache for this sequence before use */
-    llama_kv_cache_seq_rm(state->ctx, current_seq, -1, -1);
-    if (llm->config.verbose) {
-        printf("KV cache cleared for seq %d\n", current_seq);
-    }
-
-    /* Tokenize */
-    n_tokens = llama_n_ctx(state->ctx);
-    tokens = (llama_token *)malloc(n_tokens * sizeof(llama_token));
-    n_prompt_tokens = LLAMA_TOKENIZE(state->model,
-                                     prompt, (int)strlen(prompt),
-                                     tokens, n_tokens);
-    if (n_prompt_tokens < 0) {
-        free(tokens);
-        return 0;
-    }
-
-    /* Process prompt */
-    struct llama_batch batch = llama_batch_init(llm->config.batch_size, 0, seq_capacity);
-    if (llm->config.verbose) {
-        printf("Processing prompt: %d tokens\n", n_prompt_tokens);
-    }
-    for (int i = 0; i < n_prompt_tokens; i += llm->config.batch_size) {
-        int n_eval = n_prompt_tokens - i;
-        if (n_eval > llm->config.batch_size) n_eval = llm->config.batch_size;
-
-        batch.n_tokens = n_eval;
-        for (int k = 0; k < n_eval; k++) {
-            batch.token[k] = tokens[i + k];
-            batch.pos[k] = i + k;
-            batch.n_seq_id[k] = 1;
-            batch.seq_id[k][0] = current_seq;
-            batch.logits[k] = false;
-        }
-        if (i + n_eval == n_prompt_tokens) {
-            batch.logits[n_eval - 1] = true;
-        }
-        if (llm->config.verbose) {
-            printf("Decoding batch: tokens=%d, first_pos=%d, seq=%d\n", n_eval, i, current_seq);
-        }
-        if (llama_decode(state->ctx, batch) != 0) {
-            if (llm->config.verbose) {
-                printf("ERROR: llama_decode failed during prompt processing\n");
-            }
-            llama_batch_free(batch);
-            free(tokens);
-            return 0;
-        }
-    }
-    llama_batch_free(batch);
-    free(tokens);
-
-    /* Generate response */
-    response_len = 0;
-    gen_count = 0;
-    struct llama_batch batch_gen = llama_batch_init(1, 0, seq_capacity);
-    if (llm->config.verbose) {
-        printf("Starting generation phase, prompt processed up to position %d\n", n_prompt_tokens - 1);
-    }
-    while (response_len < (int)sizeof(response_buf) - 1 && gen_count < llm->config.max_tokens) {
-        llama_token new_token = llama_sampler_sample(state->sampler, state->ctx, -1);
-        llama_sampler_accept(state->sampler, new_token);
-
-        if (LLAMA_IS_EOG(state->model, new_token)) {
-            if (llm->config.verbose) {
-                printf("Generation ended: EOG token after %d tokens\n", gen_count);
-            }
-            break;
-        }
-
-        int piece_len = LLAMA_TOKEN_TO_PIECE(state->model,
-                                             new_token, piece, sizeof(piece));
-        if (piece_len > 0 && response_len + piece_len < (int)sizeof(response_buf) - 1) {
-            memcpy(response_buf + response_len, piece, piece_len);
-            response_len += piece_len;
-        }
-
-        batch_gen.n_tokens = 1;
-        batch_gen.token[0] = new_token;
-        batch_gen.pos[0] = n_prompt_tokens + gen_count;
-        batch_gen.n_seq_id[0] = 1;
-        batch_gen.seq_id[0][0] = current_seq;
-        batch_gen.logits[0] = true;
-
-        if (llm->config.verbose && gen_count == 0) {
-            printf("First generation decode: pos=%d, seq=%d\n", batch_gen.pos[0], current_seq);
-        }
-
-        if (llama_decode(state->ctx, batch_gen) != 0) {
-            if (llm->config.verbose) {
-                printf("ERROR: llama_decode failed during generation at token %d (pos=%d)\n",
-                       gen_count, n_prompt_tokens + gen_count);
-            }
-            break;
-        }
-        gen_count++;
-    }
-
-    if (llm->config.verbose && gen_count >= llm->config.max_tokens) {
-        printf("Generation stopped: max_tokens limit (%d) reached\n", llm->config.max_tokens);
-    }
-
-    llama_batch_free(batch_gen);
-    response_buf[response_len] = '\0';
-
-    /* Normalize response: convert to lowercase and trim whitespace */
-    for (int i = 0; i < response_len; i++) {
-        response_buf[i] = tolower((unsigned char)response_buf[i]);
-    }
-
-    /* Trim leading whitespace */
-    char *trimmed = response_buf;
-    while (*trimmed == ' ' || *trimmed == '\n' || *trimmed == '\r' || *trimmed == '\t') {
-        trimmed++;
-    }
-
-    if (llm->config.verbose) {
-        printf("LLM response: \"%s\"\n", response_buf);
-        printf("Trimmed response: \"%s\"\n", trimmed);
-    }
-
-    /* Check if response starts with "yes" or "no" */
-    if (strncmp(trimmed, "yes", 3) == 0) {
-        if (llm->config.verbose) {
-            printf("Result: MATCH\n===================\n\n");
-        }
-        return 1;
-    }
-    if (strncmp(trimmed, "no", 2) == 0) {
-        if (llm->config.verbose) {
-            printf("Result: NO MATCH\n===================\n\n");
-        }
-        return 0;
-    }
-
-    /* If LLM didn't give clear yes/no, assume no match (conservative) */
-    if (llm->config.verbose) {
-        printf("Result: NO MATCH (unclear response)\n===================\n\n");
-    }
-    return 0;
-}
-
-/*
- * Generate response
- */
-static int bitnet_generate_response(nagi_llm_t *llm, const char *game_response,
-                                   const char *user_input, char *output, int output_size)
-{
-    llm_state_t *state = llm->state;
-    char prompt[NAGI_LLM_MAX_PROMPT_SIZE];
-    int n_tokens, n_prompt_tokens;
-    int current_seq;
-    int response_len, gen_count, max_response_tokens;
-    char piece[64];
-    llama_token *tokens;
-
-    if (!nagi_llm_ready(llm)) return 0;
-    if (!game_response || !user_input || !output || output_size <= 0) return 0;
-
-    /* Detect language if user provided input */
-    const char *language = "English";
-    if (user_input && user_input[0] != '\0') {
-        language = llama_common_detect_language(llm, user_input, state->model, state->ctx, state->sampler);
-    } else if (state->detected_language[0]) {
-        language = state->detected_language;
-    }
-
-    /* Build prompt with explicit language */
-    snprintf(prompt, sizeof(prompt), RESPONSE_GENERATION_PROMPT,
-             language, /*llm->config.personality,*/ user_input ? user_input : "", game_response);
-
-    /* Use rotating sequence IDs */
-    int seq_capacity = llm->config.n_seq_max > 0 ? llm->config.n_seq_max : 1;
-    current_seq = state->seq_counter++ % seq_capacity;
-
-    if (llm->config.verbose) {
-        printf("BitNet: Generating response in %s\n", language);
-    }
-
-    /* Clear KV cache for this sequence */
-    llama_kv_cache_seq_rm(state->ctx, current_seq, -1, -1);
-
-    /* Tokenize prompt */
-    n_tokens = llama_n_ctx(state->ctx);
-    tokens = (llama_token *)malloc(n_tokens * sizeof(llama_token));
-    n_prompt_tokens = LLAMA_TOKENIZE(state->model,
-                                     prompt, (int)strlen(prompt),
-                                     tokens, n_tokens);
-    if (n_prompt_tokens < 0) {
-        free(tokens);
-        return 0;
-    }
-
-    /* Process prompt in batches */
-    struct llama_batch batch = llama_batch_init(llm->config.batch_size, 0, seq_capacity);
-    for (int i = 0; i < n_prompt_tokens; i += llm->config.batch_size) {
-        int n_eval = n_prompt_tokens - i;
-        if (n_eval > llm->config.batch_size) n_eval = llm->config.batch_size;
-
-        batch.n_tokens = n_eval;
-        for (int k = 0; k < n_eval; k++) {
-            batch.token[k] = tokens[i + k];
-            batch.pos[k] = i + k;
-            batch.n_seq_id[k] = 1;
-            batch.seq_id[k][0] = current_seq;
-            batch.logits[k] = false;
-        }
-        if (i + n_eval == n_prompt_tokens) {
-            batch.logits[n_eval - 1] = true;
-        }
-
-        if (llama_decode(state->ctx, batch) != 0) {
-            llama_batch_free(batch);
-            free(tokens);
-            return 0;
-        }
-    }
-    llama_batch_free(batch);
-    free(tokens);
-
-    /* Generate response using creative sampler */
-    response_len = 0;
-    gen_count = 0;
-    max_response_tokens = 150;  /* Limit for adventure game responses */
-    struct llama_batch batch_gen = llama_batch_init(1, 0, seq_capacity);
-
-    while (response_len < output_size - 1 && gen_count < max_response_tokens) {
-        llama_token new_token = llama_sampler_sample(state->sampler_creative, state->ctx, -1);
-        llama_sampler_accept(state->sampler_creative, new_token);
-
-        if (LLAMA_IS_EOG(state->model, new_token)) {
-            break;
-        }
-
-        int piece_len = LLAMA_TOKEN_TO_PIECE(state->model,
-                                             new_token, piece, sizeof(piece));
-        if (piece_len > 0 && response_len + piece_len < output_size - 1) {
-            memcpy(output + response_len, piece, piece_len);
-            response_len += piece_len;
-        }
-
-        batch_gen.n_tokens = 1;
-        batch_gen.token[0] = new_token;
-        batch_gen.pos[0] = n_prompt_tokens + gen_count;
-        batch_gen.n_seq_id[0] = 1;
-        batch_gen.seq_id[0][0] = current_seq;
-        batch_gen.logits[0] = true;
-
-        if (llama_decode(state->ctx, batch_gen) != 0) {
-            break;
-        }
-        gen_count++;
-    }
-
-    llama_batch_free(batch_gen);
-    output[response_len] = '\0';
-
-    /* Trim whitespace */
-    char *trimmed = output;
-    while (*trimmed == ' ' || *trimmed == '\n' || *trimmed == '\r' || *trimmed == '\t') {
-        trimmed++;
-    }
-    char *end = trimmed + strlen(trimmed) - 1;
-    while (end > trimmed && (*end == ' ' || *end == '\n' || *end == '\r' || *end == '\t')) {
-        *end-- = '\0';
-    }
-
-    /* Move trimmed result to start of output buffer */
-    if (trimmed != output) {
-        memmove(output, trimmed, strlen(trimmed) + 1);
-        response_len = strlen(output);
-    }
-
-    if (llm->config.verbose && response_len > 0) {
-        printf("Generated: \"%s\"\n", output);
-    }
-
-    return response_len;
-}
-
 /*
  * Create BitNet backend instance
  */
@@ -663,9 +240,11 @@ nagi_llm_t *nagi_llm_bitnet_create(void)
     
     llm->init = bitnet_init;
     llm->shutdown = bitnet_shutdown;
-    llm->extract_words = bitnet_extract_words;
-    llm->matches_expected = bitnet_matches_expected;
-    llm->generate_response = bitnet_generate_response;
+    llm->extract_words = llama_common_extract_words;
+    llm->matches_expected = llama_common_matches_expected;
+    llm->generate_response = llama_common_generate_response;
+    llm->generate_response_stream = llama_common_generate_response_stream;
+    llm->reconfigure = llama_common_samplers_init;
     llm->state = NULL;
 
     /* Set default config for BitNet backend */
@@ -674,6 +253,8 @@ nagi_llm_t *nagi_llm_bitnet_create(void)
     llm->config.batch_size = NAGI_LLM_DEFAULT_BATCH_SIZE;
     llm->config.u_batch_size = NAGI_LLM_DEFAULT_U_BATCH_SIZE;
     llm->config.n_threads = 6;
+    llm->config.pin_threads = 1;  /* CPU-only, keep decode threads off SMT siblings */
+    llm->config.reserve_cores = NAGI_LLM_DEFAULT_RESERVE_CORES;
     llm->config.temperature = 0.0f;  /* Extraction temperature (deterministic) */
     llm->config.temperature_creative_base = 0.3f;
     llm->config.temperature_creative_offset = 0.2f;
@@ -681,12 +262,23 @@ nagi_llm_t *nagi_llm_bitnet_create(void)
     llm->config.top_k = 1;
     llm->config.max_tokens = 5;
     llm->config.use_gpu = 0;
+    llm->config.use_mmap = 1;
     llm->config.verbose = 0;
     llm->config.mode = NAGI_LLM_MODE_EXTRACTION;
     llm->config.flash_attn = false;  /* BitNet works best without flash attention */
     llm->config.n_seq_max = 8;
     strncpy(llm->config.personality, DEFAULT_PERSONALITY, sizeof(llm->config.personality) - 1);
     llm->config.personality[sizeof(llm->config.personality) - 1] = '\0';
+    llm->config.translation_cache_kb = NAGI_LLM_DEFAULT_CACHE_KB;
+    llm->config.extraction_memo_entries = NAGI_LLM_DEFAULT_MEMO_ENTRIES;
+    llm->config.match_threshold = NAGI_LLM_DEFAULT_MATCH_THRESHOLD;
+    llm->config.match_cache_entries = NAGI_LLM_DEFAULT_MATCH_CACHE_ENTRIES;
+    llm->config.embedding_match_high = NAGI_LLM_DEFAULT_EMBED_MATCH_HIGH;
+    llm->config.embedding_match_low = NAGI_LLM_DEFAULT_EMBED_MATCH_LOW;
+    llm->config.draft_tokens = NAGI_LLM_DEFAULT_DRAFT_TOKENS;
+    llm->config.lora_scale = NAGI_LLM_DEFAULT_LORA_SCALE;
+    llm->config.hedge_deadline_ms = NAGI_LLM_DEFAULT_HEDGE_DEADLINE_MS;
+    llm->config.hedge_percentile = NAGI_LLM_DEFAULT_HEDGE_PERCENTILE;
     llm->backend = NAGI_LLM_BACKEND_BITNET;
 
     return llm;
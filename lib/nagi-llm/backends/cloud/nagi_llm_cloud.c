@@ -1,142 +1,1325 @@
 #include "nagi_llm_cloud.h"
+#include "nagi_llm_cloud_json.h"
+#include "../../include/llm_utils.h"
+#include "../../include/llm_log.h"
+#include "../../src/llm_thread.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 #include <curl/curl.h>
+#ifdef NAGI_LLM_HAS_ZLIB
+#define ZLIB_CONST                      /* next_in takes the request body as it is */
+#include <zlib.h>
+#endif
 
-typedef struct {
-    nagi_llm_cloud_config_t config;
-    CURL *curl;
-} cloud_backend_t;
+#define CLOUD_BACKOFF_MS 500.0          /* First retry delay, doubled each time */
+#define CLOUD_RETRY_MAX_MS 60000.0      /* Longest hold, whatever Retry-After says */
+#define CLOUD_WAIT_SLICE_MS 100         /* Cancellation is checked this often while waiting */
+#define CLOUD_FLIGHT_CANCELLED -2
+#define CLOUD_MAX_ENDPOINTS 8
+#define CLOUD_CONNECT_TIMEOUT_MS 5000L
+#define CLOUD_RTT_WEIGHT 0.2            /* Weight of the newest sample in the rolling estimate */
+#define CLOUD_BATCH_POLL_MS 30000.0     /* A submitted batch is checked this often */
+
+/*
+ * Requests run on one curl multi handle driven by an event loop thread.
+ * The multi handle keeps the connection alive between requests and
+ * multiplexes concurrent ones over it with HTTP/2, so only the first
+ * request pays for the TLS handshake. A caller queues its transfer and
+ * sleeps until the loop reports it done; meanwhile it drops the backend
+ * call lock, so the async worker's translation and the game thread's
+ * extraction can be in flight at the same time.
+ *
+ * Before a transfer goes out it takes its share of the [cloud] rate
+ * limits from two token buckets (requests and tokens per minute), so a
+ * burst waits here instead of coming back as 429s. A 429, a 5xx or a
+ * dropped connection holds every request until the provider's Retry-After,
+ * or an exponential backoff with jitter, and the request is sent again.
+ * Identical requests in flight at the same time share one call.
+ *
+ * [cloud] endpoint lines add places to send requests to, each with its own
+ * model and key. Every request goes to the healthy endpoint with the
+ * lowest rolling time to first byte; one that fails or times out is held
+ * back, so the retry goes to the next. Endpoints idle for probe_interval
+ * get a HEAD request on the loop thread, which tracks how their latency
+ * drifts while no requests go there.
+ *
+ * Responses are asked for compressed, and with [cloud] compress the
+ * request bodies go gzipped too, for endpoints (or proxies) that take
+ * Content-Encoding: gzip.
+ */
 
+/* Worker thread hooks (nagi_llm_async.c) */
+void nagi_llm_async_lock(nagi_llm_t *llm);
+void nagi_llm_async_unlock(nagi_llm_t *llm);
+volatile unsigned int *nagi_llm_async_cancel_swap(nagi_llm_t *llm, volatile unsigned int *token);
+
+/* Growable buffer, kept with its transfer between requests */
 typedef struct {
     char *data;
     size_t size;
+    size_t cap;
 } response_buffer_t;
 
+typedef struct cloud_transfer {
+    struct cloud_transfer *next;
+    CURL *curl;
+    response_buffer_t payload;      /* JSON request body */
+    response_buffer_t packed;       /* The body gzipped, with [cloud] compress */
+    response_buffer_t response;     /* Partial SSE line when streaming */
+    CURLcode result;
+    int done;
+    volatile unsigned int *cancel;  /* Cancellation token of the request, NULL if none */
+} cloud_transfer_t;
+
+/* A per-minute limit, refilled continuously */
+typedef struct {
+    double level;                   /* What can be taken now */
+    double capacity;                /* The limit, 0 for none */
+} rate_bucket_t;
+
+/* A request on the wire that identical ones wait for instead of sending */
+typedef struct cloud_flight {
+    struct cloud_flight *next;
+    char *key;                      /* The messages, one after another */
+    char *text;                     /* The answer once done, NULL if it failed */
+    int len;
+    int done;
+    int waiters;
+} cloud_flight_t;
+
+/* One place requests can go, with what has been seen of it */
+typedef struct {
+    char url[512];
+    char model[128];
+    struct curl_slist *headers;     /* Built once with its key, shared by its transfers */
+    struct curl_slist *stream_headers;
+    double rtt_ms;                  /* Rolling time to first byte, 0 until measured */
+    double probe_ms;                /* Last probe's time to first byte */
+    double hold_until;              /* Skipped before this, after a 429 or a failure */
+    double last_used;               /* Last request or probe sent there */
+    int failures;                   /* In a row, sets the backoff */
+    CURL *probe;                    /* Probe in flight, NULL if none */
+} cloud_endpoint_t;
+
+typedef struct {
+    nagi_llm_cloud_config_t config;
+    CURLM *multi;
+    cloud_endpoint_t endpoints[CLOUD_MAX_ENDPOINTS];
+    int endpoint_count;
+    llm_thread_t thread;
+    llm_mutex_t lock;                   /* Protects the lists and transfer results */
+    llm_cond_t done;
+    cloud_transfer_t *submitted;        /* Waiting to be added to the multi handle */
+    cloud_transfer_t *idle;             /* Finished transfers kept for reuse */
+    rate_bucket_t requests;             /* Client-side rate limits */
+    rate_bucket_t tokens;
+    double rate_time;                   /* When the buckets were last filled */
+    unsigned int jitter;                /* Backoff jitter state */
+    cloud_flight_t *flights;            /* Requests in flight, for coalescing */
+    int quit;
+} cloud_backend_t;
+
+static int buffer_reserve(response_buffer_t *buf, size_t extra) {
+    size_t cap;
+    char *ptr;
+
+    if (buf->size + extra + 1 <= buf->cap) return 1;
+
+    cap = buf->cap ? buf->cap : 1024;
+    while (cap < buf->size + extra + 1) cap *= 2;
+
+    ptr = realloc(buf->data, cap);
+    if (!ptr) return 0;
+    buf->data = ptr;
+    buf->cap = cap;
+    return 1;
+}
+
+static int buffer_append(response_buffer_t *buf, const char *str, size_t len) {
+    if (!buffer_reserve(buf, len)) return 0;
+    memcpy(buf->data + buf->size, str, len);
+    buf->size += len;
+    buf->data[buf->size] = '\0';
+    return 1;
+}
+
+static int buffer_append_str(response_buffer_t *buf, const char *str) {
+    return buffer_append(buf, str, strlen(str));
+}
+
+/* Append str escaped for use inside a JSON string */
+static int buffer_append_json(response_buffer_t *buf, const char *str) {
+    const char *run = str;
+    char esc[8];
+
+    for (; *str; str++) {
+        unsigned char c = (unsigned char)*str;
+
+        if (c != '"' && c != '\\' && c >= 0x20) continue;
+
+        if (!buffer_append(buf, run, str - run)) return 0;
+        if (c == '"' || c == '\\') { esc[0] = '\\'; esc[1] = c; esc[2] = '\0'; }
+        else if (c == '\n') strcpy(esc, "\\n");
+        else if (c == '\r') strcpy(esc, "\\r");
+        else if (c == '\t') strcpy(esc, "\\t");
+        else snprintf(esc, sizeof(esc), "\\u%04x", c);
+        if (!buffer_append_str(buf, esc)) return 0;
+        run = str + 1;
+    }
+    return buffer_append(buf, run, str - run);
+}
+
 static size_t write_callback(void *contents, size_t size, size_t nmemb, void *userp) {
     size_t realsize = size * nmemb;
     response_buffer_t *mem = (response_buffer_t *)userp;
-    
-    char *ptr = realloc(mem->data, mem->size + realsize + 1);
-    if (!ptr) return 0;
-    
-    mem->data = ptr;
-    memcpy(&(mem->data[mem->size]), contents, realsize);
-    mem->size += realsize;
-    mem->data[mem->size] = 0;
-    
+
+    if (!buffer_append(mem, (const char *)contents, realsize)) return 0;
     return realsize;
 }
 
-static char *escape_json_string(const char *str) {
-    static char buffer[8192];
-    char *out = buffer;
-    
-    while (*str && (out - buffer) < sizeof(buffer) - 2) {
-        if (*str == '"' || *str == '\\') *out++ = '\\';
-        else if (*str == '\n') { *out++ = '\\'; *out++ = 'n'; str++; continue; }
-        else if (*str == '\r') { *out++ = '\\'; *out++ = 'r'; str++; continue; }
-        else if (*str == '\t') { *out++ = '\\'; *out++ = 't'; str++; continue; }
-        *out++ = *str++;
-    }
-    *out = '\0';
-    return buffer;
-}
-
-static int extract_content(const char *json, char *output, int output_size) {
-    const char *content_start = strstr(json, "\"content\":\"");
-    if (!content_start) return -1;
-    
-    content_start += 11;
-    const char *content_end = content_start;
-    while (*content_end && *content_end != '"') {
-        if (*content_end == '\\' && *(content_end + 1)) content_end++;
-        content_end++;
-    }
-    
-    int len = content_end - content_start;
-    if (len >= output_size) len = output_size - 1;
-    
-    char *out = output;
-    for (int i = 0; i < len; i++) {
-        if (content_start[i] == '\\' && i + 1 < len) {
-            i++;
-            if (content_start[i] == 'n') *out++ = '\n';
-            else if (content_start[i] == 'r') *out++ = '\r';
-            else if (content_start[i] == 't') *out++ = '\t';
-            else *out++ = content_start[i];
+/* The body is decoded as it arrives, it is never held whole */
+static size_t content_write_callback(void *contents, size_t size, size_t nmemb, void *userp) {
+    size_t realsize = size * nmemb;
+
+    cloud_json_reader_feed((cloud_json_reader_t *)userp, (const char *)contents, realsize);
+    return realsize;
+}
+
+#ifdef NAGI_LLM_HAS_ZLIB
+/* gzip size bytes of data into buf, returns 0 if it failed */
+static int buffer_gzip(response_buffer_t *buf, const char *data, size_t size) {
+    z_stream z;
+    int ret;
+
+    memset(&z, 0, sizeof(z));
+    /* 16 over the window bits for a gzip header instead of zlib's */
+    if (deflateInit2(&z, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+        return 0;
+    }
+    buf->size = 0;
+    if (!buffer_reserve(buf, deflateBound(&z, (uLong)size))) {
+        deflateEnd(&z);
+        return 0;
+    }
+    z.next_in = (const Bytef *)data;
+    z.avail_in = (uInt)size;
+    z.next_out = (Bytef *)buf->data;
+    z.avail_out = (uInt)(buf->cap - 1);
+    ret = deflate(&z, Z_FINISH);
+    buf->size = z.total_out;
+    deflateEnd(&z);
+    return ret == Z_STREAM_END;
+}
+#endif
+
+/* Same text, same key: the provider routes it to the cache that holds it */
+static unsigned long prefix_hash(const char *model, const char *text) {
+    unsigned long h = 2166136261UL;
+
+    for (; *model; model++) h = (h ^ (unsigned char)*model) * 16777619UL;
+    h = (h ^ '\n') * 16777619UL;
+    for (; *text; text++) h = (h ^ (unsigned char)*text) * 16777619UL;
+    return h & 0xFFFFFFFFUL;
+}
+
+/* Build the chat completion request into the transfer's payload buffer */
+static int build_payload(cloud_backend_t *backend, const cloud_endpoint_t *ep, response_buffer_t *buf,
+                         const nagi_llm_cloud_message_t *messages, int count, int stream) {
+    char tail[160];
+    int len, i;
+
+    buf->size = 0;
+    if (!buffer_append_str(buf, "{\"model\":\"") ||
+        !buffer_append_json(buf, ep->model) ||
+        !buffer_append_str(buf, "\",\"messages\":[")) return 0;
+
+    for (i = 0; i < count; i++) {
+        if (!buffer_append_str(buf, i ? ",{\"role\":\"" : "{\"role\":\"") ||
+            !buffer_append_str(buf, messages[i].role) ||
+            !buffer_append_str(buf, "\",\"content\":\"") ||
+            !buffer_append_json(buf, messages[i].content) ||
+            !buffer_append_str(buf, "\"}")) return 0;
+    }
+
+    len = snprintf(tail, sizeof(tail), "],\"temperature\":%.2f,\"max_tokens\":%d",
+                   backend->config.temperature, backend->config.max_tokens);
+    if (backend->config.seed >= 0) {
+        len += snprintf(tail + len, sizeof(tail) - len, ",\"seed\":%d", backend->config.seed);
+    }
+    if (backend->config.prompt_cache && count > 0) {
+        len += snprintf(tail + len, sizeof(tail) - len, ",\"prompt_cache_key\":\"nagi-%08lx\"",
+                        prefix_hash(ep->model, messages[0].content));
+    }
+    snprintf(tail + len, sizeof(tail) - len, "%s}", stream ? ",\"stream\":true" : "");
+    return buffer_append_str(buf, tail);
+}
+
+/* Healthy endpoint with the lowest latency, unmeasured ones first, or the one back soonest */
+static cloud_endpoint_t *endpoint_pick(cloud_backend_t *backend) {
+    cloud_endpoint_t *ep, *best = NULL;
+    double now;
+    int i;
+
+    llm_mutex_lock(&backend->lock);
+    now = llm_time_ms();
+    for (i = 0; i < backend->endpoint_count; i++) {
+        ep = &backend->endpoints[i];
+        if (!best) {
+            best = ep;
+        } else if (ep->hold_until <= now) {
+            if (best->hold_until > now || ep->rtt_ms < best->rtt_ms) best = ep;
+        } else if (best->hold_until > now && ep->hold_until < best->hold_until) {
+            best = ep;
+        }
+    }
+    best->last_used = now;
+    llm_mutex_unlock(&backend->lock);
+    return best;
+}
+
+/* Seconds from the request going out to the first byte back, in ms */
+static double endpoint_ttfb(CURL *curl) {
+    double pretransfer = 0, starttransfer = 0;
+
+    curl_easy_getinfo(curl, CURLINFO_PRETRANSFER_TIME, &pretransfer);
+    curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME, &starttransfer);
+    return starttransfer > pretransfer ? (starttransfer - pretransfer) * 1000.0 : 0.0;
+}
+
+/* Hold an endpoint back after a failure (backend lock held). Returns the delay in ms */
+static double endpoint_fail(cloud_backend_t *backend, cloud_endpoint_t *ep, double retry_after_ms) {
+    double delay = retry_after_ms, now = llm_time_ms();
+    int shift;
+
+    ep->failures++;
+    if (delay <= 0) {
+        /* Drawn from the upper half so callers backing off together spread out */
+        shift = ep->failures - 1 < 10 ? ep->failures - 1 : 10;
+        delay = CLOUD_BACKOFF_MS * (double)(1u << shift);
+        backend->jitter = backend->jitter * 1103515245u + 12345u;
+        delay = delay / 2 + delay / 2 * (double)((backend->jitter >> 16) & 0x7FFF) / 32767.0;
+    }
+    if (delay > CLOUD_RETRY_MAX_MS) delay = CLOUD_RETRY_MAX_MS;
+    if (ep->hold_until < now + delay) ep->hold_until = now + delay;
+    return delay;
+}
+
+/*
+ * Probe the endpoints nothing went to for probe_interval (loop thread,
+ * backend lock held). Only worth it when there is a choice.
+ */
+static void endpoints_probe(cloud_backend_t *backend) {
+    cloud_endpoint_t *ep;
+    double now = llm_time_ms();
+    int i;
+
+    if (backend->config.probe_interval_s <= 0 || backend->endpoint_count < 2) return;
+
+    for (i = 0; i < backend->endpoint_count; i++) {
+        ep = &backend->endpoints[i];
+        if (ep->probe || now - ep->last_used < backend->config.probe_interval_s * 1000.0) continue;
+
+        ep->probe = curl_easy_init();
+        if (!ep->probe) return;
+        curl_easy_setopt(ep->probe, CURLOPT_URL, ep->url);
+        curl_easy_setopt(ep->probe, CURLOPT_NOBODY, 1L);
+        curl_easy_setopt(ep->probe, CURLOPT_HTTPHEADER, ep->headers);
+        curl_easy_setopt(ep->probe, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+        curl_easy_setopt(ep->probe, CURLOPT_PIPEWAIT, 1L);
+        curl_easy_setopt(ep->probe, CURLOPT_NOSIGNAL, 1L);
+        curl_easy_setopt(ep->probe, CURLOPT_CONNECTTIMEOUT_MS, CLOUD_CONNECT_TIMEOUT_MS);
+        curl_easy_setopt(ep->probe, CURLOPT_TIMEOUT_MS, 2 * CLOUD_CONNECT_TIMEOUT_MS);
+        curl_multi_add_handle(backend->multi, ep->probe);
+        ep->last_used = now;
+    }
+}
+
+/*
+ * A probe came back (loop thread). Any HTTP answer counts as healthy. The
+ * request estimate follows the change in probe latency, since a HEAD and a
+ * completion take very different times.
+ */
+static void endpoint_probed(cloud_backend_t *backend, CURL *curl, CURLcode result) {
+    cloud_endpoint_t *ep = NULL;
+    double ms, scale;
+    int i;
+
+    llm_mutex_lock(&backend->lock);
+    for (i = 0; i < backend->endpoint_count; i++) {
+        if (backend->endpoints[i].probe == curl) ep = &backend->endpoints[i];
+    }
+    if (ep) {
+        ep->probe = NULL;
+        if (result != CURLE_OK) {
+            endpoint_fail(backend, ep, 0);
+            llm_log(LLM_LOG_DEBUG, "Cloud API: probe of %s failed: %s\n", ep->url,
+                    curl_easy_strerror(result));
         } else {
-            *out++ = content_start[i];
+            ms = endpoint_ttfb(curl);
+            if (ep->rtt_ms <= 0) {
+                ep->rtt_ms = ms;
+            } else if (ep->probe_ms > 0 && ms > 0) {
+                scale = ms / ep->probe_ms;
+                if (scale < 0.5) scale = 0.5;
+                if (scale > 2.0) scale = 2.0;
+                ep->rtt_ms *= scale;
+            }
+            ep->probe_ms = ms;
+        }
+    }
+    llm_mutex_unlock(&backend->lock);
+    curl_easy_cleanup(curl);
+}
+
+/* Event loop: starts queued transfers and reports finished ones */
+static void *cloud_loop(void *arg) {
+    cloud_backend_t *backend = (cloud_backend_t *)arg;
+    cloud_transfer_t *t, *next;
+    CURLMsg *msg;
+    CURLcode result;
+    int running, left;
+
+    llm_mutex_lock(&backend->lock);
+    while (!backend->quit) {
+        for (t = backend->submitted; t; t = next) {
+            next = t->next;
+            t->next = NULL;
+            curl_multi_add_handle(backend->multi, t->curl);
+        }
+        backend->submitted = NULL;
+        endpoints_probe(backend);
+        llm_mutex_unlock(&backend->lock);
+
+        curl_multi_perform(backend->multi, &running);
+
+        while ((msg = curl_multi_info_read(backend->multi, &left)) != NULL) {
+            CURL *curl;
+
+            if (msg->msg != CURLMSG_DONE) continue;
+
+            /* msg is gone once the handle is removed */
+            curl = msg->easy_handle;
+            result = msg->data.result;
+            t = NULL;
+            curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&t);
+            curl_multi_remove_handle(backend->multi, curl);
+            if (!t) {
+                endpoint_probed(backend, curl, result);
+                continue;
+            }
+
+            llm_mutex_lock(&backend->lock);
+            t->result = result;
+            t->done = 1;
+            llm_cond_broadcast(&backend->done);
+            llm_mutex_unlock(&backend->lock);
+        }
+
+        /* Sleep until there is socket activity or curl_multi_wakeup */
+        curl_multi_poll(backend->multi, NULL, 0, 1000, NULL);
+        llm_mutex_lock(&backend->lock);
+    }
+    llm_mutex_unlock(&backend->lock);
+
+    return NULL;
+}
+
+static void transfer_free(cloud_transfer_t *t) {
+    curl_easy_cleanup(t->curl);
+    free(t->payload.data);
+    free(t->packed.data);
+    free(t->response.data);
+    free(t);
+}
+
+/* Runs on the event loop thread, non-zero aborts a cancelled request's transfer */
+static int transfer_progress(void *clientp, curl_off_t dltotal, curl_off_t dlnow,
+                             curl_off_t ultotal, curl_off_t ulnow) {
+    cloud_transfer_t *t = (cloud_transfer_t *)clientp;
+
+    (void)dltotal; (void)dlnow; (void)ultotal; (void)ulnow;
+    return t->cancel && llm_atomic_load(t->cancel);
+}
+
+/* Take an idle transfer, or set up a new one */
+static cloud_transfer_t *transfer_get(cloud_backend_t *backend) {
+    cloud_transfer_t *t;
+
+    llm_mutex_lock(&backend->lock);
+    t = backend->idle;
+    if (t) backend->idle = t->next;
+    llm_mutex_unlock(&backend->lock);
+    if (t) return t;
+
+    t = (cloud_transfer_t *)calloc(1, sizeof(cloud_transfer_t));
+    if (!t) return NULL;
+    t->curl = curl_easy_init();
+    if (!t->curl) {
+        free(t);
+        return NULL;
+    }
+
+    /* Options shared by every request, the URL and headers go with the endpoint */
+    curl_easy_setopt(t->curl, CURLOPT_CONNECTTIMEOUT_MS, CLOUD_CONNECT_TIMEOUT_MS);
+    if (backend->config.timeout_ms > 0) {
+        curl_easy_setopt(t->curl, CURLOPT_TIMEOUT_MS, (long)backend->config.timeout_ms);
+    }
+    curl_easy_setopt(t->curl, CURLOPT_HTTP_VERSION, (long)CURL_HTTP_VERSION_2TLS);
+    curl_easy_setopt(t->curl, CURLOPT_PIPEWAIT, 1L);
+    curl_easy_setopt(t->curl, CURLOPT_TCP_KEEPALIVE, 1L);
+    curl_easy_setopt(t->curl, CURLOPT_NOSIGNAL, 1L);
+    /* Every encoding curl was built with */
+    curl_easy_setopt(t->curl, CURLOPT_ACCEPT_ENCODING, "");
+    curl_easy_setopt(t->curl, CURLOPT_PRIVATE, t);
+    curl_easy_setopt(t->curl, CURLOPT_XFERINFOFUNCTION, transfer_progress);
+    curl_easy_setopt(t->curl, CURLOPT_XFERINFODATA, t);
+    curl_easy_setopt(t->curl, CURLOPT_NOPROGRESS, 0L);
+    return t;
+}
+
+static void transfer_put(cloud_backend_t *backend, cloud_transfer_t *t) {
+    llm_mutex_lock(&backend->lock);
+    t->next = backend->idle;
+    backend->idle = t;
+    llm_mutex_unlock(&backend->lock);
+}
+
+static void bucket_init(rate_bucket_t *bucket, int per_minute) {
+    bucket->capacity = per_minute > 0 ? per_minute : 0;
+    bucket->level = bucket->capacity;
+}
+
+static void bucket_refill(rate_bucket_t *bucket, double elapsed_ms) {
+    if (bucket->capacity <= 0) return;
+    bucket->level += bucket->capacity * elapsed_ms / 60000.0;
+    if (bucket->level > bucket->capacity) bucket->level = bucket->capacity;
+}
+
+/* Milliseconds until cost can be taken, 0 if it can now */
+static double bucket_wait(const rate_bucket_t *bucket, double cost) {
+    if (bucket->capacity <= 0) return 0;
+    if (cost > bucket->capacity) cost = bucket->capacity;
+    if (bucket->level >= cost) return 0;
+    return (cost - bucket->level) * 60000.0 / bucket->capacity;
+}
+
+static void bucket_take(rate_bucket_t *bucket, double cost) {
+    if (bucket->capacity <= 0) return;
+    bucket->level -= cost < bucket->capacity ? cost : bucket->capacity;
+}
+
+/*
+ * Wait until the rate limits and the endpoint's hold allow a request
+ * costing tokens, then take its share. Returns 0 if it was cancelled
+ * meanwhile. (backend lock held)
+ */
+static int rate_acquire(cloud_backend_t *backend, const cloud_endpoint_t *ep, double tokens,
+                        volatile unsigned int *cancel) {
+    double now, wait, w;
+
+    for (;;) {
+        if (cancel && llm_atomic_load(cancel)) return 0;
+
+        now = llm_time_ms();
+        bucket_refill(&backend->requests, now - backend->rate_time);
+        bucket_refill(&backend->tokens, now - backend->rate_time);
+        backend->rate_time = now;
+
+        wait = ep->hold_until - now;
+        w = bucket_wait(&backend->requests, 1);
+        if (w > wait) wait = w;
+        w = bucket_wait(&backend->tokens, tokens);
+        if (w > wait) wait = w;
+        if (wait <= 0) break;
+
+        llm_cond_timedwait(&backend->done, &backend->lock,
+                           wait < CLOUD_WAIT_SLICE_MS ? (int)wait + 1 : CLOUD_WAIT_SLICE_MS);
+    }
+
+    bucket_take(&backend->requests, 1);
+    bucket_take(&backend->tokens, tokens);
+    return 1;
+}
+
+/* Hand a transfer to the event loop and wait for it to finish */
+static CURLcode transfer_wait(nagi_llm_t *llm, cloud_backend_t *backend, const cloud_endpoint_t *ep,
+                              cloud_transfer_t *t, double tokens) {
+    CURLcode result;
+
+    /* Other backend calls may go out while this one waits or is on the wire,
+       the cancellation token goes with the transfer instead of staying with the lock */
+    t->cancel = nagi_llm_async_cancel_swap(llm, NULL);
+    nagi_llm_async_unlock(llm);
+
+    llm_mutex_lock(&backend->lock);
+    if (!rate_acquire(backend, ep, tokens, t->cancel)) {
+        result = CURLE_ABORTED_BY_CALLBACK;
+    } else {
+        t->done = 0;
+        t->next = backend->submitted;
+        backend->submitted = t;
+        llm_mutex_unlock(&backend->lock);
+        curl_multi_wakeup(backend->multi);
+
+        llm_mutex_lock(&backend->lock);
+        while (!t->done) {
+            llm_cond_wait(&backend->done, &backend->lock);
+        }
+        result = t->result;
+    }
+    llm_mutex_unlock(&backend->lock);
+
+    nagi_llm_async_lock(llm);
+    nagi_llm_async_cancel_swap(llm, t->cancel);
+    t->cancel = NULL;
+    return result;
+}
+
+/* Set the request body, gzipped with [cloud] compress (the headers say so) */
+static void transfer_body(cloud_backend_t *backend, cloud_transfer_t *t, const char *data, size_t size) {
+#ifdef NAGI_LLM_HAS_ZLIB
+    if (backend->config.compress && buffer_gzip(&t->packed, data, size)) {
+        data = t->packed.data;
+        size = t->packed.size;
+    }
+#else
+    (void)backend;
+#endif
+    curl_easy_setopt(t->curl, CURLOPT_POSTFIELDS, data);
+    curl_easy_setopt(t->curl, CURLOPT_POSTFIELDSIZE, (long)size);
+}
+
+/* Send the completion request in the transfer's payload to the endpoint */
+static CURLcode transfer_run(nagi_llm_t *llm, cloud_backend_t *backend, const cloud_endpoint_t *ep,
+                             cloud_transfer_t *t) {
+    /* About four bytes of prompt per token, and the answer may use them all */
+    double tokens = (double)t->payload.size / 4 + backend->config.max_tokens;
+
+    curl_easy_setopt(t->curl, CURLOPT_URL, ep->url);
+    transfer_body(backend, t, t->payload.data, t->payload.size);
+    return transfer_wait(llm, backend, ep, t, tokens);
+}
+
+/*
+ * After a transfer: record how the endpoint did and return 1 if the request
+ * should be sent again. A failed endpoint is held back by the provider's
+ * Retry-After or an exponential backoff with jitter, so the retry goes to
+ * another one if there is any.
+ */
+static int transfer_retry(cloud_backend_t *backend, cloud_endpoint_t *ep, cloud_transfer_t *t,
+                          CURLcode res, int attempt) {
+    long status = 0;
+    curl_off_t retry_after = 0;
+    double delay, ms;
+    int failed;
+
+    if (res == CURLE_OK) {
+        curl_easy_getinfo(t->curl, CURLINFO_RESPONSE_CODE, &status);
+        /* A key or model the endpoint doesn't know is its problem when there are others */
+        failed = status == 429 || status >= 500 ||
+                 (backend->endpoint_count > 1 && (status == 401 || status == 403 || status == 404));
+    } else {
+        failed = res == CURLE_COULDNT_CONNECT || res == CURLE_COULDNT_RESOLVE_HOST ||
+                 res == CURLE_OPERATION_TIMEDOUT || res == CURLE_SEND_ERROR ||
+                 res == CURLE_RECV_ERROR || res == CURLE_GOT_NOTHING;
+    }
+
+    if (!failed) {
+        if (res == CURLE_OK) {
+            ms = endpoint_ttfb(t->curl);
+            llm_mutex_lock(&backend->lock);
+            ep->failures = 0;
+            ep->rtt_ms = ep->rtt_ms > 0 ? ep->rtt_ms + (ms - ep->rtt_ms) * CLOUD_RTT_WEIGHT : ms;
+            llm_mutex_unlock(&backend->lock);
+        }
+        return 0;
+    }
+
+#if LIBCURL_VERSION_NUM >= 0x074200
+    curl_easy_getinfo(t->curl, CURLINFO_RETRY_AFTER, &retry_after);
+#endif
+
+    llm_mutex_lock(&backend->lock);
+    delay = endpoint_fail(backend, ep, (double)retry_after * 1000.0);
+    llm_mutex_unlock(&backend->lock);
+
+    if (attempt >= backend->config.max_retries) return 0;
+
+    if (status) {
+        llm_log(LLM_LOG_WARN, "Cloud API: HTTP %ld from %s, held for %.1f s, retrying\n",
+                status, ep->url, delay / 1000.0);
+    } else {
+        llm_log(LLM_LOG_WARN, "Cloud API: %s from %s, held for %.1f s, retrying\n",
+                curl_easy_strerror(res), ep->url, delay / 1000.0);
+    }
+    return 1;
+}
+
+static void backend_free(cloud_backend_t *backend) {
+    cloud_transfer_t *t, *next;
+    cloud_endpoint_t *ep;
+    int i;
+
+    for (t = backend->idle; t; t = next) {
+        next = t->next;
+        transfer_free(t);
+    }
+    for (i = 0; i < backend->endpoint_count; i++) {
+        ep = &backend->endpoints[i];
+        if (ep->probe) {
+            curl_multi_remove_handle(backend->multi, ep->probe);
+            curl_easy_cleanup(ep->probe);
+        }
+        curl_slist_free_all(ep->headers);
+        curl_slist_free_all(ep->stream_headers);
+    }
+    if (backend->multi) curl_multi_cleanup(backend->multi);
+    llm_cond_destroy(&backend->done);
+    llm_mutex_destroy(&backend->lock);
+    free(backend);
+}
+
+/* Add an endpoint, with the main key when it has none of its own */
+static int endpoint_add(cloud_backend_t *backend, const char *url, const char *model, const char *key) {
+    cloud_endpoint_t *ep;
+    char auth_header[512];
+
+    if (backend->endpoint_count >= CLOUD_MAX_ENDPOINTS || !url[0]) return 0;
+    ep = &backend->endpoints[backend->endpoint_count];
+
+    strncpy(ep->url, url, sizeof(ep->url) - 1);
+    strncpy(ep->model, model[0] ? model : backend->config.model, sizeof(ep->model) - 1);
+    snprintf(auth_header, sizeof(auth_header), "Authorization: Bearer %s",
+             key[0] ? key : backend->config.api_key);
+    ep->headers = curl_slist_append(NULL, auth_header);
+    ep->headers = curl_slist_append(ep->headers, "Content-Type: application/json");
+    ep->stream_headers = curl_slist_append(NULL, auth_header);
+    ep->stream_headers = curl_slist_append(ep->stream_headers, "Content-Type: application/json");
+    if (backend->config.compress) {
+        ep->headers = curl_slist_append(ep->headers, "Content-Encoding: gzip");
+        ep->stream_headers = curl_slist_append(ep->stream_headers, "Content-Encoding: gzip");
+    }
+    ep->stream_headers = curl_slist_append(ep->stream_headers, "Accept: text/event-stream");
+    backend->endpoint_count++;
+    return ep->headers && ep->stream_headers;
+}
+
+/* The [cloud] endpoint lines, "url|model|key" with model and key optional */
+static int endpoints_add(cloud_backend_t *backend, const char *list) {
+    char line[1024];
+    char *fields[3], *p;
+    const char *end;
+    size_t len;
+    int i;
+
+    while (*list) {
+        end = strchr(list, '\n');
+        len = end ? (size_t)(end - list) : strlen(list);
+        if (len >= sizeof(line)) len = sizeof(line) - 1;
+        memcpy(line, list, len);
+        line[len] = '\0';
+        list += end ? len + 1 : len;
+
+        p = line;
+        for (i = 0; i < 3; i++) {
+            fields[i] = p;
+            p = strchr(p, '|');
+            if (p) *p++ = '\0';
+            else p = line + len;
         }
+        if (fields[0][0] && !endpoint_add(backend, fields[0], fields[1], fields[2])) return 0;
     }
-    *out = '\0';
-    return out - output;
+    return 1;
 }
 
 int nagi_llm_cloud_init(nagi_llm_t *llm, const nagi_llm_cloud_config_t *config) {
-    cloud_backend_t *backend = malloc(sizeof(cloud_backend_t));
+    cloud_backend_t *backend = calloc(1, sizeof(cloud_backend_t));
+
     if (!backend) return -1;
-    
+
     memcpy(&backend->config, config, sizeof(nagi_llm_cloud_config_t));
-    
+#ifndef NAGI_LLM_HAS_ZLIB
+    if (backend->config.compress) {
+        llm_log(LLM_LOG_WARN, "Cloud LLM: built without zlib, request bodies go uncompressed\n");
+        backend->config.compress = 0;
+    }
+#endif
+    llm_mutex_init(&backend->lock);
+    llm_cond_init(&backend->done);
+    bucket_init(&backend->requests, config->requests_per_minute);
+    bucket_init(&backend->tokens, config->tokens_per_minute);
+    backend->rate_time = llm_time_ms();
+    backend->jitter = (unsigned int)(uintptr_t)backend ^ (unsigned int)backend->rate_time;
+
     curl_global_init(CURL_GLOBAL_DEFAULT);
-    backend->curl = curl_easy_init();
-    if (!backend->curl) {
-        free(backend);
+    backend->multi = curl_multi_init();
+    if (!backend->multi) {
+        backend_free(backend);
+        curl_global_cleanup();
+        return -1;
+    }
+
+    /* Concurrent requests share one HTTP/2 connection */
+    curl_multi_setopt(backend->multi, CURLMOPT_PIPELINING, (long)CURLPIPE_MULTIPLEX);
+
+    if (!endpoint_add(backend, config->api_url, config->model, config->api_key) ||
+        !endpoints_add(backend, config->endpoints) ||
+        !llm_thread_create(&backend->thread, cloud_loop, backend)) {
+        fprintf(stderr, "Cloud LLM: Failed to start the transfer thread\n");
+        backend_free(backend);
+        curl_global_cleanup();
         return -1;
     }
-    
+
     llm->backend_data = backend;
-    printf("Cloud LLM initialized: %s (model: %s)\n", config->api_url, config->model);
+    llm_log(LLM_LOG_INFO, "Cloud LLM initialized: %s (model: %s)\n", config->api_url, config->model);
+    if (backend->endpoint_count > 1) {
+        llm_log(LLM_LOG_INFO, "Cloud LLM: %d more endpoints to fail over to\n", backend->endpoint_count - 1);
+    }
     return 0;
 }
 
-int nagi_llm_cloud_generate(nagi_llm_t *llm, const char *prompt, char *output, int output_size) {
+static int cloud_generate(nagi_llm_t *llm, const nagi_llm_cloud_message_t *messages, int count,
+                          char *output, int output_size) {
     cloud_backend_t *backend = (cloud_backend_t *)llm->backend_data;
-    if (!backend || !backend->curl) return -1;
-    
-    char json_payload[16384];
-    snprintf(json_payload, sizeof(json_payload),
-        "{\"model\":\"%s\",\"messages\":[{\"role\":\"user\",\"content\":\"%s\"}],"
-        "\"temperature\":%.2f,\"max_tokens\":%d}",
-        backend->config.model, escape_json_string(prompt),
-        backend->config.temperature, backend->config.max_tokens);
-    
-    response_buffer_t response = {NULL, 0};
-    
-    struct curl_slist *headers = NULL;
-    char auth_header[512];
-    snprintf(auth_header, sizeof(auth_header), "Authorization: Bearer %s", backend->config.api_key);
-    headers = curl_slist_append(headers, auth_header);
-    headers = curl_slist_append(headers, "Content-Type: application/json");
-    
-    curl_easy_setopt(backend->curl, CURLOPT_URL, backend->config.api_url);
-    curl_easy_setopt(backend->curl, CURLOPT_HTTPHEADER, headers);
-    curl_easy_setopt(backend->curl, CURLOPT_POSTFIELDS, json_payload);
-    curl_easy_setopt(backend->curl, CURLOPT_WRITEFUNCTION, write_callback);
-    curl_easy_setopt(backend->curl, CURLOPT_WRITEDATA, &response);
-    
-    CURLcode res = curl_easy_perform(backend->curl);
-    curl_slist_free_all(headers);
-    
+    cloud_transfer_t *t;
+    cloud_endpoint_t *ep;
+    cloud_json_reader_t reader;
+    CURLcode res;
+    int len = -1, attempt;
+
+    if (!backend || output_size <= 0) return -1;
+
+    t = transfer_get(backend);
+    if (!t) return -1;
+
+    curl_easy_setopt(t->curl, CURLOPT_WRITEFUNCTION, content_write_callback);
+    curl_easy_setopt(t->curl, CURLOPT_WRITEDATA, &reader);
+
+    for (attempt = 0; ; attempt++) {
+        ep = endpoint_pick(backend);
+        if (!build_payload(backend, ep, &t->payload, messages, count, 0)) {
+            transfer_put(backend, t);
+            return -1;
+        }
+        curl_easy_setopt(t->curl, CURLOPT_HTTPHEADER, ep->headers);
+        cloud_json_reader_init(&reader, output, output_size, 0);
+        res = transfer_run(llm, backend, ep, t);
+        if (!transfer_retry(backend, ep, t, res, attempt)) break;
+    }
+
     if (res != CURLE_OK) {
+        if (res != CURLE_ABORTED_BY_CALLBACK) {
+            fprintf(stderr, "Cloud API error: %s\n", curl_easy_strerror(res));
+        }
+    } else if (reader.found) {
+        len = reader.len;
+    }
+    transfer_put(backend, t);
+
+    return len;
+}
+
+/* Server-sent events state for streaming completions */
+typedef struct {
+    response_buffer_t *line;    /* Partial SSE line carried between writes */
+    char *output;
+    int output_size;
+    int len;
+    int emitted;
+    nagi_llm_token_cb_t on_token;
+    void *userdata;
+    int stopped;
+} stream_state_t;
+
+/* Handle one "data: {...}" line of the event stream */
+static void stream_line(stream_state_t *st, const char *line, size_t size) {
+    cloud_json_reader_t reader;
+    const char *end = line + size;
+
+    if (size < 5 || strncmp(line, "data:", 5) != 0) return;
+    line += 5;
+    while (line < end && *line == ' ') line++;
+    if (end - line >= 6 && strncmp(line, "[DONE]", 6) == 0) return;
+
+    /* The delta goes straight on the end of the output */
+    cloud_json_reader_init(&reader, st->output, st->output_size, st->len);
+    cloud_json_reader_feed(&reader, line, (size_t)(end - line));
+    if (reader.len == st->len) return;
+    st->len = reader.len;
+
+    if (!llm_stream_emit(st->output, st->len, &st->emitted, st->on_token, st->userdata)) {
+        st->stopped = 1;
+    }
+}
+
+/* Runs on the event loop thread */
+static size_t stream_write_callback(void *contents, size_t size, size_t nmemb, void *userp) {
+    size_t realsize = size * nmemb;
+    stream_state_t *st = (stream_state_t *)userp;
+    char *start, *nl, *end;
+
+    if (write_callback(contents, size, nmemb, st->line) != realsize) return 0;
+
+    /* Process every complete line, keep the rest for the next write */
+    start = st->line->data;
+    while ((nl = strchr(start, '\n')) != NULL) {
+        end = (nl > start && nl[-1] == '\r') ? nl - 1 : nl;
+        stream_line(st, start, (size_t)(end - start));
+        start = nl + 1;
+    }
+    st->line->size -= (size_t)(start - st->line->data);
+    memmove(st->line->data, start, st->line->size + 1);
+
+    /* Returning short aborts the transfer */
+    return st->stopped ? 0 : realsize;
+}
+
+static int cloud_generate_stream(nagi_llm_t *llm, const nagi_llm_cloud_message_t *messages, int count,
+                                 char *output, int output_size, nagi_llm_token_cb_t on_token, void *userdata) {
+    cloud_backend_t *backend = (cloud_backend_t *)llm->backend_data;
+    cloud_transfer_t *t;
+    cloud_endpoint_t *ep;
+    stream_state_t st;
+    CURLcode res;
+    int attempt;
+
+    if (!backend || output_size <= 0) return -1;
+
+    t = transfer_get(backend);
+    if (!t) return -1;
+
+    curl_easy_setopt(t->curl, CURLOPT_WRITEFUNCTION, stream_write_callback);
+    curl_easy_setopt(t->curl, CURLOPT_WRITEDATA, &st);
+
+    for (attempt = 0; ; attempt++) {
+        ep = endpoint_pick(backend);
+        if (!build_payload(backend, ep, &t->payload, messages, count, 1)) {
+            transfer_put(backend, t);
+            return -1;
+        }
+        curl_easy_setopt(t->curl, CURLOPT_HTTPHEADER, ep->stream_headers);
+
+        memset(&st, 0, sizeof(st));
+        st.line = &t->response;
+        st.output = output;
+        st.output_size = output_size;
+        st.on_token = on_token;
+        st.userdata = userdata;
+        output[0] = '\0';
+        t->response.size = 0;
+
+        res = transfer_run(llm, backend, ep, t);
+        /* Once text has been streamed out the request can't be taken back */
+        if (!transfer_retry(backend, ep, t, res, st.len > 0 ? backend->config.max_retries : attempt)) break;
+    }
+    transfer_put(backend, t);
+
+    /* A callback asking to stop shows up as a write error */
+    if (res == CURLE_ABORTED_BY_CALLBACK) return -1;     /* Cancelled */
+    if (res != CURLE_OK && !(res == CURLE_WRITE_ERROR && st.stopped)) {
         fprintf(stderr, "Cloud API error: %s\n", curl_easy_strerror(res));
-        free(response.data);
         return -1;
     }
-    
-    int len = extract_content(response.data, output, output_size);
-    free(response.data);
-    
+
+    return st.len;
+}
+
+static void flight_free(cloud_flight_t *f) {
+    free(f->key);
+    free(f->text);
+    free(f);
+}
+
+/*
+ * Join the identical request in flight, or start one. *leader is set when
+ * this caller sends it. Returns NULL if the messages couldn't be keyed.
+ */
+static cloud_flight_t *flight_join(cloud_backend_t *backend, const nagi_llm_cloud_message_t *messages,
+                                   int count, int *leader) {
+    response_buffer_t key = { NULL, 0, 0 };
+    cloud_flight_t *f;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (!buffer_append_str(&key, messages[i].role) || !buffer_append(&key, "\x1f", 1) ||
+            !buffer_append_str(&key, messages[i].content) || !buffer_append(&key, "\x1e", 1)) {
+            free(key.data);
+            return NULL;
+        }
+    }
+    if (!key.data) return NULL;
+
+    llm_mutex_lock(&backend->lock);
+    for (f = backend->flights; f; f = f->next) {
+        if (strcmp(f->key, key.data) == 0) break;
+    }
+    if (f) {
+        f->waiters++;
+        *leader = 0;
+        free(key.data);
+    } else {
+        f = (cloud_flight_t *)calloc(1, sizeof(cloud_flight_t));
+        if (f) {
+            f->key = key.data;
+            f->next = backend->flights;
+            backend->flights = f;
+            *leader = 1;
+        } else {
+            free(key.data);
+        }
+    }
+    llm_mutex_unlock(&backend->lock);
+    return f;
+}
+
+/*
+ * Wait for the leader's answer. Returns its length, -1 if it failed, or
+ * CLOUD_FLIGHT_CANCELLED. Drops the backend call lock meanwhile, like a
+ * transfer does.
+ */
+static int flight_wait(nagi_llm_t *llm, cloud_backend_t *backend, cloud_flight_t *f,
+                       char *output, int output_size) {
+    volatile unsigned int *cancel = nagi_llm_async_cancel_swap(llm, NULL);
+    int len = -1;
+
+    nagi_llm_async_unlock(llm);
+
+    llm_mutex_lock(&backend->lock);
+    while (!f->done && !(cancel && llm_atomic_load(cancel))) {
+        llm_cond_timedwait(&backend->done, &backend->lock, CLOUD_WAIT_SLICE_MS);
+    }
+    if (!f->done) {
+        len = CLOUD_FLIGHT_CANCELLED;
+    } else if (f->text) {
+        len = f->len < output_size ? f->len : output_size - 1;
+        memcpy(output, f->text, len);
+        output[len] = '\0';
+    }
+    if (--f->waiters == 0 && f->done) flight_free(f);
+    llm_mutex_unlock(&backend->lock);
+
+    nagi_llm_async_lock(llm);
+    nagi_llm_async_cancel_swap(llm, cancel);
+    return len;
+}
+
+/* Publish the leader's answer to the callers waiting for it */
+static void flight_end(cloud_backend_t *backend, cloud_flight_t *f, const char *output, int len) {
+    cloud_flight_t **link;
+
+    llm_mutex_lock(&backend->lock);
+    for (link = &backend->flights; *link && *link != f; link = &(*link)->next) {
+    }
+    if (*link) *link = f->next;
+
+    if (len >= 0 && f->waiters > 0) {
+        f->text = (char *)malloc((size_t)len + 1);
+        if (f->text) {
+            memcpy(f->text, output, len);
+            f->text[len] = '\0';
+            f->len = len;
+        }
+    }
+    f->done = 1;
+    if (f->waiters == 0) {
+        flight_free(f);
+    } else {
+        llm_cond_broadcast(&backend->done);
+    }
+    llm_mutex_unlock(&backend->lock);
+}
+
+int nagi_llm_cloud_chat(nagi_llm_t *llm, const nagi_llm_cloud_message_t *messages, int count,
+                        char *output, int output_size, nagi_llm_token_cb_t on_token, void *userdata) {
+    cloud_backend_t *backend = (cloud_backend_t *)llm->backend_data;
+    cloud_flight_t *f;
+    int leader = 1, len, emitted = 0;
+
+    if (!backend || output_size <= 0) return -1;
+
+    f = flight_join(backend, messages, count, &leader);
+    if (f && !leader) {
+        len = flight_wait(llm, backend, f, output, output_size);
+        if (len >= 0) {
+            /* A streaming caller gets the whole answer at once, like a cache hit */
+            if (on_token) llm_stream_emit(output, len, &emitted, on_token, userdata);
+            return len;
+        }
+        if (len == CLOUD_FLIGHT_CANCELLED) return -1;
+        /* It failed there, this caller tries on its own */
+        f = NULL;
+    }
+
+    if (on_token) {
+        len = cloud_generate_stream(llm, messages, count, output, output_size, on_token, userdata);
+    } else {
+        len = cloud_generate(llm, messages, count, output, output_size);
+    }
+
+    if (f) flight_end(backend, f, output, len);
     return len;
 }
 
+/*
+ * Batch API, for pre-translation: the requests go up as one JSONL file,
+ * the provider works through them within its completion window (at a
+ * fraction of the price) and the answers come back as another file.
+ * Everything goes to the api_url endpoint, where the file is stored.
+ */
+
+/* Wait ms, dropping the backend call lock meanwhile. Returns 0 if cancelled */
+static int batch_sleep(nagi_llm_t *llm, cloud_backend_t *backend, double ms) {
+    volatile unsigned int *cancel = nagi_llm_async_cancel_swap(llm, NULL);
+    double until = llm_time_ms() + ms;
+    int cancelled;
+
+    nagi_llm_async_unlock(llm);
+    llm_mutex_lock(&backend->lock);
+    while (!(cancelled = cancel && llm_atomic_load(cancel)) && llm_time_ms() < until) {
+        llm_cond_timedwait(&backend->done, &backend->lock, CLOUD_WAIT_SLICE_MS);
+    }
+    llm_mutex_unlock(&backend->lock);
+    nagi_llm_async_lock(llm);
+    nagi_llm_async_cancel_swap(llm, cancel);
+    return !cancelled;
+}
+
+/*
+ * One call to the batch API, with the method, body and headers already set
+ * on the transfer. The reply is left in t->response. Returns the HTTP
+ * status, 0 if there was none.
+ */
+static long batch_call(nagi_llm_t *llm, cloud_backend_t *backend, cloud_transfer_t *t, const char *url) {
+    cloud_endpoint_t *ep = &backend->endpoints[0];
+    CURLcode res;
+    long status = 0;
+    int attempt;
+
+    curl_easy_setopt(t->curl, CURLOPT_URL, url);
+    for (attempt = 0; ; attempt++) {
+        t->response.size = 0;
+        res = transfer_wait(llm, backend, ep, t, 0);
+        if (!transfer_retry(backend, ep, t, res, attempt)) break;
+    }
+
+    if (res != CURLE_OK) {
+        if (res != CURLE_ABORTED_BY_CALLBACK) {
+            fprintf(stderr, "Cloud API error: %s\n", curl_easy_strerror(res));
+        }
+        return 0;
+    }
+    curl_easy_getinfo(t->curl, CURLINFO_RESPONSE_CODE, &status);
+    if (status >= 300) {
+        llm_log(LLM_LOG_WARN, "Cloud API: HTTP %ld from %s: %.200s\n", status, url,
+                t->response.data ? t->response.data : "");
+    }
+    return status;
+}
+
+static long batch_get(nagi_llm_t *llm, cloud_backend_t *backend, cloud_transfer_t *t, const char *url) {
+    curl_easy_setopt(t->curl, CURLOPT_HTTPGET, 1L);
+    return batch_call(llm, backend, t, url);
+}
+
+static long batch_post(nagi_llm_t *llm, cloud_backend_t *backend, cloud_transfer_t *t, const char *url,
+                       const char *body) {
+    transfer_body(backend, t, body, strlen(body));
+    return batch_call(llm, backend, t, url);
+}
+
+/* Every request as a line of the batch input file, custom_id is its index */
+static int batch_file(cloud_backend_t *backend, response_buffer_t *file, const char *path,
+                      const nagi_llm_cloud_message_t *messages, int per_request, int count) {
+    response_buffer_t body = { NULL, 0, 0 };
+    char head[64];
+    int i, ok = 1;
+
+    for (i = 0; i < count && ok; i++) {
+        snprintf(head, sizeof(head), "{\"custom_id\":\"r%d\",\"method\":\"POST\",\"url\":\"", i);
+        ok = build_payload(backend, &backend->endpoints[0], &body, messages + i * per_request,
+                           per_request, 0) &&
+             buffer_append_str(file, head) && buffer_append_json(file, path) &&
+             buffer_append_str(file, "\",\"body\":") && buffer_append(file, body.data, body.size) &&
+             buffer_append_str(file, "}\n");
+    }
+    free(body.data);
+    return ok;
+}
+
+/* Put each answer of the output file in its request's output. Returns how many there were */
+static int batch_results(const response_buffer_t *file, char **outputs, int count, int output_size) {
+    cloud_json_reader_t reader;
+    const char *line = file->data, *end, *response, *body, *status;
+    size_t response_len, body_len, status_len;
+    char id[32];
+    int index, done = 0;
+
+    while (line && *line) {
+        end = strchr(line, '\n');
+        if (!end) end = line + strlen(line);
+
+        if (cloud_json_string(line, end - line, "custom_id", id, sizeof(id)) &&
+            sscanf(id, "r%d", &index) == 1 && index >= 0 && index < count &&
+            (response = cloud_json_member(line, end - line, "response", &response_len)) != NULL &&
+            (status = cloud_json_member(response, response_len, "status_code", &status_len)) != NULL &&
+            atoi(status) == 200 &&
+            (body = cloud_json_member(response, response_len, "body", &body_len)) != NULL) {
+            cloud_json_reader_init(&reader, outputs[index], output_size, 0);
+            cloud_json_reader_feed(&reader, body, body_len);
+            if (reader.found && reader.len > 0) {
+                done++;
+            } else {
+                outputs[index][0] = '\0';
+            }
+        }
+        line = *end ? end + 1 : end;
+    }
+    return done;
+}
+
+int nagi_llm_cloud_batch(nagi_llm_t *llm, const nagi_llm_cloud_message_t *messages, int per_request,
+                         int count, char **outputs, int output_size) {
+    cloud_backend_t *backend = (cloud_backend_t *)llm->backend_data;
+    cloud_endpoint_t *ep;
+    cloud_transfer_t *t;
+    response_buffer_t file = { NULL, 0, 0 };
+    struct curl_slist *upload_headers = NULL;
+    curl_mime *mime = NULL;
+    curl_mimepart *part;
+    const char *suffix, *path, *counts, *value;
+    char base[512], url[640], body[256];
+    char file_id[128], batch_id[128], output_id[128], status[32], last[32];
+    size_t counts_len, len;
+    int done = 0, completed, last_completed = -1, i;
+
+    if (!backend || count <= 0 || output_size <= 0) return 0;
+    for (i = 0; i < count; i++) outputs[i][0] = '\0';
+
+    /* The batch API sits next to chat/completions, and is told its path */
+    ep = &backend->endpoints[0];
+    suffix = strstr(ep->url, "/chat/completions");
+    path = strstr(ep->url, "://");
+    path = path ? strchr(path + 3, '/') : NULL;
+    if (!suffix || strcmp(suffix, "/chat/completions") != 0 || !path ||
+        (size_t)(suffix - ep->url) >= sizeof(base)) {
+        llm_log(LLM_LOG_WARN, "Cloud API: no batch API next to %s\n", ep->url);
+        return 0;
+    }
+    memcpy(base, ep->url, suffix - ep->url);
+    base[suffix - ep->url] = '\0';
+
+    if (!batch_file(backend, &file, path, messages, per_request, count)) {
+        free(file.data);
+        return 0;
+    }
+
+    /* A handle of its own: no time limit, and its options don't go back in the pool */
+    t = transfer_get(backend);
+    if (!t) {
+        free(file.data);
+        return 0;
+    }
+    curl_easy_setopt(t->curl, CURLOPT_TIMEOUT_MS, 0L);
+    curl_easy_setopt(t->curl, CURLOPT_WRITEFUNCTION, write_callback);
+    curl_easy_setopt(t->curl, CURLOPT_WRITEDATA, &t->response);
+
+    /* Upload the requests; the multipart body sets its own content type */
+    upload_headers = curl_slist_append(NULL, ep->headers->data);
+    mime = curl_mime_init(t->curl);
+    part = curl_mime_addpart(mime);
+    curl_mime_name(part, "purpose");
+    curl_mime_data(part, "batch", CURL_ZERO_TERMINATED);
+    part = curl_mime_addpart(mime);
+    curl_mime_name(part, "file");
+    curl_mime_filename(part, "nagi_batch.jsonl");
+    curl_mime_data(part, file.data, file.size);
+    curl_easy_setopt(t->curl, CURLOPT_HTTPHEADER, upload_headers);
+    curl_easy_setopt(t->curl, CURLOPT_MIMEPOST, mime);
+    snprintf(url, sizeof(url), "%s/files", base);
+    llm_log(LLM_LOG_INFO, "Cloud API: uploading a batch of %d requests (%zu KB)\n", count, file.size / 1024);
+    if (batch_call(llm, backend, t, url) != 200 ||
+        !cloud_json_string(t->response.data, t->response.size, "id", file_id, sizeof(file_id))) {
+        goto out;
+    }
+
+    curl_easy_setopt(t->curl, CURLOPT_HTTPHEADER, ep->headers);
+    snprintf(url, sizeof(url), "%s/batches", base);
+    snprintf(body, sizeof(body),
+             "{\"input_file_id\":\"%s\",\"endpoint\":\"%s\",\"completion_window\":\"24h\"}", file_id, path);
+    if (batch_post(llm, backend, t, url, body) != 200 ||
+        !cloud_json_string(t->response.data, t->response.size, "id", batch_id, sizeof(batch_id))) {
+        goto out;
+    }
+    llm_log(LLM_LOG_INFO, "Cloud API: batch %s submitted\n", batch_id);
+
+    /* Poll until the provider is done with it */
+    last[0] = '\0';
+    snprintf(url, sizeof(url), "%s/batches/%s", base, batch_id);
+    for (;;) {
+        if (!batch_sleep(llm, backend, CLOUD_BATCH_POLL_MS)) {
+            /* Nobody wants the answers, don't pay for them */
+            snprintf(url, sizeof(url), "%s/batches/%s/cancel", base, batch_id);
+            batch_post(llm, backend, t, url, "");
+            llm_log(LLM_LOG_INFO, "Cloud API: batch %s cancelled\n", batch_id);
+            goto out;
+        }
+        if (batch_get(llm, backend, t, url) != 200 ||
+            !cloud_json_string(t->response.data, t->response.size, "status", status, sizeof(status))) {
+            goto out;
+        }
+
+        completed = 0;
+        counts = cloud_json_member(t->response.data, t->response.size, "request_counts", &counts_len);
+        if (counts && (value = cloud_json_member(counts, counts_len, "completed", &len)) != NULL) {
+            completed = atoi(value);
+        }
+        if (strcmp(status, last) != 0 || completed != last_completed) {
+            llm_log(LLM_LOG_INFO, "Cloud API: batch %s %s, %d of %d done\n", batch_id, status,
+                    completed, count);
+            strcpy(last, status);
+            last_completed = completed;
+        }
+
+        if (strcmp(status, "completed") == 0 || strcmp(status, "expired") == 0 ||
+            strcmp(status, "cancelled") == 0) break;
+        if (strcmp(status, "failed") == 0) goto out;
+    }
+
+    /* An expired or cancelled batch still returns what was finished */
+    if (!cloud_json_string(t->response.data, t->response.size, "output_file_id",
+                           output_id, sizeof(output_id))) {
+        goto out;
+    }
+    snprintf(url, sizeof(url), "%s/files/%s/content", base, output_id);
+    if (batch_get(llm, backend, t, url) == 200) {
+        done = batch_results(&t->response, outputs, count, output_size);
+    }
+
+out:
+    curl_mime_free(mime);
+    curl_slist_free_all(upload_headers);
+    transfer_free(t);
+    free(file.data);
+    return done;
+}
+
+/*
+ * Stop the event loop and free the transfers. No request may be in
+ * flight (the worker thread has been stopped by then).
+ */
 void nagi_llm_cloud_cleanup(nagi_llm_t *llm) {
     cloud_backend_t *backend = (cloud_backend_t *)llm->backend_data;
     if (backend) {
-        if (backend->curl) curl_easy_cleanup(backend->curl);
-        free(backend);
+        llm_mutex_lock(&backend->lock);
+        backend->quit = 1;
+        llm_mutex_unlock(&backend->lock);
+        curl_multi_wakeup(backend->multi);
+        llm_thread_join(backend->thread);
+
+        backend_free(backend);
         llm->backend_data = NULL;
     }
     curl_global_cleanup();
@@ -13,10 +13,38 @@ typedef struct {
     char model[128];
     float temperature;
     int max_tokens;
+    int seed;               /* Sent with every request, -1 for none */
+    int prompt_cache;       /* 1 to send a prompt_cache_key */
+    int requests_per_minute; /* Client-side rate limits, 0 for none */
+    int tokens_per_minute;
+    int max_retries;        /* Retries after a 429, a 5xx or a dropped connection */
+    char endpoints[2048];   /* More endpoints, "url|model|key" per line */
+    int probe_interval_s;   /* Idle endpoints are probed this often, 0 never */
+    int timeout_ms;         /* Longest request, 0 for no limit */
+    int compress;           /* 1 to gzip request bodies */
 } nagi_llm_cloud_config_t;
 
+/* One chat message */
+typedef struct {
+    const char *role;       /* "system", "user" or "assistant" */
+    const char *content;
+} nagi_llm_cloud_message_t;
+
 int nagi_llm_cloud_init(nagi_llm_t *llm, const nagi_llm_cloud_config_t *config);
-int nagi_llm_cloud_generate(nagi_llm_t *llm, const char *prompt, char *output, int output_size);
+/*
+ * Send the messages in order, the ones that change least first so the
+ * provider can reuse its cache of the prefix. The first one sets the
+ * prompt_cache_key. Streams through on_token when it isn't NULL.
+ */
+int nagi_llm_cloud_chat(nagi_llm_t *llm, const nagi_llm_cloud_message_t *messages, int count,
+                        char *output, int output_size, nagi_llm_token_cb_t on_token, void *userdata);
+/*
+ * Send count requests of per_request messages each through the provider's
+ * batch API and wait for them, which can take hours. Requests that got no
+ * answer leave their output empty. Returns the number answered.
+ */
+int nagi_llm_cloud_batch(nagi_llm_t *llm, const nagi_llm_cloud_message_t *messages, int per_request,
+                         int count, char **outputs, int output_size);
 void nagi_llm_cloud_cleanup(nagi_llm_t *llm);
 
 #ifdef __cplusplus
@@ -1,17 +1,119 @@
 #include "nagi_llm_cloud.h"
 #include "../../include/llm_utils.h"
+#include "../../include/llm_log.h"
 #include "../../include/nagi_llm_context.h"
+#include "../../src/llm_thread.h"
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 #include <stdio.h>
 #include <time.h>
 
+/*
+ * The prompts as chat messages: the system message and the examples are
+ * the same every turn (the verb list only changes with the game), the
+ * game context comes after them and the player's text last, so every
+ * request starts with the longest prefix the provider has seen before.
+ *
+ * With [cloud] compact_prompts the examples are left out and the system
+ * messages are the short ones, which is most of every request's bytes.
+ */
+#define CLOUD_MAX_MESSAGES 16
+#define CLOUD_COUNT(a) ((int)(sizeof(a) / sizeof((a)[0])))
+
+static const char *CLOUD_EXTRACTION_SYSTEM =
+    "Translate the player's text adventure command to English. "
+    "Answer with the verb and noun only.";
+
+static const nagi_llm_cloud_message_t cloud_extraction_examples[] = {
+    { "user", "regarde l'arbre" }, { "assistant", "look tree" },
+    { "user", "coge la llave" }, { "assistant", "get key" }
+};
+
+static const char *CLOUD_LANGUAGE_SYSTEM =
+    "Detect the language of the text and respond with only the language name.";
+
+static const nagi_llm_cloud_message_t cloud_language_examples[] = {
+    { "user", "look tree" }, { "assistant", "English" },
+    { "user", "mira arbol" }, { "assistant", "Spanish" },
+    { "user", "regarde arbre" }, { "assistant", "French" },
+    { "user", "schaue baum" }, { "assistant", "German" }
+};
+
+static const char *CLOUD_MATCH_SYSTEM =
+    "You are a command matcher for a text adventure game. Your job is to determine if a user's input "
+    "(in any language) has the same meaning as a specific game command (in English).\n\n"
+    "Rules:\n"
+    "- If the input means the same action as the expected command, answer 'yes'\n"
+    "- If the input means something different, answer 'no'\n"
+    "- Only answer with 'yes' or 'no', nothing else";
+
+#define CLOUD_MATCH_QUESTION "Expected command: %s\nUser input: %s\nDoes the input match the command?"
+
+static const nagi_llm_cloud_message_t cloud_match_examples[] = {
+    { "user", "Expected command: look castle\nUser input: mira el castillo\nDoes the input match the command?" },
+    { "assistant", "yes" },
+    { "user", "Expected command: get key\nUser input: coge la llave\nDoes the input match the command?" },
+    { "assistant", "yes" },
+    { "user", "Expected command: open door\nUser input: abrir puerta\nDoes the input match the command?" },
+    { "assistant", "yes" },
+    { "user", "Expected command: quit\nUser input: mira el castillo\nDoes the input match the command?" },
+    { "assistant", "no" },
+    { "user", "Expected command: fast\nUser input: mira el castillo\nDoes the input match the command?" },
+    { "assistant", "no" },
+    { "user", "Expected command: restore game\nUser input: mirar castillo\nDoes the input match the command?" },
+    { "assistant", "no" }
+};
+
+static const char *CLOUD_RESPONSE_SYSTEM =
+    "You are a witty narrator for a text adventure game. Translate game texts to the player's language "
+    "with creativity, humor, sarcasm and even irreverence.\n\n"
+    "SPECIAL RULE: When you see 'I don't understand' messages, DON'T translate literally.\n"
+    "Create a funny, contextual response about what the player said.\n"
+    "Output ONLY your response.";
+
+static const nagi_llm_cloud_message_t cloud_response_examples[] = {
+    { "user", "Player said: I am hungry\nGame says: I don't understand" },
+    { "assistant", "Go to the CastleBurger if you want food!" },
+    { "user", "Player said: que calor\nGame says: I don't understand" },
+    { "assistant", "¿Calor? ¡Quítate la armadura!" },
+    { "user", "Player said: tengo hambre\nGame says: I don't understand" },
+    { "assistant", "¡Sigue jugando, gordo! Aquí no hay cocina." }
+};
+
+static const char *CLOUD_EXTRACTION_COMPACT = "Player command to English, verb and noun only.";
+static const char *CLOUD_LANGUAGE_COMPACT = "Name the text's language, nothing else.";
+static const char *CLOUD_MATCH_COMPACT =
+    "Does the input (any language) mean the same action as the game command? Answer yes or no.";
+#define CLOUD_MATCH_QUESTION_COMPACT "Command: %s\nInput: %s"
+static const char *CLOUD_RESPONSE_COMPACT =
+    "Translate the text adventure message to the player's language, with wit. "
+    "For 'I don't understand', joke about what the player said instead. Output only the text.";
+
+/* System message and examples (none in the compact profile), returns the count so far */
+static int cloud_messages(nagi_llm_t *llm, nagi_llm_cloud_message_t *messages, const char *system,
+                          const char *compact, const nagi_llm_cloud_message_t *examples,
+                          int example_count) {
+    messages[0].role = "system";
+    if (llm->config.cloud_compact_prompts) {
+        messages[0].content = compact;
+        return 1;
+    }
+    messages[0].content = system;
+    memcpy(messages + 1, examples, example_count * sizeof(*examples));
+    return 1 + example_count;
+}
+
 static int cloud_matches_expected(nagi_llm_t *llm, const char *input,
                                    const int *expected_word_ids, int expected_count);
 static int cloud_generate_response(nagi_llm_t *llm, const char *game_response,
                                     const char *user_input, char *output, int output_size);
 static const char *cloud_detect_language(nagi_llm_t *llm, const char *input);
+static int cloud_generate_response_stream(nagi_llm_t *llm, const char *game_response,
+                                           const char *user_input, char *output, int output_size,
+                                           nagi_llm_token_cb_t on_token, void *userdata);
+static int cloud_generate_response_batch(nagi_llm_t *llm, const char **game_responses, int count,
+                                          char **outputs, int output_size);
 
 static int cloud_init(nagi_llm_t *llm, const char *model_path, const nagi_llm_config_t *config) {
     (void)model_path;
@@ -36,13 +138,22 @@ static int cloud_init(nagi_llm_t *llm, const char *model_path, const nagi_llm_co
         .api_key = "",
         .model = "",
         .temperature = creative_temp,  /* Use randomized creative temperature */
-        .max_tokens = llm->config.max_tokens
+        .max_tokens = llm->config.max_tokens,
+        .seed = llm->config.cloud_seed,
+        .prompt_cache = llm->config.cloud_prompt_cache,
+        .requests_per_minute = llm->config.cloud_requests_per_minute,
+        .tokens_per_minute = llm->config.cloud_tokens_per_minute,
+        .max_retries = llm->config.cloud_max_retries,
+        .probe_interval_s = llm->config.cloud_probe_interval_s,
+        .timeout_ms = llm->config.cloud_timeout_ms,
+        .compress = llm->config.cloud_compress
     };
     
     /* Copy from unified config */
     strncpy(cloud_config.api_url, llm->config.api_endpoint, sizeof(cloud_config.api_url) - 1);
     strncpy(cloud_config.api_key, llm->config.api_key, sizeof(cloud_config.api_key) - 1);
     strncpy(cloud_config.model, llm->config.model_path, sizeof(cloud_config.model) - 1);
+    strncpy(cloud_config.endpoints, llm->config.cloud_endpoints, sizeof(cloud_config.endpoints) - 1);
     
     /* Fallback to environment variable if no API key */
     if (!cloud_config.api_key[0]) {
@@ -77,39 +188,43 @@ static void cloud_shutdown(nagi_llm_t *llm) {
     }
 }
 
-static const char *cloud_extract_words(nagi_llm_t *llm, const char *input) {
-    static char response_buf[NAGI_LLM_MAX_RESPONSE_SIZE];
-    char prompt[NAGI_LLM_MAX_PROMPT_SIZE];
+static const char *cloud_extract_words(nagi_llm_t *llm, const char *input, char *out, int out_size) {
+    char system[NAGI_LLM_MAX_PROMPT_SIZE];
+    nagi_llm_cloud_message_t messages[CLOUD_MAX_MESSAGES];
+    int count;
     
     if (!input || input[0] == '\0') return input;
     
     /* Extract game verbs for vocabulary hint */
     const char *verbs = extract_game_verbs(llm);
     
-    /* Build extraction prompt */
-    if (verbs && verbs[0] != '\0' && llm->extraction_prompt_template) {
-        snprintf(prompt, sizeof(prompt), llm->extraction_prompt_template,
-                 verbs, verbs, verbs, input);
-    } else if (llm->extraction_prompt_simple) {
-        snprintf(prompt, sizeof(prompt), llm->extraction_prompt_simple, input);
+    if (llm->config.cloud_compact_prompts) {
+        snprintf(system, sizeof(system), "%s%s%s", CLOUD_EXTRACTION_COMPACT,
+                 verbs && verbs[0] ? " Verbs: " : "", verbs ? verbs : "");
+    } else if (verbs && verbs[0] != '\0') {
+        snprintf(system, sizeof(system), "%s Use these verbs: %s", CLOUD_EXTRACTION_SYSTEM, verbs);
     } else {
-        return input;
+        snprintf(system, sizeof(system), "%s", CLOUD_EXTRACTION_SYSTEM);
     }
+    count = cloud_messages(llm, messages, system, system, cloud_extraction_examples,
+                           CLOUD_COUNT(cloud_extraction_examples));
+    messages[count].role = "user";
+    messages[count++].content = input;
     
-    int len = nagi_llm_cloud_generate(llm, prompt, response_buf, sizeof(response_buf));
+    int len = nagi_llm_cloud_chat(llm, messages, count, out, out_size, NULL, NULL);
     if (len <= 0) return input;
     
     /* Trim and lowercase */
-    char *trimmed = response_buf;
+    char *trimmed = out;
     while (*trimmed == ' ' || *trimmed == '\n' || *trimmed == '\r' || *trimmed == '\t') trimmed++;
     char *end = trimmed + strlen(trimmed) - 1;
     while (end > trimmed && (*end == ' ' || *end == '\n' || *end == '\r' || *end == '\t')) *end-- = '\0';
     
     for (char *p = trimmed; *p; p++) *p = tolower((unsigned char)*p);
     
-    if (trimmed != response_buf) memmove(response_buf, trimmed, strlen(trimmed) + 1);
+    if (trimmed != out) memmove(out, trimmed, strlen(trimmed) + 1);
     
-    return response_buf;
+    return out;
 }
 
 nagi_llm_t *nagi_llm_cloud_create(void) {
@@ -122,8 +237,8 @@ nagi_llm_t *nagi_llm_cloud_create(void) {
     llm->extract_words = cloud_extract_words;
     llm->matches_expected = cloud_matches_expected;
     llm->generate_response = cloud_generate_response;
-    llm->extraction_prompt_template = EXTRACTION_PROMPT_TEMPLATE;
-    llm->extraction_prompt_simple = EXTRACTION_PROMPT_SIMPLE;
+    llm->generate_response_stream = cloud_generate_response_stream;
+    llm->generate_response_batch = cloud_generate_response_batch;
     
     /* Set default temperature values */
     llm->config.temperature = 0.0f;  /* Extraction temperature (deterministic) */
@@ -133,6 +248,19 @@ nagi_llm_t *nagi_llm_cloud_create(void) {
     llm->config.verbose = 0;
     strncpy(llm->config.personality, DEFAULT_PERSONALITY, sizeof(llm->config.personality) - 1);
     llm->config.personality[sizeof(llm->config.personality) - 1] = '\0';
+    llm->config.translation_cache_kb = NAGI_LLM_DEFAULT_CACHE_KB;
+    llm->config.extraction_memo_entries = NAGI_LLM_DEFAULT_MEMO_ENTRIES;
+    llm->config.match_threshold = NAGI_LLM_DEFAULT_MATCH_THRESHOLD;
+    llm->config.match_cache_entries = NAGI_LLM_DEFAULT_MATCH_CACHE_ENTRIES;
+    llm->config.embedding_match_high = NAGI_LLM_DEFAULT_EMBED_MATCH_HIGH;
+    llm->config.embedding_match_low = NAGI_LLM_DEFAULT_EMBED_MATCH_LOW;
+    llm->config.draft_tokens = NAGI_LLM_DEFAULT_DRAFT_TOKENS;
+    llm->config.hedge_deadline_ms = NAGI_LLM_DEFAULT_HEDGE_DEADLINE_MS;
+    llm->config.hedge_percentile = NAGI_LLM_DEFAULT_HEDGE_PERCENTILE;
+    llm->config.cloud_seed = NAGI_LLM_DEFAULT_CLOUD_SEED;
+    llm->config.cloud_max_retries = NAGI_LLM_DEFAULT_CLOUD_MAX_RETRIES;
+    llm->config.cloud_probe_interval_s = NAGI_LLM_DEFAULT_CLOUD_PROBE_INTERVAL_S;
+    llm->config.cloud_timeout_ms = NAGI_LLM_DEFAULT_CLOUD_TIMEOUT_MS;
     
     return llm;
 }
@@ -140,8 +268,10 @@ nagi_llm_t *nagi_llm_cloud_create(void) {
 static int cloud_matches_expected(nagi_llm_t *llm, const char *input,
                                    const int *expected_word_ids, int expected_count) {
     char expected_str[256] = {0};
-    char prompt[2048];
+    char question[512];
     char response[128];
+    nagi_llm_cloud_message_t messages[CLOUD_MAX_MESSAGES];
+    int count;
     
     for (int i = 0; i < expected_count; i++) {
         const char *word = get_word_string(llm, expected_word_ids[i]);
@@ -151,18 +281,27 @@ static int cloud_matches_expected(nagi_llm_t *llm, const char *input,
         }
     }
     
-    snprintf(prompt, sizeof(prompt), SEMANTIC_MATCHING_PROMPT, expected_str, input);
+    if (llm->config.cloud_compact_prompts) {
+        snprintf(question, sizeof(question), CLOUD_MATCH_QUESTION_COMPACT, expected_str, input);
+    } else {
+        snprintf(question, sizeof(question), CLOUD_MATCH_QUESTION, expected_str, input);
+    }
+    count = cloud_messages(llm, messages, CLOUD_MATCH_SYSTEM, CLOUD_MATCH_COMPACT, cloud_match_examples,
+                           CLOUD_COUNT(cloud_match_examples));
+    messages[count].role = "user";
+    messages[count++].content = question;
     
-    int len = nagi_llm_cloud_generate(llm, prompt, response, sizeof(response));
-    if (len <= 0) return 0;
+    int len = nagi_llm_cloud_chat(llm, messages, count, response, sizeof(response), NULL, NULL);
+    if (len <= 0) return NAGI_LLM_MATCH_ERROR;
     
     return (strstr(response, "yes") != NULL);
 }
 
-static const char *cloud_detect_language(nagi_llm_t *llm, const char *input) {
+static const char *cloud_detect_language_remote(nagi_llm_t *llm, const char *input) {
     llm_state_t *state = llm->state;
-    static char detected[64];
-    char prompt[512];
+    char detected[64];          /* Calls can overlap while a request is in flight */
+    nagi_llm_cloud_message_t messages[CLOUD_MAX_MESSAGES];
+    int count;
     const char *fallback = "English";
 
     if (!llm || !state || !nagi_llm_ready(llm)) {
@@ -173,8 +312,17 @@ static const char *cloud_detect_language(nagi_llm_t *llm, const char *input) {
         return state->detected_language[0] ? state->detected_language : fallback;
     }
 
-    snprintf(prompt, sizeof(prompt), LANGUAGE_DETECTION_PROMPT_CLOUD, input);
-    int len = nagi_llm_cloud_generate(llm, prompt, detected, sizeof(detected));
+    /* Most inputs are in the session language, only ask the model on doubt */
+    if (llm_language_lookup(llm, input)) {
+        llm_stats_hit(llm, LLM_STATS_CACHE_HIT);
+        return state->detected_language;
+    }
+
+    count = cloud_messages(llm, messages, CLOUD_LANGUAGE_SYSTEM, CLOUD_LANGUAGE_COMPACT,
+                           cloud_language_examples, CLOUD_COUNT(cloud_language_examples));
+    messages[count].role = "user";
+    messages[count++].content = input;
+    int len = nagi_llm_cloud_chat(llm, messages, count, detected, sizeof(detected), NULL, NULL);
 
     if (len <= 0) {
         return state->detected_language[0] ? state->detected_language : fallback;
@@ -206,28 +354,118 @@ static const char *cloud_detect_language(nagi_llm_t *llm, const char *input) {
         }
     }
 
-    strncpy(state->detected_language, lang, sizeof(state->detected_language) - 1);
-    state->detected_language[sizeof(state->detected_language) - 1] = '\0';
+    llm_language_store(llm, lang);
 
     if (llm->config.verbose) {
-        printf("Cloud: Language detected: '%s' from input: '%s'\n",
-               state->detected_language, input);
+        llm_log(LLM_LOG_DEBUG, "Cloud: Language detected: '%s' from input: '%s'\n",
+                               state->detected_language, input);
     }
 
     return state->detected_language[0] ? state->detected_language : fallback;
 }
 
-static int cloud_generate_response(nagi_llm_t *llm, const char *game_response,
-                                    const char *user_input, char *output, int output_size) {
-    char prompt[4096];
+/* Language detection is counted as its own operation */
+static const char *cloud_detect_language(nagi_llm_t *llm, const char *input) {
+    llm_stats_call_t call = llm_stats_begin(llm, NAGI_LLM_OP_DETECT, llm_time_ms());
+    const char *language = cloud_detect_language_remote(llm, input);
+
+    llm_stats_end(llm, call);
+    return language;
+}
+
+static int cloud_generate_response_stream(nagi_llm_t *llm, const char *game_response,
+                                           const char *user_input, char *output, int output_size,
+                                           nagi_llm_token_cb_t on_token, void *userdata) {
+    char context[LLM_MAX_CONTEXT_SIZE + 64];
+    char game_context[LLM_MAX_CONTEXT_SIZE];
+    char turn[NAGI_LLM_MAX_PROMPT_SIZE];
+    nagi_llm_cloud_message_t messages[CLOUD_MAX_MESSAGES];
     const char *language = cloud_detect_language(llm, user_input);
+    int count, len;
 
     if (llm->config.verbose) {
-        printf("Cloud: Generating response in %s\n", language);
+        llm_log(LLM_LOG_DEBUG, "Cloud: Generating response in %s\n", language);
+    }
+
+    /* The game context changes every turn, it goes after the examples */
+    len = snprintf(context, sizeof(context), "Translate to %s.", language);
+    if (llm_context_build(llm->session, game_context, sizeof(game_context)) > 0) {
+        snprintf(context + len, sizeof(context) - len, "\n\nGame context:\n%s", game_context);
+    }
+
+    snprintf(turn, sizeof(turn), "Player said: %s\nGame says: %s",
+             user_input ? user_input : "", game_response);
+
+    count = cloud_messages(llm, messages, CLOUD_RESPONSE_SYSTEM, CLOUD_RESPONSE_COMPACT,
+                           cloud_response_examples, CLOUD_COUNT(cloud_response_examples));
+    messages[count].role = "system";
+    messages[count++].content = context;
+    messages[count].role = "user";
+    messages[count++].content = turn;
+
+    return nagi_llm_cloud_chat(llm, messages, count, output, output_size, on_token, userdata);
+}
+
+static int cloud_generate_response(nagi_llm_t *llm, const char *game_response,
+                                    const char *user_input, char *output, int output_size) {
+    return cloud_generate_response_stream(llm, game_response, user_input, output, output_size,
+                                          NULL, NULL);
+}
+
+/*
+ * Pre-translation. With [cloud] batch on, every message goes in one batch
+ * API job instead of a request each; the caller sends the ones it left
+ * empty one at a time. There is no game running, so no game context.
+ */
+static int cloud_generate_response_batch(nagi_llm_t *llm, const char **game_responses, int count,
+                                          char **outputs, int output_size) {
+    llm_state_t *state = llm->state;
+    nagi_llm_cloud_message_t prefix[CLOUD_MAX_MESSAGES];
+    nagi_llm_cloud_message_t *messages;
+    char context[64];
+    char **turns, **outs;
+    int per_request, n, i, done = 0;
+
+    for (i = 0; i < count; i++) outputs[i][0] = '\0';
+    if (!llm->config.cloud_batch) return 0;
+
+    snprintf(context, sizeof(context), "Translate to %s.",
+             state && state->detected_language[0] ? state->detected_language : "English");
+
+    per_request = cloud_messages(llm, prefix, CLOUD_RESPONSE_SYSTEM, CLOUD_RESPONSE_COMPACT,
+                                 cloud_response_examples, CLOUD_COUNT(cloud_response_examples)) + 2;
+    messages = (nagi_llm_cloud_message_t *)malloc((size_t)count * per_request * sizeof(*messages));
+    turns = (char **)calloc((size_t)count, sizeof(*turns));
+    outs = (char **)malloc((size_t)count * sizeof(*outs));
+    if (!messages || !turns || !outs) goto out;
+
+    n = 0;
+    for (i = 0; i < count; i++) {
+        nagi_llm_cloud_message_t *m = messages + n * per_request;
+        size_t size;
+
+        if (!game_responses[i] || game_responses[i][0] == '\0') continue;
+        size = strlen(game_responses[i]) + 32;
+        turns[n] = (char *)malloc(size);
+        if (!turns[n]) goto out;
+        snprintf(turns[n], size, "Player said: \nGame says: %s", game_responses[i]);
+
+        memcpy(m, prefix, (per_request - 2) * sizeof(*m));
+        m[per_request - 2].role = "system";
+        m[per_request - 2].content = context;
+        m[per_request - 1].role = "user";
+        m[per_request - 1].content = turns[n];
+        outs[n++] = outputs[i];
     }
 
-    snprintf(prompt, sizeof(prompt), RESPONSE_GENERATION_PROMPT,
-             language, /*llm->config.personality,*/ user_input ? user_input : "", game_response);
+    if (n > 0) done = nagi_llm_cloud_batch(llm, messages, per_request, n, outs, output_size);
 
-    return nagi_llm_cloud_generate(llm, prompt, output, output_size);
+out:
+    if (turns) {
+        for (i = 0; i < count; i++) free(turns[i]);
+    }
+    free(turns);
+    free(outs);
+    free(messages);
+    return done;
 }
@@ -0,0 +1,410 @@
+/*
+ * nagi_llm_cloud_json.c - One pass reader for the completion content
+ *
+ * A byte at a time state machine, so a response can be decoded as curl
+ * hands it over without holding the body. It tracks how far the open
+ * containers follow the path
+ *     { "choices": [ { "message" | "delta": { "content": "..." } } ] }
+ * and only the string at its end is written out, with \uXXXX escapes
+ * (surrogate pairs included) turned into UTF-8.
+ *
+ * The batch API's replies are small or come a line at a time, those are
+ * picked apart whole with cloud_json_member().
+ */
+
+#include <string.h>
+
+#include "nagi_llm_cloud_json.h"
+
+enum {
+    JSON_VALUE,         /* A value is next */
+    JSON_VALUE_OR_END,  /* First element of an array, or ] */
+    JSON_KEY_OR_END,    /* First key of an object, or } */
+    JSON_KEY_NEXT,      /* Key after a comma */
+    JSON_KEY,
+    JSON_KEY_ESC,
+    JSON_COLON,
+    JSON_AFTER,         /* After a value: , or the closing bracket */
+    JSON_LITERAL,       /* Number, true, false or null */
+    JSON_STRING,
+    JSON_ESC,
+    JSON_HEX,
+    JSON_LOW_ESC,       /* \ of the low surrogate */
+    JSON_LOW_U,         /* u of the low surrogate */
+    JSON_DONE,
+    JSON_ERROR
+};
+
+/* Depth of the value, and the container it has to be to stay on the path */
+static int path_want(const cloud_json_reader_t *r, int is_object) {
+    if (r->on != r->depth) return 0;
+    switch (r->depth) {
+    case 0: return is_object;
+    case 1: return r->key_ok && !is_object;
+    case 2: return r->index == 0 && is_object;
+    case 3: return r->key_ok && is_object;
+    default: return 0;
+    }
+}
+
+static int key_match(const cloud_json_reader_t *r) {
+    const char *key = r->key;
+
+    if (r->key_len < 0 || r->on != r->depth) return 0;
+    switch (r->depth) {
+    case 1: return strcmp(key, "choices") == 0;
+    case 3: return strcmp(key, "message") == 0 || strcmp(key, "delta") == 0;
+    case 4: return strcmp(key, "content") == 0;
+    default: return 0;
+    }
+}
+
+static void emit(cloud_json_reader_t *r, unsigned int cp) {
+    char utf[4];
+    int n;
+
+    if (cp < 0x80) {
+        utf[0] = (char)cp;
+        n = 1;
+    } else if (cp < 0x800) {
+        utf[0] = (char)(0xC0 | (cp >> 6));
+        utf[1] = (char)(0x80 | (cp & 0x3F));
+        n = 2;
+    } else if (cp < 0x10000) {
+        utf[0] = (char)(0xE0 | (cp >> 12));
+        utf[1] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        utf[2] = (char)(0x80 | (cp & 0x3F));
+        n = 3;
+    } else {
+        utf[0] = (char)(0xF0 | (cp >> 18));
+        utf[1] = (char)(0x80 | ((cp >> 12) & 0x3F));
+        utf[2] = (char)(0x80 | ((cp >> 6) & 0x3F));
+        utf[3] = (char)(0x80 | (cp & 0x3F));
+        n = 4;
+    }
+
+    /* Whole characters only when the output fills up */
+    if (r->full || r->len + n >= r->out_size) {
+        r->full = 1;
+        return;
+    }
+    memcpy(r->out + r->len, utf, n);
+    r->len += n;
+    r->out[r->len] = '\0';
+}
+
+/* Raw UTF-8 is copied as is, a character at a time */
+static void emit_byte(cloud_json_reader_t *r, char c) {
+    unsigned char b = (unsigned char)c;
+    int n;
+
+    /* Room is checked at the first byte of each character */
+    if (b < 0x80 || b >= 0xC0) {
+        n = b >= 0xF0 ? 4 : b >= 0xE0 ? 3 : b >= 0xC0 ? 2 : 1;
+        if (r->len + n >= r->out_size) r->full = 1;
+    }
+    if (r->full) return;
+    r->out[r->len++] = c;
+    r->out[r->len] = '\0';
+}
+
+/* A \uXXXX is complete */
+static void hex_done(cloud_json_reader_t *r) {
+    unsigned int cp = r->hex;
+
+    if (r->high) {
+        if (cp >= 0xDC00 && cp <= 0xDFFF) {
+            cp = 0x10000 + ((r->high - 0xD800) << 10) + (cp - 0xDC00);
+            r->high = 0;
+            if (r->content) emit(r, cp);
+            r->state = JSON_STRING;
+            return;
+        }
+        r->high = 0;
+        if (r->content) emit(r, 0xFFFD);
+    }
+
+    if (cp >= 0xD800 && cp <= 0xDBFF) {
+        r->high = cp;
+        r->state = JSON_LOW_ESC;
+        return;
+    }
+    if (cp >= 0xDC00 && cp <= 0xDFFF) cp = 0xFFFD;
+    if (r->content) emit(r, cp);
+    r->state = JSON_STRING;
+}
+
+static int is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static int open_container(cloud_json_reader_t *r, int is_object) {
+    if (r->depth >= CLOUD_JSON_DEPTH) return 0;
+    if (path_want(r, is_object)) {
+        r->on = r->depth + 1;
+        r->index = 0;
+    }
+    r->object[r->depth++] = (unsigned char)is_object;
+    r->state = is_object ? JSON_KEY_OR_END : JSON_VALUE_OR_END;
+    return 1;
+}
+
+static int close_container(cloud_json_reader_t *r, int is_object) {
+    if (r->depth == 0 || r->object[r->depth - 1] != is_object) return 0;
+    if (r->on == r->depth) r->on--;
+    r->depth--;
+    r->state = r->depth ? JSON_AFTER : JSON_DONE;
+    return 1;
+}
+
+static void value_done(cloud_json_reader_t *r) {
+    r->state = r->depth ? JSON_AFTER : JSON_DONE;
+}
+
+/* The start of a value */
+static int value(cloud_json_reader_t *r, char c) {
+    switch (c) {
+    case '{': return open_container(r, 1);
+    case '[': return open_container(r, 0);
+    case '"':
+        r->content = r->depth == 4 && r->on == 4 && r->key_ok;
+        if (r->content) r->found = 1;
+        r->high = 0;
+        r->state = JSON_STRING;
+        return 1;
+    case ',': case ':': case ']': case '}':
+        return 0;
+    default:
+        r->state = JSON_LITERAL;
+        return 1;
+    }
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+static int step(cloud_json_reader_t *r, char c) {
+    int d;
+
+    switch (r->state) {
+    case JSON_VALUE:
+        if (is_space(c)) return 1;
+        return value(r, c);
+
+    case JSON_VALUE_OR_END:
+        if (is_space(c)) return 1;
+        if (c == ']') return close_container(r, 0);
+        return value(r, c);
+
+    case JSON_KEY_OR_END:
+        if (c == '}') return close_container(r, 1);
+        /* fall through */
+    case JSON_KEY_NEXT:
+        if (is_space(c)) return 1;
+        if (c != '"') return 0;
+        r->key_len = 0;
+        r->key[0] = '\0';
+        r->state = JSON_KEY;
+        return 1;
+
+    case JSON_KEY:
+        if (c == '"') {
+            r->key_ok = key_match(r);
+            r->state = JSON_COLON;
+        } else if (c == '\\') {
+            /* None of the path's keys need escaping */
+            r->key_len = -1;
+            r->state = JSON_KEY_ESC;
+        } else if (r->key_len >= 0 && r->key_len < CLOUD_JSON_KEY - 1) {
+            r->key[r->key_len++] = c;
+            r->key[r->key_len] = '\0';
+        } else {
+            r->key_len = -1;
+        }
+        return 1;
+
+    case JSON_KEY_ESC:
+        r->state = JSON_KEY;
+        return 1;
+
+    case JSON_COLON:
+        if (is_space(c)) return 1;
+        if (c != ':') return 0;
+        r->state = JSON_VALUE;
+        return 1;
+
+    case JSON_LITERAL:
+        if (!is_space(c) && c != ',' && c != ']' && c != '}') return 1;
+        value_done(r);
+        if (r->state == JSON_DONE) return 1;
+        /* fall through */
+    case JSON_AFTER:
+        if (is_space(c)) return 1;
+        if (c == '}') return close_container(r, 1);
+        if (c == ']') return close_container(r, 0);
+        if (c != ',') return 0;
+        r->key_ok = 0;
+        if (r->object[r->depth - 1]) {
+            r->state = JSON_KEY_NEXT;
+        } else {
+            if (r->on == r->depth) r->index++;
+            r->state = JSON_VALUE;
+        }
+        return 1;
+
+    case JSON_STRING:
+        if (c == '"') {
+            r->content = 0;
+            value_done(r);
+        } else if (c == '\\') {
+            r->state = JSON_ESC;
+        } else if (r->content) {
+            emit_byte(r, c);
+        }
+        return 1;
+
+    case JSON_ESC:
+        r->state = JSON_STRING;
+        switch (c) {
+        case 'n': c = '\n'; break;
+        case 'r': c = '\r'; break;
+        case 't': c = '\t'; break;
+        case 'b': c = '\b'; break;
+        case 'f': c = '\f'; break;
+        case '"': case '\\': case '/': break;
+        case 'u':
+            r->hex = 0;
+            r->hex_len = 0;
+            r->state = JSON_HEX;
+            return 1;
+        default: return 0;
+        }
+        if (r->content) emit_byte(r, c);
+        return 1;
+
+    case JSON_HEX:
+        d = hex_digit(c);
+        if (d < 0) return 0;
+        r->hex = (r->hex << 4) | (unsigned int)d;
+        if (++r->hex_len == 4) hex_done(r);
+        return 1;
+
+    case JSON_LOW_ESC:
+        if (c == '\\') {
+            r->state = JSON_LOW_U;
+            return 1;
+        }
+        /* A lone high surrogate */
+        r->high = 0;
+        if (r->content) emit(r, 0xFFFD);
+        r->state = JSON_STRING;
+        return step(r, c);
+
+    case JSON_LOW_U:
+        if (c != 'u') {
+            r->high = 0;
+            if (r->content) emit(r, 0xFFFD);
+            r->state = JSON_ESC;
+            return step(r, c);
+        }
+        r->hex = 0;
+        r->hex_len = 0;
+        r->state = JSON_HEX;
+        return 1;
+
+    case JSON_DONE:
+        return is_space(c);
+
+    default:
+        return 0;
+    }
+}
+
+void cloud_json_reader_init(cloud_json_reader_t *r, char *out, int out_size, int len) {
+    memset(r, 0, sizeof(*r));
+    r->state = JSON_VALUE;
+    r->out = out;
+    r->out_size = out_size;
+    r->len = len;
+    if (len < out_size) out[len] = '\0';
+}
+
+int cloud_json_reader_feed(cloud_json_reader_t *r, const char *data, size_t size) {
+    size_t i;
+
+    if (r->state == JSON_ERROR) return 0;
+    for (i = 0; i < size; i++) {
+        if (!step(r, data[i])) {
+            r->state = JSON_ERROR;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Skip the value at p, returns where it ends or NULL if it is cut short */
+static const char *skip_value(const char *p, const char *end) {
+    int depth = 0, in_string = 0;
+
+    for (; p < end; p++) {
+        if (in_string) {
+            if (*p == '\\') p++;
+            else if (*p == '"') {
+                in_string = 0;
+                if (depth == 0) return p + 1;
+            }
+        } else if (*p == '"') {
+            in_string = 1;
+        } else if (*p == '{' || *p == '[') {
+            depth++;
+        } else if (*p == '}' || *p == ']') {
+            if (depth == 0) return p;
+            if (--depth == 0) return p + 1;
+        } else if (depth == 0 && (*p == ',' || is_space(*p))) {
+            return p;
+        }
+    }
+    return depth == 0 && !in_string ? p : NULL;
+}
+
+const char *cloud_json_member(const char *doc, size_t size, const char *key, size_t *len) {
+    const char *p = doc, *end = doc + size, *name, *value;
+    size_t key_len = strlen(key), name_len;
+
+    while (p < end && is_space(*p)) p++;
+    if (p == end || *p != '{') return NULL;
+    p++;
+
+    for (;;) {
+        while (p < end && (is_space(*p) || *p == ',')) p++;
+        if (p == end || *p != '"') return NULL;
+        name = p + 1;
+        p = skip_value(p, end);
+        if (!p) return NULL;
+        name_len = (size_t)(p - name) - 1;
+
+        while (p < end && (is_space(*p) || *p == ':')) p++;
+        value = p;
+        p = skip_value(p, end);
+        if (!p || p == value) return NULL;
+
+        if (name_len == key_len && memcmp(name, key, key_len) == 0) {
+            *len = (size_t)(p - value);
+            return value;
+        }
+    }
+}
+
+int cloud_json_string(const char *doc, size_t size, const char *key, char *out, size_t out_size) {
+    size_t len;
+    const char *value = cloud_json_member(doc, size, key, &len);
+
+    if (!value || len < 2 || value[0] != '"' || len - 2 >= out_size) return 0;
+    memcpy(out, value + 1, len - 2);
+    out[len - 2] = '\0';
+    return 1;
+}
@@ -0,0 +1,59 @@
+#ifndef NAGI_LLM_CLOUD_JSON_H
+#define NAGI_LLM_CLOUD_JSON_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Deepest nesting the reader follows */
+#define CLOUD_JSON_DEPTH 32
+/* Longest key that can match */
+#define CLOUD_JSON_KEY 16
+
+/*
+ * Incremental reader for chat completion responses. It is fed the body
+ * in whatever pieces arrive and decodes choices[0].message.content (or
+ * choices[0].delta.content in a streamed chunk) straight into the output,
+ * escapes and all. Nothing else in the document is kept.
+ */
+typedef struct {
+    int state;
+    int depth;                              /* Open containers */
+    unsigned char object[CLOUD_JSON_DEPTH]; /* 1 = object, 0 = array */
+    int on;                                 /* Open containers on the content path */
+    int index;                              /* Element of the choices array */
+    int key_ok;                             /* Last key is the next step of the path */
+    char key[CLOUD_JSON_KEY];
+    int key_len;
+    int content;                            /* Inside the content string */
+    unsigned int hex;
+    int hex_len;
+    unsigned int high;                      /* Pending high surrogate */
+    char *out;
+    int out_size;
+    int len;
+    int full;                               /* Out of room, the rest is dropped */
+    int found;
+} cloud_json_reader_t;
+
+/* Start a document, appending to out from len on */
+void cloud_json_reader_init(cloud_json_reader_t *r, char *out, int out_size, int len);
+/* Returns 0 once the input isn't JSON, the rest is ignored */
+int cloud_json_reader_feed(cloud_json_reader_t *r, const char *data, size_t size);
+
+/*
+ * Find a member of the object that doc starts with (a whole document, or
+ * a value found by an earlier call). Returns its value, the raw JSON of
+ * *len bytes, or NULL if the object has no such key.
+ */
+const char *cloud_json_member(const char *doc, size_t size, const char *key, size_t *len);
+/* A member that is a string without escapes (ids, status), copied to out */
+int cloud_json_string(const char *doc, size_t size, const char *key, char *out, size_t out_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
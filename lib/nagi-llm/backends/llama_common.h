@@ -10,46 +10,1713 @@
 
 #include "../include/nagi_llm.h"
 #include "../include/llm_utils.h"
+#include "../include/llm_log.h"
+#include "../include/nagi_llm_context.h"
+#include "../src/llm_thread.h"
+#include "../src/llm_numa.h"
 #include "llama.h"
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <math.h>
+#include <ctype.h>
+#include <time.h>
+#include <stdint.h>
+
+/* Worker thread hook (nagi_llm_async.c) */
+int nagi_llm_async_cancelled(nagi_llm_t *llm);
 
 /* API abstraction macros */
 #ifdef NAGI_LLM_HAS_BITNET
 #define LLAMA_TOKENIZE(model, prompt, len, tokens, n_tokens) \
     llama_tokenize(model, prompt, len, tokens, n_tokens, false, true)
 #define LLAMA_KV_CLEAR(ctx, seq, p0, p1) llama_kv_cache_seq_rm(ctx, seq, p0, p1)
+#define LLAMA_KV_COPY(ctx, src, dst, p0, p1) llama_kv_cache_seq_cp(ctx, src, dst, p0, p1)
 #define LLAMA_IS_EOG(model, token) llama_token_is_eog(model, token)
 #define LLAMA_TOKEN_TO_PIECE(model, token, buf, size) \
     llama_token_to_piece(model, token, buf, size, 0, true)
+#define LLAMA_SAMPLER_INIT_GRAMMAR(model, grammar, root) \
+    llama_sampler_init_grammar(model, grammar, root)
+#define LLAMA_N_LAYER(model) llama_n_layer(model)
+#define LLAMA_N_EMBD(model) llama_n_embd(model)
+#define LLAMA_N_HEAD(model) llama_n_head(model)
+#define LLAMA_N_HEAD_KV(model) llama_n_head(model)  /* Not exposed, assume no GQA (upper bound) */
+#define LLAMA_N_VOCAB(model) llama_n_vocab(model)
 #else
 #define LLAMA_TOKENIZE(model, prompt, len, tokens, n_tokens) \
     llama_tokenize(llama_model_get_vocab(model), prompt, len, tokens, n_tokens, false, true)
 #define LLAMA_KV_CLEAR(ctx, seq, p0, p1) \
     do { llama_memory_t mem = llama_get_memory(ctx); llama_memory_seq_rm(mem, seq, p0, p1); } while(0)
+#define LLAMA_KV_COPY(ctx, src, dst, p0, p1) \
+    llama_memory_seq_cp(llama_get_memory(ctx), src, dst, p0, p1)
 #define LLAMA_IS_EOG(model, token) llama_vocab_is_eog(llama_model_get_vocab(model), token)
 #define LLAMA_TOKEN_TO_PIECE(model, token, buf, size) \
     llama_token_to_piece(llama_model_get_vocab(model), token, buf, size, 0, true)
+#define LLAMA_SAMPLER_INIT_GRAMMAR(model, grammar, root) \
+    llama_sampler_init_grammar(llama_model_get_vocab(model), grammar, root)
+#define LLAMA_N_LAYER(model) llama_model_n_layer(model)
+#define LLAMA_N_EMBD(model) llama_model_n_embd(model)
+#define LLAMA_N_HEAD(model) llama_model_n_head(model)
+#define LLAMA_N_HEAD_KV(model) llama_model_n_head_kv(model)
+#define LLAMA_N_VOCAB(model) llama_vocab_n_tokens(llama_model_get_vocab(model))
+#endif
+
+/* Like LLAMA_TOKENIZE, add_special puts the model's BOS in front */
+#ifdef NAGI_LLM_HAS_BITNET
+#define LLAMA_TOKENIZE_SPECIAL(model, prompt, len, tokens, n_tokens, add_special) \
+    llama_tokenize(model, prompt, len, tokens, n_tokens, add_special, true)
+#else
+#define LLAMA_TOKENIZE_SPECIAL(model, prompt, len, tokens, n_tokens, add_special) \
+    llama_tokenize(llama_model_get_vocab(model), prompt, len, tokens, n_tokens, add_special, true)
 #endif
 
+/*
+ * Compiled prompt templates
+ *
+ * The prompts of llm_utils.h are few-shot examples around a couple of %s
+ * holes, tokenized again on every call. A compiled template cuts the
+ * static text into parts, at the holes and at line starts, tokenizes each
+ * part once and keeps the last value of every hole with its tokens. A
+ * call then only tokenizes the values that changed and copies the rest
+ * into place.
+ *
+ * Pieces tokenized apart only give the tokens of the whole text when no
+ * token would span a cut. The cuts sit where BPE pre-tokenizers split
+ * anyway: after a single newline, and before the space leading a hole,
+ * which is tokenized with the value. Compiling checks the parts against the whole
+ * text once. Templates that fail the check (SentencePiece vocabularies
+ * adding a space to every piece, say) and values with whitespace at
+ * either end go through the whole text as before.
+ *
+ * The player's line goes in the language detection, extraction and match
+ * templates in turn, so a value that misses its own hole is looked up in a
+ * few entries shared by every template of the instance before it is
+ * tokenized again.
+ */
+#define LLAMA_PROMPT_MAX_PARTS 96
+#define LLAMA_PROMPT_MAX_HOLES 8
+#define LLAMA_PROMPT_MAX_SPECIAL 4      /* Tokens add_special puts in front (BOS) */
+#define LLAMA_PROMPT_SHARED 4           /* Values remembered across templates */
+#define LLAMA_PROMPT_PROBE "look tree"  /* Hole value for the check at compile time */
+
+enum {
+    LLAMA_PROMPT_EXTRACTION,            /* llm->extraction_prompt_template */
+    LLAMA_PROMPT_EXTRACTION_SIMPLE,     /* llm->extraction_prompt_simple */
+    LLAMA_PROMPT_EXTRACTION_COMBINED,   /* With the language, config.combined_extraction */
+    LLAMA_PROMPT_DETECT,
+    LLAMA_PROMPT_MATCH,
+    LLAMA_PROMPT_RESPONSE,
+    LLAMA_PROMPT_COUNT
+};
+
+struct llama_prompt_part {
+    size_t offset;                      /* Start in the template text */
+    int hole;                           /* Hole number, -1 for static text */
+    int lead;                           /* Hole: a space before it goes with the value */
+    int start, n;                       /* Static: its tokens in prompt->tokens */
+};
+
+struct llama_prompt_value {
+    char *text;                         /* Last value tokenized, NULL for none */
+    size_t len;
+    llama_token *tokens;
+    int n, cap;
+};
+
+struct llama_prompt_shared {
+    struct llama_prompt_value value[LLAMA_PROMPT_SHARED];
+    int lead[LLAMA_PROMPT_SHARED];      /* Tokenized with a leading space */
+    int next;                           /* Entry replaced next */
+};
+
+struct llama_prompt {
+    const char *format;                 /* Template compiled, NULL if none */
+    int valid;                          /* Parts match the whole text */
+    int n_parts, n_holes;
+    struct llama_prompt_part part[LLAMA_PROMPT_MAX_PARTS];
+    llama_token *tokens;                /* Static parts, one after the other */
+    llama_token special[LLAMA_PROMPT_MAX_SPECIAL];
+    int n_special;
+    struct llama_prompt_value value[LLAMA_PROMPT_MAX_HOLES];
+    struct llama_prompt_shared *shared; /* Values of every template, NULL for none */
+};
+
+static inline void llama_prompt_value_free(struct llama_prompt_value *value)
+{
+    free(value->text);
+    free(value->tokens);
+    memset(value, 0, sizeof(*value));
+}
+
+static inline void llama_prompt_free(struct llama_prompt *prompt)
+{
+    int i;
+
+    for (i = 0; i < LLAMA_PROMPT_MAX_HOLES; i++) {
+        llama_prompt_value_free(&prompt->value[i]);
+    }
+    free(prompt->tokens);
+    memset(prompt, 0, sizeof(*prompt));
+}
+
+/*
+ * Make value hold text and its tokens
+ * Returns 1 on success, 0 (value emptied) if out of memory.
+ */
+static inline int llama_prompt_value_set(struct llama_prompt_value *value, const char *text,
+                                         size_t len, const llama_token *tokens, int n)
+{
+    if (n > value->cap) {
+        llama_token *grown = (llama_token *)realloc(value->tokens, (size_t)n * sizeof(llama_token));
+
+        if (!grown) return 0;
+        value->tokens = grown;
+        value->cap = n;
+    }
+    free(value->text);
+    value->text = (char *)malloc(len + 1);
+    if (!value->text) {
+        value->len = 0;
+        return 0;
+    }
+    memcpy(value->text, text, len);
+    value->text[len] = '\0';
+    value->len = len;
+    memcpy(value->tokens, tokens, (size_t)n * sizeof(llama_token));
+    value->n = n;
+    return 1;
+}
+
+/* The shared entry holding text tokenized with or without a leading space */
+static inline struct llama_prompt_value *llama_prompt_shared_find(struct llama_prompt_shared *shared,
+                                                                  const char *text, size_t len, int lead)
+{
+    struct llama_prompt_value *value;
+    int i;
+
+    if (!shared) return NULL;
+    for (i = 0; i < LLAMA_PROMPT_SHARED; i++) {
+        value = &shared->value[i];
+        if (value->text && value->len == len && shared->lead[i] == lead &&
+            memcmp(value->text, text, len) == 0) {
+            return value;
+        }
+    }
+    return NULL;
+}
+
+static inline void llama_prompt_shared_free(struct llama_prompt_shared *shared)
+{
+    int i;
+
+    for (i = 0; i < LLAMA_PROMPT_SHARED; i++) {
+        llama_prompt_value_free(&shared->value[i]);
+    }
+    shared->next = 0;
+}
+
+/* Holes of the template before offset */
+static inline int llama_prompt_holes_before(const char *format, size_t offset)
+{
+    size_t i;
+    int n = 0;
+
+    for (i = 0; i < offset && format[i]; i++) {
+        if (format[i] == '%' && format[i + 1] == 's') {
+            n++;
+            i++;
+        }
+    }
+    return n;
+}
+
+/*
+ * Fill the %s holes of format with values, like snprintf
+ * Returns the length written, -1 if it doesn't fit.
+ */
+static inline int llama_prompt_fill(const char *format, const char *const *values,
+                                    char *out, size_t out_size)
+{
+    size_t len = 0, n;
+    const char *value;
+    int hole = 0;
+
+    for (; *format; format++) {
+        if (format[0] == '%' && format[1] == 's') {
+            value = values[hole++];
+            format++;
+        } else {
+            value = NULL;
+        }
+
+        n = value ? strlen(value) : 1;
+        if (len + n + 1 > out_size) return -1;
+        memcpy(out + len, value ? value : format, n);
+        len += n;
+    }
+    out[len] = '\0';
+    return (int)len;
+}
+
+/*
+ * Tokens of a hole value, with the space before the hole when it has one
+ * Returns the value entry, NULL if it could not be tokenized.
+ */
+static inline struct llama_prompt_value *llama_prompt_value(struct llama_model *model,
+                                                             struct llama_prompt *prompt,
+                                                             const struct llama_prompt_part *part,
+                                                             const char *text)
+{
+    struct llama_prompt_value *value = &prompt->value[part->hole];
+    struct llama_prompt_value *shared;
+    char buf[NAGI_LLM_MAX_PROMPT_SIZE];
+    size_t len = strlen(text);
+    int n, i;
+
+    if (value->text && value->len == len && memcmp(value->text, text, len) == 0) {
+        return value;
+    }
+
+    /* Another template had it, e.g. the input line detection just tokenized */
+    shared = llama_prompt_shared_find(prompt->shared, text, len, part->lead);
+    if (shared) {
+        return llama_prompt_value_set(value, text, len, shared->tokens, shared->n) ? value : NULL;
+    }
+
+    if (len + 2 > sizeof(buf)) return NULL;
+    buf[0] = ' ';
+    memcpy(buf + 1, text, len + 1);
+
+    n = LLAMA_TOKENIZE(model, buf + !part->lead, (int)len + part->lead, value->tokens, value->cap);
+    if (n < 0) {
+        llama_token *grown = (llama_token *)realloc(value->tokens, (size_t)-n * sizeof(llama_token));
+
+        if (!grown) return NULL;
+        value->tokens = grown;
+        value->cap = -n;
+        n = LLAMA_TOKENIZE(model, buf + !part->lead, (int)len + part->lead, value->tokens, value->cap);
+    }
+
+    free(value->text);
+    value->text = (char *)malloc(len + 1);
+    if (n < 0 || !value->text) {
+        value->len = 0;
+        return NULL;
+    }
+    memcpy(value->text, text, len + 1);
+    value->len = len;
+    value->n = n;
+
+    if (prompt->shared) {
+        i = prompt->shared->next;
+        prompt->shared->next = (i + 1) % LLAMA_PROMPT_SHARED;
+        if (llama_prompt_value_set(&prompt->shared->value[i], text, len, value->tokens, n)) {
+            prompt->shared->lead[i] = part->lead;
+        }
+    }
+    return value;
+}
+
+/*
+ * Assemble the tokens from the parts, starting with part first
+ * Returns the token count, -1 if a value can't go in by itself.
+ */
+static inline int llama_prompt_assemble(struct llama_model *model, struct llama_prompt *prompt,
+                                        const char *const *values, int first, bool add_special,
+                                        llama_token *tokens, int n_max)
+{
+    const struct llama_prompt_part *part;
+    const struct llama_prompt_value *value;
+    const llama_token *src;
+    const char *text;
+    size_t len;
+    int i, n = 0, count;
+
+    if (add_special) {
+        if (prompt->n_special > n_max) return -1;
+        memcpy(tokens, prompt->special, prompt->n_special * sizeof(llama_token));
+        n = prompt->n_special;
+    }
+
+    for (i = first; i < prompt->n_parts; i++) {
+        part = &prompt->part[i];
+        if (part->hole < 0) {
+            src = prompt->tokens + part->start;
+            count = part->n;
+        } else {
+            /* Whitespace at the edges would merge with the text around it */
+            text = values[part->hole];
+            len = strlen(text);
+            if (len == 0 || isspace((unsigned char)text[0]) ||
+                isspace((unsigned char)text[len - 1])) {
+                return -1;
+            }
+            value = llama_prompt_value(model, prompt, part, text);
+            if (!value) return -1;
+            src = value->tokens;
+            count = value->n;
+        }
+
+        if (n + count > n_max) return -1;
+        memcpy(tokens + n, src, count * sizeof(llama_token));
+        n += count;
+    }
+    return n;
+}
+
+/* Does the assembled prompt tokenize like the whole text */
+static inline int llama_prompt_check(struct llama_model *model, struct llama_prompt *prompt,
+                                     bool add_special)
+{
+    const char *probes[LLAMA_PROMPT_MAX_HOLES];
+    char text[NAGI_LLM_MAX_PROMPT_SIZE];
+    llama_token *whole, *parts;
+    int i, n_whole, n_parts, n_max, ok;
+
+    for (i = 0; i < LLAMA_PROMPT_MAX_HOLES; i++) {
+        probes[i] = LLAMA_PROMPT_PROBE;
+    }
+    if (llama_prompt_fill(prompt->format, probes, text, sizeof(text)) < 0) return 0;
+
+    n_max = (int)strlen(text) + LLAMA_PROMPT_MAX_SPECIAL + 1;
+    whole = (llama_token *)malloc(2 * (size_t)n_max * sizeof(llama_token));
+    if (!whole) return 0;
+    parts = whole + n_max;
+
+    n_whole = LLAMA_TOKENIZE_SPECIAL(model, text, (int)strlen(text), whole, n_max, add_special);
+    n_parts = llama_prompt_assemble(model, prompt, probes, 0, add_special, parts, n_max);
+    ok = n_whole >= 0 && n_whole == n_parts &&
+         memcmp(whole, parts, n_whole * sizeof(llama_token)) == 0;
+    free(whole);
+    return ok;
+}
+
+/*
+ * Cut format into parts and tokenize the static ones
+ * Returns 1 if the template can be assembled from parts, 0 if its calls
+ * go through the whole text (the prompt still remembers the format).
+ */
+static inline int llama_prompt_compile(nagi_llm_t *llm, struct llama_model *model,
+                                       struct llama_prompt *prompt, const char *format)
+{
+    struct llama_prompt_part *part;
+    size_t i, start, end, len;
+    int n_tokens, n, hole;
+
+    llama_prompt_free(prompt);
+    prompt->format = format;
+    if (!format) return 0;
+
+    len = strlen(format);
+    n_tokens = (int)len + 1;
+    prompt->tokens = (llama_token *)malloc((size_t)n_tokens * sizeof(llama_token));
+    if (!prompt->tokens) return 0;
+
+    prompt->n_special = LLAMA_TOKENIZE_SPECIAL(model, "", 0, prompt->special,
+                                               LLAMA_PROMPT_MAX_SPECIAL, true);
+    if (prompt->n_special < 0) return 0;
+
+    n = 0;
+    hole = 0;
+    start = 0;
+    for (i = 0; i <= len; i++) {
+        int at_hole = format[i] == '%' && format[i + 1] == 's';
+        int at_line = i > 1 && format[i - 1] == '\n' && !isspace((unsigned char)format[i - 2]) &&
+                      format[i] && !isspace((unsigned char)format[i]);
+
+        /* Only %s makes sense in a prompt, anything else stays whole */
+        if (format[i] == '%' && !at_hole) return 0;
+        if (!at_hole && !at_line && i < len) continue;
+
+        /* Close the static text before the cut */
+        end = i;
+        if (at_hole && end > start && format[end - 1] == ' ') end--;
+        if (end > start) {
+            if (prompt->n_parts >= LLAMA_PROMPT_MAX_PARTS) return 0;
+            part = &prompt->part[prompt->n_parts++];
+            part->offset = start;
+            part->hole = -1;
+            part->start = n;
+            part->n = LLAMA_TOKENIZE(model, format + start, (int)(end - start),
+                                     prompt->tokens + n, n_tokens - n);
+            if (part->n < 0) return 0;
+            n += part->n;
+        }
+
+        if (at_hole) {
+            if (hole >= LLAMA_PROMPT_MAX_HOLES || prompt->n_parts >= LLAMA_PROMPT_MAX_PARTS) return 0;
+            part = &prompt->part[prompt->n_parts++];
+            part->offset = end;
+            part->hole = hole++;
+            part->lead = end < i;
+            i++;
+            start = i + 1;
+        } else {
+            start = i;
+        }
+    }
+    prompt->n_holes = hole;
+
+    prompt->valid = llama_prompt_check(model, prompt, false) && llama_prompt_check(model, prompt, true);
+    if (llm->config.verbose) {
+        llm_log(LLM_LOG_DEBUG, "LLM: Prompt template %s: %d parts, %d holes, %d static tokens\n",
+                               prompt->valid ? "compiled" : "kept whole", prompt->n_parts, prompt->n_holes, n);
+    }
+    return prompt->valid;
+}
+
+/*
+ * Tokenize a template with its holes filled
+ * Starts at offset skip of the template: callers that have the head of the
+ * prompt decoded already (prefix cache, game context) skip it. skip should
+ * be a line start, anywhere else the whole text is tokenized.
+ * Returns the token count, negative if it doesn't fit, like llama_tokenize.
+ */
+static inline int llama_prompt_tokenize(nagi_llm_t *llm, struct llama_model *model,
+                                        struct llama_prompt *prompt, const char *const *values,
+                                        size_t skip, bool add_special,
+                                        llama_token *tokens, int n_max)
+{
+    char text[NAGI_LLM_MAX_PROMPT_SIZE];
+    double start = llm_time_ms();
+    int i, n = -1, len;
+
+    for (i = 0; prompt->valid && i < prompt->n_parts; i++) {
+        if (prompt->part[i].offset == skip) {
+            n = llama_prompt_assemble(model, prompt, values, i, add_special, tokens, n_max);
+            break;
+        }
+    }
+
+    if (n < 0) {
+        len = llama_prompt_fill(prompt->format + skip,
+                                values + llama_prompt_holes_before(prompt->format, skip),
+                                text, sizeof(text));
+        if (len < 0) return -1;
+        n = LLAMA_TOKENIZE_SPECIAL(model, text, len, tokens, n_max, add_special);
+    }
+
+    llm_stats_stage(llm, LLM_STATS_TOKENIZE, llm_time_ms() - start, 0);
+    return n;
+}
+
+/*
+ * Template offset where the line holding a hole starts, for skipping
+ * the part of a prompt before it
+ */
+static inline size_t llama_prompt_line_start(const struct llama_prompt *prompt, int hole)
+{
+    const char *format = prompt->format;
+    size_t i, line = 0;
+    int n = 0;
+
+    for (i = 0; format[i]; i++) {
+        if (format[i] == '\n') {
+            line = i + 1;
+        } else if (format[i] == '%' && format[i + 1] == 's') {
+            if (n++ == hole) break;
+            i++;
+        }
+    }
+    return line;
+}
+
+/*
+ * Stop conditions of response generation
+ *
+ * Only the first line of a response is kept (llm_stream_emit and the
+ * backends' clean up), so generation stops once that line is complete
+ * instead of running to the token limit. It also stops at one of the
+ * config.stop_strings, after a token budget that follows the length of
+ * the game message, and at the config.response_deadline_ms wall-clock
+ * deadline, keeping the part of the line generated so far.
+ */
+#define LLAMA_STOP_MIN_TOKENS 24        /* Budget for a message of a few words */
+#define LLAMA_STOP_BYTES_PER_TOKEN 2    /* About twice the tokens of the message */
+
+struct llama_stop {
+    int budget;                         /* Tokens the response may take */
+    double deadline;                    /* llm_time_ms() to stop at, 0 for none */
+    int strings;                        /* Check config.stop_strings (responses only) */
+};
+
+/* Budget for a response to source, from start (llm_time_ms()) of the call */
+static inline void llama_stop_init(nagi_llm_t *llm, struct llama_stop *stop,
+                                   const char *source, int max_tokens, double start)
+{
+    stop->budget = LLAMA_STOP_MIN_TOKENS +
+                   (source ? (int)strlen(source) : 0) / LLAMA_STOP_BYTES_PER_TOKEN;
+    if (stop->budget > max_tokens) stop->budget = max_tokens;
+    stop->deadline = llm->config.response_deadline_ms > 0 ?
+                     start + llm->config.response_deadline_ms : 0;
+    stop->strings = 1;
+}
+
+/*
+ * Offset of the first stop string in text, -1 for none
+ * *held gets the length of the end of text that could still become one.
+ */
+static inline int llama_stop_find(nagi_llm_t *llm, const char *text, int len, int *held)
+{
+    const char *list, *sep;
+    int i, n, k, cut = -1;
+
+    *held = 0;
+    for (list = llm->config.stop_strings; *list; list = *sep ? sep + 1 : sep) {
+        sep = strchr(list, '|');
+        if (!sep) sep = list + strlen(list);
+        n = (int)(sep - list);
+        if (n == 0) continue;
+
+        for (i = 0; i + n <= len && (cut < 0 || i < cut); i++) {
+            if (memcmp(text + i, list, n) == 0) {
+                cut = i;
+                break;
+            }
+        }
+        for (k = n - 1 < len ? n - 1 : len; k > *held; k--) {
+            if (memcmp(text + len - k, list, k) == 0) {
+                *held = k;
+                break;
+            }
+        }
+    }
+    return cut;
+}
+
+/*
+ * Check a response after a new token, text NUL terminated at *len
+ * A stop string found is cut off with what follows it (*len shrinks).
+ * Returns 1 if generation should stop.
+ */
+static inline int llama_stop_check(nagi_llm_t *llm, const struct llama_stop *stop,
+                                   char *text, int *len)
+{
+    const char *start;
+    int cut, held;
+
+    cut = stop->strings ? llama_stop_find(llm, text, *len, &held) : -1;
+    if (cut >= 0) {
+        *len = cut;
+        text[cut] = '\0';
+        return 1;
+    }
+
+    if (stop->deadline > 0 && llm_time_ms() >= stop->deadline) {
+        if (llm->config.verbose) {
+            llm_log(LLM_LOG_DEBUG, "LLM: Response deadline of %d ms reached, keeping %d bytes\n",
+                                   llm->config.response_deadline_ms, *len);
+        }
+        return 1;
+    }
+
+    /* A complete first line, after the "Translate:" some models put first */
+    start = strstr(text, "Translate:");
+    start = start ? start + 10 : text;
+    while (*start == ' ' || *start == '\n' || *start == '\r' || *start == '\t') {
+        start++;
+    }
+    return *start && strpbrk(start, "\r\n") != NULL;
+}
+
+/*
+ * Length of a response that can be streamed, holding back an end that
+ * may turn out to be a stop string
+ */
+static inline int llama_stop_stream_len(nagi_llm_t *llm, const char *text, int len)
+{
+    int held;
+
+    llama_stop_find(llm, text, len, &held);
+    return len - held;
+}
+
+/*
+ * Work buffers shared by every request of an llm instance
+ * Allocated once at init so the request paths do no heap allocation.
+ * Backend calls are serialized by the worker lock, so one set is enough;
+ * a function must be done with the tokens before calling a helper that
+ * tokenizes (prefix cache, language detection).
+ */
+#define LLAMA_ARENA_STEP_TOKENS 8       /* One token for each sequence */
+
+struct llm_arena {
+    llama_token *tokens;                /* n_tokens entries, a full context */
+    int n_tokens;
+    struct llama_batch batch;           /* Prompt decoding, batch_size tokens */
+    struct llama_batch step;            /* Generation, LLAMA_ARENA_STEP_TOKENS tokens */
+    struct llama_prompt prompt[LLAMA_PROMPT_COUNT];
+    struct llama_prompt_shared shared;  /* Hole values across the templates */
+    char language_input[256];           /* Input whose language extraction settled */
+};
+
+/*
+ * Allocate the work buffers once the context exists
+ * Returns 1 on success, 0 on failure
+ */
+static inline int llama_common_arena_init(nagi_llm_t *llm)
+{
+    llm_state_t *state = llm->state;
+    struct llm_arena *arena;
+    int i;
+
+    arena = (struct llm_arena *)calloc(1, sizeof(struct llm_arena));
+    if (!arena) return 0;
+
+    arena->n_tokens = llama_n_ctx(state->ctx);
+    arena->tokens = (llama_token *)malloc(arena->n_tokens * sizeof(llama_token));
+    if (!arena->tokens) {
+        free(arena);
+        return 0;
+    }
+    arena->batch = llama_batch_init(llm->config.batch_size, 0, 1);
+    arena->step = llama_batch_init(LLAMA_ARENA_STEP_TOKENS, 0, 1);
+
+    /* The prompts every backend uses, tokenized while the model loads */
+    llama_prompt_compile(llm, state->model, &arena->prompt[LLAMA_PROMPT_EXTRACTION],
+                         llm->extraction_prompt_template);
+    llama_prompt_compile(llm, state->model, &arena->prompt[LLAMA_PROMPT_EXTRACTION_SIMPLE],
+                         llm->extraction_prompt_simple);
+    llama_prompt_compile(llm, state->model, &arena->prompt[LLAMA_PROMPT_DETECT],
+                         LANGUAGE_DETECTION_PROMPT);
+    llama_prompt_compile(llm, state->model, &arena->prompt[LLAMA_PROMPT_MATCH],
+                         SEMANTIC_MATCHING_PROMPT);
+    llama_prompt_compile(llm, state->model, &arena->prompt[LLAMA_PROMPT_RESPONSE],
+                         RESPONSE_GENERATION_PROMPT);
+    if (llm->config.combined_extraction) {
+        llama_prompt_compile(llm, state->model, &arena->prompt[LLAMA_PROMPT_EXTRACTION_COMBINED],
+                             EXTRACTION_PROMPT_COMBINED);
+    }
+    /* Set after compiling, the check's probe values aren't worth sharing */
+    for (i = 0; i < LLAMA_PROMPT_COUNT; i++) {
+        arena->prompt[i].shared = &arena->shared;
+    }
+
+    state->arena = arena;
+    return 1;
+}
+
+/*
+ * Compiled template for format, compiled again if the backend's
+ * extraction prompts were swapped since
+ */
+static inline struct llama_prompt *llama_common_prompt(nagi_llm_t *llm, int id, const char *format)
+{
+    struct llama_prompt *prompt = &llm->state->arena->prompt[id];
+
+    if (prompt->format != format) {
+        llama_prompt_compile(llm, llm->state->model, prompt, format);
+        prompt->shared = &llm->state->arena->shared;
+    }
+    return prompt;
+}
+
+static inline void llama_common_arena_free(llm_state_t *state)
+{
+    int i;
+
+    if (!state->arena) return;
+
+    for (i = 0; i < LLAMA_PROMPT_COUNT; i++) {
+        llama_prompt_free(&state->arena->prompt[i]);
+    }
+    llama_prompt_shared_free(&state->arena->shared);
+
+    llama_batch_free(state->arena->batch);
+    llama_batch_free(state->arena->step);
+    free(state->arena->tokens);
+    free(state->arena);
+    state->arena = NULL;
+}
+
+/*
+ * Model load progress callback, set in llama_model_params
+ * Returning false makes llama.cpp abort the load (shutdown during load)
+ */
+static inline bool llama_common_load_progress(float progress, void *user_data)
+{
+    return llm_load_progress((nagi_llm_t *)user_data, progress) != 0;
+}
+
+/*
+ * llama.cpp abort callback, set on every context of the instance
+ * A cancelled async request stops between compute graph nodes, so a long
+ * prompt decode doesn't run to the end for nothing.
+ */
+static inline bool llama_common_abort(void *user_data)
+{
+    return nagi_llm_async_cancelled((nagi_llm_t *)user_data) != 0;
+}
+
+/*
+ * Token counter for the game context budget, userdata is the model
+ */
+static inline int llama_common_count_tokens(const char *text, int len, void *userdata)
+{
+    /* With no room for tokens llama.cpp returns minus the count */
+    int n = LLAMA_TOKENIZE((struct llama_model *)userdata, text, len, NULL, 0);
+    return n < 0 ? -n : n;
+}
+
+/*
+ * Measure the game context with this model, and give it a quarter of the context
+ */
+static inline void llama_common_context_attach(nagi_llm_t *llm)
+{
+    llm_context_set_token_counter(llm->session, llama_common_count_tokens, llm->state->model);
+    llm_context_set_token_budget(llm->session, (int)llama_n_ctx(llm->state->ctx) / 4);
+}
+
+static inline void llama_common_context_detach(nagi_llm_t *llm)
+{
+    llm_context_set_token_counter(llm->session, NULL, NULL);
+    llm_context_set_token_budget(llm->session, 0);
+}
+
+/*
+ * KV cache layout under config.memory_budget_mb
+ * The budget covers the model weights, the KV cache and a fixed allowance
+ * for the compute buffers; the context shrinks until the cache fits.
+ */
+#define LLAMA_COMMON_COMPUTE_RESERVE_MB 256
+#define LLAMA_COMMON_CTX_ALIGN 256      /* Context sizes stay a multiple of this */
+#define LLAMA_COMMON_MIN_CTX 1024       /* Below this the extraction prompts no longer fit */
+#define LLAMA_COMMON_REQUEST_SEQS 8     /* Prefix cache plus work sequences */
+#define LLAMA_COMMON_EXTRA_SEQ_CTX 2048 /* Smallest context that keeps more sequences */
+
+static inline const char *llama_common_kv_type_name(nagi_llm_kv_type_t type)
+{
+    switch (type) {
+        case NAGI_LLM_KV_Q8_0: return "q8_0";
+        case NAGI_LLM_KV_Q4_0: return "q4_0";
+        default: return "f16";
+    }
+}
+
+static inline enum ggml_type llama_common_kv_ggml_type(nagi_llm_kv_type_t type)
+{
+    switch (type) {
+        case NAGI_LLM_KV_Q8_0: return GGML_TYPE_Q8_0;
+        case NAGI_LLM_KV_Q4_0: return GGML_TYPE_Q4_0;
+        default: return GGML_TYPE_F16;
+    }
+}
+
+/* Bytes per cached element, quantized types store 32 values per block */
+static inline double llama_common_kv_type_size(nagi_llm_kv_type_t type)
+{
+    switch (type) {
+        case NAGI_LLM_KV_Q8_0: return 34.0 / 32.0;
+        case NAGI_LLM_KV_Q4_0: return 18.0 / 32.0;
+        default: return 2.0;
+    }
+}
+
+/*
+ * Bytes of KV cache one context token takes with this model
+ */
+static inline double llama_common_kv_token_bytes(nagi_llm_t *llm, struct llama_model *model)
+{
+    double n_layer = LLAMA_N_LAYER(model);
+    double n_head = LLAMA_N_HEAD(model) > 0 ? LLAMA_N_HEAD(model) : 1;
+    double n_embd_kv = (double)LLAMA_N_EMBD(model) / n_head * LLAMA_N_HEAD_KV(model);
+
+    return n_layer * n_embd_kv * (llama_common_kv_type_size(llm->config.kv_type_k) +
+                                  llama_common_kv_type_size(llm->config.kv_type_v));
+}
+
+/*
+ * Set the KV cache types and fit config.context_size into the memory budget
+ * Called once the model is loaded, before the context is created
+ */
+static inline void llama_common_kv_layout(nagi_llm_t *llm, struct llama_model *model,
+                                          struct llama_context_params *ctx_params)
+{
+    double token_bytes, model_mb, room_mb, kv_mb;
+    int max_ctx;
+
+    /* Without flash attention llama.cpp refuses a quantized V cache */
+    if (llm->config.kv_type_v != NAGI_LLM_KV_F16 && !llm->config.flash_attn) {
+        fprintf(stderr, "LLM: kv_type_v %s needs flash_attn, using f16\n",
+                llama_common_kv_type_name(llm->config.kv_type_v));
+        llm->config.kv_type_v = NAGI_LLM_KV_F16;
+    }
+#ifdef NAGI_LLM_HAS_BITNET
+    if (llm->config.kv_type_v != NAGI_LLM_KV_F16) {
+        ctx_params->flash_attn = true;
+    }
+#endif
+
+    token_bytes = llama_common_kv_token_bytes(llm, model);
+    model_mb = (double)llama_model_size(model) / (1024.0 * 1024.0);
+
+    if (llm->config.memory_budget_mb > 0 && token_bytes > 0) {
+        room_mb = llm->config.memory_budget_mb - model_mb - LLAMA_COMMON_COMPUTE_RESERVE_MB;
+        max_ctx = room_mb > 0 ? (int)(room_mb * 1024.0 * 1024.0 / token_bytes) : 0;
+        max_ctx -= max_ctx % LLAMA_COMMON_CTX_ALIGN;
+
+        if (llm->config.context_size > max_ctx) {
+            if (max_ctx < LLAMA_COMMON_MIN_CTX) {
+                fprintf(stderr, "LLM: memory_budget_mb %d is too small for this model, "
+                        "using a %d token context\n", llm->config.memory_budget_mb,
+                        LLAMA_COMMON_MIN_CTX);
+                max_ctx = LLAMA_COMMON_MIN_CTX;
+            }
+            llm->config.context_size = max_ctx;
+        }
+
+        /* Extra sequences (the game context) hold their cells for good */
+        if (llm->config.context_size < LLAMA_COMMON_EXTRA_SEQ_CTX &&
+            llm->config.n_seq_max > LLAMA_COMMON_REQUEST_SEQS) {
+            llm->config.n_seq_max = LLAMA_COMMON_REQUEST_SEQS;
+        }
+    }
+
+    ctx_params->type_k = llama_common_kv_ggml_type(llm->config.kv_type_k);
+    ctx_params->type_v = llama_common_kv_ggml_type(llm->config.kv_type_v);
+    ctx_params->n_ctx = llm->config.context_size;
+    ctx_params->n_seq_max = llm->config.n_seq_max;
+
+    if (llm->config.verbose) {
+        /* One line, so another thread's can't land in the middle */
+        char budget[32] = "";
+
+        kv_mb = token_bytes * llm->config.context_size / (1024.0 * 1024.0);
+        if (llm->config.memory_budget_mb > 0) {
+            snprintf(budget, sizeof(budget), ", budget %d MB", llm->config.memory_budget_mb);
+        }
+        llm_log(LLM_LOG_DEBUG, "LLM: KV cache %d tokens x %d sequences, K %s V %s, %.0f MB (model %.0f MB%s)\n",
+                               llm->config.context_size, llm->config.n_seq_max,
+                               llama_common_kv_type_name(llm->config.kv_type_k),
+                               llama_common_kv_type_name(llm->config.kv_type_v), kv_mb, model_mb, budget);
+    }
+}
+
+/*
+ * CPU placement
+ *
+ * Decoding on a CPU-only box is bound by the cores, not by their SMT
+ * siblings: two ggml threads on one core share its vector units and each
+ * runs at about half speed. Thread counts of 0 in the config follow the
+ * physical cores, and config.pin_threads keeps the decoding thread to one
+ * logical CPU per core. ggml starts its compute threads from the thread
+ * that decodes and they inherit its affinity, so pinning that thread
+ * places them all. config.reserve_cores leaves the first cores out of
+ * both, the game's interpreter and audio run there without a decode
+ * thread taking turns with them. Linux only, elsewhere the scheduler
+ * decides.
+ */
+
+#if defined(__linux__)
+#define LLAMA_CPU_PLACEMENT 1
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+#define LLAMA_CPU_MAX 1024
+#define LLAMA_CPU_WORD (8 * (int)sizeof(unsigned long))
+
+/* Affinity mask in the kernel's layout, for the raw syscalls */
+struct llama_cpu_set {
+    unsigned long bits[LLAMA_CPU_MAX / (8 * sizeof(unsigned long))];
+};
+
+#define LLAMA_CPU_ISSET(set, cpu) (((set)->bits[(cpu) / LLAMA_CPU_WORD] >> ((cpu) % LLAMA_CPU_WORD)) & 1)
+#define LLAMA_CPU_SET(set, cpu) ((set)->bits[(cpu) / LLAMA_CPU_WORD] |= 1UL << ((cpu) % LLAMA_CPU_WORD))
+
+#ifdef LLAMA_CPU_PLACEMENT
+/*
+ * Lowest CPU of cpu's core that allowed holds, from the sysfs sibling list
+ * ("0,8" or "0-1"). Returns cpu itself when the topology can't be read.
+ */
+static inline int llama_cpu_first_sibling(int cpu, const struct llama_cpu_set *allowed)
+{
+    char path[96], list[128];
+    const char *p;
+    FILE *f;
+    int first, lo, hi, c;
+
+    snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", cpu);
+    f = fopen(path, "r");
+    if (!f) return cpu;
+    p = fgets(list, sizeof(list), f);
+    fclose(f);
+    if (!p) return cpu;
+
+    first = cpu;
+    while (*p) {
+        if (sscanf(p, "%d", &lo) != 1) break;
+        hi = lo;
+        while (isdigit((unsigned char)*p)) p++;
+        if (*p == '-') {
+            p++;
+            if (sscanf(p, "%d", &hi) != 1) break;
+            while (isdigit((unsigned char)*p)) p++;
+        }
+        for (c = lo; c <= hi && c < first; c++) {
+            if (c >= 0 && c < LLAMA_CPU_MAX && LLAMA_CPU_ISSET(allowed, c)) {
+                first = c;
+            }
+        }
+        if (*p != ',') break;
+        p++;
+    }
+    return first;
+}
+#endif
+
+/*
+ * One logical CPU per physical core among those the process may run on,
+ * past the config.reserve_cores first ones (all of them if that would
+ * leave none). Returns the number of cores, 0 when that isn't known.
+ */
+static inline int llama_cpu_physical(nagi_llm_t *llm, struct llama_cpu_set *set)
+{
+#ifdef LLAMA_CPU_PLACEMENT
+    struct llama_cpu_set allowed, kept;
+    int cpu, n = 0, skip = 0, total = 0;
+
+    memset(set, 0, sizeof(*set));
+    memset(&kept, 0, sizeof(kept));
+    memset(&allowed, 0, sizeof(allowed));
+    if (syscall(SYS_sched_getaffinity, 0, sizeof(allowed.bits), allowed.bits) <= 0) {
+        return 0;
+    }
+    for (cpu = 0; cpu < LLAMA_CPU_MAX; cpu++) {
+        if (LLAMA_CPU_ISSET(&allowed, cpu) && llama_cpu_first_sibling(cpu, &allowed) == cpu) {
+            LLAMA_CPU_SET(set, cpu);
+            total++;
+        }
+    }
+    if (llm->config.reserve_cores > 0 && llm->config.reserve_cores < total) {
+        skip = llm->config.reserve_cores;
+    }
+    for (cpu = 0; cpu < LLAMA_CPU_MAX; cpu++) {
+        if (!LLAMA_CPU_ISSET(set, cpu)) continue;
+        if (skip > 0) {
+            skip--;
+            continue;
+        }
+        LLAMA_CPU_SET(&kept, cpu);
+        n++;
+    }
+    *set = kept;
+    return n;
+#else
+    (void)llm;
+    memset(set, 0, sizeof(*set));
+    return 0;
+#endif
+}
+
+/*
+ * Generation and prompt batch threads for a context
+ * Generation reads the whole model once per token and stops scaling with
+ * memory bandwidth, prompt batches are compute bound, so the two are set
+ * apart; 0 in the config gives one thread per physical core.
+ */
+static inline void llama_cpu_threads(nagi_llm_t *llm, struct llama_context_params *params)
+{
+    struct llama_cpu_set set;
+    int cores = llama_cpu_physical(llm, &set);
+
+    if (cores <= 0) cores = NAGI_LLM_DEFAULT_THREADS;
+    params->n_threads = llm->config.n_threads > 0 ? llm->config.n_threads : cores;
+    params->n_threads_batch = llm->config.n_threads_batch > 0 ? llm->config.n_threads_batch : cores;
+}
+
+/*
+ * Pin the calling thread to one logical CPU per physical core
+ * Done once per thread, before its first decode, when config.pin_threads
+ * is set. A context with a threadpool of its own places its threads
+ * itself and leaves the caller where it is.
+ */
+static inline void llama_cpu_pin(nagi_llm_t *llm)
+{
+#ifdef LLAMA_CPU_PLACEMENT
+    static _Thread_local int pinned;
+    struct llama_cpu_set set;
+    int cores;
+
+    if (!llm->config.pin_threads || pinned || llm->state->threadpool) return;
+    pinned = 1;
+
+    cores = llama_cpu_physical(llm, &set);
+    if (cores <= 0) return;
+    if (syscall(SYS_sched_setaffinity, 0, sizeof(set.bits), set.bits) != 0) {
+        fprintf(stderr, "LLM: Could not pin decode thread to physical cores\n");
+        return;
+    }
+    if (llm->config.verbose) {
+        llm_log(LLM_LOG_DEBUG, "LLM: Decode thread pinned to %d physical cores\n", cores);
+    }
+#else
+    (void)llm;
+#endif
+}
+
+/*
+ * NUMA interleave
+ *
+ * config.numa = interleave spreads one model over every node of a
+ * multi-socket machine. ggml's threads go round the nodes, and while the
+ * model loads and the contexts and compute threads are made, pages go to
+ * one node after another. Every thread then reads a share of the weights
+ * and KV cache locally instead of one socket's memory serving them all.
+ * The compute threads started meanwhile keep the policy. nagi-llm-server
+ * with numa = replicas binds a whole instance to each node instead, see
+ * tools/nagi_llm_server.c.
+ */
+static inline int llama_common_numa_begin(nagi_llm_t *llm)
+{
+    if (llm->config.numa != NAGI_LLM_NUMA_INTERLEAVE || llm_numa_nodes(NULL) < 2) return 0;
+
+    llama_numa_init(GGML_NUMA_STRATEGY_DISTRIBUTE);
+    if (!llm_numa_interleave()) {
+        llm_log(LLM_LOG_WARN, "LLM: Memory can't be interleaved over the NUMA nodes\n");
+        return 0;
+    }
+    llm_log(LLM_LOG_INFO, "LLM: Model interleaved over %d NUMA nodes\n", llm_numa_nodes(NULL));
+    return 1;
+}
+
+/* The loading thread's own memory goes back to where the kernel puts it */
+static inline void llama_common_numa_end(int interleaved)
+{
+    if (interleaved) llm_numa_reset();
+}
+
+/*
+ * Huge pages
+ *
+ * Every token walks gigabytes of weights and KV cache, and with 4 KB pages
+ * a good share of decode time goes to TLB misses. config.huge_pages asks
+ * for transparent huge pages once the contexts exist: on the model file's
+ * mappings (the page cache keeps them in huge pages on kernels with
+ * CONFIG_READ_ONLY_THP_FOR_FS) and on every large anonymous mapping, which
+ * is where ggml keeps the KV cache, the weights without use_mmap and the
+ * compute buffers, and where malloc puts the library's big arenas.
+ * MADV_COLLAPSE (Linux 6.1) makes what is there huge at once, older
+ * kernels leave it to khugepaged and to pages touched later. llama.cpp
+ * does its own mmap, so MAP_HUGETLB isn't an option; whatever the kernel
+ * refuses stays in small pages. Linux only.
+ */
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#ifndef MADV_COLLAPSE
+#define MADV_COLLAPSE 25
+#endif
+#endif
+
+#define LLAMA_HUGE_MIN_BYTES (32ul << 20)   /* Smaller anonymous mappings are left as they are */
+#define LLAMA_HUGE_RANGES 256
+
+/* MB of the process in huge pages */
+static inline int llama_huge_pages_mb(void)
+{
+#if defined(__linux__)
+    char line[256];
+    long kb, total = 0;
+    FILE *f;
+
+    f = fopen("/proc/self/smaps_rollup", "r");
+    if (!f) return 0;
+    while (fgets(line, sizeof(line), f)) {
+        if (sscanf(line, "AnonHugePages: %ld", &kb) == 1 ||
+            sscanf(line, "FilePmdMapped: %ld", &kb) == 1) {
+            total += kb;
+        }
+    }
+    fclose(f);
+    return (int)(total / 1024);
+#else
+    return 0;
+#endif
+}
+
+static inline void llama_huge_pages(nagi_llm_t *llm)
+{
+#if defined(__linux__)
+    unsigned long start[LLAMA_HUGE_RANGES], len[LLAMA_HUGE_RANGES];
+    unsigned long lo, hi, inode;
+    unsigned int dev_major, dev_minor;
+    double t0, advised = 0.0;
+    char line[512], perms[8];
+    struct stat st;
+    int i, n = 0, name, model;
+    FILE *f;
+
+    llm->state->huge_pages_mb = 0;
+    if (!llm->config.huge_pages) return;
+
+    t0 = llm_time_ms();
+    model = llm->config.use_mmap && stat(llm->config.model_path, &st) == 0;
+
+    /* The ranges first, advising splits mappings under the reader */
+    f = fopen("/proc/self/maps", "r");
+    if (!f) return;
+    while (n < LLAMA_HUGE_RANGES && fgets(line, sizeof(line), f)) {
+        name = 0;
+        if (sscanf(line, "%lx-%lx %7s %*s %x:%x %lu %n", &lo, &hi, perms, &dev_major, &dev_minor,
+                   &inode, &name) < 6 || perms[0] != 'r') {
+            continue;
+        }
+        if (inode != 0) {
+            if (!model || inode != (unsigned long)st.st_ino ||
+                makedev(dev_major, dev_minor) != st.st_dev) {
+                continue;
+            }
+        } else if (perms[1] != 'w' || hi - lo < LLAMA_HUGE_MIN_BYTES ||
+                   (name > 0 && line[name] == '[' && strncmp(line + name, "[heap]", 6) != 0)) {
+            continue;
+        }
+        start[n] = lo;
+        len[n] = hi - lo;
+        n++;
+    }
+    fclose(f);
+
+    for (i = 0; i < n; i++) {
+        if (madvise((void *)start[i], len[i], MADV_HUGEPAGE) != 0) continue;
+        advised += (double)len[i];
+        madvise((void *)start[i], len[i], MADV_COLLAPSE);
+    }
+
+    llm->state->huge_pages_mb = llama_huge_pages_mb();
+    llm_log(LLM_LOG_INFO, "LLM: %d MB in huge pages, %.0f MB asked for (%.0f ms)\n",
+                          llm->state->huge_pages_mb, advised / (1024.0 * 1024.0), llm_time_ms() - t0);
+#else
+    llm->state->huge_pages_mb = 0;
+#endif
+}
+
+/*
+ * Decode engine
+ *
+ * The tokenize, decode and sample steps every request goes through, on
+ * top of the LLAMA_* macros so llamacpp and bitnet run the same code. The
+ * requests themselves (extraction, matching, response generation) are at
+ * the end of this file; the backends only add what needs the newer API
+ * (game context, speculative decoding, batching).
+ */
+
+/* Sequence 0 holds the cached prompt prefix, requests rotate over 1-7 */
+#define LLAMA_PREFIX_SEQ 0
+#define LLAMA_WORK_SEQS 7
+#define LLAMA_NEXT_SEQ(state) (1 + ((state)->seq_counter++) % LLAMA_WORK_SEQS)
+#define LLAMA_DETECT_SEQ 7              /* Language detection, the last work sequence */
+
+/* Longest response, adventure game replies are a line or two */
+#define LLAMA_RESPONSE_TOKENS 150
+#define LLAMA_EXTRACT_TOKENS 10
+#define LLAMA_LANGUAGE_TOKENS 4         /* The language name and '|' of a combined extraction */
+
+/*
+ * Tokenize text with the main model, timed for the telemetry
+ */
+static inline int llama_common_tokenize(nagi_llm_t *llm, const char *text, int len,
+                                        llama_token *tokens, int n_max, bool add_special)
+{
+    double start = llm_time_ms();
+    int n;
+
+    n = LLAMA_TOKENIZE_SPECIAL(llm->state->model, text, len, tokens, n_max, add_special);
+    llm_stats_stage(llm, LLM_STATS_TOKENIZE, llm_time_ms() - start, 0);
+    return n;
+}
+
+/*
+ * Decode tokens into a sequence of ctx starting at position pos0.
+ * Only the last token requests logits when want_logits is set.
+ * Returns 1 on success, 0 on failure.
+ */
+static inline int llama_common_decode_ctx(nagi_llm_t *llm, struct llama_context *ctx,
+                                          const llama_token *tokens, int n_tokens,
+                                          int pos0, int seq, int want_logits)
+{
+    struct llama_batch batch;
+    int i, k, n_eval;
+
+    llama_cpu_pin(llm);
+    batch = llm->state->arena->batch;
+    for (i = 0; i < n_tokens; i += llm->config.batch_size) {
+        n_eval = n_tokens - i;
+        if (n_eval > llm->config.batch_size) n_eval = llm->config.batch_size;
+
+        batch.n_tokens = n_eval;
+        for (k = 0; k < n_eval; k++) {
+            batch.token[k] = tokens[i + k];
+            batch.pos[k] = pos0 + i + k;
+            batch.n_seq_id[k] = 1;
+            batch.seq_id[k][0] = seq;
+            batch.logits[k] = false;
+        }
+        if (want_logits && i + n_eval == n_tokens) {
+            batch.logits[n_eval - 1] = true;
+        }
+
+        if (llama_decode(ctx, batch) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Decode tokens into a sequence of the main context, timed as prompt
+ */
+static inline int llama_common_decode(nagi_llm_t *llm, const llama_token *tokens, int n_tokens,
+                                      int pos0, int seq, int want_logits)
+{
+    double start = llm_time_ms();
+    int ok;
+
+    ok = llama_common_decode_ctx(llm, llm->state->ctx, tokens, n_tokens, pos0, seq, want_logits);
+    llm_stats_stage(llm, LLM_STATS_PROMPT, llm_time_ms() - start, n_tokens);
+    return ok;
+}
+
+/*
+ * Hash prompt text (djb2) to detect when the cached prefix is out of date
+ */
+static inline unsigned long llama_common_hash_text(const char *text, size_t len)
+{
+    unsigned long hash = 5381;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash = ((hash << 5) + hash) + (unsigned char)text[i];
+    }
+    return hash;
+}
+
+/* 64-bit FNV-1a of len bytes, carried on from hash */
+static inline uint64_t llama_common_hash64(uint64_t hash, const void *data, size_t len)
+{
+    const unsigned char *p = (const unsigned char *)data;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= p[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+/*
+ * File of a decoded prefix in config.prompt_cache_dir. The name carries
+ * what the KV values depend on: the model (path, parameters and size),
+ * the LoRA adapter and its scale, and the prefix text, which covers both
+ * the prompt template and the dictionary it was filled with. The file
+ * keeps the tokens too, which are compared before it is used.
+ */
+static inline void llama_common_prefix_path(nagi_llm_t *llm, const char *prefix, size_t prefix_len,
+                                            char *path, size_t size)
+{
+    llm_state_t *state = llm->state;
+    uint64_t model = 14695981039346656037ULL, text;
+    uint64_t n_params = llama_model_n_params(state->model);
+    uint64_t model_size = llama_model_size(state->model);
+
+    model = llama_common_hash64(model, llm->config.model_path, strlen(llm->config.model_path) + 1);
+    model = llama_common_hash64(model, &n_params, sizeof(n_params));
+    model = llama_common_hash64(model, &model_size, sizeof(model_size));
+    model = llama_common_hash64(model, state->adapter_path, strlen(state->adapter_path) + 1);
+    model = llama_common_hash64(model, &state->adapter_scale, sizeof(state->adapter_scale));
+    text = llama_common_hash64(14695981039346656037ULL, prefix, prefix_len);
+    snprintf(path, size, "%s/prefix-%016llx-%016llx.kv", llm->config.prompt_cache_dir,
+             (unsigned long long)model, (unsigned long long)text);
+}
+
+/*
+ * Load a saved prefix into the reserved sequence if it holds exactly
+ * these tokens. Returns 1 if it does.
+ */
+static inline int llama_common_prefix_load(nagi_llm_t *llm, const char *path,
+                                           const llama_token *tokens, int n_tokens)
+{
+    llm_state_t *state = llm->state;
+    llama_token *saved;
+    size_t n_saved = 0;
+    int ok;
+
+    saved = (llama_token *)malloc((size_t)state->arena->n_tokens * sizeof(llama_token));
+    if (!saved) return 0;
+    ok = llama_state_seq_load_file(state->ctx, path, LLAMA_PREFIX_SEQ, saved,
+                                   (size_t)state->arena->n_tokens, &n_saved) > 0 &&
+         n_saved == (size_t)n_tokens &&
+         memcmp(saved, tokens, (size_t)n_tokens * sizeof(llama_token)) == 0;
+    free(saved);
+
+    if (!ok) {
+        LLAMA_KV_CLEAR(state->ctx, LLAMA_PREFIX_SEQ, -1, -1);
+        if (n_saved > 0 && llm->config.verbose) {
+            llm_log(LLM_LOG_DEBUG, "LLM: Saved prompt prefix %s is out of date\n", path);
+        }
+    }
+    return ok;
+}
+
+/*
+ * Make sure the reserved sequence holds the given prompt prefix.
+ * The prefix is only re-decoded when its text changes (new dictionary,
+ * or switching between extraction and semantic matching). With
+ * config.prompt_cache_dir set, decoded prefixes are saved there and
+ * loaded back instead of decoded, on the next run too.
+ * Returns the number of prefix tokens, or 0 if it could not be cached.
+ */
+static inline int llama_common_prefix_get(nagi_llm_t *llm, const char *prefix, size_t prefix_len)
+{
+    llm_state_t *state = llm->state;
+    llama_token *tokens;
+    unsigned long hash;
+    int n_prefix_tokens;
+    char path[NAGI_LLM_MAX_MODEL_PATH + 64];
+
+    hash = llama_common_hash_text(prefix, prefix_len);
+    if (state->prefix_n_tokens > 0 && state->prefix_hash == hash) {
+        llm_stats_hit(llm, LLM_STATS_KV_REUSE);
+        return state->prefix_n_tokens;
+    }
+
+    LLAMA_KV_CLEAR(state->ctx, LLAMA_PREFIX_SEQ, -1, -1);
+    state->prefix_n_tokens = 0;
+
+    tokens = state->arena->tokens;
+    n_prefix_tokens = llama_common_tokenize(llm, prefix, (int)prefix_len, tokens,
+                                            state->arena->n_tokens, true);
+    if (n_prefix_tokens <= 0) return 0;
+
+    /* Tokenizing is cheap next to decoding, and tells a stale file apart */
+    if (llm->config.prompt_cache_dir[0] != '\0') {
+        llama_common_prefix_path(llm, prefix, prefix_len, path, sizeof(path));
+        if (llama_common_prefix_load(llm, path, tokens, n_prefix_tokens)) {
+            state->prefix_n_tokens = n_prefix_tokens;
+            state->prefix_hash = hash;
+            llm_stats_hit(llm, LLM_STATS_KV_REUSE);
+            if (llm->config.verbose) {
+                llm_log(LLM_LOG_DEBUG, "LLM: Loaded prompt prefix into seq %d (%d tokens) from %s\n",
+                                       LLAMA_PREFIX_SEQ, n_prefix_tokens, path);
+            }
+            return n_prefix_tokens;
+        }
+    }
+
+    if (!llama_common_decode(llm, tokens, n_prefix_tokens, 0, LLAMA_PREFIX_SEQ, 0)) {
+        LLAMA_KV_CLEAR(state->ctx, LLAMA_PREFIX_SEQ, -1, -1);
+        return 0;
+    }
+
+    state->prefix_n_tokens = n_prefix_tokens;
+    state->prefix_hash = hash;
+
+    if (llm->config.prompt_cache_dir[0] != '\0' &&
+        llama_state_seq_save_file(state->ctx, path, LLAMA_PREFIX_SEQ, tokens, (size_t)n_prefix_tokens) == 0) {
+        llm_log(LLM_LOG_WARN, "LLM: Could not save the prompt prefix to %s\n", path);
+    }
+
+    if (llm->config.verbose) {
+        llm_log(LLM_LOG_DEBUG, "LLM: Cached prompt prefix in seq %d (%d tokens)\n",
+                               LLAMA_PREFIX_SEQ, n_prefix_tokens);
+    }
+
+    return n_prefix_tokens;
+}
+
+/*
+ * Append a generated token to the response and stream it.
+ * Returns 0 when generation should stop (end of generation, output full,
+ * a stop condition, or the callback asked to stop).
+ */
+static inline int llama_common_emit(nagi_llm_t *llm, const struct llama_stop *stop, llama_token token,
+                                    char *output, int output_size, int *response_len, int *emitted,
+                                    nagi_llm_token_cb_t on_token, void *userdata)
+{
+    struct llama_model *model = llm->state->model;
+    char piece[64];
+    int piece_len, done;
+
+    if (LLAMA_IS_EOG(model, token) || nagi_llm_async_cancelled(llm)) {
+        return 0;
+    }
+
+    piece_len = LLAMA_TOKEN_TO_PIECE(model, token, piece, sizeof(piece));
+    if (piece_len > 0 && *response_len + piece_len < output_size - 1) {
+        memcpy(output + *response_len, piece, piece_len);
+        *response_len += piece_len;
+    }
+    output[*response_len] = '\0';
+
+    done = llama_stop_check(llm, stop, output, response_len);
+    if (!llm_stream_emit(output, done ? *response_len : llama_stop_stream_len(llm, output, *response_len),
+                         emitted, on_token, userdata)) {
+        return 0;
+    }
+    return !done && *response_len < output_size - 1;
+}
+
+/*
+ * Index of the largest logit, the token temperature 0 picks
+ * Eight running maxima the compiler keeps in one vector register, then a
+ * pass that stops at the first logit equal to the winner. No sort, no
+ * softmax, unlike a top_k/top_p/temp/dist chain.
+ */
+static inline llama_token llama_common_argmax(const float *logits, int n_vocab)
+{
+    float lane[8], best;
+    int i, j;
+
+    for (j = 0; j < 8; j++) lane[j] = -INFINITY;
+    for (i = 0; i + 8 <= n_vocab; i += 8) {
+        for (j = 0; j < 8; j++) {
+            lane[j] = logits[i + j] > lane[j] ? logits[i + j] : lane[j];
+        }
+    }
+    best = lane[0];
+    for (j = 1; j < 8; j++) {
+        if (lane[j] > best) best = lane[j];
+    }
+    for (; i < n_vocab; i++) {
+        if (logits[i] > best) best = logits[i];
+    }
+
+    for (i = 0; i < n_vocab; i++) {
+        if (logits[i] == best) return i;
+    }
+    return 0;
+}
+
+/*
+ * Build the sampler chains from the config, freeing the old ones
+ * At init, and again when nagi_llm_apply_config changes the sampling
+ * settings (the backends' reconfigure).
+ */
+static inline void llama_common_samplers_init(nagi_llm_t *llm)
+{
+    llm_state_t *state = llm->state;
+    uint32_t seed;
+    float creative_temp;
+
+    if (state->sampler) {
+        llama_sampler_free(state->sampler);
+    }
+    if (state->sampler_creative) {
+        llama_sampler_free(state->sampler_creative);
+    }
+
+    /* Random seed for variety */
+    seed = (uint32_t)time(NULL) ^ (uint32_t)((uintptr_t)state);
+
+    /* Create sampler for extraction/semantic (deterministic) */
+    state->sampler = llama_sampler_chain_init(llama_sampler_chain_default_params());
+    llama_sampler_chain_add(state->sampler, llama_sampler_init_top_k(llm->config.top_k));
+    llama_sampler_chain_add(state->sampler, llama_sampler_init_top_p(llm->config.top_p, 1));
+    llama_sampler_chain_add(state->sampler, llama_sampler_init_temp(llm->config.temperature));
+    llama_sampler_chain_add(state->sampler, llama_sampler_init_dist(seed));
+
+    /* Create sampler for response generation (creative with randomized temperature) */
+    creative_temp = llm->config.temperature_creative_base +
+                    ((float)(seed % 100) / 100.0f) * llm->config.temperature_creative_offset;
+    state->sampler_creative = llama_sampler_chain_init(llama_sampler_chain_default_params());
+    llama_sampler_chain_add(state->sampler_creative, llama_sampler_init_top_k(40));
+    llama_sampler_chain_add(state->sampler_creative, llama_sampler_init_top_p(0.9f, 1));
+    llama_sampler_chain_add(state->sampler_creative, llama_sampler_init_temp(creative_temp));
+    llama_sampler_chain_add(state->sampler_creative, llama_sampler_init_dist(seed + 1));
+
+    if (llm->config.verbose) {
+        llm_log(LLM_LOG_DEBUG, "LLM Sampler: seed=%u, creative_temp=%.2f\n", seed, creative_temp);
+    }
+}
+
+/*
+ * Sampler for the deterministic tasks (extraction, language detection,
+ * batched responses): NULL for plain argmax while config.temperature is 0,
+ * which is always unless set otherwise. The chain has no repetition
+ * penalty, so greedy tokens need no accept either.
+ */
+static inline struct llama_sampler *llama_common_task_sampler(nagi_llm_t *llm)
+{
+    return llm->config.temperature > 0.0f ? llm->state->sampler : NULL;
+}
+
+/*
+ * Next token from the logits at idx (-1 for the last), accepted into the
+ * sampler, or greedy when sampler is NULL
+ */
+static inline llama_token llama_common_sample(struct llama_model *model, struct llama_context *ctx,
+                                              struct llama_sampler *sampler, int idx)
+{
+    llama_token token;
+
+    if (!sampler) {
+        return llama_common_argmax(llama_get_logits_ith(ctx, idx), LLAMA_N_VOCAB(model));
+    }
+    token = llama_sampler_sample(sampler, ctx, idx);
+    llama_sampler_accept(sampler, token);
+    return token;
+}
+
+/*
+ * Sample into output until a stop condition, one decode per token
+ * Expects the prompt decoded into seq up to position pos, with logits on
+ * its last token. A NULL sampler is greedy. Returns the length of output
+ * (NUL terminated).
+ */
+static inline int llama_common_generate(nagi_llm_t *llm, struct llama_sampler *sampler, int seq,
+                                        int pos, const struct llama_stop *stop,
+                                        char *output, int output_size,
+                                        nagi_llm_token_cb_t on_token, void *userdata)
+{
+    llm_state_t *state = llm->state;
+    struct llama_batch step;
+    llama_token token;
+    int response_len, emitted, gen_count;
+    double start;
+
+    response_len = 0;
+    emitted = 0;
+    gen_count = 0;
+    output[0] = '\0';
+    step = state->arena->step;
+
+    start = llm_time_ms();
+    while (gen_count < stop->budget) {
+        token = llama_common_sample(state->model, state->ctx, sampler, -1);
+
+        if (!llama_common_emit(llm, stop, token, output, output_size, &response_len, &emitted,
+                               on_token, userdata)) {
+            break;
+        }
+
+        step.n_tokens = 1;
+        step.token[0] = token;
+        step.pos[0] = pos + gen_count;
+        step.n_seq_id[0] = 1;
+        step.seq_id[0][0] = seq;
+        step.logits[0] = true;
+
+        if (llama_decode(state->ctx, step) != 0) {
+            break;
+        }
+        gen_count++;
+    }
+    llm_stats_stage(llm, LLM_STATS_GENERATE, llm_time_ms() - start, gen_count);
+
+    return response_len;
+}
+
+/*
+ * Keep only the translation line of a generated response (first line or
+ * after "Translate:"), trimmed in place. Returns the new length.
+ */
+static inline int llama_common_clean_response(char *output)
+{
+    char *translate_marker, *start, *end, *check;
+
+    /* Extract only the translation line (first line or after "Translate:") */
+    translate_marker = strstr(output, "Translate:");
+    start = translate_marker ? translate_marker + 10 : output;
+
+    /* Skip whitespace */
+    while (*start == ' ' || *start == '\n' || *start == '\r' || *start == '\t') {
+        start++;
+    }
+
+    /* Find end of first line */
+    end = start;
+    while (*end && *end != '\n' && *end != '\r') {
+        end++;
+    }
+    *end = '\0';
+
+    /* Remove trailing whitespace and punctuation artifacts */
+    end--;
+    while (end > start && (*end == ' ' || *end == '\t' || *end == '?' || *end == '!')) {
+        if (*end == '?' || *end == '!') {
+            /* Keep if it's the only punctuation at the end */
+            check = end - 1;
+            if (check > start && (*check == '?' || *check == '!')) {
+                *end = '\0';
+                end--;
+            } else {
+                break;
+            }
+        } else {
+            *end = '\0';
+            end--;
+        }
+    }
+
+    /* Move to output buffer */
+    if (start != output) {
+        memmove(output, start, strlen(start) + 1);
+    }
+    return (int)strlen(output);
+}
+
+/*
+ * Record the language name the model answered with, validated
+ */
+static inline void llama_common_language_store(nagi_llm_t *llm, const char *p)
+{
+    if (strncmp(p, "English", 7) == 0) {
+        llm_language_store(llm, "English");
+    } else if (strncmp(p, "Spanish", 7) == 0) {
+        llm_language_store(llm, "Spanish");
+    } else if (strncmp(p, "French", 6) == 0) {
+        llm_language_store(llm, "French");
+    } else if (strncmp(p, "German", 6) == 0) {
+        llm_language_store(llm, "German");
+    } else if (strncmp(p, "Italian", 7) == 0) {
+        llm_language_store(llm, "Italian");
+    } else if (strncmp(p, "Portuguese", 10) == 0) {
+        llm_language_store(llm, "Portuguese");
+    } else if (strncmp(p, "Russian", 7) == 0) {
+        llm_language_store(llm, "Russian");
+    } else if (strncmp(p, "Japanese", 8) == 0) {
+        llm_language_store(llm, "Japanese");
+    } else if (strncmp(p, "Chinese", 7) == 0) {
+        llm_language_store(llm, "Chinese");
+    } else if (strlen(p) > 2 && strlen(p) < 32) {
+        llm_language_store(llm, p);
+    } else {
+        llm_language_store(llm, "English");
+    }
+}
+
+/*
+ * Remember that the session language is settled for input, so detection
+ * doesn't look at the same line again (config.combined_extraction)
+ */
+static inline void llama_common_language_settled(nagi_llm_t *llm, const char *input)
+{
+    struct llm_arena *arena = llm->state->arena;
+
+    if (strlen(input) < sizeof(arena->language_input)) {
+        strcpy(arena->language_input, input);
+    }
+}
+
 /*
  * Detect language from user input - shared implementation
  */
-static inline const char *llama_common_detect_language(nagi_llm_t *llm, const char *input,
-                                                       struct llama_model *model,
-                                                       struct llama_context *ctx,
-                                                       struct llama_sampler *sampler)
+static inline const char *llama_common_detect_language_model(nagi_llm_t *llm, const char *input,
+                                                             struct llama_model *model,
+                                                             struct llama_context *ctx,
+                                                             struct llama_sampler *sampler)
 {
     llm_state_t *state;
-    char prompt[512];
+    const char *values[1];
     int n_tokens, n_prompt_tokens;
     llama_token *tokens;
     int lang_seq;
-    struct llama_batch batch;
     char detected[64];
     int detected_len;
     int i;
+    double start;
     
     state = llm->state;
     
@@ -58,60 +1725,50 @@ static inline const char *llama_common_detect_language(nagi_llm_t *llm, const ch
         return state->detected_language[0] ? state->detected_language : "English";
     }
 
-    snprintf(prompt, sizeof(prompt), LANGUAGE_DETECTION_PROMPT, input);
+    /* Most inputs are in the session language, only ask the model on doubt */
+    if (strcmp(state->arena->language_input, input) == 0 || llm_language_lookup(llm, input)) {
+        llm_stats_hit(llm, LLM_STATS_CACHE_HIT);
+        return state->detected_language;
+    }
+
+    values[0] = input;
 
-    n_tokens = llama_n_ctx(ctx);
-    tokens = (llama_token *)malloc(n_tokens * sizeof(llama_token));
+    n_tokens = state->arena->n_tokens;
+    tokens = state->arena->tokens;
     
-    /* Tokenize */
-    n_prompt_tokens = LLAMA_TOKENIZE(model, prompt, (int)strlen(prompt), tokens, n_tokens);
+    /* Tokenize, only the input is new */
+    n_prompt_tokens = llama_prompt_tokenize(llm, model,
+                                            llama_common_prompt(llm, LLAMA_PROMPT_DETECT,
+                                                                LANGUAGE_DETECTION_PROMPT),
+                                            values, 0, false, tokens, n_tokens);
     
     if (n_prompt_tokens < 0) {
-        free(tokens);
         return "English";
     }
 
-    /* Use dedicated sequence 7 for language detection */
-    lang_seq = 7;
+    /* Language detection has a work sequence of its own */
+    lang_seq = LLAMA_DETECT_SEQ;
     
     /* Clear KV cache */
     LLAMA_KV_CLEAR(ctx, lang_seq, -1, -1);
 
-    batch = llama_batch_init(llm->config.batch_size, 0, 1);
-    for (i = 0; i < n_prompt_tokens; i += llm->config.batch_size) {
-        int n_eval = n_prompt_tokens - i;
-        int k;
-        if (n_eval > llm->config.batch_size) n_eval = llm->config.batch_size;
-
-        batch.n_tokens = n_eval;
-        for (k = 0; k < n_eval; k++) {
-            batch.token[k] = tokens[i + k];
-            batch.pos[k] = i + k;
-            batch.n_seq_id[k] = 1;
-            batch.seq_id[k][0] = lang_seq;
-            batch.logits[k] = (i + k == n_prompt_tokens - 1);
-        }
-
-        if (llama_decode(ctx, batch) != 0) {
-            llama_batch_free(batch);
-            free(tokens);
-            return "English";
-        }
+    start = llm_time_ms();
+    if (!llama_common_decode_ctx(llm, ctx, tokens, n_prompt_tokens, 0, lang_seq, 1)) {
+        return "English";
     }
-    llama_batch_free(batch);
-    free(tokens);
+    llm_stats_stage(llm, LLM_STATS_PROMPT, llm_time_ms() - start, n_prompt_tokens);
 
     /* Sample language name with greedy decoding */
     detected[0] = '\0';
     detected_len = 0;
+    start = llm_time_ms();
     
     for (i = 0; i < 15 && detected_len < 60; i++) {
         llama_token lang_token;
         char piece[16];
         int piece_len;
         
-        lang_token = llama_sampler_sample(sampler, ctx, -1);
-        llama_sampler_accept(sampler, lang_token);
+        lang_token = llama_common_sample(model, ctx, sampler, -1);
         
         /* Check for end of generation */
         if (LLAMA_IS_EOG(model, lang_token)) break;
@@ -127,6 +1784,7 @@ static inline const char *llama_common_detect_language(nagi_llm_t *llm, const ch
             if (strchr(piece, '\n')) break;
         }
     }
+    llm_stats_stage(llm, LLM_STATS_GENERATE, llm_time_ms() - start, i);
     char *p;
     char *end;
     
@@ -138,34 +1796,11 @@ static inline const char *llama_common_detect_language(nagi_llm_t *llm, const ch
     end = p + strlen(p) - 1;
     while (end > p && (*end == ' ' || *end == '\n' || *end == '.')) *end-- = '\0';
     
-    /* Validate it's a known language */
-    if (strncmp(p, "English", 7) == 0) {
-        strcpy(state->detected_language, "English");
-    } else if (strncmp(p, "Spanish", 7) == 0) {
-        strcpy(state->detected_language, "Spanish");
-    } else if (strncmp(p, "French", 6) == 0) {
-        strcpy(state->detected_language, "French");
-    } else if (strncmp(p, "German", 6) == 0) {
-        strcpy(state->detected_language, "German");
-    } else if (strncmp(p, "Italian", 7) == 0) {
-        strcpy(state->detected_language, "Italian");
-    } else if (strncmp(p, "Portuguese", 10) == 0) {
-        strcpy(state->detected_language, "Portuguese");
-    } else if (strncmp(p, "Russian", 7) == 0) {
-        strcpy(state->detected_language, "Russian");
-    } else if (strncmp(p, "Japanese", 8) == 0) {
-        strcpy(state->detected_language, "Japanese");
-    } else if (strncmp(p, "Chinese", 7) == 0) {
-        strcpy(state->detected_language, "Chinese");
-    } else if (strlen(p) > 2 && strlen(p) < 32) {
-        strcpy(state->detected_language, p);
-    } else {
-        strcpy(state->detected_language, "English");
-    }
+    llama_common_language_store(llm, p);
 
     if (llm->config.verbose) {
-        printf("Language detected: '%s' from input: '%s'\n", 
-               state->detected_language, input);
+        llm_log(LLM_LOG_DEBUG, "Language detected: '%s' from input: '%s'\n", 
+                               state->detected_language, input);
     }
 
     /* Clear language detection sequence */
@@ -174,4 +1809,502 @@ static inline const char *llama_common_detect_language(nagi_llm_t *llm, const ch
     return state->detected_language;
 }
 
+/*
+ * Detect language from user input, counted as its own operation
+ */
+static inline const char *llama_common_detect_language(nagi_llm_t *llm, const char *input,
+                                                       struct llama_model *model,
+                                                       struct llama_context *ctx,
+                                                       struct llama_sampler *sampler)
+{
+    llm_stats_call_t call = llm_stats_begin(llm, NAGI_LLM_OP_DETECT, llm_time_ms());
+    const char *language;
+
+    language = llama_common_detect_language_model(llm, input, model, ctx, sampler);
+    llm_stats_end(llm, call);
+    return language;
+}
+
+/*
+ * Read a yes/no answer straight from the logits of a decoded prompt
+ *
+ * @param idx: Batch index of the token whose logits were requested
+ * @return: Probability of "yes" against "no" (0.0-1.0), or -1.0 on failure
+ */
+static inline float llama_common_yes_probability(struct llama_model *model,
+                                                 struct llama_context *ctx, int idx)
+{
+    llama_token yes_token, no_token;
+    float *logits;
+
+    /* The answer is the first token after the assistant marker */
+    if (LLAMA_TOKENIZE(model, "yes", 3, &yes_token, 1) != 1 ||
+        LLAMA_TOKENIZE(model, "no", 2, &no_token, 1) != 1) {
+        return -1.0f;
+    }
+
+    logits = llama_get_logits_ith(ctx, idx);
+    if (!logits) return -1.0f;
+
+    return 1.0f / (1.0f + expf(logits[no_token] - logits[yes_token]));
+}
+
+/*
+ * Greedy sampler over a grammar starting at rule root, NULL if it won't build
+ */
+static inline struct llama_sampler *llama_common_grammar_chain(struct llama_model *model,
+                                                               const char *text, const char *root)
+{
+    struct llama_sampler *grammar, *chain;
+
+    grammar = LLAMA_SAMPLER_INIT_GRAMMAR(model, text, root);
+    if (!grammar) return NULL;
+
+    /* Grammar first so greedy picks among dictionary words only */
+    chain = llama_sampler_chain_init(llama_sampler_chain_default_params());
+    llama_sampler_chain_add(chain, grammar);
+    llama_sampler_chain_add(chain, llama_sampler_init_greedy());
+    return chain;
+}
+
+/*
+ * Get the sampler that restricts extraction output to the dictionary grammar
+ * Rebuilt whenever the dictionary changes, reset on every call. With
+ * combined set, the answer starts with a language name and '|' (see
+ * config.combined_extraction).
+ *
+ * @return: Sampler (owned by state), or NULL if there is no usable grammar
+ */
+static inline struct llama_sampler *llama_common_grammar_sampler(nagi_llm_t *llm,
+                                                                 struct llama_model *model,
+                                                                 int combined)
+{
+    static const char combined_rules[] = "combined ::= [A-Z] [a-z]+ \"|\" root\n";
+    llm_state_t *state = llm->state;
+    struct llama_sampler *sampler;
+    char *text;
+    size_t len;
+
+    if (state->grammar_sampler_version != state->grammar_version) {
+        if (state->grammar_sampler) {
+            llama_sampler_free(state->grammar_sampler);
+            state->grammar_sampler = NULL;
+        }
+        if (state->grammar_sampler_combined) {
+            llama_sampler_free(state->grammar_sampler_combined);
+            state->grammar_sampler_combined = NULL;
+        }
+        state->grammar_sampler_version = state->grammar_version;
+
+        if (state->extraction_grammar) {
+            state->grammar_sampler = llama_common_grammar_chain(model, state->extraction_grammar, "root");
+            if (!state->grammar_sampler) {
+                fprintf(stderr, "LLM: Could not build the extraction grammar, output is unconstrained\n");
+            }
+        }
+        if (state->grammar_sampler && llm->config.combined_extraction) {
+            len = strlen(state->extraction_grammar);
+            text = (char *)malloc(sizeof(combined_rules) + len);
+            if (text) {
+                memcpy(text, combined_rules, sizeof(combined_rules) - 1);
+                memcpy(text + sizeof(combined_rules) - 1, state->extraction_grammar, len + 1);
+                state->grammar_sampler_combined = llama_common_grammar_chain(model, text, "combined");
+                free(text);
+            }
+        }
+    }
+
+    sampler = combined ? state->grammar_sampler_combined : state->grammar_sampler;
+    if (sampler) {
+        llama_sampler_reset(sampler);
+    }
+    return sampler;
+}
+
+/*
+ * Build the "verb noun" command for a said() word list.
+ * Returns 0 if none of the words are in the dictionary.
+ */
+static inline int llama_common_expected_command(nagi_llm_t *llm, const int *expected_word_ids,
+                                                int expected_count, char *out, size_t out_size)
+{
+    const char *word_str;
+    size_t len;
+    int i;
+
+    out[0] = '\0';
+    len = 0;
+    for (i = 0; i < expected_count; i++) {
+        word_str = get_word_string(llm, expected_word_ids[i]);
+        if (!word_str) continue;
+
+        len += snprintf(out + len, out_size - len, "%s%s", len ? " " : "", word_str);
+        if (len >= out_size) {
+            out[out_size - 1] = '\0';
+            break;
+        }
+    }
+    return out[0] != '\0';
+}
+
+/*
+ * Extract verb and noun from user input (EXTRACTION mode)
+ */
+static inline const char *llama_common_extract_words(nagi_llm_t *llm, const char *input,
+                                                     char *out, int out_size)
+{
+    char head[NAGI_LLM_MAX_PROMPT_SIZE];
+    char text[NAGI_LLM_MAX_PROMPT_SIZE];
+    int n_prompt_tokens, n_past, n_holes;
+    int current_seq;
+    llama_token *tokens;
+    const char *verbs;
+    const char *values[LLAMA_PROMPT_MAX_HOLES];
+    struct llama_prompt *prompt;
+    struct llama_stop stop;
+    size_t split, skip;
+    llm_state_t *state;
+    struct llama_sampler *sampler, *combined_sampler;
+    int i;
+    int use_prefix, combined;
+    bool add_special;
+    char *trimmed, *end, *bar;
+
+    if (!nagi_llm_ready(llm)) return input;
+    if (!input || input[0] == '\0') return input;
+
+    state = llm->state;
+
+    /*
+     * With the dictionary grammar the model can only answer with game words,
+     * and a game's LoRA adapter has learned them, so either way the verb list
+     * doesn't need to be in the prompt at all.
+     */
+    sampler = llama_common_grammar_sampler(llm, state->model, 0);
+    verbs = (sampler || state->adapter) ? NULL : extract_game_verbs(llm);
+
+    /*
+     * When the language would take a model call of its own, the short
+     * prompt asks for it in the same answer, "<language>|<verb noun>"
+     */
+    combined = 0;
+    if (llm->config.combined_extraction && (!verbs || verbs[0] == '\0')) {
+        combined_sampler = sampler ? llama_common_grammar_sampler(llm, state->model, 1) : NULL;
+        if (!sampler || combined_sampler) {
+            if (llm_language_lookup(llm, input)) {
+                llama_common_language_settled(llm, input);
+            } else {
+                combined = 1;
+                sampler = combined_sampler;
+            }
+        }
+    }
+
+    /* Extraction prompt with vocabulary context: verb list holes, then the input */
+    use_prefix = 1;
+    if (combined) {
+        prompt = llama_common_prompt(llm, LLAMA_PROMPT_EXTRACTION_COMBINED, EXTRACTION_PROMPT_COMBINED);
+    } else if ((sampler || state->adapter) && llm->extraction_prompt_simple) {
+        prompt = llama_common_prompt(llm, LLAMA_PROMPT_EXTRACTION_SIMPLE,
+                                     llm->extraction_prompt_simple);
+    } else if (verbs && verbs[0] != '\0' && llm->extraction_prompt_template) {
+        prompt = llama_common_prompt(llm, LLAMA_PROMPT_EXTRACTION, llm->extraction_prompt_template);
+    } else if (llm->extraction_prompt_simple) {
+        prompt = llama_common_prompt(llm, LLAMA_PROMPT_EXTRACTION_SIMPLE,
+                                     llm->extraction_prompt_simple);
+        use_prefix = 0;
+    } else {
+        return input;
+    }
+
+    n_holes = llama_prompt_holes_before(prompt->format, strlen(prompt->format));
+    if (n_holes < 1 || n_holes > LLAMA_PROMPT_MAX_HOLES) return input;
+    for (i = 0; i < n_holes - 1; i++) {
+        values[i] = verbs ? verbs : "";
+    }
+    values[n_holes - 1] = input;
+
+    if (!sampler) sampler = llama_common_task_sampler(llm);
+    current_seq = LLAMA_NEXT_SEQ(state);
+
+    if (llm->config.verbose) {
+        llm_log(LLM_LOG_DEBUG, "\n=== LLM Extraction ===\n");
+        llm_log(LLM_LOG_DEBUG, "Input: \"%s\"\n", input);
+        llm_log(LLM_LOG_DEBUG, "Using sequence ID: %d\n", current_seq);
+    }
+
+    /* Clear KV cache for this sequence */
+    LLAMA_KV_CLEAR(state->ctx, current_seq, -1, -1);
+
+    /*
+     * Everything up to the line holding the input only depends on the verb
+     * list, so it lives in seq 0 and gets copied instead of re-decoded.
+     */
+    n_past = 0;
+    skip = 0;
+    add_special = true;
+    split = llama_prompt_line_start(prompt, n_holes - 1);
+    if (use_prefix && split < sizeof(head)) {
+        int len;
+
+        memcpy(head, prompt->format, split);
+        head[split] = '\0';
+        len = llama_prompt_fill(head, values, text, sizeof(text));
+        n_past = len >= 0 ? llama_common_prefix_get(llm, text, (size_t)len) : 0;
+        if (n_past > 0) {
+            LLAMA_KV_COPY(state->ctx, LLAMA_PREFIX_SEQ, current_seq, -1, -1);
+            add_special = false;
+            skip = split;
+        }
+    }
+
+    /* Tokenize the rest of the prompt, the static lines come precompiled */
+    tokens = state->arena->tokens;
+    n_prompt_tokens = llama_prompt_tokenize(llm, state->model, prompt, values, skip, add_special,
+                                            tokens, state->arena->n_tokens - n_past);
+    if (n_prompt_tokens < 0) {
+        return input;
+    }
+
+    if (llm->config.verbose) {
+        llm_log(LLM_LOG_DEBUG, "Processing prompt: %d tokens (%d reused from prefix)\n", n_prompt_tokens, n_past);
+    }
+
+    /* Process prompt in batches */
+    if (!llama_common_decode(llm, tokens, n_prompt_tokens, n_past, current_seq, 1)) {
+        return input;
+    }
+
+    /* Generate the English words, a finished grammar only allows end of generation */
+    stop.budget = LLAMA_EXTRACT_TOKENS + (combined ? LLAMA_LANGUAGE_TOKENS : 0);
+    stop.deadline = 0;
+    stop.strings = 0;
+    llama_common_generate(llm, sampler, current_seq, n_past + n_prompt_tokens, &stop,
+                          out, out_size, NULL, NULL);
+
+    /* Normalize: trim whitespace and lowercase */
+    trimmed = out;
+    while (*trimmed == ' ' || *trimmed == '\n' || *trimmed == '\r' || *trimmed == '\t') {
+        trimmed++;
+    }
+    end = trimmed + strlen(trimmed) - 1;
+    while (end > trimmed && (*end == ' ' || *end == '\n' || *end == '\r' || *end == '\t')) {
+        *end-- = '\0';
+    }
+
+    /* The language goes to the session, the words on as usual */
+    bar = combined ? strchr(trimmed, '|') : NULL;
+    if (bar) {
+        *bar = '\0';
+        llama_common_language_store(llm, trimmed);
+        llama_common_language_settled(llm, input);
+        trimmed = bar + 1;
+        while (*trimmed == ' ') trimmed++;
+    }
+
+    /* Convert to lowercase */
+    for (i = 0; trimmed[i]; i++) {
+        trimmed[i] = tolower((unsigned char)trimmed[i]);
+    }
+
+    if (llm->config.verbose) {
+        llm_log(LLM_LOG_DEBUG, "Extracted: \"%s\"\n", trimmed);
+        llm_log(LLM_LOG_DEBUG, "===================\n\n");
+    }
+
+    /* Copy trimmed result back to start of buffer */
+    if (trimmed != out) {
+        memmove(out, trimmed, strlen(trimmed) + 1);
+    }
+
+    return out;
+}
+
+/*
+ * Check whether an input matches an expected AGI word list
+ * Uses semantic matching: asks LLM "does input match command?"
+ * The answer is classified from the "yes"/"no" logits of the prompt and
+ * compared against config.match_threshold.
+ * Returns NAGI_LLM_MATCH_YES, _NO, or _ERROR if the model couldn't answer
+ */
+static inline int llama_common_matches_expected(nagi_llm_t *llm, const char *input,
+                                                const int *expected_word_ids, int expected_count)
+{
+    char expected_command[256];
+    const char *values[2];
+    int n_prompt_tokens;
+    int current_seq;
+    llama_token *tokens;
+    llm_state_t *state;
+    float p_yes;
+
+    if (!nagi_llm_ready(llm)) return NAGI_LLM_MATCH_ERROR;
+    if (expected_count == 0) return NAGI_LLM_MATCH_NO;
+
+    /* Build expected command string from word IDs */
+    if (!llama_common_expected_command(llm, expected_word_ids, expected_count,
+                                       expected_command, sizeof(expected_command))) {
+        return NAGI_LLM_MATCH_NO;
+    }
+
+    state = llm->state;
+
+    /* Use rotating sequence IDs to avoid KV cache conflicts */
+    current_seq = LLAMA_NEXT_SEQ(state);
+
+    if (llm->config.verbose) {
+        llm_log(LLM_LOG_DEBUG, "\n=== LLM Matching ===\n");
+        llm_log(LLM_LOG_DEBUG, "User input: \"%s\"\n", input);
+        llm_log(LLM_LOG_DEBUG, "Expected: \"%s\"\n", expected_command);
+        llm_log(LLM_LOG_DEBUG, "Using sequence ID: %d\n", current_seq);
+    }
+
+    /* Clear KV cache for this sequence before use */
+    LLAMA_KV_CLEAR(state->ctx, current_seq, -1, -1);
+
+    /* Tokenize the semantic matching prompt, only the two holes are new */
+    tokens = state->arena->tokens;
+    values[0] = expected_command;
+    values[1] = input;
+    n_prompt_tokens = llama_prompt_tokenize(llm, state->model,
+                                            llama_common_prompt(llm, LLAMA_PROMPT_MATCH,
+                                                                SEMANTIC_MATCHING_PROMPT),
+                                            values, 0, true, tokens, state->arena->n_tokens);
+    if (n_prompt_tokens <= 0) {
+        return NAGI_LLM_MATCH_ERROR;
+    }
+
+    if (llm->config.verbose) {
+        llm_log(LLM_LOG_DEBUG, "Processing prompt: %d tokens\n", n_prompt_tokens);
+    }
+    if (!llama_common_decode(llm, tokens, n_prompt_tokens, 0, current_seq, 1)) {
+        if (llm->config.verbose) {
+            llm_log(LLM_LOG_DEBUG, "ERROR: llama_decode failed during prompt processing\n");
+        }
+        return NAGI_LLM_MATCH_ERROR;
+    }
+
+    /* Classify from the logits of the last prompt token, nothing is sampled */
+    p_yes = llama_common_yes_probability(state->model, state->ctx, -1);
+    if (p_yes < 0.0f) {
+        if (llm->config.verbose) {
+            llm_log(LLM_LOG_DEBUG, "Result: ERROR (no yes/no logits)\n===================\n\n");
+        }
+        return NAGI_LLM_MATCH_ERROR;
+    }
+
+    if (llm->config.verbose) {
+        llm_log(LLM_LOG_DEBUG, "Result: %s (p(yes)=%.3f, threshold=%.2f)\n===================\n\n",
+                               p_yes >= llm->config.match_threshold ? "MATCH" : "NO MATCH",
+                               p_yes, llm->config.match_threshold);
+    }
+    return p_yes >= llm->config.match_threshold;
+}
+
+/*
+ * Decode the response prompt for game_response into seq
+ * The first n_past tokens of seq are already there, covering the template
+ * up to offset skip (the game context of llamacpp). Leaves the logits of
+ * the last prompt token. Returns the position of the first generated
+ * token, 0 on failure.
+ */
+static inline int llama_common_response_prompt(nagi_llm_t *llm, const char *game_response,
+                                               const char *user_input, int seq,
+                                               int n_past, size_t skip)
+{
+    llm_state_t *state = llm->state;
+    const char *values[3];
+    int n_prompt_tokens;
+    llama_token *tokens;
+    const char *language;
+
+    /* Detect language if user provided input */
+    language = "English";
+    if (user_input && user_input[0] != '\0') {
+        language = llama_common_detect_language(llm, user_input, state->model, state->ctx,
+                                                llama_common_task_sampler(llm));
+    } else if (state->detected_language[0]) {
+        language = state->detected_language;
+    }
+
+    /* Prompt with explicit language, including user input for context */
+    values[0] = language;
+    values[1] = user_input ? user_input : "";
+    values[2] = game_response;
+
+    if (llm->config.verbose) {
+        llm_log(LLM_LOG_DEBUG, "Generating response in %s\n", language);
+        llm_log(LLM_LOG_DEBUG, "\n=== LLM Response Generation ===\n");
+        llm_log(LLM_LOG_DEBUG, "User input: \"%s\"\n", user_input);
+        llm_log(LLM_LOG_DEBUG, "Game response: \"%s\"\n", game_response);
+        llm_log(LLM_LOG_DEBUG, "Using sequence ID: %d\n", seq);
+    }
+
+    /* Tokenize prompt (add_special=false to avoid double BOS) */
+    tokens = state->arena->tokens;
+    n_prompt_tokens = llama_prompt_tokenize(llm, state->model,
+                                            llama_common_prompt(llm, LLAMA_PROMPT_RESPONSE,
+                                                                RESPONSE_GENERATION_PROMPT),
+                                            values, skip, false, tokens,
+                                            state->arena->n_tokens - n_past);
+    if (n_prompt_tokens <= 0) {
+        return 0;
+    }
+
+    if (!llama_common_decode(llm, tokens, n_prompt_tokens, n_past, seq, 1)) {
+        return 0;
+    }
+
+    return n_past + n_prompt_tokens;
+}
+
+/*
+ * Generate a game response using the LLM
+ * Translates game response to player's language and optionally adds context.
+ * on_token (optional) receives the first response line as it is generated.
+ */
+static inline int llama_common_generate_response_stream(nagi_llm_t *llm, const char *game_response,
+                                                        const char *user_input,
+                                                        char *output, int output_size,
+                                                        nagi_llm_token_cb_t on_token,
+                                                        void *userdata)
+{
+    llm_state_t *state;
+    struct llama_stop stop;
+    int current_seq, n_past, response_len;
+
+    if (!nagi_llm_ready(llm)) return 0;
+    if (!game_response || !user_input || !output || output_size <= 0) return 0;
+
+    state = llm->state;
+    llama_stop_init(llm, &stop, game_response, LLAMA_RESPONSE_TOKENS, llm_time_ms());
+
+    /* Clear KV cache completely for this sequence to prevent language contamination */
+    current_seq = LLAMA_NEXT_SEQ(state);
+    LLAMA_KV_CLEAR(state->ctx, current_seq, -1, -1);
+
+    n_past = llama_common_response_prompt(llm, game_response, user_input, current_seq, 0, 0);
+    if (n_past <= 0) {
+        return 0;
+    }
+
+    llama_common_generate(llm, state->sampler_creative, current_seq, n_past, &stop,
+                          output, output_size, on_token, userdata);
+    response_len = llama_common_clean_response(output);
+
+    if (llm->config.verbose && response_len > 0) {
+        llm_log(LLM_LOG_DEBUG, "Generated: \"%s\"\n", output);
+    }
+
+    return response_len;
+}
+
+static inline int llama_common_generate_response(nagi_llm_t *llm, const char *game_response,
+                                                 const char *user_input, char *output,
+                                                 int output_size)
+{
+    return llama_common_generate_response_stream(llm, game_response, user_input,
+                                                 output, output_size, NULL, NULL);
+}
+
 #endif /* LLAMA_COMMON_H */
@@ -14,13 +14,19 @@
 #include <stdbool.h>
 #include <stdint.h>
 #include <time.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
 
 #include "nagi_llm_llamacpp.h"
 #include "../../include/nagi_llm_context.h"
 #include "../../include/llm_utils.h"
+#include "../../include/llm_log.h"
 #include "../llama_common.h"
 
 #include "llama.h"
+#include "ggml-cpu.h"
 
 #include <stdint.h>
 #include <stddef.h>
@@ -28,412 +34,1968 @@
 /* Forward declarations */
 static int llamacpp_init(nagi_llm_t *llm, const char *model_path, const nagi_llm_config_t *config);
 static void llamacpp_shutdown(nagi_llm_t *llm);
-static const char *llamacpp_extract_words(nagi_llm_t *llm, const char *input);
 static const char *llamacpp_detect_language(nagi_llm_t *llm, const char *input);
+static int llamacpp_slots_busy(llm_state_t *state);
+
+/* After the engine's sequences (llama_common.h) the game context stays decoded in its own (needs n_seq_max > 8) */
+#define LLAMACPP_CONTEXT_SEQ 8
+#define LLAMACPP_CONTEXT_PREAMBLE START_OF_SYSTEM "Game context:\n"
+
+/* Upper bound for config.draft_tokens (speculative decoding) */
+#define LLAMACPP_MAX_DRAFT 16
+
+/* Context of the embedding matcher, tokens per input or said() phrase */
+#define LLAMACPP_EMBED_CTX 512
+
+/* Async generation slots use the sequences after the game context one */
+#define LLAMACPP_SLOT_SEQ (LLAMACPP_CONTEXT_SEQ + 1)
+#define LLAMACPP_MAX_SLOTS 8
+
+/* Context sections in the order they sit in the sequence, most stable first */
+static const llm_context_segment_id_t llamacpp_context_order[] = {
+    LLM_SEG_ROOM, LLM_SEG_INVENTORY, LLM_SEG_FLAGS, LLM_SEG_STATE, LLM_SEG_EVENTS
+};
+#define LLAMACPP_CONTEXT_SECTIONS \
+    ((int)(sizeof(llamacpp_context_order) / sizeof(llamacpp_context_order[0])))
+
+/*
+ * What the game context sequence holds, so a turn only decodes what changed
+ */
+struct llm_context_kv {
+    int valid;                                  /* Preamble decoded */
+    unsigned long hash[LLAMACPP_CONTEXT_SECTIONS];
+    int pos[LLAMACPP_CONTEXT_SECTIONS + 1];     /* Start of each section, then of the history */
+    int n_past;                                 /* Tokens in the sequence */
+    u32 epoch;                                  /* History epoch decoded */
+    nagi_llm_session_t *session;                /* Whose history, set again on load */
+    u32 first_serial;                           /* Oldest history entry decoded */
+    u32 next_serial;                            /* First history entry not decoded yet */
+    int entry_pos[LLM_MAX_HISTORY_ENTRIES];     /* Where each decoded entry starts, by serial */
+};
+
+/*
+ * The game context as it was when a sync started, copied under the
+ * context lock so the decoding runs without it and the game thread's
+ * flag and variable updates don't wait on llama_decode
+ */
+struct llm_context_copy {
+    char section[LLAMACPP_CONTEXT_SECTIONS][LLM_MAX_SEGMENT_SIZE];
+    int section_len[LLAMACPP_CONTEXT_SECTIONS];
+    int room;                                   /* Current room */
+    u32 epoch;                                  /* History epoch */
+    u32 next_serial;                            /* Serial of the next entry */
+    int count;                                  /* History entries, oldest first */
+    u32 serial[LLM_MAX_HISTORY_ENTRIES];
+    int tokens[LLM_MAX_HISTORY_ENTRIES];        /* Estimated where not counted */
+    int line_len[LLM_MAX_HISTORY_ENTRIES];
+    char line[LLM_MAX_HISTORY_ENTRIES][LLM_MAX_ENTRY_SIZE + 16];
+};
+
+/* Fill copy from the session. Called with the context lock held. */
+static void llamacpp_context_copy(nagi_llm_session_t *session, struct llm_context_copy *copy)
+{
+    const llm_context_t *ctx = llm_context_state(session);
+    const char *text;
+    int i, len;
+
+    for (i = 0; i < LLAMACPP_CONTEXT_SECTIONS; i++) {
+        text = llm_context_segment(session, llamacpp_context_order[i], &len);
+        if (len > LLM_MAX_SEGMENT_SIZE) len = LLM_MAX_SEGMENT_SIZE;
+        memcpy(copy->section[i], text, (size_t)len);
+        copy->section_len[i] = len;
+    }
+
+    copy->room = ctx->current_room;
+    copy->epoch = ctx->history_epoch;
+    copy->next_serial = ctx->history_serial;
+    copy->count = ctx->history_count;
+    for (i = 0; i < ctx->history_count; i++) {
+        const llm_context_entry_t *entry = &ctx->history[(ctx->history_head + i) % LLM_MAX_HISTORY_ENTRIES];
+
+        copy->serial[i] = entry->serial;
+        copy->tokens[i] = entry->tokens >= 0 ? entry->tokens
+                                             : (int)(strlen(llm_context_entry_text(session, entry)) + 3) / 4;
+        copy->line_len[i] = llm_context_format_entry(session, entry, copy->line[i], sizeof(copy->line[i]));
+    }
+}
+
+/*
+ * Pick the oldest history entry to keep when the history is decoded again
+ * The newest entries that fit half of room tokens are kept, so later
+ * turns have space to append.
+ */
+static u32 llamacpp_context_history_start(const struct llm_context_copy *copy, int room)
+{
+    int used = 0;
+    int i, count;
+    u32 start = copy->next_serial;
+
+    count = copy->count;
+    if (count > LLM_MAX_CONTEXT_EVENTS) count = LLM_MAX_CONTEXT_EVENTS;
+
+    for (i = 0; i < count; i++) {
+        int idx = copy->count - 1 - i;
+
+        if (used + copy->tokens[idx] > room / 2) break;
+        used += copy->tokens[idx];
+        start = copy->serial[idx];
+    }
+    return start;
+}
+
+/*
+ * Make room for n more history tokens by sliding the history along: the
+ * oldest decoded entries are removed with llama_memory_seq_rm and the rest
+ * moved back over them with llama_memory_seq_add, so nothing is decoded
+ * again. Keeps no more than half the history room, so the next turns only
+ * append. Not possible while a generation slot shares the sequence's
+ * cells, which the move would shift under it, or if the cache can't shift.
+ * Returns 1 if the entry fits now.
+ */
+static int llamacpp_context_shift(nagi_llm_t *llm, struct llm_context_kv *kv, int budget, int n)
+{
+    llm_state_t *state = llm->state;
+    llama_memory_t mem = llama_get_memory(state->ctx);
+    int start = kv->pos[LLAMACPP_CONTEXT_SECTIONS];
+    int room, keep, delta;
+    u32 serial;
+
+    if (!llama_memory_can_shift(mem) || llamacpp_slots_busy(state)) return 0;
+
+    room = (budget - start) / 2 - n;
+    if (room < 0) room = 0;
+
+    /* Older entries than the ring remembers go with the first one dropped */
+    serial = kv->first_serial;
+    if (kv->next_serial - serial > LLM_MAX_HISTORY_ENTRIES) {
+        serial = kv->next_serial - LLM_MAX_HISTORY_ENTRIES;
+    }
+    keep = kv->n_past;
+    for (; serial < kv->next_serial; serial++) {
+        if (kv->n_past - kv->entry_pos[serial % LLM_MAX_HISTORY_ENTRIES] <= room) {
+            keep = kv->entry_pos[serial % LLM_MAX_HISTORY_ENTRIES];
+            break;
+        }
+    }
+    delta = keep - start;
+    if (delta <= 0) return 0;
+
+    llama_memory_seq_rm(mem, LLAMACPP_CONTEXT_SEQ, start, keep);
+    llama_memory_seq_add(mem, LLAMACPP_CONTEXT_SEQ, keep, -1, -delta);
+    kv->first_serial = serial;
+    for (; serial < kv->next_serial; serial++) {
+        kv->entry_pos[serial % LLM_MAX_HISTORY_ENTRIES] -= delta;
+    }
+    kv->n_past -= delta;
+    llm_stats_hit(llm, LLM_STATS_KV_REUSE);
+
+    if (llm->config.verbose) {
+        llm_log(LLM_LOG_DEBUG, "LLM: Game context history shifted back %d tokens\n", delta);
+    }
+    return kv->n_past + n <= budget;
+}
+
+/*
+ * Return visits: the sequence as it was straight after a room's section
+ * (the preamble, then the room) is kept with the room number and the
+ * section's hash. Walking back into the room puts it back with
+ * llama_state_seq_set_data instead of decoding the description and
+ * objects again. Bounded by config.room_kv_cache_mb, least recently
+ * visited first.
+ */
+#define LLAMACPP_ROOM_KV_MAX 64
+
+struct llm_room_kv_entry {
+    int room;
+    unsigned long hash;
+    int pos;                                    /* Start of the room section */
+    int n_past;                                 /* End of it */
+    u32 used;
+    size_t size;
+    uint8_t *data;                              /* NULL if the entry is free */
+};
+
+struct llm_room_kv {
+    struct llm_room_kv_entry entry[LLAMACPP_ROOM_KV_MAX];
+    size_t bytes;
+    u32 stamp;
+};
+
+static void llamacpp_room_kv_drop(struct llm_room_kv *rooms, struct llm_room_kv_entry *e)
+{
+    if (!e->data) return;
+    free(e->data);
+    rooms->bytes -= e->size;
+    e->data = NULL;
+    e->size = 0;
+}
+
+static void llamacpp_room_kv_clear(llm_state_t *state)
+{
+    int i;
+
+    if (!state->room_kv) return;
+    for (i = 0; i < LLAMACPP_ROOM_KV_MAX; i++) {
+        llamacpp_room_kv_drop(state->room_kv, &state->room_kv->entry[i]);
+    }
+}
+
+/* The least recently visited room held, NULL if none is */
+static struct llm_room_kv_entry *llamacpp_room_kv_oldest(struct llm_room_kv *rooms)
+{
+    struct llm_room_kv_entry *oldest = NULL;
+    int i;
+
+    for (i = 0; i < LLAMACPP_ROOM_KV_MAX; i++) {
+        if (rooms->entry[i].data && (!oldest || rooms->entry[i].used < oldest->used)) {
+            oldest = &rooms->entry[i];
+        }
+    }
+    return oldest;
+}
+
+/* The room's section was just decoded, nothing after it yet */
+static void llamacpp_room_kv_store(nagi_llm_t *llm, struct llm_context_kv *kv, int room, unsigned long hash)
+{
+    llm_state_t *state = llm->state;
+    struct llm_room_kv *rooms = state->room_kv;
+    struct llm_room_kv_entry *e = NULL;
+    size_t cap, n;
+    int i;
+
+    if (!rooms) return;
+    cap = (size_t)llm->config.room_kv_cache_mb << 20;
+
+    /* A room whose description changed has one entry, the newest */
+    for (i = 0; i < LLAMACPP_ROOM_KV_MAX; i++) {
+        if (rooms->entry[i].data && rooms->entry[i].room == room) {
+            llamacpp_room_kv_drop(rooms, &rooms->entry[i]);
+        }
+    }
+
+    n = llama_state_seq_get_size(state->ctx, LLAMACPP_CONTEXT_SEQ);
+    if (n == 0 || n > cap / 4) return;
+
+    while (rooms->bytes + n > cap && (e = llamacpp_room_kv_oldest(rooms)) != NULL) {
+        llamacpp_room_kv_drop(rooms, e);
+    }
+    e = NULL;
+    for (i = 0; i < LLAMACPP_ROOM_KV_MAX && !e; i++) {
+        if (!rooms->entry[i].data) e = &rooms->entry[i];
+    }
+    if (!e) {
+        e = llamacpp_room_kv_oldest(rooms);
+        llamacpp_room_kv_drop(rooms, e);
+    }
+
+    e->data = (uint8_t *)malloc(n);
+    if (!e->data) return;
+    e->size = llama_state_seq_get_data(state->ctx, e->data, n, LLAMACPP_CONTEXT_SEQ);
+    if (e->size == 0) {
+        free(e->data);
+        e->data = NULL;
+        return;
+    }
+    e->room = room;
+    e->hash = hash;
+    e->pos = kv->pos[0];
+    e->n_past = kv->n_past;
+    e->used = ++rooms->stamp;
+    rooms->bytes += e->size;
+}
+
+/*
+ * Put the room's section back if it was kept with the same text. The
+ * sequence then holds the preamble and the room and nothing else.
+ * Returns 1 if it did.
+ */
+static int llamacpp_room_kv_restore(nagi_llm_t *llm, struct llm_context_kv *kv, int room, unsigned long hash)
+{
+    llm_state_t *state = llm->state;
+    struct llm_room_kv *rooms = state->room_kv;
+    struct llm_room_kv_entry *e = NULL;
+    llama_memory_t mem;
+    int i;
+
+    if (!rooms) return 0;
+    for (i = 0; i < LLAMACPP_ROOM_KV_MAX && !e; i++) {
+        if (rooms->entry[i].data && rooms->entry[i].room == room && rooms->entry[i].hash == hash) {
+            e = &rooms->entry[i];
+        }
+    }
+    if (!e) return 0;
+
+    mem = llama_get_memory(state->ctx);
+    llama_memory_seq_rm(mem, LLAMACPP_CONTEXT_SEQ, -1, -1);
+    if (llama_state_seq_set_data(state->ctx, e->data, e->size, LLAMACPP_CONTEXT_SEQ) == 0) {
+        llama_memory_seq_rm(mem, LLAMACPP_CONTEXT_SEQ, -1, -1);
+        llamacpp_room_kv_drop(rooms, e);
+        kv->valid = 0;
+        return 0;
+    }
+    kv->pos[0] = e->pos;
+    kv->n_past = e->n_past;
+    kv->valid = 1;
+    e->used = ++rooms->stamp;
+    llm_stats_hit(llm, LLM_STATS_KV_REUSE);
+
+    if (llm->config.verbose) {
+        llm_log(LLM_LOG_DEBUG, "LLM: Room %d context restored (%d tokens)\n", room, e->n_past);
+    }
+    return 1;
+}
+
+/*
+ * Bring the game context sequence up to date
+ * Sections are compared by hash. The first that changed (the room, most
+ * of the time) and everything after it is dropped with llama_memory_seq_rm
+ * and decoded again, the room's section from a snapshot of a visit before
+ * if there is one. New history entries are only appended; when they
+ * outgrow the budget the oldest ones are shifted out, or if that can't be
+ * done the history restarts from the newest entries.
+ * The context is copied under its lock first and decoded from the copy,
+ * so the lock is never held across llama_decode.
+ * Returns the tokens in the sequence, or 0 if there is no context to use.
+ */
+static int llamacpp_context_sync(nagi_llm_t *llm)
+{
+    llm_state_t *state = llm->state;
+    struct llm_context_kv *kv = state->context_kv;
+    nagi_llm_session_t *session = llm->session;
+    struct llm_context_copy *copy;
+    llama_memory_t mem;
+    llama_token *tokens;
+    unsigned long hash[LLAMACPP_CONTEXT_SECTIONS];
+    int first, restart, compacted;
+    int budget, n_max, n, len, i;
+
+    if (!kv || !llm_context_state(session)) return 0;
+
+    copy = (struct llm_context_copy *)malloc(sizeof(*copy));
+    if (!copy) return 0;
+
+    llm_context_lock(session);
+    llamacpp_context_copy(session, copy);
+    llm_context_unlock(session);
+
+    mem = llama_get_memory(state->ctx);
+    tokens = state->arena->tokens;
+    n_max = state->arena->n_tokens;
+    budget = (int)llama_n_ctx(state->ctx) / 4;
+
+    first = LLAMACPP_CONTEXT_SECTIONS;
+    if (!kv->valid) {
+        llama_memory_seq_rm(mem, LLAMACPP_CONTEXT_SEQ, -1, -1);
+        n = llama_common_tokenize(llm, LLAMACPP_CONTEXT_PREAMBLE, (int)strlen(LLAMACPP_CONTEXT_PREAMBLE),
+                                  tokens, n_max, false);
+        if (n < 0 || !llama_common_decode(llm, tokens, n, 0, LLAMACPP_CONTEXT_SEQ, 0)) {
+            goto fail;
+        }
+        kv->pos[0] = n;
+        kv->valid = 1;
+        first = 0;
+    }
+
+    for (i = 0; i < LLAMACPP_CONTEXT_SECTIONS; i++) {
+        hash[i] = llama_common_hash_text(copy->section[i], (size_t)copy->section_len[i]);
+        if (first == LLAMACPP_CONTEXT_SECTIONS && hash[i] != kv->hash[i]) {
+            first = i;
+        }
+    }
+
+    /* Another game's history (a server's clients) has serials of its own */
+    restart = kv->epoch != copy->epoch || kv->session != session;
+    if (first < LLAMACPP_CONTEXT_SECTIONS) {
+        llama_memory_seq_rm(mem, LLAMACPP_CONTEXT_SEQ, kv->pos[first], -1);
+        kv->n_past = kv->pos[first];
+
+        for (i = first; i < LLAMACPP_CONTEXT_SECTIONS; i++) {
+            if (i == 0 && llamacpp_room_kv_restore(llm, kv, copy->room, hash[0])) {
+                kv->hash[0] = hash[0];
+                continue;
+            }
+            len = copy->section_len[i];
+            kv->pos[i] = kv->n_past;
+            if (len > 0) {
+                n = llama_common_tokenize(llm, copy->section[i], len, tokens, n_max, false);
+                if (n < 0 || kv->n_past + n > budget ||
+                    !llama_common_decode(llm, tokens, n, kv->n_past, LLAMACPP_CONTEXT_SEQ, 0)) {
+                    goto fail;
+                }
+                kv->n_past += n;
+            }
+            kv->hash[i] = hash[i];
+            if (i == 0 && len > 0) {
+                llamacpp_room_kv_store(llm, kv, copy->room, hash[0]);
+            }
+        }
+        kv->pos[LLAMACPP_CONTEXT_SECTIONS] = kv->n_past;
+        restart = 1;
+    }
+
+    /* Append the entries not decoded yet, oldest first */
+    compacted = 0;
+    for (i = -1; i < copy->count; i++) {
+        if (i < 0) {
+            if (!restart) continue;
+
+            /* History decoded again from the newest entries */
+            llama_memory_seq_rm(mem, LLAMACPP_CONTEXT_SEQ, kv->pos[LLAMACPP_CONTEXT_SECTIONS], -1);
+            kv->n_past = kv->pos[LLAMACPP_CONTEXT_SECTIONS];
+            kv->next_serial = llamacpp_context_history_start(copy, budget - kv->n_past);
+            kv->first_serial = kv->next_serial;
+            kv->epoch = copy->epoch;
+            kv->session = session;
+            restart = 0;
+            continue;
+        }
+
+        if (copy->serial[i] < kv->next_serial) continue;
+
+        n = llama_common_tokenize(llm, copy->line[i], copy->line_len[i], tokens, n_max, false);
+        if (n < 0) goto fail;
+
+        if (kv->n_past + n > budget && !llamacpp_context_shift(llm, kv, budget, n)) {
+            if (compacted) break;
+            compacted = 1;
+            restart = 1;
+            i = -2;
+            continue;
+        }
+
+        if (!llama_common_decode(llm, tokens, n, kv->n_past, LLAMACPP_CONTEXT_SEQ, 0)) {
+            goto fail;
+        }
+        kv->entry_pos[copy->serial[i] % LLM_MAX_HISTORY_ENTRIES] = kv->n_past;
+        kv->n_past += n;
+        kv->next_serial = copy->serial[i] + 1;
+    }
+
+    free(copy);
+
+    if (llm->config.verbose) {
+        llm_log(LLM_LOG_DEBUG, "LLM: Game context in seq %d (%d tokens)\n", LLAMACPP_CONTEXT_SEQ, kv->n_past);
+    }
+    return kv->n_past;
+
+fail:
+    free(copy);
+    llama_memory_seq_rm(mem, LLAMACPP_CONTEXT_SEQ, -1, -1);
+    kv->valid = 0;
+    return 0;
+}
+
+/*
+ * Game context sequence in a save file, the KV data follows it
+ */
+struct llm_context_kv_save {
+    uint64_t n_params;                          /* Model it was decoded with */
+    u32 n_ctx;
+    u32 layout;                                 /* sizeof(struct llm_context_kv) */
+    int current;                                /* History decoded was the saved one's */
+    struct llm_context_kv kv;
+};
+
+static size_t llamacpp_kv_save(nagi_llm_t *llm, void *buf, size_t size)
+{
+    llm_state_t *state = llm->state;
+    struct llm_context_kv_save head;
+    size_t n;
+
+    if (!state->context_kv || !state->context_kv->valid) return 0;
+    n = llama_state_seq_get_size(state->ctx, LLAMACPP_CONTEXT_SEQ);
+    if (n == 0) return 0;
+    if (!buf) return sizeof(head) + n;
+    if (size < sizeof(head) + n) return 0;
+
+    memset(&head, 0, sizeof(head));
+    head.n_params = llama_model_n_params(state->model);
+    head.n_ctx = llama_n_ctx(state->ctx);
+    head.layout = sizeof(struct llm_context_kv);
+    head.kv = *state->context_kv;
+    llm_context_lock(llm->session);
+    head.current = llm->session && head.kv.epoch == llm_context_state(llm->session)->history_epoch;
+    llm_context_unlock(llm->session);
+    memcpy(buf, &head, sizeof(head));
+
+    n = llama_state_seq_get_data(state->ctx, (uint8_t *)buf + sizeof(head), n, LLAMACPP_CONTEXT_SEQ);
+    return n ? sizeof(head) + n : 0;
+}
 
 /*
- * Helper: Check whether an input matches an expected AGI word list
- * Uses semantic matching: asks LLM "does input match command?"
- * Returns 1 if match, 0 otherwise
+ * The restored history has a new epoch, so the saved one is only carried
+ * over if the two agreed when it was saved. Otherwise the sections are kept
+ * and the history is decoded again on the next turn.
  */
+static int llamacpp_kv_load(nagi_llm_t *llm, const void *buf, size_t size)
+{
+    llm_state_t *state = llm->state;
+    struct llm_context_kv_save head;
+    llama_memory_t mem;
+
+    if (!state->context_kv || !llm->session || size <= sizeof(head)) return 0;
+    memcpy(&head, buf, sizeof(head));
+    if (head.n_params != llama_model_n_params(state->model) || head.n_ctx != llama_n_ctx(state->ctx) ||
+        head.layout != sizeof(struct llm_context_kv)) {
+        return 0;
+    }
+
+    mem = llama_get_memory(state->ctx);
+    llama_memory_seq_rm(mem, LLAMACPP_CONTEXT_SEQ, -1, -1);
+    if (llama_state_seq_set_data(state->ctx, (const uint8_t *)buf + sizeof(head), size - sizeof(head),
+                                 LLAMACPP_CONTEXT_SEQ) == 0) {
+        llama_memory_seq_rm(mem, LLAMACPP_CONTEXT_SEQ, -1, -1);
+        state->context_kv->valid = 0;
+        return 0;
+    }
+
+    llm_context_lock(llm->session);
+    head.kv.epoch = llm_context_state(llm->session)->history_epoch - (head.current ? 0 : 1);
+    llm_context_unlock(llm->session);
+    head.kv.session = llm->session;
+    *state->context_kv = head.kv;
+
+    if (llm->config.verbose) {
+        llm_log(LLM_LOG_DEBUG, "LLM: Game context restored in seq %d (%d tokens)\n", LLAMACPP_CONTEXT_SEQ, head.kv.n_past);
+    }
+    return 1;
+}
+
+/*
+ * Task models: extraction and matching can run on smaller models than the
+ * one generating responses. Each is a llama.cpp instance of its own, fed
+ * the dictionary and session language of this one before every request.
+ */
+enum {
+    LLAMACPP_TASK_EXTRACT,
+    LLAMACPP_TASK_MATCH,
+    LLAMACPP_TASKS
+};
+
+struct llm_task_models {
+    nagi_llm_t *llm[LLAMACPP_TASKS];            /* NULL for the main model, may be the same twice */
+    int dictionary_version[LLAMACPP_TASKS];     /* grammar_version last pushed to it */
+};
+
+nagi_llm_t *nagi_llm_llamacpp_create(void);
+
+static nagi_llm_t *llamacpp_task_init(nagi_llm_t *llm, const char *path)
+{
+    nagi_llm_config_t config;
+    nagi_llm_t *child;
+
+    /* Short prompts only: no game context, drafts, embeddings or adapters */
+    memcpy(&config, &llm->config, sizeof(config));
+    config.extraction_model[0] = '\0';
+    config.matching_model[0] = '\0';
+    config.generation_model[0] = '\0';
+    config.draft_model_path[0] = '\0';
+    config.embedding_match = 0;
+    config.lora_dir[0] = '\0';
+    config.n_seq_max = LLAMA_COMMON_REQUEST_SEQS;
+
+    child = nagi_llm_llamacpp_create();
+    if (!child) return NULL;
+    if (!nagi_llm_init(child, path, &config)) {
+        nagi_llm_destroy(child);
+        return NULL;
+    }
+
+    /* A cancelled request stops the child's decodes too */
+    llama_set_abort_callback(child->state->ctx, llama_common_abort, llm);
+    return child;
+}
+
+static void llamacpp_tasks_init(nagi_llm_t *llm)
+{
+    llm_state_t *state = llm->state;
+    const char *paths[LLAMACPP_TASKS];
+    int i;
+
+    paths[LLAMACPP_TASK_EXTRACT] = llm->config.extraction_model;
+    paths[LLAMACPP_TASK_MATCH] = llm->config.matching_model;
+
+    for (i = 0; i < LLAMACPP_TASKS; i++) {
+        if (paths[i][0] == '\0' || strcmp(paths[i], llm->config.model_path) == 0) continue;
+
+        if (!state->tasks) {
+            state->tasks = (struct llm_task_models *)calloc(1, sizeof(struct llm_task_models));
+            if (!state->tasks) return;
+        }
+        if (i > 0 && strcmp(paths[i], paths[i - 1]) == 0) {
+            state->tasks->llm[i] = state->tasks->llm[i - 1];
+            continue;
+        }
+
+        llm_log(LLM_LOG_INFO, "LLM Parser: Loading %s model from %s...\n",
+                              i == LLAMACPP_TASK_EXTRACT ? "extraction" : "matching", paths[i]);
+        state->tasks->llm[i] = llamacpp_task_init(llm, paths[i]);
+        if (!state->tasks->llm[i]) {
+            fprintf(stderr, "LLM Parser: Failed to load %s, using the main model\n", paths[i]);
+        }
+    }
+}
+
+static void llamacpp_tasks_free(llm_state_t *state)
+{
+    int i;
+
+    if (!state->tasks) return;
+    for (i = 0; i < LLAMACPP_TASKS; i++) {
+        if (i > 0 && state->tasks->llm[i] == state->tasks->llm[i - 1]) continue;
+        nagi_llm_destroy(state->tasks->llm[i]);
+    }
+    free(state->tasks);
+    state->tasks = NULL;
+}
+
+/*
+ * The instance to run a task on, brought up to date with this one
+ * Returns NULL if the main model does the task. Until llamacpp_task_done
+ * the child's stages are charged to this instance's telemetry.
+ */
+static nagi_llm_t *llamacpp_task(nagi_llm_t *llm, int task)
+{
+    llm_state_t *state = llm->state;
+    nagi_llm_t *child;
+
+    if (!state || !state->tasks || !state->tasks->llm[task]) return NULL;
+    child = state->tasks->llm[task];
+
+    if (state->dictionary_data && state->tasks->dictionary_version[task] != state->grammar_version) {
+        nagi_llm_set_dictionary(child, state->dictionary_data, state->dictionary_size);
+        state->tasks->dictionary_version[task] = state->grammar_version;
+    }
+    memcpy(child->state->detected_language, state->detected_language, sizeof(state->detected_language));
+    child->state->language_confidence = state->language_confidence;
+
+    child->stats = llm->stats;
+    child->session = llm->session;
+    return child;
+}
+
+static void llamacpp_task_done(nagi_llm_t *llm, nagi_llm_t *child)
+{
+    llm_state_t *state = llm->state;
+
+    child->stats = NULL;
+    child->session = NULL;
+    if (child->state->detected_language[0]) {
+        memcpy(state->detected_language, child->state->detected_language, sizeof(state->detected_language));
+        state->language_confidence = child->state->language_confidence;
+    }
+}
+
+static const char *llamacpp_extract_words(nagi_llm_t *llm, const char *input,
+                                          char *out, int out_size)
+{
+    nagi_llm_t *child = llamacpp_task(llm, LLAMACPP_TASK_EXTRACT);
+    const char *words;
+
+    if (!child) return llama_common_extract_words(llm, input, out, out_size);
+    words = child->extract_words(child, input, out, out_size);
+    llamacpp_task_done(llm, child);
+    return words;
+}
+
 static int llamacpp_matches_expected(nagi_llm_t *llm, const char *input,
                                      const int *expected_word_ids, int expected_count)
-{    
-    char prompt[NAGI_LLM_MAX_PROMPT_SIZE];
+{
+    nagi_llm_t *child = llamacpp_task(llm, LLAMACPP_TASK_MATCH);
+    int result;
+
+    if (!child) return llama_common_matches_expected(llm, input, expected_word_ids, expected_count);
+    result = child->matches_expected(child, input, expected_word_ids, expected_count);
+    llamacpp_task_done(llm, child);
+    return result;
+}
+
+/*
+ * Detect language from user input (wrapper for shared implementation)
+ */
+static const char *llamacpp_detect_language(nagi_llm_t *llm, const char *input)
+{
+    llm_state_t *state = llm->state;
+    return llama_common_detect_language(llm, input, state->model, state->ctx,
+                                        llama_common_task_sampler(llm));
+}
+
+/*
+ * Score several said() word lists against one input.
+ * The few-shot part of the matching prompt is shared by every candidate, so
+ * it is cached in seq 0 and copied into one working sequence per candidate.
+ * The last prompt token of every candidate is decoded in a single batch and
+ * the answer is read straight from the "yes"/"no" logits, nothing is sampled.
+ */
+static int llamacpp_matches_expected_batch(nagi_llm_t *llm, const char *input,
+                                           const int *const *expected_lists,
+                                           const int *expected_counts, int n_lists,
+                                           int *results)
+{
+    llm_state_t *state;
+    llama_memory_t mem;
+    struct llama_prompt *prompt;
     char expected_command[256];
-    char response_buf[256];
-    char piece[64];
-    int n_tokens, n_prompt_tokens;
-    int current_seq;
-    int response_len, gen_count;
+    const char *values[2];
+    size_t split;
+    nagi_llm_t *child;
     llama_token *tokens;
-    llm_state_t *state;
-    struct llama_batch batch, batch_gen;
-    int i, k, n_eval;
-    int word_id;
-    const char *word_str;
-    int piece_len;
-    char *trimmed;
+    int seq_of[LLAMA_WORK_SEQS];
+    llama_token last_token[LLAMA_WORK_SEQS];
+    int last_pos[LLAMA_WORK_SEQS];
+    int n_par, n_ctx, n_past, n_prompt_tokens;
+    int first, j, n_live, ok;
+    float p_yes;
+    double start;
+    struct llama_batch batch;
 
     if (!nagi_llm_ready(llm)) return 0;
-    if (expected_count == 0) return 0;
+    if (!input || !expected_lists || !expected_counts || !results || n_lists <= 0) return 0;
+
+    child = llamacpp_task(llm, LLAMACPP_TASK_MATCH);
+    if (child) {
+        ok = child->matches_expected_batch(child, input, expected_lists, expected_counts, n_lists, results);
+        llamacpp_task_done(llm, child);
+        return ok;
+    }
+
+    state = llm->state;
+    mem = llama_get_memory(state->ctx);
+
+    /* Shared prefix: everything before the "Expected command" line */
+    prompt = llama_common_prompt(llm, LLAMA_PROMPT_MATCH, SEMANTIC_MATCHING_PROMPT);
+    split = llama_prompt_line_start(prompt, 0);
+    n_past = llama_common_prefix_get(llm, SEMANTIC_MATCHING_PROMPT, split);
+    values[1] = input;
+
+    n_par = llm->config.n_seq_max - 1;
+    if (n_par > LLAMA_WORK_SEQS) n_par = LLAMA_WORK_SEQS;
+    if (n_par < 1) n_par = 1;
+
+    n_ctx = state->arena->n_tokens;
+    tokens = state->arena->tokens;
+    batch = state->arena->step;
+
+    for (first = 0; first < n_lists; first += n_par) {
+        n_live = 0;
+
+        for (j = 0; j < n_par && first + j < n_lists; j++) {
+            int seq = 1 + j;
+
+            results[first + j] = NAGI_LLM_MATCH_NO;
+            if (!llama_common_expected_command(llm, expected_lists[first + j], expected_counts[first + j],
+                                               expected_command, sizeof(expected_command))) {
+                continue;
+            }
+
+            /* Until its logits are read */
+            results[first + j] = NAGI_LLM_MATCH_ERROR;
+
+            llama_memory_seq_rm(mem, seq, -1, -1);
+            if (n_past > 0) {
+                llama_memory_seq_cp(mem, LLAMA_PREFIX_SEQ, seq, -1, -1);
+            }
 
-    /* Build expected command string from word IDs */
-    expected_command[0] = '\0';
-    for (i = 0; i < expected_count; i++) {
-        word_id = expected_word_ids[i];
-        word_str = get_word_string(llm, word_id);
+            values[0] = expected_command;
+            n_prompt_tokens = llama_prompt_tokenize(llm, state->model, prompt, values,
+                                                    n_past > 0 ? split : 0, n_past == 0,
+                                                    tokens, n_ctx - n_past);
+            if (n_prompt_tokens <= 0) continue;
 
-        if (word_str) {
-            if (expected_command[0] != '\0') {
-                strcat(expected_command, " ");
+            /* Everything but the last token, which goes in the shared batch */
+            if (!llama_common_decode(llm, tokens, n_prompt_tokens - 1, n_past, seq, 0)) {
+                llama_memory_seq_rm(mem, seq, -1, -1);
+                continue;
             }
-            strcat(expected_command, word_str);
+
+            seq_of[n_live] = first + j;
+            last_token[n_live] = tokens[n_prompt_tokens - 1];
+            last_pos[n_live] = n_past + n_prompt_tokens - 1;
+            n_live++;
+        }
+
+        if (n_live > 0) {
+            batch.n_tokens = n_live;
+            for (j = 0; j < n_live; j++) {
+                batch.token[j] = last_token[j];
+                batch.pos[j] = last_pos[j];
+                batch.n_seq_id[j] = 1;
+                batch.seq_id[j][0] = 1 + (seq_of[j] - first);
+                batch.logits[j] = true;
+            }
+
+            start = llm_time_ms();
+            ok = llama_decode(state->ctx, batch) == 0;
+            llm_stats_stage(llm, LLM_STATS_PROMPT, llm_time_ms() - start, n_live);
+            if (ok) {
+                for (j = 0; j < n_live; j++) {
+                    p_yes = llama_common_yes_probability(state->model, state->ctx, j);
+                    if (p_yes < 0.0f) continue;
+                    results[seq_of[j]] = p_yes >= llm->config.match_threshold;
+
+                    if (llm->config.verbose) {
+                        llm_log(LLM_LOG_TRACE, "LLM batch match %d: p(yes)=%.3f -> %s\n", seq_of[j], p_yes,
+                                               results[seq_of[j]] ? "MATCH" : "NO MATCH");
+                    }
+                }
+            } else if (llm->config.verbose) {
+                llm_log(LLM_LOG_DEBUG, "LLM: Batched match decode failed\n");
+            }
+        }
+
+        for (j = 0; j < n_par && first + j < n_lists; j++) {
+            llama_memory_seq_rm(mem, 1 + j, -1, -1);
         }
     }
 
-    if (expected_command[0] == '\0') return 0;
+    return 1;
+}
+
+/*
+ * Speculative response generation
+ *
+ * The draft model proposes up to draft_tokens tokens greedily, then the
+ * main model decodes the last sampled token and the whole draft in one
+ * batch. Every output token is still sampled from the main model with the
+ * creative sampler; a draft token is kept only while it equals that
+ * sample, so the output is what plain generation would give and the draft
+ * only saves main model decodes.
+ *
+ * Expects the prompt (still in the arena tokens) decoded into seq with
+ * logits on its last token. Returns the response length.
+ */
+static int llamacpp_generate_speculative(nagi_llm_t *llm, int seq, int n_prompt_tokens,
+                                         const struct llama_stop *stop, char *output, int output_size,
+                                         nagi_llm_token_cb_t on_token, void *userdata)
+{
+    llm_state_t *state = llm->state;
+    llama_memory_t mem, draft_mem;
+    struct llama_batch batch, step;
+    llama_token draft[LLAMACPP_MAX_DRAFT];
+    llama_token last, prev, token;
+    int n_vocab, n_draft, n_drafted, n_accepted;
+    int n_past, draft_past, gen_count;
+    int response_len, emitted;
+    int drafted_total, accepted_total;
+    int max_tokens, draft_ok, i;
+    double start;
+
+    mem = llama_get_memory(state->ctx);
+    max_tokens = stop->budget;
+    draft_mem = llama_get_memory(state->draft_ctx);
+    n_vocab = llama_vocab_n_tokens(llama_model_get_vocab(state->model));
+
+    /* The verification batch holds the last token plus the draft */
+    n_draft = llm->config.draft_tokens;
+    if (n_draft > LLAMACPP_MAX_DRAFT) n_draft = LLAMACPP_MAX_DRAFT;
+    if (n_draft > llm->config.batch_size - 1) n_draft = llm->config.batch_size - 1;
+
+    /* Bring the draft model up to the end of the prompt */
+    llama_memory_seq_rm(draft_mem, 0, -1, -1);
+    draft_ok = llama_common_decode_ctx(llm, state->draft_ctx, state->arena->tokens,
+                                       n_prompt_tokens, 0, 0, 0);
+    draft_past = draft_ok ? n_prompt_tokens : 0;
 
-    /* Build semantic matching prompt */
-    snprintf(prompt, sizeof(prompt),
-        SEMANTIC_MATCHING_PROMPT,
-        expected_command, input);
+    response_len = 0;
+    emitted = 0;
+    gen_count = 0;
+    drafted_total = 0;
+    accepted_total = 0;
+    n_past = n_prompt_tokens;
+    prev = 0;
+    batch = state->arena->batch;
+    step = state->arena->step;
+
+    /* last is always sampled but not decoded yet */
+    start = llm_time_ms();
+    last = llama_sampler_sample(state->sampler_creative, state->ctx, -1);
+    llama_sampler_accept(state->sampler_creative, last);
+
+    while (gen_count < max_tokens) {
+        if (!llama_common_emit(llm, stop, last, output, output_size, &response_len, &emitted,
+                               on_token, userdata)) {
+            break;
+        }
+        gen_count++;
+
+        /* Draft: feed last (and the token the draft missed when all of the
+           previous draft was accepted), then propose greedily */
+        n_drafted = 0;
+        if (draft_ok && gen_count < max_tokens) {
+            step.n_tokens = 0;
+            if (draft_past == n_past - 1) {
+                step.token[0] = prev;
+                step.pos[0] = n_past - 1;
+                step.n_seq_id[0] = 1;
+                step.seq_id[0][0] = 0;
+                step.logits[0] = false;
+                step.n_tokens = 1;
+            }
+            token = last;
+            while (n_drafted < n_draft) {
+                step.token[step.n_tokens] = token;
+                step.pos[step.n_tokens] = n_past + n_drafted;
+                step.n_seq_id[step.n_tokens] = 1;
+                step.seq_id[step.n_tokens][0] = 0;
+                step.logits[step.n_tokens] = true;
+                step.n_tokens++;
+
+                if (llama_decode(state->draft_ctx, step) != 0) {
+                    /* Positions are out of step now, finish without the draft */
+                    draft_ok = 0;
+                    n_drafted = 0;
+                    break;
+                }
+                draft_past = n_past + n_drafted + 1;
+                step.n_tokens = 0;
+
+                token = llama_common_argmax(llama_get_logits_ith(state->draft_ctx, -1), n_vocab);
+                if (llama_vocab_is_eog(llama_model_get_vocab(state->model), token)) break;
+                draft[n_drafted++] = token;
+            }
+        }
+
+        /* Verify: the main model scores last and the draft in one decode */
+        batch.n_tokens = 1 + n_drafted;
+        for (i = 0; i < batch.n_tokens; i++) {
+            batch.token[i] = i == 0 ? last : draft[i - 1];
+            batch.pos[i] = n_past + i;
+            batch.n_seq_id[i] = 1;
+            batch.seq_id[i][0] = seq;
+            batch.logits[i] = true;
+        }
+        if (llama_decode(state->ctx, batch) != 0) {
+            break;
+        }
+
+        /* Keep draft tokens while they match what the main model samples */
+        prev = last;
+        n_accepted = 0;
+        for (i = 0; i <= n_drafted; i++) {
+            token = llama_sampler_sample(state->sampler_creative, state->ctx, i);
+            llama_sampler_accept(state->sampler_creative, token);
+            if (i == n_drafted || token != draft[i]) break;
+
+            n_accepted++;
+            prev = token;
+            if (!llama_common_emit(llm, stop, token, output, output_size, &response_len, &emitted,
+                                   on_token, userdata) ||
+                ++gen_count >= max_tokens) {
+                break;
+            }
+        }
+        drafted_total += n_drafted;
+        accepted_total += n_accepted;
+
+        if (i < n_drafted && token == draft[i]) {
+            /* Stopped while emitting an accepted token */
+            break;
+        }
+
+        /* Rejected draft tokens leave both caches */
+        n_past += 1 + n_accepted;
+        llama_memory_seq_rm(mem, seq, n_past, -1);
+        if (draft_past > n_past) draft_past = n_past;
+        llama_memory_seq_rm(draft_mem, 0, draft_past, -1);
+
+        last = token;
+    }
+
+    llm_stats_stage(llm, LLM_STATS_GENERATE, llm_time_ms() - start, gen_count);
+
+    if (llm->config.verbose && drafted_total > 0) {
+        llm_log(LLM_LOG_DEBUG, "Speculative decoding: %d of %d draft tokens accepted\n",
+                               accepted_total, drafted_total);
+    }
+
+    return response_len;
+}
+
+/*
+ * Decode the response prompt for game_response into seq, on top of the
+ * game context when it is kept decoded. Leaves the logits of the last
+ * prompt token. Returns the position of the first generated token, 0 on
+ * failure.
+ */
+static int llamacpp_response_prompt(nagi_llm_t *llm, const char *game_response,
+                                    const char *user_input, int seq)
+{
+    llm_state_t *state = llm->state;
+    llama_memory_t mem;
+    int n_past;
+    size_t skip;
+
+    /* Clear KV cache completely for this sequence to prevent language contamination */
+    mem = llama_get_memory(state->ctx);
+    llama_memory_seq_rm(mem, seq, -1, -1);
+
+    /*
+     * The game context goes at the start of the system prompt. It is kept
+     * decoded across turns, so only the instructions and the message are
+     * decoded here. The draft model has no copy of it, so speculative
+     * decoding goes without.
+     */
+    n_past = 0;
+    skip = 0;
+    if (!state->draft_ctx &&
+        strncmp(RESPONSE_GENERATION_PROMPT, START_OF_SYSTEM, strlen(START_OF_SYSTEM)) == 0) {
+        n_past = llamacpp_context_sync(llm);
+        if (n_past > 0) {
+            llama_memory_seq_cp(mem, LLAMACPP_CONTEXT_SEQ, seq, -1, -1);
+            llm_stats_hit(llm, LLM_STATS_KV_REUSE);
+            skip = strlen(START_OF_SYSTEM);
+        }
+    }
+
+    return llama_common_response_prompt(llm, game_response, user_input, seq, n_past, skip);
+}
+
+/*
+ * Generate a game response using the LLM
+ * Translates game response to player's language and optionally adds context.
+ * on_token (optional) receives the first response line as it is generated.
+ */
+static int llamacpp_generate_response_stream(nagi_llm_t *llm, const char *game_response,
+                                             const char *user_input, char *output, int output_size,
+                                             nagi_llm_token_cb_t on_token, void *userdata)
+{
+    llm_state_t *state;
+    int current_seq;
+    int response_len;
+    int n_past;
+    struct llama_stop stop;
+
+    if (!nagi_llm_ready(llm)) return 0;
+    if (!game_response || !user_input || !output || output_size <= 0) return 0;
 
     state = llm->state;
+    llama_stop_init(llm, &stop, game_response, LLAMA_RESPONSE_TOKENS, llm_time_ms());
 
-    /* Use rotating sequence IDs to avoid KV cache conflicts */
-    current_seq = (state->seq_counter++) % 8;
+    /* Use rotating sequence IDs */
+    current_seq = LLAMA_NEXT_SEQ(state);
+    n_past = llamacpp_response_prompt(llm, game_response, user_input, current_seq);
+    if (n_past <= 0) {
+        return 0;
+    }
 
-    if (llm->config.verbose) {
-        printf("\n=== LLM Matching ===\n");
-        printf("User input: \"%s\"\n", input);
-        printf("Expected: \"%s\"\n", expected_command);
-        printf("Using sequence ID: %d\n", current_seq);
+    /* Generate response using creative sampler */
+    if (state->draft_ctx) {
+        /* A draft model lets one main model decode confirm several tokens */
+        response_len = llamacpp_generate_speculative(llm, current_seq, n_past, &stop,
+                                                     output, output_size, on_token, userdata);
+    } else {
+        response_len = llama_common_generate(llm, state->sampler_creative, current_seq, n_past,
+                                             &stop, output, output_size, on_token, userdata);
+    }
+
+    output[response_len] = '\0';
+
+    response_len = llama_common_clean_response(output);
+
+    if (llm->config.verbose && response_len > 0) {
+        llm_log(LLM_LOG_DEBUG, "Generated: \"%s\"\n", output);
     }
 
-    /* Clear KV cache for this sequence before use */
+    return response_len;
+}
+
+/*
+ * Generation slots of the async worker
+ *
+ * Each slot has a sequence of its own after the game context one, so the
+ * synchronous calls that run between steps (extraction, matching,
+ * detection on 1-7) never touch them. A slot holds the token it sampled
+ * last until the next step decodes it together with the other slots'.
+ */
+struct llamacpp_slot {
+    int active;
+    int done;                        /* Finished, reported by the next step */
+    llama_token pending;             /* Sampled, not decoded yet */
+    int pos;
+    int gen_count;
+    int response_len;
+    int emitted;
+    struct llama_stop stop;
+    char *output;
+    int output_size;
+    nagi_llm_token_cb_t on_token;
+    void *userdata;
+};
+
+struct llm_slots {
+    int count;
+    struct llamacpp_slot slot[LLAMACPP_MAX_SLOTS];
+};
+
+static int llamacpp_generate_slots(nagi_llm_t *llm)
+{
+    if (!nagi_llm_ready(llm) || !llm->state->slots) return 0;
+    return llm->state->slots->count;
+}
+
+/*
+ * Sample the next token of a slot from logits index idx and stream it
+ */
+static void llamacpp_slot_sample(nagi_llm_t *llm, struct llamacpp_slot *slot, int idx)
+{
+    llm_state_t *state = llm->state;
+    llama_token token;
+
+    token = llama_sampler_sample(state->sampler_creative, state->ctx, idx);
+    llama_sampler_accept(state->sampler_creative, token);
+
+    if (!llama_common_emit(llm, &slot->stop, token, slot->output, slot->output_size,
+                           &slot->response_len, &slot->emitted, slot->on_token, slot->userdata) ||
+        slot->gen_count >= slot->stop.budget) {
+        slot->done = 1;
+        return;
+    }
+    slot->pending = token;
+}
+
+/* Whether a slot is generating, with a copy of the game context */
+static int llamacpp_slots_busy(llm_state_t *state)
+{
+    int i;
+
+    if (!state->slots) return 0;
+    for (i = 0; i < state->slots->count; i++) {
+        if (state->slots->slot[i].active) return 1;
+    }
+    return 0;
+}
+
+static int llamacpp_generate_begin(nagi_llm_t *llm, int slot_num, const char *game_response,
+                                   const char *user_input, char *output, int output_size,
+                                   nagi_llm_token_cb_t on_token, void *userdata)
+{
+    struct llamacpp_slot *slot;
+    int seq, n_past;
+    double start = llm_time_ms();
+
+    if (slot_num < 0 || slot_num >= llamacpp_generate_slots(llm)) return 0;
+
+    slot = &llm->state->slots->slot[slot_num];
+    seq = LLAMACPP_SLOT_SEQ + slot_num;
+    memset(slot, 0, sizeof(*slot));
+    llama_memory_seq_rm(llama_get_memory(llm->state->ctx), seq, -1, -1);
+
+    if (!game_response || !output || output_size <= 0) return 0;
+
+    n_past = llamacpp_response_prompt(llm, game_response, user_input ? user_input : "", seq);
+    if (n_past <= 0) {
+        llama_memory_seq_rm(llama_get_memory(llm->state->ctx), seq, -1, -1);
+        return 0;
+    }
+
+    slot->active = 1;
+    slot->pos = n_past;
+    llama_stop_init(llm, &slot->stop, game_response, LLAMA_RESPONSE_TOKENS, start);
+    slot->output = output;
+    slot->output_size = output_size;
+    slot->on_token = on_token;
+    slot->userdata = userdata;
+    llamacpp_slot_sample(llm, slot, -1);
+    return 1;
+}
+
+static int llamacpp_generate_step(nagi_llm_t *llm, int *lengths)
+{
+    llm_state_t *state;
+    struct llm_slots *slots;
+    struct llamacpp_slot *slot;
+    struct llama_batch batch;
+    int idx[LLAMACPP_MAX_SLOTS];
+    int i, running;
+    double start;
+
+    if (llamacpp_generate_slots(llm) <= 0) return 0;
+
+    state = llm->state;
+    slots = state->slots;
+    batch = state->arena->step;
+    batch.n_tokens = 0;
+
+    /* Every slot still going adds its pending token to one batch */
+    for (i = 0; i < slots->count; i++) {
+        slot = &slots->slot[i];
+        lengths[i] = -1;
+        idx[i] = -1;
+        if (!slot->active || slot->done) continue;
+
+        idx[i] = batch.n_tokens;
+        batch.token[batch.n_tokens] = slot->pending;
+        batch.pos[batch.n_tokens] = slot->pos++;
+        batch.n_seq_id[batch.n_tokens] = 1;
+        batch.seq_id[batch.n_tokens][0] = LLAMACPP_SLOT_SEQ + i;
+        batch.logits[batch.n_tokens] = true;
+        batch.n_tokens++;
+    }
+
+    if (batch.n_tokens > 0) {
+        start = llm_time_ms();
+        if (llama_decode(state->ctx, batch) != 0) {
+            /* Out of cache, keep what each slot has so far */
+            for (i = 0; i < slots->count; i++) {
+                if (idx[i] >= 0) slots->slot[i].done = 1;
+            }
+        } else {
+            for (i = 0; i < slots->count; i++) {
+                if (idx[i] < 0) continue;
+                slots->slot[i].gen_count++;
+                llamacpp_slot_sample(llm, &slots->slot[i], idx[i]);
+            }
+        }
+        llm_stats_stage(llm, LLM_STATS_GENERATE, llm_time_ms() - start, batch.n_tokens);
+    }
+
+    running = 0;
+    for (i = 0; i < slots->count; i++) {
+        slot = &slots->slot[i];
+        if (!slot->active) continue;
+        if (!slot->done) {
+            running++;
+            continue;
+        }
+
+        slot->output[slot->response_len] = '\0';
+        lengths[i] = llama_common_clean_response(slot->output);
+        if (llm->config.verbose && lengths[i] > 0) {
+            llm_log(LLM_LOG_TRACE, "Generated (slot %d): \"%s\"\n", i, slot->output);
+        }
+        llama_memory_seq_rm(llama_get_memory(state->ctx), LLAMACPP_SLOT_SEQ + i, -1, -1);
+        slot->active = 0;
+    }
+    return running;
+}
+
+static int llamacpp_generate_response(nagi_llm_t *llm, const char *game_response,
+                                      const char *user_input, char *output, int output_size)
+{
+    return llamacpp_generate_response_stream(llm, game_response, user_input,
+                                             output, output_size, NULL, NULL);
+}
+
+/*
+ * A sampler of its own for one message of a batch, seeded from its text,
+ * so the message comes out the same whatever is batched with it or ran
+ * before. NULL (greedy) while config.temperature is 0 or if it won't build.
+ */
+static struct llama_sampler *llamacpp_batch_sampler(nagi_llm_t *llm, const char *text)
+{
+    struct llama_sampler *chain;
+    uint32_t seed;
+
+    if (llm->config.temperature <= 0.0f) return NULL;
+    chain = llama_sampler_chain_init(llama_sampler_chain_default_params());
+    if (!chain) return NULL;
+
+    seed = (uint32_t)llama_common_hash_text(text, strlen(text));
+    llama_sampler_chain_add(chain, llama_sampler_init_top_k(llm->config.top_k));
+    llama_sampler_chain_add(chain, llama_sampler_init_top_p(llm->config.top_p, 1));
+    llama_sampler_chain_add(chain, llama_sampler_init_temp(llm->config.temperature));
+    llama_sampler_chain_add(chain, llama_sampler_init_dist(seed));
+    return chain;
+}
+
+/*
+ * Generate responses for several game messages at once (no player input).
+ * Each message gets its own working sequence; prompts are decoded per
+ * sequence and generation then advances every sequence in one batch per
+ * step. Each message samples from its own llamacpp_batch_sampler, so
+ * results are reproducible. Messages that fail are left empty for the
+ * caller to retry.
+ */
+static int llamacpp_generate_response_batch(nagi_llm_t *llm, const char **game_responses,
+                                            int count, char **outputs, int output_size)
+{
+    llm_state_t *state;
+    const struct llama_vocab *vocab;
     llama_memory_t mem;
-    bool cleared;
-    
+    struct llama_prompt *prompt;
+    struct llama_sampler *sampler[LLAMA_WORK_SEQS];
+    const char *values[3];
+    const char *language;
+    llama_token *tokens;
+    llama_token pending[LLAMA_WORK_SEQS];
+    int pos[LLAMA_WORK_SEQS];
+    int len[LLAMA_WORK_SEQS];
+    int active[LLAMA_WORK_SEQS];
+    struct llama_stop stop[LLAMA_WORK_SEQS];
+    int n_par, n_active, n_ctx, n_prompt_tokens;
+    int first, j, step, piece_len, done, n_generated;
+    char piece[64];
+    struct llama_batch batch;
+    double start, group_start;
+
+    if (!nagi_llm_ready(llm)) return 0;
+    if (!game_responses || !outputs || count <= 0 || output_size <= 0) return 0;
+
+    state = llm->state;
+    vocab = llama_model_get_vocab(state->model);
     mem = llama_get_memory(state->ctx);
-    cleared = llama_memory_seq_rm(mem, current_seq, -1, -1);
+    language = state->detected_language[0] ? state->detected_language : "English";
+    prompt = llama_common_prompt(llm, LLAMA_PROMPT_RESPONSE, RESPONSE_GENERATION_PROMPT);
+    values[0] = language;
+    values[1] = "";
+
+    n_par = llm->config.n_seq_max - 1;
+    if (n_par > LLAMA_WORK_SEQS) n_par = LLAMA_WORK_SEQS;
+    if (n_par < 1) n_par = 1;
+
+    n_ctx = state->arena->n_tokens;
+    tokens = state->arena->tokens;
+    batch = state->arena->step;
+    done = 0;
+
+    for (first = 0; first < count; first += n_par) {
+        n_active = 0;
+        /* One deadline per group, a call can hold every message of a game */
+        group_start = llm_time_ms();
+
+        /* Decode every prompt of this group except its last token */
+        for (j = 0; j < n_par && first + j < count; j++) {
+            outputs[first + j][0] = '\0';
+            active[j] = 0;
+            len[j] = 0;
+            sampler[j] = NULL;
+            llama_memory_seq_rm(mem, 1 + j, -1, -1);
+
+            if (!game_responses[first + j] || game_responses[first + j][0] == '\0') continue;
+
+            values[2] = game_responses[first + j];
+            n_prompt_tokens = llama_prompt_tokenize(llm, state->model, prompt, values, 0, false,
+                                                    tokens, n_ctx);
+            if (n_prompt_tokens <= 0) continue;
+
+            if (!llama_common_decode(llm, tokens, n_prompt_tokens - 1, 0, 1 + j, 0)) {
+                llama_memory_seq_rm(mem, 1 + j, -1, -1);
+                continue;
+            }
+            pending[j] = tokens[n_prompt_tokens - 1];
+            pos[j] = n_prompt_tokens - 1;
+            llama_stop_init(llm, &stop[j], game_responses[first + j], LLAMA_RESPONSE_TOKENS,
+                            group_start);
+            sampler[j] = llamacpp_batch_sampler(llm, game_responses[first + j]);
+            active[j] = 1;
+            n_active++;
+        }
+
+        /* Advance all live sequences one token per decode */
+        start = llm_time_ms();
+        n_generated = 0;
+        for (step = 0; n_active > 0 && step < LLAMA_RESPONSE_TOKENS; step++) {
+            batch.n_tokens = 0;
+            for (j = 0; j < n_par && first + j < count; j++) {
+                if (!active[j]) continue;
+                batch.token[batch.n_tokens] = pending[j];
+                batch.pos[batch.n_tokens] = pos[j]++;
+                batch.n_seq_id[batch.n_tokens] = 1;
+                batch.seq_id[batch.n_tokens][0] = 1 + j;
+                batch.logits[batch.n_tokens] = true;
+                batch.n_tokens++;
+            }
+
+            if (llama_decode(state->ctx, batch) != 0) {
+                if (llm->config.verbose) {
+                    llm_log(LLM_LOG_DEBUG, "LLM: Batched generation failed at step %d\n", step);
+                }
+                for (j = 0; j < n_par && first + j < count; j++) {
+                    if (active[j]) len[j] = 0;
+                }
+                break;
+            }
+            n_generated += batch.n_tokens;
+
+            n_active = 0;
+            for (j = 0; j < n_par && first + j < count; j++) {
+                if (!active[j]) continue;
+
+                pending[j] = llama_common_sample(state->model, state->ctx, sampler[j], n_active);
+                n_active++;
+
+                if (llama_vocab_is_eog(vocab, pending[j])) {
+                    active[j] = 0;
+                    continue;
+                }
+
+                piece_len = llama_token_to_piece(vocab, pending[j], piece, sizeof(piece), 0, true);
+                if (piece_len <= 0) continue;
+                if (len[j] + piece_len >= output_size - 1) {
+                    active[j] = 0;
+                    continue;
+                }
+                memcpy(outputs[first + j] + len[j], piece, piece_len);
+                len[j] += piece_len;
+                outputs[first + j][len[j]] = '\0';
+
+                /* Only the first line is kept, see llama_stop_check */
+                if (step + 1 >= stop[j].budget ||
+                    llama_stop_check(llm, &stop[j], outputs[first + j], &len[j])) {
+                    active[j] = 0;
+                }
+            }
+
+            n_active = 0;
+            for (j = 0; j < n_par && first + j < count; j++) {
+                n_active += active[j];
+            }
+        }
+        llm_stats_stage(llm, LLM_STATS_GENERATE, llm_time_ms() - start, n_generated);
+
+        for (j = 0; j < n_par && first + j < count; j++) {
+            outputs[first + j][len[j]] = '\0';
+            if (len[j] > 0 && llama_common_clean_response(outputs[first + j]) > 0) {
+                done++;
+            }
+            if (sampler[j]) llama_sampler_free(sampler[j]);
+            llama_memory_seq_rm(mem, 1 + j, -1, -1);
+        }
+
+        if (llm->config.verbose) {
+            llm_log(LLM_LOG_DEBUG, "LLM: Batch generated %d/%d messages\n", done, count);
+        }
+    }
+
+    return done;
+}
+
+/* set_error is defined in nagi_llm.c - using extern declaration */
+
+/*
+ * Load the optional draft model used for speculative response generation.
+ * Generation works without it, so any problem only disables speculation.
+ */
+static void llamacpp_draft_init(nagi_llm_t *llm, struct llama_model_params model_params)
+{
+    llm_state_t *state = llm->state;
+    struct llama_context_params ctx_params;
+
+    if (llm->config.draft_model_path[0] == '\0' || llm->config.draft_tokens <= 0) {
+        return;
+    }
+
+    llm_log(LLM_LOG_INFO, "LLM Parser: Loading draft model from %s...\n", llm->config.draft_model_path);
+    model_params.progress_callback = NULL;
+    model_params.progress_callback_user_data = NULL;
+    state->draft_model = llama_model_load_from_file(llm->config.draft_model_path, model_params);
+    if (!state->draft_model) {
+        fprintf(stderr, "LLM Parser: Failed to load draft model %s, speculative decoding disabled\n",
+                llm->config.draft_model_path);
+        return;
+    }
+
+    /* Draft tokens are compared with the main model's by ID */
+    if (llama_vocab_n_tokens(llama_model_get_vocab(state->draft_model)) !=
+        llama_vocab_n_tokens(llama_model_get_vocab(state->model))) {
+        fprintf(stderr, "LLM Parser: Draft model vocabulary differs from the main model, "
+                        "speculative decoding disabled\n");
+        llama_model_free(state->draft_model);
+        state->draft_model = NULL;
+        return;
+    }
+
+    /* One sequence is enough, the draft only follows the response being generated */
+    ctx_params = llama_context_default_params();
+    ctx_params.n_ctx = llm->config.context_size;
+    ctx_params.n_batch = llm->config.batch_size;
+    ctx_params.n_ubatch = llm->config.u_batch_size;
+    llama_cpu_threads(llm, &ctx_params);
+    ctx_params.n_seq_max = 1;
+
+    state->draft_ctx = llama_init_from_model(state->draft_model, ctx_params);
+    if (!state->draft_ctx) {
+        fprintf(stderr, "LLM Parser: Failed to create draft context, speculative decoding disabled\n");
+        llama_model_free(state->draft_model);
+        state->draft_model = NULL;
+        return;
+    }
+    llama_set_abort_callback(state->draft_ctx, llama_common_abort, llm);
+
     if (llm->config.verbose) {
-        printf("KV cache clear for seq %d: %s\n", current_seq, cleared ? "SUCCESS" : "FAILED");
+        llm_log(LLM_LOG_DEBUG, "LLM Parser: Speculative decoding with %d draft tokens\n", llm->config.draft_tokens);
     }
+}
+
+/*
+ * ggml compute threads for the main, draft and embedding contexts, on
+ * the cores llama_cpu_physical leaves to the model so config.reserve_cores
+ * keeps them off the game's. They sleep between graphs instead of spinning, a
+ * spinning pool takes the game's audio thread's turn. Where the cores
+ * aren't known ggml starts threads of its own as before.
+ */
+static void llamacpp_threadpool_init(nagi_llm_t *llm, const struct llama_context_params *ctx_params)
+{
+#ifdef LLAMA_CPU_PLACEMENT
+    llm_state_t *state = llm->state;
+    struct ggml_threadpool_params params;
+    struct llama_cpu_set set;
+    int cpu, cores;
+
+    cores = llama_cpu_physical(llm, &set);
+    if (cores <= 0) return;
+
+    params = ggml_threadpool_params_default(ctx_params->n_threads);
+    for (cpu = 0; cpu < LLAMA_CPU_MAX && cpu < GGML_MAX_N_THREADS; cpu++) {
+        params.cpumask[cpu] = LLAMA_CPU_ISSET(&set, cpu) ? true : false;
+    }
+    params.strict_cpu = llm->config.pin_threads ? true : false;
+    params.poll = 0;
+
+    state->threadpool = ggml_threadpool_new(&params);
+    if (!state->threadpool) {
+        fprintf(stderr, "LLM Parser: Could not create the compute threads, ggml's own are used\n");
+        return;
+    }
+    if (ctx_params->n_threads_batch != ctx_params->n_threads) {
+        params.n_threads = ctx_params->n_threads_batch;
+        state->threadpool_batch = ggml_threadpool_new(&params);
+    }
+    llama_attach_threadpool(state->ctx, state->threadpool, state->threadpool_batch);
+    if (state->draft_ctx) {
+        llama_attach_threadpool(state->draft_ctx, state->threadpool, state->threadpool_batch);
+    }
+    if (state->embed_ctx) {
+        llama_attach_threadpool(state->embed_ctx, state->threadpool, state->threadpool_batch);
+    }
+
+    if (llm->config.verbose) {
+        llm_log(LLM_LOG_DEBUG, "LLM Parser: Compute threads on %d cores, %d kept for the game\n",
+                               cores, llm->config.reserve_cores);
+    }
+#else
+    (void)llm;
+    (void)ctx_params;
+#endif
+}
+
+/*
+ * Create the embedding context used by the embedding matcher, on the
+ * dedicated embedding model if one is configured, else on the main model.
+ * Matching works without it, so any problem only leaves it to the chat model.
+ */
+static void llamacpp_embed_init(nagi_llm_t *llm, struct llama_model_params model_params)
+{
+    llm_state_t *state = llm->state;
+    struct llama_context_params ctx_params;
+    struct llama_model *model;
 
-    /* Tokenize */
-    n_tokens = llama_n_ctx(state->ctx);
-    tokens = (llama_token *)malloc(n_tokens * sizeof(llama_token));
-    n_prompt_tokens = llama_tokenize(llama_model_get_vocab(state->model),
-                                     prompt, (int)strlen(prompt),
-                                     tokens, n_tokens, true, true);
-    if (n_prompt_tokens < 0) {
-        free(tokens);
-        return 0;
+    if (!llm->config.embedding_match) {
+        return;
     }
 
-    /* Process prompt */
-    batch = llama_batch_init(llm->config.batch_size, 0, 8);
-    if (llm->config.verbose) {
-        printf("Processing prompt: %d tokens\n", n_prompt_tokens);
+    model = state->model;
+    if (llm->config.embedding_model_path[0] != '\0') {
+        llm_log(LLM_LOG_INFO, "LLM Parser: Loading embedding model from %s...\n", llm->config.embedding_model_path);
+        model_params.progress_callback = NULL;
+        model_params.progress_callback_user_data = NULL;
+        state->embed_model = llama_model_load_from_file(llm->config.embedding_model_path, model_params);
+        if (!state->embed_model) {
+            fprintf(stderr, "LLM Parser: Failed to load embedding model %s, using the main model\n",
+                    llm->config.embedding_model_path);
+        } else {
+            model = state->embed_model;
+        }
     }
-    for (i = 0; i < n_prompt_tokens; i += llm->config.batch_size) {
-        n_eval = n_prompt_tokens - i;
-        if (n_eval > llm->config.batch_size) n_eval = llm->config.batch_size;
 
-        batch.n_tokens = n_eval;
-        for (k = 0; k < n_eval; k++) {
-            batch.token[k] = tokens[i + k];
-            batch.pos[k] = i + k;
-            batch.n_seq_id[k] = 1;
-            batch.seq_id[k][0] = current_seq;
-            batch.logits[k] = false;
-        }
-        if (i + n_eval == n_prompt_tokens) {
-            batch.logits[n_eval - 1] = true;
-        }
-        if (llm->config.verbose) {
-            printf("Decoding batch: tokens=%d, first_pos=%d, seq=%d\n", n_eval, i, current_seq);
-        }
-        if (llama_decode(state->ctx, batch) != 0) {
-            if (llm->config.verbose) {
-                printf("ERROR: llama_decode failed during prompt processing\n");
-            }
-            llama_batch_free(batch);
-            free(tokens);
-            return 0;
+    /* said() phrases and player inputs are short, one small sequence is plenty */
+    ctx_params = llama_context_default_params();
+    ctx_params.n_ctx = LLAMACPP_EMBED_CTX;
+    ctx_params.n_batch = LLAMACPP_EMBED_CTX;
+    ctx_params.n_ubatch = LLAMACPP_EMBED_CTX;
+    llama_cpu_threads(llm, &ctx_params);
+    ctx_params.n_seq_max = 1;
+    ctx_params.embeddings = true;
+    ctx_params.pooling_type = LLAMA_POOLING_TYPE_MEAN;
+
+    state->embed_ctx = llama_init_from_model(model, ctx_params);
+    if (!state->embed_ctx) {
+        fprintf(stderr, "LLM Parser: Failed to create embedding context, embedding matcher disabled\n");
+        if (state->embed_model) {
+            llama_model_free(state->embed_model);
+            state->embed_model = NULL;
         }
+        return;
     }
-    llama_batch_free(batch);
-    free(tokens);
 
-    /* Generate response */
-    response_len = 0;
-    gen_count = 0;
-    batch_gen = llama_batch_init(1, 0, 8);
     if (llm->config.verbose) {
-        printf("Starting generation phase, prompt processed up to position %d\n", n_prompt_tokens - 1);
+        llm_log(LLM_LOG_DEBUG, "LLM Parser: Embedding matcher on %s model, %d dimensions\n",
+                               state->embed_model ? "embedding" : "main", llama_model_n_embd(model));
     }
-    while (response_len < (int)sizeof(response_buf) - 1 && gen_count < llm->config.max_tokens) {
-        llama_token new_token = llama_sampler_sample(state->sampler, state->ctx, -1);
-        llama_sampler_accept(state->sampler, new_token);
+}
 
-        if (llama_vocab_is_eog(llama_model_get_vocab(state->model), new_token)) {
-            if (llm->config.verbose) {
-                printf("Generation ended: EOG token after %d tokens\n", gen_count);
-            }
-            break;
-        }
+/*
+ * Embed text with the embedding context (mean pooled over its tokens)
+ * Returns the embedding size, 0 on failure or without an embedding context
+ */
+static int llamacpp_embed_text(nagi_llm_t *llm, const char *text, float *output, int output_size)
+{
+    llm_state_t *state = llm->state;
+    const struct llama_model *model;
+    llama_token tokens[LLAMACPP_EMBED_CTX];
+    const float *embd;
+    int n_embd, n_tokens, ok;
+    double start;
+
+    if (!state || !state->embed_ctx) return 0;
+
+    model = llama_get_model(state->embed_ctx);
+    n_embd = llama_model_n_embd(model);
+    if (!output) return n_embd;
+    if (!text || text[0] == '\0' || output_size < n_embd) return 0;
+
+    start = llm_time_ms();
+    n_tokens = llama_tokenize(llama_model_get_vocab(model), text, (int)strlen(text),
+                              tokens, LLAMACPP_EMBED_CTX, true, false);
+    llm_stats_stage(llm, LLM_STATS_TOKENIZE, llm_time_ms() - start, 0);
+    if (n_tokens <= 0) return 0;
+
+    llama_memory_clear(llama_get_memory(state->embed_ctx), true);
+
+    /* Encoder-only models (BERT-like) have no decoder to run */
+    start = llm_time_ms();
+    if (llama_model_has_encoder(model) && !llama_model_has_decoder(model)) {
+        ok = llama_encode(state->embed_ctx, llama_batch_get_one(tokens, n_tokens)) == 0;
+    } else {
+        ok = llama_decode(state->embed_ctx, llama_batch_get_one(tokens, n_tokens)) == 0;
+    }
+    llm_stats_stage(llm, LLM_STATS_PROMPT, llm_time_ms() - start, n_tokens);
+    if (!ok) return 0;
 
-        piece_len = llama_token_to_piece(llama_model_get_vocab(state->model),
-                                             new_token, piece, sizeof(piece), 0, true);
-        if (piece_len > 0 && response_len + piece_len < (int)sizeof(response_buf) - 1) {
-            memcpy(response_buf + response_len, piece, piece_len);
-            response_len += piece_len;
-        }
+    embd = llama_get_embeddings_seq(state->embed_ctx, 0);
+    if (!embd) return 0;
 
-        batch_gen.n_tokens = 1;
-        batch_gen.token[0] = new_token;
-        batch_gen.pos[0] = n_prompt_tokens + gen_count;
-        batch_gen.n_seq_id[0] = 1;
-        batch_gen.seq_id[0][0] = current_seq;
-        batch_gen.logits[0] = true;
+    memcpy(output, embd, n_embd * sizeof(float));
+    return n_embd;
+}
 
-        if (llm->config.verbose && gen_count == 0) {
-            printf("First generation decode: pos=%d, seq=%d\n", batch_gen.pos[0], current_seq);
-        }
+/* Size of the model file, the weights are nearly all of it */
+static double llamacpp_file_mb(const char *path)
+{
+#ifdef _WIN32
+    struct _stat64 st;
 
-        if (llama_decode(state->ctx, batch_gen) != 0) {
-            if (llm->config.verbose) {
-                printf("ERROR: llama_decode failed during generation at token %d (pos=%d)\n",
-                       gen_count, n_prompt_tokens + gen_count);
-            }
-            break;
-        }
-        gen_count++;
-    }
+    if (_stat64(path, &st) != 0) return 0.0;
+#else
+    struct stat st;
 
-    if (llm->config.verbose && gen_count >= llm->config.max_tokens) {
-        printf("Generation stopped: max_tokens limit (%d) reached\n", llm->config.max_tokens);
-    }
+    if (stat(path, &st) != 0) return 0.0;
+#endif
+    return (double)st.st_size / (1024.0 * 1024.0);
+}
 
-    llama_batch_free(batch_gen);
-    response_buf[response_len] = '\0';
+/*
+ * Free video memory the model can use, in MB. With a tensor_split the GPU
+ * that runs out first sets how much of the model fits.
+ */
+static double llamacpp_gpu_free_mb(nagi_llm_t *llm)
+{
+    double total = 0.0, share_sum = 0.0, fit = -1.0, free_mb, share;
+    size_t i, free_bytes, total_bytes;
+    int gpu = 0;
 
-    /* Normalize response: convert to lowercase and trim whitespace */
-    for (i = 0; i < response_len; i++) {
-        response_buf[i] = tolower((unsigned char)response_buf[i]);
+    for (i = 0; i < NAGI_LLM_MAX_DEVICES; i++) {
+        share_sum += llm->config.tensor_split[i];
     }
 
-    /* Trim leading whitespace */
-    trimmed = response_buf;
-    while (*trimmed == ' ' || *trimmed == '\n' || *trimmed == '\r' || *trimmed == '\t') {
-        trimmed++;
-    }
+    for (i = 0; i < ggml_backend_dev_count(); i++) {
+        ggml_backend_dev_t dev = ggml_backend_dev_get(i);
 
-    if (llm->config.verbose) {
-        printf("LLM response: \"%s\"\n", response_buf);
-        printf("Trimmed response: \"%s\"\n", trimmed);
-    }
+        if (ggml_backend_dev_type(dev) != GGML_BACKEND_DEVICE_TYPE_GPU) continue;
+        ggml_backend_dev_memory(dev, &free_bytes, &total_bytes);
+        free_mb = (double)free_bytes / (1024.0 * 1024.0);
 
-    /* Check if response starts with "yes" or "no" (more strict matching) */
-    if (strncmp(trimmed, "yes", 3) == 0) {
-        if (llm->config.verbose) {
-            printf("Result: MATCH\n===================\n\n");
-        }
-        return 1;
-    }
-    if (strncmp(trimmed, "no", 2) == 0) {
-        if (llm->config.verbose) {
-            printf("Result: NO MATCH\n===================\n\n");
+        if (llm->config.split_mode == NAGI_LLM_SPLIT_NONE) {
+            if (gpu == llm->config.main_gpu) return free_mb;
+        } else if (share_sum > 0.0) {
+            share = gpu < NAGI_LLM_MAX_DEVICES ? llm->config.tensor_split[gpu] / share_sum : 0.0;
+            if (share > 0.0 && (fit < 0.0 || free_mb / share < fit)) fit = free_mb / share;
+        } else {
+            total += free_mb;
         }
-        return 0;
+        gpu++;
     }
 
-    /* If LLM didn't give clear yes/no, assume no match (conservative) */
-    if (llm->config.verbose) {
-        printf("Result: NO MATCH (unclear response)\n===================\n\n");
+    if (share_sum > 0.0 && llm->config.split_mode != NAGI_LLM_SPLIT_NONE) {
+        return fit > 0.0 ? fit : 0.0;
     }
-    return 0;
+    return total;
 }
 
 /*
- * Detect language from user input (wrapper for shared implementation)
+ * n_gpu_layers = -2: as many layers as fit in free video memory, less
+ * gpu_reserve_mb for the game's renderer. Only the header of the model is
+ * read for its shape, a layer is taken as an even share of the file
+ * (the output layer counted as one more) plus its part of the KV cache.
  */
-static const char *llamacpp_detect_language(nagi_llm_t *llm, const char *input)
+static int llamacpp_auto_layers(nagi_llm_t *llm, const char *path)
 {
-    llm_state_t *state = llm->state;
-    return llama_common_detect_language(llm, input, state->model, state->ctx, state->sampler);
+    struct llama_model_params params;
+    struct llama_model *model;
+    double free_mb, file_mb, layer_mb, room_mb;
+    int n_layer, fit;
+
+    free_mb = llamacpp_gpu_free_mb(llm);
+    file_mb = llamacpp_file_mb(path);
+    if (free_mb <= 0.0 || file_mb <= 0.0) return 0;
+
+    params = llama_model_default_params();
+    params.vocab_only = true;
+    params.n_gpu_layers = 0;
+    model = llama_model_load_from_file(path, params);
+    if (!model) return 0;
+
+    n_layer = LLAMA_N_LAYER(model);
+    if (n_layer <= 0) {
+        llama_model_free(model);
+        return 0;
+    }
+    layer_mb = file_mb / (n_layer + 1) +
+               llama_common_kv_token_bytes(llm, model) / n_layer * llm->config.context_size /
+               (1024.0 * 1024.0);
+    llama_model_free(model);
+
+    room_mb = free_mb - llm->config.gpu_reserve_mb - LLAMA_COMMON_COMPUTE_RESERVE_MB;
+    fit = room_mb > 0.0 ? (int)(room_mb / layer_mb) : 0;
+    if (fit > n_layer) fit = n_layer + 1;
+
+    llm_log(LLM_LOG_INFO, "LLM Parser: %.0f MB of video memory free, offloading %d of %d layers\n",
+                          free_mb, fit > n_layer ? n_layer : fit, n_layer);
+    return fit;
 }
 
 /*
- * Generate a game response using the LLM
- * Translates game response to player's language and optionally adds context
+ * Requantized copies in config.quant_cache_dir
+ *
+ * One F16 or Q8 GGUF ships for every machine. With quant_cache_dir set the
+ * first run loads it as it is and, on a thread of its own, writes a copy in
+ * the type that suits the host: Q8_0 when layers go to a GPU, Q4_K_M on a
+ * CPU, where every token reads the whole model through memory. Later runs
+ * load the copy instead. It is written under a .part name and renamed when
+ * complete, so a run that exits half way leaves nothing to load and the
+ * next one starts over. None of the types need the tables
+ * llama_backend_free() releases, so a shutdown doesn't wait for it.
  */
-static int llamacpp_generate_response(nagi_llm_t *llm, const char *game_response,
-                                      const char *user_input, char *output, int output_size)
+struct llamacpp_quant_type {
+    const char *name;
+    enum llama_ftype ftype;
+    double bpw;                     /* Bits per weight, about */
+};
+
+static const struct llamacpp_quant_type llamacpp_quant_types[] = {
+    { "q4_0", LLAMA_FTYPE_MOSTLY_Q4_0, 4.5 },
+    { "q4_k_m", LLAMA_FTYPE_MOSTLY_Q4_K_M, 4.9 },
+    { "q5_k_m", LLAMA_FTYPE_MOSTLY_Q5_K_M, 5.7 },
+    { "q6_k", LLAMA_FTYPE_MOSTLY_Q6_K, 6.6 },
+    { "q8_0", LLAMA_FTYPE_MOSTLY_Q8_0, 8.5 },
+};
+#define LLAMACPP_QUANT_TYPES (int)(sizeof(llamacpp_quant_types) / sizeof(llamacpp_quant_types[0]))
+
+struct llamacpp_quant_job {
+    char src[NAGI_LLM_MAX_MODEL_PATH];
+    char dst[NAGI_LLM_MAX_MODEL_PATH];
+    int type;
+    int nthread;
+};
+
+/* One copy is written at a time, the others wait for a later run */
+static volatile unsigned int llamacpp_quant_busy = 0;
+
+static int llamacpp_quant_find(const char *name)
 {
-    llm_state_t *state;
-    char prompt[NAGI_LLM_MAX_PROMPT_SIZE];
-    int n_tokens, n_prompt_tokens;
-    int current_seq;
-    int response_len, gen_count, max_response_tokens;
-    char piece[64];
-    llama_token *tokens;
-    const char *language;
-    struct llama_batch batch, batch_gen;
-    int i, k, n_eval;
-    int piece_len;
-    char *translate_marker, *start, *end, *check;
+    int i;
 
-    if (!nagi_llm_ready(llm)) return 0;
-    if (!game_response || !user_input || !output || output_size <= 0) return 0;
-
-    /* Get context if available */
-    /*
-    context_str[0] = '\0';
-    const char *context = llm_context_build();
-    if (context && context[0] != '\0') {
-        snprintf(context_str, sizeof(context_str), "Game context: %s\n", context);
-    */
-    
-    state = llm->state;
-
-    /* Detect language if user provided input */
-    language = "English";
-    if (user_input && user_input[0] != '\0') {
-        language = llamacpp_detect_language(llm, user_input);
-    } else if (state->detected_language[0]) {
-        language = state->detected_language;
+    for (i = 0; i < LLAMACPP_QUANT_TYPES; i++) {
+        if (strcmp(llamacpp_quant_types[i].name, name) == 0) return i;
     }
+    return -1;
+}
 
-    /* Build prompt with explicit language, including user input for context */
-    snprintf(prompt, sizeof(prompt), RESPONSE_GENERATION_PROMPT,
-             language, /*llm->config.personality,*/ user_input ? user_input : "", game_response);
-
-    if (llm->config.verbose) {
-        printf("Generating response in %s\n", language);
-    }
+/* Type the copy is written in, -1 for no copy */
+static int llamacpp_quant_target(nagi_llm_t *llm)
+{
+    const char *name = llm->config.quant_type;
+    size_t i;
+    int type;
 
-    /* Use rotating sequence IDs */
-    current_seq = (state->seq_counter++) % 8;
+    if (llm->config.quant_cache_dir[0] == '\0') return -1;
 
-    if (llm->config.verbose) {
-        printf("\n=== LLM Response Generation ===\n");
-        printf("User input: \"%s\"\n", user_input);
-        printf("Game response: \"%s\"\n", game_response);
-        printf("Using sequence ID: %d\n", current_seq);
+    if (name[0] != '\0' && strcmp(name, "auto") != 0) {
+        type = llamacpp_quant_find(name);
+        if (type < 0) {
+            llm_log(LLM_LOG_WARN, "LLM Parser: Unknown quant_type %s, the model is used as it is\n", name);
+        }
+        return type;
     }
 
-    /* Clear KV cache completely for this sequence to prevent language contamination */
-    llama_memory_t mem;
-    
-    mem = llama_get_memory(state->ctx);
-    llama_memory_seq_rm(mem, current_seq, -1, -1);
-
-    /* Tokenize prompt (add_special=false to avoid double BOS) */
-    n_tokens = llama_n_ctx(state->ctx);
-    tokens = (llama_token *)malloc(n_tokens * sizeof(llama_token));
-    n_prompt_tokens = llama_tokenize(llama_model_get_vocab(state->model),
-                                     prompt, (int)strlen(prompt),
-                                     tokens, n_tokens, false, true);
-    if (n_prompt_tokens < 0) {
-        free(tokens);
-        return 0;
+    if (llm->config.use_gpu && llm->config.n_gpu_layers != 0) {
+        for (i = 0; i < ggml_backend_dev_count(); i++) {
+            if (ggml_backend_dev_type(ggml_backend_dev_get(i)) == GGML_BACKEND_DEVICE_TYPE_GPU) {
+                return llamacpp_quant_find("q8_0");
+            }
+        }
     }
+    return llamacpp_quant_find("q4_k_m");
+}
+
+/* When the file was last written, 0 if it isn't there */
+static time_t llamacpp_file_time(const char *path)
+{
+    struct stat st;
 
-    /* Process prompt in batches */
-    batch = llama_batch_init(llm->config.batch_size, 0, 8);
-    for (i = 0; i < n_prompt_tokens; i += llm->config.batch_size) {
-        n_eval = n_prompt_tokens - i;
-        if (n_eval > llm->config.batch_size) n_eval = llm->config.batch_size;
+    if (stat(path, &st) != 0) return 0;
+    return st.st_mtime;
+}
 
-        batch.n_tokens = n_eval;
-        for (k = 0; k < n_eval; k++) {
-            batch.token[k] = tokens[i + k];
-            batch.pos[k] = i + k;
-            batch.n_seq_id[k] = 1;
-            batch.seq_id[k][0] = current_seq;
-            batch.logits[k] = false;
-        }
-        if (i + n_eval == n_prompt_tokens) {
-            batch.logits[n_eval - 1] = true;
-        }
+/* <quant_cache_dir>/<model file less .gguf>.<type>.gguf, 0 if too long */
+static int llamacpp_quant_path(nagi_llm_t *llm, int type, char *path, size_t size)
+{
+    const char *base, *p;
+    size_t len;
+    int n;
 
-        if (llama_decode(state->ctx, batch) != 0) {
-            llama_batch_free(batch);
-            free(tokens);
-            return 0;
-        }
+    base = llm->config.model_path;
+    for (p = base; *p; p++) {
+        if (*p == '/' || *p == '\\') base = p + 1;
     }
-    llama_batch_free(batch);
-    free(tokens);
+    len = strlen(base);
+    if (len > 5 && strcmp(base + len - 5, ".gguf") == 0) len -= 5;
 
-    /* Generate response using creative sampler */
-    response_len = 0;
-    gen_count = 0;
-    max_response_tokens = 150;  /* Limit for adventure game responses */
-    batch_gen = llama_batch_init(1, 0, 8);
+    n = snprintf(path, size, "%s/%.*s.%s.gguf", llm->config.quant_cache_dir, (int)len, base,
+                 llamacpp_quant_types[type].name);
+    return n > 0 && (size_t)n < size;
+}
 
-    while (response_len < output_size - 1 && gen_count < max_response_tokens) {
-        llama_token new_token = llama_sampler_sample(state->sampler_creative, state->ctx, -1);
-        llama_sampler_accept(state->sampler_creative, new_token);
+/*
+ * Load the host's copy of the model in its place, if one was written since
+ * the model was last changed. Returns the type to write a copy in once the
+ * model is loaded, -1 for none.
+ */
+static int llamacpp_quant_resolve(nagi_llm_t *llm)
+{
+    char path[NAGI_LLM_MAX_MODEL_PATH];
+    time_t made;
+    int type;
 
-        if (llama_vocab_is_eog(llama_model_get_vocab(state->model), new_token)) {
-            break;
-        }
+    type = llamacpp_quant_target(llm);
+    if (type < 0 || !llamacpp_quant_path(llm, type, path, sizeof(path))) return -1;
 
-        piece_len = llama_token_to_piece(llama_model_get_vocab(state->model),
-                                             new_token, piece, sizeof(piece), 0, true);
-        if (piece_len > 0 && response_len + piece_len < output_size - 1) {
-            memcpy(output + response_len, piece, piece_len);
-            response_len += piece_len;
-        }
+    made = llamacpp_file_time(path);
+    if (made == 0 || made < llamacpp_file_time(llm->config.model_path)) return type;
 
-        batch_gen.n_tokens = 1;
-        batch_gen.token[0] = new_token;
-        batch_gen.pos[0] = n_prompt_tokens + gen_count;
-        batch_gen.n_seq_id[0] = 1;
-        batch_gen.seq_id[0][0] = current_seq;
-        batch_gen.logits[0] = true;
+    llm_log(LLM_LOG_INFO, "LLM Parser: Using the %s copy of %s\n", llamacpp_quant_types[type].name,
+                          llm->config.model_path);
+    memcpy(llm->config.model_path, path, NAGI_LLM_MAX_MODEL_PATH);
+    return -1;
+}
 
-        if (llama_decode(state->ctx, batch_gen) != 0) {
-            break;
+static void *llamacpp_quant_main(void *arg)
+{
+    struct llamacpp_quant_job *job = (struct llamacpp_quant_job *)arg;
+    struct llama_model_quantize_params params;
+    char part[NAGI_LLM_MAX_MODEL_PATH + 8];
+    double start = llm_time_ms();
+
+    snprintf(part, sizeof(part), "%s.part", job->dst);
+    params = llama_model_quantize_default_params();
+    params.nthread = job->nthread;
+    params.ftype = llamacpp_quant_types[job->type].ftype;
+
+    if (llama_model_quantize(job->src, part, &params) != 0) {
+        llm_log(LLM_LOG_WARN, "LLM Parser: Could not write %s\n", part);
+        remove(part);
+    } else {
+        remove(job->dst);
+        if (rename(part, job->dst) != 0) {
+            llm_log(LLM_LOG_WARN, "LLM Parser: Could not rename %s\n", part);
+            remove(part);
+        } else {
+            llm_log(LLM_LOG_INFO, "LLM Parser: Wrote %s in %.0f s, used from the next run\n", job->dst,
+                                  (llm_time_ms() - start) / 1000.0);
         }
-        gen_count++;
     }
 
-    llama_batch_free(batch_gen);
-    output[response_len] = '\0';
+    free(job);
+    llm_atomic_store(&llamacpp_quant_busy, 0);
+    return NULL;
+}
 
-    /* Extract only the translation line (first line or after "Translate:") */
-    translate_marker = strstr(output, "Translate:");
-    start = translate_marker ? translate_marker + 10 : output;
-    
-    /* Skip whitespace */
-    while (*start == ' ' || *start == '\n' || *start == '\r' || *start == '\t') {
-        start++;
+/*
+ * Start writing the copy of the loaded model, unless it is no bigger than
+ * the copy would be. Half the physical cores do it, the game is playing.
+ */
+static void llamacpp_quant_start(nagi_llm_t *llm, int type)
+{
+    struct llamacpp_quant_job *job;
+    struct llama_cpu_set set;
+    llm_thread_t thread;
+    double bpw;
+
+    bpw = (double)llama_model_size(llm->state->model) * 8.0 /
+          (double)llama_model_n_params(llm->state->model);
+    if (bpw <= llamacpp_quant_types[type].bpw + 0.5) {
+        if (llm->config.verbose) {
+            llm_log(LLM_LOG_DEBUG, "LLM Parser: Model is already %.1f bits per weight, not requantized\n", bpw);
+        }
+        return;
     }
-    
-    /* Find end of first line */
-    end = start;
-    while (*end && *end != '\n' && *end != '\r') {
-        end++;
+    if (!llm_atomic_cas(&llamacpp_quant_busy, 0, 1)) return;
+
+    job = (struct llamacpp_quant_job *)calloc(1, sizeof(struct llamacpp_quant_job));
+    if (!job || !llamacpp_quant_path(llm, type, job->dst, sizeof(job->dst))) {
+        free(job);
+        llm_atomic_store(&llamacpp_quant_busy, 0);
+        return;
     }
-    *end = '\0';
-    
-    /* Remove trailing whitespace and punctuation artifacts */
-    end--;
-    while (end > start && (*end == ' ' || *end == '\t' || *end == '?' || *end == '!')) {
-        if (*end == '?' || *end == '!') {
-            /* Keep if it's the only punctuation at the end */
-            check = end - 1;
-            if (check > start && (*check == '?' || *check == '!')) {
-                *end = '\0';
-                end--;
-            } else {
-                break;
-            }
-        } else {
-            *end = '\0';
-            end--;
-        }
+    memcpy(job->src, llm->config.model_path, NAGI_LLM_MAX_MODEL_PATH);
+    job->type = type;
+    job->nthread = llama_cpu_physical(llm, &set) / 2;
+    if (job->nthread < 1) job->nthread = 1;
+
+#ifdef _WIN32
+    _mkdir(llm->config.quant_cache_dir);
+#else
+    mkdir(llm->config.quant_cache_dir, 0755);
+#endif
+
+    /* The job is the thread's once it starts */
+    llm_log(LLM_LOG_INFO, "LLM Parser: Writing a %s copy of the model (%.1f bits per weight) to %s\n",
+                          llamacpp_quant_types[type].name, bpw, job->dst);
+    if (!llm_thread_create(&thread, llamacpp_quant_main, job)) {
+        free(job);
+        llm_atomic_store(&llamacpp_quant_busy, 0);
+        return;
     }
-    
-    /* Move to output buffer */
-    if (start != output) {
-        memmove(output, start, strlen(start) + 1);
+    llm_thread_detach(thread);
+}
+
+/*
+ * Where the model's layers go. The draft and embedding models are loaded
+ * with the same params.
+ */
+static void llamacpp_gpu_params(nagi_llm_t *llm, struct llama_model_params *params)
+{
+    if (!llm->config.use_gpu) {
+        params->n_gpu_layers = 0;
+        return;
     }
-    response_len = (int)strlen(output);
 
-    if (llm->config.verbose && response_len > 0) {
-        printf("Generated: \"%s\"\n", output);
+    if (llm->config.n_gpu_layers == NAGI_LLM_GPU_LAYERS_AUTO) {
+        params->n_gpu_layers = llamacpp_auto_layers(llm, llm->config.model_path);
+    } else {
+        params->n_gpu_layers = llm->config.n_gpu_layers >= 0 ? llm->config.n_gpu_layers : 999;
     }
+    params->main_gpu = llm->config.main_gpu;
 
-    return response_len;
-}
+    switch (llm->config.split_mode) {
+        case NAGI_LLM_SPLIT_ROW: params->split_mode = LLAMA_SPLIT_MODE_ROW; break;
+        case NAGI_LLM_SPLIT_NONE: params->split_mode = LLAMA_SPLIT_MODE_NONE; break;
+        default: params->split_mode = LLAMA_SPLIT_MODE_LAYER; break;
+    }
 
-/* set_error is defined in nagi_llm.c - using extern declaration */
+    /* One share per GPU found, all 0 splits by free memory */
+    params->tensor_split = llm->config.tensor_split;
+}
 
 /*
  * Initialize the llama.cpp backend
@@ -443,8 +2005,7 @@ static int llamacpp_init(nagi_llm_t *llm, const char *model_path, const nagi_llm
     struct llama_model_params model_params;
     struct llama_context_params ctx_params;
     llm_state_t *state;
-    uint32_t seed;
-    float creative_temp;
+    int quant, numa;
     
     if (!llm) {
         return 0;
@@ -473,24 +2034,25 @@ static int llamacpp_init(nagi_llm_t *llm, const char *model_path, const nagi_llm
         strncpy(llm->config.model_path, model_path, NAGI_LLM_MAX_MODEL_PATH - 1);
         llm->config.model_path[NAGI_LLM_MAX_MODEL_PATH - 1] = '\0';
     }
+    if (llm->config.generation_model[0] != '\0') {
+        memcpy(llm->config.model_path, llm->config.generation_model, NAGI_LLM_MAX_MODEL_PATH);
+    }
 
     /* Initialize llama.cpp backend */
     llama_backend_init();
+    quant = llamacpp_quant_resolve(llm);
+    numa = llama_common_numa_begin(llm);
 
     /* Load model */
     model_params = llama_model_default_params();
+    llamacpp_gpu_params(llm, &model_params);
     
-    if (llm->config.use_gpu) {
-        model_params.n_gpu_layers = 999;
-        model_params.main_gpu = 0;
-    } else {
-        model_params.n_gpu_layers = 0;
-    }
-    
-    model_params.use_mmap = true;
-    model_params.use_mlock = false;
+    model_params.use_mmap = llm->config.use_mmap != 0;
+    model_params.use_mlock = llm->config.use_mlock != 0;
+    model_params.progress_callback = llama_common_load_progress;
+    model_params.progress_callback_user_data = llm;
 
-    printf("LLM Parser: Loading model from %s...\n", llm->config.model_path);
+    llm_log(LLM_LOG_INFO, "LLM Parser: Loading model from %s...\n", llm->config.model_path);
     state->model = llama_model_load_from_file(llm->config.model_path, model_params);
     if (!state->model) {
         set_error(state, "Failed to load model: %s", llm->config.model_path);
@@ -498,17 +2060,21 @@ static int llamacpp_init(nagi_llm_t *llm, const char *model_path, const nagi_llm
         free(state);
         state = NULL;
         llm->state = NULL;
+        llama_common_numa_end(numa);
         return 0;
     }
+    if (quant >= 0) {
+        llamacpp_quant_start(llm, quant);
+    }
 
     /* Create context */
     ctx_params = llama_context_default_params();
     ctx_params.n_ctx = llm->config.context_size;
     ctx_params.n_batch = llm->config.batch_size;
     ctx_params.n_ubatch = llm->config.u_batch_size;
-    ctx_params.n_threads = llm->config.n_threads;
-    ctx_params.n_threads_batch = llm->config.n_threads;
+    llama_cpu_threads(llm, &ctx_params);
     ctx_params.n_seq_max = llm->config.n_seq_max;
+    llama_common_kv_layout(llm, state->model, &ctx_params);
 
     state->ctx = llama_init_from_model(state->model, ctx_params);
     if (!state->ctx) {
@@ -517,237 +2083,207 @@ static int llamacpp_init(nagi_llm_t *llm, const char *model_path, const nagi_llm
         llama_model_free(state->model);
         free(state);
         llm->state = NULL;
+        llama_common_numa_end(numa);
         return 0;
     }
+    llama_set_abort_callback(state->ctx, llama_common_abort, llm);
 
-    /* Random seed for variety */
-    seed = (uint32_t)time(NULL) ^ (uint32_t)((uintptr_t)state);
-    
-    /* Create sampler for extraction/semantic (deterministic) */
-    state->sampler = llama_sampler_chain_init(llama_sampler_chain_default_params());
-    llama_sampler_chain_add(state->sampler, llama_sampler_init_top_k(llm->config.top_k));
-    llama_sampler_chain_add(state->sampler, llama_sampler_init_top_p(llm->config.top_p, 1));
-    llama_sampler_chain_add(state->sampler, llama_sampler_init_temp(llm->config.temperature));
-    llama_sampler_chain_add(state->sampler, llama_sampler_init_dist(seed));
-
-    /* Create sampler for response generation (creative with randomized temperature) */
-    creative_temp = llm->config.temperature_creative_base + 
-                         ((float)(seed % 100) / 100.0f) * llm->config.temperature_creative_offset;
-    state->sampler_creative = llama_sampler_chain_init(llama_sampler_chain_default_params());
-    llama_sampler_chain_add(state->sampler_creative, llama_sampler_init_top_k(40));
-    llama_sampler_chain_add(state->sampler_creative, llama_sampler_init_top_p(0.9f, 1));
-    llama_sampler_chain_add(state->sampler_creative, llama_sampler_init_temp(creative_temp));
-    llama_sampler_chain_add(state->sampler_creative, llama_sampler_init_dist(seed + 1));
-    
-    if (llm->config.verbose) {
-        printf("LLM Sampler: seed=%u, creative_temp=%.2f\n", seed, creative_temp);
+    /* Token buffer and batches reused by every request */
+    if (!llama_common_arena_init(llm)) {
+        set_error(state, "Failed to allocate work buffers");
+        fprintf(stderr, "LLM Parser: %s\n", state->last_error);
+        llama_free(state->ctx);
+        llama_model_free(state->model);
+        free(state);
+        llm->state = NULL;
+        llama_common_numa_end(numa);
+        return 0;
+    }
+
+    /* Game context sequence, only if the context has room for it */
+    if (llm->config.n_seq_max > LLAMACPP_CONTEXT_SEQ) {
+        state->context_kv = (struct llm_context_kv *)calloc(1, sizeof(struct llm_context_kv));
+        if (state->context_kv && llm->config.room_kv_cache_mb > 0) {
+            state->room_kv = (struct llm_room_kv *)calloc(1, sizeof(struct llm_room_kv));
+        }
+    }
+
+    llamacpp_draft_init(llm, model_params);
+    llamacpp_embed_init(llm, model_params);
+    llamacpp_tasks_init(llm);
+    llamacpp_threadpool_init(llm, &ctx_params);
+    llama_huge_pages(llm);
+    llama_common_numa_end(numa);
+
+    /* Sequences past the game context one let async responses share decodes */
+    if (llm->config.n_seq_max > LLAMACPP_SLOT_SEQ && !state->draft_ctx) {
+        state->slots = (struct llm_slots *)calloc(1, sizeof(struct llm_slots));
+        if (state->slots) {
+            state->slots->count = llm->config.n_seq_max - LLAMACPP_SLOT_SEQ;
+            if (state->slots->count > LLAMACPP_MAX_SLOTS) {
+                state->slots->count = LLAMACPP_MAX_SLOTS;
+            }
+        }
     }
 
+    llama_common_samplers_init(llm);
+
     state->initialized = 1;
     state->seq_counter = 0;
+    llama_common_context_attach(llm);
 
     if (llm->config.verbose) {
-        printf("LLM Parser: Initialized successfully\n");
-        printf("  Context size: %d\n", llm->config.context_size);
-        printf("  Batch size: %d\n", llm->config.batch_size);
-        printf("  Threads: %d\n", llm->config.n_threads);
-        printf("  Sequences: %d (seq 0 reserved for system prompt)\n", llm->config.n_seq_max);
+        llm_log(LLM_LOG_DEBUG, "LLM Parser: Initialized successfully\n");
+        llm_log(LLM_LOG_DEBUG, "  Context size: %d\n", llm->config.context_size);
+        llm_log(LLM_LOG_DEBUG, "  Batch size: %d\n", llm->config.batch_size);
+        llm_log(LLM_LOG_DEBUG, "  Threads: %d generation, %d batch\n",
+                               ctx_params.n_threads, ctx_params.n_threads_batch);
+        llm_log(LLM_LOG_DEBUG, "  Sequences: %d (seq 0 reserved for system prompt)\n", llm->config.n_seq_max);
     }
 
     return 1;
 }
 
 /*
- * Shutdown the llama.cpp backend
+ * Swap the game's LoRA adapter on the context
+ * The base weights stay as they are, so this is a file read away and not
+ * a model reload. What is decoded in the cached sequences was computed
+ * without the new adapter and gets decoded again.
  */
-static void llamacpp_shutdown(nagi_llm_t *llm)
+static int llamacpp_set_adapter(nagi_llm_t *llm, const char *path, float scale)
 {
     llm_state_t *state = llm->state;
+    struct llama_adapter_lora *adapter = NULL;
 
-    if (!state) return;
+    if (!state || !state->ctx) return 0;
+    if (!path && !state->adapter) return 1;
 
-    if (llm->config.verbose) {
-        fprintf(stderr, "LLM: Shutting down\n");
+    if (path) {
+        adapter = llama_adapter_lora_init(state->model, path);
+        if (!adapter) {
+            fprintf(stderr, "LLM: Cannot load LoRA adapter %s\n", path);
+            return 0;
+        }
     }
 
-    if (state->sampler) {
-        llama_sampler_free(state->sampler);
+    llama_clear_adapter_lora(state->ctx);
+    if (state->adapter) {
+        llama_adapter_lora_free(state->adapter);
     }
-    if (state->sampler_creative) {
-        llama_sampler_free(state->sampler_creative);
-    }
-    if (state->ctx) {
-        llama_free(state->ctx);
+    state->adapter = adapter;
+    if (adapter && llama_set_adapter_lora(state->ctx, adapter, scale) != 0) {
+        fprintf(stderr, "LLM: Cannot apply LoRA adapter %s\n", path);
+        llama_adapter_lora_free(adapter);
+        state->adapter = NULL;
     }
-    if (state->model) {
-        llama_model_free(state->model);
+    /* Part of the key of the prefixes saved in prompt_cache_dir */
+    state->adapter_path[0] = '\0';
+    state->adapter_scale = 0.0f;
+    if (state->adapter) {
+        snprintf(state->adapter_path, sizeof(state->adapter_path), "%s", path);
+        state->adapter_scale = scale;
     }
 
-    llama_backend_free();
-
-    free(state);
-    llm->state = NULL;
+    state->prefix_n_tokens = 0;
+    if (state->context_kv) {
+        state->context_kv->valid = 0;
+    }
+    llamacpp_room_kv_clear(state);
 
     if (llm->config.verbose) {
-        printf("LLM Parser: Shutdown complete\n");
+        llm_log(LLM_LOG_DEBUG, "LLM: LoRA adapter %s\n", state->adapter ? path : "removed");
     }
+    return state->adapter != NULL || !path;
 }
 
 /*
- * Extract verb and noun from user input (EXTRACTION mode)
+ * New sampling settings, nagi_llm_apply_config. The task models take the
+ * same ones.
  */
-static const char *llamacpp_extract_words(nagi_llm_t *llm, const char *input)
+static void llamacpp_reconfigure(nagi_llm_t *llm)
 {
-    static char response_buf[NAGI_LLM_MAX_RESPONSE_SIZE];
-    char prompt[NAGI_LLM_MAX_PROMPT_SIZE];
-    char piece[64];
-    int n_tokens, n_prompt_tokens;
-    int current_seq;
-    int response_len, gen_count, max_extract_tokens;
-    llama_token *tokens;
-    const char *verbs;
-    llm_state_t *state;
-    struct llama_batch batch, batch_gen;
-    int i, k, n_eval;
-    int piece_len;
-    char *trimmed, *end;
-
-    if (!nagi_llm_ready(llm)) return input;
-    if (!input || input[0] == '\0') return input;
-
-    /* Extract game verbs for vocabulary hint */
-    verbs = extract_game_verbs(llm);
-
-    /* Build extraction prompt with vocabulary context */
-    if (verbs && verbs[0] != '\0' && llm->extraction_prompt_template) {
-        snprintf(prompt, sizeof(prompt), llm->extraction_prompt_template,
-                 verbs, verbs, verbs, input);
-    } else if (llm->extraction_prompt_simple) {
-        snprintf(prompt, sizeof(prompt), llm->extraction_prompt_simple, input);
-    } else {
-        return input;
-    }
-
-    state = llm->state;
-    current_seq = (state->seq_counter++) % 8;
-
-    if (llm->config.verbose) {
-        printf("\n=== LLM Extraction ===\n");
-        printf("Input: \"%s\"\n", input);
-        printf("Using sequence ID: %d\n", current_seq);
-    }
+    llm_state_t *state = llm->state;
+    int i;
 
-    /* Clear KV cache for this sequence */
-    llama_memory_t mem;
-    
-    mem = llama_get_memory(state->ctx);
-    llama_memory_seq_rm(mem, current_seq, -1, -1);
+    llama_common_samplers_init(llm);
 
-    /* Tokenize prompt */
-    n_tokens = llama_n_ctx(state->ctx);
-    tokens = (llama_token *)malloc(n_tokens * sizeof(llama_token));
-    n_prompt_tokens = llama_tokenize(llama_model_get_vocab(state->model),
-                                     prompt, (int)strlen(prompt),
-                                     tokens, n_tokens, true, true);
-    if (n_prompt_tokens < 0) {
-        free(tokens);
-        return input;
+    if (!state->tasks) return;
+    for (i = 0; i < LLAMACPP_TASKS; i++) {
+        if (!state->tasks->llm[i] || (i > 0 && state->tasks->llm[i] == state->tasks->llm[i - 1])) continue;
+        nagi_llm_apply_config(state->tasks->llm[i], &llm->config);
     }
+}
 
-    /* Process prompt in batches */
-    batch = llama_batch_init(llm->config.batch_size, 0, 8);
-    for (i = 0; i < n_prompt_tokens; i += llm->config.batch_size) {
-        n_eval = n_prompt_tokens - i;
-        if (n_eval > llm->config.batch_size) n_eval = llm->config.batch_size;
+/*
+ * Shutdown the llama.cpp backend
+ */
+static void llamacpp_shutdown(nagi_llm_t *llm)
+{
+    llm_state_t *state = llm->state;
 
-        batch.n_tokens = n_eval;
-        for (k = 0; k < n_eval; k++) {
-            batch.token[k] = tokens[i + k];
-            batch.pos[k] = i + k;
-            batch.n_seq_id[k] = 1;
-            batch.seq_id[k][0] = current_seq;
-            batch.logits[k] = false;
-        }
-        if (i + n_eval == n_prompt_tokens) {
-            batch.logits[n_eval - 1] = true;
-        }
+    if (!state) return;
 
-        if (llama_decode(state->ctx, batch) != 0) {
-            llama_batch_free(batch);
-            free(tokens);
-            return input;
-        }
+    if (llm->config.verbose) {
+        fprintf(stderr, "LLM: Shutting down\n");
     }
-    llama_batch_free(batch);
-    free(tokens);
-
-    /* Generate response (extract English words) */
-    response_len = 0;
-    gen_count = 0;
-    max_extract_tokens = 10;
-    batch_gen = llama_batch_init(1, 0, 8);
-
-    while (response_len < (int)sizeof(response_buf) - 1 && gen_count < max_extract_tokens) {
-        llama_token new_token = llama_sampler_sample(state->sampler, state->ctx, -1);
-        llama_sampler_accept(state->sampler, new_token);
-
-        if (llama_vocab_is_eog(llama_model_get_vocab(state->model), new_token)) {
-            break;
-        }
-
-        piece_len = llama_token_to_piece(llama_model_get_vocab(state->model),
-                                             new_token, piece, sizeof(piece), 0, true);
-        if (piece_len > 0 && response_len + piece_len < (int)sizeof(response_buf) - 1) {
-            memcpy(response_buf + response_len, piece, piece_len);
-            response_len += piece_len;
-
-            if (strchr(piece, '\n') != NULL) {
-                break;
-            }
-        }
 
-        batch_gen.n_tokens = 1;
-        batch_gen.token[0] = new_token;
-        batch_gen.pos[0] = n_prompt_tokens + gen_count;
-        batch_gen.n_seq_id[0] = 1;
-        batch_gen.seq_id[0][0] = current_seq;
-        batch_gen.logits[0] = true;
+    llama_common_context_detach(llm);
 
-        if (llama_decode(state->ctx, batch_gen) != 0) {
-            break;
-        }
-        gen_count++;
+    if (state->sampler) {
+        llama_sampler_free(state->sampler);
     }
-
-    llama_batch_free(batch_gen);
-    response_buf[response_len] = '\0';
-
-    /* Normalize: trim whitespace and lowercase */
-    trimmed = response_buf;
-    while (*trimmed == ' ' || *trimmed == '\n' || *trimmed == '\r' || *trimmed == '\t') {
-        trimmed++;
+    if (state->sampler_creative) {
+        llama_sampler_free(state->sampler_creative);
     }
-    end = trimmed + strlen(trimmed) - 1;
-    while (end > trimmed && (*end == ' ' || *end == '\n' || *end == '\r' || *end == '\t')) {
-        *end-- = '\0';
+    if (state->grammar_sampler_combined) {
+        llama_sampler_free(state->grammar_sampler_combined);
     }
-
-    /* Convert to lowercase */
-    for (i = 0; trimmed[i]; i++) {
-        trimmed[i] = tolower((unsigned char)trimmed[i]);
+    if (state->grammar_sampler) {
+        llama_sampler_free(state->grammar_sampler);
     }
-
-    if (llm->config.verbose) {
-        printf("Extracted: \"%s\"\n", trimmed);
-        printf("===================\n\n");
+    llamacpp_tasks_free(state);
+    llama_common_arena_free(state);
+    free(state->context_kv);
+    llamacpp_room_kv_clear(state);
+    free(state->room_kv);
+    free(state->slots);
+    if (state->draft_ctx) {
+        llama_free(state->draft_ctx);
     }
-
-    /* Copy trimmed result back to start of buffer */
-    if (trimmed != response_buf) {
-        memmove(response_buf, trimmed, strlen(trimmed) + 1);
+    if (state->draft_model) {
+        llama_model_free(state->draft_model);
+    }
+    if (state->embed_ctx) {
+        llama_free(state->embed_ctx);
+    }
+    if (state->embed_model) {
+        llama_model_free(state->embed_model);
     }
+    if (state->ctx) {
+        llama_free(state->ctx);
+    }
+    /* After the contexts that use them */
+    if (state->threadpool_batch) {
+        ggml_threadpool_free(state->threadpool_batch);
+    }
+    if (state->threadpool) {
+        ggml_threadpool_free(state->threadpool);
+    }
+    if (state->adapter) {
+        llama_adapter_lora_free(state->adapter);
+    }
+    if (state->model) {
+        llama_model_free(state->model);
+    }
+
+    llama_backend_free();
+
+    free(state);
+    llm->state = NULL;
 
-    return response_buf;
+    if (llm->config.verbose) {
+        llm_log(LLM_LOG_DEBUG, "LLM Parser: Shutdown complete\n");
+    }
 }
 
 /*
@@ -775,11 +2311,26 @@ nagi_llm_t *nagi_llm_llamacpp_create(void)
     llm->config.top_k = 1;
     llm->config.max_tokens = 5;
     llm->config.use_gpu = 1;
+    llm->config.n_gpu_layers = NAGI_LLM_DEFAULT_GPU_LAYERS;
+    llm->config.gpu_reserve_mb = NAGI_LLM_DEFAULT_GPU_RESERVE_MB;
+    llm->config.reserve_cores = NAGI_LLM_DEFAULT_RESERVE_CORES;
+    llm->config.use_mmap = 1;
     llm->config.verbose = 0;
     llm->config.mode = NAGI_LLM_MODE_EXTRACTION;
     llm->config.n_seq_max = 8;
     strncpy(llm->config.personality, DEFAULT_PERSONALITY, sizeof(llm->config.personality) - 1);
     llm->config.personality[sizeof(llm->config.personality) - 1] = '\0';
+    llm->config.translation_cache_kb = NAGI_LLM_DEFAULT_CACHE_KB;
+    llm->config.extraction_memo_entries = NAGI_LLM_DEFAULT_MEMO_ENTRIES;
+    llm->config.room_kv_cache_mb = NAGI_LLM_DEFAULT_ROOM_KV_MB;
+    llm->config.match_threshold = NAGI_LLM_DEFAULT_MATCH_THRESHOLD;
+    llm->config.match_cache_entries = NAGI_LLM_DEFAULT_MATCH_CACHE_ENTRIES;
+    llm->config.embedding_match_high = NAGI_LLM_DEFAULT_EMBED_MATCH_HIGH;
+    llm->config.embedding_match_low = NAGI_LLM_DEFAULT_EMBED_MATCH_LOW;
+    llm->config.draft_tokens = NAGI_LLM_DEFAULT_DRAFT_TOKENS;
+    llm->config.lora_scale = NAGI_LLM_DEFAULT_LORA_SCALE;
+    llm->config.hedge_deadline_ms = NAGI_LLM_DEFAULT_HEDGE_DEADLINE_MS;
+    llm->config.hedge_percentile = NAGI_LLM_DEFAULT_HEDGE_PERCENTILE;
     llm->config.flash_attn = true;
     
     /* Assign function pointers */
@@ -787,7 +2338,18 @@ nagi_llm_t *nagi_llm_llamacpp_create(void)
     llm->shutdown = llamacpp_shutdown;
     llm->extract_words = llamacpp_extract_words;
     llm->matches_expected = llamacpp_matches_expected;
+    llm->matches_expected_batch = llamacpp_matches_expected_batch;
+    llm->embed_text = llamacpp_embed_text;
     llm->generate_response = llamacpp_generate_response;
+    llm->generate_response_stream = llamacpp_generate_response_stream;
+    llm->generate_response_batch = llamacpp_generate_response_batch;
+    llm->generate_slots = llamacpp_generate_slots;
+    llm->generate_begin = llamacpp_generate_begin;
+    llm->generate_step = llamacpp_generate_step;
+    llm->kv_save = llamacpp_kv_save;
+    llm->kv_load = llamacpp_kv_load;
+    llm->set_adapter = llamacpp_set_adapter;
+    llm->reconfigure = llamacpp_reconfigure;
     llm->state = NULL; 
     llm->backend = NAGI_LLM_BACKEND_LLAMACPP;
 
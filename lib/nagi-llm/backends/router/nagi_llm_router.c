@@ -0,0 +1,619 @@
+/*
+ * nagi_llm_router.c - Hedging router over a local and a cloud backend
+ *
+ * Every request goes to the local backend first. If it has not answered
+ * within the hedge deadline, the same request is also sent to the cloud
+ * backend and whichever answers first wins; the other answer is dropped.
+ * The deadline follows the local latency histogram (hedge_percentile),
+ * capped at hedge_deadline_ms, so only the slow tail pays for a cloud call.
+ *
+ * Each child backend runs on its own lane thread. A lane still busy with a
+ * request the other lane won is skipped until it is done.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../../include/nagi_llm.h"
+#include "../../include/llm_utils.h"
+#include "../../include/llm_log.h"
+#include "../../src/llm_thread.h"
+
+#define ROUTER_HIST_BUCKETS 16      /* Bucket i counts latencies below ROUTER_BUCKET_MS << i */
+#define ROUTER_BUCKET_MS 8
+#define ROUTER_MIN_SAMPLES 20       /* Local answers needed before the histogram sets the deadline */
+#define ROUTER_MAX_EXPECTED 32      /* said() takes a handful of words */
+
+#if defined(NAGI_LLM_HAS_LLAMACPP)
+#define ROUTER_LOCAL_BACKEND NAGI_LLM_BACKEND_LLAMACPP
+#else
+#define ROUTER_LOCAL_BACKEND NAGI_LLM_BACKEND_BITNET
+#endif
+
+enum {
+    ROUTER_LOCAL,
+    ROUTER_CLOUD,
+    ROUTER_LANES
+};
+
+static const char *lane_names[ROUTER_LANES] = { "local", "cloud" };
+
+typedef enum {
+    ROUTER_JOB_EXTRACT,
+    ROUTER_JOB_MATCH,
+    ROUTER_JOB_GENERATE
+} router_job_kind_t;
+
+static const nagi_llm_op_t lane_ops[] = {
+    NAGI_LLM_OP_EXTRACT, NAGI_LLM_OP_MATCH, NAGI_LLM_OP_GENERATE
+};
+
+/* A request, copied into the lane so a dropped one never points at the caller */
+typedef struct {
+    router_job_kind_t kind;
+    char input[NAGI_LLM_MAX_PROMPT_SIZE];       /* User input, or game response for GENERATE */
+    char user_input[NAGI_LLM_MAX_PROMPT_SIZE];  /* GENERATE only */
+    int expected[ROUTER_MAX_EXPECTED];          /* MATCH only */
+    int expected_count;
+    int output_size;
+
+    /* Router state at submit time, pushed to the child before it runs */
+    const unsigned char *dictionary;
+    size_t dictionary_size;
+    int dictionary_version;
+    char vocabulary[NAGI_LLM_VOCABULARY_SIZE];
+    char language[32];
+    float language_confidence;
+    struct nagi_llm_session *session;
+} router_job_t;
+
+typedef struct router router_t;
+
+typedef struct {
+    router_t *router;
+    nagi_llm_t *child;                  /* NULL if this backend failed to start */
+    llm_thread_t thread;
+    int started;
+    llm_cond_t wake;
+
+    /* Protected by router->lock */
+    int busy;                           /* Job posted and not finished */
+    unsigned int ticket;                /* Request the job belongs to */
+    router_job_t job;
+    int result;                         /* Backend return value */
+    char output[NAGI_LLM_MAX_RESPONSE_SIZE];
+    char language[32];                  /* Child's session language after the job */
+    float language_confidence;
+
+    /* Lane thread only */
+    int dictionary_version;             /* Dictionary last pushed to the child */
+
+    /* Latency histogram, protected by router->lock */
+    unsigned int hist[ROUTER_HIST_BUCKETS];
+    unsigned int samples;
+    unsigned int wins;
+} router_lane_t;
+
+struct router {
+    router_lane_t lanes[ROUTER_LANES];
+    llm_mutex_t lock;
+    llm_cond_t done;                    /* Broadcast when a lane finishes */
+    int quit;
+    unsigned int ticket;
+    unsigned int requests;
+    unsigned int hedged;
+    router_job_t job;                   /* Request being built, calls are serialized */
+};
+
+static void lane_record(router_lane_t *lane, double ms)
+{
+    int bucket = 0;
+
+    while (bucket < ROUTER_HIST_BUCKETS - 1 && ms >= (double)(ROUTER_BUCKET_MS << bucket)) {
+        bucket++;
+    }
+    lane->hist[bucket]++;
+    lane->samples++;
+}
+
+/*
+ * Upper bound of the bucket holding the given percentile, in ms
+ */
+static int lane_percentile(const router_lane_t *lane, float percentile)
+{
+    unsigned int target, seen = 0;
+    int i;
+
+    target = (unsigned int)((float)lane->samples * percentile / 100.0f);
+    if (target < 1) target = 1;
+
+    for (i = 0; i < ROUTER_HIST_BUCKETS; i++) {
+        seen += lane->hist[i];
+        if (seen >= target) break;
+    }
+    if (i == ROUTER_HIST_BUCKETS) i--;
+    return ROUTER_BUCKET_MS << i;
+}
+
+/*
+ * How long the local lane gets before the request is also sent to the cloud
+ */
+static int router_hedge_deadline(nagi_llm_t *llm)
+{
+    router_t *router = (router_t *)llm->backend_data;
+    const router_lane_t *local = &router->lanes[ROUTER_LOCAL];
+    int deadline = llm->config.hedge_deadline_ms;
+    int tail;
+
+    if (local->samples < ROUTER_MIN_SAMPLES) return deadline;
+
+    tail = lane_percentile(local, llm->config.hedge_percentile);
+    return tail < deadline ? tail : deadline;
+}
+
+/*
+ * Run one job on the child backend
+ */
+static void lane_run(router_lane_t *lane)
+{
+    nagi_llm_t *child = lane->child;
+    router_job_t *job = &lane->job;
+    llm_state_t *state = child->state;
+    const char *words;
+    llm_stats_call_t call;
+    int size;
+
+    if (job->dictionary && job->dictionary_version != lane->dictionary_version) {
+        nagi_llm_set_dictionary(child, job->dictionary, job->dictionary_size);
+        lane->dictionary_version = job->dictionary_version;
+    }
+    memcpy(child->vocabulary, job->vocabulary, sizeof(child->vocabulary));
+    child->session = job->session;
+    if (job->language[0] && !state->detected_language[0]) {
+        strncpy(state->detected_language, job->language, sizeof(state->detected_language) - 1);
+        state->detected_language[sizeof(state->detected_language) - 1] = '\0';
+        state->language_confidence = job->language_confidence;
+    }
+
+    /* The child keeps its own telemetry, next to the router's */
+    call = llm_stats_begin(child, lane_ops[job->kind], llm_time_ms());
+
+    lane->output[0] = '\0';
+    switch (job->kind) {
+        case ROUTER_JOB_EXTRACT:
+            words = child->extract_words(child, job->input, lane->output, (int)sizeof(lane->output));
+            if (!words) words = job->input;
+            if (words != lane->output) {
+                strncpy(lane->output, words, sizeof(lane->output) - 1);
+                lane->output[sizeof(lane->output) - 1] = '\0';
+            }
+            lane->result = 1;
+            break;
+
+        case ROUTER_JOB_MATCH:
+            lane->result = child->matches_expected(child, job->input, job->expected,
+                                                   job->expected_count);
+            break;
+
+        case ROUTER_JOB_GENERATE:
+            size = job->output_size < (int)sizeof(lane->output) ? job->output_size
+                                                                 : (int)sizeof(lane->output);
+            lane->result = child->generate_response(child, job->input, job->user_input,
+                                                    lane->output, size);
+            break;
+    }
+
+    llm_stats_end(child, call);
+}
+
+static void *lane_main(void *arg)
+{
+    router_lane_t *lane = (router_lane_t *)arg;
+    router_t *router = lane->router;
+    double start, elapsed;
+
+    llm_mutex_lock(&router->lock);
+    for (;;) {
+        while (!lane->busy && !router->quit) {
+            llm_cond_wait(&lane->wake, &router->lock);
+        }
+        if (!lane->busy) break;
+
+        /* Nobody touches the job or the child while the lane is busy */
+        llm_mutex_unlock(&router->lock);
+        start = llm_time_ms();
+        lane_run(lane);
+        elapsed = llm_time_ms() - start;
+        llm_mutex_lock(&router->lock);
+
+        strncpy(lane->language, lane->child->state->detected_language, sizeof(lane->language) - 1);
+        lane->language[sizeof(lane->language) - 1] = '\0';
+        lane->language_confidence = lane->child->state->language_confidence;
+
+        /* Dropped answers count too, they are real latencies */
+        lane_record(lane, elapsed);
+        lane->busy = 0;
+        llm_cond_broadcast(&router->done);
+    }
+    llm_mutex_unlock(&router->lock);
+
+    return NULL;
+}
+
+/*
+ * Hand the current request to a lane
+ * Returns 0 if the lane has no backend or is still busy (call with lock held)
+ */
+static int lane_post(router_t *router, router_lane_t *lane, unsigned int ticket)
+{
+    if (!lane->child || lane->busy) return 0;
+
+    memcpy(&lane->job, &router->job, sizeof(router_job_t));
+    lane->ticket = ticket;
+    lane->result = 0;
+    lane->busy = 1;
+    llm_cond_signal(&lane->wake);
+    return 1;
+}
+
+static int lane_answered(const router_lane_t *lane)
+{
+    /* A failed generation or match may still be saved by the other backend */
+    if (lane->job.kind == ROUTER_JOB_MATCH) return lane->result != NAGI_LLM_MATCH_ERROR;
+    return lane->job.kind != ROUTER_JOB_GENERATE || lane->result > 0;
+}
+
+/*
+ * Run router->job on the fastest backend
+ * Returns the lane holding the answer; it stays untouched until the next request
+ */
+static router_lane_t *router_run(nagi_llm_t *llm)
+{
+    router_t *router = (router_t *)llm->backend_data;
+    llm_state_t *state = llm->state;
+    router_job_t *job = &router->job;
+    router_lane_t *winner = NULL;
+    router_lane_t *failed, *pending;
+    unsigned int ticket;
+    int running, deadline, wait_ms, i;
+    double start;
+
+    job->dictionary = state->dictionary_data;
+    job->dictionary_size = state->dictionary_size;
+    job->dictionary_version = state->grammar_version;
+    memcpy(job->vocabulary, llm->vocabulary, sizeof(job->vocabulary));
+    job->session = llm->session;
+    memcpy(job->language, state->detected_language, sizeof(job->language));
+    job->language_confidence = state->language_confidence;
+
+    llm_mutex_lock(&router->lock);
+    ticket = ++router->ticket;
+    router->requests++;
+
+    while (!lane_post(router, &router->lanes[ROUTER_LOCAL], ticket) &&
+           !lane_post(router, &router->lanes[ROUTER_CLOUD], ticket)) {
+        llm_cond_wait(&router->done, &router->lock);
+    }
+
+    deadline = router_hedge_deadline(llm);
+    start = llm_time_ms();
+
+    for (;;) {
+        failed = NULL;
+        pending = NULL;
+        running = 0;
+
+        for (i = 0; i < ROUTER_LANES && !winner; i++) {
+            router_lane_t *lane = &router->lanes[i];
+
+            if (!lane->child) continue;
+            if (lane->ticket != ticket) {
+                pending = lane;
+            } else if (lane->busy) {
+                running++;
+            } else if (lane_answered(lane)) {
+                winner = lane;
+            } else {
+                failed = lane;
+            }
+        }
+        if (winner) break;
+
+        /* Nothing left to try, hand back the failure */
+        if (!running && !pending) {
+            winner = failed;
+            break;
+        }
+
+        if (pending && !pending->busy) {
+            wait_ms = running ? deadline - (int)(llm_time_ms() - start) : 0;
+            if (wait_ms <= 0) {
+                lane_post(router, pending, ticket);
+                router->hedged++;
+                continue;
+            }
+            llm_cond_timedwait(&router->done, &router->lock, wait_ms);
+        } else {
+            llm_cond_wait(&router->done, &router->lock);
+        }
+    }
+
+    winner->wins++;
+    if (winner->language[0]) {
+        memcpy(state->detected_language, winner->language, sizeof(state->detected_language));
+        state->language_confidence = winner->language_confidence;
+    }
+    llm_mutex_unlock(&router->lock);
+
+    if (llm->config.verbose) {
+        llm_log(LLM_LOG_DEBUG, "Router: %s answered in %.0f ms (deadline %d ms)\n",
+                               lane_names[winner - router->lanes], llm_time_ms() - start, deadline);
+    }
+
+    return winner;
+}
+
+static void router_print_stats(nagi_llm_t *llm)
+{
+    router_t *router = (router_t *)llm->backend_data;
+    int i, b;
+
+    llm_log(LLM_LOG_INFO, "Router: %u requests, %u hedged\n", router->requests, router->hedged);
+    for (i = 0; i < ROUTER_LANES; i++) {
+        router_lane_t *lane = &router->lanes[i];
+
+        if (!lane->child || !lane->samples) continue;
+        llm_log(LLM_LOG_INFO, "Router: %s won %u of %u, p50 < %d ms, p95 < %d ms\n", lane_names[i],
+                              lane->wins, lane->samples, lane_percentile(lane, 50.0f),
+                              lane_percentile(lane, 95.0f));
+        for (b = 0; b < ROUTER_HIST_BUCKETS; b++) {
+            if (lane->hist[b]) {
+                llm_log(LLM_LOG_INFO, "Router:   < %6d ms: %u\n", ROUTER_BUCKET_MS << b, lane->hist[b]);
+            }
+        }
+    }
+}
+
+/*
+ * Stop the lane threads and free the children
+ */
+static void router_free(nagi_llm_t *llm)
+{
+    router_t *router = (router_t *)llm->backend_data;
+    int i;
+
+    if (!router) return;
+
+    llm_mutex_lock(&router->lock);
+    router->quit = 1;
+    for (i = 0; i < ROUTER_LANES; i++) {
+        llm_cond_signal(&router->lanes[i].wake);
+    }
+    llm_mutex_unlock(&router->lock);
+
+    /* A lane may still be finishing an answer that lost */
+    for (i = 0; i < ROUTER_LANES; i++) {
+        if (router->lanes[i].started) {
+            llm_thread_join(router->lanes[i].thread);
+        }
+    }
+
+    if (llm->config.verbose && router->requests) {
+        router_print_stats(llm);
+    }
+
+    for (i = 0; i < ROUTER_LANES; i++) {
+        nagi_llm_destroy(router->lanes[i].child);
+        llm_cond_destroy(&router->lanes[i].wake);
+    }
+    llm_cond_destroy(&router->done);
+    llm_mutex_destroy(&router->lock);
+    free(router);
+    llm->backend_data = NULL;
+}
+
+/*
+ * Create and initialize one child with its own section of llm_config.ini
+ */
+static nagi_llm_t *router_child_init(nagi_llm_backend_t backend, const char *model_path)
+{
+    nagi_llm_config_t config;
+    nagi_llm_t *child;
+    int ok;
+
+    child = nagi_llm_create(backend);
+    if (!child) return NULL;
+
+    if (nagi_llm_load_config(&config, backend, NULL)) {
+        ok = nagi_llm_init(child, model_path, &config);
+    } else {
+        ok = nagi_llm_init(child, model_path, NULL);
+    }
+
+    if (!ok) {
+        nagi_llm_destroy(child);
+        return NULL;
+    }
+    return child;
+}
+
+static int router_init(nagi_llm_t *llm, const char *model_path, const nagi_llm_config_t *config)
+{
+    router_t *router;
+    int i, lanes = 0;
+
+    if (config) {
+        memcpy(&llm->config, config, sizeof(nagi_llm_config_t));
+    }
+    if (model_path && model_path[0] != '\0') {
+        strncpy(llm->config.model_path, model_path, NAGI_LLM_MAX_MODEL_PATH - 1);
+        llm->config.model_path[NAGI_LLM_MAX_MODEL_PATH - 1] = '\0';
+    }
+
+    if (!llm->state) {
+        llm->state = (llm_state_t *)calloc(1, sizeof(llm_state_t));
+        if (!llm->state) return 0;
+    }
+
+    router = (router_t *)calloc(1, sizeof(router_t));
+    if (!router) {
+        free(llm->state);
+        llm->state = NULL;
+        return 0;
+    }
+    llm_mutex_init(&router->lock);
+    llm_cond_init(&router->done);
+    for (i = 0; i < ROUTER_LANES; i++) {
+        router->lanes[i].router = router;
+        llm_cond_init(&router->lanes[i].wake);
+    }
+    llm->backend_data = router;
+
+    /* Local model first, it takes the time; the cloud model name is in [cloud] */
+    router->lanes[ROUTER_LOCAL].child = router_child_init(ROUTER_LOCAL_BACKEND, llm->config.model_path);
+    if (!router->lanes[ROUTER_LOCAL].child) {
+        fprintf(stderr, "Router: Local backend failed, using the cloud only\n");
+    }
+    if (!llm_load_progress(llm, 0.9f)) {
+        router_free(llm);
+        free(llm->state);
+        llm->state = NULL;
+        return 0;
+    }
+
+    router->lanes[ROUTER_CLOUD].child = router_child_init(NAGI_LLM_BACKEND_CLOUD, NULL);
+    if (!router->lanes[ROUTER_CLOUD].child) {
+        fprintf(stderr, "Router: Cloud backend failed, using the local model only\n");
+    }
+
+    for (i = 0; i < ROUTER_LANES; i++) {
+        router_lane_t *lane = &router->lanes[i];
+
+        if (!lane->child) continue;
+        if (!llm_thread_create(&lane->thread, lane_main, lane)) {
+            fprintf(stderr, "Router: Failed to start the %s lane\n", lane_names[i]);
+            nagi_llm_destroy(lane->child);
+            lane->child = NULL;
+            continue;
+        }
+        lane->started = 1;
+        lanes++;
+    }
+
+    if (!lanes) {
+        fprintf(stderr, "Router: No backend available\n");
+        router_free(llm);
+        free(llm->state);
+        llm->state = NULL;
+        return 0;
+    }
+
+    if (llm->config.verbose) {
+        llm_log(LLM_LOG_DEBUG, "Router: Hedging after %d ms or the local p%.0f\n",
+                               llm->config.hedge_deadline_ms, llm->config.hedge_percentile);
+    }
+
+    llm->state->initialized = 1;
+    return 1;
+}
+
+static void router_shutdown(nagi_llm_t *llm)
+{
+    router_free(llm);
+    if (llm->state) {
+        free(llm->state);
+        llm->state = NULL;
+    }
+}
+
+static const char *router_extract_words(nagi_llm_t *llm, const char *input,
+                                        char *out, int out_size)
+{
+    router_t *router = (router_t *)llm->backend_data;
+    router_lane_t *lane;
+
+    if (!input || input[0] == '\0' || !nagi_llm_ready(llm)) return input;
+
+    router->job.kind = ROUTER_JOB_EXTRACT;
+    strncpy(router->job.input, input, sizeof(router->job.input) - 1);
+    router->job.input[sizeof(router->job.input) - 1] = '\0';
+
+    lane = router_run(llm);
+    strncpy(out, lane->output, (size_t)out_size - 1);
+    out[out_size - 1] = '\0';
+    return out;
+}
+
+static int router_matches_expected(nagi_llm_t *llm, const char *input,
+                                   const int *expected_word_ids, int expected_count)
+{
+    router_t *router = (router_t *)llm->backend_data;
+
+    if (!input || !nagi_llm_ready(llm)) return NAGI_LLM_MATCH_ERROR;
+    if (expected_count > ROUTER_MAX_EXPECTED) expected_count = ROUTER_MAX_EXPECTED;
+
+    router->job.kind = ROUTER_JOB_MATCH;
+    strncpy(router->job.input, input, sizeof(router->job.input) - 1);
+    router->job.input[sizeof(router->job.input) - 1] = '\0';
+    memcpy(router->job.expected, expected_word_ids, expected_count * sizeof(int));
+    router->job.expected_count = expected_count;
+
+    return router_run(llm)->result;
+}
+
+static int router_generate_response(nagi_llm_t *llm, const char *game_response,
+                                    const char *user_input, char *output, int output_size)
+{
+    router_t *router = (router_t *)llm->backend_data;
+    router_lane_t *lane;
+
+    if (!game_response || !output || output_size <= 0 || !nagi_llm_ready(llm)) return 0;
+
+    router->job.kind = ROUTER_JOB_GENERATE;
+    strncpy(router->job.input, game_response, sizeof(router->job.input) - 1);
+    router->job.input[sizeof(router->job.input) - 1] = '\0';
+    strncpy(router->job.user_input, user_input ? user_input : "", sizeof(router->job.user_input) - 1);
+    router->job.user_input[sizeof(router->job.user_input) - 1] = '\0';
+    router->job.output_size = output_size;
+
+    lane = router_run(llm);
+    if (lane->result <= 0) return lane->result;
+
+    strncpy(output, lane->output, output_size - 1);
+    output[output_size - 1] = '\0';
+    return (int)strlen(output);
+}
+
+nagi_llm_t *nagi_llm_router_create(void)
+{
+    nagi_llm_t *llm = (nagi_llm_t *)calloc(1, sizeof(nagi_llm_t));
+    if (!llm) return NULL;
+
+    llm->backend = NAGI_LLM_BACKEND_ROUTER;
+    llm->init = router_init;
+    llm->shutdown = router_shutdown;
+    llm->extract_words = router_extract_words;
+    llm->matches_expected = router_matches_expected;
+    llm->generate_response = router_generate_response;
+
+    /* Set default temperature values */
+    llm->config.temperature = 0.0f;
+    llm->config.temperature_creative_base = 0.3f;
+    llm->config.temperature_creative_offset = 0.2f;
+    llm->config.max_tokens = 512;
+    llm->config.verbose = 0;
+    strncpy(llm->config.personality, DEFAULT_PERSONALITY, sizeof(llm->config.personality) - 1);
+    llm->config.personality[sizeof(llm->config.personality) - 1] = '\0';
+    llm->config.translation_cache_kb = NAGI_LLM_DEFAULT_CACHE_KB;
+    llm->config.extraction_memo_entries = NAGI_LLM_DEFAULT_MEMO_ENTRIES;
+    llm->config.match_threshold = NAGI_LLM_DEFAULT_MATCH_THRESHOLD;
+    llm->config.match_cache_entries = NAGI_LLM_DEFAULT_MATCH_CACHE_ENTRIES;
+    llm->config.embedding_match_high = NAGI_LLM_DEFAULT_EMBED_MATCH_HIGH;
+    llm->config.embedding_match_low = NAGI_LLM_DEFAULT_EMBED_MATCH_LOW;
+    llm->config.draft_tokens = NAGI_LLM_DEFAULT_DRAFT_TOKENS;
+    llm->config.hedge_deadline_ms = NAGI_LLM_DEFAULT_HEDGE_DEADLINE_MS;
+    llm->config.hedge_percentile = NAGI_LLM_DEFAULT_HEDGE_PERCENTILE;
+
+    return llm;
+}
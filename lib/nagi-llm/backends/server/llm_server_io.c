@@ -0,0 +1,565 @@
+/*
+ * llm_server_io.c - Framing shared by nagi-llm-server and the client backend
+ *
+ * Frames go over the Unix socket, or on Linux through two single
+ * producer / single consumer rings in a shared memory segment, one per
+ * direction. A ring record is an 8 byte length word, the frame header,
+ * the payload and a NUL, rounded up to 8 bytes; a record that would run
+ * past the end of the ring is preceded by a padding record up to the end.
+ * Head and tail count bytes and only ever grow, the ring size being a
+ * power of two makes them wrap cleanly.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "nagi_llm_server.h"
+#include "../../src/llm_thread.h"
+
+#if defined(__linux__)
+#define LLM_SERVER_HAS_SHM 1
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#endif
+
+/* The other end going away must not kill the process with SIGPIPE */
+#ifdef MSG_NOSIGNAL
+#define SERVER_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SERVER_SEND_FLAGS 0
+#endif
+
+static int server_address(struct sockaddr_un *addr, const char *path)
+{
+    if (!path || strlen(path) >= sizeof(addr->sun_path)) {
+        fprintf(stderr, "LLM Server: Bad socket path '%s'\n", path ? path : "");
+        return 0;
+    }
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+    return 1;
+}
+
+static int server_socket(void)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+#ifdef SO_NOSIGPIPE
+    if (fd >= 0) {
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+    }
+#endif
+    return fd;
+}
+
+int llm_server_connect(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (!server_address(&addr, path)) return -1;
+
+    fd = server_socket();
+    if (fd < 0) return -1;
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int llm_server_listen(const char *path)
+{
+    struct sockaddr_un addr;
+    int fd;
+
+    if (!server_address(&addr, path)) return -1;
+
+    fd = server_socket();
+    if (fd < 0) return -1;
+
+    /* A socket left behind by a server that died would block the bind */
+    unlink(path);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(fd, 16) != 0) {
+        fprintf(stderr, "LLM Server: Cannot listen on %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+void llm_server_frame(nagi_llm_server_frame_t *frame, nagi_llm_server_op_t op, int value,
+                      uint32_t size)
+{
+    memset(frame, 0, sizeof(*frame));
+    frame->magic = NAGI_LLM_SERVER_MAGIC;
+    frame->op = op;
+    frame->value = value;
+    frame->size = size;
+}
+
+static int server_write(int fd, const void *data, size_t size)
+{
+    const char *p = (const char *)data;
+    ssize_t n;
+
+    while (size > 0) {
+        n = send(fd, p, size, SERVER_SEND_FLAGS);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        p += n;
+        size -= (size_t)n;
+    }
+    return 1;
+}
+
+static int server_read(int fd, void *data, size_t size)
+{
+    char *p = (char *)data;
+    ssize_t n;
+
+    while (size > 0) {
+        n = recv(fd, p, size, 0);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        p += n;
+        size -= (size_t)n;
+    }
+    return 1;
+}
+
+static int server_frame_ok(const nagi_llm_server_frame_t *frame)
+{
+    if (frame->magic != NAGI_LLM_SERVER_MAGIC || frame->size > NAGI_LLM_SERVER_MAX_PAYLOAD) {
+        fprintf(stderr, "LLM Server: Bad frame from the other end\n");
+        return 0;
+    }
+    return 1;
+}
+
+#ifdef LLM_SERVER_HAS_SHM
+
+/*
+ * The socket carries nothing once the rings are in use, so anything
+ * happening on it means the other end closed it
+ */
+static int server_alive(llm_server_link_t *link)
+{
+    struct pollfd pfd;
+    int n;
+
+    if (link->fd < 0) return 0;
+    pfd.fd = link->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    n = poll(&pfd, 1, 0);
+    return n == 0 || (n < 0 && errno == EINTR);
+}
+
+#define SHM_MAGIC 0x4D485353                /* "SSHM" */
+#define SHM_RING_SIZE (2u << 20)            /* Power of two that fits the largest frame */
+#define SHM_ALIGN 8u
+#define SHM_PAD 0x80000000u                 /* Length word of a padding record */
+#define SHM_SPIN 2000                       /* Checks before going to sleep */
+#define SHM_CHECK_MS 50                     /* How often a sleeper looks at the socket */
+
+#define SHM_RECORD(size) \
+    (((uint32_t)(SHM_ALIGN + sizeof(nagi_llm_server_frame_t) + (size) + 1) + SHM_ALIGN - 1) & \
+     ~(SHM_ALIGN - 1))
+
+/*
+ * Head and tail sit on their own cache lines, each is written by one side.
+ * They're plain words the futex can be given, always read and written
+ * through the __atomic builtins
+ */
+typedef struct {
+    uint32_t head;                          /* Bytes written */
+    uint32_t reader_waiting;                /* Reader is asleep on head */
+    char pad0[56];
+    uint32_t tail;                          /* Bytes read */
+    uint32_t writer_waiting;                /* Writer is asleep on tail */
+    char pad1[56];
+    char data[SHM_RING_SIZE];
+} shm_ring_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t ring_size;
+    char pad[56];
+    shm_ring_t ring[2];                     /* ring[side] carries what that side sends */
+} shm_layout_t;
+
+struct llm_server_shm {
+    shm_layout_t *map;
+    char name[64];
+    int owner;                              /* Created here, the name goes on close */
+};
+
+/* Not FUTEX_PRIVATE, the word is shared between processes */
+static void shm_futex_wait(uint32_t *word, uint32_t seen, int ms)
+{
+    struct timespec ts;
+
+    ts.tv_sec = ms / 1000;
+    ts.tv_nsec = (long)(ms % 1000) * 1000000L;
+    syscall(SYS_futex, word, FUTEX_WAIT, seen, &ts, NULL, 0);
+}
+
+static void shm_futex_wake(uint32_t *word)
+{
+    syscall(SYS_futex, word, FUTEX_WAKE, 1, NULL, NULL, 0);
+}
+
+/*
+ * Wait for *word to move on from seen, spinning a little first since the
+ * other end usually answers within microseconds. ms < 0 waits for good.
+ * Returns 1 when it moved, 0 on timeout, -1 if the other end is gone.
+ */
+static int shm_wait_change(llm_server_link_t *link, uint32_t *word,
+                           uint32_t *waiting, uint32_t seen, int ms)
+{
+    double until = llm_time_ms() + ms;
+    int i, slice;
+
+    for (i = 0; i < SHM_SPIN; i++) {
+        if (__atomic_load_n(word, __ATOMIC_SEQ_CST) != seen) return 1;
+    }
+
+    for (;;) {
+        slice = SHM_CHECK_MS;
+        if (ms >= 0) {
+            double left = until - llm_time_ms();
+
+            if (left <= 0) return 0;
+            if (left < slice) slice = (int)left + 1;
+        }
+
+        /* The other end checks the flag after it moves the word */
+        __atomic_store_n(waiting, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(word, __ATOMIC_SEQ_CST) == seen) {
+            shm_futex_wait(word, seen, slice);
+        }
+        __atomic_store_n(waiting, 0, __ATOMIC_SEQ_CST);
+
+        if (__atomic_load_n(word, __ATOMIC_SEQ_CST) != seen) return 1;
+        if (!server_alive(link)) return -1;
+    }
+}
+
+/* Wait for need bytes of room after head */
+static int shm_room(llm_server_link_t *link, shm_ring_t *ring, uint32_t head, uint32_t need)
+{
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST);
+
+    while (SHM_RING_SIZE - (head - tail) < need) {
+        if (shm_wait_change(link, &ring->tail, &ring->writer_waiting, tail, -1) < 0) return 0;
+        tail = __atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST);
+    }
+    return 1;
+}
+
+static int shm_send(llm_server_link_t *link, const nagi_llm_server_frame_t *frame,
+                    const void *payload)
+{
+    shm_ring_t *ring = &link->shm->map->ring[link->side];
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+    uint32_t need = SHM_RECORD(frame->size);
+    uint32_t off = head & (SHM_RING_SIZE - 1);
+    char *record;
+
+    /* Records stay contiguous so the reader can use them in place */
+    if (SHM_RING_SIZE - off < need) {
+        uint32_t rest = SHM_RING_SIZE - off;
+
+        if (!shm_room(link, ring, head, rest)) return 0;
+        *(uint32_t *)(ring->data + off) = rest | SHM_PAD;
+        head += rest;
+        __atomic_store_n(&ring->head, head, __ATOMIC_SEQ_CST);
+        off = 0;
+    }
+    if (!shm_room(link, ring, head, need)) return 0;
+
+    record = ring->data + off;
+    *(uint32_t *)record = need;
+    memcpy(record + SHM_ALIGN, frame, sizeof(*frame));
+    if (frame->size > 0) {
+        memcpy(record + SHM_ALIGN + sizeof(*frame), payload, frame->size);
+    }
+    record[SHM_ALIGN + sizeof(*frame) + frame->size] = '\0';
+
+    __atomic_store_n(&ring->head, head + need, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&ring->reader_waiting, __ATOMIC_SEQ_CST)) {
+        shm_futex_wake(&ring->head);
+    }
+    return 1;
+}
+
+static int shm_recv(llm_server_link_t *link, nagi_llm_server_frame_t *frame,
+                    const char **payload)
+{
+    shm_ring_t *ring = &link->shm->map->ring[!link->side];
+    uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+    uint32_t length;
+    const char *record;
+
+    for (;;) {
+        uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+
+        if (head == tail) {
+            if (shm_wait_change(link, &ring->head, &ring->reader_waiting, tail, -1) < 0) return 0;
+            continue;
+        }
+
+        record = ring->data + (tail & (SHM_RING_SIZE - 1));
+        length = *(const uint32_t *)record;
+        if (!(length & SHM_PAD)) break;
+
+        tail += length & ~SHM_PAD;
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&ring->writer_waiting, __ATOMIC_SEQ_CST)) {
+            shm_futex_wake(&ring->tail);
+        }
+    }
+
+    memcpy(frame, record + SHM_ALIGN, sizeof(*frame));
+    if (!server_frame_ok(frame) || length != SHM_RECORD(frame->size)) return 0;
+    frame->language[sizeof(frame->language) - 1] = '\0';
+
+    *payload = frame->size > 0 ? record + SHM_ALIGN + sizeof(*frame) : NULL;
+    link->held = length;
+    return 1;
+}
+
+static void shm_release(llm_server_link_t *link)
+{
+    shm_ring_t *ring = &link->shm->map->ring[!link->side];
+
+    __atomic_store_n(&ring->tail, __atomic_load_n(&ring->tail, __ATOMIC_RELAXED) + link->held,
+                     __ATOMIC_SEQ_CST);
+    link->held = 0;
+    if (__atomic_load_n(&ring->writer_waiting, __ATOMIC_SEQ_CST)) {
+        shm_futex_wake(&ring->tail);
+    }
+}
+
+static int shm_wait(llm_server_link_t *link, int ms)
+{
+    shm_ring_t *ring = &link->shm->map->ring[!link->side];
+    uint32_t next = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED) + link->held;
+
+    /* The frame being served is still in the ring, look past it */
+    if (__atomic_load_n(&ring->head, __ATOMIC_SEQ_CST) != next) return 1;
+    return shm_wait_change(link, &ring->head, &ring->reader_waiting, next, ms);
+}
+
+static llm_server_shm_t *shm_map(const char *name, int fd, int owner)
+{
+    llm_server_shm_t *shm;
+    void *map;
+
+    map = mmap(NULL, sizeof(shm_layout_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "LLM Server: Cannot map %s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+
+    shm = (llm_server_shm_t *)calloc(1, sizeof(llm_server_shm_t));
+    if (!shm) {
+        munmap(map, sizeof(shm_layout_t));
+        return NULL;
+    }
+    shm->map = (shm_layout_t *)map;
+    strncpy(shm->name, name, sizeof(shm->name) - 1);
+    shm->owner = owner;
+    return shm;
+}
+
+static void shm_free(llm_server_shm_t *shm)
+{
+    munmap(shm->map, sizeof(shm_layout_t));
+    if (shm->owner) {
+        shm_unlink(shm->name);
+    }
+    free(shm);
+}
+
+llm_server_shm_t *llm_server_shm_create(char *name, size_t name_size)
+{
+    static _Atomic unsigned int serial = 0;
+    llm_server_shm_t *shm;
+    int fd;
+
+    snprintf(name, name_size, "/nagi-llm-%d-%u", (int)getpid(), atomic_fetch_add(&serial, 1));
+    fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        fprintf(stderr, "LLM Server: Cannot create %s: %s\n", name, strerror(errno));
+        return NULL;
+    }
+    /* New pages read as zero, which is an empty ring */
+    if (ftruncate(fd, sizeof(shm_layout_t)) != 0) {
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+
+    shm = shm_map(name, fd, 1);
+    if (!shm) {
+        shm_unlink(name);
+        return NULL;
+    }
+    shm->map->ring_size = SHM_RING_SIZE;
+    shm->map->magic = SHM_MAGIC;
+    return shm;
+}
+
+llm_server_shm_t *llm_server_shm_open(const char *name)
+{
+    llm_server_shm_t *shm;
+    struct stat st;
+    int fd;
+
+    fd = shm_open(name, O_RDWR, 0);
+    if (fd < 0) return NULL;
+    /* Both ends are mapped now, nobody else needs the name */
+    shm_unlink(name);
+
+    if (fstat(fd, &st) != 0 || st.st_size != (off_t)sizeof(shm_layout_t)) {
+        close(fd);
+        return NULL;
+    }
+    shm = shm_map(name, fd, 0);
+    if (shm && (shm->map->magic != SHM_MAGIC || shm->map->ring_size != SHM_RING_SIZE)) {
+        shm_free(shm);
+        return NULL;
+    }
+    return shm;
+}
+
+#else
+
+llm_server_shm_t *llm_server_shm_create(char *name, size_t name_size)
+{
+    (void)name;
+    (void)name_size;
+    return NULL;
+}
+
+llm_server_shm_t *llm_server_shm_open(const char *name)
+{
+    (void)name;
+    return NULL;
+}
+
+#endif /* LLM_SERVER_HAS_SHM */
+
+void llm_server_link_init(llm_server_link_t *link, int fd, int side)
+{
+    memset(link, 0, sizeof(*link));
+    link->fd = fd;
+    link->side = side;
+}
+
+void llm_server_link_attach(llm_server_link_t *link, llm_server_shm_t *shm)
+{
+    link->shm = shm;
+    link->held = 0;
+}
+
+void llm_server_link_close(llm_server_link_t *link)
+{
+#ifdef LLM_SERVER_HAS_SHM
+    if (link->shm) {
+        shm_free(link->shm);
+    }
+#endif
+    link->shm = NULL;
+    link->held = 0;
+    if (link->fd >= 0) {
+        close(link->fd);
+    }
+    link->fd = -1;
+    free(link->buf);
+    link->buf = NULL;
+    link->buf_size = 0;
+}
+
+int llm_server_send(llm_server_link_t *link, const nagi_llm_server_frame_t *frame,
+                    const void *payload)
+{
+    if (frame->size > NAGI_LLM_SERVER_MAX_PAYLOAD) return 0;
+#ifdef LLM_SERVER_HAS_SHM
+    if (link->shm) return shm_send(link, frame, payload);
+#endif
+    if (link->fd < 0 || !server_write(link->fd, frame, sizeof(*frame))) return 0;
+    return frame->size == 0 || server_write(link->fd, payload, frame->size);
+}
+
+int llm_server_recv(llm_server_link_t *link, nagi_llm_server_frame_t *frame,
+                    const char **payload)
+{
+    *payload = NULL;
+    llm_server_release(link);
+#ifdef LLM_SERVER_HAS_SHM
+    if (link->shm) return shm_recv(link, frame, payload);
+#endif
+    if (link->fd < 0 || !server_read(link->fd, frame, sizeof(*frame))) return 0;
+    if (!server_frame_ok(frame)) return 0;
+    frame->language[sizeof(frame->language) - 1] = '\0';
+
+    if (frame->size == 0) return 1;
+
+    if (link->buf_size < (size_t)frame->size + 1) {
+        char *buf = (char *)realloc(link->buf, (size_t)frame->size + 1);
+
+        if (!buf) return 0;
+        link->buf = buf;
+        link->buf_size = (size_t)frame->size + 1;
+    }
+    if (!server_read(link->fd, link->buf, frame->size)) return 0;
+    link->buf[frame->size] = '\0';
+    *payload = link->buf;
+    return 1;
+}
+
+void llm_server_release(llm_server_link_t *link)
+{
+#ifdef LLM_SERVER_HAS_SHM
+    if (link->shm && link->held) {
+        shm_release(link);
+    }
+#else
+    (void)link;
+#endif
+}
+
+int llm_server_wait(llm_server_link_t *link, int ms)
+{
+    struct pollfd pfd;
+    int n;
+
+#ifdef LLM_SERVER_HAS_SHM
+    if (link->shm) return shm_wait(link, ms);
+#endif
+    if (link->fd < 0) return -1;
+    pfd.fd = link->fd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+    n = poll(&pfd, 1, ms);
+    if (n < 0) return errno == EINTR ? 0 : -1;
+    return n > 0;
+}
@@ -0,0 +1,741 @@
+/*
+ * nagi_llm_client.c - Backend that forwards every call to a nagi-llm-server
+ *
+ * Games running side by side on one machine share the server's model,
+ * caches and batching worker instead of each loading its own copy; this
+ * backend only keeps a socket. The socket path is [server] socket in
+ * llm_config.ini, or the NAGI_LLM_SERVER environment variable.
+ *
+ * Calls are serialized by the worker call lock like with any backend, so
+ * one connection carries them all. Responses are built on the server from
+ * its copy of the game context, sent ahead of them whenever it changed. If the server goes away the call
+ * fails and the next one reconnects. With [server] shared_memory the
+ * connection moves to shared memory rings right after the handshake.
+ *
+ * With [server] nodes listing several servers, the session is hashed onto
+ * a ring of them and connects to the first one on it that answers. When
+ * the node drains or the session is away from its own node and that one
+ * is back, the session is exported and imported where it goes next.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "nagi_llm_server.h"
+#include "../../include/nagi_llm_context.h"
+#include "../../include/llm_utils.h"
+#include "../../include/llm_log.h"
+#include "../../src/llm_thread.h"
+
+#define CLIENT_MAX_NODES 16
+#define CLIENT_RING_POINTS 128          /* Points per node on the hash ring, evens out the shares */
+#define CLIENT_REBALANCE_MS 10000       /* How often a session away from its node looks for it */
+
+typedef struct {
+    uint32_t hash;
+    int node;
+} client_point_t;
+
+typedef struct {
+    llm_server_link_t link;          /* link.fd is -1 while disconnected */
+    int shared_memory;               /* Ask for the rings, cleared if they can't be opened */
+    int dictionary_version;          /* state->grammar_version the server has, -1 for none */
+    char *context;                   /* Game context snapshot the server has */
+    char *context_next;              /* The one being taken */
+    int context_size;                /* Bytes of each, 0 until one is sent */
+    int context_sent;                /* The server has context */
+    uint32_t reply_size;             /* Payload bytes of the last result */
+    int moving;                      /* Taking the session to another node, MOVED fails */
+    int node;                        /* Index in path of the server connected to */
+    int n_nodes;
+    int order[CLIENT_MAX_NODES];     /* Nodes in ring order from the session, order[0] owns it */
+    double rebalance_ms;             /* Next look at order[0] while on another node */
+    char path[CLIENT_MAX_NODES][NAGI_LLM_MAX_MODEL_PATH];
+} client_t;
+
+static int client_request(nagi_llm_t *llm, nagi_llm_server_op_t op, int value,
+                          const void *payload, uint32_t size,
+                          nagi_llm_token_cb_t on_token, void *userdata, const char **reply);
+static int client_move(nagi_llm_t *llm, int skip);
+static int client_dictionary(nagi_llm_t *llm);
+static int client_context(nagi_llm_t *llm);
+
+/* FNV-1a of str after seed, then mixed so similar strings land far apart on the ring */
+static uint32_t client_hash(const char *str, const char *seed)
+{
+    uint32_t hash = 2166136261u;
+
+    while (*seed) {
+        hash ^= (unsigned char)*seed++;
+        hash *= 16777619u;
+    }
+    while (*str) {
+        hash ^= (unsigned char)*str++;
+        hash *= 16777619u;
+    }
+    hash ^= hash >> 16;
+    hash *= 0x85ebca6bu;
+    hash ^= hash >> 13;
+    hash *= 0xc2b2ae35u;
+    hash ^= hash >> 16;
+    return hash;
+}
+
+static int client_point_cmp(const void *a, const void *b)
+{
+    uint32_t x = ((const client_point_t *)a)->hash;
+    uint32_t y = ((const client_point_t *)b)->hash;
+
+    return x < y ? -1 : x > y;
+}
+
+/*
+ * Split the '|' separated socket list and order the nodes for this
+ * session: clockwise round the ring from the session's hash, each node
+ * where its first point is. Every game builds the same ring, so a node
+ * that goes away only moves the sessions it owned.
+ */
+static void client_nodes(client_t *client, const char *list)
+{
+    client_point_t points[CLIENT_MAX_NODES * CLIENT_RING_POINTS];
+    char key[64];
+    const char *p = list, *end;
+    uint32_t session;
+    size_t len;
+    int i, j, k, n, node, seen;
+
+    client->n_nodes = 0;
+    while (*p && client->n_nodes < CLIENT_MAX_NODES) {
+        while (*p == ' ' || *p == '\t') p++;
+        end = strchr(p, '|');
+        if (!end) end = p + strlen(p);
+        len = end - p;
+        while (len > 0 && (p[len - 1] == ' ' || p[len - 1] == '\t')) len--;
+        if (len > 0 && len < sizeof(client->path[0])) {
+            memcpy(client->path[client->n_nodes], p, len);
+            client->path[client->n_nodes][len] = '\0';
+            client->n_nodes++;
+        }
+        p = *end ? end + 1 : end;
+    }
+
+    n = 0;
+    for (i = 0; i < client->n_nodes; i++) {
+        for (j = 0; j < CLIENT_RING_POINTS; j++) {
+            snprintf(key, sizeof(key), "#%d", j);
+            points[n].hash = client_hash(key, client->path[i]);
+            points[n].node = i;
+            n++;
+        }
+    }
+    qsort(points, n, sizeof(points[0]), client_point_cmp);
+
+    /* One session per process, it keeps its node for as long as it runs */
+    snprintf(key, sizeof(key), "%ld:%ld", (long)getpid(), (long)time(NULL));
+    session = client_hash(key, "");
+    i = 0;
+    while (i < n && points[i].hash < session) i++;
+
+    seen = 0;
+    for (j = 0; j < n && seen < client->n_nodes; j++) {
+        node = points[(i + j) % n].node;
+        for (k = 0; k < seen; k++) {
+            if (client->order[k] == node) break;
+        }
+        if (k == seen) {
+            client->order[seen++] = node;
+        }
+    }
+}
+
+/* Stores a 32-bit value at p, returns the next position */
+static char *client_put_int(char *p, int value)
+{
+    int32_t v = value;
+    memcpy(p, &v, sizeof(v));
+    return p + sizeof(v);
+}
+
+static char *client_put_string(char *p, const char *str)
+{
+    size_t len = strlen(str) + 1;
+    memcpy(p, str, len);
+    return p + len;
+}
+
+static void client_disconnect(client_t *client)
+{
+    llm_server_link_close(&client->link);
+    client->dictionary_version = -1;
+    client->context_sent = 0;
+}
+
+/*
+ * Send one request and wait for its result
+ * PIECE frames go to on_token; if it asks to stop, the server is told to
+ * cancel and the pieces still in flight are dropped.
+ * A draining server answers MOVED; the session goes to the next node and
+ * the request is sent again there.
+ * Returns the result value, -1 if there is no server. *reply (optional)
+ * points at the result payload until the next request, client->reply_size
+ * is its size.
+ */
+static int client_request(nagi_llm_t *llm, nagi_llm_server_op_t op, int value,
+                          const void *payload, uint32_t size,
+                          nagi_llm_token_cb_t on_token, void *userdata, const char **reply)
+{
+    client_t *client = (client_t *)llm->backend_data;
+    llm_state_t *state = llm->state;
+    nagi_llm_server_frame_t frame;
+    const char *data;
+    int streaming = on_token != NULL;
+
+    if (reply) *reply = NULL;
+    if (client->link.fd < 0) return -1;
+
+    llm_server_frame(&frame, op, value, size);
+    memcpy(frame.language, state->detected_language, sizeof(frame.language));
+    frame.language_confidence = state->language_confidence;
+
+    if (!llm_server_send(&client->link, &frame, payload)) {
+        client_disconnect(client);
+        return -1;
+    }
+
+    for (;;) {
+        if (!llm_server_recv(&client->link, &frame, &data)) {
+            fprintf(stderr, "LLM Client: Lost the server at %s\n", client->path[client->node]);
+            client_disconnect(client);
+            return -1;
+        }
+
+        if (frame.op == NAGI_LLM_SERVER_PIECE) {
+            if (streaming && data && !on_token(data, (int)frame.size, userdata)) {
+                nagi_llm_server_frame_t cancel;
+
+                llm_server_frame(&cancel, NAGI_LLM_SERVER_CANCEL, 0, 0);
+                llm_server_send(&client->link, &cancel, NULL);
+                streaming = 0;
+            }
+            continue;
+        }
+        if (frame.op == NAGI_LLM_SERVER_MOVED && !client->moving) {
+            if (!client_move(llm, client->node)) return -1;
+            if (op != NAGI_LLM_SERVER_DICTIONARY && !client_dictionary(llm)) return -1;
+            if (op != NAGI_LLM_SERVER_CONTEXT && !client_context(llm)) return -1;
+            return client_request(llm, op, value, payload, size, on_token, userdata, reply);
+        }
+        if (frame.op != NAGI_LLM_SERVER_RESULT) {
+            client_disconnect(client);
+            return -1;
+        }
+        break;
+    }
+
+    client->reply_size = frame.size;
+    if (frame.language[0]) {
+        memcpy(state->detected_language, frame.language, sizeof(state->detected_language));
+        state->language_confidence = frame.language_confidence;
+    }
+
+    if (reply) *reply = data;
+    return frame.value;
+}
+
+/*
+ * Connect to node and say hello, on the rings if they can be had
+ * Returns 1 when connected.
+ */
+static int client_connect(nagi_llm_t *llm, int node)
+{
+    client_t *client = (client_t *)llm->backend_data;
+    const char *name;
+    int fd = llm_server_connect(client->path[node]);
+
+    if (fd < 0) return 0;
+    llm_server_link_init(&client->link, fd, 0);
+    client->node = node;
+    if (client_request(llm, NAGI_LLM_SERVER_HELLO, NAGI_LLM_SERVER_VERSION,
+                       NULL, 0, NULL, NULL, NULL) != NAGI_LLM_SERVER_VERSION) {
+        fprintf(stderr, "LLM Client: Server at %s speaks another protocol\n", client->path[node]);
+        client_disconnect(client);
+        return 0;
+    }
+
+    /* A server without the rings says no and the socket carries on */
+    if (client->shared_memory &&
+        client_request(llm, NAGI_LLM_SERVER_SHM, 0, NULL, 0, NULL, NULL, &name) > 0) {
+        llm_server_shm_t *shm = name ? llm_server_shm_open(name) : NULL;
+
+        if (!shm) {
+            /* The server has moved over already, start again on the socket */
+            fprintf(stderr, "LLM Client: Cannot open the shared memory of %s\n", client->path[node]);
+            client_disconnect(client);
+            client->shared_memory = 0;
+            return client_connect(llm, node);
+        }
+        llm_server_link_attach(&client->link, shm);
+    }
+
+    if (node != client->order[0]) {
+        client->rebalance_ms = llm_time_ms() + CLIENT_REBALANCE_MS;
+    }
+    return 1;
+}
+
+/*
+ * The session as the server has it, in one malloc'd block
+ * Returns NULL if it has nothing to give.
+ */
+static char *client_export(nagi_llm_t *llm, size_t *size)
+{
+    client_t *client = (client_t *)llm->backend_data;
+    char *session = NULL;
+    const char *reply;
+    int total = 0, offset = 0, got;
+
+    do {
+        got = client_request(llm, NAGI_LLM_SERVER_SESSION_EXPORT, offset, NULL, 0,
+                             NULL, NULL, &reply);
+        if (got <= 0 || !reply || client->reply_size == 0 || (session && got != total) ||
+            client->reply_size > (uint32_t)(got - offset)) {
+            free(session);
+            return NULL;
+        }
+        if (!session) {
+            total = got;
+            session = (char *)malloc(total);
+            if (!session) return NULL;
+        }
+        memcpy(session + offset, reply, client->reply_size);
+        offset += client->reply_size;
+    } while (offset < total);
+
+    *size = (size_t)total;
+    return session;
+}
+
+/* Hand an exported session to the server connected to */
+static void client_import(nagi_llm_t *llm, const char *session, size_t size)
+{
+    client_t *client = (client_t *)llm->backend_data;
+    size_t offset = 0, n;
+    int result = 0;
+
+    while (offset < size && result == 0) {
+        n = size - offset;
+        if (n > NAGI_LLM_SERVER_MAX_PAYLOAD) n = NAGI_LLM_SERVER_MAX_PAYLOAD;
+        result = client_request(llm, NAGI_LLM_SERVER_SESSION_IMPORT, (int)size, session + offset,
+                                (uint32_t)n, NULL, NULL, NULL);
+        offset += n;
+    }
+
+    if (llm->config.verbose) {
+        llm_log(LLM_LOG_DEBUG, "LLM Client: Session moved to %s (%zu bytes, %s)\n",
+                client->path[client->node], size,
+                result == 1 ? "context kept" : "context decoded again");
+    }
+}
+
+/*
+ * Connect to the first node on the session's ring that answers, other
+ * than skip, and give it the session if there is one
+ * Returns 1 when connected.
+ */
+static int client_open(nagi_llm_t *llm, int skip, const char *session, size_t size)
+{
+    client_t *client = (client_t *)llm->backend_data;
+    int i;
+
+    for (i = 0; i < client->n_nodes; i++) {
+        if (client->order[i] == skip || !client_connect(llm, client->order[i])) continue;
+        if (session) {
+            client->moving = 1;
+            client_import(llm, session, size);
+            client->moving = 0;
+        }
+        /* Draining too, on to the next */
+        if (client->link.fd >= 0) return 1;
+    }
+    return 0;
+}
+
+/*
+ * Take the session from the server connected to over to another node
+ * skip: node it must not land on (the one draining), -1 for any
+ * Returns 1 when connected again.
+ */
+static int client_move(nagi_llm_t *llm, int skip)
+{
+    client_t *client = (client_t *)llm->backend_data;
+    char *session;
+    size_t size = 0;
+    int ok;
+
+    client->moving = 1;
+    session = client_export(llm, &size);
+    client->moving = 0;
+    client_disconnect(client);
+
+    ok = client_open(llm, skip, session, size);
+    free(session);
+    return ok;
+}
+
+/*
+ * Make sure the server has our dictionary
+ * Returns 1 when requests can be sent, 0 if the server went away.
+ */
+static int client_dictionary(nagi_llm_t *llm)
+{
+    client_t *client = (client_t *)llm->backend_data;
+    llm_state_t *state = llm->state;
+
+    if (state->dictionary_data && client->dictionary_version != state->grammar_version) {
+        if (client_request(llm, NAGI_LLM_SERVER_DICTIONARY, 0, state->dictionary_data,
+                           (uint32_t)state->dictionary_size, NULL, NULL, NULL) <= 0) {
+            return client->link.fd >= 0;
+        }
+        client->dictionary_version = state->grammar_version;
+    }
+    return 1;
+}
+
+/*
+ * Make sure the server has the game context as it is now, for the
+ * responses it builds. A snapshot goes only when it changed since the
+ * last one.
+ * Returns 1 when requests can be sent, 0 if the server went away.
+ */
+static int client_context(nagi_llm_t *llm)
+{
+    client_t *client = (client_t *)llm->backend_data;
+    int size = llm_context_snapshot_size(llm->session);
+    char *swap;
+
+    if (size <= 0 || size > NAGI_LLM_SERVER_MAX_PAYLOAD) return 1;
+    if (size != client->context_size) {
+        free(client->context);
+        free(client->context_next);
+        client->context = (char *)malloc(size);
+        client->context_next = (char *)malloc(size);
+        client->context_size = client->context && client->context_next ? size : 0;
+        client->context_sent = 0;
+        if (client->context_size == 0) return 1;
+    }
+
+    llm_context_snapshot(llm->session, client->context_next);
+    if (client->context_sent && memcmp(client->context, client->context_next, size) == 0) return 1;
+
+    if (client_request(llm, NAGI_LLM_SERVER_CONTEXT, 0, client->context_next, (uint32_t)size,
+                       NULL, NULL, NULL) <= 0) {
+        return client->link.fd >= 0;
+    }
+    swap = client->context;
+    client->context = client->context_next;
+    client->context_next = swap;
+    client->context_sent = 1;
+    return 1;
+}
+
+/*
+ * Make sure there is a connection, on the session's own node when it
+ * answers, and the server has our dictionary
+ * Returns 1 when requests can be sent, 0 if no server is there.
+ */
+static int client_ready(nagi_llm_t *llm)
+{
+    client_t *client = (client_t *)llm->backend_data;
+    int fd;
+
+    if (!client) return 0;
+
+    if (client->link.fd < 0) {
+        if (!client_open(llm, -1, NULL, 0)) return 0;
+    } else if (client->node != client->order[0] && llm_time_ms() >= client->rebalance_ms) {
+        /* Back home once the node that owns the session is up again */
+        client->rebalance_ms = llm_time_ms() + CLIENT_REBALANCE_MS;
+        fd = llm_server_connect(client->path[client->order[0]]);
+        if (fd >= 0) {
+            close(fd);
+            if (!client_move(llm, -1)) return 0;
+        }
+    }
+
+    return client_dictionary(llm);
+}
+
+static int client_init(nagi_llm_t *llm, const char *model_path, const nagi_llm_config_t *config)
+{
+    client_t *client;
+    const char *path;
+
+    (void)model_path;
+    if (config) {
+        llm->config = *config;
+    }
+
+    client = (client_t *)calloc(1, sizeof(client_t));
+    if (!client) return 0;
+    llm_server_link_init(&client->link, -1, 0);
+    client->shared_memory = llm->config.server_shared_memory;
+    client->dictionary_version = -1;
+
+    path = getenv("NAGI_LLM_SERVER");
+    if (!path || !path[0]) {
+        path = llm->config.server_nodes[0] ? llm->config.server_nodes : llm->config.server_socket;
+    }
+    client_nodes(client, path);
+    if (client->n_nodes == 0) {
+        fprintf(stderr, "LLM Client: No server socket configured\n");
+        free(client);
+        return 0;
+    }
+
+    if (!llm->state) {
+        llm->state = (llm_state_t *)calloc(1, sizeof(llm_state_t));
+        if (!llm->state) {
+            free(client);
+            return 0;
+        }
+    }
+    llm->backend_data = client;
+
+    if (!client_ready(llm)) {
+        fprintf(stderr, "LLM Client: No nagi-llm-server at %s\n", path);
+        llm->backend_data = NULL;
+        free(client);
+        free(llm->state);
+        llm->state = NULL;
+        return 0;
+    }
+
+    if (llm->config.verbose) {
+        llm_log(LLM_LOG_DEBUG, "LLM Client: Connected to %s\n", client->path[client->node]);
+    }
+
+    llm->state->initialized = 1;
+    return 1;
+}
+
+static void client_shutdown(nagi_llm_t *llm)
+{
+    client_t *client = (client_t *)llm->backend_data;
+
+    if (client) {
+        client_disconnect(client);
+        free(client->context);
+        free(client->context_next);
+        free(client);
+        llm->backend_data = NULL;
+    }
+    free(llm->state);
+    llm->state = NULL;
+}
+
+static const char *client_extract_words(nagi_llm_t *llm, const char *input, char *out, int out_size)
+{
+    const char *reply;
+
+    if (!input || input[0] == '\0' || !client_ready(llm)) return input;
+
+    if (client_request(llm, NAGI_LLM_SERVER_EXTRACT, 0, input, (uint32_t)strlen(input) + 1,
+                       NULL, NULL, &reply) < 0 || !reply) {
+        return input;
+    }
+
+    strncpy(out, reply, (size_t)out_size - 1);
+    out[out_size - 1] = '\0';
+    return out;
+}
+
+static int client_matches_expected(nagi_llm_t *llm, const char *input,
+                                   const int *expected_word_ids, int expected_count)
+{
+    char *payload, *p;
+    size_t size;
+    int i, result;
+
+    if (!input || !expected_word_ids || expected_count <= 0) return NAGI_LLM_MATCH_NO;
+    if (!client_ready(llm)) return NAGI_LLM_MATCH_ERROR;
+
+    size = (1 + (size_t)expected_count) * sizeof(int32_t) + strlen(input) + 1;
+    payload = (char *)malloc(size);
+    if (!payload) return NAGI_LLM_MATCH_ERROR;
+
+    p = client_put_int(payload, expected_count);
+    for (i = 0; i < expected_count; i++) {
+        p = client_put_int(p, expected_word_ids[i]);
+    }
+    client_put_string(p, input);
+
+    result = client_request(llm, NAGI_LLM_SERVER_MATCH, 0, payload, (uint32_t)size,
+                            NULL, NULL, NULL);
+    free(payload);
+    return result < 0 ? NAGI_LLM_MATCH_ERROR : result > 0;
+}
+
+static int client_matches_expected_batch(nagi_llm_t *llm, const char *input,
+                                         const int *const *expected_lists,
+                                         const int *expected_counts, int n_lists, int *results)
+{
+    client_t *client = (client_t *)llm->backend_data;
+    char *payload, *p;
+    const char *reply;
+    size_t size;
+    int i, j, ok;
+    int32_t v;
+
+    if (!input || n_lists <= 0 || !client_ready(llm)) return 0;
+
+    size = (1 + (size_t)n_lists) * sizeof(int32_t) + strlen(input) + 1;
+    for (i = 0; i < n_lists; i++) {
+        size += (size_t)expected_counts[i] * sizeof(int32_t);
+    }
+    payload = (char *)malloc(size);
+    if (!payload) return 0;
+
+    p = client_put_int(payload, n_lists);
+    for (i = 0; i < n_lists; i++) {
+        p = client_put_int(p, expected_counts[i]);
+    }
+    for (i = 0; i < n_lists; i++) {
+        for (j = 0; j < expected_counts[i]; j++) {
+            p = client_put_int(p, expected_lists[i][j]);
+        }
+    }
+    client_put_string(p, input);
+
+    ok = client_request(llm, NAGI_LLM_SERVER_MATCH_BATCH, 0, payload, (uint32_t)size,
+                        NULL, NULL, &reply) > 0;
+    free(payload);
+
+    ok = ok && reply && client->reply_size >= n_lists * sizeof(int32_t);
+    for (i = 0; ok && i < n_lists; i++) {
+        memcpy(&v, reply + i * sizeof(int32_t), sizeof(v));
+        results[i] = v;
+    }
+    return ok;
+}
+
+static int client_generate_response_stream(nagi_llm_t *llm, const char *game_response,
+                                           const char *user_input, char *output, int output_size,
+                                           nagi_llm_token_cb_t on_token, void *userdata)
+{
+    char *payload;
+    const char *reply;
+    size_t size;
+    int len;
+
+    if (!game_response || !output || output_size <= 0) return 0;
+    output[0] = '\0';
+    if (!user_input) user_input = "";
+    if (!client_ready(llm) || !client_context(llm)) return 0;
+
+    size = strlen(game_response) + strlen(user_input) + 2;
+    payload = (char *)malloc(size);
+    if (!payload) return 0;
+    client_put_string(client_put_string(payload, game_response), user_input);
+
+    len = client_request(llm, NAGI_LLM_SERVER_GENERATE, on_token != NULL, payload,
+                         (uint32_t)size, on_token, userdata, &reply);
+    free(payload);
+
+    if (len <= 0 || !reply) return 0;
+    strncpy(output, reply, output_size - 1);
+    output[output_size - 1] = '\0';
+    return (int)strlen(output);
+}
+
+static int client_generate_response(nagi_llm_t *llm, const char *game_response,
+                                    const char *user_input, char *output, int output_size)
+{
+    return client_generate_response_stream(llm, game_response, user_input, output, output_size,
+                                           NULL, NULL);
+}
+
+static int client_generate_response_batch(nagi_llm_t *llm, const char **game_responses, int count,
+                                          char **outputs, int output_size)
+{
+    client_t *client = (client_t *)llm->backend_data;
+    char *payload, *p;
+    const char *reply, *q;
+    size_t size;
+    int i, done;
+
+    if (!game_responses || !outputs || count <= 0 || output_size <= 0) return 0;
+    for (i = 0; i < count; i++) {
+        outputs[i][0] = '\0';
+    }
+    if (!client_ready(llm) || !client_context(llm)) return 0;
+
+    size = sizeof(int32_t);
+    for (i = 0; i < count; i++) {
+        size += strlen(game_responses[i] ? game_responses[i] : "") + 1;
+    }
+    payload = (char *)malloc(size);
+    if (!payload) return 0;
+
+    p = client_put_int(payload, count);
+    for (i = 0; i < count; i++) {
+        p = client_put_string(p, game_responses[i] ? game_responses[i] : "");
+    }
+
+    done = client_request(llm, NAGI_LLM_SERVER_GENERATE_BATCH, 0, payload, (uint32_t)size,
+                          NULL, NULL, &reply);
+    free(payload);
+    if (done <= 0 || !reply) return 0;
+
+    /* One NUL-terminated response per message, empty for the ones that failed */
+    q = reply;
+    for (i = 0; i < count && q < reply + client->reply_size; i++) {
+        strncpy(outputs[i], q, output_size - 1);
+        outputs[i][output_size - 1] = '\0';
+        q += strlen(q) + 1;
+    }
+    return done;
+}
+
+nagi_llm_t *nagi_llm_client_create(void)
+{
+    nagi_llm_t *llm = (nagi_llm_t *)calloc(1, sizeof(nagi_llm_t));
+    if (!llm) return NULL;
+
+    llm->backend = NAGI_LLM_BACKEND_SERVER;
+    llm->init = client_init;
+    llm->shutdown = client_shutdown;
+    llm->extract_words = client_extract_words;
+    llm->matches_expected = client_matches_expected;
+    llm->matches_expected_batch = client_matches_expected_batch;
+    llm->generate_response = client_generate_response;
+    llm->generate_response_stream = client_generate_response_stream;
+    llm->generate_response_batch = client_generate_response_batch;
+
+    llm->config.backend = NAGI_LLM_BACKEND_SERVER;
+    llm->config.temperature = 0.0f;
+    llm->config.temperature_creative_base = 0.3f;
+    llm->config.temperature_creative_offset = 0.2f;
+    llm->config.max_tokens = 512;
+    llm->config.verbose = 0;
+    llm->config.mode = NAGI_LLM_MODE_EXTRACTION;
+    strncpy(llm->config.personality, DEFAULT_PERSONALITY, sizeof(llm->config.personality) - 1);
+    llm->config.personality[sizeof(llm->config.personality) - 1] = '\0';
+    llm->config.translation_cache_kb = NAGI_LLM_DEFAULT_CACHE_KB;
+    llm->config.extraction_memo_entries = NAGI_LLM_DEFAULT_MEMO_ENTRIES;
+    llm->config.match_threshold = NAGI_LLM_DEFAULT_MATCH_THRESHOLD;
+    llm->config.match_cache_entries = NAGI_LLM_DEFAULT_MATCH_CACHE_ENTRIES;
+    llm->config.embedding_match_high = NAGI_LLM_DEFAULT_EMBED_MATCH_HIGH;
+    llm->config.embedding_match_low = NAGI_LLM_DEFAULT_EMBED_MATCH_LOW;
+    llm->config.draft_tokens = NAGI_LLM_DEFAULT_DRAFT_TOKENS;
+    llm->config.hedge_deadline_ms = NAGI_LLM_DEFAULT_HEDGE_DEADLINE_MS;
+    llm->config.hedge_percentile = NAGI_LLM_DEFAULT_HEDGE_PERCENTILE;
+    strncpy(llm->config.server_socket, NAGI_LLM_DEFAULT_SERVER_SOCKET,
+            sizeof(llm->config.server_socket) - 1);
+    llm->config.server_shared_memory = NAGI_LLM_DEFAULT_SERVER_SHARED_MEMORY;
+
+    return llm;
+}
@@ -0,0 +1,182 @@
+/*
+ * nagi_llm_server.h - Wire format between nagi-llm-server and its clients
+ *
+ * One nagi-llm-server process keeps the model loaded and answers the
+ * games running on the same machine over a Unix domain socket. Every
+ * message is a fixed frame header followed by size bytes of payload.
+ * Both ends are on one host, so fields travel in native byte order.
+ *
+ * The session language rides in every frame: requests carry what the
+ * game last detected and results carry what the server detected, so a
+ * shared model never mixes up two players' languages. The game context
+ * goes ahead of the responses that need it (CONTEXT) whenever it changed,
+ * and the server builds that game's prompts from its own copy.
+ *
+ * On Linux a client can move the frames off the socket into a pair of
+ * rings in shared memory (SHM below). The same frames are written
+ * straight into the ring and read where they lie, a sleeping reader is
+ * woken with a futex, so a round trip costs no copies through the kernel
+ * and usually no syscall at all. The socket stays open only to tell when
+ * the other end goes away.
+ *
+ * Several servers can share the games (see [server] nodes). Each game
+ * session is routed to one of them by consistent hashing, so its warm
+ * caches and decoded context stay on one node and a node coming or going
+ * only moves the sessions that hashed to it. A session can be exported
+ * from one node and imported on another: its language and the decoded
+ * game context travel along, so it doesn't decode everything again where
+ * it lands. A draining server (SIGUSR1) answers requests with MOVED, and
+ * the client takes its session to the next node before asking again.
+ */
+
+#ifndef NAGI_LLM_SERVER_H
+#define NAGI_LLM_SERVER_H
+
+#include <stdint.h>
+
+#include "../../include/nagi_llm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define NAGI_LLM_SERVER_MAGIC 0x4D4C4C4E        /* "NLLM" */
+#define NAGI_LLM_SERVER_VERSION 3
+#define NAGI_LLM_SERVER_MAX_PAYLOAD (1 << 20)   /* Dictionaries are the largest, tens of KB */
+
+/*
+ * Payloads (strings are NUL-terminated, int arrays are int32):
+ *
+ *   HELLO           -                   value: protocol version
+ *   DICTIONARY      WORDS.TOK bytes     value: 1 if set
+ *   EXTRACT         input               payload: extracted words
+ *   MATCH           count, ids, input   value: NAGI_LLM_MATCH_ verdict, -1 on error
+ *   MATCH_BATCH     n, counts[n], ids of every list, input
+ *                                       value: 1 if scored, payload: results[n]
+ *                                       (verdicts, -1 where not scored)
+ *   GENERATE        game response, user input
+ *                                       PIECE frames while streaming (value 1),
+ *                                       then value: length, payload: response
+ *   GENERATE_BATCH  n, n game responses value: messages generated, payload: n responses
+ *   CANCEL          -                   stops the GENERATE in progress
+ *   SHM             -                   value: 1 if the rings are set up,
+ *                                       payload: shared memory name. Every
+ *                                       later frame goes through the rings.
+ *   SESSION_EXPORT  - (value: offset)   value: session bytes, payload: those
+ *                                       from offset on, as many as fit a frame
+ *   SESSION_IMPORT  session bytes in order (value: their total)
+ *                                       value: 0 while more are expected, then
+ *                                       1 with the decoded context used, 2
+ *                                       without it (decoded again), -1 refused
+ *   CONTEXT         llm_context_snapshot bytes
+ *                                       value: 1 if taken, 0 if the size is
+ *                                       another build's
+ *
+ * The server answers every request with one RESULT frame, or MOVED while
+ * it drains (anything but SESSION_EXPORT and CANCEL).
+ */
+typedef enum {
+    NAGI_LLM_SERVER_HELLO = 1,
+    NAGI_LLM_SERVER_DICTIONARY,
+    NAGI_LLM_SERVER_EXTRACT,
+    NAGI_LLM_SERVER_MATCH,
+    NAGI_LLM_SERVER_MATCH_BATCH,
+    NAGI_LLM_SERVER_GENERATE,
+    NAGI_LLM_SERVER_GENERATE_BATCH,
+    NAGI_LLM_SERVER_CANCEL,
+    NAGI_LLM_SERVER_PIECE,
+    NAGI_LLM_SERVER_RESULT,
+    NAGI_LLM_SERVER_SHM,
+    NAGI_LLM_SERVER_SESSION_EXPORT,
+    NAGI_LLM_SERVER_SESSION_IMPORT,
+    NAGI_LLM_SERVER_MOVED,
+    NAGI_LLM_SERVER_CONTEXT
+} nagi_llm_server_op_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t op;                    /* nagi_llm_server_op_t */
+    int32_t value;                  /* Argument or result of the operation */
+    uint32_t size;                  /* Payload bytes after the header */
+    char language[32];              /* Session language, empty if not known yet */
+    float language_confidence;
+} nagi_llm_server_frame_t;
+
+typedef struct llm_server_shm llm_server_shm_t;
+
+/*
+ * One end of a connection: the socket, and the shared rings once the
+ * connection has switched to them
+ */
+typedef struct {
+    int fd;                         /* -1 once closed */
+    int side;                       /* 0 client, 1 server: picks the ring to send on */
+    llm_server_shm_t *shm;          /* NULL while frames go over the socket */
+    char *buf;                      /* Socket payloads are read into this */
+    size_t buf_size;
+    uint32_t held;                  /* Ring bytes of the frame last received */
+} llm_server_link_t;
+
+/*
+ * Connect to or listen on the socket at path
+ * Returns the socket, -1 on failure.
+ */
+int llm_server_connect(const char *path);
+int llm_server_listen(const char *path);
+
+/*
+ * Fill in a frame header
+ */
+void llm_server_frame(nagi_llm_server_frame_t *frame, nagi_llm_server_op_t op, int value,
+                      uint32_t size);
+
+/*
+ * Start a link on a connected socket, or close it (socket and rings)
+ */
+void llm_server_link_init(llm_server_link_t *link, int fd, int side);
+void llm_server_link_close(llm_server_link_t *link);
+
+/*
+ * Send a frame and its payload (frame->size bytes)
+ * Returns 1 on success, 0 if the other end is gone.
+ */
+int llm_server_send(llm_server_link_t *link, const nagi_llm_server_frame_t *frame,
+                    const void *payload);
+
+/*
+ * Receive a frame. *payload points at the NUL-terminated payload (NULL
+ * when there is none), in the ring itself on shared memory. It stays
+ * valid until the next receive on the link or llm_server_release().
+ * Returns 1 on success, 0 if the connection closed or sent garbage.
+ */
+int llm_server_recv(llm_server_link_t *link, nagi_llm_server_frame_t *frame,
+                    const char **payload);
+void llm_server_release(llm_server_link_t *link);
+
+/*
+ * Wait up to ms for a frame to arrive
+ * Returns 1 if one is ready, 0 on timeout, -1 if the other end is gone.
+ */
+int llm_server_wait(llm_server_link_t *link, int ms);
+
+/*
+ * Shared memory rings (Linux only, NULL elsewhere)
+ * The server creates them and sends the name back; the client opens
+ * them by name. Once the SHM exchange is done, each end hands its
+ * mapping to its link and from then on frames travel through it.
+ */
+llm_server_shm_t *llm_server_shm_create(char *name, size_t name_size);
+llm_server_shm_t *llm_server_shm_open(const char *name);
+void llm_server_link_attach(llm_server_link_t *link, llm_server_shm_t *shm);
+
+/*
+ * Create a client backend instance
+ * Called internally by nagi_llm_create(NAGI_LLM_BACKEND_SERVER)
+ */
+nagi_llm_t *nagi_llm_client_create(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NAGI_LLM_SERVER_H */
@@ -0,0 +1,42 @@
+#ifndef LLM_LOG_H
+#define LLM_LOG_H
+
+/*
+ * Verbose output of the library and its backends. A line costs a format
+ * into the ring buffer, the writing is done by the thread that
+ * nagi_llm_log_start() makes. Levels past NAGI_LLM_LOG_MAX are compiled out.
+ */
+
+#define LLM_LOG_ERROR 0
+#define LLM_LOG_WARN  1
+#define LLM_LOG_INFO  2
+#define LLM_LOG_DEBUG 3
+#define LLM_LOG_TRACE 4     /* A line per item of a batch */
+
+#ifndef NAGI_LLM_LOG_MAX
+#ifdef NDEBUG
+#define NAGI_LLM_LOG_MAX LLM_LOG_DEBUG
+#else
+#define NAGI_LLM_LOG_MAX LLM_LOG_TRACE
+#endif
+#endif
+
+#define llm_log(level, ...) \
+    do { \
+        if ((level) <= NAGI_LLM_LOG_MAX) llm_log_write((level), __VA_ARGS__); \
+    } while (0)
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(__GNUC__)
+__attribute__((format(printf, 2, 3)))
+#endif
+void llm_log_write(int level, const char *fmt, ...);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LLM_LOG_H */
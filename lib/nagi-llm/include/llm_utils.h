@@ -61,6 +61,28 @@ static const char *EXTRACTION_PROMPT_SIMPLE =
     "%s" END_OF_USER
     START_OF_ASSISTANT;
 
+/* Fallback prompt that names the input's language too, "<language>|<verb noun>" */
+static const char *EXTRACTION_PROMPT_COMBINED =
+    START_OF_USER
+    "Name the language, then translate to English (verb noun only):\n"
+    "regarde l'arbre" END_OF_USER
+    START_OF_ASSISTANT
+    "French|look tree" END_OF_ASSISTANT
+    START_OF_USER
+    "Name the language, then translate to English (verb noun only):\n"
+    "coge la llave" END_OF_USER
+    START_OF_ASSISTANT
+    "Spanish|get key" END_OF_ASSISTANT
+    START_OF_USER
+    "Name the language, then translate to English (verb noun only):\n"
+    "open the door" END_OF_USER
+    START_OF_ASSISTANT
+    "English|open door" END_OF_ASSISTANT
+    START_OF_USER
+    "Name the language, then translate to English (verb noun only):\n"
+    "%s" END_OF_USER
+    START_OF_ASSISTANT;
+
 /* Language detection prompt */
 static const char *LANGUAGE_DETECTION_PROMPT =
     START_OF_USER
@@ -72,20 +94,9 @@ static const char *LANGUAGE_DETECTION_PROMPT =
     START_OF_USER
     "%s" END_OF_USER START_OF_ASSISTANT;
 
-/* Cloud-specific language detection prompt (no special markers) */
-static const char *LANGUAGE_DETECTION_PROMPT_CLOUD =
-    "Detect the language of this text and respond with only the language name:\n\n"
-    "Examples:\n"
-    "look tree -> English\n"
-    "mira arbol -> Spanish\n"
-    "regarde arbre -> French\n"
-    "schaue baum -> German\n\n"
-    "Text: %s\n"
-    "Language:";
-
-/*
 static const char *DEFAULT_PERSONALITY = "Try to keep the message as close as possible to the original.";
 
+/*
 static const char *RESPONSE_GENERATION_PROMPT =
     START_OF_SYSTEM
     "You are a narrator for a text adventure game. Translate game texts to %s. %s.\n\n"
@@ -170,20 +181,182 @@ static const char *SEMANTIC_MATCHING_PROMPT =
     "Does the input match the command?" END_OF_USER
     START_OF_ASSISTANT;
 
-/* Forward declaration */
+/* Forward declarations */
 typedef struct nagi_llm nagi_llm_t;
+typedef int (*nagi_llm_token_cb_t)(const char *piece, int len, void *userdata);
+
+/*
+ * Decode the game dictionary into the lookup tables (llm_dict.c)
+ * Replaces any previous one. Returns 1 on success.
+ */
+int llm_dict_build(nagi_llm_t *llm, const unsigned char *data, size_t size);
 
 /*
  * Get word string from word ID
- * Returns pointer to static buffer with decoded word, or NULL if not found
+ * Returns pointer into the dictionary table, or NULL if not found.
+ * Reentrant, valid until the dictionary is replaced.
  */
 const char *get_word_string(nagi_llm_t *llm, int word_id);
 
+/*
+ * Find the word ID of len chars of word (case insensitive)
+ * Returns the word ID, or -1 if not in the dictionary
+ */
+int llm_dict_find(nagi_llm_t *llm, const char *word, int len);
+
+/*
+ * Iterate over the dictionary in file order (A-Z)
+ * Returns the word at index, or NULL past the end. *word_id receives its ID.
+ */
+const char *llm_dict_word_at(nagi_llm_t *llm, int index, int *word_id);
+
 /*
  * Extract common verbs from the game dictionary
- * Returns a static buffer with comma-separated verb list (e.g., "look, get, open, close")
- * Extracts first 40-50 words which are typically verbs in AGI games
+ * Returns the instance's comma-separated verb list (e.g., "look, get, open, close")
+ * Extracts first 40-50 words which are typically verbs in AGI games, or
+ * the room's words when nagi_llm_set_vocabulary gave some
  */
 const char *extract_game_verbs(nagi_llm_t *llm);
 
+/*
+ * Build a GBNF grammar that only accepts "verb [noun [noun]]" made of words
+ * from the game dictionary
+ * Returns a malloc'd grammar string, or NULL if the dictionary is empty
+ */
+char *build_dictionary_grammar(nagi_llm_t *llm);
+
+/*
+ * Learned input word -> dictionary word table for the fast path (llm_normalize.c)
+ */
+void llm_synonyms_free(nagi_llm_t *llm);
+
+/*
+ * Fold input for case, accents and punctuation into key (llm_normalize.c)
+ * Returns the key length, -1 if it doesn't fit
+ */
+int llm_normalize_key(const char *input, char *key, int key_size);
+
+/*
+ * said() verdicts per (input, expected word IDs) (llm_memo.c)
+ * The lookup returns 1 or 0 for a known verdict, -1 if the model has to be asked.
+ * NAGI_LLM_MATCH_ERROR verdicts are not stored.
+ */
+int llm_match_cache_lookup(nagi_llm_t *llm, const char *input, const int *ids, int count);
+void llm_match_cache_store(nagi_llm_t *llm, const char *input, const int *ids, int count,
+                           int verdict);
+
+/*
+ * Embedding matcher (llm_embed.c), called with the worker lock held
+ * Sets each result to 1 or 0 when the similarity settles it, -1 when the
+ * generative model has to decide. Returns 0 if embeddings are not in use.
+ */
+int llm_embed_classify(nagi_llm_t *llm, const char *input, const int *const *lists,
+                       const int *counts, int n_lists, int *results);
+void llm_embed_free(nagi_llm_t *llm);
+
+/*
+ * Free the extraction memo and the match cache (llm_memo.c)
+ */
+void llm_memo_free(nagi_llm_t *llm);
+
+/*
+ * Shared cache tier (llm_remote.c)
+ * kind separates the tables ('t' translations, 'x' extractions). The get
+ * copies a hit to output and returns its length, 0 on a miss or without a
+ * server. Both are safe from any thread.
+ */
+int llm_remote_get(nagi_llm_t *llm, char kind, const char *source, const char *language,
+                   const char *personality, char *output, int output_size);
+void llm_remote_put(nagi_llm_t *llm, char kind, const char *source, const char *language,
+                    const char *personality, const char *text);
+void llm_remote_free(nagi_llm_t *llm);
+
+/*
+ * Guess the language of text from its script and common words (llm_lang.c)
+ * Returns the language name, or NULL if unsure. *confidence gets 0.0-1.0.
+ */
+const char *llm_guess_language(const char *text, float *confidence);
+
+/*
+ * Decode one UTF-8 sequence at *s and advance past it (llm_lang.c)
+ * Returns the code point, or -1 if the sequence is invalid
+ */
+long llm_utf8_next(const unsigned char **s);
+
+/*
+ * Answer language detection from the session language when the guess
+ * agrees with it. Returns NULL when the model should be asked.
+ */
+const char *llm_language_lookup(nagi_llm_t *llm, const char *input);
+
+/*
+ * The language the response to input will be in, without asking the model
+ * or changing the session. Returns NULL if detection could still change it.
+ */
+const char *llm_language_peek(nagi_llm_t *llm, const char *input);
+
+/*
+ * Remember the language the model detected for the session
+ */
+void llm_language_store(nagi_llm_t *llm, const char *language);
+
+/*
+ * Report model load progress (0.0-1.0) from a backend init (nagi_llm_loader.c)
+ * Returns 0 if the load should be aborted, 1 otherwise
+ */
+int llm_load_progress(nagi_llm_t *llm, float progress);
+
+/*
+ * Pass newly generated text to a streaming callback
+ *
+ * Leading whitespace is skipped and nothing past the first line is passed
+ * on, matching what the backends keep after post-processing.
+ *
+ * @param text: Response generated so far
+ * @param len: Length of text
+ * @param emitted: In/out offset of the text already handled (start at 0)
+ * @return: 0 if the callback asked to stop, 1 otherwise
+ */
+int llm_stream_emit(const char *text, int len, int *emitted,
+                    nagi_llm_token_cb_t on_token, void *userdata);
+
+/*
+ * Request telemetry (llm_stats.c)
+ *
+ * The caller of a backend function brackets it with llm_stats_begin and
+ * llm_stats_end, keeping what begin returns; inside, llm_stats_stage and
+ * llm_stats_hit are charged to that operation on the calling thread.
+ * Nested operations (detection during generation) are charged to
+ * themselves and restore the outer one. llm_stats_leave ends a bracket
+ * without counting a request, for work that is counted once it finishes
+ * (llm_stats_count).
+ */
+typedef enum {
+    LLM_STATS_TOKENIZE,
+    LLM_STATS_PROMPT,               /* tokens: prompt tokens decoded */
+    LLM_STATS_GENERATE              /* tokens: tokens generated */
+} llm_stats_stage_t;
+
+typedef enum {
+    LLM_STATS_CACHE_HIT,            /* Answer known without asking the model */
+    LLM_STATS_KV_REUSE              /* Prompt prefix already in the KV cache */
+} llm_stats_hit_t;
+
+/* One operation being timed, from llm_stats_begin to its end */
+typedef struct {
+    int op;                         /* nagi_llm_op_t */
+    int outer;                      /* The thread's operation before it, -1 for none */
+    double start_ms;                /* When the request started, llm_time_ms */
+} llm_stats_call_t;
+
+struct llm_stats *llm_stats_create(void);
+void llm_stats_free(nagi_llm_t *llm);
+llm_stats_call_t llm_stats_begin(nagi_llm_t *llm, nagi_llm_op_t op, double start_ms);
+void llm_stats_end(nagi_llm_t *llm, llm_stats_call_t call);
+void llm_stats_leave(nagi_llm_t *llm, llm_stats_call_t call);
+void llm_stats_count(nagi_llm_t *llm, nagi_llm_op_t op, double start_ms);
+void llm_stats_stage(nagi_llm_t *llm, llm_stats_stage_t stage, double ms, int tokens);
+void llm_stats_hit(nagi_llm_t *llm, llm_stats_hit_t hit);
+void llm_stats_cached(nagi_llm_t *llm, nagi_llm_op_t op, double start_ms);
+
 #endif /* LLM_UTILS_H */
@@ -28,10 +28,40 @@ typedef unsigned int u32;
 #define NAGI_LLM_MAX_MODEL_PATH 512
 #define NAGI_LLM_MAX_PROMPT_SIZE 4096
 #define NAGI_LLM_MAX_RESPONSE_SIZE 1024
+#define NAGI_LLM_VOCABULARY_SIZE 512    /* The extraction prompt's word list */
 #define NAGI_LLM_DEFAULT_CONTEXT_SIZE 4096
 #define NAGI_LLM_DEFAULT_BATCH_SIZE 1024
 #define NAGI_LLM_DEFAULT_U_BATCH_SIZE 512
 #define NAGI_LLM_DEFAULT_THREADS 4
+#define NAGI_LLM_DEFAULT_GPU_LAYERS -1
+#define NAGI_LLM_GPU_LAYERS_AUTO -2     /* As many as fit in free video memory */
+#define NAGI_LLM_DEFAULT_GPU_RESERVE_MB 512
+#define NAGI_LLM_DEFAULT_RESERVE_CORES 1
+#define NAGI_LLM_MAX_DEVICES 16        /* llama.cpp's LLAMA_MAX_DEVICES */
+#define NAGI_LLM_DEFAULT_CACHE_KB 256
+#define NAGI_LLM_DEFAULT_MEMO_ENTRIES 1024
+#define NAGI_LLM_DEFAULT_ROOM_KV_MB 64
+#define NAGI_LLM_DEFAULT_MATCH_CACHE_ENTRIES 4096
+#define NAGI_LLM_DEFAULT_MATCH_THRESHOLD 0.5f
+#define NAGI_LLM_DEFAULT_EMBED_MATCH_HIGH 0.85f
+#define NAGI_LLM_DEFAULT_EMBED_MATCH_LOW 0.60f
+#define NAGI_LLM_DEFAULT_DRAFT_TOKENS 5
+#define NAGI_LLM_DEFAULT_LORA_SCALE 1.0f
+#define NAGI_LLM_DEFAULT_HEDGE_DEADLINE_MS 1500
+#define NAGI_LLM_DEFAULT_HEDGE_PERCENTILE 95.0f
+#define NAGI_LLM_DEFAULT_SERVER_SOCKET "/tmp/nagi-llm.sock"
+#define NAGI_LLM_DEFAULT_SERVER_SHARED_MEMORY 1
+#define NAGI_LLM_DEFAULT_CLOUD_SEED 0
+#define NAGI_LLM_DEFAULT_CLOUD_MAX_RETRIES 3
+#define NAGI_LLM_DEFAULT_CLOUD_PROBE_INTERVAL_S 60
+#define NAGI_LLM_DEFAULT_CLOUD_TIMEOUT_MS 30000
+#define NAGI_LLM_DEFAULT_BACKGROUND_DUTY 100
+#define NAGI_LLM_DEFAULT_HYBRID_SLO_MS 1500
+#define NAGI_LLM_DEFAULT_SHARED_CACHE_TIMEOUT_MS 50
+#define NAGI_LLM_DEFAULT_STT_VAD_THRESHOLD 300
+#define NAGI_LLM_DEFAULT_STT_END_MS 700
+#define NAGI_LLM_DEFAULT_STT_CHUNK_MS 1000
+#define NAGI_LLM_DEFAULT_SHARED_CACHE_TTL_DAYS 30
 
 /*
  * LLM operation modes
@@ -39,9 +69,24 @@ typedef unsigned int u32;
 typedef enum {
     NAGI_LLM_MODE_DISABLED = 0,   /* LLM disabled, use original parser only */
     NAGI_LLM_MODE_EXTRACTION = 1, /* Extract verb+noun in English, use original said() matching (FAST) */
-    NAGI_LLM_MODE_SEMANTIC = 2    /* Semantic matching: compare input meaning with expected command (SLOW, PRECISE) */
+    NAGI_LLM_MODE_SEMANTIC = 2,   /* Semantic matching: compare input meaning with expected command (SLOW, PRECISE) */
+    NAGI_LLM_MODE_HYBRID = 3      /* Extraction first, semantic matching when the re-parse fails, within hybrid_slo_ms */
 } nagi_llm_mode_t;
 
+/*
+ * Whether game messages are generated for a player writing English
+ */
+#define NAGI_LLM_ENGLISH_OFF 0        /* Never, the game's own text is shown */
+#define NAGI_LLM_ENGLISH_CREATIVE 1   /* Only when the personality retells it (not the default one) */
+#define NAGI_LLM_ENGLISH_ALWAYS 2     /* Every message, as for any other language */
+
+/*
+ * Verdicts of matches_expected(_batch)
+ */
+#define NAGI_LLM_MATCH_NO 0
+#define NAGI_LLM_MATCH_YES 1
+#define NAGI_LLM_MATCH_ERROR -1       /* The backend couldn't answer, nothing is cached */
+
 /*
  * LLM backend types
  */
@@ -49,9 +94,38 @@ typedef enum {
     NAGI_LLM_BACKEND_UNDEFINED = -1,
     NAGI_LLM_BACKEND_LLAMACPP = 0,  /* llama.cpp - embedded local LLM */
     NAGI_LLM_BACKEND_BITNET = 1,    /* BitNet - optimized quantized models */
-    NAGI_LLM_BACKEND_CLOUD = 2      /* Cloud API (OpenAI-compatible) */
+    NAGI_LLM_BACKEND_CLOUD = 2,     /* Cloud API (OpenAI-compatible) */
+    NAGI_LLM_BACKEND_ROUTER = 3,    /* Local backend, hedged to the cloud when slow */
+    NAGI_LLM_BACKEND_SERVER = 4     /* Client of a nagi-llm-server shared by several games */
 } nagi_llm_backend_t;
 
+/*
+ * KV cache element types for the local backends
+ */
+typedef enum {
+    NAGI_LLM_KV_F16 = 0,            /* Full precision, 2 bytes per element */
+    NAGI_LLM_KV_Q8_0 = 1,           /* 8-bit blocks, about half the memory */
+    NAGI_LLM_KV_Q4_0 = 2            /* 4-bit blocks, about a quarter, V needs flash attention */
+} nagi_llm_kv_type_t;
+
+/*
+ * How the local backends spread a model over several GPUs
+ */
+typedef enum {
+    NAGI_LLM_SPLIT_LAYER = 0,       /* Whole layers per GPU, in tensor_split proportions */
+    NAGI_LLM_SPLIT_ROW = 1,         /* Rows of each tensor across the GPUs */
+    NAGI_LLM_SPLIT_NONE = 2         /* Everything on main_gpu */
+} nagi_llm_split_mode_t;
+
+/*
+ * Where the local backends put memory and threads on a multi-socket machine
+ */
+typedef enum {
+    NAGI_LLM_NUMA_OFF = 0,          /* Wherever the kernel puts them */
+    NAGI_LLM_NUMA_INTERLEAVE = 1,   /* One model spread over every node, threads too */
+    NAGI_LLM_NUMA_REPLICAS = 2      /* nagi-llm-server: one model per node, sessions stay on theirs */
+} nagi_llm_numa_t;
+
 /*
  * LLM configuration structure
  */
@@ -60,10 +134,24 @@ typedef struct {
     char model_path[NAGI_LLM_MAX_MODEL_PATH];   /* Path to model file (for local backends) */
     char api_key[256];                          /* API key (for cloud backends) */
     char api_endpoint[512];                     /* API endpoint URL (for cloud backends) */
+    int cloud_seed;                             /* Sampling seed sent with cloud requests, -1 for none */
+    int cloud_prompt_cache;                     /* 1 to send a prompt_cache_key with cloud requests */
+    int cloud_requests_per_minute;              /* Provider's request rate limit, 0 for none */
+    int cloud_tokens_per_minute;                /* Provider's token rate limit, 0 for none */
+    int cloud_max_retries;                      /* Retries of a rate limited or failed request */
+    char cloud_endpoints[2048];                 /* More endpoints to fail over to, "url|model|key" per line */
+    int cloud_probe_interval_s;                 /* Idle endpoints are probed this often, 0 never */
+    int cloud_timeout_ms;                       /* Longest cloud request before failing over, 0 for none */
+    int cloud_batch;                            /* 1 to pre-translate through the cloud batch API */
+    int cloud_compress;                         /* 1 to gzip cloud request bodies */
+    int cloud_compact_prompts;                  /* 1 for short cloud prompts without examples */
     int context_size;
     int batch_size;
     int u_batch_size;
-    int n_threads;
+    int n_threads;                              /* Generation threads, 0 for one per physical core */
+    int n_threads_batch;                        /* Prompt batch threads, 0 for one per physical core */
+    int pin_threads;                            /* 1 to keep decode threads on one CPU per physical core (Linux) */
+    int reserve_cores;                          /* Physical cores decode threads stay off, for the game and audio */
     float temperature;                          /* Extraction temperature (always 0.0 for deterministic) */
     float temperature_creative_base;            /* Base creative temperature for response generation */
     float temperature_creative_offset;          /* Random offset for creative temperature variation */
@@ -71,11 +159,76 @@ typedef struct {
     int top_k;
     int max_tokens;
     int use_gpu;                                /* 1 to use GPU acceleration (for local backends) */
+    int n_gpu_layers;                           /* Layers offloaded when use_gpu is on, -1 for all, -2 for what fits */
+    int main_gpu;                               /* GPU for the whole model (split none) or the scratch buffers */
+    nagi_llm_split_mode_t split_mode;
+    float tensor_split[NAGI_LLM_MAX_DEVICES];   /* Share of the model per GPU, all 0 for llama.cpp's own */
+    int gpu_reserve_mb;                         /* Video memory left free by n_gpu_layers = -2 */
+    int use_mmap;                               /* 1 to map the model file, shared with other processes */
+    int use_mlock;                              /* 1 to lock the model in RAM so it's never paged out */
+    int mmap_warmup;                            /* 1 to read the whole model file in before ready */
+    int huge_pages;                             /* 1 to put weights and KV cache in huge pages (Linux) */
+    nagi_llm_numa_t numa;                       /* NUMA placement (Linux) */
     int verbose;                                /* 1 for verbose output */
     nagi_llm_mode_t mode;                       /* LLM operation mode */
     int flash_attn;
     int n_seq_max;
     char personality[512];                      /* how llm shold narrate the texts */
+    int english_responses;                      /* NAGI_LLM_ENGLISH_*, generation when the player writes English */
+    int translation_cache_kb;                   /* Translation cache budget in KB, 0 disables it */
+    int extraction_memo_entries;                /* Inputs remembered with their extraction, 0 disables it */
+    int combined_extraction;                    /* 1 to detect the language in the extraction's own answer */
+    float match_threshold;                      /* Minimum P(yes) for a said() match (0.0-1.0) */
+    int match_cache_entries;                    /* said() verdicts remembered per input, 0 disables it */
+    int match_cache_persist;                    /* 1 to save the verdicts per game */
+    int save_kv;                                /* 1 to keep the decoded game context in save files */
+    int room_kv_cache_mb;                       /* Decoded room sections kept for return visits in MB, 0 disables it */
+    int embedding_match;                        /* 1 to settle said() matches by embedding similarity first */
+    char embedding_model_path[NAGI_LLM_MAX_MODEL_PATH]; /* Embedding GGUF, empty to embed with the main model */
+    float embedding_match_high;                 /* Similarity at or above which a said() matches */
+    float embedding_match_low;                  /* Similarity below which it doesn't, the model decides between */
+    char draft_model_path[NAGI_LLM_MAX_MODEL_PATH]; /* Small draft model for speculative decoding, empty for none */
+    int draft_tokens;                           /* Tokens the draft proposes per verification step */
+    char extraction_model[NAGI_LLM_MAX_MODEL_PATH]; /* Smaller model for extraction, empty for the main one */
+    char matching_model[NAGI_LLM_MAX_MODEL_PATH];   /* Smaller model for said() matching, empty for the main one */
+    char generation_model[NAGI_LLM_MAX_MODEL_PATH]; /* Main model if set, in place of model_path */
+    char lora_dir[NAGI_LLM_MAX_MODEL_PATH];     /* Per-game LoRA adapters, <game id>.gguf, empty for none */
+    float lora_scale;                           /* Strength the adapter is applied with */
+    char prompt_cache_dir[NAGI_LLM_MAX_MODEL_PATH]; /* Decoded prompt prefixes kept here across runs, empty for none */
+    char quant_cache_dir[NAGI_LLM_MAX_MODEL_PATH];  /* Requantized copies of the models, empty for none */
+    char quant_type[16];                        /* Their type (q4_k_m, q8_0...), empty or "auto" for the host's */
+    nagi_llm_kv_type_t kv_type_k;               /* KV cache key type (local backends) */
+    nagi_llm_kv_type_t kv_type_v;               /* KV cache value type (local backends) */
+    int memory_budget_mb;                       /* Model plus KV cache limit in MB, 0 for no limit */
+    char stats_file[NAGI_LLM_MAX_MODEL_PATH];   /* Telemetry written here on exit (.csv or JSON), empty for none */
+    char log_file[NAGI_LLM_MAX_MODEL_PATH];     /* Verbose output written here, empty for the console */
+    int stats_overlay;                          /* 1 to show the telemetry over the game screen */
+    int hedge_deadline_ms;                      /* Router: longest wait for the local backend before the cloud */
+    float hedge_percentile;                     /* Router: local latency percentile that sets the wait (0-100) */
+    char server_socket[NAGI_LLM_MAX_MODEL_PATH]; /* Unix socket of nagi-llm-server, for the server backend */
+    int server_shared_memory;                   /* 1 to move the server connection to shared memory (Linux) */
+    char server_nodes[1024];                    /* Sockets of several servers, separated by '|', empty for server_socket */
+    int server_metrics_port;                    /* nagi-llm-server: Prometheus endpoint on localhost, 0 for none */
+    int response_deadline_ms;                   /* Longest response generation, the partial line is kept; 0 for none */
+    char stop_strings[256];                     /* Texts that end a generated response, separated by '|' */
+    int background_duty;                        /* Percent of the time pre-translation may run, 100 for no limit */
+    int hybrid_slo_ms;                          /* Hybrid mode: time an input may take the model, 0 for no limit */
+    char tts_command[NAGI_LLM_MAX_MODEL_PATH];  /* Speech: command reading text lines, writing raw 16-bit mono */
+    char tts_url[512];                          /* Speech: OpenAI-compatible /v1/audio/speech endpoint */
+    char tts_api_key[256];
+    char tts_model[128];
+    char tts_voice[64];
+    int tts_sample_rate;                        /* Rate of the speech audio, 0 for the backend's usual */
+    char stt_url[512];                          /* Speech input: OpenAI-compatible /v1/audio/transcriptions */
+    char stt_api_key[256];
+    char stt_model[128];
+    char stt_language[16];                      /* Spoken language for the transcription, empty to detect */
+    int stt_vad_threshold;                      /* RMS a 20 ms frame must pass to count as speech */
+    int stt_end_ms;                             /* Quiet that ends an utterance */
+    int stt_chunk_ms;                           /* New speech between partial transcripts */
+    char shared_cache[256];                     /* host:port of a Redis server shared by the fleet, empty for none */
+    int shared_cache_timeout_ms;                /* Longest wait for its answer before carrying on without it */
+    int shared_cache_ttl_days;                  /* Days its entries are kept, 0 for no expiry */
 
 } nagi_llm_config_t;
 
@@ -93,12 +246,58 @@ typedef struct llm_state {
     /* Sequence counter for rotating through sequences (1-7, seq 0 is reserved for system prompt) */
     int seq_counter;
 
-    /* Detected language cache */
+    /* Shared prompt prefix (few-shot header, verb list) decoded into seq 0 */
+    int prefix_n_tokens;                     /* Tokens cached in seq 0, 0 when invalid */
+    unsigned long prefix_hash;               /* Hash of the prefix text held in seq 0 */
+
+    /* Detected language cache, kept for the session (see llm_lang.c) */
     char detected_language[32];
+    float language_confidence;               /* 0.0-1.0, how sure we are of it */
 
     /* Game dictionary (words.tok data) - passed from game engine */
     const u8 *dictionary_data;
     size_t dictionary_size;
+
+    /* GBNF grammar over the dictionary words, restricts extraction output */
+    char *extraction_grammar;                /* NULL if no dictionary */
+    int grammar_version;                     /* Bumped when the grammar changes */
+    struct llama_sampler *grammar_sampler;   /* Built by the backend from the grammar */
+    struct llama_sampler *grammar_sampler_combined;  /* Language name, '|', then the same */
+    int grammar_sampler_version;
+
+    /* Preallocated token buffer and batches, see llama_common.h */
+    struct llm_arena *arena;
+
+    /* MB of the process in huge pages once loaded, 0 without config.huge_pages */
+    int huge_pages_mb;
+
+    /* Draft model for speculative response generation, NULL if not configured */
+    struct llama_model *draft_model;
+    struct llama_context *draft_ctx;
+
+    /* ggml compute threads of ctx and draft_ctx, NULL for ggml's own */
+    struct ggml_threadpool *threadpool;
+    struct ggml_threadpool *threadpool_batch;   /* Prompt batches, NULL to use threadpool */
+
+    /* What the game context sequence holds, NULL if there is no sequence for it */
+    struct llm_context_kv *context_kv;
+    /* The sequence as it was after each room's section, NULL without them */
+    struct llm_room_kv *room_kv;
+
+    /* Embedding context for config.embedding_match, NULL if not configured */
+    struct llama_model *embed_model;         /* NULL when the main model is used */
+    struct llama_context *embed_ctx;
+
+    /* Responses the async worker generates together, NULL without slots */
+    struct llm_slots *slots;
+
+    /* Instances on the extraction and matching models, NULL if there are none */
+    struct llm_task_models *tasks;
+
+    /* The game's LoRA adapter on ctx, NULL for the base model */
+    struct llama_adapter_lora *adapter;
+    char adapter_path[NAGI_LLM_MAX_MODEL_PATH];   /* Its file, "" for none */
+    float adapter_scale;
 } llm_state_t;
 
 /*
@@ -106,6 +305,87 @@ typedef struct llm_state {
  */
 typedef struct nagi_llm nagi_llm_t;
 
+/*
+ * Streaming callback, called as text is generated
+ *
+ * @param piece: Newly generated text (not NUL-terminated)
+ * @param len: Length of piece in bytes
+ * @param userdata: Pointer given to the streaming call
+ * @return: 1 to keep generating, 0 to stop
+ */
+typedef int (*nagi_llm_token_cb_t)(const char *piece, int len, void *userdata);
+
+/*
+ * Asynchronous request handle (see nagi_llm_generate_response_async)
+ */
+typedef struct nagi_llm_request nagi_llm_request_t;
+
+typedef enum {
+    NAGI_LLM_REQUEST_PENDING = 0,  /* Queued or being generated */
+    NAGI_LLM_REQUEST_DONE = 1,     /* Result available */
+    NAGI_LLM_REQUEST_FAILED = 2    /* Backend produced nothing */
+} nagi_llm_request_status_t;
+
+/*
+ * Background load state (see nagi_llm_init_async)
+ */
+typedef enum {
+    NAGI_LLM_LOAD_LOADING = 0,     /* Model still loading */
+    NAGI_LLM_LOAD_READY = 1,       /* Backend initialized */
+    NAGI_LLM_LOAD_FAILED = 2       /* Backend could not be initialized */
+} nagi_llm_load_status_t;
+
+/*
+ * Called from the loader thread once a background load is over
+ *
+ * @param ok: 1 if the backend is ready, 0 if it failed to load
+ * @param userdata: Pointer given to nagi_llm_init_async
+ */
+typedef void (*nagi_llm_ready_cb_t)(nagi_llm_t *llm, int ok, void *userdata);
+
+/*
+ * Called from the worker thread when an async request has more text or
+ * has ended, so a caller sleeping between polls can wake up for it
+ */
+typedef void (*nagi_llm_wake_cb_t)(void *userdata);
+
+/*
+ * Operations measured by the telemetry (see nagi_llm_get_stats)
+ */
+typedef enum {
+    NAGI_LLM_OP_EXTRACT = 0,       /* nagi_llm_extract_words */
+    NAGI_LLM_OP_MATCH = 1,         /* nagi_llm_matches_expected(_batch) */
+    NAGI_LLM_OP_GENERATE = 2,      /* Response generation, sync or async */
+    NAGI_LLM_OP_DETECT = 3,        /* Language detection, also run inside generation */
+    NAGI_LLM_OP_COUNT
+} nagi_llm_op_t;
+
+/* Upper bounds (ms) of the request latency buckets, the last one catches the rest */
+#define NAGI_LLM_LATENCY_BOUNDS_MS { 10, 25, 50, 100, 250, 500, 1000, 2500, 5000, 10000 }
+#define NAGI_LLM_LATENCY_BUCKETS 11
+
+/*
+ * Counters for one operation, times in milliseconds
+ * Stage times are only filled in by the llama.cpp-based backends.
+ */
+typedef struct {
+    u32 requests;
+    u32 cache_hits;                /* Answered from the translation cache or the language lookup */
+    u32 kv_reuse_hits;             /* Prompt prefix or game context already decoded */
+    u32 prompt_tokens;             /* Tokens decoded for prompts */
+    u32 generated_tokens;
+    double tokenize_ms;
+    double prompt_ms;              /* Prompt decoding */
+    double generate_ms;            /* Token by token generation */
+    double total_ms;               /* Whole requests, not counting the async queue */
+    double max_ms;                 /* Slowest request */
+    u32 latency[NAGI_LLM_LATENCY_BUCKETS]; /* Requests by total time, see NAGI_LLM_LATENCY_BOUNDS_MS */
+} nagi_llm_op_stats_t;
+
+typedef struct {
+    nagi_llm_op_stats_t op[NAGI_LLM_OP_COUNT];
+} nagi_llm_stats_t;
+
 /*
  * Abstract LLM interface - function pointer table (vtable)
  */
@@ -121,6 +401,53 @@ struct nagi_llm {
     /* Backend-specific data */
     void *backend_data;
 
+    /* Worker thread for async requests, started on first use */
+    struct nagi_llm_worker *worker;
+
+    /* Loader thread while nagi_llm_init_async is loading the model */
+    struct nagi_llm_loader *loader;
+
+    /* Async request progress, see nagi_llm_set_wake */
+    nagi_llm_wake_cb_t on_wake;
+    void *wake_userdata;
+
+    /* Generated responses keyed by message/language/personality, created on first use */
+    struct llm_cache *translation_cache;
+
+    /* Decoded game dictionary (ID -> word table, word -> ID hash) */
+    struct llm_dict *dictionary;
+
+    /* Input words learned from extractions, for nagi_llm_normalize_input */
+    struct llm_synonyms *synonyms;
+
+    /* Whole inputs with the extraction that parsed, created on first use */
+    struct llm_memo *extraction_memo;
+
+    /* said() verdicts per (input, expected word IDs), created on first use */
+    struct llm_memo *match_cache;
+
+    /* said() phrase embeddings for config.embedding_match, created on first use */
+    struct llm_embed *phrase_embeddings;
+
+    /* Request telemetry, created with the instance */
+    struct llm_stats *stats;
+
+    /* Connection to the fleet's shared cache, see nagi_llm_set_game_key */
+    struct llm_remote *remote;
+
+    /* llm_config.ini watched for changes, see nagi_llm_watch_config */
+    struct llm_config_watch *config_watch;
+
+    /* The extraction prompt's word list, see nagi_llm_set_vocabulary */
+    char vocabulary[NAGI_LLM_VOCABULARY_SIZE];
+
+    /* Verbs from the dictionary when there's no vocabulary, and which dictionary */
+    char verb_list[512];
+    const void *verbs_source;
+
+    /* Game context the prompts are built from, see nagi_llm_set_session */
+    struct nagi_llm_session *session;
+
     /* Backend-specific prompt templates */
     const char *extraction_prompt_template;
     const char *extraction_prompt_simple;
@@ -139,8 +466,11 @@ struct nagi_llm {
     
     /*
      * Extract verb and noun from user input
+     *
+     * @param out: Caller's buffer the words may be written to
+     * @return: out, or input if there's nothing better
      */
-    const char *(*extract_words)(nagi_llm_t *llm, const char *input);
+    const char *(*extract_words)(nagi_llm_t *llm, const char *input, char *out, int out_size);
 
     /*
      * Check if input matches expected command (Semantic Match)
@@ -149,11 +479,37 @@ struct nagi_llm {
      * @param input: User input string
      * @param expected_word_ids: Array of expected word IDs
      * @param expected_count: Number of expected words
-     * @return: 1 if matches, 0 otherwise
+     * @return: NAGI_LLM_MATCH_YES, NAGI_LLM_MATCH_NO, or NAGI_LLM_MATCH_ERROR
+     *          if the backend failed to answer
      */
     int (*matches_expected)(nagi_llm_t *llm, const char *input,
                            const int *expected_word_ids, int expected_count);
 
+    /*
+     * Check one input against several expected commands at once.
+     * Optional, may be NULL.
+     *
+     * @param expected_lists: Word ID arrays, one per candidate
+     * @param expected_counts: Number of words in each candidate
+     * @param n_lists: Number of candidates
+     * @param results: Set to a NAGI_LLM_MATCH_ verdict for each candidate,
+     *                 NAGI_LLM_MATCH_ERROR for those that couldn't be scored
+     * @return: 1 if the candidates were scored, 0 on failure
+     */
+    int (*matches_expected_batch)(nagi_llm_t *llm, const char *input,
+                                  const int *const *expected_lists, const int *expected_counts,
+                                  int n_lists, int *results);
+
+    /*
+     * Embed text into a vector for the embedding matcher.
+     * Optional, may be NULL.
+     *
+     * @param output: Receives the embedding, or NULL to only ask its size
+     * @param output_size: Number of floats output can hold
+     * @return: Size of the embedding, 0 if there is no embedding context
+     */
+    int (*embed_text)(nagi_llm_t *llm, const char *text, float *output, int output_size);
+
     /*
      * Generate a game response using the LLM
      *
@@ -166,6 +522,75 @@ struct nagi_llm {
      */
     int (*generate_response)(nagi_llm_t *llm, const char *game_response,
                             const char *user_input, char *output, int output_size);
+
+    /*
+     * Generate a game response, passing text to a callback as it is produced
+     *
+     * Same as generate_response; the complete (post-processed) response is
+     * still written to output. Optional, may be NULL.
+     *
+     * @param on_token: Called with each new piece of the first response line
+     * @param userdata: Passed to on_token
+     */
+    int (*generate_response_stream)(nagi_llm_t *llm, const char *game_response,
+                                    const char *user_input, char *output, int output_size,
+                                    nagi_llm_token_cb_t on_token, void *userdata);
+
+    /*
+     * Generate responses for several game messages in one pass (no player
+     * input, language from state->detected_language). Optional, may be NULL.
+     *
+     * @param game_responses: Messages to generate for
+     * @param count: Number of messages
+     * @param outputs: One buffer of output_size bytes per message, left
+     *                 empty for messages that could not be generated
+     * @return: Number of messages generated
+     */
+    int (*generate_response_batch)(nagi_llm_t *llm, const char **game_responses, int count,
+                                   char **outputs, int output_size);
+
+    /*
+     * Continuous batching for the async worker. Optional, all three or none.
+     * generate_begin decodes a response prompt into a free slot;
+     * generate_step then advances every started slot with one decode, so
+     * responses queued while others run join the next step. The worker
+     * drops its call lock between steps.
+     *
+     * generate_slots returns how many slots there are, 0 if none.
+     * generate_begin takes the generate_response_stream arguments and
+     * returns 1 once the slot is generating, 0 on failure. A NULL
+     * game_response drops whatever the slot was generating.
+     * generate_step sets lengths[slot] to the cleaned response length for
+     * slots that finished (0 when nothing usable came out), -1 for the
+     * others, and returns how many slots are still generating.
+     */
+    int (*generate_slots)(nagi_llm_t *llm);
+    int (*generate_begin)(nagi_llm_t *llm, int slot, const char *game_response,
+                          const char *user_input, char *output, int output_size,
+                          nagi_llm_token_cb_t on_token, void *userdata);
+    int (*generate_step)(nagi_llm_t *llm, int *lengths);
+
+    /*
+     * Decoded game context for a save file. Optional, may be NULL.
+     * kv_save returns the bytes written, or needed with a NULL buf, 0 if
+     * there's nothing decoded. kv_load returns 1 if the data was taken, it
+     * expects the game context (llm_context_snapshot_restore) to be back
+     * already so it can tell the two still agree.
+     */
+    size_t (*kv_save)(nagi_llm_t *llm, void *buf, size_t size);
+    int (*kv_load)(nagi_llm_t *llm, const void *buf, size_t size);
+
+    /*
+     * Swap the LoRA adapter without reloading the model. Optional, may be
+     * NULL. A NULL path goes back to the base model. Returns 1 on success.
+     */
+    int (*set_adapter)(nagi_llm_t *llm, const char *path, float scale);
+
+    /*
+     * Rebuild what was made from the sampling settings (samplers) after
+     * nagi_llm_apply_config changed them. Optional, may be NULL.
+     */
+    void (*reconfigure)(nagi_llm_t *llm);
 };
 
 /*
@@ -190,6 +615,35 @@ int nagi_llm_init(nagi_llm_t *llm,
                 const char *model_path,
                 const nagi_llm_config_t *config);
 
+/*
+ * Initialize the LLM backend on a loader thread and return at once
+ *
+ * The config and model path are applied before returning. Until the
+ * load is done nagi_llm_ready returns 0, so callers keep their non-LLM
+ * path; a dictionary or language set meanwhile is applied when it ends.
+ *
+ * @param on_ready: Called from the loader thread when the load ends (may be NULL)
+ * @param userdata: Passed to on_ready
+ * @return: 1 if loading started, 0 on failure
+ */
+int nagi_llm_init_async(nagi_llm_t *llm, const char *model_path, const nagi_llm_config_t *config,
+                        nagi_llm_ready_cb_t on_ready, void *userdata);
+
+/*
+ * Check how a background load is going
+ *
+ * @param progress: Receives 0.0-1.0 (may be NULL)
+ * @return: Load state, READY/FAILED for instances set up with nagi_llm_init
+ */
+nagi_llm_load_status_t nagi_llm_load_status(nagi_llm_t *llm, float *progress);
+
+/*
+ * Block until a background load is over, for tools that need the model
+ *
+ * @return: 1 if the backend is ready, 0 if it failed to load
+ */
+int nagi_llm_wait_ready(nagi_llm_t *llm);
+
 /*
  * Shutdown the LLM backend
  */
@@ -200,28 +654,478 @@ void nagi_llm_shutdown(nagi_llm_t *llm);
  */
 int nagi_llm_ready(nagi_llm_t *llm);
 
+/*
+ * MB of the process backed by huge pages when the model was loaded with
+ * config.huge_pages, 0 when it wasn't or none could be had
+ */
+int nagi_llm_huge_pages_mb(nagi_llm_t *llm);
+
+/*
+ * Check if game messages are worth generating. A player writing English
+ * (or who hasn't written anything yet) reads the game's own text unless
+ * config.english_responses says otherwise, so English costs no model runs.
+ */
+int nagi_llm_wants_response(nagi_llm_t *llm);
+
+/*
+ * Check the player's language against language, ignoring case. Reads it
+ * like nagi_llm_wants_response, without waiting for a call in progress.
+ *
+ * @return: 1 if it is language, 0 if it's another, -1 while none is known
+ */
+int nagi_llm_language_is(nagi_llm_t *llm, const char *language);
+
 /*
  * Set dictionary data
  */
 int nagi_llm_set_dictionary(nagi_llm_t *llm, const unsigned char *dictionary, size_t size);
 
+/*
+ * Narrow the extraction prompt's word list to these word IDs, the most
+ * used first (the said() words of the current room). A count of 0 goes
+ * back to the list from the whole dictionary.
+ */
+void nagi_llm_set_vocabulary(nagi_llm_t *llm, const int *word_ids, int count);
+
+/*
+ * Apply the LoRA adapter tuned for a game, <config.lora_dir>/<game_id>.gguf
+ * A game without one runs on the base model. With an adapter on, the
+ * extraction prompt leaves out the verb list.
+ *
+ * @return: 1 if the game's adapter is applied, or will be once the model
+ *          has loaded
+ */
+int nagi_llm_set_game_adapter(nagi_llm_t *llm, const char *game_id);
+
+/*
+ * Look up len chars of word in the dictionary (case insensitive)
+ *
+ * @return: Word ID, or -1 if unknown or no dictionary is set
+ */
+int nagi_llm_find_word(nagi_llm_t *llm, const char *word, int len);
+
+/*
+ * Fix up input the classic parser rejected from the dictionary alone:
+ * accents are folded, plurals and one-letter typos corrected and words
+ * learned from earlier extractions replaced. Takes microseconds, so it is
+ * tried before nagi_llm_extract_words. Works while the model is loading.
+ * Game thread only.
+ *
+ * @param output: Receives the rewritten input, lowercase dictionary words
+ * @return: 1 if every word was resolved, 0 if the model is needed
+ */
+int nagi_llm_normalize_input(nagi_llm_t *llm, const char *input, char *output, int output_size);
+
+/*
+ * Learn from an extraction that parsed: when one input word was unknown
+ * and the extraction brought in one new dictionary word, the first maps to
+ * the second from then on. The table is bounded and cleared with the
+ * dictionary. Game thread only.
+ */
+void nagi_llm_learn_extraction(nagi_llm_t *llm, const char *input, const char *extracted);
+
 /*
  * Extract verb and noun from user input
+ * Any number of threads may call it with their own buffers.
+ *
+ * @param output: Receives the English words, the input itself if the
+ *                model couldn't do better
+ * @return: Length of output
  */
-const char *nagi_llm_extract_words(nagi_llm_t *llm, const char *input);
+int nagi_llm_extract_words(nagi_llm_t *llm, const char *input, char *output, int output_size);
+
+/*
+ * Queue an extraction on the worker thread at low priority, for text the
+ * player is still typing. It only runs while no response is queued or
+ * being generated. Poll and free it like a generation request; the result
+ * is what nagi_llm_extract_words would have returned.
+ *
+ * @return: Request handle, or NULL if the request could not be queued
+ */
+nagi_llm_request_t *nagi_llm_extract_words_async(nagi_llm_t *llm, const char *input);
 
 /*
  * Check if input matches expected command
+ * Verdicts are cached per input, so asking again costs nothing.
+ *
+ * @return: NAGI_LLM_MATCH_YES, NAGI_LLM_MATCH_NO, or NAGI_LLM_MATCH_ERROR
+ *          if the backend failed (not cached, the next call asks again)
  */
 int nagi_llm_matches_expected(nagi_llm_t *llm, const char *input,
                                     const int *expected_word_ids, int expected_count);
 
+/*
+ * Embed said() word lists ahead of the first match, e.g. every phrase of
+ * the game's logic at load time, so matching is a dot product scan.
+ * Phrases not given here are embedded the first time they are tested.
+ * Does nothing unless config.embedding_match is set and the backend can embed.
+ *
+ * @return: Number of phrases embedded so far
+ */
+int nagi_llm_embed_phrases(nagi_llm_t *llm, const int *const *expected_lists,
+                           const int *expected_counts, int n_lists);
+
+/*
+ * Check an input against several expected commands in one call
+ * Falls back to one matches_expected call per candidate if the backend
+ * can't batch. Candidates the backend failed to score get
+ * NAGI_LLM_MATCH_ERROR, which is not cached.
+ *
+ * @return: 1 if results were filled in, 0 on failure
+ */
+int nagi_llm_matches_expected_batch(nagi_llm_t *llm, const char *input,
+                                    const int *const *expected_lists, const int *expected_counts,
+                                    int n_lists, int *results);
+
 /*
  * Generate a game response
  */
 int nagi_llm_generate_response(nagi_llm_t *llm, const char *game_response,
                                       const char *user_input, char *output, int output_size);
 
+/*
+ * Generate a game response, streaming text through on_token
+ * Falls back to generate_response (one callback) if the backend can't stream
+ */
+int nagi_llm_generate_response_stream(nagi_llm_t *llm, const char *game_response,
+                                      const char *user_input, char *output, int output_size,
+                                      nagi_llm_token_cb_t on_token, void *userdata);
+
+/*
+ * Generate responses for a list of game messages, e.g. to pre-translate a
+ * whole game. Uses the backend's batched path when it has one and retries
+ * anything it missed one message at a time.
+ *
+ * @return: Number of messages generated
+ */
+int nagi_llm_generate_response_batch(nagi_llm_t *llm, const char **game_responses, int count,
+                                     char **outputs, int output_size);
+
+/*
+ * Set the language responses are generated in until the player's input
+ * says otherwise
+ */
+void nagi_llm_set_language(nagi_llm_t *llm, const char *language);
+
+/*
+ * Save what the session has learned for a save file: the detected language
+ * and, with kv set, the backend's decoded game context so a restore doesn't
+ * decode it again (see config.save_kv)
+ *
+ * @param buf: Where to write it, NULL to get the size needed
+ * @return: Bytes written or needed, 0 if there's nothing to save
+ */
+size_t nagi_llm_session_save(nagi_llm_t *llm, void *buf, size_t size, int kv);
+
+/*
+ * Put back what nagi_llm_session_save wrote. Call it after the game
+ * context is restored, the decoded part is only used if it still matches.
+ *
+ * @return: 1 if the decoded game context was used too
+ */
+int nagi_llm_session_load(nagi_llm_t *llm, const void *buf, size_t size);
+
+/*
+ * Queue a game response for generation on the worker thread
+ *
+ * @param llm: LLM instance
+ * @param game_response: Original game response (copied)
+ * @param user_input: Original user input (copied, may be NULL)
+ * @return: Request handle, or NULL if the request could not be queued
+ */
+nagi_llm_request_t *nagi_llm_generate_response_async(nagi_llm_t *llm, const char *game_response,
+                                                     const char *user_input);
+
+/*
+ * Queue a response for a game other than the instance's own, e.g. one of
+ * a server's clients. The request carries that game's context and player
+ * language; the worker puts them in place only while it generates, so
+ * they don't depend on what the instance holds by then. Let go of the
+ * request, then nagi_llm_set_player, before freeing the session.
+ *
+ * @param session: The game's context, NULL for none
+ * @param language: Its player's language, NULL or "" until it's detected
+ */
+nagi_llm_request_t *nagi_llm_generate_response_async_for(nagi_llm_t *llm, struct nagi_llm_session *session,
+                                                         const char *language, float language_confidence,
+                                                         const char *game_response, const char *user_input);
+
+/*
+ * Queue a game message for translation into the cache in the background,
+ * behind responses and speculative extractions. It stops at the next token
+ * for any of those or a synchronous call and starts over later, and runs
+ * no more than config.background_duty percent of the time. Nothing is
+ * queued before a language is detected, when nagi_llm_wants_response says
+ * no or if the message is already cached.
+ *
+ * @return: 1 if it was queued
+ */
+int nagi_llm_pretranslate_async(nagi_llm_t *llm, const char *game_response);
+
+/*
+ * Drop the queued pre-translations that haven't started yet
+ */
+void nagi_llm_pretranslate_cancel(nagi_llm_t *llm);
+
+/*
+ * Count the async requests still queued and the ones being generated or
+ * extracted right now. Both are 0 before the worker has started.
+ */
+void nagi_llm_async_load(nagi_llm_t *llm, int *queued, int *running);
+
+/*
+ * Check if the game is waiting on the model, a synchronous call or an
+ * async request other than background work. The host's own background
+ * threads can stand back meanwhile.
+ */
+int nagi_llm_async_interactive(nagi_llm_t *llm);
+
+/*
+ * Build prompts from this game context (see nagi_llm_context.h), NULL for
+ * none. Set it before the model loads for the local backends to measure
+ * the context with their own tokenizer. The session must outlive its use.
+ */
+void nagi_llm_set_session(nagi_llm_t *llm, struct nagi_llm_session *session);
+
+/*
+ * Serve another game from the instance: its context and player language
+ * stand in for the instance's until the next call. Waits for the backend
+ * call in progress, so once it returns nothing uses the previous session.
+ *
+ * @param language: NULL or "" until it's detected
+ */
+void nagi_llm_set_player(nagi_llm_t *llm, struct nagi_llm_session *session,
+                         const char *language, float language_confidence);
+
+/*
+ * The player's language as the calls since nagi_llm_set_player left it
+ *
+ * @return: Length of the language written to buf
+ */
+int nagi_llm_player_language(nagi_llm_t *llm, char *buf, int buf_size, float *confidence);
+
+/*
+ * Have the worker call on_wake whenever a request streams text or ends
+ * Set it before queueing requests. NULL stops the calls.
+ */
+void nagi_llm_set_wake(nagi_llm_t *llm, nagi_llm_wake_cb_t on_wake, void *userdata);
+
+/*
+ * Check the state of an async request without blocking
+ */
+nagi_llm_request_status_t nagi_llm_request_poll(nagi_llm_request_t *req);
+
+/*
+ * Copy the text streamed so far by a pending request
+ *
+ * @return: Length of the partial text (0 if nothing yet)
+ */
+int nagi_llm_request_partial(nagi_llm_request_t *req, char *buf, int buf_size);
+
+/*
+ * The language a request for another game was generated in, its player's
+ * as given until the request is done
+ *
+ * @return: Length of the language written to buf, 0 if none
+ */
+int nagi_llm_request_language(nagi_llm_request_t *req, char *buf, int buf_size, float *confidence);
+
+/*
+ * Get the generated text of a finished request
+ *
+ * @return: Generated text (owned by the request), or NULL if not done
+ */
+const char *nagi_llm_request_result(nagi_llm_request_t *req);
+
+/*
+ * Release a request. Safe to call while it is still pending; the result
+ * is then discarded.
+ */
+void nagi_llm_request_free(nagi_llm_request_t *req);
+
+/*
+ * Translation cache
+ *
+ * Responses are cached per (game message, response language, personality)
+ * and reused instead of calling the backend again.
+ */
+
+/*
+ * Look up a cached response for a game message, in the language the
+ * reply to user_input (NULL if there is none) will be in
+ *
+ * @return: Length of the text copied to output, 0 on a miss or while
+ *          the language can only be told by the model
+ */
+int nagi_llm_cache_lookup(nagi_llm_t *llm, const char *game_response, const char *user_input,
+                          char *output, int output_size);
+
+/*
+ * Store a generated response for a game message
+ */
+void nagi_llm_cache_store(nagi_llm_t *llm, const char *game_response, const char *text);
+
+/*
+ * Load/save the cache, e.g. one file per game
+ *
+ * @return: 1 on success, 0 on failure (a missing file is not an error to report)
+ */
+int nagi_llm_cache_load(nagi_llm_t *llm, const char *path);
+int nagi_llm_cache_save(nagi_llm_t *llm, const char *path);
+
+/*
+ * Drop all cached responses
+ */
+void nagi_llm_cache_clear(nagi_llm_t *llm);
+
+/*
+ * Memory held by the cache, for a budget shared with other caches
+ *
+ * @return: Bytes held, with the size of the least recently used entry and
+ *          the milliseconds since it was last used (both 0 if empty)
+ */
+size_t nagi_llm_cache_usage(nagi_llm_t *llm, size_t *oldest_bytes, double *oldest_age_ms);
+
+/*
+ * Drop the least recently used response
+ */
+void nagi_llm_cache_evict(nagi_llm_t *llm);
+
+/*
+ * Extraction memo
+ *
+ * Extractions that parsed are remembered per input (folded for case,
+ * accents and punctuation), up to config.extraction_memo_entries, so a
+ * phrase typed again skips the model. Game thread only.
+ */
+
+/*
+ * Look up the extraction remembered for an input
+ *
+ * @return: Length of the words copied to output, 0 on a miss
+ */
+int nagi_llm_memo_lookup(nagi_llm_t *llm, const char *input, char *output, int output_size);
+
+/*
+ * Remember the extraction of an input once it parsed
+ */
+void nagi_llm_memo_store(nagi_llm_t *llm, const char *input, const char *extracted);
+
+/*
+ * Load/save the memo, one file per game
+ *
+ * @return: 1 on success, 0 on failure (a missing file is not an error to report)
+ */
+int nagi_llm_memo_load(nagi_llm_t *llm, const char *path);
+int nagi_llm_memo_save(nagi_llm_t *llm, const char *path);
+
+/*
+ * Memory held by the memo and its least recently used entry, and dropping
+ * that entry, like nagi_llm_cache_usage/nagi_llm_cache_evict
+ */
+size_t nagi_llm_memo_usage(nagi_llm_t *llm, size_t *oldest_bytes, double *oldest_age_ms);
+void nagi_llm_memo_evict(nagi_llm_t *llm);
+
+/*
+ * Shared cache
+ *
+ * With config.shared_cache set, translations and extractions missing from
+ * the local cache and memo are looked up on a Redis server shared by every
+ * node, and the model's answers are published there. Entries are keyed by
+ * game, text, language, personality and model.
+ */
+
+/*
+ * Name the game being played, e.g. from the CRCs of its files. Sharing
+ * starts with this call and the key goes into every entry.
+ */
+void nagi_llm_set_game_key(nagi_llm_t *llm, const char *game_key);
+
+/*
+ * Load/save the said() verdicts nagi_llm_matches_expected(_batch) keep
+ * per (input, expected word IDs), see config.match_cache_persist
+ *
+ * @return: 1 on success, 0 on failure (a missing file is not an error to report)
+ */
+int nagi_llm_match_cache_load(nagi_llm_t *llm, const char *path);
+int nagi_llm_match_cache_save(nagi_llm_t *llm, const char *path);
+
+/*
+ * Request telemetry
+ *
+ * Every call is counted against its operation. The counters can be read at
+ * any time, from any thread.
+ */
+
+/*
+ * Copy the counters gathered so far
+ *
+ * @return: 1 on success, 0 if the instance keeps no telemetry
+ */
+int nagi_llm_get_stats(nagi_llm_t *llm, nagi_llm_stats_t *stats);
+
+/*
+ * Start counting again from zero
+ */
+void nagi_llm_reset_stats(nagi_llm_t *llm);
+
+/*
+ * Name of an operation as used in the dumps ("extract", "match", ...)
+ */
+const char *nagi_llm_op_name(nagi_llm_op_t op);
+
+/*
+ * Write the counters to a file, as CSV if the name ends in .csv, JSON otherwise
+ *
+ * @return: 1 on success, 0 on failure
+ */
+int nagi_llm_stats_save(nagi_llm_t *llm, const char *path);
+
+/*
+ * The counters in the Prometheus text format, for a metrics endpoint:
+ * requests, hits, tokens and latency histograms by operation and backend,
+ * the async queue, and the bytes held by the caches. With more than one
+ * instance (the replicas of nagi-llm-server) each sample carries its index.
+ *
+ * @param buf: Where to write it, NUL-terminated, may be NULL with size 0
+ * @return: Length of the whole text, more than size - 1 if it was cut short
+ */
+size_t nagi_llm_metrics(nagi_llm_t *const *llms, int count, char *buf, size_t size);
+
+/*
+ * Hybrid mode bookkeeping
+ *
+ * The parser reports how long each way of reading an input kept the model
+ * busy and whether the input was understood, and asks before trying one.
+ * Only inputs that reached the model are reported.
+ */
+void nagi_llm_hybrid_record(nagi_llm_t *llm, nagi_llm_mode_t mode, double ms, int understood);
+
+/*
+ * Whether to try mode (EXTRACTION or SEMANTIC) on the current input, with
+ * spent_ms already gone on it. Extraction is skipped while it rarely
+ * parses and semantic matching alone fits config.hybrid_slo_ms; semantic
+ * matching is skipped when it would usually take the input past it. Now
+ * and then a skipped way is tried anyway so its figures stay current.
+ *
+ * @return: 1 to try it, 0 to skip it
+ */
+int nagi_llm_hybrid_try(nagi_llm_t *llm, nagi_llm_mode_t mode, double spent_ms);
+
+/*
+ * Send the library's verbose output through a ring buffer that a
+ * background thread writes out, to path or to the console if it's NULL.
+ * Until it's started every line is printed where it's logged.
+ *
+ * @return: 1 on success, 0 if the file or the thread couldn't be made
+ */
+int nagi_llm_log_start(const char *path);
+
+/*
+ * Write out what's left in the ring and stop the thread
+ */
+void nagi_llm_log_stop(void);
+
 /*
  * Load unified configuration from llm_config.ini
  */
@@ -229,6 +1133,59 @@ int nagi_llm_load_config(nagi_llm_config_t *config,
                          nagi_llm_backend_t backend,
                          const char *config_file);
 
+/*
+ * Apply the settings that don't need the model loaded again: temperatures,
+ * top_k/top_p, max_tokens, personality, stop strings, the response
+ * deadline, mode and match thresholds. Samplers are rebuilt and the
+ * translations made with another personality dropped; the model and the
+ * prompt prefixes it has decoded are kept.
+ *
+ * @return: 1 if anything changed, 0 if nothing did or the model is still loading
+ */
+int nagi_llm_apply_config(nagi_llm_t *llm, const nagi_llm_config_t *config);
+
+/*
+ * Watch the configuration file (the default llm_config.ini if NULL) for
+ * changes. nagi_llm_poll_config, called from the game loop, looks at the
+ * file at most once a second and applies what changed with
+ * nagi_llm_apply_config. Pass an absolute path if the working directory
+ * changes.
+ *
+ * @return: 1 if the file was found, 0 otherwise
+ */
+int nagi_llm_watch_config(nagi_llm_t *llm, const char *config_file);
+
+/*
+ * @return: 1 if the watched file changed and was applied by this call
+ */
+int nagi_llm_poll_config(nagi_llm_t *llm);
+
+/* Hex digits of a machine fingerprint, with the NUL */
+#define NAGI_LLM_FINGERPRINT_SIZE 17
+
+/*
+ * Identify this machine's CPU and GPU, for the [llamacpp.auto] profiles
+ *
+ * @param id: Receives a short hash of the description (NAGI_LLM_FINGERPRINT_SIZE)
+ * @param desc: Receives the readable description, may be NULL
+ */
+void nagi_llm_machine_fingerprint(char *id, size_t id_size, char *desc, size_t desc_size);
+
+/*
+ * Calibrate the llama.cpp backend on this machine and save the fastest settings
+ *
+ * Threads, batch sizes, flash attention, KV cache types and GPU offload are
+ * tried in turn against the corpus (nagi-llm-bench's text format, only the
+ * '>' and '<' records are used; NULL for a short built-in one). The best is
+ * written to config_file as a [llamacpp.auto] section for this machine's
+ * fingerprint, replacing an older one.
+ *
+ * @return: 1 on success, 0 on failure
+ */
+int nagi_llm_tune(const char *config_file, const char *model_path,
+                  const unsigned char *dictionary, size_t dict_size,
+                  const char *corpus_path);
+
 /*
  * Utility functions
  */
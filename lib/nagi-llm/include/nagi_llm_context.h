@@ -30,9 +30,13 @@ extern "C" {
 /* Maximum sizes for context buffers */
 #define LLM_MAX_CONTEXT_SIZE 8192
 #define LLM_MAX_HISTORY_ENTRIES 50
-#define LLM_MAX_ENTRY_SIZE 512
+#define LLM_MAX_ENTRY_SIZE 512               /* Longest history text kept */
+#define LLM_HISTORY_TEXT_SIZE 8192           /* Interned history text, the oldest entries make room */
 #define LLM_MAX_ROOM_DESC_SIZE 1024
 #define LLM_MAX_OBJECTS_SIZE 512
+#define LLM_MAX_SEGMENT_SIZE 2048
+#define LLM_MAX_CONTEXT_EVENTS 20            /* Most history entries in the context */
+#define LLM_DEFAULT_CONTEXT_TOKENS 1024      /* Token budget until a backend sets one */
 
 /*
  * Context entry types
@@ -52,14 +56,58 @@ typedef enum {
 
 /*
  * Single context entry
+ * The text is interned, repeats of a message share one copy. Read it with
+ * llm_context_entry_text.
  */
 typedef struct {
-    llm_context_type_t type;
+    u32 serial;                /* Increases with every entry added */
     u32 timestamp;             /* Game tick when this occurred */
-    int room;                  /* Room where this occurred */
-    char text[LLM_MAX_ENTRY_SIZE];
+    short room;                /* Room where this occurred */
+    short tokens;              /* Tokens of the formatted line, -1 until counted */
+    u8 type;                   /* llm_context_type_t */
+    u8 text;                   /* Interned string, 0 for none */
 } llm_context_entry_t;
 
+/*
+ * Interned history string, in llm_context_t.history_text
+ */
+typedef struct {
+    u32 hash;
+    u16 at;
+    u16 len;
+    u16 refs;                  /* Entries using it, 0 for a free slot */
+} llm_context_string_t;
+
+/*
+ * Context sections, in prompt order
+ * Each is rebuilt only when the state it shows changes.
+ */
+typedef enum {
+    LLM_SEG_STATE,         /* Room number and score */
+    LLM_SEG_ROOM,          /* Room description and exits */
+    LLM_SEG_INVENTORY,
+    LLM_SEG_FLAGS,         /* Tracked flags that are set */
+    LLM_SEG_EVENTS,        /* Header of the history list */
+    LLM_SEG_COUNT
+} llm_context_segment_id_t;
+
+typedef struct {
+    char text[LLM_MAX_SEGMENT_SIZE];
+    int len;
+    int tokens;                /* Cached token count of text */
+    int dirty;                 /* 1 if text must be rebuilt */
+} llm_context_segment_t;
+
+/*
+ * Token counter used for the context budget
+ *
+ * @param text: Text to measure (not NUL-terminated)
+ * @param len: Length of text in bytes
+ * @param userdata: Pointer given to llm_context_set_token_counter
+ * @return: Number of tokens
+ */
+typedef int (*llm_context_token_count_t)(const char *text, int len, void *userdata);
+
 /*
  * Game object info for context
  */
@@ -97,6 +145,13 @@ typedef struct {
     llm_context_entry_t history[LLM_MAX_HISTORY_ENTRIES];
     int history_head;
     int history_count;
+    u32 history_serial;        /* Serial of the next entry */
+    u32 history_epoch;         /* Bumped when the history is cleared */
+
+    /* The history's text: slot 0 stays unused, there's one per entry at most */
+    llm_context_string_t strings[LLM_MAX_HISTORY_ENTRIES + 1];
+    int history_text_used;
+    char history_text[LLM_HISTORY_TEXT_SIZE];
 
     /* Inventory */
     int inventory[32];
@@ -110,28 +165,50 @@ typedef struct {
     } tracked_flags[64];
     int tracked_flags_count;
 
-    /* Compiled context string (for LLM input) */
-    char context_buffer[LLM_MAX_CONTEXT_SIZE];
+    /* Cached sections of the context string */
+    llm_context_segment_t segments[LLM_SEG_COUNT];
+
+    int context_tokens; /* Tokens in the built context */
     int context_dirty;  /* 1 if context needs rebuilding */
 } llm_context_t;
 
-/* Global context instance */
-extern llm_context_t g_llm_context;
+/*
+ * One game's context, its history, description tables and lock
+ * Sessions share nothing, so several games (or server clients) can each
+ * have one. Every llm_context_* call takes the session first; with NULL
+ * the hooks drop their events, llm_context_build gives "" and snapshots
+ * are empty.
+ */
+typedef struct nagi_llm_session nagi_llm_session_t;
 
 /*
- * Initialize the LLM context system
+ * Start a session, NULL if out of memory
  */
-void llm_context_init(void);
+nagi_llm_session_t *nagi_llm_session_new(void);
 
 /*
- * Shutdown the LLM context system
+ * End a session, freeing its context and tables
  */
-void llm_context_shutdown(void);
+void nagi_llm_session_free(nagi_llm_session_t *s);
+
+/*
+ * The session's context, read it under llm_context_lock
+ */
+llm_context_t *llm_context_state(nagi_llm_session_t *s);
+
+/*
+ * Flags and variables the context follows, a bit each (0x80 >> n % 8 of
+ * byte n / 8, the game's own layout). The game tests the bit on every
+ * write and only reports those that are set. 32 bytes each, NULL without
+ * a session.
+ */
+const u8 *llm_context_flag_watch(nagi_llm_session_t *s);
+const u8 *llm_context_var_watch(nagi_llm_session_t *s);
 
 /*
  * Clear all context history
  */
-void llm_context_clear(void);
+void llm_context_clear(nagi_llm_session_t *s);
 
 /*
  * Add an entry to the context history
@@ -139,7 +216,7 @@ void llm_context_clear(void);
  * @param type: Type of context entry
  * @param text: Text content of the entry
  */
-void llm_context_add(llm_context_type_t type, const char *text);
+void llm_context_add(nagi_llm_session_t *s, llm_context_type_t type, const char *text);
 
 /*
  * Add a formatted entry to the context history
@@ -148,7 +225,7 @@ void llm_context_add(llm_context_type_t type, const char *text);
  * @param fmt: Format string
  * @param ...: Format arguments
  */
-void llm_context_addf(llm_context_type_t type, const char *fmt, ...);
+void llm_context_addf(nagi_llm_session_t *s, llm_context_type_t type, const char *fmt, ...);
 
 /*
  * Update room information
@@ -157,7 +234,7 @@ void llm_context_addf(llm_context_type_t type, const char *fmt, ...);
  * @param description: Room description text
  * @param exits: Available exits description
  */
-void llm_context_set_room(int room_num, const char *description, const char *exits);
+void llm_context_set_room(nagi_llm_session_t *s, int room_num, const char *description, const char *exits);
 
 /*
  * Add an object to context
@@ -166,12 +243,12 @@ void llm_context_set_room(int room_num, const char *description, const char *exi
  * @param name: Object name
  * @param room: Room where object is (255 = inventory)
  */
-void llm_context_add_object(int obj_id, const char *name, int room);
+void llm_context_add_object(nagi_llm_session_t *s, int obj_id, const char *name, int room);
 
 /*
  * Update inventory in context
  */
-void llm_context_update_inventory(void);
+void llm_context_update_inventory(nagi_llm_session_t *s);
 
 /*
  * Track a flag for context
@@ -179,42 +256,128 @@ void llm_context_update_inventory(void);
  * @param flag_num: Flag number
  * @param description: Human-readable description of what this flag means
  */
-void llm_context_track_flag(int flag_num, const char *description);
+void llm_context_track_flag(nagi_llm_session_t *s, int flag_num, const char *description);
 
 /*
  * Build the context string for LLM input
- * Returns a pointer to the internal context buffer.
- * The buffer is only rebuilt if context_dirty is set.
+ * The session keeps the last one and only rebuilds it if context_dirty is
+ * set, and then only the sections that changed are formatted again.
+ * Sections are kept in order while they fit the token budget, then the
+ * newest history entries fill what is left.
  *
- * @return: Pointer to context string
+ * @param buffer: Receives the context, LLM_MAX_CONTEXT_SIZE holds all of it
+ * @param size: Size of buffer
+ * @return: Length of the context string
+ */
+int llm_context_build(nagi_llm_session_t *s, char *buffer, int size);
+
+/*
+ * Set the token budget of the built context
+ *
+ * @param tokens: Maximum tokens, 0 restores LLM_DEFAULT_CONTEXT_TOKENS
+ */
+void llm_context_set_token_budget(nagi_llm_session_t *s, int tokens);
+
+/*
+ * Set how context text is measured in tokens
+ * Without a counter, tokens are estimated at four bytes each.
+ *
+ * @param count: Token counter, NULL for the estimate
+ * @param userdata: Passed to count
+ */
+void llm_context_set_token_counter(nagi_llm_session_t *s, llm_context_token_count_t count, void *userdata);
+
+/*
+ * Tokens in the last built context
  */
-const char *llm_context_build(void);
+int llm_context_tokens(nagi_llm_session_t *s);
+
+/*
+ * Serialize access for an LLM worker thread reading the context
+ * The llm_context_* functions take the lock themselves; hold it around
+ * llm_context_segment and direct reads of llm_context_state(s)->history.
+ */
+void llm_context_lock(nagi_llm_session_t *s);
+void llm_context_unlock(nagi_llm_session_t *s);
+
+/*
+ * Get one formatted section, rebuilt first if it changed (lock held)
+ *
+ * @param id: Section
+ * @param len: Receives the text length, may be NULL
+ * @return: Section text, empty if the section has nothing to show
+ */
+const char *llm_context_segment(nagi_llm_session_t *s, llm_context_segment_id_t id, int *len);
+
+/*
+ * Text of a history entry (lock held)
+ * Valid until the next entry is added.
+ */
+const char *llm_context_entry_text(nagi_llm_session_t *s, const llm_context_entry_t *entry);
+
+/*
+ * Format a history entry the way the context shows it
+ *
+ * @return: Length of the line written to buf
+ */
+int llm_context_format_entry(nagi_llm_session_t *s, const llm_context_entry_t *entry, char *buf, int size);
 
 /*
  * Force rebuild of context string
  */
-void llm_context_invalidate(void);
+void llm_context_invalidate(nagi_llm_session_t *s);
+
+/*
+ * Copy of the game state and history, e.g. to rewind to
+ * It holds no pointers, so it can be saved or sent to another process.
+ *
+ * @param buf: llm_context_snapshot_size() bytes
+ */
+int llm_context_snapshot_size(nagi_llm_session_t *s);
+void llm_context_snapshot(nagi_llm_session_t *s, void *buf);
 
 /*
- * Get recent history as a string
+ * Put back a copy from llm_context_snapshot
+ * The history counts as cleared and refilled, so cached prompts that
+ * followed it aren't reused. Tracked flags keep this session's
+ * descriptions and take the copy's values.
+ */
+void llm_context_snapshot_restore(nagi_llm_session_t *s, const void *buf);
+
+/*
+ * Get the most relevant history as a string
+ * Entries are ranked like the context's: recency, the current room and
+ * objects the last input names. They come out oldest first.
  *
  * @param buffer: Output buffer
  * @param buffer_size: Size of output buffer
  * @param max_entries: Maximum number of entries to include
  */
-void llm_context_get_history(char *buffer, int buffer_size, int max_entries);
+void llm_context_get_history(nagi_llm_session_t *s, char *buffer, int buffer_size, int max_entries);
 
-void llm_context_on_print(const char *text);
-void llm_context_on_room_change(int old_room, int new_room);
-void llm_context_on_flag_change(int flag_num, int new_value);
-void llm_context_on_var_change(int var_num, int new_value);
-void llm_context_on_player_input(const char *input);
+/*
+ * Game hooks, called from the game thread only
+ * Each just queues the event; it is folded into the context the next
+ * time the context lock is taken, or by llm_context_fold_events.
+ */
+void llm_context_on_print(nagi_llm_session_t *s, const char *text);
+void llm_context_on_update(nagi_llm_session_t *s, const char *text);
+void llm_context_on_room_change(nagi_llm_session_t *s, int old_room, int new_room);
+void llm_context_on_flag_change(nagi_llm_session_t *s, int flag_num, int new_value);
+void llm_context_on_var_change(nagi_llm_session_t *s, int var_num, int new_value);
+void llm_context_on_player_input(nagi_llm_session_t *s, const char *input);
+
+/*
+ * Fold the queued game events into the context now
+ * The LLM worker calls it between requests.
+ */
+void llm_context_fold_events(nagi_llm_session_t *s);
 
-/* Get the most recent raw player input text (internal buffer pointer, do not free) */
-const char *llm_context_get_last_player_input(void);
+/* Copy the most recent raw player input text, its length (0 if there's none) */
+int llm_context_get_last_player_input(nagi_llm_session_t *s, char *buffer, int size);
 
 /* Clear the last stored player input */
-void llm_context_clear_last_player_input(void);
+void llm_context_clear_last_player_input(nagi_llm_session_t *s);
 
 /*
  * Serialize context to JSON for external LLM APIs
@@ -223,7 +386,7 @@ void llm_context_clear_last_player_input(void);
  * @param buffer_size: Size of output buffer
  * @return: Number of bytes written
  */
-int llm_context_to_json(char *buffer, int buffer_size);
+int llm_context_to_json(nagi_llm_session_t *s, char *buffer, int buffer_size);
 
 /*
  * Load room descriptions from a file
@@ -232,7 +395,7 @@ int llm_context_to_json(char *buffer, int buffer_size);
  * @param filename: Path to room descriptions file
  * @return: Number of rooms loaded
  */
-int llm_context_load_room_descs(const char *filename);
+int llm_context_load_room_descs(nagi_llm_session_t *s, const char *filename);
 
 /*
  * Load object names from a file
@@ -241,7 +404,7 @@ int llm_context_load_room_descs(const char *filename);
  * @param filename: Path to object names file
  * @return: Number of objects loaded
  */
-int llm_context_load_object_names(const char *filename);
+int llm_context_load_object_names(nagi_llm_session_t *s, const char *filename);
 
 /*
  * Load flag descriptions from a file
@@ -250,7 +413,26 @@ int llm_context_load_object_names(const char *filename);
  * @param filename: Path to flag descriptions file
  * @return: Number of flags loaded
  */
-int llm_context_load_flag_descs(const char *filename);
+int llm_context_load_flag_descs(nagi_llm_session_t *s, const char *filename);
+
+/*
+ * Map room, object and flag descriptions written by llm_context_save_descs
+ * The file is used in place, nothing is parsed or copied. It replaces the
+ * tables loaded before.
+ *
+ * @param filename: Path to the compiled tables
+ * @return: Number of entries loaded
+ */
+int llm_context_load_descs(nagi_llm_session_t *s, const char *filename);
+
+/*
+ * Write the loaded description tables in the compiled format
+ * The file is only meant for the machine that wrote it (byte order).
+ *
+ * @param filename: Path to write
+ * @return: 1 on success
+ */
+int llm_context_save_descs(nagi_llm_session_t *s, const char *filename);
 
 #ifdef __cplusplus
 }
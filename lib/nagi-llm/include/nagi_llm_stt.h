@@ -0,0 +1,66 @@
+/*
+ * nagi_llm_stt.h - Speech input for the parser
+ *
+ * The caller hands over 16-bit mono samples at nagi_stt_sample_rate as
+ * they're recorded. A worker thread finds where speech starts and ends
+ * (voice activity by energy against the room's noise) and, while it goes
+ * on, transcribes what's been said so far every [stt] chunk_ms. Each of
+ * those is a partial transcript, the one after the speech ends is final.
+ *
+ * Transcripts come from an OpenAI-compatible /v1/audio/transcriptions
+ * endpoint ([stt] url, model and api_key). whisper.cpp's whisper-server
+ * answers the same request, so a local model works the same way.
+ */
+
+#ifndef NAGI_LLM_STT_H
+#define NAGI_LLM_STT_H
+
+#include "nagi_llm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct nagi_stt nagi_stt_t;
+
+/* What nagi_stt_poll found */
+#define NAGI_STT_NONE 0
+#define NAGI_STT_PARTIAL 1              /* The words so far, speech still going on */
+#define NAGI_STT_FINAL 2                /* The whole utterance */
+
+/*
+ * Start the speech input the config asks for
+ *
+ * @return: Instance, or NULL if none is configured or it can't be used
+ */
+nagi_stt_t *nagi_stt_create(const nagi_llm_config_t *config);
+
+/*
+ * Stop the worker and free everything
+ */
+void nagi_stt_destroy(nagi_stt_t *stt);
+
+/*
+ * Samples per second nagi_stt_write expects
+ */
+int nagi_stt_sample_rate(nagi_stt_t *stt);
+
+/*
+ * Add recorded samples, without waiting on a transcription. When the
+ * worker falls behind the oldest are dropped.
+ */
+void nagi_stt_write(nagi_stt_t *stt, const short *pcm, int n);
+
+/*
+ * Take the newest transcript. A final one is never replaced by the
+ * partials of the next utterance before it has been taken.
+ *
+ * @return: NAGI_STT_NONE, NAGI_STT_PARTIAL or NAGI_STT_FINAL
+ */
+int nagi_stt_poll(nagi_stt_t *stt, char *text, int size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NAGI_LLM_STT_H */
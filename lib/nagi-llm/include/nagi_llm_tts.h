@@ -0,0 +1,74 @@
+/*
+ * nagi_llm_tts.h - Text-to-speech for generated responses
+ *
+ * Sentences are queued as soon as they're complete and synthesized on a
+ * worker thread while the rest of the response is still being generated.
+ * The samples (16-bit mono at nagi_tts_sample_rate) are taken off a ring
+ * by the caller's audio callback.
+ *
+ * Two backends:
+ *   - local: a long running command that reads one line of text at a time
+ *     on stdin and writes raw samples to stdout, e.g.
+ *     "piper --model voice.onnx --output_raw" ([tts] command, POSIX only)
+ *   - cloud: an OpenAI-compatible /v1/audio/speech endpoint asked for raw
+ *     pcm ([cloud] tts_url, tts_model, tts_voice and api_key)
+ */
+
+#ifndef NAGI_LLM_TTS_H
+#define NAGI_LLM_TTS_H
+
+#include "nagi_llm.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct nagi_tts nagi_tts_t;
+
+/*
+ * Start the speech backend the config asks for
+ *
+ * @return: Instance, or NULL if none is configured or it can't be used
+ */
+nagi_tts_t *nagi_tts_create(const nagi_llm_config_t *config);
+
+/*
+ * Stop the worker (and the local command) and free everything
+ */
+void nagi_tts_destroy(nagi_tts_t *tts);
+
+/*
+ * Samples per second of the audio nagi_tts_read hands out
+ */
+int nagi_tts_sample_rate(nagi_tts_t *tts);
+
+/*
+ * Length of the complete sentences at the start of text. With final set
+ * whatever is left counts as one.
+ */
+int nagi_tts_sentences(const char *text, int len, int final);
+
+/*
+ * Queue text to be spoken after anything already queued
+ *
+ * @return: 1 if queued, 0 if there's no room
+ */
+int nagi_tts_say(nagi_tts_t *tts, const char *text, int len);
+
+/*
+ * Drop the queued text and the audio not played yet, e.g. for a new message
+ */
+void nagi_tts_flush(nagi_tts_t *tts);
+
+/*
+ * Take up to max synthesized samples without blocking (audio thread)
+ *
+ * @return: Number of samples copied
+ */
+int nagi_tts_read(nagi_tts_t *tts, short *pcm, int max);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* NAGI_LLM_TTS_H */
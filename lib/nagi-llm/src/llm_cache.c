@@ -0,0 +1,440 @@
+/*
+ * llm_cache.c - Translation result cache for NAGI
+ *
+ * Games print the same messages over and over, so generated responses are
+ * kept in an LRU cache keyed by (game message, response language,
+ * personality). Lookups resolve the language from the player's input
+ * first, so a reply cached in the last turn's language isn't handed to a
+ * player who just switched. The cache is bounded by config.translation_cache_kb and
+ * can be saved/loaded per game. Lookups come from the game thread and
+ * stores from the async worker, so every access takes the cache lock.
+ * Misses go on to the fleet's shared cache if there is one (llm_remote.c).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "../include/nagi_llm.h"
+#include "../include/llm_log.h"
+#include "../include/llm_utils.h"
+#include "llm_thread.h"
+
+#define CACHE_BUCKETS 1024
+#define CACHE_FILE_MAGIC "NLTC"
+#define CACHE_FILE_VERSION 2
+
+typedef struct cache_entry {
+    uint64_t hash;
+    char *source;
+    char *text;
+    char *personality;
+    char language[32];
+    size_t bytes;                     /* Memory charged to the budget */
+    double used;                      /* Last stored or looked up, llm_time_ms */
+    struct cache_entry *hash_next;
+    struct cache_entry *lru_prev;     /* Towards most recently used */
+    struct cache_entry *lru_next;     /* Towards least recently used */
+} cache_entry_t;
+
+struct llm_cache {
+    llm_mutex_t lock;
+    cache_entry_t *buckets[CACHE_BUCKETS];
+    cache_entry_t *lru_head;          /* Most recently used */
+    cache_entry_t *lru_tail;          /* Least recently used */
+    size_t bytes;
+    size_t max_bytes;
+    int count;
+};
+
+/* FNV-1a over a string including its terminator */
+static uint64_t hash_string(uint64_t hash, const char *str)
+{
+    do {
+        hash ^= (unsigned char)*str;
+        hash *= 1099511628211ULL;
+    } while (*str++);
+    return hash;
+}
+
+static uint64_t cache_key(const char *source, const char *language, const char *personality)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    hash = hash_string(hash, source);
+    hash = hash_string(hash, language);
+    hash = hash_string(hash, personality);
+    return hash;
+}
+
+static const char *cache_language(nagi_llm_t *llm)
+{
+    if (llm->state && llm->state->detected_language[0]) {
+        return llm->state->detected_language;
+    }
+    return "English";
+}
+
+static void lru_unlink(struct llm_cache *cache, cache_entry_t *e)
+{
+    if (e->lru_prev) e->lru_prev->lru_next = e->lru_next;
+    else cache->lru_head = e->lru_next;
+    if (e->lru_next) e->lru_next->lru_prev = e->lru_prev;
+    else cache->lru_tail = e->lru_prev;
+    e->lru_prev = e->lru_next = NULL;
+}
+
+static void lru_push_front(struct llm_cache *cache, cache_entry_t *e)
+{
+    e->used = llm_time_ms();
+    e->lru_prev = NULL;
+    e->lru_next = cache->lru_head;
+    if (cache->lru_head) cache->lru_head->lru_prev = e;
+    cache->lru_head = e;
+    if (!cache->lru_tail) cache->lru_tail = e;
+}
+
+static void entry_remove(struct llm_cache *cache, cache_entry_t *e)
+{
+    cache_entry_t **link = &cache->buckets[e->hash % CACHE_BUCKETS];
+
+    while (*link && *link != e) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) *link = e->hash_next;
+
+    lru_unlink(cache, e);
+    cache->bytes -= e->bytes;
+    cache->count--;
+    free(e->source);
+    free(e->text);
+    free(e->personality);
+    free(e);
+}
+
+static cache_entry_t *entry_find(struct llm_cache *cache, uint64_t hash, const char *source,
+                                 const char *language, const char *personality)
+{
+    cache_entry_t *e;
+
+    for (e = cache->buckets[hash % CACHE_BUCKETS]; e; e = e->hash_next) {
+        if (e->hash == hash && strcmp(e->source, source) == 0 &&
+            strcmp(e->language, language) == 0 && strcmp(e->personality, personality) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/* Insert or replace an entry, then evict until under budget (lock held) */
+static void entry_store(struct llm_cache *cache, uint64_t hash, const char *source,
+                        const char *language, const char *personality, const char *text)
+{
+    cache_entry_t *e;
+    size_t source_len, text_len, personality_len;
+
+    e = entry_find(cache, hash, source, language, personality);
+    if (e) entry_remove(cache, e);
+
+    source_len = strlen(source);
+    text_len = strlen(text);
+    personality_len = strlen(personality);
+
+    e = (cache_entry_t *)calloc(1, sizeof(cache_entry_t));
+    if (!e) return;
+    e->source = (char *)malloc(source_len + 1);
+    e->text = (char *)malloc(text_len + 1);
+    e->personality = (char *)malloc(personality_len + 1);
+    if (!e->source || !e->text || !e->personality) {
+        free(e->source);
+        free(e->text);
+        free(e->personality);
+        free(e);
+        return;
+    }
+    memcpy(e->source, source, source_len + 1);
+    memcpy(e->text, text, text_len + 1);
+    memcpy(e->personality, personality, personality_len + 1);
+    strncpy(e->language, language, sizeof(e->language) - 1);
+    e->hash = hash;
+    e->bytes = sizeof(cache_entry_t) + source_len + text_len + personality_len + 3;
+
+    e->hash_next = cache->buckets[hash % CACHE_BUCKETS];
+    cache->buckets[hash % CACHE_BUCKETS] = e;
+    lru_push_front(cache, e);
+    cache->bytes += e->bytes;
+    cache->count++;
+
+    while (cache->bytes > cache->max_bytes && cache->lru_tail) {
+        entry_remove(cache, cache->lru_tail);
+    }
+}
+
+/*
+ * Create the cache on first use. Returns NULL if disabled.
+ */
+static struct llm_cache *cache_get(nagi_llm_t *llm)
+{
+    struct llm_cache *cache;
+
+    if (llm->translation_cache) return llm->translation_cache;
+    if (llm->config.translation_cache_kb <= 0) return NULL;
+
+    cache = (struct llm_cache *)calloc(1, sizeof(struct llm_cache));
+    if (!cache) return NULL;
+
+    llm_mutex_init(&cache->lock);
+    cache->max_bytes = (size_t)llm->config.translation_cache_kb * 1024;
+    llm->translation_cache = cache;
+    return cache;
+}
+
+/*
+ * Look up a cached response in the language user_input will get its
+ * reply in. Copies it to output and returns its length, or 0 on a miss
+ * (also while the language can't be told without the model).
+ */
+int nagi_llm_cache_lookup(nagi_llm_t *llm, const char *game_response, const char *user_input,
+                          char *output, int output_size)
+{
+    struct llm_cache *cache;
+    cache_entry_t *e;
+    const char *resolved;
+    char language[32];
+    uint64_t hash;
+    int len = 0;
+
+    if (!llm || !game_response || !output || output_size <= 0) return 0;
+    cache = cache_get(llm);
+    if (!cache) return 0;
+
+    resolved = llm_language_peek(llm, user_input);
+    if (!resolved) return 0;
+    strncpy(language, resolved, sizeof(language) - 1);
+    language[sizeof(language) - 1] = '\0';
+    hash = cache_key(game_response, language, llm->config.personality);
+
+    llm_mutex_lock(&cache->lock);
+    e = entry_find(cache, hash, game_response, language, llm->config.personality);
+    if (e) {
+        lru_unlink(cache, e);
+        lru_push_front(cache, e);
+        len = (int)strlen(e->text);
+        if (len >= output_size) len = output_size - 1;
+        memcpy(output, e->text, len);
+        output[len] = '\0';
+    }
+    llm_mutex_unlock(&cache->lock);
+
+    if (e && llm->config.verbose) {
+        llm_log(LLM_LOG_DEBUG, "LLM: Translation cache hit (%s)\n", language);
+    }
+
+    /* Another node may have generated it, keep it here from now on */
+    if (!e) {
+        len = llm_remote_get(llm, 't', game_response, language, llm->config.personality,
+                             output, output_size);
+        if (len > 0) {
+            llm_mutex_lock(&cache->lock);
+            entry_store(cache, hash, game_response, language, llm->config.personality, output);
+            llm_mutex_unlock(&cache->lock);
+        }
+    }
+
+    return len;
+}
+
+/*
+ * Remember a generated response under the current language/personality
+ */
+void nagi_llm_cache_store(nagi_llm_t *llm, const char *game_response, const char *text)
+{
+    struct llm_cache *cache;
+    const char *language;
+
+    if (!llm || !game_response || !text || text[0] == '\0') return;
+    cache = cache_get(llm);
+    if (!cache) return;
+
+    language = cache_language(llm);
+
+    llm_mutex_lock(&cache->lock);
+    entry_store(cache, cache_key(game_response, language, llm->config.personality),
+                game_response, language, llm->config.personality, text);
+    llm_mutex_unlock(&cache->lock);
+
+    llm_remote_put(llm, 't', game_response, language, llm->config.personality, text);
+}
+
+void nagi_llm_cache_clear(nagi_llm_t *llm)
+{
+    struct llm_cache *cache;
+
+    if (!llm || !llm->translation_cache) return;
+    cache = llm->translation_cache;
+
+    llm_mutex_lock(&cache->lock);
+    while (cache->lru_tail) {
+        entry_remove(cache, cache->lru_tail);
+    }
+    llm_mutex_unlock(&cache->lock);
+}
+
+size_t nagi_llm_cache_usage(nagi_llm_t *llm, size_t *oldest_bytes, double *oldest_age_ms)
+{
+    struct llm_cache *cache;
+    size_t bytes;
+
+    *oldest_bytes = 0;
+    *oldest_age_ms = 0;
+    if (!llm || !llm->translation_cache) return 0;
+    cache = llm->translation_cache;
+
+    llm_mutex_lock(&cache->lock);
+    bytes = cache->bytes;
+    if (cache->lru_tail) {
+        *oldest_bytes = cache->lru_tail->bytes;
+        *oldest_age_ms = llm_time_ms() - cache->lru_tail->used;
+    }
+    llm_mutex_unlock(&cache->lock);
+    return bytes;
+}
+
+void nagi_llm_cache_evict(nagi_llm_t *llm)
+{
+    struct llm_cache *cache;
+
+    if (!llm || !llm->translation_cache) return;
+    cache = llm->translation_cache;
+
+    llm_mutex_lock(&cache->lock);
+    if (cache->lru_tail) entry_remove(cache, cache->lru_tail);
+    llm_mutex_unlock(&cache->lock);
+}
+
+void nagi_llm_cache_free(nagi_llm_t *llm)
+{
+    if (!llm || !llm->translation_cache) return;
+
+    nagi_llm_cache_clear(llm);
+    llm_mutex_destroy(&llm->translation_cache->lock);
+    free(llm->translation_cache);
+    llm->translation_cache = NULL;
+}
+
+static int write_string(FILE *f, const char *str)
+{
+    uint16_t len = (uint16_t)strlen(str);
+    return fwrite(&len, sizeof(len), 1, f) == 1 &&
+           fwrite(str, 1, len, f) == len;
+}
+
+static char *read_string(FILE *f)
+{
+    uint16_t len;
+    char *str;
+
+    if (fread(&len, sizeof(len), 1, f) != 1) return NULL;
+    str = (char *)malloc((size_t)len + 1);
+    if (!str) return NULL;
+    if (fread(str, 1, len, f) != len) {
+        free(str);
+        return NULL;
+    }
+    str[len] = '\0';
+    return str;
+}
+
+/*
+ * Save the cache, least recently used first so loading restores the order.
+ * The file is native-endian; it's a cache, a mismatch just means a miss.
+ */
+int nagi_llm_cache_save(nagi_llm_t *llm, const char *path)
+{
+    struct llm_cache *cache;
+    cache_entry_t *e;
+    uint32_t version = CACHE_FILE_VERSION;
+    uint32_t count;
+    FILE *f;
+    int ok;
+
+    if (!llm || !path || !llm->translation_cache) return 0;
+    cache = llm->translation_cache;
+
+    f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "LLM: Could not write translation cache %s\n", path);
+        return 0;
+    }
+
+    llm_mutex_lock(&cache->lock);
+    count = (uint32_t)cache->count;
+    ok = fwrite(CACHE_FILE_MAGIC, 1, 4, f) == 4 &&
+         fwrite(&version, sizeof(version), 1, f) == 1 &&
+         fwrite(&count, sizeof(count), 1, f) == 1;
+    for (e = cache->lru_tail; ok && e; e = e->lru_prev) {
+        ok = fwrite(&e->hash, sizeof(e->hash), 1, f) == 1 &&
+             write_string(f, e->language) &&
+             write_string(f, e->personality) &&
+             write_string(f, e->source) &&
+             write_string(f, e->text);
+    }
+    llm_mutex_unlock(&cache->lock);
+
+    fclose(f);
+
+    if (llm->config.verbose) {
+        printf("LLM: Saved %u cached translations to %s\n", count, path);
+    }
+    return ok;
+}
+
+int nagi_llm_cache_load(nagi_llm_t *llm, const char *path)
+{
+    struct llm_cache *cache;
+    char magic[4];
+    uint32_t version, count, i;
+    uint64_t hash;
+    char *language, *personality, *source, *text;
+    FILE *f;
+
+    if (!llm || !path) return 0;
+    cache = cache_get(llm);
+    if (!cache) return 0;
+
+    f = fopen(path, "rb");
+    if (!f) return 0;
+
+    if (fread(magic, 1, 4, f) != 4 || memcmp(magic, CACHE_FILE_MAGIC, 4) != 0 ||
+        fread(&version, sizeof(version), 1, f) != 1 || version != CACHE_FILE_VERSION ||
+        fread(&count, sizeof(count), 1, f) != 1) {
+        fprintf(stderr, "LLM: Ignoring invalid translation cache %s\n", path);
+        fclose(f);
+        return 0;
+    }
+
+    llm_mutex_lock(&cache->lock);
+    for (i = 0; i < count; i++) {
+        if (fread(&hash, sizeof(hash), 1, f) != 1) break;
+        language = read_string(f);
+        personality = read_string(f);
+        source = read_string(f);
+        text = read_string(f);
+        if (language && personality && source && text) {
+            entry_store(cache, hash, source, language, personality, text);
+        }
+        free(language);
+        free(personality);
+        free(source);
+        free(text);
+        if (!language || !personality || !source || !text) break;
+    }
+    llm_mutex_unlock(&cache->lock);
+
+    fclose(f);
+
+    if (llm->config.verbose) {
+        printf("LLM: Loaded %u cached translations from %s\n", i, path);
+    }
+    return 1;
+}
@@ -6,8 +6,11 @@
 #include <string.h>
 #include <stdlib.h>
 #include <ctype.h>
+#include <time.h>
+#include <sys/stat.h>
 #include "../include/nagi_llm.h"
 #include "../include/llm_utils.h"
+#include "llm_thread.h"
 
 /*
  * Trim leading and trailing whitespace from a string
@@ -111,6 +114,184 @@ static int is_section_header(const char *line, char *section_name, int max_len)
     return 1;
 }
 
+/*
+ * Parse a KV cache type name (f16, q8_0, q4_0)
+ * Unknown names fall back to f16
+ */
+static nagi_llm_kv_type_t parse_kv_type(const char *key, const char *value)
+{
+    if (strcmp(value, "f16") == 0) return NAGI_LLM_KV_F16;
+    if (strcmp(value, "q8_0") == 0) return NAGI_LLM_KV_Q8_0;
+    if (strcmp(value, "q4_0") == 0) return NAGI_LLM_KV_Q4_0;
+
+    fprintf(stderr, "LLM Config: Unknown %s '%s', using f16\n", key, value);
+    return NAGI_LLM_KV_F16;
+}
+
+static nagi_llm_split_mode_t parse_split_mode(const char *value)
+{
+    if (strcmp(value, "layer") == 0) return NAGI_LLM_SPLIT_LAYER;
+    if (strcmp(value, "row") == 0) return NAGI_LLM_SPLIT_ROW;
+    if (strcmp(value, "none") == 0) return NAGI_LLM_SPLIT_NONE;
+
+    fprintf(stderr, "LLM Config: Unknown split_mode '%s', using layer\n", value);
+    return NAGI_LLM_SPLIT_LAYER;
+}
+
+static nagi_llm_numa_t parse_numa(const char *value)
+{
+    if (strcmp(value, "off") == 0) return NAGI_LLM_NUMA_OFF;
+    if (strcmp(value, "interleave") == 0) return NAGI_LLM_NUMA_INTERLEAVE;
+    if (strcmp(value, "replicas") == 0) return NAGI_LLM_NUMA_REPLICAS;
+
+    fprintf(stderr, "LLM Config: Unknown numa '%s', using off\n", value);
+    return NAGI_LLM_NUMA_OFF;
+}
+
+static nagi_llm_mode_t parse_mode(const char *value)
+{
+    if (strcmp(value, "extraction") == 0) return NAGI_LLM_MODE_EXTRACTION;
+    if (strcmp(value, "semantic") == 0) return NAGI_LLM_MODE_SEMANTIC;
+    if (strcmp(value, "hybrid") == 0) return NAGI_LLM_MODE_HYBRID;
+    if (strcmp(value, "disabled") == 0) return NAGI_LLM_MODE_DISABLED;
+
+    fprintf(stderr, "LLM Config: Unknown mode '%s', using extraction\n", value);
+    return NAGI_LLM_MODE_EXTRACTION;
+}
+
+/* Comma separated shares, one per GPU */
+static void parse_tensor_split(float *split, const char *value)
+{
+    char *end;
+    int i;
+
+    memset(split, 0, NAGI_LLM_MAX_DEVICES * sizeof(float));
+    for (i = 0; i < NAGI_LLM_MAX_DEVICES && *value; i++) {
+        split[i] = strtof(value, &end);
+        if (end == value || split[i] < 0.0f) {
+            fprintf(stderr, "LLM Config: Bad tensor_split, using the default\n");
+            memset(split, 0, NAGI_LLM_MAX_DEVICES * sizeof(float));
+            return;
+        }
+        value = end;
+        while (*value == ',' || *value == ' ' || *value == '/') value++;
+    }
+}
+
+/*
+ * The local backends' keys, under [llamacpp] or [bitnet] and in a
+ * [llamacpp.auto] profile written by nagi --tune-llm
+ */
+static void parse_local(nagi_llm_config_t *config, const char *key, const char *value)
+{
+    if (strcmp(key, "context_size") == 0) {
+        config->context_size = atoi(value);
+    } else if (strcmp(key, "batch_size") == 0) {
+        config->batch_size = atoi(value);
+    } else if (strcmp(key, "u_batch_size") == 0) {
+        config->u_batch_size = atoi(value);
+    } else if (strcmp(key, "n_threads") == 0) {
+        config->n_threads = atoi(value);
+    } else if (strcmp(key, "n_threads_batch") == 0) {
+        config->n_threads_batch = atoi(value);
+    } else if (strcmp(key, "pin_threads") == 0) {
+        config->pin_threads = atoi(value);
+    } else if (strcmp(key, "reserve_cores") == 0) {
+        config->reserve_cores = atoi(value);
+    } else if (strcmp(key, "top_p") == 0) {
+        config->top_p = atof(value);
+    } else if (strcmp(key, "top_k") == 0) {
+        config->top_k = atoi(value);
+    } else if (strcmp(key, "use_gpu") == 0) {
+        config->use_gpu = atoi(value);
+    } else if (strcmp(key, "n_gpu_layers") == 0) {
+        config->n_gpu_layers = strcmp(value, "auto") == 0 ? NAGI_LLM_GPU_LAYERS_AUTO : atoi(value);
+    } else if (strcmp(key, "main_gpu") == 0) {
+        config->main_gpu = atoi(value);
+    } else if (strcmp(key, "split_mode") == 0) {
+        config->split_mode = parse_split_mode(value);
+    } else if (strcmp(key, "tensor_split") == 0) {
+        parse_tensor_split(config->tensor_split, value);
+    } else if (strcmp(key, "gpu_reserve_mb") == 0) {
+        config->gpu_reserve_mb = atoi(value);
+    } else if (strcmp(key, "use_mmap") == 0) {
+        config->use_mmap = atoi(value);
+    } else if (strcmp(key, "use_mlock") == 0) {
+        config->use_mlock = atoi(value);
+    } else if (strcmp(key, "mmap_warmup") == 0) {
+        config->mmap_warmup = atoi(value);
+    } else if (strcmp(key, "huge_pages") == 0) {
+        config->huge_pages = atoi(value);
+    } else if (strcmp(key, "numa") == 0) {
+        config->numa = parse_numa(value);
+    } else if (strcmp(key, "flash_attn") == 0) {
+        config->flash_attn = atoi(value);
+    } else if (strcmp(key, "n_seq_max") == 0) {
+        config->n_seq_max = atoi(value);
+    } else if (strcmp(key, "draft_model_path") == 0) {
+        strncpy(config->draft_model_path, value, sizeof(config->draft_model_path) - 1);
+        config->draft_model_path[sizeof(config->draft_model_path) - 1] = '\0';
+    } else if (strcmp(key, "embedding_model_path") == 0) {
+        strncpy(config->embedding_model_path, value, sizeof(config->embedding_model_path) - 1);
+        config->embedding_model_path[sizeof(config->embedding_model_path) - 1] = '\0';
+    } else if (strcmp(key, "draft_tokens") == 0) {
+        config->draft_tokens = atoi(value);
+    } else if (strcmp(key, "extraction_model") == 0) {
+        strncpy(config->extraction_model, value, sizeof(config->extraction_model) - 1);
+        config->extraction_model[sizeof(config->extraction_model) - 1] = '\0';
+    } else if (strcmp(key, "matching_model") == 0) {
+        strncpy(config->matching_model, value, sizeof(config->matching_model) - 1);
+        config->matching_model[sizeof(config->matching_model) - 1] = '\0';
+    } else if (strcmp(key, "generation_model") == 0) {
+        strncpy(config->generation_model, value, sizeof(config->generation_model) - 1);
+        config->generation_model[sizeof(config->generation_model) - 1] = '\0';
+    } else if (strcmp(key, "lora_dir") == 0) {
+        strncpy(config->lora_dir, value, sizeof(config->lora_dir) - 1);
+        config->lora_dir[sizeof(config->lora_dir) - 1] = '\0';
+    } else if (strcmp(key, "lora_scale") == 0) {
+        config->lora_scale = atof(value);
+    } else if (strcmp(key, "prompt_cache_dir") == 0) {
+        strncpy(config->prompt_cache_dir, value, sizeof(config->prompt_cache_dir) - 1);
+        config->prompt_cache_dir[sizeof(config->prompt_cache_dir) - 1] = '\0';
+    } else if (strcmp(key, "quant_cache_dir") == 0) {
+        strncpy(config->quant_cache_dir, value, sizeof(config->quant_cache_dir) - 1);
+        config->quant_cache_dir[sizeof(config->quant_cache_dir) - 1] = '\0';
+    } else if (strcmp(key, "quant_type") == 0) {
+        strncpy(config->quant_type, value, sizeof(config->quant_type) - 1);
+        config->quant_type[sizeof(config->quant_type) - 1] = '\0';
+    } else if (strcmp(key, "kv_type_k") == 0) {
+        config->kv_type_k = parse_kv_type(key, value);
+    } else if (strcmp(key, "kv_type_v") == 0) {
+        config->kv_type_v = parse_kv_type(key, value);
+    } else if (strcmp(key, "memory_budget_mb") == 0) {
+        config->memory_budget_mb = atoi(value);
+    }
+}
+
+/*
+ * The cloud speech endpoint's keys under [cloud], read with any backend
+ * Returns 1 if the key is done with, 0 to let the cloud backend see it too
+ */
+static int parse_tts_cloud(nagi_llm_config_t *config, const char *key, const char *value,
+                           nagi_llm_backend_t backend)
+{
+    if (strcmp(key, "tts_url") == 0) {
+        strncpy(config->tts_url, value, sizeof(config->tts_url) - 1);
+        config->tts_url[sizeof(config->tts_url) - 1] = '\0';
+    } else if (strcmp(key, "tts_model") == 0) {
+        strncpy(config->tts_model, value, sizeof(config->tts_model) - 1);
+        config->tts_model[sizeof(config->tts_model) - 1] = '\0';
+    } else if (strcmp(key, "tts_voice") == 0) {
+        strncpy(config->tts_voice, value, sizeof(config->tts_voice) - 1);
+        config->tts_voice[sizeof(config->tts_voice) - 1] = '\0';
+    } else if (strcmp(key, "api_key") == 0) {
+        strncpy(config->tts_api_key, value, sizeof(config->tts_api_key) - 1);
+        config->tts_api_key[sizeof(config->tts_api_key) - 1] = '\0';
+        return backend != NAGI_LLM_BACKEND_CLOUD;
+    }
+    return 1;
+}
+
 /*
  * Load unified configuration from llm_config.ini
  */
@@ -124,6 +305,8 @@ int nagi_llm_load_config(nagi_llm_config_t *config,
     char current_section[64] = "";
     char key[128], value[512];
     const char *backend_section;
+    char machine[NAGI_LLM_FINGERPRINT_SIZE] = "";
+    int auto_match = 0;
     
     if (!config) return 0;
 
@@ -141,9 +324,38 @@ int nagi_llm_load_config(nagi_llm_config_t *config,
     config->top_p = 0.9f;
     config->top_k = 40;
     config->use_gpu = 1;
+    config->n_gpu_layers = NAGI_LLM_DEFAULT_GPU_LAYERS;
+    config->gpu_reserve_mb = NAGI_LLM_DEFAULT_GPU_RESERVE_MB;
+    config->reserve_cores = NAGI_LLM_DEFAULT_RESERVE_CORES;
+    config->use_mmap = 1;
     config->mode = NAGI_LLM_MODE_EXTRACTION;
     config->flash_attn = 0;
     config->n_seq_max = 1;
+    config->english_responses = NAGI_LLM_ENGLISH_CREATIVE;
+    config->translation_cache_kb = NAGI_LLM_DEFAULT_CACHE_KB;
+    config->extraction_memo_entries = NAGI_LLM_DEFAULT_MEMO_ENTRIES;
+    config->room_kv_cache_mb = NAGI_LLM_DEFAULT_ROOM_KV_MB;
+    config->match_threshold = NAGI_LLM_DEFAULT_MATCH_THRESHOLD;
+    config->match_cache_entries = NAGI_LLM_DEFAULT_MATCH_CACHE_ENTRIES;
+    config->embedding_match_high = NAGI_LLM_DEFAULT_EMBED_MATCH_HIGH;
+    config->embedding_match_low = NAGI_LLM_DEFAULT_EMBED_MATCH_LOW;
+    config->draft_tokens = NAGI_LLM_DEFAULT_DRAFT_TOKENS;
+    config->lora_scale = NAGI_LLM_DEFAULT_LORA_SCALE;
+    config->hedge_deadline_ms = NAGI_LLM_DEFAULT_HEDGE_DEADLINE_MS;
+    config->hedge_percentile = NAGI_LLM_DEFAULT_HEDGE_PERCENTILE;
+    strncpy(config->server_socket, NAGI_LLM_DEFAULT_SERVER_SOCKET, sizeof(config->server_socket) - 1);
+    config->server_shared_memory = NAGI_LLM_DEFAULT_SERVER_SHARED_MEMORY;
+    config->cloud_seed = NAGI_LLM_DEFAULT_CLOUD_SEED;
+    config->cloud_max_retries = NAGI_LLM_DEFAULT_CLOUD_MAX_RETRIES;
+    config->cloud_probe_interval_s = NAGI_LLM_DEFAULT_CLOUD_PROBE_INTERVAL_S;
+    config->cloud_timeout_ms = NAGI_LLM_DEFAULT_CLOUD_TIMEOUT_MS;
+    config->background_duty = NAGI_LLM_DEFAULT_BACKGROUND_DUTY;
+    config->hybrid_slo_ms = NAGI_LLM_DEFAULT_HYBRID_SLO_MS;
+    config->shared_cache_timeout_ms = NAGI_LLM_DEFAULT_SHARED_CACHE_TIMEOUT_MS;
+    config->stt_vad_threshold = NAGI_LLM_DEFAULT_STT_VAD_THRESHOLD;
+    config->stt_end_ms = NAGI_LLM_DEFAULT_STT_END_MS;
+    config->stt_chunk_ms = NAGI_LLM_DEFAULT_STT_CHUNK_MS;
+    config->shared_cache_ttl_days = NAGI_LLM_DEFAULT_SHARED_CACHE_TTL_DAYS;
     strncpy(config->personality, DEFAULT_PERSONALITY, sizeof(config->personality) - 1);
     config->personality[sizeof(config->personality) - 1] = '\0';
 
@@ -168,6 +380,12 @@ int nagi_llm_load_config(nagi_llm_config_t *config,
         case NAGI_LLM_BACKEND_CLOUD:
             backend_section = "cloud";
             break;
+        case NAGI_LLM_BACKEND_ROUTER:
+            backend_section = "router";
+            break;
+        case NAGI_LLM_BACKEND_SERVER:
+            backend_section = "server";
+            break;
         default:
             backend_section = "";
             break;
@@ -180,6 +398,7 @@ int nagi_llm_load_config(nagi_llm_config_t *config,
         if (is_section_header(line, section_name, sizeof(section_name))) {
             strncpy(current_section, section_name, sizeof(current_section) - 1);
             current_section[sizeof(current_section) - 1] = '\0';
+            auto_match = 0;
             continue;
         }
 
@@ -200,34 +419,132 @@ int nagi_llm_load_config(nagi_llm_config_t *config,
                 config->max_tokens = atoi(value);
             } else if (strcmp(key, "verbose") == 0) {
                 config->verbose = atoi(value);
+            } else if (strcmp(key, "translation_cache_kb") == 0) {
+                config->translation_cache_kb = atoi(value);
+            } else if (strcmp(key, "extraction_memo_entries") == 0) {
+                config->extraction_memo_entries = atoi(value);
+            } else if (strcmp(key, "english_responses") == 0) {
+                config->english_responses = atoi(value);
+            } else if (strcmp(key, "combined_extraction") == 0) {
+                config->combined_extraction = atoi(value);
+            } else if (strcmp(key, "match_threshold") == 0) {
+                config->match_threshold = atof(value);
+            } else if (strcmp(key, "match_cache_entries") == 0) {
+                config->match_cache_entries = atoi(value);
+            } else if (strcmp(key, "match_cache_persist") == 0) {
+                config->match_cache_persist = atoi(value);
+            } else if (strcmp(key, "save_kv") == 0) {
+                config->save_kv = atoi(value);
+            } else if (strcmp(key, "room_kv_cache_mb") == 0) {
+                config->room_kv_cache_mb = atoi(value);
+            } else if (strcmp(key, "embedding_match") == 0) {
+                config->embedding_match = atoi(value);
+            } else if (strcmp(key, "embedding_match_high") == 0) {
+                config->embedding_match_high = atof(value);
+            } else if (strcmp(key, "embedding_match_low") == 0) {
+                config->embedding_match_low = atof(value);
+            } else if (strcmp(key, "stats_file") == 0) {
+                strncpy(config->stats_file, value, sizeof(config->stats_file) - 1);
+                config->stats_file[sizeof(config->stats_file) - 1] = '\0';
+            } else if (strcmp(key, "log_file") == 0) {
+                strncpy(config->log_file, value, sizeof(config->log_file) - 1);
+                config->log_file[sizeof(config->log_file) - 1] = '\0';
+            } else if (strcmp(key, "stats_overlay") == 0) {
+                config->stats_overlay = atoi(value);
+            } else if (strcmp(key, "response_deadline_ms") == 0) {
+                config->response_deadline_ms = atoi(value);
+            } else if (strcmp(key, "background_duty") == 0) {
+                config->background_duty = atoi(value);
+            } else if (strcmp(key, "mode") == 0) {
+                config->mode = parse_mode(value);
+            } else if (strcmp(key, "hybrid_slo_ms") == 0) {
+                config->hybrid_slo_ms = atoi(value);
+            } else if (strcmp(key, "stop_strings") == 0) {
+                strncpy(config->stop_strings, value, sizeof(config->stop_strings) - 1);
+                config->stop_strings[sizeof(config->stop_strings) - 1] = '\0';
             } else if (strcmp(key, "personality") == 0) {
                 strncpy(config->personality, value, sizeof(config->personality) - 1);
                 config->personality[sizeof(config->personality) - 1] = '\0';
             }
         }
+        /* Speech, whatever the backend */
+        else if (strcmp(current_section, "tts") == 0) {
+            if (strcmp(key, "command") == 0) {
+                strncpy(config->tts_command, value, sizeof(config->tts_command) - 1);
+                config->tts_command[sizeof(config->tts_command) - 1] = '\0';
+            } else if (strcmp(key, "sample_rate") == 0) {
+                config->tts_sample_rate = atoi(value);
+            }
+        }
+        /* Speech input, whatever the backend */
+        else if (strcmp(current_section, "stt") == 0) {
+            if (strcmp(key, "url") == 0) {
+                strncpy(config->stt_url, value, sizeof(config->stt_url) - 1);
+                config->stt_url[sizeof(config->stt_url) - 1] = '\0';
+            } else if (strcmp(key, "model") == 0) {
+                strncpy(config->stt_model, value, sizeof(config->stt_model) - 1);
+                config->stt_model[sizeof(config->stt_model) - 1] = '\0';
+            } else if (strcmp(key, "api_key") == 0) {
+                strncpy(config->stt_api_key, value, sizeof(config->stt_api_key) - 1);
+                config->stt_api_key[sizeof(config->stt_api_key) - 1] = '\0';
+            } else if (strcmp(key, "language") == 0) {
+                strncpy(config->stt_language, value, sizeof(config->stt_language) - 1);
+                config->stt_language[sizeof(config->stt_language) - 1] = '\0';
+            } else if (strcmp(key, "vad_threshold") == 0) {
+                config->stt_vad_threshold = atoi(value);
+            } else if (strcmp(key, "end_ms") == 0) {
+                config->stt_end_ms = atoi(value);
+            } else if (strcmp(key, "chunk_ms") == 0) {
+                config->stt_chunk_ms = atoi(value);
+            }
+        }
+        else if (strcmp(current_section, "cloud") == 0 &&
+                 (strncmp(key, "tts_", 4) == 0 || strcmp(key, "api_key") == 0) &&
+                 parse_tts_cloud(config, key, value, backend)) {
+            continue;
+        }
+        /* Fleet-wide cache, whatever the backend */
+        else if (strcmp(current_section, "shared_cache") == 0) {
+            if (strcmp(key, "address") == 0) {
+                strncpy(config->shared_cache, value, sizeof(config->shared_cache) - 1);
+                config->shared_cache[sizeof(config->shared_cache) - 1] = '\0';
+            } else if (strcmp(key, "timeout_ms") == 0) {
+                config->shared_cache_timeout_ms = atoi(value);
+            } else if (strcmp(key, "ttl_days") == 0) {
+                config->shared_cache_ttl_days = atoi(value);
+            }
+        }
+        /* The server and its clients both read the socket path */
+        else if (strcmp(current_section, "server") == 0) {
+            if (strcmp(key, "socket") == 0) {
+                strncpy(config->server_socket, value, sizeof(config->server_socket) - 1);
+                config->server_socket[sizeof(config->server_socket) - 1] = '\0';
+            } else if (strcmp(key, "shared_memory") == 0) {
+                config->server_shared_memory = atoi(value);
+            } else if (strcmp(key, "metrics_port") == 0) {
+                config->server_metrics_port = atoi(value);
+            } else if (strcmp(key, "nodes") == 0) {
+                strncpy(config->server_nodes, value, sizeof(config->server_nodes) - 1);
+                config->server_nodes[sizeof(config->server_nodes) - 1] = '\0';
+            }
+        }
+        /* A tuned profile, used if it was measured on this machine */
+        else if (strcmp(current_section, "llamacpp.auto") == 0) {
+            if (backend != NAGI_LLM_BACKEND_LLAMACPP) continue;
+            if (strcmp(key, "fingerprint") == 0) {
+                if (!machine[0]) {
+                    nagi_llm_machine_fingerprint(machine, sizeof(machine), NULL, 0);
+                }
+                auto_match = strcmp(value, machine) == 0;
+            } else if (auto_match) {
+                parse_local(config, key, value);
+            }
+        }
         /* Parse backend-specific settings */
         else if (backend_section && strcmp(current_section, backend_section) == 0) {
             /* LlamaCPP/BitNet settings */
             if (backend == NAGI_LLM_BACKEND_LLAMACPP || backend == NAGI_LLM_BACKEND_BITNET) {
-                if (strcmp(key, "context_size") == 0) {
-                    config->context_size = atoi(value);
-                } else if (strcmp(key, "batch_size") == 0) {
-                    config->batch_size = atoi(value);
-                } else if (strcmp(key, "u_batch_size") == 0) {
-                    config->u_batch_size = atoi(value);
-                } else if (strcmp(key, "n_threads") == 0) {
-                    config->n_threads = atoi(value);
-                } else if (strcmp(key, "top_p") == 0) {
-                    config->top_p = atof(value);
-                } else if (strcmp(key, "top_k") == 0) {
-                    config->top_k = atoi(value);
-                } else if (strcmp(key, "use_gpu") == 0) {
-                    config->use_gpu = atoi(value);
-                } else if (strcmp(key, "flash_attn") == 0) {
-                    config->flash_attn = atoi(value);
-                } else if (strcmp(key, "n_seq_max") == 0) {
-                    config->n_seq_max = atoi(value);
-                }
+                parse_local(config, key, value);
             }
             /* Cloud-specific settings */
             else if (backend == NAGI_LLM_BACKEND_CLOUD) {
@@ -240,12 +557,114 @@ int nagi_llm_load_config(nagi_llm_config_t *config,
                 } else if (strcmp(key, "model") == 0) {
                     strncpy(config->model_path, value, sizeof(config->model_path) - 1);
                     config->model_path[sizeof(config->model_path) - 1] = '\0';
+                } else if (strcmp(key, "seed") == 0) {
+                    config->cloud_seed = atoi(value);
+                } else if (strcmp(key, "prompt_cache") == 0) {
+                    config->cloud_prompt_cache = atoi(value);
+                } else if (strcmp(key, "requests_per_minute") == 0) {
+                    config->cloud_requests_per_minute = atoi(value);
+                } else if (strcmp(key, "tokens_per_minute") == 0) {
+                    config->cloud_tokens_per_minute = atoi(value);
+                } else if (strcmp(key, "max_retries") == 0) {
+                    config->cloud_max_retries = atoi(value);
+                } else if (strcmp(key, "endpoint") == 0) {
+                    /* One line per endpoint, the key can be given again */
+                    size_t used = strlen(config->cloud_endpoints);
+                    snprintf(config->cloud_endpoints + used, sizeof(config->cloud_endpoints) - used,
+                             "%s\n", value);
+                } else if (strcmp(key, "probe_interval") == 0) {
+                    config->cloud_probe_interval_s = atoi(value);
+                } else if (strcmp(key, "timeout_ms") == 0) {
+                    config->cloud_timeout_ms = atoi(value);
+                } else if (strcmp(key, "batch") == 0) {
+                    config->cloud_batch = atoi(value);
+                } else if (strcmp(key, "compress") == 0) {
+                    config->cloud_compress = atoi(value);
+                } else if (strcmp(key, "compact_prompts") == 0) {
+                    config->cloud_compact_prompts = atoi(value);
                 }
                 /* For cloud backend, temperature is used from common section's temperature_creative_base */
             }
+            /* Router settings, the children read their own sections */
+            else if (backend == NAGI_LLM_BACKEND_ROUTER) {
+                if (strcmp(key, "hedge_deadline_ms") == 0) {
+                    config->hedge_deadline_ms = atoi(value);
+                } else if (strcmp(key, "hedge_percentile") == 0) {
+                    config->hedge_percentile = atof(value);
+                }
+            }
         }
     }
 
     fclose(f);
     return 1;
 }
+
+/*
+ * Configuration file watch, see nagi_llm_watch_config
+ */
+#define CONFIG_POLL_MS 1000.0
+
+struct llm_config_watch {
+    char path[NAGI_LLM_MAX_MODEL_PATH];
+    time_t mtime;                               /* Of the settings applied last */
+    double checked;                             /* llm_time_ms of the last look */
+};
+
+static time_t config_mtime(const char *path)
+{
+    struct stat st;
+
+    return stat(path, &st) == 0 ? st.st_mtime : 0;
+}
+
+int nagi_llm_watch_config(nagi_llm_t *llm, const char *config_file)
+{
+    struct llm_config_watch *watch;
+
+    if (!llm) return 0;
+    if (!llm->config_watch) {
+        llm->config_watch = (struct llm_config_watch *)calloc(1, sizeof(struct llm_config_watch));
+        if (!llm->config_watch) return 0;
+    }
+    watch = llm->config_watch;
+
+    strncpy(watch->path, config_file ? config_file : "llm_config.ini", sizeof(watch->path) - 1);
+    watch->path[sizeof(watch->path) - 1] = '\0';
+    watch->mtime = config_mtime(watch->path);
+    watch->checked = llm_time_ms();
+    return watch->mtime != 0;
+}
+
+int nagi_llm_poll_config(nagi_llm_t *llm)
+{
+    struct llm_config_watch *watch;
+    nagi_llm_config_t config;
+    double now;
+    time_t mtime;
+
+    if (!llm || !llm->config_watch) return 0;
+    watch = llm->config_watch;
+
+    now = llm_time_ms();
+    if (now - watch->checked < CONFIG_POLL_MS) return 0;
+    watch->checked = now;
+
+    mtime = config_mtime(watch->path);
+    if (mtime == 0 || mtime == watch->mtime) return 0;
+
+    /* Half written by an editor, or the model still loading: next time */
+    if (!nagi_llm_load_config(&config, llm->backend, watch->path)) return 0;
+    if (!nagi_llm_ready(llm)) return 0;
+    watch->mtime = mtime;
+
+    if (!nagi_llm_apply_config(llm, &config)) return 0;
+    fprintf(stderr, "LLM Config: Applied changes in %s\n", watch->path);
+    return 1;
+}
+
+void llm_config_watch_free(nagi_llm_t *llm)
+{
+    free(llm->config_watch);
+    llm->config_watch = NULL;
+}
@@ -0,0 +1,297 @@
+/*
+ * llm_dict.c - Decoded game dictionary for NAGI
+ *
+ * WORDS.TOK is prefix compressed, so finding a word by ID means decoding
+ * the whole stream. The dictionary is decoded once when it is set into a
+ * table of words in file order, an ID -> word table and a word -> ID hash.
+ * The tables are never modified after they are built, so lookups need no
+ * lock and the returned strings stay valid until the dictionary changes.
+ *
+ * WORDS.TOK format (Sierra AGI compression):
+ * - First 52 bytes: 26 big-endian 16-bit offsets (one per letter A-Z)
+ * - Each word starts with:
+ *   1. Prefix count byte (how many chars shared with previous word)
+ *   2. Encoded characters where:
+ *      - Bits 0-6: character XOR 0x7F
+ *      - Bit 7 (0x80): set if this is the last character
+ *   3. 16-bit big-endian word ID
+ * - Each letter section ends with a 0 byte
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <stdint.h>
+
+#include "../include/nagi_llm.h"
+#include "../include/llm_utils.h"
+
+#define DICT_MAX_WORD 64
+
+struct llm_dict {
+    char *pool;                       /* All words, nul terminated, in file order */
+    const char **words;               /* Words in file order */
+    uint16_t *ids;                    /* Word ID of each entry in words */
+    int count;
+    const char **by_id;               /* First word for each ID, NULL if unused */
+    int max_id;
+    int *hash;                        /* Open addressing, entry index or -1 */
+    unsigned int hash_mask;
+};
+
+static u16 load_be_16(const u8 *ptr) {
+    return (u16)((ptr[0] << 8) | ptr[1]);
+}
+
+/* FNV-1a over a lowercased word */
+static uint32_t hash_word(const char *word, int len)
+{
+    uint32_t hash = 2166136261u;
+    int i;
+
+    for (i = 0; i < len; i++) {
+        hash ^= (unsigned char)tolower((unsigned char)word[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * Walk WORDS.TOK, filling the word table of out. Returns the number of
+ * words, out may be NULL to just count them and size the pool.
+ */
+static int dict_decode(const u8 *data, size_t size, struct llm_dict *out, size_t *pool_size)
+{
+    const u8 *data_end = data + size;
+    char buffer[DICT_MAX_WORD];
+    size_t pool_pos = 0;
+    int count = 0;
+    int i;
+
+    if (size < 52) return 0;
+
+    /* Iterate through all 26 letter offsets (A-Z) */
+    for (i = 0; i < 26; i++) {
+        u16 offset = load_be_16(data + i * 2);
+        const u8 *ptr;
+        int words_in_section;
+        int len;
+
+        if (offset == 0 || offset >= size) continue;
+
+        ptr = data + offset;
+        words_in_section = 0;
+
+        while (ptr < data_end) {
+            u8 prefix_count = *ptr;
+
+            /* End of section */
+            if (words_in_section > 0 && prefix_count == 0) {
+                break;
+            }
+
+            ptr++;
+            words_in_section++;
+            len = prefix_count < DICT_MAX_WORD ? prefix_count : DICT_MAX_WORD - 1;
+
+            /* Decode characters */
+            while (ptr < data_end) {
+                u8 byte = *ptr++;
+
+                if (len < DICT_MAX_WORD - 1) {
+                    buffer[len++] = (byte & 0x7F) ^ 0x7F;
+                }
+                if (byte & 0x80) break;
+            }
+            buffer[len] = '\0';
+
+            if (ptr + 2 > data_end) break;
+
+            if (out) {
+                out->words[count] = out->pool + pool_pos;
+                out->ids[count] = load_be_16(ptr);
+                memcpy(out->pool + pool_pos, buffer, len + 1);
+            }
+            ptr += 2;
+            pool_pos += len + 1;
+            count++;
+        }
+    }
+
+    if (pool_size) *pool_size = pool_pos;
+    return count;
+}
+
+static void dict_free(struct llm_dict *dict)
+{
+    if (!dict) return;
+    free(dict->pool);
+    free(dict->words);
+    free(dict->ids);
+    free(dict->by_id);
+    free(dict->hash);
+    free(dict);
+}
+
+static struct llm_dict *dict_build(const u8 *data, size_t size)
+{
+    struct llm_dict *dict;
+    size_t pool_size;
+    unsigned int hash_size, slot;
+    int count, i;
+
+    count = dict_decode(data, size, NULL, &pool_size);
+    if (count == 0) return NULL;
+
+    dict = (struct llm_dict *)calloc(1, sizeof(struct llm_dict));
+    if (!dict) return NULL;
+
+    /* Keep the hash at most half full */
+    hash_size = 64;
+    while (hash_size < (unsigned int)count * 2) {
+        hash_size *= 2;
+    }
+
+    dict->pool = (char *)malloc(pool_size);
+    dict->words = (const char **)malloc(count * sizeof(const char *));
+    dict->ids = (uint16_t *)malloc(count * sizeof(uint16_t));
+    dict->hash = (int *)malloc(hash_size * sizeof(int));
+    if (!dict->pool || !dict->words || !dict->ids || !dict->hash) {
+        dict_free(dict);
+        return NULL;
+    }
+
+    dict->count = dict_decode(data, size, dict, NULL);
+    dict->hash_mask = hash_size - 1;
+
+    dict->max_id = 0;
+    for (i = 0; i < dict->count; i++) {
+        if (dict->ids[i] > dict->max_id) dict->max_id = dict->ids[i];
+    }
+    dict->by_id = (const char **)calloc(dict->max_id + 1, sizeof(const char *));
+    if (!dict->by_id) {
+        dict_free(dict);
+        return NULL;
+    }
+
+    memset(dict->hash, 0xFF, hash_size * sizeof(int));
+    for (i = 0; i < dict->count; i++) {
+        const char *word = dict->words[i];
+
+        /* Several words can share an ID (synonyms), the first one names it */
+        if (!dict->by_id[dict->ids[i]]) {
+            dict->by_id[dict->ids[i]] = word;
+        }
+
+        slot = hash_word(word, (int)strlen(word)) & dict->hash_mask;
+        while (dict->hash[slot] >= 0) {
+            slot = (slot + 1) & dict->hash_mask;
+        }
+        dict->hash[slot] = i;
+    }
+
+    return dict;
+}
+
+/* Case insensitive compare of a dictionary word against len input chars */
+static int word_equal(const char *entry, const char *word, int len)
+{
+    int i;
+
+    for (i = 0; i < len; i++) {
+        if (entry[i] == '\0' ||
+            tolower((unsigned char)entry[i]) != tolower((unsigned char)word[i])) {
+            return 0;
+        }
+    }
+    return entry[len] == '\0';
+}
+
+/*
+ * Decode the dictionary given to nagi_llm_set_dictionary
+ * Replaces any previous one. Returns 1 on success.
+ */
+int llm_dict_build(nagi_llm_t *llm, const unsigned char *data, size_t size)
+{
+    struct llm_dict *dict = NULL;
+
+    if (data && size > 0) {
+        dict = dict_build(data, size);
+        if (!dict) {
+            fprintf(stderr, "LLM: Could not decode the game dictionary\n");
+        }
+    }
+
+    dict_free(llm->dictionary);
+    llm->dictionary = dict;
+
+    if (dict && llm->config.verbose) {
+        printf("LLM: Dictionary indexed, %d words, highest word_id %d\n",
+               dict->count, dict->max_id);
+    }
+    return dict != NULL;
+}
+
+void llm_dict_free(nagi_llm_t *llm)
+{
+    if (!llm) return;
+    dict_free(llm->dictionary);
+    llm->dictionary = NULL;
+}
+
+/*
+ * Get word string from word ID
+ *
+ * Returns: pointer into the dictionary table, or NULL if not found.
+ * Valid until the dictionary is replaced.
+ */
+const char *get_word_string(nagi_llm_t *llm, int word_id)
+{
+    struct llm_dict *dict = llm->dictionary;
+
+    if (!dict || word_id < 0 || word_id > dict->max_id || !dict->by_id[word_id]) {
+        if (llm->config.verbose) {
+            fprintf(stderr, "LLM: word_id %d not found in dictionary\n", word_id);
+        }
+        return NULL;
+    }
+    return dict->by_id[word_id];
+}
+
+/*
+ * Find the word ID of a word (case insensitive)
+ * Returns: word ID, or -1 if the word isn't in the dictionary
+ */
+int llm_dict_find(nagi_llm_t *llm, const char *word, int len)
+{
+    struct llm_dict *dict = llm->dictionary;
+    unsigned int slot;
+    int i;
+
+    if (!dict || !word || len <= 0) return -1;
+
+    slot = hash_word(word, len) & dict->hash_mask;
+    while ((i = dict->hash[slot]) >= 0) {
+        const char *entry = dict->words[i];
+
+        if (word_equal(entry, word, len)) {
+            return dict->ids[i];
+        }
+        slot = (slot + 1) & dict->hash_mask;
+    }
+    return -1;
+}
+
+/*
+ * Iterate over the dictionary in file order (A-Z)
+ * Returns: word at index, or NULL past the end. *word_id receives its ID.
+ */
+const char *llm_dict_word_at(nagi_llm_t *llm, int index, int *word_id)
+{
+    struct llm_dict *dict = llm->dictionary;
+
+    if (!dict || index < 0 || index >= dict->count) return NULL;
+    if (word_id) *word_id = dict->ids[index];
+    return dict->words[index];
+}
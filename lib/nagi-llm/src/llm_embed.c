@@ -0,0 +1,352 @@
+/*
+ * llm_embed.c - Embedding matcher for said() word lists
+ *
+ * SEMANTIC mode puts one yes/no question to the chat model per said()
+ * test. With config.embedding_match the input is embedded once and scored
+ * against the embedding of every candidate phrase, kept as unit vectors in
+ * one contiguous matrix whose rows are padded to EMBED_ROW_ALIGN floats, so
+ * a match is a dot product scan the compiler can vectorize. Scores at or
+ * above embedding_match_high match, below embedding_match_low don't; only
+ * the ones in between go to the generative model.
+ *
+ * Phrases are keyed by their word IDs and dropped with the dictionary.
+ * Called from the match entry points with the worker lock held.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "../include/nagi_llm.h"
+#include "../include/llm_utils.h"
+#include "../include/llm_log.h"
+
+#define EMBED_BUCKETS 512
+#define EMBED_ROW_ALIGN 16                /* Floats, 64 bytes: one cache line, any SIMD width */
+#define EMBED_MIN_ROWS 64
+#define EMBED_MAX_KEY 128
+#define EMBED_MAX_PHRASE 256
+
+/* Worker thread hooks (nagi_llm_async.c) */
+void nagi_llm_async_lock(nagi_llm_t *llm);
+void nagi_llm_async_unlock(nagi_llm_t *llm);
+
+struct llm_embed {
+    int dim;                              /* Embedding size from the backend */
+    int stride;                           /* Row length, dim rounded up to EMBED_ROW_ALIGN */
+    int count;
+    int capacity;
+    float *matrix;                        /* count rows of stride floats, aligned */
+    void *matrix_block;                   /* What was allocated for matrix */
+    char **keys;                          /* Word IDs of each row, "12,40" */
+    uint32_t *hashes;
+    int *hash_next;                       /* Row chains, -1 terminated */
+    int buckets[EMBED_BUCKETS];
+    float *input;                         /* Last input embedded, one row */
+    void *input_block;
+    char *input_text;                     /* NULL until an input is embedded */
+};
+
+/* FNV-1a */
+static uint32_t embed_hash(const char *key)
+{
+    uint32_t hash = 2166136261u;
+
+    while (*key) {
+        hash ^= (unsigned char)*key++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+/*
+ * Allocate rows * stride floats on a 64-byte boundary
+ * *block receives the pointer to free.
+ */
+static float *embed_alloc_rows(int rows, int stride, void **block)
+{
+    size_t bytes = (size_t)rows * stride * sizeof(float) + EMBED_ROW_ALIGN * sizeof(float);
+    uintptr_t p;
+
+    *block = calloc(1, bytes);
+    if (!*block) return NULL;
+
+    p = (uintptr_t)*block;
+    p = (p + EMBED_ROW_ALIGN * sizeof(float) - 1) & ~(uintptr_t)(EMBED_ROW_ALIGN * sizeof(float) - 1);
+    return (float *)p;
+}
+
+/*
+ * Dot product of two padded rows
+ * Independent accumulators let it vectorize without -ffast-math; the
+ * padding is zero so whole blocks can be summed.
+ */
+static float embed_dot(const float *a, const float *b, int stride)
+{
+    float acc[EMBED_ROW_ALIGN] = {0};
+    float sum = 0.0f;
+    int i, k;
+
+    for (i = 0; i < stride; i += EMBED_ROW_ALIGN) {
+        for (k = 0; k < EMBED_ROW_ALIGN; k++) {
+            acc[k] += a[i + k] * b[i + k];
+        }
+    }
+    for (k = 0; k < EMBED_ROW_ALIGN; k++) {
+        sum += acc[k];
+    }
+    return sum;
+}
+
+/*
+ * Embed text into a padded row as a unit vector
+ * Returns 1 on success, 0 if the backend could not embed it
+ */
+static int embed_text_row(nagi_llm_t *llm, struct llm_embed *embed, const char *text, float *row)
+{
+    double norm = 0.0;
+    float scale;
+    int i;
+
+    if (llm->embed_text(llm, text, row, embed->dim) != embed->dim) return 0;
+
+    for (i = 0; i < embed->dim; i++) {
+        norm += (double)row[i] * row[i];
+    }
+    if (norm <= 0.0) return 0;
+
+    scale = (float)(1.0 / sqrt(norm));
+    for (i = 0; i < embed->dim; i++) {
+        row[i] *= scale;
+    }
+    return 1;
+}
+
+/*
+ * Create the table on first use
+ * Returns NULL if embedding matching is off or the backend can't embed.
+ */
+static struct llm_embed *embed_get(nagi_llm_t *llm)
+{
+    struct llm_embed *embed;
+    int dim;
+
+    if (llm->phrase_embeddings) return llm->phrase_embeddings;
+    if (!llm->config.embedding_match || !llm->embed_text || !nagi_llm_ready(llm)) return NULL;
+
+    dim = llm->embed_text(llm, NULL, NULL, 0);
+    if (dim <= 0) return NULL;
+
+    embed = (struct llm_embed *)calloc(1, sizeof(struct llm_embed));
+    if (!embed) return NULL;
+
+    embed->dim = dim;
+    embed->stride = (dim + EMBED_ROW_ALIGN - 1) / EMBED_ROW_ALIGN * EMBED_ROW_ALIGN;
+    embed->input = embed_alloc_rows(1, embed->stride, &embed->input_block);
+    if (!embed->input) {
+        free(embed);
+        return NULL;
+    }
+    memset(embed->buckets, -1, sizeof(embed->buckets));
+
+    if (llm->config.verbose) {
+        printf("LLM: Embedding matcher ready, %d dimensions\n", dim);
+    }
+
+    llm->phrase_embeddings = embed;
+    return embed;
+}
+
+/* Make room for one more row. Returns 1 on success, 0 on failure */
+static int embed_grow(struct llm_embed *embed)
+{
+    float *matrix;
+    void *block;
+    char **keys;
+    uint32_t *hashes;
+    int *hash_next;
+    int capacity;
+
+    if (embed->count < embed->capacity) return 1;
+
+    capacity = embed->capacity ? embed->capacity * 2 : EMBED_MIN_ROWS;
+    matrix = embed_alloc_rows(capacity, embed->stride, &block);
+    if (!matrix) return 0;
+
+    keys = (char **)realloc(embed->keys, capacity * sizeof(char *));
+    if (keys) embed->keys = keys;
+    hashes = (uint32_t *)realloc(embed->hashes, capacity * sizeof(uint32_t));
+    if (hashes) embed->hashes = hashes;
+    hash_next = (int *)realloc(embed->hash_next, capacity * sizeof(int));
+    if (hash_next) embed->hash_next = hash_next;
+    if (!keys || !hashes || !hash_next) {
+        free(block);
+        return 0;
+    }
+
+    if (embed->count > 0) {
+        memcpy(matrix, embed->matrix, (size_t)embed->count * embed->stride * sizeof(float));
+    }
+    free(embed->matrix_block);
+    embed->matrix = matrix;
+    embed->matrix_block = block;
+    embed->capacity = capacity;
+    return 1;
+}
+
+/*
+ * Find the row of a said() word list, embedding it on first sight
+ * Returns the row, or -1 if the words aren't in the dictionary or can't be embedded
+ */
+static int embed_phrase_row(nagi_llm_t *llm, struct llm_embed *embed, const int *ids, int count)
+{
+    char key[EMBED_MAX_KEY];
+    char phrase[EMBED_MAX_PHRASE];
+    const char *word;
+    size_t len, phrase_len;
+    uint32_t hash;
+    int i, row, n;
+
+    len = 0;
+    phrase_len = 0;
+    phrase[0] = '\0';
+    for (i = 0; i < count; i++) {
+        n = snprintf(key + len, sizeof(key) - len, "%s%d", i ? "," : "", ids[i]);
+        if (n < 0 || (size_t)n >= sizeof(key) - len) return -1;
+        len += n;
+
+        /* Same phrase the generative prompt gets, see llamacpp_expected_command */
+        word = get_word_string(llm, ids[i]);
+        if (word && phrase_len < sizeof(phrase) - 1) {
+            n = snprintf(phrase + phrase_len, sizeof(phrase) - phrase_len, "%s%s",
+                         phrase_len ? " " : "", word);
+            if (n > 0) phrase_len += n;
+            if (phrase_len >= sizeof(phrase)) phrase_len = sizeof(phrase) - 1;
+        }
+    }
+    if (len == 0 || phrase[0] == '\0') return -1;
+
+    hash = embed_hash(key);
+    for (row = embed->buckets[hash % EMBED_BUCKETS]; row >= 0; row = embed->hash_next[row]) {
+        if (embed->hashes[row] == hash && strcmp(embed->keys[row], key) == 0) {
+            return row;
+        }
+    }
+
+    if (!embed_grow(embed)) return -1;
+
+    row = embed->count;
+    embed->keys[row] = (char *)malloc(len + 1);
+    if (!embed->keys[row]) return -1;
+    if (!embed_text_row(llm, embed, phrase, embed->matrix + (size_t)row * embed->stride)) {
+        free(embed->keys[row]);
+        return -1;
+    }
+    memcpy(embed->keys[row], key, len + 1);
+    embed->hashes[row] = hash;
+    embed->hash_next[row] = embed->buckets[hash % EMBED_BUCKETS];
+    embed->buckets[hash % EMBED_BUCKETS] = row;
+    embed->count++;
+    return row;
+}
+
+/*
+ * Embed the player input, reusing the last one since logic tests the
+ * same input against every said() of the cycle
+ * Returns 1 on success, 0 on failure
+ */
+static int embed_input(nagi_llm_t *llm, struct llm_embed *embed, const char *input)
+{
+    size_t len;
+
+    if (embed->input_text && strcmp(embed->input_text, input) == 0) return 1;
+
+    free(embed->input_text);
+    embed->input_text = NULL;
+    if (!embed_text_row(llm, embed, input, embed->input)) return 0;
+
+    len = strlen(input);
+    embed->input_text = (char *)malloc(len + 1);
+    if (embed->input_text) memcpy(embed->input_text, input, len + 1);
+    return 1;
+}
+
+int llm_embed_classify(nagi_llm_t *llm, const char *input, const int *const *lists,
+                       const int *counts, int n_lists, int *results)
+{
+    struct llm_embed *embed;
+    float score;
+    int i, row;
+
+    if (!llm || !input || input[0] == '\0') return 0;
+    embed = embed_get(llm);
+    if (!embed || !embed_input(llm, embed, input)) return 0;
+
+    for (i = 0; i < n_lists; i++) {
+        row = embed_phrase_row(llm, embed, lists[i], counts[i]);
+        if (row < 0) {
+            results[i] = -1;
+            continue;
+        }
+
+        score = embed_dot(embed->input, embed->matrix + (size_t)row * embed->stride, embed->stride);
+        if (score >= llm->config.embedding_match_high) {
+            results[i] = 1;
+        } else if (score < llm->config.embedding_match_low) {
+            results[i] = 0;
+        } else {
+            results[i] = -1;
+        }
+
+        if (llm->config.verbose) {
+            llm_log(LLM_LOG_TRACE, "LLM embed match '%s' vs %s: %.3f -> %s\n", input, embed->keys[row], score,
+                                   results[i] > 0 ? "MATCH" : results[i] == 0 ? "NO MATCH" : "ASK MODEL");
+        }
+    }
+    return 1;
+}
+
+int nagi_llm_embed_phrases(nagi_llm_t *llm, const int *const *expected_lists,
+                           const int *expected_counts, int n_lists)
+{
+    struct llm_embed *embed;
+    int i, count;
+
+    if (!llm || !expected_lists || !expected_counts) return 0;
+
+    nagi_llm_async_lock(llm);
+    embed = embed_get(llm);
+    for (i = 0; embed && i < n_lists; i++) {
+        embed_phrase_row(llm, embed, expected_lists[i], expected_counts[i]);
+    }
+    count = embed ? embed->count : 0;
+    nagi_llm_async_unlock(llm);
+
+    if (embed && llm->config.verbose) {
+        printf("LLM: %d said() phrases embedded\n", count);
+    }
+    return count;
+}
+
+void llm_embed_free(nagi_llm_t *llm)
+{
+    struct llm_embed *embed;
+    int i;
+
+    if (!llm || !llm->phrase_embeddings) return;
+    embed = llm->phrase_embeddings;
+
+    for (i = 0; i < embed->count; i++) {
+        free(embed->keys[i]);
+    }
+    free(embed->keys);
+    free(embed->hashes);
+    free(embed->hash_next);
+    free(embed->matrix_block);
+    free(embed->input_block);
+    free(embed->input_text);
+    free(embed);
+    llm->phrase_embeddings = NULL;
+}
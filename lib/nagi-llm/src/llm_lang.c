@@ -0,0 +1,280 @@
+/*
+ * llm_lang.c - Cheap language guessing for player input
+ *
+ * Asking the model which language the player writes in costs a full prompt
+ * decode. Players rarely switch language mid-game, so the detected language
+ * is kept for the session with a confidence value, and a byte-level
+ * classifier (Unicode script plus common function words) decides whether
+ * the model needs to be asked again:
+ * - no language yet: a confident guess is taken as is
+ * - guess agrees, or there is no guess: keep the language, confidence rises
+ * - guess disagrees strongly: ask the model again
+ * - guess disagrees weakly: confidence drops, ask again once it is too low
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "../include/nagi_llm.h"
+#include "../include/llm_utils.h"
+#include "../include/llm_log.h"
+
+/* Guess confidence needed to skip the model on the first input */
+#define LANG_ACCEPT_CONFIDENCE 0.6f
+/* Disagreeing guess confidence that triggers a model re-check */
+#define LANG_RECHECK_CONFIDENCE 0.5f
+/* Session confidence below which the model is asked again */
+#define LANG_MIN_CONFIDENCE 0.4f
+/* Confidence given to a language reported by the model */
+#define LANG_MODEL_CONFIDENCE 0.8f
+
+/* Index of each Latin-script language in lang_words */
+enum { LANG_EN, LANG_ES, LANG_FR, LANG_DE, LANG_IT, LANG_PT };
+
+typedef struct {
+    const char *language;
+    const char *words[24];            /* Common short words, NULL terminated */
+} lang_words_t;
+
+/* Words unlikely to be game vocabulary in another language */
+static const lang_words_t lang_words[] = {
+    { "English",    { "the", "and", "is", "to", "at", "on", "with", "my", "you", "what",
+                      "look", "get", "take", "open", "go", "talk", "use", "give", NULL } },
+    { "Spanish",    { "el", "la", "los", "las", "de", "del", "que", "y", "en", "con", "al",
+                      "una", "por", "es", "mi", "mira", "coge", "abre", "habla", "usa", NULL } },
+    { "French",     { "le", "la", "les", "des", "du", "et", "est", "une", "avec", "dans",
+                      "je", "au", "aux", "regarde", "prends", "ouvre", "parle", NULL } },
+    { "German",     { "der", "die", "das", "und", "ist", "ein", "eine", "mit", "den", "dem",
+                      "ich", "nicht", "zu", "nimm", "schau", "sprich", NULL } },
+    { "Italian",    { "il", "lo", "gli", "di", "che", "con", "una", "della", "nel", "guarda",
+                      "prendi", "apri", "parla", NULL } },
+    { "Portuguese", { "o", "os", "as", "do", "da", "dos", "das", "em", "um", "uma", "com",
+                      "olha", "pega", "abre", "fala", NULL } },
+};
+
+#define LANG_LATIN_COUNT (int)(sizeof(lang_words) / sizeof(lang_words[0]))
+
+/* Decode one UTF-8 sequence, returns the code point or -1 if invalid */
+long llm_utf8_next(const unsigned char **s)
+{
+    const unsigned char *p = *s;
+    long cp;
+    int extra, i;
+
+    if (p[0] < 0x80) { cp = p[0]; extra = 0; }
+    else if ((p[0] & 0xE0) == 0xC0) { cp = p[0] & 0x1F; extra = 1; }
+    else if ((p[0] & 0xF0) == 0xE0) { cp = p[0] & 0x0F; extra = 2; }
+    else if ((p[0] & 0xF8) == 0xF0) { cp = p[0] & 0x07; extra = 3; }
+    else { *s = p + 1; return -1; }
+
+    for (i = 1; i <= extra; i++) {
+        if ((p[i] & 0xC0) != 0x80) {
+            *s = p + i;
+            return -1;
+        }
+        cp = (cp << 6) | (p[i] & 0x3F);
+    }
+    *s = p + extra + 1;
+    return cp;
+}
+
+/* Score Latin letters that only some languages use */
+static void score_latin_char(long cp, int *score)
+{
+    switch (cp) {
+    case 0xF1: case 0xBF: case 0xA1:            /* n tilde, inverted ? and ! */
+        score[LANG_ES] += 3; break;
+    case 0xE7:                                  /* c cedilla */
+        score[LANG_FR] += 1; score[LANG_PT] += 1; break;
+    case 0xE3: case 0xF5:                       /* a/o tilde */
+        score[LANG_PT] += 3; break;
+    case 0xDF:                                  /* sharp s */
+        score[LANG_DE] += 3; break;
+    case 0xE4: case 0xF6: case 0xFC:            /* umlauts */
+        score[LANG_DE] += 2; break;
+    case 0xE8: case 0xEA: case 0xE2: case 0xEE: case 0xFB: case 0xEB: case 0xEF:
+        score[LANG_FR] += 1; break;             /* grave/circumflex/diaeresis */
+    case 0xF2: case 0xEC:                       /* o/i grave */
+        score[LANG_IT] += 2; break;
+    default:
+        break;
+    }
+}
+
+static void score_latin_word(const char *word, int len, int *score)
+{
+    int l, w;
+
+    for (l = 0; l < LANG_LATIN_COUNT; l++) {
+        for (w = 0; lang_words[l].words[w]; w++) {
+            if ((int)strlen(lang_words[l].words[w]) == len &&
+                strncmp(lang_words[l].words[w], word, len) == 0) {
+                score[l]++;
+                break;
+            }
+        }
+    }
+}
+
+/*
+ * Guess the language of a piece of text
+ *
+ * @param confidence: Receives 0.0-1.0, how far the guess is ahead
+ * @return: Language name, or NULL if there's nothing to go on
+ */
+const char *llm_guess_language(const char *text, float *confidence)
+{
+    const unsigned char *s = (const unsigned char *)text;
+    int score[LANG_LATIN_COUNT] = { 0 };
+    int latin = 0, cyrillic = 0, greek = 0, kana = 0, han = 0, hangul = 0;
+    int arabic = 0, hebrew = 0, other;
+    char word[16];
+    int word_len = 0;
+    int best, second, i;
+    long cp;
+
+    *confidence = 0.0f;
+    if (!text) return NULL;
+
+    while (1) {
+        cp = *s ? llm_utf8_next(&s) : 0;
+
+        /* Lowercase ASCII words for the function word tables */
+        if (cp > 0 && cp < 0x80 && isalpha((int)cp)) {
+            if (word_len < (int)sizeof(word)) word[word_len] = (char)tolower((int)cp);
+            word_len++;
+            latin++;
+            continue;
+        }
+        if (word_len > 0 && word_len <= (int)sizeof(word)) {
+            score_latin_word(word, word_len, score);
+        }
+        word_len = 0;
+
+        if (cp == 0) break;
+        if (cp >= 0xA0 && cp < 0x250) { latin++; score_latin_char(cp, score); }
+        else if (cp >= 0x370 && cp < 0x400) greek++;
+        else if (cp >= 0x400 && cp < 0x530) cyrillic++;
+        else if (cp >= 0x590 && cp < 0x600) hebrew++;
+        else if (cp >= 0x600 && cp < 0x700) arabic++;
+        else if (cp >= 0x3040 && cp < 0x3100) kana++;
+        else if (cp >= 0x4E00 && cp < 0xA000) han++;
+        else if (cp >= 0xAC00 && cp < 0xD7B0) hangul++;
+    }
+
+    /* A non-Latin script settles it on its own */
+    other = cyrillic + greek + kana + han + hangul + arabic + hebrew;
+    if (other > latin) {
+        *confidence = 0.9f;
+        if (kana > 0) return "Japanese";
+        if (han >= cyrillic && han >= greek && han >= hangul && han >= arabic && han >= hebrew) return "Chinese";
+        if (hangul >= cyrillic && hangul >= greek && hangul >= arabic && hangul >= hebrew) return "Korean";
+        if (cyrillic >= greek && cyrillic >= arabic && cyrillic >= hebrew) return "Russian";
+        if (greek >= arabic && greek >= hebrew) return "Greek";
+        return arabic >= hebrew ? "Arabic" : "Hebrew";
+    }
+
+    best = 0;
+    for (i = 1; i < LANG_LATIN_COUNT; i++) {
+        if (score[i] > score[best]) best = i;
+    }
+    if (score[best] == 0) return NULL;
+
+    second = 0;
+    for (i = 0; i < LANG_LATIN_COUNT; i++) {
+        if (i != best && score[i] > second) second = score[i];
+    }
+    if (score[best] == second) return NULL;
+
+    *confidence = (float)(score[best] - second) / (float)(score[best] + second + 1);
+    return lang_words[best].language;
+}
+
+static void language_set(llm_state_t *state, const char *language, float confidence)
+{
+    strncpy(state->detected_language, language, sizeof(state->detected_language) - 1);
+    state->detected_language[sizeof(state->detected_language) - 1] = '\0';
+    state->language_confidence = confidence;
+}
+
+/*
+ * Answer a language detection from the session language if possible
+ *
+ * @return: Language to use, or NULL when the model should be asked
+ */
+const char *llm_language_lookup(nagi_llm_t *llm, const char *input)
+{
+    llm_state_t *state = llm->state;
+    const char *guess;
+    float confidence;
+
+    guess = llm_guess_language(input, &confidence);
+
+    if (!state->detected_language[0]) {
+        if (guess && confidence >= LANG_ACCEPT_CONFIDENCE) {
+            language_set(state, guess, confidence);
+            if (llm->config.verbose) {
+                llm_log(LLM_LOG_DEBUG, "Language guessed: '%s' (%.2f) from input: '%s'\n", guess, confidence, input);
+            }
+            return state->detected_language;
+        }
+        return NULL;
+    }
+
+    if (!guess || strcmp(guess, state->detected_language) == 0) {
+        state->language_confidence += (1.0f - state->language_confidence) * confidence * 0.5f;
+        return state->detected_language;
+    }
+
+    /* Classifier disagrees */
+    state->language_confidence -= confidence * 0.5f;
+    if (confidence >= LANG_RECHECK_CONFIDENCE || state->language_confidence < LANG_MIN_CONFIDENCE) {
+        if (llm->config.verbose) {
+            llm_log(LLM_LOG_DEBUG, "Language re-check: input looks %s (%.2f), session is %s (%.2f)\n",
+                                   guess, confidence, state->detected_language, state->language_confidence);
+        }
+        return NULL;
+    }
+    return state->detected_language;
+}
+
+/*
+ * The language a response to input will be in, as far as it can be told
+ * without the model. Unlike llm_language_lookup it leaves the session's
+ * confidence alone, so it can be asked before the backend runs.
+ *
+ * @return: Language, or NULL while detection could still change it
+ */
+const char *llm_language_peek(nagi_llm_t *llm, const char *input)
+{
+    llm_state_t *state = llm->state;
+    const char *guess;
+    float confidence;
+
+    if (!state) return "English";
+    if (!input || input[0] == '\0') {
+        return state->detected_language[0] ? state->detected_language : "English";
+    }
+
+    guess = llm_guess_language(input, &confidence);
+    if (!state->detected_language[0]) {
+        return guess && confidence >= LANG_ACCEPT_CONFIDENCE ? guess : NULL;
+    }
+    if (!guess || strcmp(guess, state->detected_language) == 0) {
+        return state->detected_language;
+    }
+    if (confidence >= LANG_RECHECK_CONFIDENCE ||
+        state->language_confidence - confidence * 0.5f < LANG_MIN_CONFIDENCE) {
+        return NULL;
+    }
+    return state->detected_language;
+}
+
+/*
+ * Record the language the model reported
+ */
+void llm_language_store(nagi_llm_t *llm, const char *language)
+{
+    language_set(llm->state, language, LANG_MODEL_CONFIDENCE);
+}
@@ -0,0 +1,195 @@
+/*
+ * llm_log.c - Non blocking sink for the library's verbose output
+ *
+ * Any thread can log: a line claims the next slot of a fixed ring with a
+ * compare and swap on the head, is formatted into it, and is published by
+ * the slot's sequence number (a bounded MPMC queue with one consumer).
+ * The writer thread wakes every LOG_FLUSH_MS, or when half the ring has
+ * filled, and writes out the published lines in order. When the ring is
+ * full lines are dropped and counted, the game never waits on the console
+ * or the disk.
+ */
+
+#include <stdio.h>
+#include <stdarg.h>
+
+#include "../include/nagi_llm.h"
+#include "../include/llm_log.h"
+#include "llm_thread.h"
+
+#define LOG_SLOTS 1024          /* Power of two */
+#define LOG_LINE 256
+#define LOG_FLUSH_MS 20
+
+typedef struct {
+    volatile unsigned int seq;  /* pos + 1 once slot pos is written, pos + LOG_SLOTS once it's free */
+    int level;
+    char text[LOG_LINE];
+} log_slot_t;
+
+static log_slot_t log_ring[LOG_SLOTS];
+static volatile unsigned int log_head = 0;
+static unsigned int log_tail = 0;           /* The writer's */
+static volatile unsigned int log_dropped = 0;
+static volatile unsigned int log_running = 0;
+static volatile unsigned int log_stopping = 0;
+
+static FILE *log_file = NULL;
+static llm_thread_t log_thread;
+static llm_mutex_t log_mutex;
+static llm_cond_t log_cond;
+
+static FILE *log_stream(int level)
+{
+    if (log_file) return log_file;
+    return level <= LLM_LOG_WARN ? stderr : stdout;
+}
+
+void llm_log_write(int level, const char *fmt, ...)
+{
+    log_slot_t *slot;
+    unsigned int pos, dropped;
+    va_list args;
+    int diff;
+
+    va_start(args, fmt);
+    if (!llm_atomic_load(&log_running)) {
+        vfprintf(log_stream(level), fmt, args);
+        va_end(args);
+        return;
+    }
+
+    pos = llm_atomic_load(&log_head);
+    for (;;) {
+        slot = &log_ring[pos & (LOG_SLOTS - 1)];
+        diff = (int)(llm_atomic_load(&slot->seq) - pos);
+        if (diff == 0) {
+            if (llm_atomic_cas(&log_head, pos, pos + 1)) break;
+        } else if (diff < 0) {
+            /* Full, the writer is a lap behind */
+            do {
+                dropped = llm_atomic_load(&log_dropped);
+            } while (!llm_atomic_cas(&log_dropped, dropped, dropped + 1));
+            va_end(args);
+            return;
+        }
+        pos = llm_atomic_load(&log_head);
+    }
+
+    slot->level = level;
+    vsnprintf(slot->text, LOG_LINE, fmt, args);
+    va_end(args);
+    llm_atomic_store(&slot->seq, pos + 1);
+
+    /* Every half lap, so a burst doesn't have to wait out the timer */
+    if ((pos & (LOG_SLOTS / 2 - 1)) == LOG_SLOTS / 2 - 1) {
+        llm_cond_signal(&log_cond);
+    }
+}
+
+/* Write out the lines published so far, in order */
+static void log_drain(void)
+{
+    log_slot_t *slot;
+    unsigned int dropped;
+    int wrote = 0;
+
+    for (;;) {
+        slot = &log_ring[log_tail & (LOG_SLOTS - 1)];
+        if (llm_atomic_load(&slot->seq) != log_tail + 1) break;
+        fputs(slot->text, log_stream(slot->level));
+        llm_atomic_store(&slot->seq, log_tail + LOG_SLOTS);
+        log_tail++;
+        wrote = 1;
+    }
+
+    dropped = llm_atomic_load(&log_dropped);
+    if (dropped) {
+        while (!llm_atomic_cas(&log_dropped, dropped, 0)) {
+            dropped = llm_atomic_load(&log_dropped);
+        }
+        fprintf(log_stream(LLM_LOG_WARN), "Log: %u lines dropped\n", dropped);
+        wrote = 1;
+    }
+
+    if (wrote) {
+        if (log_file) {
+            fflush(log_file);
+        } else {
+            fflush(stdout);
+        }
+    }
+}
+
+static void *log_main(void *arg)
+{
+    int stopping;
+
+    (void)arg;
+    for (;;) {
+        stopping = (int)llm_atomic_load(&log_stopping);
+        log_drain();
+        if (stopping) break;
+        llm_mutex_lock(&log_mutex);
+        if (!llm_atomic_load(&log_stopping)) {
+            llm_cond_timedwait(&log_cond, &log_mutex, LOG_FLUSH_MS);
+        }
+        llm_mutex_unlock(&log_mutex);
+    }
+    return NULL;
+}
+
+int nagi_llm_log_start(const char *path)
+{
+    unsigned int i;
+
+    if (llm_atomic_load(&log_running)) return 1;
+
+    if (path && path[0]) {
+        log_file = fopen(path, "a");
+        if (!log_file) {
+            fprintf(stderr, "Log: Could not open %s\n", path);
+            return 0;
+        }
+    }
+
+    for (i = 0; i < LOG_SLOTS; i++) {
+        log_ring[i].seq = i;
+    }
+    log_head = 0;
+    log_tail = 0;
+    log_dropped = 0;
+    log_stopping = 0;
+    llm_mutex_init(&log_mutex);
+    llm_cond_init(&log_cond);
+
+    if (!llm_thread_create(&log_thread, log_main, NULL)) {
+        fprintf(stderr, "Log: Could not start the writer thread\n");
+        llm_cond_destroy(&log_cond);
+        llm_mutex_destroy(&log_mutex);
+        if (log_file) fclose(log_file);
+        log_file = NULL;
+        return 0;
+    }
+    llm_atomic_store(&log_running, 1);
+    return 1;
+}
+
+void nagi_llm_log_stop(void)
+{
+    if (!llm_atomic_load(&log_running)) return;
+
+    /* New lines are printed straight away from here on */
+    llm_atomic_store(&log_running, 0);
+
+    llm_mutex_lock(&log_mutex);
+    llm_atomic_store(&log_stopping, 1);
+    llm_cond_signal(&log_cond);
+    llm_mutex_unlock(&log_mutex);
+    llm_thread_join(log_thread);
+
+    llm_cond_destroy(&log_cond);
+    llm_mutex_destroy(&log_mutex);
+    if (log_file) fclose(log_file);
+    log_file = NULL;
+}
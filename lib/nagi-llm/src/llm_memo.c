@@ -0,0 +1,445 @@
+/*
+ * llm_memo.c - Learned answers keyed by player input for NAGI
+ *
+ * Players type the same phrases over and over ("mira la puerta", "coge
+ * todo"), and logic tests the pending input against the same said() word
+ * lists every cycle. Two LRU tables keyed by the input folded for case,
+ * accents and punctuation keep what the model answered:
+ * - the extraction memo: extractions that then parsed, so the parser gets
+ *   the English words without asking the model
+ *   (config.extraction_memo_entries)
+ * - the match cache: said() verdicts per (input, expected word IDs), so
+ *   each candidate is put to the model at most once per input
+ *   (config.match_cache_entries)
+ * Both can be saved per game. Like the parser and logic they are only used
+ * from the game thread. Extractions are also shared with the fleet's cache
+ * if there is one (llm_remote.c).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "../include/nagi_llm.h"
+#include "../include/llm_utils.h"
+#include "../include/llm_log.h"
+#include "llm_thread.h"
+
+#define MEMO_BUCKETS 256
+#define MEMO_MAX_KEY 256
+#define MEMO_FILE_MAGIC "NLXM"
+#define MATCH_FILE_MAGIC "NLXV"
+#define MEMO_FILE_VERSION 1
+
+typedef struct memo_entry {
+    uint32_t hash;
+    char *key;                        /* Folded input (and word IDs for verdicts) */
+    char *words;                      /* Extracted English words, or "0"/"1" */
+    size_t bytes;
+    double used;                      /* Last stored or looked up, llm_time_ms */
+    struct memo_entry *hash_next;
+    struct memo_entry *lru_prev;      /* Towards most recently used */
+    struct memo_entry *lru_next;      /* Towards least recently used */
+} memo_entry_t;
+
+struct llm_memo {
+    memo_entry_t *buckets[MEMO_BUCKETS];
+    memo_entry_t *lru_head;           /* Most recently used */
+    memo_entry_t *lru_tail;           /* Least recently used */
+    int count;
+    int max_count;
+    size_t bytes;
+};
+
+/* FNV-1a */
+static uint32_t hash_key(const char *key)
+{
+    uint32_t hash = 2166136261u;
+
+    while (*key) {
+        hash ^= (unsigned char)*key++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void lru_unlink(struct llm_memo *memo, memo_entry_t *e)
+{
+    if (e->lru_prev) e->lru_prev->lru_next = e->lru_next;
+    else memo->lru_head = e->lru_next;
+    if (e->lru_next) e->lru_next->lru_prev = e->lru_prev;
+    else memo->lru_tail = e->lru_prev;
+    e->lru_prev = e->lru_next = NULL;
+}
+
+static void lru_push_front(struct llm_memo *memo, memo_entry_t *e)
+{
+    e->used = llm_time_ms();
+    e->lru_prev = NULL;
+    e->lru_next = memo->lru_head;
+    if (memo->lru_head) memo->lru_head->lru_prev = e;
+    memo->lru_head = e;
+    if (!memo->lru_tail) memo->lru_tail = e;
+}
+
+static void entry_remove(struct llm_memo *memo, memo_entry_t *e)
+{
+    memo_entry_t **link = &memo->buckets[e->hash % MEMO_BUCKETS];
+
+    while (*link && *link != e) {
+        link = &(*link)->hash_next;
+    }
+    if (*link) *link = e->hash_next;
+
+    lru_unlink(memo, e);
+    memo->count--;
+    memo->bytes -= e->bytes;
+    free(e->key);
+    free(e->words);
+    free(e);
+}
+
+static memo_entry_t *entry_find(struct llm_memo *memo, uint32_t hash, const char *key)
+{
+    memo_entry_t *e;
+
+    for (e = memo->buckets[hash % MEMO_BUCKETS]; e; e = e->hash_next) {
+        if (e->hash == hash && strcmp(e->key, key) == 0) {
+            return e;
+        }
+    }
+    return NULL;
+}
+
+/* Insert or replace an entry, evicting the least recently used past the limit */
+static void entry_store(struct llm_memo *memo, const char *key, const char *words)
+{
+    uint32_t hash = hash_key(key);
+    memo_entry_t *e;
+    size_t key_len, words_len;
+
+    e = entry_find(memo, hash, key);
+    if (e) entry_remove(memo, e);
+
+    key_len = strlen(key);
+    words_len = strlen(words);
+
+    e = (memo_entry_t *)calloc(1, sizeof(memo_entry_t));
+    if (!e) return;
+    e->key = (char *)malloc(key_len + 1);
+    e->words = (char *)malloc(words_len + 1);
+    if (!e->key || !e->words) {
+        free(e->key);
+        free(e->words);
+        free(e);
+        return;
+    }
+    memcpy(e->key, key, key_len + 1);
+    memcpy(e->words, words, words_len + 1);
+    e->hash = hash;
+    e->bytes = sizeof(memo_entry_t) + key_len + words_len + 2;
+
+    e->hash_next = memo->buckets[hash % MEMO_BUCKETS];
+    memo->buckets[hash % MEMO_BUCKETS] = e;
+    lru_push_front(memo, e);
+    memo->count++;
+    memo->bytes += e->bytes;
+
+    while (memo->count > memo->max_count && memo->lru_tail) {
+        entry_remove(memo, memo->lru_tail);
+    }
+}
+
+/*
+ * Create a table on first use. Returns NULL if disabled.
+ */
+static struct llm_memo *memo_get(struct llm_memo **slot, int max_count)
+{
+    struct llm_memo *memo;
+
+    if (*slot) return *slot;
+    if (max_count <= 0) return NULL;
+
+    memo = (struct llm_memo *)calloc(1, sizeof(struct llm_memo));
+    if (!memo) return NULL;
+
+    memo->max_count = max_count;
+    *slot = memo;
+    return memo;
+}
+
+static void memo_free(struct llm_memo **slot)
+{
+    struct llm_memo *memo = *slot;
+
+    if (!memo) return;
+    while (memo->lru_tail) {
+        entry_remove(memo, memo->lru_tail);
+    }
+    free(memo);
+    *slot = NULL;
+}
+
+/* Look up key, moving it to the front. Returns its value or NULL. */
+static const char *memo_find(struct llm_memo *memo, const char *key)
+{
+    memo_entry_t *e = entry_find(memo, hash_key(key), key);
+
+    if (!e) return NULL;
+    lru_unlink(memo, e);
+    lru_push_front(memo, e);
+    return e->words;
+}
+
+/*
+ * Match cache key: the folded input, then the expected word IDs
+ * Returns 0 if the input doesn't fold into a key
+ */
+static int match_key(const char *input, const int *ids, int count, char *key, int key_size)
+{
+    int len, i, n;
+
+    len = llm_normalize_key(input, key, key_size);
+    if (len <= 0) return 0;
+
+    for (i = 0; i < count; i++) {
+        n = snprintf(key + len, key_size - len, "%c%d", i == 0 ? '|' : ',', ids[i]);
+        if (n < 0 || n >= key_size - len) return 0;
+        len += n;
+    }
+    return 1;
+}
+
+int nagi_llm_memo_lookup(nagi_llm_t *llm, const char *input, char *output, int output_size)
+{
+    struct llm_memo *memo;
+    const char *words;
+    char key[MEMO_MAX_KEY];
+    double start = llm_time_ms();
+    int len;
+
+    if (!llm || !input || !output || output_size <= 0) return 0;
+    memo = memo_get(&llm->extraction_memo, llm->config.extraction_memo_entries);
+    if (!memo || llm_normalize_key(input, key, sizeof(key)) <= 0) return 0;
+
+    words = memo_find(memo, key);
+    if (words) {
+        len = (int)strlen(words);
+        if (len >= output_size) len = output_size - 1;
+        memcpy(output, words, len);
+        output[len] = '\0';
+    } else {
+        len = llm_remote_get(llm, 'x', key, NULL, NULL, output, output_size);
+        if (len <= 0) return 0;
+        entry_store(memo, key, output);
+    }
+
+    /* Counted as an extraction the model didn't have to make */
+    llm_stats_cached(llm, NAGI_LLM_OP_EXTRACT, start);
+
+    if (llm->config.verbose) {
+        llm_log(LLM_LOG_DEBUG, "LLM: Extraction memo hit '%s' -> '%s'\n", input, output);
+    }
+    return len;
+}
+
+void nagi_llm_memo_store(nagi_llm_t *llm, const char *input, const char *extracted)
+{
+    struct llm_memo *memo;
+    char key[MEMO_MAX_KEY];
+
+    if (!llm || !input || !extracted || extracted[0] == '\0') return;
+    memo = memo_get(&llm->extraction_memo, llm->config.extraction_memo_entries);
+    if (!memo || llm_normalize_key(input, key, sizeof(key)) <= 0) return;
+
+    entry_store(memo, key, extracted);
+    llm_remote_put(llm, 'x', key, NULL, NULL, extracted);
+}
+
+/*
+ * Look up a said() verdict
+ * Returns 1 or 0 for a known verdict, -1 if the model has to be asked
+ */
+int llm_match_cache_lookup(nagi_llm_t *llm, const char *input, const int *ids, int count)
+{
+    struct llm_memo *memo;
+    const char *verdict;
+    char key[MEMO_MAX_KEY];
+
+    if (!input) return -1;
+    memo = memo_get(&llm->match_cache, llm->config.match_cache_entries);
+    if (!memo || !match_key(input, ids, count, key, sizeof(key))) return -1;
+
+    verdict = memo_find(memo, key);
+    if (!verdict) return -1;
+    return verdict[0] == '1';
+}
+
+void llm_match_cache_store(nagi_llm_t *llm, const char *input, const int *ids, int count,
+                           int verdict)
+{
+    struct llm_memo *memo;
+    char key[MEMO_MAX_KEY];
+
+    if (!input || verdict == NAGI_LLM_MATCH_ERROR) return;
+    memo = memo_get(&llm->match_cache, llm->config.match_cache_entries);
+    if (!memo || !match_key(input, ids, count, key, sizeof(key))) return;
+
+    entry_store(memo, key, verdict ? "1" : "0");
+}
+
+size_t nagi_llm_memo_usage(nagi_llm_t *llm, size_t *oldest_bytes, double *oldest_age_ms)
+{
+    struct llm_memo *memo;
+
+    *oldest_bytes = 0;
+    *oldest_age_ms = 0;
+    if (!llm || !llm->extraction_memo) return 0;
+    memo = llm->extraction_memo;
+
+    if (memo->lru_tail) {
+        *oldest_bytes = memo->lru_tail->bytes;
+        *oldest_age_ms = llm_time_ms() - memo->lru_tail->used;
+    }
+    return memo->bytes;
+}
+
+void nagi_llm_memo_evict(nagi_llm_t *llm)
+{
+    if (!llm || !llm->extraction_memo || !llm->extraction_memo->lru_tail) return;
+    entry_remove(llm->extraction_memo, llm->extraction_memo->lru_tail);
+}
+
+void llm_memo_free(nagi_llm_t *llm)
+{
+    if (!llm) return;
+    memo_free(&llm->extraction_memo);
+    memo_free(&llm->match_cache);
+}
+
+static int write_string(FILE *f, const char *str)
+{
+    uint16_t len = (uint16_t)strlen(str);
+    return fwrite(&len, sizeof(len), 1, f) == 1 &&
+           fwrite(str, 1, len, f) == len;
+}
+
+static char *read_string(FILE *f)
+{
+    uint16_t len;
+    char *str;
+
+    if (fread(&len, sizeof(len), 1, f) != 1) return NULL;
+    str = (char *)malloc((size_t)len + 1);
+    if (!str) return NULL;
+    if (fread(str, 1, len, f) != len) {
+        free(str);
+        return NULL;
+    }
+    str[len] = '\0';
+    return str;
+}
+
+/*
+ * Save a table, least recently used first so loading restores the order.
+ * Native-endian like the translation cache.
+ */
+static int memo_save(nagi_llm_t *llm, struct llm_memo *memo, const char *path,
+                     const char *magic, const char *what)
+{
+    memo_entry_t *e;
+    uint32_t version = MEMO_FILE_VERSION;
+    uint32_t count;
+    FILE *f;
+    int ok;
+
+    if (!llm || !path || !memo) return 0;
+
+    f = fopen(path, "wb");
+    if (!f) {
+        fprintf(stderr, "LLM: Could not write %s %s\n", what, path);
+        return 0;
+    }
+
+    count = (uint32_t)memo->count;
+    ok = fwrite(magic, 1, 4, f) == 4 &&
+         fwrite(&version, sizeof(version), 1, f) == 1 &&
+         fwrite(&count, sizeof(count), 1, f) == 1;
+    for (e = memo->lru_tail; ok && e; e = e->lru_prev) {
+        ok = write_string(f, e->key) && write_string(f, e->words);
+    }
+
+    fclose(f);
+
+    if (llm->config.verbose) {
+        printf("LLM: Saved %u entries of the %s to %s\n", count, what, path);
+    }
+    return ok;
+}
+
+static int memo_load(nagi_llm_t *llm, struct llm_memo *memo, const char *path,
+                     const char *magic, const char *what)
+{
+    char file_magic[4];
+    uint32_t version, count, i;
+    char *key, *words;
+    FILE *f;
+
+    if (!llm || !path || !memo) return 0;
+
+    f = fopen(path, "rb");
+    if (!f) return 0;
+
+    if (fread(file_magic, 1, 4, f) != 4 || memcmp(file_magic, magic, 4) != 0 ||
+        fread(&version, sizeof(version), 1, f) != 1 || version != MEMO_FILE_VERSION ||
+        fread(&count, sizeof(count), 1, f) != 1) {
+        fprintf(stderr, "LLM: Ignoring invalid %s %s\n", what, path);
+        fclose(f);
+        return 0;
+    }
+
+    for (i = 0; i < count; i++) {
+        key = read_string(f);
+        words = read_string(f);
+        if (key && words && key[0] && words[0]) {
+            entry_store(memo, key, words);
+        }
+        free(key);
+        free(words);
+        if (!key || !words) break;
+    }
+
+    fclose(f);
+
+    if (llm->config.verbose) {
+        printf("LLM: Loaded %u entries of the %s from %s\n", i, what, path);
+    }
+    return 1;
+}
+
+int nagi_llm_memo_save(nagi_llm_t *llm, const char *path)
+{
+    if (!llm) return 0;
+    return memo_save(llm, llm->extraction_memo, path, MEMO_FILE_MAGIC, "extraction memo");
+}
+
+int nagi_llm_memo_load(nagi_llm_t *llm, const char *path)
+{
+    if (!llm) return 0;
+    return memo_load(llm, memo_get(&llm->extraction_memo, llm->config.extraction_memo_entries),
+                     path, MEMO_FILE_MAGIC, "extraction memo");
+}
+
+int nagi_llm_match_cache_save(nagi_llm_t *llm, const char *path)
+{
+    if (!llm) return 0;
+    return memo_save(llm, llm->match_cache, path, MATCH_FILE_MAGIC, "match cache");
+}
+
+int nagi_llm_match_cache_load(nagi_llm_t *llm, const char *path)
+{
+    if (!llm) return 0;
+    return memo_load(llm, memo_get(&llm->match_cache, llm->config.match_cache_entries),
+                     path, MATCH_FILE_MAGIC, "match cache");
+}
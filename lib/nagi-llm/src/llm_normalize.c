@@ -0,0 +1,448 @@
+/*
+ * llm_normalize.c - Dictionary-only fast path in front of extraction
+ *
+ * Most inputs the classic parser rejects are English with a typo, a plural
+ * or an accented letter, which the dictionary alone can fix in microseconds.
+ * Each word of the input is resolved, in order, by:
+ * - an exact (longest, up to three words) dictionary match after folding
+ *   accents and case
+ * - the synonym table learned from earlier successful extractions
+ * - stripping a plural ending
+ * - a unique dictionary word one edit away (delete, insert, replace or
+ *   swap one letter), for words of four letters or more
+ * Only when a word resolves none of these ways is the model needed.
+ *
+ * Everything here runs on the game thread, like the parser.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "../include/nagi_llm.h"
+#include "../include/llm_utils.h"
+#include "../include/llm_log.h"
+#include "llm_thread.h"
+
+#define NORM_MAX_TOKENS 16
+#define NORM_MAX_WORD 32
+/* Longest dictionary entry tried, in words ("pick up", "look at") */
+#define NORM_MAX_PHRASE 3
+/* Shorter words have too many neighbours for edit matching */
+#define NORM_MIN_EDIT_LEN 4
+#define NORM_MAX_SYNONYMS 256
+
+typedef struct {
+    char from[NORM_MAX_WORD];         /* Folded input word */
+    char to[NORM_MAX_WORD];           /* Dictionary word */
+} llm_synonym_t;
+
+struct llm_synonyms {
+    llm_synonym_t entries[NORM_MAX_SYNONYMS];
+    int count;
+    int next;                         /* Entry replaced once the table is full */
+};
+
+/* Parser separators and characters it drops (see parse.c) */
+static const char *norm_separators = " ,.?!();:[]{}";
+static const char *norm_illegal = "'`-\"";
+
+/* ASCII for U+00C0-U+00FF, NULL for the signs */
+static const char *latin1_fold[64] = {
+    "a", "a", "a", "a", "a", "a", "ae", "c", "e", "e", "e", "e", "i", "i", "i", "i",
+    "d", "n", "o", "o", "o", "o", "o", NULL, "o", "u", "u", "u", "u", "y", "th", "ss",
+    "a", "a", "a", "a", "a", "a", "ae", "c", "e", "e", "e", "e", "i", "i", "i", "i",
+    "d", "n", "o", "o", "o", "o", "o", NULL, "o", "u", "u", "u", "u", "y", "th", "y"
+};
+
+/* ASCII for U+0100-U+017F (Latin Extended-A), ligatures handled apart */
+static const char latin_ext_fold[128 + 1] =
+    "aaaaaa" "cccccccc" "dddd" "eeeeeeeeee" "gggggggg" "hhhh" "iiiiiiiiii" "ii" "jj"
+    "kkk" "llllllllll" "nnnnnnn" "nn" "oooooo" "oo" "rrrrrr" "ssssssss" "tttttt"
+    "uuuuuuuuuuuu" "ww" "yyy" "zzzzzz" "s";
+
+/*
+ * Fold input to lowercase words joined by single spaces, the way the
+ * parser splits it. Letters of other scripts are kept as they are if
+ * keep_other is set, otherwise they fail the fold.
+ * Returns the length of out, -1 on failure
+ */
+static int fold_text(const char *input, char *out, int out_size, int keep_other)
+{
+    const unsigned char *s = (const unsigned char *)input;
+    const unsigned char *seq;
+    const char *fold;
+    char ascii[2], other[2];
+    int len = 0, fold_len;
+    long cp;
+
+    ascii[1] = '\0';
+    while (*s) {
+        seq = s;
+        cp = llm_utf8_next(&s);
+        fold = NULL;
+        fold_len = 0;
+
+        if (cp < 0) {
+            return -1;
+        } else if (cp < 0x80) {
+            if (strchr(norm_illegal, (int)cp)) continue;
+            if (!strchr(norm_separators, (int)cp) && !isspace((int)cp)) {
+                ascii[0] = (char)tolower((int)cp);
+                fold = ascii;
+            }
+        } else if (cp >= 0xC0 && cp <= 0xFF) {
+            fold = latin1_fold[cp - 0xC0];
+        } else if (cp == 0x132 || cp == 0x133) {
+            fold = "ij";
+        } else if (cp == 0x152 || cp == 0x153) {
+            fold = "oe";
+        } else if (cp >= 0x100 && cp <= 0x17F) {
+            ascii[0] = latin_ext_fold[cp - 0x100];
+            fold = ascii;
+        } else if (cp == 0xA1 || cp == 0xBF) {
+            /* Inverted marks, separators like ! and ? */
+        } else if (keep_other && cp >= 0x391 && cp <= 0x42F) {
+            /* Greek and Cyrillic capitals, the memo key ignores case there too */
+            if (cp <= 0x3A9) cp += 0x20;
+            else if (cp >= 0x410) cp += 0x20;
+            else if (cp >= 0x400) cp += 0x50;
+            other[0] = (char)(0xC0 | (cp >> 6));
+            other[1] = (char)(0x80 | (cp & 0x3F));
+            fold = other;
+            fold_len = 2;
+        } else if (keep_other) {
+            fold = (const char *)seq;
+            fold_len = (int)(s - seq);
+        } else {
+            return -1;
+        }
+
+        if (!fold) {
+            /* Separator, ends the current word */
+            if (len > 0 && out[len - 1] != ' ') {
+                if (len + 1 >= out_size) return -1;
+                out[len++] = ' ';
+            }
+            continue;
+        }
+
+        if (!fold_len) fold_len = (int)strlen(fold);
+        if (len + fold_len >= out_size) return -1;
+        memcpy(out + len, fold, fold_len);
+        len += fold_len;
+    }
+    if (len > 0 && out[len - 1] == ' ') len--;
+    out[len] = '\0';
+    return len;
+}
+
+/*
+ * Split input into lowercase ASCII words
+ * Returns the number of words, -1 if a word can't be folded to ASCII
+ */
+static int fold_words(const char *input, char words[][NORM_MAX_WORD], int max_words)
+{
+    char text[NORM_MAX_TOKENS * NORM_MAX_WORD];
+    char *word, *end;
+    int count = 0;
+    size_t len;
+
+    if (fold_text(input, text, sizeof(text), 0) < 0) return -1;
+
+    for (word = text; *word; word = end) {
+        len = strcspn(word, " ");
+        end = word + len;
+        if (*end) end++;
+
+        if (count >= max_words || len >= NORM_MAX_WORD) return -1;
+        memcpy(words[count], word, len);
+        words[count++][len] = '\0';
+    }
+    return count;
+}
+
+/*
+ * Key for inputs that only differ in case, accents or punctuation
+ * Returns the key length, -1 if it doesn't fit
+ */
+int llm_normalize_key(const char *input, char *key, int key_size)
+{
+    return fold_text(input, key, key_size, 1);
+}
+
+static const char *synonym_find(nagi_llm_t *llm, const char *word)
+{
+    struct llm_synonyms *table = llm->synonyms;
+    int i;
+
+    if (!table) return NULL;
+    for (i = 0; i < table->count; i++) {
+        if (strcmp(table->entries[i].from, word) == 0) {
+            return table->entries[i].to;
+        }
+    }
+    return NULL;
+}
+
+static void synonym_store(nagi_llm_t *llm, const char *from, const char *to)
+{
+    struct llm_synonyms *table = llm->synonyms;
+    llm_synonym_t *entry = NULL;
+    int i;
+
+    if (!table) {
+        table = (struct llm_synonyms *)calloc(1, sizeof(struct llm_synonyms));
+        if (!table) return;
+        llm->synonyms = table;
+    }
+
+    for (i = 0; i < table->count; i++) {
+        if (strcmp(table->entries[i].from, from) == 0) {
+            entry = &table->entries[i];
+            break;
+        }
+    }
+    if (!entry) {
+        if (table->count < NORM_MAX_SYNONYMS) {
+            entry = &table->entries[table->count++];
+        } else {
+            entry = &table->entries[table->next];
+            table->next = (table->next + 1) % NORM_MAX_SYNONYMS;
+        }
+    }
+
+    strncpy(entry->from, from, NORM_MAX_WORD - 1);
+    entry->from[NORM_MAX_WORD - 1] = '\0';
+    strncpy(entry->to, to, NORM_MAX_WORD - 1);
+    entry->to[NORM_MAX_WORD - 1] = '\0';
+}
+
+void llm_synonyms_free(nagi_llm_t *llm)
+{
+    if (!llm) return;
+    free(llm->synonyms);
+    llm->synonyms = NULL;
+}
+
+/* Try word as a dictionary word, copy it to out on success */
+static int try_word(nagi_llm_t *llm, const char *word, int len, char *out)
+{
+    if (len <= 0 || len >= NORM_MAX_WORD || llm_dict_find(llm, word, len) < 0) return 0;
+    memcpy(out, word, len);
+    out[len] = '\0';
+    return 1;
+}
+
+/* Plural endings: keys -> key, boxes -> box, berries -> berry */
+static int strip_plural(nagi_llm_t *llm, const char *word, char *out)
+{
+    char stem[NORM_MAX_WORD];
+    int len = (int)strlen(word);
+
+    if (len < 3 || word[len - 1] != 's') return 0;
+
+    if (len > 3 && strcmp(word + len - 3, "ies") == 0) {
+        memcpy(stem, word, len - 3);
+        stem[len - 3] = 'y';
+        if (try_word(llm, stem, len - 2, out)) return 1;
+    }
+    if (len > 3 && word[len - 2] == 'e' && try_word(llm, word, len - 2, out)) return 1;
+    return try_word(llm, word, len - 1, out);
+}
+
+/*
+ * Find the one dictionary word one edit away from word
+ * Candidates with different word IDs make the match ambiguous.
+ */
+static int edit_distance_one(nagi_llm_t *llm, const char *word, char *out)
+{
+    char cand[NORM_MAX_WORD + 1];
+    int len = (int)strlen(word);
+    int found = -1;
+    int i, op, c, id, cand_len;
+
+    if (len < NORM_MIN_EDIT_LEN || len + 1 >= NORM_MAX_WORD) return 0;
+
+    /* op 0: delete, 1: swap with next, 2: replace, 3: insert before i */
+    for (op = 0; op < 4; op++) {
+        for (i = 0; i <= len; i++) {
+            if (op < 3 && i == len) break;
+            if (op == 1 && i == len - 1) break;
+
+            for (c = 'a'; c <= 'z'; c++) {
+                if (op < 2 && c > 'a') break;
+                if (op == 2 && c == word[i]) continue;
+
+                switch (op) {
+                    case 0:
+                        memcpy(cand, word, i);
+                        memcpy(cand + i, word + i + 1, len - i - 1);
+                        cand_len = len - 1;
+                        break;
+                    case 1:
+                        if (word[i] == word[i + 1]) continue;
+                        memcpy(cand, word, len);
+                        cand[i] = word[i + 1];
+                        cand[i + 1] = word[i];
+                        cand_len = len;
+                        break;
+                    case 2:
+                        memcpy(cand, word, len);
+                        cand[i] = (char)c;
+                        cand_len = len;
+                        break;
+                    default:
+                        memcpy(cand, word, i);
+                        cand[i] = (char)c;
+                        memcpy(cand + i + 1, word + i, len - i);
+                        cand_len = len + 1;
+                        break;
+                }
+
+                id = llm_dict_find(llm, cand, cand_len);
+                if (id < 0) continue;
+                if (found >= 0 && id != found) return 0;
+                if (found < 0) {
+                    found = id;
+                    memcpy(out, cand, cand_len);
+                    out[cand_len] = '\0';
+                }
+            }
+        }
+    }
+    return found >= 0;
+}
+
+/*
+ * Resolve one folded word to a dictionary word
+ * Returns 1 with the word in out (NORM_MAX_WORD bytes), 0 if unknown
+ */
+static int resolve_word(nagi_llm_t *llm, const char *word, char *out)
+{
+    const char *synonym;
+    int len = (int)strlen(word);
+
+    if (try_word(llm, word, len, out)) return 1;
+
+    /* The parser skips "a" and "i" by itself */
+    if (len == 1 && (word[0] == 'a' || word[0] == 'i')) {
+        memcpy(out, word, 2);
+        return 1;
+    }
+
+    synonym = synonym_find(llm, word);
+    if (synonym) {
+        strcpy(out, synonym);
+        return 1;
+    }
+
+    return strip_plural(llm, word, out) || edit_distance_one(llm, word, out);
+}
+
+/* Longest run of words starting at first that is one dictionary entry */
+static int match_phrase(nagi_llm_t *llm, char words[][NORM_MAX_WORD], int first, int count,
+                        char *out, int out_size)
+{
+    char phrase[NORM_MAX_PHRASE * NORM_MAX_WORD];
+    int n, i, len;
+
+    for (n = NORM_MAX_PHRASE; n >= 1; n--) {
+        if (first + n > count) continue;
+
+        len = 0;
+        for (i = 0; i < n; i++) {
+            int word_len = (int)strlen(words[first + i]);
+            if (i > 0) phrase[len++] = ' ';
+            memcpy(phrase + len, words[first + i], word_len);
+            len += word_len;
+        }
+        if (len < out_size && llm_dict_find(llm, phrase, len) >= 0) {
+            memcpy(out, phrase, len);
+            out[len] = '\0';
+            return n;
+        }
+    }
+    return 0;
+}
+
+int nagi_llm_normalize_input(nagi_llm_t *llm, const char *input, char *output, int output_size)
+{
+    char words[NORM_MAX_TOKENS][NORM_MAX_WORD];
+    char resolved[NORM_MAX_PHRASE * NORM_MAX_WORD];
+    double start = llm_time_ms();
+    int count, i, n, len, pos = 0;
+
+    if (!llm || !llm->dictionary || !input || !output || output_size <= 0) return 0;
+
+    count = fold_words(input, words, NORM_MAX_TOKENS);
+    if (count <= 0) return 0;
+
+    for (i = 0; i < count; i += n) {
+        n = match_phrase(llm, words, i, count, resolved, sizeof(resolved));
+        if (n == 0) {
+            if (!resolve_word(llm, words[i], resolved)) return 0;
+            n = 1;
+        }
+
+        len = (int)strlen(resolved);
+        if (pos + len + (pos > 0) >= output_size) return 0;
+        if (pos > 0) output[pos++] = ' ';
+        memcpy(output + pos, resolved, len);
+        pos += len;
+    }
+    output[pos] = '\0';
+
+    /* Counted as an extraction the model didn't have to make */
+    llm_stats_cached(llm, NAGI_LLM_OP_EXTRACT, start);
+
+    if (llm->config.verbose) {
+        llm_log(LLM_LOG_DEBUG, "LLM: Normalized '%s' -> '%s'\n", input, output);
+    }
+    return 1;
+}
+
+void nagi_llm_learn_extraction(nagi_llm_t *llm, const char *input, const char *extracted)
+{
+    char words[NORM_MAX_TOKENS][NORM_MAX_WORD];
+    char known[NORM_MAX_TOKENS][NORM_MAX_WORD];
+    char found[NORM_MAX_TOKENS][NORM_MAX_WORD];
+    const char *unknown = NULL, *learned = NULL;
+    int count, n_found, n_known = 0;
+    int i, j;
+
+    if (!llm || !llm->dictionary || !input || !extracted) return;
+
+    count = fold_words(input, words, NORM_MAX_TOKENS);
+    n_found = fold_words(extracted, found, NORM_MAX_TOKENS);
+    if (count <= 0 || n_found <= 0) return;
+
+    /* Exactly one input word the dictionary doesn't know... */
+    for (i = 0; i < count; i++) {
+        if (resolve_word(llm, words[i], known[n_known])) {
+            n_known++;
+        } else if (unknown) {
+            return;
+        } else {
+            unknown = words[i];
+        }
+    }
+    if (!unknown || strlen(unknown) < 2) return;
+
+    /* ...and exactly one extracted word that isn't one of the known ones */
+    for (i = 0; i < n_found; i++) {
+        for (j = 0; j < n_known; j++) {
+            if (strcmp(found[i], known[j]) == 0) break;
+        }
+        if (j < n_known || llm_dict_find(llm, found[i], (int)strlen(found[i])) < 0) continue;
+        if (learned) return;
+        learned = found[i];
+    }
+    if (!learned) return;
+
+    synonym_store(llm, unknown, learned);
+    if (llm->config.verbose) {
+        llm_log(LLM_LOG_DEBUG, "LLM: Learned '%s' -> '%s'\n", unknown, learned);
+    }
+}
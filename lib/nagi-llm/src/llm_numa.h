@@ -0,0 +1,152 @@
+/*
+ * llm_numa.h - NUMA node placement for nagi-llm
+ *
+ * Without libnuma: the nodes and their CPUs are read from sysfs and the
+ * memory policy is set with the raw syscalls. A thread bound to a node
+ * runs on its CPUs and takes its memory there first; threads it starts
+ * inherit both, so binding the thread that loads a model places the
+ * model's compute threads and buffers with it. Linux only, elsewhere
+ * there is one node and nothing is bound.
+ */
+
+#ifndef LLM_NUMA_H
+#define LLM_NUMA_H
+
+#define LLM_NUMA_MAX_NODES 8
+
+#if defined(__linux__)
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#define LLM_NUMA_MPOL_DEFAULT 0
+#define LLM_NUMA_MPOL_PREFERRED 1
+#define LLM_NUMA_MPOL_INTERLEAVE 3
+#define LLM_NUMA_MAX_CPUS 1024
+#define LLM_NUMA_WORD (8 * (int)sizeof(unsigned long))
+
+/*
+ * Call fn for every number of a sysfs list ("0-15,32-47")
+ * Returns how many there were.
+ */
+static inline int llm_numa_list(const char *path, void (*fn)(int n, void *arg), void *arg)
+{
+    char list[512];
+    const char *p;
+    FILE *f;
+    int lo, hi, n, count = 0;
+
+    f = fopen(path, "r");
+    if (!f) return 0;
+    p = fgets(list, sizeof(list), f);
+    fclose(f);
+    if (!p) return 0;
+
+    while (*p && sscanf(p, "%d", &lo) == 1) {
+        hi = lo;
+        while (isdigit((unsigned char)*p)) p++;
+        if (*p == '-') {
+            p++;
+            if (sscanf(p, "%d", &hi) != 1) break;
+            while (isdigit((unsigned char)*p)) p++;
+        }
+        for (n = lo; n <= hi; n++) {
+            if (fn) fn(n, arg);
+            count++;
+        }
+        if (*p != ',') break;
+        p++;
+    }
+    return count;
+}
+
+static inline void llm_numa_set_bit(int n, void *arg)
+{
+    unsigned long *bits = (unsigned long *)arg;
+
+    if (n >= 0 && n < LLM_NUMA_MAX_CPUS) bits[n / LLM_NUMA_WORD] |= 1UL << (n % LLM_NUMA_WORD);
+}
+
+/*
+ * Nodes online, their numbers in ids (LLM_NUMA_MAX_NODES of them) if it
+ * isn't NULL. 1 (node 0) on a single-socket machine or when they can't be read.
+ */
+static inline int llm_numa_nodes(int *ids)
+{
+    unsigned long online[LLM_NUMA_MAX_CPUS / (8 * sizeof(unsigned long))];
+    int node, n = 0;
+
+    memset(online, 0, sizeof(online));
+    llm_numa_list("/sys/devices/system/node/online", llm_numa_set_bit, online);
+    for (node = 0; node < LLM_NUMA_WORD && n < LLM_NUMA_MAX_NODES; node++) {
+        if (!((online[0] >> node) & 1)) continue;
+        if (ids) ids[n] = node;
+        n++;
+    }
+    if (n == 0) {
+        if (ids) ids[0] = 0;
+        n = 1;
+    }
+    return n;
+}
+
+/*
+ * Keep the calling thread, and the threads it starts, on node's CPUs and
+ * their memory on node while it has room
+ * Returns 1 if both could be set.
+ */
+static inline int llm_numa_bind(int node)
+{
+    unsigned long cpus[LLM_NUMA_MAX_CPUS / (8 * sizeof(unsigned long))];
+    unsigned long nodes;
+    char path[96];
+    int ok;
+
+    if (node < 0 || node >= LLM_NUMA_WORD) return 0;
+    nodes = 1UL << node;
+    memset(cpus, 0, sizeof(cpus));
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    if (llm_numa_list(path, llm_numa_set_bit, cpus) <= 0) return 0;
+
+    ok = syscall(SYS_sched_setaffinity, 0, sizeof(cpus), cpus) == 0;
+    ok &= syscall(SYS_set_mempolicy, LLM_NUMA_MPOL_PREFERRED, &nodes, LLM_NUMA_WORD + 1) == 0;
+    return ok;
+}
+
+/* The calling thread's memory, and that of the threads it starts, a page per node in turn */
+static inline int llm_numa_interleave(void)
+{
+    unsigned long nodes = 0;
+    int ids[LLM_NUMA_MAX_NODES];
+    int i, n;
+
+    n = llm_numa_nodes(ids);
+    for (i = 0; i < n; i++) {
+        nodes |= 1UL << ids[i];
+    }
+    return syscall(SYS_set_mempolicy, LLM_NUMA_MPOL_INTERLEAVE, &nodes, LLM_NUMA_WORD + 1) == 0;
+}
+
+/* Back to the kernel's placement for the calling thread's memory */
+static inline void llm_numa_reset(void)
+{
+    syscall(SYS_set_mempolicy, LLM_NUMA_MPOL_DEFAULT, NULL, 0);
+}
+
+#else
+
+static inline int llm_numa_nodes(int *ids)
+{
+    if (ids) ids[0] = 0;
+    return 1;
+}
+static inline int llm_numa_bind(int node) { (void)node; return 0; }
+static inline int llm_numa_interleave(void) { return 0; }
+static inline void llm_numa_reset(void) {}
+
+#endif
+
+#endif /* LLM_NUMA_H */
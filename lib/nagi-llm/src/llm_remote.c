@@ -0,0 +1,476 @@
+/*
+ * llm_remote.c - Shared cache tier for NAGI
+ *
+ * Nodes playing the same games in the same languages ask the model for the
+ * same translations and extractions. With config.shared_cache set to the
+ * host:port of a Redis server (or anything speaking its protocol), a miss
+ * in the local translation cache or extraction memo is looked up there,
+ * and what the model answers is published, so one node's work serves the
+ * whole fleet. The local LRUs stay in front and keep what came back.
+ *
+ * Keys are nagi:<kind>:<game>:<hash of text, language, personality and
+ * model>. The value repeats the text ahead of the answer, so a hash
+ * collision reads as a miss. Stores are pipelined: their replies are read
+ * before the next command instead of waited for. Every wait is bounded by
+ * config.shared_cache_timeout_ms; after a failure the server is left alone
+ * for a while and everything stays local.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "../include/nagi_llm.h"
+#include "../include/llm_utils.h"
+#include "../include/llm_log.h"
+#include "llm_thread.h"
+
+#ifndef _WIN32
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#endif
+
+#define REMOTE_RETRY_MS 30000.0       /* Wait after a failure before reconnecting */
+#define REMOTE_MAX_VALUE (64 * 1024)  /* Longer replies are dropped, not stored */
+#define REMOTE_KEY_SIZE 128
+
+struct llm_remote {
+    llm_mutex_t lock;
+    int fd;                           /* -1 while disconnected */
+    int pending;                      /* Store replies not read yet */
+    double retry_at;                  /* No connection attempt before this */
+    char game[64];
+    char buf[4096];                   /* Reply bytes read ahead */
+    int buf_len;
+    int buf_pos;
+};
+
+#ifndef _WIN32
+
+static void remote_disconnect(struct llm_remote *remote)
+{
+    if (remote->fd >= 0) {
+        close(remote->fd);
+    }
+    remote->fd = -1;
+    remote->pending = 0;
+    remote->buf_len = remote->buf_pos = 0;
+    remote->retry_at = llm_time_ms() + REMOTE_RETRY_MS;
+}
+
+/*
+ * Connect with the timeout, then leave the socket blocking with it as the
+ * I/O limit. A failure puts off the next attempt.
+ */
+static int remote_connect(struct llm_remote *remote, const nagi_llm_config_t *config)
+{
+    char host[256];
+    const char *port;
+    struct addrinfo hints, *res, *ai;
+    struct timeval tv;
+    struct pollfd pfd;
+    int timeout_ms = config->shared_cache_timeout_ms > 0 ? config->shared_cache_timeout_ms : 1;
+    int fd = -1, err, one = 1;
+    socklen_t len;
+    char *colon;
+
+    strncpy(host, config->shared_cache, sizeof(host) - 1);
+    host[sizeof(host) - 1] = '\0';
+    colon = strrchr(host, ':');
+    if (colon) {
+        *colon = '\0';
+        port = colon + 1;
+    } else {
+        port = "6379";
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &res) != 0) {
+        llm_log(LLM_LOG_WARN, "LLM: Shared cache %s not found\n", config->shared_cache);
+        remote->retry_at = llm_time_ms() + REMOTE_RETRY_MS;
+        return 0;
+    }
+
+    for (ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd < 0) continue;
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) break;
+        if (errno == EINPROGRESS) {
+            pfd.fd = fd;
+            pfd.events = POLLOUT;
+            len = sizeof(err);
+            if (poll(&pfd, 1, timeout_ms) == 1 &&
+                getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && err == 0) {
+                break;
+            }
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+
+    if (fd < 0) {
+        llm_log(LLM_LOG_WARN, "LLM: Shared cache %s not reachable, staying local for now\n",
+                config->shared_cache);
+        remote->retry_at = llm_time_ms() + REMOTE_RETRY_MS;
+        return 0;
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+    tv.tv_sec = timeout_ms / 1000;
+    tv.tv_usec = (timeout_ms % 1000) * 1000;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+#ifdef SO_NOSIGPIPE
+    setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &one, sizeof(one));
+#endif
+
+    remote->fd = fd;
+    remote->pending = 0;
+    remote->buf_len = remote->buf_pos = 0;
+    return 1;
+}
+
+static int remote_send(struct llm_remote *remote, const char *data, size_t len)
+{
+    ssize_t n;
+    int flags = 0;
+
+#ifdef MSG_NOSIGNAL
+    flags = MSG_NOSIGNAL;
+#endif
+    while (len > 0) {
+        n = send(remote->fd, data, len, flags);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return 0;
+        data += n;
+        len -= (size_t)n;
+    }
+    return 1;
+}
+
+static int remote_read_byte(struct llm_remote *remote, char *c)
+{
+    ssize_t n;
+
+    if (remote->buf_pos >= remote->buf_len) {
+        do {
+            n = recv(remote->fd, remote->buf, sizeof(remote->buf), 0);
+        } while (n < 0 && errno == EINTR);
+        if (n <= 0) return 0;
+        remote->buf_len = (int)n;
+        remote->buf_pos = 0;
+    }
+    *c = remote->buf[remote->buf_pos++];
+    return 1;
+}
+
+/* One reply line without its CRLF. Returns 0 on failure or if it doesn't fit */
+static int remote_read_line(struct llm_remote *remote, char *line, int size)
+{
+    int len = 0;
+    char c;
+
+    for (;;) {
+        if (!remote_read_byte(remote, &c)) return 0;
+        if (c == '\n') break;
+        if (len >= size - 1) return 0;
+        line[len++] = c;
+    }
+    if (len > 0 && line[len - 1] == '\r') len--;
+    line[len] = '\0';
+    return 1;
+}
+
+/*
+ * Read one reply. A bulk string goes to *value (malloc'd, NULL for a nil
+ * or any other reply). Returns 0 if the connection is no longer usable.
+ */
+static int remote_read_reply(struct llm_remote *remote, char **value, int *value_len)
+{
+    char line[256];
+    long len, i;
+    char *data;
+
+    if (value) *value = NULL;
+    if (!remote_read_line(remote, line, sizeof(line))) return 0;
+
+    switch (line[0]) {
+    case '+':
+    case ':':
+        return 1;
+    case '-':
+        llm_log(LLM_LOG_WARN, "LLM: Shared cache error: %s\n", line + 1);
+        return 1;
+    case '$':
+        len = strtol(line + 1, NULL, 10);
+        if (len < 0) return 1;
+        if (len > REMOTE_MAX_VALUE) return 0;
+        data = (char *)malloc((size_t)len + 1);
+        if (!data) return 0;
+        for (i = 0; i < len + 2; i++) {
+            char c;
+            if (!remote_read_byte(remote, &c)) {
+                free(data);
+                return 0;
+            }
+            if (i < len) data[i] = c;
+        }
+        data[len] = '\0';
+        if (value) {
+            *value = data;
+            *value_len = (int)len;
+        } else {
+            free(data);
+        }
+        return 1;
+    default:
+        /* Nothing sent here answers with anything else */
+        return 0;
+    }
+}
+
+/* Read the replies to earlier stores so the next reply is ours */
+static int remote_drain(struct llm_remote *remote)
+{
+    while (remote->pending > 0) {
+        if (!remote_read_reply(remote, NULL, NULL)) return 0;
+        remote->pending--;
+    }
+    return 1;
+}
+
+/* Send a command as an array of bulk strings */
+static int remote_command(struct llm_remote *remote, int argc, const char **argv, const size_t *argl)
+{
+    char head[32];
+    int i, ok;
+
+    snprintf(head, sizeof(head), "*%d\r\n", argc);
+    ok = remote_send(remote, head, strlen(head));
+    for (i = 0; ok && i < argc; i++) {
+        snprintf(head, sizeof(head), "$%zu\r\n", argl[i]);
+        ok = remote_send(remote, head, strlen(head)) &&
+             remote_send(remote, argv[i], argl[i]) &&
+             remote_send(remote, "\r\n", 2);
+    }
+    return ok;
+}
+
+/* Lock the connection, connecting if it's time. Returns 0 (unlocked) if there is none */
+static int remote_begin(nagi_llm_t *llm)
+{
+    struct llm_remote *remote = llm->remote;
+
+    if (!remote || !llm->config.shared_cache[0]) return 0;
+
+    llm_mutex_lock(&remote->lock);
+    if (remote->fd < 0 &&
+        (llm_time_ms() < remote->retry_at || !remote_connect(remote, &llm->config))) {
+        llm_mutex_unlock(&remote->lock);
+        return 0;
+    }
+    if (!remote_drain(remote)) {
+        remote_disconnect(remote);
+        llm_mutex_unlock(&remote->lock);
+        return 0;
+    }
+    return 1;
+}
+
+#endif /* !_WIN32 */
+
+/* FNV-1a over a string including its terminator */
+static uint64_t hash_string(uint64_t hash, const char *str)
+{
+    do {
+        hash ^= (unsigned char)*str;
+        hash *= 1099511628211ULL;
+    } while (*str++);
+    return hash;
+}
+
+/* The model file's name, or the cloud model's */
+static const char *remote_model(nagi_llm_t *llm)
+{
+    const char *path = llm->config.model_path;
+    const char *slash = strrchr(path, '/');
+    const char *backslash = strrchr(path, '\\');
+
+    if (backslash && (!slash || backslash > slash)) slash = backslash;
+    return slash ? slash + 1 : path;
+}
+
+static void remote_key(nagi_llm_t *llm, char kind, const char *source, const char *language,
+                       const char *personality, char *key, int size)
+{
+    uint64_t hash = 14695981039346656037ULL;
+
+    hash = hash_string(hash, source);
+    hash = hash_string(hash, language ? language : "");
+    hash = hash_string(hash, personality ? personality : "");
+    hash = hash_string(hash, remote_model(llm));
+    snprintf(key, size, "nagi:%c:%s:%016llx", kind, llm->remote->game, (unsigned long long)hash);
+}
+
+void nagi_llm_set_game_key(nagi_llm_t *llm, const char *game_key)
+{
+#ifndef _WIN32
+    struct llm_remote *remote;
+#endif
+
+    if (!llm || !game_key || !game_key[0]) return;
+#ifdef _WIN32
+    if (llm->config.shared_cache[0]) {
+        llm_log(LLM_LOG_WARN, "LLM: The shared cache is not supported on Windows\n");
+    }
+    return;
+#else
+    if (!llm->config.shared_cache[0]) return;
+
+    remote = llm->remote;
+    if (!remote) {
+        remote = (struct llm_remote *)calloc(1, sizeof(struct llm_remote));
+        if (!remote) return;
+        llm_mutex_init(&remote->lock);
+        remote->fd = -1;
+        llm->remote = remote;
+    }
+
+    llm_mutex_lock(&remote->lock);
+    strncpy(remote->game, game_key, sizeof(remote->game) - 1);
+    remote->game[sizeof(remote->game) - 1] = '\0';
+    llm_mutex_unlock(&remote->lock);
+#endif
+}
+
+int llm_remote_get(nagi_llm_t *llm, char kind, const char *source, const char *language,
+                   const char *personality, char *output, int output_size)
+{
+#ifdef _WIN32
+    (void)llm; (void)kind; (void)source; (void)language; (void)personality;
+    (void)output; (void)output_size;
+    return 0;
+#else
+    struct llm_remote *remote;
+    char key[REMOTE_KEY_SIZE];
+    const char *argv[2];
+    size_t argl[2];
+    char *value = NULL;
+    int value_len = 0, source_len, len = 0;
+
+    if (!llm || !source || !output || output_size <= 0) return 0;
+    if (!remote_begin(llm)) return 0;
+    remote = llm->remote;
+
+    remote_key(llm, kind, source, language, personality, key, sizeof(key));
+    argv[0] = "GET";
+    argv[1] = key;
+    argl[0] = 3;
+    argl[1] = strlen(key);
+    if (!remote_command(remote, 2, argv, argl) ||
+        !remote_read_reply(remote, &value, &value_len)) {
+        remote_disconnect(remote);
+        llm_mutex_unlock(&remote->lock);
+        return 0;
+    }
+    llm_mutex_unlock(&remote->lock);
+
+    /* <source> NUL <answer> */
+    source_len = (int)strlen(source);
+    if (value && value_len > source_len + 1 && memcmp(value, source, source_len + 1) == 0) {
+        len = value_len - source_len - 1;
+        if (len >= output_size) len = output_size - 1;
+        memcpy(output, value + source_len + 1, len);
+        output[len] = '\0';
+        if (llm->config.verbose) {
+            llm_log(LLM_LOG_DEBUG, "LLM: Shared cache hit %s\n", key);
+        }
+    }
+    free(value);
+    return len;
+#endif
+}
+
+void llm_remote_put(nagi_llm_t *llm, char kind, const char *source, const char *language,
+                    const char *personality, const char *text)
+{
+#ifdef _WIN32
+    (void)llm; (void)kind; (void)source; (void)language; (void)personality; (void)text;
+#else
+    struct llm_remote *remote;
+    char key[REMOTE_KEY_SIZE];
+    char ttl[16];
+    const char *argv[5];
+    size_t argl[5];
+    size_t source_len, text_len;
+    char *value;
+    int argc = 3;
+
+    if (!llm || !source || !text || !text[0]) return;
+    source_len = strlen(source);
+    text_len = strlen(text);
+    if (source_len + text_len + 1 > REMOTE_MAX_VALUE) return;
+
+    value = (char *)malloc(source_len + text_len + 1);
+    if (!value) return;
+    memcpy(value, source, source_len + 1);
+    memcpy(value + source_len + 1, text, text_len);
+
+    if (!remote_begin(llm)) {
+        free(value);
+        return;
+    }
+    remote = llm->remote;
+
+    remote_key(llm, kind, source, language, personality, key, sizeof(key));
+    argv[0] = "SET";
+    argv[1] = key;
+    argv[2] = value;
+    argl[0] = 3;
+    argl[1] = strlen(key);
+    argl[2] = source_len + 1 + text_len;
+    if (llm->config.shared_cache_ttl_days > 0) {
+        snprintf(ttl, sizeof(ttl), "%ld", (long)llm->config.shared_cache_ttl_days * 86400L);
+        argv[3] = "EX";
+        argv[4] = ttl;
+        argl[3] = 2;
+        argl[4] = strlen(ttl);
+        argc = 5;
+    }
+
+    if (remote_command(remote, argc, argv, argl)) {
+        remote->pending++;
+    } else {
+        remote_disconnect(remote);
+    }
+    llm_mutex_unlock(&remote->lock);
+    free(value);
+#endif
+}
+
+void llm_remote_free(nagi_llm_t *llm)
+{
+    if (!llm || !llm->remote) return;
+
+#ifndef _WIN32
+    if (llm->remote->fd >= 0) {
+        close(llm->remote->fd);
+    }
+#endif
+    llm_mutex_destroy(&llm->remote->lock);
+    free(llm->remote);
+    llm->remote = NULL;
+}
@@ -0,0 +1,538 @@
+/*
+ * llm_stats.c - Request telemetry for NAGI
+ *
+ * Counts requests, tokens and time per operation so batch sizes and
+ * backends can be tuned per deployment. The public entry points (and the
+ * async worker) bracket each backend call with llm_stats_begin/end; the
+ * backends add stage times and hits to the operation in progress. What a
+ * call is timing travels with the call, and the operation in progress is
+ * the calling thread's, so calls that overlap (a backend waiting on I/O
+ * without the worker lock, router lanes) don't take each other's. The
+ * counters themselves are read from the game thread, hence the lock.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <stddef.h>
+
+#include "../include/nagi_llm.h"
+#include "../include/llm_utils.h"
+#include "../include/llm_log.h"
+#include "llm_thread.h"
+
+#define HYBRID_MIN_INPUTS 8           /* Inputs a way needs before its figures count */
+#define HYBRID_WEIGHT 0.2             /* Of the newest input in the running averages */
+#define HYBRID_SKIP_RATE 0.25         /* Extraction understanding less is skipped, if it can be */
+#define HYBRID_PROBE 16               /* Every this many skips, try anyway */
+
+/* How one way of reading inputs has been doing in hybrid mode */
+struct llm_stats_way {
+    double ms;                        /* Running average per input */
+    double understood;                /* Running share of inputs understood */
+    u32 inputs;
+    u32 skipped;
+};
+
+struct llm_stats {
+    llm_mutex_t lock;
+    nagi_llm_stats_t counters;
+    struct llm_stats_way hybrid[2];   /* Extraction, semantic matching */
+};
+
+/* Operation in progress on this thread, -1 for none */
+static _Thread_local int stats_current = -1;
+
+static const char *op_names[NAGI_LLM_OP_COUNT] = {
+    "extract", "match", "generate", "detect"
+};
+
+static const double latency_bounds[NAGI_LLM_LATENCY_BUCKETS - 1] = NAGI_LLM_LATENCY_BOUNDS_MS;
+
+static void stats_latency(nagi_llm_op_stats_t *op, double ms)
+{
+    int i = 0;
+
+    while (i < NAGI_LLM_LATENCY_BUCKETS - 1 && ms > latency_bounds[i]) i++;
+    op->latency[i]++;
+}
+
+struct llm_stats *llm_stats_create(void)
+{
+    struct llm_stats *stats;
+
+    stats = (struct llm_stats *)calloc(1, sizeof(struct llm_stats));
+    if (!stats) return NULL;
+
+    llm_mutex_init(&stats->lock);
+    return stats;
+}
+
+void llm_stats_free(nagi_llm_t *llm)
+{
+    if (!llm->stats) return;
+
+    llm_mutex_destroy(&llm->stats->lock);
+    free(llm->stats);
+    llm->stats = NULL;
+}
+
+/*
+ * Make op this thread's operation in progress, for a request that
+ * started at start_ms (llm_time_ms)
+ */
+llm_stats_call_t llm_stats_begin(nagi_llm_t *llm, nagi_llm_op_t op, double start_ms)
+{
+    llm_stats_call_t call;
+
+    (void)llm;
+    call.op = op;
+    call.outer = stats_current;
+    call.start_ms = start_ms;
+    stats_current = op;
+    return call;
+}
+
+/*
+ * Put back what the thread was doing before call, without counting it
+ */
+void llm_stats_leave(nagi_llm_t *llm, llm_stats_call_t call)
+{
+    (void)llm;
+    stats_current = call.outer;
+}
+
+/*
+ * Count a request of op that started at start_ms
+ */
+void llm_stats_count(nagi_llm_t *llm, nagi_llm_op_t op, double start_ms)
+{
+    struct llm_stats *stats = llm->stats;
+    nagi_llm_op_stats_t *counters;
+    double elapsed = llm_time_ms() - start_ms;
+
+    if (!stats || (int)op < 0 || op >= NAGI_LLM_OP_COUNT) return;
+
+    llm_mutex_lock(&stats->lock);
+    counters = &stats->counters.op[op];
+    counters->requests++;
+    counters->total_ms += elapsed;
+    if (elapsed > counters->max_ms) counters->max_ms = elapsed;
+    stats_latency(counters, elapsed);
+    llm_mutex_unlock(&stats->lock);
+}
+
+/*
+ * Count the request call was timing and put back the outer operation
+ */
+void llm_stats_end(nagi_llm_t *llm, llm_stats_call_t call)
+{
+    llm_stats_leave(llm, call);
+    llm_stats_count(llm, (nagi_llm_op_t)call.op, call.start_ms);
+}
+
+/*
+ * Add the time and tokens of one stage to the operation in progress
+ */
+void llm_stats_stage(nagi_llm_t *llm, llm_stats_stage_t stage, double ms, int tokens)
+{
+    struct llm_stats *stats = llm->stats;
+    nagi_llm_op_stats_t *op;
+
+    if (!stats || stats_current < 0) return;
+
+    llm_mutex_lock(&stats->lock);
+    op = &stats->counters.op[stats_current];
+    switch (stage) {
+        case LLM_STATS_TOKENIZE:
+            op->tokenize_ms += ms;
+            break;
+        case LLM_STATS_PROMPT:
+            op->prompt_ms += ms;
+            op->prompt_tokens += tokens;
+            break;
+        case LLM_STATS_GENERATE:
+            op->generate_ms += ms;
+            op->generated_tokens += tokens;
+            break;
+    }
+    llm_mutex_unlock(&stats->lock);
+}
+
+/*
+ * Count a hit for the operation in progress
+ */
+void llm_stats_hit(nagi_llm_t *llm, llm_stats_hit_t hit)
+{
+    struct llm_stats *stats = llm->stats;
+    nagi_llm_op_stats_t *op;
+
+    if (!stats || stats_current < 0) return;
+
+    llm_mutex_lock(&stats->lock);
+    op = &stats->counters.op[stats_current];
+    if (hit == LLM_STATS_KV_REUSE) {
+        op->kv_reuse_hits++;
+    } else {
+        op->cache_hits++;
+    }
+    llm_mutex_unlock(&stats->lock);
+}
+
+/*
+ * Count a request answered from the translation cache
+ * Called without the worker lock, so it leaves the operation in progress alone.
+ */
+void llm_stats_cached(nagi_llm_t *llm, nagi_llm_op_t op, double start_ms)
+{
+    struct llm_stats *stats = llm->stats;
+    nagi_llm_op_stats_t *counters;
+    double elapsed = llm_time_ms() - start_ms;
+
+    if (!stats) return;
+
+    llm_mutex_lock(&stats->lock);
+    counters = &stats->counters.op[op];
+    counters->requests++;
+    counters->cache_hits++;
+    counters->total_ms += elapsed;
+    if (elapsed > counters->max_ms) counters->max_ms = elapsed;
+    stats_latency(counters, elapsed);
+    llm_mutex_unlock(&stats->lock);
+}
+
+int nagi_llm_get_stats(nagi_llm_t *llm, nagi_llm_stats_t *stats)
+{
+    if (!llm || !llm->stats || !stats) return 0;
+
+    llm_mutex_lock(&llm->stats->lock);
+    memcpy(stats, &llm->stats->counters, sizeof(nagi_llm_stats_t));
+    llm_mutex_unlock(&llm->stats->lock);
+    return 1;
+}
+
+void nagi_llm_reset_stats(nagi_llm_t *llm)
+{
+    if (!llm || !llm->stats) return;
+
+    llm_mutex_lock(&llm->stats->lock);
+    memset(&llm->stats->counters, 0, sizeof(nagi_llm_stats_t));
+    llm_mutex_unlock(&llm->stats->lock);
+}
+
+const char *nagi_llm_op_name(nagi_llm_op_t op)
+{
+    if ((int)op < 0 || op >= NAGI_LLM_OP_COUNT) return "unknown";
+    return op_names[op];
+}
+
+static struct llm_stats_way *stats_way(struct llm_stats *stats, nagi_llm_mode_t mode)
+{
+    return &stats->hybrid[mode == NAGI_LLM_MODE_SEMANTIC];
+}
+
+void nagi_llm_hybrid_record(nagi_llm_t *llm, nagi_llm_mode_t mode, double ms, int understood)
+{
+    struct llm_stats_way *way;
+
+    if (!llm || !llm->stats) return;
+
+    llm_mutex_lock(&llm->stats->lock);
+    way = stats_way(llm->stats, mode);
+    if (way->inputs == 0) {
+        way->ms = ms;
+        way->understood = understood ? 1.0 : 0.0;
+    } else {
+        way->ms += (ms - way->ms) * HYBRID_WEIGHT;
+        way->understood += ((understood ? 1.0 : 0.0) - way->understood) * HYBRID_WEIGHT;
+    }
+    way->inputs++;
+    llm_mutex_unlock(&llm->stats->lock);
+}
+
+int nagi_llm_hybrid_try(nagi_llm_t *llm, nagi_llm_mode_t mode, double spent_ms)
+{
+    struct llm_stats_way *extract, *semantic, *way;
+    double slo, ms, understood;
+    int skip = 0;
+
+    if (!llm || !llm->stats) return 1;
+    slo = llm->config.hybrid_slo_ms > 0 ? llm->config.hybrid_slo_ms : 1e12;
+
+    llm_mutex_lock(&llm->stats->lock);
+    extract = stats_way(llm->stats, NAGI_LLM_MODE_EXTRACTION);
+    semantic = stats_way(llm->stats, NAGI_LLM_MODE_SEMANTIC);
+    way = stats_way(llm->stats, mode);
+
+    if (mode == NAGI_LLM_MODE_SEMANTIC) {
+        skip = semantic->inputs >= HYBRID_MIN_INPUTS && spent_ms + semantic->ms > slo;
+    } else if (extract->inputs >= HYBRID_MIN_INPUTS && semantic->inputs >= HYBRID_MIN_INPUTS) {
+        /* Straight to semantic matching when extraction is mostly time lost */
+        skip = semantic->ms <= slo &&
+               (extract->understood < HYBRID_SKIP_RATE || extract->ms + semantic->ms > slo);
+    }
+
+    if (skip && ++way->skipped % HYBRID_PROBE == 0) {
+        skip = 0;
+    }
+    ms = way->ms;
+    understood = way->understood;
+    llm_mutex_unlock(&llm->stats->lock);
+
+    if (skip && llm->config.verbose) {
+        llm_log(LLM_LOG_DEBUG, "LLM: Hybrid skips %s (%.0f ms, %.0f%% understood)\n",
+                               mode == NAGI_LLM_MODE_SEMANTIC ? "semantic matching" : "extraction",
+                               ms, understood * 100.0);
+    }
+    return !skip;
+}
+
+/* Tokens per second over a stage, 0 when nothing was timed */
+static double stats_rate(u32 tokens, double ms)
+{
+    return ms > 0.0 ? tokens * 1000.0 / ms : 0.0;
+}
+
+static void stats_write_csv(FILE *f, const nagi_llm_stats_t *stats)
+{
+    const nagi_llm_op_stats_t *op;
+    int i;
+
+    fprintf(f, "operation,requests,cache_hits,kv_reuse_hits,prompt_tokens,generated_tokens,"
+               "tokenize_ms,prompt_ms,generate_ms,total_ms,max_ms,"
+               "prompt_tokens_per_s,generated_tokens_per_s\n");
+    for (i = 0; i < NAGI_LLM_OP_COUNT; i++) {
+        op = &stats->op[i];
+        fprintf(f, "%s,%u,%u,%u,%u,%u,%.3f,%.3f,%.3f,%.3f,%.3f,%.1f,%.1f\n",
+                op_names[i], op->requests, op->cache_hits, op->kv_reuse_hits,
+                op->prompt_tokens, op->generated_tokens,
+                op->tokenize_ms, op->prompt_ms, op->generate_ms, op->total_ms, op->max_ms,
+                stats_rate(op->prompt_tokens, op->prompt_ms),
+                stats_rate(op->generated_tokens, op->generate_ms));
+    }
+}
+
+static void stats_write_json(FILE *f, const nagi_llm_stats_t *stats)
+{
+    const nagi_llm_op_stats_t *op;
+    int i;
+
+    fprintf(f, "{\n");
+    for (i = 0; i < NAGI_LLM_OP_COUNT; i++) {
+        op = &stats->op[i];
+        fprintf(f, "  \"%s\": {\n", op_names[i]);
+        fprintf(f, "    \"requests\": %u,\n", op->requests);
+        fprintf(f, "    \"cache_hits\": %u,\n", op->cache_hits);
+        fprintf(f, "    \"kv_reuse_hits\": %u,\n", op->kv_reuse_hits);
+        fprintf(f, "    \"prompt_tokens\": %u,\n", op->prompt_tokens);
+        fprintf(f, "    \"generated_tokens\": %u,\n", op->generated_tokens);
+        fprintf(f, "    \"tokenize_ms\": %.3f,\n", op->tokenize_ms);
+        fprintf(f, "    \"prompt_ms\": %.3f,\n", op->prompt_ms);
+        fprintf(f, "    \"generate_ms\": %.3f,\n", op->generate_ms);
+        fprintf(f, "    \"total_ms\": %.3f,\n", op->total_ms);
+        fprintf(f, "    \"max_ms\": %.3f,\n", op->max_ms);
+        fprintf(f, "    \"prompt_tokens_per_s\": %.1f,\n",
+                stats_rate(op->prompt_tokens, op->prompt_ms));
+        fprintf(f, "    \"generated_tokens_per_s\": %.1f\n",
+                stats_rate(op->generated_tokens, op->generate_ms));
+        fprintf(f, "  }%s\n", i + 1 < NAGI_LLM_OP_COUNT ? "," : "");
+    }
+    fprintf(f, "}\n");
+}
+
+int nagi_llm_stats_save(nagi_llm_t *llm, const char *path)
+{
+    nagi_llm_stats_t stats;
+    size_t len;
+    FILE *f;
+
+    if (!path || !nagi_llm_get_stats(llm, &stats)) return 0;
+
+    f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "LLM: Could not write stats to %s\n", path);
+        return 0;
+    }
+
+    len = strlen(path);
+    if (len > 4 && strcmp(path + len - 4, ".csv") == 0) {
+        stats_write_csv(f, &stats);
+    } else {
+        stats_write_json(f, &stats);
+    }
+    fclose(f);
+
+    if (llm->config.verbose) {
+        printf("LLM: Stats written to %s\n", path);
+    }
+    return 1;
+}
+
+/* Text being built for nagi_llm_metrics, counts what didn't fit too */
+struct metrics_out {
+    char *buf;
+    size_t size;
+    size_t len;
+};
+
+static void metrics_printf(struct metrics_out *out, const char *fmt, ...)
+{
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(out->len < out->size ? out->buf + out->len : NULL,
+                  out->len < out->size ? out->size - out->len : 0, fmt, ap);
+    va_end(ap);
+    if (n > 0) out->len += n;
+}
+
+static const char *metrics_backend(nagi_llm_backend_t backend)
+{
+    switch (backend) {
+        case NAGI_LLM_BACKEND_LLAMACPP: return "llamacpp";
+        case NAGI_LLM_BACKEND_BITNET: return "bitnet";
+        case NAGI_LLM_BACKEND_CLOUD: return "cloud";
+        case NAGI_LLM_BACKEND_ROUTER: return "router";
+        case NAGI_LLM_BACKEND_SERVER: return "server";
+        default: return "none";
+    }
+}
+
+/*
+ * One counter or gauge family, a sample per instance and operation
+ * field: offset of a u32 or double in nagi_llm_op_stats_t, scale turns ms into seconds
+ */
+static void metrics_family(struct metrics_out *out, const char *name, const char *type,
+                           const char *help, nagi_llm_t *const *llms, const nagi_llm_stats_t *stats,
+                           int count, size_t field, int is_double, double scale)
+{
+    char instance[32];
+    const char *p;
+    double value;
+    int i, o;
+
+    metrics_printf(out, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+    for (i = 0; i < count; i++) {
+        if (!llms[i]) continue;
+        instance[0] = '\0';
+        if (count > 1) snprintf(instance, sizeof(instance), ",instance=\"%d\"", i);
+        for (o = 0; o < NAGI_LLM_OP_COUNT; o++) {
+            p = (const char *)&stats[i].op[o] + field;
+            value = is_double ? *(const double *)p : (double)*(const u32 *)p;
+            metrics_printf(out, "%s{op=\"%s\",backend=\"%s\"%s} %.17g\n", name, op_names[o],
+                           metrics_backend(llms[i]->backend), instance, value * scale);
+        }
+    }
+}
+
+#define METRICS_GAUGES 5
+
+static const char *const gauge_names[METRICS_GAUGES][2] = {
+    { "nagi_llm_queued", "Requests waiting for the async worker" },
+    { "nagi_llm_running", "Requests the async worker is on" },
+    { "nagi_llm_cache_bytes", "Bytes held by the translation cache" },
+    { "nagi_llm_memo_bytes", "Bytes held by the extraction memo" },
+    { "nagi_llm_huge_page_bytes", "Bytes of the process in huge pages" }
+};
+
+size_t nagi_llm_metrics(nagi_llm_t *const *llms, int count, char *buf, size_t size)
+{
+    struct metrics_out out;
+    nagi_llm_stats_t *stats;
+    const nagi_llm_op_stats_t *op;
+    char labels[96];
+    double *gauges, oldest_ms;
+    size_t oldest_bytes, used;
+    u32 total;
+    int i, o, b, queued, running;
+
+    out.buf = buf;
+    out.size = buf ? size : 0;
+    out.len = 0;
+    if (out.size) buf[0] = '\0';
+    if (!llms || count <= 0) return 0;
+
+    stats = (nagi_llm_stats_t *)calloc(count, sizeof(nagi_llm_stats_t));
+    gauges = (double *)calloc((size_t)count * METRICS_GAUGES, sizeof(double));
+    if (!stats || !gauges) {
+        free(stats);
+        free(gauges);
+        return 0;
+    }
+    for (i = 0; i < count; i++) {
+        if (llms[i]) nagi_llm_get_stats(llms[i], &stats[i]);
+    }
+
+#define METRICS_U32(name, help, member) \
+    metrics_family(&out, name, "counter", help, llms, stats, count, \
+                   offsetof(nagi_llm_op_stats_t, member), 0, 1.0)
+#define METRICS_MS(name, help, member) \
+    metrics_family(&out, name, "counter", help, llms, stats, count, \
+                   offsetof(nagi_llm_op_stats_t, member), 1, 0.001)
+
+    METRICS_U32("nagi_llm_requests_total", "Requests by operation", requests);
+    METRICS_U32("nagi_llm_cache_hits_total", "Requests answered from a cache", cache_hits);
+    METRICS_U32("nagi_llm_kv_reuse_total", "Prompt prefixes or game contexts already decoded", kv_reuse_hits);
+    METRICS_U32("nagi_llm_prompt_tokens_total", "Tokens decoded for prompts", prompt_tokens);
+    METRICS_U32("nagi_llm_generated_tokens_total", "Tokens generated", generated_tokens);
+    METRICS_MS("nagi_llm_prompt_seconds_total", "Time decoding prompts", prompt_ms);
+    METRICS_MS("nagi_llm_generate_seconds_total", "Time generating tokens", generate_ms);
+#undef METRICS_U32
+#undef METRICS_MS
+
+    metrics_printf(&out, "# HELP nagi_llm_request_duration_seconds Request latency, not counting the queue\n"
+                         "# TYPE nagi_llm_request_duration_seconds histogram\n");
+    for (i = 0; i < count; i++) {
+        if (!llms[i]) continue;
+        for (o = 0; o < NAGI_LLM_OP_COUNT; o++) {
+            op = &stats[i].op[o];
+            snprintf(labels, sizeof(labels), "op=\"%s\",backend=\"%s\"", op_names[o],
+                     metrics_backend(llms[i]->backend));
+            if (count > 1) {
+                snprintf(labels + strlen(labels), sizeof(labels) - strlen(labels), ",instance=\"%d\"", i);
+            }
+            total = 0;
+            for (b = 0; b < NAGI_LLM_LATENCY_BUCKETS; b++) {
+                total += op->latency[b];
+                if (b < NAGI_LLM_LATENCY_BUCKETS - 1) {
+                    metrics_printf(&out, "nagi_llm_request_duration_seconds_bucket{%s,le=\"%g\"} %u\n",
+                                   labels, latency_bounds[b] / 1000.0, total);
+                } else {
+                    metrics_printf(&out, "nagi_llm_request_duration_seconds_bucket{%s,le=\"+Inf\"} %u\n",
+                                   labels, total);
+                }
+            }
+            metrics_printf(&out, "nagi_llm_request_duration_seconds_sum{%s} %.6f\n", labels, op->total_ms / 1000.0);
+            metrics_printf(&out, "nagi_llm_request_duration_seconds_count{%s} %u\n", labels, total);
+        }
+    }
+
+    /* Gauges, one sample an instance */
+    for (i = 0; i < count; i++) {
+        if (!llms[i]) continue;
+        nagi_llm_async_load(llms[i], &queued, &running);
+        gauges[i * METRICS_GAUGES + 0] = queued;
+        gauges[i * METRICS_GAUGES + 1] = running;
+        used = nagi_llm_cache_usage(llms[i], &oldest_bytes, &oldest_ms);
+        gauges[i * METRICS_GAUGES + 2] = (double)used;
+        used = nagi_llm_memo_usage(llms[i], &oldest_bytes, &oldest_ms);
+        gauges[i * METRICS_GAUGES + 3] = (double)used;
+        gauges[i * METRICS_GAUGES + 4] = nagi_llm_huge_pages_mb(llms[i]) * 1048576.0;
+    }
+    for (b = 0; b < METRICS_GAUGES; b++) {
+        metrics_printf(&out, "# HELP %s %s\n# TYPE %s gauge\n",
+                       gauge_names[b][0], gauge_names[b][1], gauge_names[b][0]);
+        for (i = 0; i < count; i++) {
+            if (!llms[i]) continue;
+            labels[0] = '\0';
+            if (count > 1) snprintf(labels, sizeof(labels), "{instance=\"%d\"}", i);
+            metrics_printf(&out, "%s%s %.17g\n", gauge_names[b][0], labels, gauges[i * METRICS_GAUGES + b]);
+        }
+    }
+
+    free(gauges);
+    free(stats);
+    return out.len;
+}
@@ -0,0 +1,417 @@
+/*
+ * llm_stt.c - Speech input for the parser
+ *
+ * Samples go into a ring as they're recorded and one worker thread takes
+ * them 20 ms at a time. A frame is speech when it's louder than both
+ * [stt] vad_threshold and three times the noise floor, which follows the
+ * quiet frames. A few loud frames in a row start an utterance, with a
+ * little of the audio before them so the first sound isn't cut, and
+ * end_ms of quiet ends it.
+ *
+ * While the player talks the utterance so far is posted as a WAV every
+ * chunk_ms of new audio, the answer is a partial transcript the parser
+ * can start extracting from. The last post is the final one. Audio that
+ * comes in while a request is out waits in the ring.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "../include/nagi_llm_stt.h"
+#include "llm_thread.h"
+
+#ifdef NAGI_LLM_HAS_CLOUD_API
+#include <curl/curl.h>
+#endif
+
+#define NAGI_STT_RATE 16000             /* What whisper models take */
+#define NAGI_STT_RING (1 << 19)         /* Samples waiting for the worker, a power of 2 (about 30s) */
+#define NAGI_STT_FRAME 320              /* 20 ms, voice activity is judged a frame at a time */
+#define NAGI_STT_FRAME_MS 20
+#define NAGI_STT_START_FRAMES 3         /* Loud frames in a row that start an utterance */
+#define NAGI_STT_PREROLL (NAGI_STT_RATE * 300 / 1000)   /* Kept from before the start */
+#define NAGI_STT_MAX_MS 15000           /* An utterance is cut off this long */
+#define NAGI_STT_UTTERANCE (NAGI_STT_RATE * NAGI_STT_MAX_MS / 1000 + NAGI_STT_PREROLL + NAGI_STT_FRAME)
+#define NAGI_STT_TEXT 512
+#define NAGI_STT_POLL_MS 100
+
+struct nagi_stt {
+    char url[512];
+    char api_key[256];
+    char model[128];
+    char language[16];
+    int vad_threshold;
+    int end_ms;
+    int chunk_ms;
+
+    llm_thread_t thread;
+    llm_mutex_t lock;
+    llm_cond_t wake;             /* Samples written or quit */
+    int quit;
+
+    short *ring;
+    unsigned ring_head;          /* Next sample written */
+    unsigned ring_tail;          /* Next sample read */
+
+    /* Transcripts not taken yet */
+    char partial[NAGI_STT_TEXT];
+    char final[NAGI_STT_TEXT];
+    int has_partial;
+    int has_final;
+
+    /* The worker's own */
+    short *utterance;
+    int utterance_len;
+    int sent_len;                /* Samples in the last partial */
+    int speaking;
+    int loud_run;
+    int quiet_ms;
+    double noise;                /* RMS of the quiet frames, -1 before the first */
+
+#ifdef NAGI_LLM_HAS_CLOUD_API
+    CURL *curl;
+    struct curl_slist *headers;
+#endif
+};
+
+#ifdef NAGI_LLM_HAS_CLOUD_API
+typedef struct {
+    char text[NAGI_STT_TEXT];
+    size_t len;
+} stt_reply_t;
+
+static size_t stt_reply_write(void *contents, size_t size, size_t nmemb, void *userp)
+{
+    stt_reply_t *reply = (stt_reply_t *)userp;
+    size_t n = size * nmemb;
+    size_t room = sizeof(reply->text) - 1 - reply->len;
+
+    memcpy(reply->text + reply->len, contents, n < room ? n : room);
+    reply->len += n < room ? n : room;
+    reply->text[reply->len] = '\0';
+    return n;
+}
+
+static void stt_put_le(unsigned char *p, unsigned value, int bytes)
+{
+    int i;
+
+    for (i = 0; i < bytes; i++) {
+        p[i] = (unsigned char)(value >> (i * 8));
+    }
+}
+
+/*
+ * Transcribe the utterance so far into text, "" if nothing was made out
+ * Returns 0 if the request failed.
+ */
+static int stt_transcribe(nagi_stt_t *stt, char *text, size_t size)
+{
+    unsigned char *wav;
+    size_t bytes;
+    curl_mime *mime;
+    curl_mimepart *part;
+    stt_reply_t reply;
+    CURLcode res;
+    long status = 0;
+    char *s, *end;
+    int i;
+
+    text[0] = '\0';
+    bytes = (size_t)stt->utterance_len * 2;
+    wav = (unsigned char *)malloc(44 + bytes);
+    if (!wav) return 0;
+
+    /* 16-bit mono PCM in a RIFF header */
+    memcpy(wav, "RIFF", 4);
+    stt_put_le(wav + 4, (unsigned)(36 + bytes), 4);
+    memcpy(wav + 8, "WAVEfmt ", 8);
+    stt_put_le(wav + 16, 16, 4);
+    stt_put_le(wav + 20, 1, 2);
+    stt_put_le(wav + 22, 1, 2);
+    stt_put_le(wav + 24, NAGI_STT_RATE, 4);
+    stt_put_le(wav + 28, NAGI_STT_RATE * 2, 4);
+    stt_put_le(wav + 32, 2, 2);
+    stt_put_le(wav + 34, 16, 2);
+    memcpy(wav + 36, "data", 4);
+    stt_put_le(wav + 40, (unsigned)bytes, 4);
+    for (i = 0; i < stt->utterance_len; i++) {
+        stt_put_le(wav + 44 + i * 2, (unsigned short)stt->utterance[i], 2);
+    }
+
+    mime = curl_mime_init(stt->curl);
+    part = curl_mime_addpart(mime);
+    curl_mime_name(part, "file");
+    curl_mime_data(part, (const char *)wav, 44 + bytes);
+    curl_mime_filename(part, "speech.wav");
+    curl_mime_type(part, "audio/wav");
+    part = curl_mime_addpart(mime);
+    curl_mime_name(part, "model");
+    curl_mime_data(part, stt->model, CURL_ZERO_TERMINATED);
+    part = curl_mime_addpart(mime);
+    curl_mime_name(part, "response_format");
+    curl_mime_data(part, "text", CURL_ZERO_TERMINATED);
+    part = curl_mime_addpart(mime);
+    curl_mime_name(part, "temperature");
+    curl_mime_data(part, "0", CURL_ZERO_TERMINATED);
+    if (stt->language[0]) {
+        part = curl_mime_addpart(mime);
+        curl_mime_name(part, "language");
+        curl_mime_data(part, stt->language, CURL_ZERO_TERMINATED);
+    }
+
+    memset(&reply, 0, sizeof(reply));
+    curl_easy_setopt(stt->curl, CURLOPT_URL, stt->url);
+    curl_easy_setopt(stt->curl, CURLOPT_HTTPHEADER, stt->headers);
+    curl_easy_setopt(stt->curl, CURLOPT_MIMEPOST, mime);
+    curl_easy_setopt(stt->curl, CURLOPT_WRITEFUNCTION, stt_reply_write);
+    curl_easy_setopt(stt->curl, CURLOPT_WRITEDATA, &reply);
+    res = curl_easy_perform(stt->curl);
+    curl_easy_getinfo(stt->curl, CURLINFO_RESPONSE_CODE, &status);
+    curl_mime_free(mime);
+    free(wav);
+
+    if (res != CURLE_OK || status != 200) {
+        fprintf(stderr, "STT: %s\n", res != CURLE_OK ? curl_easy_strerror(res) : reply.text);
+        return 0;
+    }
+
+    /* One line of text, whisper puts spaces and line breaks around it */
+    s = reply.text;
+    while (*s == ' ' || *s == '\n' || *s == '\r' || *s == '\t') s++;
+    for (end = s; *end; end++) {
+        if (*end == '\n' || *end == '\r' || *end == '\t') *end = ' ';
+    }
+    while (end > s && end[-1] == ' ') *(--end) = '\0';
+    strncpy(text, s, size - 1);
+    text[size - 1] = '\0';
+    return 1;
+}
+#endif
+
+/* Hand a transcript to nagi_stt_poll */
+static void stt_result(nagi_stt_t *stt, int final)
+{
+    char text[NAGI_STT_TEXT];
+
+#ifdef NAGI_LLM_HAS_CLOUD_API
+    if (!stt_transcribe(stt, text, sizeof(text))) return;
+#else
+    text[0] = '\0';
+#endif
+    if (text[0] == '\0') return;
+
+    llm_mutex_lock(&stt->lock);
+    if (final) {
+        memcpy(stt->final, text, sizeof(stt->final));
+        stt->has_final = 1;
+        stt->has_partial = 0;
+    } else {
+        memcpy(stt->partial, text, sizeof(stt->partial));
+        stt->has_partial = 1;
+    }
+    llm_mutex_unlock(&stt->lock);
+}
+
+static void stt_frame(nagi_stt_t *stt, const short *frame)
+{
+    double sum = 0.0, rms;
+    int loud, i;
+
+    for (i = 0; i < NAGI_STT_FRAME; i++) {
+        sum += (double)frame[i] * frame[i];
+    }
+    rms = sqrt(sum / NAGI_STT_FRAME);
+    if (stt->noise < 0.0) stt->noise = rms;
+    loud = rms > stt->vad_threshold && rms > stt->noise * 3.0;
+
+    if (stt->utterance_len + NAGI_STT_FRAME <= NAGI_STT_UTTERANCE) {
+        memcpy(stt->utterance + stt->utterance_len, frame, NAGI_STT_FRAME * sizeof(short));
+        stt->utterance_len += NAGI_STT_FRAME;
+    }
+
+    if (!stt->speaking) {
+        if (!loud) stt->noise = stt->noise * 0.95 + rms * 0.05;
+        stt->loud_run = loud ? stt->loud_run + 1 : 0;
+        if (stt->loud_run >= NAGI_STT_START_FRAMES) {
+            stt->speaking = 1;
+            stt->quiet_ms = 0;
+            stt->sent_len = 0;
+        } else if (stt->utterance_len > NAGI_STT_PREROLL) {
+            memmove(stt->utterance, stt->utterance + stt->utterance_len - NAGI_STT_PREROLL,
+                    NAGI_STT_PREROLL * sizeof(short));
+            stt->utterance_len = NAGI_STT_PREROLL;
+        }
+        return;
+    }
+
+    stt->quiet_ms = loud ? 0 : stt->quiet_ms + NAGI_STT_FRAME_MS;
+    if (stt->quiet_ms >= stt->end_ms || stt->utterance_len + NAGI_STT_FRAME > NAGI_STT_UTTERANCE) {
+        stt_result(stt, 1);
+        stt->speaking = 0;
+        stt->loud_run = 0;
+        stt->utterance_len = 0;
+    } else if ((stt->utterance_len - stt->sent_len) * 1000 >= stt->chunk_ms * NAGI_STT_RATE) {
+        stt_result(stt, 0);
+        stt->sent_len = stt->utterance_len;
+    }
+}
+
+static void *stt_worker(void *arg)
+{
+    nagi_stt_t *stt = (nagi_stt_t *)arg;
+    short frame[NAGI_STT_FRAME];
+    int i;
+
+    llm_mutex_lock(&stt->lock);
+    while (!stt->quit) {
+        if (stt->ring_head - stt->ring_tail < NAGI_STT_FRAME) {
+            llm_cond_timedwait(&stt->wake, &stt->lock, NAGI_STT_POLL_MS);
+            continue;
+        }
+        for (i = 0; i < NAGI_STT_FRAME; i++) {
+            frame[i] = stt->ring[(stt->ring_tail + i) & (NAGI_STT_RING - 1)];
+        }
+        stt->ring_tail += NAGI_STT_FRAME;
+        llm_mutex_unlock(&stt->lock);
+
+        stt_frame(stt, frame);
+
+        llm_mutex_lock(&stt->lock);
+    }
+    llm_mutex_unlock(&stt->lock);
+    return NULL;
+}
+
+nagi_stt_t *nagi_stt_create(const nagi_llm_config_t *config)
+{
+    nagi_stt_t *stt = NULL;
+
+    if (!config || !config->stt_url[0]) return NULL;
+#ifndef NAGI_LLM_HAS_CLOUD_API
+    fprintf(stderr, "STT: url not available in this build\n");
+    return stt;
+#else
+    stt = (nagi_stt_t *)calloc(1, sizeof(nagi_stt_t));
+    if (!stt) return NULL;
+    stt->ring = (short *)malloc(NAGI_STT_RING * sizeof(short));
+    stt->utterance = (short *)malloc(NAGI_STT_UTTERANCE * sizeof(short));
+    if (!stt->ring || !stt->utterance) {
+        free(stt->ring);
+        free(stt->utterance);
+        free(stt);
+        return NULL;
+    }
+
+    strncpy(stt->url, config->stt_url, sizeof(stt->url) - 1);
+    strncpy(stt->api_key, config->stt_api_key, sizeof(stt->api_key) - 1);
+    strncpy(stt->model, config->stt_model[0] ? config->stt_model : "whisper-1", sizeof(stt->model) - 1);
+    strncpy(stt->language, config->stt_language, sizeof(stt->language) - 1);
+    stt->vad_threshold = config->stt_vad_threshold;
+    stt->end_ms = config->stt_end_ms > 0 ? config->stt_end_ms : NAGI_LLM_DEFAULT_STT_END_MS;
+    stt->chunk_ms = config->stt_chunk_ms > 0 ? config->stt_chunk_ms : NAGI_LLM_DEFAULT_STT_CHUNK_MS;
+    stt->noise = -1.0;
+
+    {
+        char auth[300];
+        const char *key = stt->api_key[0] ? stt->api_key : getenv("OPENAI_API_KEY");
+
+        stt->curl = curl_easy_init();
+        if (key && key[0]) {
+            snprintf(auth, sizeof(auth), "Authorization: Bearer %s", key);
+            stt->headers = curl_slist_append(NULL, auth);
+        }
+        if (!stt->curl) {
+            curl_slist_free_all(stt->headers);
+            free(stt->utterance);
+            free(stt->ring);
+            free(stt);
+            return NULL;
+        }
+    }
+
+    llm_mutex_init(&stt->lock);
+    llm_cond_init(&stt->wake);
+    if (!llm_thread_create(&stt->thread, stt_worker, stt)) {
+        stt->quit = 1;
+        nagi_stt_destroy(stt);
+        return NULL;
+    }
+
+    fprintf(stderr, "STT: %s\n", stt->url);
+    return stt;
+#endif
+}
+
+void nagi_stt_destroy(nagi_stt_t *stt)
+{
+    int running;
+
+    if (!stt) return;
+
+    llm_mutex_lock(&stt->lock);
+    running = !stt->quit;
+    stt->quit = 1;
+    llm_cond_broadcast(&stt->wake);
+    llm_mutex_unlock(&stt->lock);
+    if (running) {
+        llm_thread_join(stt->thread);
+    }
+
+#ifdef NAGI_LLM_HAS_CLOUD_API
+    if (stt->curl) curl_easy_cleanup(stt->curl);
+    curl_slist_free_all(stt->headers);
+#endif
+
+    llm_cond_destroy(&stt->wake);
+    llm_mutex_destroy(&stt->lock);
+    free(stt->utterance);
+    free(stt->ring);
+    free(stt);
+}
+
+int nagi_stt_sample_rate(nagi_stt_t *stt)
+{
+    return stt ? NAGI_STT_RATE : 0;
+}
+
+void nagi_stt_write(nagi_stt_t *stt, const short *pcm, int n)
+{
+    int i;
+
+    if (!stt || n <= 0) return;
+
+    llm_mutex_lock(&stt->lock);
+    for (i = 0; i < n; i++) {
+        stt->ring[(stt->ring_head + i) & (NAGI_STT_RING - 1)] = pcm[i];
+    }
+    stt->ring_head += n;
+    if (stt->ring_head - stt->ring_tail > NAGI_STT_RING) {
+        stt->ring_tail = stt->ring_head - NAGI_STT_RING;
+    }
+    llm_cond_broadcast(&stt->wake);
+    llm_mutex_unlock(&stt->lock);
+}
+
+int nagi_stt_poll(nagi_stt_t *stt, char *text, int size)
+{
+    int got = NAGI_STT_NONE;
+
+    if (!stt || size <= 0) return NAGI_STT_NONE;
+
+    llm_mutex_lock(&stt->lock);
+    if (stt->has_final) {
+        strncpy(text, stt->final, (size_t)size - 1);
+        stt->has_final = 0;
+        got = NAGI_STT_FINAL;
+    } else if (stt->has_partial) {
+        strncpy(text, stt->partial, (size_t)size - 1);
+        stt->has_partial = 0;
+        got = NAGI_STT_PARTIAL;
+    }
+    llm_mutex_unlock(&stt->lock);
+    if (got != NAGI_STT_NONE) text[size - 1] = '\0';
+    return got;
+}
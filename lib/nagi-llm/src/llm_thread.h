@@ -0,0 +1,188 @@
+/*
+ * llm_thread.h - Minimal threading wrappers for nagi-llm
+ *
+ * The library does not depend on SDL, so worker threads use pthreads on
+ * POSIX systems and the Win32 API on Windows.
+ */
+
+#ifndef LLM_THREAD_H
+#define LLM_THREAD_H
+
+#ifdef _WIN32
+
+#include <windows.h>
+#include <stdlib.h>
+
+typedef HANDLE llm_thread_t;
+typedef CRITICAL_SECTION llm_mutex_t;
+typedef CONDITION_VARIABLE llm_cond_t;
+
+typedef struct {
+    void *(*func)(void *);
+    void *arg;
+} llm_thread_start_t;
+
+static DWORD WINAPI llm_thread_trampoline(LPVOID param)
+{
+    llm_thread_start_t start = *(llm_thread_start_t *)param;
+    free(param);
+    start.func(start.arg);
+    return 0;
+}
+
+/* Returns 1 on success, 0 on failure */
+static inline int llm_thread_create(llm_thread_t *thread, void *(*func)(void *), void *arg)
+{
+    llm_thread_start_t *start = (llm_thread_start_t *)malloc(sizeof(llm_thread_start_t));
+    if (!start) return 0;
+    start->func = func;
+    start->arg = arg;
+    *thread = CreateThread(NULL, 0, llm_thread_trampoline, start, 0, NULL);
+    if (!*thread) {
+        free(start);
+        return 0;
+    }
+    return 1;
+}
+
+static inline void llm_thread_join(llm_thread_t thread)
+{
+    WaitForSingleObject(thread, INFINITE);
+    CloseHandle(thread);
+}
+
+/* Nobody waits for it, it goes when it returns or the process exits */
+static inline void llm_thread_detach(llm_thread_t thread) { CloseHandle(thread); }
+
+/* Returns 1 if called from that thread */
+static inline int llm_thread_is_current(llm_thread_t thread)
+{
+    return GetThreadId(thread) == GetCurrentThreadId();
+}
+
+static inline void llm_mutex_init(llm_mutex_t *m) { InitializeCriticalSection(m); }
+static inline void llm_mutex_destroy(llm_mutex_t *m) { DeleteCriticalSection(m); }
+static inline void llm_mutex_lock(llm_mutex_t *m) { EnterCriticalSection(m); }
+static inline void llm_mutex_unlock(llm_mutex_t *m) { LeaveCriticalSection(m); }
+
+static inline void llm_cond_init(llm_cond_t *c) { InitializeConditionVariable(c); }
+static inline void llm_cond_destroy(llm_cond_t *c) { (void)c; }
+static inline void llm_cond_wait(llm_cond_t *c, llm_mutex_t *m) { SleepConditionVariableCS(c, m, INFINITE); }
+static inline void llm_cond_signal(llm_cond_t *c) { WakeConditionVariable(c); }
+static inline void llm_cond_broadcast(llm_cond_t *c) { WakeAllConditionVariable(c); }
+
+/* Returns 0 if ms passed without a wakeup */
+static inline int llm_cond_timedwait(llm_cond_t *c, llm_mutex_t *m, int ms)
+{
+    return SleepConditionVariableCS(c, m, (DWORD)ms) != 0;
+}
+
+/* Counters shared without a lock: loads acquire, stores release */
+static inline unsigned int llm_atomic_load(volatile unsigned int *p)
+{
+    return (unsigned int)InterlockedCompareExchange((volatile LONG *)p, 0, 0);
+}
+
+static inline void llm_atomic_store(volatile unsigned int *p, unsigned int value)
+{
+    InterlockedExchange((volatile LONG *)p, (LONG)value);
+}
+
+/* Returns 1 if *p was expected and is now value */
+static inline int llm_atomic_cas(volatile unsigned int *p, unsigned int expected, unsigned int value)
+{
+    return (unsigned int)InterlockedCompareExchange((volatile LONG *)p, (LONG)value,
+                                                    (LONG)expected) == expected;
+}
+
+/* Milliseconds from a steady clock, for measuring latency */
+static inline double llm_time_ms(void)
+{
+    LARGE_INTEGER freq, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&now);
+    return (double)now.QuadPart * 1000.0 / (double)freq.QuadPart;
+}
+
+#else
+
+#include <pthread.h>
+#include <time.h>
+#include <errno.h>
+
+typedef pthread_t llm_thread_t;
+typedef pthread_mutex_t llm_mutex_t;
+typedef pthread_cond_t llm_cond_t;
+
+/* Returns 1 on success, 0 on failure */
+static inline int llm_thread_create(llm_thread_t *thread, void *(*func)(void *), void *arg)
+{
+    return pthread_create(thread, NULL, func, arg) == 0;
+}
+
+static inline void llm_thread_join(llm_thread_t thread) { pthread_join(thread, NULL); }
+
+/* Nobody waits for it, it goes when it returns or the process exits */
+static inline void llm_thread_detach(llm_thread_t thread) { pthread_detach(thread); }
+
+/* Returns 1 if called from that thread */
+static inline int llm_thread_is_current(llm_thread_t thread)
+{
+    return pthread_equal(pthread_self(), thread) != 0;
+}
+
+static inline void llm_mutex_init(llm_mutex_t *m) { pthread_mutex_init(m, NULL); }
+static inline void llm_mutex_destroy(llm_mutex_t *m) { pthread_mutex_destroy(m); }
+static inline void llm_mutex_lock(llm_mutex_t *m) { pthread_mutex_lock(m); }
+static inline void llm_mutex_unlock(llm_mutex_t *m) { pthread_mutex_unlock(m); }
+
+static inline void llm_cond_init(llm_cond_t *c) { pthread_cond_init(c, NULL); }
+static inline void llm_cond_destroy(llm_cond_t *c) { pthread_cond_destroy(c); }
+static inline void llm_cond_wait(llm_cond_t *c, llm_mutex_t *m) { pthread_cond_wait(c, m); }
+static inline void llm_cond_signal(llm_cond_t *c) { pthread_cond_signal(c); }
+static inline void llm_cond_broadcast(llm_cond_t *c) { pthread_cond_broadcast(c); }
+
+/* Returns 0 if ms passed without a wakeup */
+static inline int llm_cond_timedwait(llm_cond_t *c, llm_mutex_t *m, int ms)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (long)(ms % 1000) * 1000000L;
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return pthread_cond_timedwait(c, m, &ts) != ETIMEDOUT;
+}
+
+/* Counters shared without a lock: loads acquire, stores release */
+static inline unsigned int llm_atomic_load(volatile unsigned int *p)
+{
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
+}
+
+static inline void llm_atomic_store(volatile unsigned int *p, unsigned int value)
+{
+    __atomic_store_n(p, value, __ATOMIC_RELEASE);
+}
+
+/* Returns 1 if *p was expected and is now value */
+static inline int llm_atomic_cas(volatile unsigned int *p, unsigned int expected, unsigned int value)
+{
+    return __atomic_compare_exchange_n(p, &expected, value, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+
+/* Milliseconds from a steady clock, for measuring latency */
+static inline double llm_time_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1000.0 + (double)ts.tv_nsec / 1000000.0;
+}
+
+#endif
+
+#endif /* LLM_THREAD_H */
@@ -0,0 +1,645 @@
+/*
+ * llm_tts.c - Text-to-speech for generated responses
+ *
+ * One worker thread takes the queued sentences in order. The local backend
+ * writes each one as a line to the command's stdin and a reader thread
+ * moves whatever it prints into the sample ring, so one sentence plays
+ * while the next is synthesized. The cloud backend posts each sentence and
+ * streams the body into the ring as it arrives.
+ *
+ * nagi_tts_flush() bumps a generation count so audio for text queued
+ * before it is dropped. A local command can't say where the audio for one
+ * line ends, so one that may still be working on old text is restarted.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#include "../include/nagi_llm_tts.h"
+#include "../include/llm_log.h"
+#include "llm_thread.h"
+
+#ifndef _WIN32
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#define NAGI_TTS_HAS_LOCAL 1
+#endif
+
+#ifdef NAGI_LLM_HAS_CLOUD_API
+#include <curl/curl.h>
+#endif
+
+#define NAGI_TTS_TEXT_MAX 4096          /* Queued text not synthesized yet */
+#define NAGI_TTS_RING (1 << 19)         /* Samples held, a power of 2 (about 20s) */
+#define NAGI_TTS_CLAUSE_MAX 160         /* Split a longer sentence at a comma */
+#define NAGI_TTS_QUIET_MS 2000          /* Local command silent this long is done */
+#define NAGI_TTS_POLL_MS 100
+#define NAGI_TTS_LOCAL_RATE 22050       /* piper's usual voices */
+#define NAGI_TTS_CLOUD_RATE 24000       /* OpenAI "pcm" */
+
+#if defined(MSG_NOSIGNAL)
+#define NAGI_TTS_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define NAGI_TTS_SEND_FLAGS 0
+#endif
+
+/* Raw bytes to samples, with an odd byte kept for the next chunk */
+typedef struct {
+    nagi_tts_t *tts;
+    unsigned gen;
+    unsigned char carry;
+    int has_carry;
+} tts_bytes_t;
+
+struct nagi_tts {
+    char command[NAGI_LLM_MAX_MODEL_PATH];
+    char url[512];
+    char api_key[256];
+    char model[128];
+    char voice[64];
+    int rate;
+
+    llm_thread_t thread;
+    llm_mutex_t lock;
+    llm_cond_t wake;             /* Text queued, room in the ring or quit */
+    int quit;
+    unsigned gen;                /* Bumped by nagi_tts_flush */
+
+    char text[NAGI_TTS_TEXT_MAX]; /* Sentences to speak, each ended by '\n' */
+    int text_len;
+
+    short *ring;
+    unsigned ring_head;          /* Next sample written */
+    unsigned ring_tail;          /* Next sample read */
+
+#ifdef NAGI_TTS_HAS_LOCAL
+    pid_t pid;                   /* 0 until the first line */
+    int fd_in;
+    int fd_out;
+    llm_thread_t reader;
+    int reader_quit;
+    int local_busy;              /* Written to and not quiet since */
+    int local_heard;             /* Printed something since the last line */
+    double local_last;           /* When it last printed, llm_time_ms */
+    int local_restart;
+    int local_failed;
+#endif
+
+#ifdef NAGI_LLM_HAS_CLOUD_API
+    CURL *curl;
+    struct curl_slist *headers;
+#endif
+};
+
+/*
+ * Add samples for the text of generation gen, waiting for room in the ring
+ * Returns 0 once they aren't wanted any more.
+ */
+static int tts_push(nagi_tts_t *tts, unsigned gen, const short *pcm, int n)
+{
+    int room, chunk, i;
+    int ok = 1;
+
+    llm_mutex_lock(&tts->lock);
+    while (n > 0) {
+        if (tts->quit || tts->gen != gen) {
+            ok = 0;
+            break;
+        }
+        room = NAGI_TTS_RING - (int)(tts->ring_head - tts->ring_tail);
+        if (room == 0) {
+            llm_cond_timedwait(&tts->wake, &tts->lock, NAGI_TTS_POLL_MS);
+            continue;
+        }
+        chunk = (n < room) ? n : room;
+        for (i = 0; i < chunk; i++) {
+            tts->ring[(tts->ring_head + i) & (NAGI_TTS_RING - 1)] = pcm[i];
+        }
+        tts->ring_head += chunk;
+        pcm += chunk;
+        n -= chunk;
+    }
+    llm_mutex_unlock(&tts->lock);
+    return ok;
+}
+
+/* Little-endian 16-bit bytes as they come from the backend */
+static int tts_push_bytes(tts_bytes_t *b, const unsigned char *data, size_t len)
+{
+    short pcm[1024];
+    int n = 0;
+
+    while (len > 0) {
+        if (b->has_carry) {
+            pcm[n++] = (short)(b->carry | (data[0] << 8));
+            b->has_carry = 0;
+            data++;
+            len--;
+        } else if (len == 1) {
+            b->carry = data[0];
+            b->has_carry = 1;
+            len = 0;
+        } else {
+            pcm[n++] = (short)(data[0] | (data[1] << 8));
+            data += 2;
+            len -= 2;
+        }
+        if (n == (int)(sizeof(pcm) / sizeof(pcm[0]))) {
+            if (!tts_push(b->tts, b->gen, pcm, n)) return 0;
+            n = 0;
+        }
+    }
+    return (n == 0) || tts_push(b->tts, b->gen, pcm, n);
+}
+
+#ifdef NAGI_TTS_HAS_LOCAL
+static void *local_reader(void *arg)
+{
+    nagi_tts_t *tts = (nagi_tts_t *)arg;
+    unsigned char buf[4096];
+    struct pollfd pfd;
+    tts_bytes_t bytes;
+    ssize_t got;
+    int ready, drop;
+
+    memset(&bytes, 0, sizeof(bytes));
+    bytes.tts = tts;
+
+    for (;;) {
+        pfd.fd = tts->fd_out;
+        pfd.events = POLLIN;
+        pfd.revents = 0;
+        ready = poll(&pfd, 1, NAGI_TTS_POLL_MS);
+
+        llm_mutex_lock(&tts->lock);
+        if (tts->reader_quit) {
+            llm_mutex_unlock(&tts->lock);
+            break;
+        }
+        if (ready <= 0) {
+            if (tts->local_heard && llm_time_ms() - tts->local_last >= NAGI_TTS_QUIET_MS) {
+                tts->local_busy = 0;
+            }
+            llm_mutex_unlock(&tts->lock);
+            continue;
+        }
+        if (bytes.gen != tts->gen) {
+            bytes.gen = tts->gen;
+            bytes.has_carry = 0;
+        }
+        /* Still the old text, it's about to be restarted */
+        drop = tts->local_restart;
+        llm_mutex_unlock(&tts->lock);
+
+        got = read(tts->fd_out, buf, sizeof(buf));
+        if (got <= 0) break;    /* The command has gone */
+        if (drop) continue;
+
+        llm_mutex_lock(&tts->lock);
+        tts->local_heard = 1;
+        tts->local_last = llm_time_ms();
+        llm_mutex_unlock(&tts->lock);
+        tts_push_bytes(&bytes, buf, (size_t)got);
+    }
+    return NULL;
+}
+
+static void local_stop(nagi_tts_t *tts)
+{
+    if (tts->pid <= 0) return;
+
+    kill(tts->pid, SIGTERM);
+    close(tts->fd_in);
+    llm_mutex_lock(&tts->lock);
+    tts->reader_quit = 1;
+    llm_mutex_unlock(&tts->lock);
+    llm_thread_join(tts->reader);
+    waitpid(tts->pid, NULL, 0);
+    close(tts->fd_out);
+    tts->pid = 0;
+    tts->local_busy = 0;
+}
+
+/* stdin is a socket so a command that dies can't take the game with SIGPIPE */
+static int local_start(nagi_tts_t *tts)
+{
+    int in[2], out[2];
+    pid_t pid;
+
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, in) != 0) return 0;
+    if (pipe(out) != 0) {
+        close(in[0]);
+        close(in[1]);
+        return 0;
+    }
+#ifdef SO_NOSIGPIPE
+    {
+        int on = 1;
+        setsockopt(in[0], SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+    }
+#endif
+
+    pid = fork();
+    if (pid == 0) {
+        dup2(in[1], 0);
+        dup2(out[1], 1);
+        close(in[0]);
+        close(in[1]);
+        close(out[0]);
+        close(out[1]);
+        execl("/bin/sh", "sh", "-c", tts->command, (char *)NULL);
+        _exit(127);
+    }
+    close(in[1]);
+    close(out[1]);
+    if (pid < 0) {
+        close(in[0]);
+        close(out[0]);
+        return 0;
+    }
+
+    tts->pid = pid;
+    tts->fd_in = in[0];
+    tts->fd_out = out[0];
+    tts->reader_quit = 0;
+    tts->local_busy = 0;
+    if (!llm_thread_create(&tts->reader, local_reader, tts)) {
+        kill(pid, SIGTERM);
+        close(tts->fd_in);
+        close(tts->fd_out);
+        waitpid(pid, NULL, 0);
+        tts->pid = 0;
+        return 0;
+    }
+    return 1;
+}
+
+static void local_speak(nagi_tts_t *tts, const char *line, int len)
+{
+    ssize_t sent;
+    int off;
+
+    if (tts->local_failed) return;
+    if (tts->pid == 0 && !local_start(tts)) {
+        fprintf(stderr, "TTS: Could not start '%s'\n", tts->command);
+        tts->local_failed = 1;
+        return;
+    }
+
+    llm_mutex_lock(&tts->lock);
+    tts->local_busy = 1;
+    tts->local_heard = 0;
+    llm_mutex_unlock(&tts->lock);
+
+    for (off = 0; off < len; off += (int)sent) {
+        sent = send(tts->fd_in, line + off, (size_t)(len - off), NAGI_TTS_SEND_FLAGS);
+        if (sent <= 0) {
+            fprintf(stderr, "TTS: '%s' stopped reading\n", tts->command);
+            local_stop(tts);
+            return;
+        }
+    }
+}
+#endif
+
+#ifdef NAGI_LLM_HAS_CLOUD_API
+static size_t cloud_write(void *contents, size_t size, size_t nmemb, void *userp)
+{
+    tts_bytes_t *bytes = (tts_bytes_t *)userp;
+
+    /* Anything short of the full size aborts the transfer */
+    if (!tts_push_bytes(bytes, (const unsigned char *)contents, size * nmemb)) return 0;
+    return size * nmemb;
+}
+
+/* Append str as it is, 0 if it doesn't fit */
+static int text_append(char *buf, int *len, int size, const char *str)
+{
+    int n = (int)strlen(str);
+
+    if (*len + n >= size) return 0;
+    memcpy(buf + *len, str, (size_t)n + 1);
+    *len += n;
+    return 1;
+}
+
+/* Append str escaped for a JSON string, 0 if it doesn't fit */
+static int json_append(char *buf, int *len, int size, const char *str)
+{
+    char esc[8];
+    const char *add;
+    int n;
+
+    for (; *str; str++) {
+        if (*str == '"' || *str == '\\') {
+            esc[0] = '\\';
+            esc[1] = *str;
+            esc[2] = '\0';
+            add = esc;
+        } else if ((unsigned char)*str < 0x20) {
+            snprintf(esc, sizeof(esc), "\\u%04x", (unsigned char)*str);
+            add = esc;
+        } else {
+            esc[0] = *str;
+            esc[1] = '\0';
+            add = esc;
+        }
+        n = (int)strlen(add);
+        if (*len + n >= size) return 0;
+        memcpy(buf + *len, add, (size_t)n);
+        *len += n;
+    }
+    buf[*len] = '\0';
+    return 1;
+}
+
+static void cloud_speak(nagi_tts_t *tts, const char *line, unsigned gen)
+{
+    char body[NAGI_TTS_TEXT_MAX * 2 + 512];
+    tts_bytes_t bytes;
+    CURLcode res;
+    int len = 0;
+
+    if (!tts->curl) return;
+
+    if (!text_append(body, &len, sizeof(body), "{\"model\":\"") ||
+        !json_append(body, &len, sizeof(body), tts->model) ||
+        !text_append(body, &len, sizeof(body), "\",\"voice\":\"") ||
+        !json_append(body, &len, sizeof(body), tts->voice) ||
+        !text_append(body, &len, sizeof(body), "\",\"input\":\"") ||
+        !json_append(body, &len, sizeof(body), line) ||
+        !text_append(body, &len, sizeof(body), "\",\"response_format\":\"pcm\"}")) {
+        return;
+    }
+
+    memset(&bytes, 0, sizeof(bytes));
+    bytes.tts = tts;
+    bytes.gen = gen;
+
+    curl_easy_setopt(tts->curl, CURLOPT_URL, tts->url);
+    curl_easy_setopt(tts->curl, CURLOPT_HTTPHEADER, tts->headers);
+    curl_easy_setopt(tts->curl, CURLOPT_POSTFIELDS, body);
+    curl_easy_setopt(tts->curl, CURLOPT_POSTFIELDSIZE, (long)len);
+    curl_easy_setopt(tts->curl, CURLOPT_WRITEFUNCTION, cloud_write);
+    curl_easy_setopt(tts->curl, CURLOPT_WRITEDATA, &bytes);
+    res = curl_easy_perform(tts->curl);
+    if (res != CURLE_OK && res != CURLE_WRITE_ERROR) {
+        fprintf(stderr, "TTS: %s\n", curl_easy_strerror(res));
+    }
+}
+#endif
+
+static void *tts_worker(void *arg)
+{
+    nagi_tts_t *tts = (nagi_tts_t *)arg;
+    char line[NAGI_TTS_TEXT_MAX + 1];
+    char *end;
+    unsigned gen;
+    int len;
+
+    llm_mutex_lock(&tts->lock);
+    while (!tts->quit) {
+#ifdef NAGI_TTS_HAS_LOCAL
+        if (tts->local_restart) {
+            tts->local_restart = 0;
+            llm_mutex_unlock(&tts->lock);
+            local_stop(tts);
+            llm_mutex_lock(&tts->lock);
+            continue;
+        }
+#endif
+        if (tts->text_len == 0) {
+            llm_cond_wait(&tts->wake, &tts->lock);
+            continue;
+        }
+
+        /* The oldest sentence, with its '\n' */
+        end = (char *)memchr(tts->text, '\n', (size_t)tts->text_len);
+        len = end ? (int)(end - tts->text) + 1 : tts->text_len;
+        memcpy(line, tts->text, (size_t)len);
+        line[len] = '\0';
+        tts->text_len -= len;
+        memmove(tts->text, tts->text + len, (size_t)tts->text_len);
+        gen = tts->gen;
+        llm_mutex_unlock(&tts->lock);
+
+#ifdef NAGI_TTS_HAS_LOCAL
+        if (tts->command[0]) {
+            local_speak(tts, line, len);
+        }
+#endif
+#ifdef NAGI_LLM_HAS_CLOUD_API
+        if (!tts->command[0]) {
+            line[len - 1] = '\0';
+            cloud_speak(tts, line, gen);
+        }
+#endif
+        (void)gen;
+
+        llm_mutex_lock(&tts->lock);
+    }
+    llm_mutex_unlock(&tts->lock);
+    return NULL;
+}
+
+nagi_tts_t *nagi_tts_create(const nagi_llm_config_t *config)
+{
+    nagi_tts_t *tts;
+    int local = 0, cloud = 0;
+
+    if (!config) return NULL;
+#ifdef NAGI_TTS_HAS_LOCAL
+    local = config->tts_command[0] != '\0';
+#endif
+#ifdef NAGI_LLM_HAS_CLOUD_API
+    cloud = !local && config->tts_url[0] != '\0';
+#endif
+    if (!local && !cloud) {
+        if (config->tts_command[0] || config->tts_url[0]) {
+            fprintf(stderr, "TTS: %s not available in this build\n",
+                    config->tts_command[0] ? "command" : "tts_url");
+        }
+        return NULL;
+    }
+
+    tts = (nagi_tts_t *)calloc(1, sizeof(nagi_tts_t));
+    if (!tts) return NULL;
+    tts->ring = (short *)malloc(NAGI_TTS_RING * sizeof(short));
+    if (!tts->ring) {
+        free(tts);
+        return NULL;
+    }
+
+    strncpy(tts->command, config->tts_command, sizeof(tts->command) - 1);
+    strncpy(tts->url, config->tts_url, sizeof(tts->url) - 1);
+    strncpy(tts->api_key, config->tts_api_key, sizeof(tts->api_key) - 1);
+    strncpy(tts->model, config->tts_model[0] ? config->tts_model : "tts-1", sizeof(tts->model) - 1);
+    strncpy(tts->voice, config->tts_voice[0] ? config->tts_voice : "alloy", sizeof(tts->voice) - 1);
+    tts->rate = config->tts_sample_rate;
+    if (tts->rate <= 0) {
+        tts->rate = local ? NAGI_TTS_LOCAL_RATE : NAGI_TTS_CLOUD_RATE;
+    }
+
+#ifdef NAGI_LLM_HAS_CLOUD_API
+    if (cloud) {
+        char auth[300];
+        const char *key = tts->api_key[0] ? tts->api_key : getenv("OPENAI_API_KEY");
+
+        tts->curl = curl_easy_init();
+        tts->headers = curl_slist_append(NULL, "Content-Type: application/json");
+        if (key && key[0]) {
+            snprintf(auth, sizeof(auth), "Authorization: Bearer %s", key);
+            tts->headers = curl_slist_append(tts->headers, auth);
+        }
+        if (!tts->curl) {
+            curl_slist_free_all(tts->headers);
+            free(tts->ring);
+            free(tts);
+            return NULL;
+        }
+    }
+#endif
+
+    llm_mutex_init(&tts->lock);
+    llm_cond_init(&tts->wake);
+    if (!llm_thread_create(&tts->thread, tts_worker, tts)) {
+        tts->quit = 1;
+        nagi_tts_destroy(tts);
+        return NULL;
+    }
+
+    if (config->verbose) {
+        llm_log(LLM_LOG_INFO, "TTS: %s at %d Hz\n", local ? tts->command : tts->url, tts->rate);
+    }
+    return tts;
+}
+
+void nagi_tts_destroy(nagi_tts_t *tts)
+{
+    int running;
+
+    if (!tts) return;
+
+    llm_mutex_lock(&tts->lock);
+    running = !tts->quit;
+    tts->quit = 1;
+    llm_cond_broadcast(&tts->wake);
+    llm_mutex_unlock(&tts->lock);
+    if (running) {
+        llm_thread_join(tts->thread);
+    }
+
+#ifdef NAGI_TTS_HAS_LOCAL
+    local_stop(tts);
+#endif
+#ifdef NAGI_LLM_HAS_CLOUD_API
+    if (tts->curl) curl_easy_cleanup(tts->curl);
+    curl_slist_free_all(tts->headers);
+#endif
+
+    llm_cond_destroy(&tts->wake);
+    llm_mutex_destroy(&tts->lock);
+    free(tts->ring);
+    free(tts);
+}
+
+int nagi_tts_sample_rate(nagi_tts_t *tts)
+{
+    return tts ? tts->rate : 0;
+}
+
+/* A sentence ends at . ! ? or a line break followed by a space (or
+   nothing, with final) and at the full-width marks straight away */
+int nagi_tts_sentences(const char *text, int len, int final)
+{
+    const unsigned char *s = (const unsigned char *)text;
+    int i, end = 0, clause = 0;
+
+    if (final) return len;
+
+    for (i = 0; i < len; i++) {
+        if (s[i] == '.' || s[i] == '!' || s[i] == '?' || s[i] == '\n') {
+            /* "..." and "?!" and a closing quote belong to it */
+            while (i + 1 < len && strchr(".!?\"')", s[i + 1])) i++;
+            if (i + 1 < len && isspace(s[i + 1])) end = i + 1;
+        } else if (i + 2 < len && s[i] == 0xE3 && s[i + 1] == 0x80 && s[i + 2] == 0x82) {
+            end = i + 3;                                    /* 。 */
+        } else if (i + 2 < len && s[i] == 0xEF && s[i + 1] == 0xBC &&
+                   (s[i + 2] == 0x81 || s[i + 2] == 0x9F)) {
+            end = i + 3;                                    /* ！ ？ */
+        } else if ((s[i] == ',' || s[i] == ';') && i + 1 < len && isspace(s[i + 1])) {
+            clause = i + 1;
+        }
+    }
+
+    /* Don't hold a long sentence back for its end */
+    if (len - end > NAGI_TTS_CLAUSE_MAX && clause > end) end = clause;
+    return end;
+}
+
+int nagi_tts_say(nagi_tts_t *tts, const char *text, int len)
+{
+    int i, ok = 0;
+
+    if (!tts || len <= 0) return 0;
+
+    /* Skip what's only spaces and punctuation */
+    for (i = 0; i < len; i++) {
+        if (isalnum((unsigned char)text[i]) || (unsigned char)text[i] >= 0x80) break;
+    }
+    if (i == len) return 1;
+
+    llm_mutex_lock(&tts->lock);
+    if (tts->text_len + len + 1 <= NAGI_TTS_TEXT_MAX) {
+        for (i = 0; i < len; i++) {
+            tts->text[tts->text_len++] = (text[i] == '\n' || text[i] == '\r') ? ' ' : text[i];
+        }
+        tts->text[tts->text_len++] = '\n';
+        llm_cond_broadcast(&tts->wake);
+        ok = 1;
+    }
+    llm_mutex_unlock(&tts->lock);
+    return ok;
+}
+
+void nagi_tts_flush(nagi_tts_t *tts)
+{
+    if (!tts) return;
+
+    llm_mutex_lock(&tts->lock);
+    tts->gen++;
+    tts->text_len = 0;
+    tts->ring_tail = tts->ring_head;
+#ifdef NAGI_TTS_HAS_LOCAL
+    if (tts->local_busy) {
+        tts->local_restart = 1;
+    }
+#endif
+    llm_cond_broadcast(&tts->wake);
+    llm_mutex_unlock(&tts->lock);
+}
+
+int nagi_tts_read(nagi_tts_t *tts, short *pcm, int max)
+{
+    int n, i;
+
+    if (!tts) return 0;
+
+    llm_mutex_lock(&tts->lock);
+    n = (int)(tts->ring_head - tts->ring_tail);
+    if (n > max) n = max;
+    for (i = 0; i < n; i++) {
+        pcm[i] = tts->ring[(tts->ring_tail + i) & (NAGI_TTS_RING - 1)];
+    }
+    tts->ring_tail += n;
+    if (n > 0) {
+        llm_cond_broadcast(&tts->wake);
+    }
+    llm_mutex_unlock(&tts->lock);
+    return n;
+}
@@ -0,0 +1,581 @@
+/*
+ * llm_tune.c - Per machine calibration of the llama.cpp backend
+ *
+ * nagi --tune-llm loads the model again for every setting tried and
+ * replays a short corpus through extraction and generation. One setting
+ * is varied at a time, from GPU offload down to the batch sizes, and the
+ * fastest choice for it is kept if it beats the current one by more than
+ * TUNE_GAIN. Noise between two loads of the same settings is about that.
+ *
+ * The result goes to llm_config.ini as a [llamacpp.auto] section headed by
+ * a hash of the CPU and GPU names. The config parser only reads a section
+ * whose hash matches the machine it runs on, so one config can carry the
+ * profiles of every machine it is copied to.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+#ifdef __APPLE__
+#include <sys/sysctl.h>
+#endif
+
+#include "../include/nagi_llm.h"
+#include "llm_thread.h"
+
+#define TUNE_GAIN 0.05                  /* Improvement a change has to make */
+#define TUNE_MAX_RECORDS 64             /* Of a corpus file, it only needs a few */
+#define TUNE_SECTION "llamacpp.auto"
+
+/* Settings varied, in the order they are tried */
+enum {
+    TUNE_GPU,
+    TUNE_FLASH_ATTN,
+    TUNE_KV,
+    TUNE_THREADS,
+    TUNE_BATCH,
+    TUNE_DIMS
+};
+
+static const char *tune_dim_names[TUNE_DIMS] = {
+    "gpu layers", "flash attention", "kv cache", "threads", "batch size"
+};
+
+/* 0 runs on the CPU, -1 offloads every layer, -2 what fits in video memory */
+static const int tune_gpu_layers[] = { 0, -1, -2, 8, 24 };
+static const int tune_threads[] = { 0, 2, 4, 6, 8, 12, 16, 24, 32 };
+static const int tune_batch[][2] = { { 512, 256 }, { 1024, 512 }, { 2048, 512 }, { 2048, 1024 } };
+static const nagi_llm_kv_type_t tune_kv[][2] = {
+    { NAGI_LLM_KV_F16, NAGI_LLM_KV_F16 },
+    { NAGI_LLM_KV_Q8_0, NAGI_LLM_KV_F16 },
+    { NAGI_LLM_KV_Q8_0, NAGI_LLM_KV_Q8_0 }
+};
+
+static const int tune_dim_count[TUNE_DIMS] = {
+    (int)(sizeof(tune_gpu_layers) / sizeof(tune_gpu_layers[0])),
+    2,
+    (int)(sizeof(tune_kv) / sizeof(tune_kv[0])),
+    (int)(sizeof(tune_threads) / sizeof(tune_threads[0])),
+    (int)(sizeof(tune_batch) / sizeof(tune_batch[0]))
+};
+
+/* Used when no corpus is given, a few turns of a typical game */
+static const char *tune_builtin[] = {
+    "> look around",
+    "< You are standing in front of a small castle. A moat surrounds it.",
+    "> open the door",
+    "< The door is locked.",
+    "> get the key from under the mat",
+    "< You take the key.",
+    "> unlock door with key",
+    "< The door swings open with a creak.",
+    "> go inside",
+    "> talk to the old man",
+    "< The old man ignores you.",
+    "> give him the bowl of soup",
+    "< He thanks you and tells you about a dragon in the cave to the north."
+};
+
+typedef struct {
+    char kind;                          /* '>' or '<' */
+    const char *text;
+} tune_record_t;
+
+typedef struct {
+    tune_record_t records[TUNE_MAX_RECORDS];
+    int count;
+    const char *model_path;
+    const unsigned char *dictionary;
+    size_t dict_size;
+} tune_run_t;
+
+static int cpu_count(void)
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+
+    GetSystemInfo(&info);
+    return (int)info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+#endif
+}
+
+/* Everything after the colon of a /proc style "key : value" line */
+static void proc_value(const char *line, char *out, size_t out_size)
+{
+    const char *colon = strchr(line, ':');
+
+    if (!colon || out_size == 0) return;
+    strncpy(out, colon + 1, out_size - 1);
+    out[out_size - 1] = '\0';
+    trim_whitespace(out);
+}
+
+static void cpu_name(char *name, size_t size)
+{
+#ifdef _WIN32
+    const char *id = getenv("PROCESSOR_IDENTIFIER");
+
+    strncpy(name, id ? id : "", size - 1);
+    name[size - 1] = '\0';
+#elif defined(__APPLE__)
+    size_t len = size;
+
+    if (sysctlbyname("machdep.cpu.brand_string", name, &len, NULL, 0) != 0) {
+        name[0] = '\0';
+    }
+    name[size - 1] = '\0';
+#else
+    char line[256];
+    FILE *f = fopen("/proc/cpuinfo", "r");
+
+    name[0] = '\0';
+    if (!f) return;
+    while (fgets(line, sizeof(line), f)) {
+        /* ARM kernels have no model name, the implementer and part say it */
+        if (strncmp(line, "model name", 10) == 0 || strncmp(line, "Hardware", 8) == 0) {
+            proc_value(line, name, size);
+            break;
+        }
+        if (strncmp(line, "CPU part", 8) == 0 && !name[0]) {
+            proc_value(line, name, size);
+        }
+    }
+    fclose(f);
+#endif
+}
+
+static void gpu_name(char *name, size_t size)
+{
+#ifdef _WIN32
+    DISPLAY_DEVICEA device;
+
+    name[0] = '\0';
+    memset(&device, 0, sizeof(device));
+    device.cb = sizeof(device);
+    if (EnumDisplayDevicesA(NULL, 0, &device, 0)) {
+        strncpy(name, device.DeviceString, size - 1);
+        name[size - 1] = '\0';
+    }
+#elif defined(__APPLE__)
+    /* The GPU comes with the chip, the CPU name already says which */
+    name[0] = '\0';
+    (void)size;
+#else
+    char vendor[32] = "", device[32] = "";
+    FILE *f;
+
+    name[0] = '\0';
+    f = fopen("/sys/class/drm/card0/device/vendor", "r");
+    if (f) {
+        if (!fgets(vendor, sizeof(vendor), f)) vendor[0] = '\0';
+        fclose(f);
+    }
+    f = fopen("/sys/class/drm/card0/device/device", "r");
+    if (f) {
+        if (!fgets(device, sizeof(device), f)) device[0] = '\0';
+        fclose(f);
+    }
+    trim_whitespace(vendor);
+    trim_whitespace(device);
+    if (vendor[0]) {
+        snprintf(name, size, "%s:%s", vendor, device);
+    }
+#endif
+}
+
+void nagi_llm_machine_fingerprint(char *id, size_t id_size, char *desc, size_t desc_size)
+{
+    char cpu[128], gpu[128], text[320];
+    unsigned long long hash = 14695981039346656037ULL;     /* FNV-1a */
+    const char *p;
+
+    cpu_name(cpu, sizeof(cpu));
+    gpu_name(gpu, sizeof(gpu));
+    snprintf(text, sizeof(text), "%s, %d threads, gpu %s",
+             cpu[0] ? cpu : "unknown cpu", cpu_count(), gpu[0] ? gpu : "none");
+
+    for (p = text; *p; p++) {
+        hash ^= (unsigned char)*p;
+        hash *= 1099511628211ULL;
+    }
+    if (id && id_size > 0) {
+        snprintf(id, id_size, "%016llx", hash);
+    }
+    if (desc && desc_size > 0) {
+        strncpy(desc, text, desc_size - 1);
+        desc[desc_size - 1] = '\0';
+    }
+}
+
+static const char *kv_name(nagi_llm_kv_type_t type)
+{
+    switch (type) {
+        case NAGI_LLM_KV_Q8_0: return "q8_0";
+        case NAGI_LLM_KV_Q4_0: return "q4_0";
+        default:               return "f16";
+    }
+}
+
+/*
+ * Change one setting to its i'th candidate
+ * Returns 0 if that candidate doesn't apply here
+ */
+static int tune_set(nagi_llm_config_t *config, int dim, int i, int n_cpus)
+{
+    switch (dim) {
+        case TUNE_GPU:
+            config->use_gpu = tune_gpu_layers[i] != 0;
+            config->n_gpu_layers = config->use_gpu ? tune_gpu_layers[i] : NAGI_LLM_DEFAULT_GPU_LAYERS;
+            return 1;
+        case TUNE_FLASH_ATTN:
+            config->flash_attn = i;
+            return 1;
+        case TUNE_KV:
+            /* A quantized V cache needs flash attention */
+            if (tune_kv[i][1] != NAGI_LLM_KV_F16 && !config->flash_attn) return 0;
+            config->kv_type_k = tune_kv[i][0];
+            config->kv_type_v = tune_kv[i][1];
+            return 1;
+        case TUNE_THREADS:
+            if (tune_threads[i] > n_cpus) return 0;
+            config->n_threads = tune_threads[i];
+            config->n_threads_batch = tune_threads[i];
+            return 1;
+        case TUNE_BATCH:
+            if (tune_batch[i][0] > config->context_size) return 0;
+            config->batch_size = tune_batch[i][0];
+            config->u_batch_size = tune_batch[i][1];
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int tune_same(const nagi_llm_config_t *a, const nagi_llm_config_t *b)
+{
+    return a->use_gpu == b->use_gpu && a->n_gpu_layers == b->n_gpu_layers &&
+           a->flash_attn == b->flash_attn &&
+           a->kv_type_k == b->kv_type_k && a->kv_type_v == b->kv_type_v &&
+           a->n_threads == b->n_threads && a->n_threads_batch == b->n_threads_batch &&
+           a->batch_size == b->batch_size && a->u_batch_size == b->u_batch_size;
+}
+
+static void tune_describe(const nagi_llm_config_t *config, char *out, size_t size)
+{
+    snprintf(out, size, "gpu %d/%d, flash %d, kv %s/%s, threads %d/%d, batch %d/%d",
+             config->use_gpu, config->n_gpu_layers, config->flash_attn,
+             kv_name(config->kv_type_k), kv_name(config->kv_type_v),
+             config->n_threads, config->n_threads_batch,
+             config->batch_size, config->u_batch_size);
+}
+
+/*
+ * Load the model with config and time a pass over the corpus, after one
+ * unmeasured pass. Returns mean extract plus mean generate ms, -1 if it
+ * failed to load
+ */
+static double tune_trial(const tune_run_t *run, const nagi_llm_config_t *config,
+                         double *extract_ms, double *generate_ms)
+{
+    char output[NAGI_LLM_MAX_RESPONSE_SIZE];
+    nagi_llm_config_t trial = *config;
+    nagi_llm_t *llm;
+    double total[2], start;
+    int count[2];
+    int pass, i, op;
+
+    /* Repeats would only measure the caches */
+    trial.translation_cache_kb = 0;
+    trial.extraction_memo_entries = 0;
+    trial.stats_file[0] = '\0';
+    trial.stats_overlay = 0;
+
+    llm = nagi_llm_create(NAGI_LLM_BACKEND_LLAMACPP);
+    if (!llm) return -1.0;
+    if (!nagi_llm_init(llm, run->model_path, &trial) ||
+        !nagi_llm_set_dictionary(llm, run->dictionary, run->dict_size)) {
+        nagi_llm_shutdown(llm);
+        nagi_llm_destroy(llm);
+        return -1.0;
+    }
+
+    for (pass = 0; pass < 2; pass++) {
+        const char *input = "";
+
+        total[0] = total[1] = 0.0;
+        count[0] = count[1] = 0;
+        for (i = 0; i < run->count; i++) {
+            const tune_record_t *rec = &run->records[i];
+
+            start = llm_time_ms();
+            if (rec->kind == '>') {
+                input = rec->text;
+                nagi_llm_extract_words(llm, input, output, sizeof(output));
+                op = 0;
+            } else {
+                nagi_llm_generate_response(llm, rec->text, input, output, sizeof(output));
+                op = 1;
+            }
+            total[op] += llm_time_ms() - start;
+            count[op]++;
+        }
+    }
+
+    nagi_llm_shutdown(llm);
+    nagi_llm_destroy(llm);
+
+    *extract_ms = count[0] ? total[0] / count[0] : 0.0;
+    *generate_ms = count[1] ? total[1] / count[1] : 0.0;
+    return *extract_ms + *generate_ms;
+}
+
+/*
+ * Take the '>' and '<' records of a nagi-llm-bench corpus, in place
+ * Returns the data to free, NULL if it couldn't be read
+ */
+static char *tune_load_corpus(tune_run_t *run, const char *path)
+{
+    FILE *f;
+    char *data, *line;
+    long len;
+
+    f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Tune: Could not open %s\n", path);
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    data = len >= 0 ? (char *)malloc((size_t)len + 1) : NULL;
+    if (data && fread(data, 1, (size_t)len, f) != (size_t)len) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+    if (!data) {
+        fprintf(stderr, "Tune: Could not read %s\n", path);
+        return NULL;
+    }
+    data[len] = '\0';
+
+    for (line = data; line && *line && run->count < TUNE_MAX_RECORDS; ) {
+        char *next = strchr(line, '\n');
+        char kind;
+
+        if (next) *next++ = '\0';
+        trim_whitespace(line);
+        kind = *line;
+        if (kind == '>' || kind == '<') {
+            line++;
+            while (isspace((unsigned char)*line)) line++;
+            if (*line) {
+                run->records[run->count].kind = kind;
+                run->records[run->count].text = line;
+                run->count++;
+            }
+        }
+        line = next;
+    }
+    return data;
+}
+
+/*
+ * Name of the section a line starts
+ * Returns 0 if it isn't a section header
+ */
+static int section_name(const char *line, char *name, size_t size)
+{
+    const char *end;
+    size_t len;
+
+    while (isspace((unsigned char)*line)) line++;
+    if (*line != '[') return 0;
+    end = strchr(line, ']');
+    if (!end) return 0;
+    len = (size_t)(end - line - 1);
+    if (len >= size) len = size - 1;
+    memcpy(name, line + 1, len);
+    name[len] = '\0';
+    trim_whitespace(name);
+    return 1;
+}
+
+/*
+ * Write the profile to the end of the config, dropping an older one for
+ * the same machine. Goes through a temporary file so a failed write
+ * leaves the old config
+ */
+static int tune_save(const char *path, const char *id, const char *desc,
+                     const nagi_llm_config_t *config, double extract_ms, double generate_ms)
+{
+    char tmp_path[1024];
+    char line[1024], key[128], value[512], name[64];
+    char held[4096];                    /* A profile's lines until its fingerprint */
+    size_t held_len = 0;
+    int holding = 0, skip = 0;
+    FILE *in, *out;
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    out = fopen(tmp_path, "w");
+    if (!out) {
+        fprintf(stderr, "Tune: Could not write %s\n", tmp_path);
+        return 0;
+    }
+
+    in = fopen(path, "r");
+    while (in && fgets(line, sizeof(line), in)) {
+        size_t len = strlen(line);
+
+        if (section_name(line, name, sizeof(name))) {
+            if (holding) fwrite(held, 1, held_len, out);
+            holding = strcmp(name, TUNE_SECTION) == 0;
+            held_len = 0;
+            skip = 0;
+        } else if (holding && parse_config_line(line, key, value, sizeof(key))) {
+            /* The first key says which machine it was measured on */
+            holding = 0;
+            skip = strcmp(key, "fingerprint") == 0 && strcmp(value, id) == 0;
+            if (!skip) fwrite(held, 1, held_len, out);
+        }
+
+        if (holding && held_len + len <= sizeof(held)) {
+            memcpy(held + held_len, line, len);
+            held_len += len;
+        } else if (holding) {
+            /* Too long to be one of ours */
+            fwrite(held, 1, held_len, out);
+            fputs(line, out);
+            holding = 0;
+        } else if (!skip) {
+            fputs(line, out);
+        }
+    }
+    if (holding) fwrite(held, 1, held_len, out);
+    if (in) fclose(in);
+
+    fprintf(out, "\n[%s]\n", TUNE_SECTION);
+    fprintf(out, "fingerprint = %s\n", id);
+    fprintf(out, "# %s\n", desc);
+    fprintf(out, "# nagi --tune-llm: extract %.0f ms, generate %.0f ms\n", extract_ms, generate_ms);
+    fprintf(out, "use_gpu = %d\n", config->use_gpu);
+    fprintf(out, "n_gpu_layers = %d\n", config->n_gpu_layers);
+    fprintf(out, "flash_attn = %d\n", config->flash_attn);
+    fprintf(out, "kv_type_k = %s\n", kv_name(config->kv_type_k));
+    fprintf(out, "kv_type_v = %s\n", kv_name(config->kv_type_v));
+    fprintf(out, "n_threads = %d\n", config->n_threads);
+    fprintf(out, "n_threads_batch = %d\n", config->n_threads_batch);
+    fprintf(out, "batch_size = %d\n", config->batch_size);
+    fprintf(out, "u_batch_size = %d\n", config->u_batch_size);
+
+    if (fclose(out) != 0) {
+        remove(tmp_path);
+        fprintf(stderr, "Tune: Could not write %s\n", tmp_path);
+        return 0;
+    }
+    /* rename() won't replace a file on Windows */
+    remove(path);
+    if (rename(tmp_path, path) != 0) {
+        fprintf(stderr, "Tune: Could not replace %s, the profile is in %s\n", path, tmp_path);
+        return 0;
+    }
+    return 1;
+}
+
+int nagi_llm_tune(const char *config_file, const char *model_path,
+                  const unsigned char *dictionary, size_t dict_size,
+                  const char *corpus_path)
+{
+    tune_run_t run;
+    nagi_llm_config_t best, dim_best, candidate;
+    char id[NAGI_LLM_FINGERPRINT_SIZE], desc[320], text[160];
+    char *corpus = NULL;
+    double best_ms, best_extract, best_generate;
+    double dim_ms, dim_extract = 0.0, dim_generate = 0.0;
+    double ms, extract_ms, generate_ms;
+    int n_cpus, dim, i, ok;
+
+    if (!config_file) config_file = "llm_config.ini";
+
+    memset(&run, 0, sizeof(run));
+    run.model_path = model_path;
+    run.dictionary = dictionary;
+    run.dict_size = dict_size;
+    if (corpus_path) {
+        corpus = tune_load_corpus(&run, corpus_path);
+        if (!corpus) return 0;
+    }
+    if (run.count == 0) {
+        for (i = 0; i < (int)(sizeof(tune_builtin) / sizeof(tune_builtin[0])); i++) {
+            run.records[i].kind = tune_builtin[i][0];
+            run.records[i].text = tune_builtin[i] + 2;
+        }
+        run.count = i;
+    }
+
+    /* A profile saved before for this machine is the starting point */
+    nagi_llm_load_config(&best, NAGI_LLM_BACKEND_LLAMACPP, config_file);
+    best.verbose = 0;
+    nagi_llm_machine_fingerprint(id, sizeof(id), desc, sizeof(desc));
+    n_cpus = cpu_count();
+    printf("Tune: %s (%s), %d records\n", desc, id, run.count);
+
+    best_ms = tune_trial(&run, &best, &best_extract, &best_generate);
+    if (best_ms < 0.0) {
+        fprintf(stderr, "Tune: The model failed to load with the current settings\n");
+        free(corpus);
+        return 0;
+    }
+    tune_describe(&best, text, sizeof(text));
+    printf("Tune: %-60s %8.1f ms\n", text, best_ms);
+
+    for (dim = 0; dim < TUNE_DIMS; dim++) {
+        dim_best = best;
+        dim_ms = best_ms;
+        for (i = 0; i < tune_dim_count[dim]; i++) {
+            candidate = best;
+            if (!tune_set(&candidate, dim, i, n_cpus) || tune_same(&candidate, &best)) continue;
+
+            ms = tune_trial(&run, &candidate, &extract_ms, &generate_ms);
+            tune_describe(&candidate, text, sizeof(text));
+            if (ms < 0.0) {
+                printf("Tune: %-60s   failed\n", text);
+                continue;
+            }
+            printf("Tune: %-60s %8.1f ms\n", text, ms);
+            if (ms < dim_ms) {
+                dim_best = candidate;
+                dim_ms = ms;
+                dim_extract = extract_ms;
+                dim_generate = generate_ms;
+            }
+        }
+        if (dim_ms < best_ms * (1.0 - TUNE_GAIN)) {
+            best = dim_best;
+            best_ms = dim_ms;
+            best_extract = dim_extract;
+            best_generate = dim_generate;
+            printf("Tune: Keeping the %s change\n", tune_dim_names[dim]);
+        }
+    }
+
+    tune_describe(&best, text, sizeof(text));
+    printf("Tune: Best %s, extract %.0f ms, generate %.0f ms\n", text, best_extract, best_generate);
+    ok = tune_save(config_file, id, desc, &best, best_extract, best_generate);
+    if (ok) {
+        printf("Tune: Saved to [%s] in %s\n", TUNE_SECTION, config_file);
+    }
+
+    free(corpus);
+    return ok;
+}
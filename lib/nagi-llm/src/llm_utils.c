@@ -7,206 +7,177 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <limits.h>
 #include "../include/nagi_llm.h"
 #include "../include/llm_utils.h"
 #include "../include/nagi_llm_context.h"
 
-/* Endian conversion function (big-endian to host) */
-static u16 load_be_16(const u8 *ptr) {
-    return (u16)((ptr[0] << 8) | ptr[1]);
-}
-
 /*
- * Get word string from word ID
- *
- * Searches through the WORDS.TOK data structure to find the string
- * corresponding to a given word ID.
- *
- * WORDS.TOK format (Sierra AGI compression):
- * - First 52 bytes: 26 big-endian 16-bit offsets (one per letter A-Z)
- * - Each word starts with:
- *   1. Prefix count byte (how many chars shared with previous word)
- *   2. Encoded characters where:
- *      - Bits 0-6: character XOR 0x7F
- *      - Bit 7 (0x80): set if this is the last character
- *   3. 16-bit big-endian word ID
- * - Each letter section ends with a 0 byte
- *
- * Returns: pointer to static buffer with decoded word, or NULL if not found
+ * Extract common verbs from the game dictionary
+ * Returns the instance's comma-separated verb list (e.g., "look, get, open, close")
+ * Extracts first 40-50 words which are typically verbs in AGI games, or
+ * the room's words when nagi_llm_set_vocabulary gave some
  */
-const char *get_word_string(nagi_llm_t *llm, int word_id)
+const char *extract_game_verbs(nagi_llm_t *llm)
 {
-    llm_state_t *state = llm->state;
-    static char buffer[64];
+    char *verb_list = llm->verb_list;
+    const char *word;
+    int verb_count;
+    int max_verbs;
     int i;
 
-    if (!state || !state->dictionary_data) {
-        return NULL;
+    if (llm->vocabulary[0] != '\0') {
+        return llm->vocabulary;
     }
 
-    /* Iterate through all 26 letter offsets (A-Z) */
-    for (i = 0; i < 26; i++) {
-        u16 offset = load_be_16(state->dictionary_data + i * 2);
-        if (offset == 0) continue;
-
-        const u8 *ptr;
-        int words_in_section;
-        int len;
-        
-        ptr = state->dictionary_data + offset;
-        buffer[0] = '\0';
-        words_in_section = 0;
-        
-        while (1) {
-            u8 prefix_count = *ptr;
-            if (words_in_section > 0 && prefix_count == 0) {
-                break;
-            }
-
-            ptr++;
-            words_in_section++;
-            len = prefix_count;
-
-            /* Decode characters */
-            while (1) {
-                u8 byte = *ptr;
-                char decoded_char = (byte & 0x7F) ^ 0x7F;
-
-                if (len < (int)sizeof(buffer) - 1) {
-                    buffer[len++] = decoded_char;
-                } else {
-                    /* Word too long - shouldn't happen with valid data */
-                    if (llm->config.verbose) {
-                        fprintf(stderr, "LLM: Word too long in dictionary\n");
-                    }
-                    break;
-                }
-
-                if (byte & 0x80) {
-                    ptr++;
-                    break;
-                }
-                ptr++;
-            }
+    /* Only extract once per dictionary */
+    if (llm->verbs_source && llm->verbs_source == llm->dictionary) {
+        return verb_list;
+    }
 
-            buffer[len] = '\0';
+    /* Verify that words.tok data is loaded */
+    if (!llm->dictionary) {
+        fprintf(stderr, "LLM: dictionary_data not loaded, cannot extract verbs\n");
+        return NULL;
+    }
 
-            /* Read word ID */
-            u16 id;
-            
-            id = load_be_16(ptr);
+    verb_list[0] = '\0';
+    verb_count = 0;
+    max_verbs = 50;  /* First ~50 words are usually verbs in AGI */
 
-            if (id == (u16)word_id) {
-                if (llm->config.verbose) {
-                    printf("LLM: Found word_id %d -> \"%s\"\n", word_id, buffer);
-                }
-                return buffer;
+    for (i = 0; verb_count < max_verbs && (word = llm_dict_word_at(llm, i, NULL)) != NULL; i++) {
+        /* Add to verb list if there's space */
+        if (word[0] != '\0') {
+            if (verb_list[0] != '\0') {
+                strncat(verb_list, ", ", sizeof(llm->verb_list) - strlen(verb_list) - 1);
             }
-
-            ptr += 2;
+            strncat(verb_list, word, sizeof(llm->verb_list) - strlen(verb_list) - 1);
+            verb_count++;
         }
     }
 
-    /* Word ID not found */
+    llm->verbs_source = llm->dictionary;
+
     if (llm->config.verbose) {
-        fprintf(stderr, "LLM: word_id %d not found in dictionary\n", word_id);
+        printf("LLM: Extracted %d verbs from dictionary: %s\n", verb_count, verb_list);
     }
-    return NULL;
+
+    return verb_list;
+}
+
+/* Append to a growing grammar buffer, returns 0 if out of memory */
+static int grammar_append(char **buf, size_t *len, size_t *cap, const char *str, size_t n)
+{
+    if (*len + n + 1 > *cap) {
+        size_t new_cap = *cap ? *cap * 2 : 4096;
+        char *new_buf;
+
+        while (*len + n + 1 > new_cap) new_cap *= 2;
+        new_buf = (char *)realloc(*buf, new_cap);
+        if (!new_buf) return 0;
+        *buf = new_buf;
+        *cap = new_cap;
+    }
+    memcpy(*buf + *len, str, n);
+    *len += n;
+    (*buf)[*len] = '\0';
+    return 1;
 }
 
 /*
- * Extract common verbs from the game dictionary
- * Returns a static buffer with comma-separated verb list (e.g., "look, get, open, close")
- * Extracts first 40-50 words which are typically verbs in AGI games
+ * Build a GBNF grammar from the game dictionary
+ *
+ * Every word with a real word ID becomes an alternative of "word", so the
+ * model can only answer with words parse() will recognise:
+ *   root ::= word (" " word)? (" " word)?
+ *   word ::= "look" | "get" | ...
+ * Words with ID 0 (ignored words like "the") and 9999 (rest of line) are left out.
+ *
+ * Returns: malloc'd grammar string, or NULL if no words were found
  */
-const char *extract_game_verbs(nagi_llm_t *llm)
+char *build_dictionary_grammar(nagi_llm_t *llm)
 {
-    llm_state_t *state = llm->state;
-    static char verb_list[512];
-    static int verbs_extracted = 0;
-
-    /* Only extract once */
-    if (verbs_extracted) {
-        return verb_list;
+    static const char header[] =
+        "root ::= word (\" \" word)? (\" \" word)?\n"
+        "word ::= ";
+    char *grammar = NULL;
+    size_t len = 0, cap = 0;
+    const char *word;
+    int word_count = 0;
+    int word_id;
+    int i, k;
+
+    if (!llm->dictionary) {
+        return NULL;
     }
 
-    /* Verify that words.tok data is loaded */
-    if (!state->dictionary_data) {
-        fprintf(stderr, "LLM: dictionary_data not loaded, cannot extract verbs\n");
+    if (!grammar_append(&grammar, &len, &cap, header, sizeof(header) - 1)) {
         return NULL;
     }
 
-    verb_list[0] = '\0';
-    int verb_count;
-    int max_verbs;
-    int i;
-    
-    verb_count = 0;
-    max_verbs = 50;  /* First ~50 words are usually verbs in AGI */
+    for (i = 0; (word = llm_dict_word_at(llm, i, &word_id)) != NULL; i++) {
+        if (word_id == 0 || word_id == 9999 || word[0] == '\0') continue;
 
-    /* Iterate through all 26 letter offsets (A-Z) */
-    for (i = 0; i < 26 && verb_count < max_verbs; i++) {
-        u16 offset = load_be_16(state->dictionary_data + i * 2);
-        const u8 *ptr;
-        char buffer[64];
-        int words_in_section;
-        int len;
-        
-        if (offset == 0) continue;
-
-        ptr = state->dictionary_data + offset;
-        buffer[0] = '\0';
-        words_in_section = 0;
-        
-        while (verb_count < max_verbs) {
-            u8 prefix_count = *ptr;
-
-            /* End of section */
-            if (words_in_section > 0 && prefix_count == 0) {
-                break;
-            }
+        /* One quoted alternative per word, escaping GBNF specials */
+        if (word_count > 0 && !grammar_append(&grammar, &len, &cap, " | ", 3)) goto oom;
+        if (!grammar_append(&grammar, &len, &cap, "\"", 1)) goto oom;
+        for (k = 0; word[k]; k++) {
+            if ((word[k] == '"' || word[k] == '\\') &&
+                !grammar_append(&grammar, &len, &cap, "\\", 1)) goto oom;
+            if (!grammar_append(&grammar, &len, &cap, word + k, 1)) goto oom;
+        }
+        if (!grammar_append(&grammar, &len, &cap, "\"", 1)) goto oom;
+        word_count++;
+    }
 
-            ptr++;
-            words_in_section++;
-            len = prefix_count;
+    if (word_count == 0 || !grammar_append(&grammar, &len, &cap, "\n", 1)) {
+        free(grammar);
+        return NULL;
+    }
 
-            /* Decode characters */
-            while (1) {
-                u8 byte = *ptr;
-                char decoded_char = (byte & 0x7F) ^ 0x7F;
+    if (llm->config.verbose) {
+        printf("LLM: Built extraction grammar with %d words (%zu bytes)\n", word_count, len);
+    }
 
-                if (len < (int)sizeof(buffer) - 1) {
-                    buffer[len++] = decoded_char;
-                }
+    return grammar;
 
-                if (byte & 0x80) {
-                    ptr++;
-                    break;
-                }
-                ptr++;
-            }
+oom:
+    free(grammar);
+    return NULL;
+}
 
-            buffer[len] = '\0';
+/*
+ * Pass newly generated text to a streaming callback
+ * Only the first non-blank line is streamed; *emitted is set to len once
+ * that line is complete so later text is ignored.
+ */
+int llm_stream_emit(const char *text, int len, int *emitted,
+                    nagi_llm_token_cb_t on_token, void *userdata)
+{
+    int start, end;
 
-            /* Read word ID and skip it */
-            ptr += 2;
+    if (!on_token || *emitted >= len) return 1;
 
-            /* Add to verb list if there's space */
-            if (strlen(buffer) > 0) {
-                if (verb_list[0] != '\0') {
-                    strncat(verb_list, ", ", sizeof(verb_list) - strlen(verb_list) - 1);
-                }
-                strncat(verb_list, buffer, sizeof(verb_list) - strlen(verb_list) - 1);
-                verb_count++;
-            }
+    /* Skip whitespace before the first visible character */
+    start = *emitted;
+    if (start == 0) {
+        while (start < len && (text[start] == ' ' || text[start] == '\n' ||
+                               text[start] == '\r' || text[start] == '\t')) {
+            start++;
         }
+        if (start == len) return 1;
     }
 
-    verbs_extracted = 1;
-
-    if (llm->config.verbose) {
-        printf("LLM: Extracted %d verbs from dictionary: %s\n", verb_count, verb_list);
+    end = start;
+    while (end < len && text[end] != '\n' && text[end] != '\r') {
+        end++;
     }
 
-    return verb_list;
+    /* First line complete, nothing else gets streamed */
+    *emitted = (end < len) ? INT_MAX : end;
+
+    if (end > start) {
+        return on_token(text + start, end - start, userdata) != 0;
+    }
+    return 1;
 }
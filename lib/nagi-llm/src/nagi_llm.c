@@ -10,6 +10,8 @@
 #include <time.h>
 #include <stdint.h>
 #include "../include/llm_utils.h"
+#include "../include/llm_log.h"
+#include "llm_thread.h"
 
 /* Forward declarations for backend constructors */
 #ifdef NAGI_LLM_HAS_LLAMACPP
@@ -24,6 +26,35 @@ nagi_llm_t *nagi_llm_bitnet_create(void);
 nagi_llm_t *nagi_llm_cloud_create(void);
 #endif
 
+#ifdef NAGI_LLM_HAS_ROUTER
+nagi_llm_t *nagi_llm_router_create(void);
+#endif
+
+#ifdef NAGI_LLM_HAS_SERVER
+nagi_llm_t *nagi_llm_client_create(void);
+#endif
+
+/* Worker thread hooks (nagi_llm_async.c) */
+void nagi_llm_async_stop(nagi_llm_t *llm);
+void nagi_llm_async_lock(nagi_llm_t *llm);
+void nagi_llm_async_unlock(nagi_llm_t *llm);
+
+/* Background loading hooks (nagi_llm_loader.c) */
+void nagi_llm_loader_stop(nagi_llm_t *llm);
+int nagi_llm_loader_defer_dictionary(nagi_llm_t *llm, const unsigned char *dictionary, size_t size,
+                                     char *grammar);
+int nagi_llm_loader_defer_language(nagi_llm_t *llm, const char *language);
+int nagi_llm_loader_defer_adapter(nagi_llm_t *llm, const char *path);
+
+/* Translation cache teardown (llm_cache.c) */
+void nagi_llm_cache_free(nagi_llm_t *llm);
+
+/* Dictionary teardown (llm_dict.c) */
+void llm_dict_free(nagi_llm_t *llm);
+
+/* Configuration file watch teardown (llm_config_parser.c) */
+void llm_config_watch_free(nagi_llm_t *llm);
+
 /* Common error setter */
 void set_error(llm_state_t *state, const char *fmt, ...)
 {
@@ -65,11 +96,27 @@ nagi_llm_t *nagi_llm_create(nagi_llm_backend_t backend)
             break;
 #endif
 
+#ifdef NAGI_LLM_HAS_ROUTER
+        case NAGI_LLM_BACKEND_ROUTER:
+            llm = nagi_llm_router_create();
+            break;
+#endif
+
+#ifdef NAGI_LLM_HAS_SERVER
+        case NAGI_LLM_BACKEND_SERVER:
+            llm = nagi_llm_client_create();
+            break;
+#endif
+
         default:
             /* Backend not available */
             return NULL;
     }
 
+    if (llm) {
+        llm->stats = llm_stats_create();
+    }
+
     return llm;
 }
 
@@ -83,6 +130,14 @@ void nagi_llm_destroy(nagi_llm_t *llm)
     }
 
     nagi_llm_shutdown(llm);
+    nagi_llm_cache_free(llm);
+    llm_dict_free(llm);
+    llm_synonyms_free(llm);
+    llm_memo_free(llm);
+    llm_embed_free(llm);
+    llm_stats_free(llm);
+    llm_remote_free(llm);
+    llm_config_watch_free(llm);
 
     /* Free the instance */
     free(llm);
@@ -104,7 +159,16 @@ int nagi_llm_init(nagi_llm_t *llm,
  * Shutdown the LLM parser
  */
 void nagi_llm_shutdown(nagi_llm_t *llm) {
-    if (!llm || !llm->shutdown) return;
+    if (!llm) return;
+    nagi_llm_loader_stop(llm);
+    nagi_llm_async_stop(llm);
+    if (llm->state) {
+        free(llm->state->extraction_grammar);
+        llm->state->extraction_grammar = NULL;
+    }
+    /* Embeddings belong to the model being unloaded */
+    llm_embed_free(llm);
+    if (!llm->shutdown) return;
     llm->shutdown(llm);
 }
 
@@ -112,23 +176,166 @@ void nagi_llm_shutdown(nagi_llm_t *llm) {
  * Check if LLM is initialized and ready
  */
 int nagi_llm_ready(nagi_llm_t *llm) {
-    llm_state_t *state = llm->state;
-    return state && state->initialized;
+    if (!llm) return 0;
+
+    /* The state belongs to the loader thread until the load is over */
+    if (llm->loader && nagi_llm_load_status(llm, NULL) != NAGI_LLM_LOAD_READY) return 0;
+    return llm->state && llm->state->initialized;
+}
+
+int nagi_llm_huge_pages_mb(nagi_llm_t *llm) {
+    if (!nagi_llm_ready(llm)) return 0;
+    return llm->state->huge_pages_mb;
+}
+
+/* Language names compared ignoring case */
+static int language_equal(const char *a, const char *b) {
+    int i;
+
+    for (i = 0; a[i] && b[i]; i++) {
+        if (tolower((unsigned char)a[i]) != tolower((unsigned char)b[i])) return 0;
+    }
+    return a[i] == b[i];
+}
+
+int nagi_llm_wants_response(nagi_llm_t *llm) {
+    const char *language;
+
+    if (!nagi_llm_ready(llm)) return 0;
+    if (llm->config.english_responses == NAGI_LLM_ENGLISH_ALWAYS) return 1;
+    if (llm->config.english_responses == NAGI_LLM_ENGLISH_CREATIVE &&
+        strcmp(llm->config.personality, DEFAULT_PERSONALITY) != 0) return 1;
+
+    /* Nothing detected yet is English too, that's what the game is in */
+    language = llm->state->detected_language;
+    if (language[0] == '\0') return 0;
+    return !language_equal(language, "english");
+}
+
+int nagi_llm_language_is(nagi_llm_t *llm, const char *language) {
+    if (!llm || !llm->state || !language || llm->state->detected_language[0] == '\0') return -1;
+    return language_equal(llm->state->detected_language, language);
+}
+
+/*
+ * Point the backend state at a dictionary and its extraction grammar
+ * Takes ownership of grammar. Also used by the loader thread.
+ */
+void llm_state_set_dictionary(llm_state_t *state, const unsigned char *dictionary, size_t size,
+                              char *grammar)
+{
+    state->dictionary_data = dictionary;
+    state->dictionary_size = size;
+
+    /* Verb list comes from the dictionary, so any cached prompt prefix is stale */
+    state->prefix_n_tokens = 0;
+
+    /* Extraction output is restricted to the dictionary words */
+    free(state->extraction_grammar);
+    state->extraction_grammar = grammar;
+    state->grammar_version++;
+}
+
+/*
+ * Whether a float setting was left as it was. Compared bit for bit, a
+ * setting read back from the same text comes out the same
+ */
+static int config_float_same(float a, float b) {
+    return memcmp(&a, &b, sizeof(a)) == 0;
+}
+
+/*
+ * Apply the settings that take effect without loading the model again
+ */
+int nagi_llm_apply_config(nagi_llm_t *llm, const nagi_llm_config_t *config) {
+    nagi_llm_config_t *cur;
+    int sampling, personality;
+
+    if (!config || !nagi_llm_ready(llm)) return 0;
+    cur = &llm->config;
+
+    sampling = !config_float_same(cur->temperature, config->temperature) ||
+               !config_float_same(cur->temperature_creative_base, config->temperature_creative_base) ||
+               !config_float_same(cur->temperature_creative_offset, config->temperature_creative_offset) ||
+               cur->top_k != config->top_k || !config_float_same(cur->top_p, config->top_p);
+    personality = strcmp(cur->personality, config->personality) != 0;
+
+    if (!sampling && !personality && cur->max_tokens == config->max_tokens &&
+        strcmp(cur->stop_strings, config->stop_strings) == 0 &&
+        cur->response_deadline_ms == config->response_deadline_ms &&
+        cur->mode == config->mode && cur->hybrid_slo_ms == config->hybrid_slo_ms &&
+        config_float_same(cur->match_threshold, config->match_threshold) &&
+        config_float_same(cur->embedding_match_high, config->embedding_match_high) &&
+        config_float_same(cur->embedding_match_low, config->embedding_match_low) &&
+        cur->background_duty == config->background_duty && cur->verbose == config->verbose) {
+        return 0;
+    }
+
+    /* The worker reads these while it runs a request */
+    nagi_llm_async_lock(llm);
+    cur->temperature = config->temperature;
+    cur->temperature_creative_base = config->temperature_creative_base;
+    cur->temperature_creative_offset = config->temperature_creative_offset;
+    cur->top_k = config->top_k;
+    cur->top_p = config->top_p;
+    cur->max_tokens = config->max_tokens;
+    memcpy(cur->personality, config->personality, sizeof(cur->personality));
+    memcpy(cur->stop_strings, config->stop_strings, sizeof(cur->stop_strings));
+    cur->response_deadline_ms = config->response_deadline_ms;
+    cur->mode = config->mode;
+    cur->hybrid_slo_ms = config->hybrid_slo_ms;
+    cur->match_threshold = config->match_threshold;
+    cur->embedding_match_high = config->embedding_match_high;
+    cur->embedding_match_low = config->embedding_match_low;
+    cur->background_duty = config->background_duty;
+    cur->verbose = config->verbose;
+
+    if (sampling && llm->reconfigure) {
+        llm->reconfigure(llm);
+    }
+    nagi_llm_async_unlock(llm);
+
+    /* Translations are keyed by personality, the old ones can't be hit again */
+    if (personality) {
+        nagi_llm_cache_clear(llm);
+    }
+
+    if (llm->config.verbose) {
+        llm_log(LLM_LOG_DEBUG, "LLM: Settings applied%s%s\n", sampling ? ", samplers rebuilt" : "",
+                               personality ? ", translations of the old personality dropped" : "");
+    }
+    return 1;
 }
 
 /*
  * Set dictionary
  */
 int nagi_llm_set_dictionary(nagi_llm_t *llm, const unsigned char *dictionary, size_t size) {
-    llm_state_t *state = llm->state;
+    char *grammar;
 
-    if (!state) {
-        fprintf(stderr, "LLM Parser: Cannot set dictionary - not initialized\n");
-        return 0;
+    if (!llm) return 0;
+
+    /* The worker may be resolving word IDs, swap the tables under its lock */
+    nagi_llm_async_lock(llm);
+
+    /* The lookup tables don't need the model, so the classic parser gets them now */
+    llm_dict_build(llm, dictionary, size);
+    llm->vocabulary[0] = '\0';
+    llm_synonyms_free(llm);
+    llm_embed_free(llm);
+    grammar = build_dictionary_grammar(llm);
+
+    if (!nagi_llm_loader_defer_dictionary(llm, dictionary, size, grammar)) {
+        if (!llm->state) {
+            nagi_llm_async_unlock(llm);
+            free(grammar);
+            fprintf(stderr, "LLM Parser: Cannot set dictionary - not initialized\n");
+            return 0;
+        }
+        llm_state_set_dictionary(llm->state, dictionary, size, grammar);
     }
 
-    state->dictionary_data = dictionary;
-    state->dictionary_size = size;
+    nagi_llm_async_unlock(llm);
 
     if (llm->config.verbose) {
         fprintf(stderr, "LLM Parser: Dictionary set (%zu bytes)\n", size);
@@ -137,23 +344,431 @@ int nagi_llm_set_dictionary(nagi_llm_t *llm, const unsigned char *dictionary, si
     return 1;
 }
 
+/*
+ * The game context the prompts are built from
+ */
+void nagi_llm_set_session(nagi_llm_t *llm, struct nagi_llm_session *session) {
+    if (!llm) return;
+    /* The worker may be building a prompt from the old one */
+    nagi_llm_async_lock(llm);
+    llm->session = session;
+    nagi_llm_async_unlock(llm);
+}
+
+/*
+ * Another game's context and language, under the call lock so the worker
+ * swapping in those of a request never sees half of them
+ */
+void nagi_llm_set_player(nagi_llm_t *llm, struct nagi_llm_session *session,
+                         const char *language, float language_confidence) {
+    if (!llm) return;
+    nagi_llm_async_lock(llm);
+    llm->session = session;
+    if (llm->state) {
+        memset(llm->state->detected_language, 0, sizeof(llm->state->detected_language));
+        if (language) {
+            strncpy(llm->state->detected_language, language, sizeof(llm->state->detected_language) - 1);
+        }
+        llm->state->language_confidence = language && language[0] ? language_confidence : 0.0f;
+    }
+    nagi_llm_async_unlock(llm);
+}
+
+int nagi_llm_player_language(nagi_llm_t *llm, char *buf, int buf_size, float *confidence) {
+    int len = 0;
+
+    if (!buf || buf_size <= 0) return 0;
+    buf[0] = '\0';
+    if (confidence) *confidence = 0.0f;
+    if (!llm || !llm->state) return 0;
+
+    nagi_llm_async_lock(llm);
+    len = (int)strlen(llm->state->detected_language);
+    if (len >= buf_size) len = buf_size - 1;
+    memcpy(buf, llm->state->detected_language, len);
+    buf[len] = '\0';
+    if (confidence) *confidence = llm->state->language_confidence;
+    nagi_llm_async_unlock(llm);
+    return len;
+}
+
+/*
+ * The word list the extraction prompt offers the model, one dictionary
+ * word per ID in the order given. The prefix cache notices the new text.
+ */
+void nagi_llm_set_vocabulary(nagi_llm_t *llm, const int *word_ids, int count) {
+    char list[NAGI_LLM_VOCABULARY_SIZE];
+    const char *word;
+    size_t len, n;
+    int i;
+
+    if (!llm) return;
+
+    list[0] = '\0';
+    len = 0;
+    for (i = 0; i < count; i++) {
+        word = get_word_string(llm, word_ids[i]);
+        if (!word || word[0] == '\0') continue;
+        n = strlen(word);
+        if (len + n + 3 > sizeof(list)) break;
+        if (len > 0) {
+            memcpy(list + len, ", ", 2);
+            len += 2;
+        }
+        memcpy(list + len, word, n + 1);
+        len += n;
+    }
+
+    /* An extraction may be reading it on the worker */
+    nagi_llm_async_lock(llm);
+    memcpy(llm->vocabulary, list, len + 1);
+    nagi_llm_async_unlock(llm);
+
+    if (llm->config.verbose) {
+        printf("LLM: Extraction vocabulary: %s\n", list[0] ? list : "(whole dictionary)");
+    }
+}
+
+/*
+ * Apply the game's LoRA adapter, or go back to the base model without one
+ */
+int nagi_llm_set_game_adapter(nagi_llm_t *llm, const char *game_id) {
+    char path[NAGI_LLM_MAX_MODEL_PATH];
+    FILE *f;
+    int ok;
+
+    if (!llm || !llm->set_adapter || llm->config.lora_dir[0] == '\0') return 0;
+
+    path[0] = '\0';
+    if (game_id && game_id[0] != '\0') {
+        snprintf(path, sizeof(path), "%s/%s.gguf", llm->config.lora_dir, game_id);
+        f = fopen(path, "rb");
+        if (f) {
+            fclose(f);
+        } else {
+            path[0] = '\0';
+        }
+    }
+
+    if (nagi_llm_loader_defer_adapter(llm, path)) return path[0] != '\0';
+    if (!llm->state) return 0;
+
+    /* The worker may be decoding with the old weights */
+    nagi_llm_async_lock(llm);
+    ok = llm->set_adapter(llm, path[0] ? path : NULL, llm->config.lora_scale);
+    nagi_llm_async_unlock(llm);
+
+    return ok && path[0] != '\0';
+}
+
+/*
+ * Look up a word in the decoded dictionary
+ */
+int nagi_llm_find_word(nagi_llm_t *llm, const char *word, int len) {
+    if (!llm) return -1;
+    return llm_dict_find(llm, word, len);
+}
+
 /*
  * Extract verb and noun from user input (EXTRACTION mode)
  * Translates "mira el castillo" -> "look castle"
  * Much faster than semantic matching, uses shorter prompt
- * Returns static buffer with extracted English words
+ * The English words go to the caller's buffer
  */
-const char *nagi_llm_extract_words(nagi_llm_t *llm, const char *input) {
-    if (!llm || !llm->extract_words) return input;
-    return llm->extract_words(llm, input);
+int nagi_llm_extract_words(nagi_llm_t *llm, const char *input, char *output, int output_size) {
+    const char *result = input;
+    double start = llm_time_ms();
+    llm_stats_call_t call;
+
+    if (output_size <= 0) return 0;
+    if (!input) input = result = "";
+
+    if (llm && llm->extract_words) {
+        nagi_llm_async_lock(llm);
+        call = llm_stats_begin(llm, NAGI_LLM_OP_EXTRACT, start);
+        result = llm->extract_words(llm, input, output, output_size);
+        llm_stats_end(llm, call);
+        nagi_llm_async_unlock(llm);
+    }
+    if (!result) result = input;
+    if (result != output) {
+        snprintf(output, output_size, "%s", result);
+    }
+    return (int)strlen(output);
 }
 
 int nagi_llm_matches_expected(nagi_llm_t *llm, const char *input,
                                     const int *expected_word_ids, int expected_count) {
-    return llm && llm->matches_expected ? llm->matches_expected(llm, input, expected_word_ids, expected_count) : 0;
+    int result;
+    double start = llm_time_ms();
+    llm_stats_call_t call;
+
+    if (!llm || !llm->matches_expected) return NAGI_LLM_MATCH_ERROR;
+
+    /* Logic tests the pending input every cycle, the model only needs to answer once */
+    result = llm_match_cache_lookup(llm, input, expected_word_ids, expected_count);
+    if (result >= 0) {
+        llm_stats_cached(llm, NAGI_LLM_OP_MATCH, start);
+        return result;
+    }
+
+    nagi_llm_async_lock(llm);
+    call = llm_stats_begin(llm, NAGI_LLM_OP_MATCH, start);
+    /* The generative model only breaks ties the embeddings leave open */
+    if (!llm_embed_classify(llm, input, &expected_word_ids, &expected_count, 1, &result) ||
+        result < 0) {
+        result = llm->matches_expected(llm, input, expected_word_ids, expected_count);
+    }
+    llm_stats_end(llm, call);
+    nagi_llm_async_unlock(llm);
+
+    /* A failed call is asked again next time, not remembered as a no */
+    llm_match_cache_store(llm, input, expected_word_ids, expected_count, result);
+    return result;
+}
+
+int nagi_llm_matches_expected_batch(nagi_llm_t *llm, const char *input,
+                                    const int *const *expected_lists, const int *expected_counts,
+                                    int n_lists, int *results) {
+    const int **lists;
+    int *counts, *slots, *answers;
+    int result, i, n, m;
+    llm_stats_call_t call;
+    double start = llm_time_ms();
+
+    if (!llm || !expected_lists || !expected_counts || !results || n_lists <= 0) return 0;
+
+    lists = (const int **)malloc(n_lists * sizeof(const int *));
+    counts = (int *)malloc(n_lists * 3 * sizeof(int));
+    if (!lists || !counts) {
+        free(lists);
+        free(counts);
+        return 0;
+    }
+    slots = counts + n_lists;
+    answers = slots + n_lists;
+
+    /* Only the candidates without a cached verdict go to the backend */
+    n = 0;
+    for (i = 0; i < n_lists; i++) {
+        results[i] = llm_match_cache_lookup(llm, input, expected_lists[i], expected_counts[i]);
+        if (results[i] < 0) {
+            lists[n] = expected_lists[i];
+            counts[n] = expected_counts[i];
+            slots[n++] = i;
+        }
+    }
+    if (n == 0) {
+        llm_stats_cached(llm, NAGI_LLM_OP_MATCH, start);
+        free(lists);
+        free(counts);
+        return 1;
+    }
+
+    nagi_llm_async_lock(llm);
+    call = llm_stats_begin(llm, NAGI_LLM_OP_MATCH, start);
+
+    /* Settle what the embeddings can, the generative model scores the rest */
+    if (llm_embed_classify(llm, input, lists, counts, n, answers)) {
+        m = 0;
+        for (i = 0; i < n; i++) {
+            if (answers[i] >= 0) {
+                results[slots[i]] = answers[i];
+                llm_match_cache_store(llm, input, lists[i], counts[i], answers[i]);
+            } else {
+                lists[m] = lists[i];
+                counts[m] = counts[i];
+                slots[m++] = slots[i];
+            }
+        }
+        n = m;
+    }
+
+    if (n == 0) {
+        result = 1;
+    } else if (llm->matches_expected_batch) {
+        result = llm->matches_expected_batch(llm, input, lists, counts, n, answers);
+    } else if (llm->matches_expected) {
+        for (i = 0; i < n; i++) {
+            answers[i] = llm->matches_expected(llm, input, lists[i], counts[i]);
+        }
+        result = 1;
+    } else {
+        result = 0;
+    }
+    llm_stats_end(llm, call);
+    nagi_llm_async_unlock(llm);
+
+    for (i = 0; i < n; i++) {
+        results[slots[i]] = result ? answers[i] : NAGI_LLM_MATCH_ERROR;
+        llm_match_cache_store(llm, input, lists[i], counts[i], results[slots[i]]);
+    }
+    free(lists);
+    free(counts);
+    return result;
 }
 
 int nagi_llm_generate_response(nagi_llm_t *llm, const char *game_response,
                                       const char *user_input, char *output, int output_size) {
-    return llm && llm->generate_response ? llm->generate_response(llm, game_response, user_input, output, output_size) : 0;
+    int result;
+    llm_stats_call_t call;
+    double start = llm_time_ms();
+
+    if (!llm || !llm->generate_response) return 0;
+    result = nagi_llm_cache_lookup(llm, game_response, user_input, output, output_size);
+    if (result > 0) {
+        llm_stats_cached(llm, NAGI_LLM_OP_GENERATE, start);
+        return result;
+    }
+
+    nagi_llm_async_lock(llm);
+    call = llm_stats_begin(llm, NAGI_LLM_OP_GENERATE, start);
+    result = llm->generate_response(llm, game_response, user_input, output, output_size);
+    llm_stats_end(llm, call);
+    nagi_llm_async_unlock(llm);
+    if (result > 0) nagi_llm_cache_store(llm, game_response, output);
+    return result;
+}
+
+int nagi_llm_generate_response_stream(nagi_llm_t *llm, const char *game_response,
+                                      const char *user_input, char *output, int output_size,
+                                      nagi_llm_token_cb_t on_token, void *userdata) {
+    int result;
+    llm_stats_call_t call;
+    double start = llm_time_ms();
+
+    if (!llm) return 0;
+    if (!llm->generate_response_stream) {
+        result = nagi_llm_generate_response(llm, game_response, user_input, output, output_size);
+        if (result > 0 && on_token) {
+            on_token(output, result, userdata);
+        }
+        return result;
+    }
+
+    result = nagi_llm_cache_lookup(llm, game_response, user_input, output, output_size);
+    if (result > 0) {
+        llm_stats_cached(llm, NAGI_LLM_OP_GENERATE, start);
+        if (on_token) on_token(output, result, userdata);
+        return result;
+    }
+
+    nagi_llm_async_lock(llm);
+    call = llm_stats_begin(llm, NAGI_LLM_OP_GENERATE, start);
+    result = llm->generate_response_stream(llm, game_response, user_input, output, output_size,
+                                           on_token, userdata);
+    llm_stats_end(llm, call);
+    nagi_llm_async_unlock(llm);
+    if (result > 0) nagi_llm_cache_store(llm, game_response, output);
+    return result;
+}
+
+int nagi_llm_generate_response_batch(nagi_llm_t *llm, const char **game_responses, int count,
+                                     char **outputs, int output_size) {
+    int i, done;
+    llm_stats_call_t call;
+    double start = llm_time_ms();
+
+    if (!llm || !game_responses || !outputs || count <= 0) return 0;
+
+    done = 0;
+    if (llm->generate_response_batch) {
+        /* The whole batch counts as one request */
+        nagi_llm_async_lock(llm);
+        call = llm_stats_begin(llm, NAGI_LLM_OP_GENERATE, start);
+        llm->generate_response_batch(llm, game_responses, count, outputs, output_size);
+        llm_stats_end(llm, call);
+        nagi_llm_async_unlock(llm);
+    } else {
+        for (i = 0; i < count; i++) {
+            outputs[i][0] = '\0';
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        if (!game_responses[i] || game_responses[i][0] == '\0') continue;
+        if (outputs[i][0] == '\0') {
+            nagi_llm_generate_response(llm, game_responses[i], "", outputs[i], output_size);
+        }
+        if (outputs[i][0] != '\0') done++;
+    }
+    return done;
+}
+
+void llm_state_set_language(llm_state_t *state, const char *language) {
+    strncpy(state->detected_language, language, sizeof(state->detected_language) - 1);
+    state->detected_language[sizeof(state->detected_language) - 1] = '\0';
+    state->language_confidence = 1.0f;
+}
+
+void nagi_llm_set_language(nagi_llm_t *llm, const char *language) {
+    if (!llm || !language) return;
+    if (nagi_llm_loader_defer_language(llm, language)) return;
+    if (!llm->state) return;
+    llm_state_set_language(llm->state, language);
+}
+
+/*
+ * Session part of a save file, the decoded game context follows it
+ */
+struct llm_session_head {
+    char language[32];
+    float confidence;
+    u32 kv_size;
+};
+
+size_t nagi_llm_session_save(nagi_llm_t *llm, void *buf, size_t size, int kv) {
+    struct llm_session_head head;
+    size_t kv_size = 0;
+
+    if (!nagi_llm_ready(llm)) return 0;
+    if (!buf) size = 0;
+    else if (size < sizeof(head)) return 0;
+
+    nagi_llm_async_lock(llm);
+    memset(&head, 0, sizeof(head));
+    memcpy(head.language, llm->state->detected_language, sizeof(head.language));
+    head.confidence = llm->state->language_confidence;
+
+    if (kv && llm->kv_save) {
+        if (!buf) {
+            kv_size = llm->kv_save(llm, NULL, 0);
+        } else {
+            /* It may have grown since the size was asked, then it's left out */
+            kv_size = llm->kv_save(llm, (char *)buf + sizeof(head), size - sizeof(head));
+        }
+    }
+    nagi_llm_async_unlock(llm);
+
+    if (!buf) return sizeof(head) + kv_size;
+    head.kv_size = (u32)kv_size;
+    memcpy(buf, &head, sizeof(head));
+    return sizeof(head) + kv_size;
+}
+
+int nagi_llm_session_load(nagi_llm_t *llm, const void *buf, size_t size) {
+    struct llm_session_head head;
+    int ok = 0;
+
+    if (!llm || !buf || size < sizeof(head)) return 0;
+    memcpy(&head, buf, sizeof(head));
+    head.language[sizeof(head.language) - 1] = '\0';
+    if (head.kv_size > size - sizeof(head)) return 0;
+
+    /* Still loading, the language waits for it and there's nothing decoded */
+    if (!nagi_llm_ready(llm)) {
+        if (head.language[0]) nagi_llm_set_language(llm, head.language);
+        return 0;
+    }
+
+    nagi_llm_async_lock(llm);
+    if (head.language[0]) {
+        llm_state_set_language(llm->state, head.language);
+        llm->state->language_confidence = head.confidence;
+    }
+    if (head.kv_size && llm->kv_load) {
+        ok = llm->kv_load(llm, (const char *)buf + sizeof(head), head.kv_size);
+    }
+    nagi_llm_async_unlock(llm);
+    return ok;
 }
@@ -0,0 +1,1163 @@
+/*
+ * nagi_llm_async.c - Asynchronous LLM requests for NAGI
+ *
+ * Response generation runs on a single worker thread per LLM instance so
+ * the game loop keeps running while tokens are generated. Backends that
+ * can stream fill in the partial text as they go. Requests are started
+ * in FIFO order within three priority classes: interactive (responses
+ * the player is waiting for), near-term (extractions of a line still being
+ * typed) and background (pre-translations of a room's messages). A class
+ * only starts once the ones above it have nothing queued. With generation
+ * slots (generate_begin/generate_step) several run at once and share every
+ * decode, otherwise they run one after the other. The backend itself is
+ * not thread-safe, so the synchronous wrappers in nagi_llm.c take the same
+ * call lock.
+ *
+ * Background work gives way at token granularity: when anything else is
+ * queued, or a synchronous call waits for the lock, its cancellation token
+ * is set and the request goes back to the front of its queue to start over
+ * later. Background requests never share a decode step with other work,
+ * and config.background_duty limits the share of the time they run.
+ *
+ * Every request carries a cancellation token, set when the caller frees
+ * it. While a request holds the call lock its token is the worker's
+ * current one, which backends poll from llama.cpp's abort callback or
+ * curl's progress callback so a dead request stops mid-prompt instead of
+ * finishing. A cancelled request in a generation slot gives the slot
+ * back before the next step.
+ *
+ * A request queued for another game (nagi_llm_generate_response_async_for)
+ * carries that game's context and player language. The worker puts them
+ * in place of the instance's own only while it holds the call lock for
+ * the request, and puts the instance's back before letting go, so calls
+ * in between see what their callers set.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/nagi_llm.h"
+#include "../include/nagi_llm_context.h"
+#include "../include/llm_utils.h"
+#include "llm_thread.h"
+
+#define NAGI_LLM_WORKER_SLOTS 8      /* Most requests generated together */
+
+/* Priority classes, the queue of a lower one starts first */
+enum { WORKER_INTERACTIVE, WORKER_NEAR, WORKER_BACKGROUND, WORKER_CLASSES };
+
+struct nagi_llm_worker {
+    nagi_llm_t *llm;
+    llm_thread_t thread;
+    llm_mutex_t queue_lock;      /* Protects the queue and request status */
+    llm_cond_t queue_wake;
+    llm_mutex_t call_lock;       /* Serializes backend calls */
+    nagi_llm_request_t *head[WORKER_CLASSES];   /* One FIFO per priority class */
+    nagi_llm_request_t *tail[WORKER_CLASSES];
+    int quit;
+    volatile unsigned int *cancel;   /* Token of the request holding the call lock */
+    nagi_llm_request_t *current;     /* Being started or generated on its own */
+    int waiting;                     /* Synchronous calls waiting for the call lock */
+    int calling;                     /* Synchronous calls holding it */
+    double rest_until;               /* No background work before then, llm_time_ms */
+    int n_slots;                 /* Backend generation slots, 0 for one at a time */
+    int n_running;
+    int n_background;            /* Slots running background requests */
+    nagi_llm_request_t *slot[NAGI_LLM_WORKER_SLOTS];
+};
+
+struct nagi_llm_request {
+    struct nagi_llm_worker *worker;  /* NULL once the worker has stopped */
+    nagi_llm_request_t *next;
+    char *game_response;             /* The input for an extraction */
+    char *user_input;
+    char output[NAGI_LLM_MAX_RESPONSE_SIZE];
+    char partial[NAGI_LLM_MAX_RESPONSE_SIZE];  /* Text streamed so far */
+    int partial_len;
+    nagi_llm_request_status_t status;
+    double start;                    /* When it got a slot, llm_time_ms */
+    int running;                     /* Picked up by the worker */
+    int released;                    /* Caller freed it while running */
+    int extract;                     /* An extraction rather than a response */
+    int detached;                    /* No caller, freed once it's done */
+    int priority;                    /* WORKER_INTERACTIVE, _NEAR or _BACKGROUND */
+    int preempted;                   /* Stopped for other work, runs again */
+    volatile unsigned int cancelled; /* Cancellation token, 1 once the caller let go */
+    int carried;                     /* Brings its own context and language */
+    struct nagi_llm_session *session;  /* Game context of a carried request */
+    char language[32];               /* Its player's language, the one generated in once done */
+    float language_confidence;
+};
+
+/* The instance's own context and language while a carried request runs */
+typedef struct {
+    struct nagi_llm_session *session;
+    char language[32];
+    float language_confidence;
+} request_saved_t;
+
+static char *dup_string(const char *str)
+{
+    size_t len = strlen(str) + 1;
+    char *copy = (char *)malloc(len);
+    if (copy) {
+        memcpy(copy, str, len);
+    }
+    return copy;
+}
+
+static void request_destroy(nagi_llm_request_t *req)
+{
+    free(req->game_response);
+    free(req->user_input);
+    free(req);
+}
+
+/*
+ * Put a carried request's context and language in place of the instance's
+ * Called with the call lock held.
+ */
+static void request_enter(nagi_llm_t *llm, nagi_llm_request_t *req, request_saved_t *saved)
+{
+    llm_state_t *state = llm->state;
+
+    if (!req->carried) return;
+    saved->session = llm->session;
+    llm->session = req->session;
+    if (state) {
+        memcpy(saved->language, state->detected_language, sizeof(saved->language));
+        saved->language_confidence = state->language_confidence;
+        memcpy(state->detected_language, req->language, sizeof(state->detected_language));
+        state->language_confidence = req->language_confidence;
+    }
+}
+
+/*
+ * Keep the language a carried request ended up in and put the instance's
+ * own back. Called with the call lock held.
+ */
+static void request_leave(nagi_llm_t *llm, nagi_llm_request_t *req, const request_saved_t *saved)
+{
+    llm_state_t *state = llm->state;
+
+    if (!req->carried) return;
+    llm->session = saved->session;
+    if (state) {
+        memcpy(req->language, state->detected_language, sizeof(req->language));
+        req->language_confidence = state->language_confidence;
+        memcpy(state->detected_language, saved->language, sizeof(state->detected_language));
+        state->language_confidence = saved->language_confidence;
+    }
+}
+
+/*
+ * A carried request skips the submit-time cache lookup, the cache is keyed
+ * on the language the worker puts in place. Call lock held, entered.
+ */
+static int request_cached(nagi_llm_t *llm, nagi_llm_request_t *req)
+{
+    int len;
+
+    if (!req->carried) return 0;
+    len = nagi_llm_cache_lookup(llm, req->game_response, req->user_input, req->output, sizeof(req->output));
+    if (len > 0) llm_stats_cached(llm, NAGI_LLM_OP_GENERATE, llm_time_ms());
+    return len > 0 ? len : 0;
+}
+
+/*
+ * Streaming callback run on the worker thread. Stops generation early if
+ * the caller has already dropped the request.
+ */
+static int worker_on_token(const char *piece, int len, void *userdata)
+{
+    nagi_llm_request_t *req = (nagi_llm_request_t *)userdata;
+    struct nagi_llm_worker *worker = req->worker;
+    nagi_llm_t *llm = worker->llm;
+    int keep_going;
+
+    llm_mutex_lock(&worker->queue_lock);
+    if (req->partial_len + len >= (int)sizeof(req->partial)) {
+        len = (int)sizeof(req->partial) - 1 - req->partial_len;
+    }
+    if (len > 0) {
+        memcpy(req->partial + req->partial_len, piece, len);
+        req->partial_len += len;
+        req->partial[req->partial_len] = '\0';
+    }
+    keep_going = !req->released && !req->preempted;
+    llm_mutex_unlock(&worker->queue_lock);
+
+    if (len > 0 && llm->on_wake) llm->on_wake(llm->wake_userdata);
+    return keep_going;
+}
+
+/*
+ * Publish the outcome of a request and free it if the caller already let go
+ * Called with the queue lock held.
+ */
+static void worker_finish(nagi_llm_request_t *req, int len)
+{
+    nagi_llm_t *llm = req->worker->llm;
+
+    req->running = 0;
+    req->status = (len > 0 && req->output[0] != '\0') ?
+                  NAGI_LLM_REQUEST_DONE : NAGI_LLM_REQUEST_FAILED;
+    if (req->released || req->detached) {
+        request_destroy(req);
+    } else if (llm->on_wake) {
+        llm->on_wake(llm->wake_userdata);
+    }
+}
+
+/*
+ * The request that starts next: the oldest of the highest class queued
+ * Called with the queue lock held.
+ */
+static nagi_llm_request_t *worker_peek(struct nagi_llm_worker *worker)
+{
+    int c;
+
+    for (c = 0; c < WORKER_CLASSES; c++) {
+        if (worker->head[c]) return worker->head[c];
+    }
+    return NULL;
+}
+
+static nagi_llm_request_t *worker_pop(struct nagi_llm_worker *worker)
+{
+    nagi_llm_request_t *req = worker_peek(worker);
+    int c = req->priority;
+
+    worker->head[c] = req->next;
+    if (!worker->head[c]) worker->tail[c] = NULL;
+    req->next = NULL;
+    req->running = 1;
+    return req;
+}
+
+/*
+ * Take a request that hasn't started out of its queue
+ * Called with the queue lock held.
+ */
+static void worker_unlink(struct nagi_llm_worker *worker, nagi_llm_request_t *req)
+{
+    nagi_llm_request_t *prev, *cur;
+    int c = req->priority;
+
+    prev = NULL;
+    for (cur = worker->head[c]; cur; prev = cur, cur = cur->next) {
+        if (cur != req) continue;
+
+        if (prev) {
+            prev->next = cur->next;
+        } else {
+            worker->head[c] = cur->next;
+        }
+        if (worker->tail[c] == cur) worker->tail[c] = prev;
+        cur->next = NULL;
+        break;
+    }
+}
+
+/*
+ * Stop the background request being started or generated on its own so
+ * work of a higher class gets the model. It stops at its next token and
+ * the worker puts it back in its queue. Called with the queue lock held.
+ */
+static void worker_preempt(struct nagi_llm_worker *worker, int priority)
+{
+    nagi_llm_request_t *req = worker->current;
+
+    if (priority >= WORKER_BACKGROUND) return;
+    if (req && req->priority == WORKER_BACKGROUND && !req->preempted) {
+        req->preempted = 1;
+        llm_atomic_store(&req->cancelled, 1);
+    }
+}
+
+/*
+ * Queue a request behind the others of its class
+ * Called with the queue lock held.
+ */
+static void worker_push(struct nagi_llm_worker *worker, nagi_llm_request_t *req)
+{
+    int c = req->priority;
+
+    req->next = NULL;
+    if (worker->tail[c]) {
+        worker->tail[c]->next = req;
+    } else {
+        worker->head[c] = req;
+    }
+    worker->tail[c] = req;
+    worker_preempt(worker, c);
+    llm_cond_signal(&worker->queue_wake);
+}
+
+/*
+ * Put a preempted request back at the front of its queue, to start over
+ * from its prompt. Called with the queue lock held.
+ */
+static void worker_requeue(struct nagi_llm_worker *worker, nagi_llm_request_t *req)
+{
+    int c = req->priority;
+
+    req->running = 0;
+    req->preempted = 0;
+    req->partial_len = 0;
+    req->partial[0] = '\0';
+    req->output[0] = '\0';
+    llm_atomic_store(&req->cancelled, 0);
+
+    req->next = worker->head[c];
+    worker->head[c] = req;
+    if (!worker->tail[c]) worker->tail[c] = req;
+}
+
+/*
+ * Have background work rest after running since start, so it takes no
+ * more than config.background_duty percent of the time
+ * Called with the queue lock held.
+ */
+static void worker_rest(struct nagi_llm_worker *worker, double start)
+{
+    int duty = worker->llm->config.background_duty;
+    double now;
+
+    if (duty <= 0 || duty >= 100) return;
+    now = llm_time_ms();
+    worker->rest_until = now + (now - start) * (100 - duty) / duty;
+}
+
+/*
+ * Whether the worker's next step is background work only
+ * Called with the queue lock held.
+ */
+static int worker_background_next(struct nagi_llm_worker *worker)
+{
+    nagi_llm_request_t *next = worker_peek(worker);
+
+    if (next && next->priority != WORKER_BACKGROUND) return 0;
+    if (worker->n_running > 0) return worker->n_background == worker->n_running;
+    return next != NULL;
+}
+
+/*
+ * Whether a generation slot can take the next request. Extractions don't
+ * go in slots, they wait until every slot is free, and background requests
+ * only share the slots with each other.
+ */
+static int worker_can_admit(struct nagi_llm_worker *worker)
+{
+    nagi_llm_request_t *next = worker_peek(worker);
+
+    if (!next || next->extract) return 0;
+    if (next->priority == WORKER_BACKGROUND) return worker->n_background == worker->n_running;
+    return worker->n_background == 0;
+}
+
+/*
+ * Extract the words of a speculative request
+ * Called without locks, takes the call lock.
+ */
+static int worker_extract(struct nagi_llm_worker *worker, nagi_llm_request_t *req)
+{
+    nagi_llm_t *llm = worker->llm;
+    const char *result;
+    llm_stats_call_t call;
+    int len;
+
+    len = 0;
+    llm_mutex_lock(&worker->call_lock);
+    worker->cancel = &req->cancelled;
+    if (llm->extract_words) {
+        call = llm_stats_begin(llm, NAGI_LLM_OP_EXTRACT, llm_time_ms());
+        result = llm->extract_words(llm, req->game_response, req->output, (int)sizeof(req->output));
+        llm_stats_end(llm, call);
+        /* The backend hands the input back when it can't do better */
+        if (result) {
+            len = result == req->output ? (int)strlen(result)
+                                        : snprintf(req->output, sizeof(req->output), "%s", result);
+        }
+    }
+    worker->cancel = NULL;
+    llm_mutex_unlock(&worker->call_lock);
+    return len;
+}
+
+/*
+ * Generate one request start to finish, for backends without slots
+ * Called with the queue lock held, drops it while generating.
+ */
+static void worker_run_one(struct nagi_llm_worker *worker)
+{
+    nagi_llm_t *llm = worker->llm;
+    nagi_llm_request_t *req;
+    request_saved_t saved;
+    llm_stats_call_t call;
+    double start;
+    int len;
+
+    req = worker_pop(worker);
+    worker->current = req;
+    llm_mutex_unlock(&worker->queue_lock);
+
+    if (req->extract) {
+        len = worker_extract(worker, req);
+        llm_mutex_lock(&worker->queue_lock);
+        worker->current = NULL;
+        worker_finish(req, len);
+        return;
+    }
+
+    /* What the game did since the last request, a carried context has no events */
+    if (!req->carried) llm_context_fold_events(llm->session);
+
+    llm_mutex_lock(&worker->call_lock);
+    start = llm_time_ms();
+    len = 0;
+    /* A carried context may be gone once its request is let go */
+    if (!llm_atomic_load(&req->cancelled)) {
+        worker->cancel = &req->cancelled;
+        request_enter(llm, req, &saved);
+        len = request_cached(llm, req);
+        if (len == 0) {
+            call = llm_stats_begin(llm, NAGI_LLM_OP_GENERATE, start);
+            if (llm->generate_response_stream) {
+                len = llm->generate_response_stream(llm, req->game_response, req->user_input,
+                                                    req->output, sizeof(req->output),
+                                                    worker_on_token, req);
+            } else {
+                len = llm->generate_response ?
+                      llm->generate_response(llm, req->game_response, req->user_input,
+                                             req->output, sizeof(req->output)) : 0;
+            }
+            llm_stats_end(llm, call);
+
+            /* Text cut short by a cancel is not a translation to keep */
+            if (len > 0 && req->output[0] != '\0' && !llm_atomic_load(&req->cancelled)) {
+                nagi_llm_cache_store(llm, req->game_response, req->output);
+            }
+        }
+        request_leave(llm, req, &saved);
+        worker->cancel = NULL;
+    }
+    llm_mutex_unlock(&worker->call_lock);
+
+    llm_mutex_lock(&worker->queue_lock);
+    worker->current = NULL;
+    if (req->priority == WORKER_BACKGROUND) worker_rest(worker, start);
+    if (req->preempted && !req->released) {
+        worker_requeue(worker, req);
+        return;
+    }
+    worker_finish(req, len);
+}
+
+/*
+ * Give the slots of background requests back so the work queued above
+ * them can start. They go back in their queue.
+ * Called with the queue lock held, drops it while freeing the slots.
+ */
+static void worker_evict_background(struct nagi_llm_worker *worker)
+{
+    nagi_llm_t *llm = worker->llm;
+    nagi_llm_request_t *req;
+    int i;
+
+    /* Last slot first, so the requeued ones keep their order */
+    for (i = worker->n_slots - 1; i >= 0; i--) {
+        req = worker->slot[i];
+        if (!req || req->priority != WORKER_BACKGROUND) continue;
+
+        worker->slot[i] = NULL;
+        worker->n_running--;
+        worker->n_background--;
+        llm_mutex_unlock(&worker->queue_lock);
+        llm_mutex_lock(&worker->call_lock);
+        llm->generate_begin(llm, i, NULL, NULL, NULL, 0, NULL, NULL);
+        llm_mutex_unlock(&worker->call_lock);
+        llm_mutex_lock(&worker->queue_lock);
+        if (req->released) {
+            worker_finish(req, 0);
+        } else {
+            worker_requeue(worker, req);
+        }
+    }
+}
+
+/*
+ * Continuous batching: queued requests take free backend slots as soon as
+ * there are any, and every running request advances by one token per
+ * generate_step. The call lock is only held for one begin or step at a
+ * time, so synchronous extraction and matching get in between tokens
+ * instead of waiting for a whole response.
+ * Called with the queue lock held, drops it while generating.
+ */
+static void worker_run_slots(struct nagi_llm_worker *worker)
+{
+    nagi_llm_t *llm = worker->llm;
+    nagi_llm_request_t *req;
+    request_saved_t saved;
+    llm_stats_call_t call;
+    int lengths[NAGI_LLM_WORKER_SLOTS];
+    int i, ok, background, cached;
+    double start;
+
+    req = worker_peek(worker);
+    if (worker->n_background > 0 && req && req->priority != WORKER_BACKGROUND) {
+        worker_evict_background(worker);
+    }
+
+    /* Admit what is waiting into the free slots */
+    for (i = 0; i < worker->n_slots && worker_can_admit(worker); i++) {
+        if (worker->slot[i]) continue;
+
+        req = worker_pop(worker);
+        req->start = llm_time_ms();
+        worker->current = req;
+        llm_mutex_unlock(&worker->queue_lock);
+
+        if (!req->carried) llm_context_fold_events(llm->session);
+
+        llm_mutex_lock(&worker->call_lock);
+        ok = 0;
+        cached = 0;
+        if (!llm_atomic_load(&req->cancelled)) {
+            worker->cancel = &req->cancelled;
+            request_enter(llm, req, &saved);
+            cached = request_cached(llm, req);
+            if (cached == 0) {
+                call = llm_stats_begin(llm, NAGI_LLM_OP_GENERATE, req->start);
+                ok = llm->generate_begin(llm, i, req->game_response, req->user_input,
+                                         req->output, sizeof(req->output), worker_on_token, req);
+                llm_stats_leave(llm, call);    /* Counted once it finishes */
+            }
+            request_leave(llm, req, &saved);
+            worker->cancel = NULL;
+        }
+        llm_mutex_unlock(&worker->call_lock);
+
+        /* Let go of or preempted while its prompt was decoding */
+        llm_mutex_lock(&worker->queue_lock);
+        worker->current = NULL;
+        if (cached > 0) {
+            worker_finish(req, cached);
+            continue;
+        }
+        if (ok && llm_atomic_load(&req->cancelled)) {
+            llm_mutex_unlock(&worker->queue_lock);
+            llm_mutex_lock(&worker->call_lock);
+            llm->generate_begin(llm, i, NULL, NULL, NULL, 0, NULL, NULL);
+            llm_mutex_unlock(&worker->call_lock);
+            llm_mutex_lock(&worker->queue_lock);
+            ok = 0;
+        }
+
+        if (ok) {
+            worker->slot[i] = req;
+            worker->n_running++;
+            if (req->priority == WORKER_BACKGROUND) worker->n_background++;
+        } else if (req->preempted && !req->released) {
+            worker_requeue(worker, req);
+        } else {
+            worker_finish(req, 0);
+        }
+    }
+    if (worker->n_running == 0) return;
+
+    /* Cancelled requests give their slot and sequence back before the step */
+    for (i = 0; i < worker->n_slots; i++) {
+        req = worker->slot[i];
+        if (!req || !req->released) continue;
+
+        worker->slot[i] = NULL;
+        worker->n_running--;
+        if (req->priority == WORKER_BACKGROUND) worker->n_background--;
+        llm_mutex_unlock(&worker->queue_lock);
+        llm_mutex_lock(&worker->call_lock);
+        llm->generate_begin(llm, i, NULL, NULL, NULL, 0, NULL, NULL);
+        llm_mutex_unlock(&worker->call_lock);
+        llm_mutex_lock(&worker->queue_lock);
+        worker_finish(req, 0);
+    }
+    if (worker->n_running == 0) return;
+    background = worker->n_background == worker->n_running;
+    llm_mutex_unlock(&worker->queue_lock);
+
+    llm_mutex_lock(&worker->call_lock);
+    start = llm_time_ms();
+    call = llm_stats_begin(llm, NAGI_LLM_OP_GENERATE, start);
+    llm->generate_step(llm, lengths);
+    llm_stats_leave(llm, call);
+
+    for (i = 0; i < worker->n_slots; i++) {
+        req = worker->slot[i];
+        if (!req || lengths[i] < 0) continue;
+
+        llm_stats_count(llm, NAGI_LLM_OP_GENERATE, req->start);
+        if (lengths[i] > 0 && req->output[0] != '\0' && !llm_atomic_load(&req->cancelled)) {
+            request_enter(llm, req, &saved);
+            nagi_llm_cache_store(llm, req->game_response, req->output);
+            request_leave(llm, req, &saved);
+        }
+    }
+    llm_mutex_unlock(&worker->call_lock);
+
+    llm_mutex_lock(&worker->queue_lock);
+    if (background) worker_rest(worker, start);
+    for (i = 0; i < worker->n_slots; i++) {
+        req = worker->slot[i];
+        if (!req || lengths[i] < 0) continue;
+
+        worker->slot[i] = NULL;
+        worker->n_running--;
+        if (req->priority == WORKER_BACKGROUND) worker->n_background--;
+        worker_finish(req, lengths[i]);
+    }
+}
+
+/*
+ * Drop the requests still in a slot when the worker stops
+ */
+static void worker_abort_slots(struct nagi_llm_worker *worker)
+{
+    nagi_llm_t *llm = worker->llm;
+    nagi_llm_request_t *req;
+    int i;
+
+    if (worker->n_running == 0) return;
+
+    llm_mutex_lock(&worker->call_lock);
+    for (i = 0; i < worker->n_slots; i++) {
+        if (worker->slot[i]) {
+            llm->generate_begin(llm, i, NULL, NULL, NULL, 0, NULL, NULL);
+        }
+    }
+    llm_mutex_unlock(&worker->call_lock);
+
+    llm_mutex_lock(&worker->queue_lock);
+    for (i = 0; i < worker->n_slots; i++) {
+        req = worker->slot[i];
+        if (!req) continue;
+
+        worker->slot[i] = NULL;
+        req->running = 0;
+        req->status = NAGI_LLM_REQUEST_FAILED;
+        if (req->released || req->detached) {
+            request_destroy(req);
+        } else {
+            req->worker = NULL;
+        }
+    }
+    worker->n_running = 0;
+    worker->n_background = 0;
+    llm_mutex_unlock(&worker->queue_lock);
+}
+
+static void *worker_main(void *arg)
+{
+    struct nagi_llm_worker *worker = (struct nagi_llm_worker *)arg;
+    int wait_ms;
+
+    llm_mutex_lock(&worker->queue_lock);
+    for (;;) {
+        while (!worker_peek(worker) && worker->n_running == 0 && !worker->quit) {
+            llm_cond_wait(&worker->queue_wake, &worker->queue_lock);
+        }
+        if (worker->quit) break;
+
+        /* Background work lets synchronous calls in first, then rests */
+        if (worker_background_next(worker)) {
+            wait_ms = worker->waiting > 0 ? 1 : (int)(worker->rest_until - llm_time_ms() + 1.0);
+            if (wait_ms > 0) {
+                llm_cond_timedwait(&worker->queue_wake, &worker->queue_lock, wait_ms);
+                continue;
+            }
+        }
+
+        if (worker->n_slots > 0 && (worker->n_running > 0 || worker_can_admit(worker))) {
+            worker_run_slots(worker);
+        } else {
+            worker_run_one(worker);
+        }
+    }
+    llm_mutex_unlock(&worker->queue_lock);
+    worker_abort_slots(worker);
+
+    return NULL;
+}
+
+/*
+ * Start the worker thread on first use
+ */
+static struct nagi_llm_worker *worker_get(nagi_llm_t *llm)
+{
+    struct nagi_llm_worker *worker;
+
+    if (llm->worker) return llm->worker;
+
+    worker = (struct nagi_llm_worker *)calloc(1, sizeof(struct nagi_llm_worker));
+    if (!worker) return NULL;
+
+    worker->llm = llm;
+    if (llm->generate_slots && llm->generate_begin && llm->generate_step) {
+        worker->n_slots = llm->generate_slots(llm);
+        if (worker->n_slots > NAGI_LLM_WORKER_SLOTS) worker->n_slots = NAGI_LLM_WORKER_SLOTS;
+    }
+    llm_mutex_init(&worker->queue_lock);
+    llm_mutex_init(&worker->call_lock);
+    llm_cond_init(&worker->queue_wake);
+
+    if (!llm_thread_create(&worker->thread, worker_main, worker)) {
+        fprintf(stderr, "LLM: Failed to start worker thread\n");
+        llm_cond_destroy(&worker->queue_wake);
+        llm_mutex_destroy(&worker->call_lock);
+        llm_mutex_destroy(&worker->queue_lock);
+        free(worker);
+        return NULL;
+    }
+
+    llm->worker = worker;
+    return worker;
+}
+
+/*
+ * Stop the worker thread. Requests still queued are marked as failed and
+ * stay owned by the caller.
+ */
+void nagi_llm_async_stop(nagi_llm_t *llm)
+{
+    struct nagi_llm_worker *worker = llm->worker;
+    nagi_llm_request_t *req, *next;
+    int c;
+
+    if (!worker) return;
+
+    llm_mutex_lock(&worker->queue_lock);
+    worker->quit = 1;
+    llm_cond_broadcast(&worker->queue_wake);
+    llm_mutex_unlock(&worker->queue_lock);
+
+    llm_thread_join(worker->thread);
+
+    /* Under the lock, a caller polling one of them holds it through the read */
+    llm_mutex_lock(&worker->queue_lock);
+    for (c = 0; c < WORKER_CLASSES; c++) {
+        for (req = worker->head[c]; req; req = next) {
+            next = req->next;
+            req->next = NULL;
+            if (req->detached) {
+                request_destroy(req);     /* Pre-translations nobody holds */
+                continue;
+            }
+            req->worker = NULL;
+            req->status = NAGI_LLM_REQUEST_FAILED;
+        }
+        worker->head[c] = NULL;
+        worker->tail[c] = NULL;
+    }
+    llm_mutex_unlock(&worker->queue_lock);
+
+    llm->worker = NULL;
+    llm_cond_destroy(&worker->queue_wake);
+    llm_mutex_destroy(&worker->call_lock);
+    llm_mutex_destroy(&worker->queue_lock);
+    free(worker);
+}
+
+/*
+ * Serialize synchronous backend calls against the worker thread
+ * A backend may drop the lock while it only waits on I/O (cloud requests)
+ * and take it back before touching shared state again. Synchronous calls
+ * come from the game, so background work gives way to them.
+ */
+void nagi_llm_async_lock(nagi_llm_t *llm)
+{
+    struct nagi_llm_worker *worker = llm->worker;
+
+    if (!worker) return;
+    /* The worker taking it back after an I/O wait */
+    if (llm_thread_is_current(worker->thread)) {
+        llm_mutex_lock(&worker->call_lock);
+        return;
+    }
+
+    llm_mutex_lock(&worker->queue_lock);
+    worker->waiting++;
+    worker_preempt(worker, WORKER_INTERACTIVE);
+    llm_mutex_unlock(&worker->queue_lock);
+
+    llm_mutex_lock(&worker->call_lock);
+
+    llm_mutex_lock(&worker->queue_lock);
+    worker->waiting--;
+    worker->calling++;
+    llm_mutex_unlock(&worker->queue_lock);
+}
+
+void nagi_llm_async_unlock(nagi_llm_t *llm)
+{
+    struct nagi_llm_worker *worker = llm->worker;
+
+    if (!worker) return;
+    if (!llm_thread_is_current(worker->thread)) {
+        llm_mutex_lock(&worker->queue_lock);
+        worker->calling--;
+        llm_mutex_unlock(&worker->queue_lock);
+    }
+    llm_mutex_unlock(&worker->call_lock);
+}
+
+/*
+ * Whether the request holding the call lock has been cancelled, for the
+ * backend's abort and progress callbacks. Synchronous calls never are.
+ */
+int nagi_llm_async_cancelled(nagi_llm_t *llm)
+{
+    volatile unsigned int *cancel;
+
+    if (!llm || !llm->worker) return 0;
+    cancel = llm->worker->cancel;
+    return cancel && llm_atomic_load(cancel);
+}
+
+/*
+ * Swap the current cancellation token, call lock held. A backend that
+ * drops the lock while it waits takes the token with it, so the calls
+ * that run in the meantime don't see it.
+ */
+volatile unsigned int *nagi_llm_async_cancel_swap(nagi_llm_t *llm, volatile unsigned int *token)
+{
+    volatile unsigned int *prev;
+
+    if (!llm || !llm->worker) return NULL;
+    prev = llm->worker->cancel;
+    llm->worker->cancel = token;
+    return prev;
+}
+
+/*
+ * Queue a response generation request
+ */
+nagi_llm_request_t *nagi_llm_generate_response_async(nagi_llm_t *llm, const char *game_response,
+                                                     const char *user_input)
+{
+    struct nagi_llm_worker *worker;
+    nagi_llm_request_t *req;
+    double start = llm_time_ms();
+    int len;
+
+    if (!llm || !game_response || !nagi_llm_ready(llm)) return NULL;
+
+    worker = worker_get(llm);
+    if (!worker) return NULL;
+
+    req = (nagi_llm_request_t *)calloc(1, sizeof(nagi_llm_request_t));
+    if (!req) return NULL;
+
+    req->game_response = dup_string(game_response);
+    req->user_input = dup_string(user_input ? user_input : "");
+    if (!req->game_response || !req->user_input) {
+        request_destroy(req);
+        return NULL;
+    }
+    /* Cached responses complete immediately without touching the worker */
+    len = nagi_llm_cache_lookup(llm, game_response, user_input, req->output, sizeof(req->output));
+    if (len > 0) {
+        llm_stats_cached(llm, NAGI_LLM_OP_GENERATE, start);
+        memcpy(req->partial, req->output, len + 1);
+        req->partial_len = len;
+        req->status = NAGI_LLM_REQUEST_DONE;
+        return req;
+    }
+
+    req->worker = worker;
+    req->status = NAGI_LLM_REQUEST_PENDING;
+    req->priority = WORKER_INTERACTIVE;
+
+    llm_mutex_lock(&worker->queue_lock);
+    worker_push(worker, req);
+    llm_mutex_unlock(&worker->queue_lock);
+
+    return req;
+}
+
+/*
+ * Queue a response for another game, with its context and language
+ */
+nagi_llm_request_t *nagi_llm_generate_response_async_for(nagi_llm_t *llm, struct nagi_llm_session *session,
+                                                         const char *language, float language_confidence,
+                                                         const char *game_response, const char *user_input)
+{
+    struct nagi_llm_worker *worker;
+    nagi_llm_request_t *req;
+
+    if (!llm || !game_response || !nagi_llm_ready(llm)) return NULL;
+
+    worker = worker_get(llm);
+    if (!worker) return NULL;
+
+    req = (nagi_llm_request_t *)calloc(1, sizeof(nagi_llm_request_t));
+    if (!req) return NULL;
+
+    req->game_response = dup_string(game_response);
+    req->user_input = dup_string(user_input ? user_input : "");
+    if (!req->game_response || !req->user_input) {
+        request_destroy(req);
+        return NULL;
+    }
+    req->carried = 1;
+    req->session = session;
+    if (language) {
+        strncpy(req->language, language, sizeof(req->language) - 1);
+        req->language_confidence = language_confidence;
+    }
+
+    req->worker = worker;
+    req->status = NAGI_LLM_REQUEST_PENDING;
+    req->priority = WORKER_INTERACTIVE;
+
+    llm_mutex_lock(&worker->queue_lock);
+    worker_push(worker, req);
+    llm_mutex_unlock(&worker->queue_lock);
+
+    return req;
+}
+
+/*
+ * Queue a speculative extraction behind the responses
+ */
+nagi_llm_request_t *nagi_llm_extract_words_async(nagi_llm_t *llm, const char *input)
+{
+    struct nagi_llm_worker *worker;
+    nagi_llm_request_t *req;
+
+    if (!llm || !input || !llm->extract_words || !nagi_llm_ready(llm)) return NULL;
+
+    worker = worker_get(llm);
+    if (!worker) return NULL;
+
+    req = (nagi_llm_request_t *)calloc(1, sizeof(nagi_llm_request_t));
+    if (!req) return NULL;
+
+    req->game_response = dup_string(input);
+    if (!req->game_response) {
+        request_destroy(req);
+        return NULL;
+    }
+    req->worker = worker;
+    req->status = NAGI_LLM_REQUEST_PENDING;
+    req->extract = 1;
+    req->priority = WORKER_NEAR;
+
+    llm_mutex_lock(&worker->queue_lock);
+    worker_push(worker, req);
+    llm_mutex_unlock(&worker->queue_lock);
+
+    return req;
+}
+
+/*
+ * Queue a game message for translation into the cache, behind everything
+ * else. Nobody waits on it, the worker frees it when it's done.
+ */
+int nagi_llm_pretranslate_async(nagi_llm_t *llm, const char *game_response)
+{
+    struct nagi_llm_worker *worker;
+    nagi_llm_request_t *req;
+    char cached[NAGI_LLM_MAX_RESPONSE_SIZE];
+
+    if (!llm || !game_response || game_response[0] == '\0' || !nagi_llm_ready(llm)) return 0;
+    /* Until the player has typed something it's not known what to translate into */
+    if (!llm->state || llm->state->detected_language[0] == '\0') return 0;
+    /* An English player reads the game's own text */
+    if (!nagi_llm_wants_response(llm)) return 0;
+    if (nagi_llm_cache_lookup(llm, game_response, NULL, cached, sizeof(cached)) > 0) return 0;
+
+    worker = worker_get(llm);
+    if (!worker) return 0;
+
+    req = (nagi_llm_request_t *)calloc(1, sizeof(nagi_llm_request_t));
+    if (!req) return 0;
+
+    req->game_response = dup_string(game_response);
+    req->user_input = dup_string("");
+    if (!req->game_response || !req->user_input) {
+        request_destroy(req);
+        return 0;
+    }
+    req->worker = worker;
+    req->status = NAGI_LLM_REQUEST_PENDING;
+    req->detached = 1;
+    req->priority = WORKER_BACKGROUND;
+
+    llm_mutex_lock(&worker->queue_lock);
+    worker_push(worker, req);
+    llm_mutex_unlock(&worker->queue_lock);
+
+    return 1;
+}
+
+/*
+ * Drop the pre-translations that haven't started, the player left the room
+ */
+void nagi_llm_pretranslate_cancel(nagi_llm_t *llm)
+{
+    struct nagi_llm_worker *worker;
+    nagi_llm_request_t *req, *next;
+
+    if (!llm || !llm->worker) return;
+    worker = llm->worker;
+
+    llm_mutex_lock(&worker->queue_lock);
+    for (req = worker->head[WORKER_BACKGROUND]; req; req = next) {
+        next = req->next;
+        request_destroy(req);
+    }
+    worker->head[WORKER_BACKGROUND] = NULL;
+    worker->tail[WORKER_BACKGROUND] = NULL;
+    llm_mutex_unlock(&worker->queue_lock);
+}
+
+/*
+ * Count the requests waiting for the worker and the ones it is running
+ */
+void nagi_llm_async_load(nagi_llm_t *llm, int *queued, int *running)
+{
+    struct nagi_llm_worker *worker;
+    nagi_llm_request_t *req;
+    int c;
+
+    *queued = 0;
+    *running = 0;
+    if (!llm || !llm->worker) return;
+    worker = llm->worker;
+
+    llm_mutex_lock(&worker->queue_lock);
+    for (c = 0; c < WORKER_CLASSES; c++) {
+        for (req = worker->head[c]; req; req = req->next) (*queued)++;
+    }
+    *running = worker->n_running + (worker->current ? 1 : 0);
+    llm_mutex_unlock(&worker->queue_lock);
+}
+
+/*
+ * Whether the game is waiting on the model: a synchronous call, or an
+ * async request that isn't background work, queued or running
+ */
+int nagi_llm_async_interactive(nagi_llm_t *llm)
+{
+    struct nagi_llm_worker *worker;
+    int c, busy;
+
+    if (!llm || !llm->worker) return 0;
+    worker = llm->worker;
+
+    llm_mutex_lock(&worker->queue_lock);
+    busy = worker->waiting > 0 || worker->calling > 0 ||
+           worker->n_running > worker->n_background ||
+           (worker->current && worker->current->priority != WORKER_BACKGROUND);
+    for (c = 0; c < WORKER_BACKGROUND && !busy; c++) {
+        busy = worker->head[c] != NULL;
+    }
+    llm_mutex_unlock(&worker->queue_lock);
+    return busy;
+}
+
+void nagi_llm_set_wake(nagi_llm_t *llm, nagi_llm_wake_cb_t on_wake, void *userdata)
+{
+    if (!llm) return;
+    llm->wake_userdata = userdata;
+    llm->on_wake = on_wake;
+}
+
+/*
+ * The request's worker is read once: the lock taken is the one given back
+ * even if the worker lets go of the request in between
+ */
+nagi_llm_request_status_t nagi_llm_request_poll(nagi_llm_request_t *req)
+{
+    struct nagi_llm_worker *worker;
+    nagi_llm_request_status_t status;
+
+    if (!req) return NAGI_LLM_REQUEST_FAILED;
+    worker = req->worker;
+    if (!worker) return req->status;
+
+    llm_mutex_lock(&worker->queue_lock);
+    status = req->status;
+    llm_mutex_unlock(&worker->queue_lock);
+
+    return status;
+}
+
+int nagi_llm_request_partial(nagi_llm_request_t *req, char *buf, int buf_size)
+{
+    struct nagi_llm_worker *worker;
+    int len;
+
+    if (!req || !buf || buf_size <= 0) return 0;
+    worker = req->worker;
+    if (worker) llm_mutex_lock(&worker->queue_lock);
+    len = req->partial_len;
+    if (len >= buf_size) len = buf_size - 1;
+    memcpy(buf, req->partial, len);
+    buf[len] = '\0';
+    if (worker) llm_mutex_unlock(&worker->queue_lock);
+
+    return len;
+}
+
+int nagi_llm_request_language(nagi_llm_request_t *req, char *buf, int buf_size, float *confidence)
+{
+    struct nagi_llm_worker *worker;
+    int len;
+
+    if (!req || !buf || buf_size <= 0) return 0;
+    worker = req->worker;
+    if (worker) llm_mutex_lock(&worker->queue_lock);
+    len = (int)strlen(req->language);
+    if (len >= buf_size) len = buf_size - 1;
+    memcpy(buf, req->language, len);
+    buf[len] = '\0';
+    if (confidence) *confidence = req->language_confidence;
+    if (worker) llm_mutex_unlock(&worker->queue_lock);
+
+    return len;
+}
+
+const char *nagi_llm_request_result(nagi_llm_request_t *req)
+{
+    if (nagi_llm_request_poll(req) != NAGI_LLM_REQUEST_DONE) return NULL;
+    return req->output;
+}
+
+void nagi_llm_request_free(nagi_llm_request_t *req)
+{
+    struct nagi_llm_worker *worker;
+
+    if (!req) return;
+
+    worker = req->worker;
+    if (!worker) {
+        request_destroy(req);
+        return;
+    }
+
+    llm_mutex_lock(&worker->queue_lock);
+    if (req->running) {
+        /* Worker frees it once generation stops, which the token makes soon */
+        req->released = 1;
+        llm_atomic_store(&req->cancelled, 1);
+        llm_mutex_unlock(&worker->queue_lock);
+        return;
+    }
+
+    /* Drop it from the queue if it has not started yet */
+    worker_unlink(worker, req);
+    llm_mutex_unlock(&worker->queue_lock);
+
+    request_destroy(req);
+}
@@ -8,96 +8,431 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <ctype.h>
+#include <limits.h>
 #include <stdint.h>
 #include <stddef.h>
 
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif
+
 #include "../include/nagi_llm_context.h"
+#include "llm_thread.h"
 
-/* MSVC uses strtok_s instead of strtok_r */
-#ifdef _MSC_VER
-#define strtok_r(str, delim, saveptr) strtok_s(str, delim, saveptr)
-#endif
+static void watch_bit(u8 *map, int num)
+{
+    if (num >= 0 && num < 256) {
+        map[num >> 3] |= (u8)(0x80 >> (num & 7));
+    }
+}
+
+/*
+ * Room, object and flag description tables, kept in the layout of the
+ * compiled file: entries sorted by id pointing into a pool of NUL
+ * terminated strings. A compiled file is mapped and used as it is; the
+ * text loaders build the same layout in memory. Blocks are only released
+ * at shutdown, tracked flags keep pointers to their descriptions.
+ */
+#define DESC_MAGIC "NDSC"
+#define DESC_VERSION 1
+#define DESC_ORDER 0x01020304u
+
+enum { DESC_ROOMS, DESC_OBJECTS, DESC_FLAGS, DESC_TABLES };
+
+typedef struct {
+    int32_t id;
+    uint32_t text;      /* Pool offsets, 0 is the empty string */
+    uint32_t extra;     /* Exits of a room */
+} desc_entry_t;
+
+/* File: header, the entries of each table in turn, then the pool */
+typedef struct {
+    char magic[4];
+    uint32_t version;
+    uint32_t order;     /* DESC_ORDER in the byte order it was written in */
+    uint32_t count[DESC_TABLES];
+    uint32_t pool_size;
+} desc_head_t;
+
+typedef struct {
+    const desc_entry_t *entry;
+    uint32_t count;
+    const char *pool;
+} desc_table_t;
+
+typedef struct desc_block {
+    struct desc_block *next;
+    void *data;
+    size_t size;
+    int mapped;
+} desc_block_t;
+
+/* Entries and pool being put together */
+typedef struct {
+    desc_entry_t *entry;
+    uint32_t count, cap;
+    char *pool;
+    size_t pool_size, pool_cap;
+} desc_builder_t;
+
+/* What the game's hooks queue, see Context events */
+#define EVENT_QUEUE_SIZE 128    /* Power of two */
+
+enum {
+    EVENT_PRINT,
+    EVENT_UPDATE,
+    EVENT_INPUT,
+    EVENT_ROOM,
+    EVENT_FLAG,
+    EVENT_VAR
+};
+
+typedef struct {
+    int type;
+    int a, b;
+    char text[LLM_MAX_ENTRY_SIZE];
+} context_event_t;
+
+/* Text of the tracked flags' descriptions in a snapshot */
+#define SNAPSHOT_FLAG_TEXT 4096
+
+/*
+ * A snapshot is the game state up to the tracked flags, then the flags by
+ * number and value. Descriptions go as text, the session's own pointers
+ * mean nothing in another process.
+ */
+typedef struct {
+    int32_t flag_num;
+    int32_t value;
+    uint16_t at;        /* Description in text */
+    uint16_t len;
+} snapshot_flag_t;
+
+typedef struct {
+    int32_t count;
+    snapshot_flag_t flag[64];
+    char text[SNAPSHOT_FLAG_TEXT];
+} snapshot_flags_t;
+
+/*
+ * Everything one game's context needs, sessions share nothing
+ */
+struct nagi_llm_session {
+    llm_context_t ctx;
+
+    /* Compiled context string (for LLM input), kept out of the game state */
+    char built[LLM_MAX_CONTEXT_SIZE];
+
+    /* Guards ctx, the LLM worker reads it */
+    llm_mutex_t mutex;
+
+    /* Token measurement for the context budget */
+    llm_context_token_count_t token_count;
+    void *token_count_userdata;
+    int token_budget;
+
+    context_event_t events[EVENT_QUEUE_SIZE];
+    volatile unsigned int event_head;   /* Next to write, the game's */
+    volatile unsigned int event_tail;   /* Next to fold, under the lock */
+
+    /* Blocks are only released with the session, tracked flags keep
+       pointers to their descriptions */
+    desc_table_t desc_tables[DESC_TABLES];
+    desc_block_t *desc_blocks;
+
+    /* Descriptions of flags only a restored snapshot knows of */
+    char flag_text[SNAPSHOT_FLAG_TEXT];
+    int flag_text_used;
+
+    u8 flag_watch[32];
+    u8 var_watch[32];
+};
+
+/* Entry of a table with this id, NULL if there's none */
+static const desc_entry_t *desc_find(nagi_llm_session_t *s, int table, int id)
+{
+    const desc_table_t *t = &s->desc_tables[table];
+    uint32_t lo = 0, hi = t->count;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (t->entry[mid].id < id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo < t->count && t->entry[lo].id == id) {
+        return &t->entry[lo];
+    }
+    return NULL;
+}
 
-/* Global context instance */
-llm_context_t g_llm_context = {0};
+static int count_tokens(nagi_llm_session_t *s, const char *text, int len)
+{
+    if (len <= 0) return 0;
+    if (s->token_count) return s->token_count(text, len, s->token_count_userdata);
+    return (len + 3) / 4;
+}
 
-/* Internal room descriptions storage */
-static struct {
-    int room_num;
-    char description[LLM_MAX_ROOM_DESC_SIZE];
-    char exits[256];
-} room_descs[256];
-static int room_descs_count = 0;
+/*
+ * A section changed, format it again on the next build
+ */
+static void segment_invalidate(nagi_llm_session_t *s, llm_context_segment_id_t id)
+{
+    if (!s) return;
+    s->ctx.segments[id].dirty = 1;
+    s->ctx.context_dirty = 1;
+}
 
-/* Internal object names storage */
-static struct {
-    int obj_id;
-    char name[64];
-} object_names[256];
-static int object_names_count = 0;
+/*
+ * Everything changed, or is measured differently now
+ */
+static void segment_invalidate_all(nagi_llm_session_t *s)
+{
+    if (!s) return;
+    for (int i = 0; i < LLM_SEG_COUNT; i++) {
+        s->ctx.segments[i].dirty = 1;
+    }
+    for (int i = 0; i < LLM_MAX_HISTORY_ENTRIES; i++) {
+        s->ctx.history[i].tokens = -1;
+    }
+    s->ctx.context_dirty = 1;
+}
 
 /*
- * Initialize the LLM context system
+ * Start a game's context
+ * Nothing is allocated until then, a game without an LLM doesn't pay for
+ * the context. Each session is independent, one per game or client.
  */
-void llm_context_init(void)
+static void desc_free_all(nagi_llm_session_t *s);
+
+nagi_llm_session_t *nagi_llm_session_new(void)
 {
-    memset(&g_llm_context, 0, sizeof(g_llm_context));
-    g_llm_context.context_dirty = 1;
+    nagi_llm_session_t *s;
+
+    s = (nagi_llm_session_t *)calloc(1, sizeof(*s));
+    if (!s) {
+        fprintf(stderr, "LLM Context: Out of memory\n");
+        return NULL;
+    }
+
+    llm_mutex_init(&s->mutex);
+    s->token_budget = LLM_DEFAULT_CONTEXT_TOKENS;
+    watch_bit(s->var_watch, 3);    /* The score */
+    s->ctx.history_serial = 1;
+    segment_invalidate_all(s);
     printf("LLM Context: Initialized\n");
+    return s;
 }
 
 /*
- * Shutdown the LLM context system
+ * End a game's context, nobody may use it any more
  */
-void llm_context_shutdown(void)
+void nagi_llm_session_free(nagi_llm_session_t *s)
 {
-    memset(&g_llm_context, 0, sizeof(g_llm_context));
+    if (!s) return;
+    desc_free_all(s);
+    llm_mutex_destroy(&s->mutex);
+    free(s);
     printf("LLM Context: Shutdown\n");
 }
 
+/*
+ * The session's context, under llm_context_lock
+ */
+llm_context_t *llm_context_state(nagi_llm_session_t *s)
+{
+    return s ? &s->ctx : NULL;
+}
+
+/*
+ * Which flags and variables the game reports changes of, one bit each
+ */
+const u8 *llm_context_flag_watch(nagi_llm_session_t *s)
+{
+    return s ? s->flag_watch : NULL;
+}
+
+const u8 *llm_context_var_watch(nagi_llm_session_t *s)
+{
+    return s ? s->var_watch : NULL;
+}
+
 /*
  * Clear all context history
  */
-void llm_context_clear(void)
+void llm_context_clear(nagi_llm_session_t *s)
 {
-    g_llm_context.history_head = 0;
-    g_llm_context.history_count = 0;
-    g_llm_context.context_dirty = 1;
+    llm_context_lock(s);
+    if (!s) {
+        llm_context_unlock(s);
+        return;
+    }
+    s->ctx.history_head = 0;
+    s->ctx.history_count = 0;
+    s->ctx.history_epoch++;
+    memset(s->ctx.strings, 0, sizeof(s->ctx.strings));
+    s->ctx.history_text_used = 0;
+    s->ctx.context_dirty = 1;
+    llm_context_unlock(s);
+}
+
+static u32 string_hash(const char *text, int len)
+{
+    u32 hash = 2166136261u;
+
+    for (int i = 0; i < len; i++) {
+        hash = (hash ^ (unsigned char)text[i]) * 16777619u;
+    }
+    return hash;
 }
 
 /*
- * Add an entry to the context history
+ * Slide the history strings in use to the start of the text, in order
  */
-void llm_context_add(llm_context_type_t type, const char *text)
+static void strings_compact(nagi_llm_session_t *s)
+{
+    llm_context_string_t *str = s->ctx.strings;
+    int order[LLM_MAX_HISTORY_ENTRIES + 1];
+    int n = 0, at = 0;
+
+    for (int i = 1; i <= LLM_MAX_HISTORY_ENTRIES; i++) {
+        int j;
+
+        if (str[i].refs == 0) continue;
+        for (j = n; j > 0 && str[order[j - 1]].at > str[i].at; j--) {
+            order[j] = order[j - 1];
+        }
+        order[j] = i;
+        n++;
+    }
+    for (int i = 0; i < n; i++) {
+        llm_context_string_t *e = &str[order[i]];
+
+        if (e->at != at) {
+            memmove(s->ctx.history_text + at, s->ctx.history_text + e->at, e->len + 1);
+            e->at = (u16)at;
+        }
+        at += e->len + 1;
+    }
+    s->ctx.history_text_used = at;
+}
+
+static void string_release(nagi_llm_session_t *s, int id)
+{
+    if (id != 0 && s->ctx.strings[id].refs > 0) {
+        s->ctx.strings[id].refs--;
+    }
+}
+
+static void history_drop_oldest(nagi_llm_session_t *s)
+{
+    string_release(s, s->ctx.history[s->ctx.history_head].text);
+    s->ctx.history_head = (s->ctx.history_head + 1) % LLM_MAX_HISTORY_ENTRIES;
+    s->ctx.history_count--;
+}
+
+/*
+ * Slot of the text, shared with any entry that has the same
+ * When the text is full the oldest entries go until it fits. There is
+ * always a free slot, one more than the entries that can use them.
+ */
+static int string_intern(nagi_llm_session_t *s, const char *text)
+{
+    llm_context_string_t *str = s->ctx.strings;
+    int len = 0, free_slot = 0;
+    u32 hash;
+
+    while (len < LLM_MAX_ENTRY_SIZE - 1 && text[len]) len++;
+    if (len == 0) return 0;
+    hash = string_hash(text, len);
+
+    for (int i = 1; i <= LLM_MAX_HISTORY_ENTRIES; i++) {
+        if (str[i].refs == 0) {
+            if (!free_slot) free_slot = i;
+        } else if (str[i].hash == hash && str[i].len == len &&
+                   memcmp(s->ctx.history_text + str[i].at, text, len) == 0) {
+            str[i].refs++;
+            return i;
+        }
+    }
+
+    while (s->ctx.history_text_used + len + 1 > LLM_HISTORY_TEXT_SIZE) {
+        strings_compact(s);
+        if (s->ctx.history_text_used + len + 1 <= LLM_HISTORY_TEXT_SIZE) break;
+        history_drop_oldest(s);
+    }
+
+    str[free_slot].hash = hash;
+    str[free_slot].at = (u16)s->ctx.history_text_used;
+    str[free_slot].len = (u16)len;
+    str[free_slot].refs = 1;
+    memcpy(s->ctx.history_text + s->ctx.history_text_used, text, len);
+    s->ctx.history_text[s->ctx.history_text_used + len] = '\0';
+    s->ctx.history_text_used += len + 1;
+    return free_slot;
+}
+
+/*
+ * Add an entry to the history (lock held)
+ */
+static void history_add(nagi_llm_session_t *s, llm_context_type_t type, const char *text)
 {
     llm_context_entry_t *entry;
-    int idx;
+    int idx, id;
+
+    /* Buffer full, the oldest entry goes */
+    if (s->ctx.history_count >= LLM_MAX_HISTORY_ENTRIES) {
+        history_drop_oldest(s);
+    }
+    id = string_intern(s, text);
 
     /* Calculate insertion index (circular buffer) */
-    idx = (g_llm_context.history_head + g_llm_context.history_count) % LLM_MAX_HISTORY_ENTRIES;
+    idx = (s->ctx.history_head + s->ctx.history_count) % LLM_MAX_HISTORY_ENTRIES;
+    s->ctx.history_count++;
+
+    entry = &s->ctx.history[idx];
+    entry->type = (u8)type;
+    entry->text = (u8)id;
+    entry->timestamp = 0;  /* Game engine should set this via llm_context_set_room(s) if needed */
+    entry->room = (short)s->ctx.current_room;
+    entry->tokens = -1;
+    entry->serial = s->ctx.history_serial++;
+
+    s->ctx.context_dirty = 1;
+}
 
-    if (g_llm_context.history_count >= LLM_MAX_HISTORY_ENTRIES) {
-        /* Buffer full, overwrite oldest entry */
-        g_llm_context.history_head = (g_llm_context.history_head + 1) % LLM_MAX_HISTORY_ENTRIES;
-    } else {
-        g_llm_context.history_count++;
-    }
+static void history_addf(nagi_llm_session_t *s, llm_context_type_t type, const char *fmt, ...)
+{
+    char buffer[LLM_MAX_ENTRY_SIZE];
+    va_list args;
 
-    entry = &g_llm_context.history[idx];
-    entry->type = type;
-    entry->timestamp = 0;  /* Game engine should set this via llm_context_set_room() if needed */
-    entry->room = g_llm_context.current_room;
+    va_start(args, fmt);
+    vsnprintf(buffer, sizeof(buffer), fmt, args);
+    va_end(args);
 
-    strncpy(entry->text, text, LLM_MAX_ENTRY_SIZE - 1);
-    entry->text[LLM_MAX_ENTRY_SIZE - 1] = '\0';
+    history_add(s, type, buffer);
+}
 
-    g_llm_context.context_dirty = 1;
+/*
+ * Add an entry to the context history
+ */
+void llm_context_add(nagi_llm_session_t *s, llm_context_type_t type, const char *text)
+{
+    llm_context_lock(s);
+    if (s) history_add(s, type, text);
+    llm_context_unlock(s);
 }
 
 /*
  * Add a formatted entry to the context history
  */
-void llm_context_addf(llm_context_type_t type, const char *fmt, ...)
+void llm_context_addf(nagi_llm_session_t *s, llm_context_type_t type, const char *fmt, ...)
 {
     char buffer[LLM_MAX_ENTRY_SIZE];
     va_list args;
@@ -106,75 +441,102 @@ void llm_context_addf(llm_context_type_t type, const char *fmt, ...)
     vsnprintf(buffer, sizeof(buffer), fmt, args);
     va_end(args);
 
-    llm_context_add(type, buffer);
+    llm_context_add(s, type, buffer);
 }
 
 /*
- * Update room information
+ * Update room information (lock held)
  */
-void llm_context_set_room(int room_num, const char *description, const char *exits)
+static void room_set(nagi_llm_session_t *s, int room_num, const char *description, const char *exits)
 {
-    g_llm_context.room_info.room_num = room_num;
+    s->ctx.room_info.room_num = room_num;
 
     if (description) {
-        strncpy(g_llm_context.room_info.description, description,
+        strncpy(s->ctx.room_info.description, description,
                 LLM_MAX_ROOM_DESC_SIZE - 1);
-        g_llm_context.room_info.description[LLM_MAX_ROOM_DESC_SIZE - 1] = '\0';
+        s->ctx.room_info.description[LLM_MAX_ROOM_DESC_SIZE - 1] = '\0';
     }
 
     if (exits) {
-        strncpy(g_llm_context.room_info.exits, exits, sizeof(g_llm_context.room_info.exits) - 1);
-        g_llm_context.room_info.exits[sizeof(g_llm_context.room_info.exits) - 1] = '\0';
+        strncpy(s->ctx.room_info.exits, exits, sizeof(s->ctx.room_info.exits) - 1);
+        s->ctx.room_info.exits[sizeof(s->ctx.room_info.exits) - 1] = '\0';
     }
 
-    g_llm_context.current_room = room_num;
-    g_llm_context.context_dirty = 1;
+    s->ctx.current_room = room_num;
+    segment_invalidate(s, LLM_SEG_STATE);
+    segment_invalidate(s, LLM_SEG_ROOM);
+}
+
+/*
+ * Update room information
+ */
+void llm_context_set_room(nagi_llm_session_t *s, int room_num, const char *description, const char *exits)
+{
+    llm_context_lock(s);
+    if (s) room_set(s, room_num, description, exits);
+    llm_context_unlock(s);
 }
 
 /*
  * Add an object to context
  */
-void llm_context_add_object(int obj_id, const char *name, int room)
+void llm_context_add_object(nagi_llm_session_t *s, int obj_id, const char *name, int room)
 {
+    llm_context_lock(s);
+    if (!s) {
+        llm_context_unlock(s);
+        return;
+    }
+
     /* Store in room info if in current room */
-    if (room == g_llm_context.current_room) {
-        if (g_llm_context.room_info.object_count < 32) {
-            g_llm_context.room_info.objects[g_llm_context.room_info.object_count++] = obj_id;
+    if (room == s->ctx.current_room) {
+        if (s->ctx.room_info.object_count < 32) {
+            s->ctx.room_info.objects[s->ctx.room_info.object_count++] = obj_id;
         }
     }
 
     /* Store in inventory if carried */
     if (room == 255) {
-        if (g_llm_context.inventory_count < 32) {
-            g_llm_context.inventory[g_llm_context.inventory_count++] = obj_id;
+        if (s->ctx.inventory_count < 32) {
+            s->ctx.inventory[s->ctx.inventory_count++] = obj_id;
         }
+        segment_invalidate(s, LLM_SEG_INVENTORY);
     }
-
-    g_llm_context.context_dirty = 1;
+    llm_context_unlock(s);
 }
 
 /*
  * Update inventory in context
  */
-void llm_context_update_inventory(void)
+void llm_context_update_inventory(nagi_llm_session_t *s)
 {
     /* TODO: Iterate through actual game objects and update inventory list */
-    g_llm_context.context_dirty = 1;
+    if (!s) return;
+    llm_context_lock(s);
+    segment_invalidate(s, LLM_SEG_INVENTORY);
+    llm_context_unlock(s);
 }
 
 /*
  * Track a flag for context
  */
-void llm_context_track_flag(int flag_num, const char *description)
+void llm_context_track_flag(nagi_llm_session_t *s, int flag_num, const char *description)
 {
     int idx;
 
-    if (g_llm_context.tracked_flags_count >= 64) return;
+    llm_context_lock(s);
+    if (!s || s->ctx.tracked_flags_count >= 64) {
+        llm_context_unlock(s);
+        return;
+    }
 
-    idx = g_llm_context.tracked_flags_count++;
-    g_llm_context.tracked_flags[idx].flag_num = flag_num;
-    g_llm_context.tracked_flags[idx].description = description;
-    g_llm_context.tracked_flags[idx].value = 0;
+    idx = s->ctx.tracked_flags_count++;
+    s->ctx.tracked_flags[idx].flag_num = flag_num;
+    s->ctx.tracked_flags[idx].description = description;
+    s->ctx.tracked_flags[idx].value = 0;
+    watch_bit(s->flag_watch, flag_num);
+    segment_invalidate(s, LLM_SEG_FLAGS);
+    llm_context_unlock(s);
 }
 
 /*
@@ -198,261 +560,735 @@ static const char *context_type_str(llm_context_type_t type)
 }
 
 /*
- * Build the context string for LLM input
+ * Append to a section, only if the whole piece fits
  */
-const char *llm_context_build(void)
+static void segment_printf(llm_context_segment_t *seg, const char *fmt, ...)
 {
-    char *buf = g_llm_context.context_buffer;
-    int remaining = LLM_MAX_CONTEXT_SIZE;
+    int remaining = LLM_MAX_SEGMENT_SIZE - seg->len;
     int written;
+    va_list args;
 
-    if (!g_llm_context.context_dirty) {
-        return buf;
+    va_start(args, fmt);
+    written = vsnprintf(seg->text + seg->len, remaining, fmt, args);
+    va_end(args);
+
+    if (written > 0 && written < remaining) {
+        seg->len += written;
+    } else {
+        seg->text[seg->len] = '\0';
     }
+}
 
-    buf[0] = '\0';
+/*
+ * Format one section and measure it
+ */
+static void segment_build(nagi_llm_session_t *s, llm_context_segment_id_t id)
+{
+    llm_context_segment_t *seg = &s->ctx.segments[id];
+
+    seg->len = 0;
+    seg->text[0] = '\0';
+
+    switch (id) {
+        case LLM_SEG_STATE:
+            segment_printf(seg,
+                "=== GAME STATE ===\n"
+                "Room: %d\n"
+                "Score: %d/%d\n\n",
+                s->ctx.current_room,
+                s->ctx.score,
+                s->ctx.max_score);
+            break;
+
+        case LLM_SEG_ROOM:
+            if (s->ctx.room_info.description[0]) {
+                segment_printf(seg, "=== CURRENT LOCATION ===\n%s\n",
+                    s->ctx.room_info.description);
+                if (s->ctx.room_info.exits[0]) {
+                    segment_printf(seg, "Exits: %s\n", s->ctx.room_info.exits);
+                }
+                segment_printf(seg, "\n");
+            }
+            break;
 
-    /* Header with current state */
-    written = snprintf(buf, remaining,
-        "=== GAME STATE ===\n"
-        "Room: %d\n"
-        "Score: %d/%d\n\n",
-        g_llm_context.current_room,
-        g_llm_context.score,
-        g_llm_context.max_score);
+        case LLM_SEG_INVENTORY:
+            if (s->ctx.inventory_count > 0) {
+                segment_printf(seg, "=== INVENTORY ===\n");
+                for (int i = 0; i < s->ctx.inventory_count; i++) {
+                    int obj_id = s->ctx.inventory[i];
+                    const desc_entry_t *e = desc_find(s, DESC_OBJECTS, obj_id);
+                    const char *name = "unknown object";
+
+                    if (e) {
+                        name = s->desc_tables[DESC_OBJECTS].pool + e->text;
+                    }
+                    segment_printf(seg, "- %s\n", name);
+                }
+                segment_printf(seg, "\n");
+            }
+            break;
 
-    if (written > 0 && written < remaining) {
-        buf += written;
-        remaining -= written;
+        case LLM_SEG_FLAGS:
+            if (s->ctx.tracked_flags_count > 0) {
+                segment_printf(seg, "=== GAME FLAGS ===\n");
+                for (int i = 0; i < s->ctx.tracked_flags_count; i++) {
+                    if (s->ctx.tracked_flags[i].value) {
+                        segment_printf(seg, "- %s\n", s->ctx.tracked_flags[i].description);
+                    }
+                }
+                segment_printf(seg, "\n");
+            }
+            break;
+
+        case LLM_SEG_EVENTS:
+            segment_printf(seg, "=== RECENT EVENTS ===\n");
+            break;
+
+        default:
+            break;
     }
 
-    /* Room description if available */
-    if (g_llm_context.room_info.description[0]) {
-        written = snprintf(buf, remaining,
-            "=== CURRENT LOCATION ===\n%s\n",
-            g_llm_context.room_info.description);
+    seg->tokens = count_tokens(s, seg->text, seg->len);
+    seg->dirty = 0;
+}
 
-        if (written > 0 && written < remaining) {
-            buf += written;
-            remaining -= written;
-        }
+/*
+ * Text of a history entry
+ */
+const char *llm_context_entry_text(nagi_llm_session_t *s, const llm_context_entry_t *entry)
+{
+    if (entry->text == 0 || !s) return "";
+    return s->ctx.history_text + s->ctx.strings[entry->text].at;
+}
 
-        if (g_llm_context.room_info.exits[0]) {
-            written = snprintf(buf, remaining, "Exits: %s\n",
-                g_llm_context.room_info.exits);
-            if (written > 0 && written < remaining) {
-                buf += written;
-                remaining -= written;
-            }
-        }
-        written = snprintf(buf, remaining, "\n");
-        if (written > 0 && written < remaining) {
-            buf += written;
-            remaining -= written;
-        }
+/*
+ * Format a history entry the way the context shows it
+ */
+int llm_context_format_entry(nagi_llm_session_t *s, const llm_context_entry_t *entry, char *buf, int size)
+{
+    int written = snprintf(buf, size, "[%s] %s\n", context_type_str((llm_context_type_t)entry->type),
+                           llm_context_entry_text(s, entry));
+
+    if (written < 0) return 0;
+    return written < size ? written : size - 1;
+}
+
+/* History ranking: recency first, raised by what the entry is about */
+#define HISTORY_SCORE_ROOM 20       /* Happened in the current room */
+#define HISTORY_SCORE_MENTION 40    /* Names an object the last input names */
+#define HISTORY_FOCUS_WORDS 8
+#define HISTORY_WORD_SIZE 24
+
+/* Next word of the text lowercased, 0 at the end */
+static int next_word(const char **text, char *word, int size)
+{
+    const char *p = *text;
+    int n = 0;
+
+    while (*p && !isalnum((unsigned char)*p)) p++;
+    while (isalnum((unsigned char)*p)) {
+        if (n < size - 1) word[n++] = (char)tolower((unsigned char)*p);
+        p++;
     }
+    word[n] = '\0';
+    *text = p;
+    return n > 0;
+}
+
+static int text_has_word(const char *text, const char *word)
+{
+    char w[HISTORY_WORD_SIZE];
+
+    while (next_word(&text, w, sizeof(w))) {
+        if (strcmp(w, word) == 0) return 1;
+    }
+    return 0;
+}
 
-    /* Inventory */
-    if (g_llm_context.inventory_count > 0) {
-        written = snprintf(buf, remaining, "=== INVENTORY ===\n");
-        if (written > 0 && written < remaining) {
-            buf += written;
-            remaining -= written;
+/* A word of some object's name; any longer word if no names are loaded */
+static int word_names_object(nagi_llm_session_t *s, const char *word)
+{
+    const desc_table_t *t = &s->desc_tables[DESC_OBJECTS];
+
+    if (t->count == 0) return strlen(word) >= 4;
+    for (uint32_t i = 0; i < t->count; i++) {
+        if (text_has_word(t->pool + t->entry[i].text, word)) return 1;
+    }
+    return 0;
+}
+
+/*
+ * Words of the last player input that name objects (lock held)
+ */
+static int history_focus(nagi_llm_session_t *s, char words[HISTORY_FOCUS_WORDS][HISTORY_WORD_SIZE])
+{
+    const char *input = NULL;
+    char w[HISTORY_WORD_SIZE];
+    int count = 0;
+
+    for (int i = s->ctx.history_count - 1; i >= 0 && !input; i--) {
+        const llm_context_entry_t *entry =
+            &s->ctx.history[(s->ctx.history_head + i) % LLM_MAX_HISTORY_ENTRIES];
+
+        if (entry->type == CTX_PLAYER_INPUT && entry->text != 0) {
+            input = llm_context_entry_text(s, entry);
         }
+    }
+    if (!input) return 0;
 
-        for (int i = 0; i < g_llm_context.inventory_count; i++) {
-            int obj_id = g_llm_context.inventory[i];
-            const char *name = "unknown object";
+    while (count < HISTORY_FOCUS_WORDS && next_word(&input, w, sizeof(w))) {
+        int seen = 0;
 
-            /* Look up object name */
-            for (int j = 0; j < object_names_count; j++) {
-                if (object_names[j].obj_id == obj_id) {
-                    name = object_names[j].name;
-                    break;
-                }
-            }
+        if (strlen(w) < 3 || !word_names_object(s, w)) continue;
+        for (int i = 0; i < count && !seen; i++) {
+            seen = strcmp(words[i], w) == 0;
+        }
+        if (!seen) strcpy(words[count++], w);
+    }
+    return count;
+}
 
-            written = snprintf(buf, remaining, "- %s\n", name);
-            if (written > 0 && written < remaining) {
-                buf += written;
-                remaining -= written;
+/*
+ * Pick the history entries worth their room (lock held)
+ * Each is scored on recency, the current room and naming an object the
+ * last input names. The best that fit are taken, up to max; the rooms
+ * left are updated and idx comes back with ring positions, oldest first.
+ */
+static int history_select(nagi_llm_session_t *s, int *idx, int max, int *token_room, int *byte_room)
+{
+    char focus[HISTORY_FOCUS_WORDS][HISTORY_WORD_SIZE];
+    char line[LLM_MAX_ENTRY_SIZE + 16];
+    int score[LLM_MAX_HISTORY_ENTRIES];
+    int order[LLM_MAX_HISTORY_ENTRIES];
+    int picked[LLM_MAX_HISTORY_ENTRIES] = {0};
+    int n = s->ctx.history_count;
+    int focus_count = history_focus(s, focus);
+    int chosen = 0;
+
+    /* By age, 0 the newest; ties keep the newer first */
+    for (int age = 0; age < n; age++) {
+        const llm_context_entry_t *entry =
+            &s->ctx.history[(s->ctx.history_head + n - 1 - age) % LLM_MAX_HISTORY_ENTRIES];
+        const char *text = llm_context_entry_text(s, entry);
+        int j;
+
+        score[age] = LLM_MAX_HISTORY_ENTRIES - age;
+        if (entry->room == s->ctx.current_room) {
+            score[age] += HISTORY_SCORE_ROOM;
+        }
+        for (int f = 0; f < focus_count; f++) {
+            if (text_has_word(text, focus[f])) {
+                score[age] += HISTORY_SCORE_MENTION;
+                break;
             }
         }
-        written = snprintf(buf, remaining, "\n");
-        if (written > 0 && written < remaining) {
-            buf += written;
-            remaining -= written;
+        for (j = age; j > 0 && score[order[j - 1]] < score[age]; j--) {
+            order[j] = order[j - 1];
         }
+        order[j] = age;
     }
 
-    /* Tracked flags (game state) */
-    if (g_llm_context.tracked_flags_count > 0) {
-        written = snprintf(buf, remaining, "=== GAME FLAGS ===\n");
-        if (written > 0 && written < remaining) {
-            buf += written;
-            remaining -= written;
-        }
+    for (int k = 0; k < n && chosen < max; k++) {
+        int age = order[k];
+        llm_context_entry_t *entry =
+            &s->ctx.history[(s->ctx.history_head + n - 1 - age) % LLM_MAX_HISTORY_ENTRIES];
+        int line_len = (int)strlen(context_type_str((llm_context_type_t)entry->type)) +
+                       (entry->text ? s->ctx.strings[entry->text].len : 0) + 4;
 
-        for (int i = 0; i < g_llm_context.tracked_flags_count; i++) {
-            if (g_llm_context.tracked_flags[i].value) {
-                written = snprintf(buf, remaining, "- %s\n",
-                    g_llm_context.tracked_flags[i].description);
-                if (written > 0 && written < remaining) {
-                    buf += written;
-                    remaining -= written;
-                }
-            }
+        if (entry->tokens < 0) {
+            entry->tokens = (short)count_tokens(s, line, llm_context_format_entry(s, entry, line, sizeof(line)));
         }
-        written = snprintf(buf, remaining, "\n");
-        if (written > 0 && written < remaining) {
-            buf += written;
-            remaining -= written;
+        if (entry->tokens > *token_room || line_len > *byte_room) {
+            continue;
         }
+        *token_room -= entry->tokens;
+        *byte_room -= line_len;
+        picked[age] = 1;
+        chosen++;
     }
 
-    /* Recent history */
-    written = snprintf(buf, remaining, "=== RECENT EVENTS ===\n");
-    if (written > 0 && written < remaining) {
-        buf += written;
-        remaining -= written;
+    chosen = 0;
+    for (int age = n - 1; age >= 0; age--) {
+        if (picked[age]) {
+            idx[chosen++] = (s->ctx.history_head + n - 1 - age) % LLM_MAX_HISTORY_ENTRIES;
+        }
     }
+    return chosen;
+}
 
-    /* Show last N entries from history */
-    int start_idx = 0;
-    int show_count = g_llm_context.history_count;
-    if (show_count > 20) {
-        start_idx = show_count - 20;
-        show_count = 20;
+/*
+ * Assemble the context string into the session's cache (lock held)
+ */
+static int context_assemble(nagi_llm_session_t *s)
+{
+    char *buf = s->built;
+    int idx[LLM_MAX_CONTEXT_EVENTS];
+    int len = 0;
+    int tokens = 0;
+    int token_room, byte_room, selected;
+
+    /* Nothing has been formatted yet */
+    if (s->ctx.segments[LLM_SEG_EVENTS].len == 0) {
+        segment_invalidate_all(s);
     }
 
-    for (int i = 0; i < show_count; i++) {
-        int idx = (g_llm_context.history_head + start_idx + i) % LLM_MAX_HISTORY_ENTRIES;
-        llm_context_entry_t *entry = &g_llm_context.history[idx];
+    if (!s->ctx.context_dirty) {
+        return (int)strlen(buf);
+    }
 
-        written = snprintf(buf, remaining, "[%s] %s\n",
-            context_type_str(entry->type), entry->text);
-        if (written > 0 && written < remaining) {
-            buf += written;
-            remaining -= written;
+    buf[0] = '\0';
+
+    /* Sections in order, any that would overflow the budget is left out */
+    for (int i = 0; i < LLM_SEG_COUNT; i++) {
+        llm_context_segment_t *seg = &s->ctx.segments[i];
+
+        if (seg->dirty) {
+            segment_build(s, (llm_context_segment_id_t)i);
+        }
+        if (seg->len == 0 || tokens + seg->tokens > s->token_budget ||
+            len + seg->len >= LLM_MAX_CONTEXT_SIZE) {
+            continue;
         }
+        memcpy(buf + len, seg->text, seg->len + 1);
+        len += seg->len;
+        tokens += seg->tokens;
     }
 
-    g_llm_context.context_dirty = 0;
-    return g_llm_context.context_buffer;
+    /* The most relevant history fills what is left of the budget */
+    token_room = s->token_budget - tokens;
+    byte_room = LLM_MAX_CONTEXT_SIZE - 1 - len;
+    selected = history_select(s, idx, LLM_MAX_CONTEXT_EVENTS, &token_room, &byte_room);
+
+    /* Oldest first, as they happened */
+    for (int i = 0; i < selected; i++) {
+        len += llm_context_format_entry(s, &s->ctx.history[idx[i]], buf + len, LLM_MAX_CONTEXT_SIZE - len);
+    }
+
+    s->ctx.context_tokens = s->token_budget - token_room;
+    s->ctx.context_dirty = 0;
+    return len;
 }
 
 /*
- * Force rebuild of context string
+ * Build the context string for LLM input into buffer, cut at size
  */
-void llm_context_invalidate(void)
+int llm_context_build(nagi_llm_session_t *s, char *buffer, int size)
 {
-    g_llm_context.context_dirty = 1;
+    int len;
+
+    if (size <= 0) return 0;
+    buffer[0] = '\0';
+
+    llm_context_lock(s);
+
+    /* Without a session there's no context */
+    if (!s) {
+        llm_context_unlock(s);
+        return 0;
+    }
+
+    len = context_assemble(s);
+    if (len > size - 1) len = size - 1;
+    memcpy(buffer, s->built, (size_t)len);
+    buffer[len] = '\0';
+    llm_context_unlock(s);
+    return len;
 }
 
 /*
- * Get recent history as a string
+ * Set the token budget of the built context
  */
-void llm_context_get_history(char *buffer, int buffer_size, int max_entries)
+void llm_context_set_token_budget(nagi_llm_session_t *s, int tokens)
 {
-    char *buf = buffer;
-    int remaining = buffer_size;
-    int written;
+    if (!s) return;
+    llm_context_lock(s);
+    s->token_budget = tokens > 0 ? tokens : LLM_DEFAULT_CONTEXT_TOKENS;
+    s->ctx.context_dirty = 1;
+    llm_context_unlock(s);
+}
 
-    buf[0] = '\0';
+/*
+ * Set how context text is measured in tokens
+ */
+void llm_context_set_token_counter(nagi_llm_session_t *s, llm_context_token_count_t count, void *userdata)
+{
+    if (!s) return;
+    llm_context_lock(s);
+    s->token_count = count;
+    s->token_count_userdata = userdata;
+    segment_invalidate_all(s);
+    llm_context_unlock(s);
+}
 
-    int start_idx = 0;
-    int show_count = g_llm_context.history_count;
-    if (show_count > max_entries) {
-        start_idx = show_count - max_entries;
-        show_count = max_entries;
+/*
+ * Tokens in the last built context
+ */
+int llm_context_tokens(nagi_llm_session_t *s)
+{
+    return s ? s->ctx.context_tokens : 0;
+}
+
+static void events_fold(nagi_llm_session_t *s);
+
+void llm_context_lock(nagi_llm_session_t *s)
+{
+    if (s) {
+        llm_mutex_lock(&s->mutex);
     }
+    /* Whoever looks at the context sees everything queued before */
+    events_fold(s);
+}
 
-    for (int i = 0; i < show_count; i++) {
-        int idx = (g_llm_context.history_head + start_idx + i) % LLM_MAX_HISTORY_ENTRIES;
-        llm_context_entry_t *entry = &g_llm_context.history[idx];
+void llm_context_unlock(nagi_llm_session_t *s)
+{
+    if (s) {
+        llm_mutex_unlock(&s->mutex);
+    }
+}
 
-        written = snprintf(buf, remaining, "[%s] %s\n",
-            context_type_str(entry->type), entry->text);
-        if (written > 0 && written < remaining) {
-            buf += written;
-            remaining -= written;
-        }
+/*
+ * Get one formatted section, rebuilt first if it changed
+ */
+const char *llm_context_segment(nagi_llm_session_t *s, llm_context_segment_id_t id, int *len)
+{
+    llm_context_segment_t *seg;
+
+    if (!s) {
+        if (len) *len = 0;
+        return "";
     }
+    seg = &s->ctx.segments[id];
+    if (seg->dirty || s->ctx.segments[LLM_SEG_EVENTS].len == 0) {
+        segment_build(s, id);
+    }
+    if (len) *len = seg->len;
+    return seg->text;
 }
 
 /*
- * Callback: Game printed text
+ * Force rebuild of context string
  */
-void llm_context_on_print(const char *text)
+void llm_context_invalidate(nagi_llm_session_t *s)
 {
-    llm_context_add(CTX_GAME_OUTPUT, text);
+    if (!s) return;
+    llm_context_lock(s);
+    segment_invalidate_all(s);
+    llm_context_unlock(s);
 }
 
 /*
- * Callback: Room changed
+ * The game state up to the tracked flags, then the flags, none without a
+ * context
  */
-void llm_context_on_room_change(int old_room, int new_room)
+int llm_context_snapshot_size(nagi_llm_session_t *s)
 {
-    llm_context_addf(CTX_ROOM_CHANGE, "Moved from room %d to room %d", old_room, new_room);
+    return s ? (int)(offsetof(llm_context_t, tracked_flags) + sizeof(snapshot_flags_t)) : 0;
+}
 
-    /* Look up room description */
-    for (int i = 0; i < room_descs_count; i++) {
-        if (room_descs[i].room_num == new_room) {
-            llm_context_set_room(new_room,
-                room_descs[i].description,
-                room_descs[i].exits);
-            break;
+void llm_context_snapshot(nagi_llm_session_t *s, void *buf)
+{
+    snapshot_flags_t flags;
+    const char *desc;
+    size_t len, used = 0;
+    int i;
+
+    if (!s) return;
+    memset(&flags, 0, sizeof(flags));
+
+    llm_context_lock(s);
+    memcpy(buf, &s->ctx, offsetof(llm_context_t, tracked_flags));
+    flags.count = s->ctx.tracked_flags_count;
+    for (i = 0; i < s->ctx.tracked_flags_count; i++) {
+        desc = s->ctx.tracked_flags[i].description;
+        len = desc ? strlen(desc) : 0;
+        if (len > sizeof(flags.text) - used) len = sizeof(flags.text) - used;
+        if (len > 0) memcpy(flags.text + used, desc, len);
+        flags.flag[i].flag_num = s->ctx.tracked_flags[i].flag_num;
+        flags.flag[i].value = s->ctx.tracked_flags[i].value;
+        flags.flag[i].at = (uint16_t)used;
+        flags.flag[i].len = (uint16_t)len;
+        used += len;
+    }
+    llm_context_unlock(s);
+
+    memcpy((char *)buf + offsetof(llm_context_t, tracked_flags), &flags, sizeof(flags));
+}
+
+/*
+ * Flags the session tracks keep their own descriptions and take the
+ * snapshot's values. Ones it doesn't track get the snapshot's text, so a
+ * server's session shows a client's flags.
+ */
+static void snapshot_restore_flags(nagi_llm_session_t *s, const snapshot_flags_t *flags)
+{
+    const snapshot_flag_t *f;
+    int i, j, n;
+
+    /* Drop the flags an earlier snapshot brought, their text goes */
+    n = 0;
+    for (i = 0; i < s->ctx.tracked_flags_count; i++) {
+        const char *desc = s->ctx.tracked_flags[i].description;
+        if (desc >= s->flag_text && desc < s->flag_text + sizeof(s->flag_text)) continue;
+        s->ctx.tracked_flags[n] = s->ctx.tracked_flags[i];
+        s->ctx.tracked_flags[n].value = 0;
+        n++;
+    }
+    s->ctx.tracked_flags_count = n;
+    s->flag_text_used = 0;
+
+    for (i = 0; i < flags->count && i < 64; i++) {
+        f = &flags->flag[i];
+        for (j = 0; j < s->ctx.tracked_flags_count; j++) {
+            if (s->ctx.tracked_flags[j].flag_num == f->flag_num) break;
+        }
+        if (j == s->ctx.tracked_flags_count) {
+            if (j >= 64 || f->at + f->len > SNAPSHOT_FLAG_TEXT ||
+                s->flag_text_used + f->len + 1 > (int)sizeof(s->flag_text)) continue;
+            memcpy(s->flag_text + s->flag_text_used, flags->text + f->at, f->len);
+            s->flag_text[s->flag_text_used + f->len] = '\0';
+            s->ctx.tracked_flags[j].flag_num = f->flag_num;
+            s->ctx.tracked_flags[j].description = s->flag_text + s->flag_text_used;
+            s->flag_text_used += f->len + 1;
+            s->ctx.tracked_flags_count++;
+            watch_bit(s->flag_watch, f->flag_num);
         }
+        s->ctx.tracked_flags[j].value = f->value;
     }
+}
 
-    g_llm_context.current_room = new_room;
+void llm_context_snapshot_restore(nagi_llm_session_t *s, const void *buf)
+{
+    snapshot_flags_t flags;
+    u32 epoch;
+
+    if (!s) return;
+    memcpy(&flags, (const char *)buf + offsetof(llm_context_t, tracked_flags), sizeof(flags));
+
+    llm_context_lock(s);
+    epoch = s->ctx.history_epoch;
+    memcpy(&s->ctx, buf, offsetof(llm_context_t, tracked_flags));
+    s->ctx.history_epoch = epoch + 1;
+    snapshot_restore_flags(s, &flags);
+    segment_invalidate_all(s);
+    llm_context_unlock(s);
 }
 
 /*
- * Callback: Flag changed
+ * Get the most relevant history as a string
  */
-void llm_context_on_flag_change(int flag_num, int new_value)
+void llm_context_get_history(nagi_llm_session_t *s, char *buffer, int buffer_size, int max_entries)
+{
+    int idx[LLM_MAX_HISTORY_ENTRIES];
+    int token_room = INT_MAX;
+    int byte_room = buffer_size - 1;
+    int len = 0, count;
+
+    if (buffer_size <= 0) return;
+    buffer[0] = '\0';
+    if (max_entries > LLM_MAX_HISTORY_ENTRIES) max_entries = LLM_MAX_HISTORY_ENTRIES;
+
+    llm_context_lock(s);
+    count = s ? history_select(s, idx, max_entries, &token_room, &byte_room) : 0;
+    for (int i = 0; i < count; i++) {
+        len += llm_context_format_entry(s, &s->ctx.history[idx[i]], buffer + len, buffer_size - len);
+    }
+    llm_context_unlock(s);
+}
+
+/*
+ * Context events
+ * The game's hooks only queue what happened, a copy into a single
+ * producer / single consumer ring. Taking the context lock folds the
+ * queue in first, so the LLM worker does it between requests and the
+ * game whenever it reads the context. The game thread is the only
+ * producer; the context lock makes everyone else one consumer.
+ */
+
+/* NULL if there's no context to queue for */
+static context_event_t *event_begin(nagi_llm_session_t *s, int type)
+{
+    context_event_t *ev;
+
+    if (!s) return NULL;
+    /* Full, nobody has looked in a while: fold it in here */
+    if (s->event_head - llm_atomic_load(&s->event_tail) >= EVENT_QUEUE_SIZE) {
+        llm_context_lock(s);
+        llm_context_unlock(s);
+    }
+    ev = &s->events[s->event_head & (EVENT_QUEUE_SIZE - 1)];
+    ev->type = type;
+    return ev;
+}
+
+static void event_end(nagi_llm_session_t *s)
+{
+    llm_atomic_store(&s->event_head, s->event_head + 1);
+}
+
+static void event_text(nagi_llm_session_t *s, int type, const char *text)
+{
+    context_event_t *ev = event_begin(s, type);
+    int len = 0;
+
+    if (!ev) return;
+    while (len < LLM_MAX_ENTRY_SIZE - 1 && text[len]) len++;
+    memcpy(ev->text, text, len);
+    ev->text[len] = '\0';
+    event_end(s);
+}
+
+static void event_value(nagi_llm_session_t *s, int type, int a, int b)
+{
+    context_event_t *ev = event_begin(s, type);
+
+    if (!ev) return;
+    ev->a = a;
+    ev->b = b;
+    event_end(s);
+}
+
+static void room_changed(nagi_llm_session_t *s, int old_room, int new_room)
+{
+    const desc_entry_t *e;
+
+    history_addf(s, CTX_ROOM_CHANGE, "Moved from room %d to room %d", old_room, new_room);
+
+    /* Look up room description, the tables only change at load time */
+    e = desc_find(s, DESC_ROOMS, new_room);
+    if (e) {
+        room_set(s, new_room,
+            s->desc_tables[DESC_ROOMS].pool + e->text,
+            s->desc_tables[DESC_ROOMS].pool + e->extra);
+    }
+
+    s->ctx.current_room = new_room;
+    segment_invalidate(s, LLM_SEG_STATE);
+}
+
+static void flag_changed(nagi_llm_session_t *s, int flag_num, int new_value)
 {
     /* Check if this is a tracked flag */
-    for (int i = 0; i < g_llm_context.tracked_flags_count; i++) {
-        if (g_llm_context.tracked_flags[i].flag_num == flag_num) {
-            g_llm_context.tracked_flags[i].value = new_value;
-            llm_context_addf(CTX_FLAG_CHANGE, "%s: %s",
-                g_llm_context.tracked_flags[i].description,
+    for (int i = 0; i < s->ctx.tracked_flags_count; i++) {
+        if (s->ctx.tracked_flags[i].flag_num == flag_num) {
+            s->ctx.tracked_flags[i].value = new_value;
+            segment_invalidate(s, LLM_SEG_FLAGS);
+            history_addf(s, CTX_FLAG_CHANGE, "%s: %s",
+                s->ctx.tracked_flags[i].description,
                 new_value ? "true" : "false");
             break;
         }
     }
 }
 
-/*
- * Callback: Variable changed
- */
-void llm_context_on_var_change(int var_num, int new_value)
+static void var_changed(nagi_llm_session_t *s, int var_num, int new_value)
 {
-    /* Track important variables */
     /* Variable 3 is the score in AGI standard */
     if (var_num == 3) {
-        g_llm_context.score = new_value;
-        llm_context_addf(CTX_SYSTEM_MSG, "Score changed to %d", new_value);
+        if (s->ctx.score != new_value) {
+            s->ctx.score = new_value;
+            segment_invalidate(s, LLM_SEG_STATE);
+            history_addf(s, CTX_SYSTEM_MSG, "Score changed to %d", new_value);
+        }
+    } else {
+        history_addf(s, CTX_SYSTEM_MSG, "Variable %d changed to %d", var_num, new_value);
+    }
+}
+
+/*
+ * Fold in what has been queued (lock held)
+ */
+static void events_fold(nagi_llm_session_t *s)
+{
+    unsigned int tail, head;
+
+    if (!s) return;
+    tail = s->event_tail;
+    head = llm_atomic_load(&s->event_head);
+
+    for (; tail != head; tail++) {
+        const context_event_t *ev = &s->events[tail & (EVENT_QUEUE_SIZE - 1)];
+
+        switch (ev->type) {
+            case EVENT_PRINT:  history_add(s, CTX_GAME_OUTPUT, ev->text); break;
+            case EVENT_UPDATE: history_add(s, CTX_SCENE_DESC, ev->text); break;
+            case EVENT_INPUT:  history_add(s, CTX_PLAYER_INPUT, ev->text); break;
+            case EVENT_ROOM:   room_changed(s, ev->a, ev->b); break;
+            case EVENT_FLAG:   flag_changed(s, ev->a, ev->b); break;
+            case EVENT_VAR:    var_changed(s, ev->a, ev->b); break;
+            default: break;
+        }
     }
+    llm_atomic_store(&s->event_tail, tail);
+}
+
+/*
+ * Fold queued events in now
+ */
+void llm_context_fold_events(nagi_llm_session_t *s)
+{
+    llm_context_lock(s);
+    llm_context_unlock(s);
+}
+
+/*
+ * Callback: Game printed text
+ */
+void llm_context_on_print(nagi_llm_session_t *s, const char *text)
+{
+    event_text(s, EVENT_PRINT, text);
+}
+
+/*
+ * Callback: The logic reported something with update.context
+ */
+void llm_context_on_update(nagi_llm_session_t *s, const char *text)
+{
+    event_text(s, EVENT_UPDATE, text);
+}
+
+/*
+ * Callback: Room changed
+ */
+void llm_context_on_room_change(nagi_llm_session_t *s, int old_room, int new_room)
+{
+    event_value(s, EVENT_ROOM, old_room, new_room);
+}
+
+/*
+ * Callback: Flag changed
+ */
+void llm_context_on_flag_change(nagi_llm_session_t *s, int flag_num, int new_value)
+{
+    event_value(s, EVENT_FLAG, flag_num, new_value);
+}
+
+/*
+ * Callback: Variable changed
+ */
+void llm_context_on_var_change(nagi_llm_session_t *s, int var_num, int new_value)
+{
+    event_value(s, EVENT_VAR, var_num, new_value);
 }
 
 /*
  * Callback: Player input
  */
-void llm_context_on_player_input(const char *input)
+void llm_context_on_player_input(nagi_llm_session_t *s, const char *input)
 {
-    llm_context_add(CTX_PLAYER_INPUT, input);
+    event_text(s, EVENT_INPUT, input);
 }
 
 /*
  * Serialize context to JSON
  */
-int llm_context_to_json(char *buffer, int buffer_size)
+int llm_context_to_json(nagi_llm_session_t *s, char *buffer, int buffer_size)
 {
     int written;
 
+    if (!s) {
+        return snprintf(buffer, buffer_size, "{}\n");
+    }
+
     /* Build a simple JSON representation */
     written = snprintf(buffer, buffer_size,
         "{\n"
@@ -464,177 +1300,463 @@ int llm_context_to_json(char *buffer, int buffer_size)
         "  \"inventoryCount\": %d,\n"
         "  \"historyCount\": %d\n"
         "}\n",
-        g_llm_context.current_room,
-        g_llm_context.score,
-        g_llm_context.max_score,
-        g_llm_context.room_info.description,
-        g_llm_context.room_info.exits,
-        g_llm_context.inventory_count,
-        g_llm_context.history_count);
+        s->ctx.current_room,
+        s->ctx.score,
+        s->ctx.max_score,
+        s->ctx.room_info.description,
+        s->ctx.room_info.exits,
+        s->ctx.inventory_count,
+        s->ctx.history_count);
 
     return written;
 }
 
-/*
- * Load room descriptions from a file
- */
-int llm_context_load_room_descs(const char *filename)
+static void desc_free_all(nagi_llm_session_t *s)
 {
-    FILE *f;
-    char line[2048];
-    int count = 0;
+    desc_block_t *b, *next;
+
+    for (b = s->desc_blocks; b; b = next) {
+        next = b->next;
+#ifndef _WIN32
+        if (b->mapped) {
+            munmap(b->data, b->size);
+        } else
+#endif
+        free(b->data);
+        free(b);
+    }
+    s->desc_blocks = NULL;
+    memset(s->desc_tables, 0, sizeof(s->desc_tables));
+}
 
-    f = fopen(filename, "r");
-    if (!f) {
-        fprintf(stderr, "LLM Context: Could not open room descriptions file: %s\n", filename);
-        return 0;
+/* Keep a block until shutdown */
+static int desc_block_add(nagi_llm_session_t *s, void *data, size_t size, int mapped)
+{
+    desc_block_t *b = (desc_block_t *)malloc(sizeof(desc_block_t));
+
+    if (!b) return 0;
+    b->data = data;
+    b->size = size;
+    b->mapped = mapped;
+    b->next = s->desc_blocks;
+    s->desc_blocks = b;
+    return 1;
+}
+
+/* Room for need more pool bytes, the pool always starts with the empty string */
+static int desc_builder_reserve(desc_builder_t *b, size_t need)
+{
+    size_t cap;
+    char *pool;
+
+    if (b->pool_size == 0) need++;
+    if (b->pool_size + need > UINT32_MAX) return 0;
+    if (b->pool_size + need > b->pool_cap) {
+        cap = b->pool_cap ? b->pool_cap : 4096;
+        while (cap < b->pool_size + need) cap *= 2;
+        pool = (char *)realloc(b->pool, cap);
+        if (!pool) return 0;
+        b->pool = pool;
+        b->pool_cap = cap;
+    }
+    if (b->pool_size == 0) {
+        b->pool[b->pool_size++] = '\0';
     }
+    return 1;
+}
 
-    while (fgets(line, sizeof(line), f) && room_descs_count < 256) {
-        char *room_str, *desc_str, *exits_str;
-        char *saveptr;
+static uint32_t desc_builder_string(desc_builder_t *b, const char *str, size_t len)
+{
+    uint32_t at = (uint32_t)b->pool_size;
 
-        /* Remove newline */
-        line[strcspn(line, "\r\n")] = '\0';
+    if (len == 0) return 0;
+    memcpy(b->pool + at, str, len);
+    b->pool[at + len] = '\0';
+    b->pool_size += len + 1;
+    return at;
+}
 
-        /* Parse: room_num|description|exits */
-        room_str = strtok_r(line, "|", &saveptr);
-        desc_str = strtok_r(NULL, "|", &saveptr);
-        exits_str = strtok_r(NULL, "|", &saveptr);
-
-        if (room_str && desc_str) {
-            room_descs[room_descs_count].room_num = atoi(room_str);
-            strncpy(room_descs[room_descs_count].description, desc_str,
-                    LLM_MAX_ROOM_DESC_SIZE - 1);
-            room_descs[room_descs_count].description[LLM_MAX_ROOM_DESC_SIZE - 1] = '\0';
-
-            if (exits_str) {
-                strncpy(room_descs[room_descs_count].exits, exits_str,
-                        sizeof(room_descs[room_descs_count].exits) - 1);
-                room_descs[room_descs_count].exits[sizeof(room_descs[room_descs_count].exits) - 1] = '\0';
-            } else {
-                room_descs[room_descs_count].exits[0] = '\0';
-            }
+static int desc_builder_add(desc_builder_t *b, int id, const char *text, const char *extra)
+{
+    size_t text_len = strlen(text);
+    size_t extra_len = extra ? strlen(extra) : 0;
+    desc_entry_t *e;
+
+    if (b->count == b->cap) {
+        uint32_t cap = b->cap ? b->cap * 2 : 64;
+        e = (desc_entry_t *)realloc(b->entry, cap * sizeof(desc_entry_t));
+        if (!e) return 0;
+        b->entry = e;
+        b->cap = cap;
+    }
+    if (!desc_builder_reserve(b, text_len + 1 + extra_len + 1)) return 0;
+
+    e = &b->entry[b->count++];
+    e->id = id;
+    e->text = desc_builder_string(b, text, text_len);
+    e->extra = desc_builder_string(b, extra, extra_len);
+    return 1;
+}
+
+static void desc_builder_free(desc_builder_t *b)
+{
+    free(b->entry);
+    free(b->pool);
+    memset(b, 0, sizeof(*b));
+}
+
+/* Sort by id, keeping the first of each id like the lookups always did */
+static void desc_builder_sort(desc_builder_t *b)
+{
+    uint32_t i, j, n;
 
-            room_descs_count++;
-            count++;
+    /* Stable, and the files are usually in order already */
+    for (i = 1; i < b->count; i++) {
+        desc_entry_t e = b->entry[i];
+        for (j = i; j > 0 && b->entry[j - 1].id > e.id; j--) {
+            b->entry[j] = b->entry[j - 1];
         }
+        b->entry[j] = e;
     }
+    for (i = 0, n = 0; i < b->count; i++) {
+        if (n > 0 && b->entry[n - 1].id == b->entry[i].id) continue;
+        b->entry[n++] = b->entry[i];
+    }
+    b->count = n;
+}
 
-    fclose(f);
-    printf("LLM Context: Loaded %d room descriptions\n", count);
-    return count;
+/* Make the built entries the table */
+static int desc_builder_install(nagi_llm_session_t *s, desc_builder_t *b, int table)
+{
+    size_t entries = b->count * sizeof(desc_entry_t);
+    unsigned char *data;
+
+    if (!desc_builder_reserve(b, 0)) return 0;
+    data = (unsigned char *)malloc(entries + b->pool_size);
+    if (!data) return 0;
+    memcpy(data, b->entry, entries);
+    memcpy(data + entries, b->pool, b->pool_size);
+    if (!desc_block_add(s, data, entries + b->pool_size, 0)) {
+        free(data);
+        return 0;
+    }
+
+    llm_context_lock(s);
+    s->desc_tables[table].entry = (const desc_entry_t *)data;
+    s->desc_tables[table].count = b->count;
+    s->desc_tables[table].pool = (const char *)data + entries;
+    segment_invalidate(s, LLM_SEG_INVENTORY);
+    llm_context_unlock(s);
+    return 1;
+}
+
+/* Track the flags of the table that aren't yet */
+static void desc_track_flags(nagi_llm_session_t *s)
+{
+    const desc_table_t *t;
+    uint32_t i;
+    int j;
+
+    if (!s) return;
+    t = &s->desc_tables[DESC_FLAGS];
+    for (i = 0; i < t->count; i++) {
+        for (j = 0; j < s->ctx.tracked_flags_count; j++) {
+            if (s->ctx.tracked_flags[j].flag_num == t->entry[i].id) break;
+        }
+        if (j == s->ctx.tracked_flags_count) {
+            llm_context_track_flag(s, t->entry[i].id, t->pool + t->entry[i].text);
+        }
+    }
 }
 
 /*
- * Load object names from a file
+ * Read "id|text" or "id|text|extra" lines after the table's entries
+ * Returns the number of lines read, -1 if the file can't be opened
  */
-int llm_context_load_object_names(const char *filename)
+static int desc_load_text(nagi_llm_session_t *s, const char *filename, int table, int has_extra, desc_builder_t *b)
 {
+    const desc_table_t *t = &s->desc_tables[table];
     FILE *f;
-    char line[256];
+    char line[2048];
     int count = 0;
 
     f = fopen(filename, "r");
-    if (!f) {
-        fprintf(stderr, "LLM Context: Could not open object names file: %s\n", filename);
-        return 0;
+    if (!f) return -1;
+
+    /* What was loaded before wins over the new lines */
+    for (uint32_t i = 0; i < t->count; i++) {
+        if (!desc_builder_add(b, t->entry[i].id, t->pool + t->entry[i].text,
+                              t->pool + t->entry[i].extra)) {
+            fclose(f);
+            return count;
+        }
     }
 
-    while (fgets(line, sizeof(line), f) && object_names_count < 256) {
-        char *id_str, *name_str;
-        char *saveptr;
+    while (fgets(line, sizeof(line), f)) {
+        char *text, *extra = NULL, *end;
 
         /* Remove newline */
         line[strcspn(line, "\r\n")] = '\0';
 
-        /* Parse: obj_id|name */
-        id_str = strtok_r(line, "|", &saveptr);
-        name_str = strtok_r(NULL, "|", &saveptr);
-
-        if (id_str && name_str) {
-            object_names[object_names_count].obj_id = atoi(id_str);
-            strncpy(object_names[object_names_count].name, name_str,
-                    sizeof(object_names[object_names_count].name) - 1);
-            object_names[object_names_count].name[sizeof(object_names[object_names_count].name) - 1] = '\0';
-
-            object_names_count++;
-            count++;
+        text = strchr(line, '|');
+        if (!text || text == line) continue;
+        *text++ = '\0';
+        end = strchr(text, '|');
+        if (end) {
+            *end = '\0';
+            if (has_extra) {
+                extra = end + 1;
+                end = strchr(extra, '|');
+                if (end) *end = '\0';
+            }
         }
+        if (text[0] == '\0') continue;
+
+        if (!desc_builder_add(b, atoi(line), text, extra)) break;
+        count++;
     }
 
     fclose(f);
-    printf("LLM Context: Loaded %d object names\n", count);
+    desc_builder_sort(b);
+    return count;
+}
+
+static int desc_load_table(nagi_llm_session_t *s, const char *filename, int table, int has_extra, const char *what)
+{
+    desc_builder_t b = {0};
+    int count;
+
+    if (!s) return 0;
+    count = desc_load_text(s, filename, table, has_extra, &b);
+    if (count < 0) {
+        fprintf(stderr, "LLM Context: Could not open %s file: %s\n", what, filename);
+        return 0;
+    }
+    if (!desc_builder_install(s, &b, table)) {
+        count = 0;
+    }
+    desc_builder_free(&b);
+    printf("LLM Context: Loaded %d %s\n", count, what);
     return count;
 }
 
+/*
+ * Load room descriptions from a file
+ */
+int llm_context_load_room_descs(nagi_llm_session_t *s, const char *filename)
+{
+    return desc_load_table(s, filename, DESC_ROOMS, 1, "room descriptions");
+}
+
+/*
+ * Load object names from a file
+ */
+int llm_context_load_object_names(nagi_llm_session_t *s, const char *filename)
+{
+    return desc_load_table(s, filename, DESC_OBJECTS, 0, "object names");
+}
+
 /*
  * Load flag descriptions from a file
  */
-int llm_context_load_flag_descs(const char *filename)
+int llm_context_load_flag_descs(nagi_llm_session_t *s, const char *filename)
 {
+    int count = desc_load_table(s, filename, DESC_FLAGS, 0, "flag descriptions");
+
+    desc_track_flags(s);
+    return count;
+}
+
+/*
+ * Map compiled description tables
+ */
+int llm_context_load_descs(nagi_llm_session_t *s, const char *filename)
+{
+    const desc_head_t *head;
+    const desc_entry_t *entry;
+    const char *pool;
+    void *data = NULL;
+    size_t size = 0;
+    uint64_t at;
+    uint32_t i, n;
+    int mapped = 0;
+    int t, total = 0;
+
+#ifndef _WIN32
+    struct stat st;
+    int fd;
+
+    if (!s) return 0;
+    fd = open(filename, O_RDONLY);
+    if (fd >= 0) {
+        if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(desc_head_t)) {
+            size = (size_t)st.st_size;
+            data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data == MAP_FAILED) {
+                data = NULL;
+            } else {
+                mapped = 1;
+            }
+        }
+        close(fd);
+    }
+#else
     FILE *f;
-    char line[256];
-    int count = 0;
-    static char flag_desc_storage[64][128];  /* Static storage for descriptions */
 
-    f = fopen(filename, "r");
-    if (!f) {
-        fprintf(stderr, "LLM Context: Could not open flag descriptions file: %s\n", filename);
+    if (!s) return 0;
+    f = fopen(filename, "rb");
+    if (f) {
+        if (fseek(f, 0, SEEK_END) == 0) {
+            long end = ftell(f);
+            if (end >= (long)sizeof(desc_head_t)) {
+                size = (size_t)end;
+                data = malloc(size);
+            }
+        }
+        if (data && (fseek(f, 0, SEEK_SET) != 0 || fread(data, 1, size, f) != size)) {
+            free(data);
+            data = NULL;
+        }
+        fclose(f);
+    }
+#endif
+    if (!data) {
+        fprintf(stderr, "LLM Context: Could not open description tables: %s\n", filename);
         return 0;
     }
 
-    while (fgets(line, sizeof(line), f) && g_llm_context.tracked_flags_count < 64) {
-        char *flag_str, *desc_str;
-        char *saveptr;
-
-        /* Remove newline */
-        line[strcspn(line, "\r\n")] = '\0';
-
-        /* Parse: flag_num|description */
-        flag_str = strtok_r(line, "|", &saveptr);
-        desc_str = strtok_r(NULL, "|", &saveptr);
-
-        if (flag_str && desc_str) {
-            int flag_num = atoi(flag_str);
-            strncpy(flag_desc_storage[g_llm_context.tracked_flags_count], desc_str,
-                    sizeof(flag_desc_storage[0]) - 1);
-            flag_desc_storage[g_llm_context.tracked_flags_count][sizeof(flag_desc_storage[0]) - 1] = '\0';
+    /* Offsets are checked, nothing is parsed or copied */
+    head = (const desc_head_t *)data;
+    at = sizeof(desc_head_t);
+    for (t = 0; t < DESC_TABLES; t++) {
+        at += (uint64_t)head->count[t] * sizeof(desc_entry_t);
+    }
+    if (memcmp(head->magic, DESC_MAGIC, 4) != 0 || head->version != DESC_VERSION ||
+        head->order != DESC_ORDER || head->pool_size == 0 || at + head->pool_size != size) {
+        goto bad;
+    }
+    entry = (const desc_entry_t *)(head + 1);
+    pool = (const char *)data + at;
+    if (pool[head->pool_size - 1] != '\0') goto bad;
+    for (t = 0, n = 0; t < DESC_TABLES; n += head->count[t], t++) {
+        for (i = 0; i < head->count[t]; i++) {
+            const desc_entry_t *e = &entry[n + i];
+            if (e->text >= head->pool_size || e->extra >= head->pool_size) goto bad;
+            if (i > 0 && e[-1].id >= e->id) goto bad;
+        }
+    }
+    if (!desc_block_add(s, data, size, mapped)) goto bad;
+
+    llm_context_lock(s);
+    for (t = 0; t < DESC_TABLES; t++) {
+        s->desc_tables[t].entry = entry;
+        s->desc_tables[t].count = head->count[t];
+        s->desc_tables[t].pool = pool;
+        entry += head->count[t];
+        total += (int)head->count[t];
+    }
+    segment_invalidate(s, LLM_SEG_INVENTORY);
+    llm_context_unlock(s);
+    desc_track_flags(s);
+
+    printf("LLM Context: Mapped %d descriptions from %s\n", total, filename);
+    return total;
+
+bad:
+    fprintf(stderr, "LLM Context: Not a description table file: %s\n", filename);
+#ifndef _WIN32
+    if (mapped) {
+        munmap(data, size);
+        return 0;
+    }
+#endif
+    free(data);
+    return 0;
+}
 
-            llm_context_track_flag(flag_num, flag_desc_storage[g_llm_context.tracked_flags_count - 1]);
-            count++;
+/*
+ * Write the tables in the compiled format
+ */
+int llm_context_save_descs(nagi_llm_session_t *s, const char *filename)
+{
+    desc_builder_t b = {0};
+    desc_head_t head;
+    FILE *f;
+    int t, ok = 1;
+
+    if (!s) return 0;
+    memset(&head, 0, sizeof(head));
+    memcpy(head.magic, DESC_MAGIC, 4);
+    head.version = DESC_VERSION;
+    head.order = DESC_ORDER;
+
+    /* One pool for all the tables */
+    for (t = 0; t < DESC_TABLES && ok; t++) {
+        const desc_table_t *table = &s->desc_tables[t];
+        for (uint32_t i = 0; i < table->count && ok; i++) {
+            ok = desc_builder_add(&b, table->entry[i].id, table->pool + table->entry[i].text,
+                                  table->pool + table->entry[i].extra);
         }
+        head.count[t] = table->count;
     }
+    ok = ok && desc_builder_reserve(&b, 0);
+    head.pool_size = (uint32_t)b.pool_size;
+
+    f = ok ? fopen(filename, "wb") : NULL;
+    if (f) {
+        ok = fwrite(&head, sizeof(head), 1, f) == 1 &&
+             fwrite(b.entry, sizeof(desc_entry_t), b.count, f) == b.count &&
+             fwrite(b.pool, 1, b.pool_size, f) == b.pool_size;
+        ok = (fclose(f) == 0) && ok;
+    } else {
+        ok = 0;
+    }
+    desc_builder_free(&b);
 
-    fclose(f);
-    printf("LLM Context: Loaded %d flag descriptions\n", count);
-    return count;
+    if (!ok) {
+        fprintf(stderr, "LLM Context: Could not write description tables: %s\n", filename);
+    }
+    return ok;
 }
 
-/* Return last raw player input stored in history (or NULL) */
-const char *llm_context_get_last_player_input(void)
+/* Copy the last raw player input stored in history, its length or 0 */
+int llm_context_get_last_player_input(nagi_llm_session_t *s, char *buffer, int size)
 {
-    if (g_llm_context.history_count == 0) return NULL;
+    const char *text = NULL;
+    int len = 0;
 
-    for (int i = g_llm_context.history_count - 1; i >= 0; --i) {
-        int idx = (g_llm_context.history_head + i) % LLM_MAX_HISTORY_ENTRIES;
-        if (g_llm_context.history[idx].type == CTX_PLAYER_INPUT) {
-            return g_llm_context.history[idx].text;
+    if (size <= 0) return 0;
+
+    /* The input may still be queued */
+    llm_context_lock(s);
+    for (int i = s ? s->ctx.history_count - 1 : -1; i >= 0 && !text; --i) {
+        int idx = (s->ctx.history_head + i) % LLM_MAX_HISTORY_ENTRIES;
+        if (s->ctx.history[idx].type == CTX_PLAYER_INPUT) {
+            text = llm_context_entry_text(s, &s->ctx.history[idx]);
         }
     }
-    return NULL;
+    if (text) {
+        while (len < size - 1 && text[len]) len++;
+        memcpy(buffer, text, (size_t)len);
+    }
+    buffer[len] = '\0';
+    llm_context_unlock(s);
+    return len;
 }
 
 /* Clear the last stored player input */
-void llm_context_clear_last_player_input(void)
+void llm_context_clear_last_player_input(nagi_llm_session_t *s)
 {
-    if (g_llm_context.history_count == 0) return;
-
-    for (int i = g_llm_context.history_count - 1; i >= 0; --i) {
-        int idx = (g_llm_context.history_head + i) % LLM_MAX_HISTORY_ENTRIES;
-        if (g_llm_context.history[idx].type == CTX_PLAYER_INPUT) {
-            g_llm_context.history[idx].text[0] = '\0';
-            return;
+    llm_context_lock(s);
+    for (int i = s ? s->ctx.history_count - 1 : -1; i >= 0; --i) {
+        int idx = (s->ctx.history_head + i) % LLM_MAX_HISTORY_ENTRIES;
+        if (s->ctx.history[idx].type == CTX_PLAYER_INPUT) {
+            string_release(s, s->ctx.history[idx].text);
+            s->ctx.history[idx].text = 0;
+            s->ctx.history[idx].tokens = -1;
+            s->ctx.context_dirty = 1;
+            break;
         }
     }
+    llm_context_unlock(s);
 }
@@ -0,0 +1,343 @@
+/*
+ * nagi_llm_loader.c - Background model loading for NAGI
+ *
+ * Loading a multi-GB model takes seconds, so nagi_llm_init_async runs the
+ * backend init on a loader thread and returns at once. The game plays with
+ * the classic parser meanwhile: nagi_llm_ready stays 0 until the model is
+ * resident. A dictionary, language or LoRA adapter set during the load is
+ * kept here and applied to the backend state just before it is marked ready.
+ *
+ * With mmap_warmup the loader also reads the model file through once
+ * before that. The mapped weights are then in the page cache (shared by
+ * every process mapping the same file) instead of being faulted in from
+ * disk a page at a time by the first request.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../include/nagi_llm.h"
+#include "../include/llm_utils.h"
+#include "../include/llm_log.h"
+#include "llm_thread.h"
+
+#define LOADER_WARMUP_CHUNK (1 << 20)
+
+/* State setters (nagi_llm.c) */
+void llm_state_set_dictionary(llm_state_t *state, const unsigned char *dictionary, size_t size,
+                              char *grammar);
+void llm_state_set_language(llm_state_t *state, const char *language);
+
+struct nagi_llm_loader {
+    llm_thread_t thread;
+    int joined;                       /* Thread already waited for (game thread only) */
+    llm_mutex_t lock;                 /* Protects everything below */
+    nagi_llm_load_status_t status;
+    float progress;                   /* 0.0-1.0, as reported by the backend */
+    int cancel;                       /* Set on shutdown, aborts the model load */
+    nagi_llm_ready_cb_t on_ready;
+    void *userdata;
+
+    /* Set while loading, applied once the state exists */
+    int has_dictionary;
+    const unsigned char *dictionary;
+    size_t dictionary_size;
+    char *grammar;
+    char language[32];
+    int has_adapter;
+    char adapter[NAGI_LLM_MAX_MODEL_PATH];  /* Empty for the base model */
+};
+
+static void loader_destroy(struct nagi_llm_loader *loader)
+{
+    llm_mutex_destroy(&loader->lock);
+    free(loader->grammar);
+    free(loader);
+}
+
+/* Read the model file in, a chunk at a time until done or cancelled */
+static void loader_warmup(nagi_llm_t *llm, struct nagi_llm_loader *loader)
+{
+    FILE *f;
+    char *chunk;
+    double start, mb = 0.0;
+    size_t got;
+    int cancel = 0;
+
+    if (llm->config.backend != NAGI_LLM_BACKEND_LLAMACPP &&
+        llm->config.backend != NAGI_LLM_BACKEND_BITNET) {
+        return;
+    }
+    f = fopen(llm->config.model_path, "rb");
+    if (!f) return;
+    chunk = (char *)malloc(LOADER_WARMUP_CHUNK);
+    if (!chunk) {
+        fclose(f);
+        return;
+    }
+
+    start = llm_time_ms();
+    while (!cancel && (got = fread(chunk, 1, LOADER_WARMUP_CHUNK, f)) > 0) {
+        mb += (double)got / (1024.0 * 1024.0);
+        llm_mutex_lock(&loader->lock);
+        cancel = loader->cancel;
+        llm_mutex_unlock(&loader->lock);
+    }
+    free(chunk);
+    fclose(f);
+
+    if (llm->config.verbose && !cancel) {
+        llm_log(LLM_LOG_DEBUG, "LLM: Model pages warmed, %.0f MB in %.0f ms\n", mb, llm_time_ms() - start);
+    }
+}
+
+static void *loader_main(void *arg)
+{
+    nagi_llm_t *llm = (nagi_llm_t *)arg;
+    struct nagi_llm_loader *loader = llm->loader;
+    nagi_llm_ready_cb_t on_ready;
+    void *userdata;
+    char adapter[NAGI_LLM_MAX_MODEL_PATH];
+    int ok;
+
+    /* Model path and config were copied into llm->config before the thread started */
+    ok = llm->init(llm, NULL, NULL);
+    if (ok && llm->config.mmap_warmup && llm->config.use_mmap) {
+        loader_warmup(llm, loader);
+    }
+
+    llm_mutex_lock(&loader->lock);
+
+    /* An adapter takes a while to load, the game isn't kept waiting on the lock for it */
+    while (ok && llm->state && loader->has_adapter && llm->set_adapter) {
+        loader->has_adapter = 0;
+        memcpy(adapter, loader->adapter, sizeof(adapter));
+        llm_mutex_unlock(&loader->lock);
+        llm->set_adapter(llm, adapter[0] ? adapter : NULL, llm->config.lora_scale);
+        llm_mutex_lock(&loader->lock);
+    }
+
+    if (ok && llm->state) {
+        if (loader->has_dictionary) {
+            llm_state_set_dictionary(llm->state, loader->dictionary, loader->dictionary_size,
+                                     loader->grammar);
+            loader->grammar = NULL;
+        }
+        if (loader->language[0]) {
+            llm_state_set_language(llm->state, loader->language);
+        }
+        loader->progress = 1.0f;
+    }
+    ok = ok && llm->state && !loader->cancel;
+    loader->status = ok ? NAGI_LLM_LOAD_READY : NAGI_LLM_LOAD_FAILED;
+    on_ready = loader->cancel ? NULL : loader->on_ready;
+    userdata = loader->userdata;
+    llm_mutex_unlock(&loader->lock);
+
+    if (llm->config.verbose) {
+        printf("LLM: Background load %s\n", ok ? "finished" : "failed");
+    }
+
+    if (on_ready) {
+        on_ready(llm, ok, userdata);
+    }
+    return NULL;
+}
+
+/*
+ * Start loading the backend on a loader thread
+ */
+int nagi_llm_init_async(nagi_llm_t *llm, const char *model_path, const nagi_llm_config_t *config,
+                        nagi_llm_ready_cb_t on_ready, void *userdata)
+{
+    struct nagi_llm_loader *loader;
+
+    if (!llm || !llm->init || llm->loader) {
+        return 0;
+    }
+
+    /* The loader thread must not write the config the game reads */
+    if (config) {
+        memcpy(&llm->config, config, sizeof(nagi_llm_config_t));
+    }
+    if (model_path && model_path[0] != '\0') {
+        strncpy(llm->config.model_path, model_path, NAGI_LLM_MAX_MODEL_PATH - 1);
+        llm->config.model_path[NAGI_LLM_MAX_MODEL_PATH - 1] = '\0';
+    }
+
+    loader = (struct nagi_llm_loader *)calloc(1, sizeof(struct nagi_llm_loader));
+    if (!loader) return 0;
+
+    llm_mutex_init(&loader->lock);
+    loader->status = NAGI_LLM_LOAD_LOADING;
+    loader->on_ready = on_ready;
+    loader->userdata = userdata;
+
+    llm->loader = loader;
+    if (!llm_thread_create(&loader->thread, loader_main, llm)) {
+        fprintf(stderr, "LLM: Failed to start loader thread\n");
+        llm->loader = NULL;
+        loader_destroy(loader);
+        return 0;
+    }
+
+    return 1;
+}
+
+/*
+ * Report the load state, and optionally how far the model load has got
+ */
+nagi_llm_load_status_t nagi_llm_load_status(nagi_llm_t *llm, float *progress)
+{
+    struct nagi_llm_loader *loader;
+    nagi_llm_load_status_t status;
+
+    if (!llm) {
+        if (progress) *progress = 0.0f;
+        return NAGI_LLM_LOAD_FAILED;
+    }
+
+    loader = llm->loader;
+    if (!loader) {
+        /* Loaded synchronously with nagi_llm_init */
+        status = (llm->state && llm->state->initialized) ? NAGI_LLM_LOAD_READY : NAGI_LLM_LOAD_FAILED;
+        if (progress) *progress = status == NAGI_LLM_LOAD_READY ? 1.0f : 0.0f;
+        return status;
+    }
+
+    llm_mutex_lock(&loader->lock);
+    status = loader->status;
+    if (progress) *progress = loader->progress;
+    llm_mutex_unlock(&loader->lock);
+
+    return status;
+}
+
+/*
+ * Called by the backends while the model file loads
+ * Returns 0 when the load should be aborted
+ */
+int llm_load_progress(nagi_llm_t *llm, float progress)
+{
+    struct nagi_llm_loader *loader = llm->loader;
+    int cancel;
+
+    if (!loader) return 1;
+
+    llm_mutex_lock(&loader->lock);
+    loader->progress = progress;
+    cancel = loader->cancel;
+    llm_mutex_unlock(&loader->lock);
+
+    return !cancel;
+}
+
+/*
+ * Hold a dictionary until the state exists
+ * Returns 1 if it was taken (grammar is then owned by the loader)
+ */
+int nagi_llm_loader_defer_dictionary(nagi_llm_t *llm, const unsigned char *dictionary, size_t size,
+                                     char *grammar)
+{
+    struct nagi_llm_loader *loader = llm->loader;
+    int deferred = 0;
+
+    if (!loader) return 0;
+
+    llm_mutex_lock(&loader->lock);
+    if (loader->status == NAGI_LLM_LOAD_LOADING) {
+        free(loader->grammar);
+        loader->has_dictionary = 1;
+        loader->dictionary = dictionary;
+        loader->dictionary_size = size;
+        loader->grammar = grammar;
+        deferred = 1;
+    }
+    llm_mutex_unlock(&loader->lock);
+
+    return deferred;
+}
+
+/*
+ * Hold a language until the state exists
+ * Returns 1 if it was taken
+ */
+int nagi_llm_loader_defer_language(nagi_llm_t *llm, const char *language)
+{
+    struct nagi_llm_loader *loader = llm->loader;
+    int deferred = 0;
+
+    if (!loader) return 0;
+
+    llm_mutex_lock(&loader->lock);
+    if (loader->status == NAGI_LLM_LOAD_LOADING) {
+        strncpy(loader->language, language, sizeof(loader->language) - 1);
+        loader->language[sizeof(loader->language) - 1] = '\0';
+        deferred = 1;
+    }
+    llm_mutex_unlock(&loader->lock);
+
+    return deferred;
+}
+
+/*
+ * Hold an adapter path (empty for none) until the state exists
+ * Returns 1 if it was taken
+ */
+int nagi_llm_loader_defer_adapter(nagi_llm_t *llm, const char *path)
+{
+    struct nagi_llm_loader *loader = llm->loader;
+    int deferred = 0;
+
+    if (!loader) return 0;
+
+    llm_mutex_lock(&loader->lock);
+    if (loader->status == NAGI_LLM_LOAD_LOADING) {
+        strncpy(loader->adapter, path, sizeof(loader->adapter) - 1);
+        loader->adapter[sizeof(loader->adapter) - 1] = '\0';
+        loader->has_adapter = 1;
+        deferred = 1;
+    }
+    llm_mutex_unlock(&loader->lock);
+
+    return deferred;
+}
+
+/*
+ * Block until a background load is over
+ */
+int nagi_llm_wait_ready(nagi_llm_t *llm)
+{
+    struct nagi_llm_loader *loader;
+
+    if (!llm) return 0;
+
+    loader = llm->loader;
+    if (loader && !loader->joined) {
+        llm_thread_join(loader->thread);
+        loader->joined = 1;
+    }
+    return nagi_llm_ready(llm);
+}
+
+/*
+ * Abort a load still in progress and wait for the loader thread
+ */
+void nagi_llm_loader_stop(nagi_llm_t *llm)
+{
+    struct nagi_llm_loader *loader = llm->loader;
+
+    if (!loader) return;
+
+    llm_mutex_lock(&loader->lock);
+    loader->cancel = 1;
+    llm_mutex_unlock(&loader->lock);
+
+    if (!loader->joined) {
+        llm_thread_join(loader->thread);
+    }
+
+    llm->loader = NULL;
+    loader_destroy(loader);
+}
@@ -0,0 +1,767 @@
+/*
+ * nagi_llm_bench.c - Standalone latency benchmark for the nagi-llm backends
+ *
+ * Replays a recorded session through nagi_llm_extract_words,
+ * nagi_llm_matches_expected and nagi_llm_generate_response without the
+ * game or SDL, and reports p50/p95/p99 latency, tokens/s and memory for
+ * every backend and config preset given. Run it before and after bumping
+ * llama.cpp (AddLlamaCpp.cmake) to catch regressions.
+ *
+ * The corpus is a text file, one record per line:
+ *
+ *   # comment
+ *   > look at the old door          player input, timed as extract
+ *   = look door                     said() words for the last input, timed as match
+ *   < The door is locked.           game message for the last input, timed as generate
+ *
+ * or a log written by nagi --record, whose parser lines are replayed as
+ * player input.
+ *
+ * Usage:
+ *   nagi-llm-bench -d WORDS.TOK -t corpus.txt [-m model.gguf]
+ *                  [-b backend[,backend...]] [-c llm_config.ini]...
+ *                  [-n passes] [-W warmup_passes] [-k] [-o results.csv]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#elif defined(__APPLE__)
+#include <mach/mach.h>
+#include <sys/resource.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#include "nagi_llm.h"
+#include "../src/llm_thread.h"
+
+#define BENCH_MAX_BACKENDS 5
+#define BENCH_MAX_PRESETS 8
+#define BENCH_MAX_RUNS (BENCH_MAX_BACKENDS * BENCH_MAX_PRESETS)
+#define BENCH_MAX_WORDS 10
+
+/* Operations the corpus replays, in report order */
+enum {
+    BENCH_EXTRACT,
+    BENCH_MATCH,
+    BENCH_GENERATE,
+    BENCH_OPS
+};
+
+static const char *bench_op_names[BENCH_OPS] = { "extract", "match", "generate" };
+
+/* Library counters each bench operation reads its tokens/s from */
+static const nagi_llm_op_t bench_stats_ops[BENCH_OPS] = {
+    NAGI_LLM_OP_EXTRACT, NAGI_LLM_OP_MATCH, NAGI_LLM_OP_GENERATE
+};
+
+typedef struct {
+    char kind;                        /* '>', '=' or '<' */
+    char *text;
+} bench_record_t;
+
+typedef struct {
+    bench_record_t *records;
+    int count;
+} bench_corpus_t;
+
+/* Latency samples of one operation */
+typedef struct {
+    double *ms;
+    int count;
+    int capacity;
+} bench_samples_t;
+
+/* Per operation results of one run */
+typedef struct {
+    int count;
+    double p50, p95, p99, mean, max;
+    double prompt_tps, generate_tps;
+} bench_result_t;
+
+typedef struct {
+    nagi_llm_backend_t backend;
+    const char *preset;
+    int ok;
+    double load_ms;
+    double rss_mb;                    /* Resident after the model loaded */
+    double peak_mb;                   /* Process peak so far */
+    bench_result_t op[BENCH_OPS];
+} bench_run_t;
+
+typedef struct {
+    const char *dict_path;
+    const char *corpus_path;
+    const char *model_path;
+    const char *output_path;
+    nagi_llm_backend_t backends[BENCH_MAX_BACKENDS];
+    int n_backends;
+    const char *presets[BENCH_MAX_PRESETS];
+    int n_presets;
+    int passes;
+    int warmup;
+    int keep_cache;
+} bench_options_t;
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s -d WORDS.TOK -t corpus.txt [options]\n"
+            "  -d file      Game dictionary (WORDS.TOK)\n"
+            "  -t file      Recorded inputs and messages (or a nagi --record log) to replay\n"
+            "  -m file      Model for the local backends (default $NAGI_LLM_MODEL_PATH)\n"
+            "  -b list      Backends to compare: llamacpp, bitnet, cloud, router, server\n"
+            "  -c file      Config preset, repeat to compare (default llm_config.ini)\n"
+            "  -n passes    Measured passes over the corpus (default 1)\n"
+            "  -W passes    Unmeasured warmup passes (default 0)\n"
+            "  -k           Keep the translation cache (off by default)\n"
+            "  -o file      Also write the results as CSV\n",
+            prog);
+}
+
+static const char *backend_name(nagi_llm_backend_t backend)
+{
+    switch (backend) {
+        case NAGI_LLM_BACKEND_LLAMACPP: return "llamacpp";
+        case NAGI_LLM_BACKEND_BITNET:   return "bitnet";
+        case NAGI_LLM_BACKEND_CLOUD:    return "cloud";
+        case NAGI_LLM_BACKEND_ROUTER:   return "router";
+        case NAGI_LLM_BACKEND_SERVER:   return "server";
+        default:                        return "unknown";
+    }
+}
+
+static nagi_llm_backend_t parse_backend(const char *name, size_t len)
+{
+    static const nagi_llm_backend_t all[] = {
+        NAGI_LLM_BACKEND_LLAMACPP, NAGI_LLM_BACKEND_BITNET,
+        NAGI_LLM_BACKEND_CLOUD, NAGI_LLM_BACKEND_ROUTER, NAGI_LLM_BACKEND_SERVER
+    };
+    size_t i;
+
+    for (i = 0; i < sizeof(all) / sizeof(all[0]); i++) {
+        const char *known = backend_name(all[i]);
+        if (strlen(known) == len && strncmp(known, name, len) == 0) {
+            return all[i];
+        }
+    }
+    return NAGI_LLM_BACKEND_UNDEFINED;
+}
+
+/* First backend compiled in, the local one when there is a choice */
+static nagi_llm_backend_t default_backend(void)
+{
+#if defined(NAGI_LLM_HAS_LLAMACPP)
+    return NAGI_LLM_BACKEND_LLAMACPP;
+#elif defined(NAGI_LLM_HAS_BITNET)
+    return NAGI_LLM_BACKEND_BITNET;
+#elif defined(NAGI_LLM_HAS_CLOUD_API)
+    return NAGI_LLM_BACKEND_CLOUD;
+#else
+    return NAGI_LLM_BACKEND_UNDEFINED;
+#endif
+}
+
+static int parse_options(bench_options_t *opts, int argc, char **argv)
+{
+    int i;
+
+    memset(opts, 0, sizeof(bench_options_t));
+    opts->passes = 1;
+    opts->model_path = getenv("NAGI_LLM_MODEL_PATH");
+
+    for (i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+        const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (strcmp(arg, "-k") == 0) {
+            opts->keep_cache = 1;
+            continue;
+        }
+        if (arg[0] != '-' || arg[1] == '\0' || arg[2] != '\0' || !value) {
+            fprintf(stderr, "Bench: Bad argument '%s'\n", arg);
+            return 0;
+        }
+        i++;
+
+        switch (arg[1]) {
+            case 'd': opts->dict_path = value; break;
+            case 't': opts->corpus_path = value; break;
+            case 'm': opts->model_path = value; break;
+            case 'o': opts->output_path = value; break;
+            case 'n': opts->passes = atoi(value); break;
+            case 'W': opts->warmup = atoi(value); break;
+            case 'c':
+                if (opts->n_presets >= BENCH_MAX_PRESETS) {
+                    fprintf(stderr, "Bench: At most %d config presets\n", BENCH_MAX_PRESETS);
+                    return 0;
+                }
+                opts->presets[opts->n_presets++] = value;
+                break;
+            case 'b':
+                while (*value) {
+                    size_t len = strcspn(value, ",");
+                    nagi_llm_backend_t backend = parse_backend(value, len);
+
+                    if (backend == NAGI_LLM_BACKEND_UNDEFINED) {
+                        fprintf(stderr, "Bench: Unknown backend '%.*s'\n", (int)len, value);
+                        return 0;
+                    }
+                    if (opts->n_backends >= BENCH_MAX_BACKENDS) {
+                        fprintf(stderr, "Bench: At most %d backends\n", BENCH_MAX_BACKENDS);
+                        return 0;
+                    }
+                    opts->backends[opts->n_backends++] = backend;
+                    value += len;
+                    if (*value == ',') value++;
+                }
+                break;
+            default:
+                fprintf(stderr, "Bench: Unknown option '%s'\n", arg);
+                return 0;
+        }
+    }
+
+    if (!opts->dict_path || !opts->corpus_path || opts->passes < 1 || opts->warmup < 0) {
+        return 0;
+    }
+    if (opts->n_backends == 0) {
+        opts->backends[0] = default_backend();
+        if (opts->backends[0] == NAGI_LLM_BACKEND_UNDEFINED) {
+            fprintf(stderr, "Bench: No LLM backend compiled in\n");
+            return 0;
+        }
+        opts->n_backends = 1;
+    }
+    if (opts->n_presets == 0) {
+        opts->presets[opts->n_presets++] = "llm_config.ini";
+    }
+    return 1;
+}
+
+/*
+ * Read a whole file into memory
+ * Returns the data (NUL terminated, caller frees) or NULL on failure
+ */
+static char *read_file(const char *path, size_t *size)
+{
+    FILE *f;
+    char *data;
+    long len;
+
+    f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "Bench: Could not open %s\n", path);
+        return NULL;
+    }
+
+    fseek(f, 0, SEEK_END);
+    len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (len < 0) {
+        fclose(f);
+        return NULL;
+    }
+
+    data = (char *)malloc((size_t)len + 1);
+    if (data && fread(data, 1, (size_t)len, f) != (size_t)len) {
+        free(data);
+        data = NULL;
+    }
+    fclose(f);
+
+    if (!data) {
+        fprintf(stderr, "Bench: Could not read %s\n", path);
+        return NULL;
+    }
+    data[len] = '\0';
+    if (size) *size = (size_t)len;
+    return data;
+}
+
+static int corpus_add(bench_corpus_t *corpus, int *capacity, char kind, char *text)
+{
+    if (corpus->count == *capacity) {
+        bench_record_t *grown;
+
+        *capacity = *capacity ? *capacity * 2 : 64;
+        grown = (bench_record_t *)realloc(corpus->records,
+                                          *capacity * sizeof(bench_record_t));
+        if (!grown) return 0;
+        corpus->records = grown;
+    }
+    corpus->records[corpus->count].kind = kind;
+    corpus->records[corpus->count].text = text;
+    corpus->count++;
+    return 1;
+}
+
+/* nagi --record logs, see src/sys/replay.c */
+#define REPLAY_MAGIC "NAGIRPL"
+#define REPLAY_MAGIC_SIZE 8           /* With the version byte */
+
+/* One LEB128 number, returns 0 past the end */
+static int replay_number(unsigned char **p, const unsigned char *end, size_t *n)
+{
+    int shift;
+
+    *n = 0;
+    for (shift = 0; *p < end && shift < 32; shift += 7) {
+        unsigned char c = *(*p)++;
+
+        *n |= (size_t)(c & 0x7F) << shift;
+        if (!(c & 0x80)) return 1;
+    }
+    return 0;
+}
+
+/*
+ * Take the parser lines out of a replay log as '>' records, in place
+ * Each line moves back a byte over its length to make room for the NUL.
+ */
+static int load_replay_corpus(bench_corpus_t *corpus, char *data, size_t size)
+{
+    /* Numbers after the cycles, by record tag */
+    static const int fields[] = { 0, 4, 5, 3 };
+    /* Not const, the lines are moved about where they are */
+    unsigned char *p = (unsigned char *)data + REPLAY_MAGIC_SIZE;
+    const unsigned char *end = (const unsigned char *)data + size;
+    int capacity = 0;
+    size_t n;
+    int i;
+
+    while (p < end) {
+        int tag = *p++;
+
+        if (!replay_number(&p, end, &n)) break;
+        if (tag == 4) {
+            char *text;
+
+            if (!replay_number(&p, end, &n) || n > (size_t)(end - p)) break;
+            text = (char *)p - 1;
+            memmove(text, p, n);
+            text[n] = '\0';
+            p += n;
+            if (n > 0 && !corpus_add(corpus, &capacity, '>', text)) return 0;
+        } else if (tag >= 0 && tag < (int)(sizeof(fields) / sizeof(fields[0]))) {
+            for (i = 0; i < fields[tag]; i++) {
+                if (!replay_number(&p, end, &n)) break;
+            }
+        } else {
+            fprintf(stderr, "Bench: Bad replay record %d\n", tag);
+            break;
+        }
+    }
+
+    return corpus->count > 0;
+}
+
+/*
+ * Split the corpus into records, in place
+ * Returns 1 on success, 0 if it holds nothing to replay
+ */
+static int load_corpus(bench_corpus_t *corpus, char *data, size_t size)
+{
+    char *line = data;
+    int capacity = 0;
+
+    corpus->records = NULL;
+    corpus->count = 0;
+
+    if (size >= REPLAY_MAGIC_SIZE && memcmp(data, REPLAY_MAGIC, strlen(REPLAY_MAGIC)) == 0) {
+        return load_replay_corpus(corpus, data, size);
+    }
+
+    while (line && *line) {
+        char *next = strchr(line, '\n');
+        char *end;
+
+        if (next) *next++ = '\0';
+        end = line + strlen(line);
+        while (end > line && isspace((unsigned char)end[-1])) *--end = '\0';
+        while (isspace((unsigned char)*line)) line++;
+
+        if (*line == '>' || *line == '=' || *line == '<') {
+            char kind = *line++;
+
+            while (isspace((unsigned char)*line)) line++;
+            if (*line && !corpus_add(corpus, &capacity, kind, line)) return 0;
+        } else if (*line && *line != '#') {
+            fprintf(stderr, "Bench: Skipping corpus line '%s'\n", line);
+        }
+        line = next;
+    }
+
+    return corpus->count > 0;
+}
+
+static void samples_add(bench_samples_t *samples, double ms)
+{
+    if (samples->count == samples->capacity) {
+        int capacity = samples->capacity ? samples->capacity * 2 : 256;
+        double *grown = (double *)realloc(samples->ms, capacity * sizeof(double));
+
+        if (!grown) return;
+        samples->ms = grown;
+        samples->capacity = capacity;
+    }
+    samples->ms[samples->count++] = ms;
+}
+
+static int compare_ms(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Nearest rank percentile of sorted samples */
+static double percentile(const bench_samples_t *samples, double pct)
+{
+    int rank;
+
+    if (samples->count == 0) return 0.0;
+
+    rank = (int)(pct / 100.0 * samples->count + 0.999999);
+    if (rank < 1) rank = 1;
+    if (rank > samples->count) rank = samples->count;
+    return samples->ms[rank - 1];
+}
+
+/*
+ * Resident and peak memory of the process in MB
+ * The peak never goes down, so later runs report at least the earlier peaks.
+ */
+static void memory_usage(double *rss_mb, double *peak_mb)
+{
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+
+    *rss_mb = *peak_mb = -1.0;
+    if (K32GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        *rss_mb = counters.WorkingSetSize / (1024.0 * 1024.0);
+        *peak_mb = counters.PeakWorkingSetSize / (1024.0 * 1024.0);
+    }
+#else
+    struct rusage usage;
+
+    *rss_mb = *peak_mb = -1.0;
+#ifdef __APPLE__
+    {
+        struct mach_task_basic_info info;
+        mach_msg_type_number_t count = MACH_TASK_BASIC_INFO_COUNT;
+
+        if (task_info(mach_task_self(), MACH_TASK_BASIC_INFO,
+                      (task_info_t)&info, &count) == KERN_SUCCESS) {
+            *rss_mb = info.resident_size / (1024.0 * 1024.0);
+        }
+    }
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        *peak_mb = usage.ru_maxrss / (1024.0 * 1024.0);       /* Bytes */
+    }
+#else
+    {
+        FILE *f = fopen("/proc/self/statm", "r");
+        unsigned long pages, resident;
+
+        if (f) {
+            if (fscanf(f, "%lu %lu", &pages, &resident) == 2) {
+                *rss_mb = resident * 4096.0 / (1024.0 * 1024.0);
+            }
+            fclose(f);
+        }
+    }
+    if (getrusage(RUSAGE_SELF, &usage) == 0) {
+        *peak_mb = usage.ru_maxrss / 1024.0;                  /* KB */
+    }
+#endif
+#endif
+}
+
+/*
+ * Look up the said() words of a '=' record
+ * Returns the number of word IDs, 0 if a word is not in the dictionary
+ */
+static int said_words(nagi_llm_t *llm, const char *text, int *ids)
+{
+    int count = 0;
+
+    while (*text && count < BENCH_MAX_WORDS) {
+        int len = (int)strcspn(text, " \t");
+
+        if (len > 0) {
+            int id = nagi_llm_find_word(llm, text, len);
+            if (id < 0) {
+                fprintf(stderr, "Bench: '%.*s' is not in the dictionary\n", len, text);
+                return 0;
+            }
+            ids[count++] = id;
+        }
+        text += len;
+        while (*text == ' ' || *text == '\t') text++;
+    }
+    return count;
+}
+
+/*
+ * Replay the corpus once, adding latencies to samples (NULL for warmup)
+ */
+static void replay(nagi_llm_t *llm, const bench_corpus_t *corpus, bench_samples_t *samples)
+{
+    char output[NAGI_LLM_MAX_RESPONSE_SIZE];
+    const char *input = "";
+    int ids[BENCH_MAX_WORDS];
+    int i, n_ids, op;
+    double start;
+
+    for (i = 0; i < corpus->count; i++) {
+        const bench_record_t *rec = &corpus->records[i];
+
+        start = llm_time_ms();
+        switch (rec->kind) {
+            case '>':
+                input = rec->text;
+                nagi_llm_extract_words(llm, input, output, sizeof(output));
+                op = BENCH_EXTRACT;
+                break;
+            case '=':
+                n_ids = said_words(llm, rec->text, ids);
+                if (n_ids == 0) continue;
+                start = llm_time_ms();
+                nagi_llm_matches_expected(llm, input, ids, n_ids);
+                op = BENCH_MATCH;
+                break;
+            default:
+                nagi_llm_generate_response(llm, rec->text, input, output, sizeof(output));
+                op = BENCH_GENERATE;
+                break;
+        }
+        if (samples) {
+            samples_add(&samples[op], llm_time_ms() - start);
+        }
+    }
+}
+
+/* Tokens per second over a stage, 0 when nothing was timed */
+static double rate(u32 tokens, double ms)
+{
+    return ms > 0.0 ? tokens * 1000.0 / ms : 0.0;
+}
+
+/*
+ * Load one backend with one preset and measure the corpus
+ * Returns 1 if the run completed
+ */
+static int bench_run(bench_run_t *run, const bench_options_t *opts, const bench_corpus_t *corpus,
+                     const unsigned char *dict, size_t dict_size)
+{
+    bench_samples_t samples[BENCH_OPS];
+    nagi_llm_config_t config;
+    nagi_llm_stats_t stats;
+    nagi_llm_t *llm;
+    double start, rss_mb;
+    int i;
+
+    if (!nagi_llm_load_config(&config, run->backend, run->preset)) {
+        return 0;
+    }
+    /* Repeated passes would otherwise only measure the cache */
+    if (!opts->keep_cache) {
+        config.translation_cache_kb = 0;
+    }
+    config.stats_file[0] = '\0';
+
+    llm = nagi_llm_create(run->backend);
+    if (!llm) {
+        fprintf(stderr, "Bench: Backend %s is not compiled in\n", backend_name(run->backend));
+        return 0;
+    }
+
+    start = llm_time_ms();
+    if (!nagi_llm_init(llm, opts->model_path, &config)) {
+        fprintf(stderr, "Bench: %s failed to load\n", backend_name(run->backend));
+        nagi_llm_destroy(llm);
+        return 0;
+    }
+    run->load_ms = llm_time_ms() - start;
+    memory_usage(&run->rss_mb, &run->peak_mb);
+
+    if (!nagi_llm_set_dictionary(llm, dict, dict_size)) {
+        fprintf(stderr, "Bench: Could not use dictionary %s\n", opts->dict_path);
+        nagi_llm_shutdown(llm);
+        nagi_llm_destroy(llm);
+        return 0;
+    }
+
+    for (i = 0; i < opts->warmup; i++) {
+        replay(llm, corpus, NULL);
+    }
+
+    memset(samples, 0, sizeof(samples));
+    nagi_llm_reset_stats(llm);
+    for (i = 0; i < opts->passes; i++) {
+        replay(llm, corpus, samples);
+    }
+    nagi_llm_get_stats(llm, &stats);
+    memory_usage(&rss_mb, &run->peak_mb);
+
+    for (i = 0; i < BENCH_OPS; i++) {
+        bench_result_t *res = &run->op[i];
+        const nagi_llm_op_stats_t *op = &stats.op[bench_stats_ops[i]];
+        double total = 0.0;
+        int j;
+
+        qsort(samples[i].ms, samples[i].count, sizeof(double), compare_ms);
+        for (j = 0; j < samples[i].count; j++) {
+            total += samples[i].ms[j];
+        }
+
+        res->count = samples[i].count;
+        res->p50 = percentile(&samples[i], 50.0);
+        res->p95 = percentile(&samples[i], 95.0);
+        res->p99 = percentile(&samples[i], 99.0);
+        res->max = samples[i].count ? samples[i].ms[samples[i].count - 1] : 0.0;
+        res->mean = samples[i].count ? total / samples[i].count : 0.0;
+        res->prompt_tps = rate(op->prompt_tokens, op->prompt_ms);
+        res->generate_tps = rate(op->generated_tokens, op->generate_ms);
+        free(samples[i].ms);
+    }
+
+    nagi_llm_shutdown(llm);
+    nagi_llm_destroy(llm);
+    return 1;
+}
+
+static void print_run(const bench_run_t *run)
+{
+    int i;
+
+    printf("\n%s, %s: loaded in %.0f ms, %.0f MB resident, %.0f MB peak\n",
+           backend_name(run->backend), run->preset, run->load_ms, run->rss_mb, run->peak_mb);
+    printf("  %-9s %7s %9s %9s %9s %9s %12s %10s\n",
+           "op", "count", "p50 ms", "p95 ms", "p99 ms", "max ms", "prompt tok/s", "gen tok/s");
+    for (i = 0; i < BENCH_OPS; i++) {
+        const bench_result_t *res = &run->op[i];
+
+        if (res->count == 0) continue;
+        printf("  %-9s %7d %9.1f %9.1f %9.1f %9.1f %12.1f %10.1f\n",
+               bench_op_names[i], res->count, res->p50, res->p95, res->p99, res->max,
+               res->prompt_tps, res->generate_tps);
+    }
+}
+
+/* One line per run, to compare backends and presets at a glance */
+static void print_summary(const bench_run_t *runs, int n_runs)
+{
+    int i, j;
+
+    printf("\np95 ms per run\n");
+    printf("  %-10s %-24s", "backend", "config");
+    for (j = 0; j < BENCH_OPS; j++) {
+        printf(" %9s", bench_op_names[j]);
+    }
+    printf(" %9s\n", "peak MB");
+
+    for (i = 0; i < n_runs; i++) {
+        printf("  %-10s %-24s", backend_name(runs[i].backend), runs[i].preset);
+        if (!runs[i].ok) {
+            printf(" failed\n");
+            continue;
+        }
+        for (j = 0; j < BENCH_OPS; j++) {
+            printf(" %9.1f", runs[i].op[j].p95);
+        }
+        printf(" %9.0f\n", runs[i].peak_mb);
+    }
+}
+
+static int write_csv(const char *path, const bench_run_t *runs, int n_runs)
+{
+    FILE *f;
+    int i, j;
+
+    f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "Bench: Could not write %s\n", path);
+        return 0;
+    }
+
+    fprintf(f, "backend,config,operation,count,p50_ms,p95_ms,p99_ms,mean_ms,max_ms,"
+               "prompt_tokens_per_s,generated_tokens_per_s,load_ms,rss_mb,peak_mb\n");
+    for (i = 0; i < n_runs; i++) {
+        if (!runs[i].ok) continue;
+        for (j = 0; j < BENCH_OPS; j++) {
+            const bench_result_t *res = &runs[i].op[j];
+
+            fprintf(f, "%s,%s,%s,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.1f,%.1f,%.0f,%.0f,%.0f\n",
+                    backend_name(runs[i].backend), runs[i].preset, bench_op_names[j],
+                    res->count, res->p50, res->p95, res->p99, res->mean, res->max,
+                    res->prompt_tps, res->generate_tps,
+                    runs[i].load_ms, runs[i].rss_mb, runs[i].peak_mb);
+        }
+    }
+    fclose(f);
+    return 1;
+}
+
+int main(int argc, char **argv)
+{
+    bench_options_t opts;
+    bench_corpus_t corpus;
+    bench_run_t runs[BENCH_MAX_RUNS];
+    char *dict, *corpus_data;
+    size_t dict_size, corpus_size = 0;
+    int n_runs = 0, failed = 0;
+    int b, p;
+
+    if (!parse_options(&opts, argc, argv)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    dict = read_file(opts.dict_path, &dict_size);
+    corpus_data = read_file(opts.corpus_path, &corpus_size);
+    if (!dict || !corpus_data || !load_corpus(&corpus, corpus_data, corpus_size)) {
+        if (corpus_data && dict) {
+            fprintf(stderr, "Bench: Nothing to replay in %s\n", opts.corpus_path);
+        }
+        free(dict);
+        free(corpus_data);
+        return 1;
+    }
+
+    printf("Bench: %d records from %s, %d pass(es), %d warmup\n",
+           corpus.count, opts.corpus_path, opts.passes, opts.warmup);
+
+    memset(runs, 0, sizeof(runs));
+    for (b = 0; b < opts.n_backends; b++) {
+        for (p = 0; p < opts.n_presets; p++) {
+            bench_run_t *run = &runs[n_runs++];
+
+            run->backend = opts.backends[b];
+            run->preset = opts.presets[p];
+            run->ok = bench_run(run, &opts, &corpus, (const unsigned char *)dict, dict_size);
+            if (run->ok) {
+                print_run(run);
+            } else {
+                failed++;
+            }
+        }
+    }
+
+    print_summary(runs, n_runs);
+    if (opts.output_path) {
+        write_csv(opts.output_path, runs, n_runs);
+    }
+
+    free(corpus.records);
+    free(corpus_data);
+    free(dict);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,978 @@
+/*
+ * nagi_llm_server.c - One resident model for every game on the machine
+ *
+ * Loads a local backend once and serves the games that run with the
+ * server backend (NAGI_LLM_BACKEND_SERVER) over a Unix domain socket, so
+ * N interpreters cost one model in memory. Each connection gets a thread;
+ * generation goes through the async worker, so responses from different
+ * games share its batched decodes (n_seq_max > 9, see llm_config.ini).
+ *
+ * Connections keep their own dictionary, language and game context. The
+ * instance holds one dictionary at a time; games running the same game
+ * share it, a request from another game switches it first. Responses
+ * carry their game's context and language through the worker
+ * (nagi_llm_generate_response_async_for), so what another connection
+ * switches in meanwhile doesn't reach them. On Linux clients move to
+ * shared memory rings after the handshake (see nagi_llm_server.h).
+ *
+ * With numa = replicas on a multi-socket machine there is an instance per
+ * NUMA node. Each is loaded by a thread bound to its node, so its weights
+ * (read into private memory, not shared through the page cache), KV cache
+ * and compute threads are all there. A new connection goes to the replica
+ * with the fewest sessions and its thread is bound to that node, so a
+ * session's decodes never cross the socket link.
+ *
+ * Several servers can split the games between them ([server] nodes, see
+ * nagi_llm_server.h). SIGUSR1 drains one for a deploy: it stops taking
+ * connections and answers the next request of each game with MOVED, the
+ * game exports its session (language and decoded game context) and
+ * imports it on the next node, then the server exits once they're gone.
+ * An instance decodes one game context, so an import replaces the one
+ * the sessions already there were sharing.
+ *
+ * With [server] metrics_port the replicas' telemetry is served for
+ * Prometheus on localhost (nagi_llm_metrics), with the sessions on each.
+ *
+ * Usage:
+ *   nagi-llm-server [-m model.gguf] [-c llm_config.ini] [-s socket] [-b backend]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <signal.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "nagi_llm.h"
+#include "nagi_llm_context.h"
+#include "../src/llm_thread.h"
+#include "../src/llm_numa.h"
+#include "../backends/server/nagi_llm_server.h"
+
+#define SERVER_POLL_MS 2                /* Partial text check while a response generates */
+#define SERVER_DRAIN_MS 60000           /* Longest wait for the sessions to move before exiting */
+#define SERVER_MAX_SESSION (1u << 30)   /* Largest session import taken */
+#define METRICS_POLL_MS 250             /* How soon the metrics thread sees it should stop */
+
+typedef struct server_client server_client_t;
+
+/* One loaded instance, on its NUMA node */
+typedef struct {
+    nagi_llm_t *llm;
+    llm_mutex_t lock;                   /* Held while a client's session is swapped in */
+    unsigned char *dictionary;          /* Copy the instance points at */
+    size_t dictionary_size;
+    int node;                           /* NUMA node it's bound to, -1 for none */
+    int sessions;                       /* Connections on it, under clients_lock */
+} server_replica_t;
+
+typedef struct {
+    server_replica_t replica[LLM_NUMA_MAX_NODES];
+    int n_replicas;
+    server_client_t *clients;
+    llm_mutex_t clients_lock;
+    int metrics_fd;                     /* Prometheus endpoint, -1 for none */
+    llm_thread_t metrics_thread;
+    volatile int metrics_quit;
+} server_t;
+
+struct server_client {
+    server_t *server;
+    server_replica_t *replica;          /* The instance its requests go to */
+    llm_server_link_t link;
+    llm_thread_t thread;
+    int done;                           /* Thread finished, can be joined */
+    unsigned char *dictionary;          /* This game's WORDS.TOK */
+    size_t dictionary_size;
+    char language[32];                  /* Language of the request being served */
+    float language_confidence;
+    nagi_llm_session_t *context;        /* The game's context as it last sent it */
+    char *session;                      /* Session being exported or imported, NULL for none */
+    size_t session_size;                /* Its bytes, all of them when exporting */
+    size_t session_total;               /* Bytes an import expects */
+    server_client_t *next;
+};
+
+static volatile sig_atomic_t server_quit = 0;
+static volatile sig_atomic_t server_drain = 0;
+
+static void on_signal(int sig)
+{
+    if (sig == SIGUSR1) {
+        server_drain = 1;
+    } else {
+        server_quit = 1;
+    }
+}
+
+static void usage(const char *prog)
+{
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "  -m file      Model to serve (default $NAGI_LLM_MODEL_PATH)\n"
+            "  -c file      Config (default llm_config.ini)\n"
+            "  -s path      Socket to listen on (default [server] socket)\n"
+            "  -b backend   Local backend: llamacpp or bitnet\n",
+            prog);
+}
+
+/*
+ * Put the client's dictionary, context and language into the instance
+ * Called with replica->lock held.
+ */
+static void session_enter(server_client_t *client)
+{
+    server_replica_t *replica = client->replica;
+    unsigned char *copy, *old;
+
+    if (client->dictionary &&
+        (client->dictionary_size != replica->dictionary_size ||
+         memcmp(client->dictionary, replica->dictionary, client->dictionary_size) != 0)) {
+        copy = (unsigned char *)malloc(client->dictionary_size);
+        if (copy) {
+            memcpy(copy, client->dictionary, client->dictionary_size);
+            old = replica->dictionary;
+            nagi_llm_set_dictionary(replica->llm, copy, client->dictionary_size);
+            replica->dictionary = copy;
+            replica->dictionary_size = client->dictionary_size;
+            free(old);
+        }
+    }
+
+    nagi_llm_set_player(replica->llm, client->context, client->language, client->language_confidence);
+}
+
+/*
+ * Take the language back from the instance, which keeps no pointer to
+ * the context. Called with replica->lock held.
+ */
+static void session_leave(server_client_t *client)
+{
+    nagi_llm_t *llm = client->replica->llm;
+
+    nagi_llm_player_language(llm, client->language, sizeof(client->language),
+                             &client->language_confidence);
+    nagi_llm_set_player(llm, NULL, NULL, 0.0f);
+}
+
+static int reply(server_client_t *client, nagi_llm_server_op_t op, int value,
+                 const void *payload, size_t size)
+{
+    nagi_llm_server_frame_t frame;
+
+    llm_server_frame(&frame, op, value, (uint32_t)size);
+    memcpy(frame.language, client->language, sizeof(frame.language));
+    frame.language_confidence = client->language_confidence;
+    return llm_server_send(&client->link, &frame, payload);
+}
+
+static int get_int(const char **p, const char *end, int *value)
+{
+    int32_t v;
+
+    if (end - *p < (long)sizeof(v)) return 0;
+    memcpy(&v, *p, sizeof(v));
+    *p += sizeof(v);
+    *value = v;
+    return 1;
+}
+
+/* Next NUL-terminated string of the payload, NULL when it runs out */
+static const char *get_string(const char **p, const char *end)
+{
+    const char *str = *p;
+    const char *nul;
+
+    if (*p >= end) return NULL;
+    nul = (const char *)memchr(*p, '\0', end - *p);
+    if (!nul) return NULL;
+    *p = nul + 1;
+    return str;
+}
+
+static int serve_extract(server_client_t *client, const char *payload, size_t size)
+{
+    server_replica_t *replica = client->replica;
+    const char *p = payload, *input;
+    char result[NAGI_LLM_MAX_RESPONSE_SIZE];
+
+    input = get_string(&p, payload + size);
+    if (!input) return reply(client, NAGI_LLM_SERVER_RESULT, -1, NULL, 0);
+
+    llm_mutex_lock(&replica->lock);
+    session_enter(client);
+    nagi_llm_extract_words(replica->llm, input, result, sizeof(result));
+    session_leave(client);
+    llm_mutex_unlock(&replica->lock);
+
+    return reply(client, NAGI_LLM_SERVER_RESULT, 1, result, strlen(result) + 1);
+}
+
+static int serve_match(server_client_t *client, const char *payload, size_t size, int batch)
+{
+    server_replica_t *replica = client->replica;
+    const char *p = payload, *end = payload + size, *input;
+    const int **lists = NULL;
+    int *counts = NULL, *ids = NULL, *results = NULL;
+    int32_t *out = NULL;
+    int n = 1, total, i, ok = 0, result = -1;
+
+    if (batch && (!get_int(&p, end, &n) || n <= 0 || n > (int)(size / sizeof(int32_t)))) goto done;
+
+    lists = (const int **)malloc(n * sizeof(const int *));
+    counts = (int *)malloc(n * sizeof(int));
+    results = (int *)malloc(n * sizeof(int));
+    out = (int32_t *)malloc(n * sizeof(int32_t));
+    if (!lists || !counts || !results || !out) goto done;
+
+    /* Single matches carry one count, batches all counts before the IDs */
+    total = 0;
+    for (i = 0; i < n; i++) {
+        if (!get_int(&p, end, &counts[i]) || counts[i] <= 0 ||
+            counts[i] > (int)(size / sizeof(int32_t))) goto done;
+        total += counts[i];
+        if (total > (int)(size / sizeof(int32_t))) goto done;
+    }
+    ids = (int *)malloc(total * sizeof(int));
+    if (!ids) goto done;
+    for (i = 0; i < total; i++) {
+        if (!get_int(&p, end, &ids[i])) goto done;
+    }
+    total = 0;
+    for (i = 0; i < n; i++) {
+        lists[i] = ids + total;
+        total += counts[i];
+    }
+    input = get_string(&p, end);
+    if (!input) goto done;
+
+    llm_mutex_lock(&replica->lock);
+    session_enter(client);
+    if (batch) {
+        result = nagi_llm_matches_expected_batch(replica->llm, input, lists, counts, n, results);
+    } else {
+        result = nagi_llm_matches_expected(replica->llm, input, lists[0], counts[0]);
+    }
+    session_leave(client);
+    llm_mutex_unlock(&replica->lock);
+
+    for (i = 0; batch && i < n; i++) {
+        out[i] = results[i];
+    }
+    ok = 1;
+
+done:
+    if (ok) {
+        ok = reply(client, NAGI_LLM_SERVER_RESULT, result, batch ? out : NULL,
+                   batch ? n * sizeof(int32_t) : 0);
+    } else {
+        ok = reply(client, NAGI_LLM_SERVER_RESULT, -1, NULL, 0);
+    }
+    free(lists);
+    free(counts);
+    free(ids);
+    free(results);
+    free(out);
+    return ok;
+}
+
+/*
+ * Queue the response on the async worker and stream its partial text
+ * back until it is done. The client can CANCEL in between.
+ * Returns 0 if the connection is gone.
+ */
+static int serve_generate(server_client_t *client, int streaming, const char *payload, size_t size)
+{
+    server_replica_t *replica = client->replica;
+    const char *p = payload, *end = payload + size;
+    const char *game_response, *user_input, *result;
+    char partial[NAGI_LLM_MAX_RESPONSE_SIZE];
+    nagi_llm_server_frame_t frame;
+    nagi_llm_request_t *req;
+    nagi_llm_request_status_t status;
+    const char *data;
+    int sent = 0, len, alive = 1, cancelled = 0;
+
+    game_response = get_string(&p, end);
+    user_input = get_string(&p, end);
+    if (!game_response || !user_input) return reply(client, NAGI_LLM_SERVER_RESULT, 0, NULL, 0);
+
+    req = nagi_llm_generate_response_async_for(replica->llm, client->context, client->language,
+                                               client->language_confidence, game_response, user_input);
+    if (!req) return reply(client, NAGI_LLM_SERVER_RESULT, 0, NULL, 0);
+
+    for (;;) {
+        status = nagi_llm_request_poll(req);
+
+        if (streaming) {
+            len = nagi_llm_request_partial(req, partial, sizeof(partial));
+            if (len > sent) {
+                if (!reply(client, NAGI_LLM_SERVER_PIECE, 1, partial + sent, len - sent)) {
+                    alive = 0;
+                    break;
+                }
+                sent = len;
+            }
+        }
+        if (status != NAGI_LLM_REQUEST_PENDING) break;
+
+        /* Waits out the poll interval unless the client has something to say */
+        len = llm_server_wait(&client->link, SERVER_POLL_MS);
+        if (len < 0) {
+            alive = 0;
+            break;
+        }
+        if (len > 0) {
+            if (!llm_server_recv(&client->link, &frame, &data)) {
+                alive = 0;
+                break;
+            }
+            if (frame.op == NAGI_LLM_SERVER_CANCEL) {
+                cancelled = 1;
+                break;
+            }
+        }
+    }
+
+    /* The language it was generated in, which may be one it detected */
+    if (status == NAGI_LLM_REQUEST_DONE) {
+        nagi_llm_request_language(req, client->language, sizeof(client->language),
+                                  &client->language_confidence);
+    }
+
+    /* A cancelled stream ends with what the client has already seen */
+    if (cancelled) {
+        partial[sent] = '\0';
+        result = partial;
+    } else {
+        result = nagi_llm_request_result(req);
+    }
+    if (alive) {
+        alive = result ?
+                reply(client, NAGI_LLM_SERVER_RESULT, (int)strlen(result), result, strlen(result) + 1) :
+                reply(client, NAGI_LLM_SERVER_RESULT, 0, NULL, 0);
+    }
+    nagi_llm_request_free(req);
+    return alive;
+}
+
+static int serve_generate_batch(server_client_t *client, const char *payload, size_t size)
+{
+    server_replica_t *replica = client->replica;
+    const char *p = payload, *end = payload + size;
+    const char **messages = NULL;
+    char **outputs = NULL;
+    char *out = NULL, *q = NULL;
+    int n = 0, i, done = 0, ok;
+    size_t out_size;
+
+    if (!get_int(&p, end, &n) || n <= 0 || n > (int)size) {
+        return reply(client, NAGI_LLM_SERVER_RESULT, 0, NULL, 0);
+    }
+
+    messages = (const char **)calloc(n, sizeof(const char *));
+    outputs = (char **)calloc(n, sizeof(char *));
+    out = (char *)malloc((size_t)n * NAGI_LLM_MAX_RESPONSE_SIZE);
+    if (!messages || !outputs || !out) goto done;
+
+    for (i = 0; i < n; i++) {
+        messages[i] = get_string(&p, end);
+        if (!messages[i]) goto done;
+        outputs[i] = out + (size_t)i * NAGI_LLM_MAX_RESPONSE_SIZE;
+    }
+
+    llm_mutex_lock(&replica->lock);
+    session_enter(client);
+    done = nagi_llm_generate_response_batch(replica->llm, messages, n, outputs,
+                                            NAGI_LLM_MAX_RESPONSE_SIZE);
+    session_leave(client);
+    llm_mutex_unlock(&replica->lock);
+
+    /* Pack the responses back to back */
+    q = out;
+    for (i = 0; i < n; i++) {
+        size_t len = strlen(outputs[i]) + 1;
+        memmove(q, outputs[i], len);
+        q += len;
+    }
+
+done:
+    out_size = done > 0 ? (size_t)(q - out) : 0;
+    ok = reply(client, NAGI_LLM_SERVER_RESULT, done, out, out_size);
+    free(messages);
+    free(outputs);
+    free(out);
+    return ok;
+}
+
+/*
+ * Set up the shared memory rings and tell the client where they are
+ * The answer still goes over the socket, everything after it through the rings.
+ */
+static int serve_shm(server_client_t *client)
+{
+    llm_server_shm_t *shm;
+    char name[64];
+    int ok;
+
+    shm = client->link.shm ? NULL : llm_server_shm_create(name, sizeof(name));
+    if (!shm) return reply(client, NAGI_LLM_SERVER_RESULT, 0, NULL, 0);
+
+    ok = reply(client, NAGI_LLM_SERVER_RESULT, 1, name, strlen(name) + 1);
+    llm_server_link_attach(&client->link, shm);
+    return ok;
+}
+
+/*
+ * Send the session from offset on. It is taken at offset 0 and kept until
+ * its last bytes are sent.
+ */
+static int serve_export(server_client_t *client, int offset)
+{
+    server_replica_t *replica = client->replica;
+    size_t size, n;
+
+    if (offset == 0) {
+        free(client->session);
+        client->session = NULL;
+        client->session_size = 0;
+
+        llm_mutex_lock(&replica->lock);
+        session_enter(client);
+        size = nagi_llm_session_save(replica->llm, NULL, 0, 1);
+        client->session = size ? (char *)malloc(size) : NULL;
+        if (client->session) {
+            client->session_size = nagi_llm_session_save(replica->llm, client->session, size, 1);
+        }
+        session_leave(client);
+        llm_mutex_unlock(&replica->lock);
+    }
+
+    if (!client->session || offset < 0 || (size_t)offset >= client->session_size ||
+        client->session_size > SERVER_MAX_SESSION) {
+        return reply(client, NAGI_LLM_SERVER_RESULT, 0, NULL, 0);
+    }
+
+    n = client->session_size - offset;
+    if (n > NAGI_LLM_SERVER_MAX_PAYLOAD) n = NAGI_LLM_SERVER_MAX_PAYLOAD;
+    if (!reply(client, NAGI_LLM_SERVER_RESULT, (int)client->session_size, client->session + offset, n)) {
+        return 0;
+    }
+    if (offset + n == client->session_size) {
+        free(client->session);
+        client->session = NULL;
+        client->session_size = 0;
+    }
+    return 1;
+}
+
+/* Collect a session exported from another node, and take it once it's all here */
+static int serve_import(server_client_t *client, int total, const char *payload, size_t size)
+{
+    server_replica_t *replica = client->replica;
+    int result;
+
+    if (total <= 0 || (size_t)total > SERVER_MAX_SESSION || !payload) {
+        return reply(client, NAGI_LLM_SERVER_RESULT, -1, NULL, 0);
+    }
+    /* The first part of a new session */
+    if (!client->session || client->session_total != (size_t)total) {
+        free(client->session);
+        client->session = (char *)malloc(total);
+        client->session_size = 0;
+        client->session_total = total;
+        if (!client->session) return reply(client, NAGI_LLM_SERVER_RESULT, -1, NULL, 0);
+    }
+    if (size > client->session_total - client->session_size) {
+        return reply(client, NAGI_LLM_SERVER_RESULT, -1, NULL, 0);
+    }
+    memcpy(client->session + client->session_size, payload, size);
+    client->session_size += size;
+    if (client->session_size < client->session_total) {
+        return reply(client, NAGI_LLM_SERVER_RESULT, 0, NULL, 0);
+    }
+
+    llm_mutex_lock(&replica->lock);
+    session_enter(client);
+    result = nagi_llm_session_load(replica->llm, client->session, client->session_size) ? 1 : 2;
+    session_leave(client);
+    llm_mutex_unlock(&replica->lock);
+
+    free(client->session);
+    client->session = NULL;
+    client->session_size = 0;
+    client->session_total = 0;
+    return reply(client, NAGI_LLM_SERVER_RESULT, result, NULL, 0);
+}
+
+/* The game's context as it is now, the prompts for it are built from it */
+static int serve_context(server_client_t *client, const char *payload, size_t size)
+{
+    if (!client->context || !payload || size != (size_t)llm_context_snapshot_size(client->context)) {
+        return reply(client, NAGI_LLM_SERVER_RESULT, 0, NULL, 0);
+    }
+    llm_context_snapshot_restore(client->context, payload);
+    return reply(client, NAGI_LLM_SERVER_RESULT, 1, NULL, 0);
+}
+
+static void *client_main(void *arg)
+{
+    server_client_t *client = (server_client_t *)arg;
+    server_t *server = client->server;
+    nagi_llm_server_frame_t frame;
+    const char *payload;
+    int alive = 1, id = client->link.fd;
+
+    /* Decodes run on this thread and the worker it may start, both on the replica's node */
+    if (client->replica->node >= 0) {
+        llm_numa_bind(client->replica->node);
+    }
+    client->context = nagi_llm_session_new();
+
+    while (alive && !server_quit && llm_server_recv(&client->link, &frame, &payload)) {
+        if (frame.language[0]) {
+            memcpy(client->language, frame.language, sizeof(client->language));
+            client->language_confidence = frame.language_confidence;
+        }
+
+        /* Draining: the connection stays up for the session to be exported */
+        if (server_drain && frame.op != NAGI_LLM_SERVER_HELLO && frame.op != NAGI_LLM_SERVER_SHM &&
+            frame.op != NAGI_LLM_SERVER_CANCEL && frame.op != NAGI_LLM_SERVER_SESSION_EXPORT) {
+            alive = reply(client, NAGI_LLM_SERVER_MOVED, 0, NULL, 0);
+            continue;
+        }
+
+        switch (frame.op) {
+            case NAGI_LLM_SERVER_HELLO:
+                alive = reply(client, NAGI_LLM_SERVER_RESULT, NAGI_LLM_SERVER_VERSION, NULL, 0);
+                break;
+            case NAGI_LLM_SERVER_DICTIONARY:
+                free(client->dictionary);
+                client->dictionary = payload ? (unsigned char *)malloc(frame.size) : NULL;
+                client->dictionary_size = client->dictionary ? frame.size : 0;
+                if (client->dictionary) {
+                    memcpy(client->dictionary, payload, frame.size);
+                }
+                alive = reply(client, NAGI_LLM_SERVER_RESULT, client->dictionary != NULL, NULL, 0);
+                break;
+            case NAGI_LLM_SERVER_EXTRACT:
+                alive = serve_extract(client, payload, frame.size);
+                break;
+            case NAGI_LLM_SERVER_MATCH:
+            case NAGI_LLM_SERVER_MATCH_BATCH:
+                alive = serve_match(client, payload, frame.size,
+                                    frame.op == NAGI_LLM_SERVER_MATCH_BATCH);
+                break;
+            case NAGI_LLM_SERVER_GENERATE:
+                alive = serve_generate(client, frame.value, payload, frame.size);
+                break;
+            case NAGI_LLM_SERVER_GENERATE_BATCH:
+                alive = serve_generate_batch(client, payload, frame.size);
+                break;
+            case NAGI_LLM_SERVER_CANCEL:
+                /* Arrived after the response was done */
+                break;
+            case NAGI_LLM_SERVER_SHM:
+                alive = serve_shm(client);
+                break;
+            case NAGI_LLM_SERVER_SESSION_EXPORT:
+                alive = serve_export(client, frame.value);
+                break;
+            case NAGI_LLM_SERVER_SESSION_IMPORT:
+                alive = serve_import(client, frame.value, payload, frame.size);
+                break;
+            case NAGI_LLM_SERVER_CONTEXT:
+                alive = serve_context(client, payload, frame.size);
+                break;
+            default:
+                alive = reply(client, NAGI_LLM_SERVER_RESULT, -1, NULL, 0);
+                break;
+        }
+    }
+
+    if (client->replica->llm->config.verbose) {
+        printf("LLM Server: Client %d disconnected\n", id);
+    }
+
+    /* A cancelled response may still be stopping, it has the context until then */
+    llm_mutex_lock(&client->replica->lock);
+    nagi_llm_set_player(client->replica->llm, NULL, NULL, 0.0f);
+    llm_mutex_unlock(&client->replica->lock);
+    nagi_llm_session_free(client->context);
+    client->context = NULL;
+
+    llm_mutex_lock(&server->clients_lock);
+    llm_server_link_close(&client->link);
+    client->done = 1;
+    client->replica->sessions--;
+    llm_mutex_unlock(&server->clients_lock);
+    return NULL;
+}
+
+/*
+ * Join the threads of clients that went away
+ * all: also wait for the ones still connected (shutdown)
+ */
+static void reap_clients(server_t *server, int all)
+{
+    server_client_t **link, *client;
+    int done;
+
+    link = &server->clients;
+    while (*link) {
+        client = *link;
+        llm_mutex_lock(&server->clients_lock);
+        done = client->done;
+        if (all && !done && client->link.fd >= 0) {
+            shutdown(client->link.fd, SHUT_RDWR);
+        }
+        llm_mutex_unlock(&server->clients_lock);
+
+        if (!done && !all) {
+            link = &client->next;
+            continue;
+        }
+        llm_thread_join(client->thread);
+        *link = client->next;
+        free(client->dictionary);
+        free(client->session);
+        free(client);
+    }
+}
+
+/*
+ * Load an instance per NUMA node with numa = replicas, else the one
+ * Returns 0 if one failed, those loaded are freed by replicas_free.
+ */
+static int replicas_load(server_t *server, nagi_llm_backend_t backend, const char *model_path,
+                         nagi_llm_config_t *config)
+{
+    server_replica_t *replica;
+    int nodes[LLM_NUMA_MAX_NODES];
+    int i, n = 1;
+
+    if (config->numa == NAGI_LLM_NUMA_REPLICAS) {
+        n = llm_numa_nodes(nodes);
+        if (n > 1) {
+            /* Read in for each node, a shared mapping would leave them all on one */
+            config->use_mmap = 0;
+        }
+    }
+
+    for (i = 0; i < n; i++) {
+        replica = &server->replica[i];
+        replica->node = -1;
+        if (n > 1) {
+            if (!llm_numa_bind(nodes[i])) {
+                fprintf(stderr, "LLM Server: Can't bind to NUMA node %d, replica placed by the kernel\n",
+                        nodes[i]);
+            } else {
+                replica->node = nodes[i];
+            }
+        }
+
+        replica->llm = nagi_llm_create(backend);
+        if (!replica->llm) {
+            fprintf(stderr, "LLM Server: Backend not compiled in\n");
+            break;
+        }
+        llm_mutex_init(&replica->lock);
+        server->n_replicas++;
+        if (!nagi_llm_init(replica->llm, model_path, config)) {
+            fprintf(stderr, "LLM Server: Model failed to load\n");
+            break;
+        }
+        if (n > 1) {
+            printf("LLM Server: Replica %d loaded on NUMA node %d\n", i, nodes[i]);
+        }
+    }
+
+    /* The accepting thread runs anywhere */
+    llm_numa_reset();
+    return i == n;
+}
+
+static void replicas_free(server_t *server)
+{
+    server_replica_t *replica;
+    int i;
+
+    for (i = 0; i < server->n_replicas; i++) {
+        replica = &server->replica[i];
+        nagi_llm_shutdown(replica->llm);
+        nagi_llm_destroy(replica->llm);
+        free(replica->dictionary);
+        llm_mutex_destroy(&replica->lock);
+    }
+    server->n_replicas = 0;
+}
+
+/* The replica with the fewest sessions takes a new one */
+static server_replica_t *replica_pick(server_t *server)
+{
+    server_replica_t *best;
+    int i;
+
+    llm_mutex_lock(&server->clients_lock);
+    best = &server->replica[0];
+    for (i = 1; i < server->n_replicas; i++) {
+        if (server->replica[i].sessions < best->sessions) {
+            best = &server->replica[i];
+        }
+    }
+    best->sessions++;
+    llm_mutex_unlock(&server->clients_lock);
+    return best;
+}
+
+/* The sessions on each replica, then the telemetry of them all */
+static char *metrics_text(server_t *server, size_t *len)
+{
+    nagi_llm_t *llms[LLM_NUMA_MAX_NODES];
+    char *text;
+    size_t size, head;
+    int i;
+
+    size = 128 + (size_t)server->n_replicas * 48;
+    for (i = 0; i < server->n_replicas; i++) {
+        llms[i] = server->replica[i].llm;
+    }
+    size += nagi_llm_metrics(llms, server->n_replicas, NULL, 0) + 1;
+    text = (char *)malloc(size);
+    if (!text) return NULL;
+
+    head = snprintf(text, size, "# HELP nagi_llm_server_sessions Games connected\n"
+                                "# TYPE nagi_llm_server_sessions gauge\n");
+    llm_mutex_lock(&server->clients_lock);
+    for (i = 0; i < server->n_replicas; i++) {
+        head += snprintf(text + head, size - head, "nagi_llm_server_sessions{instance=\"%d\"} %d\n",
+                         i, server->replica[i].sessions);
+    }
+    llm_mutex_unlock(&server->clients_lock);
+
+    *len = head + nagi_llm_metrics(llms, server->n_replicas, text + head, size - head);
+    if (*len >= size) *len = size - 1;
+    return text;
+}
+
+/* Answer scrapes one at a time until metrics_stop */
+static void *metrics_main(void *arg)
+{
+    server_t *server = (server_t *)arg;
+    struct pollfd pfd;
+    struct timeval timeout = { 2, 0 };
+    char request[1024], header[160];
+    char *text;
+    size_t len;
+    ssize_t got;
+    int fd;
+
+    pfd.fd = server->metrics_fd;
+    pfd.events = POLLIN;
+    while (!server->metrics_quit) {
+        if (poll(&pfd, 1, METRICS_POLL_MS) <= 0) continue;
+        fd = accept(server->metrics_fd, NULL, NULL);
+        if (fd < 0) continue;
+        /* A scraper that says nothing doesn't hold up the next */
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        got = recv(fd, request, sizeof(request) - 1, 0);
+        text = got > 0 ? metrics_text(server, &len) : NULL;
+        if (text) {
+            snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                             "Content-Length: %zu\r\nConnection: close\r\n\r\n", len);
+            if (send(fd, header, strlen(header), MSG_NOSIGNAL) > 0) {
+                send(fd, text, len, MSG_NOSIGNAL);
+            }
+            free(text);
+        }
+        close(fd);
+    }
+    return NULL;
+}
+
+static void metrics_start(server_t *server, int port)
+{
+    struct sockaddr_in addr;
+    int on = 1;
+
+    server->metrics_fd = -1;
+    if (port <= 0) return;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons((uint16_t)port);
+    server->metrics_fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (server->metrics_fd < 0) return;
+    setsockopt(server->metrics_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    if (bind(server->metrics_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 ||
+        listen(server->metrics_fd, 4) != 0 ||
+        !llm_thread_create(&server->metrics_thread, metrics_main, server)) {
+        fprintf(stderr, "LLM Server: Cannot serve metrics on port %d: %s\n", port, strerror(errno));
+        close(server->metrics_fd);
+        server->metrics_fd = -1;
+        return;
+    }
+    printf("LLM Server: Metrics on http://127.0.0.1:%d/metrics\n", port);
+}
+
+static void metrics_stop(server_t *server)
+{
+    if (server->metrics_fd < 0) return;
+    server->metrics_quit = 1;
+    llm_thread_join(server->metrics_thread);
+    close(server->metrics_fd);
+    server->metrics_fd = -1;
+}
+
+/*
+ * Stop taking connections and give the games connected time to move
+ * their sessions to the other nodes
+ */
+static void drain(server_t *server)
+{
+    int waited;
+
+    printf("LLM Server: Draining, sessions move to the other nodes\n");
+    for (waited = 0; waited < SERVER_DRAIN_MS && !server_quit; waited += 100) {
+        reap_clients(server, 0);
+        if (!server->clients) break;
+        usleep(100 * 1000);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    server_t server;
+    nagi_llm_config_t config;
+    nagi_llm_backend_t backend;
+    const char *model_path = getenv("NAGI_LLM_MODEL_PATH");
+    const char *config_path = "llm_config.ini";
+    const char *socket_path = NULL;
+    struct sigaction sa;
+    server_client_t *client;
+    int listen_fd, fd, i;
+
+#if defined(NAGI_LLM_HAS_LLAMACPP)
+    backend = NAGI_LLM_BACKEND_LLAMACPP;
+#else
+    backend = NAGI_LLM_BACKEND_BITNET;
+#endif
+
+    for (i = 1; i < argc; i++) {
+        const char *value = (i + 1 < argc) ? argv[i + 1] : NULL;
+
+        if (argv[i][0] != '-' || argv[i][1] == '\0' || argv[i][2] != '\0' || !value) {
+            usage(argv[0]);
+            return 1;
+        }
+        i++;
+        switch (argv[i - 1][1]) {
+            case 'm': model_path = value; break;
+            case 'c': config_path = value; break;
+            case 's': socket_path = value; break;
+            case 'b':
+                if (strcmp(value, "llamacpp") == 0) {
+                    backend = NAGI_LLM_BACKEND_LLAMACPP;
+                } else if (strcmp(value, "bitnet") == 0) {
+                    backend = NAGI_LLM_BACKEND_BITNET;
+                } else {
+                    usage(argv[0]);
+                    return 1;
+                }
+                break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
+    if (!nagi_llm_load_config(&config, backend, config_path)) {
+        return 1;
+    }
+    if (!socket_path) {
+        socket_path = config.server_socket;
+    }
+
+    memset(&server, 0, sizeof(server));
+    llm_mutex_init(&server.clients_lock);
+    if (!replicas_load(&server, backend, model_path, &config)) {
+        replicas_free(&server);
+        llm_mutex_destroy(&server.clients_lock);
+        return 1;
+    }
+
+    listen_fd = llm_server_listen(socket_path);
+    if (listen_fd < 0) {
+        replicas_free(&server);
+        llm_mutex_destroy(&server.clients_lock);
+        return 1;
+    }
+
+    /* No SA_RESTART, so accept() returns on a signal */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sigaction(SIGUSR1, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    printf("LLM Server: Serving %s on %s\n", model_path ? model_path : "", socket_path);
+    metrics_start(&server, config.server_metrics_port);
+
+    while (!server_quit && !server_drain) {
+        fd = accept(listen_fd, NULL, NULL);
+        reap_clients(&server, 0);
+        if (fd < 0) {
+            if (errno != EINTR) {
+                fprintf(stderr, "LLM Server: accept failed: %s\n", strerror(errno));
+            }
+            continue;
+        }
+
+        client = (server_client_t *)calloc(1, sizeof(server_client_t));
+        if (!client) {
+            close(fd);
+            continue;
+        }
+        client->server = &server;
+        client->replica = replica_pick(&server);
+        llm_server_link_init(&client->link, fd, 1);
+        if (!llm_thread_create(&client->thread, client_main, client)) {
+            llm_mutex_lock(&server.clients_lock);
+            client->replica->sessions--;
+            llm_mutex_unlock(&server.clients_lock);
+            close(fd);
+            free(client);
+            continue;
+        }
+        client->next = server.clients;
+        server.clients = client;
+
+        if (config.verbose) {
+            printf("LLM Server: Client %d connected\n", fd);
+        }
+    }
+
+    /* New games go to the next node as soon as the socket is gone */
+    close(listen_fd);
+    unlink(socket_path);
+    if (server_drain) {
+        drain(&server);
+    }
+    printf("LLM Server: Shutting down\n");
+    metrics_stop(&server);
+    reap_clients(&server, 1);
+
+    replicas_free(&server);
+    llm_mutex_destroy(&server.clients_lock);
+    return 0;
+}
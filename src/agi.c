@@ -9,11 +9,31 @@ CONF_BOOL c_nagi_log_debug = 0;
 CONF_BOOL c_nagi_console = 1;
 CONF_BOOL c_nagi_font_benchmark = 0;
 CONF_BOOL c_nagi_crc_print = 0;
+CONF_BOOL c_nagi_crc_cache = 1;
+CONF_BOOL c_nagi_aot = 1;
+CONF_INT c_nagi_rewind = 30;
+CONF_INT c_nagi_cache_budget = 0;
+CONF_BOOL c_nagi_startup_report = 0;
+CONF_STRING c_nagi_startup_trace = 0;
+CONF_INT c_nagi_trace_slow = 0;
+CONF_BOOL c_nagi_turbo = 0;
+CONF_INT c_nagi_turbo_present = 0;
+CONF_INT c_nagi_cpu_budget = 0;
+CONF_STRING c_nagi_priority_main = 0;
+CONF_STRING c_nagi_priority_audio = 0;
+CONF_STRING c_nagi_priority_worker = 0;
+CONF_INT c_nagi_cpu_main = -1;
+CONF_INT c_nagi_cpu_audio = -1;
+CONF_INT c_nagi_metrics_port = 0;
+CONF_STRING c_nagi_metrics_address = 0;
 CONF_STRING c_nagi_dir_list = 0;
 CONF_STRING c_nagi_sort = 0;
 CONF_STRING c_vid_driver = 0;
 CONF_INT c_vid_scale = 2;
 CONF_BOOL c_vid_full_screen = 0;
+CONF_INT c_vid_stream_port = 0;
+CONF_STRING c_vid_capture = 0;
+CONF_STRING c_vid_capture_file = 0;
 CONF_STRING c_vid_renderer = 0;
 CONF_STRING c_vid_pal_16 = 0;
 CONF_STRING c_vid_pal_text = 0;
@@ -22,12 +42,19 @@ CONF_STRING c_vid_pal_cga1 = 0;
 CONF_STRING c_vid_pal_bw = 0;
 CONF_STRING c_vid_fonts_bitmap = 0;
 CONF_STRING c_vid_fonts_vector = 0;
+CONF_BOOL c_vid_hud = 0;
+CONF_STRING c_vid_filter = 0;
+CONF_INT c_vid_window_scale = 1;
 CONF_STRING c_snd_driver = 0;
 CONF_BOOL c_snd_enable = 1;
 CONF_BOOL c_snd_single = 0;
 CONF_INT c_snd_dissolve = 3;
 CONF_BOOL c_snd_read_var = 0;
 CONF_INT c_snd_volume = 0x7FFF;
+CONF_BOOL c_snd_bandlimit = 0;
+CONF_BOOL c_snd_prerender = 0;
+CONF_INT c_snd_rate = 0;
+CONF_INT c_snd_buffer = 0;
 CONF_STRING c_sdl_drv_video = 0;
 CONF_STRING c_sdl_drv_sound = 0;
 
@@ -42,6 +69,7 @@ CONF_STRING c_standard_amiga_v3_default = 0;
 CONF_STRING c_game_version_info = 0;
 CONF_INT c_game_mouse = 0;
 CONF_INT c_game_loop_update = 0;
+CONF_BOOL c_game_follow_path = 0;
 CONF_STRING c_game_id = 0;	// RES TYPE
 CONF_BOOL c_game_object_decrypt = 1;	// RES TYPE
 CONF_BOOL c_game_object_packed = 0;	// RES TYPE
@@ -51,6 +79,7 @@ CONF_INT c_game_dir_type = 1;	// RES TYPE
 
 // pre calc'd
 char c_game_file_id[ID_SIZE+1] = "";// RES TYPE
+u32 c_game_crc = 0;	// the game's files, see standard.c
 VSTRING *c_game_location = 0;
 
 // for use in nagi.ini
@@ -60,11 +89,31 @@ CONF config_nagi[] =
 	{"console", 0, CT_BOOL, .b = {&c_nagi_console, 1} },
 	{"font_benchmark", 0, CT_BOOL, .b = {&c_nagi_font_benchmark, 0} },
 	{"crc_print", 0, CT_BOOL, .b = {&c_nagi_crc_print, 0} },
+	{"crc_cache", 0, CT_BOOL, .b = {&c_nagi_crc_cache, 1} },
+	{"aot", 0, CT_BOOL, .b = {&c_nagi_aot, 1} },
+	{"rewind", 0, CT_INT, .i = {&c_nagi_rewind, 30, 0, 300} },
+	{"cache_budget", 0, CT_INT, .i = {&c_nagi_cache_budget, 0, 0, -1} },
+	{"startup_report", 0, CT_BOOL, .b = {&c_nagi_startup_report, 0} },
+	{"startup_trace", 0, CT_STRING, .s = {&c_nagi_startup_trace, ""} },
+	{"trace_slow", 0, CT_INT, .i = {&c_nagi_trace_slow, 0, 0, -1} },
+	{"turbo", 0, CT_BOOL, .b = {&c_nagi_turbo, 0} },
+	{"turbo_present", 0, CT_INT, .i = {&c_nagi_turbo_present, 0, 0, -1} },
+	{"cpu_budget", 0, CT_INT, .i = {&c_nagi_cpu_budget, 0, 0, -1} },
+	{"priority_main", 0, CT_STRING, .s = {&c_nagi_priority_main, "high"} },
+	{"priority_audio", 0, CT_STRING, .s = {&c_nagi_priority_audio, "sdl"} },
+	{"priority_worker", 0, CT_STRING, .s = {&c_nagi_priority_worker, "low"} },
+	{"cpu_main", 0, CT_INT, .i = {&c_nagi_cpu_main, -1, -1, -1} },
+	{"cpu_audio", 0, CT_INT, .i = {&c_nagi_cpu_audio, -1, -1, -1} },
+	{"metrics_port", 0, CT_INT, .i = {&c_nagi_metrics_port, 0, 0, 65535} },
+	{"metrics_address", 0, CT_STRING, .s = {&c_nagi_metrics_address, "127.0.0.1"} },
 	{"dir_list", 0, CT_STRING, .s = {&c_nagi_dir_list, "."} },
 	{"sort", 0, CT_STRING, .s = {&c_nagi_sort, "alpha"} },
 	{"driver", "vid", CT_STRING, .s = {&c_vid_driver, "sdl"} },
 	{"scale", 0, CT_INT, .i = {&c_vid_scale, 2, 1, -1} },
 	{"full_screen", 0, CT_BOOL, .b = {&c_vid_full_screen, 0} },
+	{"stream_port", 0, CT_INT, .i = {&c_vid_stream_port, 0, 0, 65535} },
+	{"capture", 0, CT_STRING, .s = {&c_vid_capture, "none"} },
+	{"capture_file", 0, CT_STRING, .s = {&c_vid_capture_file, "nagi_capture"} },
 	{"renderer", 0, CT_STRING, .s = {&c_vid_renderer, "ega"} },
 	{"pal_16", 0, CT_STRING, .s = {&c_vid_pal_16, "pal_16.pal"} },
 	{"pal_text", 0, CT_STRING, .s = {&c_vid_pal_text, "pal_text.pal"} },
@@ -73,12 +122,19 @@ CONF config_nagi[] =
 	{"pal_bw", 0, CT_STRING, .s = {&c_vid_pal_bw, "pal_bw.pal"} },
 	{"fonts_bitmap", 0, CT_STRING, .s = {&c_vid_fonts_bitmap, "font_4x8.nbf;font_8x8.nbf;font_16x16.nbf"} },
 	{"fonts_vector", 0, CT_STRING, .s = {&c_vid_fonts_vector, "none.nvf"} },
+	{"hud", 0, CT_BOOL, .b = {&c_vid_hud, 0} },
+	{"filter", 0, CT_STRING, .s = {&c_vid_filter, "none"} },
+	{"window_scale", 0, CT_INT, .i = {&c_vid_window_scale, 1, 1, 16} },
 	{"driver", "snd", CT_STRING, .s = {&c_snd_driver, "sdl"} },
 	{"enable", 0, CT_BOOL, .b = {&c_snd_enable, 1} },
 	{"single", 0, CT_BOOL, .b = {&c_snd_single, 0} },
 	{"dissolve", 0, CT_INT, .i = {&c_snd_dissolve, 3, 0, 3} },
 	{"read_var", 0, CT_BOOL, .b = {&c_snd_read_var, 0} },
 	{"volume", 0, CT_INT, .i = {&c_snd_volume, 0x7FFF, 0, 0x7FFF} },
+	{"bandlimit", 0, CT_BOOL, .b = {&c_snd_bandlimit, 0} },
+	{"prerender", 0, CT_BOOL, .b = {&c_snd_prerender, 0} },
+	{"rate", 0, CT_INT, .i = {&c_snd_rate, 0, 0, 192000} },
+	{"buffer", 0, CT_INT, .i = {&c_snd_buffer, 0, 0, 8192} },
 	{"drv_video", "sdl", CT_STRING, .s = {&c_sdl_drv_video, ""} },
 	{"drv_sound", 0, CT_STRING, .s = {&c_sdl_drv_sound, ""} },
 	{.key = 0}
@@ -103,6 +159,7 @@ CONF config_game[] =
 	{"version_info", 0, CT_STRING, .s = {&c_game_version_info, 0} },
 	{"mouse", 0, CT_INT, .i = {&c_game_mouse, 0, 0, 20} },
 	{"loop_update", 0, CT_INT, .i = {&c_game_loop_update, 0, 0, 4} },
+	{"follow_path", 0, CT_BOOL, .b = {&c_game_follow_path, 0} },
 	
 	{"id", 0, CT_STRING, .s = {&c_game_id, 0} },
 	{"object_decrypt", 0, CT_BOOL, .b = {&c_game_object_decrypt, 1} },
@@ -69,9 +69,11 @@ typedef struct list_struct STACK;
 typedef uint8_t		u8;
 typedef uint16_t	u16;
 typedef uint32_t	u32;
+typedef uint64_t	u64;
 typedef int8_t		s8;
 typedef int16_t		s16;
 typedef int32_t		s32;
+typedef int64_t		s64;
 
 #define V00_ROOM0		0
 #define V01_OLDROOM		1
@@ -318,17 +320,20 @@ struct blit_struct
 	s16 x_size;			// A-B
 	s16 y_size;			// C-D
 	u8 *buffer;			// E-F
+	u16 buffer_size;		// allocated size of buffer
 };
 
 typedef struct blit_struct BLIT;
 
+// the save_ fields are only filled in for save games and snapshots, they
+// keep the old layout.  while the game runs those live in obj_hot below
 struct view_struct
 {
-	u8 step_time;		// 0
-	u8 step_count;		// 1	// counts down until the next step
+	u8 save_step_time;		// 0
+	u8 save_step_count;		// 1	// counts down until the next step
 	u8 num;			// 2
-	s16 x;			// 3-4
-	s16 y;			// 5-6
+	s16 save_x;			// 3-4
+	s16 save_y;			// 5-6
 	
 	u8 view_cur;		// 7
 	u8 *view_data;		// 8-9
@@ -349,14 +354,14 @@ struct view_struct
 	s16 y_prev;		// 18-19
 	s16 x_size;			// 1A-1B
 	s16 y_size;			// 1C-1D
-	u8 step_size;		// 1E
-	u8 cycle_time; 		// 1F
-	u8 cycle_count;		// 20	// counts down till next cycle
-	u8 direction;		// 21
+	u8 save_step_size;		// 1E
+	u8 save_cycle_time; 		// 1F
+	u8 save_cycle_count;		// 20	// counts down till next cycle
+	u8 save_direction;		// 21
 	u8 motion;			// 22
 	u8 cycle;			// 23
 	u8 priority;			// 24
-	u16 flags;			// 25-26
+	u16 save_flags;			// 25-26
 	
 	// 27-2A represent a union
 	//u8 unknown27;		// 27	// these variables depend on the motion
@@ -390,6 +395,38 @@ struct view_struct
 
 typedef struct view_struct VIEW;
 
+// the fields objtable_update() and the motion go through every cycle, one
+// array each so a pass over the table doesn't pull in the rest of every
+// VIEW.  indexed by where the object is in objtable, with a couple of
+// slots past objtable_tail for the loose objects (obj_loose())
+struct obj_hot_struct
+{
+	u16 *flags;
+	s16 *x;
+	s16 *y;
+	u8 *step_time;
+	u8 *step_count;	// counts down until the next step
+	u8 *step_size;
+	u8 *cycle_time;
+	u8 *cycle_count;	// counts down till next cycle
+	u8 *direction;
+};
+typedef struct obj_hot_struct OBJ_HOT;
+
+extern VIEW *objtable;
+extern OBJ_HOT obj_hot;
+
+// a VIEW's hot fields, these work as v->field did
+#define OBJ_FLAGS(v) (obj_hot.flags[(v) - objtable])
+#define OBJ_X(v) (obj_hot.x[(v) - objtable])
+#define OBJ_Y(v) (obj_hot.y[(v) - objtable])
+#define OBJ_STEP_TIME(v) (obj_hot.step_time[(v) - objtable])
+#define OBJ_STEP_COUNT(v) (obj_hot.step_count[(v) - objtable])
+#define OBJ_STEP_SIZE(v) (obj_hot.step_size[(v) - objtable])
+#define OBJ_CYCLE_TIME(v) (obj_hot.cycle_time[(v) - objtable])
+#define OBJ_CYCLE_COUNT(v) (obj_hot.cycle_count[(v) - objtable])
+#define OBJ_DIRECTION(v) (obj_hot.direction[(v) - objtable])
+
 
 struct vstring_struct
 {
@@ -453,11 +490,31 @@ extern CONF_BOOL c_nagi_log_debug;
 extern CONF_BOOL c_nagi_console;
 extern CONF_BOOL c_nagi_font_benchmark;
 extern CONF_BOOL c_nagi_crc_print;
+extern CONF_BOOL c_nagi_crc_cache;
+extern CONF_BOOL c_nagi_aot;
+extern CONF_INT c_nagi_rewind;
+extern CONF_INT c_nagi_cache_budget;
+extern CONF_BOOL c_nagi_startup_report;
+extern CONF_STRING c_nagi_startup_trace;
+extern CONF_INT c_nagi_trace_slow;
+extern CONF_BOOL c_nagi_turbo;
+extern CONF_INT c_nagi_turbo_present;
+extern CONF_INT c_nagi_cpu_budget;
+extern CONF_STRING c_nagi_priority_main;
+extern CONF_STRING c_nagi_priority_audio;
+extern CONF_STRING c_nagi_priority_worker;
+extern CONF_INT c_nagi_cpu_main;
+extern CONF_INT c_nagi_cpu_audio;
+extern CONF_INT c_nagi_metrics_port;
+extern CONF_STRING c_nagi_metrics_address;
 extern CONF_STRING c_nagi_dir_list;
 extern CONF_STRING c_nagi_sort;
 extern CONF_STRING c_vid_driver;
 extern CONF_INT c_vid_scale;
 extern CONF_BOOL c_vid_full_screen;
+extern CONF_INT c_vid_stream_port;
+extern CONF_STRING c_vid_capture;
+extern CONF_STRING c_vid_capture_file;
 extern CONF_STRING c_vid_renderer;
 extern CONF_STRING c_vid_pal_16;
 extern CONF_STRING c_vid_pal_text;
@@ -466,12 +523,19 @@ extern CONF_STRING c_vid_pal_cga1;
 extern CONF_STRING c_vid_pal_bw;
 extern CONF_STRING c_vid_fonts_bitmap;
 extern CONF_STRING c_vid_fonts_vector;
+extern CONF_BOOL c_vid_hud;
+extern CONF_STRING c_vid_filter;
+extern CONF_INT c_vid_window_scale;
 extern CONF_STRING c_snd_driver;
 extern CONF_BOOL c_snd_enable;
 extern CONF_BOOL c_snd_single;
 extern CONF_INT c_snd_dissolve;
 extern CONF_BOOL c_snd_read_var;
 extern CONF_INT c_snd_volume;
+extern CONF_BOOL c_snd_bandlimit;
+extern CONF_BOOL c_snd_prerender;
+extern CONF_INT c_snd_rate;
+extern CONF_INT c_snd_buffer;
 extern CONF_STRING c_sdl_drv_video;
 extern CONF_STRING c_sdl_drv_sound;
 
@@ -486,6 +550,7 @@ extern CONF_STRING c_standard_amiga_v3_default;
 extern CONF_STRING c_game_version_info;
 extern CONF_INT c_game_mouse;
 extern CONF_INT c_game_loop_update;
+extern CONF_BOOL c_game_follow_path;
 extern CONF_STRING c_game_id;
 extern CONF_BOOL c_game_object_decrypt;
 extern CONF_BOOL c_game_object_packed;
@@ -493,6 +558,7 @@ extern CONF_BOOL c_game_compression;
 extern CONF_INT c_game_dir_type;
 
 extern char c_game_file_id[ID_SIZE+1];
+extern u32 c_game_crc;
 extern VSTRING *c_game_location;
 
 extern CONF config_nagi[];
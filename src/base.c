@@ -28,11 +28,11 @@
 
 u8 *cmd_pause(u8 *c)
 {
-	clock_state = 1;
+	clock_set_state(1);
 	events_clear();
 	sound_stop();
 	message_box("      Game paused.\nPress Enter to continue." );
-	clock_state = 0;
+	clock_set_state(0);
 
 	return(c);
 }
@@ -2,6 +2,8 @@
 
 */
 
+#define MEM_TAG MEM_TEXT
+
 /* BASE headers	---	---	---	---	---	---	--- */
 #include "agi.h"
 
@@ -52,7 +54,7 @@ void config_load(CONF *config, INI *ini)
 			
 			case CT_STRING:
 				if ((key_data != 0) && (strcmp(key_data, conf_ptr->s.def)) )
-					*(conf_ptr->s.ptr) = strdup(key_data);
+					*(conf_ptr->s.ptr) = a_strdup(key_data);
 				else
 					*conf_ptr->s.ptr = conf_ptr->s.def;
 				break;
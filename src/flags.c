@@ -20,6 +20,7 @@ _ClearFlags                      cseg     00007463 0000000E
 
 #include "agi.h"
 #include "flags.h"
+#include "logic/llm.h"
 
 u8 *cmd_set(u8 *c)
 {
@@ -78,18 +79,21 @@ then or, xor 'n all that is used to set, reset, 'n stuff
 void flag_set(u8 flag_num)
 {
 	*(state.flag+(flag_num>>3)) |= 0x80>>(flag_num % 8);
+	LLM_FLAG_WRITE(flag_num);
 	//state.flag[flag_num] = 1;
 }
 
 void flag_reset(u8 flag_num)
 {
 	*(state.flag+(flag_num>>3)) &= (0x80>>(flag_num % 8))^0xFF;
+	LLM_FLAG_WRITE(flag_num);
 	//state.flag[flag_num] = 0;
 }
 
 void flag_toggle(u8 flag_num)
 {
 	*(state.flag+(flag_num>>3)) ^= 0x80>>(flag_num % 8);
+	LLM_FLAG_WRITE(flag_num);
 	//state.flag[flag_num] = state.flag[flag_num] ^ 1;
 }
 
@@ -30,6 +30,8 @@ _RoomInit                        cseg     000012DE 00000015
 #include "sys/gfx.h"
 #include "sys/glob_sys.h"
 #include "picture/pic_res.h"
+#include "picture/pic_cache.h"
+#include "picture/pic_prerender.h"
 #include "game_id.h"
 #include "flags.h"
 #include "decrypt.h"
@@ -51,9 +53,13 @@ _RoomInit                        cseg     000012DE 00000015
 #include "ui/agi_text.h"
 // input_redraw
 #include "ui/cmd_input.h"
+#include "ui/msg_pretrans.h"
+#include "logic/logic_aot.h"
 // byte-order support
 #include "sys/endian.h"
 #include "objects.h"
+#include "state_snap.h"
+#include "state_rewind.h"
 #include "sys/time.h"
 
 #include "logic/cmd_table.h"
@@ -63,16 +69,32 @@ _RoomInit                        cseg     000012DE 00000015
 #include "config.h"
 
 #include "sys/sys_dir.h"
+#include "sys/chargen.h"
+#include "version/standard.h"
 #include "sys/agi_file.h"
+#include "sys/game_cache.h"
+#include "sys/memory.h"
 
 #include "sound/sound_gen.h"
+#include "sound/speech.h"
+#include "sound/voice.h"
 #include "base.h"
+#include "sys/mem_budget.h"
 #include "sys/mem_wrap.h"
+#include "sys/metrics.h"
+#include "sys/profile.h"
+#include "sys/replay.h"
+#include "sys/startup.h"
+#include "sys/thread_attr.h"
+#include "sys/workers.h"
+#include "sys/zip_mount.h"
 
 #include "log.h"
 
 #ifdef NAGI_ENABLE_LLM
 #include "llm_global.h"
+#include "logic/llm.h"
+#include "logic/said_index.h"
 #endif
 
 
@@ -92,12 +114,66 @@ void room_init(void);
 #ifdef NAGI_ENABLE_LLM
 /* Global LLM instance and configuration */
 nagi_llm_t *g_llm = NULL;
+nagi_llm_session_t *g_llm_session = NULL;
 nagi_llm_config_t g_llm_config = {0};
+static u64 llm_load_start = 0;
+
+// per-game llm file (translation cache, extraction memo), kept in the nagi directory
+static void llm_game_path(char *path, int size, const char *prefix)
+{
+	const char *id;
+	
+	id = c_game_id;
+	if ((id == 0) || (id[0] == 0))
+		id = c_game_file_id;
+	if (id[0] == 0)
+		id = "game";
+	snprintf(path, size, "%s_%s.bin", prefix, id);
+}
+
+// runs on the llm loader thread, the game keeps the classic parser until then
+static void llm_on_ready(nagi_llm_t *llm, int ok, void *userdata)
+{
+	// the timeline keeps the name
+	static char name[48];
+
+	(void)userdata;
+	if (ok)
+		fprintf(stderr, "LLM initialized with model: %s\n", llm->config.model_path);
+	else
+		fprintf(stderr, "LLM initialization failed for model: %s\n", llm->config.model_path);
+
+	snprintf(name, sizeof(name), "llm model load");
+	if (nagi_llm_huge_pages_mb(llm) > 0)
+		snprintf(name, sizeof(name), "llm model load (%d MB huge pages)", nagi_llm_huge_pages_mb(llm));
+	startup_async_end(name, llm_load_start);
+}
+
+// runs on the llm worker thread when a translation streams in or ends
+static void llm_on_wake(void *userdata)
+{
+	(void)userdata;
+	event_wake();
+}
+
+// once a cycle.  the file is only looked at once a second
+void llm_config_poll(void)
+{
+	if ( (g_llm != 0) && nagi_llm_poll_config(g_llm) )
+		g_llm_config = g_llm->config;
+}
 #endif
 
 
 /* CODE	---	---	---	---	---	---	---	--- */
 
+// sndgen_init() on the startup task, nothing else touches sound until it's waited for
+static int sndgen_task(void *data)
+{
+	(void)data;
+	sndgen_init();
+	return 0;
+}
 
 void nagi_init()
 {	
@@ -105,6 +181,7 @@ void nagi_init()
 	u8 env_value[50];
 #endif
 	INI *ini_nagi;
+	u64 t;
 
 	memset( &state, 0, sizeof(AGI_STATE) );
 	state.word_13f = 0x0F;
@@ -118,10 +195,20 @@ void nagi_init()
 	//text_mode = 0;
 
 	// read nagi.ini
+	t = startup_now();
 	dir_preset_change(DIR_PRESET_NAGI);
 	ini_nagi = ini_open("nagi.ini");
 	config_load(config_nagi, ini_nagi);
 	ini_close(ini_nagi);
+	startup_phase("nagi.ini", t);
+
+	// the interpreter goes ahead of the llm's threads
+	thread_attr_apply(THREAD_MAIN);
+
+	// the game scan and the font only need the config, the rest of
+	// startup goes on while they run
+	standard_scan_start();
+	ch_font_start();
 
 	// for the console window thingy
 #ifdef  _WIN32
@@ -170,14 +257,31 @@ void nagi_init()
 	
 #endif
 
+	// nothing to see or hear, it's just running the game
+	if (replay_headless)
+	{
+		SDL_SetHint(SDL_HINT_VIDEO_DRIVER, "dummy");
+		SDL_SetHint(SDL_HINT_AUDIO_DRIVER, "dummy");
+	}
+	// sounds take no time so a replay does what the recording did
+	if (replay_mode != REPLAY_OFF)
+		c_snd_enable = 0;
+
+	t = startup_now();
 	if ( !SDL_Init(SDL_INIT_VIDEO|SDL_INIT_AUDIO) )
 	{
 		printf("Unable to init SDL: %s\n", SDL_GetError());
 		exit(1);
 	}
 	printf("done.\n");
+	startup_phase("SDL_Init", t);
+
+	// the audio device opens while the window is being made
+	startup_task(STARTUP_TASK_AUDIO, sndgen_task, 0);
 	
+	t = startup_now();
 	gfx_init();
+	startup_phase("gfx_init", t);
 	
 	// clear keyboard input
 	//clear_input();
@@ -188,7 +292,14 @@ void nagi_init()
 
 	// call do_clock at 20Hz.
 	clock_init();
-	sndgen_init();
+	if (!startup_task_wait(STARTUP_TASK_AUDIO, 0))
+		sndgen_init();
+	t = startup_now();
+	workers_init();
+	pic_prerender_init();
+	res_prefetch_init();
+	startup_phase("worker threads", t);
+	metrics_open(c_nagi_metrics_port, c_nagi_metrics_address);
 
 	/*
 	input_init();	// inits joystick
@@ -208,7 +319,8 @@ void nagi_init()
 
 #ifdef NAGI_LLM_HAS_CLOUD_API
 	backend = NAGI_LLM_BACKEND_CLOUD;
-#else
+#endif
+#if !defined(NAGI_LLM_HAS_CLOUD_API) || defined(NAGI_LLM_HAS_ROUTER)
 
 #ifdef NAGI_DEFAULT_LLM_MODEL_PATH
 	llm_model_path = NAGI_DEFAULT_LLM_MODEL_PATH;
@@ -217,7 +329,10 @@ void nagi_init()
 #endif
 
 	if (llm_model_path && llm_model_path[0]) {
-#ifdef NAGI_LLM_HAS_LLAMACPP
+#ifdef NAGI_LLM_HAS_ROUTER
+		// Local model first, the cloud takes over when it is slow
+		backend = NAGI_LLM_BACKEND_ROUTER;
+#elif defined(NAGI_LLM_HAS_LLAMACPP)
 		backend = NAGI_LLM_BACKEND_LLAMACPP;
 #elif defined(NAGI_LLM_HAS_BITNET)
 		backend = NAGI_LLM_BACKEND_BITNET;
@@ -229,7 +344,14 @@ void nagi_init()
 	}
 #endif
 
+#ifdef NAGI_LLM_HAS_SERVER
+	// A running nagi-llm-server holds the model for every game on this machine
+	if (getenv("NAGI_LLM_SERVER") && getenv("NAGI_LLM_SERVER")[0])
+		backend = NAGI_LLM_BACKEND_SERVER;
+#endif
+
 	if (backend != NAGI_LLM_BACKEND_UNDEFINED) {
+		t = startup_now();
 		g_llm = nagi_llm_create(backend);
 		
 		if (!g_llm) {
@@ -238,19 +360,61 @@ void nagi_init()
 			int config_loaded = 0;
 			nagi_llm_config_t config;
 
+			/* Game context for the prompts, the LLM worker reads it under its lock.
+			   Only allocated when there's an LLM to read it */
+			g_llm_session = nagi_llm_session_new();
+			nagi_llm_set_session(g_llm, g_llm_session);
+			llm_watch_session(g_llm_session);
+
     			if (nagi_llm_load_config(&config, backend, NULL)) {
 				config_loaded = 1;
+				// decode threads within cpu_budget, the game keeps a core
+				if (workers_llm_threads() > 0)
+				{
+					if ( (config.n_threads <= 0) || (config.n_threads > workers_llm_threads()) )
+						config.n_threads = workers_llm_threads();
+					if ( (config.n_threads_batch <= 0) || (config.n_threads_batch > workers_llm_threads()) )
+						config.n_threads_batch = workers_llm_threads();
+				}
     			}
+
+			/* Verbose output is written by a thread of its own, not the game's */
+			dir_preset_change(DIR_PRESET_NAGI);
+			nagi_llm_log_start((config_loaded && config.log_file[0] != 0) ? config.log_file : NULL);
     
-			/* Initialize with model path and config */
-			if (!nagi_llm_init(g_llm, llm_model_path, config_loaded? &config : NULL)) {
+			/* Waits sleep until the worker has something for them */
+			nagi_llm_set_wake(g_llm, llm_on_wake, NULL);
+
+			startup_phase("llm create", t);
+
+			/* Load the model in the background, LLM features switch on once it's ready */
+			llm_load_start = startup_now();
+			startup_async_begin();
+			if (!nagi_llm_init_async(g_llm, llm_model_path, config_loaded? &config : NULL,
+						llm_on_ready, NULL)) {
+				startup_async_end("llm model load", llm_load_start);
 				fprintf(stderr, "LLM initialization failed for model: %s\n", llm_model_path);
 				nagi_llm_destroy(g_llm);
 				g_llm = NULL;
+				llm_watch_session(0);
+				nagi_llm_session_free(g_llm_session);
+				g_llm_session = NULL;
 			} else {
-				fprintf(stderr, "LLM initialized with model: %s\n", llm_model_path);
+				fprintf(stderr, "LLM loading model: %s\n", llm_model_path ? llm_model_path : "");
 				/* Copy configuration from instance to global (for mode checking in other files) */
 				g_llm_config = g_llm->config;
+				/* Tone and sampling can be tuned in llm_config.ini while the game runs */
+				if (dir_preset_get(DIR_PRESET_NAGI) != 0)
+				{
+					char config_path[NAGI_LLM_MAX_MODEL_PATH];
+					snprintf(config_path, sizeof(config_path), "%s/llm_config.ini", dir_preset_get(DIR_PRESET_NAGI));
+					nagi_llm_watch_config(g_llm, config_path);
+				}
+				/* Translated messages can be spoken as they're generated */
+				speech_init();
+				// and commands spoken instead of typed
+				voice_init();
+				startup_phase("llm init", llm_load_start);
 			}
 		}
 	} else {
@@ -261,6 +425,8 @@ void nagi_init()
 
 void agi_init()
 {
+	u64 t;
+
 	// initialise any function changes from the norm 
 	// quit 0-1 param
 	
@@ -275,10 +441,20 @@ void agi_init()
 	
 	/* load directories for the various resources */
 	/* logics, pictures, views, sound */
+	t = startup_now();
 	dir_load();
+	startup_phase("dir_load", t);
+	t = startup_now();
+	pack_load();
+	startup_phase("pack_load", t);
+	gcache_open();
 	
+	t = startup_now();
 	dir_preset_change(DIR_PRESET_GAME);
 	words_tok_data = file_load("words.tok", 0);
+	if (words_tok_data != 0)
+		parse_dict_init(words_tok_data, file_buf_size);
+	startup_phase("words.tok", t);
 
 #ifdef NAGI_ENABLE_LLM
 	/* Pass dictionary to LLM backend if initialized */
@@ -291,19 +467,74 @@ void agi_init()
 			fprintf(stderr, "Warning: Failed to pass dictionary to LLM backend\n");
 		}
 	}
+	
+	// reuse translations and extractions from previous sessions of this game
+	if (g_llm)
+	{
+		char cache_path[64];
+		t = startup_now();
+		// the fleet's shared cache knows the game by its files
+		if (c_game_crc != 0)
+		{
+			char game_key[16];
+			snprintf(game_key, sizeof(game_key), "%08X", (unsigned int)c_game_crc);
+			nagi_llm_set_game_key(g_llm, game_key);
+		}
+		else
+			nagi_llm_set_game_key(g_llm, ((c_game_id != 0) && (c_game_id[0] != 0)) ? c_game_id : c_game_file_id);
+		dir_preset_change(DIR_PRESET_NAGI);
+		llm_game_path(cache_path, sizeof(cache_path), "llm_cache");
+		nagi_llm_cache_load(g_llm, cache_path);
+		llm_game_path(cache_path, sizeof(cache_path), "llm_memo");
+		nagi_llm_memo_load(g_llm, cache_path);
+		if (g_llm_config.match_cache_persist)
+		{
+			llm_game_path(cache_path, sizeof(cache_path), "llm_match");
+			nagi_llm_match_cache_load(g_llm, cache_path);
+		}
+		// an adapter fine-tuned on this game's vocabulary, same model
+		if (g_llm_config.lora_dir[0] != 0)
+			nagi_llm_set_game_adapter(g_llm, ((c_game_id != 0) && (c_game_id[0] != 0)) ? c_game_id : c_game_file_id);
+		dir_preset_change(DIR_PRESET_GAME);
+		startup_phase("llm caches", t);
+	}
+
+	// said() candidates for semantic matching, known before the first input
+	if (g_llm)
+	{
+		t = startup_now();
+		said_index_build();
+		startup_phase("said_index_build", t);
+	}
 #endif
 
+	t = startup_now();
+	pretrans_load();
+	startup_phase("pretrans_load", t);
+
+	t = startup_now();
+	aot_load();
+	startup_phase("aot_load", t);
+
 	logic_list_init();
 	view_list_init();
 	sound_list_init();
 	pic_list_init();
+	pic_cache_init();
+	mem_budget_init();
 
-	game_init();	
+	t = startup_now();
+	game_init();
+	state_restart_take();
+	startup_phase("game_init", t);
 	
+	t = startup_now();
 	logic_load_2(0);
+	startup_phase("logic 0", t);
 	//_SetMemRm0();	// pointer to data AFTER loaded logic 0
 
 	flag_set(F09_SOUND);	// turn sound on
+	state_rewind_init();
 }
 
 void game_init(void)
@@ -323,7 +554,7 @@ void game_init(void)
 	state.var[V20_COMPUTER] = computer_type;
 	state.var[V26_MONITORTYPE] = display_type;
 	state.var[V24_INPUTLEN] = 0x29;
-	state.var[V08_FREEMEM] = 10;
+	update_var8();
 	
 	flag_set(F05_NEWROOM);			// first time in room.
 
@@ -346,6 +577,9 @@ void room_init(void)
 	view_list_new_room();
 	sound_list_new_room();
 	pic_list_new_room();
+	res_prefetch_flush();
+	room_clear();
+	state_rewind_room();
 }
 
 
@@ -371,14 +605,41 @@ void agi_shutdown(void)
 	
 	//pic_list_free();
 	view_list_free();
+	pic_cache_free();
 	//logic_list_free();
 	//sound_list_free();
 	
+#ifdef NAGI_ENABLE_LLM
+	// keep translations and extractions for the next session
+	if (g_llm)
+	{
+		char cache_path[64];
+		dir_preset_change(DIR_PRESET_NAGI);
+		llm_game_path(cache_path, sizeof(cache_path), "llm_cache");
+		nagi_llm_cache_save(g_llm, cache_path);
+		llm_game_path(cache_path, sizeof(cache_path), "llm_memo");
+		nagi_llm_memo_save(g_llm, cache_path);
+		if (g_llm_config.match_cache_persist)
+		{
+			llm_game_path(cache_path, sizeof(cache_path), "llm_match");
+			nagi_llm_match_cache_save(g_llm, cache_path);
+		}
+	}
+	said_index_free();
+#endif
+	
+	pretrans_unload();
+	aot_unload();
+	
 	// words.tok free
+	parse_dict_free();
 	a_free(words_tok_data);
 	words_tok_data = 0;
 	
 	// dir_load free
+	pack_unload();
+	gcache_close();
+	res_cache_clear();
 	dir_unload();
 	
 	// mouse shutdown
@@ -389,15 +650,29 @@ void agi_shutdown(void)
 
 void nagi_shutdown(void)
 {
+	profile_dump();
+	replay_close();
+	state_snap_denit();
+	state_rewind_denit();
 	printf("nagi_shutdown: lzw_shutdown...\n"); fflush(stdout);
 	lzw_shutdown();
 
+#ifdef NAGI_ENABLE_LLM
+	voice_denit();
+	speech_denit();
+#endif
 	//sound_shutdown
 	printf("nagi_shutdown: sndgen_shutdown...\n"); fflush(stdout);
 	sndgen_shutdown();
 	// clock_shutdown
 	printf("nagi_shutdown: clock_denit...\n"); fflush(stdout);
 	clock_denit();
+	metrics_close();
+	workers_denit();
+	pic_prerender_denit();
+	res_prefetch_denit();
+	// the vols point into it until the worker's gone
+	zip_unmount();
 
 	// events_shutdown
 	// TODO during events rewrite
@@ -409,11 +684,23 @@ void nagi_shutdown(void)
 #ifdef NAGI_ENABLE_LLM
 	/* Shutdown LLM cleanly */
 	if (g_llm) {
+		if (g_llm_config.stats_file[0] != 0)
+		{
+			dir_preset_change(DIR_PRESET_NAGI);
+			nagi_llm_stats_save(g_llm, g_llm_config.stats_file);
+		}
 		nagi_llm_shutdown(g_llm);
 		nagi_llm_destroy(g_llm);
 		g_llm = NULL;
+		llm_watch_session(0);
+		nagi_llm_session_free(g_llm_session);
+		g_llm_session = NULL;
 	}
+	nagi_llm_log_stop();
 #endif
+
+	// what's left held here is the room's resources, the caches and leaks
+	mem_report();
 	
 	printf("nagi_shutdown: SDL_Quit...\n"); fflush(stdout);
 	SDL_Quit();
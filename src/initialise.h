@@ -17,4 +17,9 @@ extern void room_init(void);
 extern void agi_shutdown(void);
 extern void nagi_shutdown(void);
 
+#ifdef NAGI_ENABLE_LLM
+// apply llm_config.ini edits made while the game runs
+extern void llm_config_poll(void);
+#endif
+
 #endif /* NAGI_INITIALISE_H */
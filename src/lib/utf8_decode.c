@@ -38,7 +38,7 @@ static int  the_index = 0;
 static int  the_length = 0;
 static int  the_char = 0;
 static int  the_byte = 0;
-static char* the_input;
+static const char* the_input;
 
 static int get() {
     if (the_index >= the_length) return UTF8_END;
@@ -52,7 +52,7 @@ static int cont() {
     return ((c & 0xC0) == 0x80) ? (c & 0x3F) : UTF8_ERROR;
 }
 
-void utf8_decode_init(char p[], int length) {
+void utf8_decode_init(const char p[], int length) {
     the_index = 0;
     the_input = p;
     the_length = length;
@@ -17,7 +17,7 @@ uint32_t utf8_decode(uint32_t* state, uint32_t* codep, uint32_t byte);
 /* Legacy API for compatibility */
 extern int  utf8_decode_at_byte(void);
 extern int  utf8_decode_at_character(void);
-extern void utf8_decode_init(char p[], int length);
+extern void utf8_decode_init(const char p[], int length);
 extern int  utf8_decode_next(void);
 
 #endif
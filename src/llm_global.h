@@ -19,6 +19,9 @@ extern "C" {
 /* Global LLM instance */
 extern nagi_llm_t *g_llm;
 
+/* The game's context for the LLM, NULL without an LLM */
+extern nagi_llm_session_t *g_llm_session;
+
 /* Global LLM configuration - exposed for mode checking in parse.c and logic_eval.c */
 extern nagi_llm_config_t g_llm_config;
 
@@ -22,6 +22,7 @@ CmdDivV                          cseg     0000739E 0000001F
 
 #include "../agi.h"
 #include "arithmetic.h"
+#include "llm.h"
 
 
 // command increment
@@ -33,6 +34,7 @@ u8 *cmd_increment(u8 *code)
 	a = *code++;
 	if (state.var[a] < 0xFF)
 		state.var[a]++;
+	LLM_VAR_WRITE(a);
 
 	return(code);
 }
@@ -48,6 +50,7 @@ u8 *cmd_decrement(u8 *code)
 	// c = *code++;
 	if (state.var[a] != 0x00)
 		state.var[a]--;
+	LLM_VAR_WRITE(a);
 
 	return(code);
 }
@@ -62,6 +65,7 @@ u8 *cmd_assignn(u8 *code)
 	b = *code++;
 	// c = *code++;
 	state.var[a] = b;
+	LLM_VAR_WRITE(a);
 
 	return(code);
 }
@@ -75,6 +79,7 @@ u8 *cmd_assignv(u8 *code)
 	b = *code++;
 	// c = *code++;
 	state.var[a] = state.var[b];
+	LLM_VAR_WRITE(a);
 
 	return(code);
 }
@@ -90,6 +95,7 @@ u8 *cmd_addn(u8 *code)
 	b = *code++;
 	// c = *code++;
 	state.var[a] += b;
+	LLM_VAR_WRITE(a);
 
 	return(code);
 }
@@ -102,6 +108,7 @@ u8 *cmd_addv(u8 *code)
 	b = *code++;
 	// c = *code++;
 	state.var[a] += state.var[b];
+	LLM_VAR_WRITE(a);
 
 	return(code);
 }
@@ -114,6 +121,7 @@ u8 *cmd_subn(u8 *code)
 	b = *code++;
 	// c = *code++;
 	state.var[a] -= b;
+	LLM_VAR_WRITE(a);
 
 	return(code);
 }
@@ -126,6 +134,7 @@ u8 *cmd_subv(u8 *code)
 	b = *code++;
 	// c = *code++;
 	state.var[a] -= state.var[b];
+	LLM_VAR_WRITE(a);
 
 	return(code);
 }
@@ -140,6 +149,7 @@ u8 *cmd_lindirectv(u8 *code)
 	a = *code++;
 	b = *code++;
 	state.var[ state.var[a] ] = state.var[b];
+	LLM_VAR_WRITE(state.var[a]);
 
 	return(code);
 }
@@ -151,6 +161,7 @@ u8 *cmd_lindirectn(u8 *code)
 	a = *code++;
 	b = *code++;
 	state.var[ state.var[a] ] = b;
+	LLM_VAR_WRITE(state.var[a]);
 
 	return(code);
 }
@@ -162,6 +173,7 @@ u8 *cmd_rindirect(u8 *code)
 	a = *code++;
 	b = *code++;
 	state.var[a] = state.var[ state.var[b] ];
+	LLM_VAR_WRITE(a);
 
 	return(code);
 }
@@ -176,6 +188,7 @@ u8 *cmd_multn(u8 *code)
 	b = *code++;
 	// c = *code++;
 	state.var[a] *= b;
+	LLM_VAR_WRITE(a);
 
 	return(code);
 }
@@ -188,6 +201,7 @@ u8 *cmd_multv(u8 *code)
 	b = *code++;
 	// c = *code++;
 	state.var[a] *= state.var[b];
+	LLM_VAR_WRITE(a);
 
 	return(code);
 }
@@ -200,6 +214,7 @@ u8 *cmd_divn(u8 *code)
 	b = *code++;
 	// c = *code++;
 	state.var[a] /= b;
+	LLM_VAR_WRITE(a);
 
 	return(code);
 }
@@ -211,6 +226,7 @@ u8 *cmd_divv(u8 *code)
 	a = *code++;
 	b = *code++;
 	state.var[a] /= state.var[b];
+	LLM_VAR_WRITE(a);
 
 	return(code);
 }
@@ -15,6 +15,8 @@
 #include "../picture/pic_res.h"
 // setscript.size   u171  u172
 #include "../sys/script.h"
+// show.mem
+#include "../sys/memory.h"
 // animate.. unanimateall
 #include "../view/obj_base.h"
 // ignore observe distanc
@@ -288,7 +290,7 @@ FUNC cmd_table[CMD_MAX + 1] = {
 			{"cmd.player.control", cmd_player_control, 0, 0},
 			{"cmd.obj.status.v (incomplete)", cmd_do_nothing, 1, 0x80},
 			{"cmd.quit", cmd_quit, 1, 0},
-			{"cmd.show.mem (incomplete)", cmd_do_nothing, 0, 0},
+			{"cmd.show.mem", cmd_show_mem, 0, 0},
 			{"cmd.pause", cmd_pause, 0, 0},
 			{"cmd.echo.line", cmd_echo_line, 0, 0},
 
@@ -2,6 +2,7 @@
 
 #include "../ui/msg.h"
 
+
 u8 *cmd_update_context(u8 *c)
 {
     	u8 message_index = *(c++);
@@ -18,7 +19,67 @@ u8 *cmd_update_context(u8 *c)
     	return c;
 }
 
+// queued for the llm's context, folded in before its next request
 void process_context_update(const char *message)
 {
-	// TODO: send this message to the LLM context system
+#ifdef NAGI_ENABLE_LLM
+	llm_context_on_update(g_llm_session, message);
+#else
+	(void)message;
+#endif
+}
+
+#ifdef NAGI_ENABLE_LLM
+u8 llm_flag_written[32];
+u8 llm_var_written[32];
+static u8 llm_flag_seen[32];
+static u8 llm_var_seen[256];
+
+static const u8 llm_watch_none[32];
+const u8 *llm_flag_watch = llm_watch_none;
+const u8 *llm_var_watch = llm_watch_none;
+
+void llm_watch_session(nagi_llm_session_t *s)
+{
+	llm_flag_watch = s ? llm_context_flag_watch(s) : llm_watch_none;
+	llm_var_watch = s ? llm_context_var_watch(s) : llm_watch_none;
+}
+
+// once a cycle.. the followed flags and vars that were written and really
+// changed since they were last reported
+void llm_watch_cycle()
+{
+	u16 i, n;
+	u8 bit, value;
+
+	for (i=0; i<32; i++)
+	{
+		if (llm_flag_written[i] != 0)
+		{
+			for (bit=0x80, n=i<<3; bit != 0; bit>>=1, n++)
+			{
+				if ( (llm_flag_written[i] & bit) && ((state.flag[i] ^ llm_flag_seen[i]) & bit) )
+				{
+					llm_flag_seen[i] ^= bit;
+					llm_context_on_flag_change(g_llm_session, n, (state.flag[i] & bit) != 0);
+				}
+			}
+			llm_flag_written[i] = 0;
+		}
+
+		if (llm_var_written[i] != 0)
+		{
+			for (bit=0x80, n=i<<3; bit != 0; bit>>=1, n++)
+			{
+				value = state.var[n];
+				if ( (llm_var_written[i] & bit) && (value != llm_var_seen[n]) )
+				{
+					llm_var_seen[n] = value;
+					llm_context_on_var_change(g_llm_session, n, value);
+				}
+			}
+			llm_var_written[i] = 0;
+		}
+	}
 }
+#endif
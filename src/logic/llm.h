@@ -7,4 +7,26 @@ extern u8 *cmd_update_context(u8 *c);
 
 void process_context_update(const char *message);
 
+#ifdef NAGI_ENABLE_LLM
+#include "../llm_global.h"
+
+// a write to a flag or var the llm's context follows only sets a bit here,
+// one test and an or.  llm_watch_cycle() reports the ones that changed.
+extern u8 llm_flag_written[32];
+extern u8 llm_var_written[32];
+// the session's watch bits, all clear without one
+extern const u8 *llm_flag_watch;
+extern const u8 *llm_var_watch;
+
+#define LLM_FLAG_WRITE(n)	(llm_flag_written[(n)>>3] |= llm_flag_watch[(n)>>3] & (0x80>>((n)%8)))
+#define LLM_VAR_WRITE(n)	(llm_var_written[(n)>>3] |= llm_var_watch[(n)>>3] & (0x80>>((n)%8)))
+
+// follow the flags and vars this session watches (0 for none)
+void llm_watch_session(nagi_llm_session_t *s);
+void llm_watch_cycle(void);
+#else
+#define LLM_FLAG_WRITE(n)
+#define LLM_VAR_WRITE(n)
+#endif
+
 #endif // LLM_H
\ No newline at end of file
@@ -0,0 +1,367 @@
+/*
+Logics compiled ahead of time
+
+"nagi --aot [game dir]" turns every logic of the game into C, one function
+each, in nagi_aot_<game crc>.c in the game directory.  built as a shared
+library next to it (the file says how) it's loaded with the game and its
+logics run instead of the interpreter.. no dispatch, no decoding, the
+control flow of the predecoded ops is gotos.
+
+the commands and tests are the interpreter's own, called through the
+tables handed over in AOT_HOST (a plugin can't link against the
+executable everywhere).  each keeps logic_data and the trace ring as
+logic_prog_run() does; the command profile isn't kept.  anything the
+compiled code wasn't written for (a command sending the code elsewhere,
+tracing, a command with no function) goes back to logic_prog_run() from
+there.  a logic is only run compiled when its code is the same as when it
+was compiled, a patched game just interprets the ones that changed.
+*/
+
+#define MEM_TAG MEM_RES
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../agi.h"
+
+#include "../logic/logic_base.h"
+#include "../logic/logic_execute.h"
+#include "../logic/logic_prog.h"
+#include "../logic/logic_aot.h"
+#include "../logic/cmd_table.h"
+
+#include "../res/res.h"
+#include "../version/agi_crc.h"
+#include "../sys/endian.h"
+#include "../sys/mem_wrap.h"
+#include "../sys/sys_dir.h"
+#include "../sys/trace_ring.h"
+#include "../trace.h"
+
+#if defined(_WIN32)
+#define AOT_EXT ".dll"
+#elif defined(__APPLE__)
+#define AOT_EXT ".dylib"
+#else
+#define AOT_EXT ".so"
+#endif
+
+static SDL_SharedObject *aot_object = 0;
+static const AOT_PLUGIN *aot_plugin = 0;
+static CMD_TYPE aot_cmd[CMD_MAX + 1];
+static EVAL_TYPE aot_eval[EVAL_MAX + 1];
+static AOT_HOST aot_host;
+
+// the rest of the logic from "at" in the interpreter
+static u8 *aot_resume(u8 *at)
+{
+	return logic_prog_run(logic_cur->prog, at);
+}
+
+void aot_load(void)
+{
+	AOT_INIT_FUNC init;
+	char name[32];
+	int i;
+
+	aot_unload();
+	if ( !c_nagi_aot || (c_game_crc == 0) )
+		return;
+
+	// dlopen() wants a path or it only looks in the system's
+	dir_preset_change(DIR_PRESET_GAME);
+	snprintf(name, sizeof(name), "./" AOT_FILE AOT_EXT, (unsigned int)c_game_crc);
+	aot_object = SDL_LoadObject(name);
+	if (aot_object == 0)
+		return;
+
+	for (i = 0; i <= CMD_MAX; i++)
+		aot_cmd[i] = (CMD_TYPE)cmd_table[i].func;
+	for (i = 0; i <= EVAL_MAX; i++)
+		aot_eval[i] = (EVAL_TYPE)eval_table[i].func;
+	aot_host.version = AOT_VERSION;
+	aot_host.cmd = aot_cmd;
+	aot_host.eval = aot_eval;
+	aot_host.logic_data = &logic_data;
+	aot_host.trace_state = &trace_state;
+	aot_host.ring = trace_ring;
+	aot_host.ring_pos = &trace_ring_pos;
+	aot_host.ring_mask = TRACE_RING_MASK;
+	aot_host.resume = aot_resume;
+
+	init = (AOT_INIT_FUNC)SDL_LoadFunction(aot_object, AOT_INIT);
+	if (init != 0)
+		aot_plugin = init(&aot_host);
+	if ( (aot_plugin == 0) || (aot_plugin->version != AOT_VERSION) ||
+		(aot_plugin->game_crc != c_game_crc) )
+	{
+		printf("AOT: %s is for another game or version of nagi\n", name);
+		aot_unload();
+		return;
+	}
+	printf("AOT: %u logics compiled in %s\n", aot_plugin->total, name);
+}
+
+// the logics that were using it are gone by now
+void aot_unload(void)
+{
+	aot_plugin = 0;
+	if (aot_object != 0)
+		SDL_UnloadObject(aot_object);
+	aot_object = 0;
+}
+
+AOT_RUN aot_find(LOGIC *log)
+{
+	const AOT_LOGIC *l;
+	u16 size, i;
+
+	if (aot_plugin == 0)
+		return 0;
+	size = load_le_16(log->data);
+	for (i = 0; i < aot_plugin->total; i++)
+	{
+		l = aot_plugin->logic + i;
+		if (l->num != log->num)
+			continue;
+		if ( (l->size == size) && (l->crc == crc_generate(log->code, size)) )
+			return l->run;
+		printf("AOT: logic %d changed since it was compiled, interpreting it\n", log->num);
+		return 0;
+	}
+	return 0;
+}
+
+// ---------- COMPILE -------------------------
+
+// the plugin's own copy of logic_aot.h's structs and what the code uses
+static const char aot_head[] =
+	"#include <stdint.h>\n"
+	"\n"
+	"typedef uint8_t u8;\n"
+	"typedef uint16_t u16;\n"
+	"typedef uint32_t u32;\n"
+	"\n"
+	"typedef u8 *(*AOT_RUN)(u8 *code, u8 *start);\n"
+	"typedef struct\n"
+	"{\n"
+	"\tu32 version;\n"
+	"\tu8 *(*const *cmd)(u8 *code);\n"
+	"\tu8 (*const *eval)(void);\n"
+	"\tu8 **logic_data;\n"
+	"\tu16 *trace_state;\n"
+	"\tu32 *ring;\n"
+	"\tu32 *ring_pos;\n"
+	"\tu32 ring_mask;\n"
+	"\tu8 *(*resume)(u8 *at);\n"
+	"} AOT_HOST;\n"
+	"typedef struct\n"
+	"{\n"
+	"\tu16 num;\n"
+	"\tu16 size;\n"
+	"\tu32 crc;\n"
+	"\tAOT_RUN run;\n"
+	"} AOT_LOGIC;\n"
+	"typedef struct\n"
+	"{\n"
+	"\tu32 version;\n"
+	"\tu32 game_crc;\n"
+	"\tu16 total;\n"
+	"\tconst AOT_LOGIC *logic;\n"
+	"} AOT_PLUGIN;\n"
+	"\n"
+	"#ifdef _WIN32\n"
+	"#define AOT_EXPORT __declspec(dllexport)\n"
+	"#else\n"
+	"#define AOT_EXPORT __attribute__((visibility(\"default\")))\n"
+	"#endif\n"
+	"\n"
+	"static const AOT_HOST *h;\n"
+	"\n"
+	"// the trace ring word, then what logic_prog_run() does for the op\n"
+	"#define RING(w) (h->ring[(*h->ring_pos)++ & h->ring_mask] = (w))\n"
+	"#define CMD(op, param, next, w) \\\n"
+	"\tRING(w); \\\n"
+	"\t*h->logic_data = code + (param); \\\n"
+	"\tp = h->cmd[op](code + (param)); \\\n"
+	"\t*h->logic_data = p; \\\n"
+	"\tif (p == 0) \\\n"
+	"\t\treturn 0; \\\n"
+	"\tif ( (p != code + (next)) || (*h->trace_state == 1) ) \\\n"
+	"\t\treturn h->resume(p)\n"
+	"#define TEST(op, param, not, w) \\\n"
+	"\t(RING(w), *h->logic_data = code + (param), (h->eval[op]() ^ (not)) != 0)\n"
+	"#define RETURN(next) return (*h->logic_data = code + (next))\n"
+	"#define RESUME(at) return h->resume(code + (at))\n";
+
+// goto the op or let the interpreter carry on from the byte
+static void aot_target(FILE *stream, LOGIC_PROG *prog, u16 index, u8 *at)
+{
+	if (index != LOGIC_OP_NONE)
+		fprintf(stream, "goto o%u", index);
+	else
+		fprintf(stream, "RESUME(%ld)", (long)(at - prog->code));
+}
+
+// a logic's ops as a function.  a switch finds where the scan starts
+static void aot_logic(FILE *stream, LOGIC *log, LOGIC_PROG *prog)
+{
+	LOGIC_OP *o;
+	u8 *label;
+	u32 ring;
+	u16 i;
+
+	// the ops something gets to other than by running into them
+	label = (u8 *)a_malloc(prog->op_total + 1u);
+	memset(label, 0, prog->op_total + 1u);
+	for (i = 0; i < prog->op_total; i++)
+	{
+		o = prog->op + i;
+		if (o->at != 0)
+			label[i] = 1;
+		if (o->next < prog->op_total)
+			label[o->next] = 1;
+		if (o->jump < prog->op_total)
+			label[o->jump] = 1;
+	}
+
+	fprintf(stream, "\nstatic u8 *logic_%u(u8 *code, u8 *start)\n{\n", log->num);
+	fprintf(stream, "\tu8 *p;\n\n\t(void)p;\n\tswitch (start - code)\n\t{\n");
+	for (i = 0; i < prog->op_total; i++)
+		if (prog->op[i].at != 0)
+			fprintf(stream, "\t\tcase %ld: goto o%u;\n", (long)(prog->op[i].at - prog->code), i);
+	fprintf(stream, "\t\tdefault: return h->resume(start);\n\t}\n\n");
+
+	for (i = 0; i < prog->op_total; i++)
+	{
+		o = prog->op + i;
+		if (label[i] != 0)
+			fprintf(stream, "o%u:\n", i);
+
+		switch (logic_op_kind(o))
+		{
+			case LOGIC_OP_RETURN:
+				fprintf(stream, "\tRETURN(%ld);\n", (long)(o->next_at - prog->code));
+				break;
+
+			case LOGIC_OP_CMD:
+				// "no cmd" is the interpreter's to say
+				if (o->func == 0)
+				{
+					fprintf(stream, "\tRESUME(%ld);\n", (long)(o->at - prog->code));
+					break;
+				}
+				ring = ((u32)log->num << 24) | ((u32)o->code << 16) | TRACE_RING_CMD |
+					((u32)(o->at - prog->code) & 0x7FFF);
+				fprintf(stream, "\tCMD(%u, %ld, %ld, 0x%08Xu);\n", o->code,
+					(long)(o->param - prog->code), (long)(o->next_at - prog->code),
+					(unsigned int)ring);
+				if (o->next != i + 1)
+				{
+					fprintf(stream, "\t");
+					aot_target(stream, prog, o->next, o->next_at);
+					fprintf(stream, ";\n");
+				}
+				break;
+
+			case LOGIC_OP_TEST:
+				ring = ((u32)log->num << 24) | ((u32)o->code << 16) | TRACE_RING_TEST |
+					((u32)(o->param - 1 - prog->code) & 0x7FFF);
+				fprintf(stream, "\tif (TEST(%u, %ld, %u, 0x%08Xu))\n\t\t", o->code,
+					(long)(o->param - prog->code), o->flags & LOGIC_OP_NOT, (unsigned int)ring);
+				aot_target(stream, prog, o->next, o->next_at);
+				fprintf(stream, ";\n\telse\n\t\t");
+				aot_target(stream, prog, o->jump, o->jump_at);
+				fprintf(stream, ";\n");
+				break;
+
+			case LOGIC_OP_GOTO:
+				fprintf(stream, "\t");
+				aot_target(stream, prog, o->jump, o->jump_at);
+				fprintf(stream, ";\n");
+				break;
+
+			default:
+				fprintf(stream, "\tRESUME(%ld);\n", (long)(o->at - prog->code));
+				break;
+		}
+	}
+	fprintf(stream, "}\n");
+	a_free(label);
+}
+
+int aot_build(void)
+{
+	FILE *stream;
+	LOGIC log;
+	LOGIC_PROG *prog;
+	u8 *data;
+	u16 *size;
+	u32 *crc;
+	char name[32];
+	u16 num, total, i;
+
+	if (c_game_crc == 0)
+	{
+		printf("aot: the game has no crc to know it by (see standard.ini)\n");
+		return 1;
+	}
+
+	dir_preset_change(DIR_PRESET_GAME);
+	snprintf(name, sizeof(name), AOT_FILE ".c", (unsigned int)c_game_crc);
+	stream = fopen(name, "w");
+	if (stream == 0)
+	{
+		printf("aot: unable to write %s\n", name);
+		return 1;
+	}
+
+	fprintf(stream, "/* the logics of this game compiled by \"nagi --aot\".  build it next to\n");
+	fprintf(stream, "   it as " AOT_FILE AOT_EXT ", for example\n", (unsigned int)c_game_crc);
+	fprintf(stream, "\tcc -O2 -shared -fPIC -fvisibility=hidden " AOT_FILE ".c -o " AOT_FILE AOT_EXT " */\n\n",
+		(unsigned int)c_game_crc, (unsigned int)c_game_crc);
+	fputs(aot_head, stream);
+
+	size = (u16 *)a_malloc(256 * sizeof(u16));
+	crc = (u32 *)a_malloc(256 * sizeof(u32));
+	memset(size, 0, 256 * sizeof(u16));
+	total = 0;
+	for (num = 0; (num < dir_logic_count()) && (num < 256); num++)
+	{
+		if (dir_logic_find(num) == 0)
+			continue;
+		data = vol_res_load(dir_logic_find(num), 0);
+		if (data == 0)
+			continue;
+
+		memset(&log, 0, sizeof(log));
+		log.num = (u8)num;
+		log.data = data;
+		log.code = data + 2;
+		prog = logic_prog_new(&log);
+		aot_logic(stream, &log, prog);
+		size[num] = prog->size;
+		crc[num] = crc_generate(log.code, prog->size);
+		total++;
+		logic_prog_free(prog);
+		a_free(data);
+	}
+
+	fprintf(stream, "\nstatic const AOT_LOGIC aot_logic[] =\n{\n");
+	for (i = 0; i < 256; i++)
+		if (size[i] != 0)
+			fprintf(stream, "\t{%u, %u, 0x%08Xu, logic_%u},\n", i, size[i], (unsigned int)crc[i], i);
+	fprintf(stream, "\t{0, 0, 0, 0}\n};\n\n");
+	fprintf(stream, "static const AOT_PLUGIN aot_plugin = {%d, 0x%08Xu, %u, aot_logic};\n\n",
+		AOT_VERSION, (unsigned int)c_game_crc, total);
+	fprintf(stream, "AOT_EXPORT const AOT_PLUGIN *" AOT_INIT "(const AOT_HOST *host);\n");
+	fprintf(stream, "AOT_EXPORT const AOT_PLUGIN *" AOT_INIT "(const AOT_HOST *host)\n{\n");
+	fprintf(stream, "\tif (host->version != %d)\n\t\treturn 0;\n", AOT_VERSION);
+	fprintf(stream, "\th = host;\n\treturn &aot_plugin;\n}\n");
+	fclose(stream);
+	a_free(crc);
+	a_free(size);
+
+	printf("aot: wrote %u logics to %s\n", total, name);
+	return 0;
+}
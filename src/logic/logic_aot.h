@@ -0,0 +1,64 @@
+#ifndef NAGI_LOGIC_LOGIC_AOT_H
+#define NAGI_LOGIC_LOGIC_AOT_H
+
+/* STRUCTURES	---	---	---	---	---	---	--- */
+
+// the plugin's name in the game directory, the game's crc and the
+// system's shared library extension
+#define AOT_FILE "nagi_aot_%08X"
+
+// bumped whenever what follows changes.  aot_build() writes the same
+// structs into the plugin's source
+#define AOT_VERSION 1
+
+// a compiled logic, run from start like logic_prog_run()
+typedef u8 *(*AOT_RUN)(u8 *code, u8 *start);
+
+// what the interpreter hands the plugin
+struct aot_host_struct
+{
+	u32 version;
+	u8 *(*const *cmd)(u8 *code);	// cmd_table's functions by opcode
+	u8 (*const *eval)(void);		// eval_table's
+	u8 **logic_data;
+	u16 *trace_state;
+	u32 *ring;				// trace_ring
+	u32 *ring_pos;
+	u32 ring_mask;
+	u8 *(*resume)(u8 *at);		// the interpreter carries on from at
+};
+typedef struct aot_host_struct AOT_HOST;
+
+// one compiled logic.  only used when the loaded code is the same
+struct aot_logic_struct
+{
+	u16 num;
+	u16 size;				// bytes of code
+	u32 crc;				// crc_generate() of them
+	AOT_RUN run;
+};
+typedef struct aot_logic_struct AOT_LOGIC;
+
+// what the plugin's AOT_INIT returns
+struct aot_plugin_struct
+{
+	u32 version;
+	u32 game_crc;
+	u16 total;
+	const AOT_LOGIC *logic;
+};
+typedef struct aot_plugin_struct AOT_PLUGIN;
+
+#define AOT_INIT "nagi_aot_init"
+typedef const AOT_PLUGIN *(*AOT_INIT_FUNC)(const AOT_HOST *host);
+
+/* FUNCTIONS	---	---	---	---	---	---	--- */
+
+extern void aot_load(void);
+extern void aot_unload(void);
+// the compiled code for a logic just loaded, 0 to interpret it
+extern AOT_RUN aot_find(LOGIC *log);
+// nagi --aot: write the plugin's source for every logic
+extern int aot_build(void);
+
+#endif /* NAGI_LOGIC_LOGIC_AOT_H */
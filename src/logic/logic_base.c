@@ -17,12 +17,17 @@ R_Logic1364                      cseg     00001364 00000041
 R_Logic13A5                      cseg     000013A5 0000002F
 */
 
+#define MEM_TAG MEM_RES
+
 #include <stdlib.h>
+#include <string.h>
 
 #include "../agi.h"
 
 #include "../logic/logic_base.h"
 #include "../logic/logic_execute.h"
+#include "../logic/logic_prog.h"
+#include "../logic/cmd_table.h"
 
 
 // script
@@ -42,16 +47,33 @@ R_Logic13A5                      cseg     000013A5 0000002F
 #include "../ui/msg.h"
 
 #include "../sys/mem_wrap.h"
+#include "../sys/memory.h"
 
 #include <assert.h>
 
 #include "../trace.h"
+#include "../sys/profile.h"
 
-static LOGIC logic_head = {0,0,0,0,0,0,0};
+static LOGIC logic_head = {0,0,0,0,0,0,0,0,0};
 LOGIC *logic_cur = 0;
-static LOGIC *logic_last = 0;
+static LOGIC *logic_last = &logic_head;	// the end of the list
+static LOGIC *logic_index[256];		// the list's nodes by number
 u16 scan_start_list[60];
 
+// logic.0 is a_malloc'd, the others are on the room heap
+static void logic_data_free(LOGIC *log)
+{
+	logic_prog_free(log->prog);
+	log->prog = 0;
+	log->aot = 0;
+	if (log->data == 0)
+		return;
+	if (log->num == 0)
+		a_free(log->data);
+	else
+		room_free(log->data);
+}
+
 // initialising the list for the first time
 void logic_list_init()
 {
@@ -62,14 +84,15 @@ void logic_list_init()
 	while (cur != 0)
 	{
 		next = cur->next;
-		if (cur->data != 0)
-			free(cur->data);
+		logic_data_free(cur);
 		
-		free(cur);
+		a_free(cur);
 		cur = next;
 	}
 	
 	logic_head.next = 0;
+	logic_last = &logic_head;
+	memset(logic_index, 0, sizeof(logic_index));
 }
 
 // frees up the list for a new instance of a room
@@ -85,35 +108,26 @@ void logic_list_new_room()
 		while (cur != 0)
 		{
 			next = cur->next;
-			if (cur->data != 0)
-				free(cur->data);
+			logic_index[cur->num] = 0;
+			logic_data_free(cur);
 			assert(cur->num != 0);
-			free(cur);
+			a_free(cur);
 			cur = next;
 		}
 		
 		(logic_head.next)->next = 0;
+		logic_last = logic_head.next;
 	}
 }
 
 // returns a pointer to the logic node if it's found
 // if not, returns 0
-// logic_last is set so if it's not found, you can add it onto the last one
+// logic_last is always the end of the list so a new one can be added onto it
 LOGIC *logic_list_find(u16 logic_num)
 {
-	LOGIC *cur, *prev;
-	
-	cur = logic_head.next;
-	prev = &logic_head;
-	
-	while ( (cur != 0) && (cur->num != logic_num) )
-	{
-		prev = cur;
-		cur = cur->next;
-	}
-	
-	logic_last = prev;
-	return cur;
+	if (logic_num >= 256)
+		return 0;
+	return logic_index[logic_num];
 }
 	
 u8 *cmd_load_logics(u8 *c)
@@ -161,8 +175,16 @@ LOGIC *logic_load_2(u16 logic_num)
 		logic_last->next = log;
 		log->next = 0;
 		log->num = logic_num;
+		log->prog = 0;
+		log->aot = 0;
+		logic_last = log;
+		logic_index[log->num] = log;
 		
-		log_data = vol_res_load( dir_logic(logic_num), 0 );
+		// logic.0 stays for the whole game, the rest go with the room
+		if (logic_num == 0)
+			log_data = vol_res_load( dir_logic(logic_num), 0 );
+		else
+			log_data = vol_res_room_load( dir_logic(logic_num), 0 );
 		
 		log->data = log_data;
 		log->code = log_data + 2;	// skip header
@@ -186,10 +208,54 @@ LOGIC *logic_load_2(u16 logic_num)
 		}
 
 		blists_draw();
+		res_prefetch_logic(log);
 	}
 	return log;
 }
 
+// walks a logic's commands in file order, skipping over the tests, and
+// hands each one to func.  stops at anything it doesn't understand.
+void logic_scan(LOGIC *log, void (*func)(u8 code, const u8 *param, void *arg), void *arg)
+{
+	u8 *p, *end;
+	u8 code;
+
+	p = log->code;
+	end = p + load_le_16(log->data);
+
+	while (p < end)
+	{
+		code = *(p++);
+		if (code == 0xFF)	// if
+		{
+			while ( (p < end) && (*p != 0xFF) )
+			{
+				code = *(p++);
+				if ( (code == 0xFC) || (code == 0xFD) )	// or, not
+					continue;
+				if (code == 0x0E)	// said
+					p += 1 + (*p << 1);
+				else if (code <= EVAL_MAX)
+					p += eval_table[code].param_total;
+				else
+					return;
+			}
+			p += 3;	// closing 0xFF and the jump
+		}
+		else if (code == 0xFE)	// else goto
+			p += 2;
+		else if (code <= CMD_MAX)
+		{
+			if (p + cmd_table[code].param_total > end)
+				break;
+			func(code, p, arg);
+			p += cmd_table[code].param_total;
+		}
+		else
+			break;
+	}
+}
+
 u8 *cmd_call(u8 *c)
 {
 	//printf("%d ", *c);
@@ -215,7 +281,9 @@ u8 *logic_call(u16 logic_num)
 	u8 *code;			// logic code return
 	LOGIC *last_orig = 0;		// original last node
 	LOGIC *cur_orig;		// oringal current node
+	LOGIC *cur;
 	u16 untouched;
+	u64 prof;
 
 	/* Save current logic and set up new one*/
 	cur_orig = logic_cur;
@@ -239,7 +307,9 @@ u8 *logic_call(u16 logic_num)
 	if (logic_num == 0)
 		logic_called = 1;
 
+	prof = profile_detail_now();
 	code = logic_execute(logic_cur);
+	profile_logic(logic_num, prof);
 
 	// TODO: warning another AGI bug.  if restore/restart/newroom is called from a called logic, havoc may be wrecked when returning.
 	// you don't want to try and free the previous logic code if it was just free'd by a returning restore command.
@@ -248,12 +318,15 @@ u8 *logic_call(u16 logic_num)
 		assert(logic_new != NULL);
 		assert(last_orig != NULL);
 
+		// anything it loaded goes too
+		for (cur = last_orig->next; cur != 0; cur = cur->next)
+			logic_index[cur->num] = 0;
 		last_orig->next = 0;
+		logic_last = last_orig;
 		blists_erase();
 		//set_mem_ptr(logic_new);
-		if (logic_new->data != 0)
-			free(logic_new->data);	// hope this works
-		free(logic_new);
+		logic_data_free(logic_new);	// hope this works
+		a_free(logic_new);
 		blists_draw();
 	}
 
@@ -10,6 +10,8 @@ struct logic_struct
 	u8 *code;				// 4
 	u8 *scan_start;			// 6
 	u8 *msg;				// 8
+	struct logic_prog_struct *prog;	// predecoded code, 0 until it's run
+	u8 *(*aot)(u8 *code, u8 *start);	// compiled by --aot, found with prog
 };
 // may need to check offsets
 
@@ -25,6 +27,7 @@ extern u8 *cmd_load_logics(u8 *c);
 extern u8 *cmd_load_logics_v(u8 *c);
 extern void logic_load(u16 logic_num);
 extern LOGIC *logic_load_2(u16 logic_num);
+extern void logic_scan(LOGIC *log, void (*func)(u8 code, const u8 *param, void *arg), void *arg);
 
 extern u8 *cmd_call(u8 *c);
 extern u8 *cmd_call_v(u8 *c);
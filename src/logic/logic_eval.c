@@ -18,6 +18,9 @@ CmdHaveKey                       cseg     000009BE 0000001A
 CmdRetFalse                      cseg     000009D8 00000003
 CmdCompareStrns                  cseg     000009DB 0000000F
 */
+
+#define MEM_TAG MEM_CACHE
+
 #include "../agi.h"
 #include "../flags.h"
 
@@ -37,10 +40,15 @@ CmdCompareStrns                  cseg     000009DB 0000000F
 #ifdef NAGI_ENABLE_LLM
 /* LLM interfaces for fallback matching */
 #include "../llm_global.h"
+#include "../logic/said_index.h"
+#include "../sys/mem_wrap.h"
+#include <string.h>
+#include <SDL3/SDL.h>
 #endif
 
 // byte-order support
 #include "../sys/endian.h"
+#include "../sys/profile.h"
 
 // object
 #include "../objects.h"
@@ -52,6 +60,39 @@ CmdCompareStrns                  cseg     000009DB 0000000F
 #include "../ui/controller.h"
 
 static u8 is_obj_inside(u16 left, u16 right, u16 y);
+static u8 said_possible(const u8 *list, u16 count);
+
+#ifdef NAGI_ENABLE_LLM
+// semantic said() results for the current input.  the first failing said()
+// in a logic scores every said() list of that logic in one batch, later
+// said() tests just read the answer back.
+#define SAID_LLM_MAX 64
+#define SAID_LLM_WORDS 16
+
+struct said_llm_struct
+{
+	u16 count;
+	u16 words[SAID_LLM_WORDS];
+	u8 match;
+};
+typedef struct said_llm_struct SAID_LLM;
+
+static SAID_LLM said_llm[SAID_LLM_MAX];
+static u16 said_llm_total = 0;
+static char said_llm_input[256] = "";
+static u16 said_llm_embed_done = 0xFFFF;	// room whose lists were embedded last
+
+// hybrid mode: whether this input may be matched, and how that went so far.
+// it's reported once the next input comes along
+static char said_hybrid_input[256] = "";
+static u8 said_hybrid_ok = 0;
+static u8 said_hybrid_asked = 0;
+static u8 said_hybrid_hit = 0;
+static u32 said_hybrid_ms = 0;
+
+static int said_llm_match(LOGIC *log, const u8 *list, const char *input);
+static u8 said_llm_allowed(const char *input);
+#endif
 
 // logic_data is the logic data
 // return the true/false bit
@@ -128,28 +169,28 @@ u8 cmd_posn()
 {
 	VIEW *v;
 	v = &objtable[*(logic_data++)];
-	return is_obj_inside(v->x, v->x, v->y);
+	return is_obj_inside(OBJ_X(v), OBJ_X(v), OBJ_Y(v));
 }
 
 u8 cmd_center_posn()
 {
 	VIEW *v;
 	v = &objtable[*(logic_data++)];
-	return is_obj_inside(v->x+v->x_size/2,  v->x+v->x_size/2, v->y);
+	return is_obj_inside(OBJ_X(v)+v->x_size/2,  OBJ_X(v)+v->x_size/2, OBJ_Y(v));
 }
 
 u8 cmd_right_posn()
 {
 	VIEW *v;
 	v = &objtable[*(logic_data++)];
-	return is_obj_inside(v->x+v->x_size-1, v->x+v->x_size-1, v->y);
+	return is_obj_inside(OBJ_X(v)+v->x_size-1, OBJ_X(v)+v->x_size-1, OBJ_Y(v));
 }
 
 u8 cmd_obj_in_box()
 {
 	VIEW *v;
 	v = &objtable[*(logic_data++)];
-	return is_obj_inside(v->x, v->x+v->x_size-1, v->y);
+	return is_obj_inside(OBJ_X(v), OBJ_X(v)+v->x_size-1, OBJ_Y(v));
 }
 	
 static u8 is_obj_inside(u16 left, u16 right, u16 y)
@@ -201,15 +242,13 @@ u8 cmd_said()
 	u16 cur;
 	/* Save start of the said-word list so we can reconstruct it later */
 	u8 *said_list_start = logic_data;
-	u16 orig_word_count = 0;
 	
 	word_remaining = *(logic_data++);	// number of words to check.
-	orig_word_count = word_remaining;
 	word_bad = word_total;
 	
 	if (word_bad != 0)
 		if (flag_test(F04_SAIDACCEPT) == 0)
-			if (flag_test(F02_PLAYERCMD) != 0)
+			if ( (flag_test(F02_PLAYERCMD) != 0) && said_possible(logic_data, word_remaining) )
 			{
 				cur = 0;
 				while (word_remaining != 0)
@@ -248,24 +287,25 @@ u8 cmd_said()
 		/* LLM fallback depends on configured mode:
 		 * - EXTRACTION mode: Words already extracted and reparsed in cmd_parse(), just fail here
 		 * - SEMANTIC mode: Use semantic matching to compare input with expected command
+		 * - HYBRID mode: Extraction already failed in cmd_parse(), match if it fits the SLO
 		 * - DISABLED mode: No LLM, just fail
 		 */
-		if (nagi_llm_ready(g_llm) && flag_test(F04_SAIDACCEPT) == 0 && g_llm_config.mode == NAGI_LLM_MODE_SEMANTIC) {
+		if (nagi_llm_ready(g_llm) && flag_test(F04_SAIDACCEPT) == 0 &&
+		    (g_llm_config.mode == NAGI_LLM_MODE_SEMANTIC || g_llm_config.mode == NAGI_LLM_MODE_HYBRID)) {
 			/* SEMANTIC MODE: Compare user input meaning with expected command */
 			/* Only try if we have unknown words */
 			if (state.var[V09_BADWORD] > 0) {
-				const char *last_input = llm_context_get_last_player_input();
-				if (last_input && last_input[0] != '\0') {
-					int expected[64];
-					int ecount = 0;
-					u8 *ptr = said_list_start + 1; /* skip count byte */
-					for (int i = 0; i < orig_word_count && ecount < 64; ++i) {
-						u16 w = load_le_16(ptr);
-						ptr += 2;
-						expected[ecount++] = w;
-					}
-
-					if (nagi_llm_matches_expected(g_llm, last_input, expected, ecount)) {
+				char last_input[LLM_MAX_ENTRY_SIZE];
+				llm_context_get_last_player_input(g_llm_session, last_input, sizeof(last_input));
+				if (last_input[0] != '\0' && said_llm_allowed(last_input)) {
+					u64 prof = profile_now();
+					u64 start = SDL_GetTicks();
+					int matched = said_llm_match(logic_cur, said_list_start, last_input);
+					said_hybrid_ms += (u32)(SDL_GetTicks() - start);
+					said_hybrid_asked = 1;
+					said_hybrid_hit |= (matched != 0);
+					profile_sub(PROFILE_LLM, prof);
+					if (matched) {
 						flag_set(F04_SAIDACCEPT);
 						logic_data += word_remaining << 1;
 						return 1;
@@ -281,6 +321,211 @@ u8 cmd_said()
 	}
 }
 
+// quick check before the ordered compare.  every word the list asks for has to
+// be in the input somewhere, and there have to be as many words (or at least
+// as many before a rol)
+static u8 said_possible(const u8 *list, u16 count)
+{
+	u16 num;
+	u16 need;
+	
+	for (need = 0; need < count; need++)
+	{
+		num = load_le_16(list + (need << 1));
+		if (num == 9999)	// rol
+			return (need <= word_total);
+		if ( (num != 1) && (WORD_SEEN(num) == 0) )
+			return 0;
+	}
+	return (count == word_total);
+}
+
+#ifdef NAGI_ENABLE_LLM
+static SAID_LLM *said_llm_find_words(u16 count, const u16 *words)
+{
+	u16 i;
+	
+	for (i = 0; i < said_llm_total; i++)
+		if ( (said_llm[i].count == count) &&
+			(memcmp(said_llm[i].words, words, count * sizeof(u16)) == 0) )
+			return &said_llm[i];
+	return 0;
+}
+
+static SAID_LLM *said_llm_find(const u8 *list)
+{
+	u16 words[SAID_LLM_WORDS];
+	u16 w;
+	
+	if (*list > SAID_LLM_WORDS)
+		return 0;
+	for (w = 0; w < *list; w++)
+		words[w] = load_le_16(list + 1 + (w<<1));
+	return said_llm_find_words(*list, words);
+}
+
+// remember a said() list that still needs scoring
+static void said_llm_add_words(u16 count, const u16 *words)
+{
+	SAID_LLM *item;
+	
+	if ( (count == 0) || (count > SAID_LLM_WORDS) || (said_llm_total >= SAID_LLM_MAX) )
+		return;
+	if (said_llm_find_words(count, words) != 0)
+		return;
+	
+	item = &said_llm[said_llm_total++];
+	item->count = count;
+	memcpy(item->words, words, count * sizeof(u16));
+	item->match = 0xFF;	// not scored yet
+}
+
+static void said_llm_add(const u8 *list)
+{
+	u16 words[SAID_LLM_WORDS];
+	u16 w;
+	
+	if (*list > SAID_LLM_WORDS)
+		return;
+	for (w = 0; w < *list; w++)
+		words[w] = load_le_16(list + 1 + (w<<1));
+	said_llm_add_words(*list, words);
+}
+
+// queue every other said() word list of the logic, from the phrase index
+static void said_llm_scan(LOGIC *log)
+{
+	const SAID_PHRASE *phrase;
+	u16 i;
+	
+	for (i = 0; i < said_index_total(); i++)
+	{
+		phrase = said_index_get(i);
+		if (said_index_in_logic(phrase, log->num))
+			said_llm_add_words(phrase->count, phrase->words);
+	}
+}
+
+// embed the said() lists this room can test before the first one is scored.
+// lists of rooms already visited are kept, so each is embedded only once.
+static void said_llm_embed_room(void)
+{
+	const SAID_PHRASE *phrase;
+	const int **lists;
+	int *counts, *words;
+	u16 room, i, w, n;
+	
+	room = state.var[V00_ROOM0];
+	if ( !g_llm_config.embedding_match || (room == said_llm_embed_done) ||
+		(said_index_total() == 0) )
+		return;
+	said_llm_embed_done = room;
+	
+	lists = a_malloc(said_index_total() * sizeof(int *));
+	counts = a_malloc(said_index_total() * sizeof(int));
+	words = a_malloc(said_index_total() * SAID_INDEX_WORDS * sizeof(int));
+	
+	n = 0;
+	for (i = 0; i < said_index_total(); i++)
+	{
+		phrase = said_index_get(i);
+		if (!said_index_in_room(phrase, room))
+			continue;
+		for (w = 0; w < phrase->count; w++)
+			words[n * SAID_INDEX_WORDS + w] = phrase->words[w];
+		lists[n] = words + n * SAID_INDEX_WORDS;
+		counts[n] = phrase->count;
+		n++;
+	}
+	if (n != 0)
+		nagi_llm_embed_phrases(g_llm, lists, counts, n);
+	
+	a_free(words);
+	a_free(counts);
+	a_free(lists);
+}
+
+// in hybrid mode, semantic matching only gets an input if it can answer
+// within the latency target, counting what extraction took already
+static u8 said_llm_allowed(const char *input)
+{
+	if (g_llm_config.mode != NAGI_LLM_MODE_HYBRID)
+		return 1;
+	if (strncmp(said_hybrid_input, input, sizeof(said_hybrid_input) - 1) == 0)
+		return said_hybrid_ok;
+	
+	if (said_hybrid_asked)
+		nagi_llm_hybrid_record(g_llm, NAGI_LLM_MODE_SEMANTIC, said_hybrid_ms, said_hybrid_hit);
+	strncpy(said_hybrid_input, input, sizeof(said_hybrid_input) - 1);
+	said_hybrid_input[sizeof(said_hybrid_input) - 1] = 0;
+	said_hybrid_asked = 0;
+	said_hybrid_hit = 0;
+	said_hybrid_ms = 0;
+	said_hybrid_ok = nagi_llm_hybrid_try(g_llm, NAGI_LLM_MODE_SEMANTIC, parse_llm_ms) != 0;
+	return said_hybrid_ok;
+}
+
+static int said_llm_match(LOGIC *log, const u8 *list, const char *input)
+{
+	const int *lists[SAID_LLM_MAX];
+	int words[SAID_LLM_MAX][SAID_LLM_WORDS];
+	int counts[SAID_LLM_MAX];
+	int results[SAID_LLM_MAX];
+	u16 first, i, w, n;
+	SAID_LLM *item;
+	
+	// new input, forget the old answers
+	if (strncmp(said_llm_input, input, sizeof(said_llm_input) - 1) != 0)
+	{
+		strncpy(said_llm_input, input, sizeof(said_llm_input) - 1);
+		said_llm_input[sizeof(said_llm_input) - 1] = 0;
+		said_llm_total = 0;
+	}
+	
+	item = said_llm_find(list);
+	if ( (item != 0) && (item->match != 0xFF) )
+		return item->match;
+	
+	first = said_llm_total;
+	said_llm_add(list);
+	
+	// too long to keep or no room left, ask for this one alone
+	if (said_llm_find(list) == 0)
+	{
+		int expected[256];
+		for (w = 0; w < *list; w++)
+			expected[w] = load_le_16(list + 1 + (w<<1));
+		return nagi_llm_matches_expected(g_llm, input, expected, *list) == NAGI_LLM_MATCH_YES;
+	}
+	
+	// this list went first so it's scored even if the table fills up
+	said_llm_embed_room();
+	said_llm_scan(log);
+	
+	n = 0;
+	for (i = first; i < said_llm_total; i++)
+	{
+		for (w = 0; w < said_llm[i].count; w++)
+			words[n][w] = said_llm[i].words[w];
+		lists[n] = words[n];
+		counts[n] = said_llm[i].count;
+		n++;
+	}
+	
+	if ( (n == 0) || !nagi_llm_matches_expected_batch(g_llm, input, lists, counts, n, results) )
+	{
+		said_llm_total = first;
+		return 0;
+	}
+	
+	for (i = 0; i < n; i++)
+		said_llm[first + i].match = (results[i] == NAGI_LLM_MATCH_YES);
+	
+	item = said_llm_find(list);
+	return (item != 0) && (item->match == 1);
+}
+#endif
+
 u8 cmd_have_key()
 {
 	u16 ax;
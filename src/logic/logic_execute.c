@@ -19,6 +19,8 @@ _LogicExecute                    cseg     0000293C 000000BA
 
 #include "../logic/logic_base.h"
 #include "../logic/logic_execute.h"
+#include "../logic/logic_prog.h"
+#include "../logic/logic_aot.h"
 #include "../logic/cmd_table.h"
 
 // agi_error
@@ -33,6 +35,8 @@ _LogicExecute                    cseg     0000293C 000000BA
 #include "../sys/mem_wrap.h"
 
 #include "../trace.h"
+#include "../sys/profile.h"
+#include "../sys/trace_ring.h"
 
 static void execute_if(void);
 static void skip_true_or(void);
@@ -49,15 +53,32 @@ static u8 op;	// al;
 
 u8 *logic_execute(LOGIC *log)
 {
-	logic_data = log->scan_start;
-	
 	#if LOG_DEBUG
 	//printf("logic code (40 bytes):  ");
-	//print_hex_array(logic_data, 40);
+	//print_hex_array(log->scan_start, 40);
 	//printf("\n");
 	printf("executing logic %d... \n", log->num);
-	
 	#endif
+
+	// the byte interpreter prints the trace
+	if (trace_state == 1)
+		return logic_execute_at(log->scan_start);
+
+	if (log->prog == 0)
+	{
+		log->prog = logic_prog_new(log);
+		log->aot = aot_find(log);
+	}
+	// the compiled code goes back to prog for anything it can't do
+	if (log->aot != 0)
+		return log->aot(log->code, log->scan_start);
+	return logic_prog_run(log->prog, log->scan_start);
+}
+
+// interpret the logic code at data until it returns
+u8 *logic_execute_at(u8 *data)
+{
+	logic_data = data;
 	
 	op = *(logic_data++);
 	while (op != 0)
@@ -216,11 +237,14 @@ static void skip_false_and()
 
 static void logic_cmd()
 {
+	u64 prof;
+
 	while (  (op < 0xFC) && (op != 0)  )
 	{
 		if ( op > CMD_MAX)
 			set_agi_error(0x10, op);
 
+		TRACE_RING_ADD(logic_cur, op, logic_data - 1, TRACE_RING_CMD);
 		if ( trace_state == 1)
 			trace_cmd(op, logic_data);	// does not touch AX
 
@@ -229,6 +253,7 @@ static void logic_cmd()
 		print_hex_array(logic_data, cmd_table[op].param_total);
 		printf(")\n");
 		#endif
+		prof = profile_detail_now();
 		if (cmd_table[op].func != cmd_do_nothing)	// ADDED
 			logic_data = ((CMD_TYPE)cmd_table[op].func)(logic_data);
 		//cmd_table[op].func.cmd(logic_data);
@@ -238,6 +263,7 @@ static void logic_cmd()
 			printf("no cmd=\"%s\"\n", cmd_table[op].func_name);
 			logic_data += cmd_table[op].param_total;	// ADDED
 		}
+		profile_cmd(op, prof);
 		
 		if (logic_data == 0) 
 			break;
@@ -256,6 +282,7 @@ static u8 logic_eval()
 	data_orig = logic_data - 1;
 	if ( op > 19)
 		set_agi_error(0xF, op);
+	TRACE_RING_ADD(logic_cur, op, data_orig, TRACE_RING_TEST);
 	
 	#if LOG_DEBUG
 	printf("%d:0x%X %s (", logic_cur->num, logic_data - logic_cur->data, eval_table[op].func_name);
@@ -2,6 +2,7 @@
 #define NAGI_LOGIC_LOGIC_EXECUTE_H
 
 extern u8 *logic_execute(LOGIC *log);
+extern u8 *logic_execute_at(u8 *data);
 
 extern u8 *logic_data;	// si;
 
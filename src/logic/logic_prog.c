@@ -0,0 +1,624 @@
+/*
+Predecoded logic code
+
+the first time a logic runs its code is decoded once into an array of ops:
+commands with their function already looked up, gotos with their target
+resolved, and each if() turned into a chain of tests that know where to go
+when they're true or false.. no more walking the condition bytes to skip
+over the rest of an "or" bracket or to find the end of the if.
+
+logic_prog_run() follows the ops but keeps everything the byte interpreter
+did: commands and tests get the same parameter pointers, logic_data is kept
+up to date and a command can still send the code anywhere it likes.
+whenever the code ends up somewhere that wasn't decoded (a jump into the
+middle of something, an odd if(), an unknown command) or tracing is on, the
+rest is handed over to logic_execute_at() as it always was.
+
+the pairs of ops that follow each other most (prog_fuse_table, from the
+pairs a NAGI_PROFILE build prints) become superinstructions: the simple
+commands and tests in them are done inline instead of through their
+function, and the first goes straight on to the second without another
+trip round the switch.  each still leaves the trace ring, the command
+profile and logic_data as its function would, and a jump into the
+middle of one lands on an op that works by itself.
+*/
+
+#define MEM_TAG MEM_RES
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../agi.h"
+
+#include "../logic/logic_base.h"
+#include "../logic/logic_execute.h"
+#include "../logic/logic_prog.h"
+#include "../logic/cmd_table.h"
+#include "../logic/arithmetic.h"
+#include "../logic/logic_eval.h"
+#include "../logic/llm.h"
+#include "../flags.h"
+
+#include "../sys/endian.h"
+#include "../sys/mem_wrap.h"
+
+#include "../trace.h"
+#include "../sys/profile.h"
+#include "../sys/trace_ring.h"
+
+#define PROG_SAID 0x0E
+#define PROG_FAIL 0xFFFE	// an "or" bracket that ran out of tests
+
+// what a superinstruction does inline, commands then tests
+#define SUPER_NONE 0
+#define SUPER_INCREMENT 1
+#define SUPER_DECREMENT 2
+#define SUPER_ASSIGNN 3
+#define SUPER_SET 4
+#define SUPER_RESET 5
+#define SUPER_EQUALN 6
+#define SUPER_LESSN 7
+#define SUPER_GREATERN 8
+#define SUPER_ISSET 9
+#define SUPER_TEST SUPER_EQUALN
+
+// the pairs fused.  the commands and tests they're made of are the ones
+// that fill the top of a profile build's pair list (flags, counters and
+// their tests in logic 0 and the rooms), check it when adding more
+static const u8 prog_fuse_table[][2] =
+{
+	{SUPER_ISSET, SUPER_ISSET},
+	{SUPER_ISSET, SUPER_ASSIGNN},
+	{SUPER_ISSET, SUPER_RESET},
+	{SUPER_ISSET, SUPER_SET},
+	{SUPER_EQUALN, SUPER_ISSET},
+	{SUPER_EQUALN, SUPER_ASSIGNN},
+	{SUPER_EQUALN, SUPER_SET},
+	{SUPER_EQUALN, SUPER_RESET},
+	{SUPER_RESET, SUPER_RESET},
+	{SUPER_SET, SUPER_SET},
+	{SUPER_RESET, SUPER_SET},
+	{SUPER_SET, SUPER_RESET},
+	{SUPER_ASSIGNN, SUPER_ASSIGNN},
+	{SUPER_INCREMENT, SUPER_GREATERN},
+	{SUPER_INCREMENT, SUPER_EQUALN},
+	{SUPER_DECREMENT, SUPER_EQUALN},
+	{SUPER_ASSIGNN, SUPER_SET},
+	{SUPER_RESET, SUPER_ASSIGNN},
+	{SUPER_GREATERN, SUPER_LESSN},
+};
+
+#define PROG_FUSE_TOTAL (sizeof(prog_fuse_table) / sizeof(prog_fuse_table[0]))
+
+#ifdef NAGI_PROFILE
+// the op run before, for the pair counts
+static LOGIC_OP *prog_last = 0;
+
+static u16 prog_key(const LOGIC_OP *o)
+{
+	if ( (o->kind == LOGIC_OP_TEST) || ((o->kind == LOGIC_OP_SUPER) && (o->super >= SUPER_TEST)) )
+		return PROFILE_PAIR_TEST | o->code;
+	return o->code;
+}
+
+// count o after the op before it
+#define PROG_PAIR(o) do { if (prog_last + 1 == (o)) profile_pair(prog_key(prog_last), prog_key(o)); \
+				prog_last = (o); } while (0)
+#else
+#define PROG_PAIR(o) ((void)0)
+#endif
+
+static u16 prog_find(LOGIC_PROG *prog, u8 *p)
+{
+	if ( (p < prog->code) || (p >= prog->code + prog->size) )
+		return LOGIC_OP_NONE;
+	return prog->map[p - prog->code];
+}
+
+static LOGIC_OP *prog_op(LOGIC_OP *op, u16 *total, u8 kind, u8 code, u8 *at)
+{
+	LOGIC_OP *o;
+
+	o = op + (*total)++;
+	memset(o, 0, sizeof(LOGIC_OP));
+	o->kind = kind;
+	o->code = code;
+	o->at = at;
+	o->next = LOGIC_OP_NONE;
+	o->jump = LOGIC_OP_NONE;
+	return o;
+}
+
+// where execute_if() would carry on from item n.. the next test, the body
+// or the else
+static void prog_if_target(const u16 *item, u16 item_total, u16 n,
+				u8 *body, u8 *other, u8 **at, u16 *index)
+{
+	if (n >= item_total)
+		*at = body;
+	else if (item[n] == PROG_FAIL)
+		*at = other;
+	else
+	{
+		*at = 0;
+		*index = item[n];
+	}
+}
+
+// decode the if() whose 0xFF is at "at" into tests.  works out the "or"
+// and "not" state at each test the same way execute_if() does as it goes.
+// returns where the code carries on or 0 if it can't be done.
+static u8 *prog_if(LOGIC_OP *op, u16 *total, u16 *item, u16 *group, u8 *at, u8 *end)
+{
+	LOGIC_OP *o;
+	u8 *p, *body, *other;
+	u16 base, item_total, or_group, group_total, n, m;
+	u8 code, not_mode, or_mode;
+
+	base = *total;
+	item_total = 0;
+	group_total = 0;
+	or_group = 0;
+	not_mode = 0;
+	or_mode = 0;
+	p = at + 1;
+
+	for (;;)
+	{
+		if (p >= end)
+			return 0;
+		code = *(p++);
+		if (code == 0xFF)
+		{
+			// execute_if() would call it true but skip_true_or() would
+			// go straight past it
+			if (or_mode != 0)
+				return 0;
+			break;
+		}
+		else if (code == 0xFD)
+			not_mode ^= 1;
+		else if (code == 0xFC)
+		{
+			if (or_mode != 0)
+			{
+				// only get here by running out of tests.. a true
+				// test skips past it with not_mode cleared
+				item[item_total] = PROG_FAIL;
+				group[item_total++] = or_group;
+				or_mode = 0;
+				not_mode = 0;
+			}
+			else
+			{
+				or_mode = 1;
+				or_group = ++group_total;
+			}
+		}
+		else if (code <= EVAL_MAX)
+		{
+			o = prog_op(op, total, LOGIC_OP_TEST, code, (item_total == 0) ? at : 0);
+			if (eval_table[code].func != cmd_ret_false)
+				o->func = eval_table[code].func;
+			o->param = p;
+			o->flags = not_mode ? LOGIC_OP_NOT : 0;
+			if (code == PROG_SAID)
+			{
+				if (p >= end)
+					return 0;
+				p += (*p << 1) + 1;
+			}
+			else
+				p += eval_table[code].param_total;
+			if (p > end)
+				return 0;
+			item[item_total] = (u16)(o - op);
+			group[item_total++] = or_mode ? or_group : 0;
+			not_mode = 0;
+		}
+		else
+			return 0;
+	}
+
+	if (p + 2 > end)
+		return 0;
+	body = p + 2;
+	other = p + 2 + load_le_16(p);
+
+	// nothing to test (or a bracket with nothing in it first)
+	if ( (item_total == 0) || (item[0] == PROG_FAIL) )
+	{
+		*total = base;
+		o = prog_op(op, total, LOGIC_OP_GOTO, 0xFF, at);
+		prog_if_target(item, item_total, 0, body, other, &o->jump_at, &o->jump);
+		return body;
+	}
+
+	for (n = 0; n < item_total; n++)
+	{
+		if (item[n] == PROG_FAIL)
+			continue;
+		o = op + item[n];
+		if (group[n] == 0)
+		{
+			prog_if_target(item, item_total, n + 1, body, other, &o->next_at, &o->next);
+			o->jump_at = other;
+		}
+		else
+		{
+			// true skips the rest of the bracket, false tries the next
+			for (m = n + 1; m < item_total; m++)
+				if ( (item[m] == PROG_FAIL) && (group[m] == group[n]) )
+					break;
+			prog_if_target(item, item_total, m + 1, body, other, &o->next_at, &o->next);
+			prog_if_target(item, item_total, n + 1, body, other, &o->jump_at, &o->jump);
+		}
+	}
+	return body;
+}
+
+// the inline version of a command or test.  only the functions themselves,
+// a game's own table might put something else behind the opcode
+static u8 prog_super_code(const LOGIC_OP *o)
+{
+	if (o->kind == LOGIC_OP_CMD)
+	{
+		if (o->func == (void *)cmd_increment)
+			return SUPER_INCREMENT;
+		if (o->func == (void *)cmd_decrement)
+			return SUPER_DECREMENT;
+		if (o->func == (void *)cmd_assignn)
+			return SUPER_ASSIGNN;
+		if (o->func == (void *)cmd_set)
+			return SUPER_SET;
+		if (o->func == (void *)cmd_reset)
+			return SUPER_RESET;
+	}
+	else if (o->kind == LOGIC_OP_TEST)
+	{
+		if (o->func == (void *)cmd_equal_n)
+			return SUPER_EQUALN;
+		if (o->func == (void *)cmd_less_n)
+			return SUPER_LESSN;
+		if (o->func == (void *)cmd_greater_n)
+			return SUPER_GREATERN;
+		if (o->func == (void *)cmd_isset)
+			return SUPER_ISSET;
+	}
+	return SUPER_NONE;
+}
+
+// turn the pairs in prog_fuse_table into superinstructions.  pairs
+// overlap so a chain of set()s is run in one go
+static void prog_fuse(LOGIC_OP *op, u16 total)
+{
+	u16 i, n;
+
+	for (i = 0; i < total; i++)
+		op[i].super = prog_super_code(op + i);
+
+	for (i = 0; i + 1 < total; i++)
+	{
+		if ( (op[i].super == SUPER_NONE) || (op[i + 1].super == SUPER_NONE) )
+			continue;
+		// only if the second can follow the first
+		if ( (op[i].next != i + 1) && (op[i].jump != i + 1) )
+			continue;
+		for (n = 0; n < PROG_FUSE_TOTAL; n++)
+			if ( (prog_fuse_table[n][0] == op[i].super) &&
+				(prog_fuse_table[n][1] == op[i + 1].super) )
+				break;
+		if (n == PROG_FUSE_TOTAL)
+			continue;
+		op[i].kind = LOGIC_OP_SUPER;
+		op[i].flags |= LOGIC_OP_FUSE;
+		op[i + 1].kind = LOGIC_OP_SUPER;
+	}
+}
+
+// decode a logic's code from the start until it ends or something can't
+// be decoded
+LOGIC_PROG *logic_prog_new(LOGIC *log)
+{
+	LOGIC_PROG *prog;
+	LOGIC_OP *op, *o;
+	u16 *item, *group;
+	u8 *p, *at, *end, *after;
+	u16 total, i;
+	u8 code;
+
+	prog = (LOGIC_PROG *)a_malloc(sizeof(LOGIC_PROG));
+	prog->code = log->code;
+	prog->size = load_le_16(log->data);
+	prog->map = (u16 *)a_malloc((prog->size + 1) * sizeof(u16));
+	memset(prog->map, 0xFF, (prog->size + 1) * sizeof(u16));
+
+	// every op takes at least a byte
+	op = (LOGIC_OP *)a_malloc((prog->size + 1) * sizeof(LOGIC_OP));
+	item = (u16 *)a_malloc((prog->size + 1) * sizeof(u16));
+	group = (u16 *)a_malloc((prog->size + 1) * sizeof(u16));
+	total = 0;
+
+	p = prog->code;
+	end = prog->code + prog->size;
+	while (p < end)
+	{
+		at = p;
+		code = *(p++);
+		prog->map[at - prog->code] = total;
+
+		if (code == 0)
+		{
+			o = prog_op(op, &total, LOGIC_OP_RETURN, code, at);
+			o->next_at = p;
+		}
+		else if (code == 0xFF)		// if
+		{
+			i = total;
+			after = prog_if(op, &total, item, group, at, end);
+			if (after == 0)
+			{
+				total = i;
+				prog_op(op, &total, LOGIC_OP_BYTES, code, at);
+				break;
+			}
+			p = after;
+		}
+		else if ( (code == 0xFE) && (p + 2 <= end) )	// else goto
+		{
+			o = prog_op(op, &total, LOGIC_OP_GOTO, code, at);
+			o->jump_at = p + (s16)load_le_16(p) + 2;
+			p += 2;
+		}
+		else if ( (code <= CMD_MAX) && (p + cmd_table[code].param_total <= end) )
+		{
+			o = prog_op(op, &total, LOGIC_OP_CMD, code, at);
+			if (cmd_table[code].func != cmd_do_nothing)
+				o->func = cmd_table[code].func;
+			o->param = p;
+			p += cmd_table[code].param_total;
+			o->next_at = p;
+		}
+		else
+		{
+			// let logic_execute_at() deal with it
+			prog_op(op, &total, LOGIC_OP_BYTES, code, at);
+			break;
+		}
+	}
+
+	// everything decoded so the byte targets can be turned into ops
+	for (i = 0; i < total; i++)
+	{
+		o = op + i;
+		if ( (o->next == LOGIC_OP_NONE) && (o->next_at != 0) )
+			o->next = prog_find(prog, o->next_at);
+		if ( (o->jump == LOGIC_OP_NONE) && (o->jump_at != 0) )
+			o->jump = prog_find(prog, o->jump_at);
+	}
+
+	prog_fuse(op, total);
+
+	prog->op_total = total;
+	prog->op = (LOGIC_OP *)a_malloc((total + 1) * sizeof(LOGIC_OP));
+	memcpy(prog->op, op, total * sizeof(LOGIC_OP));
+	a_free(group);
+	a_free(item);
+	a_free(op);
+	return prog;
+}
+
+u8 logic_op_kind(const LOGIC_OP *o)
+{
+	if (o->kind != LOGIC_OP_SUPER)
+		return o->kind;
+	return (o->super >= SUPER_TEST) ? LOGIC_OP_TEST : LOGIC_OP_CMD;
+}
+
+void logic_prog_free(LOGIC_PROG *prog)
+{
+	if (prog == 0)
+		return;
+	a_free(prog->op);
+	a_free(prog->map);
+	a_free(prog);
+}
+
+// run superinstruction i and whatever's fused after it.  returns the
+// next op, at is where that is in the code
+static u16 prog_super(LOGIC_PROG *prog, u16 i, u8 **at)
+{
+	LOGIC_OP *o;
+	u8 *param;
+	u16 next;
+	u8 result;
+	u64 prof;
+
+	for (;;)
+	{
+		o = prog->op + i;
+		// trace_eval() wants the bytes, as for any other op
+		if ( (o->at != 0) && (trace_state == 1) )
+		{
+			*at = o->at;
+			return LOGIC_OP_NONE;
+		}
+		PROG_PAIR(o);
+		param = o->param;
+
+		if (o->super < SUPER_TEST)
+		{
+			TRACE_RING_ADD(logic_cur, o->code, o->at, TRACE_RING_CMD);
+			prof = profile_detail_now();
+			switch (o->super)
+			{
+				case SUPER_INCREMENT:
+					if (state.var[param[0]] < 0xFF)
+						state.var[param[0]]++;
+					LLM_VAR_WRITE(param[0]);
+					break;
+				case SUPER_DECREMENT:
+					if (state.var[param[0]] != 0x00)
+						state.var[param[0]]--;
+					LLM_VAR_WRITE(param[0]);
+					break;
+				case SUPER_ASSIGNN:
+					state.var[param[0]] = param[1];
+					LLM_VAR_WRITE(param[0]);
+					break;
+				case SUPER_SET:
+					flag_set(param[0]);
+					break;
+				default:
+					flag_reset(param[0]);
+					break;
+			}
+			profile_cmd(o->code, prof);
+			logic_data = o->next_at;
+			next = o->next;
+			*at = o->next_at;
+		}
+		else
+		{
+			TRACE_RING_ADD(logic_cur, o->code, param - 1, TRACE_RING_TEST);
+			switch (o->super)
+			{
+				case SUPER_EQUALN:
+					result = (state.var[param[0]] == param[1]);
+					logic_data = param + 2;
+					break;
+				case SUPER_LESSN:
+					result = (state.var[param[0]] < param[1]);
+					logic_data = param + 2;
+					break;
+				case SUPER_GREATERN:
+					result = (state.var[param[0]] > param[1]);
+					logic_data = param + 2;
+					break;
+				default:
+					result = flag_test(param[0]);
+					logic_data = param + 1;
+					break;
+			}
+			if ( (result ^ (o->flags & LOGIC_OP_NOT)) != 0 )
+			{
+				next = o->next;
+				*at = o->next_at;
+			}
+			else
+			{
+				next = o->jump;
+				*at = o->jump_at;
+			}
+		}
+
+		if ( ((o->flags & LOGIC_OP_FUSE) == 0) || (next != i + 1) )
+			return next;
+		i = next;
+	}
+}
+
+// run the logic from "start" until it returns, same result as
+// logic_execute_at()
+u8 *logic_prog_run(LOGIC_PROG *prog, u8 *start)
+{
+	LOGIC_OP *o;
+	u8 *p;
+	u16 i;
+	u8 result;
+	u64 prof;
+	u32 ops;
+
+	p = start;
+	i = prog_find(prog, p);
+	ops = 0;
+
+	while (i != LOGIC_OP_NONE)
+	{
+		o = prog->op + i;
+		ops++;
+		switch (o->kind)
+		{
+			case LOGIC_OP_RETURN:
+				profile_ops(logic_cur->num, ops);
+				logic_data = o->next_at;
+				return logic_data;
+
+			case LOGIC_OP_SUPER:
+				i = prog_super(prog, i, &p);
+				break;
+
+			case LOGIC_OP_CMD:
+				if (trace_state == 1)
+				{
+					p = o->at;
+					i = LOGIC_OP_NONE;
+					break;
+				}
+				PROG_PAIR(o);
+				TRACE_RING_ADD(logic_cur, o->code, o->at, TRACE_RING_CMD);
+				logic_data = o->param;
+				prof = profile_detail_now();
+				if (o->func != 0)
+					p = ((CMD_TYPE)o->func)(o->param);
+				else
+				{
+					printf("no cmd=\"%s\"\n", cmd_table[o->code].func_name);
+					p = o->next_at;
+				}
+				profile_cmd(o->code, prof);
+				logic_data = p;
+				if (p == 0)
+				{
+					profile_ops(logic_cur->num, ops);
+					return 0;
+				}
+				i = (p == o->next_at) ? o->next : prog_find(prog, p);
+				break;
+
+			case LOGIC_OP_TEST:
+				// trace_eval() wants the bytes
+				if ( (o->at != 0) && (trace_state == 1) )
+				{
+					p = o->at;
+					i = LOGIC_OP_NONE;
+					break;
+				}
+				PROG_PAIR(o);
+				// the opcode's just before the parameters
+				TRACE_RING_ADD(logic_cur, o->code, o->param - 1, TRACE_RING_TEST);
+				logic_data = o->param;
+				if (o->func != 0)
+					result = ((EVAL_TYPE)o->func)();
+				else
+				{
+					printf("no eval=\"%s\"    \n", eval_table[o->code].func_name);
+					result = 0;
+				}
+				if ( (result ^ (o->flags & LOGIC_OP_NOT)) != 0 )
+				{
+					p = o->next_at;
+					i = o->next;
+				}
+				else
+				{
+					p = o->jump_at;
+					i = o->jump;
+				}
+				break;
+
+			case LOGIC_OP_GOTO:
+				p = o->jump_at;
+				i = o->jump;
+				break;
+
+			default:
+				p = o->at;
+				i = LOGIC_OP_NONE;
+				break;
+		}
+	}
+
+	profile_ops(logic_cur->num, ops);
+	return logic_execute_at(p);
+}
@@ -0,0 +1,55 @@
+#ifndef NAGI_LOGIC_LOGIC_PROG_H
+#define NAGI_LOGIC_LOGIC_PROG_H
+
+/* STRUCTURES	---	---	---	---	---	---	--- */
+
+#define LOGIC_OP_NONE 0xFFFF
+
+// what a logic op does
+#define LOGIC_OP_RETURN 0
+#define LOGIC_OP_CMD 1
+#define LOGIC_OP_TEST 2
+#define LOGIC_OP_GOTO 3
+#define LOGIC_OP_BYTES 4	// hand the rest over to logic_execute_at()
+#define LOGIC_OP_SUPER 5	// a command or test run inline, with the ones fused after it
+
+// a test that's true when its eval is false
+#define LOGIC_OP_NOT 0x01
+// a superinstruction that goes straight on to the next op when it's next
+#define LOGIC_OP_FUSE 0x02
+
+// one predecoded command, goto or if() test
+struct logic_op_struct
+{
+	void *func;		// the cmd_table/eval_table function, 0 if there's none
+	u8 *at;			// its opcode in the logic, 0 for tests after an if's first
+	u8 *param;		// its parameters
+	u8 *next_at;		// where it carries on (a test: where it goes if true)
+	u8 *jump_at;		// where a goto or false test goes
+	u16 next;		// next_at and jump_at as ops, LOGIC_OP_NONE if they
+	u16 jump;		// don't start one
+	u8 kind;
+	u8 code;		// the opcode
+	u8 flags;
+	u8 super;		// what a LOGIC_OP_SUPER does inline
+};
+typedef struct logic_op_struct LOGIC_OP;
+
+struct logic_prog_struct
+{
+	u8 *code;
+	u16 size;
+	u16 *map;		// op starting at each byte of code, LOGIC_OP_NONE if none
+	LOGIC_OP *op;
+	u16 op_total;
+};
+typedef struct logic_prog_struct LOGIC_PROG;
+
+/* FUNCTIONS	---	---	---	---	---	---	--- */
+extern LOGIC_PROG *logic_prog_new(LOGIC *log);
+extern void logic_prog_free(LOGIC_PROG *prog);
+extern u8 *logic_prog_run(LOGIC_PROG *prog, u8 *start);
+// an op's kind with superinstructions as the command or test they are
+extern u8 logic_op_kind(const LOGIC_OP *o);
+
+#endif /* NAGI_LOGIC_LOGIC_PROG_H */
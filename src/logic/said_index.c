@@ -0,0 +1,347 @@
+/*
+Static said() phrase index
+
+said_index_build() walks every LOGIC resource once the directories are
+loaded and keeps each distinct said() word list with the logics it is
+tested in.  call() targets make up a call graph: a room (the logic
+new.room loads) reaches the lists of every logic it calls, and whatever
+logic 0 reaches is tested in every room since it runs each cycle.
+call.v targets aren't known until run time so they aren't followed.
+
+the llm layer scores and embeds candidates from here instead of decoding
+bytecode inside cmd_said().  the index is kept in the game's cache file
+(game_cache.c) so it's only worked out on the first run.
+*/
+
+#define MEM_TAG MEM_CACHE
+
+#include <string.h>
+#include <stdio.h>
+
+#include "../agi.h"
+#include "said_index.h"
+
+#include "../logic/cmd_table.h"
+#include "../res/res.h"
+#include "../sys/endian.h"
+#include "../sys/game_cache.h"
+#include "../sys/mem_wrap.h"
+
+#define SAID_INDEX_LOGICS 256
+#define SAID_INDEX_SET (SAID_INDEX_LOGICS / 8)
+#define SAID_INDEX_HASH 256
+#define SAID_INDEX_GROW 128
+#define SAID_INDEX_CALL 0x16	// cmd.call
+// the cached index is thrown away when this or SAID_PHRASE changes
+#define SAID_INDEX_VERSION 1
+#define SAID_INDEX_KEY ((SAID_INDEX_VERSION << 16) | sizeof(SAID_PHRASE))
+
+#define SET_BIT(set, n) ((set)[(n) >> 3] |= (u8)(1 << ((n) & 7)))
+#define TEST_BIT(set, n) (((set)[(n) >> 3] >> ((n) & 7)) & 1)
+
+static SAID_PHRASE *said_phrase = 0;
+static int *said_next = 0;		// hash chains, -1 terminated
+static u16 said_phrase_total = 0;
+static u16 said_phrase_size = 0;
+static int said_bucket[SAID_INDEX_HASH];
+
+static u16 said_index_hash(u16 count, const u16 *words)
+{
+	u16 hash, w;
+
+	hash = count;
+	for (w = 0; w < count; w++)
+		hash = (hash * 31) + words[w];
+	return hash % SAID_INDEX_HASH;
+}
+
+static int said_index_lookup(u16 count, const u16 *words)
+{
+	int i;
+
+	if (said_phrase == 0)
+		return -1;
+	for (i = said_bucket[said_index_hash(count, words)]; i >= 0; i = said_next[i])
+		if ( (said_phrase[i].count == count) &&
+			(memcmp(said_phrase[i].words, words, count * sizeof(u16)) == 0) )
+			return i;
+	return -1;
+}
+
+// read a said() list from the logic code.  returns 0 if it's too long to keep
+static u16 said_index_words(const u8 *list, u16 *words)
+{
+	u16 w;
+
+	if ( (*list == 0) || (*list > SAID_INDEX_WORDS) )
+		return 0;
+	for (w = 0; w < *list; w++)
+		words[w] = load_le_16(list + 1 + (w<<1));
+	return *list;
+}
+
+static void said_index_add(u16 logic_num, const u8 *list)
+{
+	u16 words[SAID_INDEX_WORDS];
+	SAID_PHRASE *phrase;
+	u16 count, hash;
+	int i;
+
+	count = said_index_words(list, words);
+	if (count == 0)
+		return;
+
+	i = said_index_lookup(count, words);
+	if (i < 0)
+	{
+		if (said_phrase_total >= said_phrase_size)
+		{
+			SAID_PHRASE *grow_phrase;
+			int *grow_next;
+
+			if (said_phrase_size > 0xFFFF - SAID_INDEX_GROW)
+				return;
+			grow_phrase = a_malloc((said_phrase_size + SAID_INDEX_GROW) * sizeof(SAID_PHRASE));
+			grow_next = a_malloc((said_phrase_size + SAID_INDEX_GROW) * sizeof(int));
+			if (said_phrase != 0)
+			{
+				memcpy(grow_phrase, said_phrase, said_phrase_total * sizeof(SAID_PHRASE));
+				memcpy(grow_next, said_next, said_phrase_total * sizeof(int));
+				a_free(said_phrase);
+				a_free(said_next);
+			}
+			said_phrase = grow_phrase;
+			said_next = grow_next;
+			said_phrase_size += SAID_INDEX_GROW;
+		}
+
+		i = said_phrase_total++;
+		phrase = &said_phrase[i];
+		memset(phrase, 0, sizeof(SAID_PHRASE));
+		phrase->count = count;
+		memcpy(phrase->words, words, count * sizeof(u16));
+
+		hash = said_index_hash(count, words);
+		said_next[i] = said_bucket[hash];
+		said_bucket[hash] = i;
+	}
+
+	SET_BIT(said_phrase[i].logics, logic_num);
+}
+
+// walk one logic's code for said() lists and call() targets
+static void said_index_scan(u16 logic_num, u8 *data, u8 *calls)
+{
+	u8 *p, *end;
+	u8 code;
+
+	p = data + 2;	// skip header
+	end = p + load_le_16(data);
+
+	while (p < end)
+	{
+		code = *(p++);
+		if (code == 0xFF)	// if
+		{
+			while ( (p < end) && (*p != 0xFF) )
+			{
+				code = *(p++);
+				if ( (code == 0xFC) || (code == 0xFD) )	// or, not
+					continue;
+				if (code == 0x0E)	// said
+				{
+					said_index_add(logic_num, p);
+					p += 1 + (*p << 1);
+				}
+				else if (code <= EVAL_MAX)
+					p += eval_table[code].param_total;
+				else
+					return;
+			}
+			p += 3;	// closing 0xFF and the jump
+		}
+		else if (code == 0xFE)	// else goto
+			p += 2;
+		else if (code <= CMD_MAX)
+		{
+			if ( (code == SAID_INDEX_CALL) && (p < end) )
+				SET_BIT(calls, *p);
+			p += cmd_table[code].param_total;
+		}
+		else
+			return;
+	}
+}
+
+// every logic a room can get to through call()
+static void said_index_reach(u16 room, u8 (*calls)[SAID_INDEX_SET], u8 *reach)
+{
+	u16 stack[SAID_INDEX_LOGICS];
+	u16 top, logic_num, target;
+
+	memset(reach, 0, SAID_INDEX_SET);
+	SET_BIT(reach, room);
+	stack[0] = room;
+	top = 1;
+
+	while (top != 0)
+	{
+		logic_num = stack[--top];
+		for (target = 0; target < SAID_INDEX_LOGICS; target++)
+			if (TEST_BIT(calls[logic_num], target) && !TEST_BIT(reach, target))
+			{
+				SET_BIT(reach, target);
+				stack[top++] = target;
+			}
+	}
+}
+
+static u8 said_index_meets(const u8 *a, const u8 *b)
+{
+	u16 i;
+
+	for (i = 0; i < SAID_INDEX_SET; i++)
+		if (a[i] & b[i])
+			return 1;
+	return 0;
+}
+
+// the index from the cache file.  0 if it's not there
+static u8 said_index_cached(void)
+{
+	const SAID_PHRASE *cached;
+	size_t size;
+	u16 total, i, hash;
+
+	cached = (const SAID_PHRASE *)gcache_find(GCACHE_SAID, SAID_INDEX_KEY, &size);
+	if ( (cached == 0) || (size % sizeof(SAID_PHRASE) != 0) ||
+		(size / sizeof(SAID_PHRASE) > 0xFFFF - SAID_INDEX_GROW) )
+		return 0;
+	total = (u16)(size / sizeof(SAID_PHRASE));
+	for (i = 0; i < total; i++)
+		if ( (cached[i].count == 0) || (cached[i].count > SAID_INDEX_WORDS) )
+			return 0;
+
+	if (total != 0)
+	{
+		said_phrase = a_malloc(total * sizeof(SAID_PHRASE));
+		said_next = a_malloc(total * sizeof(int));
+		memcpy(said_phrase, cached, total * sizeof(SAID_PHRASE));
+	}
+	said_phrase_total = total;
+	said_phrase_size = total;
+	for (i = 0; i < total; i++)
+	{
+		hash = said_index_hash(said_phrase[i].count, said_phrase[i].words);
+		said_next[i] = said_bucket[hash];
+		said_bucket[hash] = i;
+	}
+	return 1;
+}
+
+void said_index_build(void)
+{
+	u8 (*calls)[SAID_INDEX_SET];
+	u8 reach[SAID_INDEX_SET];
+	u8 present[SAID_INDEX_SET];
+	u16 logic_total, logic_num, i;
+	u8 *dir_entry, *data;
+
+	said_index_free();
+	if (said_index_cached())
+	{
+		if (c_nagi_log_debug)
+			printf("Loaded %d said() phrases from the game cache\n", said_phrase_total);
+		return;
+	}
+
+	logic_total = dir_logic_count();
+	if (logic_total > SAID_INDEX_LOGICS)
+		logic_total = SAID_INDEX_LOGICS;
+
+	calls = a_malloc(SAID_INDEX_LOGICS * SAID_INDEX_SET);
+	memset(calls, 0, SAID_INDEX_LOGICS * SAID_INDEX_SET);
+	memset(present, 0, sizeof(present));
+
+	for (logic_num = 0; logic_num < logic_total; logic_num++)
+	{
+		dir_entry = dir_logic_find(logic_num);
+		if (dir_entry == 0)
+			continue;
+		data = vol_res_load(dir_entry, 0);
+		if (data == 0)
+			continue;
+		SET_BIT(present, logic_num);
+		said_index_scan(logic_num, data, calls[logic_num]);
+		a_free(data);
+	}
+
+	// logic 0 runs every cycle
+	said_index_reach(0, calls, reach);
+	for (i = 0; i < said_phrase_total; i++)
+		said_phrase[i].global = said_index_meets(said_phrase[i].logics, reach);
+
+	for (logic_num = 1; logic_num < logic_total; logic_num++)
+	{
+		if (!TEST_BIT(present, logic_num))
+			continue;
+		said_index_reach(logic_num, calls, reach);
+		for (i = 0; i < said_phrase_total; i++)
+			if (said_index_meets(said_phrase[i].logics, reach))
+				SET_BIT(said_phrase[i].rooms, logic_num);
+	}
+
+	a_free(calls);
+	gcache_store(GCACHE_SAID, SAID_INDEX_KEY, said_phrase, said_phrase_total * sizeof(SAID_PHRASE));
+	if (c_nagi_log_debug)
+		printf("Indexed %d said() phrases\n", said_phrase_total);
+}
+
+void said_index_free(void)
+{
+	if (said_phrase != 0)
+	{
+		a_free(said_phrase);
+		a_free(said_next);
+	}
+	said_phrase = 0;
+	said_next = 0;
+	said_phrase_total = 0;
+	said_phrase_size = 0;
+	memset(said_bucket, -1, sizeof(said_bucket));
+}
+
+u16 said_index_total(void)
+{
+	return said_phrase_total;
+}
+
+const SAID_PHRASE *said_index_get(u16 num)
+{
+	if (num >= said_phrase_total)
+		return 0;
+	return &said_phrase[num];
+}
+
+int said_index_find(const u8 *list)
+{
+	u16 words[SAID_INDEX_WORDS];
+	u16 count;
+
+	count = said_index_words(list, words);
+	if (count == 0)
+		return -1;
+	return said_index_lookup(count, words);
+}
+
+u8 said_index_in_logic(const SAID_PHRASE *phrase, u16 logic_num)
+{
+	return (logic_num < SAID_INDEX_LOGICS) && TEST_BIT(phrase->logics, logic_num);
+}
+
+u8 said_index_in_room(const SAID_PHRASE *phrase, u16 room)
+{
+	if (phrase->global)
+		return 1;
+	return (room < SAID_INDEX_LOGICS) && TEST_BIT(phrase->rooms, room);
+}
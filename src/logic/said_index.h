@@ -0,0 +1,33 @@
+#ifndef NAGI_LOGIC_SAID_INDEX_H
+#define NAGI_LOGIC_SAID_INDEX_H
+
+/* STRUCTURES	---	---	---	---	---	---	--- */
+
+// the longest said() word list kept, longer ones are skipped
+#define SAID_INDEX_WORDS 16
+
+// one distinct said() word list of the game
+struct said_phrase_struct
+{
+	u16 count;
+	u16 words[SAID_INDEX_WORDS];
+	u8 logics[32];		// bit per logic the list is tested in
+	u8 rooms[32];		// bit per room that reaches one of those logics
+	u8 global;			// reached from logic 0, so tested in every room
+};
+typedef struct said_phrase_struct SAID_PHRASE;
+
+/* FUNCTIONS	---	---	---	---	---	---	--- */
+// walk every logic of the game and collect its said() word lists
+extern void said_index_build(void);
+extern void said_index_free(void);
+
+extern u16 said_index_total(void);
+extern const SAID_PHRASE *said_index_get(u16 num);
+// index of a said() list as it sits in the logic code, or -1
+extern int said_index_find(const u8 *list);
+// is the phrase tested in this logic / can it be tested in this room
+extern u8 said_index_in_logic(const SAID_PHRASE *phrase, u16 logic_num);
+extern u8 said_index_in_room(const SAID_PHRASE *phrase, u16 room);
+
+#endif /* NAGI_LOGIC_SAID_INDEX_H */
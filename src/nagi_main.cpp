@@ -26,6 +26,7 @@ extern "C" {
 #include <stdlib.h>
 #include <stdio.h>
 #include <setjmp.h>
+#include <string.h>
 
 #include <SDL3/SDL.h>
 
@@ -45,7 +46,9 @@ extern "C" {
 #endif
 #include "ui/cmd_input.h"
 #include "logic/logic_base.h"
+#include "logic/llm.h"
 #include "sys/ini_config.h"
+#include "sys/mem_budget.h"
 #include "sys/mem_wrap.h"
 
 // extra
@@ -54,12 +57,22 @@ extern "C" {
 #include "sys/chargen.h"
 #include "ui/msg.h"
 #include "ui/window.h"
+#include "ui/msg_pretrans.h"
+#include "logic/logic_aot.h"
 #include "version/standard.h"
 #include "res/res.h"
+#include "state_rewind.h"
 
 #include "sys/sys_dir.h"
 
 #include "list.h"
+#include "base.h"
+#include "sys/profile.h"
+#include "sys/replay.h"
+#include "sys/startup.h"
+#include "sys/time.h"
+#include "sys/trace_ring.h"
+#include "sys/tune_llm.h"
 }
 
 /* PROTOTYPES	---	---	---	---	---	---	--- */
@@ -67,19 +80,86 @@ int main(int argc, char *argv[]);
 
 /* VARIABLES	---	---	---	---	---	---	--- */
 
-// Score before running logic scripts, to determine whether we update status bar
-static u16 old_score = 0;
-
 /* CODE	---	---	---	---	---	---	---	--- */
 int main(int argc, char *argv[])
 {
-	u16 snd_flag;
+	u64 prof;
+	u64 t = startup_now();
+	const char *pretrans_lang = 0;
+	u16 pack = 0;
+	u16 aot = 0;
+	u16 tune_llm = 0;
+	const char *tune_corpus = 0;
+	int n;
+	
+	for (;;)
+	{
+		// nagi --pretranslate <language> [game dir]
+		if ( (argc >= 3) && (strcmp(argv[1], "--pretranslate") == 0) )
+		{
+			pretrans_lang = argv[2];
+			n = 2;
+		}
+		// nagi --pack [game dir]
+		else if ( (argc >= 2) && (strcmp(argv[1], "--pack") == 0) )
+		{
+			pack = 1;
+			n = 1;
+		}
+		// nagi --aot [game dir]
+		else if ( (argc >= 2) && (strcmp(argv[1], "--aot") == 0) )
+		{
+			aot = 1;
+			n = 1;
+		}
+		// nagi --tune-llm [game dir]
+		else if ( (argc >= 2) && (strcmp(argv[1], "--tune-llm") == 0) )
+		{
+			tune_llm = 1;
+			n = 1;
+		}
+		// nagi --tune-corpus <corpus> [game dir]
+		else if ( (argc >= 3) && (strcmp(argv[1], "--tune-corpus") == 0) )
+		{
+			tune_llm = 1;
+			tune_corpus = argv[2];
+			n = 2;
+		}
+		// nagi --record <log> [game dir]
+		else if ( (argc >= 3) && (strcmp(argv[1], "--record") == 0) )
+		{
+			replay_open(argv[2], REPLAY_RECORD);
+			n = 2;
+		}
+		// nagi [--headless] --replay <log> [game dir]
+		else if ( (argc >= 3) && (strcmp(argv[1], "--replay") == 0) )
+		{
+			replay_open(argv[2], REPLAY_PLAY);
+			n = 2;
+		}
+		else if ( (argc >= 2) && (strcmp(argv[1], "--headless") == 0) )
+		{
+			replay_headless = 1;
+			n = 1;
+		}
+		else
+			break;
+		argv[n] = argv[0];
+		argv += n;
+		argc -= n;
+	}
 	
 	dir_init(argc, argv);
+	startup_phase("dir_init", t);
 
+	t = startup_now();
 	nagi_init();		// initialise NAGI
+	startup_phase("nagi_init", t);
 	
+	// game detection
+	t = startup_now();
 	standard_select_ng();
+	startup_phase("standard_select_ng", t);
 
 #if 0
 	if (argc > 1)
@@ -88,12 +168,47 @@ int main(int argc, char *argv[])
 		dir_preset_set_cwd(DIR_PRESET_GAME);
 #endif
 
+	t = startup_now();
 	agi_init();		// initialise AGI with version
+	startup_phase("agi_init", t);
+	
+	if (pretrans_lang != 0)
+	{
+		pretrans_build(pretrans_lang);
+		agi_exit();
+	}
+	
+	if (pack != 0)
+	{
+		pack_build();
+		agi_exit();
+	}
+
+	if (aot != 0)
+	{
+		aot_build();
+		agi_exit();
+	}
+
+	if (tune_llm != 0)
+	{
+		tune_llm_build(tune_corpus);
+		agi_exit();
+	}
+	
 	delay_init();	// initialise delay
+	trace_ring_init();
+	startup_done();
 	
 	printf("\nEntering main AGI loop...\n");
 	for (;;)
 	{
+		// game time up to the start of this cycle
+		clock_cycle();
+
+		// rewind or snapshot between cycles
+		state_rewind_cycle();
+
 		// reset all input vars
 		control_state_clear();
 		flag_reset(F02_PLAYERCMD);		// player has not issued command line
@@ -106,20 +221,25 @@ int main(int argc, char *argv[])
 		//input_poll();	// read the events and do something with them
 		
 		// do_delay now calls input_poll during delay to decrease key lag
+		replay_cycle();
+		prof = profile_now();
 		do_delay();
+		profile_sub(PROFILE_DELAY, prof);
+		replay_logic();
+		profile_cycle();
+		mem_budget_check();
 		
 		if (state.ego_control_state == 0)
-			state.var[V06_DIRECTION] = objtable->direction;	// program control
+			state.var[V06_DIRECTION] = OBJ_DIRECTION(objtable);	// program control
 		else
-			objtable->direction = state.var[V06_DIRECTION];	// player control
+			OBJ_DIRECTION(objtable) = state.var[V06_DIRECTION];	// player control
 		objs_dir_calc();
+		trace_ring_cycle_begin();
 		
-		old_score = state.var[V03_SCORE];
-		snd_flag = flag_test(F09_SOUND);	// is sound on?
-
 		// someone set us up the jump!
 		setjmp(agi_err_state);
 
+		prof = profile_now();
 		while (logic_call(0) == 0)	// logic 0
 		{
 			// comes here if we need to restart logic0
@@ -128,13 +248,15 @@ int main(int argc, char *argv[])
 			state.var[V05_OBJBORDER] = 0;
 			state.var[V04_OBJECT] = 0;
 			flag_reset(F02_PLAYERCMD);	// player has not issued command line
-			old_score = state.var[V03_SCORE];
 		} 
 
-		objtable->direction = state.var[V06_DIRECTION];
+		profile_sub(PROFILE_LOGIC, prof);
+		OBJ_DIRECTION(objtable) = state.var[V06_DIRECTION];
 
-		if ( (old_score!=state.var[V03_SCORE]) || (flag_test(F09_SOUND)!=snd_flag) )
-			status_line_write();
+		status_line_update();
+#ifdef NAGI_ENABLE_LLM
+		llm_watch_cycle();
+#endif
 
 		state.var[V05_OBJBORDER] = 0;
 		state.var[V04_OBJECT] = 0;
@@ -144,6 +266,11 @@ int main(int argc, char *argv[])
 
 		// update graphics if not in textmode		
 		if (chgen_textmode == 0)
+		{
+			prof = profile_now();
 			objtable_update();
+			profile_sub(PROFILE_OBJ, prof);
+		}
+		trace_ring_cycle_end();
 	}
 }
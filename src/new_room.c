@@ -19,6 +19,8 @@ _NewRoom                         cseg     00001792 0000011A
 // memory
 // script
 #include "sys/script.h"
+// update_var8
+#include "sys/memory.h"
 // lists new room (init.h)
 #include "initialise.h"
 // vt start
@@ -28,10 +30,16 @@ _NewRoom                         cseg     00001792 0000011A
 
 #include "new_room.h"
 
+#ifdef NAGI_ENABLE_LLM
+#include "llm_global.h"
+#endif
+
 
 #include "res/res.h"
 #include "ui/cmd_input.h"
 #include "logic/logic_base.h"
+#include "picture/pic_prerender.h"
+#include "ui/msg_pretrans.h"
 #include "trace.h"
 
 
@@ -62,16 +70,16 @@ u8 *new_room(u16 room_num)
 
 	for (si=objtable ; si<objtable_tail; si++)
 	{
-		si->flags &= ~(O_ANIMATE|O_DRAWN);
-		si->flags |= O_UPDATE;
+		OBJ_FLAGS(si) &= ~(O_ANIMATE|O_DRAWN);
+		OBJ_FLAGS(si) |= O_UPDATE;
 		si->cel_data = 0;
 		si->view_data = 0;
 		si->blit = 0;
-		si->step_time = 1;
-		si->step_count = 1;
-		si->cycle_count = 1;
-		si->cycle_time = 1;
-		si->step_size = 1;
+		OBJ_STEP_TIME(si) = 1;
+		OBJ_STEP_COUNT(si) = 1;
+		OBJ_CYCLE_COUNT(si) = 1;
+		OBJ_CYCLE_TIME(si) = 1;
+		OBJ_STEP_SIZE(si) = 1;
 	}
 
 	// VERSION THREE
@@ -89,19 +97,24 @@ u8 *new_room(u16 room_num)
 
 	state.var[V01_OLDROOM] = state.var[V00_ROOM0];
 	state.var[V00_ROOM0] = room_num;
+	#ifdef NAGI_ENABLE_LLM
+	llm_context_on_room_change(g_llm_session, state.var[V01_OLDROOM], room_num);
+	#endif
 	printf("[NEW_ROOM] Set room var[0] = %d, state.var addr = %p, &state = %p\n",
 	       room_num, (void*)state.var, (void*)&state);
 	state.var[V05_OBJBORDER] = 0;
 	state.var[V04_OBJECT] = 0;
 	state.var[V16_EGOVIEWRES] = objtable->view_cur;
 
-	state.var[V08_FREEMEM] = 10;
+	update_var8();
 	printf("[NEW_ROOM] Before logic_load: var[0] = %d\n", state.var[0]);
 
 	// not in v2.936 and later
 	//volumes_close();
 
 	logic_load(room_num);
+	pic_prerender_room(room_num);
+	pretrans_room(room_num);
 	printf("[NEW_ROOM] After logic_load: var[0] = %d\n", state.var[0]);
 	if (trace_logic != 0)
 	{
@@ -111,16 +124,16 @@ u8 *new_room(u16 room_num)
 	switch(state.var[V02_BORDER])
 	{
 		case 1:	// move to bottom
-			objtable->y = 0xA7;
+			OBJ_Y(objtable) = 0xA7;
 			break;
 		case 2:	// move to left
-			objtable->x = 0;
+			OBJ_X(objtable) = 0;
 			break;
 		case 3:	// move to top
-			objtable->y = 0x25;
+			OBJ_Y(objtable) = 0x25;
 			break;
 		case 4:	// move to right
-			objtable->x = 0xA0 - objtable->x_size;
+			OBJ_X(objtable) = 0xA0 - objtable->x_size;
 			break;
 	}
 	
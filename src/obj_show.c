@@ -39,7 +39,7 @@ static void obj_show(u16 view_num)
 	u16 obj_displayed;
 	u16 view_loaded;	// 1=view exists
 	
-	VIEW obj_view;
+	VIEW *obj_view;
 	//u16 temp2f;	// 0-1	// steptime
 	//u8 temp2d;		// 2	// num
 	//u16 temp2c;	// 3	// x
@@ -60,6 +60,7 @@ static void obj_show(u16 view_num)
 	VIEW_NODE *si;
 	
 	script_block();
+	obj_view = obj_loose(OBJ_LOOSE_SHOW);
 	obj_displayed = 0;
 	view_loaded = (view_find(view_num) != 0);
 	
@@ -73,30 +74,30 @@ static void obj_show(u16 view_num)
 	{
 		free_mem_check = 0;
 		
-		obj_view.cel_cur = 0;
-		obj_view.loop_cur = 0;
-		obj_view_set(&obj_view, view_num);
+		obj_view->cel_cur = 0;
+		obj_view->loop_cur = 0;
+		obj_view_set(obj_view, view_num);
 		
-		//obj_view.cel_data_prev = obj_view.cel_data;  // removed because of kq4 bug
-		obj_view.cel_prev_height = obj_view.cel_data[1];
-		obj_view.cel_prev_width = obj_view.cel_data[0];
-		obj_view.x_prev = (159-obj_view.x_size)/2;
-		obj_view.x = obj_view.x_prev;
-		obj_view.y_prev = 167;
-		obj_view.y = 167;
-		obj_view.priority = 0xF;
-		obj_view.flags = obj_view.flags | O_PRIFIXED;
-		obj_view.num = 0xFF;
+		//obj_view->cel_data_prev = obj_view->cel_data;  // removed because of kq4 bug
+		obj_view->cel_prev_height = obj_view->cel_data[1];
+		obj_view->cel_prev_width = obj_view->cel_data[0];
+		obj_view->x_prev = (159-obj_view->x_size)/2;
+		OBJ_X(obj_view) = obj_view->x_prev;
+		obj_view->y_prev = 167;
+		OBJ_Y(obj_view) = 167;
+		obj_view->priority = 0xF;
+		OBJ_FLAGS(obj_view) = OBJ_FLAGS(obj_view) | O_PRIFIXED;
+		obj_view->num = 0xFF;
 		
-		obj_size = obj_view.y_size * obj_view.x_size + sizeof(BLIT);
+		obj_size = obj_view->y_size * obj_view->x_size + sizeof(BLIT);
 		update_var8();
 		//if ( update_var8() > obj_size)
 		{
 			obj_displayed = 1;
-			obj_bg_area = blit_new(&obj_view);
+			obj_bg_area = blit_new(obj_view);
 			blit_save(obj_bg_area);
-			obj_blit(&obj_view);
-			obj_cel_update(&obj_view);
+			obj_blit(obj_view);
+			obj_cel_update(obj_view);
 		}
 		
 		si = view_find(view_num);
@@ -106,7 +107,7 @@ static void obj_show(u16 view_num)
 		if (obj_displayed != 0)
 		{
 			blit_restore(obj_bg_area);
-			obj_cel_update(&obj_view);
+			obj_cel_update(obj_view);
 			if (obj_bg_area->buffer != 0)
 			{
 				a_free(obj_bg_area->buffer);
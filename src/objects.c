@@ -8,6 +8,9 @@ CmdGetRoomV                      cseg     0000751B 0000002B
 _Get                             cseg     00007546 00000056
 _GetV                            cseg     0000759C 00000064
 */
+
+#define MEM_TAG MEM_TEXT
+
 #include <string.h>
 #include <assert.h>
 #include "agi.h"
@@ -0,0 +1,300 @@
+/*
+Rendered picture cache
+
+keeps gfx_picbuff as it is straight after a draw.pic or overlay.pic so
+a room that's visited again doesn't run the whole command stream and its
+flood fills.  an entry is keyed by the draw.pic number followed by each
+overlay.pic on top of it.  add.to.pic draws into the buffer so the chain
+isn't cached again until the next draw.pic.
+
+entries go least recently used first, when every entry is taken or the
+cache budget (mem_budget.c) wants the memory.  discard.pic only throws
+away the picture's entries when every entry is taken.
+
+what the budget takes is lz4 compressed first (a room is mostly runs of
+one colour) and only thrown away when the budget wants that memory too.
+a hit on a packed entry unpacks it straight into gfx_picbuff, a few
+microseconds against a whole render, and leaves it packed.
+*/
+
+#define MEM_TAG MEM_CACHE
+
+#include <string.h>
+
+#include "../agi.h"
+
+#include "../picture/pic_cache.h"
+#include "../view/obj_picbuff.h"
+
+#include "../sys/drv_video.h"
+#include "../sys/gfx.h"
+#include "../sys/lz4.h"
+#include "../sys/mem_wrap.h"
+
+#define PIC_CACHE_SIZE (PICBUFF_WIDTH*PICBUFF_HEIGHT)
+
+struct pic_cache_struct
+{
+	u8 chain[PIC_CACHE_CHAIN];
+	u8 len;			// 0 if the entry is free
+	u32 used;		// lru stamp
+	Uint64 used_ms;
+	u8 *buff;
+	u16 packed;		// bytes of lz4 in buff, 0 if it's plain
+};
+typedef struct pic_cache_struct PIC_CACHE;
+
+static PIC_CACHE pic_cache[PIC_CACHE_ENTRIES];
+static u32 pic_cache_stamp = 0;
+
+// what's in gfx_picbuff right now
+static u8 cur_chain[PIC_CACHE_CHAIN];
+static u8 cur_len = 0;		// 0 if it can't be cached
+
+// draw.pic and overlay.pic answered from the cache or not, for the hud
+u32 pic_cache_hits = 0;
+u32 pic_cache_misses = 0;
+
+void pic_cache_init()
+{
+	pic_cache_free();
+}
+
+static void pic_cache_drop(PIC_CACHE *c)
+{
+	if (c->buff != 0)
+		a_free(c->buff);
+	c->buff = 0;
+	c->len = 0;
+	c->packed = 0;
+}
+
+void pic_cache_free()
+{
+	int i;
+
+	for (i = 0; i < PIC_CACHE_ENTRIES; i++)
+		pic_cache_drop(&pic_cache[i]);
+	pic_cache_stamp = 0;
+	cur_len = 0;
+}
+
+static PIC_CACHE *pic_cache_find()
+{
+	int i;
+
+	if (cur_len == 0)
+		return 0;
+	for (i = 0; i < PIC_CACHE_ENTRIES; i++)
+		if ( (pic_cache[i].len == cur_len) &&
+			(memcmp(pic_cache[i].chain, cur_chain, cur_len) == 0) )
+			return &pic_cache[i];
+	return 0;
+}
+
+static u8 pic_cache_hit()
+{
+	PIC_CACHE *c;
+
+	c = pic_cache_find();
+	if (c == 0)
+	{
+		pic_cache_misses++;
+		return 0;
+	}
+	if (c->packed == 0)
+		memcpy(gfx_picbuff, c->buff, PIC_CACHE_SIZE);
+	else if (lz4_decompress(c->buff, c->packed, gfx_picbuff, PIC_CACHE_SIZE) != PIC_CACHE_SIZE)
+	{
+		// nothing's been drawn yet, the picture's rendered as if it missed
+		pic_cache_drop(c);
+		pic_cache_misses++;
+		return 0;
+	}
+	pic_cache_hits++;
+	obj_ctl_invalidate();
+	c->used = ++pic_cache_stamp;
+	c->used_ms = SDL_GetTicks();
+	return 1;
+}
+
+u8 pic_cache_draw(u16 pic_num)
+{
+	cur_chain[0] = (u8)pic_num;
+	cur_len = 1;
+	return pic_cache_hit();
+}
+
+u8 pic_cache_overlay(u16 pic_num)
+{
+	if ( (cur_len == 0) || (cur_len >= PIC_CACHE_CHAIN) )
+	{
+		cur_len = 0;
+		pic_cache_misses++;
+		return 0;
+	}
+	cur_chain[cur_len++] = (u8)pic_num;
+	return pic_cache_hit();
+}
+
+// a free entry or the least recently used one
+static PIC_CACHE *pic_cache_victim()
+{
+	PIC_CACHE *c;
+	int i;
+
+	c = &pic_cache[0];
+	for (i = 0; i < PIC_CACHE_ENTRIES; i++)
+	{
+		if (pic_cache[i].len == 0)
+			return &pic_cache[i];
+		if (pic_cache[i].used < c->used)
+			c = &pic_cache[i];
+	}
+	return c;
+}
+
+void pic_cache_store()
+{
+	PIC_CACHE *c;
+
+	if ( (cur_len == 0) || (pic_cache_find() != 0) )
+		return;
+
+	c = pic_cache_victim();
+	if (c->packed != 0)
+		pic_cache_drop(c);
+	if (c->buff == 0)
+		c->buff = (u8 *)a_malloc(PIC_CACHE_SIZE);
+	memcpy(c->buff, gfx_picbuff, PIC_CACHE_SIZE);
+	memcpy(c->chain, cur_chain, cur_len);
+	c->len = cur_len;
+	c->used = ++pic_cache_stamp;
+	c->used_ms = SDL_GetTicks();
+}
+
+u8 pic_cache_has(u16 pic_num)
+{
+	int i;
+
+	for (i = 0; i < PIC_CACHE_ENTRIES; i++)
+		if ( (pic_cache[i].len == 1) && (pic_cache[i].chain[0] == (u8)pic_num) )
+			return 1;
+	return 0;
+}
+
+// takes a picture rendered somewhere else, the cache frees buff
+void pic_cache_insert(u16 pic_num, u8 *buff)
+{
+	PIC_CACHE *c;
+
+	if (pic_cache_has(pic_num))
+	{
+		a_free(buff);
+		return;
+	}
+
+	c = pic_cache_victim();
+	pic_cache_drop(c);
+	c->buff = buff;
+	c->chain[0] = (u8)pic_num;
+	c->len = 1;
+	// as recent as the last picture drawn, without claiming a stamp of its own
+	c->used = pic_cache_stamp;
+	c->used_ms = SDL_GetTicks();
+}
+
+// the least recently used entry held in a tier, 0 if there's none
+static PIC_CACHE *pic_cache_oldest(u8 packed)
+{
+	PIC_CACHE *c;
+	int i;
+
+	c = 0;
+	for (i = 0; i < PIC_CACHE_ENTRIES; i++)
+		if ( (pic_cache[i].len != 0) && ((pic_cache[i].packed != 0) == packed) &&
+			((c == 0) || (pic_cache[i].used < c->used)) )
+			c = &pic_cache[i];
+	return c;
+}
+
+// for the cache budget, the plain tier
+size_t pic_cache_usage(size_t *oldest_bytes, u32 *oldest_age)
+{
+	PIC_CACHE *c;
+	size_t bytes;
+	int i;
+
+	bytes = 0;
+	for (i = 0; i < PIC_CACHE_ENTRIES; i++)
+		if ( (pic_cache[i].buff != 0) && (pic_cache[i].packed == 0) )
+			bytes += PIC_CACHE_SIZE;
+	c = pic_cache_oldest(0);
+	*oldest_bytes = (c != 0) ? PIC_CACHE_SIZE : 0;
+	*oldest_age = (c != 0) ? (u32)(SDL_GetTicks() - c->used_ms) : 0;
+	return bytes;
+}
+
+// into the packed tier, or gone if it doesn't compress
+void pic_cache_evict()
+{
+	PIC_CACHE *c;
+	u8 *buff;
+	size_t packed;
+
+	c = pic_cache_oldest(0);
+	if (c == 0)
+		return;
+	buff = lz4_pack(c->buff, PIC_CACHE_SIZE, &packed);
+	if (buff == 0)
+	{
+		pic_cache_drop(c);
+		return;
+	}
+	a_free(c->buff);
+	c->buff = buff;
+	c->packed = (u16)packed;
+}
+
+// the packed tier
+size_t pic_pack_usage(size_t *oldest_bytes, u32 *oldest_age)
+{
+	PIC_CACHE *c;
+	size_t bytes;
+	int i;
+
+	bytes = 0;
+	for (i = 0; i < PIC_CACHE_ENTRIES; i++)
+		bytes += pic_cache[i].packed;
+	c = pic_cache_oldest(1);
+	*oldest_bytes = (c != 0) ? c->packed : 0;
+	*oldest_age = (c != 0) ? (u32)(SDL_GetTicks() - c->used_ms) : 0;
+	return bytes;
+}
+
+void pic_pack_evict()
+{
+	PIC_CACHE *c;
+
+	c = pic_cache_oldest(1);
+	if (c != 0)
+		pic_cache_drop(c);
+}
+
+void pic_cache_break()
+{
+	cur_len = 0;
+}
+
+void pic_cache_discard(u16 pic_num)
+{
+	int i;
+
+	for (i = 0; i < PIC_CACHE_ENTRIES; i++)
+		if (pic_cache[i].len == 0)
+			return;		// room to spare
+
+	for (i = 0; i < PIC_CACHE_ENTRIES; i++)
+		if (memchr(pic_cache[i].chain, (u8)pic_num, pic_cache[i].len) != 0)
+			pic_cache_drop(&pic_cache[i]);
+}
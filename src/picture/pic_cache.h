@@ -0,0 +1,34 @@
+#ifndef NAGI_PICTURE_PIC_CACHE_H
+#define NAGI_PICTURE_PIC_CACHE_H
+
+// rendered buffers kept, 26880 bytes each
+#define PIC_CACHE_ENTRIES 64
+// the longest draw.pic + overlay.pic chain kept
+#define PIC_CACHE_CHAIN 8
+
+extern u32 pic_cache_hits;
+extern u32 pic_cache_misses;
+
+extern void pic_cache_init(void);
+extern void pic_cache_free(void);
+
+// copy a rendered chain into gfx_picbuff.  returns 1 on a hit
+extern u8 pic_cache_draw(u16 pic_num);
+extern u8 pic_cache_overlay(u16 pic_num);
+// keep gfx_picbuff for the current chain after a render
+extern void pic_cache_store(void);
+// gfx_picbuff was drawn on by something other than a picture
+extern void pic_cache_break(void);
+extern void pic_cache_discard(u16 pic_num);
+
+extern u8 pic_cache_has(u16 pic_num);
+// takes a picture rendered somewhere else, the cache frees buff
+extern void pic_cache_insert(u16 pic_num, u8 *buff);
+
+// the cache budget's plain and packed tiers
+extern size_t pic_cache_usage(size_t *oldest_bytes, u32 *oldest_age);
+extern void pic_cache_evict(void);
+extern size_t pic_pack_usage(size_t *oldest_bytes, u32 *oldest_age);
+extern void pic_pack_evict(void);
+
+#endif /* NAGI_PICTURE_PIC_CACHE_H */
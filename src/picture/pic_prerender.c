@@ -0,0 +1,288 @@
+/*
+Background picture rendering
+
+after new.room the shared workers (sys/workers.c) render the pictures the room is likely
+to need next into private buffers so the next room's draw.pic is a cache
+hit.  candidates come from the room's logic: new.room() targets, taking
+the picture number to match the room number like sierra's games do, and
+load.pic() / new.room.v() of a variable that was set with assignn() just
+before.
+
+resources are still loaded on the main thread since the volume files
+are shared.  the worker only runs the picture command stream.  finished
+buffers are handed to the picture cache from the main thread too.
+*/
+
+#define MEM_TAG MEM_CACHE
+
+#include <string.h>
+
+#include "../agi.h"
+
+#include "../picture/pic_prerender.h"
+#include "../picture/pic_cache.h"
+#include "../picture/pic_render.h"
+
+#include "../logic/logic_base.h"
+#include "../res/res.h"
+#include "../sys/drv_video.h"
+#include "../sys/gfx.h"
+#include "../sys/mem_wrap.h"
+#include "../sys/workers.h"
+
+#define PRERENDER_ASSIGNN 0x03
+#define PRERENDER_NEW_ROOM 0x12
+#define PRERENDER_NEW_ROOM_V 0x13
+#define PRERENDER_LOAD_PIC 0x18
+
+#define JOB_FREE 0
+#define JOB_QUEUED 1
+#define JOB_BUSY 2
+#define JOB_DONE 3
+
+struct prerender_job_struct
+{
+	u8 state;
+	u8 num;
+	u8 *data;		// the picture resource
+	u8 *buff;		// rendered into here
+};
+typedef struct prerender_job_struct PRERENDER_JOB;
+
+static PRERENDER_JOB prerender_job[PIC_PRERENDER_JOBS];
+static u8 prerender_on = 0;
+static SDL_Mutex *prerender_mutex = 0;
+static SDL_Condition *prerender_cond = 0;
+
+// on a worker, render the first queued picture
+static int prerender_work(int worker)
+{
+	PRERENDER_JOB *job;
+	int i;
+
+	(void) worker;
+
+	SDL_LockMutex(prerender_mutex);
+	job = 0;
+	for (i = 0; i < PIC_PRERENDER_JOBS; i++)
+		if (prerender_job[i].state == JOB_QUEUED)
+		{
+			job = &prerender_job[i];
+			break;
+		}
+	if (job == 0)
+	{
+		SDL_UnlockMutex(prerender_mutex);
+		return 0;
+	}
+	job->state = JOB_BUSY;
+	SDL_UnlockMutex(prerender_mutex);
+
+	render_pic_buff(job->buff, job->data, 0);
+
+	SDL_LockMutex(prerender_mutex);
+	job->state = JOB_DONE;
+	SDL_BroadcastCondition(prerender_cond);
+	SDL_UnlockMutex(prerender_mutex);
+	return 1;
+}
+
+// called with the mutex held
+static void prerender_drop(PRERENDER_JOB *job)
+{
+	if (job->data != 0)
+		a_free(job->data);
+	if (job->buff != 0)
+		a_free(job->buff);
+	job->data = 0;
+	job->buff = 0;
+	job->state = JOB_FREE;
+}
+
+void pic_prerender_init()
+{
+	memset(prerender_job, 0, sizeof(prerender_job));
+	prerender_on = 0;
+
+	prerender_mutex = SDL_CreateMutex();
+	prerender_cond = SDL_CreateCondition();
+	if ( (prerender_mutex != 0) && (prerender_cond != 0) )
+		prerender_on = (u8)workers_add(prerender_work);
+
+	// draw.pic renders each picture when it is called, as it always did
+	if (prerender_on == 0)
+	{
+		printf("Picture prerender: off (no workers)\n");
+		pic_prerender_denit();
+	}
+}
+
+void pic_prerender_denit()
+{
+	int i;
+
+	// workers_denit() has stopped the workers
+	prerender_on = 0;
+	for (i = 0; i < PIC_PRERENDER_JOBS; i++)
+		prerender_drop(&prerender_job[i]);
+
+	if (prerender_cond != 0)
+		SDL_DestroyCondition(prerender_cond);
+	if (prerender_mutex != 0)
+		SDL_DestroyMutex(prerender_mutex);
+	prerender_cond = 0;
+	prerender_mutex = 0;
+}
+
+static void prerender_add(u8 *list, u8 *total, u16 pic_num, u16 room_num)
+{
+	u8 i;
+
+	// the room draws its own picture straight away
+	if ( (pic_num == room_num) || (*total >= PIC_PRERENDER_JOBS) )
+		return;
+	for (i = 0; i < *total; i++)
+		if (list[i] == pic_num)
+			return;
+	list[(*total)++] = (u8)pic_num;
+}
+
+struct prerender_scan_struct
+{
+	s16 var_val[256];
+	u8 *list;
+	u8 total;
+	u16 room_num;
+};
+typedef struct prerender_scan_struct PRERENDER_SCAN;
+
+static void prerender_cmd(u8 code, const u8 *p, void *arg)
+{
+	PRERENDER_SCAN *scan = (PRERENDER_SCAN *)arg;
+
+	switch (code)
+	{
+		case PRERENDER_ASSIGNN:
+			scan->var_val[p[0]] = p[1];
+			break;
+		case PRERENDER_NEW_ROOM:
+			prerender_add(scan->list, &scan->total, p[0], scan->room_num);
+			break;
+		case PRERENDER_NEW_ROOM_V:
+		case PRERENDER_LOAD_PIC:
+			if (scan->var_val[p[0]] >= 0)
+				prerender_add(scan->list, &scan->total, scan->var_val[p[0]], scan->room_num);
+			break;
+	}
+}
+
+// walk the room's logic for pictures it may load or rooms it leads to
+static u8 prerender_scan(LOGIC *log, u16 room_num, u8 *list)
+{
+	PRERENDER_SCAN scan;
+
+	memset(scan.var_val, -1, sizeof(scan.var_val));
+	scan.list = list;
+	scan.total = 0;
+	scan.room_num = room_num;
+	logic_scan(log, prerender_cmd, &scan);
+	return scan.total;
+}
+
+void pic_prerender_room(u16 room_num)
+{
+	u8 list[PIC_PRERENDER_JOBS];
+	u8 total, i, n;
+	LOGIC *log;
+	u8 *dir_entry, *data;
+	PRERENDER_JOB *job;
+
+	if (prerender_on == 0)
+		return;
+	log = logic_list_find(room_num);
+	if (log == 0)
+		return;
+
+	// whatever the last room wanted and hasn't started isn't wanted now
+	SDL_LockMutex(prerender_mutex);
+	for (i = 0; i < PIC_PRERENDER_JOBS; i++)
+		if (prerender_job[i].state == JOB_QUEUED)
+			prerender_drop(&prerender_job[i]);
+	SDL_UnlockMutex(prerender_mutex);
+
+	total = prerender_scan(log, room_num, list);
+	for (n = 0; n < total; n++)
+	{
+		if (pic_cache_has(list[n]))
+			continue;
+		dir_entry = dir_picture_find(list[n]);
+		if (dir_entry == 0)
+			continue;
+
+		// only the main thread frees a job so it stays free while loading
+		job = 0;
+		SDL_LockMutex(prerender_mutex);
+		for (i = 0; i < PIC_PRERENDER_JOBS; i++)
+		{
+			if (prerender_job[i].state == JOB_FREE)
+			{
+				if (job == 0)
+					job = &prerender_job[i];
+			}
+			else if (prerender_job[i].num == list[n])
+			{
+				job = 0;
+				break;
+			}
+		}
+		SDL_UnlockMutex(prerender_mutex);
+		if (job == 0)
+			continue;
+
+		data = vol_res_load(dir_entry, 0);
+		if (data == 0)
+			continue;
+
+		SDL_LockMutex(prerender_mutex);
+		job->num = list[n];
+		job->data = data;
+		job->buff = (u8 *)a_malloc(PICBUFF_WIDTH*PICBUFF_HEIGHT);
+		job->state = JOB_QUEUED;
+		SDL_UnlockMutex(prerender_mutex);
+		workers_wake();
+	}
+}
+
+void pic_prerender_collect(u16 pic_num)
+{
+	PRERENDER_JOB *job;
+	int i;
+
+	if (prerender_on == 0)
+		return;
+
+	SDL_LockMutex(prerender_mutex);
+	for (i = 0; i < PIC_PRERENDER_JOBS; i++)
+	{
+		job = &prerender_job[i];
+		if (job->num != pic_num)
+			continue;
+		// drawing it now is quicker than waiting for the worker to get to it
+		if (job->state == JOB_QUEUED)
+			prerender_drop(job);
+		// it's part way there
+		while (job->state == JOB_BUSY)
+			SDL_WaitCondition(prerender_cond, prerender_mutex);
+	}
+
+	for (i = 0; i < PIC_PRERENDER_JOBS; i++)
+	{
+		job = &prerender_job[i];
+		if (job->state != JOB_DONE)
+			continue;
+		pic_cache_insert(job->num, job->buff);
+		job->buff = 0;
+		prerender_drop(job);
+	}
+	SDL_UnlockMutex(prerender_mutex);
+}
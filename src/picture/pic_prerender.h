@@ -0,0 +1,15 @@
+#ifndef NAGI_PICTURE_PIC_PRERENDER_H
+#define NAGI_PICTURE_PIC_PRERENDER_H
+
+// pictures rendered ahead per new.room
+#define PIC_PRERENDER_JOBS 4
+
+extern void pic_prerender_init(void);
+extern void pic_prerender_denit(void);
+
+// queue the pictures the room's logic may need next
+extern void pic_prerender_room(u16 room_num);
+// move finished pictures into the cache.  waits if pic_num is being rendered
+extern void pic_prerender_collect(u16 pic_num);
+
+#endif /* NAGI_PICTURE_PIC_PRERENDER_H */
@@ -33,50 +33,37 @@ _DrawLine                        cseg     0000661A 00000096
 // all picture functions must contribute to pic_Data and pic_byte!!!
 
 #include <stdlib.h>
+#include <string.h>
 #include "../agi.h"
 
 #include "../picture/sbuf_util.h"
 
 #include "../picture/pic_res.h"
 #include "../picture/pic_render.h"
+#include "../view/obj_picbuff.h"
 #include "../sys/drv_video.h"
+#include "../sys/gfx.h"
 #include "../sys/vid_render.h"
-
-static void pic_cmd_loop(void);
-static void enable_pic_draw(void);
-static void disable_pic_draw(void);
-static void enable_pri_draw(void);
-static void disable_pri_draw(void);
-static void plot_with_pen(void);
-static void read_pen_status(void);
-static void plot_with_pen_2(void);
-static void absolute_line(void);
-static void pic_fill(void);
-static int read_xy_pos(u8 *x, u8 *y);
-static int get_x_pos(u8 *x);
-static int get_y_pos(u8 *y);
-static void draw_line(void);
-static void draw_y_corner(void);
-static void draw_x_corner(void);
-static void relative_line(void);
-static void draw_corner(u8 type);
-
-u8 pos_init_y = 0;
-u8 pos_init_x = 0;
-u8 pos_final_y = 0;
-u8 pos_final_x = 0;
-
-u8 col_even = 0xff;
-u8 col_odd = 0xff;
-u8 sbuff_drawmask = 0;
-u8 colour_pictpart=0;
-u8 colour_pripart=0;
-u8 *given_pic_data = 0;
-
-static u16 pen_status = 0;
-static s16 pen_x = 0;		// these should be u16
-static s16 pen_y = 0;
-static u16 texture_num = 0;
+#include "../sys/mem_wrap.h"
+
+static void pic_cmd_loop(PIC_RENDER *r);
+static void enable_pic_draw(PIC_RENDER *r);
+static void disable_pic_draw(PIC_RENDER *r);
+static void enable_pri_draw(PIC_RENDER *r);
+static void disable_pri_draw(PIC_RENDER *r);
+static void plot_with_pen(PIC_RENDER *r);
+static void read_pen_status(PIC_RENDER *r);
+static void plot_with_pen_2(PIC_RENDER *r);
+static void absolute_line(PIC_RENDER *r);
+static void pic_fill(PIC_RENDER *r);
+static int read_xy_pos(PIC_RENDER *r, u8 *x, u8 *y);
+static int get_x_pos(PIC_RENDER *r, u8 *x);
+static int get_y_pos(PIC_RENDER *r, u8 *y);
+static void draw_line(PIC_RENDER *r);
+static void draw_y_corner(PIC_RENDER *r);
+static void draw_x_corner(PIC_RENDER *r);
+static void relative_line(PIC_RENDER *r);
+static void draw_corner(PIC_RENDER *r, u8 type);
 
 /*
 u8 LineFinalX
@@ -88,30 +75,47 @@ u8 LineLargestSide
 
 
 
-// jumps into render_pic so it doesn't clear the screen buffer
-void render_overlay()
+// the palette as it is, for when there's no render driver to ask
+static void pic_render_colour(u8 col, COLOUR *col_dith)
+{
+	col_dith->odd = col;
+	col_dith->even = col;
+}
+
+void pic_render_init(PIC_RENDER *r, u8 *buff)
 {
-	render_pic(1);
+	memset(r, 0, sizeof(PIC_RENDER));
+	r->buff = buff;
+	r->colour = (rend_drv != 0) ? rend_drv->func_colour : pic_render_colour;
+	r->col_odd = 0xFF;
+	r->col_even = 0xFF;
 }
 
-// render_pic()
+// pic_render_run()
 // clears screen buff, set various variables and runs _PicCmdLoop.
 // calls a HGC command (unknown which one though)
-void render_pic(u8 overlay)
+void pic_render_run(PIC_RENDER *r, const u8 *data, u8 overlay)
 {
 	if (overlay != 1)
 	{
 		// colour 15, priority 4
 		// 4 = priority, F = colour
-		sbuff_fill(0x4F);	// fill screen buffer
+		memset(r->buff, 0x4F, PICBUFF_WIDTH*PICBUFF_HEIGHT);	// fill screen buffer
 	}
 
-	sbuff_drawmask = 0;
-	pen_status = 0;		// the pen has no style.. man
-	col_odd = 0xFF;		// reset to white
-	col_even = 0xFF;	// reset to white
+	r->code = data;
+	r->drawmask = 0;
+	r->pen_status = 0;		// the pen has no style.. man
+	r->col_odd = 0xFF;		// reset to white
+	r->col_even = 0xFF;	// reset to white
+
+	pic_cmd_loop(r);
 
-	pic_cmd_loop();
+	if (r->fill_stack != 0)
+		a_free(r->fill_stack);
+	r->fill_stack = 0;
+	r->fill_total = 0;
+	r->fill_size = 0;
 
 	//if (DisplayType == 2)
 	//	call loc97d9;	// this is a HGC command
@@ -121,10 +125,27 @@ void render_pic(u8 overlay)
 	return;	
 }
 
-// ----------------
+// a whole picture into any 160x168 buffer
+void render_pic_buff(u8 *buff, const u8 *data, u8 overlay)
+{
+	PIC_RENDER r;
 
-static u8 *pic_code;
-static u8 pic_byte;
+	pic_render_init(&r, buff);
+	pic_render_run(&r, data, overlay);
+}
+
+void render_pic(const u8 *data)
+{
+	render_pic_buff(gfx_picbuff, data, 0);
+	obj_ctl_invalidate();
+}
+
+// jumps into render_pic so it doesn't clear the screen buffer
+void render_overlay(const u8 *data)
+{
+	render_pic_buff(gfx_picbuff, data, 1);
+	obj_ctl_invalidate();
+}
 
 // ----------------
 
@@ -132,34 +153,33 @@ static u8 pic_byte;
 // reads through the picture data and executes commands.
 // if there's a command it doesn't understand, it skips it and keeps going
 // FFh means it quits
-static void pic_cmd_loop()
+static void pic_cmd_loop(PIC_RENDER *r)
 {
-	pic_code = given_pic_data;
-	pic_byte = *(pic_code++);		// read next byte
+	r->byte = *(r->code++);		// read next byte
 
 	// get next command
-	while (pic_byte != 0xFF) //goto 63AD;
+	while (r->byte != 0xFF) //goto 63AD;
 	{
-		pic_byte -= 0xF0;	// first command = 0xf0
+		r->byte -= 0xF0;	// first command = 0xf0
 		// Radiation: removed obvious check.
 		//~ if ( (pic_byte < 0x0) || (pic_byte > 0x0A) )
-		if (pic_byte > 0x0A) 	// 0xA commands possible
-			pic_byte = *(pic_code++);		// read next byte
+		if (r->byte > 0x0A) 	// 0xA commands possible
+			r->byte = *(r->code++);		// read next byte
 		else
 		{
-			switch(pic_byte)
+			switch(r->byte)
 			{
-				case 0x00: enable_pic_draw();  break;
-				case 0x01: disable_pic_draw();  break;
-				case 0x02: enable_pri_draw();  break;
-				case 0x03: disable_pri_draw();  break;
-				case 0x04: draw_y_corner();  break;
-				case 0x05: draw_x_corner();  break;
-				case 0x06: absolute_line();  break;
-				case 0x07: relative_line();  break;
-				case 0x08: pic_fill();  break;
-				case 0x09: read_pen_status();  break;
-				case 0x0A: plot_with_pen();  break;
+				case 0x00: enable_pic_draw(r);  break;
+				case 0x01: disable_pic_draw(r);  break;
+				case 0x02: enable_pri_draw(r);  break;
+				case 0x03: disable_pri_draw(r);  break;
+				case 0x04: draw_y_corner(r);  break;
+				case 0x05: draw_x_corner(r);  break;
+				case 0x06: absolute_line(r);  break;
+				case 0x07: relative_line(r);  break;
+				case 0x08: pic_fill(r);  break;
+				case 0x09: read_pen_status(r);  break;
+				case 0x0A: plot_with_pen(r);  break;
 			}
 		}
 	}
@@ -173,11 +193,11 @@ static void pic_cmd_loop()
 
 
 // 0xF0: Change picture colour and enable picture draw
-static void enable_pic_draw()
+static void enable_pic_draw(PIC_RENDER *r)
 {
 	COLOUR new_col;
 	
-	pic_byte = *(pic_code++);	
+	r->byte = *(r->code++);	
 
 	// ahah.. this is some kind of dithering method
 	// for the low-colour CGA people.
@@ -185,50 +205,50 @@ static void enable_pic_draw()
 
 	// if not cga.. ah=al;
 	//ax = _CGAColourDither();
-	render_colour(pic_byte, &new_col);
-	colour_pictpart = pic_byte;	// equals paint colour if ega/hgc
-	sbuff_drawmask = sbuff_drawmask | 0x0F;
-	col_odd = (col_odd & 0xF0) | new_col.odd;	// clear lower 4 bits
-	col_even = (col_even & 0xF0) | new_col.even;
+	r->colour(r->byte, &new_col);
+	r->colour_pictpart = r->byte;	// equals paint colour if ega/hgc
+	r->drawmask = r->drawmask | 0x0F;
+	r->col_odd = (r->col_odd & 0xF0) | new_col.odd;	// clear lower 4 bits
+	r->col_even = (r->col_even & 0xF0) | new_col.even;
 
-	pic_byte = *(pic_code++);	
+	r->byte = *(r->code++);	
 }
 
 // 0xF1: Disable picture draw
-static void disable_pic_draw()
+static void disable_pic_draw(PIC_RENDER *r)
 {
-	sbuff_drawmask = sbuff_drawmask & 0xF0;
-	col_odd = col_odd | 0x0F;	// white
-	col_even = col_even | 0x0F;
+	r->drawmask = r->drawmask & 0xF0;
+	r->col_odd = r->col_odd | 0x0F;	// white
+	r->col_even = r->col_even | 0x0F;
 	
-	pic_byte = *(pic_code++);	
+	r->byte = *(r->code++);	
 	return;	
 }
 
 // 0xF2: Change priority colour and enable priority draw
-static void enable_pri_draw()
+static void enable_pri_draw(PIC_RENDER *r)
 {
-	pic_byte = *(pic_code++);	
+	r->byte = *(r->code++);	
 
-	pic_byte *= 0x10;
-	colour_pripart  = pic_byte;
-	sbuff_drawmask = sbuff_drawmask | 0xF0;
-	col_odd = (col_odd & 0x0F) | pic_byte;
-	col_even = (col_even & 0x0F) | pic_byte;
+	r->byte *= 0x10;
+	r->colour_pripart  = r->byte;
+	r->drawmask = r->drawmask | 0xF0;
+	r->col_odd = (r->col_odd & 0x0F) | r->byte;
+	r->col_even = (r->col_even & 0x0F) | r->byte;
 
-	pic_byte = *(pic_code++);	
+	r->byte = *(r->code++);	
 	return;	
 }
 
 
 // 0xF3: Disable priority draw
-static void disable_pri_draw()
+static void disable_pri_draw(PIC_RENDER *r)
 {
-	sbuff_drawmask = sbuff_drawmask & 0x0F;
-	col_odd = col_odd | 0xF0;
-	col_even = col_even | 0xF0;
+	r->drawmask = r->drawmask & 0x0F;
+	r->col_odd = r->col_odd | 0xF0;
+	r->col_even = r->col_even | 0xF0;
 
-	pic_byte = *(pic_code++);	
+	r->byte = *(r->code++);	
 	return;	
 }
 
@@ -238,47 +258,47 @@ static void disable_pri_draw()
 
 
 // 0xFA: Plot with pen
-static void plot_with_pen()
+static void plot_with_pen(PIC_RENDER *r)
 {
 	u8 xx, yy;
 	//printf("pen plot.. incomplete \n");
 loc6438:
 	// solid(0) vs splater(1) (20h)
-	if ((pen_status & 0x20) != 0)
+	if ((r->pen_status & 0x20) != 0)
 	{
-		pic_byte = *(pic_code++);	
-		if (pic_byte >= 0xF0)
+		r->byte = *(r->code++);	
+		if (r->byte >= 0xF0)
 			return;
-		texture_num = pic_byte;
+		r->texture_num = r->byte;
 	}
 	
-	if (read_xy_pos(&xx, &yy) == 1)
+	if (read_xy_pos(r, &xx, &yy) == 1)
 		return;
-	pen_x = xx;
-	pen_y = yy;
+	r->pen_x = xx;
+	r->pen_y = yy;
 	
 	//(push si)
-		plot_with_pen_2();
+		plot_with_pen_2(r);
 	//(pop si)
 	goto loc6438;
 }
 
 // 0xF9: Change pen size and style
-static void read_pen_status()
+static void read_pen_status(PIC_RENDER *r)
 {	
-	pen_status = *(pic_code++);
-	pic_byte = *(pic_code++);
+	r->pen_status = *(r->code++);
+	r->byte = *(r->code++);
 	return;
 }
 
 
 
 
-static u16 binary_list[] = {0x8000, 0x4000, 0x2000, 0x1000, 0x800, 0x400, 0x200, 0x100, 
+static const u16 binary_list[] = {0x8000, 0x4000, 0x2000, 0x1000, 0x800, 0x400, 0x200, 0x100, 
 			0x80, 0x40, 0x20, 0x10, 0x8, 0x4, 0x2, 0x1};
 
-static u8 circle_list[] = {0, 1, 4, 9, 16, 25, 37, 50};
-static u16 circle_data[] =
+static const u8 circle_list[] = {0, 1, 4, 9, 16, 25, 37, 50};
+static const u16 circle_data[] =
 {0x8000, 
 0x0E000, 0x0E000, 0x0E000, 
 0x7000, 0xF800, 0x0F800, 0x0F800, 0x7000, 
@@ -289,10 +309,10 @@ static u16 circle_data[] =
 0x07C0, 0x1FF0, 0x3FF8, 0x7FFC, 0x7FFC, 0x0FFFE, 0x0FFFE, 0x0FFFE, 0x0FFFE, 0x0FFFE, 0x7FFC, 0x7FFC, 0x3FF8, 0x1FF0, 0x07C0};
 				
 // called by plot with pen.
-static void plot_with_pen_2()
+static void plot_with_pen_2(PIC_RENDER *r)
 {
 	u16 circle_word;
-	u16 *circle_ptr;	// si
+	const u16 *circle_ptr;	// si
 	u16 counter;	// bx sometimes
 	u16 pen_width = 0;
 	u16 pen_final_x = 0;	// 15EA
@@ -302,37 +322,37 @@ static void plot_with_pen_2()
 	u8 temp8;
 	u16 temp16;
 
-	circle_ptr = &circle_data[ circle_list[(pen_status & 0x07)] ];	// pen size
+	circle_ptr = &circle_data[ circle_list[(r->pen_status & 0x07)] ];	// pen size
 	
 	// setup the X position
 	// = pen_x - pen.size/2
 
-	pen_x = (pen_x * 2) - (pen_status & 0x07);
-	if (pen_x < 0) pen_x = 0;
+	r->pen_x = (r->pen_x * 2) - (r->pen_status & 0x07);
+	if (r->pen_x < 0) r->pen_x = 0;
 
-	temp16 = 0x140 - (2 * (pen_status & 0x07));
-	if (pen_x >= temp16)
-		pen_x = temp16;
+	temp16 = 0x140 - (2 * (r->pen_status & 0x07));
+	if (r->pen_x >= temp16)
+		r->pen_x = temp16;
 		
-	pen_x /= 2;
-	pen_final_x = pen_x;	// original starting point?? -> used in plotrelated
+	r->pen_x /= 2;
+	pen_final_x = r->pen_x;	// original starting point?? -> used in plotrelated
 
 	// Setup the Y Position
 	// = pen_y - pen.size
-	pen_y = pen_y - (pen_status & 0x07);
-	if (pen_y < 0) pen_y = 0;
+	r->pen_y = r->pen_y - (r->pen_status & 0x07);
+	if (r->pen_y < 0) r->pen_y = 0;
 
-	temp16 = 0xA7 - (2 * (pen_status & 0x07));
-	if (pen_y >= temp16)
-		pen_y = temp16;
+	temp16 = 0xA7 - (2 * (r->pen_status & 0x07));
+	if (r->pen_y >= temp16)
+		r->pen_y = temp16;
 		
-	pen_final_y = pen_y;	// used in plotrelated
+	pen_final_y = r->pen_y;	// used in plotrelated
 
-	t = texture_num | 0x01;		// even
+	t = r->texture_num | 0x01;		// even
 	
 	// new purpose for temp16
 	
-	temp16 =( (pen_status & 0x07)<<1) +1;	// pen size
+	temp16 =( (r->pen_status & 0x07)<<1) +1;	// pen size
 	pen_final_y += temp16;					// the last row of this shape
 	temp16 = temp16 << 1;
 	pen_width = temp16;					// width of shape?
@@ -346,9 +366,9 @@ loc64DB:			// new y
 	circle_word = *circle_ptr;
 	circle_ptr += 1;
 loc64DF:			// new x
-	if (   ((pen_status&0x10) != 0) || ( (binary_list[counter>>1] & circle_word) != 0)   )
+	if (   ((r->pen_status&0x10) != 0) || ( (binary_list[counter>>1] & circle_word) != 0)   )
 	{
-		if ( (pen_status & 0x20) == 0) goto loc6506;			// skip last column??  not sure
+		if ( (r->pen_status & 0x20) == 0) goto loc6506;			// skip last column??  not sure
 
 		temp8 = t % 2;
 		t = t >> 1;
@@ -359,19 +379,19 @@ loc64DF:			// new x
 		if ((t & 0x02) == 0) goto loc651b;
 	loc6506:
 		//(push dx, ax, bx, si)
-		pos_init_y = pen_y;
-		pos_init_x = pen_x;
-		sbuff_plot();
+		r->pos_init_y = r->pen_y;
+		r->pos_init_x = r->pen_x;
+		sbuff_plot(r);
 		//(pop si, bx, ax, dx)
 	}
 loc651b:
-	pen_x++;
+	r->pen_x++;
 	counter += 4;	// needs to be 4 or the width will be wrong
 	if (counter <= pen_width)
 		goto loc64DF;
-	pen_x = pen_final_x;
-	pen_y++;
-	if (pen_y != pen_final_y)
+	r->pen_x = pen_final_x;
+	r->pen_y++;
+	if (r->pen_y != pen_final_y)
 		goto loc64DB;
 	return;
 }
@@ -395,14 +415,14 @@ loc651b:
 
 
 // 0xF6: Absolute line
-static void absolute_line()
+static void absolute_line(PIC_RENDER *r)
 {	
-	if (read_xy_pos(&pos_init_x, &pos_init_y) != 1)
+	if (read_xy_pos(r, &r->pos_init_x, &r->pos_init_y) != 1)
 	{
-		sbuff_plot();
+		sbuff_plot(r);
 		
-		while (read_xy_pos(&pos_final_x, &pos_final_y) != 1)
-		draw_line();
+		while (read_xy_pos(r, &r->pos_final_x, &r->pos_final_y) != 1)
+		draw_line(r);
 	}
 }
 
@@ -411,28 +431,28 @@ static void absolute_line()
 	
 
 // 0xF5: Draw an X corner
-static void draw_x_corner()
+static void draw_x_corner(PIC_RENDER *r)
 {
-	if (read_xy_pos(&pos_init_x, &pos_init_y) != 1)
+	if (read_xy_pos(r, &r->pos_init_x, &r->pos_init_y) != 1)
 	{
-		sbuff_plot();
-		draw_corner(0);
+		sbuff_plot(r);
+		draw_corner(r, 0);
 	}
 }
 
 // 0xF4: Draw a Y corner
-static void draw_y_corner()
+static void draw_y_corner(PIC_RENDER *r)
 {
-	if (read_xy_pos(&pos_init_x, &pos_init_y) != 1)
+	if (read_xy_pos(r, &r->pos_init_x, &r->pos_init_y) != 1)
 	{
-		sbuff_plot();
-		draw_corner(1);
+		sbuff_plot(r);
+		draw_corner(r, 1);
 	}
 } 
 
 // 0 = x corner
 // 1 = y corner
-static void draw_corner(u8 type)
+static void draw_corner(PIC_RENDER *r, u8 type)
 {
 	u8 pos;
 	u8 orig_x, orig_y;
@@ -441,28 +461,28 @@ static void draw_corner(u8 type)
 draw_x:	
 
 	
-	if (get_x_pos(&pos) == 1)
+	if (get_x_pos(r, &pos) == 1)
 		return;
 
-	pos_final_x = pos;
-	pos_final_y = pos_init_y;	// y
-	orig_x = pos_final_x;
-	orig_y = pos_final_y;
-	sbuff_xline();
-	pos_init_y = orig_y;
-	pos_init_x = orig_x;
+	r->pos_final_x = pos;
+	r->pos_final_y = r->pos_init_y;	// y
+	orig_x = r->pos_final_x;
+	orig_y = r->pos_final_y;
+	sbuff_xline(r);
+	r->pos_init_y = orig_y;
+	r->pos_init_x = orig_x;
 
 draw_y:
-	if (get_y_pos(&pos) == 1)
+	if (get_y_pos(r, &pos) == 1)
 		return;
 
-	pos_final_y = pos;
-	pos_final_x = pos_init_x;
-	orig_x = pos_final_x;
-	orig_y = pos_final_y;
-	sbuff_yline();
-	pos_init_y = orig_y;
-	pos_init_x = orig_x;
+	r->pos_final_y = pos;
+	r->pos_final_x = r->pos_init_x;
+	orig_x = r->pos_final_x;
+	orig_y = r->pos_final_y;
+	sbuff_yline(r);
+	r->pos_init_y = orig_y;
+	r->pos_init_x = orig_x;
 	goto draw_x;
 }
 	
@@ -475,7 +495,7 @@ draw_y:
 	
 	
 	
-static void relative_line()
+static void relative_line(PIC_RENDER *r)
 {
 	u8 x_pos, y_pos;
 	u8 x_step, y_step;	// x = bh, y = bl;
@@ -483,13 +503,13 @@ static void relative_line()
 	
 	//printf("relative line.. incomplete \n");
 	
-	if (read_xy_pos(&pos_init_x, &pos_init_y) == 1)
+	if (read_xy_pos(r, &r->pos_init_x, &r->pos_init_y) == 1)
 		return;
-	sbuff_plot();
+	sbuff_plot(r);
 
 	loc65a2:
-	pic_byte = *(pic_code++);
-	pos_data = pic_byte ;
+	r->byte = *(r->code++);
+	pos_data = r->byte ;
 	if (pos_data > 0xEF)
 	{
 		//printf("nope.. outta here\n");
@@ -497,8 +517,8 @@ static void relative_line()
 	}
 	
 	x_step = pos_data;
-	x_pos = pos_init_x;
-	y_pos = pos_init_y;
+	x_pos = r->pos_init_x;
+	y_pos = r->pos_init_y;
 	
 	x_step = (x_step & 0x70) / 16;		// x
 	if ( (pos_data & 0x80) == 0)	// sign
@@ -520,10 +540,10 @@ static void relative_line()
 	if ( y_pos > 0xA7)
 		y_pos = 0xA7;
 
-	pos_final_x = x_pos;
-	pos_final_y = y_pos;
+	r->pos_final_x = x_pos;
+	r->pos_final_y = y_pos;
 
-	draw_line();
+	draw_line(r);
 
 	goto loc65a2;
 	
@@ -534,27 +554,27 @@ static void relative_line()
 
 
 // 0xF8: Fill
-static void pic_fill()
+static void pic_fill(PIC_RENDER *r)
 {
-	while (read_xy_pos(&pos_init_x, &pos_init_y) != 1)
-		sbuff_picfill(pos_init_y, pos_init_x);
+	while (read_xy_pos(r, &r->pos_init_x, &r->pos_init_y) != 1)
+		sbuff_picfill(r, r->pos_init_y, r->pos_init_x);
 }
 
 
 // reads the position from the pic file data
 // puts read positions into x and y mem ptrs
 // returns 0 if successful
-static int read_xy_pos(u8 *x, u8 *y)
+static int read_xy_pos(PIC_RENDER *r, u8 *x, u8 *y)
 {
-	if(get_x_pos(x) == 1)
+	if(get_x_pos(r, x) == 1)
 		return 1;
-	return(get_y_pos(y));
+	return(get_y_pos(r, y));
 }
 
-static int get_x_pos(u8 *x)
+static int get_x_pos(PIC_RENDER *r, u8 *x)
 {
-	pic_byte = *(pic_code++);
-	*x = pic_byte;
+	r->byte = *(r->code++);
+	*x = r->byte;
 
 	if ( *x > 0xEF)	// command
 		return 1;
@@ -563,10 +583,10 @@ static int get_x_pos(u8 *x)
 	return 0;
 }
 
-static int get_y_pos(u8 *y)
+static int get_y_pos(PIC_RENDER *r, u8 *y)
 {
-	pic_byte = *(pic_code++);
-	*y = pic_byte;
+	r->byte = *(r->code++);
+	*y = r->byte;
 	
 	if ((*y) > 0xEF)	// command
 		return 1;
@@ -577,7 +597,7 @@ static int get_y_pos(u8 *y)
 
 
 
-static void draw_line()
+static void draw_line(PIC_RENDER *r)
 {
 	//u8 line_x_final;	// these final are ignored in this or any function
 	//u8 line_y_final;	// I'll put them in if necessary
@@ -594,23 +614,23 @@ static void draw_line()
 	s16 y_count;	// ah
 	s16 x_count;	// al
 
-	pos_y = pos_init_y;	// y
-	pos_x = pos_init_x;
+	pos_y = r->pos_init_y;	// y
+	pos_x = r->pos_init_x;
 
 	// if straight line.. call the straight line function
-	if (pos_y == pos_final_y)
+	if (pos_y == r->pos_final_y)
 	{
-		sbuff_xline();
+		sbuff_xline(r);
 		return;
 	}
-	else if (pos_x == pos_final_x)
+	else if (pos_x == r->pos_final_x)
 	{
-		sbuff_yline();
+		sbuff_yline(r);
 		return;
 	}
 
 	line_y_inc = 0x1;
-	y_component = pos_final_y - pos_init_y;	// y
+	y_component = r->pos_final_y - r->pos_init_y;	// y
 	if (y_component < 0)
 	{
 		line_y_inc *= -1;
@@ -618,7 +638,7 @@ static void draw_line()
 	}
 
 	line_x_inc = 0x1;
-	x_component = pos_final_x - pos_init_x;
+	x_component = r->pos_final_x - r->pos_init_x;
 	if (x_component < 0)
 	{
 		line_x_inc *= -1;
@@ -658,9 +678,9 @@ static void draw_line()
 	
 		//(push ax, bx, cx, dx)
 
-		pos_init_y = pos_y;	// y;
-		pos_init_x = pos_x;
-		sbuff_plot();
+		r->pos_init_y = pos_y;	// y;
+		r->pos_init_x = pos_x;
+		sbuff_plot(r);
 
 		//(pop dx, cx, bx, ax)
 
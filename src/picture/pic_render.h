@@ -1,19 +1,56 @@
 #ifndef NAGI_PICTURE_PIC_RENDER_H
 #define NAGI_PICTURE_PIC_RENDER_H
 
-extern u8 pos_init_y;
-extern u8 pos_init_x;
-extern u8 pos_final_y;
-extern u8 pos_final_x;
-
-extern u8 col_even;
-extern u8 col_odd;
-extern u8 sbuff_drawmask;
-extern u8 colour_pictpart;
-extern u8 colour_pripart;
-extern u8 *given_pic_data;
-
-extern void render_pic(u8 overlay);
-extern void render_overlay(void);
+struct colour_struct;
+
+// a run sbuff_picfill() has filled, the rows either side are still to look at
+struct pic_fill_span_struct
+{
+	u8 y;
+	u8 x0;
+	u8 x1;
+	s8 dir;			// found from row y - dir
+	u8 left;		// the run on that row that found it
+	u8 right;
+};
+typedef struct pic_fill_span_struct PIC_FILL_SPAN;
+
+// everything one picture render needs.  nothing is shared between two
+// of these so they can run side by side
+struct pic_render_struct
+{
+	u8 *buff;		// 160x168, priority in the high nibble
+	void (*colour)(u8 col, struct colour_struct *col_dith);	// cga dithering
+	const u8 *code;
+	u8 byte;
+
+	u8 pos_init_y;
+	u8 pos_init_x;
+	u8 pos_final_y;
+	u8 pos_final_x;
+
+	u8 col_even;
+	u8 col_odd;
+	u8 drawmask;
+	u8 colour_pictpart;
+	u8 colour_pripart;
+
+	u16 pen_status;
+	s16 pen_x;		// these should be u16
+	s16 pen_y;
+	u16 texture_num;
+
+	PIC_FILL_SPAN *fill_stack;	// for sbuff_picfill()
+	u32 fill_total;
+	u32 fill_size;
+};
+typedef struct pic_render_struct PIC_RENDER;
+
+extern void pic_render_init(PIC_RENDER *r, u8 *buff);
+extern void pic_render_run(PIC_RENDER *r, const u8 *data, u8 overlay);
+
+extern void render_pic(const u8 *data);
+extern void render_overlay(const u8 *data);
+extern void render_pic_buff(u8 *buff, const u8 *data, u8 overlay);
 
 #endif /* NAGI_PICTURE_PIC_RENDER_H */
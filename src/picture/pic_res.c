@@ -14,6 +14,7 @@
 
 
 #include <stdlib.h>
+#include <string.h>
 #include "../agi.h"
 
 
@@ -25,6 +26,8 @@
 
 #include "../picture/pic_res.h"
 #include "../picture/pic_render.h"
+#include "../picture/pic_cache.h"
+#include "../picture/pic_prerender.h"
 
 #include "../res/res.h"
 
@@ -49,7 +52,8 @@
 static PIC *pic_find(u16 pic_num);
 
 static PIC pic_head = {0,0,0};	// the pic head struct
-static PIC *last_pic;
+static PIC *last_pic = &pic_head;	// the end of the list
+static PIC *pic_index[256];		// the list's nodes by number
 u16 pic_visible = 0;
 
 
@@ -63,12 +67,14 @@ void pic_list_init()
 	{
 		next = cur->next;
 		if (cur->data != 0)
-			a_free(cur->data);
+			room_free(cur->data);
 		a_free(cur);
 		cur = next;
 	}
 	
 	pic_head.next = 0;
+	last_pic = &pic_head;
+	memset(pic_index, 0, sizeof(pic_index));
 } 
 
 void pic_list_new_room()
@@ -78,24 +84,12 @@ void pic_list_new_room()
 
 // finds the pointer to a pic struct
 // passes 0 if nothing found.
+// last_pic is always the end of the list so a new one can be added onto it
 static PIC *pic_find(u16 pic_num)
 {
-	PIC *next, *cur;
-	
-	next = pic_head.next;
-	cur = &pic_head;
-	goto loop;
-	
-next_pic:
-	cur = next;
-	next = next->next;
-loop:
-	if (next != 0)
-		if (next->num != pic_num)
-			goto next_pic;
-	
-	last_pic = cur;	// used if reached zero
-	return (next);
+	if (pic_num >= 256)
+		return 0;
+	return pic_index[pic_num];
 }
 
 u8 *cmd_load_pic(u8 *c)
@@ -123,10 +117,12 @@ PIC *pic_load(u16 pic_num)
 			prev = last_pic;
 			prev->next = n;
 			n->next = 0;	// next_struct
+			last_pic = n;
 		}
 
 		n->num = pic_num;	// pic_num
-		n->data = vol_res_load( dir_picture(pic_num), 0);
+		pic_index[n->num] = n;
+		n->data = vol_res_room_load( dir_picture(pic_num), 0);
 		
 		if (n->data == 0) return 0;
 	
@@ -155,10 +151,14 @@ void pic_draw(u16 pic_num)
 		set_agi_error(0x12, pic_num);
 
 	script_write(4, pic_num);
-	given_pic_data = cur->data;
 	
 	blists_erase();
-	render_pic(0);
+	pic_prerender_collect(pic_num);
+	if (!pic_cache_draw(pic_num))
+	{
+		render_pic(cur->data);
+		pic_cache_store();
+	}
 	blists_draw();
 	
 	pic_visible = 0;
@@ -181,10 +181,13 @@ void pic_overlay(u16 pic_num)
 		set_agi_error(0x12, pic_num);
 	
 	script_write(8, pic_num);
-	given_pic_data = cur->data;
 	
 	blists_erase();
-	render_overlay();	// no clearing
+	if (!pic_cache_overlay(pic_num))
+	{
+		render_overlay(cur->data);	// no clearing
+		pic_cache_store();
+	}
 	blists_draw();
 	blists_update();
 	
@@ -210,7 +213,7 @@ u8 *cmd_discard_pic(u8 *c)
 
 void pic_discard(u16 pic_num)
 {
-	PIC *cur;
+	PIC *cur, *prev, *n;
 	
 	cur = pic_find(pic_num);
 
@@ -219,13 +222,20 @@ void pic_discard(u16 pic_num)
 
 	script_write(6, pic_num);
 
-	last_pic->next = 0;
+	// the list gets cut off at the one before it
+	for (prev = &pic_head; prev->next != cur; prev = prev->next)
+		;
+	for (n = cur; n != 0; n = n->next)
+		pic_index[n->num] = 0;
+	prev->next = 0;
+	last_pic = prev;
 	
 	blists_erase();
 	
 	if (cur->data != 0)
-		a_free(cur->data);
+		room_free(cur->data);
 	a_free(cur);
+	pic_cache_discard(pic_num);
 	
 	blists_draw();
 
@@ -14,9 +14,11 @@ END picture render video related functions */
 #include "../picture/sbuf_util.h"
 
 #include "../picture/pic_render.h"
+#include "../view/obj_picbuff.h"
 
 #include "../sys/drv_video.h"
 #include "../sys/gfx.h"
+#include "../sys/mem_wrap.h"
 
 /*
 CGARelated135B
@@ -44,6 +46,7 @@ FinalPicX
 void sbuff_fill(u8 colour)
 {
 	memset(gfx_picbuff, colour, PICBUFF_WIDTH*PICBUFF_HEIGHT);
+	obj_ctl_invalidate();
 }
 
 #if 0
@@ -76,56 +79,56 @@ static void sbuff_testpattern()
 
 
 // y pos's should be equal or you suck
-void sbuff_xline()
+void sbuff_xline(PIC_RENDER *r)
 {
 	u8 x1, x2, x_orig, len;
 	u8 *b;
 	u8 colour;
 	
-	x1 = pos_init_x;
-	x2 = pos_final_x;
+	x1 = r->pos_init_x;
+	x2 = r->pos_final_x;
 	x_orig = x2;	// push init position
 
-	if (pos_init_x > pos_final_x)
+	if (r->pos_init_x > r->pos_final_x)
 	{
 		u8 temp;
 		
 		temp = x1;
 		x1 = x2;
 		x2 = temp;
-		pos_init_x = x1;
-		pos_final_x = x2;
+		r->pos_init_x = x1;
+		r->pos_final_x = x2;
 	}
 
 	// TODO: replicated from sbuff_plot code
-	b = gfx_picbuff + PBUF_MULT(pos_init_y) + pos_init_x;
-	if ((pos_init_y & 1) == 0)
-		colour = col_even;
+	b = r->buff + PBUF_MULT(r->pos_init_y) + r->pos_init_x;
+	if ((r->pos_init_y & 1) == 0)
+		colour = r->col_even;
 	else
-		colour = col_odd;
-	*b = (*b | sbuff_drawmask) & colour;
+		colour = r->col_odd;
+	*b = (*b | r->drawmask) & colour;
 
 	len = x2 - x1;
 	while (len != 0)
 	{
 		b++;		// b is given from sbuff_plot
-		*b = (*b | sbuff_drawmask) & colour;
+		*b = (*b | r->drawmask) & colour;
 		len--;
 	}
 	
-	pos_init_x= x_orig;	// pop init position
+	r->pos_init_x= x_orig;	// pop init position
 	
 }
 
 
-void sbuff_yline()
+void sbuff_yline(PIC_RENDER *r)
 {
 	u8 y1, y2, y_orig, len;
 	u8 *b;
 	u8 colour;
 	
-	y1 = pos_init_y;
-	y2 = pos_final_y;
+	y1 = r->pos_init_y;
+	y2 = r->pos_final_y;
 	y_orig = y2;
 	
 	if (y1 >= y2)
@@ -133,266 +136,238 @@ void sbuff_yline()
 		u8 temp = y1;
 		y1 = y2;
 		y2 = temp;
-		pos_final_y = y2;	
-		pos_init_y = y1;
+		r->pos_final_y = y2;	
+		r->pos_init_y = y1;
 	}
 	
-	b = gfx_picbuff + PBUF_MULT(pos_init_y) + pos_init_x;
-	if ((pos_init_y & 1) == 0)
-		colour = col_even;
+	b = r->buff + PBUF_MULT(r->pos_init_y) + r->pos_init_x;
+	if ((r->pos_init_y & 1) == 0)
+		colour = r->col_even;
 	else
-		colour = col_odd;
-	*b = (*b | sbuff_drawmask) & colour;
+		colour = r->col_odd;
+	*b = (*b | r->drawmask) & colour;
 	
 	len = y2 - y1;
 	
 	while (len != 0)
 	{	
 		if ((y1 & 1) == 0)
-			colour = col_odd;
+			colour = r->col_odd;
 		else
-			colour = col_even;
+			colour = r->col_even;
 
 		b += 160;
-		*b = (*b | sbuff_drawmask) & colour;
+		*b = (*b | r->drawmask) & colour;
 		len--;
 		y1++;
 	}
 
-	pos_init_y = y_orig;
+	r->pos_init_y = y_orig;
 }
 
-void sbuff_plot()
+void sbuff_plot(PIC_RENDER *r)
 {
 	u8 *b;
 	u8 colour, pixel;
 	
-	b = gfx_picbuff + PBUF_MULT(pos_init_y) + pos_init_x;
+	b = r->buff + PBUF_MULT(r->pos_init_y) + r->pos_init_x;
 	
-	if ((pos_init_y & 1) == 0)
-		colour = col_even;
+	if ((r->pos_init_y & 1) == 0)
+		colour = r->col_even;
 	else
-		colour = col_odd;
-	pixel = (*b | sbuff_drawmask) & colour;
+		colour = r->col_odd;
+	pixel = (*b | r->drawmask) & colour;
 	
 	*b = pixel;
 }
 
 
-static u8 left=0, right=0;
-static u8 direction=0, old_direction=0;
-static u8 toggle=0, old_toggle=0;		//, pos_x3;
-static u8 old_initx=0, old_inity=0;
-static u8 stack_left=0, stack_right=0;
-static u8 old_right=0, old_left=0;
 // FILL
-void sbuff_picfill(u8 ypos, u8 xpos)
+// fills a run of pixels as soon as it's found and queues it so the rows
+// above and below get looked at.  the row a run was found from only needs
+// looking at past the ends of the run that found it.  that's the same area
+// the original's line-by-line walk covers.
+// pixels go four at a time, one can be filled if (pixel & mask) == match
+
+#define FILL_WORD(b) ((u32)(b) * 0x01010101u)
+// set the top bit of every zero byte
+#define FILL_ZERO(w) (((w) - 0x01010101u) & ~(w) & 0x80808080u)
+#define FILL_GROW 256
+
+struct fill_span_struct
 {
-	u8 *b; // buffer
-	u8 fill_stack[3000];	// the agi stack is 2560.. and that's got a few function names in it. so this should be right
-	u8 *stack_ptr;
-	//DATA *d = 0;
+	u32 mask4;		// all in every byte
+	u32 match4;
+	u32 draw4;
+	u32 colour4[2];	// even and odd rows
+	u8 mask;
+	u8 match;
+};
+typedef struct fill_span_struct FILL_SPAN;
+
+static u32 fill_load(const u8 *b)
+{
+	u32 w;
+	memcpy(&w, b, sizeof(w));
+	return w;
+}
 
-	u8 al;		// temp al register
-	
-	// al = old, ah = new
-	u8 mask_bh, mask_dl, colour_bl;
-	u8 *old_buff, *temp;
-	u16 counter;
-	u8 colour_new, colour_old;
-	
-	b = gfx_picbuff + PBUF_MULT(ypos) + xpos;
-	mask_bh = sbuff_drawmask;
-	colour_bl = 0x4F;
-	stack_ptr = fill_stack;
-	
-/*
-	dl = bitmask?
-	bl = some sort of colour after bitmask
-		the colour that you can only fill in??
-*/	
+// first x at or after x that can be filled, or 160
+static s16 fill_skip(const FILL_SPAN *f, const u8 *row, s16 x)
+{
+	while ( (x + 4 <= 160) && (FILL_ZERO((fill_load(row + x) & f->mask4) ^ f->match4) == 0) )
+		x += 4;
+	while ( (x < 160) && ((row[x] & f->mask) != f->match) )
+		x++;
+	return x;
+}
 
-	// ***** Initialise masks and colours
-	
-	// depending on the bitmask.. sees if it's worth bothering
-	if ((sbuff_drawmask & 0x0F) != 0)
+// fill the run x is in, x can be filled
+static void fill_run(const FILL_SPAN *f, u8 *row, s16 y, s16 x, s16 *x0, s16 *x1)
+{
+	u32 w, colour4;
+	u8 colour;
+	s16 l, r;
+
+	colour4 = f->colour4[y & 1];
+	colour = (u8)colour4;
+
+	r = x;
+	while (r + 4 <= 160)
 	{
-		mask_dl = 0xF;
-		// filling in a white area.. already white man
-		if (colour_pictpart == 0x0F) return;
+		w = fill_load(row + r);
+		if ((w & f->mask4) != f->match4)
+			break;
+		w = (w | f->draw4) & colour4;
+		memcpy(row + r, &w, sizeof(w));
+		r += 4;
+	}
+	while ( (r < 160) && ((row[r] & f->mask) == f->match) )
+	{
+		row[r] = (row[r] | (u8)f->draw4) & colour;
+		r++;
+	}
 
+	l = x;
+	while (l >= 4)
+	{
+		w = fill_load(row + l - 4);
+		if ((w & f->mask4) != f->match4)
+			break;
+		w = (w | f->draw4) & colour4;
+		memcpy(row + l - 4, &w, sizeof(w));
+		l -= 4;
 	}
-	else
+	while ( (l > 0) && ((row[l - 1] & f->mask) == f->match) )
 	{
-		if ((sbuff_drawmask & 0xF0) == 0) return;
-		mask_dl = 0xF0;
-		if (colour_pripart == 0x40) return;
+		l--;
+		row[l] = (row[l] | (u8)f->draw4) & colour;
 	}
 
-	colour_bl = colour_bl & mask_dl;
-	if ( (*b & mask_dl) != colour_bl )
-		return;
+	*x0 = l;
+	*x1 = r - 1;
+}
 
-	memset(stack_ptr, 0xFF, 7);
-	stack_ptr += 7;
-	
-	//d = fill_push(d, 255,255,255,255,255,255,255 );	
-	// TODO: check for NO leaks in push /pop
+static void fill_push(PIC_RENDER *r, s16 y, s16 x0, s16 x1, s8 dir, s16 left, s16 right)
+{
+	PIC_FILL_SPAN *span;
 
-	// ***** Fill in a *line*
+	if (r->fill_total >= r->fill_size)
+	{
+		PIC_FILL_SPAN *grow;
 
-	left = 161;
-	right = 0;
-	direction = 1;
-	toggle = 0;
+		grow = (PIC_FILL_SPAN *)a_malloc((r->fill_size + FILL_GROW) * sizeof(PIC_FILL_SPAN));
+		if (r->fill_stack != 0)
+		{
+			memcpy(grow, r->fill_stack, r->fill_total * sizeof(PIC_FILL_SPAN));
+			a_free(r->fill_stack);
+		}
+		r->fill_stack = grow;
+		r->fill_size += FILL_GROW;
+	}
 
-loc52ca:			// fill a new line. 
-	old_right = right;
-	old_left = left;
-	old_toggle = toggle;
-	old_initx = pos_init_x;
-	
-	counter = pos_init_x;
+	span = &r->fill_stack[r->fill_total++];
+	span->y = (u8)y;
+	span->x0 = (u8)x0;
+	span->x1 = (u8)x1;
+	span->dir = dir;
+	span->left = (u8)left;
+	span->right = (u8)right;
+}
 
-	if ( (pos_init_y & 1) == 0)
-		colour_new = col_even;
-	else
-		colour_new = col_odd;
+// fill every run in x0..x1 of row y+dir that can be
+static void fill_row(PIC_RENDER *r, const FILL_SPAN *f, s16 y, s8 dir, s16 x0, s16 x1, s16 left, s16 right)
+{
+	u8 *row;
+	s16 x, run0, run1;
 
-	old_buff = b;
-	
-	counter++;
-	colour_old = *b;
+	y += dir;
+	if ( (y < 0) || (y > 167) || (x0 > x1) )
+		return;
 
-	// fill backwards from this point...
-	do
+	row = r->buff + PBUF_MULT(y);
+	x = fill_skip(f, row, x0);
+	while (x <= x1)
 	{
-		*b = (colour_old | sbuff_drawmask) & colour_new;
-		b--;
-		colour_old = *b;
-		counter--;
-	} while ( ( (colour_old & mask_dl) == colour_bl) && (counter != 0) );
-
-	b++;
-	counter = 159 - pos_init_x;
-	left = pos_init_x - (old_buff - b);
-	pos_init_x = left;
-
-	temp = old_buff;
-	old_buff = b;
-	b = temp;		// exchange buff, old_buff
-	b++;
-
-	// fill forwards
-	while (counter != 0)
-	{
-		colour_old = *b;
-		if ((colour_old & mask_dl) != colour_bl) break;
-
-		*b = ( colour_old | sbuff_drawmask ) & colour_new;
-		b++;
-		counter--;
+		fill_run(f, row, y, x, &run0, &run1);
+		fill_push(r, y, run0, run1, dir, left, right);
+		x = fill_skip(f, row, run1 + 1);
 	}
+}
 
-	right =  left + (b - old_buff) - 1;
-	// remember old_buff was swapped with di
+void sbuff_picfill(PIC_RENDER *r, u8 ypos, u8 xpos)
+{
+	FILL_SPAN f;
+	PIC_FILL_SPAN span;
+	u8 *row;
+	s16 x0, x1;
 
-	// ***** Find the next line to fill
+	// ***** Initialise masks and colours
 
-	if (old_left != 161)
+	// depending on the bitmask.. sees if it's worth bothering
+	if ((r->drawmask & 0x0F) != 0)
 	{
-		if (right == old_right)
-		{
-			if (left != old_left) goto loc5376;
-			if (toggle == 1) goto locnext;
-			toggle = 1;
-			old_initx = right;
-		}
-		else if (right > old_right)
-		{
-		loc5376:
-			toggle = 0;
-			old_initx = old_right;
-		}
-		else 
-		{
-			toggle = 0;
-			old_initx = right;	
-		}
-		
-		*(stack_ptr++) = old_toggle;
-		*(stack_ptr++) = direction;
-		*(stack_ptr++) = old_direction;
-		*(stack_ptr++) = old_inity;
-		*(stack_ptr++) = old_initx;
-		*(stack_ptr++) = old_right;
-		*(stack_ptr++) = old_left;
-
-		//d = fill_push(d, old_left, old_right, old_initx, old_inity, old_direction, direction, old_toggle);
+		f.mask = 0xF;
+		// filling in a white area.. already white man
+		if (r->colour_pictpart == 0x0F) return;
 	}
-
-locnext:
-
-	old_direction = direction;
-	old_inity = pos_init_y;
-	pos_init_y += direction;
-	
-	for(;;)
+	else
 	{
-		if (pos_init_y > 167)
-			goto loc5413;
-	loc53A8:
-		b = gfx_picbuff + PBUF_MULT(pos_init_y) + pos_init_x;
-		if ((*b & mask_dl) == colour_bl) goto loc52ca;
-	
-		// redirected position isn't a fill colour??
-		if (direction == old_direction) goto loc5406;
-		if (toggle == 1) goto loc5406;
-		if (pos_init_x < stack_left) goto loc5406;
-		if (pos_init_x > stack_right) goto loc5406;
-		if (stack_right >= right) goto loc5413;
-		
-		pos_init_x = stack_right +1;
-	loc5406:
-		if (pos_init_x < right)
-		{
-			pos_init_x++;
-			goto loc53A8;
-		}
-		// reached the edge of screen??
-	loc5413:
-		// al = direction;
-		if ( (direction == old_direction) && (toggle == 0) )
-		{
-			direction = -direction;
-			pos_init_x = left;
-			pos_init_y = old_inity;
-			al = old_inity;
-		}
-		else
-		{
-			left = *(--stack_ptr);
-			right = *(--stack_ptr);
-			pos_init_x = *(--stack_ptr);
-			pos_init_y = *(--stack_ptr);
-			old_direction = *(--stack_ptr);
-			direction = *(--stack_ptr);
-			toggle = *(--stack_ptr);
-			//d = fill_pop(d, &left, &right, &pos_init_x, &pos_init_y, &old_direction, &direction, &toggle);
-	
-			al = pos_init_y;
-			if (pos_init_y == 0xFF)
-				return;
-			old_inity = pos_init_y;
-		}
-	
-		// last pushed onto stack.. pos_old_1_rl
-		stack_left = *(stack_ptr-1);
-		stack_right = *(stack_ptr-2);
-		//fill_topab(d, &stack_left, &stack_right);
-		pos_init_y = al + direction;
+		if ((r->drawmask & 0xF0) == 0) return;
+		f.mask = 0xF0;
+		if (r->colour_pripart == 0x40) return;
 	}
+	f.match = 0x4F & f.mask;
 
-}
+	row = r->buff + PBUF_MULT(ypos);
+	if ((row[xpos] & f.mask) != f.match)
+		return;
+
+	// a colour byte out of range can still leave the area fillable.
+	// the original never finished those
+	if ( ((r->col_even & f.mask) == f.match) || ((r->col_odd & f.mask) == f.match) )
+		return;
 
+	f.mask4 = FILL_WORD(f.mask);
+	f.match4 = FILL_WORD(f.match);
+	f.draw4 = FILL_WORD(r->drawmask);
+	f.colour4[0] = FILL_WORD(r->col_even);
+	f.colour4[1] = FILL_WORD(r->col_odd);
+
+	// ***** Fill in a *line*
+	fill_run(&f, row, ypos, xpos, &x0, &x1);
+	r->fill_total = 0;
+	fill_push(r, ypos, x0, x1, 1, x0, x1);
+	fill_push(r, ypos, x0, x1, -1, x0, x1);
 
+	// ***** Find the next lines to fill
+	while (r->fill_total != 0)
+	{
+		span = r->fill_stack[--r->fill_total];
+
+		fill_row(r, &f, span.y, span.dir, span.x0, span.x1, span.x0, span.x1);
+		// back the way it came, past the ends of the run that found it
+		fill_row(r, &f, span.y, -span.dir, span.x0, span.left - 1, span.x0, span.x1);
+		fill_row(r, &f, span.y, -span.dir, span.right + 1, span.x1, span.x0, span.x1);
+	}
+}
@@ -1,10 +1,12 @@
 #ifndef NAGI_PICTURE_SBUF_UTIL_H
 #define NAGI_PICTURE_SBUF_UTIL_H
 
+struct pic_render_struct;
+
 extern void sbuff_fill(u8 colour);
-extern void sbuff_plot(void);
-extern void sbuff_xline(void);
-extern void sbuff_yline(void);
-extern void sbuff_picfill(u8 ypos, u8 xpos);
+extern void sbuff_plot(struct pic_render_struct *r);
+extern void sbuff_xline(struct pic_render_struct *r);
+extern void sbuff_yline(struct pic_render_struct *r);
+extern void sbuff_picfill(struct pic_render_struct *r, u8 ypos, u8 xpos);
 
 #endif /* NAGI_PICTURE_SBUF_UTIL_H */
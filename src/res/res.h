@@ -1,14 +1,26 @@
 #ifndef NAGI_RES_RES_H
 #define NAGI_RES_RES_H
 
+// resource types, in the order they're kept in the pack
+#define RES_TYPE_LOGIC 0
+#define RES_TYPE_PIC 1
+#define RES_TYPE_VIEW 2
+#define RES_TYPE_SOUND 3
+#define RES_TYPE_MAX 4
+
 // res_dir.c
 
 extern void dir_load(void);
 extern void dir_unload(void);
 extern u8 *dir_logic(u16 num);
+extern u8 *dir_logic_find(u16 num);
+extern u16 dir_logic_count(void);
 extern u8 *dir_view(u16 num);
 extern u8 *dir_picture(u16 num);
+extern u8 *dir_picture_find(u16 num);
 extern u8 *dir_sound(u16 num);
+extern u8 *dir_find(u16 type, u16 num);
+extern u16 dir_count(u16 type);
 
 // res_vol.c
 
@@ -18,17 +30,62 @@ extern size_t res_size;
 extern u16 not_compressed;
 
 extern u8 *vol_res_load(const u8 *dir_entry, u8 *buff);
+extern u8 *vol_res_room_load(const u8 *dir_entry, u8 *buff);
+extern u8 *vol_res_fetch(const u8 *dir_entry, void *lzw_dict, size_t *size, u16 *plain);
+extern size_t vol_res_need(const u8 *dir_entry, const u8 *data, size_t got);
+extern u8 *vol_res_decode(const u8 *data, void *lzw_dict, size_t *size, u16 *plain);
+extern struct aio_file_struct *vol_res_aio(const u8 *dir_entry, u64 *pos);
 extern void err_msg(char *msg, u16 num);
 extern void volumes_close(void);
 extern u8 *file_load(const char *name, u8 *buff);
 
+// res_pack.c
+
+extern void pack_load(void);
+extern void pack_unload(void);
+extern const u8 *pack_res_find(const u8 *dir_entry, size_t *size);
+extern int pack_build(void);
+
+// res_cache.c
+
+// decoded resources kept between rooms
+#define RES_CACHE_ENTRIES 256
+
+extern const u8 *res_cache_find(const u8 *dir_entry, size_t *size);
+extern u16 res_cache_has(const u8 *dir_entry);
+extern void res_cache_store(const u8 *dir_entry, const u8 *data, size_t size);
+extern void res_cache_clear(void);
+// the cache budget's plain and packed tiers
+extern size_t res_cache_usage(size_t *oldest_bytes, u32 *oldest_age);
+extern void res_cache_evict(void);
+extern size_t res_pack_usage(size_t *oldest_bytes, u32 *oldest_age);
+extern void res_pack_evict(void);
+
+// res_prefetch.c
+
+// resources decoded ahead at a time
+#define RES_PREFETCH_JOBS 16
+
+struct logic_struct;
+extern void res_prefetch_init(void);
+extern void res_prefetch_denit(void);
+extern void res_prefetch_flush(void);
+extern void res_prefetch_logic(struct logic_struct *log);
+extern void res_prefetch_res(u16 type, u16 num);
+extern u8 *res_prefetch_take(const u8 *dir_entry, u8 *buff, u16 room);
+
 // res_lzw.c
 
 extern void lzw_init(void);
 extern void lzw_shutdown(void);
-extern u16 lzw_decompress(FILE *cfile, u8 *cbuff, u16 fsize, u8 *ubuff, u16 usize);
+extern u16 lzw_decompress(FILE *cfile, u16 fsize, u8 *ubuff, u16 usize);
+extern u16 lzw_decompress_mem(const u8 *cmem, u16 fsize, u8 *ubuff, u16 usize);
+extern void *lzw_dict_new(void);
+extern void lzw_dict_free(void *dict);
+extern u16 lzw_decompress_dict(void *dict, const u8 *cmem, u16 fsize, u8 *ubuff, u16 usize);
 
 // res_pic.c
 u16 pic_decompress(FILE *cfile, u8 *cbuff, u16 cfile_size, u8 *buff, u16 cbuff_size);
+u16 pic_decompress_mem(const u8 *cmem, u8 *cbuff, u16 cfile_size, u8 *buff, u16 cbuff_size);
 
 #endif /* NAGI_RES_RES_H */
@@ -0,0 +1,227 @@
+/*
+Decoded resource cache
+
+new.room throws away every resource the last room loaded, so walking back
+and forth between two rooms loads and decompresses the same data again.
+vol_res_load() keeps a copy of what it decodes here and hands out copies
+of it instead of going back to the vols.  how much it can hold is up to the
+cache budget (mem_budget.c), least recently used out first.
+
+that's two tiers.  what the budget takes from the plain one is lz4
+compressed and kept (if it's worth it) instead of being thrown away, and
+it's only gone from the cache once the budget takes it from the packed
+tier too.  a packed entry that's wanted again is unpacked and plain again.
+
+it's only a copy of the vol data.. what's logically loaded is still up to
+the logic, view, picture and sound lists.
+*/
+
+#define MEM_TAG MEM_CACHE
+
+#include <string.h>
+
+#include "../agi.h"
+#include "res.h"
+
+#include "../sys/lz4.h"
+#include "../sys/mem_budget.h"
+#include "../sys/mem_wrap.h"
+
+struct res_cache_struct
+{
+	u8 dir_entry[3];	// where it is in the vols
+	u16 plain;		// not_compressed
+	u8 *data;		// 0 if it's free
+	size_t size;
+	size_t packed;		// bytes of lz4 data holds, 0 if it's plain
+	u32 used;		// stamp of the last time it was wanted
+	Uint64 used_ms;
+};
+typedef struct res_cache_struct RES_CACHE;
+
+static RES_CACHE res_cache[RES_CACHE_ENTRIES];
+static size_t res_cache_bytes = 0;
+static size_t res_pack_bytes = 0;
+static u32 res_cache_stamp = 0;
+
+static RES_CACHE *res_cache_lookup(const u8 *dir_entry)
+{
+	int i;
+
+	if (dir_entry == 0)
+		return 0;
+	for (i = 0; i < RES_CACHE_ENTRIES; i++)
+		if ( (res_cache[i].data != 0) && (memcmp(res_cache[i].dir_entry, dir_entry, 3) == 0) )
+			return &res_cache[i];
+	return 0;
+}
+
+static void res_cache_drop(RES_CACHE *c)
+{
+	if ( (c == 0) || (c->data == 0) )
+		return;
+	a_free(c->data);
+	if (c->packed != 0)
+		res_pack_bytes -= c->packed;
+	else
+		res_cache_bytes -= c->size;
+	c->data = 0;
+	c->size = 0;
+	c->packed = 0;
+}
+
+// the least recently used entry of a tier, 0 if it has none
+static RES_CACHE *res_cache_oldest(u8 packed)
+{
+	RES_CACHE *c;
+	int i;
+
+	c = 0;
+	for (i = 0; i < RES_CACHE_ENTRIES; i++)
+		if ( (res_cache[i].data != 0) && ((res_cache[i].packed != 0) == packed) &&
+			((c == 0) || (res_cache[i].used < c->used)) )
+			c = &res_cache[i];
+	return c;
+}
+
+// a free entry or the least recently used one of either tier
+static RES_CACHE *res_cache_victim(void)
+{
+	RES_CACHE *plain, *packed;
+	int i;
+
+	for (i = 0; i < RES_CACHE_ENTRIES; i++)
+		if (res_cache[i].data == 0)
+			return &res_cache[i];
+	plain = res_cache_oldest(0);
+	packed = res_cache_oldest(1);
+	if ( (plain == 0) || ((packed != 0) && (packed->used < plain->used)) )
+		return packed;
+	return plain;
+}
+
+// back to the plain tier.  0 if the packed copy's no good
+static u8 res_cache_unpack(RES_CACHE *c)
+{
+	u8 *data;
+
+	data = (u8 *)a_malloc(c->size);
+	if (lz4_decompress(c->data, c->packed, data, c->size) != c->size)
+	{
+		a_free(data);
+		res_cache_drop(c);
+		return 0;
+	}
+	a_free(c->data);
+	res_pack_bytes -= c->packed;
+	res_cache_bytes += c->size;
+	c->data = data;
+	c->packed = 0;
+	return 1;
+}
+
+// the cached resource at dir_entry's vol location, 0 if it's not there
+const u8 *res_cache_find(const u8 *dir_entry, size_t *size)
+{
+	RES_CACHE *c;
+
+	c = res_cache_lookup(dir_entry);
+	if (c == 0)
+		return 0;
+	if ( (c->packed != 0) && !res_cache_unpack(c) )
+		return 0;
+	if (c_game_compression)
+		not_compressed = c->plain;
+	c->used = ++res_cache_stamp;
+	c->used_ms = SDL_GetTicks();
+	*size = c->size;
+	return c->data;
+}
+
+u16 res_cache_has(const u8 *dir_entry)
+{
+	return res_cache_lookup(dir_entry) != 0;
+}
+
+// keep a copy of a resource that's just been decoded
+void res_cache_store(const u8 *dir_entry, const u8 *data, size_t size)
+{
+	RES_CACHE *c;
+
+	// a few big ones would push everything else out
+	if ( (dir_entry == 0) || (size == 0) || (size > mem_budget_limit() / 4) ||
+		(res_cache_lookup(dir_entry) != 0) )
+		return;
+
+	c = res_cache_victim();
+	res_cache_drop(c);
+	c->data = (u8 *)a_malloc(size);
+	memcpy(c->data, data, size);
+	memcpy(c->dir_entry, dir_entry, 3);
+	c->plain = not_compressed;
+	c->size = size;
+	c->packed = 0;
+	c->used = ++res_cache_stamp;
+	c->used_ms = SDL_GetTicks();
+	res_cache_bytes += size;
+}
+
+// for the cache budget, the plain tier
+size_t res_cache_usage(size_t *oldest_bytes, u32 *oldest_age)
+{
+	RES_CACHE *c;
+
+	c = res_cache_oldest(0);
+	*oldest_bytes = (c != 0) ? c->size : 0;
+	*oldest_age = (c != 0) ? (u32)(SDL_GetTicks() - c->used_ms) : 0;
+	return res_cache_bytes;
+}
+
+// into the packed tier, or gone if it doesn't compress
+void res_cache_evict(void)
+{
+	RES_CACHE *c;
+	u8 *data;
+	size_t packed;
+
+	c = res_cache_oldest(0);
+	if (c == 0)
+		return;
+	data = lz4_pack(c->data, c->size, &packed);
+	if (data == 0)
+	{
+		res_cache_drop(c);
+		return;
+	}
+	a_free(c->data);
+	res_cache_bytes -= c->size;
+	res_pack_bytes += packed;
+	c->data = data;
+	c->packed = packed;
+}
+
+// the packed tier
+size_t res_pack_usage(size_t *oldest_bytes, u32 *oldest_age)
+{
+	RES_CACHE *c;
+
+	c = res_cache_oldest(1);
+	*oldest_bytes = (c != 0) ? c->packed : 0;
+	*oldest_age = (c != 0) ? (u32)(SDL_GetTicks() - c->used_ms) : 0;
+	return res_pack_bytes;
+}
+
+void res_pack_evict(void)
+{
+	res_cache_drop(res_cache_oldest(1));
+}
+
+void res_cache_clear(void)
+{
+	int i;
+
+	for (i = 0; i < RES_CACHE_ENTRIES; i++)
+		res_cache_drop(&res_cache[i]);
+	res_cache_bytes = 0;
+	res_pack_bytes = 0;
+}
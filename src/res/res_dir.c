@@ -28,6 +28,7 @@ _ResNotFound                     cseg     00004441 0000002F
 
 #include "../sys/agi_file.h"
 #include "../sys/mem_wrap.h"
+#include "../sys/zip_mount.h"
 
 #define DIR_ITEM_SIZE 3
 
@@ -37,7 +38,25 @@ static u8 *dir_log_data = 0;
 static u8 *dir_pic_data = 0;
 static u8 *dir_view_data = 0;
 static u8 *dir_snd_data = 0;
+static u16 dir_log_count = 0;	// number of entries in the logic dir
+static u16 dir_pic_count = 0;	// and the picture dir
+static u16 dir_view_count = 0;
+static u16 dir_snd_count = 0;
 
+// in the game's zip or its directory
+static int dir_file_exists(const char *name)
+{
+	FILE *stream;
+	size_t size;
+
+	if (zip_game_file(name, &size) != 0)
+		return 1;
+	stream = fopen_nocase(name);
+	if (stream == 0)
+		return 0;
+	fclose(stream);
+	return 1;
+}
 
 void dir_load(void)
 {
@@ -71,9 +90,9 @@ void dir_load(void)
 	while (!dir_loaded)
 	{
 		char *dir_v3_name = alloca(strlen("dir") + ID_SIZE + 1);
-		FILE *dir_stream;
+		int dir_found;
 		
-		dir_stream = 0;
+		dir_found = 0;
 		
 		switch (dir_type)
 		{
@@ -85,9 +104,13 @@ void dir_load(void)
 				if (dir_type_ptr)
 					printf("dir_load(): attempting to load seperated dir structure.\n");
 				dir_log_data = file_to_buf("logdir");
+				dir_log_count = (dir_log_data != 0) ? file_buf_size / DIR_ITEM_SIZE : 0;
 				dir_pic_data = file_to_buf("picdir");
+				dir_pic_count = (dir_pic_data != 0) ? file_buf_size / DIR_ITEM_SIZE : 0;
 				dir_view_data = file_to_buf("viewdir");
+				dir_view_count = (dir_view_data != 0) ? file_buf_size / DIR_ITEM_SIZE : 0;
 				dir_snd_data = file_to_buf("snddir");
+				dir_snd_count = (dir_snd_data != 0) ? file_buf_size / DIR_ITEM_SIZE : 0;
 				dir_ver = 2;
 				if ( (dir_log_data != 0) && (dir_pic_data != 0) && 
 					(dir_view_data != 0) && (dir_snd_data != 0) )
@@ -100,28 +123,33 @@ void dir_load(void)
 					printf("dir_load(): attempting to load combined PC dir structure.\n");
 				sprintf(dir_v3_name, "%sdir", c_game_file_id);
 //				dir_stream = fopen(dir_v3_name, "rb");
-				dir_stream = fopen_nocase(dir_v3_name);
+				dir_found = dir_file_exists(dir_v3_name);
 				break;
 			case 3:
 				if (dir_type_ptr)
 					printf("dir_load(): attempting to load combined Amiga dir structure.\n");
 				sprintf(dir_v3_name, "dirs");
 //				dir_stream = fopen(dir_v3_name, "rb");
-				dir_stream = fopen_nocase(dir_v3_name);
+				dir_found = dir_file_exists(dir_v3_name);
 				break;
 			case -1:
 			default:
 			;
 		}
 		
-		if (dir_stream != 0)
+		if (dir_found)
 		{
-			fclose(dir_stream);
 			dir_data = file_load(dir_v3_name, 0);
 			dir_log_data = dir_data + load_le_16(dir_data+0);
+			dir_log_count = (load_le_16(dir_data+2) - load_le_16(dir_data+0)) / DIR_ITEM_SIZE;
 			dir_pic_data = dir_data + load_le_16(dir_data+2);
+			dir_pic_count = (load_le_16(dir_data+4) - load_le_16(dir_data+2)) / DIR_ITEM_SIZE;
 			dir_view_data = dir_data + load_le_16(dir_data+4);
+			dir_view_count = (load_le_16(dir_data+6) - load_le_16(dir_data+4)) / DIR_ITEM_SIZE;
 			dir_snd_data = dir_data + load_le_16(dir_data+6);
+			// sounds run to the end of the file
+			dir_snd_count = (res_size > load_le_16(dir_data+6)) ?
+				(res_size - load_le_16(dir_data+6)) / DIR_ITEM_SIZE : 0;
 			dir_ver = 3;
 			dir_loaded = 1;
 		}
@@ -157,9 +185,13 @@ void dir_unload(void)
 	
 	dir_data = 0;
 	dir_log_data = 0;
+	dir_log_count = 0;
 	dir_pic_data = 0;
+	dir_pic_count = 0;
 	dir_view_data = 0;
+	dir_view_count = 0;
 	dir_snd_data = 0;
+	dir_snd_count = 0;
 }
 
 // checks the first four bits of a vol_item.
@@ -188,6 +220,19 @@ u8 *dir_logic(u16 num)
 	return entry;
 }
 
+// same as dir_logic() but returns 0 instead of quitting if it doesn't exist
+u8 *dir_logic_find(u16 num)
+{
+	if (num >= dir_log_count)
+		return 0;
+	return dir_check(dir_log_data + num * DIR_ITEM_SIZE);
+}
+
+u16 dir_logic_count(void)
+{
+	return dir_log_count;
+}
+
 u8 *dir_view(u16 num)
 {
 	u8 *entry;
@@ -206,6 +251,14 @@ u8 *dir_picture(u16 num)
 	return entry;
 }
 
+// same as dir_picture() but returns 0 instead of quitting if it doesn't exist
+u8 *dir_picture_find(u16 num)
+{
+	if (num >= dir_pic_count)
+		return 0;
+	return dir_check(dir_pic_data + num * DIR_ITEM_SIZE);
+}
+
 u8 *dir_sound(u16 num)
 {
 	u8 *entry;
@@ -215,4 +268,39 @@ u8 *dir_sound(u16 num)
 	return entry;
 }
 
+// any type of resource.  0 if it's not in the directory
+u8 *dir_find(u16 type, u16 num)
+{
+	switch (type)
+	{
+		case RES_TYPE_LOGIC:
+			return dir_logic_find(num);
+		case RES_TYPE_PIC:
+			return dir_picture_find(num);
+		case RES_TYPE_VIEW:
+			if (num >= dir_view_count)
+				return 0;
+			return dir_check(dir_view_data + num * DIR_ITEM_SIZE);
+		case RES_TYPE_SOUND:
+			if (num >= dir_snd_count)
+				return 0;
+			return dir_check(dir_snd_data + num * DIR_ITEM_SIZE);
+	}
+	return 0;
+}
 
+u16 dir_count(u16 type)
+{
+	switch (type)
+	{
+		case RES_TYPE_LOGIC:
+			return dir_log_count;
+		case RES_TYPE_PIC:
+			return dir_pic_count;
+		case RES_TYPE_VIEW:
+			return dir_view_count;
+		case RES_TYPE_SOUND:
+			return dir_snd_count;
+	}
+	return 0;
+}
@@ -7,197 +7,183 @@ _LzwBuffShift                    cseg     00000A01 00000030
 
 #include "../agi.h"
 #include "../res/res.h"
-#include "../sys/endian.h"
 
-#include <errno.h>
 #include <string.h>
 
+// every string in the dictionary is one that's already been written out.
+// a new code is the previous string plus the first byte of the next one and
+// those sit next to each other in the output.. so all a code needs is where
+// its string starts and how long it is.
 struct dict_struct
 {
-	u16 prev;
-	u8 ascii;
+	u16 off;
+	u16 len;
 };
 typedef struct dict_struct DICT;
-	
-static void lzw_buff_fill(u16 cur_byte);
-static u16 lzw_read_next(void);
-static void lzw_buff_shift(void);
 
-static DICT *lzw_dict = 0;
+#define LZW_DICT_SIZE 0x800
+#define LZW_CODE_RESET 0x100
+#define LZW_CODE_END 0x101
+#define LZW_CODE_FIRST 0x102
+#define LZW_WIDTH_MAX 11
+
+static u16 lzw_decode(DICT *dict, const u8 *src, u16 src_size, u8 *dst, u16 dst_size);
 
-static FILE *lzw_res_stream = 0;
-static u16 lzw_buff_size = 0;
-static u16 lzw_res_size = 0;
-static u8 *lzw_buff = 0;
-static u16 lzw_code_width = 0;
-static u16 lzw_code_mask[] = {0x1FF, 0x3FF, 0x7FF, 0xFFF}; //code mask (9bits, 10 bits, 11 bits, 12 bits 
-static u16 lzw_bit_cur = 0;	// current bit
-static u16 lzw_bit_max = 0;	// max number of bits in lzw_buffer
-
-// var8 = res stream handle
-// vara = comp buff
-// varc = compressed size
-// vare = uncompressed buff
-// var10 = decomp buff size
+static DICT *lzw_dict = 0;
+static u8 *lzw_in = 0;		// compressed data read in from a stream
+static u16 lzw_in_size = 0;
 
 void lzw_init()
 {
 	// allocate memory for the LZW dictionary
 	if (lzw_dict != 0) { return; }
-	lzw_dict = malloc(0x800 * sizeof(DICT));
+	lzw_dict = malloc(LZW_DICT_SIZE * sizeof(DICT));
 }
 
 void lzw_shutdown()
 {
+	if (lzw_in != 0)
+		free(lzw_in);
+	lzw_in = 0;
+	lzw_in_size = 0;
 	if (lzw_dict == 0) { return; }
 	free(lzw_dict);
 	lzw_dict = 0;
 }
 
-u16 lzw_decompress(FILE *cfile, u8 *cbuff, u16 fsize, u8 *lzw_uncomp_buff, u16 cbuff_size)
+// reads the compressed data in whole then decodes it like a mapped vol
+u16 lzw_decompress(FILE *cfile, u16 fsize, u8 *ubuff, u16 usize)
 {
-	u16 code_cur = 0;	// code	
-	u16 code_prev = 0;	// code
-	u16 code_read = 0;
-	u16 code_next = 0x102;	// the next code to be written
-	u16 stack_size = 0;		// number of times something is pushed onto stack
-	u16 code_max = 0x200;	
-	u8 lzw_ascii = 0;		// "ascii"?
-	u8 *di;
-	u8 code_string[2048];
-	u8 *str_ptr;
-	
-	errno = 0;  // reset file errors that may have occured from vol opening
-	
-	lzw_res_stream = cfile;
-	lzw_buff = cbuff;
-	lzw_res_size = fsize;
-	lzw_buff_size = cbuff_size;
-	lzw_bit_max = (lzw_buff_size - 2)<<3;
-	lzw_code_width = 9;
-	lzw_bit_cur = 0;
-	lzw_buff_fill(0);
-	
-	di = lzw_uncomp_buff;
-	if (errno == 0)
+	if (fsize > lzw_in_size)
 	{
-		code_read = lzw_read_next();
-		while ( (errno==0)&&(code_read!=0x101) )
-		{	
-			if (code_read == 0x100)	// start over code
-			{
-				lzw_code_width = 9;
-				code_max = 0x200;
-				code_next = 0x102;
-				code_read = lzw_read_next();
-				if (errno != 0)
-					break;
-					//return di - lzw_uncomp_buff;
-				code_cur = code_read;
-				code_prev = code_read;
-				lzw_ascii = code_read;
-				*(di++) = code_read;
-			}
-			else
-			{
-				code_cur = code_read;
-				str_ptr = code_string;
-				if ( code_cur >= code_next)
-				{
-					code_cur = code_prev;
-					*(str_ptr++) = lzw_ascii;
-					stack_size++;
-				}
-				
-				while (code_cur >= 0x100)
-				{
-					*(str_ptr++) = lzw_dict[code_cur].ascii;
-					stack_size++;
-					code_cur = lzw_dict[code_cur].prev;
-				}
-				lzw_ascii = code_cur;
-				*(str_ptr++) = lzw_ascii;
-				stack_size++;
-				
-				while (stack_size > 0)
-				{
-					str_ptr--;
-					*(di++) = *str_ptr;
-					stack_size--;
-				}			
-				stack_size = 0;
-		
-				lzw_dict[code_next].ascii = lzw_ascii;
-				lzw_dict[code_next].prev = code_prev;
-				code_next++;
-				code_prev = code_read;
-				if ( (code_next>=code_max) && (lzw_code_width!=11) )
-				{
-					lzw_code_width++;
-					code_max <<= 1;
-				}
-			}
-			code_read = lzw_read_next();
-		}
+		if (lzw_in != 0)
+			free(lzw_in);
+		lzw_in = malloc(fsize);
+		lzw_in_size = (lzw_in != 0) ? fsize : 0;
+		if (lzw_in == 0)
+			return 0;
 	}
+	if (fread(lzw_in, sizeof(u8), fsize, cfile) != fsize)
+		return 0;
+	if (lzw_dict == 0)
+		lzw_init();
+	return lzw_decode(lzw_dict, lzw_in, fsize, ubuff, usize);
+}
 
-	return di - lzw_uncomp_buff;
+u16 lzw_decompress_mem(const u8 *cmem, u16 fsize, u8 *ubuff, u16 usize)
+{
+	if (lzw_dict == 0)
+		lzw_init();
+	return lzw_decode(lzw_dict, cmem, fsize, ubuff, usize);
 }
 
-// cur byte in the lzw_buff.. not in the res
-static void lzw_buff_fill(u16 cur_byte)	// cur point?
+// for decoding off the main thread.. each thread needs its own dictionary
+void *lzw_dict_new(void)
 {
-	u16 temp2;
-	temp2 = lzw_buff_size - cur_byte;
-	
-	if ( temp2 < lzw_res_size)
-		lzw_res_size -= temp2;
-	else
-	{
-		temp2 = lzw_res_size;
-		lzw_res_size = 0;
-	}
-	
-	if ( temp2 != 0)
-	{
-		size_t bytes_read = fread(lzw_buff+cur_byte, sizeof(u8), temp2, lzw_res_stream);
-		(void)bytes_read;
-		//lib_read(lzw_res_stream, lzw_buff+cur_byte, temp2);
-	}
+	return malloc(LZW_DICT_SIZE * sizeof(DICT));
 }
 
+void lzw_dict_free(void *dict)
+{
+	free(dict);
+}
 
+u16 lzw_decompress_dict(void *dict, const u8 *cmem, u16 fsize, u8 *ubuff, u16 usize)
+{
+	return lzw_decode((DICT *)dict, cmem, fsize, ubuff, usize);
+}
 
-static u16 lzw_read_next()
+// codes are 9 to 11 bits, least significant first.  they're pulled out of
+// a 64 bit reservoir that's topped up a byte at a time.
+// returns the number of bytes written.  stops early at the end of the input
+// or if dst_size would be overrun so the caller sees the size is wrong.
+static u16 lzw_decode(DICT *dict, const u8 *src, u16 src_size, u8 *dst, u16 dst_size)
 {
-	u16 code_new, over_flow;
-	
-	if (lzw_bit_cur >= lzw_bit_max)
+	const u8 *src_end;
+	u64 bits;
+	u16 bit_count;
+	u16 width, code, code_next, code_max;
+	u16 prev_off, prev_len;	// the string written for the last code
+	u16 di, len;
+
+	src_end = src + src_size;
+	bits = 0;
+	bit_count = 0;
+	width = 9;
+	code_next = LZW_CODE_FIRST;
+	code_max = 0x200;
+	prev_off = 0;
+	prev_len = 0;
+	di = 0;
+
+	for (;;)
 	{
-		lzw_buff_shift();
-		if (errno != 0)
-			return 0;
+		while ( (bit_count <= 56) && (src < src_end) )
+		{
+			bits |= (u64)*(src++) << bit_count;
+			bit_count += 8;
+		}
+		if (bit_count < width)
+			break;
+		code = (u16)bits & ((1 << width) - 1);
+		bits >>= width;
+		bit_count -= width;
+
+		if (code == LZW_CODE_END)
+			break;
+		if (code == LZW_CODE_RESET)
+		{
+			width = 9;
+			code_max = 0x200;
+			code_next = LZW_CODE_FIRST;
+			prev_len = 0;
+			continue;
+		}
+
+		if (code < 0x100)
+		{
+			if (di >= dst_size)
+				break;
+			dst[di] = (u8)code;
+			len = 1;
+		}
+		else if (code < code_next)
+		{
+			// a string that's somewhere behind us already
+			len = dict[code].len;
+			if (len > dst_size - di)
+				break;
+			memcpy(dst + di, dst + dict[code].off, len);
+		}
+		else
+		{
+			// the code being defined right now.. previous string plus its own first byte
+			len = prev_len + 1;
+			if ( (prev_len == 0) || (len > dst_size - di) )
+				break;
+			memcpy(dst + di, dst + prev_off, prev_len);
+			dst[di + prev_len] = dst[prev_off];
+		}
+
+		// the first code after a reset doesn't define anything
+		if (prev_len != 0)
+		{
+			if (code_next < LZW_DICT_SIZE)
+			{
+				dict[code_next].off = prev_off;
+				dict[code_next].len = prev_len + 1;
+			}
+			code_next++;
+			if ( (code_next >= code_max) && (width != LZW_WIDTH_MAX) )
+			{
+				width++;
+				code_max <<= 1;
+			}
+		}
+		prev_off = di;
+		prev_len = len;
+		di += len;
 	}
-		
-	code_new = load_le_16(lzw_buff + (lzw_bit_cur>>3));
-	code_new >>= lzw_bit_cur&7;
-	over_flow = lzw_buff[(lzw_bit_cur>>3)+2];
-	over_flow <<= (16-(lzw_bit_cur&7));
-	
-	code_new |= over_flow;
-	
-	lzw_bit_cur += lzw_code_width;
-	return code_new & lzw_code_mask[lzw_code_width-9];
-}
 
-// si = bit cur
-static void lzw_buff_shift()
-{
-	u16 cx;
-	cx = lzw_buff_size - (lzw_bit_cur>>3);
-	
-	memmove(lzw_buff, lzw_buff+(lzw_bit_cur>>3), cx);
-	lzw_buff_fill(cx);
-	lzw_bit_cur = lzw_bit_cur & 7;
+	return di;
 }
-
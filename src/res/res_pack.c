@@ -0,0 +1,257 @@
+/*
+Whole game resource pack
+
+"nagi --pack [game dir]" loads every logic, picture, view and sound through
+the vol loaders and writes them already decompressed to PACK_FILE in the
+game directory.  when it's there vol_res_load() copies resources straight
+out of it with one hash lookup.. no seeking, no decompression and no
+asking for disks.
+
+file layout (little endian):
+	0	"NPAK"
+	4	u16 version
+	6	u16 number of entries
+	8	u32 offset of the index
+	12	resource data, each starting on a PACK_ALIGN boundary
+	index	entries of u32 vol location (the 3 dir bytes), u8 type,
+		u8 flags, u16 number, u32 data offset, u32 size
+*/
+
+#define MEM_TAG MEM_RES
+
+#include <string.h>
+#include <stdio.h>
+
+#include "../agi.h"
+#include "res.h"
+
+#include "../sys/endian.h"
+#include "../sys/agi_file.h"
+#include "../sys/sys_dir.h"
+#include "../sys/mem_wrap.h"
+
+#define PACK_FILE "nagi_pack.bin"
+#define PACK_VERSION 1
+#define PACK_HEAD_SIZE 12
+#define PACK_ENTRY_SIZE 16
+#define PACK_ALIGN 16
+// a v3 resource that was stored uncompressed (see not_compressed)
+#define PACK_PLAIN 0x01
+
+static u8 *pack_data = 0;
+static size_t pack_size = 0;
+static u8 pack_mapped = 0;	// pack_data is a file mapping, not a buffer
+static u8 *pack_index = 0;
+static u16 pack_count = 0;
+// entry number + 1 by vol location, open addressing
+static u16 *pack_hash = 0;
+static u32 pack_hash_mask = 0;
+
+static u32 pack_key(const u8 *dir_entry)
+{
+	return (dir_entry[0] << 16) | (dir_entry[1] << 8) | dir_entry[2];
+}
+
+static u32 pack_hash_slot(u32 key)
+{
+	return (key * 0x9E3779B1u) >> 16;
+}
+
+void pack_load(void)
+{
+	FILE *stream;
+	u32 index_off, i, slot, off, size;
+	u8 *entry;
+
+	pack_unload();
+
+	dir_preset_change(DIR_PRESET_GAME);
+	stream = fopen_nocase(PACK_FILE);
+	if (stream == 0)
+		return;
+	pack_data = file_map(stream, &pack_size);
+	fclose(stream);
+	if (pack_data != 0)
+		pack_mapped = 1;
+	else
+	{
+		pack_data = file_to_buf(PACK_FILE);
+		pack_size = file_buf_size;
+		if (pack_data == 0)
+			return;
+	}
+
+	// sanity check so the lookups can't run off the file
+	if ( (pack_size < PACK_HEAD_SIZE) || (memcmp(pack_data, "NPAK", 4) != 0) ||
+		(load_le_16(pack_data + 4) != PACK_VERSION) )
+		goto bad_file;
+
+	pack_count = load_le_16(pack_data + 6);
+	index_off = load_le_32(pack_data + 8);
+	if ( (index_off < PACK_HEAD_SIZE) || (index_off > pack_size) ||
+		((pack_size - index_off) / PACK_ENTRY_SIZE < pack_count) )
+		goto bad_file;
+	pack_index = pack_data + index_off;
+
+	pack_hash_mask = 1;
+	while (pack_hash_mask < (u32)pack_count * 2)
+		pack_hash_mask <<= 1;
+	pack_hash = a_malloc(pack_hash_mask * sizeof(u16));
+	memset(pack_hash, 0, pack_hash_mask * sizeof(u16));
+	pack_hash_mask--;
+
+	for (i = 0; i < pack_count; i++)
+	{
+		entry = pack_index + i * PACK_ENTRY_SIZE;
+		off = load_le_32(entry + 8);
+		size = load_le_32(entry + 12);
+		if ( (off < PACK_HEAD_SIZE) || (off > index_off) || (size > index_off - off) )
+			goto bad_file;
+
+		slot = pack_hash_slot(load_le_32(entry)) & pack_hash_mask;
+		while (pack_hash[slot] != 0)
+			slot = (slot + 1) & pack_hash_mask;
+		pack_hash[slot] = i + 1;
+	}
+
+	printf("Loaded %d resources from %s\n", pack_count, PACK_FILE);
+	return;
+
+bad_file:
+	printf("Ignoring invalid %s\n", PACK_FILE);
+	pack_unload();
+}
+
+void pack_unload(void)
+{
+	if (pack_data != 0)
+	{
+		if (pack_mapped)
+			file_unmap(pack_data, pack_size);
+		else
+			a_free(pack_data);
+	}
+	if (pack_hash != 0)
+		a_free(pack_hash);
+	pack_data = 0;
+	pack_size = 0;
+	pack_mapped = 0;
+	pack_index = 0;
+	pack_count = 0;
+	pack_hash = 0;
+	pack_hash_mask = 0;
+}
+
+// the resource at dir_entry's vol location or 0 if there's no pack
+const u8 *pack_res_find(const u8 *dir_entry, size_t *size)
+{
+	u32 key, slot;
+	u8 *entry;
+
+	if ( (pack_hash == 0) || (dir_entry == 0) )
+		return 0;
+
+	key = pack_key(dir_entry);
+	slot = pack_hash_slot(key) & pack_hash_mask;
+	while (pack_hash[slot] != 0)
+	{
+		entry = pack_index + (pack_hash[slot] - 1) * PACK_ENTRY_SIZE;
+		if (load_le_32(entry) == key)
+		{
+			if (c_game_compression)
+				not_compressed = (entry[5] & PACK_PLAIN) != 0;
+			*size = load_le_32(entry + 12);
+			return pack_data + load_le_32(entry + 8);
+		}
+		slot = (slot + 1) & pack_hash_mask;
+	}
+	return 0;
+}
+
+// pad the file out to the next PACK_ALIGN boundary
+static void pack_align(FILE *stream, u32 *pos)
+{
+	static const u8 zero[PACK_ALIGN] = {0};
+	u32 pad;
+
+	pad = (PACK_ALIGN - (*pos % PACK_ALIGN)) % PACK_ALIGN;
+	fwrite(zero, 1, pad, stream);
+	*pos += pad;
+}
+
+// write every resource in the directories to PACK_FILE.  returns 0 on success
+int pack_build(void)
+{
+	FILE *stream;
+	u8 head[PACK_HEAD_SIZE];
+	u8 *index, *entry, *data, *dir_entry;
+	u16 count, type, num, i;
+	u32 pos, key;
+
+	// everything has to come from the vols
+	pack_unload();
+
+	dir_preset_change(DIR_PRESET_GAME);
+	stream = fopen(PACK_FILE, "wb");
+	if (stream == 0)
+	{
+		printf("pack: unable to write %s\n", PACK_FILE);
+		return 1;
+	}
+
+	// header is rewritten with the real count and index once done
+	memset(head, 0, sizeof(head));
+	fwrite(head, 1, sizeof(head), stream);
+
+	index = a_malloc(RES_TYPE_MAX * 256 * PACK_ENTRY_SIZE);
+	count = 0;
+	pos = PACK_HEAD_SIZE;
+	for (type = 0; type < RES_TYPE_MAX; type++)
+		for (num = 0; num < dir_count(type); num++)
+		{
+			dir_entry = dir_find(type, num);
+			if (dir_entry == 0)
+				continue;
+			key = pack_key(dir_entry);
+			entry = index + count * PACK_ENTRY_SIZE;
+
+			// two directory entries can share the one resource
+			for (i = 0; i < count; i++)
+				if (load_le_32(index + i * PACK_ENTRY_SIZE) == key)
+					break;
+			if (i < count)
+				memcpy(entry, index + i * PACK_ENTRY_SIZE, PACK_ENTRY_SIZE);
+			else
+			{
+				data = vol_res_load(dir_entry, 0);
+				if (data == 0)
+					continue;
+				pack_align(stream, &pos);
+				fwrite(data, 1, res_size, stream);
+				store_le_32(entry, key);
+				entry[5] = (c_game_compression && not_compressed) ? PACK_PLAIN : 0;
+				store_le_32(entry + 8, pos);
+				store_le_32(entry + 12, (u32)res_size);
+				pos += (u32)res_size;
+				a_free(data);
+			}
+			entry[4] = (u8)type;
+			store_le_16(entry + 6, num);
+			count++;
+		}
+
+	pack_align(stream, &pos);
+	fwrite(index, PACK_ENTRY_SIZE, count, stream);
+	a_free(index);
+
+	memcpy(head, "NPAK", 4);
+	store_le_16(head + 4, PACK_VERSION);
+	store_le_16(head + 6, count);
+	store_le_32(head + 8, pos);
+	fseek(stream, 0, SEEK_SET);
+	fwrite(head, 1, sizeof(head), stream);
+	fclose(stream);
+
+	printf("pack: wrote %d resources to %s\n", count, PACK_FILE);
+	return 0;
+}
@@ -10,11 +10,13 @@ _PdBuffShift                     cseg     00009B70 0000001E
 #include <string.h>
 #include <errno.h>
 
+static u16 pd_run(FILE *cfile, const u8 *cmem, u8 *cbuff, u16 cfile_size, u8 *buff, u16 cbuff_size);
 static void pd_buff_fill(u16 byte_cur);
 static u8 *pd_buff_shift(u8 *buff_cur);
 
 
 static FILE *pd_stream = 0;
+static const u8 *pd_mem = 0;	// reading from a mapped vol instead
 static u16 pd_stream_size = 0;
 static u8 *pd_buff = 0;
 static u8 *pd_buff_end = 0;
@@ -24,6 +26,16 @@ static u8 nibble_pad = 0;
 static u8 nibble_align = 0;
 
 u16 pic_decompress(FILE *cfile, u8 *cbuff, u16 cfile_size, u8 *buff, u16 cbuff_size)
+{
+	return pd_run(cfile, 0, cbuff, cfile_size, buff, cbuff_size);
+}
+
+u16 pic_decompress_mem(const u8 *cmem, u8 *cbuff, u16 cfile_size, u8 *buff, u16 cbuff_size)
+{
+	return pd_run(0, cmem, cbuff, cfile_size, buff, cbuff_size);
+}
+
+static u16 pd_run(FILE *cfile, const u8 *cmem, u8 *cbuff, u16 cfile_size, u8 *buff, u16 cbuff_size)
 {
 	u8 *di, *si;
 	u8 pic_code;
@@ -31,6 +43,7 @@ u16 pic_decompress(FILE *cfile, u8 *cbuff, u16 cfile_size, u8 *buff, u16 cbuff_s
 	errno = 0; // reset from prev file errors
 	
 	pd_stream = cfile;
+	pd_mem = cmem;
 	pd_buff = cbuff;
 	pd_stream_size = cfile_size;
 	pd_uncomp_buff = buff;
@@ -99,7 +112,12 @@ static void pd_buff_fill(u16 byte_cur)
 		size = pd_stream_size;
 		pd_stream_size = 0;
 	}
-	if ( size != 0)
+	if ( (size != 0) && (pd_mem != 0) )
+	{
+		memcpy(pd_buff+byte_cur, pd_mem, size);
+		pd_mem += size;
+	}
+	else if ( size != 0)
 	{
 		size_t bytes_read = fread(pd_buff+byte_cur, sizeof(u8), size, pd_stream);
 		(void)bytes_read;
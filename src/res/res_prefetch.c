@@ -0,0 +1,478 @@
+/*
+Background resource prefetch
+
+when a logic is loaded its commands are scanned for the views, pictures and
+sounds it loads (load.view, set.view, add.to.pic, load.pic, load.sound and
+the .v versions of a variable that was set with assignn() just before).  the
+shared workers (sys/workers.c) decode those out of the mapped vol files so
+when the logic gets to them vol_res_load() just takes the finished buffer.
+
+the worker never touches the streams, the loader's globals or the disk
+prompts.  it decodes out of the mapped vols (vol_res_fetch()) and vols that
+couldn't be mapped are read through the vol's aio handle (sys/aio.c): a
+worker that picks one of those up takes every other one that's queued and
+keeps all their reads in flight at once, which is what slow SD cards and
+network shares need.  the first read takes PREFETCH_READ_FIRST bytes so
+most resources come in one go.  anything it can't do, or hasn't started by
+the time it's wanted, is loaded the normal way.  whatever a room didn't
+use is dropped at the next room_init().
+*/
+
+#include <string.h>
+
+#include "../agi.h"
+#include "res.h"
+
+#include "../logic/logic_base.h"
+#include "../sys/aio.h"
+#include "../sys/memory.h"
+#include "../sys/mem_wrap.h"
+#include "../sys/workers.h"
+
+#define PREFETCH_ASSIGNN 0x03
+#define PREFETCH_LOAD_PIC 0x18
+#define PREFETCH_LOAD_VIEW 0x1E
+#define PREFETCH_LOAD_VIEW_V 0x1F
+#define PREFETCH_SET_VIEW 0x29
+#define PREFETCH_SET_VIEW_V 0x2A
+#define PREFETCH_LOAD_SOUND 0x62
+#define PREFETCH_ADD_TO_PIC 0x7A
+#define PREFETCH_ADD_TO_PIC_V 0x7B
+
+#define JOB_FREE 0
+#define JOB_QUEUED 1
+#define JOB_BUSY 2
+#define JOB_DONE 3
+
+// the header and, for most resources, the rest
+#define PREFETCH_READ_FIRST 4096
+
+struct prefetch_job_struct
+{
+	u8 state;
+	u8 dir_entry[3];	// where it is in the vols
+	u16 plain;		// not_compressed
+	u8 *data;		// decoded, 0 if the worker couldn't
+	size_t size;
+	// being read through aio
+	AIO_REQ req;
+	u8 *read;		// the bytes from the vol
+	size_t need;		// all of them, 0 until the header's in
+};
+typedef struct prefetch_job_struct PREFETCH_JOB;
+
+static PREFETCH_JOB prefetch_job[RES_PREFETCH_JOBS];
+static u8 prefetch_on = 0;
+static SDL_Mutex *prefetch_mutex = 0;
+static SDL_Condition *prefetch_cond = 0;
+static void *prefetch_dict[WORKERS_MAX];	// each worker's lzw dictionary
+static AIO_QUEUE *prefetch_aio[WORKERS_MAX];	// and its reads
+
+// a queued job, with aio set one that's in a vol that isn't mapped.
+// called with the mutex held
+static PREFETCH_JOB *prefetch_next(u16 aio)
+{
+	PREFETCH_JOB *job;
+	u64 pos;
+	int i;
+
+	for (i = 0; i < RES_PREFETCH_JOBS; i++)
+	{
+		job = &prefetch_job[i];
+		if (job->state != JOB_QUEUED)
+			continue;
+		if ( (aio == 0) || (vol_res_aio(job->dir_entry, &pos) != 0) )
+			return job;
+	}
+	return 0;
+}
+
+static void prefetch_done(PREFETCH_JOB *job, u8 *data, size_t size, u16 plain)
+{
+	if (job->read != 0)
+		a_free(job->read);
+	job->read = 0;
+
+	SDL_LockMutex(prefetch_mutex);
+	job->data = data;
+	job->size = size;
+	job->plain = plain;
+	job->state = JOB_DONE;
+	SDL_BroadcastCondition(prefetch_cond);
+	SDL_UnlockMutex(prefetch_mutex);
+}
+
+// start reading a job's first bytes.  0 if the queue's full
+static u16 prefetch_read(AIO_QUEUE *q, PREFETCH_JOB *job)
+{
+	memset(&job->req, 0, sizeof(job->req));
+	job->req.file = vol_res_aio(job->dir_entry, &job->req.offset);
+	job->req.buff = job->read = (u8 *)a_malloc(PREFETCH_READ_FIRST);
+	job->req.size = PREFETCH_READ_FIRST;
+	job->req.user = job;
+	job->need = 0;
+	if (aio_submit(q, &job->req) != 0)
+		return 1;
+	a_free(job->read);
+	job->read = 0;
+	return 0;
+}
+
+// a read's come back.  decode it or go back for the rest
+static void prefetch_read_done(AIO_QUEUE *q, PREFETCH_JOB *job, void *dict)
+{
+	AIO_REQ *req;
+	u8 *read, *data;
+	size_t size;
+	u16 plain;
+
+	req = &job->req;
+	if (req->result < 0)
+	{
+		prefetch_done(job, 0, 0, 0);
+		return;
+	}
+	if (job->need == 0)
+	{
+		job->need = vol_res_need(job->dir_entry, job->read, (size_t)req->result);
+		if (job->need == 0)
+		{
+			prefetch_done(job, 0, 0, 0);
+			return;
+		}
+		if ((size_t)req->result < job->need)
+		{
+			read = (u8 *)a_malloc(job->need);
+			memcpy(read, job->read, (size_t)req->result);
+			a_free(job->read);
+			job->read = read;
+			req->offset += (u64)req->result;
+			req->buff = read + req->result;
+			req->size = job->need - (size_t)req->result;
+			if (aio_submit(q, req) == 0)
+				prefetch_done(job, 0, 0, 0);
+			return;
+		}
+	}
+	else if ((size_t)req->result != req->size)
+	{
+		prefetch_done(job, 0, 0, 0);
+		return;
+	}
+
+	size = 0;
+	plain = 0;
+	data = vol_res_decode(job->read, dict, &size, &plain);
+	prefetch_done(job, data, size, plain);
+}
+
+// read first and every other job in an unmapped vol, as many at once as
+// the queue takes, and decode them as they come in
+static void prefetch_read_all(int worker, PREFETCH_JOB *first)
+{
+	AIO_QUEUE *q;
+	PREFETCH_JOB *job;
+	AIO_REQ *req;
+
+	if (prefetch_aio[worker] == 0)
+		prefetch_aio[worker] = aio_queue_new(RES_PREFETCH_JOBS);
+	q = prefetch_aio[worker];
+	if (prefetch_read(q, first) == 0)
+	{
+		prefetch_done(first, 0, 0, 0);
+		return;
+	}
+
+	while (aio_busy(q) != 0)
+	{
+		// anything queued since goes in with the rest
+		SDL_LockMutex(prefetch_mutex);
+		while (aio_busy(q) < RES_PREFETCH_JOBS)
+		{
+			job = prefetch_next(1);
+			if (job == 0)
+				break;
+			job->state = JOB_BUSY;
+			SDL_UnlockMutex(prefetch_mutex);
+			if (prefetch_read(q, job) == 0)
+				prefetch_done(job, 0, 0, 0);
+			SDL_LockMutex(prefetch_mutex);
+		}
+		SDL_UnlockMutex(prefetch_mutex);
+
+		req = aio_complete(q, 1);
+		if (req != 0)
+			prefetch_read_done(q, (PREFETCH_JOB *)req->user, prefetch_dict[worker]);
+	}
+}
+
+// on a worker, decode the first queued resource
+static int prefetch_work(int worker)
+{
+	PREFETCH_JOB *job;
+	u8 *data;
+	size_t size;
+	u64 pos;
+	u16 plain;
+
+	SDL_LockMutex(prefetch_mutex);
+	job = prefetch_next(0);
+	if (job == 0)
+	{
+		SDL_UnlockMutex(prefetch_mutex);
+		return 0;
+	}
+	job->state = JOB_BUSY;
+	SDL_UnlockMutex(prefetch_mutex);
+
+	if (prefetch_dict[worker] == 0)
+		prefetch_dict[worker] = lzw_dict_new();
+	if (prefetch_dict[worker] == 0)
+	{
+		prefetch_done(job, 0, 0, 0);
+		return 1;
+	}
+	if (vol_res_aio(job->dir_entry, &pos) != 0)
+	{
+		prefetch_read_all(worker, job);
+		return 1;
+	}
+
+	size = 0;
+	plain = 0;
+	data = vol_res_fetch(job->dir_entry, prefetch_dict[worker], &size, &plain);
+	prefetch_done(job, data, size, plain);
+	return 1;
+}
+
+// called with the mutex held
+static void prefetch_drop(PREFETCH_JOB *job)
+{
+	if (job->data != 0)
+		a_free(job->data);
+	job->data = 0;
+	job->size = 0;
+	job->state = JOB_FREE;
+}
+
+static PREFETCH_JOB *prefetch_find(const u8 *dir_entry)
+{
+	int i;
+
+	for (i = 0; i < RES_PREFETCH_JOBS; i++)
+		if ( (prefetch_job[i].state != JOB_FREE) &&
+			(memcmp(prefetch_job[i].dir_entry, dir_entry, 3) == 0) )
+			return &prefetch_job[i];
+	return 0;
+}
+
+void res_prefetch_init()
+{
+	memset(prefetch_job, 0, sizeof(prefetch_job));
+	memset(prefetch_dict, 0, sizeof(prefetch_dict));
+	memset(prefetch_aio, 0, sizeof(prefetch_aio));
+	prefetch_on = 0;
+
+	prefetch_mutex = SDL_CreateMutex();
+	prefetch_cond = SDL_CreateCondition();
+	if ( (prefetch_mutex != 0) && (prefetch_cond != 0) )
+		prefetch_on = (u8)workers_add(prefetch_work);
+
+	// every load goes back to reading and decoding when it's asked for
+	if (prefetch_on == 0)
+	{
+		printf("Resource prefetch: off (no workers)\n");
+		res_prefetch_denit();
+	}
+}
+
+void res_prefetch_denit()
+{
+	int i;
+
+	// workers_denit() has stopped the workers
+	prefetch_on = 0;
+	for (i = 0; i < RES_PREFETCH_JOBS; i++)
+		prefetch_drop(&prefetch_job[i]);
+	for (i = 0; i < WORKERS_MAX; i++)
+	{
+		if (prefetch_dict[i] != 0)
+			lzw_dict_free(prefetch_dict[i]);
+		aio_queue_free(prefetch_aio[i]);
+	}
+	memset(prefetch_dict, 0, sizeof(prefetch_dict));
+	memset(prefetch_aio, 0, sizeof(prefetch_aio));
+
+	if (prefetch_cond != 0)
+		SDL_DestroyCondition(prefetch_cond);
+	if (prefetch_mutex != 0)
+		SDL_DestroyMutex(prefetch_mutex);
+	prefetch_cond = 0;
+	prefetch_mutex = 0;
+}
+
+// drop everything and wait for the worker to let go of the vols
+void res_prefetch_flush()
+{
+	int i;
+
+	if (prefetch_on == 0)
+		return;
+
+	SDL_LockMutex(prefetch_mutex);
+	for (i = 0; i < RES_PREFETCH_JOBS; i++)
+	{
+		while (prefetch_job[i].state == JOB_BUSY)
+			SDL_WaitCondition(prefetch_cond, prefetch_mutex);
+		prefetch_drop(&prefetch_job[i]);
+	}
+	SDL_UnlockMutex(prefetch_mutex);
+}
+
+static void prefetch_add(u16 type, u16 num)
+{
+	PREFETCH_JOB *job;
+	const u8 *dir_entry;
+	size_t size;
+	int i;
+
+	if (num > 0xFF)
+		return;
+	dir_entry = dir_find(type, num);
+	if (dir_entry == 0)
+		return;
+	// already as quick as it gets
+	if ( res_cache_has(dir_entry) || (pack_res_find(dir_entry, &size) != 0) )
+		return;
+
+	SDL_LockMutex(prefetch_mutex);
+	if (prefetch_find(dir_entry) == 0)
+	{
+		job = 0;
+		for (i = 0; i < RES_PREFETCH_JOBS; i++)
+			if (prefetch_job[i].state == JOB_FREE)
+			{
+				job = &prefetch_job[i];
+				break;
+			}
+		if (job != 0)
+		{
+			memcpy(job->dir_entry, dir_entry, 3);
+			job->state = JOB_QUEUED;
+		}
+	}
+	SDL_UnlockMutex(prefetch_mutex);
+	workers_wake();
+}
+
+struct prefetch_scan_struct
+{
+	s16 var_val[256];
+};
+typedef struct prefetch_scan_struct PREFETCH_SCAN;
+
+static void prefetch_var(PREFETCH_SCAN *scan, u16 type, u8 var)
+{
+	if (scan->var_val[var] >= 0)
+		prefetch_add(type, scan->var_val[var]);
+}
+
+static void prefetch_cmd(u8 code, const u8 *p, void *arg)
+{
+	PREFETCH_SCAN *scan = (PREFETCH_SCAN *)arg;
+
+	switch (code)
+	{
+		case PREFETCH_ASSIGNN:
+			scan->var_val[p[0]] = p[1];
+			break;
+		case PREFETCH_LOAD_VIEW:
+		case PREFETCH_ADD_TO_PIC:
+			prefetch_add(RES_TYPE_VIEW, p[0]);
+			break;
+		case PREFETCH_LOAD_VIEW_V:
+		case PREFETCH_ADD_TO_PIC_V:
+			prefetch_var(scan, RES_TYPE_VIEW, p[0]);
+			break;
+		case PREFETCH_SET_VIEW:
+			prefetch_add(RES_TYPE_VIEW, p[1]);
+			break;
+		case PREFETCH_SET_VIEW_V:
+			prefetch_var(scan, RES_TYPE_VIEW, p[1]);
+			break;
+		case PREFETCH_LOAD_PIC:
+			prefetch_var(scan, RES_TYPE_PIC, p[0]);
+			break;
+		case PREFETCH_LOAD_SOUND:
+			prefetch_add(RES_TYPE_SOUND, p[0]);
+			break;
+	}
+}
+
+// queue what a newly loaded logic is going to ask for
+void res_prefetch_logic(struct logic_struct *log)
+{
+	PREFETCH_SCAN scan;
+
+	if (prefetch_on == 0)
+		return;
+	memset(scan.var_val, -1, sizeof(scan.var_val));
+	logic_scan(log, prefetch_cmd, &scan);
+}
+
+// queue one resource that's about to be loaded, e.g. by a restore
+void res_prefetch_res(u16 type, u16 num)
+{
+	if (prefetch_on == 0)
+		return;
+	prefetch_add(type, num);
+}
+
+// the prefetched copy of a resource, set up the way vol_res_load() would
+// have.  0 if it has to be loaded the normal way.
+u8 *res_prefetch_take(const u8 *dir_entry, u8 *buff, u16 room)
+{
+	PREFETCH_JOB *job;
+	u8 *data;
+
+	if ( (prefetch_on == 0) || (dir_entry == 0) )
+		return 0;
+
+	SDL_LockMutex(prefetch_mutex);
+	job = prefetch_find(dir_entry);
+	if (job == 0)
+	{
+		SDL_UnlockMutex(prefetch_mutex);
+		return 0;
+	}
+	// loading it now is quicker than waiting for the worker to get to it
+	if (job->state == JOB_QUEUED)
+	{
+		prefetch_drop(job);
+		SDL_UnlockMutex(prefetch_mutex);
+		return 0;
+	}
+	// it's part way there
+	while (job->state == JOB_BUSY)
+		SDL_WaitCondition(prefetch_cond, prefetch_mutex);
+
+	data = job->data;
+	if (data != 0)
+	{
+		res_size = job->size;
+		if (c_game_compression)
+			not_compressed = job->plain;
+		if ( (buff == 0) && (room == 0) )
+			job->data = 0;		// handed over as it is
+		else
+		{
+			if (buff == 0)
+				buff = room_malloc(res_size);
+			memcpy(buff, data, res_size);
+			data = buff;
+		}
+	}
+	prefetch_drop(job);
+	SDL_UnlockMutex(prefetch_mutex);
+	return data;
+}
@@ -12,6 +12,8 @@ _FileLoad                        cseg     00003113 000000C5
 //~ RaDIaT1oN (2002-04-29):
 //~ open first lowercase name changes
 
+#define MEM_TAG MEM_RES
+
 #include <string.h>
 #include <errno.h>
 
@@ -41,18 +43,35 @@ _FileLoad                        cseg     00003113 000000C5
 #include "../log.h"
 
 #include "../sys/agi_file.h"
+#include "../sys/aio.h"
 #include "../sys/memory.h"
+#include "../sys/zip_mount.h"
 
-static u8 *v2_res_load(const u8 *dir_entry, u8 *buff);
-static u8 *v3_res_load(const u8 *dir_entry, u8 *buff);
+static u8 *vol_res_read(const u8 *dir_entry, u8 *buff, u16 room);
+static u8 *v2_res_load(const u8 *dir_entry, u8 *buff, u16 room);
+static u8 *v3_res_load(const u8 *dir_entry, u8 *buff, u16 room);
+static u8 *res_alloc(size_t size, u16 room);
+static void res_alloc_free(u8 *buff, u16 room);
 static void err_insert_disk(u16 num);
 static u16 err_wrong_disk(u16 num);
 static void volumes_open(void);
+static int vol_read(u16 vol_num, u32 pos, u8 *buff, size_t size);
+static const u8 *vol_mem(u16 vol_num, u32 pos, size_t size);
+static int vol_present(u16 vol_num);
 
 static u16 volume_error = 0;
 static u8 res_header[8];
 // size 16 for v3,  10 for v2
 static FILE *vol_handle_table[] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,0,0,0,0,0,0};
+// each vol is mapped once when it's opened.. 0 if the platform wouldn't
+static const u8 *vol_map_table[0x10] = {0};
+static size_t vol_map_size[0x10] = {0};
+// the same mappings when they're ours to unmap (not spans of the zip)
+static u8 *vol_map_owned[0x10] = {0};
+// the vols that couldn't be mapped, for the prefetch worker to read
+static AIO_FILE *vol_aio_table[0x10] = {0};
+// the vols are spans in the game's zip (zip_mount.c), there's nothing to close
+static u8 vol_in_zip = 0;
 u16 free_mem_check = 0;
 size_t res_size = 0;
 static u16 vol_disk_num = 0;
@@ -60,30 +79,208 @@ static u16 vol_disk_num = 0;
 u16 not_compressed = 0;
 
 u8 *vol_res_load(const u8 *dir_entry, u8 *buff)
+{
+	return vol_res_read(dir_entry, buff, 0);
+}
+
+// same but a new buffer comes off the room heap (sys/memory.c)
+// and goes away with the room
+u8 *vol_res_room_load(const u8 *dir_entry, u8 *buff)
+{
+	return vol_res_read(dir_entry, buff, 1);
+}
+
+static u8 *vol_res_read(const u8 *dir_entry, u8 *buff, u16 room)
 {
 	u8 *si=0;
+	const u8 *packed;
+	size_t packed_size;
 	
-	do
+	// still around from an earlier room, or straight out of the resource pack
+	packed = res_cache_find(dir_entry, &packed_size);
+	if (packed == 0)
+		packed = pack_res_find(dir_entry, &packed_size);
+	if (packed != 0)
 	{
-		if (c_game_compression)
-			si = v3_res_load(dir_entry, buff);
-		else
-			si = v2_res_load(dir_entry, buff);
-	} while (  (si==0) && (volume_error != 5)  );
+		res_size = packed_size;
+		if (buff == 0)
+			buff = res_alloc(res_size, room);
+		if (buff != 0)
+			memcpy(buff, packed, res_size);
+		return buff;
+	}
+
+	// fetched ahead by the prefetch worker
+	si = res_prefetch_take(dir_entry, buff, room);
+	if (si == 0)
+	{
+		do
+		{
+			if (c_game_compression)
+				si = v3_res_load(dir_entry, buff, room);
+			else
+				si = v2_res_load(dir_entry, buff, room);
+		} while (  (si==0) && (volume_error != 5)  );
+	}
 	
+	if (si != 0)
+		res_cache_store(dir_entry, si, res_size);
 	return si;
 }
 
-static u8 *v2_res_load(const u8 *dir_entry, u8 *buff)
+static u8 *res_alloc(size_t size, u16 room)
+{
+	if (room != 0)
+		return room_malloc(size);
+	return a_malloc(size);
+}
+
+static void res_alloc_free(u8 *buff, u16 room)
+{
+	if (room != 0)
+		room_free(buff);
+	else
+		a_free(buff);
+}
+
+// copies out of the mapped vol if it's there, otherwise seeks and reads
+static int vol_read(u16 vol_num, u32 pos, u8 *buff, size_t size)
+{
+	const u8 *mem;
+
+	mem = vol_mem(vol_num, pos, size);
+	if (mem != 0)
+	{
+		memcpy(buff, mem, size);
+		return 1;
+	}
+	if (vol_handle_table[vol_num] == 0)
+		return 0;
+	fseek(vol_handle_table[vol_num], pos, SEEK_SET);
+	return fread(buff, sizeof(u8), size, vol_handle_table[vol_num]) == size;
+}
+
+// the bytes in the mapped vol or 0 if it isn't mapped (or they run off the end)
+static const u8 *vol_mem(u16 vol_num, u32 pos, size_t size)
+{
+	if (vol_map_table[vol_num] == 0)
+		return 0;
+	if ( (pos > vol_map_size[vol_num]) || (size > vol_map_size[vol_num] - pos) )
+		return 0;
+	return vol_map_table[vol_num] + pos;
+}
+
+// opened from a file or found in the zip
+static int vol_present(u16 vol_num)
+{
+	return (vol_handle_table[vol_num] != 0) || (vol_map_table[vol_num] != 0);
+}
+
+static u32 vol_res_pos(const u8 *dir_entry)
+{
+	u32 pos;
+
+	pos = dir_entry[2];
+	pos |= dir_entry[1] << 8;
+	pos |= (dir_entry[0] & 0x0F) << 16;
+	return pos;
+}
+
+// the bytes a resource takes in its vol, header and all, from the first
+// got of them.  0 if they aren't a header the prefetch worker can do
+// something with (compressed pictures are left to the main thread).
+size_t vol_res_need(const u8 *dir_entry, const u8 *data, size_t got)
+{
+	u16 vol_num;
+
+	vol_num = dir_entry[0] >> 4;
+	if ( (got < RES_HEAD_SIZE) || (data[0]!=0x12)||(data[1]!=0x34)||(data[2]!=vol_num) )
+		return 0;
+	if (load_le_16(data + 3) == 0)
+		return 0;
+	if (c_game_compression)
+	{
+		if ( (got < 7) || ((data[2] & 0x80) != 0) )
+			return 0;
+		return 7 + (size_t)load_le_16(data + 5);
+	}
+	return RES_HEAD_SIZE + (size_t)load_le_16(data + 3);
+}
+
+// a decoded copy of the resource from all vol_res_need() of its bytes.
+// it doesn't touch the loader's globals so any thread can do it.  plain is
+// not_compressed for the resource.
+u8 *vol_res_decode(const u8 *data, void *lzw_dict, size_t *size, u16 *plain)
+{
+	u16 usize, csize;
+	u8 *buff;
+
+	usize = load_le_16(data + 3);
+	buff = a_malloc(usize);
+	if (c_game_compression)
+	{
+		csize = load_le_16(data + 5);
+		if (usize == csize)
+		{
+			memcpy(buff, data + 7, usize);
+			*plain = 1;
+		}
+		else if (lzw_decompress_dict(lzw_dict, data + 7, csize, buff, usize) == usize)
+			*plain = 0;
+		else
+		{
+			a_free(buff);
+			return 0;
+		}
+	}
+	else
+	{
+		memcpy(buff, data + RES_HEAD_SIZE, usize);
+		*plain = 0;
+	}
+
+	*size = usize;
+	return buff;
+}
+
+// a decoded copy of a resource for the prefetch worker.  it doesn't ask
+// for disks so it only works off mapped vols.  0 if it can't do it here.
+u8 *vol_res_fetch(const u8 *dir_entry, void *lzw_dict, size_t *size, u16 *plain)
+{
+	const u8 *data;
+	u16 vol_num;
+	u32 pos;
+	size_t need;
+
+	vol_num = dir_entry[0] >> 4;
+	pos = vol_res_pos(dir_entry);
+	data = vol_mem(vol_num, pos, 0);
+	if (data == 0)
+		return 0;
+	need = vol_res_need(dir_entry, data, vol_map_size[vol_num] - pos);
+	if ( (need == 0) || (vol_mem(vol_num, pos, need) == 0) )
+		return 0;
+	return vol_res_decode(data, lzw_dict, size, plain);
+}
+
+// the vol a resource is in and where, for reading it with aio when it
+// isn't mapped.  0 if it's mapped (or not open)
+AIO_FILE *vol_res_aio(const u8 *dir_entry, u64 *pos)
+{
+	*pos = vol_res_pos(dir_entry);
+	return vol_aio_table[dir_entry[0] >> 4];
+}
+
+static u8 *v2_res_load(const u8 *dir_entry, u8 *buff, u16 room)
 {	
 	u8 res_head[5];
 	//u8 *mem_ptr_orig;		// orig mem ptr
 	u16 vol_num;		// vol num
-	FILE *vol_stream;	// vol stream
 	u32 vol_pos;
+	u8 *own = 0;		// buffer allocated here, freed on error
 	
 	//mem_ptr_orig = get_mem_ptr();
-	if (vol_handle_table[0] == 0)
+	if (!vol_present(0))
 		volumes_open();
 
 	vol_num = dir_entry[0] >> 4;	// vol num
@@ -92,10 +289,7 @@ static u8 *v2_res_load(const u8 *dir_entry, u8 *buff)
 	if ( vol_disk_num == 0)
 		vol_disk_num = 1;
 
-	vol_stream = vol_handle_table[vol_num];
-	
-
-	if ( vol_stream == 0)
+	if (!vol_present(vol_num))
 	{
 		volumes_close();
 		volume_error = 1;
@@ -108,8 +302,7 @@ static u8 *v2_res_load(const u8 *dir_entry, u8 *buff)
 		vol_pos |= dir_entry[1] << 8;
 		vol_pos |= (dir_entry[0] & 0x0F) << 16;
 	
-		fseek(vol_stream, vol_pos, SEEK_SET);
-		if ( fread(res_head, sizeof(u8), RES_HEAD_SIZE, vol_stream) == RES_HEAD_SIZE)
+		if ( vol_read(vol_num, vol_pos, res_head, RES_HEAD_SIZE) )
 		{
 			if (  (res_head[0]!=0x12)||(res_head[1]!=0x34)||(res_head[2]!=vol_num)  )
 			{
@@ -135,7 +328,7 @@ static u8 *v2_res_load(const u8 *dir_entry, u8 *buff)
 						//set_mem_ptr(mem_ptr_orig);
 						return 0;
 					} */
-					buff = a_malloc(res_size);
+					buff = own = res_alloc(res_size, room);
 					if ( buff == 0)
 					{
 						volume_error = 5;
@@ -144,28 +337,28 @@ static u8 *v2_res_load(const u8 *dir_entry, u8 *buff)
 				}
 				else
 				{
-					buff = a_malloc(res_size);
+					buff = own = res_alloc(res_size, room);
 				}
 			}
 			
-			if ( fread(buff, sizeof(u8), res_size, vol_stream) == res_size)
+			if ( vol_read(vol_num, vol_pos + RES_HEAD_SIZE, buff, res_size) )
 				return buff;
 		}
 		if ( print_err_code() != 0)
 		{
 			//set_mem_ptr(mem_ptr_orig);
-			if (buff != 0)
-				free(buff);
+			if (own != 0)
+				res_alloc_free(own, room);
 			return 0;
 		}
 		agi_exit();
 	}
-	if (buff != 0)
-		a_free(buff);
+	if (own != 0)
+		res_alloc_free(own, room);
 	return 0;
 }
 
-static u8 *v3_res_load(const u8 *dir_entry, u8 *buff)
+static u8 *v3_res_load(const u8 *dir_entry, u8 *buff, u16 room)
 {
 	u16 pic_compressed;		// 1 = picture compression
 	u8 decomp_buff[0x400];
@@ -174,9 +367,11 @@ static u8 *v3_res_load(const u8 *dir_entry, u8 *buff)
 	u16 vol_num;			// volume number
 	FILE *vol_stream;		// vol handle
 	u32 res_pos;			// position of resource in vol
+	u8 *own = 0;			// buffer allocated here, freed on error
+	const u8 *res_mem;		// compressed data in the mapped vol
 	
 	//mem_orig = mem_ptr_get();
-	if (vol_handle_table[0] == 0)
+	if (!vol_present(0))
 		volumes_open();
 	vol_num = dir_entry[0] >> 4;	// vol num
 	if ( (vol_num!=0) && (vol_num<=8) )
@@ -184,7 +379,7 @@ static u8 *v3_res_load(const u8 *dir_entry, u8 *buff)
 	if (vol_disk_num == 0)
 		vol_disk_num = 1;
 	vol_stream = vol_handle_table[vol_num];
-	if (vol_stream == 0)
+	if (!vol_present(vol_num))
 	{
 		volumes_close();
 		volume_error = 1;
@@ -197,8 +392,7 @@ static u8 *v3_res_load(const u8 *dir_entry, u8 *buff)
 		res_pos = dir_entry[2];
 		res_pos |= dir_entry[1] << 8;
 		res_pos |= (dir_entry[0] & 0x0F) << 16;
-		fseek(vol_stream, res_pos, SEEK_SET);
-		if (fread(&res_header, sizeof(u8), 7, vol_stream) != 7)
+		if ( !vol_read(vol_num, res_pos, res_header, 7) )
 			goto res_error;
 		if ( (res_header[2] & 0x80) != 0)
 		{
@@ -227,23 +421,42 @@ static u8 *v3_res_load(const u8 *dir_entry, u8 *buff)
 					volume_error = 5;
 					goto res_error_2;
 				}*/
-			buff = a_malloc(res_size);
+			buff = own = res_alloc(res_size, room);
+		}
+
+		res_mem = vol_mem(vol_num, res_pos + 7, res_comp_size);
+		if (res_mem == 0)
+		{
+			// runs off the end of a vol in the zip
+			if (vol_stream == 0)
+				goto res_error;
+			fseek(vol_stream, res_pos + 7, SEEK_SET);
 		}
 
 		if ( pic_compressed != 0)
 		{
-			if (pic_decompress(vol_stream, decomp_buff, res_comp_size, buff, 0x400) != res_size)
+			if (res_mem != 0)
+			{
+				if (pic_decompress_mem(res_mem, decomp_buff, res_comp_size, buff, 0x400) != res_size)
+					goto res_error;
+			}
+			else if (pic_decompress(vol_stream, decomp_buff, res_comp_size, buff, 0x400) != res_size)
 				goto res_error;
 		}
 		else if (res_size == res_comp_size)
 		{
-			if (fread(buff, sizeof(u8), res_size, vol_stream) != res_size)
+			if ( !vol_read(vol_num, res_pos + 7, buff, res_size) )
 				goto res_error;
 			not_compressed = 1;
 		}
 		else
 		{
-			if ( lzw_decompress(vol_stream, decomp_buff, res_comp_size, buff, 0x400) != res_size)
+			if (res_mem != 0)
+			{
+				if ( lzw_decompress_mem(res_mem, res_comp_size, buff, res_size) != res_size)
+					goto res_error;
+			}
+			else if ( lzw_decompress(vol_stream, res_comp_size, buff, res_size) != res_size)
 				goto res_error;
 			not_compressed = 0;
 		}
@@ -254,8 +467,8 @@ res_error:
 	if (print_err_code() == 0)
 		agi_exit();
 res_error_2:
-	if (buff != 0)
-		free(buff);
+	if (own != 0)
+		res_alloc_free(own, room);
 	//mem_ptr_set(mem_orig);
 	return 0;
 }
@@ -308,17 +521,30 @@ static void volumes_open()
 		vol_max = 0x5;*/
 	dir_preset_change(DIR_PRESET_GAME);
 
+	vol_in_zip = zip_mounted();
 	for (i=0 ; i<0x10 ; i++)
 	{
 		if (c_game_file_id[0] != '\0')
 			sprintf(name, "%svol.%d", c_game_file_id, i);
 		else
 			sprintf(name, "vol.%d", i);
+		if (vol_in_zip)
+		{
+			vol_map_table[i] = zip_game_file(name, &vol_map_size[i]);
+			continue;
+		}
 		//do
 		//{
 			//errno = 0;
 //			vol_handle_table[i] = fopen(name, "rb");
 			vol_handle_table[i] = fopen_nocase(name);
+			if (vol_handle_table[i] != 0)
+			{
+				vol_map_owned[i] = file_map(vol_handle_table[i], &vol_map_size[i]);
+				vol_map_table[i] = vol_map_owned[i];
+			}
+			if ( (vol_handle_table[i] != 0) && (vol_map_table[i] == 0) )
+				vol_aio_table[i] = aio_file_open(vol_handle_table[i], 0);
 			/*
 			if ( (errno != 0) && (errno != ENOENT)  )
 				if (print_err_code() == 0)
@@ -333,9 +559,25 @@ void volumes_close()
 {
 	u16 i;
 	
+	// the worker reads straight out of the mappings
+	res_prefetch_flush();
+	
 // it should be 0x10.  original interpreter only closes first 0x5?
 	for (i=0 ; i<0x10 ; i++)
 	{
+		if (vol_map_table[i] != 0)
+		{
+			if (vol_map_owned[i] != 0)
+				file_unmap(vol_map_owned[i], vol_map_size[i]);
+			vol_map_table[i] = 0;
+			vol_map_owned[i] = 0;
+			vol_map_size[i] = 0;
+		}
+		if (vol_aio_table[i] != 0)
+		{
+			aio_file_close(vol_aio_table[i]);
+			vol_aio_table[i] = 0;
+		}
 		if (vol_handle_table[i] != 0)
 		{
 			fclose(vol_handle_table[i]);
@@ -352,6 +594,17 @@ u8 *file_load(const char *name, u8 *buff)
 	size_t file_size;
 	FILE *file_stream;
 	char newline_orig;
+	const u8 *zip_data;
+
+	zip_data = zip_game_file(name, &file_size);
+	if (zip_data != 0)
+	{
+		res_size = file_size;
+		if (buff == 0)
+			buff = (u8 *)a_malloc(res_size + 1);
+		memcpy(buff, zip_data, res_size);
+		return buff;
+	}
 
 	newline_orig = msgstate.newline_char;
 	msgstate.newline_char = '@';
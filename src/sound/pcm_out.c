@@ -39,6 +39,7 @@ static DRVINIT pcm_out_init_list[] =
 
 static PCM_OUT_DRIVER pcm_out_drv;
 
+// freq 0 is whatever the device runs at
 int pcm_out_init(int freq, int format)
 {
 	DRVINITSTATE local_initstate;
@@ -100,3 +101,9 @@ void pcm_out_unlock(void)
 	pcm_out_drv.ptr_unlock();
 }
 
+
+// samples per sec it's actually running at
+int pcm_out_freq_get(void)
+{
+	return pcm_out_drv.ptr_freq_get();
+}
@@ -24,6 +24,7 @@ struct pcm_out_driver_struct
 	int (*ptr_state_get)(void);
 	void (*ptr_lock)(void);
 	void (*ptr_unlock)(void);
+	int (*ptr_freq_get)(void);
 };
 typedef struct pcm_out_driver_struct PCM_OUT_DRIVER;
 	
@@ -36,5 +37,6 @@ extern void pcm_out_state_set(int);
 extern int pcm_out_state_get(void);
 extern void pcm_out_lock(void);
 extern void pcm_out_unlock(void);
+extern int pcm_out_freq_get(void);
 
 #endif /* NAGI_SOUND_PCM_OUT_H */
@@ -37,6 +37,7 @@
 #include "sound_gen.h"
 #include "pcm_out.h"
 #include "pcm_out_sdl.h"
+#include "../sys/thread_attr.h"
 
 /* PROTOTYPES	---	---	---	---	---	---	--- */
 
@@ -59,6 +60,7 @@ static void pcm_out_sdl_state_set(int );
 static int pcm_out_sdl_state_get(void);
 static void pcm_out_sdl_lock(void);
 static void pcm_out_sdl_unlock(void);
+static int pcm_out_sdl_freq_get(void);
 static void SDLCALL sdl_audio_callback(void *userdata, SDL_AudioStream *stream, int additional_amount, int total_amount);
 
 /* VARIABLES	---	---	---	---	---	---	--- */
@@ -70,8 +72,26 @@ static LIST *chan_list = 0;
 static SDL_AudioStream *audio_stream = NULL;
 static SDL_AudioDeviceID audio_device = 0;
 static int audio_playing = 0;
+static int audio_freq = 44100;
 static SDL_Mutex *audio_mutex = NULL;
 
+// callbacks that came after the device had played everything it was given
+static SDL_AtomicInt audio_late;
+static Uint64 audio_due_ns = 0;		// when the last callback's data runs out, 0 after a pause
+static SDL_ThreadID audio_thread = 0;	// given its priority and cpu
+static int audio_frames = 0;		// the device's buffer
+
+// the callback's time in us, since pcm_out_sdl_stats() last took them
+static SDL_AtomicInt audio_cb_total;
+static SDL_AtomicInt audio_cb_count;
+static SDL_AtomicInt audio_cb_max;
+static SDL_AtomicInt audio_queued;	// bytes the stream still held when the callback came
+
+// every callback's time, never cleared (pcm_out_sdl_callback_hist())
+static const u32 audio_cb_bound_us[PCM_OUT_CB_BUCKETS - 1] = PCM_OUT_CB_BOUNDS_US;
+static SDL_AtomicInt audio_cb_hist[PCM_OUT_CB_BUCKETS];
+static SDL_AtomicInt audio_cb_sum;	// us, wraps after an hour of callbacks
+
 #if WRITE_TO_DISK
 struct data_struct
 {
@@ -105,13 +125,17 @@ void pcm_out_sdl_drv_init(void *void_ptr)
 	drv->ptr_state_get = pcm_out_sdl_state_get;
 	drv->ptr_lock = pcm_out_sdl_lock;
 	drv->ptr_unlock = pcm_out_sdl_unlock;
+	drv->ptr_freq_get = pcm_out_sdl_freq_get;
 	drv->type = PCM_OUT_SDL;
 }
 
 
 static int pcm_out_sdl_init(int freq, int format)
 {
-	(void) freq;
+	SDL_AudioSpec device_spec;
+	int device_frames;
+	char hint[16];
+
 	(void) format;
 
 	printf("pcm_out_sdl_init(): Initialising SDL audio subsystem... ");
@@ -125,9 +149,27 @@ static int pcm_out_sdl_init(int freq, int format)
 		return -1;
 	}
 
-	// SDL3 audio spec - 44100 Hz, 16-bit signed, mono
+	// the device's own rate unless asked for one, so the stream doesn't
+	// have to resample
+	audio_freq = 44100;
+	if (freq <= 0)
+		freq = c_snd_rate;
+	if (freq > 0)
+		audio_freq = freq;
+	else if (SDL_GetAudioDeviceFormat(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, &device_spec, NULL) &&
+			(device_spec.freq > 0))
+		audio_freq = device_spec.freq;
+
+	// the device's buffer is only asked for when it's opened
+	if (c_snd_buffer > 0)
+	{
+		snprintf(hint, sizeof(hint), "%d", c_snd_buffer);
+		SDL_SetHint(SDL_HINT_AUDIO_DEVICE_SAMPLE_FRAMES, hint);
+	}
+
+	// SDL3 audio spec - 16-bit signed, mono
 	SDL_AudioSpec spec;
-	spec.freq = 44100;
+	spec.freq = audio_freq;
 	spec.format = SDL_AUDIO_S16LE;
 	spec.channels = 1;
 
@@ -147,6 +189,24 @@ static int pcm_out_sdl_init(int freq, int format)
 	// Get the device ID associated with this stream
 	audio_device = SDL_GetAudioStreamDevice(audio_stream);
 
+	// what it ended up with.  a rate of its own means sdl resamples
+	audio_frames = 0;
+	if (SDL_GetAudioDeviceFormat(audio_device, &device_spec, &device_frames))
+	{
+		audio_frames = device_frames;
+		if (device_spec.freq != audio_freq)
+			printf("\npcm_out_sdl_init(): %d Hz resampled to the device's %d Hz.",
+				audio_freq, device_spec.freq);
+		if ( (c_snd_buffer > 0) && (device_frames != c_snd_buffer) )
+			printf("\npcm_out_sdl_init(): device buffer is %d frames, not %d.",
+				device_frames, c_snd_buffer);
+	}
+	SDL_SetAtomicInt(&audio_late, 0);
+	SDL_SetAtomicInt(&audio_cb_total, 0);
+	SDL_SetAtomicInt(&audio_cb_count, 0);
+	SDL_SetAtomicInt(&audio_cb_max, 0);
+	SDL_SetAtomicInt(&audio_queued, 0);
+
 	// Start paused
 	pcm_out_sdl_state_set(0);
 
@@ -318,6 +378,7 @@ static void pcm_out_sdl_state_set(int snd_state)
 			SDL_PauseAudioStreamDevice(audio_stream);
 			audio_playing = 0;
 		}
+		audio_due_ns = 0;
 	}
 }
 
@@ -326,6 +387,11 @@ static int pcm_out_sdl_state_get(void)
 	return audio_playing;
 }
 
+static int pcm_out_sdl_freq_get(void)
+{
+	return audio_freq;
+}
+
 // lock audio thread so data can be changed
 static void pcm_out_sdl_lock(void)
 {
@@ -346,13 +412,79 @@ static void pcm_out_sdl_unlock(void)
 
 
 
+void pcm_out_sdl_stats(PCM_OUT_SDL_STATS *stats)
+{
+	int total, count, frames;
+
+	memset(stats, 0, sizeof(PCM_OUT_SDL_STATS));
+	stats->late = (u32)SDL_GetAtomicInt(&audio_late);
+	stats->freq = audio_freq;
+	stats->buffer = audio_frames;
+
+	// taken and cleared, the count last so a callback in between is
+	// only half counted at worst
+	stats->callback_max_us = (u32)SDL_SetAtomicInt(&audio_cb_max, 0);
+	total = SDL_SetAtomicInt(&audio_cb_total, 0);
+	count = SDL_SetAtomicInt(&audio_cb_count, 0);
+	if (count > 0)
+		stats->callback_avg_us = (u32)(total / count);
+
+	// what the stream holds and the device's buffer are both still to be heard
+	frames = SDL_GetAtomicInt(&audio_queued) / (int)sizeof(s16) + audio_frames;
+	if (audio_freq > 0)
+		stats->ahead_us = (int)((Sint64)frames * 1000000 / audio_freq);
+}
+
+void pcm_out_sdl_callback_hist(u32 *count, const u32 **bound_us, u32 *sum_us)
+{
+	int i;
+
+	for (i = 0; i < PCM_OUT_CB_BUCKETS; i++)
+		count[i] = (u32)SDL_GetAtomicInt(&audio_cb_hist[i]);
+	*bound_us = audio_cb_bound_us;
+	*sum_us = (u32)SDL_GetAtomicInt(&audio_cb_sum);
+}
+
+// keep the longest callback
+static void sdl_audio_callback_time(Uint64 start)
+{
+	int us, max, i;
+
+	us = (int)((SDL_GetTicksNS() - start) / 1000);
+	for (i = 0; (i < PCM_OUT_CB_BUCKETS - 1) && ((u32)us > audio_cb_bound_us[i]); i++)
+		;
+	SDL_AddAtomicInt(&audio_cb_hist[i], 1);
+	SDL_AddAtomicInt(&audio_cb_sum, us);
+	SDL_AddAtomicInt(&audio_cb_total, us);
+	SDL_AddAtomicInt(&audio_cb_count, 1);
+	max = SDL_GetAtomicInt(&audio_cb_max);
+	while ( (us > max) && !SDL_CompareAndSwapAtomicInt(&audio_cb_max, max, us) )
+		max = SDL_GetAtomicInt(&audio_cb_max);
+}
+
 static void SDLCALL sdl_audio_callback(void *userdata, SDL_AudioStream *stream, int additional_amount, int total_amount)
 {
+	Uint64 now;
+
 	(void)userdata;
 	(void)total_amount;
 
 	if (additional_amount <= 0) return;
 
+	// the device may get a new thread when it's reopened
+	if (SDL_GetCurrentThreadID() != audio_thread)
+	{
+		audio_thread = SDL_GetCurrentThreadID();
+		thread_attr_apply(THREAD_AUDIO);
+	}
+
+	// a couple of ms of slack for the device's own buffering
+	now = SDL_GetTicksNS();
+	if ( (audio_due_ns != 0) && (now > audio_due_ns + 2000000) )
+		SDL_AddAtomicInt(&audio_late, 1);
+	audio_due_ns = now + (Uint64)additional_amount / sizeof(s16) * SDL_NS_PER_SECOND / (Uint64)audio_freq;
+	SDL_SetAtomicInt(&audio_queued, SDL_GetAudioStreamQueued(stream));
+
 	// Allocate temporary buffers
 	u8* output_buffer = alloca(additional_amount);
 	s16* chan_data = alloca(additional_amount);
@@ -415,6 +547,7 @@ static void SDLCALL sdl_audio_callback(void *userdata, SDL_AudioStream *stream,
 
 	// Put audio data into the stream
 	SDL_PutAudioStreamData(stream, output_buffer, additional_amount);
+	sdl_audio_callback_time(now);
 
 	if (!output)
 	{
@@ -2,8 +2,30 @@
 #define NAGI_SOUND_PCM_OUT_SDL_H
 
 /* STRUCTURES	---	---	---	---	---	---	--- */
+
+// how the sound device is keeping up, for the hud
+struct pcm_out_sdl_stats_struct
+{
+	u32 late;		// times the sound ran dry waiting for the callback
+	u32 callback_avg_us;	// the callback's time since the last look
+	u32 callback_max_us;
+	int ahead_us;		// how far the sound being mixed is ahead of what's heard
+	int freq;
+	int buffer;		// the device's sample frames per buffer
+};
+typedef struct pcm_out_sdl_stats_struct PCM_OUT_SDL_STATS;
+
+// the callback times histogram, the last bucket takes the rest
+#define PCM_OUT_CB_BOUNDS_US {50, 100, 250, 500, 1000, 2500, 5000}
+#define PCM_OUT_CB_BUCKETS 8
+
 /* VARIABLES	---	---	---	---	---	---	--- */
 /* FUNCTIONS	---	---	---	---	---	---	--- */
 extern void pcm_out_sdl_drv_init(void *drv);
+// the callback times are since the last call
+extern void pcm_out_sdl_stats(PCM_OUT_SDL_STATS *stats);
+// every callback so far by its time, PCM_OUT_CB_BUCKETS counts, and
+// their time added up
+extern void pcm_out_sdl_callback_hist(u32 *count, const u32 **bound_us, u32 *sum_us);
 
 #endif /* NAGI_SOUND_PCM_OUT_SDL_H */
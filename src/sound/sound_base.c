@@ -38,13 +38,22 @@ volatile int sound_state = 0;  // 0=silence  1=playing
 u16 sound_flag = 0;		// the flag to set when the sound is finished
 
 static LIST *sound_list = 0;
+static SOUND *sound_index[256];	// the list's nodes by number
 
 void sound_list_init(void)
 {
+	int i;
+
+	// the callback might still be reading the last room's sound
+	sndgen_sync();
+	for (i=0; i<256; i++)
+		if ( (sound_index[i] != 0) && (sound_index[i]->pcm != 0) )
+			a_free(sound_index[i]->pcm);
 	if (sound_list)
 		list_clear(sound_list);
 	else
 		sound_list = list_new(sizeof(SOUND));	
+	memset(sound_index, 0, sizeof(sound_index));
 }
 
 void sound_list_new_room(void)
@@ -54,14 +63,9 @@ void sound_list_new_room(void)
 
 static SOUND *sound_find(u16 snd_num)
 {
-	SOUND *s;
-	
-	s = list_element_head(sound_list);
-	
-	while ( (s) && (snd_num != s->num) )
-		s = node_next(s);
-	
-	return s;
+	if (snd_num >= 256)
+		return 0;
+	return sound_index[snd_num];
 }
 
 u8 *cmd_load_sound(u8 *c)
@@ -85,6 +89,7 @@ SOUND *sound_load(u16 snd_num)
 		snd = (SOUND*)list_add(sound_list);
 		script_write(3, snd_num);
 		snd->num = snd_num;
+		sound_index[snd->num] = snd;
 		snd->data = vol_res_load(dir_sound(snd_num), 0);
 		
 		dptr = snd->data;
@@ -93,6 +98,7 @@ SOUND *sound_load(u16 snd_num)
 			snd->channel[c] = snd->data + load_le_16(dptr);
 			dptr += sizeof(u16);	// word.. dude
 		}
+		sndgen_render(snd);
 		
 		blists_draw();
 	}
@@ -9,6 +9,8 @@ struct sound_struct
 	u16 num;		// 2-3
 	u8 *data;		// 4-5
 	u8 *channel[4];	// 6-7, 8-9, A-B, C-D
+	s16 *pcm;		// rendered up front, 0 if it's made as it plays
+	int pcm_len;		// samples
 };
 typedef struct sound_struct SOUND;
 
@@ -2,6 +2,19 @@
 
 */
 
+/*
+the game and the audio callback don't share any sound state.  the game
+puts play, stop and volume commands on a single producer/single consumer
+ring and the callback takes them off at the start of each buffer.  the
+channels are only touched by the callback.  when a sound runs out the
+callback posts its number back and sndgen_poll() sets the flag on the game
+side.  neither ever waits on the other, except sndgen_sync() before the
+sound data is thrown away.
+
+sndgen_render() steps a sound through its own set of channels on the game
+side, for tone_render() to make the whole thing into samples up front.
+*/
+
 /* BASE headers	---	---	---	---	---	---	--- */
 #include "../agi.h"
 
@@ -40,8 +53,26 @@ struct sndgen_channel_struct
 typedef struct sndgen_channel_struct SNDGEN_CHAN;
 
 
+#define SNDCMD_PLAY 1
+#define SNDCMD_STOP 2
+#define SNDCMD_VOLUME 3	// v23 or the sound flag changed
+
+struct sndgen_cmd_struct
+{
+	u8 type;
+	u8 vol;		// v23
+	u8 sound_on;	// f9
+	int seq;	// which play it is
+	SOUND *snd;
+};
+typedef struct sndgen_cmd_struct SNDGEN_CMD;
+
+
 /* VARIABLES	---	---	---	---	---	---	--- */
 #define CHAN_MAX 4
+#define SNDCMD_MAX 16		// a power of 2
+#define SNDGEN_SYNC_MS 100	// give up on a callback that isn't running
+#define SNDGEN_RENDER_MAX (60*60)	// longest sound rendered up front, in 60ths of a sec
 
 // "fade out" or possibly "dissolve"
 // v2.9xx
@@ -83,18 +114,40 @@ static s8 dissolve_data_v3[] =
 //u8 channels_left = 0;
 static SNDGEN_CHAN channel[CHAN_MAX];
 
+static SNDGEN_CMD sndcmd_ring[SNDCMD_MAX];
+static SDL_AtomicInt sndcmd_head;	// next one the game writes
+static SDL_AtomicInt sndcmd_tail;	// next one the callback reads
+static SDL_AtomicInt sndgen_done;	// seq of the last sound that ran out
+
+// game side
+static int sndgen_seq = 0;
+static u8 sndgen_vol_sent = 0;
+static u8 sndgen_on_sent = 1;
+
+// callback side
+static int sndgen_playing = 0;	// seq, 0 if nothing's playing
+static u8 sndgen_vol = 0;
+static u8 sndgen_on = 1;
+
 		
 /* CODE	---	---	---	---	---	---	---	--- */
 
 void sndgen_init(void)
 {
+	SDL_SetAtomicInt(&sndcmd_head, 0);
+	SDL_SetAtomicInt(&sndcmd_tail, 0);
+	SDL_SetAtomicInt(&sndgen_done, 0);
+	sndgen_seq = 0;
+	sndgen_playing = 0;
+
 	if (c_snd_enable)
 	{
-		// init tone_gen
+		// init tone_gen.. it runs the whole time, silent when there's
+		// nothing to play
 		if (tone_init())
 			c_snd_enable = 0;
 		else
-			tone_state_set(0);
+			tone_state_set(1);
 	}
 }
 
@@ -103,64 +156,140 @@ void sndgen_shutdown(void)
 	// shutdown tone_gen
 	if (c_snd_enable)
 	{
-		sndgen_stop();
+		tone_state_set(0);
+		tone_lock();
+		sndgen_kill_thread();
+		tone_unlock();
 		tone_shutdown();
 	}
 }
 
+// queue a command for the callback.  returns 0 if the ring's full
+static int sndcmd_push(u8 type, SOUND *snd)
+{
+	SNDGEN_CMD *cmd;
+	int head;
+
+	head = SDL_GetAtomicInt(&sndcmd_head);
+	if (head - SDL_GetAtomicInt(&sndcmd_tail) >= SNDCMD_MAX)
+		return 0;
+
+	cmd = &sndcmd_ring[head & (SNDCMD_MAX - 1)];
+	cmd->type = type;
+	cmd->snd = snd;
+	cmd->seq = sndgen_seq;
+	cmd->vol = sndgen_vol_sent;
+	cmd->sound_on = sndgen_on_sent;
+	SDL_SetAtomicInt(&sndcmd_head, head + 1);	// publishes it
+	return 1;
+}
+
 void sndgen_play(SOUND *snd)
 {
-	int i;
-	
 	assert(snd);
 	
 	if (c_snd_enable)
 	{
-		for (i=0; i<(c_snd_single?1:CHAN_MAX); i++)
+		sndgen_seq++;
+		sndgen_vol_sent = (u8)state.var[V23_SNDVOL];
+		sndgen_on_sent = flag_test(F09_SOUND) ? 1 : 0;
+		if (sndcmd_push(SNDCMD_PLAY, snd))
 		{
-			channel[i].data = snd->channel[i];
-			channel[i].duration = 0;
-			channel[i].dissolve_count = 0xFFFF;
-			channel[i].avail = 0xFFFF;
-			channel[i].freq_count = 0;
-			channel[i].tone_handle = tone_open(i);
-			
-			if (channel[i].tone_handle == 0)
-			{
-				printf("%s(): error opening tone channel.\n", __func__);
-				sndgen_shutdown();
-				c_snd_enable = 0;
-				return;
-			}
+			sound_state = 1;
+			return;
 		}
-		
-		// we're assuming 4 channel tandy/pcjr here anyways
-		//channels_left = CHAN_MAX;	// channels
-		
-		sound_state = 1;
-		
-		//sound_vector();
-		
-		tone_state_set(1);
 	}
-	else
+	flag_set(sound_flag);
+}
+
+static void sndgen_chan_reset(SNDGEN_CHAN *chan, u8 *data)
+{
+	chan->data = data;
+	chan->duration = 0;
+	chan->dissolve_count = 0xFFFF;
+	chan->avail = 0xFFFF;
+	chan->freq_count = 0;
+	chan->tone_handle = 0;
+}
+
+// on the callback's side.. set the channels going
+static void sndgen_start(SOUND *snd, int seq)
+{
+	int i;
+
+	sndgen_kill_thread();
+	if ( (snd->pcm != 0) && sndgen_on )
 	{
-		flag_set(sound_flag);
-	}}
+		tone_stream(snd->pcm, snd->pcm_len);
+		sndgen_playing = seq;
+		return;
+	}
+	for (i=0; i<(c_snd_single?1:CHAN_MAX); i++)
+	{
+		sndgen_chan_reset(&channel[i], snd->channel[i]);
+		channel[i].tone_handle = tone_open(i);
+		
+		if (channel[i].tone_handle == 0)
+		{
+			printf("%s(): error opening tone channel.\n", __func__);
+			sndgen_kill_thread();
+			SDL_SetAtomicInt(&sndgen_done, seq);
+			return;
+		}
+	}
+	
+	// we're assuming 4 channel tandy/pcjr here anyways
+	//channels_left = CHAN_MAX;	// channels
+	sndgen_playing = seq;
+}
 
+// on the callback's side.. take the commands off the ring
+void sndgen_drain(void)
+{
+	SNDGEN_CMD *cmd;
+	int tail;
 
+	tail = SDL_GetAtomicInt(&sndcmd_tail);
+	while (tail != SDL_GetAtomicInt(&sndcmd_head))
+	{
+		cmd = &sndcmd_ring[tail & (SNDCMD_MAX - 1)];
+		sndgen_vol = cmd->vol;
+		sndgen_on = cmd->sound_on;
+		switch (cmd->type)
+		{
+			case SNDCMD_PLAY:
+				sndgen_start(cmd->snd, cmd->seq);
+				break;
+			case SNDCMD_STOP:
+				sndgen_kill_thread();
+				break;
+			case SNDCMD_VOLUME:
+			default:
+				// a rendered sound doesn't look at the flag itself
+				if (!sndgen_on)
+					sndgen_kill_thread();
+				break;
+		}
+		tail++;
+		SDL_SetAtomicInt(&sndcmd_tail, tail);
+	}
+}
+
+// on the callback's side.. every channel has run out or it's been stopped
 void sndgen_kill_thread(void)
 {
 	int i;
 		
-	sound_state = 0;
-	tone_state_set(0);
+	tone_stream(0, 0);
 	for (i=0; i<(c_snd_single?1:CHAN_MAX) ; i++)
 	{
 		if (channel[i].tone_handle != 0)
 			tone_close(channel[i].tone_handle);
+		channel[i].tone_handle = 0;
 	}
-	flag_set(sound_flag);
+	if (sndgen_playing != 0)
+		SDL_SetAtomicInt(&sndgen_done, sndgen_playing);
+	sndgen_playing = 0;
 }
 
 
@@ -168,14 +297,53 @@ void sndgen_stop(void)
 {
 	if (c_snd_enable)
 	{
-		tone_lock();
-		sndgen_kill_thread();
-		tone_unlock();
+		sndcmd_push(SNDCMD_STOP, 0);
+		sound_state = 0;
+		flag_set(sound_flag);
 	}}
 
+// once a cycle.. pass on what the callback finished and anything that
+// changes the volume
+void sndgen_poll(void)
+{
+	u8 vol, sound_on;
+
+	if (!c_snd_enable)
+		return;
+
+	if ( sound_state && (SDL_GetAtomicInt(&sndgen_done) == sndgen_seq) )
+	{
+		sound_state = 0;
+		flag_set(sound_flag);
+	}
+
+	vol = (u8)state.var[V23_SNDVOL];
+	sound_on = flag_test(F09_SOUND) ? 1 : 0;
+	if ( sound_state && ((vol != sndgen_vol_sent) || (sound_on != sndgen_on_sent)) )
+	{
+		sndgen_vol_sent = vol;
+		sndgen_on_sent = sound_on;
+		sndcmd_push(SNDCMD_VOLUME, 0);
+	}
+}
+
+// wait for the callback to let go of any sound it's been told to stop,
+// before the data goes
+void sndgen_sync(void)
+{
+	Uint64 start;
+
+	if (!c_snd_enable)
+		return;
+	start = SDL_GetTicks();
+	while ( (SDL_GetAtomicInt(&sndcmd_tail) != SDL_GetAtomicInt(&sndcmd_head)) &&
+		(SDL_GetTicks() - start < SNDGEN_SYNC_MS) )
+		SDL_Delay(1);
+}
+
 
 
-static int volume_calc(SNDGEN_CHAN *chan)
+static int volume_calc(SNDGEN_CHAN *chan, u8 vol)
 {
 	s8 al, dissolve_value;
 	
@@ -222,7 +390,7 @@ static int volume_calc(SNDGEN_CHAN *chan)
 				
 				al &= 0x0F;
 				if (c_snd_read_var)
-					al += state.var[V23_SNDVOL];
+					al += vol;
 				if (al > 0x0F)
 					al = 0x0F;
 			}
@@ -239,7 +407,7 @@ static int volume_calc(SNDGEN_CHAN *chan)
 // if tone isn't touched.. it should be inited so it just plays silence
 // return 0 if it's passing more data
 // return -1 if it's passing nothing (end of data)
-int sndgen_callback(int ch, TONE *tone)
+static int sndgen_step(SNDGEN_CHAN *set, int ch, TONE *tone, u8 vol)
 {
 	SNDGEN_CHAN *chan;
 	void *data;
@@ -247,10 +415,7 @@ int sndgen_callback(int ch, TONE *tone)
 	assert(tone);
 	assert(ch < (c_snd_single?1:CHAN_MAX));
 	
-	if ( !flag_test(F09_SOUND) )
-		return -1;
-	
-	chan = &channel[ch];
+	chan = &set[ch];
 	if (!chan->avail)
 		return -1;
 
@@ -305,7 +470,7 @@ int sndgen_callback(int ch, TONE *tone)
 						chan->freq_count = 128;
 						break;
 					case 3:
-						chan->freq_count = channel[2].freq_count*2;
+						chan->freq_count = set[2].freq_count*2;
 						break;
 				}
 			}
@@ -317,7 +482,7 @@ int sndgen_callback(int ch, TONE *tone)
 	if (chan->duration != 0xFFFF)
 	{
 		tone->freq_count = chan->freq_count;
-		tone->atten = volume_calc(chan);	// calc volume, sent vol is different from saved vol
+		tone->atten = volume_calc(chan, vol);	// calc volume, sent vol is different from saved vol
 		tone->type = chan->gen_type;
 		chan->duration --;
 	}
@@ -335,3 +500,63 @@ int sndgen_callback(int ch, TONE *tone)
 }
 	
 
+int sndgen_callback(int ch, TONE *tone)
+{
+	if ( !sndgen_on )
+		return -1;
+	return sndgen_step(channel, ch, tone, sndgen_vol);
+}
+
+static int sndgen_render_next(void *src, int ch, TONE *tone)
+{
+	return sndgen_step((SNDGEN_CHAN *)src, ch, tone, 0);
+}
+
+// how many 60ths of a second the longest channel lasts, 0 if it's too long
+static int sndgen_length(SOUND *snd, int chan_total)
+{
+	u8 *data;
+	u16 duration;
+	int i, ticks, longest;
+
+	longest = 0;
+	for (i=0; i<chan_total; i++)
+	{
+		ticks = 0;
+		data = snd->channel[i];
+		while ( (duration = load_le_16(data)) != 0xFFFF )
+		{
+			ticks += duration;
+			if (ticks > SNDGEN_RENDER_MAX)
+				return 0;
+			data += 5;
+		}
+		if (ticks > longest)
+			longest = ticks;
+	}
+	return longest;
+}
+
+// with [sound] prerender, make a newly loaded sound into samples so the
+// callback only has to copy it.  not when v23 can change the volume
+// while it plays.
+void sndgen_render(SOUND *snd)
+{
+	SNDGEN_CHAN set[CHAN_MAX];
+	int chan_total, ticks, i;
+
+	assert(snd);
+	snd->pcm = 0;
+	snd->pcm_len = 0;
+	if ( !c_snd_enable || !c_snd_prerender || c_snd_read_var )
+		return;
+
+	chan_total = c_snd_single ? 1 : CHAN_MAX;
+	ticks = sndgen_length(snd, chan_total);
+	if (ticks == 0)
+		return;
+
+	for (i=0; i<chan_total; i++)
+		sndgen_chan_reset(&set[i], snd->channel[i]);
+	snd->pcm = tone_render(sndgen_render_next, set, chan_total, ticks, &snd->pcm_len);
+}
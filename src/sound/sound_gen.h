@@ -25,5 +25,8 @@ extern void sndgen_stop(void);
 extern int sndgen_callback(int ch, TONE *tone);
 extern void sndgen_poll(void);
 extern void sndgen_kill_thread(void);
+extern void sndgen_drain(void);
+extern void sndgen_sync(void);
+extern void sndgen_render(SOUND *snd);
 
 #endif /* NAGI_SOUND_SOUND_GEN_H */
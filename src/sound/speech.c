@@ -0,0 +1,140 @@
+/*
+Spoken messages
+
+the translated text of a message box is passed on a sentence at a time
+while it's still being generated, and nagi_tts synthesizes each one on its
+own thread.  what it makes is played on a pcm_out handle of its own next
+to the tone mix, resampled from the speech rate to the device's on the
+way.
+
+it needs sound to be on and a [tts] command or [cloud] tts_url in
+llm_config.ini.
+*/
+
+#ifdef NAGI_ENABLE_LLM
+
+#include "../agi.h"
+
+#include "speech.h"
+#include "pcm_out.h"
+
+#include "../llm_global.h"
+#include <nagi_llm_tts.h>
+
+#define SPEECH_BLOCK 256	// samples taken off the ring at a time
+
+static nagi_tts_t *speech_tts = 0;
+static int speech_handle = 0;
+static int speech_said = 0;	// length of the message passed on so far
+
+// on the callback's side
+static s16 speech_block[SPEECH_BLOCK];
+static int speech_block_len = 0;
+static int speech_block_pos = 0;
+static u32 speech_step = 0;	// speech samples per device sample, 16.16
+static u32 speech_frac = 0;
+static s16 speech_prev = 0;
+static s16 speech_next = 0;
+
+// the next speech sample, silence if there isn't one yet
+static s16 speech_sample(void)
+{
+	if (speech_block_pos >= speech_block_len)
+	{
+		speech_block_len = nagi_tts_read(speech_tts, speech_block, SPEECH_BLOCK);
+		speech_block_pos = 0;
+		if (speech_block_len == 0)
+			return 0;
+	}
+	return speech_block[speech_block_pos++];
+}
+
+static int speech_mix(void *unused, u8 *stream, int len)
+{
+	s16 *out;
+	int i;
+
+	(void) unused;
+
+	out = (s16 *)stream;
+	len /= 2;
+	for (i=0; i<len; i++)
+	{
+		while (speech_frac >= 0x10000)
+		{
+			speech_prev = speech_next;
+			speech_next = speech_sample();
+			speech_frac -= 0x10000;
+		}
+		out[i] = (s16)(speech_prev +
+			(((s64)speech_next - speech_prev) * speech_frac >> 16));
+		speech_frac += speech_step;
+	}
+	return 0;
+}
+
+void speech_init(void)
+{
+	int freq;
+
+	speech_said = 0;
+	if ( !c_snd_enable || (g_llm == 0) )
+		return;
+
+	speech_tts = nagi_tts_create(&g_llm_config);
+	if (speech_tts == 0)
+		return;
+
+	freq = pcm_out_freq_get();
+	speech_step = (u32)(((u64)nagi_tts_sample_rate(speech_tts) << 16) / (u32)freq);
+	speech_frac = 0;
+	speech_prev = 0;
+	speech_next = 0;
+	speech_block_len = 0;
+	speech_block_pos = 0;
+
+	speech_handle = pcm_out_open(speech_mix, 0);
+	if (speech_handle == 0)
+	{
+		printf("Speech: no pcm_out handle left\n");
+		speech_denit();
+	}
+}
+
+void speech_denit(void)
+{
+	if (speech_handle != 0)
+	{
+		pcm_out_lock();
+		pcm_out_close(speech_handle);
+		pcm_out_unlock();
+	}
+	speech_handle = 0;
+	if (speech_tts != 0)
+		nagi_tts_destroy(speech_tts);
+	speech_tts = 0;
+}
+
+void speech_stop(void)
+{
+	speech_said = 0;
+	if (speech_tts != 0)
+		nagi_tts_flush(speech_tts);
+}
+
+void speech_text(const char *text, int len, int final)
+{
+	int n;
+
+	if ( (speech_tts == 0) || (len <= speech_said) )
+		return;
+
+	n = nagi_tts_sentences(text + speech_said, len - speech_said, final);
+	if (n > 0)
+	{
+		nagi_tts_say(speech_tts, text + speech_said, n);
+		speech_said += n;
+	}
+}
+
+#endif /* NAGI_ENABLE_LLM */
@@ -0,0 +1,13 @@
+#ifndef NAGI_SOUND_SPEECH_H
+#define NAGI_SOUND_SPEECH_H
+
+/* FUNCTIONS	---	---	---	---	---	---	--- */
+// speech for translated messages, with the llm's [tts] settings
+extern void speech_init(void);
+extern void speech_denit(void);
+// a new message.. drop whatever's still to be said
+extern void speech_stop(void);
+// the message text so far, final once it's all there
+extern void speech_text(const char *text, int len, int final);
+
+#endif /* NAGI_SOUND_SPEECH_H */
@@ -102,3 +102,17 @@ void tone_unlock(void)
 	tone_drv.ptr_unlock();
 }
 
+// the whole of a sound in one go, 0 if the driver can't
+s16 *tone_render(TONE_SOURCE next, void *src, int chan_total, int ticks, int *len)
+{
+	if (tone_drv.ptr_render == 0)
+		return 0;
+	return tone_drv.ptr_render(next, src, chan_total, ticks, len);
+}
+
+// play a rendered sound instead of the channels, 0 to stop it
+void tone_stream(const s16 *pcm, int len)
+{
+	if (tone_drv.ptr_stream != 0)
+		tone_drv.ptr_stream(pcm, len);
+}
@@ -8,6 +8,8 @@
 #define GEN_PERIOD 2
 #define GEN_WHITE 3
 
+// where a channel gets its next 60th of a second from
+typedef int (*TONE_SOURCE)(void *src, int ch, struct tone_struct *tone);
 
 struct tone_driver_struct
 {
@@ -21,6 +23,8 @@ struct tone_driver_struct
 	int (*ptr_state_get)(void);
 	void (*ptr_lock)(void);
 	void (*ptr_unlock)(void);
+	s16 *(*ptr_render)(TONE_SOURCE next, void *src, int chan_total, int ticks, int *len);
+	void (*ptr_stream)(const s16 *pcm, int len);
 };
 typedef struct tone_driver_struct TONE_DRIVER;
 
@@ -35,5 +39,7 @@ extern void tone_state_set(int);
 extern int tone_state_get(void);
 extern void tone_lock(void);
 extern void tone_unlock(void);
+extern s16 *tone_render(TONE_SOURCE next, void *src, int chan_total, int ticks, int *len);
+extern void tone_stream(const s16 *pcm, int len);
 
 #endif /* NAGI_SOUND_TONE_H */
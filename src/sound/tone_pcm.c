@@ -2,8 +2,23 @@
 
 */
 
+/*
+all the agi channels are made here into one buffer and handed to pcm_out as
+a single channel, at whatever rate the device runs at so nothing has to
+resample it.  between flips a square or noise channel is just the same
+value over and over, so each run of it is added to the mix in one go.
+with [sound] bandlimit=1 each flip is smoothed over the samples either
+side of it (polyblep) so high notes don't alias.
+
+with [sound] prerender=1 a sound is rendered the same way once when it's
+loaded and the callback only copies it out.
+*/
+
 
 //~ RaDIaT1oN: remove unnamed unions members
+
+#define MEM_TAG MEM_RES
+
 /* BASE headers	---	---	---	---	---	---	--- */
 #include "../agi.h"
 
@@ -22,7 +37,6 @@
 #include "pcm_out.h"
 
 #include "../sys/mem_wrap.h"
-#include "../list.h"
 
 /* PROTOTYPES	---	---	---	---	---	---	--- */
 
@@ -46,15 +60,22 @@
 //#define WAVE_HEIGHT  (0x7FFF)
 
 
+#define TONE_CHAN_MAX 4
+#define TONE_MIX_MAX 512	// samples mixed at a time
+#define TONE_NOTE_RATE 60	// tone changes 60 times per sec
+
 static s16 vol_table[16];
 
 struct tone_chan_struct
 {
-	int handle;	// for removing chan
+	int open;
 	int agi_ch;	// for calling the agi soundgen callback
 	int avail;
+	TONE_SOURCE next;
+	void *src;
 	
 	int note_count; // length of tone.. duration
+	int note_rem;	// what's left over when the rate doesn't divide by 60
 	
 	int freq_count;
 	int freq_count_prev;
@@ -62,25 +83,24 @@ struct tone_chan_struct
 	
 	int gen_type;
 	int gen_type_prev;
-	union
+	struct
 	{
-		struct
-		{
-			int count;
-			int scale;
-			int sign;
-			unsigned int noise_state;		/* noise generator      */
-			int feedback;		/* noise feedback mask */
-		} n;
-		
-	};
+		int count;
+		int scale;
+		int sign;
+		unsigned int noise_state;		/* noise generator      */
+		int feedback;		/* noise feedback mask */
+	} n;
 	
+	s32 blep_next;	// smoothing owed to the first sample of the next buffer
 };
 typedef struct tone_chan_struct TONECHAN;
 
-static int tone_pcm_callback(void *tpcm, u8 *stream, int len);
-static int noise_fill(TONECHAN *t, s16 *buf, int len);
-static int square_fill(TONECHAN *t, s16 *buf, int len);
+static int tone_pcm_mix(void *unused, u8 *stream, int len);
+static int tone_set_mix(TONECHAN *set, int set_open, s16 *out, int len);
+static int tone_chan_mix(TONECHAN *t, s32 *mix, int len);
+static void noise_fill(TONECHAN *t, s32 *mix, int len, int room);
+static void square_fill(TONECHAN *t, s32 *mix, int len, int room);
 static void tone_pcm_state_set(int tone_state);
 static int tone_pcm_state_get(void);
 static void tone_pcm_lock(void);
@@ -89,10 +109,20 @@ static void vol_table_init(void);
 static void tone_pcm_shutdown(void);
 static int tone_pcm_open(int ch);
 static void tone_pcm_close(int handle);
+static s16 *tone_pcm_render(TONE_SOURCE next, void *src, int chan_total, int ticks, int *len);
+static void tone_pcm_stream(const s16 *pcm, int len);
 
 /* VARIABLES	---	---	---	---	---	---	--- */
 
-static LIST *list_ch = 0;
+static TONECHAN tone_chan[TONE_CHAN_MAX];
+static int tone_chan_open = 0;	// how many are open
+static int pcm_handle = 0;
+static int tone_freq = 44100;	// samples per sec
+
+// a rendered sound that's playing instead of the channels
+static const s16 *stream_pcm = 0;
+static int stream_len = 0;
+static int stream_pos = 0;
 
 /* CODE	---	---	---	---	---	---	---	--- */
 
@@ -131,16 +161,30 @@ void tone_pcm_drv_init(void *drv)
 	tdrv->ptr_state_get = tone_pcm_state_get;
 	tdrv->ptr_lock = tone_pcm_lock;
 	tdrv->ptr_unlock = tone_pcm_unlock;
+	tdrv->ptr_render = tone_pcm_render;
+	tdrv->ptr_stream = tone_pcm_stream;
 }
 
 //init
 int tone_pcm_init(void)
 {
-	// init a pcm device
-	if (pcm_out_init(44100, SDL_AUDIO_S16LE))
+	// init a pcm device at its own rate
+	if (pcm_out_init(0, SDL_AUDIO_S16LE))
 		return -1;
+	tone_freq = pcm_out_freq_get();
 	
+	memset(tone_chan, 0, sizeof(tone_chan));
+	tone_chan_open = 0;
+	stream_pcm = 0;
 	vol_table_init();
+
+	// the mix stays open, sound_gen's commands come in through it
+	pcm_handle = pcm_out_open(tone_pcm_mix, 0);
+	if (pcm_handle == 0)
+	{
+		pcm_out_shutdown();
+		return -1;
+	}
 	
 	return 0;
 }
@@ -148,69 +192,74 @@ int tone_pcm_init(void)
 //shutdown
 static void tone_pcm_shutdown(void)
 {
+	int i;
+
 	tone_pcm_state_set(0);
 	
 	// all channels must be closed
-	if (list_ch)
-		list_free(list_ch);
-	list_ch = 0;
+	for (i=0; i<TONE_CHAN_MAX; i++)
+		if (tone_chan[i].open)
+			tone_pcm_close(i + 1);
+	if (pcm_handle != 0)
+		pcm_out_close(pcm_handle);
+	pcm_handle = 0;
 	
 	// shutdown pcm out
 	pcm_out_shutdown();
 }
 
+static int tone_pcm_live(void *unused, int ch, TONE *tone)
+{
+	(void) unused;
+	return sndgen_callback(ch, tone);
+}
+
+static void tone_chan_reset(TONECHAN *ch, int agi_ch, TONE_SOURCE next, void *src)
+{
+	memset(ch, 0, sizeof(TONECHAN));
+	ch->atten = 0xF;	// silence
+	ch->agi_ch = agi_ch;
+	ch->next = next;
+	ch->src = src;
+	ch->freq_count = 250;
+	ch->freq_count_prev = -1;
+	ch->gen_type = GEN_TONE;
+	ch->gen_type_prev = -1;
+	ch->note_count = 0;
+	ch->avail = 1;
+	ch->open = 1;
+}
+
 // open
 // return 0 on error
 static int tone_pcm_open(int agi_ch)
 {
-	TONECHAN ch;
-	TONECHAN *new_ch;
-	
-	if (list_ch==NULL)
-		list_ch = list_new(sizeof(TONECHAN));
-	
-	ch.atten = 0xF;	// silence
-	ch.agi_ch = agi_ch;
-	ch.freq_count = 250;
-	ch.freq_count_prev = -1;
-	ch.gen_type = GEN_TONE;
-	ch.gen_type_prev = -1;
-	ch.note_count = 0;
-	ch.avail = 1;
-	
-	new_ch = list_add(list_ch);
-	memcpy(new_ch, &ch, sizeof(TONECHAN) );
-	
-	new_ch->handle = pcm_out_open(tone_pcm_callback, (void *)new_ch);
-	
-	if (new_ch->handle == 0)
-	{
-		list_remove(list_ch, new_ch);
+	if ( (agi_ch < 0) || (agi_ch >= TONE_CHAN_MAX) )
 		return 0;
-	}
+
+	pcm_out_lock();
+	tone_chan_reset(&tone_chan[agi_ch], agi_ch, tone_pcm_live, 0);
+	tone_chan_open++;
+	pcm_out_unlock();
 	
-	return new_ch->handle;
+	return agi_ch + 1;
 }
 
 static void tone_pcm_close(int handle)
 {
 	TONECHAN *ch;
 	
-	if (list_ch!=NULL)
+	if ( (handle < 1) || (handle > TONE_CHAN_MAX) )
+		return;
+	
+	pcm_out_lock();
+	ch = &tone_chan[handle - 1];
+	if (ch->open)
 	{
-		// find the one with a handle
-		ch = list_element_head(list_ch);
-		while ((ch!=NULL) && (ch->handle != handle))
-			ch=node_next(ch);
-		
-		// kill it
-		if (ch!=NULL)
-		{
-			pcm_out_close(ch->handle);
-			list_remove(list_ch, ch);
-		}
+		ch->open = 0;
+		tone_chan_open--;
 	}
-	
+	pcm_out_unlock();
 }
 
 static void tone_pcm_state_set(int tone_state)
@@ -233,25 +282,128 @@ static void tone_pcm_unlock(void)
 	pcm_out_unlock();
 }
 
+// on the callback's side
+static void tone_pcm_stream(const s16 *pcm, int len)
+{
+	stream_pcm = pcm;
+	stream_len = len;
+	stream_pos = 0;
+}
+
 
 #define FREQ_DIV 111844
 #define MULT FREQ_DIV
 
-// fill buff
+// mix every open channel into the stream
+// it keeps going when they're done.. silence until the next sound
+static int tone_pcm_mix(void *unused, u8 *stream, int len)
+{
+	int fill_size;
+
+	(void) unused;
+
+	// what the game's asked for since the last buffer
+	sndgen_drain();
+
+	len /= 2;
+	if (stream_pcm != 0)
+	{
+		fill_size = stream_len - stream_pos;
+		if (fill_size > len)
+			fill_size = len;
+		memcpy(stream, stream_pcm + stream_pos, (size_t)fill_size * sizeof(s16));
+		memset((s16 *)stream + fill_size, 0, (size_t)(len - fill_size) * sizeof(s16));
+		stream_pos += fill_size;
+		if (stream_pos >= stream_len)
+			sndgen_kill_thread();
+		return 0;
+	}
+
+	if ( !tone_set_mix(tone_chan, tone_chan_open, (s16 *)stream, len) &&
+		(tone_chan_open != 0) )
+		sndgen_kill_thread();
+	return 0;
+}
+
+// mix a set of channels into len samples of out
+// return 0 once none of them have anything left to play
+static int tone_set_mix(TONECHAN *set, int set_open, s16 *out, int len)
+{
+	s32 mix[TONE_MIX_MAX];
+	int fill_size, playing, i;
+	s32 v;
+
+	playing = 0;
+	while (len > 0)
+	{
+		fill_size = (len < TONE_MIX_MAX) ? len : TONE_MIX_MAX;
+		memset(mix, 0, (size_t)fill_size * sizeof(s32));
+
+		for (i=0; i<TONE_CHAN_MAX; i++)
+			if ( set[i].open && (tone_chan_mix(&set[i], mix, fill_size) == 0) )
+				playing = 1;
+
+		// each channel gets its share, like they did mixed separately
+		for (i=0; i<fill_size; i++)
+		{
+			v = mix[i] / (set_open ? set_open : 1);
+			if (v > 0x7FFF)
+				v = 0x7FFF;
+			else if (v < -0x8000)
+				v = -0x8000;
+			out[i] = (s16)v;
+		}
+
+		out += fill_size;
+		len -= fill_size;
+	}
+	return playing;
+}
+
+// render "ticks" 60ths of a second of chan_total channels fed by next()
+// the whole way through.  the channels are its own so it can run while the
+// callback is playing something else.
+static s16 *tone_pcm_render(TONE_SOURCE next, void *src, int chan_total, int ticks, int *len)
+{
+	TONECHAN set[TONE_CHAN_MAX];
+	s16 *pcm;
+	int size, done, i;
+
+	if ( (chan_total < 1) || (chan_total > TONE_CHAN_MAX) )
+		return 0;
+
+	memset(set, 0, sizeof(set));
+	for (i=0; i<chan_total; i++)
+		tone_chan_reset(&set[i], i, next, src);
+
+	// room for the last part mix after the notes run out
+	size = (int)(((s64)ticks * tone_freq) / TONE_NOTE_RATE) + TONE_MIX_MAX;
+	pcm = (s16 *)a_malloc((size_t)size * sizeof(s16));
+	done = 0;
+	while (done + TONE_MIX_MAX <= size)
+	{
+		i = tone_set_mix(set, chan_total, pcm + done, TONE_MIX_MAX);
+		done += TONE_MIX_MAX;
+		if (!i)
+			break;
+	}
+
+	*len = done;
+	return pcm;
+}
+
+// add a channel's samples to the mix
 // return -1 if channel is complete.
-static int tone_pcm_callback(void *userdata, u8 *stream, int len)
+static int tone_chan_mix(TONECHAN *tpcm, s32 *mix, int len)
 {
-	TONECHAN *tpcm;
-	s16 *stream_cur;
 	TONE new_tone;
 	int fill_size;
 	int ret_val;
 
-	tpcm = (TONECHAN*)userdata;
-	stream_cur = (s16 *)stream;
-
-	len /= 2;
 	ret_val = 0;    // assume channel is okay and still going
+
+	mix[0] += tpcm->blep_next;
+	tpcm->blep_next = 0;
 	
 	while (len > 0)
 	{
@@ -262,15 +414,16 @@ static int tone_pcm_callback(void *userdata, u8 *stream, int len)
 			new_tone.atten = 0xF;
 			new_tone.type = GEN_TONE;
 			if ( (tpcm->avail) &&
-				(sndgen_callback(tpcm->agi_ch, &new_tone) == 0))
+				(tpcm->next(tpcm->src, tpcm->agi_ch, &new_tone) == 0))
 			{
 				tpcm->atten = new_tone.atten;
 				tpcm->freq_count = new_tone.freq_count;
 				tpcm->gen_type = new_tone.type;
 				
 				// setup counters 'n stuff
-				// 44100 samples per sec.. tone changes 60 times per sec
-				tpcm->note_count = 44100 / 60;
+				tpcm->note_rem += tone_freq;
+				tpcm->note_count = tpcm->note_rem / TONE_NOTE_RATE;
+				tpcm->note_rem %= TONE_NOTE_RATE;
 			}
 			else
 			{
@@ -294,21 +447,20 @@ static int tone_pcm_callback(void *userdata, u8 *stream, int len)
 		switch (tpcm->gen_type)
 		{
 			case GEN_TONE:
-				fill_size = square_fill(tpcm, stream_cur, fill_size);
+				square_fill(tpcm, mix, fill_size, len);
 				break;
 			case GEN_PERIOD:
 			case GEN_WHITE:
-				fill_size = noise_fill(tpcm, stream_cur, fill_size);
+				noise_fill(tpcm, mix, fill_size, len);
 				break;
 			case GEN_SILENCE:
 			default:
-				// fill with whitespace
-				memset(stream_cur, 0, fill_size * sizeof(s16));
+				// silence adds nothing
 				break;
 		}
 		
 		tpcm->note_count -= fill_size;
-		stream_cur += fill_size;
+		mix += fill_size;
 		len -= fill_size;
 	}
 	
@@ -316,10 +468,38 @@ static int tone_pcm_callback(void *userdata, u8 *stream, int len)
 }
 
 
+// add the same value to a run of samples
+static void run_add(s32 *mix, int len, s32 value)
+{
+	int i;
+
+	for (i=0; i<len; i++)
+		mix[i] += value;
+}
 
-static int square_fill(TONECHAN *t, s16 *buf, int len)
+// smooth a step of "height" that happens "count" of MULT into the time
+// between mix[last] and the sample after it
+static void blep_add(TONECHAN *t, s32 *mix, int last, int room, s32 height, int count)
 {
-	int count;
+	s64 f, g;
+
+	if ( (!c_snd_bandlimit) || (height == 0) )
+		return;
+
+	f = ((s64)count << 16) / MULT;	// 0..65536 past mix[last]
+	g = 65536 - f;
+	mix[last] += (s32)((height * g * g) >> 33);
+	if (last + 1 < room)
+		mix[last + 1] -= (s32)((height * f * f) >> 33);
+	else
+		t->blep_next -= (s32)((height * f * f) >> 33);
+}
+
+// room is how much of the mix is left past mix[0], for the smoothing
+static void square_fill(TONECHAN *t, s32 *mix, int len, int room)
+{
+	int i, run, before;
+	s32 vol, level;
 	
 	if (t->gen_type != t->gen_type_prev)
 	{
@@ -332,33 +512,41 @@ static int square_fill(TONECHAN *t, s16 *buf, int len)
 	if (t->freq_count != t->freq_count_prev)
 	{
 		//t->scale = (int)( (double)t->samp->freq*t->freq_count/FREQ_DIV * MULT + 0.5);
-		t->n.scale = (44100/2) * t->freq_count;
+		t->n.scale = (tone_freq/2) * t->freq_count;
 		t->n.count = t->n.scale;
 		t->freq_count_prev = t->freq_count;	
 	}
 
-	count = len;
+	vol = vol_table[t->atten];
+	i = 0;
 	
-	while (count > 0)
-	{		
-		*(buf++) = t->n.sign ? vol_table[t->atten] : -vol_table[t->atten];
-		count--;
+	while (i < len)
+	{
+		// the samples before the count runs out and it flips
+		run = (t->n.count + MULT - 1) / MULT;
+		if (run > len - i)
+			run = len - i;
+		level = t->n.sign ? vol : -vol;
+		run_add(mix + i, run, level);
+		i += run;
 		
 		// get next sample
-		t->n.count -= MULT;
+		t->n.count -= run * MULT;
+		before = t->n.count + MULT;	// at the start of the last sample
 		while (t->n.count <= 0)
 		{
 			t->n.sign ^= 1;
+			blep_add(t, mix, i - 1, room, t->n.sign ? 2*vol : -2*vol, before);
 			t->n.count += t->n.scale;
+			before += t->n.scale;
 		}
 	}
-	
-	return len;
 }
 
-static int noise_fill(TONECHAN *t, s16 *buf, int len)
+static void noise_fill(TONECHAN *t, s32 *mix, int len, int room)
 {
-	int count;
+	int i, run, before, sign;
+	s32 vol;
 	
 	if (t->gen_type != t->gen_type_prev)
 	{
@@ -370,7 +558,7 @@ static int noise_fill(TONECHAN *t, s16 *buf, int len)
 	if (t->freq_count != t->freq_count_prev)
 	{
 		//t->scale = (int)( (double)t->samp->freq*t->freq_count/FREQ_DIV * MULT + 0.5);
-		t->n.scale = (44100/2) * t->freq_count;
+		t->n.scale = (tone_freq/2) * t->freq_count;
 		t->n.count = t->n.scale;
 		t->freq_count_prev = t->freq_count;	
 		
@@ -380,24 +568,31 @@ static int noise_fill(TONECHAN *t, s16 *buf, int len)
 		t->n.sign = t->n.noise_state & 1;
 	}
 
-	count = len;
+	vol = vol_table[t->atten];
+	i = 0;
 	
-	while (count > 0)
-	{		
-		*(buf++) = t->n.sign ? vol_table[t->atten] : -vol_table[t->atten];
-		count--;
+	while (i < len)
+	{
+		run = (t->n.count + MULT - 1) / MULT;
+		if (run > len - i)
+			run = len - i;
+		run_add(mix + i, run, t->n.sign ? vol : -vol);
+		i += run;
 		
 		// get next sample
-		t->n.count -= MULT;
+		t->n.count -= run * MULT;
+		before = t->n.count + MULT;
 		while (t->n.count <= 0)
 		{
+			sign = t->n.sign;
 			if (t->n.noise_state & 1)
 				t->n.noise_state ^= t->n.feedback;
 			t->n.noise_state >>= 1;
 			t->n.sign = t->n.noise_state & 1;
+			if (t->n.sign != sign)
+				blep_add(t, mix, i - 1, room, t->n.sign ? 2*vol : -2*vol, before);
 			t->n.count += t->n.scale;
+			before += t->n.scale;
 		}
 	}
-	
-	return len;
 }
@@ -0,0 +1,114 @@
+/*
+Spoken commands
+
+the default recording device is opened at the rate nagi_stt wants and
+what it records is handed over every cycle.  nagi_stt works out where
+the player starts and stops talking and transcribes on its own thread.
+
+a partial transcript (the player's still talking) goes to the parser's
+speculative extraction, so the words are usually extracted by the time
+the final one comes in.  the final one is typed into the input line
+through the event queue like keys are, replacing whatever was typed, and
+entered.  that way it's logged and replayed like typing.
+
+it needs an [stt] url in llm_config.ini.
+*/
+
+#ifdef NAGI_ENABLE_LLM
+
+#include <string.h>
+
+#include "../agi.h"
+
+#include "voice.h"
+
+#include "../ui/cmd_input.h"
+#include "../ui/events.h"
+#include "../ui/parse.h"
+#include "../sys/replay.h"
+#include "../lib/utf8_decode.h"
+
+#include "../llm_global.h"
+#include <nagi_llm_stt.h>
+
+#define VOICE_BLOCK 1024	// samples taken off the device stream at a time
+
+static nagi_stt_t *voice_stt = 0;
+static SDL_AudioStream *voice_stream = 0;
+
+void voice_init(void)
+{
+	SDL_AudioSpec spec;
+
+	// a replay types the recorded keys itself
+	if ( (g_llm == 0) || (replay_mode == REPLAY_PLAY) )
+		return;
+
+	voice_stt = nagi_stt_create(&g_llm_config);
+	if (voice_stt == 0)
+		return;
+
+	spec.format = SDL_AUDIO_S16;
+	spec.channels = 1;
+	spec.freq = nagi_stt_sample_rate(voice_stt);
+	voice_stream = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_RECORDING, &spec, 0, 0);
+	if (voice_stream == 0)
+	{
+		printf("Voice: can't open the microphone: %s\n", SDL_GetError());
+		voice_denit();
+		return;
+	}
+	SDL_ResumeAudioStreamDevice(voice_stream);
+}
+
+void voice_denit(void)
+{
+	if (voice_stream != 0)
+		SDL_DestroyAudioStream(voice_stream);
+	voice_stream = 0;
+	if (voice_stt != 0)
+		nagi_stt_destroy(voice_stt);
+	voice_stt = 0;
+}
+
+// the transcript goes in as keys: backspaces over the line, the words, enter
+static void voice_type(const char *text)
+{
+	const char *s;
+	int ch;
+
+	for (s = input_line(); *s != 0; s++)
+		if ((*s & 0xC0) != 0x80)
+			event_write(1, 8);
+
+	utf8_decode_init(text, (int)strlen(text));
+	while ( (ch = utf8_decode_next()) > 0 )
+		if (ch < 0x10000)
+			event_write(1, (u16)ch);
+	event_write(1, 13);
+}
+
+void voice_poll(void)
+{
+	s16 pcm[VOICE_BLOCK];
+	char text[INPUT_SIZE];
+	int got;
+
+	if (voice_stt == 0)
+		return;
+
+	while ( (got = SDL_GetAudioStreamData(voice_stream, pcm, sizeof(pcm))) > 0 )
+		nagi_stt_write(voice_stt, pcm, got / 2);
+
+	got = nagi_stt_poll(voice_stt, text, sizeof(text));
+	// the game isn't taking typed commands just now
+	if ( (got == NAGI_STT_NONE) || (state.input_state == 0) )
+		return;
+
+	if (got == NAGI_STT_PARTIAL)
+		parse_speculate(text);
+	else
+		voice_type(text);
+}
+
+#endif /* NAGI_ENABLE_LLM */
@@ -0,0 +1,11 @@
+#ifndef NAGI_SOUND_VOICE_H
+#define NAGI_SOUND_VOICE_H
+
+/* FUNCTIONS	---	---	---	---	---	---	--- */
+// spoken commands, with the llm's [stt] settings
+extern void voice_init(void);
+extern void voice_denit(void);
+// pass on what the microphone recorded and act on any transcript
+extern void voice_poll(void);
+
+#endif /* NAGI_SOUND_VOICE_H */
@@ -7,6 +7,8 @@ CmdSaveGame                      cseg     00002753 00000173
 _StateWrite                      cseg     000028C6 00000074
 */
 
+#define MEM_TAG MEM_STATE
+
 #include <stdio.h>
 #include <string.h>
 
@@ -14,6 +16,8 @@ _StateWrite                      cseg     000028C6 00000074
 #include "sys/vstring.h"
 #include "state_io.h"
 #include "state_info.h"
+#include "state_snap.h"
+#include "state_rewind.h"
 
 #include "decrypt.h"
 
@@ -53,12 +57,78 @@ _StateWrite                      cseg     000028C6 00000074
 #include "trace.h"
 
 #include "sys/endian.h"
+#include "sys/mem_wrap.h"
+
+#ifdef NAGI_ENABLE_LLM
+#include "llm_global.h"
+#endif
+
+// a snapshot being read or written
+struct state_buff_struct
+{
+	u8 *data;
+	size_t size;
+	size_t pos;
+};
+typedef struct state_buff_struct STATE_BUFF;
 
-static u16 state_read(FILE *data_stream, void *data_alloc, size_t size_multiple, size_t size_max);
-static u16 state_write(FILE *stream, void *write_data, u16 write_size);
+static u16 state_read(STATE_BUFF *buff, void *data_alloc, size_t size_multiple, size_t size_max);
+static size_t state_blocks(u8 *data, size_t size, u16 apply);
+static void state_write(STATE_BUFF *buff, void *write_data, u16 write_size);
 
 char state_name_auto[0x32] = {0};
 
+#ifdef NAGI_ENABLE_LLM
+// the llm's context and what it's learned of the player go after the blocks:
+//   "LLMC", u32 context size, context, u32 session size, session
+static size_t state_llm_size(void)
+{
+	size_t size;
+
+	size = 12 + (size_t)llm_context_snapshot_size(g_llm_session);
+	if (g_llm != 0)
+		size += nagi_llm_session_save(g_llm, 0, 0, g_llm_config.save_kv);
+	return size;
+}
+
+static size_t state_llm_write(u8 *data, size_t size)
+{
+	size_t ctx_size, session_size;
+
+	ctx_size = (size_t)llm_context_snapshot_size(g_llm_session);
+	if (size < 12 + ctx_size)
+		return 0;
+	memcpy(data, "LLMC", 4);
+	store_le_32(data + 4, (u32)ctx_size);
+	llm_context_snapshot(g_llm_session, data + 8);
+	session_size = 0;
+	if (g_llm != 0)
+		session_size = nagi_llm_session_save(g_llm, data + 12 + ctx_size,
+				size - 12 - ctx_size, g_llm_config.save_kv);
+	store_le_32(data + 8 + ctx_size, (u32)session_size);
+	return 12 + ctx_size + session_size;
+}
+
+// saves from before this (or another build) just start the llm afresh
+static void state_llm_read(u8 *data, size_t size)
+{
+	size_t ctx_size, session_size;
+
+	if ( (size < 12) || (memcmp(data, "LLMC", 4) != 0) )
+		return;
+	ctx_size = load_le_32(data + 4);
+	if ( (ctx_size > size - 12) || (ctx_size != (size_t)llm_context_snapshot_size(g_llm_session)) )
+		return;
+	session_size = load_le_32(data + 8 + ctx_size);
+	if (session_size > size - 12 - ctx_size)
+		return;
+	llm_context_snapshot_restore(g_llm_session, data + 8);
+	// after the context, so the decoded copy can be checked against it
+	if ( (g_llm != 0) && (session_size != 0) )
+		nagi_llm_session_load(g_llm, data + 12 + ctx_size, session_size);
+}
+#endif
+
 u8 *cmd_restart_game(u8 *c)
 {
 	u16 snd_state;
@@ -79,7 +149,8 @@ u8 *cmd_restart_game(u8 *c)
 		cmd_cancel_line(0);
 		snd_state = flag_test(F09_SOUND);
 		//clear_memory();	// shouldn't be necessary
-		game_init();
+		if (state_restart_apply() == 0)
+			game_init();
 		volumes_close();
 		flag_set(F06_RESTART);
 		if ( snd_state != 0)
@@ -106,10 +177,13 @@ u8 *cmd_restore_game(u8 *c)
 	u8 *code_ret;	// result to pass at the end
 	char newline_orig;	// d0d orig
 	FILE *rest_stream;
+	u8 *rest_data;
+	size_t rest_size;
+	size_t rest_used;
 	//u8 msg[200];
 	char *msg;
 	
-	clock_state = 1;
+	clock_set_state(1);
 	code_ret = c;
 	newline_orig = msgstate.newline_char;
 	msgstate.newline_char = '@';
@@ -119,6 +193,10 @@ u8 *cmd_restore_game(u8 *c)
 	if (save_filename == 0)
 		save_filename = vstring_new(0, 250);
 	
+	// anything still being written has to be there to read
+	if (state_snap_wait() == 0)
+		message_box("The disk is full.\nPress ENTER to continue.");
+
 	if (state_get_info('r') != 0)
 	{
 		if (strlen(save_filename->data) > strlen(save_dir->data))
@@ -142,28 +220,17 @@ u8 *cmd_restore_game(u8 *c)
 		}
 		else
 		{
-			fseek(rest_stream, 0x1F, SEEK_SET);
-			if (state_read(rest_stream, &state, sizeof(AGI_STATE), sizeof(AGI_STATE)) == 0)
-				goto loc2630;
-			if (state_read(rest_stream, objtable, sizeof(VIEW), (objtable_tail - objtable) * sizeof(VIEW)) == 0)
-				goto loc2630;
-			if (state_read(rest_stream, inv_obj_table, sizeof(INV_OBJ), inv_obj_table_size * sizeof(INV_OBJ)) == 0)
-				goto loc2630;
-			if (state_read(rest_stream, inv_obj_string, 1, inv_obj_string_size) == 0)
-				goto loc2630;
-			if (state_read(rest_stream, script_head, 1, (state.script_size << 1)) == 0)
-				goto loc2630;
-			if (state_read(rest_stream, scan_start_list, sizeof(u16), sizeof(u16)*60) == 0)
-				goto loc2630;
-
-			goto loc2647;
-		loc2630:
+			rest_data = state_snap_load(rest_stream, save_filename->data, &rest_size);
 			fclose(rest_stream);
+			rest_used = 0;
+			if (rest_data != 0)
+				rest_used = state_apply(rest_data, rest_size);
+			if (rest_used != 0)
+				goto loc2647;
 			message_box("Error in restoring game.\nPress ENTER to quit.");
 			agi_exit();  // can't recover.. we possibly just overwrote some of the
 					// structures with stuff
 		loc2647:
-			fclose(rest_stream);
 			decrypt_string((u8*)inv_obj_string, (u8*)(inv_obj_string+inv_obj_string_size));
 			state.var[V20_COMPUTER] = computer_type;
 			state.var[V26_MONITORTYPE] = display_type;
@@ -176,6 +243,9 @@ u8 *cmd_restore_game(u8 *c)
 				state.var[V22_SNDTYPE] = 3;
 				flag_set(F11_HAS_NOISE_CHANNEL);
 			}
+#ifdef NAGI_ENABLE_LLM
+			state_llm_read(rest_data + rest_used, rest_size - rest_used);
+#endif
 			state_reload();
 			control_state_clear();
 			flag_set(F12_RESTORE);
@@ -187,11 +257,11 @@ u8 *cmd_restore_game(u8 *c)
 rest_end:
 	cmd_close_window(0);
 	msgstate.newline_char = newline_orig;
-	clock_state = 0;
+	clock_set_state(0);
 	return code_ret;
 }
 
-// Read in object array from save game file
+// Read in object array from a save game snapshot
 //
 // `size_multiple` and `size_max` are used to ensure some integrity.
 // (because this format is based on the original dos format, it is possible that nagi
@@ -201,17 +271,92 @@ rest_end:
 // Format is:
 //   0..1 - little endian word - data size
 //   2..  - bytes[data_size] - data
-static u16 state_read(FILE *data_stream, void *data_alloc, size_t size_multiple, size_t size_max)
+//
+// with data_alloc 0 it's only checked and skipped
+static u16 state_read(STATE_BUFF *buff, void *data_alloc, size_t size_multiple, size_t size_max)
 {
-	uint8_t size_bytes[2];
-	if (fread(&size_bytes, sizeof(size_bytes), 1, data_stream) != 1) { return 0; }
-	size_t data_size = load_le_16(size_bytes);
+	if (buff->size - buff->pos < 2) { return 0; }
+	size_t data_size = load_le_16(buff->data + buff->pos);
 	if ((data_size % size_multiple) != 0) { return 0; }
 	if ((data_size > size_max) != 0) { return 0; }
-	if (fread(data_alloc, data_size, 1, data_stream) != 1) { return 0; }
+	if (buff->size - buff->pos - 2 < data_size) { return 0; }
+	if (data_alloc != 0)
+		memcpy(data_alloc, buff->data + buff->pos + 2, data_size);
+	buff->pos += 2 + data_size;
 	return 1;
 }
 
+// the most state_capture() can take
+size_t state_capture_size(void)
+{
+	return 6*2 + sizeof(AGI_STATE) + objtable_size +
+		inv_obj_table_size*sizeof(INV_OBJ) + inv_obj_string_size +
+		(state.script_size<<1) + sizeof(scan_start_list);
+}
+
+// the blocks a save game is made of, in the order they're saved.
+// returns the size
+size_t state_capture(u8 *data)
+{
+	STATE_BUFF buff;
+	u16 scan_size;
+
+	scan_size = logic_save_scan_start();
+	buff.data = data;
+	buff.size = state_capture_size();
+	buff.pos = 0;
+	objtable_hot_store();
+	state_write(&buff, &state, sizeof(AGI_STATE));
+	state_write(&buff, objtable, objtable_size);
+	state_write(&buff, inv_obj_table, inv_obj_table_size*sizeof(INV_OBJ));
+	state_write(&buff, inv_obj_string, inv_obj_string_size);
+	state_write(&buff, script_head, state.script_size<<1);
+	state_write(&buff, (void *)scan_start_list, scan_size);
+	return buff.pos;
+}
+
+// walks the blocks, copying them in with apply.  the script's limit is
+// the size in the state block that was just read
+static size_t state_blocks(u8 *data, size_t size, u16 apply)
+{
+	STATE_BUFF buff;
+	AGI_STATE peek;
+	AGI_STATE *s;
+
+	s = apply ? &state : &peek;
+	buff.data = data;
+	buff.size = size;
+	buff.pos = 0;
+	if (state_read(&buff, s, sizeof(AGI_STATE), sizeof(AGI_STATE)) == 0)
+		return 0;
+	if (state_read(&buff, apply ? objtable : 0, sizeof(VIEW), (objtable_tail - objtable) * sizeof(VIEW)) == 0)
+		return 0;
+	if (apply)
+		objtable_hot_load();
+	if (state_read(&buff, apply ? inv_obj_table : 0, sizeof(INV_OBJ), inv_obj_table_size * sizeof(INV_OBJ)) == 0)
+		return 0;
+	if (state_read(&buff, apply ? inv_obj_string : 0, 1, inv_obj_string_size) == 0)
+		return 0;
+	if (state_read(&buff, apply ? script_head : 0, 1, (s->script_size << 1)) == 0)
+		return 0;
+	if (state_read(&buff, apply ? scan_start_list : 0, sizeof(u16), sizeof(u16)*60) == 0)
+		return 0;
+	return buff.pos;
+}
+
+// read the blocks back.  returns the bytes they took, or 0 if they don't
+// fit, which leaves whatever was read before it in place.
+size_t state_apply(u8 *data, size_t size)
+{
+	return state_blocks(data, size, 1);
+}
+
+// what state_apply() would return, without changing anything
+size_t state_check(u8 *data, size_t size)
+{
+	return state_blocks(data, size, 0);
+}
+
 u8 *cmd_unknown_170(u8 *c)
 {
 	strncpy(state_name_auto, state.string[*(c++)], 31);
@@ -221,10 +366,12 @@ u8 *cmd_unknown_170(u8 *c)
 u8 *cmd_save_game(u8 *c)
 {
 	char newline_orig;
-	FILE *save_stream;	// file handle
+	u8 *save_data;
+	size_t save_size;
+	size_t save_max;
 	char *msg;
 	
-	clock_state = 1;
+	clock_set_state(1);
 	newline_orig = msgstate.newline_char;
 	msgstate.newline_char = '@';
 		
@@ -235,6 +382,10 @@ u8 *cmd_save_game(u8 *c)
 	if (save_filename == 0)
 		save_filename = vstring_new(0, 250);
 	
+	// an autosave that went wrong in the background
+	if (state_snap_wait() == 0)
+		message_box("The disk is full.\nPress ENTER to continue.");
+
 	if ( state_get_info('s') != 0)// select the game
 	{
 		if (strlen(save_filename->data) > strlen(save_dir->data))
@@ -252,62 +403,46 @@ u8 *cmd_save_game(u8 *c)
 				goto save_end;
 		}
 		dir_preset_change(DIR_PRESET_GAME);
-		save_stream = fopen(save_filename->data, "wb");
-		if ( save_stream == 0)
+		save_max = state_capture_size();
+#ifdef NAGI_ENABLE_LLM
+		save_max += state_llm_size();
+#endif
+		save_data = (u8 *)a_malloc(save_max);
+		save_size = state_capture(save_data);
+#ifdef NAGI_ENABLE_LLM
+		save_size += state_llm_write(save_data + save_size, save_max - save_size);
+#endif
+
+		// autosaves (no questions asked) are left to write in the background
+		if (state_snap_save(save_filename->data, save_description,
+				save_data, save_size, state_name_auto[0] == 0) == 0)
 		{
 			sprintf(msg, "The directory\n   %s\n is full or the disk is write-protected.\nPress ENTER to continue."
 				, save_dir->data);
 			message_box(msg);
 		}
-		else
-		{
-			if (fwrite(save_description, sizeof(char), 0x1f, save_stream) != 0x1f)
-				goto save_err;
-			if (state_write(save_stream, &state, sizeof(AGI_STATE)) == 0)
-				goto save_err;
-			if (state_write(save_stream, objtable, objtable_size) == 0)
-				goto save_err;
-			if (state_write(save_stream, inv_obj_table, inv_obj_table_size*sizeof(INV_OBJ)) == 0)
-				goto save_err;
-			if (state_write(save_stream, inv_obj_string, inv_obj_string_size) == 0)
-				goto save_err;
-			if (state_write(save_stream, script_head, state.script_size<<1) == 0)
-				goto save_err;
-			if (state_write(save_stream, (void *)scan_start_list, logic_save_scan_start()) != 0)
-				goto save_close;
-		save_err:
-			fclose(save_stream);
-			remove(save_filename->data);
+		else if ( (state_name_auto[0] == 0) && (state_snap_wait() == 0) )
 			message_box("The disk is full.\nPress ENTER to continue.");
-			goto save_end;
-		save_close:
-			fclose(save_stream);
-		}
 	}
 save_end:
 	cmd_close_window(0);
 	msgstate.newline_char = newline_orig;
-	clock_state = 0;
+	clock_set_state(0);
 	decrypt_string((u8*)inv_obj_string, (u8*)(inv_obj_string+inv_obj_string_size));
 	return c;
 }
 
 
 // writes the size in little endian format.. then the data.
-// return 1 on success, 0 on error
 //
 // Format is:
 //   0..1 - little endian word - data size
 //   2..  - bytes[data_size] - data
-static u16 state_write(FILE *stream, void *write_data, u16 write_size)
+static void state_write(STATE_BUFF *buff, void *write_data, u16 write_size)
 {
-	u8 header[2];
-	store_le_16(header, write_size);
-	if (fwrite(&header, sizeof(header), 1, stream) != 1) { return 0; }
-
-	if (fwrite(write_data, write_size, 1, stream) != 1) { return 0; }
-
-	return 1;
+	store_le_16(buff->data + buff->pos, write_size);
+	memcpy(buff->data + buff->pos + 2, write_data, write_size);
+	buff->pos += 2 + write_size;
 }
 
 // used to reinitialise all the restored data so the game will run properly (ie, fix pointers 'n stuff man)
@@ -319,18 +454,41 @@ void state_reload(void)
 	u16 di;
 	
 	sound_stop();
+	message_box_llm_cancel();	// text from before the restore
 	room_init();
 	script_block();
 	
 	for (v=objtable ; v<objtable_tail ; v++)
 	{
-		v->num = (u8)v->x;
-		v->x =  v->flags;	// store the flags for later use????
-		if (( v->flags & O_ANIMATE) != 0)	// bit six
-			v->flags = (v->flags & ~O_DRAWN) | O_UPDATE;
+		v->num = (u8)OBJ_X(v);
+		OBJ_X(v) =  OBJ_FLAGS(v);	// store the flags for later use????
+		if (( OBJ_FLAGS(v) & O_ANIMATE) != 0)	// bit six
+			OBJ_FLAGS(v) = (OBJ_FLAGS(v) & ~O_DRAWN) | O_UPDATE;
 		// turn off bit 0.. turn on 4
 	}
 
+	// start on whatever isn't cached already while the script's replayed
+	script_first();
+	while ((si=script_get_next()) != 0)
+	{
+		if (si[0] == 0)
+			res_prefetch_res(RES_TYPE_LOGIC, si[1]);
+		else if (si[0] == 1)
+			res_prefetch_res(RES_TYPE_VIEW, si[1]);
+		else if (si[0] == 2)
+			res_prefetch_res(RES_TYPE_PIC, si[1]);
+		else if (si[0] == 3)
+			res_prefetch_res(RES_TYPE_SOUND, si[1]);
+		else if (si[0] == 5)
+		{
+			// add.to.pic's parameters
+			for (di=0; (di<3) && (si != 0); di++)
+				si = script_get_next();
+			if (si == 0)
+				break;
+		}
+	}
+
 	blists_erase();
 	// TODO: clear_memory() not implemented
 	//clear_memory();
@@ -385,8 +543,8 @@ void state_reload(void)
 	di=0;
 	for (v=objtable ; v<objtable_tail ; v++)
 	{
-		temp4 = v->x;	// the old flags stored in x
-		v->x = v->num;
+		temp4 = OBJ_X(v);	// the old flags stored in x
+		OBJ_X(v) = v->num;
 		v->num = di++;	// ahh.. back to normality
 		if ( view_find( v->view_cur) != 0)
 			obj_view_set(v, v->view_cur);
@@ -402,7 +560,7 @@ void state_reload(void)
 			if ( (temp4 & (O_DRAWN & O_ANIMATE))
 					== O_DRAWN)	// 4 0
 				obj_stop_update(v);
-			v->flags = temp4;
+			OBJ_FLAGS(v) = temp4;
 		}
 	}
 
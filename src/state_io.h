@@ -6,6 +6,10 @@ extern u8 *cmd_restore_game(u8 *c);
 extern u8 *cmd_unknown_170(u8 *c);
 extern u8 *cmd_save_game(u8 *c);
 extern void state_reload(void);
+extern size_t state_capture_size(void);
+extern size_t state_capture(u8 *data);
+extern size_t state_apply(u8 *data, size_t size);
+extern size_t state_check(u8 *data, size_t size);
 
 extern char state_name_auto[0x32];
 
@@ -0,0 +1,394 @@
+/*
+Rewind
+
+every REWIND_TICKS of game time, at the start of a cycle, the same blocks a
+save game holds (and the llm's history) are captured into memory.  only the
+newest snapshot is kept whole.  the ones before it are kept as the deltas
+that take it back a step (xor'd and run length coded like the save files),
+in an arena that's allocated once.  when the arena or the entry list fills
+up the oldest step goes.
+
+F11 asks for a step back, applied at the start of the next cycle.  if the
+room hasn't changed and nothing's been loaded, drawn or discarded since
+(the script is the same), the resources the objects point to are still
+there so the blocks are copied back and the objects redrawn.  otherwise
+it's state_reload() like a restore, which gets whatever it can out of the
+resource cache.
+
+restart.game uses the same blocks.  what game_init() leaves at boot (the
+object file's tables, the cleared variables and flags, the llm's empty
+history) is captured once, and a restart copies it back instead of
+reading and decrypting the object file again.  the rest of the state
+carries on through a restart as it always has.
+*/
+
+#define MEM_TAG MEM_STATE
+
+#include <stdio.h>
+#include <string.h>
+
+#include "agi.h"
+#include "state_rewind.h"
+#include "state_snap.h"
+#include "state_io.h"
+#include "initialise.h"
+
+#include "flags.h"
+#include "sound/sound_base.h"
+#include "ui/events.h"
+#include "ui/controller.h"
+#include "ui/status.h"
+#include "ui/cmd_input.h"
+#include "view/obj_base.h"
+#include "view/obj_update.h"
+#include "sys/script.h"
+#include "sys/replay.h"
+#include "sys/mem_wrap.h"
+
+#ifdef NAGI_ENABLE_LLM
+#include "llm_global.h"
+#endif
+
+struct rewind_entry_struct
+{
+	size_t at;		// its delta in the arena
+	size_t code_size;
+	size_t size;		// size of the snapshot it goes back to
+	u16 room;		// rewind_room when that was taken
+};
+typedef struct rewind_entry_struct REWIND_ENTRY;
+
+static u16 rewind_room = 0;	// bumped every room_init()
+static u16 rewind_want = 0;	// steps asked for
+static u32 rewind_tick = 0;	// state.ticks at the newest snapshot
+
+static size_t rewind_max = 0;	// biggest a snapshot can be
+static size_t rewind_llm = 0;	// the llm's part, at the end
+static u8 *rewind_cur = 0;	// newest snapshot, zeros past its size
+static size_t rewind_cur_size = 0;
+static u16 rewind_cur_room = 0;
+static u8 *rewind_work = 0;
+static u8 *rewind_code = 0;
+
+static u8 *rewind_arena = 0;
+static size_t rewind_arena_size = 0;
+static size_t rewind_head = 0;		// where the next delta goes
+static REWIND_ENTRY *rewind_entry = 0;
+static u16 rewind_entry_max = 0;
+static u16 rewind_first = 0;		// oldest
+static u16 rewind_total = 0;
+
+static u8 *restart_snap = 0;		// the state game_init() left at boot
+static size_t restart_size = 0;
+static size_t restart_llm = 0;
+
+void state_rewind_init()
+{
+	if (c_nagi_rewind <= 0)
+		return;
+
+#ifdef NAGI_ENABLE_LLM
+	rewind_llm = (size_t)llm_context_snapshot_size(g_llm_session);
+#endif
+	rewind_arena_size = (size_t)c_nagi_rewind * REWIND_ARENA_SECOND;
+	rewind_arena = (u8 *)a_malloc(rewind_arena_size);
+	rewind_entry_max = (u16)(c_nagi_rewind * 20 / REWIND_TICKS);
+	if (rewind_entry_max == 0)
+		rewind_entry_max = 1;
+	rewind_entry = (REWIND_ENTRY *)a_malloc(rewind_entry_max * sizeof(REWIND_ENTRY));
+	rewind_max = 0;
+	rewind_cur_size = 0;
+	rewind_head = 0;
+	rewind_first = 0;
+	rewind_total = 0;
+	rewind_want = 0;
+}
+
+static void rewind_buffers_free(void)
+{
+	if (rewind_cur != 0)
+	{
+		a_free(rewind_code);
+		a_free(rewind_work);
+		a_free(rewind_cur);
+	}
+	rewind_code = 0;
+	rewind_work = 0;
+	rewind_cur = 0;
+	rewind_max = 0;
+}
+
+void state_rewind_denit()
+{
+	if (restart_snap != 0)
+		a_free(restart_snap);
+	restart_snap = 0;
+	restart_size = 0;
+
+	if (rewind_arena == 0)
+		return;
+	rewind_buffers_free();
+	a_free(rewind_entry);
+	a_free(rewind_arena);
+	rewind_entry = 0;
+	rewind_arena = 0;
+	rewind_cur_size = 0;
+	rewind_total = 0;
+}
+
+// the objects in the old snapshots point into resources that are gone now
+void state_rewind_room()
+{
+	rewind_room++;
+}
+
+void state_rewind_request()
+{
+	if ( (rewind_arena != 0) && (replay_mode == REPLAY_OFF) )
+		rewind_want++;
+}
+
+static size_t rewind_capture(u8 *data)
+{
+	size_t size;
+
+	size = state_capture(data);
+#ifdef NAGI_ENABLE_LLM
+	llm_context_snapshot(g_llm_session, data + size);
+	size += rewind_llm;
+#endif
+	return size;
+}
+
+static void rewind_drop_oldest(void)
+{
+	rewind_first = (u16)((rewind_first + 1) % rewind_entry_max);
+	rewind_total--;
+}
+
+// make room in the arena for a delta, dropping the oldest that are in the way.
+// returns 0 if it's never going to fit
+static u16 rewind_alloc(size_t size, size_t *at)
+{
+	REWIND_ENTRY *e;
+
+	if (size > rewind_arena_size)
+		return 0;
+	if (rewind_head + size > rewind_arena_size)
+	{
+		// whatever's left past the head is the oldest
+		while ( (rewind_total != 0) && (rewind_entry[rewind_first].at >= rewind_head) )
+			rewind_drop_oldest();
+		rewind_head = 0;
+	}
+	if (rewind_total == rewind_entry_max)
+		rewind_drop_oldest();
+	// the oldest is always the next one along from the head
+	while (rewind_total != 0)
+	{
+		e = &rewind_entry[rewind_first];
+		if ( (e->at >= rewind_head + size) || (e->at + e->code_size <= rewind_head) )
+			break;
+		rewind_drop_oldest();
+	}
+	*at = rewind_head;
+	rewind_head += size;
+	return 1;
+}
+
+static void rewind_take(void)
+{
+	REWIND_ENTRY *e;
+	size_t size, code_size, at;
+	u8 *swap;
+
+	// the script's size is up to the game so it's only known once it's going
+	size = state_capture_size() + rewind_llm;
+	if (size > rewind_max)
+	{
+		rewind_buffers_free();
+		rewind_max = size;
+		rewind_cur = (u8 *)a_malloc(rewind_max);
+		rewind_work = (u8 *)a_malloc(rewind_max);
+		rewind_code = (u8 *)a_malloc(rewind_max * 2 + 16);
+		memset(rewind_cur, 0, rewind_max);
+		memset(rewind_work, 0, rewind_max);
+		rewind_cur_size = 0;
+		rewind_total = 0;
+		rewind_head = 0;
+	}
+
+	size = rewind_capture(rewind_work);
+	if (rewind_cur_size != 0)
+	{
+		// how to get from the new one back to the one before
+		code_size = state_snap_code(rewind_cur, rewind_work, rewind_cur_size, rewind_code);
+		if (rewind_alloc(code_size, &at) != 0)
+		{
+			e = &rewind_entry[(rewind_first + rewind_total) % rewind_entry_max];
+			e->at = at;
+			e->code_size = code_size;
+			e->size = rewind_cur_size;
+			e->room = rewind_cur_room;
+			memcpy(rewind_arena + at, rewind_code, code_size);
+			rewind_total++;
+		}
+		else
+			rewind_total = 0;
+	}
+
+	swap = rewind_cur;
+	rewind_cur = rewind_work;
+	rewind_work = swap;
+	if (rewind_cur_size > size)
+		memset(rewind_work + size, 0, rewind_cur_size - size);
+	rewind_cur_size = size;
+	rewind_cur_room = rewind_room;
+	rewind_tick = state.ticks;
+}
+
+// take the newest snapshot back a step
+static u16 rewind_step(void)
+{
+	REWIND_ENTRY *e;
+
+	if (rewind_total == 0)
+		return 0;
+	e = &rewind_entry[(rewind_first + rewind_total - 1) % rewind_entry_max];
+	if (state_snap_decode(rewind_arena + e->at, e->code_size, rewind_cur, e->size) == 0)
+	{
+		// can't happen.. but don't leave a half done one behind
+		rewind_total = 0;
+		rewind_cur_size = 0;
+		memset(rewind_cur, 0, rewind_max);
+		return 0;
+	}
+	if (rewind_cur_size > e->size)
+		memset(rewind_cur + e->size, 0, rewind_cur_size - e->size);
+	rewind_cur_size = e->size;
+	rewind_cur_room = e->room;
+	rewind_head = e->at;
+	rewind_total--;
+	return 1;
+}
+
+// put the newest snapshot in play
+static void rewind_apply(void)
+{
+	u16 script_count;
+	u16 same;
+	u8 *script;
+	size_t size;
+
+	size = rewind_cur_size - rewind_llm;
+	script_count = state.script_count;
+	script = (u8 *)a_malloc((size_t)(state.script_count << 1) + 1);
+	memcpy(script, script_head, (size_t)(state.script_count << 1));
+
+	sound_stop();
+	blists_erase();
+	if (state_apply(rewind_cur, size) == 0)
+		return;		// it was captured by state_capture().. can't happen
+#ifdef NAGI_ENABLE_LLM
+	llm_context_snapshot_restore(g_llm_session, rewind_cur + size);
+#endif
+
+	same = (rewind_cur_room == rewind_room) && (state.script_count == script_count) &&
+		(memcmp(script, script_head, (size_t)(script_count << 1)) == 0);
+	a_free(script);
+
+	if (same)
+	{
+		blists_draw();
+		blists_update();
+		status_line_write();
+		input_redraw();
+	}
+	else
+	{
+		state_reload();
+		rewind_cur_room = rewind_room;
+	}
+	control_state_clear();
+	flag_set(F12_RESTORE);
+	rewind_tick = state.ticks;
+}
+
+// straight after game_init() at boot
+void state_restart_take()
+{
+	size_t size;
+
+	restart_llm = 0;
+#ifdef NAGI_ENABLE_LLM
+	restart_llm = (size_t)llm_context_snapshot_size(g_llm_session);
+#endif
+	if (restart_snap != 0)
+		a_free(restart_snap);
+	restart_snap = (u8 *)a_malloc(state_capture_size() + restart_llm);
+	size = state_capture(restart_snap);
+#ifdef NAGI_ENABLE_LLM
+	llm_context_snapshot(g_llm_session, restart_snap + size);
+#endif
+	restart_size = size + restart_llm;
+}
+
+// game_init() for a restart.  returns 0 if there's nothing to restart from
+u16 state_restart_apply()
+{
+	AGI_STATE keep;
+	size_t size;
+
+	if (restart_snap == 0)
+		return 0;
+	// nothing's touched unless the snapshot's going to go back in whole
+	size = restart_size - restart_llm;
+	if (state_check(restart_snap, size) == 0)
+		return 0;
+
+	keep = state;
+	objtable_new((u16)(objtable_tail - objtable));
+	control_state_clear();
+	room_init();
+	blists_erase();
+	state_apply(restart_snap, size);
+#ifdef NAGI_ENABLE_LLM
+	llm_context_snapshot_restore(g_llm_session, restart_snap + size);
+#endif
+
+	// only what game_init() sets goes back to how it was at boot
+	memcpy(keep.var, state.var, sizeof(keep.var));
+	memcpy(keep.flag, state.flag, sizeof(keep.flag));
+	keep.ego_control_state = state.ego_control_state;
+	keep.pic_num = state.pic_num;
+	keep.block_state = state.block_state;
+	state = keep;
+	return 1;
+}
+
+// called at the start of every cycle
+void state_rewind_cycle()
+{
+	u16 stepped;
+
+	if (rewind_arena == 0)
+		return;
+
+	if (rewind_want != 0)
+	{
+		stepped = 0;
+		while ( (rewind_want != 0) && (rewind_step() != 0) )
+		{
+			rewind_want--;
+			stepped = 1;
+		}
+		rewind_want = 0;
+		if (stepped)
+			rewind_apply();
+		return;
+	}
+
+	if ( (replay_mode != REPLAY_OFF) || (rewind_cur_size != 0 && (u32)(state.ticks - rewind_tick) < REWIND_TICKS) )
+		return;
+	rewind_take();
+}
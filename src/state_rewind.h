@@ -0,0 +1,19 @@
+#ifndef NAGI_STATE_REWIND_H
+#define NAGI_STATE_REWIND_H
+
+// ticks (1/20 s) between snapshots
+#define REWIND_TICKS 20
+// arena bytes for each second kept
+#define REWIND_ARENA_SECOND 0x4000
+
+extern void state_rewind_init(void);
+extern void state_rewind_denit(void);
+extern void state_rewind_room(void);
+extern void state_rewind_request(void);
+extern void state_rewind_cycle(void);
+
+// restart.game from the state at boot instead of game_init()
+extern void state_restart_take(void);
+extern u16 state_restart_apply(void);
+
+#endif /* NAGI_STATE_REWIND_H */
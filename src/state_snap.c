@@ -0,0 +1,503 @@
+/*
+Save game snapshots
+
+a snapshot is the blocks cmd_save_game() always wrote (state, objtable,
+inventory, strings, script and scan starts, each with its size in front)
+in one buffer.  a file holds a baseline snapshot and then deltas: each one
+is the snapshot xor'd with the one before it, stored as runs of zeros and
+literals.  saving to the same file again (an autosave slot, say) only
+appends the bytes that changed.  once there's SNAP_DELTA_MAX deltas, the
+snapshot changes size or the file isn't the one we left, it's written out
+from scratch again.
+
+the coding and the writing are done on a thread from the caller's copy so
+the game carries on while slow storage catches up.  the file is opened
+before the thread starts since the game changes directory when it likes.
+the header, the record and its runs go to the file at once through
+sys/aio.c, then the new description once they're all there.
+
+file format:
+  0x00 - description[0x1F]
+  0x1F - little endian word - SNAP_MARK (the old format's state size)
+  0x21 - state.id (where state_info looks for it)
+  0x36 - "NSNP" and the version byte
+  then records of:
+    0     - 'B' baseline or 'D' delta
+    1..4  - little endian dword - coded size
+    5..8  - little endian dword - snapshot size
+    9..12 - little endian dword - hash of the snapshot it makes
+    13..  - coded[coded size]: zero run, literal length (both 7 bits a
+            byte, low first), literal bytes, ...
+  a record that's cut short (the disk filled up part way) is ignored.
+
+files in the old format are read as they always were.
+*/
+
+#define MEM_TAG MEM_STATE
+
+#include <stdio.h>
+#include <string.h>
+
+#include "agi.h"
+#include "state_snap.h"
+
+#include "sys/sys_dir.h"
+#include "sys/mem_wrap.h"
+#include "sys/endian.h"
+#include "sys/aio.h"
+
+#define SNAP_MARK 0xFFFF
+#define SNAP_HEAD (0x1F + 2 + ID_SIZE + 1)
+#define SNAP_MAGIC_SIZE 5
+#define SNAP_VERSION 1
+#define SNAP_RECORD 13
+#define SNAP_ZERO_MIN 4		// zeros it takes to end a literal
+#define SNAP_WRITES 3		// header, record, runs
+
+struct snap_job_struct
+{
+	FILE *stream;
+	char *name;
+	char diz[0x1F];
+	char id[ID_SIZE+1];
+	u8 *snap;
+	u8 *prev;		// what the file ends with, 0 to start it again
+	size_t size;
+	long file_size;		// where the record goes, then where the file ends
+	u16 result;
+};
+typedef struct snap_job_struct SNAP_JOB;
+
+static SNAP_JOB snap_job;
+static SDL_Thread *snap_thread = 0;
+static u8 snap_busy = 0;
+static u8 snap_failed = 0;
+
+// the last snapshot saved or restored and the file it's at the end of
+static u8 *snap_base = 0;
+static size_t snap_base_size = 0;
+static char *snap_name = 0;	// 0 if the file can't be added to
+static long snap_file_size = 0;
+static u16 snap_delta_count = 0;
+
+static u32 snap_hash(const u8 *data, size_t size)
+{
+	u32 hash;
+
+	hash = 2166136261u;
+	while (size-- != 0)
+		hash = (hash ^ *(data++)) * 16777619u;
+	return hash;
+}
+
+static char *snap_strdup(const char *s)
+{
+	char *d;
+
+	d = (char *)a_malloc(strlen(s) + 1);
+	strcpy(d, s);
+	return d;
+}
+
+static u8 *snap_size_put(u8 *p, size_t val)
+{
+	while (val >= 0x80)
+	{
+		*(p++) = (u8)(val | 0x80);
+		val >>= 7;
+	}
+	*(p++) = (u8)val;
+	return p;
+}
+
+static const u8 *snap_size_get(const u8 *p, const u8 *end, size_t *val)
+{
+	size_t v;
+	int shift;
+
+	v = 0;
+	for (shift = 0; (p < end) && (shift < 35); shift += 7)
+	{
+		v |= (size_t)(*p & 0x7F) << shift;
+		if ((*(p++) & 0x80) == 0)
+		{
+			*val = v;
+			return p;
+		}
+	}
+	return 0;
+}
+
+static u8 snap_xor(const u8 *snap, const u8 *prev, size_t i)
+{
+	return (prev != 0) ? (snap[i] ^ prev[i]) : snap[i];
+}
+
+// snap xor'd with prev (or on its own for a baseline) as runs.  out needs
+// room for size*2 + 16 bytes.
+size_t state_snap_code(const u8 *snap, const u8 *prev, size_t size, u8 *out)
+{
+	u8 *p;
+	size_t pos, lit, end, run;
+
+	p = out;
+	pos = 0;
+	while (pos < size)
+	{
+		lit = pos;
+		while ( (lit < size) && (snap_xor(snap, prev, lit) == 0) )
+			lit++;
+
+		// a few zeros between changes are cheaper left in the literal
+		end = lit;
+		while (end < size)
+		{
+			if (snap_xor(snap, prev, end) != 0)
+			{
+				end++;
+				continue;
+			}
+			run = end;
+			while ( (run < size) && (snap_xor(snap, prev, run) == 0) )
+				run++;
+			if ( (run - end >= SNAP_ZERO_MIN) || (run == size) )
+				break;
+			end = run;
+		}
+
+		p = snap_size_put(p, lit - pos);
+		p = snap_size_put(p, end - lit);
+		for (; lit < end; lit++)
+			*(p++) = snap_xor(snap, prev, lit);
+		pos = end;
+	}
+	return (size_t)(p - out);
+}
+
+// apply coded runs to snap (zeros for a baseline).  0 if they don't fit.
+u16 state_snap_decode(const u8 *code, size_t code_size, u8 *snap, size_t size)
+{
+	const u8 *p, *end;
+	size_t pos, zero, lit;
+
+	p = code;
+	end = code + code_size;
+	pos = 0;
+	while (pos < size)
+	{
+		p = snap_size_get(p, end, &zero);
+		if (p == 0)
+			return 0;
+		p = snap_size_get(p, end, &lit);
+		if (p == 0)
+			return 0;
+		if ( (zero > size - pos) || (lit > size - pos - zero) || (lit > (size_t)(end - p)) )
+			return 0;
+		pos += zero;
+		while (lit-- != 0)
+			snap[pos++] ^= *(p++);
+	}
+	return (p == end);
+}
+
+// queue one write.  0 if there's no room
+static u16 snap_write(AIO_QUEUE *q, AIO_REQ *req, AIO_FILE *file, u8 *buff, size_t size, long pos)
+{
+	memset(req, 0, sizeof(AIO_REQ));
+	req->file = file;
+	req->offset = (u64)pos;
+	req->buff = buff;
+	req->size = size;
+	req->write = 1;
+	return aio_submit(q, req);
+}
+
+// 0 if any of the writes queued didn't all go
+static u16 snap_write_wait(AIO_QUEUE *q)
+{
+	AIO_REQ *req;
+	u16 ok;
+
+	ok = 1;
+	while ( (req = aio_complete(q, 1)) != 0 )
+		if ( (req->result < 0) || ((size_t)req->result != req->size) )
+			ok = 0;
+	return ok;
+}
+
+static int snap_main(void *data)
+{
+	SNAP_JOB *job;
+	u8 head[SNAP_HEAD + SNAP_MAGIC_SIZE];
+	u8 rec[SNAP_RECORD];
+	u8 *code;
+	size_t code_size;
+	AIO_FILE *file;
+	AIO_QUEUE *q;
+	AIO_REQ req[SNAP_WRITES];
+	u16 ok;
+	int n;
+
+	job = (SNAP_JOB *)data;
+	job->result = 0;
+	code = (u8 *)a_malloc(job->size * 2 + 16);
+	code_size = state_snap_code(job->snap, job->prev, job->size, code);
+
+	rec[0] = (job->prev != 0) ? 'D' : 'B';
+	store_le_32(rec + 1, (u32)code_size);
+	store_le_32(rec + 5, (u32)job->size);
+	store_le_32(rec + 9, snap_hash(job->snap, job->size));
+
+	file = aio_file_open(job->stream, 1);
+	if (file == 0)
+		goto snap_done;
+	q = aio_queue_new(SNAP_WRITES);
+	n = 0;
+	ok = 1;
+
+	if (job->prev == 0)
+	{
+		memcpy(head, job->diz, 0x1F);
+		store_le_16(head + 0x1F, SNAP_MARK);
+		memcpy(head + 0x21, job->id, ID_SIZE+1);
+		memcpy(head + SNAP_HEAD, "NSNP", 4);
+		head[SNAP_HEAD + 4] = SNAP_VERSION;
+		ok &= snap_write(q, &req[n++], file, head, sizeof(head), 0);
+		job->file_size = sizeof(head);
+	}
+	ok &= snap_write(q, &req[n++], file, rec, sizeof(rec), job->file_size);
+	if (code_size != 0)
+		ok &= snap_write(q, &req[n++], file, code, code_size,
+			job->file_size + (long)sizeof(rec));
+	ok &= snap_write_wait(q);
+
+	// the new description once there's something for it to describe
+	if ( (ok != 0) && (job->prev != 0) )
+	{
+		ok &= snap_write(q, &req[0], file, (u8 *)job->diz, 0x1F, 0);
+		ok &= snap_write_wait(q);
+	}
+	aio_queue_free(q);
+	aio_file_close(file);
+
+	if (ok != 0)
+	{
+		job->file_size += (long)(sizeof(rec) + code_size);
+		job->result = 1;
+	}
+
+snap_done:
+	a_free(code);
+	if (fclose(job->stream) != 0)
+		job->result = 0;
+	job->stream = 0;
+	return 0;
+}
+
+static void snap_forget(void)
+{
+	if (snap_base != 0)
+		a_free(snap_base);
+	if (snap_name != 0)
+		a_free(snap_name);
+	snap_base = 0;
+	snap_base_size = 0;
+	snap_name = 0;
+	snap_file_size = 0;
+	snap_delta_count = 0;
+}
+
+// wait for the save thread and keep what it wrote as the new base
+static void snap_join(void)
+{
+	if (snap_busy == 0)
+		return;
+	if (snap_thread != 0)
+		SDL_WaitThread(snap_thread, NULL);
+	snap_thread = 0;
+	snap_busy = 0;
+
+	if (snap_job.result != 0)
+	{
+		snap_delta_count = (snap_job.prev != 0) ? (snap_delta_count + 1) : 0;
+		if (snap_base != 0)
+			a_free(snap_base);
+		if (snap_name != 0)
+			a_free(snap_name);
+		snap_base = snap_job.snap;
+		snap_base_size = snap_job.size;
+		snap_name = snap_job.name;
+		snap_file_size = snap_job.file_size;
+	}
+	else
+	{
+		snap_forget();
+		// a delta that didn't make it is ignored but a file that was
+		// only half started is no good to anyone
+		if (snap_job.prev == 0)
+		{
+			dir_preset_change(DIR_PRESET_GAME);
+			remove(snap_job.name);
+		}
+		a_free(snap_job.snap);
+		a_free(snap_job.name);
+		snap_failed = 1;
+	}
+	snap_job.snap = 0;
+	snap_job.name = 0;
+}
+
+// write snap (which is handed over) to the file with this description.
+// the writing's left to a thread unless wait is set.
+// returns 0 if the file can't be opened
+u16 state_snap_save(const char *name, const char *diz, u8 *snap, size_t size, u16 wait)
+{
+	FILE *stream;
+
+	snap_join();
+
+	stream = 0;
+	memset(&snap_job, 0, sizeof(snap_job));
+	if ( (snap_name != 0) && (strcmp(snap_name, name) == 0) &&
+		(snap_base_size == size) && (snap_delta_count < SNAP_DELTA_MAX) )
+	{
+		stream = fopen(name, "r+b");
+		if ( (stream != 0) && (fseek(stream, 0, SEEK_END) == 0) &&
+			(ftell(stream) == snap_file_size) )
+		{
+			snap_job.prev = snap_base;
+			snap_job.file_size = snap_file_size;
+		}
+		else if (stream != 0)
+		{
+			fclose(stream);
+			stream = 0;
+		}
+	}
+	if (stream == 0)
+		stream = fopen(name, "wb");
+	if (stream == 0)
+	{
+		a_free(snap);
+		return 0;
+	}
+
+	snap_job.stream = stream;
+	snap_job.name = snap_strdup(name);
+	memcpy(snap_job.diz, diz, 0x1F);
+	memcpy(snap_job.id, state.id, ID_SIZE+1);
+	snap_job.snap = snap;
+	snap_job.size = size;
+	snap_busy = 1;
+
+	if (wait == 0)
+		snap_thread = SDL_CreateThread(snap_main, "nagi_save", &snap_job);
+	if (snap_thread == 0)
+		snap_main(&snap_job);
+	return 1;
+}
+
+// wait for the last save to be written.
+// returns 0 if it (or an earlier one nobody asked about) failed
+u16 state_snap_wait(void)
+{
+	u16 result;
+
+	snap_join();
+	result = (snap_failed == 0);
+	snap_failed = 0;
+	return result;
+}
+
+// the snapshot in a save file (the base for the next save to it, so don't
+// free it).  0 if the file's no good.
+u8 *state_snap_load(FILE *stream, const char *name, size_t *size)
+{
+	u8 *file, *snap, *rec;
+	long file_size, pos;
+	size_t code_size, snap_size;
+	u16 count;
+
+	snap_join();
+	snap_forget();
+
+	snap = 0;
+	if (fseek(stream, 0, SEEK_END) != 0)
+		return 0;
+	file_size = ftell(stream);
+	if ( (file_size <= 0x21) || (fseek(stream, 0, SEEK_SET) != 0) )
+		return 0;
+	file = (u8 *)a_malloc((size_t)file_size);
+	if (fread(file, (size_t)file_size, 1, stream) != 1)
+		goto load_err;
+
+	if (load_le_16(file + 0x1F) != SNAP_MARK)
+	{
+		// the old format is the blocks on their own
+		snap_size = (size_t)file_size - 0x1F;
+		snap = (u8 *)a_malloc(snap_size);
+		memcpy(snap, file + 0x1F, snap_size);
+		a_free(file);
+		snap_base = snap;
+		snap_base_size = snap_size;
+		*size = snap_size;
+		return snap;
+	}
+
+	if ( (file_size < SNAP_HEAD + SNAP_MAGIC_SIZE) ||
+		(memcmp(file + SNAP_HEAD, "NSNP", 4) != 0) ||
+		(file[SNAP_HEAD + 4] != SNAP_VERSION) )
+		goto load_err;
+
+	snap_size = 0;
+	count = 0;
+	pos = SNAP_HEAD + SNAP_MAGIC_SIZE;
+	while (file_size - pos >= SNAP_RECORD)
+	{
+		rec = file + pos;
+		code_size = load_le_32(rec + 1);
+		if (code_size > (size_t)(file_size - pos - SNAP_RECORD))
+			break;
+		if ( (rec[0] == 'B') && (snap == 0) )
+		{
+			snap_size = load_le_32(rec + 5);
+			if (snap_size == 0)
+				goto load_err;
+			snap = (u8 *)a_malloc(snap_size);
+			memset(snap, 0, snap_size);
+		}
+		else if ( (rec[0] == 'D') && (snap != 0) && (load_le_32(rec + 5) == snap_size) )
+			count++;
+		else
+			goto load_err;
+		if (state_snap_decode(rec + SNAP_RECORD, code_size, snap, snap_size) == 0)
+			goto load_err;
+		if (snap_hash(snap, snap_size) != load_le_32(rec + 9))
+			goto load_err;
+		pos += (long)(SNAP_RECORD + code_size);
+	}
+	if (snap == 0)
+		goto load_err;
+	a_free(file);
+
+	snap_base = snap;
+	snap_base_size = snap_size;
+	snap_name = snap_strdup(name);
+	snap_file_size = pos;
+	snap_delta_count = count;
+	*size = snap_size;
+	return snap;
+
+load_err:
+	if (snap != 0)
+		a_free(snap);
+	a_free(file);
+	return 0;
+}
+
+void state_snap_denit(void)
+{
+	if (state_snap_wait() == 0)
+		printf("Unable to write the last save game.\n");
+	snap_forget();
+}
@@ -0,0 +1,14 @@
+#ifndef NAGI_STATE_SNAP_H
+#define NAGI_STATE_SNAP_H
+
+// deltas appended to a file before it's written out again from scratch
+#define SNAP_DELTA_MAX 32
+
+extern size_t state_snap_code(const u8 *snap, const u8 *prev, size_t size, u8 *out);
+extern u16 state_snap_decode(const u8 *code, size_t code_size, u8 *snap, size_t size);
+extern u16 state_snap_save(const char *name, const char *diz, u8 *snap, size_t size, u16 wait);
+extern u16 state_snap_wait(void);
+extern u8 *state_snap_load(FILE *stream, const char *name, size_t *size);
+extern void state_snap_denit(void);
+
+#endif /* NAGI_STATE_SNAP_H */
@@ -5,6 +5,8 @@
 //~ RaDIaT1oN (2002-04-29):
 //~ lowercase file search routines for linux
 
+#define MEM_TAG MEM_RES
+
 /* BASE headers	---	---	---	---	---	---	--- */
 //#include "agi.h"
 #include "../agi.h"
@@ -17,8 +19,11 @@
 #ifdef _WIN32
 #include <Windows.h>
 #include <direct.h>
+#include <io.h>
 #else
 #include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <dirent.h>
 #include <unistd.h>
 #endif
@@ -27,6 +32,7 @@
 //#include "view/crap.h"
 #include "mem_wrap.h"
 #include "agi_file.h"
+#include "zip_mount.h"
 
 #include "../ui/string.h"
 
@@ -57,13 +63,15 @@ struct dir_list_struct
 	int first;
 }; 
 
-struct dir_list_struct *agi_open_cwd(void)
+struct dir_list_struct *agi_open_dir(const char *path)
 {
 	struct dir_list_struct *d = malloc(sizeof(struct dir_list_struct));
+	char *pattern = alloca(strlen(path) + 3);
 	d->hFind = INVALID_HANDLE_VALUE;
 	d->first = 1;
 
-	d->hFind = FindFirstFile("*", &d->FindFileData);
+	sprintf(pattern, "%s\\*", path);
+	d->hFind = FindFirstFile(pattern, &d->FindFileData);
 	if (d->hFind == INVALID_HANDLE_VALUE) {
 		free(d);
 		d = 0;
@@ -71,6 +79,11 @@ struct dir_list_struct *agi_open_cwd(void)
 	return d;
 }
 
+struct dir_list_struct *agi_open_cwd(void)
+{
+	return agi_open_dir(".");
+}
+
 void agi_close_dir(struct dir_list_struct *d)
 {
 	if (d == 0) { return; }
@@ -101,6 +114,35 @@ FILE *fopen_nocase(const char *name)
 	return fopen(name, "rb");
 }
 
+u8 *file_map(FILE *stream, size_t *size)
+{
+	HANDLE file, mapping;
+	LARGE_INTEGER file_size;
+	u8 *data;
+
+	file = (HANDLE)_get_osfhandle(_fileno(stream));
+	if ( (file == INVALID_HANDLE_VALUE) || (GetFileSizeEx(file, &file_size) == 0) )
+		return 0;
+	if ( (file_size.QuadPart == 0) || (file_size.QuadPart > (LONGLONG)(size_t)-1) )
+		return 0;
+	mapping = CreateFileMapping(file, 0, PAGE_READONLY, 0, 0, 0);
+	if (mapping == 0)
+		return 0;
+	data = (u8 *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);	// the view keeps it open
+	if (data == 0)
+		return 0;
+	*size = (size_t)file_size.QuadPart;
+	return data;
+}
+
+void file_unmap(u8 *data, size_t size)
+{
+	(void)size;
+	if (data != 0)
+		UnmapViewOfFile(data);
+}
+
 #else
 
 struct dir_list_struct
@@ -109,13 +151,13 @@ struct dir_list_struct
 	struct dirent *file;
 }; 
 
-struct dir_list_struct *agi_open_cwd(void)
+struct dir_list_struct *agi_open_dir(const char *path)
 {
 	struct dir_list_struct *d = malloc(sizeof(struct dir_list_struct));
 	d->dir = 0;
 	d->file = 0;
 
-	d->dir = opendir(".");
+	d->dir = opendir(path);
 	if (d->dir == 0) {
 		free(d);
 		d = 0;
@@ -123,6 +165,11 @@ struct dir_list_struct *agi_open_cwd(void)
 	return d;
 }
 
+struct dir_list_struct *agi_open_cwd(void)
+{
+	return agi_open_dir(".");
+}
+
 void agi_close_dir(struct dir_list_struct *d)
 {
 	if (d == 0) { return; }
@@ -171,6 +218,26 @@ FILE *fopen_nocase(const char *name)
 	return NULL;
 }
 
+u8 *file_map(FILE *stream, size_t *size)
+{
+	struct stat st;
+	void *data;
+
+	if ( (fstat(fileno(stream), &st) != 0) || (st.st_size <= 0) )
+		return 0;
+	data = mmap(0, (size_t)st.st_size, PROT_READ, MAP_SHARED, fileno(stream), 0);
+	if (data == MAP_FAILED)
+		return 0;
+	*size = (size_t)st.st_size;
+	return (u8 *)data;
+}
+
+void file_unmap(u8 *data, size_t size)
+{
+	if (data != 0)
+		munmap(data, size);
+}
+
 #endif
 
 
@@ -189,7 +256,19 @@ u8 *file_to_buf(const char *file_name)
 	int file_size;
 	FILE *file_stream;
 	u8 *buf;
+	const u8 *zip_data;
+	size_t zip_size;
 	
+	// the game's own files come out of its zip when it's in one
+	zip_data = zip_game_file(file_name, &zip_size);
+	if (zip_data != 0)
+	{
+		file_buf_size = (u32)zip_size;
+		buf = (u8 *)a_malloc(zip_size + 1);
+		memcpy(buf, zip_data, zip_size);
+		return buf;
+	}
+
 //	file_stream=fopen(file_name, "rb");
 	file_stream=fopen_nocase(file_name);
 	if (file_stream == 0)
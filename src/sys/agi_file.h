@@ -16,6 +16,8 @@ extern u32 file_buf_size;
 /* FUNCTIONS	---	---	---	---	---	---	--- */
 
 extern struct dir_list_struct *agi_open_cwd(void);
+// readdir is safe on different dirs from different threads
+extern struct dir_list_struct *agi_open_dir(const char *path);
 extern void agi_close_dir(struct dir_list_struct *);
 extern const char *agi_read_dir(struct dir_list_struct *);
 
@@ -23,4 +25,8 @@ extern u8 *file_to_buf(const char *file_name);
 
 extern FILE *fopen_nocase(const char *name);
 
+// read-only view of a whole open file.  0 if it can't be mapped
+extern u8 *file_map(FILE *stream, size_t *size);
+extern void file_unmap(u8 *data, size_t size);
+
 #endif /* NAGI_SYS_AGI_FILE_H */
@@ -0,0 +1,682 @@
+/*
+Async file I/O
+
+reads and writes that are handed in and collected later, so one thread can
+keep a lot of them going: the prefetch worker reading vols that couldn't
+be mapped (res_prefetch.c) and the save thread (state_snap.c).  an SD card
+or a network share takes about as long for a dozen reads at once as for
+one.
+
+linux uses io_uring through the bare syscalls, no liburing.  windows does
+overlapped reads and writes on a second handle to the file.  anywhere
+else, or when the kernel won't set up a ring (too old, or a sandbox that
+blocks it), each queue gets a few threads doing pread and pwrite.
+*/
+
+#define MEM_TAG MEM_RES
+
+#include <string.h>
+
+#include "../agi.h"
+#include "aio.h"
+
+#include "mem_wrap.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#include <io.h>
+#else
+#include <errno.h>
+#include <unistd.h>
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#ifdef __NR_io_uring_setup
+#define AIO_URING
+#endif
+#endif
+#endif
+#endif
+
+// threads a queue gets when there's no ring
+#define AIO_THREADS 4
+
+// overlapped waits on an event each
+#ifdef _WIN32
+#define AIO_DEPTH_MAX MAXIMUM_WAIT_OBJECTS
+#else
+#define AIO_DEPTH_MAX 256
+#endif
+
+#ifdef _WIN32
+
+struct aio_file_struct
+{
+	HANDLE handle;
+};
+
+struct aio_slot_struct
+{
+	OVERLAPPED ov;
+	AIO_REQ *req;
+	u8 failed;		// didn't start, result's already set
+};
+typedef struct aio_slot_struct AIO_SLOT;
+
+struct aio_queue_struct
+{
+	u16 depth;
+	u16 busy;
+	AIO_SLOT *slot;
+	HANDLE *event;
+};
+
+#else
+
+struct aio_file_struct
+{
+	int fd;
+};
+
+#ifdef AIO_URING
+struct aio_ring_struct
+{
+	int fd;
+	void *sq_map, *cq_map;
+	size_t sq_map_size, cq_map_size;
+	struct io_uring_sqe *sqe;
+	size_t sqe_size;
+	u32 *sq_head, *sq_tail, *sq_mask, *sq_array;
+	u32 *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqe;
+	u32 unsent;		// in the ring, not given to the kernel yet
+};
+typedef struct aio_ring_struct AIO_RING;
+#endif
+
+struct aio_queue_struct
+{
+	u16 depth;
+	u16 busy;
+#ifdef AIO_URING
+	AIO_RING ring;
+	u8 uring;
+#endif
+	// the threads' lists, in through todo and out through done.  with a
+	// ring todo holds what the kernel has, in case the ring has to go
+	SDL_Mutex *mutex;
+	SDL_Condition *todo_cond, *done_cond;
+	AIO_REQ *todo, *done;
+	SDL_Thread *thread[AIO_THREADS];
+	u16 threads;
+	u8 quit;
+};
+
+#endif
+
+
+#ifdef _WIN32
+
+AIO_FILE *aio_file_open(FILE *stream, u16 write)
+{
+	AIO_FILE *file;
+	HANDLE handle;
+	DWORD access;
+
+	access = GENERIC_READ;
+	if (write != 0)
+		access |= GENERIC_WRITE;
+	handle = ReOpenFile((HANDLE)_get_osfhandle(_fileno(stream)), access,
+		FILE_SHARE_READ | FILE_SHARE_WRITE, FILE_FLAG_OVERLAPPED);
+	if (handle == INVALID_HANDLE_VALUE)
+		return 0;
+	file = (AIO_FILE *)a_malloc(sizeof(AIO_FILE));
+	file->handle = handle;
+	return file;
+}
+
+void aio_file_close(AIO_FILE *file)
+{
+	if (file == 0)
+		return;
+	CloseHandle(file->handle);
+	a_free(file);
+}
+
+AIO_QUEUE *aio_queue_new(u16 depth)
+{
+	AIO_QUEUE *q;
+	u16 i;
+
+	if (depth == 0)
+		depth = 1;
+	if (depth > AIO_DEPTH_MAX)
+		depth = AIO_DEPTH_MAX;
+	q = (AIO_QUEUE *)a_malloc(sizeof(AIO_QUEUE));
+	q->depth = depth;
+	q->busy = 0;
+	q->slot = (AIO_SLOT *)a_malloc(sizeof(AIO_SLOT) * depth);
+	q->event = (HANDLE *)a_malloc(sizeof(HANDLE) * depth);
+	memset(q->slot, 0, sizeof(AIO_SLOT) * depth);
+	for (i = 0; i < depth; i++)
+		q->event[i] = CreateEvent(0, TRUE, FALSE, 0);
+	return q;
+}
+
+void aio_queue_free(AIO_QUEUE *q)
+{
+	u16 i;
+
+	if (q == 0)
+		return;
+	while (aio_complete(q, 1) != 0)
+		;
+	for (i = 0; i < q->depth; i++)
+		if (q->event[i] != 0)
+			CloseHandle(q->event[i]);
+	a_free(q->event);
+	a_free(q->slot);
+	a_free(q);
+}
+
+u16 aio_submit(AIO_QUEUE *q, AIO_REQ *req)
+{
+	AIO_SLOT *slot;
+	BOOL ok;
+	u16 i;
+
+	for (i = 0; i < q->depth; i++)
+		if (q->slot[i].req == 0)
+			break;
+	if ( (i >= q->depth) || (q->event[i] == 0) )
+		return 0;
+	slot = &q->slot[i];
+	memset(&slot->ov, 0, sizeof(slot->ov));
+	slot->ov.Offset = (DWORD)req->offset;
+	slot->ov.OffsetHigh = (DWORD)(req->offset >> 32);
+	slot->ov.hEvent = q->event[i];
+	ResetEvent(q->event[i]);
+	slot->req = req;
+	slot->failed = 0;
+	q->busy++;
+
+	if (req->write != 0)
+		ok = WriteFile(req->file->handle, req->buff, (DWORD)req->size, 0, &slot->ov);
+	else
+		ok = ReadFile(req->file->handle, req->buff, (DWORD)req->size, 0, &slot->ov);
+	// it's collected the same way when it finished straight away.  one
+	// that failed to start gets its event set so it's noticed
+	if ( (ok == 0) && (GetLastError() != ERROR_IO_PENDING) )
+	{
+		req->result = (GetLastError() == ERROR_HANDLE_EOF) ? 0 : -1;
+		slot->failed = 1;
+		SetEvent(q->event[i]);
+	}
+	return 1;
+}
+
+// the finished request in slot i, 0 if it's still going
+static AIO_REQ *aio_slot_done(AIO_QUEUE *q, u16 i)
+{
+	AIO_SLOT *slot;
+	AIO_REQ *req;
+	DWORD done;
+
+	slot = &q->slot[i];
+	req = slot->req;
+	if (slot->failed == 0)
+	{
+		if (GetOverlappedResult(req->file->handle, &slot->ov, &done, FALSE))
+			req->result = (long)done;
+		else if (GetLastError() == ERROR_IO_INCOMPLETE)
+			return 0;
+		else
+			req->result = (GetLastError() == ERROR_HANDLE_EOF) ? 0 : -1;
+	}
+	slot->req = 0;
+	q->busy--;
+	return req;
+}
+
+AIO_REQ *aio_complete(AIO_QUEUE *q, u16 wait)
+{
+	HANDLE busy[AIO_DEPTH_MAX];
+	AIO_REQ *req;
+	DWORD count;
+	u16 i;
+
+	for (;;)
+	{
+		count = 0;
+		for (i = 0; i < q->depth; i++)
+		{
+			if (q->slot[i].req == 0)
+				continue;
+			req = aio_slot_done(q, i);
+			if (req != 0)
+				return req;
+			busy[count++] = q->event[i];
+		}
+		if ( (wait == 0) || (count == 0) )
+			return 0;
+		WaitForMultipleObjects(count, busy, FALSE, INFINITE);
+	}
+}
+
+#else
+
+AIO_FILE *aio_file_open(FILE *stream, u16 write)
+{
+	AIO_FILE *file;
+	int fd;
+
+	(void)write;
+	fd = dup(fileno(stream));
+	if (fd < 0)
+		return 0;
+	file = (AIO_FILE *)a_malloc(sizeof(AIO_FILE));
+	file->fd = fd;
+	return file;
+}
+
+void aio_file_close(AIO_FILE *file)
+{
+	if (file == 0)
+		return;
+	close(file->fd);
+	a_free(file);
+}
+
+// the whole request or up to the end of the file
+static void aio_do(AIO_REQ *req)
+{
+	ssize_t n;
+	size_t done;
+
+	done = 0;
+	while (done < req->size)
+	{
+		if (req->write != 0)
+			n = pwrite(req->file->fd, req->buff + done, req->size - done,
+				(off_t)(req->offset + done));
+		else
+			n = pread(req->file->fd, req->buff + done, req->size - done,
+				(off_t)(req->offset + done));
+		if ( (n < 0) && (errno == EINTR) )
+			continue;
+		if (n < 0)
+		{
+			req->result = -1;
+			return;
+		}
+		if (n == 0)
+			break;
+		done += (size_t)n;
+	}
+	req->result = (long)done;
+}
+
+static int aio_thread(void *data)
+{
+	AIO_QUEUE *q;
+	AIO_REQ *req;
+
+	q = (AIO_QUEUE *)data;
+	SDL_LockMutex(q->mutex);
+	for (;;)
+	{
+		while ( (q->todo == 0) && (q->quit == 0) )
+			SDL_WaitCondition(q->todo_cond, q->mutex);
+		if (q->todo == 0)
+			break;
+		req = q->todo;
+		q->todo = req->next;
+		SDL_UnlockMutex(q->mutex);
+
+		aio_do(req);
+
+		SDL_LockMutex(q->mutex);
+		req->next = q->done;
+		q->done = req;
+		SDL_SignalCondition(q->done_cond);
+	}
+	SDL_UnlockMutex(q->mutex);
+	return 0;
+}
+
+#ifdef AIO_URING
+
+static void aio_ring_free(AIO_RING *ring)
+{
+	if (ring->sqe != 0)
+		munmap(ring->sqe, ring->sqe_size);
+	if ( (ring->cq_map != 0) && (ring->cq_map != ring->sq_map) )
+		munmap(ring->cq_map, ring->cq_map_size);
+	if (ring->sq_map != 0)
+		munmap(ring->sq_map, ring->sq_map_size);
+	if (ring->fd >= 0)
+		close(ring->fd);
+	memset(ring, 0, sizeof(AIO_RING));
+	ring->fd = -1;
+}
+
+static void *aio_ring_map(int fd, size_t size, off_t what)
+{
+	void *p;
+
+	p = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, what);
+	return (p == MAP_FAILED) ? 0 : p;
+}
+
+// 0 if the kernel won't have it
+static u16 aio_ring_new(AIO_RING *ring, u16 depth)
+{
+	struct io_uring_params p;
+	u8 *sq, *cq;
+
+	memset(ring, 0, sizeof(AIO_RING));
+	memset(&p, 0, sizeof(p));
+	ring->fd = (int)syscall(__NR_io_uring_setup, (unsigned)depth, &p);
+	if (ring->fd < 0)
+	{
+		ring->fd = -1;
+		return 0;
+	}
+	// plain IORING_OP_READ and WRITE came with this (5.6)
+	if ((p.features & IORING_FEAT_RW_CUR_POS) == 0)
+		goto ring_err;
+
+	ring->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(u32);
+	ring->cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if ((p.features & IORING_FEAT_SINGLE_MMAP) != 0)
+	{
+		if (ring->cq_map_size > ring->sq_map_size)
+			ring->sq_map_size = ring->cq_map_size;
+		ring->cq_map_size = ring->sq_map_size;
+	}
+	ring->sq_map = aio_ring_map(ring->fd, ring->sq_map_size, IORING_OFF_SQ_RING);
+	if (ring->sq_map == 0)
+		goto ring_err;
+	if ((p.features & IORING_FEAT_SINGLE_MMAP) != 0)
+		ring->cq_map = ring->sq_map;
+	else
+		ring->cq_map = aio_ring_map(ring->fd, ring->cq_map_size, IORING_OFF_CQ_RING);
+	if (ring->cq_map == 0)
+		goto ring_err;
+	ring->sqe_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	ring->sqe = (struct io_uring_sqe *)aio_ring_map(ring->fd, ring->sqe_size, IORING_OFF_SQES);
+	if (ring->sqe == 0)
+		goto ring_err;
+
+	sq = (u8 *)ring->sq_map;
+	ring->sq_head = (u32 *)(sq + p.sq_off.head);
+	ring->sq_tail = (u32 *)(sq + p.sq_off.tail);
+	ring->sq_mask = (u32 *)(sq + p.sq_off.ring_mask);
+	ring->sq_array = (u32 *)(sq + p.sq_off.array);
+	cq = (u8 *)ring->cq_map;
+	ring->cq_head = (u32 *)(cq + p.cq_off.head);
+	ring->cq_tail = (u32 *)(cq + p.cq_off.tail);
+	ring->cq_mask = (u32 *)(cq + p.cq_off.ring_mask);
+	ring->cqe = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	return 1;
+
+ring_err:
+	aio_ring_free(ring);
+	return 0;
+}
+
+static void aio_ring_submit(AIO_RING *ring, AIO_REQ *req)
+{
+	struct io_uring_sqe *sqe;
+	u32 tail, index;
+
+	tail = *ring->sq_tail;
+	index = tail & *ring->sq_mask;
+	sqe = &ring->sqe[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = (req->write != 0) ? IORING_OP_WRITE : IORING_OP_READ;
+	sqe->fd = req->file->fd;
+	sqe->addr = (u64)(uintptr_t)req->buff;
+	sqe->len = (u32)req->size;
+	sqe->off = req->offset;
+	sqe->user_data = (u64)(uintptr_t)req;
+	ring->sq_array[index] = index;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->unsent++;
+}
+
+// hands the kernel what's been added and, with wait, sleeps for a completion.
+// 0 if the ring's broken.  busy (completions backed up) is just a retry
+static u16 aio_ring_enter(AIO_RING *ring, u16 wait)
+{
+	long n;
+	u32 flags;
+
+	if ( (ring->unsent == 0) && (wait == 0) )
+		return 1;
+	flags = (wait != 0) ? IORING_ENTER_GETEVENTS : 0;
+	do
+		n = syscall(__NR_io_uring_enter, ring->fd, ring->unsent, (wait != 0) ? 1 : 0, flags, 0, 0);
+	while ( (n < 0) && (errno == EINTR) );
+	if (n > 0)
+		ring->unsent -= ((u32)n < ring->unsent) ? (u32)n : ring->unsent;
+	return (n >= 0) || (errno == EAGAIN) || (errno == EBUSY);
+}
+
+static AIO_REQ *aio_ring_reap(AIO_RING *ring)
+{
+	struct io_uring_cqe *cqe;
+	AIO_REQ *req;
+	u32 head;
+
+	head = *ring->cq_head;
+	if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE))
+		return 0;
+	cqe = &ring->cqe[head & *ring->cq_mask];
+	req = (AIO_REQ *)(uintptr_t)cqe->user_data;
+	req->result = (cqe->res < 0) ? -1 : (long)cqe->res;
+	__atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+	return req;
+}
+
+#endif
+
+static SDL_AtomicInt aio_said;
+
+AIO_QUEUE *aio_queue_new(u16 depth)
+{
+	AIO_QUEUE *q;
+
+	if (depth == 0)
+		depth = 1;
+	if (depth > AIO_DEPTH_MAX)
+		depth = AIO_DEPTH_MAX;
+	q = (AIO_QUEUE *)a_malloc(sizeof(AIO_QUEUE));
+	memset(q, 0, sizeof(AIO_QUEUE));
+	q->depth = depth;
+
+#ifdef AIO_URING
+	q->uring = (u8)aio_ring_new(&q->ring, depth);
+	if (q->uring != 0)
+		return q;
+	if (SDL_CompareAndSwapAtomicInt(&aio_said, 0, 1))
+		printf("Async I/O: no io_uring, using threads\n");
+#endif
+
+	// the threads start with the first request
+	q->mutex = SDL_CreateMutex();
+	q->todo_cond = SDL_CreateCondition();
+	q->done_cond = SDL_CreateCondition();
+	return q;
+}
+
+void aio_queue_free(AIO_QUEUE *q)
+{
+	u16 i;
+
+	if (q == 0)
+		return;
+	while (aio_complete(q, 1) != 0)
+		;
+
+#ifdef AIO_URING
+	if (q->uring != 0)
+	{
+		aio_ring_free(&q->ring);
+		a_free(q);
+		return;
+	}
+#endif
+
+	if (q->mutex != 0)
+	{
+		SDL_LockMutex(q->mutex);
+		q->quit = 1;
+		SDL_BroadcastCondition(q->todo_cond);
+		SDL_UnlockMutex(q->mutex);
+	}
+	for (i = 0; i < q->threads; i++)
+		SDL_WaitThread(q->thread[i], NULL);
+	if (q->done_cond != 0)
+		SDL_DestroyCondition(q->done_cond);
+	if (q->todo_cond != 0)
+		SDL_DestroyCondition(q->todo_cond);
+	if (q->mutex != 0)
+		SDL_DestroyMutex(q->mutex);
+	a_free(q);
+}
+
+u16 aio_submit(AIO_QUEUE *q, AIO_REQ *req)
+{
+	if (q->busy >= q->depth)
+		return 0;
+	q->busy++;
+	req->next = 0;
+
+#ifdef AIO_URING
+	if (q->uring != 0)
+	{
+		aio_ring_submit(&q->ring, req);
+		req->next = q->todo;
+		q->todo = req;
+		return 1;
+	}
+#endif
+
+	// one more thread while there's fewer than requests
+	if ( (q->threads < AIO_THREADS) && (q->threads < q->busy) &&
+		(q->mutex != 0) && (q->todo_cond != 0) && (q->done_cond != 0) )
+	{
+		q->thread[q->threads] = SDL_CreateThread(aio_thread, "nagi_aio", q);
+		if (q->thread[q->threads] != 0)
+			q->threads++;
+	}
+	// no threads at all, it's done now and waits to be collected
+	if (q->threads == 0)
+	{
+		aio_do(req);
+		req->next = q->done;
+		q->done = req;
+		return 1;
+	}
+
+	SDL_LockMutex(q->mutex);
+	req->next = q->todo;
+	q->todo = req;
+	SDL_SignalCondition(q->todo_cond);
+	SDL_UnlockMutex(q->mutex);
+	return 1;
+}
+
+#ifdef AIO_URING
+// the kernel won't take or wait on the ring any more.  it's shut, what it
+// had comes back failed and the queue carries on without threads
+static void aio_ring_drop(AIO_QUEUE *q)
+{
+	AIO_REQ *req;
+
+	printf("Async I/O: io_uring failed (%s), doing it in place\n", strerror(errno));
+	aio_ring_free(&q->ring);
+	q->uring = 0;
+	while (q->todo != 0)
+	{
+		req = q->todo;
+		q->todo = req->next;
+		req->result = -1;
+		req->next = q->done;
+		q->done = req;
+	}
+}
+
+// the reaped request off the list of what the kernel has
+static void aio_ring_unlink(AIO_QUEUE *q, AIO_REQ *req)
+{
+	AIO_REQ **link;
+
+	for (link = &q->todo; *link != 0; link = &(*link)->next)
+		if (*link == req)
+		{
+			*link = req->next;
+			break;
+		}
+	req->next = 0;
+}
+#endif
+
+AIO_REQ *aio_complete(AIO_QUEUE *q, u16 wait)
+{
+	AIO_REQ *req;
+#ifdef AIO_URING
+	u16 ok;
+#endif
+
+	if (q->busy == 0)
+		return 0;
+
+#ifdef AIO_URING
+	if (q->uring != 0)
+	{
+		ok = aio_ring_enter(&q->ring, 0);
+		req = aio_ring_reap(&q->ring);
+		while ( (ok != 0) && (req == 0) && (wait != 0) )
+		{
+			ok = aio_ring_enter(&q->ring, 1);
+			req = aio_ring_reap(&q->ring);
+		}
+		if (req != 0)
+		{
+			aio_ring_unlink(q, req);
+			q->busy--;
+			return req;
+		}
+		if (ok != 0)
+			return 0;
+		// what the kernel had is on done now
+		aio_ring_drop(q);
+	}
+#endif
+
+	// without threads everything was done by aio_submit()
+	if (q->threads != 0)
+		SDL_LockMutex(q->mutex);
+	while ( (q->done == 0) && (wait != 0) && (q->threads != 0) )
+		SDL_WaitCondition(q->done_cond, q->mutex);
+	req = q->done;
+	if (req != 0)
+	{
+		q->done = req->next;
+		q->busy--;
+	}
+	if (q->threads != 0)
+		SDL_UnlockMutex(q->mutex);
+	return req;
+}
+
+#endif
+
+u16 aio_busy(AIO_QUEUE *q)
+{
+	return q->busy;
+}
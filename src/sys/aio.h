@@ -0,0 +1,47 @@
+#ifndef NAGI_SYS_AIO_H
+#define NAGI_SYS_AIO_H
+
+/* STRUCTURES	---	---	---	---	---	---	--- */
+
+struct aio_file_struct;
+typedef struct aio_file_struct AIO_FILE;
+
+struct aio_queue_struct;
+typedef struct aio_queue_struct AIO_QUEUE;
+
+// one read or write.  it's aio.c's from aio_submit() until aio_complete()
+// hands it back, so the buffer has to stay put till then
+struct aio_req_struct
+{
+	AIO_FILE *file;
+	u64 offset;
+	u8 *buff;
+	size_t size;
+	u8 write;
+	long result;		// bytes done (short at the end of a file), -1 if it failed
+	void *user;
+	struct aio_req_struct *next;	// aio.c's
+};
+typedef struct aio_req_struct AIO_REQ;
+
+/* FUNCTIONS	---	---	---	---	---	---	--- */
+
+// a handle on an open file that takes aio requests.  the stream's own
+// position and buffering are left alone.  0 if it can't have one
+extern AIO_FILE *aio_file_open(FILE *stream, u16 write);
+extern void aio_file_close(AIO_FILE *file);
+
+// at most depth requests in flight.  a queue is only used from one thread
+extern AIO_QUEUE *aio_queue_new(u16 depth);
+// waits for whatever's still in flight
+extern void aio_queue_free(AIO_QUEUE *q);
+
+// 0 if the queue's full.  it's started by the next aio_complete() at the latest
+extern u16 aio_submit(AIO_QUEUE *q, AIO_REQ *req);
+// a finished request, in any order.  0 if none has finished (or, with
+// wait, if there's nothing in flight)
+extern AIO_REQ *aio_complete(AIO_QUEUE *q, u16 wait);
+// requests submitted and not handed back yet
+extern u16 aio_busy(AIO_QUEUE *q);
+
+#endif /* NAGI_SYS_AIO_H */
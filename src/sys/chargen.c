@@ -4,6 +4,8 @@
 //~ RaDIaT1oN (2002-04-29):
 //~ cast for strtok
 
+#define MEM_TAG MEM_CACHE
+
 /* BASE headers	---	---	---	---	---	---	--- */
 #include "../agi.h"
 
@@ -29,6 +31,7 @@
 
 #include "mem_wrap.h"
 #include "sys_dir.h"
+#include "startup.h"
 
 
 /* PROTOTYPES	---	---	---	---	---	---	--- */
@@ -46,6 +49,7 @@ void ch_pos_get(TPOS *pos)
 void ch_pos_set(TPOS *pos)
 void ch_attrib(u8 colour, u16 flags)
 void ch_put(u8 ch)
+void ch_put_string(const u32 *ch, u16 total)
 void ch_scroll(TPOS *pos1, TPOS *pos2, u16 scroll, u8 attrib)
 void ch_clear(TPOS *pos1, TPOS *pos2, u8 attrib)
 */
@@ -58,15 +62,40 @@ u8 chgen_textmode;
 static TPOS chgen_textpos = {0,0};
 
 //u8 *font_list = "font_8x8.fnt,font_16x16.fnt";
-static u8 *font_data = 0;
-static u8 *font_work = 0;
 AGISIZE font_size = {0,0};
-static u32 font_chsize = 0;
-static u32 font_linesize = 0;
+
+#define TEXT_INVERT 0x1
+#define TEXT_SHADE 0x2
+
+/* bitmap font glyphs expanded to cell sized masks (0xFF for fg) when the
+   font is loaded.  one set per TEXT_INVERT/TEXT_SHADE combination */
+#define FONT_GLYPHS 128
+#define FONT_VARIANTS 4
+static u8 *font_mask = 0;
+static u32 font_cell = 0;
 
 /* TTF font support */
 static TTF_Font *ttf_font = NULL;
-static SDL_Surface *glyph_cache[256] = {NULL};  /* Pre-rendered glyphs for ASCII */
+static int ttf_points = 0;		/* the size ttf_font was opened at */
+static char ttf_error[256] = "";
+
+/* TTF glyphs thresholded to the cell once, keyed by codepoint */
+#define GLYPH_HASH 256
+#define GLYPH_MAX 4096
+
+struct glyph_struct
+{
+	struct glyph_struct *next;
+	u32 ch;
+	u8 *mask;		/* cell sized, 0xFF for fg.  0 if TTF couldn't render it */
+};
+typedef struct glyph_struct GLYPH;
+
+static GLYPH *glyph_hash[GLYPH_HASH] = {NULL};
+static u16 glyph_total = 0;
+static Uint64 glyph_used_ms = 0;	/* the last lookup */
+u32 ch_glyph_hits = 0;
+u32 ch_glyph_misses = 0;
 
 static POS update_pos = {0,0};
 static AGISIZE update_size = {0,0};
@@ -151,7 +180,11 @@ static FILE *font_open(AGISIZE *needed)
 
 static void font_load(FILE *font_stream)
 {
-	u8 ch;
+	u8 *font_data;
+	u8 *mask;
+	u32 chsize, linesize;
+	u8 font_d, shade;
+	int ch, variant, y, x;
 
 	if (font_stream == 0)
 	{
@@ -164,46 +197,255 @@ static void font_load(FILE *font_stream)
 
 	font_size.w = fgetc(font_stream);
 	font_size.h = fgetc(font_stream);
-	font_chsize = fgetc(font_stream);
-	font_linesize = font_chsize / font_size.h;
+	chsize = fgetc(font_stream);
+	linesize = chsize / font_size.h;
 
-	font_data = a_malloc(128 * font_chsize);
-	memset(font_data, 0, 128 * font_chsize);
-	font_work = a_malloc(font_chsize);
-	memset(font_work, 0, font_chsize);
+	font_data = a_malloc(FONT_GLYPHS * chsize);
+	memset(font_data, 0, FONT_GLYPHS * chsize);
 
 	ch = fgetc(font_stream);
-	while (ch != 0xFF)
+	while ((ch != 0xFF) && (ch != EOF))
 	{
-		size_t bytes_read = fread(&font_data[font_chsize*ch], font_chsize, 1, font_stream);
+		size_t bytes_read = fread(&font_data[chsize*(ch & 0x7F)], chsize, 1, font_stream);
 		(void)bytes_read;
 		ch = fgetc(font_stream);
 	}
+	fclose(font_stream);
+
+	// expand every bit of every glyph once so ch_put_string only has to
+	// pick fg or bg per pixel.  variant bit 0 is TEXT_INVERT, bit 1 TEXT_SHADE.
+	// shade ors 0xAA into a row's font bytes, 0x55 on the next and so on.
+	font_cell = font_size.w * font_size.h;
+	font_mask = a_malloc(FONT_VARIANTS * FONT_GLYPHS * font_cell);
+	mask = font_mask;
+	for (variant = 0; variant < FONT_VARIANTS; variant++)
+	{
+		for (ch = 0; ch < FONT_GLYPHS; ch++)
+		{
+			shade = (variant & TEXT_SHADE) ? 0xAA : 0;
+			for (y = 0; y < font_size.h; y++)
+			{
+				for (x = 0; x < font_size.w; x++)
+				{
+					font_d = font_data[chsize*ch + linesize*y + x/8];
+					if (variant & TEXT_INVERT)
+						font_d ^= 0xFF;
+					font_d |= shade;
+					*(mask++) = (font_d & (0x80 >> (x & 7))) ? 0xFF : 0;
+				}
+				if (shade != 0)
+					shade ^= 0xFF;
+			}
+		}
+	}
+
+	a_free(font_data);
+}
+
+static void glyph_flush(void)
+{
+	GLYPH *g, *next;
+	int i;
+
+	for (i = 0; i < GLYPH_HASH; i++) {
+		for (g = glyph_hash[i]; g != NULL; g = next) {
+			next = g->next;
+			a_free(g);
+		}
+		glyph_hash[i] = NULL;
+	}
+	glyph_total = 0;
+}
+
+/* For the cache budget.  the glyphs are given up all at once */
+size_t ch_glyph_usage(size_t *oldest_bytes, u32 *oldest_age)
+{
+	size_t bytes;
+
+	bytes = (size_t)glyph_total * (sizeof(GLYPH) + font_size.w * font_size.h);
+	*oldest_bytes = bytes;
+	*oldest_age = (bytes != 0) ? (u32)(SDL_GetTicks() - glyph_used_ms) : 0;
+	return bytes;
+}
+
+void ch_glyph_evict(void)
+{
+	glyph_flush();
+}
+
+/* Encode Unicode codepoint to UTF-8 for TTF rendering */
+static void glyph_utf8(u32 ch, char *text)
+{
+	if (ch < 0x80) {
+		text[0] = (char)ch;
+		text[1] = '\0';
+	} else if (ch < 0x800) {
+		text[0] = (char)(0xC0 | (ch >> 6));
+		text[1] = (char)(0x80 | (ch & 0x3F));
+		text[2] = '\0';
+	} else if (ch < 0x10000) {
+		text[0] = (char)(0xE0 | (ch >> 12));
+		text[1] = (char)(0x80 | ((ch >> 6) & 0x3F));
+		text[2] = (char)(0x80 | (ch & 0x3F));
+		text[3] = '\0';
+	} else {
+		text[0] = (char)(0xF0 | (ch >> 18));
+		text[1] = (char)(0x80 | ((ch >> 12) & 0x3F));
+		text[2] = (char)(0x80 | ((ch >> 6) & 0x3F));
+		text[3] = (char)(0x80 | (ch & 0x3F));
+		text[4] = '\0';
+	}
+}
+
+/* Rasterise a glyph into a cell sized mask */
+static GLYPH *glyph_render(u32 ch)
+{
+	SDL_Surface *glyph_surf;
+	SDL_Color white = {255, 255, 255, 255};
+	GLYPH *g;
+	char text[5];
+	int font_ascent, font_height;
+	int glyph_y_offset;
+	int cell, y, x;
+
+	cell = font_size.w * font_size.h;
+	g = a_malloc(sizeof(GLYPH) + cell);
+	g->ch = ch;
+	g->mask = NULL;
+
+	glyph_utf8(ch, text);
+
+	/* SDL3_ttf expects length in bytes, not characters */
+	glyph_surf = TTF_RenderText_Blended(ttf_font, text, 0, white);
+	if (glyph_surf) {
+		const SDL_PixelFormatDetails *fmt_details;
+
+		/* Get pixel format details for SDL_GetRGBA */
+		fmt_details = SDL_GetPixelFormatDetails(glyph_surf->format);
+
+		/* Position baseline at a proportional height within the cell */
+		/* The ascent should be in the upper portion of the cell */
+		font_ascent = TTF_GetFontAscent(ttf_font);
+		font_height = TTF_GetFontHeight(ttf_font);
+		glyph_y_offset = (font_size.h * font_ascent) / font_height - font_ascent;
+
+		g->mask = (u8 *)(g + 1);
+		memset(g->mask, 0, cell);
+
+		for (y = 0; y < glyph_surf->h && (y + glyph_y_offset) < font_size.h; y++) {
+			Uint32 *src;
+			u8 *dst;
+			int dst_y;
+
+			/* Skip if glyph would be above the cell */
+			dst_y = y + glyph_y_offset;
+			if (dst_y < 0) continue;
+
+			src = (Uint32 *)((Uint8 *)glyph_surf->pixels + y * glyph_surf->pitch);
+			dst = g->mask + dst_y * font_size.w;
+
+			for (x = 0; x < glyph_surf->w && x < font_size.w; x++) {
+				Uint8 r, gr, b, a;
+
+				SDL_GetRGBA(src[x], fmt_details, NULL, &r, &gr, &b, &a);
+
+				/* Only draw if pixel is sufficiently opaque (>50% alpha) */
+				if (a > 127)
+					dst[x] = 0xFF;
+			}
+		}
+
+		SDL_DestroySurface(glyph_surf);
+	}
+
+	return g;
+}
+
+static GLYPH *glyph_get(u32 ch)
+{
+	GLYPH *g;
+	GLYPH **bucket;
+
+	glyph_used_ms = SDL_GetTicks();
+	bucket = &glyph_hash[ch % GLYPH_HASH];
+	for (g = *bucket; g != NULL; g = g->next)
+		if (g->ch == ch)
+		{
+			ch_glyph_hits++;
+			return g;
+		}
+	ch_glyph_misses++;
+
+	/* a screen of every glyph of a big script stays well under this */
+	if (glyph_total >= GLYPH_MAX)
+	{
+		glyph_flush();
+		bucket = &glyph_hash[ch % GLYPH_HASH];
+	}
+
+	g = glyph_render(ch);
+	g->next = *bucket;
+	*bucket = g;
+	glyph_total++;
+	return g;
+}
+
+/* may run on the startup task.. SDL errors are per thread and the
+   working directory is the main thread's */
+static int ttf_open(void *data)
+{
+	char path[1024];
+
+	(void)data;
+	if (!TTF_Init()) {
+		snprintf(ttf_error, sizeof(ttf_error), "%s", SDL_GetError());
+		return -1;
+	}
+	snprintf(path, sizeof(path), "%s/IBMPlexMono-Regular.ttf", dir_preset_get(DIR_PRESET_NAGI));
+	ttf_font = TTF_OpenFont(path, (float)ttf_points);
+	if (!ttf_font)
+		snprintf(ttf_error, sizeof(ttf_error), "%s", SDL_GetError());
+	return 0;
+}
+
+/* neither needs the window, so they're started before SDL_Init and
+   ch_init() picks the font up */
+void ch_font_start(void)
+{
+	ttf_points = render_pick()->h * c_vid_scale / 21;
+	startup_task(STARTUP_TASK_FONT, ttf_open, 0);
 }
 
 void ch_init(void)
 {
 	AGISIZE needed;
 	int font_point_size;
+	int result;
 
 	needed.w = rend_drv->w * c_vid_scale / 40;
 	needed.h = rend_drv->h * c_vid_scale / 21;
 
-	/* Initialize SDL_ttf */
-	if (!TTF_Init()) {
-		printf("ch_init(): Failed to initialize SDL_ttf: %s\n", SDL_GetError());
-		agi_exit();
-	}
-
 	/* Load TTF font with appropriate point size based on needed height */
 	/* The point size is roughly the pixel height we want */
 	font_point_size = needed.h;
 
-	dir_preset_change(DIR_PRESET_NAGI);
-	ttf_font = TTF_OpenFont("IBMPlexMono-Regular.ttf", font_point_size);
+	/* opened already unless this is gfx_reinit() */
+	if (!startup_task_wait(STARTUP_TASK_FONT, &result)) {
+		ttf_points = font_point_size;
+		result = ttf_open(0);
+	}
+	if (result != 0) {
+		printf("ch_init(): Failed to initialize SDL_ttf: %s\n", ttf_error);
+		agi_exit();
+	}
+	if (ttf_font && (ttf_points != font_point_size)) {
+		TTF_SetFontSize(ttf_font, (float)font_point_size);
+		ttf_points = font_point_size;
+	}
 
+	dir_preset_change(DIR_PRESET_NAGI);
 	if (!ttf_font) {
-		printf("ch_init(): Failed to load TTF font: %s\n", SDL_GetError());
+		printf("ch_init(): Failed to load TTF font: %s\n", ttf_error);
 		printf("ch_init(): Falling back to bitmap fonts...\n");
 		/* Fallback to bitmap fonts */
 		font_load(font_open(&needed));
@@ -216,10 +458,8 @@ void ch_init(void)
 		printf("TTF font loaded successfully: %dx%d pixels per character cell\n",
 		       font_size.w, font_size.h);
 
-		/* Pre-render all ASCII characters to cache */
-		for (int i = 0; i < 256; i++) {
-			glyph_cache[i] = NULL;  /* Will be rendered on first use */
-		}
+		/* glyphs are rendered on first use */
+		glyph_total = 0;
 	}
 
 	// text pos = 0,0
@@ -235,14 +475,7 @@ void ch_shutdown(void)
 
 	/* Free TTF resources */
 	if (ttf_font) {
-		/* Free glyph cache */
-		for (int i = 0; i < 256; i++) {
-			if (glyph_cache[i]) {
-				SDL_DestroySurface(glyph_cache[i]);
-				glyph_cache[i] = NULL;
-			}
-		}
-
+		glyph_flush();
 		TTF_CloseFont(ttf_font);
 		ttf_font = NULL;
 	}
@@ -250,14 +483,11 @@ void ch_shutdown(void)
 	TTF_Quit();
 
 	/* Free bitmap font resources */
-	a_free(font_data);
-	a_free(font_work);
-	font_data = 0;
-	font_work = 0;
+	a_free(font_mask);
+	font_mask = 0;
+	font_cell = 0;
 
 	memset (&font_size, 0, sizeof(AGISIZE));
-	font_chsize = 0;
-	font_linesize = 0;
 }
 
 // font pos to screen pos
@@ -336,33 +566,33 @@ void ch_attrib( u8 colour, u16 flags )
 	given_flags = flags;
 }
 
-
-#define TEXT_INVERT 0x1
-#define TEXT_SHADE 0x2
-
-void ch_put(u32 ch)
+// draw a run of characters along the row from the text position.
+// one lock and one dirty rect for the lot.  the position isn't moved.
+void ch_put_string(const u32 *ch, u16 total)
 {
 	POS gfx_pos;
+	AGISIZE run_size;
+	u16 n;
+	u8 fg_index, bg_index;
+	u8 temp;
+	u8 *cell, *dst_line;
+	const u8 *mask;
+	const u8 *bitmap_set = 0;
+	int y, x;
+
+	if (total == 0)
+		return;
 
 	gfx_pos.x = font_size.w * chgen_textpos.col;
 	gfx_pos.y = font_size.h * chgen_textpos.row;
+	run_size.w = font_size.w * total;
+	run_size.h = font_size.h;
 
-	/* Use TTF rendering if available, otherwise fall back to bitmap */
-	if (ttf_font) {
-		SDL_Surface *glyph_surf;
-		SDL_Color fg_color;
-		u8 fg_index, bg_index;
-		char text[5];
-		int font_ascent, font_height;
-		u8 temp;
-		u8 *pixels;
-		int y, x;
-		int glyph_y_offset;
-
-		/* Extract foreground and background color indices */
-		fg_index = given_colour & 0x0F;
-		bg_index = (given_colour & 0x70) >> 4;
+	/* Extract foreground and background color indices */
+	fg_index = given_colour & 0x0F;
+	bg_index = (given_colour & 0x70) >> 4;
 
+	if (ttf_font) {
 		/* Handle invert flag - swap fg and bg indices */
 		if (((given_flags & TEXT_INVERT) != 0) ||
 		    (((given_colour & 0x80) != 0) && (chgen_textmode == 0))) {
@@ -370,170 +600,48 @@ void ch_put(u32 ch)
 			fg_index = bg_index;
 			bg_index = temp;
 		}
-
-		/* Get foreground color from system palette */
-		vid_palette_get_color(fg_index, &fg_color.r, &fg_color.g, &fg_color.b);
-		fg_color.a = 255;
-
-		/* Encode Unicode codepoint to UTF-8 for TTF rendering */
-		if (ch < 0x80) {
-			text[0] = (char)ch;
-			text[1] = '\0';
-		} else if (ch < 0x800) {
-			text[0] = (char)(0xC0 | (ch >> 6));
-			text[1] = (char)(0x80 | (ch & 0x3F));
-			text[2] = '\0';
-		} else if (ch < 0x10000) {
-			text[0] = (char)(0xE0 | (ch >> 12));
-			text[1] = (char)(0x80 | ((ch >> 6) & 0x3F));
-			text[2] = (char)(0x80 | (ch & 0x3F));
-			text[3] = '\0';
-		} else {
-			text[0] = (char)(0xF0 | (ch >> 18));
-			text[1] = (char)(0x80 | ((ch >> 12) & 0x3F));
-			text[2] = (char)(0x80 | ((ch >> 6) & 0x3F));
-			text[3] = (char)(0x80 | (ch & 0x3F));
-			text[4] = '\0';
-		}
-
-		/* Get font metrics for proper baseline positioning */
-		font_ascent = TTF_GetFontAscent(ttf_font);
-		font_height = TTF_GetFontHeight(ttf_font);
-
-		/* SDL3_ttf expects length in bytes, not characters */
-		glyph_surf = TTF_RenderText_Blended(ttf_font, text, 0, fg_color);
-
-		if (glyph_surf) {
-			const SDL_PixelFormatDetails *fmt_details;
-			u8 *dst_line;
-
-			/* Get pixel format details for SDL_GetRGBA */
-			fmt_details = SDL_GetPixelFormatDetails(glyph_surf->format);
-
-			/* Calculate baseline position within cell */
-			/* Position baseline at a proportional height within the cell */
-			/* The ascent should be in the upper portion of the cell */
-			glyph_y_offset = (font_size.h * font_ascent) / font_height - font_ascent;
-
-			vid_lock();
-			pixels = (u8 *)vid_getbuf() + gfx_pos.y * vid_getlinesize() + gfx_pos.x;
-
-			/* FIRST: Clear entire character cell with background color */
-			/* Like bitmap fonts, fill the entire cell to prevent ghosting */
-			dst_line = pixels;
-			for (y = 0; y < font_size.h; y++) {
-				for (x = 0; x < font_size.w; x++) {
-					dst_line[x] = bg_index;
-				}
-				dst_line += vid_getlinesize();
-			}
-
-			/* SECOND: Copy glyph with proper vertical offset based on baseline */
-			/* The glyph is positioned relative to the baseline within the cell */
-			for (y = 0; y < glyph_surf->h && (y + glyph_y_offset) < font_size.h; y++) {
-				Uint32 *src;
-				u8 *dst;
-				int dst_y;
-
-				/* Skip if glyph would be above the cell */
-				dst_y = y + glyph_y_offset;
-				if (dst_y < 0) continue;
-
-				src = (Uint32 *)((Uint8 *)glyph_surf->pixels + y * glyph_surf->pitch);
-				dst = pixels + dst_y * vid_getlinesize();
-
-				for (x = 0; x < glyph_surf->w && x < font_size.w; x++) {
-					Uint32 pixel;
-					Uint8 r, g, b, a;
-
-					pixel = src[x];
-
-					/* Extract RGBA from 32-bit pixel */
-					SDL_GetRGBA(pixel, fmt_details, NULL, &r, &g, &b, &a);
-
-					/* Only draw if pixel is sufficiently opaque (>50% alpha) */
-					/* Since we already filled background, no need for complex blending */
-					if (a > 127) {
-						dst[x] = fg_index;
-					}
-					/* else: keep background color (already written) */
-				}
-			}
-
-			vid_unlock();
-			SDL_DestroySurface(glyph_surf);
-		}
-
-		font_lazy_update(&gfx_pos, &font_size);
 	}
 	else {
-		/* Fallback to original bitmap rendering */
-		u8 *pixels;
-		u8 *fontp;
-		int h_count;
-		u32 w_count;
-		u8 mask_xor = 0;
-		u8 mask_or = 0;
-		u8 font_d, b;
-
-		pixels = (u8 *)vid_getbuf() + gfx_pos.y * vid_getlinesize() + gfx_pos.x;
+		/* bitmap fonts have invert and shade already expanded */
+		int variant = 0;
 
 		if (((given_flags & TEXT_INVERT) != 0) ||
 		    (((given_colour & 0x80) != 0) && (chgen_textmode == 0)))
-			mask_xor = 0xFF;
-
+			variant |= TEXT_INVERT;
 		if ((given_flags & TEXT_SHADE) != 0)
-			mask_or = 0xAA;
-
-		if ((mask_xor | mask_or) != 0) {
-			u8 *pp;
-
-			fontp = font_work;
-			memcpy(fontp, font_data + (font_chsize * ch), font_chsize);
-			pp = fontp;
+			variant |= TEXT_SHADE;
+		bitmap_set = font_mask + variant * FONT_GLYPHS * font_cell;
+	}
 
-			for (h_count = 0; h_count < font_size.h; h_count++) {
-				for (w_count = 0; w_count < font_linesize; w_count++) {
-					*pp ^= mask_xor;
-					*pp |= mask_or;
-					pp++;
-				}
-				if (mask_or != 0)
-					mask_or ^= 0xFF;
-			}
+	vid_lock();
+	cell = (u8 *)vid_getbuf() + gfx_pos.y * vid_getlinesize() + gfx_pos.x;
+	for (n = 0; n < total; n++, cell += font_size.w) {
+		if (ttf_font) {
+			mask = glyph_get(ch[n])->mask;
+			if (mask == NULL)
+				continue;
 		}
 		else {
-			fontp = font_data + (font_chsize * ch);
+			mask = bitmap_set + (ch[n] < FONT_GLYPHS ? ch[n] : 0) * font_cell;
 		}
 
-		vid_lock();
-
-		for (h_count = 0; h_count < font_size.h; h_count++) {
-			w_count = font_size.w;
-			font_d = *(fontp++);
-			b = 0x80; // 1000 0000b
-
-			while (w_count != 0) // for characters more than 8 bits wide
-			{
-				if (b == 0) {
-					font_d = *(fontp++);
-					b = 0x80; // 1000 0000b
-				}
-
-				if ((font_d & b) != 0)
-					*pixels = given_colour & 0x0F;
-				else
-					*pixels = (given_colour & 0x70) >> 4;
-				pixels++;
-				b >>= 1;
-				w_count--;
-			}
-			pixels += vid_getlinesize() - font_size.w;
+		/* Fill the whole cell to prevent ghosting */
+		dst_line = cell;
+		for (y = 0; y < font_size.h; y++) {
+			for (x = 0; x < font_size.w; x++)
+				dst_line[x] = (mask[x] & fg_index) | (~mask[x] & bg_index);
+			mask += font_size.w;
+			dst_line += vid_getlinesize();
 		}
-
-		vid_unlock();
-		font_lazy_update(&gfx_pos, &font_size);
 	}
+	vid_unlock();
+
+	font_lazy_update(&gfx_pos, &run_size);
+}
+
+void ch_put(u32 ch)
+{
+	ch_put_string(&ch, 1);
 }
 
 
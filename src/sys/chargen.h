@@ -5,8 +5,14 @@
 /* VARIABLES	---	---	---	---	---	---	--- */
 extern u8 chgen_textmode;
 extern AGISIZE font_size;
+/* ttf glyph cache lookups, for the hud */
+extern u32 ch_glyph_hits;
+extern u32 ch_glyph_misses;
+extern size_t ch_glyph_usage(size_t *oldest_bytes, u32 *oldest_age);
+extern void ch_glyph_evict(void);
 //extern FONT *agi_font;
 /* FUNCTIONS	---	---	---	---	---	---	--- */
+extern void ch_font_start(void);
 extern void ch_init(void);
 extern void ch_shutdown(void);
 
@@ -15,6 +21,7 @@ extern void ch_pos_get(TPOS *pos);
 extern void ch_pos_set(TPOS *pos);
 extern void ch_attrib( u8 colour, u16 flags );
 extern void ch_put(u32 ch);
+extern void ch_put_string(const u32 *ch, u16 total);
 extern void ch_scroll(TPOS *pos1, TPOS *pos2, s16 scroll, u8 attrib);
 extern void ch_clear(TPOS *pos1, TPOS *pos2, u8 attrib);
 
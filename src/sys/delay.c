@@ -7,60 +7,164 @@
 #include "../sound/sound_base.h"
 #include "../sound/sound_gen.h"
 
+#include "sdl_vid.h"
+#include "replay.h"
+
 #include "../ui/cmd_input.h"
+#include "../ui/msg.h"
 #include "../flags.h"
+#include "../initialise.h"
 
-static u32 tick_prev = 0;
 // 1/20 sec intervals
 #define DELAY_MULT 50
+#define DELAY_NS_PER_MS 1000000ull
+// shortest cycle, so fastest speed doesn't run too fast
+#define DELAY_MIN_NS (1 * DELAY_NS_PER_MS)
+
+static Uint64 cycle_start = 0;	// ns, when the current cycle was due
+
+// turbo runs the cycles back to back and counts each as the V10 delay it
+// asked for, the same as a replay does.  the screen's presented every
+// turbo_present cycles, or once a display refresh with 0.  the game time
+// stays ahead of the real time by what turbo skipped
+u8 delay_turbo = 0;
+static Uint64 turbo_game_ns = 0;	// the game time while it's on
+static Sint64 turbo_ahead_ns = 0;	// and after, its lead on SDL_GetTicksNS()
+static u32 turbo_cycles = 0;
 
 u32 calc_agi_tick()
 {
 	// if delay_mult == 50;
-	return SDL_GetTicks() / DELAY_MULT;
+	if (replay_mode == REPLAY_PLAY)
+		return replay_ms() / DELAY_MULT;
+	return (u32)(delay_game_ns() / DELAY_NS_PER_MS / DELAY_MULT);
 }
 
 
 void delay_init()
 {
-	tick_prev = SDL_GetTicks();
+	cycle_start = SDL_GetTicksNS();
+	delay_turbo_set(c_nagi_turbo);
+}
+
+Uint64 delay_game_ns(void)
+{
+	if (delay_turbo)
+		return turbo_game_ns;
+	return SDL_GetTicksNS() + turbo_ahead_ns;
+}
+
+void delay_turbo_set(u8 on)
+{
+	on = (on != 0);
+	if (on == delay_turbo)
+		return;
+	if (on)
+		turbo_game_ns = SDL_GetTicksNS() + turbo_ahead_ns;
+	else
+	{
+		turbo_ahead_ns = (Sint64)(turbo_game_ns - SDL_GetTicksNS());
+		cycle_start = SDL_GetTicksNS();
+		vid_repaint();
+	}
+	turbo_cycles = 0;
+	delay_turbo = on;
+	printf("Turbo %s\n", on ? "on" : "off");
+}
+
+static void turbo_present(void)
+{
+	if ( (c_nagi_turbo_present != 0) ? (turbo_cycles % c_nagi_turbo_present == 0) : vid_refresh_due() )
+		vid_flush();
+}
+
+// a wait for a timer (a message box's) goes by in game time straight away
+void delay_turbo_idle(u32 ms)
+{
+	turbo_game_ns += (Uint64)ms * DELAY_NS_PER_MS;
+	turbo_present();
+	SDL_PumpEvents();
+}
+
+// sleep towards the deadline, input or llm text (event_wake) wakes it
+// straight away.  so does the next display frame if the screen's animating
+static void delay_until(Uint64 deadline)
+{
+	Uint64 now, ms, frame;
+
+	frame = vid_frame_due();
+	if ((frame != 0) && (frame < deadline))
+		deadline = frame;
+
+	now = SDL_GetTicksNS();
+	if (now >= deadline)
+		return;
+
+	ms = (deadline - now) / DELAY_NS_PER_MS;
+	if (ms != 0)
+		SDL_WaitEventTimeout(0, (Sint32)ms);
+	else
+		SDL_DelayPrecise(deadline - now);	// the last fraction of a ms
 }
 
+// cycles are due every V10 * 1/20 sec from when the last one was due, so the
+// time a cycle takes doesn't add to the wait.  a cycle done early by a player
+// command, or late by more than a whole period, starts the schedule again
 void do_delay()
 {
-	SDL_PumpEvents();	// we have to poll at least once
-	input_poll();
-	SDL_Delay(1);	// so fastest speed doesn't run too fast
-	
-	while ( ( (state.var[V10_DELAY] * DELAY_MULT) > (SDL_GetTicks() - tick_prev) )
-			&& (!flag_test(F02_PLAYERCMD)) )
+	Uint64 period, deadline, now;
+
+	sndgen_poll();	// sounds that finished since the last cycle
+#ifdef NAGI_ENABLE_LLM
+	llm_config_poll();
+#endif
+
+	// no waiting, just the input that was read here when it was recorded
+	if (replay_mode == REPLAY_PLAY)
+	{
+		vid_flush();
+		do
+		{
+			input_poll();
+			message_box_llm_poll();
+		} while ( replay_delay_pending() && (!flag_test(F02_PLAYERCMD)) );
+		return;
+	}
+
+	period = (Uint64)state.var[V10_DELAY] * DELAY_MULT * DELAY_NS_PER_MS;
+	if (period < DELAY_MIN_NS)
+		period = DELAY_MIN_NS;
+
+	if (delay_turbo)
 	{
+		turbo_game_ns += period;
+		turbo_cycles++;
+		turbo_present();
 		SDL_PumpEvents();
 		input_poll();
-		//sndgen_poll();
-		SDL_Delay(5);	// to prevent it taking 100% cpu
+		message_box_llm_poll();
+		return;
 	}
 
-	tick_prev = SDL_GetTicks();
-	
-	/*
-	s32 delay_len;
-	//s32 stuff;
-	//s32 more;
-	
-	SDL_Delay(1);	// so it doesn't take up all cpu time
-
-	delay_len = state.var[V10_DELAY] * DELAY_MULT - (SDL_GetTicks() - tick_prev);
-	//stuff = SDL_GetTicks();
-	if (delay_len > 0)
-		SDL_Delay(delay_len);
-
-	//more = SDL_GetTicks() - stuff;
-	//printf("len=%d d=%d diff=%d\n", delay_len, more, more-delay_len);
-	*/
-	//tick_prev = SDL_GetTicks();
-	//SDL_PumpEvents();
-}
+	vid_flush();	// one present per cycle, of everything it drew
+	SDL_PumpEvents();	// we have to poll at least once
+	input_poll();
+	message_box_llm_poll();
 
+	deadline = cycle_start + period;
 
+	while ( (SDL_GetTicksNS() < deadline) && (!flag_test(F02_PLAYERCMD)) )
+	{
+		delay_until(deadline);
+		input_poll();
+		message_box_llm_poll();
+		//sndgen_poll();
+		vid_flush();
+	}
 
+	now = SDL_GetTicksNS();
+	if ( flag_test(F02_PLAYERCMD) || (now > deadline + period) )
+		cycle_start = now;
+	else
+		cycle_start = deadline;
+}
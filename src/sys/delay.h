@@ -4,9 +4,15 @@
 //_DoClock                       cseg     00007E35 0000007C
 //_DoDelay                       cseg     00007EB1 0000001D
 
+extern u8 delay_turbo;
+
 extern u32 calc_agi_tick(void);
 extern void do_delay(void);
 
 extern void delay_init(void);
+// game time, it runs ahead of the real time after turbo
+extern Uint64 delay_game_ns(void);
+extern void delay_turbo_set(u8 on);
+extern void delay_turbo_idle(u32 ms);
 
 #endif /* NAGI_SYS_DELAY_H */
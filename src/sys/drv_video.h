@@ -24,6 +24,8 @@ struct render_driver_struct
 	void (*func_rect)(int x, int y, int width, int height, u8 colour);
 	void (*func_colour)(u8 col, COLOUR *col_dith);
 	void (*func_view_dither)(u8 *view_data);
+	// a row of the picture buffer straight to screen pixels, scaled
+	void (*func_row)(u8 *dst, const u8 *src, u16 width, u16 scale);
 };
 typedef struct render_driver_struct RDRIVER;
 
@@ -3,6 +3,8 @@ load_le_16
 load_be_16
 store_le_16
 store_be_16
+load_le_32
+store_le_32
 
 little endian is intel
 big endian is motorola
@@ -41,3 +43,16 @@ void store_be_16(void *data, u16 value)
 	datab[0] = (value >> 8) & 0xFF;
 	datab[1] = value & 0xFF;
 }
+
+u32 load_le_32(const void *data)
+{
+	const u8 *datab = (const u8 *)(data);
+	return load_le_16(datab) | ((u32)load_le_16(datab + 2) << 16);
+}
+
+void store_le_32(void *data, u32 value)
+{
+	u8 *datab = (u8 *)(data);
+	store_le_16(datab, value & 0xFFFF);
+	store_le_16(datab + 2, (value >> 16) & 0xFFFF);
+}
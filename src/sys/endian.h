@@ -5,5 +5,7 @@ extern u16 load_le_16(const void *data);
 extern u16 load_be_16(const void *data);
 extern void store_le_16(void *data, u16 value);
 extern void store_be_16(void *data, u16 value);
+extern u32 load_le_32(const void *data);
+extern void store_le_32(void *data, u32 value);
 
 #endif /* NAGI_SYS_ENDIAN_H */
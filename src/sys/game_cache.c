@@ -0,0 +1,238 @@
+/*
+Per game cache file
+
+what's worked out from a game's files and takes a while to work out again
+(the said() phrase index, and more to come) is kept in GCACHE_FILE next
+to the saves.  it's one file of sections, each found by an id and made
+with a key: the version of the code that made it, or the model it's for.
+a section whose key doesn't match is just missing, and whoever wanted it
+builds it again and stores it.  the file as a whole is for one game,
+known by its crc, so a different or changed game starts afresh.
+
+the file is mapped and a section is used where it sits.  storing a
+section writes the file again with the others carried over.
+
+file layout:
+	0	"NGCH"
+	4	u16 version
+	6	u16 number of sections
+	8	u32 game crc
+	12	u32 GCACHE_ORDER in the byte order the sections are in
+	16	sections of u32 id, u32 key, u32 offset, u32 size
+	data	each section starting on a GCACHE_ALIGN boundary
+
+the header and table are little endian.  a section is whatever its owner
+wrote, in the writer's byte order, so a file from another byte order is
+thrown away.
+*/
+
+#define MEM_TAG MEM_CACHE
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../agi.h"
+#include "game_cache.h"
+
+#include "agi_file.h"
+#include "endian.h"
+#include "mem_wrap.h"
+#include "sys_dir.h"
+
+#define GCACHE_FILE "nagi.nagicache"
+#define GCACHE_TEMP "nagi.nagicache.tmp"
+#define GCACHE_VERSION 1
+#define GCACHE_ORDER 0x01020304u
+#define GCACHE_HEAD_SIZE 16
+#define GCACHE_ENTRY_SIZE 16
+#define GCACHE_ALIGN 16
+#define GCACHE_MAX 32
+
+static u8 *gcache_data = 0;
+static size_t gcache_size = 0;
+static u8 gcache_mapped = 0;
+static u16 gcache_count = 0;
+
+void gcache_open(void)
+{
+	FILE *stream;
+	u32 order, off, size;
+	u16 i;
+	u8 *entry;
+
+	gcache_close();
+
+	// without a crc there's nothing to tell a changed game by
+	if (c_game_crc == 0)
+		return;
+
+	dir_preset_change(DIR_PRESET_GAME);
+	stream = fopen_nocase(GCACHE_FILE);
+	if (stream == 0)
+		return;
+	gcache_data = file_map(stream, &gcache_size);
+	fclose(stream);
+	if (gcache_data != 0)
+		gcache_mapped = 1;
+	else
+	{
+		gcache_data = file_to_buf(GCACHE_FILE);
+		gcache_size = file_buf_size;
+		if (gcache_data == 0)
+			return;
+	}
+
+	if (gcache_size < GCACHE_HEAD_SIZE)
+		goto bad_file;
+	memcpy(&order, gcache_data + 12, 4);
+	if ( (memcmp(gcache_data, "NGCH", 4) != 0) ||
+		(load_le_16(gcache_data + 4) != GCACHE_VERSION) || (order != GCACHE_ORDER) ||
+		(load_le_32(gcache_data + 8) != c_game_crc) )
+		goto bad_file;
+
+	gcache_count = load_le_16(gcache_data + 6);
+	if ( (gcache_count > GCACHE_MAX) ||
+		((size_t)GCACHE_HEAD_SIZE + gcache_count * GCACHE_ENTRY_SIZE > gcache_size) )
+		goto bad_file;
+	for (i = 0; i < gcache_count; i++)
+	{
+		entry = gcache_data + GCACHE_HEAD_SIZE + i * GCACHE_ENTRY_SIZE;
+		off = load_le_32(entry + 8);
+		size = load_le_32(entry + 12);
+		if ( (off > gcache_size) || (size > gcache_size - off) || (off % GCACHE_ALIGN != 0) )
+			goto bad_file;
+	}
+	return;
+
+bad_file:
+	// another game's, or from an older nagi.  it's written again as sections are stored
+	gcache_close();
+}
+
+void gcache_close(void)
+{
+	if (gcache_data != 0)
+	{
+		if (gcache_mapped)
+			file_unmap(gcache_data, gcache_size);
+		else
+			a_free(gcache_data);
+	}
+	gcache_data = 0;
+	gcache_size = 0;
+	gcache_mapped = 0;
+	gcache_count = 0;
+}
+
+static u8 *gcache_entry(u32 id)
+{
+	u8 *entry;
+	u16 i;
+
+	for (i = 0; i < gcache_count; i++)
+	{
+		entry = gcache_data + GCACHE_HEAD_SIZE + i * GCACHE_ENTRY_SIZE;
+		if (load_le_32(entry) == id)
+			return entry;
+	}
+	return 0;
+}
+
+const u8 *gcache_find(u32 id, u32 key, size_t *size)
+{
+	u8 *entry;
+
+	entry = gcache_entry(id);
+	if ( (entry == 0) || (load_le_32(entry + 4) != key) )
+		return 0;
+	*size = load_le_32(entry + 12);
+	return gcache_data + load_le_32(entry + 8);
+}
+
+// pad the file out to the next GCACHE_ALIGN boundary
+static void gcache_align(FILE *stream, u32 *pos)
+{
+	static const u8 zero[GCACHE_ALIGN] = {0};
+	u32 pad;
+
+	pad = (GCACHE_ALIGN - (*pos % GCACHE_ALIGN)) % GCACHE_ALIGN;
+	fwrite(zero, 1, pad, stream);
+	*pos += pad;
+}
+
+static void gcache_write(FILE *stream, u8 *table, u16 *count, u32 *pos,
+	u32 id, u32 key, const void *data, size_t size)
+{
+	u8 *entry;
+
+	gcache_align(stream, pos);
+	fwrite(data, 1, size, stream);
+	entry = table + *count * GCACHE_ENTRY_SIZE;
+	store_le_32(entry, id);
+	store_le_32(entry + 4, key);
+	store_le_32(entry + 8, *pos);
+	store_le_32(entry + 12, (u32)size);
+	*pos += (u32)size;
+	(*count)++;
+}
+
+// the file again with this section in place of the old one
+void gcache_store(u32 id, u32 key, const void *data, size_t size)
+{
+	FILE *stream;
+	u8 head[GCACHE_HEAD_SIZE];
+	u8 table[GCACHE_MAX * GCACHE_ENTRY_SIZE];
+	u8 *entry;
+	u32 pos, order;
+	u16 count, i;
+
+	if ( (c_game_crc == 0) || (size > 0x7FFFFFFF) )
+		return;
+
+	dir_preset_change(DIR_PRESET_GAME);
+	stream = fopen(GCACHE_TEMP, "wb");
+	if (stream == 0)
+	{
+		printf("Unable to write %s\n", GCACHE_TEMP);
+		return;
+	}
+
+	// the table's filled in once the sections are down
+	memset(head, 0, sizeof(head));
+	fwrite(head, 1, sizeof(head), stream);
+	memset(table, 0, sizeof(table));
+	fwrite(table, GCACHE_ENTRY_SIZE, (gcache_count < GCACHE_MAX) ? gcache_count + 1 : GCACHE_MAX, stream);
+	pos = GCACHE_HEAD_SIZE + ((gcache_count < GCACHE_MAX) ? gcache_count + 1 : GCACHE_MAX) * GCACHE_ENTRY_SIZE;
+
+	count = 0;
+	gcache_write(stream, table, &count, &pos, id, key, data, size);
+	for (i = 0; (i < gcache_count) && (count < GCACHE_MAX); i++)
+	{
+		entry = gcache_data + GCACHE_HEAD_SIZE + i * GCACHE_ENTRY_SIZE;
+		if (load_le_32(entry) != id)
+			gcache_write(stream, table, &count, &pos, load_le_32(entry), load_le_32(entry + 4),
+				gcache_data + load_le_32(entry + 8), load_le_32(entry + 12));
+	}
+
+	memcpy(head, "NGCH", 4);
+	store_le_16(head + 4, GCACHE_VERSION);
+	store_le_16(head + 6, count);
+	store_le_32(head + 8, c_game_crc);
+	order = GCACHE_ORDER;
+	memcpy(head + 12, &order, 4);
+	fseek(stream, 0, SEEK_SET);
+	fwrite(head, 1, sizeof(head), stream);
+	fwrite(table, GCACHE_ENTRY_SIZE, count, stream);
+	if (fclose(stream) != 0)
+	{
+		remove(GCACHE_TEMP);
+		return;
+	}
+
+	// windows won't rename over a file that's open or mapped
+	gcache_close();
+	remove(GCACHE_FILE);
+	if (rename(GCACHE_TEMP, GCACHE_FILE) != 0)
+		printf("Unable to write %s\n", GCACHE_FILE);
+	gcache_open();
+}
@@ -0,0 +1,15 @@
+#ifndef NAGI_SYS_GAME_CACHE_H
+#define NAGI_SYS_GAME_CACHE_H
+
+// section ids, four characters
+#define GCACHE_ID(a, b, c, d) (((u32)(a) << 24) | ((u32)(b) << 16) | ((u32)(c) << 8) | (u32)(d))
+#define GCACHE_SAID GCACHE_ID('S', 'A', 'I', 'D')	// said() phrase index
+
+extern void gcache_open(void);
+extern void gcache_close(void);
+// a section made with this key, 0 if there isn't one.  good until the next
+// gcache_store() or gcache_close()
+extern const u8 *gcache_find(u32 id, u32 key, size_t *size);
+extern void gcache_store(u32 id, u32 key, const void *data, size_t size);
+
+#endif /* NAGI_SYS_GAME_CACHE_H */
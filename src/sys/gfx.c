@@ -9,6 +9,13 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define GFX_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#define GFX_NEON 1
+#include <arm_neon.h>
+#endif
 
 /* OTHER headers	---	---	---	---	---	---	--- */
 
@@ -23,10 +30,14 @@
 #include "chargen.h"
 
 #include "sdl_vid.h"
+#include "gfx_scale.h"
+#include "replay.h"
+#include "startup.h"
 
 
 
 /* PROTOTYPES	---	---	---	---	---	---	--- */
+static void gfx_scale_bind(void);
 
 /* VARIABLES	---	---	---	---	---	---	--- */
 
@@ -107,33 +118,49 @@ u8 *gfx_picbuff = 0;	// created in gfx_init();
 u8 gfx_picbuffrow = 0;	// set after fonts are init'd
 int gfx_picbuffrotate = 0;
 
+// gfx_update() and gfx_blit() for this renderer and scale, 0 to go
+// through the loops below
+static GFX_SCALE_RECT gfx_update_rect = 0;
+static GFX_SCALE_RECT gfx_blit_rect = 0;
+
 /* CODE	---	---	---	---	---	---	---	--- */
 
 // gfx_init
 void gfx_init(void)
 {
+	u64 t;
+
 	// gfx drvr init
+	t = startup_now();
 	vid_init();
+	startup_phase("vid_init", t);
 
 	// init rendererrerer
+	t = startup_now();
 	render_init();
+	startup_phase("render_init", t);
 
 	// chargen init
+	t = startup_now();
 	ch_init();
+	startup_phase("ch_init", t);
 	// **************************
 
 	// do something to calc this from render/font
 	gfx_size.w = 40 * font_size.w;
 	gfx_size.h = 25 * font_size.h;
 	
+	t = startup_now();
 	vid_display(&gfx_size, c_vid_full_screen); // create a video surface
+	startup_phase("vid_display", t);
 
 	// setup the palette
 	gfx_palette_update();
+	gfx_scale_bind();
 
 	// init pic buffer
 	if (gfx_picbuff == 0)
-		gfx_picbuff = (u8 *)a_malloc(PICBUFF_WIDTH*PICBUFF_HEIGHT);
+		gfx_picbuff = (u8 *)a_malloc_aligned(PICBUFF_WIDTH*PICBUFF_HEIGHT, PICBUFF_ALIGN);
 
 	sbuff_fill(0x40);
 	table_init();
@@ -154,7 +181,7 @@ void gfx_shutdown()
 	vid_shutdown();
 	if (gfx_picbuff != 0)
 	{
-		a_free(gfx_picbuff);
+		a_free_aligned(gfx_picbuff);
 		gfx_picbuff = 0;
 	}
 	printf("gfx_shutdown: done.\n"); fflush(stdout);
@@ -173,6 +200,21 @@ void gfx_reinit()
 	
 	vid_display(&gfx_size, c_vid_full_screen);
 	gfx_palette_update();
+	gfx_scale_bind();
+}
+
+// ch_init() settles the scale after render_init() has the renderer, so
+// both are known here.  a ctrl-r comes back through gfx_reinit()
+static void gfx_scale_bind(void)
+{
+	gfx_update_rect = gfx_scale_rect_pick(c_vid_scale);
+	gfx_blit_rect = 0;
+	if (rend_drv->scale_y != 1)
+		return;
+	if (rend_drv->type == R_EGA)
+		gfx_blit_rect = gfx_scale_ega_rect_pick(c_vid_scale);
+	else if ( (rend_drv->type == R_CGA0) || (rend_drv->type == R_CGA1) )
+		gfx_blit_rect = gfx_scale_cga_rect_pick(c_vid_scale);
 }
 
 // update the render buffer onto the screen
@@ -186,7 +228,12 @@ void gfx_update(u16 rect_x, u16 rect_y, u16 rect_w, u16 rect_h)
 
 	u16 sdl_x, sdl_y, sdl_w, sdl_h;
 	u16 rend_x, rend_y, rend_w, rend_h;
-	u16 h_count, w_count, i;
+	u16 h_count, i;
+	GFX_SCALE_ROW scale_row;
+
+	// rend_buf has it, there's no window to scale it into
+	if (replay_headless)
+		return;
 
 	rend_x = rect_x * rend_drv->scale_x;
 	rend_y = rend_drv->scale_y*(rect_y + 1) - 1;
@@ -199,20 +246,20 @@ void gfx_update(u16 rect_x, u16 rect_y, u16 rect_w, u16 rect_h)
 	sdl_h = rend_h * c_vid_scale;
 
 	
+	scale_row = gfx_scale_pick(c_vid_scale);
 	vid_lock();
 
 	r_buf = rend_buf + rend_y*rend_drv->w + rend_x;
 	sdl_buf = (u8 *)vid_getbuf() + sdl_y*vid_getlinesize() + sdl_x;
 
-	for (h_count=rend_h; h_count!=0; h_count--)
+	if (gfx_update_rect != 0)
+		gfx_update_rect(sdl_buf, vid_getlinesize(), r_buf, rend_drv->w, rend_w, rend_h);
+	else for (h_count=rend_h; h_count!=0; h_count--)
 	{
 		// draw line
-		for (w_count=rend_w; w_count!=0; w_count--)
-		{
-			memset(sdl_buf, (*r_buf)&0xF, c_vid_scale);
-			sdl_buf += c_vid_scale;
-			r_buf++;
-		}
+		scale_row(sdl_buf, r_buf, rend_w, c_vid_scale);
+		sdl_buf += rend_w*c_vid_scale;
+		r_buf += rend_w;
 
 		// repeat line
 		if (c_vid_scale != 1)
@@ -241,6 +288,57 @@ void gfx_update(u16 rect_x, u16 rect_y, u16 rect_w, u16 rect_h)
 	}
 }
 
+// the picture buffer onto the screen without going through rend_buf.  the
+// renderer's row kernel splits the colours and scales in one go
+void gfx_blit(u16 rect_x, u16 rect_y, u16 rect_w, u16 rect_h)
+{
+	u8 *sdl_buf;
+	u8 *sdl_line;
+	u8 *p_buf;
+
+	u16 sdl_x, sdl_y, sdl_w, sdl_h;
+	u16 scale_y;
+	u16 h_count, i;
+
+	if (replay_headless)
+		return;
+
+	scale_y = rend_drv->scale_y * c_vid_scale;
+	sdl_x = rect_x * rend_drv->scale_x * c_vid_scale;
+	sdl_y = scale_y*(rect_y + 1) - 1   + state.window_row_min * font_size.h;
+	sdl_w = rect_w * rend_drv->scale_x * c_vid_scale;
+	sdl_h = rect_h * scale_y;
+
+	vid_lock();
+
+	p_buf = gfx_picbuff + rect_y*PICBUFF_WIDTH + rect_x;
+	sdl_buf = (u8 *)vid_getbuf() + sdl_y*vid_getlinesize() + sdl_x;
+
+	if (gfx_blit_rect != 0)
+		gfx_blit_rect(sdl_buf, vid_getlinesize(), p_buf, PICBUFF_WIDTH, rect_w, rect_h);
+	else for (h_count=rect_h; h_count!=0; h_count--)
+	{
+		rend_drv->func_row(sdl_buf, p_buf, rect_w, c_vid_scale);
+
+		// repeat line
+		sdl_line = sdl_buf;
+		for (i=1; i<scale_y; i++)
+		{
+			sdl_buf -= vid_getlinesize();
+			memcpy(sdl_buf, sdl_line, sdl_w);
+		}
+		sdl_buf -= vid_getlinesize();
+		p_buf -= PICBUFF_WIDTH;
+	}
+
+	vid_unlock();
+
+	{
+		POS sdl_pos = {sdl_x, sdl_y-sdl_h+1};
+		AGISIZE sdl_size = {sdl_w, sdl_h};
+		vid_update(&sdl_pos, &sdl_size);
+	}
+}
 
 void gfx_shake(int count)
 {
@@ -296,15 +394,30 @@ void gfx_clear(void)
 // updates the picture buffer on the screen.
 void gfx_picbuff_update(void)
 {
+	// priority in the low nibble so it's the one drawn.  the buffer's a
+	// whole number of aligned vectors
 	if (gfx_picbuffrotate)
 	{
-		u16 i;
 		u8 *pb = gfx_picbuff;
-		for (i=0; i<(160*168); i++)
+		u8 *end = gfx_picbuff + PICBUFF_WIDTH*PICBUFF_HEIGHT;
+#if defined(GFX_SSE2)
+		const __m128i lo = _mm_set1_epi8(0x0F);
+		for (; pb < end; pb += 16)
 		{
-			*pb = (*pb<<4) | (*pb>>4);
-			pb++;
+			__m128i v = _mm_load_si128((const __m128i *)pb);
+			v = _mm_or_si128(_mm_andnot_si128(lo, _mm_slli_epi16(v, 4)),
+				_mm_and_si128(lo, _mm_srli_epi16(v, 4)));
+			_mm_store_si128((__m128i *)pb, v);
+		}
+#elif defined(GFX_NEON)
+		for (; pb < end; pb += 16)
+		{
+			uint8x16_t v = vld1q_u8(pb);
+			vst1q_u8(pb, vorrq_u8(vshlq_n_u8(v, 4), vshrq_n_u8(v, 4)));
 		}
+#endif
+		for (; pb < end; pb++)
+			*pb = (*pb<<4) | (*pb>>4);
 	}
 
 	render_update(0, 167, 160, 168);
@@ -5,6 +5,8 @@
 /* VARIABLES	---	---	---	---	---	---	--- */
 #define PICBUFF_WIDTH (160)
 #define PICBUFF_HEIGHT (168)
+// gfx_picbuff's alignment.  a row is 5 of these so every row starts on one
+#define PICBUFF_ALIGN (32)
 
 #define PAL_16 0
 #define PAL_TEXT 1
@@ -32,6 +34,7 @@ extern int gfx_picbuffrotate;
 extern void gfx_init(void);
 extern void gfx_shutdown(void);
 extern void gfx_update(u16 rect_x, u16 rect_y, u16 rect_w, u16 rect_h);
+extern void gfx_blit(u16 rect_x, u16 rect_y, u16 rect_w, u16 rect_h);
 extern void gfx_shake(int count);
 extern void gfx_msgbox(int x, int y, int w, int h, u8 bg, u8 line);
 extern void gfx_palette_update(void);
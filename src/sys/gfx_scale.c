@@ -0,0 +1,443 @@
+/* FUNCTION list 	---	---	---	---	---	---	---
+gfx_scale_pick
+gfx_scale_cga_pick
+gfx_scale_rect_pick
+gfx_scale_ega_rect_pick
+gfx_scale_cga_rect_pick
+*/
+
+/*
+Row expansion for gfx_update(), and for gfx_blit() with the ega renderer
+
+Every render pixel becomes c_vid_scale screen pixels, masked to the 16
+colours.  The common scales get a kernel that does 16 pixels per step
+with SSE2 (SSSE3 for 3x) or NEON, picked once per update from a table;
+the rest of a row and other scales go through the plain loop.
+
+The cga renderer splits every picture byte into its two 2 bit pixels
+first.  Its kernels do the split on 16 bytes at once with a shift and
+two masks, and interleave the halves into the 32 (or 64, 128) bytes out.
+
+Whole rects have a function for each renderer and scale, made by
+SCALE_RECT() with the scale a constant: the row kernel is called
+directly so it's inlined, and the rows repeated under it are a fixed
+number of fixed size copies.  gfx.c picks them when the scale is known
+and keeps its own loops for the scales without one.
+*/
+
+/* BASE headers	---	---	---	---	---	---	--- */
+#include "../agi.h"
+
+/* LIBRARY headers	---	---	---	---	---	---	--- */
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define GFX_SCALE_SSE2 1
+#include <emmintrin.h>
+#ifdef __SSSE3__
+#define GFX_SCALE_SSSE3 1
+#include <tmmintrin.h>
+#endif
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#define GFX_SCALE_NEON 1
+#include <arm_neon.h>
+#endif
+
+/* OTHER headers	---	---	---	---	---	---	--- */
+#include "gfx_scale.h"
+
+/* PROTOTYPES	---	---	---	---	---	---	--- */
+static void scale_any(u8 *dst, const u8 *src, u16 width, u16 scale);
+static void scale_1(u8 *dst, const u8 *src, u16 width, u16 scale);
+static void scale_2(u8 *dst, const u8 *src, u16 width, u16 scale);
+static void scale_3(u8 *dst, const u8 *src, u16 width, u16 scale);
+static void scale_4(u8 *dst, const u8 *src, u16 width, u16 scale);
+static void cga_any(u8 *dst, const u8 *src, u16 width, u16 scale);
+static void cga_1(u8 *dst, const u8 *src, u16 width, u16 scale);
+static void cga_2(u8 *dst, const u8 *src, u16 width, u16 scale);
+static void cga_4(u8 *dst, const u8 *src, u16 width, u16 scale);
+
+// a rect of rows, bottom up, each expanded by row() at a constant scale
+// into out bytes per pixel and repeated to make it rows high
+#define SCALE_RECT(name, row, scale, out, rows)					\
+static void name(u8 *dst, int pitch, const u8 *src, int src_pitch,		\
+			u16 width, u16 height)						\
+{										\
+	int i;									\
+	for (; height != 0; height--)						\
+	{									\
+		row(dst, src, width, (scale));					\
+		for (i = 1; i < (rows); i++)					\
+			memcpy(dst - i*pitch, dst, width*(out));		\
+		dst -= pitch*(rows);						\
+		src -= src_pitch;						\
+	}									\
+}
+
+// rend_buf, already in render pixels
+SCALE_RECT(rect_1, scale_1, 1, 1, 1)
+SCALE_RECT(rect_2, scale_2, 2, 2, 2)
+SCALE_RECT(rect_3, scale_3, 3, 3, 3)
+SCALE_RECT(rect_4, scale_4, 4, 4, 4)
+
+// the picture buffer, each pixel doubled across
+SCALE_RECT(ega_rect_1, scale_2, 2, 2, 1)
+SCALE_RECT(ega_rect_2, scale_4, 4, 4, 2)
+SCALE_RECT(ega_rect_3, scale_any, 6, 6, 3)
+SCALE_RECT(ega_rect_4, scale_any, 8, 8, 4)
+
+// the picture buffer, each pixel split into two
+SCALE_RECT(cga_rect_1, cga_1, 1, 2, 1)
+SCALE_RECT(cga_rect_2, cga_2, 2, 4, 2)
+SCALE_RECT(cga_rect_3, cga_any, 3, 6, 3)
+SCALE_RECT(cga_rect_4, cga_4, 4, 8, 4)
+
+/* VARIABLES	---	---	---	---	---	---	--- */
+
+static const GFX_SCALE_ROW scale_table[] =
+{
+	scale_any,
+	scale_1,
+	scale_2,
+	scale_3,
+	scale_4,
+};
+
+#define SCALE_TABLE_SIZE (sizeof(scale_table) / sizeof(scale_table[0]))
+
+static const GFX_SCALE_ROW cga_table[] =
+{
+	cga_any,
+	cga_1,
+	cga_2,
+	cga_any,
+	cga_4,
+};
+
+#define CGA_TABLE_SIZE (sizeof(cga_table) / sizeof(cga_table[0]))
+
+// by scale, 0 where there's none
+static const GFX_SCALE_RECT rect_table[] =
+{
+	0,
+	rect_1,
+	rect_2,
+	rect_3,
+	rect_4,
+};
+
+static const GFX_SCALE_RECT ega_rect_table[] =
+{
+	0,
+	ega_rect_1,
+	ega_rect_2,
+	ega_rect_3,
+	ega_rect_4,
+};
+
+static const GFX_SCALE_RECT cga_rect_table[] =
+{
+	0,
+	cga_rect_1,
+	cga_rect_2,
+	cga_rect_3,
+	cga_rect_4,
+};
+
+#define RECT_TABLE_SIZE (sizeof(rect_table) / sizeof(rect_table[0]))
+
+/* CODE	---	---	---	---	---	---	---	--- */
+
+GFX_SCALE_ROW gfx_scale_pick(u16 scale)
+{
+	if (scale < SCALE_TABLE_SIZE)
+		return scale_table[scale];
+	return scale_any;
+}
+
+// the same for the cga renderer, each picture pixel being two screen
+// pixels of scale across
+GFX_SCALE_ROW gfx_scale_cga_pick(u16 scale)
+{
+	if (scale < CGA_TABLE_SIZE)
+		return cga_table[scale];
+	return cga_any;
+}
+
+GFX_SCALE_RECT gfx_scale_rect_pick(u16 scale)
+{
+	if (scale < RECT_TABLE_SIZE)
+		return rect_table[scale];
+	return 0;
+}
+
+GFX_SCALE_RECT gfx_scale_ega_rect_pick(u16 scale)
+{
+	if (scale < RECT_TABLE_SIZE)
+		return ega_rect_table[scale];
+	return 0;
+}
+
+GFX_SCALE_RECT gfx_scale_cga_rect_pick(u16 scale)
+{
+	if (scale < RECT_TABLE_SIZE)
+		return cga_rect_table[scale];
+	return 0;
+}
+
+// the plain loop, also finishes the rows the kernels leave
+static void scale_any(u8 *dst, const u8 *src, u16 width, u16 scale)
+{
+	for (; width != 0; width--)
+	{
+		memset(dst, (*src)&0xF, scale);
+		dst += scale;
+		src++;
+	}
+}
+
+static void scale_1(u8 *dst, const u8 *src, u16 width, u16 scale)
+{
+#if defined(GFX_SCALE_SSE2)
+	const __m128i mask = _mm_set1_epi8(0x0F);
+	for (; width >= 16; width -= 16)
+	{
+		__m128i p = _mm_and_si128(_mm_loadu_si128((const __m128i *)src), mask);
+		_mm_storeu_si128((__m128i *)dst, p);
+		src += 16;
+		dst += 16;
+	}
+#elif defined(GFX_SCALE_NEON)
+	const uint8x16_t mask = vdupq_n_u8(0x0F);
+	for (; width >= 16; width -= 16)
+	{
+		vst1q_u8(dst, vandq_u8(vld1q_u8(src), mask));
+		src += 16;
+		dst += 16;
+	}
+#endif
+	scale_any(dst, src, width, scale);
+}
+
+static void scale_2(u8 *dst, const u8 *src, u16 width, u16 scale)
+{
+#if defined(GFX_SCALE_SSE2)
+	const __m128i mask = _mm_set1_epi8(0x0F);
+	for (; width >= 16; width -= 16)
+	{
+		__m128i p = _mm_and_si128(_mm_loadu_si128((const __m128i *)src), mask);
+		_mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi8(p, p));
+		_mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi8(p, p));
+		src += 16;
+		dst += 32;
+	}
+#elif defined(GFX_SCALE_NEON)
+	const uint8x16_t mask = vdupq_n_u8(0x0F);
+	for (; width >= 16; width -= 16)
+	{
+		uint8x16x2_t out;
+		out.val[0] = out.val[1] = vandq_u8(vld1q_u8(src), mask);
+		vst2q_u8(dst, out);
+		src += 16;
+		dst += 32;
+	}
+#endif
+	scale_any(dst, src, width, scale);
+}
+
+static void scale_3(u8 *dst, const u8 *src, u16 width, u16 scale)
+{
+#if defined(GFX_SCALE_SSSE3)
+	const __m128i mask = _mm_set1_epi8(0x0F);
+	// source byte for each of the 48 bytes out
+	const __m128i pick0 = _mm_setr_epi8(0,0,0, 1,1,1, 2,2,2, 3,3,3, 4,4,4, 5);
+	const __m128i pick1 = _mm_setr_epi8(5,5, 6,6,6, 7,7,7, 8,8,8, 9,9,9, 10,10);
+	const __m128i pick2 = _mm_setr_epi8(10, 11,11,11, 12,12,12, 13,13,13, 14,14,14, 15,15,15);
+	for (; width >= 16; width -= 16)
+	{
+		__m128i p = _mm_and_si128(_mm_loadu_si128((const __m128i *)src), mask);
+		_mm_storeu_si128((__m128i *)dst, _mm_shuffle_epi8(p, pick0));
+		_mm_storeu_si128((__m128i *)(dst + 16), _mm_shuffle_epi8(p, pick1));
+		_mm_storeu_si128((__m128i *)(dst + 32), _mm_shuffle_epi8(p, pick2));
+		src += 16;
+		dst += 48;
+	}
+#elif defined(GFX_SCALE_NEON)
+	const uint8x16_t mask = vdupq_n_u8(0x0F);
+	for (; width >= 16; width -= 16)
+	{
+		uint8x16x3_t out;
+		out.val[0] = out.val[1] = out.val[2] = vandq_u8(vld1q_u8(src), mask);
+		vst3q_u8(dst, out);
+		src += 16;
+		dst += 48;
+	}
+#endif
+	scale_any(dst, src, width, scale);
+}
+
+static void scale_4(u8 *dst, const u8 *src, u16 width, u16 scale)
+{
+#if defined(GFX_SCALE_SSE2)
+	const __m128i mask = _mm_set1_epi8(0x0F);
+	for (; width >= 16; width -= 16)
+	{
+		__m128i p = _mm_and_si128(_mm_loadu_si128((const __m128i *)src), mask);
+		__m128i lo = _mm_unpacklo_epi8(p, p);
+		__m128i hi = _mm_unpackhi_epi8(p, p);
+		_mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi16(lo, lo));
+		_mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi16(lo, lo));
+		_mm_storeu_si128((__m128i *)(dst + 32), _mm_unpacklo_epi16(hi, hi));
+		_mm_storeu_si128((__m128i *)(dst + 48), _mm_unpackhi_epi16(hi, hi));
+		src += 16;
+		dst += 64;
+	}
+#elif defined(GFX_SCALE_NEON)
+	const uint8x16_t mask = vdupq_n_u8(0x0F);
+	for (; width >= 16; width -= 16)
+	{
+		uint8x16x4_t out;
+		out.val[0] = out.val[1] = out.val[2] = out.val[3] = vandq_u8(vld1q_u8(src), mask);
+		vst4q_u8(dst, out);
+		src += 16;
+		dst += 64;
+	}
+#endif
+	scale_any(dst, src, width, scale);
+}
+
+// high bit pair then low bit pair, each scale wide
+static void cga_any(u8 *dst, const u8 *src, u16 width, u16 scale)
+{
+	if (scale == 1)
+	{
+		for (; width != 0; width--)
+		{
+			*(dst++) = (*src & 0xC)>>2;
+			*(dst++) = *(src++) & 0x3;
+		}
+		return;
+	}
+	for (; width != 0; width--)
+	{
+		memset(dst, (*src & 0xC)>>2, scale);
+		memset(dst + scale, *src & 0x3, scale);
+		dst += scale*2;
+		src++;
+	}
+}
+
+static void cga_1(u8 *dst, const u8 *src, u16 width, u16 scale)
+{
+#if defined(GFX_SCALE_SSE2)
+	const __m128i mask = _mm_set1_epi8(0x03);
+	for (; width >= 16; width -= 16)
+	{
+		__m128i p = _mm_loadu_si128((const __m128i *)src);
+		// a 16 bit shift, the mask drops what crossed over from the next byte
+		__m128i hi = _mm_and_si128(_mm_srli_epi16(p, 2), mask);
+		__m128i lo = _mm_and_si128(p, mask);
+		_mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi8(hi, lo));
+		src += 16;
+		dst += 32;
+	}
+#elif defined(GFX_SCALE_NEON)
+	const uint8x16_t mask = vdupq_n_u8(0x03);
+	for (; width >= 16; width -= 16)
+	{
+		uint8x16_t p = vld1q_u8(src);
+		uint8x16x2_t out;
+		out.val[0] = vandq_u8(vshrq_n_u8(p, 2), mask);
+		out.val[1] = vandq_u8(p, mask);
+		vst2q_u8(dst, out);
+		src += 16;
+		dst += 32;
+	}
+#endif
+	cga_any(dst, src, width, scale);
+}
+
+static void cga_2(u8 *dst, const u8 *src, u16 width, u16 scale)
+{
+#if defined(GFX_SCALE_SSE2)
+	const __m128i mask = _mm_set1_epi8(0x03);
+	for (; width >= 16; width -= 16)
+	{
+		__m128i p = _mm_loadu_si128((const __m128i *)src);
+		__m128i hi = _mm_and_si128(_mm_srli_epi16(p, 2), mask);
+		__m128i lo = _mm_and_si128(p, mask);
+		__m128i a = _mm_unpacklo_epi8(hi, lo);
+		__m128i b = _mm_unpackhi_epi8(hi, lo);
+		_mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi8(a, a));
+		_mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi8(a, a));
+		_mm_storeu_si128((__m128i *)(dst + 32), _mm_unpacklo_epi8(b, b));
+		_mm_storeu_si128((__m128i *)(dst + 48), _mm_unpackhi_epi8(b, b));
+		src += 16;
+		dst += 64;
+	}
+#elif defined(GFX_SCALE_NEON)
+	const uint8x16_t mask = vdupq_n_u8(0x03);
+	for (; width >= 16; width -= 16)
+	{
+		uint8x16_t p = vld1q_u8(src);
+		uint8x16x4_t out;
+		out.val[0] = out.val[1] = vandq_u8(vshrq_n_u8(p, 2), mask);
+		out.val[2] = out.val[3] = vandq_u8(p, mask);
+		vst4q_u8(dst, out);
+		src += 16;
+		dst += 64;
+	}
+#endif
+	cga_any(dst, src, width, scale);
+}
+
+static void cga_4(u8 *dst, const u8 *src, u16 width, u16 scale)
+{
+#if defined(GFX_SCALE_SSE2)
+	const __m128i mask = _mm_set1_epi8(0x03);
+	__m128i pair[2], q;
+	int i;
+	for (; width >= 16; width -= 16)
+	{
+		__m128i p = _mm_loadu_si128((const __m128i *)src);
+		__m128i hi = _mm_and_si128(_mm_srli_epi16(p, 2), mask);
+		__m128i lo = _mm_and_si128(p, mask);
+		pair[0] = _mm_unpacklo_epi8(hi, lo);
+		pair[1] = _mm_unpackhi_epi8(hi, lo);
+		for (i = 0; i < 2; i++)
+		{
+			q = _mm_unpacklo_epi8(pair[i], pair[i]);
+			_mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi16(q, q));
+			_mm_storeu_si128((__m128i *)(dst + 16), _mm_unpackhi_epi16(q, q));
+			q = _mm_unpackhi_epi8(pair[i], pair[i]);
+			_mm_storeu_si128((__m128i *)(dst + 32), _mm_unpacklo_epi16(q, q));
+			_mm_storeu_si128((__m128i *)(dst + 48), _mm_unpackhi_epi16(q, q));
+			dst += 64;
+		}
+		src += 16;
+	}
+#elif defined(GFX_SCALE_NEON)
+	const uint8x16_t mask = vdupq_n_u8(0x03);
+	uint8x16x2_t pair, z, w;
+	int i, j;
+	for (; width >= 16; width -= 16)
+	{
+		uint8x16_t p = vld1q_u8(src);
+		pair = vzipq_u8(vandq_u8(vshrq_n_u8(p, 2), mask), vandq_u8(p, mask));
+		for (i = 0; i < 2; i++)
+		{
+			z = vzipq_u8(pair.val[i], pair.val[i]);
+			for (j = 0; j < 2; j++)
+			{
+				w = vzipq_u8(z.val[j], z.val[j]);
+				vst1q_u8(dst, w.val[0]);
+				vst1q_u8(dst + 16, w.val[1]);
+				dst += 32;
+			}
+		}
+		src += 16;
+	}
+#endif
+	cga_any(dst, src, width, scale);
+}
@@ -0,0 +1,28 @@
+#ifndef NAGI_SYS_GFX_SCALE_H
+#define NAGI_SYS_GFX_SCALE_H
+
+/* STRUCTURES	---	---	---	---	---	---	--- */
+
+// expand one row of render pixels into screen pixels: each one masked to
+// the 16 colours and repeated scale times across
+typedef void (*GFX_SCALE_ROW)(u8 *dst, const u8 *src, u16 width, u16 scale);
+
+// a rect from its bottom left pixel up, each row expanded and repeated
+// down the screen for one renderer at one scale.  pitch and src_pitch are
+// the bytes between rows
+typedef void (*GFX_SCALE_RECT)(u8 *dst, int pitch, const u8 *src, int src_pitch,
+				u16 width, u16 height);
+
+/* FUNCTIONS	---	---	---	---	---	---	--- */
+
+// the row function for a scale, with vector kernels for 1x to 4x
+extern GFX_SCALE_ROW gfx_scale_pick(u16 scale);
+// the same for cga, each byte split into its two 2 bit pixels first
+extern GFX_SCALE_ROW gfx_scale_cga_pick(u16 scale);
+// the rect function for a scale from 1x to 4x, 0 for the rest.  rend_buf,
+// and the picture buffer through the ega or the cga renderer
+extern GFX_SCALE_RECT gfx_scale_rect_pick(u16 scale);
+extern GFX_SCALE_RECT gfx_scale_ega_rect_pick(u16 scale);
+extern GFX_SCALE_RECT gfx_scale_cga_rect_pick(u16 scale);
+
+#endif /* NAGI_SYS_GFX_SCALE_H */
@@ -0,0 +1,203 @@
+/*
+Performance hud
+
+shift+F12 (or hud=1 in nagi.ini) shows how the cycles are going over the
+game: how long a cycle takes against the V10 delay it's meant to take,
+the time spent in logic, objtable_update(), rendering and presenting,
+the pixels uploaded to the texture, the glyph and picture caches' hit
+rates, the sound device's buffer, how far ahead of the speakers the
+sound is, the audio callback's average and longest time, the times sound
+came late and what the heap holds (mem_wrap.h).  with an llm it adds the
+requests queued and running and the tokens per second being generated.
+
+the numbers are the profiler's cycle parts and the llm telemetry, taken
+twice a second and shown as the change since the last time, so a room
+that got slow shows up straight away.  it's drawn on the renderer after
+the game's texture so captures and streams don't see it.
+*/
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../agi.h"
+#include "hud.h"
+
+#include "chargen.h"
+#include "mem_wrap.h"
+#include "profile.h"
+#include "sdl_vid.h"
+#include "../picture/pic_cache.h"
+#include "../sound/pcm_out_sdl.h"
+
+#ifdef NAGI_ENABLE_LLM
+#include "../llm_global.h"
+#endif
+
+// the counters at the last sample
+struct hud_sample_struct
+{
+	Uint64 ns;
+	u64 cycles;
+	u64 sub[PROFILE_SUB_MAX];
+	u64 uploaded;
+	u32 glyph_hits;
+	u32 glyph_misses;
+	u32 pic_hits;
+	u32 pic_misses;
+	u32 tokens;
+};
+typedef struct hud_sample_struct HUD_SAMPLE;
+
+u8 hud_on = 0;
+
+static HUD_SAMPLE hud_last;
+static char hud_line[HUD_LINES][HUD_LINE_SIZE];
+static int hud_total = 0;
+
+static void hud_take(HUD_SAMPLE *s)
+{
+#ifdef NAGI_ENABLE_LLM
+	nagi_llm_stats_t stats;
+#endif
+	u16 i;
+
+	s->ns = SDL_GetTicksNS();
+	s->cycles = profile_cycles_total();
+	for (i = 0; i < PROFILE_SUB_MAX; i++)
+		s->sub[i] = profile_sub_ticks(i);
+	s->uploaded = vid_uploaded();
+	s->glyph_hits = ch_glyph_hits;
+	s->glyph_misses = ch_glyph_misses;
+	s->pic_hits = pic_cache_hits;
+	s->pic_misses = pic_cache_misses;
+	s->tokens = 0;
+#ifdef NAGI_ENABLE_LLM
+	if ( (g_llm != 0) && nagi_llm_get_stats(g_llm, &stats) )
+		s->tokens = stats.op[NAGI_LLM_OP_GENERATE].generated_tokens;
+#endif
+}
+
+// percent of lookups that hit, or a dash with none
+static void hud_rate(char *buff, size_t size, u32 hits, u32 misses)
+{
+	if (hits + misses == 0)
+		snprintf(buff, size, "   -");
+	else
+		snprintf(buff, size, "%3u%%", (unsigned)(hits * 100u / (hits + misses)));
+}
+
+// bytes in a few characters
+static void hud_size(char *buff, size_t size, u32 bytes)
+{
+	if (bytes >= 10u << 20)
+		snprintf(buff, size, "%uM", (unsigned)(bytes >> 20));
+	else if (bytes >= 10u << 10)
+		snprintf(buff, size, "%uK", (unsigned)(bytes >> 10));
+	else
+		snprintf(buff, size, "%u", (unsigned)bytes);
+}
+
+static void hud_build(const HUD_SAMPLE *now)
+{
+	double ms[PROFILE_SUB_MAX];
+	double cycle, budget, busy, freq, secs;
+	char glyph[8], pic[8];
+	char heap[12], peak[12], res[12], cache[12], view[12];
+	MEM_STAT mem;
+	PCM_OUT_SDL_STATS audio;
+	u64 cycles, ticks;
+	u16 i;
+#ifdef NAGI_ENABLE_LLM
+	int queued, running;
+#endif
+
+	cycles = now->cycles - hud_last.cycles;
+	secs = (double)(now->ns - hud_last.ns) / 1e9;
+	ticks = SDL_GetPerformanceFrequency();
+	freq = (double)ticks;
+	for (i = 0; i < PROFILE_SUB_MAX; i++)
+		ms[i] = (cycles != 0) ? (double)(now->sub[i] - hud_last.sub[i]) * 1000.0 / freq / (double)cycles : 0.0;
+
+	hud_total = 0;
+	budget = state.var[V10_DELAY] * 50.0;
+	if (cycles == 0)
+		snprintf(hud_line[hud_total++], HUD_LINE_SIZE, "cycle     -          budget %4.0f ms", budget);
+	else
+	{
+		// the present happens while waiting for the next cycle
+		cycle = secs * 1000.0 / (double)cycles;
+		busy = cycle - ms[PROFILE_DELAY] + ms[PROFILE_PRESENT];
+		if (busy < 0)
+			busy = 0;
+		snprintf(hud_line[hud_total++], HUD_LINE_SIZE, "cycle %6.1f ms  budget %4.0f ms  busy %5.1f ms %3.0f%%",
+			cycle, budget, busy, (budget > 0) ? busy * 100.0 / budget : 0.0);
+	}
+	snprintf(hud_line[hud_total++], HUD_LINE_SIZE, "logic %5.2f  obj %5.2f  render %5.2f  present %5.2f",
+		ms[PROFILE_LOGIC], ms[PROFILE_OBJ], ms[PROFILE_RENDER], ms[PROFILE_PRESENT]);
+
+	hud_rate(glyph, sizeof(glyph), now->glyph_hits - hud_last.glyph_hits,
+		now->glyph_misses - hud_last.glyph_misses);
+	hud_rate(pic, sizeof(pic), now->pic_hits - hud_last.pic_hits,
+		now->pic_misses - hud_last.pic_misses);
+	snprintf(hud_line[hud_total++], HUD_LINE_SIZE, "upload %7.0f px/s  glyphs %s  pics %s",
+		(secs > 0) ? (double)(now->uploaded - hud_last.uploaded) / secs : 0.0, glyph, pic);
+
+	pcm_out_sdl_stats(&audio);
+	snprintf(hud_line[hud_total++], HUD_LINE_SIZE, "audio %6d Hz %5d fr  ahead %5.1f ms  cb %4u/%5u us  late %u",
+		audio.freq, audio.buffer, (double)audio.ahead_us / 1000.0,
+		(unsigned)audio.callback_avg_us, (unsigned)audio.callback_max_us, (unsigned)audio.late);
+
+	mem_stat(MEM_TAG_MAX, &mem);
+	hud_size(heap, sizeof(heap), mem.bytes);
+	hud_size(peak, sizeof(peak), mem.peak);
+	mem_stat(MEM_RES, &mem);
+	hud_size(res, sizeof(res), mem.bytes);
+	mem_stat(MEM_VIEW, &mem);
+	hud_size(view, sizeof(view), mem.bytes);
+	mem_stat(MEM_CACHE, &mem);
+	hud_size(cache, sizeof(cache), mem.bytes);
+	snprintf(hud_line[hud_total++], HUD_LINE_SIZE, "heap %s peak %s  res %s view %s cache %s  v8 %u",
+		heap, peak, res, view, cache, state.var[V08_FREEMEM]);
+
+#ifdef NAGI_ENABLE_LLM
+	if (g_llm != 0)
+	{
+		nagi_llm_async_load(g_llm, &queued, &running);
+		snprintf(hud_line[hud_total++], HUD_LINE_SIZE, "llm %2d queued %2d running %6.1f tok/s  wait %5.2f",
+			queued, running, (secs > 0) ? (double)(now->tokens - hud_last.tokens) / secs : 0.0,
+			ms[PROFILE_LLM]);
+	}
+#endif
+}
+
+void hud_toggle(void)
+{
+	hud_on = !hud_on;
+	hud_total = 0;
+	hud_take(&hud_last);
+	vid_repaint();
+}
+
+// the lines to draw, worked out again once a period has gone by
+int hud_lines(const char **line, int max)
+{
+	HUD_SAMPLE now;
+	int i;
+
+	if (!hud_on)
+		return 0;
+	if (hud_last.ns == 0)
+		hud_take(&hud_last);
+
+	now.ns = SDL_GetTicksNS();
+	if ( (hud_total == 0) || (now.ns - hud_last.ns >= HUD_PERIOD_NS) )
+	{
+		hud_take(&now);
+		hud_build(&now);
+		hud_last = now;
+	}
+
+	for (i = 0; (i < hud_total) && (i < max); i++)
+		line[i] = hud_line[i];
+	return i;
+}
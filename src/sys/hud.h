@@ -0,0 +1,14 @@
+#ifndef NAGI_SYS_HUD_H
+#define NAGI_SYS_HUD_H
+
+#define HUD_LINES 6
+#define HUD_LINE_SIZE 80
+// how often the numbers change
+#define HUD_PERIOD_NS (500 * 1000000ull)
+
+extern u8 hud_on;
+
+extern void hud_toggle(void);
+extern int hud_lines(const char **line, int max);
+
+#endif /* NAGI_SYS_HUD_H */
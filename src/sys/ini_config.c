@@ -5,6 +5,8 @@
 //~ RaDIaT1oN (2002-04-29):
 //~ lowercase file search routines for linux
 
+#define MEM_TAG MEM_TEXT
+
 /* BASE headers	---	---	---	---	---	---	--- */
 //#include "agi.h"
 #include "../agi.h"
@@ -0,0 +1,220 @@
+/*
+LZ4 blocks
+
+what the caches compress their entries with instead of throwing them away
+(res_cache.c, pic_cache.c).  the plain block format, no frames or
+checksums: a token with the literal and match lengths, the literals, a
+16-bit offset back into what's already been written.  a 26k picture
+buffer comes back in a few microseconds, far less than drawing it again
+or reading and unpacking it from the vols.
+
+the compressor is the simple greedy one, one hash table of 4 byte
+sequences and no search.. pictures are mostly long runs of one colour and
+it gets those.
+*/
+
+#define MEM_TAG MEM_CACHE
+
+#include <string.h>
+
+#include "../agi.h"
+#include "lz4.h"
+
+#include "mem_wrap.h"
+
+#define LZ4_MIN_MATCH 4
+// the last 5 bytes are always literals and no match starts in the last 12
+#define LZ4_LAST_LITERALS 5
+#define LZ4_MF_LIMIT 12
+#define LZ4_OFFSET_MAX 65535
+
+#define LZ4_HASH_BITS 12
+
+static u32 lz4_read32(const u8 *p)
+{
+	u32 v;
+
+	memcpy(&v, p, 4);
+	return v;
+}
+
+static u32 lz4_hash(u32 v)
+{
+	return (v * 2654435761u) >> (32 - LZ4_HASH_BITS);
+}
+
+// a length past the token's 15, in 255s
+static u8 *lz4_length(u8 *dst, size_t len)
+{
+	while (len >= 255)
+	{
+		*dst++ = 255;
+		len -= 255;
+	}
+	*dst++ = (u8)len;
+	return dst;
+}
+
+// the literals from anchor, then the match if there is one (len 0 if not)
+static u8 *lz4_sequence(u8 *dst, const u8 *anchor, size_t lit, size_t offset, size_t len)
+{
+	u8 *token;
+
+	token = dst++;
+	*token = (u8)((lit >= 15 ? 15 : lit) << 4);
+	if (lit >= 15)
+		dst = lz4_length(dst, lit - 15);
+	memcpy(dst, anchor, lit);
+	dst += lit;
+	if (len == 0)
+		return dst;
+
+	*dst++ = (u8)(offset & 0xFF);
+	*dst++ = (u8)(offset >> 8);
+	len -= LZ4_MIN_MATCH;
+	*token |= (u8)(len >= 15 ? 15 : len);
+	if (len >= 15)
+		dst = lz4_length(dst, len - 15);
+	return dst;
+}
+
+size_t lz4_compress(const u8 *src, size_t size, u8 *dst, size_t capacity)
+{
+	u32 table[1 << LZ4_HASH_BITS];
+	const u8 *ip, *anchor, *match, *limit, *end;
+	u8 *op, *op_end;
+	size_t lit, len;
+	u32 h;
+
+	memset(table, 0, sizeof(table));
+	ip = src;
+	anchor = src;
+	end = src + size;
+	op = dst;
+	op_end = dst + capacity;
+
+	if (size > LZ4_MF_LIMIT)
+	{
+		limit = end - LZ4_MF_LIMIT;
+		while (ip <= limit)
+		{
+			h = lz4_hash(lz4_read32(ip));
+			match = src + table[h];
+			table[h] = (u32)(ip - src);
+			if ( (match >= ip) || (ip - match > LZ4_OFFSET_MAX) ||
+				(lz4_read32(match) != lz4_read32(ip)) )
+			{
+				ip++;
+				continue;
+			}
+
+			// as far back and forward as it goes
+			while ( (ip > anchor) && (match > src) && (ip[-1] == match[-1]) )
+			{
+				ip--;
+				match--;
+			}
+			len = LZ4_MIN_MATCH;
+			while ( (ip + len < end - LZ4_LAST_LITERALS) && (ip[len] == match[len]) )
+				len++;
+
+			lit = (size_t)(ip - anchor);
+			if ((size_t)(op_end - op) < lit + lit / 255 + len / 255 + 8)
+				return 0;
+			op = lz4_sequence(op, anchor, lit, (size_t)(ip - match), len);
+			ip += len;
+			anchor = ip;
+		}
+	}
+
+	lit = (size_t)(end - anchor);
+	if ((size_t)(op_end - op) < lit + lit / 255 + 2)
+		return 0;
+	op = lz4_sequence(op, anchor, lit, 0, 0);
+	return (size_t)(op - dst);
+}
+
+size_t lz4_decompress(const u8 *src, size_t size, u8 *dst, size_t capacity)
+{
+	const u8 *ip, *end, *match;
+	u8 *op, *op_end;
+	size_t len, offset;
+	u8 token, b;
+
+	ip = src;
+	end = src + size;
+	op = dst;
+	op_end = dst + capacity;
+
+	while (ip < end)
+	{
+		token = *ip++;
+
+		len = token >> 4;
+		if (len == 15)
+			do
+			{
+				if (ip >= end)
+					return 0;
+				b = *ip++;
+				len += b;
+			} while (b == 255);
+		if ( ((size_t)(end - ip) < len) || ((size_t)(op_end - op) < len) )
+			return 0;
+		memcpy(op, ip, len);
+		ip += len;
+		op += len;
+		// the last sequence is only literals
+		if (ip >= end)
+			break;
+
+		if (end - ip < 2)
+			return 0;
+		offset = (size_t)ip[0] | ((size_t)ip[1] << 8);
+		ip += 2;
+		if ( (offset == 0) || (offset > (size_t)(op - dst)) )
+			return 0;
+		len = (token & 15) + LZ4_MIN_MATCH;
+		if ((token & 15) == 15)
+			do
+			{
+				if (ip >= end)
+					return 0;
+				b = *ip++;
+				len += b;
+			} while (b == 255);
+		if ((size_t)(op_end - op) < len)
+			return 0;
+
+		match = op - offset;
+		if (offset >= len)
+			memcpy(op, match, len);
+		else
+		{
+			// overlapping, it repeats the last offset bytes
+			while (len-- != 0)
+				*op++ = *match++;
+			continue;
+		}
+		op += len;
+	}
+	return (size_t)(op - dst);
+}
+
+u8 *lz4_pack(const u8 *src, size_t size, size_t *packed)
+{
+	u8 *scratch, *buff;
+	size_t n;
+
+	scratch = (u8 *)a_malloc(size);
+	n = lz4_compress(src, size, scratch, size - size / 8);
+	buff = 0;
+	if (n != 0)
+	{
+		buff = (u8 *)a_malloc(n);
+		memcpy(buff, scratch, n);
+	}
+	a_free(scratch);
+	*packed = n;
+	return buff;
+}
@@ -0,0 +1,16 @@
+#ifndef NAGI_SYS_LZ4_H
+#define NAGI_SYS_LZ4_H
+
+// the most lz4_compress() can write for size bytes
+#define LZ4_BOUND(size) ((size) + (size) / 255 + 16)
+
+// lz4 block format.  both return the bytes written, 0 if it didn't fit in
+// capacity (or src isn't a block)
+extern size_t lz4_compress(const u8 *src, size_t size, u8 *dst, size_t capacity);
+extern size_t lz4_decompress(const u8 *src, size_t size, u8 *dst, size_t capacity);
+
+// a cache entry's compressed copy, allocated to fit.  0 if it wouldn't save
+// at least an eighth
+extern u8 *lz4_pack(const u8 *src, size_t size, size_t *packed);
+
+#endif /* NAGI_SYS_LZ4_H */
@@ -0,0 +1,194 @@
+/*
+Cache memory budget
+
+the resource, picture, glyph and llm caches each used to have a size of
+their own picked for a small machine, so a kiosk with 2G ran out of room
+for the model while a desktop left most of its memory alone.  now they
+share one budget: cache_budget in nagi.ini, or a sixteenth of the
+machine's memory if that's 0.
+
+each cache tells the budget how much it holds and which entry it'd give
+up next.  once a cycle, while the caches hold more than the budget, the
+entry that's worth the least goes: the one that's cheapest to make again
+for its size and has gone longest without being wanted.  a translation
+that took the model two seconds outlasts a picture that takes a couple of
+milliseconds to draw, unless nobody's looked at it in a long while.
+
+the resource and picture caches are in two tiers each.  giving up a plain
+entry only lz4 compresses it, so making it again costs an unpack, and the
+packed tier holds what it'd really cost.  plain entries are packed well
+before anything's thrown away, and packed ones last about as long as the
+plain ones used to for a fraction of the memory.
+*/
+
+#include <stdio.h>
+
+#include "../agi.h"
+#include "mem_budget.h"
+
+#include "chargen.h"
+#include "../picture/pic_cache.h"
+#include "../res/res.h"
+
+#ifdef NAGI_ENABLE_LLM
+#include "../llm_global.h"
+#endif
+
+// never less than this, however little memory the machine says it has
+#define MEM_BUDGET_MIN (8u << 20)
+
+static MEM_BUDGET mem_budget_table[MEM_BUDGET_MAX];
+static int mem_budget_total = 0;
+static size_t mem_budget_bytes = 0;
+
+#ifdef NAGI_ENABLE_LLM
+// g_llm comes and goes, so the llm caches are looked up every time
+static size_t llm_cache_usage(size_t *oldest_bytes, u32 *oldest_age)
+{
+	double age;
+	size_t bytes;
+
+	*oldest_bytes = 0;
+	*oldest_age = 0;
+	if (g_llm == 0)
+		return 0;
+	bytes = nagi_llm_cache_usage(g_llm, oldest_bytes, &age);
+	*oldest_age = (u32)age;
+	return bytes;
+}
+
+static void llm_cache_evict(void)
+{
+	if (g_llm != 0)
+		nagi_llm_cache_evict(g_llm);
+}
+
+static size_t llm_memo_usage(size_t *oldest_bytes, u32 *oldest_age)
+{
+	double age;
+	size_t bytes;
+
+	*oldest_bytes = 0;
+	*oldest_age = 0;
+	if (g_llm == 0)
+		return 0;
+	bytes = nagi_llm_memo_usage(g_llm, oldest_bytes, &age);
+	*oldest_age = (u32)age;
+	return bytes;
+}
+
+static void llm_memo_evict(void)
+{
+	if (g_llm != 0)
+		nagi_llm_memo_evict(g_llm);
+}
+#endif
+
+void mem_budget_init(void)
+{
+	// plain entries cost an unpack to make again
+	static const MEM_BUDGET res = {"resources", 20, res_cache_usage, res_cache_evict};
+	static const MEM_BUDGET pic = {"pictures", 30, pic_cache_usage, pic_cache_evict};
+	static const MEM_BUDGET res_pack = {"packed resources", 500, res_pack_usage, res_pack_evict};
+	static const MEM_BUDGET pic_pack = {"packed pictures", 3000, pic_pack_usage, pic_pack_evict};
+	// the whole glyph cache goes at once
+	static const MEM_BUDGET glyph = {"glyphs", 20000, ch_glyph_usage, ch_glyph_evict};
+#ifdef NAGI_ENABLE_LLM
+	static const MEM_BUDGET trans = {"translations", 2000000, llm_cache_usage, llm_cache_evict};
+	static const MEM_BUDGET memo = {"extractions", 1000000, llm_memo_usage, llm_memo_evict};
+#endif
+	int ram;
+
+	if (c_nagi_cache_budget > 0)
+		mem_budget_bytes = (size_t)c_nagi_cache_budget << 20;
+	else
+	{
+		ram = SDL_GetSystemRAM();
+		mem_budget_bytes = (ram > 0) ? ((size_t)ram << 20) / 16 : 0;
+	}
+	if (mem_budget_bytes < MEM_BUDGET_MIN)
+		mem_budget_bytes = MEM_BUDGET_MIN;
+
+	mem_budget_total = 0;
+	mem_budget_add(&res);
+	mem_budget_add(&pic);
+	mem_budget_add(&res_pack);
+	mem_budget_add(&pic_pack);
+	mem_budget_add(&glyph);
+#ifdef NAGI_ENABLE_LLM
+	mem_budget_add(&trans);
+	mem_budget_add(&memo);
+#endif
+	printf("Cache budget: %uM\n", (unsigned)(mem_budget_bytes >> 20));
+}
+
+void mem_budget_add(const MEM_BUDGET *cache)
+{
+	if (mem_budget_total < MEM_BUDGET_MAX)
+		mem_budget_table[mem_budget_total++] = *cache;
+}
+
+size_t mem_budget_limit(void)
+{
+	return mem_budget_bytes;
+}
+
+size_t mem_budget_held(void)
+{
+	size_t bytes, oldest;
+	u32 age;
+	int i;
+
+	bytes = 0;
+	for (i = 0; i < mem_budget_total; i++)
+		bytes += mem_budget_table[i].usage(&oldest, &age);
+	return bytes;
+}
+
+// what keeping the entry is worth per byte.. its cost, less the longer it's
+// gone unwanted
+static double mem_budget_value(const MEM_BUDGET *cache, size_t bytes, u32 age)
+{
+	return (double)cache->cost / (double)bytes / (1.0 + (double)age / 1000.0);
+}
+
+// once a cycle.  give up the entries worth least until the caches fit
+void mem_budget_check(void)
+{
+	size_t held[MEM_BUDGET_MAX], oldest[MEM_BUDGET_MAX];
+	u32 age[MEM_BUDGET_MAX];
+	size_t total;
+	double value, best;
+	int i, victim;
+
+	for (;;)
+	{
+		// all of them again, packing an entry moves bytes to another tier
+		total = 0;
+		for (i = 0; i < mem_budget_total; i++)
+		{
+			held[i] = mem_budget_table[i].usage(&oldest[i], &age[i]);
+			total += held[i];
+		}
+		if (total <= mem_budget_bytes)
+			return;
+
+		victim = -1;
+		best = 0;
+		for (i = 0; i < mem_budget_total; i++)
+		{
+			if (oldest[i] == 0)
+				continue;
+			value = mem_budget_value(&mem_budget_table[i], oldest[i], age[i]);
+			if ( (victim < 0) || (value < best) )
+			{
+				victim = i;
+				best = value;
+			}
+		}
+		if (victim < 0)
+			return;		// nothing left that can go
+
+		mem_budget_table[victim].evict();
+	}
+}
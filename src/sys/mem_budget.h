@@ -0,0 +1,23 @@
+#ifndef NAGI_SYS_MEM_BUDGET_H
+#define NAGI_SYS_MEM_BUDGET_H
+
+#define MEM_BUDGET_MAX 8
+
+struct mem_budget_struct
+{
+	const char *name;
+	u32 cost;		// about how many microseconds it takes to make an entry again
+	// bytes held, with the size and age in ms of the entry that'd go next
+	// (both 0 if there's nothing to give up)
+	size_t (*usage)(size_t *oldest_bytes, u32 *oldest_age);
+	void (*evict)(void);	// give up that entry
+};
+typedef struct mem_budget_struct MEM_BUDGET;
+
+extern void mem_budget_init(void);
+extern void mem_budget_add(const MEM_BUDGET *cache);
+extern size_t mem_budget_limit(void);
+extern size_t mem_budget_held(void);
+extern void mem_budget_check(void);
+
+#endif /* NAGI_SYS_MEM_BUDGET_H */
@@ -1,24 +1,135 @@
 
 #include "../agi.h"
+#include "mem_wrap.h"
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 
+// every block starts with its size and tag so a_free() can take them off
+// again.  16 bytes keeps the block as aligned as malloc's
+struct mem_head_struct
+{
+	u64 size;
+	u32 tag;
+	u32 pad;
+};
+typedef struct mem_head_struct MEM_HEAD;
+
+// allocations come from the loader threads too
+struct mem_count_struct
+{
+	SDL_AtomicInt bytes;
+	SDL_AtomicInt peak;
+	SDL_AtomicInt blocks;
+	SDL_AtomicInt allocs;
+};
+typedef struct mem_count_struct MEM_COUNT;
+
+const char *mem_tag_name[MEM_TAG_MAX] = {"other", "res", "view", "cache", "text", "llm", "state"};
+
+static MEM_COUNT mem_count[MEM_TAG_MAX + 1];	// the last one is every tag
 
-void *a_malloc (size_t size)
+static void mem_add(MEM_COUNT *c, int size)
 {
-	void *m;
+	int bytes, peak;
 
-	m = malloc(size);
+	bytes = SDL_AddAtomicInt(&c->bytes, size) + size;
+	SDL_AddAtomicInt(&c->blocks, 1);
+	SDL_AddAtomicInt(&c->allocs, 1);
+	peak = SDL_GetAtomicInt(&c->peak);
+	while ( (bytes > peak) && !SDL_CompareAndSwapAtomicInt(&c->peak, peak, bytes) )
+		peak = SDL_GetAtomicInt(&c->peak);
+}
+
+static void mem_sub(MEM_COUNT *c, int size)
+{
+	SDL_AddAtomicInt(&c->bytes, -size);
+	SDL_AddAtomicInt(&c->blocks, -1);
+}
+
+void *a_malloc_tag(size_t size, u16 tag)
+{
+	MEM_HEAD *m;
+
+	m = malloc(sizeof(MEM_HEAD) + size);
 	if ( m == 0)
 	{
 		printf("malloc error\n");
 		exit(-1);
 	}
-	return m;
+	if (tag >= MEM_TAG_MAX)
+		tag = MEM_OTHER;
+	m->size = size;
+	m->tag = tag;
+	mem_add(&mem_count[tag], (int)size);
+	mem_add(&mem_count[MEM_TAG_MAX], (int)size);
+	return m + 1;
 }
 
 void a_free(void *m)
 {
-	free(m);
+	MEM_HEAD *h;
+
+	if (m == 0)
+		return;
+	h = (MEM_HEAD *)m - 1;
+	mem_sub(&mem_count[h->tag], (int)h->size);
+	mem_sub(&mem_count[MEM_TAG_MAX], (int)h->size);
+	free(h);
+}
+
+// for buffers read with aligned vector loads.  the block a_malloc gave
+// back is kept just before the aligned one so it can be freed
+void *a_malloc_aligned_tag(size_t size, size_t align, u16 tag)
+{
+	u8 *m, *a;
+
+	m = (u8 *)a_malloc_tag(size + align + sizeof(void *), tag);
+	a = (u8 *)(((uintptr_t)(m + sizeof(void *)) + align - 1) & ~(uintptr_t)(align - 1));
+	((void **)a)[-1] = m;
+	return a;
 }
 
+void a_free_aligned(void *m)
+{
+	if (m != 0)
+		a_free(((void **)m)[-1]);
+}
+
+char *a_strdup_tag(const char *str, u16 tag)
+{
+	char *s;
+	size_t len;
+
+	len = strlen(str) + 1;
+	s = (char *)a_malloc_tag(len, tag);
+	memcpy(s, str, len);
+	return s;
+}
+
+void mem_stat(u16 tag, MEM_STAT *stat)
+{
+	MEM_COUNT *c;
+
+	c = &mem_count[(tag < MEM_TAG_MAX) ? tag : MEM_TAG_MAX];
+	stat->bytes = (u32)SDL_GetAtomicInt(&c->bytes);
+	stat->peak = (u32)SDL_GetAtomicInt(&c->peak);
+	stat->blocks = (u32)SDL_GetAtomicInt(&c->blocks);
+	stat->allocs = (u32)SDL_GetAtomicInt(&c->allocs);
+}
+
+// what's still held is what nothing freed, run at the very end it's leaks
+void mem_report(void)
+{
+	MEM_STAT s;
+	u16 tag;
+
+	printf("\n%-8s %12s %12s %10s %10s\n", "heap", "bytes", "peak", "blocks", "allocs");
+	for (tag = 0; tag <= MEM_TAG_MAX; tag++)
+	{
+		mem_stat(tag, &s);
+		printf("%-8s %12u %12u %10u %10u\n", (tag < MEM_TAG_MAX) ? mem_tag_name[tag] : "total",
+			s.bytes, s.peak, s.blocks, s.allocs);
+	}
+	fflush(stdout);
+}
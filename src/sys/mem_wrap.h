@@ -1,7 +1,44 @@
 #ifndef NAGI_SYS_MEM_WRAP_H
 #define NAGI_SYS_MEM_WRAP_H
 
-extern void *a_malloc (size_t size);
+// what an allocation is for.  a file sets MEM_TAG before its includes and
+// everything it allocates is counted against that
+#define MEM_OTHER 0
+#define MEM_RES 1		// resources, the room heap, compiled logics
+#define MEM_VIEW 2		// view tables and blits
+#define MEM_CACHE 3		// picture, resource, glyph and said caches
+#define MEM_TEXT 4		// messages, strings, words, config
+#define MEM_LLM 5		// pre-translations and other llm buffers of ours
+#define MEM_STATE 6		// saves, snapshots, rewind, replay, script
+#define MEM_TAG_MAX 7
+
+#ifndef MEM_TAG
+#define MEM_TAG MEM_OTHER
+#endif
+
+struct mem_stat_struct
+{
+	u32 bytes;		// held now
+	u32 peak;		// most ever held at once
+	u32 blocks;		// held now
+	u32 allocs;		// every allocation so far
+};
+typedef struct mem_stat_struct MEM_STAT;
+
+extern const char *mem_tag_name[MEM_TAG_MAX];
+
+#define a_malloc(size) a_malloc_tag((size), MEM_TAG)
+#define a_malloc_aligned(size, align) a_malloc_aligned_tag((size), (align), MEM_TAG)
+#define a_strdup(str) a_strdup_tag((str), MEM_TAG)
+
+extern void *a_malloc_tag(size_t size, u16 tag);
 extern void a_free(void *m);
+extern void *a_malloc_aligned_tag(size_t size, size_t align, u16 tag);
+extern void a_free_aligned(void *m);
+extern char *a_strdup_tag(const char *str, u16 tag);
+
+// a tag's counters, or all of them added up for MEM_TAG_MAX
+extern void mem_stat(u16 tag, MEM_STAT *stat);
+extern void mem_report(void);
 
 #endif /* NAGI_SYS_MEM_WRAP_H */
@@ -12,6 +12,8 @@
 
 #define HEAP_SIZE 0x10000
 
+#define MEM_TAG MEM_RES
+
 #include "../agi.h"
 
 // for blists_free()
@@ -26,17 +28,180 @@
 
 #include <setjmp.h>
 #include "../sys/error.h"
+#include "mem_wrap.h"
+#include "../ui/msg.h"
+
+static u32 room_used(void);
 
 // TODO: Does any agi logic code do something differently based on v8?
 
+// what would be left of the original 64k heap with this room's resources
+// on it, in 256 byte pages
 u16 update_var8(void)	// return via ax
 {
-	// store in multiples of 0x100 or 256
-	// free_mem
-	state.var[V08_FREEMEM] = 127;
+	u32 used, pages;
+
+	used = room_used();
+	pages = (used < HEAP_SIZE) ? (HEAP_SIZE - used) / 0x100 : 0;
+	state.var[V08_FREEMEM] = (pages > 0xFF) ? 0xFF : (u8)pages;
 	return(state.var[V08_FREEMEM]);
 }
 
+u8 *cmd_show_mem(u8 *c)
+{
+	char msg[400];
+	MEM_STAT s;
+	int len;
+	u16 tag;
+
+	update_var8();
+	len = snprintf(msg, sizeof(msg), "room heap: %uK  free: %u\n\n",
+		(unsigned)(room_used() >> 10), state.var[V08_FREEMEM]);
+	for (tag = 0; tag <= MEM_TAG_MAX; tag++)
+	{
+		mem_stat(tag, &s);
+		len += snprintf(msg + len, sizeof(msg) - len, "%-6s %6uK  max %6uK\n",
+			(tag < MEM_TAG_MAX) ? mem_tag_name[tag] : "total",
+			(unsigned)(s.bytes >> 10), (unsigned)(s.peak >> 10));
+	}
+	message_box(msg);
+	return c;
+}
+
+// ROOM HEAP
+// the resources a room loads are taken off a stack like the original
+// agi heap after logic.0 (mem_rm0) and dropped together on the next room.
+// the chunks are kept and reused so a game running for days doesn't keep
+// going back to malloc.  room_free() marks a block; freed blocks at the
+// top come off straight away so load/discard pairs don't pile up.
+
+#define ROOM_CHUNK_SIZE 0x10000
+#define ROOM_ALIGN 16
+
+struct room_block_struct
+{
+	u32 prev;	// offset of the block below this one in the chunk
+	u32 freed;
+	u8 pad[ROOM_ALIGN - 8];
+};
+typedef struct room_block_struct ROOM_BLOCK;
+
+struct room_chunk_struct
+{
+	struct room_chunk_struct *next;
+	u32 size;	// bytes after the header
+	u32 used;	// top of the stack
+	u32 last;	// offset of the top block, if used != 0
+	u8 pad[ROOM_ALIGN - (sizeof(void *) + 12) % ROOM_ALIGN];
+};
+typedef struct room_chunk_struct ROOM_CHUNK;
+
+static ROOM_CHUNK *room_head = 0;
+static ROOM_CHUNK *room_cur = 0;
+
+#define CHUNK_DATA(c) ((u8 *)((c) + 1))
+
+void *room_malloc(size_t size)
+{
+	ROOM_BLOCK *b;
+	ROOM_CHUNK *c;
+	u32 need;
+
+	need = sizeof(ROOM_BLOCK) + ((size + ROOM_ALIGN - 1) & ~(ROOM_ALIGN - 1));
+
+	if ( (room_cur == 0) || (room_cur->used + need > room_cur->size) )
+	{
+		// the next chunk is empty if there is one
+		if ( (room_cur != 0) && (room_cur->next != 0)
+			&& (room_cur->next->size >= need) )
+			c = room_cur->next;
+		else
+		{
+			u32 chunk_size = (need > ROOM_CHUNK_SIZE) ? need : ROOM_CHUNK_SIZE;
+			c = a_malloc(sizeof(ROOM_CHUNK) + chunk_size);
+			c->size = chunk_size;
+			c->used = 0;
+			c->last = 0;
+			if (room_cur == 0)
+			{
+				c->next = room_head;
+				room_head = c;
+			}
+			else
+			{
+				c->next = room_cur->next;
+				room_cur->next = c;
+			}
+		}
+		room_cur = c;
+	}
+
+	c = room_cur;
+	b = (ROOM_BLOCK *)(CHUNK_DATA(c) + c->used);
+	b->prev = c->last;
+	b->freed = 0;
+	c->last = c->used;
+	c->used += need;
+	return b + 1;
+}
+
+void room_free(void *m)
+{
+	ROOM_BLOCK *b;
+	ROOM_CHUNK *c;
+
+	if (m == 0)
+		return;
+
+	b = (ROOM_BLOCK *)m - 1;
+	b->freed = 1;
+
+	// pop freed blocks off the top, dropping back a chunk when one empties
+	while (room_cur != 0)
+	{
+		c = room_cur;
+		if (c->used != 0)
+		{
+			b = (ROOM_BLOCK *)(CHUNK_DATA(c) + c->last);
+			if (b->freed == 0)
+				break;
+			c->used = c->last;
+			c->last = b->prev;
+		}
+		if (c->used != 0)
+			continue;
+		if (c == room_head)
+			break;
+		for (room_cur = room_head; room_cur->next != c; room_cur = room_cur->next)
+			;
+	}
+}
+
+// bytes the room's resources take, chunks past room_cur are empty
+static u32 room_used(void)
+{
+	ROOM_CHUNK *c;
+	u32 used;
+
+	used = 0;
+	for (c = room_head; c != 0; c = c->next)
+		used += c->used;
+	return used;
+}
+
+// everything the room loaded is gone after this
+void room_clear(void)
+{
+	ROOM_CHUNK *c;
+
+	for (c = room_head; c != 0; c = c->next)
+	{
+		c->used = 0;
+		c->last = 0;
+	}
+	room_cur = room_head;
+}
+
 #if 0
 
 void *mem_base;
@@ -142,7 +307,7 @@ void clear_memory(void)
 	update_var8();
 }
 
-// TODO: finish cmd_show_mem
+// the original show.mem, cmd_show_mem() above replaces it
 /* word CmdShowMem(var param)
 {
 	word string[0x64];
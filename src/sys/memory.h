@@ -13,6 +13,10 @@
 // CmdShowMem                     cseg     000014BD 0000004D
 // END memory allocations
 
+void *room_malloc(size_t size);
+void room_free(void *m);
+void room_clear(void);
+
 void init_agi_heap(void);
 u16 update_var8(void);
 void *agi_malloc(u16 size);
@@ -23,6 +27,6 @@ void restore_memptr(void);
 void set_memrm0(void);
 void clear_memory(void);
 
-/* u8 *CmdShowMem(*u8); */
+u8 *cmd_show_mem(u8 *c);
 
 #endif /* NAGI_SYS_MEMORY_H */
@@ -0,0 +1,461 @@
+/*
+Metrics endpoint
+
+with metrics_port set under [nagi] the interpreter answers http requests
+for /metrics in the prometheus text format, so every box running games
+can be scraped and alerted on.  it listens on metrics_address (127.0.0.1
+unless nagi.ini says otherwise) and is polled with the input like the
+display stream, so nothing is worked out until a scrape comes.
+
+it gives the cycles, each part of a cycle (logic, objtable_update(),
+rendering, presenting, waiting on the llm, the delay) as a total and a
+histogram, the pixels uploaded, the glyph and picture caches' hits and
+misses, the sound callback's times and the times sound came late, the
+heap by tag (mem_wrap.h) and, with an llm, nagi_llm_metrics().  counters
+only go up, prometheus works out the rates.
+*/
+
+/* BASE headers	---	---	---	---	---	---	--- */
+#include "../agi.h"
+
+/* LIBRARY headers	---	---	---	---	---	---	--- */
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+/* OTHER headers	---	---	---	---	---	---	--- */
+#include "mem_wrap.h"
+#include "metrics.h"
+#include "chargen.h"
+#include "profile.h"
+#include "sdl_vid.h"
+#include "../picture/pic_cache.h"
+#include "../sound/pcm_out_sdl.h"
+
+#ifdef NAGI_ENABLE_LLM
+#include "../llm_global.h"
+#endif
+
+#ifndef _WIN32
+
+/* VARIABLES	---	---	---	---	---	---	--- */
+
+#define METRICS_CLIENTS 4
+#define METRICS_REQUEST 1024		// longest http request header taken
+#define METRICS_TIMEOUT_NS (5000 * 1000000ull)	// a scraper that takes longer is dropped
+
+#ifdef MSG_NOSIGNAL
+#define METRICS_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define METRICS_SEND_FLAGS 0
+#endif
+
+struct metrics_client_struct
+{
+	int fd;			// -1 if free
+	Uint64 since_ns;	// when it connected
+	char request[METRICS_REQUEST];
+	u16 request_len;
+	char *out;		// the reply, once the request is in
+	size_t out_len;
+	size_t out_sent;
+};
+typedef struct metrics_client_struct METRICS_CLIENT;
+
+// the reply being written
+struct metrics_text_struct
+{
+	char *buff;
+	size_t size;
+	size_t len;
+};
+typedef struct metrics_text_struct METRICS_TEXT;
+
+static const char *metrics_part_name[PROFILE_SUB_MAX] =
+	{"logic", "objtable_update", "render", "present", "llm_wait", "delay"};
+
+static int metrics_fd = -1;
+static METRICS_CLIENT metrics_client[METRICS_CLIENTS];
+
+/* CODE	---	---	---	---	---	---	--- */
+
+// room for size more bytes, 0 if there's no memory for it
+static int metrics_room(METRICS_TEXT *t, size_t size)
+{
+	char *buff;
+	size_t want;
+
+	if (t->len + size + 1 <= t->size)
+		return 1;
+	want = (t->size != 0) ? t->size : 16384;
+	while (want < t->len + size + 1)
+		want *= 2;
+	buff = a_malloc(want);
+	if (buff == 0)
+		return 0;
+	if (t->buff != 0)
+	{
+		memcpy(buff, t->buff, t->len + 1);
+		a_free(t->buff);
+	}
+	t->buff = buff;
+	t->size = want;
+	return 1;
+}
+
+static void metrics_printf(METRICS_TEXT *t, const char *fmt, ...)
+{
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(0, 0, fmt, ap);
+	va_end(ap);
+	if ( (n <= 0) || !metrics_room(t, (size_t)n) )
+		return;
+	va_start(ap, fmt);
+	vsnprintf(t->buff + t->len, t->size - t->len, fmt, ap);
+	va_end(ap);
+	t->len += (size_t)n;
+}
+
+static void metrics_head(METRICS_TEXT *t, const char *name, const char *type, const char *help)
+{
+	metrics_printf(t, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+}
+
+// a histogram's buckets from counts in each, bounds in us
+static void metrics_hist(METRICS_TEXT *t, const char *name, const char *labels,
+		const u32 *count, const u32 *bound_us, int buckets, double sum)
+{
+	u64 total;
+	int i;
+
+	total = 0;
+	for (i = 0; i < buckets; i++)
+	{
+		total += count[i];
+		if (i < buckets - 1)
+			metrics_printf(t, "%s_bucket{%s%sle=\"%g\"} %llu\n", name, labels,
+				(labels[0] != 0) ? "," : "", (double)bound_us[i] / 1e6, (unsigned long long)total);
+		else
+			metrics_printf(t, "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name, labels,
+				(labels[0] != 0) ? "," : "", (unsigned long long)total);
+	}
+	if (labels[0] != 0)
+	{
+		metrics_printf(t, "%s_sum{%s} %.6f\n", name, labels, sum);
+		metrics_printf(t, "%s_count{%s} %llu\n", name, labels, (unsigned long long)total);
+	}
+	else
+	{
+		metrics_printf(t, "%s_sum %.6f\n", name, sum);
+		metrics_printf(t, "%s_count %llu\n", name, (unsigned long long)total);
+	}
+}
+
+static void metrics_build(METRICS_TEXT *t)
+{
+	PCM_OUT_SDL_STATS audio;
+	MEM_STAT mem;
+	const u32 *count, *bound_us;
+	u32 cb[PCM_OUT_CB_BUCKETS], cb_us;
+	char labels[32];
+	double freq;
+	u64 ticks;
+	u16 i;
+
+	ticks = SDL_GetPerformanceFrequency();
+	freq = (double)ticks;
+
+	ticks = profile_cycles_total();
+	metrics_head(t, "nagi_cycles_total", "counter", "Interpreter cycles run");
+	metrics_printf(t, "nagi_cycles_total %llu\n", (unsigned long long)ticks);
+
+	metrics_head(t, "nagi_cycle_part_seconds", "histogram", "Time of each part of a cycle");
+	for (i = 0; i < PROFILE_SUB_MAX; i++)
+	{
+		count = profile_sub_hist(i, &bound_us);
+		snprintf(labels, sizeof(labels), "part=\"%s\"", metrics_part_name[i]);
+		ticks = profile_sub_ticks(i);
+		metrics_hist(t, "nagi_cycle_part_seconds", labels, count, bound_us, PROFILE_HIST,
+			(double)ticks / freq);
+	}
+
+	ticks = vid_uploaded();
+	metrics_head(t, "nagi_uploaded_pixels_total", "counter", "Pixels uploaded to the screen texture");
+	metrics_printf(t, "nagi_uploaded_pixels_total %llu\n", (unsigned long long)ticks);
+	metrics_head(t, "nagi_cache_lookups_total", "counter", "Glyph and picture cache lookups");
+	metrics_printf(t, "nagi_cache_lookups_total{cache=\"glyph\",result=\"hit\"} %u\n", (unsigned)ch_glyph_hits);
+	metrics_printf(t, "nagi_cache_lookups_total{cache=\"glyph\",result=\"miss\"} %u\n", (unsigned)ch_glyph_misses);
+	metrics_printf(t, "nagi_cache_lookups_total{cache=\"picture\",result=\"hit\"} %u\n", (unsigned)pic_cache_hits);
+	metrics_printf(t, "nagi_cache_lookups_total{cache=\"picture\",result=\"miss\"} %u\n", (unsigned)pic_cache_misses);
+
+	// the average and longest here are since anything last looked (a scrape
+	// starts the hud's over too), so they're left to the histogram
+	pcm_out_sdl_stats(&audio);
+	pcm_out_sdl_callback_hist(cb, &bound_us, &cb_us);
+	metrics_head(t, "nagi_audio_underruns_total", "counter", "Times the sound ran dry waiting for the callback");
+	metrics_printf(t, "nagi_audio_underruns_total %u\n", (unsigned)audio.late);
+	metrics_head(t, "nagi_audio_ahead_seconds", "gauge", "How far the sound being mixed is ahead of what's heard");
+	metrics_printf(t, "nagi_audio_ahead_seconds %.6f\n", (double)audio.ahead_us / 1e6);
+	metrics_head(t, "nagi_audio_callback_seconds", "histogram", "Time of the sound device's callback");
+	metrics_hist(t, "nagi_audio_callback_seconds", "", cb, bound_us, PCM_OUT_CB_BUCKETS, (double)cb_us / 1e6);
+
+	metrics_head(t, "nagi_memory_bytes", "gauge", "Heap held by what it's for");
+	for (i = 0; i < MEM_TAG_MAX; i++)
+	{
+		mem_stat(i, &mem);
+		metrics_printf(t, "nagi_memory_bytes{tag=\"%s\"} %llu\n", mem_tag_name[i], (unsigned long long)mem.bytes);
+	}
+	metrics_head(t, "nagi_memory_peak_bytes", "gauge", "Most heap ever held by what it's for");
+	for (i = 0; i < MEM_TAG_MAX; i++)
+	{
+		mem_stat(i, &mem);
+		metrics_printf(t, "nagi_memory_peak_bytes{tag=\"%s\"} %llu\n", mem_tag_name[i], (unsigned long long)mem.peak);
+	}
+
+#ifdef NAGI_ENABLE_LLM
+	if (g_llm != 0)
+	{
+		size_t size, avail;
+		int tries;
+
+		// the text can grow between asking its size and writing it, so
+		// it's only taken whole and never counted past the buffer
+		size = nagi_llm_metrics(&g_llm, 1, 0, 0);
+		for (tries = 0; (tries < 3) && (size != 0) && metrics_room(t, size); tries++)
+		{
+			avail = t->size - t->len;
+			size = nagi_llm_metrics(&g_llm, 1, t->buff + t->len, avail);
+			if (size < avail)
+			{
+				t->len += size;
+				break;
+			}
+			t->buff[t->len] = 0;
+		}
+	}
+#endif
+}
+
+static void metrics_drop(METRICS_CLIENT *cl)
+{
+	if (cl->fd < 0)
+		return;
+	close(cl->fd);
+	if (cl->out != 0)
+		a_free(cl->out);
+	memset(cl, 0, sizeof(METRICS_CLIENT));
+	cl->fd = -1;
+}
+
+// the whole reply for the request that came in
+static void metrics_reply(METRICS_CLIENT *cl)
+{
+	METRICS_TEXT body, reply;
+
+	memset(&body, 0, sizeof(body));
+	memset(&reply, 0, sizeof(reply));
+	if ( (strncmp(cl->request, "GET /metrics ", 13) == 0) || (strncmp(cl->request, "GET / ", 6) == 0) )
+	{
+		metrics_build(&body);
+		metrics_printf(&reply, "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+			"Content-Length: %u\r\nConnection: close\r\n\r\n", (unsigned)body.len);
+		if ( (body.len != 0) && metrics_room(&reply, body.len) )
+		{
+			memcpy(reply.buff + reply.len, body.buff, body.len);
+			reply.len += body.len;
+		}
+		if (body.buff != 0)
+			a_free(body.buff);
+	}
+	else
+		metrics_printf(&reply, "HTTP/1.0 404 Not Found\r\nContent-Length: 0\r\nConnection: close\r\n\r\n");
+
+	cl->out = reply.buff;
+	cl->out_len = reply.len;
+	cl->out_sent = 0;
+	if (cl->out == 0)
+		metrics_drop(cl);
+}
+
+// read the request, then send the reply and hang up
+static void metrics_serve(METRICS_CLIENT *cl)
+{
+	ssize_t got;
+
+	while (cl->out == 0)
+	{
+		if (cl->request_len >= METRICS_REQUEST - 1)
+		{
+			metrics_drop(cl);
+			return;
+		}
+		got = recv(cl->fd, cl->request + cl->request_len, METRICS_REQUEST - 1 - cl->request_len, 0);
+		if (got == 0)
+		{
+			metrics_drop(cl);
+			return;
+		}
+		if (got < 0)
+		{
+			if ( (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR) )
+				metrics_drop(cl);
+			return;
+		}
+		cl->request_len += (u16)got;
+		cl->request[cl->request_len] = 0;
+		if (strstr(cl->request, "\r\n\r\n") != 0)
+			metrics_reply(cl);
+		if (cl->fd < 0)
+			return;
+	}
+
+	while (cl->out_sent < cl->out_len)
+	{
+		got = send(cl->fd, cl->out + cl->out_sent, cl->out_len - cl->out_sent, METRICS_SEND_FLAGS);
+		if (got > 0)
+		{
+			cl->out_sent += (size_t)got;
+			continue;
+		}
+		if ( (got < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) )
+			return;
+		break;
+	}
+	metrics_drop(cl);
+}
+
+static void metrics_accept(void)
+{
+	METRICS_CLIENT *cl;
+	int fd, i;
+
+	for (;;)
+	{
+		fd = accept(metrics_fd, 0, 0);
+		if (fd < 0)
+			return;
+		for (i = 0; (i < METRICS_CLIENTS) && (metrics_client[i].fd >= 0); i++)
+			;
+		if (i == METRICS_CLIENTS)
+		{
+			close(fd);
+			continue;
+		}
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+		{
+			int on = 1;
+			setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+		}
+#endif
+		cl = &metrics_client[i];
+		memset(cl, 0, sizeof(METRICS_CLIENT));
+		cl->fd = fd;
+		cl->since_ns = SDL_GetTicksNS();
+	}
+}
+
+void metrics_open(int port, const char *address)
+{
+	struct sockaddr_in addr;
+	int i, on;
+
+	if ( (port <= 0) || (metrics_fd >= 0) )
+		return;
+
+	for (i = 0; i < METRICS_CLIENTS; i++)
+	{
+		memset(&metrics_client[i], 0, sizeof(METRICS_CLIENT));
+		metrics_client[i].fd = -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_port = htons((u16)port);
+	if ( (address == 0) || (address[0] == 0) )
+		address = "127.0.0.1";
+	if (inet_pton(AF_INET, address, &addr.sin_addr) != 1)
+	{
+		printf("Metrics: %s is not an ipv4 address\n", address);
+		return;
+	}
+
+	metrics_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (metrics_fd < 0)
+	{
+		printf("Metrics: unable to make a socket\n");
+		return;
+	}
+	on = 1;
+	setsockopt(metrics_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+	if ( (bind(metrics_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) ||
+		(listen(metrics_fd, METRICS_CLIENTS) != 0) )
+	{
+		printf("Metrics: unable to listen on %s:%d\n", address, port);
+		close(metrics_fd);
+		metrics_fd = -1;
+		return;
+	}
+	fcntl(metrics_fd, F_SETFL, fcntl(metrics_fd, F_GETFL, 0) | O_NONBLOCK);
+	printf("Metrics: serving http://%s:%d/metrics\n", address, port);
+}
+
+void metrics_close(void)
+{
+	int i;
+
+	if (metrics_fd < 0)
+		return;
+	for (i = 0; i < METRICS_CLIENTS; i++)
+		metrics_drop(&metrics_client[i]);
+	close(metrics_fd);
+	metrics_fd = -1;
+}
+
+void metrics_poll(void)
+{
+	METRICS_CLIENT *cl;
+	Uint64 now;
+	int i;
+
+	if (metrics_fd < 0)
+		return;
+	metrics_accept();
+	now = SDL_GetTicksNS();
+	for (i = 0; i < METRICS_CLIENTS; i++)
+	{
+		cl = &metrics_client[i];
+		if ( (cl->fd >= 0) && (now - cl->since_ns > METRICS_TIMEOUT_NS) )
+			metrics_drop(cl);
+		if (cl->fd >= 0)
+			metrics_serve(cl);
+	}
+}
+
+#else
+
+// the endpoint is built on bsd sockets
+void metrics_open(int port, const char *address)
+{
+	(void)address;
+	if (port > 0)
+		printf("Metrics: not supported on this platform\n");
+}
+
+void metrics_close(void) {}
+void metrics_poll(void) {}
+
+#endif
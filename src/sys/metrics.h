@@ -0,0 +1,12 @@
+#ifndef NAGI_SYS_METRICS_H
+#define NAGI_SYS_METRICS_H
+
+/* FUNCTIONS	---	---	---	---	---	---	--- */
+
+// answer scrapes on address:port, 0 leaves the endpoint off
+extern void metrics_open(int port, const char *address);
+extern void metrics_close(void);
+// take new scrapers and answer them, with the input
+extern void metrics_poll(void);
+
+#endif /* NAGI_SYS_METRICS_H */
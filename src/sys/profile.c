@@ -0,0 +1,259 @@
+/*
+Cycle profiler
+
+the big parts of a cycle are always counted and timed, with a histogram
+of how long each took, for the hud and the metrics endpoint.  built in with -DNAGI_PROFILE=ON it also counts and times every
+logic run (by number) and every command (by its cmd_table number).  logic
+and command times include whatever they call.  F12 or quitting prints
+them slowest first, with the ops each logic dispatched and the pairs of
+commands and tests that run one after the other most (what
+logic_prog.c fuses into superinstructions).
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../agi.h"
+#include "profile.h"
+
+#include "../logic/cmd_table.h"
+
+struct profile_struct
+{
+	u64 count;
+	u64 ticks;
+};
+typedef struct profile_struct PROFILE;
+
+static PROFILE profile_sub_table[PROFILE_SUB_MAX];
+static u64 profile_cycles = 0;
+
+static const u32 profile_hist_bound_us[PROFILE_HIST - 1] = PROFILE_HIST_BOUNDS_US;
+static u64 profile_hist_bound[PROFILE_HIST - 1];	// in performance counter ticks
+static u32 profile_sub_hist_table[PROFILE_SUB_MAX][PROFILE_HIST];
+
+u64 profile_now(void)
+{
+	return SDL_GetPerformanceCounter();
+}
+
+void profile_sub(u16 sub, u64 start)
+{
+	u64 ticks;
+	int i;
+
+	if (sub >= PROFILE_SUB_MAX)
+		return;
+	ticks = SDL_GetPerformanceCounter() - start;
+	profile_sub_table[sub].count++;
+	profile_sub_table[sub].ticks += ticks;
+
+	if (profile_hist_bound[0] == 0)
+		for (i = 0; i < PROFILE_HIST - 1; i++)
+			profile_hist_bound[i] = SDL_GetPerformanceFrequency() * profile_hist_bound_us[i] / 1000000;
+	for (i = 0; (i < PROFILE_HIST - 1) && (ticks > profile_hist_bound[i]); i++)
+		;
+	profile_sub_hist_table[sub][i]++;
+}
+
+void profile_cycle(void)
+{
+	profile_cycles++;
+}
+
+u64 profile_sub_ticks(u16 sub)
+{
+	return (sub < PROFILE_SUB_MAX) ? profile_sub_table[sub].ticks : 0;
+}
+
+const u32 *profile_sub_hist(u16 sub, const u32 **bound_us)
+{
+	*bound_us = profile_hist_bound_us;
+	return profile_sub_hist_table[(sub < PROFILE_SUB_MAX) ? sub : 0];
+}
+
+u64 profile_cycles_total(void)
+{
+	return profile_cycles;
+}
+
+#ifdef NAGI_PROFILE
+
+struct profile_row_struct
+{
+	const char *name;
+	u16 num;
+	PROFILE *p;
+};
+typedef struct profile_row_struct PROFILE_ROW;
+
+static const char *profile_sub_name[PROFILE_SUB_MAX] =
+	{"logic", "objtable_update", "render", "present", "llm wait", "delay"};
+
+static PROFILE profile_logic_table[256];
+static PROFILE profile_cmd_table[CMD_MAX + 1];
+static u64 profile_ops_table[256];
+
+// first and second op, commands then tests
+#define PROFILE_PAIR_KEYS (PROFILE_PAIR_TEST + EVAL_MAX + 1)
+#define PROFILE_PAIR_TOP 24
+static u32 profile_pair_table[PROFILE_PAIR_KEYS][PROFILE_PAIR_KEYS];
+
+static void profile_add(PROFILE *p, u64 start)
+{
+	p->count++;
+	p->ticks += SDL_GetPerformanceCounter() - start;
+}
+
+void profile_logic(u16 num, u64 start)
+{
+	if (num < 256)
+		profile_add(&profile_logic_table[num], start);
+}
+
+void profile_cmd(u16 code, u64 start)
+{
+	if (code <= CMD_MAX)
+		profile_add(&profile_cmd_table[code], start);
+}
+
+void profile_ops(u16 num, u32 ops)
+{
+	if (num < 256)
+		profile_ops_table[num] += ops;
+}
+
+void profile_pair(u16 first, u16 second)
+{
+	if ( (first < PROFILE_PAIR_KEYS) && (second < PROFILE_PAIR_KEYS) )
+		profile_pair_table[first][second]++;
+}
+
+static const char *profile_key_name(u16 key)
+{
+	if (key >= PROFILE_PAIR_TEST)
+		return eval_table[key - PROFILE_PAIR_TEST].func_name;
+	return cmd_table[key].func_name;
+}
+
+// the most run pairs, most first
+static void profile_pair_print(void)
+{
+	u32 top_count[PROFILE_PAIR_TOP];
+	u16 top_first[PROFILE_PAIR_TOP], top_second[PROFILE_PAIR_TOP];
+	u32 count;
+	int first, second, i, total;
+
+	total = 0;
+	for (first = 0; first < PROFILE_PAIR_KEYS; first++)
+		for (second = 0; second < PROFILE_PAIR_KEYS; second++)
+		{
+			count = profile_pair_table[first][second];
+			if ( (count == 0) || ((total == PROFILE_PAIR_TOP) && (count <= top_count[total - 1])) )
+				continue;
+			if (total < PROFILE_PAIR_TOP)
+				total++;
+			for (i = total - 1; (i > 0) && (top_count[i - 1] < count); i--)
+			{
+				top_count[i] = top_count[i - 1];
+				top_first[i] = top_first[i - 1];
+				top_second[i] = top_second[i - 1];
+			}
+			top_count[i] = count;
+			top_first[i] = (u16)first;
+			top_second[i] = (u16)second;
+		}
+
+	if (total == 0)
+		return;
+	printf("\n%-48s %10s\n", "pair", "count");
+	for (i = 0; i < total; i++)
+		printf("%-22s -> %-22s %10lu\n", profile_key_name(top_first[i]),
+			profile_key_name(top_second[i]), (unsigned long)top_count[i]);
+}
+
+static int profile_cmp(const void *a, const void *b)
+{
+	const PROFILE_ROW *ra = (const PROFILE_ROW *)a;
+	const PROFILE_ROW *rb = (const PROFILE_ROW *)b;
+
+	if (ra->p->ticks != rb->p->ticks)
+		return (ra->p->ticks < rb->p->ticks) ? 1 : -1;
+	return (int)ra->num - (int)rb->num;
+}
+
+// print the used rows of a table, slowest first
+static void profile_print(const char *title, PROFILE_ROW *row, int total)
+{
+	double ms;
+	int i;
+
+	qsort(row, (size_t)total, sizeof(PROFILE_ROW), profile_cmp);
+
+	printf("\n%-24s %10s %12s %10s %10s\n", title, "count", "total ms", "us each", "ms/cycle");
+	for (i = 0; i < total; i++)
+	{
+		ms = (double)row[i].p->ticks * 1000.0 / (double)SDL_GetPerformanceFrequency();
+		if (row[i].name != 0)
+			printf("%-24s", row[i].name);
+		else
+			printf("%-24u", row[i].num);
+		printf(" %10llu %12.2f %10.2f %10.3f\n",
+			(unsigned long long)row[i].p->count, ms,
+			ms * 1000.0 / (double)row[i].p->count,
+			(profile_cycles != 0) ? ms / (double)profile_cycles : 0.0);
+	}
+}
+
+void profile_dump(void)
+{
+	PROFILE_ROW row[CMD_MAX + 1 + 256];
+	int i, total;
+
+	// --pack, --pretranslate
+	if (profile_cycles == 0)
+		return;
+	printf("\nProfile: %llu cycles\n", (unsigned long long)profile_cycles);
+
+	total = 0;
+	for (i = 0; i < PROFILE_SUB_MAX; i++)
+		if (profile_sub_table[i].count != 0)
+		{
+			row[total].name = profile_sub_name[i];
+			row[total].num = (u16)i;
+			row[total++].p = &profile_sub_table[i];
+		}
+	profile_print("subsystem", row, total);
+
+	total = 0;
+	for (i = 0; i < 256; i++)
+		if (profile_logic_table[i].count != 0)
+		{
+			row[total].name = 0;
+			row[total].num = (u16)i;
+			row[total++].p = &profile_logic_table[i];
+		}
+	profile_print("logic", row, total);
+
+	printf("\n%-24s %10s %10s\n", "logic", "ops", "ops/run");
+	for (i = 0; i < 256; i++)
+		if (profile_ops_table[i] != 0)
+			printf("%-24d %10llu %10.1f\n", i, (unsigned long long)profile_ops_table[i],
+				(profile_logic_table[i].count != 0) ?
+				(double)profile_ops_table[i] / (double)profile_logic_table[i].count : 0.0);
+
+	total = 0;
+	for (i = 0; i <= CMD_MAX; i++)
+		if (profile_cmd_table[i].count != 0)
+		{
+			row[total].name = cmd_table[i].func_name;
+			row[total].num = (u16)i;
+			row[total++].p = &profile_cmd_table[i];
+		}
+	profile_print("command", row, total);
+	profile_pair_print();
+	fflush(stdout);
+}
+
+#endif
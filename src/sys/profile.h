@@ -0,0 +1,48 @@
+#ifndef NAGI_SYS_PROFILE_H
+#define NAGI_SYS_PROFILE_H
+
+// parts of a cycle
+#define PROFILE_LOGIC 0
+#define PROFILE_OBJ 1		// objtable_update()
+#define PROFILE_RENDER 2
+#define PROFILE_PRESENT 3
+#define PROFILE_LLM 4		// waiting on the llm
+#define PROFILE_DELAY 5		// do_delay()
+#define PROFILE_SUB_MAX 6
+
+// each part's times histogram, the last bucket takes the rest
+#define PROFILE_HIST_BOUNDS_US {100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000, 100000}
+#define PROFILE_HIST 11
+
+// the parts of a cycle are always timed, a few clock reads a cycle.  the
+// hud reads the totals
+extern u64 profile_now(void);
+extern void profile_sub(u16 sub, u64 start);
+extern void profile_cycle(void);
+extern u64 profile_sub_ticks(u16 sub);
+// times a part ran by how long it took, PROFILE_HIST counts
+extern const u32 *profile_sub_hist(u16 sub, const u32 **bound_us);
+extern u64 profile_cycles_total(void);
+
+#ifdef NAGI_PROFILE
+// every logic and command
+#define profile_detail_now() profile_now()
+extern void profile_logic(u16 num, u64 start);
+extern void profile_cmd(u16 code, u64 start);
+// ops a logic run went round the interpreter for
+extern void profile_ops(u16 num, u32 ops);
+// an op run right after the one before it in the code, a command's code
+// or a test's with PROFILE_PAIR_TEST
+#define PROFILE_PAIR_TEST 0x100
+extern void profile_pair(u16 first, u16 second);
+extern void profile_dump(void);
+#else
+// compiled out, the timestamps are never read
+#define profile_detail_now() ((u64)0)
+#define profile_logic(num, start) ((void)(start))
+#define profile_cmd(code, start) ((void)(start))
+#define profile_ops(num, ops) ((void)(ops))
+#define profile_dump() ((void)0)
+#endif
+
+#endif /* NAGI_SYS_PROFILE_H */
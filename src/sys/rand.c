@@ -33,6 +33,12 @@ u8 agi_rand(void)
 	return( r );
 }
 
+// the same seed gives the same numbers every time
+void agi_rand_seed_set(u16 seed)
+{
+	agi_rand_seed = seed;
+}
+
 
 u8 *cmd_random(u8 *c)
 {
@@ -2,6 +2,7 @@
 #define NAGI_SYS_RAND_H
 
 extern u8 agi_rand(void);
+extern void agi_rand_seed_set(u16 seed);
 extern u8 *cmd_random(u8 *c);
 
 #endif /* NAGI_SYS_RAND_H */
@@ -0,0 +1,428 @@
+/*
+Input record and replay
+
+nagi --record <log> plays as normal but writes every event the game reads
+to the log.  nagi --replay <log> feeds them back in at the same point and
+runs the cycles as fast as they go, then prints how long it took and a
+hash of the screen.  add --headless to do it without a window or sound.
+
+both ways run off the same things so the game does the same thing twice:
+a fixed random seed, no sound (so sounds finish straight away) and a clock
+that counts each cycle as the V10 delay it asked for.  an event is logged
+with the cycle it was read in and whether it was read during do_delay() or
+after it.  after it, it also gets how many reads that cycle had done so a
+key typed into a message box goes to the message box.  polled mouse
+positions are logged too, and every line typed into the parser.. replay
+doesn't need those (the keys type them again) but nagi-llm-bench takes
+them as its player input.
+
+the log is "NAGIRPL" and a version byte then records, each a tag byte and
+unsigned LEB128 numbers starting with the cycles since the last record:
+	1 event in do_delay()	cycles, type, data, x, y
+	2 event after it	cycles, read, type, data, x, y
+	3 mouse poll		cycles, buttons, x, y
+	4 parser line		cycles, length, the bytes
+	0 end			cycles
+*/
+
+#define MEM_TAG MEM_STATE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../agi.h"
+#include "../base.h"
+#include "replay.h"
+
+#include "../ui/events.h"
+#include "mem_wrap.h"
+#include "rand.h"
+#include "startup.h"
+#include "../sys/time.h"
+#include "drv_video.h"
+#include "vid_render.h"
+
+#define REPLAY_SEED 0x4E41	// anything but 0, 0 is "seed from the clock"
+#define REPLAY_MAGIC "NAGIRPL"
+#define REPLAY_VERSION 1
+
+#define REC_END 0
+#define REC_DELAY 1
+#define REC_LOGIC 2
+#define REC_MOUSE 3
+#define REC_LINE 4
+
+#define PHASE_DELAY 0		// in do_delay()
+#define PHASE_LOGIC 1		// after it
+
+struct replay_entry_struct
+{
+	u32 cycle;
+	u32 reads;		// which read of the cycle got it
+	u8 phase;
+	AGI_EVENT event;
+};
+typedef struct replay_entry_struct REPLAY_ENTRY;
+
+struct replay_mouse_struct
+{
+	int butt;
+	int x;
+	int y;
+};
+typedef struct replay_mouse_struct REPLAY_MOUSE;
+
+u8 replay_mode = REPLAY_OFF;
+u8 replay_headless = 0;
+
+static FILE *replay_file = 0;
+static u32 replay_file_cycle = 0;	// of the last record written or read
+
+static REPLAY_ENTRY *replay_log = 0;
+static u32 replay_total = 0;
+static u32 replay_next = 0;
+static REPLAY_MOUSE *replay_mouse_log = 0;
+static u32 replay_mouse_total = 0;
+static u32 replay_mouse_next = 0;
+static u32 replay_end = 0;		// the cycle it was recorded up to
+
+static u32 replay_cycles = 0;
+static u32 replay_reads = 0;
+static u8 replay_phase = PHASE_DELAY;
+static u32 replay_clock_ms = 0;
+static Uint64 replay_start = 0;
+
+static AGI_EVENT replay_event;
+
+static void replay_put(u32 n)
+{
+	while (n >= 0x80)
+	{
+		fputc((int)(n & 0x7F) | 0x80, replay_file);
+		n >>= 7;
+	}
+	fputc((int)n, replay_file);
+}
+
+// returns 0 at the end of the file
+static u16 replay_get(u32 *n)
+{
+	int c, shift;
+
+	*n = 0;
+	for (shift = 0; shift < 32; shift += 7)
+	{
+		c = fgetc(replay_file);
+		if (c == EOF)
+			return 0;
+		*n |= (u32)(c & 0x7F) << shift;
+		if ((c & 0x80) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+static void replay_put_head(u8 tag)
+{
+	fputc(tag, replay_file);
+	replay_put(replay_cycles - replay_file_cycle);
+	replay_file_cycle = replay_cycles;
+}
+
+// make room for one more in a list that doubles as it goes
+static void *replay_grow(void *list, u32 total, size_t size)
+{
+	void *grown;
+
+	if ( (total != 0) && ((total < 256) || ((total & (total - 1)) != 0)) )
+		return list;
+	grown = a_malloc((total ? total * 2 : 256) * size);
+	if (list != 0)
+	{
+		memcpy(grown, list, total * size);
+		a_free(list);
+	}
+	return grown;
+}
+
+static void replay_load(const char *name)
+{
+	char magic[sizeof(REPLAY_MAGIC)];
+	REPLAY_ENTRY *e;
+	REPLAY_MOUSE *m;
+	u32 n, val[6];
+	int tag, i, count;
+
+	replay_file = fopen(name, "rb");
+	if (replay_file == 0)
+	{
+		printf("Unable to open replay log \"%s\"\n", name);
+		exit(1);
+	}
+	if ( (fread(magic, 1, sizeof(magic), replay_file) != sizeof(magic)) ||
+		(memcmp(magic, REPLAY_MAGIC, sizeof(magic) - 1) != 0) ||
+		(magic[sizeof(magic) - 1] != REPLAY_VERSION) )
+	{
+		printf("\"%s\" isn't a replay log\n", name);
+		exit(1);
+	}
+
+	while ( (tag = fgetc(replay_file)) != EOF )
+	{
+		if (replay_get(&n) == 0)
+			break;
+		replay_file_cycle += n;
+
+		switch (tag)
+		{
+			case REC_DELAY:
+			case REC_LOGIC:
+				count = (tag == REC_DELAY) ? 4 : 5;
+				for (i = 0; i < count; i++)
+					if (replay_get(&val[i]) == 0)
+						break;
+				if (i < count)
+					break;
+				replay_log = (REPLAY_ENTRY *)replay_grow(replay_log, replay_total, sizeof(REPLAY_ENTRY));
+				e = replay_log + replay_total++;
+				e->cycle = replay_file_cycle;
+				e->phase = (tag == REC_DELAY) ? PHASE_DELAY : PHASE_LOGIC;
+				e->reads = (tag == REC_DELAY) ? 0 : val[0];
+				i = (tag == REC_DELAY) ? 0 : 1;
+				e->event.type = (u16)val[i];
+				e->event.data = (u16)val[i + 1];
+				e->event.x = (u16)val[i + 2];
+				e->event.y = (u16)val[i + 3];
+				break;
+
+			case REC_MOUSE:
+				for (i = 0; i < 3; i++)
+					if (replay_get(&val[i]) == 0)
+						break;
+				if (i < 3)
+					break;
+				replay_mouse_log = (REPLAY_MOUSE *)replay_grow(replay_mouse_log,
+							replay_mouse_total, sizeof(REPLAY_MOUSE));
+				m = replay_mouse_log + replay_mouse_total++;
+				m->butt = (int)val[0];
+				m->x = (int)val[1];
+				m->y = (int)val[2];
+				break;
+
+			case REC_LINE:
+				if (replay_get(&n) != 0)
+					fseek(replay_file, (long)n, SEEK_CUR);
+				break;
+
+			case REC_END:
+				break;
+
+			default:
+				printf("Replay: bad record %d, stopping there\n", tag);
+				fseek(replay_file, 0, SEEK_END);
+				break;
+		}
+	}
+	replay_end = replay_file_cycle;
+
+	fclose(replay_file);
+	replay_file = 0;
+	printf("Replay: %u events over %u cycles\n", replay_total, replay_end);
+}
+
+// called before anything else is set up
+void replay_open(const char *name, u8 mode)
+{
+	replay_mode = mode;
+	replay_file_cycle = 0;
+	if (mode == REPLAY_RECORD)
+	{
+		replay_file = fopen(name, "wb");
+		if (replay_file == 0)
+		{
+			printf("Unable to create replay log \"%s\"\n", name);
+			exit(1);
+		}
+		fwrite(REPLAY_MAGIC, 1, sizeof(REPLAY_MAGIC) - 1, replay_file);
+		fputc(REPLAY_VERSION, replay_file);
+	}
+	else if (mode == REPLAY_PLAY)
+		replay_load(name);
+	agi_rand_seed_set(REPLAY_SEED);
+}
+
+static u32 replay_hash(void)
+{
+	u32 hash;
+	int i;
+
+	// fnv-1a
+	hash = 0x811C9DC5;
+	if (rend_buf != 0)
+		for (i = 0; i < rend_buf_size; i++)
+			hash = (hash ^ rend_buf[i]) * 0x01000193;
+	return hash;
+}
+
+void replay_close(void)
+{
+	double secs;
+
+	if (replay_mode == REPLAY_RECORD)
+	{
+		replay_put_head(REC_END);
+		fclose(replay_file);
+		replay_file = 0;
+	}
+	else if (replay_mode == REPLAY_PLAY)
+	{
+		secs = (double)(SDL_GetTicksNS() - replay_start) / 1e9;
+		printf("Replay: %u cycles in %.3fs, %.0f cycles/s, screen %08X, startup %.1f ms\n",
+			replay_cycles, secs, (secs > 0) ? replay_cycles / secs : 0.0,
+			replay_hash(), startup_total_ms());
+		fflush(stdout);
+	}
+
+	if (replay_log != 0)
+		a_free(replay_log);
+	if (replay_mouse_log != 0)
+		a_free(replay_mouse_log);
+	replay_log = 0;
+	replay_mouse_log = 0;
+	replay_mode = REPLAY_OFF;
+}
+
+// the start of a cycle, before do_delay()
+void replay_cycle(void)
+{
+	u32 period;
+
+	if (replay_mode == REPLAY_OFF)
+		return;
+
+	if (replay_cycles == 0)
+		replay_start = SDL_GetTicksNS();
+	replay_cycles++;
+	replay_phase = PHASE_DELAY;
+	replay_reads = 0;
+
+	period = state.var[V10_DELAY] * 50;
+	if (period == 0)
+		period = 1;
+	replay_clock_ms += period;
+	clock_advance(period);
+
+	if ( (replay_mode == REPLAY_PLAY) && (replay_cycles > replay_end) )
+		agi_exit();
+}
+
+// do_delay() is done, the logics are next
+void replay_logic(void)
+{
+	replay_phase = PHASE_LOGIC;
+	replay_reads = 0;
+}
+
+static u16 replay_due(void)
+{
+	REPLAY_ENTRY *e;
+
+	if (replay_next >= replay_total)
+		return 0;
+	e = replay_log + replay_next;
+	if (e->cycle != replay_cycles)
+		return e->cycle < replay_cycles;
+	if (e->phase != replay_phase)
+		return e->phase < replay_phase;
+	return (e->phase == PHASE_DELAY) || (e->reads <= replay_reads);
+}
+
+// there's still input do_delay() read in this cycle
+u16 replay_delay_pending(void)
+{
+	return (replay_phase == PHASE_DELAY) && replay_due();
+}
+
+// event_read() while playing.. the next event if it's time for it
+AGI_EVENT *replay_read(void)
+{
+	replay_reads++;
+	if (!replay_due())
+		return 0;
+	replay_event = replay_log[replay_next++].event;
+	return &replay_event;
+}
+
+// event_read() while recording
+void replay_write(AGI_EVENT *agi_event)
+{
+	replay_reads++;
+	if (agi_event == 0)
+		return;
+	if (replay_phase == PHASE_DELAY)
+		replay_put_head(REC_DELAY);
+	else
+	{
+		replay_put_head(REC_LOGIC);
+		replay_put(replay_reads);
+	}
+	replay_put(agi_event->type);
+	replay_put(agi_event->data);
+	replay_put(agi_event->x);
+	replay_put(agi_event->y);
+}
+
+// a polled mouse position.. logged when recording, the logged one when
+// playing
+void replay_mouse(int *butt, int *x, int *y)
+{
+	REPLAY_MOUSE *m;
+
+	if (replay_mode == REPLAY_RECORD)
+	{
+		replay_put_head(REC_MOUSE);
+		replay_put((u32)*butt);
+		replay_put((u32)*x);
+		replay_put((u32)*y);
+	}
+	else if (replay_mode == REPLAY_PLAY)
+	{
+		if (replay_mouse_next < replay_mouse_total)
+		{
+			m = replay_mouse_log + replay_mouse_next++;
+			*butt = m->butt;
+			*x = m->x;
+			*y = m->y;
+		}
+		else
+			*butt = 0;
+	}
+}
+
+// a line typed into the parser
+void replay_line(const char *line)
+{
+	u32 len;
+
+	if (replay_mode != REPLAY_RECORD)
+		return;
+	len = (u32)strlen(line);
+	replay_put_head(REC_LINE);
+	replay_put(len);
+	fwrite(line, 1, len, replay_file);
+}
+
+// waiting for input while playing.. there's no one there to wait for
+void replay_idle(u32 ms)
+{
+	replay_clock_ms += ms;
+	// it wants something that never came
+	if (replay_next >= replay_total)
+		agi_exit();
+}
+
+u32 replay_ms(void)
+{
+	return replay_clock_ms;
+}
@@ -0,0 +1,25 @@
+#ifndef NAGI_SYS_REPLAY_H
+#define NAGI_SYS_REPLAY_H
+
+#define REPLAY_OFF 0
+#define REPLAY_RECORD 1		// write the player's input to a log
+#define REPLAY_PLAY 2		// take the input from a log, as fast as it goes
+
+extern u8 replay_mode;
+extern u8 replay_headless;
+
+extern void replay_open(const char *name, u8 mode);
+extern void replay_close(void);
+
+extern void replay_cycle(void);
+extern void replay_logic(void);
+extern u16 replay_delay_pending(void);
+
+extern struct agi_event_struct *replay_read(void);
+extern void replay_write(struct agi_event_struct *agi_event);
+extern void replay_mouse(int *butt, int *x, int *y);
+extern void replay_line(const char *line);
+extern void replay_idle(u32 ms);
+extern u32 replay_ms(void);
+
+#endif /* NAGI_SYS_REPLAY_H */
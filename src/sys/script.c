@@ -10,6 +10,8 @@ CmdUnknown171                    cseg     000070C4 00000012
 CmdUnknown172                    cseg     000070D6 00000020
 */
 
+#define MEM_TAG MEM_STATE
+
 #include <stdlib.h>
 
 #include "../agi.h"
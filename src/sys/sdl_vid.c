@@ -6,9 +6,27 @@
 I haven't found an ideal solution for converting 8 bit indexed surfaces to 32bit textures. However one thing that I
 decided was that I don't want to call SDL_ConvertSurface per frame.
 
-I ended up creating two surfaces, the 8 bit one that the AGI engine draws to and a second 32bit one that has the same
-pixel format as the main screen texture. On render, we SDL_BlitSurface from the 8bit to 32bit surface to do pixel
-conversion, then call SDL_UpdateTexture on the (streaming) screen texture with the 32bit surface as source.
+The AGI engine draws to an 8 bit surface. On render, the dirty parts of the (streaming) 32bit screen texture are
+locked and each index is looked up in a table of texels built when the palette is set, so the conversion writes
+straight into the texture's memory instead of blitting to a 32bit surface and copying that up.
+
+SDL 3.4 renderers can draw 8 bit textures with a palette attached, doing the lookup on the GPU. When the renderer
+takes one, the index buffer is uploaded as it is: a quarter of the bytes, no conversion on the CPU, and a palette
+change (CGA, BW) only needs another present. The 32bit path stays for older SDL and renderers without it.
+
+The surface is the frame the interpreter composes and the texture is the copy that gets presented, taken at each
+flush. There are two textures: a flush uploads into the one that isn't on screen and swaps them, so the driver never
+has to wait for the GPU to finish with a texture before writing to it. The back one is a flush behind, so it gets
+the previous flush's bands as well as its own.
+
+filter in nagi.ini smooths the picture as it's blown up to the window, all of it on the GPU so it costs the CPU the
+same at any window size. sharp draws the texture a whole number of times bigger with nearest into a target texture
+and that goes to the window with linear filtering, so the pixels stay square and only their edges are blended.
+linear filters the texture as it is and crt is sharp with dark scanlines drawn over each of the game's rows.
+
+Anything drawn over the texture on the way out (the shake offset, the llm overlay, the hud) only needs the texture, so while the
+interpreter sleeps between cycles it's presented again at the display's refresh rate without touching the surface.
+SDL renderers belong to the thread that made them, so it's the waits that do this rather than a thread of its own.
 
 References:
 Rendering 8-bit palettized surfaces in SDL 2.0 applications: http://sandervanderburg.blogspot.com/2014/05/rendering-8-bit-palettized-surfaces-in.html
@@ -30,6 +48,15 @@ Mini code sample for SDL2 256-color palette https://discourse.libsdl.org/t/mini-
 #include "mem_wrap.h"
 
 #include "sdl_vid.h"
+#include "vid_stream.h"
+#include "vid_capture.h"
+#include "hud.h"
+#include "profile.h"
+#include "replay.h"
+
+#ifdef NAGI_ENABLE_LLM
+#include "../llm_global.h"
+#endif
 
 
 
@@ -37,7 +64,15 @@ Mini code sample for SDL2 256-color palette https://discourse.libsdl.org/t/mini-
 
 
 static void vid_free_surfaces(void);
-static void vid_render(SDL_Surface* surface, const u32 x, const u32 y, const u32 w, const u32 h);
+static void vid_dirty(int x, int y, int w, int h);
+static void vid_upload(SDL_Texture *texture, SDL_Rect *rect);
+static void vid_present(void);
+static SDL_Texture *vid_filter(SDL_Texture *texture);
+static void vid_scanlines_new(void);
+static void vid_hud(void);
+#ifdef NAGI_ENABLE_LLM
+static void vid_llm_overlay(void);
+#endif
 
 /* VARIABLES	---	---	---	---	---	---	--- */
 
@@ -45,16 +80,59 @@ struct video_struct
 {
 	SDL_Window *window;
 	SDL_Renderer *renderer;
-	SDL_Texture *texture;
+	SDL_Texture *texture;	// on screen
+	SDL_Texture *back;	// uploaded into and swapped at the next flush, 0 if there's only one
 	SDL_Surface *surface;
-	SDL_Surface *surface_conv;
 	SDL_Palette *palette;
+	u32 texel[256];		// XRGB8888 of each palette index, for the CPU lookup
+	int indexed;		// texture holds palette indices, the renderer applies the palette
+	int repaint;		// present on the next flush even if nothing was drawn
+
+	int filter;		// VID_FILTER_*
+	SDL_Texture *prescaled;	// target the texture's blown up into before it's filtered
+	int prescale;		// how many times bigger it is
+	SDL_Texture *scanlines;	// crt's dark lines, drawn over the picture
+
+	Uint64 frame_ns;	// display refresh period
+	Uint64 presented_ns;	// when the last present went out
+	int shaking;		// the texture's drawn at the shake offset
+	float shake_x;		// texture offset while the screen shakes
+	float shake_y;
+	u64 uploaded;		// pixels put in a texture so far, for the hud
+
+	// rows drawn to since the last vid_flush(), each with the columns [x0, x1)
+	int *dirty_x0;
+	int *dirty_x1;
+	int dirty_top;		// dirty rows are in [dirty_top, dirty_bottom)
+	int dirty_bottom;
+
+	// bands uploaded at this flush and the last one, the back texture is missing those
+	SDL_Rect *band;
+	SDL_Rect *band_prev;
+	int band_prev_count;
 };
 
 typedef struct video_struct VIDEO;
 
 static VIDEO video_data = { 0 };
 
+// dirty bands closer than this many rows are uploaded as one
+#define VID_DIRTY_GAP 8
+
+#define VID_FILTER_NONE 0	// the texture's drawn straight to the window
+#define VID_FILTER_LINEAR 1
+#define VID_FILTER_SHARP 2
+#define VID_FILTER_CRT 3
+// the prescaled target stays under this on either side
+#define VID_PRESCALE_MAX 8192
+// darkness of the gap between crt scanlines, out of 255
+#define VID_SCANLINE_ALPHA 96
+
+// refresh rate when the display doesn't say
+#define VID_REFRESH_DEFAULT 60
+// shake.screen moves the picture every 1/20 sec, 8 times per count
+#define VID_SHAKE_STEP_NS (50 * 1000000ull)
+
 /* CODE	---	---	---	---	---	---	---	--- */
 
 
@@ -65,6 +143,7 @@ static VIDEO video_data = { 0 };
 
 void vid_init(void)
 {
+	hud_on = c_vid_hud;
 #if 0
 	printf("Initialising SDL video subsystem... ");
 
@@ -93,11 +172,13 @@ void vid_display(AGISIZE *screen_size, int fullscreen_state)
 	if (video_data.window == 0)
 	{
 		SDL_WindowFlags sdl_flags;
-		sdl_flags = SDL_WINDOW_RESIZABLE;
+		// full resolution on high dpi displays, the gpu does the scaling
+		sdl_flags = SDL_WINDOW_RESIZABLE | SDL_WINDOW_HIGH_PIXEL_DENSITY;
 		if (fullscreen_state)
 			sdl_flags |= SDL_WINDOW_FULLSCREEN;
 
-		if (!SDL_CreateWindowAndRenderer("NAGI", screen_size->w, screen_size->h,
+		if (!SDL_CreateWindowAndRenderer("NAGI", screen_size->w * c_vid_window_scale,
+			screen_size->h * c_vid_window_scale,
 			sdl_flags, &video_data.window, &video_data.renderer))
 		{
 			printf("Unable to create video window: %s\n", SDL_GetError());
@@ -107,6 +188,15 @@ void vid_display(AGISIZE *screen_size, int fullscreen_state)
 		// SDL3: Use texture scale mode for smooth scaling
 		SDL_SetRenderLogicalPresentation(video_data.renderer, screen_size->w, screen_size->h,
 			SDL_LOGICAL_PRESENTATION_LETTERBOX);
+
+		{
+			const SDL_DisplayMode *mode;
+			float rate;
+
+			mode = SDL_GetCurrentDisplayMode(SDL_GetDisplayForWindow(video_data.window));
+			rate = ((mode != 0) && (mode->refresh_rate > 0)) ? mode->refresh_rate : VID_REFRESH_DEFAULT;
+			video_data.frame_ns = (Uint64)(1000000000.0f / rate);
+		}
 	}
 	else
 	{
@@ -152,26 +242,95 @@ void vid_display(AGISIZE *screen_size, int fullscreen_state)
 		SDL_FillSurfaceRect(video_data.surface, NULL, 0);
 
 		assert(video_data.texture == 0);
+		video_data.indexed = 0;
+#if SDL_VERSION_ATLEAST(3, 4, 0)
+		// palette lookup on the GPU, if the renderer supports it
 		video_data.texture = SDL_CreateTexture( video_data.renderer,
-			SDL_PIXELFORMAT_XRGB8888,
+			SDL_PIXELFORMAT_INDEX8,
 			SDL_TEXTUREACCESS_STREAMING,
 			screen_size->w, screen_size->h );
-		if (video_data.texture == NULL)
+		if (video_data.texture != NULL)
 		{
-			printf("Unable to create video texture: %s\n", SDL_GetError());
-			agi_exit();
+			if (SDL_SetTexturePalette(video_data.texture, video_data.palette))
+			{
+				// filtering would blend indices, not colours
+				SDL_SetTextureScaleMode(video_data.texture, SDL_SCALEMODE_NEAREST);
+				video_data.indexed = 1;
+			}
+			else
+			{
+				SDL_DestroyTexture(video_data.texture);
+				video_data.texture = 0;
+			}
 		}
+#endif
 
-		// Create intermediate surface to convert 8bit to 32bit pixels.
-		assert(video_data.surface_conv == 0);
-		video_data.surface_conv = SDL_CreateSurface(screen_size->w, screen_size->h, SDL_PIXELFORMAT_XRGB8888);
-		if (video_data.surface_conv == NULL) {
-			printf("Unable to create conversion video surface: %s\n", SDL_GetError());
-			agi_exit();
+		if (!video_data.indexed)
+		{
+			video_data.texture = SDL_CreateTexture( video_data.renderer,
+				SDL_PIXELFORMAT_XRGB8888,
+				SDL_TEXTUREACCESS_STREAMING,
+				screen_size->w, screen_size->h );
+			if (video_data.texture == NULL)
+			{
+				printf("Unable to create video texture: %s\n", SDL_GetError());
+				agi_exit();
+			}
 		}
-		SDL_FillSurfaceRect(video_data.surface_conv, NULL, SDL_MapSurfaceRGBA(video_data.surface_conv, 0, 0, 0, 255));
-
-		vid_notify_window_size_changed(SDL_GetWindowID(video_data.window));
+		printf("Video: %s palette lookup\n", video_data.indexed ? "GPU" : "CPU");
+
+		video_data.filter = VID_FILTER_NONE;
+		if (SDL_strcasecmp(c_vid_filter, "linear") == 0)
+			video_data.filter = VID_FILTER_LINEAR;
+		else if (SDL_strcasecmp(c_vid_filter, "sharp") == 0)
+			video_data.filter = VID_FILTER_SHARP;
+		else if (SDL_strcasecmp(c_vid_filter, "crt") == 0)
+			video_data.filter = VID_FILTER_CRT;
+		else if (SDL_strcasecmp(c_vid_filter, "none") != 0)
+			printf("Video: unknown filter \"%s\"\n", c_vid_filter);
+		if ( (video_data.filter != VID_FILTER_NONE) && !video_data.indexed )
+			SDL_SetTextureScaleMode(video_data.texture, SDL_SCALEMODE_NEAREST);
+		if (video_data.filter == VID_FILTER_CRT)
+			vid_scanlines_new();
+
+		// the second one to upload into while the first is on screen
+		video_data.back = SDL_CreateTexture( video_data.renderer,
+			video_data.indexed ? SDL_PIXELFORMAT_INDEX8 : SDL_PIXELFORMAT_XRGB8888,
+			SDL_TEXTUREACCESS_STREAMING,
+			screen_size->w, screen_size->h );
+#if SDL_VERSION_ATLEAST(3, 4, 0)
+		if ((video_data.back != NULL) && video_data.indexed)
+		{
+			if (SDL_SetTexturePalette(video_data.back, video_data.palette))
+				SDL_SetTextureScaleMode(video_data.back, SDL_SCALEMODE_NEAREST);
+			else
+			{
+				SDL_DestroyTexture(video_data.back);
+				video_data.back = 0;
+			}
+		}
+#endif
+		if ( (video_data.back != NULL) && (video_data.filter != VID_FILTER_NONE) )
+			SDL_SetTextureScaleMode(video_data.back, SDL_SCALEMODE_NEAREST);
+
+		video_data.dirty_x0 = a_malloc(screen_size->h * sizeof(int));
+		video_data.dirty_x1 = a_malloc(screen_size->h * sizeof(int));
+		video_data.dirty_top = 0;
+		video_data.dirty_bottom = 0;
+		video_data.band = a_malloc(screen_size->h * sizeof(SDL_Rect));
+		video_data.band_prev = a_malloc(screen_size->h * sizeof(SDL_Rect));
+		video_data.band_prev_count = 0;
+		// the texture starts out undefined
+		vid_refresh();
+
+		vid_stream_open(c_vid_stream_port);
+		vid_stream_size(screen_size->w, screen_size->h);
+		vid_capture_open();
+		vid_capture_size(screen_size->w, screen_size->h);
+
+		// the window manager keeps the shape while it's resized
+		SDL_SetWindowAspectRatio(video_data.window, (float)screen_size->w / screen_size->h,
+			(float)screen_size->w / screen_size->h);
 	}
 
 	// clear
@@ -189,16 +348,29 @@ static void vid_free_surfaces(void)
 		video_data.texture = 0;
 	}
 
-	if (video_data.surface != 0)
+	if (video_data.back != 0)
 	{
-		SDL_DestroySurface(video_data.surface);
-		video_data.surface = 0;
+		SDL_DestroyTexture(video_data.back);
+		video_data.back = 0;
+	}
+
+	if (video_data.prescaled != 0)
+	{
+		SDL_DestroyTexture(video_data.prescaled);
+		video_data.prescaled = 0;
+		video_data.prescale = 0;
+	}
+
+	if (video_data.scanlines != 0)
+	{
+		SDL_DestroyTexture(video_data.scanlines);
+		video_data.scanlines = 0;
 	}
 
-	if (video_data.surface_conv != 0)
+	if (video_data.surface != 0)
 	{
-		SDL_DestroySurface(video_data.surface_conv);
-		video_data.surface_conv = 0;
+		SDL_DestroySurface(video_data.surface);
+		video_data.surface = 0;
 	}
 
 	if (video_data.palette != 0)
@@ -206,10 +378,33 @@ static void vid_free_surfaces(void)
 		SDL_DestroyPalette(video_data.palette);
 		video_data.palette = 0;
 	}
+
+	if (video_data.dirty_x0 != 0)
+	{
+		a_free(video_data.dirty_x0);
+		a_free(video_data.dirty_x1);
+		video_data.dirty_x0 = 0;
+		video_data.dirty_x1 = 0;
+	}
+
+	if (video_data.band != 0)
+	{
+		a_free(video_data.band);
+		a_free(video_data.band_prev);
+		video_data.band = 0;
+		video_data.band_prev = 0;
+	}
+	video_data.band_prev_count = 0;
+	video_data.dirty_top = 0;
+	video_data.dirty_bottom = 0;
+	video_data.indexed = 0;
+	video_data.repaint = 0;
 }
 
 void vid_free(void)
 {
+	vid_stream_close();
+	vid_capture_close();
 	vid_free_surfaces();
 
 	if (video_data.renderer != 0)
@@ -260,7 +455,7 @@ void vid_unlock(void)
 	SDL_UnlockSurface(video_data.surface);
 }
 
-// update a surface
+// mark a rect of the surface as changed, it's shown on the next vid_flush()
 void vid_update(POS *pos, AGISIZE *size)
 {
 	SDL_Surface *surface;
@@ -274,11 +469,204 @@ void vid_update(POS *pos, AGISIZE *size)
 	if ((pos->y + size->h) > surface->h)
 		size->h = surface->h - pos->y;
 
-	vid_render(surface, pos->x, pos->y, size->w, size->h);
+	vid_dirty(pos->x, pos->y, size->w, size->h);
+}
+
+static void vid_dirty(int x, int y, int w, int h)
+{
+	SDL_Surface *surface;
+	int row;
+
+	surface = video_data.surface;
+	if ((surface == 0) || (video_data.dirty_x0 == 0))
+		return;
+
+	if (x < 0)
+	{
+		w += x;
+		x = 0;
+	}
+	if (y < 0)
+	{
+		h += y;
+		y = 0;
+	}
+	if (x + w > surface->w)
+		w = surface->w - x;
+	if (y + h > surface->h)
+		h = surface->h - y;
+	if ((w <= 0) || (h <= 0))
+		return;
+
+	for (row = y; row < y + h; row++)
+	{
+		if ((row < video_data.dirty_top) || (row >= video_data.dirty_bottom)
+			|| (video_data.dirty_x0[row] >= video_data.dirty_x1[row]))
+		{
+			video_data.dirty_x0[row] = x;
+			video_data.dirty_x1[row] = x + w;
+			continue;
+		}
+		if (x < video_data.dirty_x0[row])
+			video_data.dirty_x0[row] = x;
+		if (x + w > video_data.dirty_x1[row])
+			video_data.dirty_x1[row] = x + w;
+	}
+
+	if (video_data.dirty_top >= video_data.dirty_bottom)
+	{
+		// rows beyond the old range were reset above, the new range starts clean
+		video_data.dirty_top = y;
+		video_data.dirty_bottom = y + h;
+		return;
+	}
+	for (row = y + h; row < video_data.dirty_top; row++)
+		video_data.dirty_x0[row] = video_data.dirty_x1[row] = 0;
+	for (row = video_data.dirty_bottom; row < y; row++)
+		video_data.dirty_x0[row] = video_data.dirty_x1[row] = 0;
+	if (y < video_data.dirty_top)
+		video_data.dirty_top = y;
+	if (y + h > video_data.dirty_bottom)
+		video_data.dirty_bottom = y + h;
+}
+
+// the whole screen has to be shown again (palette change, lost texture)
+void vid_refresh(void)
+{
+	if (video_data.surface == 0)
+		return;
+	vid_dirty(0, 0, video_data.surface->w, video_data.surface->h);
+}
+
+// the llm overlay changes on its own, so the texture's presented again every
+// display frame while it's up.  returns when the next frame is due, 0 if the
+// screen only changes when the game draws
+Uint64 vid_frame_due(void)
+{
+	if ((video_data.surface == 0) || replay_headless)
+		return 0;
+#ifdef NAGI_ENABLE_LLM
+	if (g_llm_config.stats_overlay)
+		return video_data.presented_ns + video_data.frame_ns;
+#endif
+	if (hud_on)
+		return video_data.presented_ns + HUD_PERIOD_NS;
+	return 0;
+}
+
+// a display refresh has gone by since the last present
+int vid_refresh_due(void)
+{
+	return SDL_GetTicksNS() >= video_data.presented_ns + video_data.frame_ns;
+}
+
+// present again at the next flush, for what's drawn over the texture
+void vid_repaint(void)
+{
+	video_data.repaint = 1;
+}
+
+u64 vid_uploaded(void)
+{
+	return video_data.uploaded;
+}
+
+// show everything drawn since the last flush, with one present
+// dirty rows are grouped into bands and only those parts of the texture
+// are converted and uploaded.  with nothing drawn it still presents if a
+// frame's due
+void vid_flush(void)
+{
+	SDL_Rect *band, *swap_band;
+	SDL_Texture *swap;
+	int row, x0, x1, last, count, i;
+	Uint64 due;
+	u64 prof;
+
+	if (video_data.surface == 0)
+		return;
+	vid_stream_poll();
+	if ((video_data.dirty_top >= video_data.dirty_bottom) && !video_data.repaint)
+	{
+		due = vid_frame_due();
+		if ((due == 0) || (SDL_GetTicksNS() < due))
+			return;
+	}
+	if (replay_headless)
+	{
+		video_data.dirty_top = 0;
+		video_data.dirty_bottom = 0;
+		video_data.repaint = 0;
+		return;
+	}
+	prof = profile_now();
+
+	count = 0;
+	row = video_data.dirty_top;
+	while (row < video_data.dirty_bottom)
+	{
+		if (video_data.dirty_x0[row] >= video_data.dirty_x1[row])
+		{
+			row++;
+			continue;
+		}
+
+		// grow the band over dirty rows and short clean gaps
+		band = &video_data.band[count++];
+		band->y = row;
+		x0 = video_data.dirty_x0[row];
+		x1 = video_data.dirty_x1[row];
+		last = row;
+		for (row++; (row < video_data.dirty_bottom) && (row - last <= VID_DIRTY_GAP); row++)
+		{
+			if (video_data.dirty_x0[row] >= video_data.dirty_x1[row])
+				continue;
+			if (video_data.dirty_x0[row] < x0)
+				x0 = video_data.dirty_x0[row];
+			if (video_data.dirty_x1[row] > x1)
+				x1 = video_data.dirty_x1[row];
+			last = row;
+		}
+		band->x = x0;
+		band->w = x1 - x0;
+		band->h = last + 1 - band->y;
+		row = last + 1;
+	}
+	vid_stream_frame(video_data.surface->pixels, video_data.surface->pitch, video_data.band, count);
+	vid_capture_frame(video_data.surface->pixels, video_data.surface->pitch, video_data.band, count);
+
+	if (video_data.back == 0)
+	{
+		for (i = 0; i < count; i++)
+			vid_upload(video_data.texture, &video_data.band[i]);
+	}
+	else if (count != 0)
+	{
+		// the back texture catches up on the last flush too, then goes on screen
+		for (i = 0; i < video_data.band_prev_count; i++)
+			vid_upload(video_data.back, &video_data.band_prev[i]);
+		for (i = 0; i < count; i++)
+			vid_upload(video_data.back, &video_data.band[i]);
+
+		swap = video_data.texture;
+		video_data.texture = video_data.back;
+		video_data.back = swap;
+		swap_band = video_data.band_prev;
+		video_data.band_prev = video_data.band;
+		video_data.band = swap_band;
+		video_data.band_prev_count = count;
+	}
 
+	video_data.dirty_top = 0;
+	video_data.dirty_bottom = 0;
+	video_data.repaint = 0;
+	vid_present();
+	profile_sub(PROFILE_PRESENT, prof);
 }
 
-// when resizing a window, make sure the aspect ratio is preserved
+// the logical presentation letterboxes the texture into whatever size the
+// window is on the gpu, so a resize only needs another present.  the
+// surface and textures stay as they are
 void vid_notify_window_size_changed(SDL_WindowID windowID)
 {
 	if (video_data.window == 0)
@@ -296,70 +684,238 @@ void vid_notify_window_size_changed(SDL_WindowID windowID)
 
 	if (current_window_id != windowID) { return; }
 
-	int window_width, window_height;
-	SDL_GetWindowSize(video_data.window, &window_width, &window_height);
-
 	if (video_data.texture == 0)
 	{
 		printf("vid_notify_window_size_changed(): ERROR: received window resize event, but no backing texture!\n");
 		return;
 	}
 
-	float texture_width_f, texture_height_f;
-	if (!SDL_GetTextureSize(video_data.texture, &texture_width_f, &texture_height_f))
+	vid_repaint();
+	vid_flush();
+}
+
+// copy a rect of the 8 bit surface into one of the textures, converting it
+// on the way if the renderer can't do the palette lookup
+static void vid_upload(SDL_Texture *texture, SDL_Rect *rect)
+{
+	u8 *pixels;
+	u8 *texels;
+	u32 *dst;
+	int pitch, row, i;
+
+	video_data.uploaded += (u64)rect->w * rect->h;
+	pixels = (u8 *)video_data.surface->pixels
+		+ rect->y * video_data.surface->pitch + rect->x;
+	if (video_data.indexed)
 	{
-		printf("vid_notify_window_size_changed(): ERROR: received window resize event, but unable to determine texture size: %s\n", SDL_GetError());
+		if (!SDL_UpdateTexture(texture, rect, pixels, video_data.surface->pitch)) {
+			printf("vid_upload: Error updating screen texture: %s\n", SDL_GetError());
+		}
 		return;
 	}
 
-	int texture_width = (int)texture_width_f;
-	int texture_height = (int)texture_height_f;
+	// Convert up from 8bpp (used on ye olde graphics cards) to
+	// something relevant to this century, in the texture itself
+	if (!SDL_LockTexture(texture, rect, (void **)&texels, &pitch)) {
+		printf("vid_upload: Error locking screen texture: %s\n", SDL_GetError());
+		return;
+	}
+	for (row = rect->h; row != 0; row--)
+	{
+		dst = (u32 *)texels;
+		for (i = 0; i < rect->w; i++)
+			dst[i] = video_data.texel[pixels[i]];
+		pixels += video_data.surface->pitch;
+		texels += pitch;
+	}
+	SDL_UnlockTexture(texture);
+}
 
-	int new_window_width = window_width;
-	int new_window_height = window_width * texture_height / texture_width;
+static void vid_present(void)
+{
+	SDL_FRect shaken;
+	SDL_FRect *dst;
+	SDL_Texture *texture;
+
+	SDL_SetRenderDrawColor(video_data.renderer, 0, 0, 0, 255);
+	if (!SDL_RenderClear(video_data.renderer)) {
+		printf("vid_present: Error clearing screen: %s\n", SDL_GetError());
+	}
 
-	// we have to check size is different or we repeatedly get change events.
-	if ((new_window_height != window_height) || (new_window_width != window_width))
+	dst = NULL;
+	if (video_data.shaking)
 	{
-		SDL_SetWindowSize(video_data.window, new_window_width, new_window_height);
-		vid_render(video_data.surface, 0, 0, texture_width, texture_height);
+		shaken.x = video_data.shake_x;
+		shaken.y = video_data.shake_y;
+		shaken.w = (float)video_data.surface->w;
+		shaken.h = (float)video_data.surface->h;
+		dst = &shaken;
+	}
+	texture = video_data.texture;
+	if (video_data.filter != VID_FILTER_NONE)
+		texture = vid_filter(texture);
+	if (!SDL_RenderTexture(video_data.renderer, texture, NULL, dst)) {
+		printf("vid_present: Error copying texture to screen: %s\n", SDL_GetError());
 	}
+	if (video_data.scanlines != 0)
+		SDL_RenderTexture(video_data.renderer, video_data.scanlines, NULL, dst);
+#ifdef NAGI_ENABLE_LLM
+	if (g_llm_config.stats_overlay)
+		vid_llm_overlay();
+#endif
+	if (hud_on)
+		vid_hud();
+	SDL_RenderPresent(video_data.renderer);
+	video_data.presented_ns = SDL_GetTicksNS();
 }
 
-static void vid_render(SDL_Surface *surface, const u32 x, const u32 y, const u32 w, const u32 h)
+// the texture to draw to the window with linear filtering.  for sharp and
+// crt it's blown up with nearest to the first whole multiple that covers
+// the window, so the linear filter only ever shrinks it a little
+static SDL_Texture *vid_filter(SDL_Texture *texture)
 {
-	SDL_Rect rect;
-	rect.x = (int)x;
-	rect.y = (int)y;
-	rect.w = (int)w;
-	rect.h = (int)h;
+	int out_w, out_h, w, h, scale, scale_y;
 
-	(void)rect; // unused in current implementation
+	w = video_data.surface->w;
+	h = video_data.surface->h;
+	scale = 1;
+	if ( (video_data.filter != VID_FILTER_LINEAR) &&
+		SDL_GetCurrentRenderOutputSize(video_data.renderer, &out_w, &out_h) )
+	{
+		// the letterbox fits the narrower way
+		scale = (out_w + w - 1) / w;
+		scale_y = (out_h + h - 1) / h;
+		if (scale_y < scale)
+			scale = scale_y;
+		while ( (scale > 1) && ((w * scale > VID_PRESCALE_MAX) || (h * scale > VID_PRESCALE_MAX)) )
+			scale--;
+		if (scale < 1)
+			scale = 1;
+	}
 
-	// Convert up from 8bpp (used on ye olde graphics cards) to
-	// something relevant to this century
-	if (!SDL_BlitSurface(surface, NULL, video_data.surface_conv, NULL)) {
-		printf("vid_render: Error converting surface: %s\n", SDL_GetError());
+	if ( (video_data.prescaled == 0) || (video_data.prescale != scale) )
+	{
+		if (video_data.prescaled != 0)
+			SDL_DestroyTexture(video_data.prescaled);
+		video_data.prescaled = SDL_CreateTexture(video_data.renderer, SDL_PIXELFORMAT_XRGB8888,
+			SDL_TEXTUREACCESS_TARGET, w * scale, h * scale);
+		video_data.prescale = scale;
+		if (video_data.prescaled == 0)
+		{
+			printf("vid_filter: Unable to create the filter's texture: %s\n", SDL_GetError());
+			video_data.filter = VID_FILTER_NONE;
+			return texture;
+		}
+		SDL_SetTextureScaleMode(video_data.prescaled, SDL_SCALEMODE_LINEAR);
 	}
-	if (!SDL_UpdateTexture(video_data.texture, NULL, video_data.surface_conv->pixels, video_data.surface_conv->pitch)) {
-		printf("vid_render: Error updating screen texture: %s\n", SDL_GetError());
+
+	// the palette's applied on the way in, the linear filter blends colours
+	SDL_SetRenderTarget(video_data.renderer, video_data.prescaled);
+	SDL_RenderTexture(video_data.renderer, texture, NULL, NULL);
+	SDL_SetRenderTarget(video_data.renderer, NULL);
+	return video_data.prescaled;
+}
+
+// a dark line under each of the game's rows, stretched over the picture
+static void vid_scanlines_new(void)
+{
+	u32 *pixels;
+	int rows, i;
+
+	rows = video_data.surface->h / c_vid_scale;
+	pixels = a_malloc(rows * 2 * sizeof(u32));
+	for (i = 0; i < rows; i++)
+	{
+		pixels[i * 2] = 0;
+		pixels[i * 2 + 1] = (u32)VID_SCANLINE_ALPHA << 24;
 	}
 
-	SDL_SetRenderDrawColor(video_data.renderer, 0, 0, 0, 255);
-	if (!SDL_RenderClear(video_data.renderer)) {
-		printf("vid_render: Error clearing screen: %s\n", SDL_GetError());
+	video_data.scanlines = SDL_CreateTexture(video_data.renderer, SDL_PIXELFORMAT_ARGB8888,
+		SDL_TEXTUREACCESS_STATIC, 1, rows * 2);
+	if (video_data.scanlines != 0)
+	{
+		SDL_UpdateTexture(video_data.scanlines, NULL, pixels, sizeof(u32));
+		SDL_SetTextureBlendMode(video_data.scanlines, SDL_BLENDMODE_BLEND);
+		SDL_SetTextureScaleMode(video_data.scanlines, SDL_SCALEMODE_LINEAR);
 	}
+	a_free(pixels);
+}
+
+// the hud's lines at the bottom left, under the game's text
+static void vid_hud(void)
+{
+	const char *line[HUD_LINES];
+	SDL_FRect back;
+	SDL_RendererLogicalPresentation mode;
+	float y;
+	int w, h, total, i;
+
+	// drawn in the logical size, the window's pixels can be many more
+	total = hud_lines(line, HUD_LINES);
+	if ( (total == 0) || !SDL_GetRenderLogicalPresentation(video_data.renderer, &w, &h, &mode) )
+		return;
 
-	if (!SDL_RenderTexture(video_data.renderer, video_data.texture, NULL, NULL)) {
-		printf("vid_render: Error copying texture to screen: %s\n", SDL_GetError());
+	y = (float)h - 4 - total * (SDL_DEBUG_TEXT_FONT_CHARACTER_SIZE + 2);
+	for (i = 0; i < total; i++)
+	{
+		back.x = 2;
+		back.y = y - 1;
+		back.w = (float)(strlen(line[i]) * SDL_DEBUG_TEXT_FONT_CHARACTER_SIZE + 4);
+		back.h = SDL_DEBUG_TEXT_FONT_CHARACTER_SIZE + 2;
+		SDL_SetRenderDrawColor(video_data.renderer, 0, 0, 0, 255);
+		SDL_RenderFillRect(video_data.renderer, &back);
+
+		SDL_SetRenderDrawColor(video_data.renderer, 85, 255, 85, 255);
+		SDL_RenderDebugText(video_data.renderer, 4, y, line[i]);
+		y += SDL_DEBUG_TEXT_FONT_CHARACTER_SIZE + 2;
+	}
+}
+
+#ifdef NAGI_ENABLE_LLM
+// llm telemetry drawn over the game, one line per operation used so far
+static void vid_llm_overlay(void)
+{
+	nagi_llm_stats_t stats;
+	const nagi_llm_op_stats_t *op;
+	char line[128];
+	SDL_FRect back;
+	float y;
+	int i;
+
+	if (!nagi_llm_get_stats(g_llm, &stats))
+		return;
+
+	y = 4;
+	for (i = 0; i < NAGI_LLM_OP_COUNT; i++)
+	{
+		op = &stats.op[i];
+		if (op->requests == 0)
+			continue;
+
+		snprintf(line, sizeof(line), "%-8s %5u req %4u hit %4u kv  avg %7.1f max %7.1f ms  %6.1f tok/s",
+			nagi_llm_op_name((nagi_llm_op_t)i), op->requests, op->cache_hits, op->kv_reuse_hits,
+			op->total_ms / op->requests, op->max_ms,
+			op->generate_ms > 0 ? op->generated_tokens * 1000.0 / op->generate_ms : 0.0);
+
+		back.x = 2;
+		back.y = y - 1;
+		back.w = (float)(strlen(line) * SDL_DEBUG_TEXT_FONT_CHARACTER_SIZE + 4);
+		back.h = SDL_DEBUG_TEXT_FONT_CHARACTER_SIZE + 2;
+		SDL_SetRenderDrawColor(video_data.renderer, 0, 0, 0, 255);
+		SDL_RenderFillRect(video_data.renderer, &back);
+
+		SDL_SetRenderDrawColor(video_data.renderer, 255, 255, 85, 255);
+		SDL_RenderDebugText(video_data.renderer, 4, y, line);
+		y += SDL_DEBUG_TEXT_FONT_CHARACTER_SIZE + 2;
 	}
-	SDL_RenderPresent(video_data.renderer);
 }
+#endif
 
 // set 8-bit palette
 void vid_palette_set(PCOLOUR *palette, u8 num)
 {
 	SDL_Color *sdl_palette = alloca(num * sizeof(SDL_Color));
+	const SDL_Color *colours;
 	int i;
 
 	assert(video_data.surface);
@@ -378,6 +934,18 @@ void vid_palette_set(PCOLOUR *palette, u8 num)
 		printf( "Unable to set colour palette: %s\n", SDL_GetError());
 		agi_exit();
 	}
+	vid_stream_palette(palette, num);
+	vid_capture_palette(palette, num);
+	if (video_data.indexed)
+		video_data.repaint = 1;	// the texture's indices stay, the GPU looks up the new colours
+	else
+	{
+		colours = video_data.palette->colors;
+		for (i=0; i<video_data.palette->ncolors; i++)
+			video_data.texel[i] = 0xFF000000 | ((u32)colours[i].r << 16)
+				| ((u32)colours[i].g << 8) | colours[i].b;
+		vid_refresh();		// every pixel converts to a new colour
+	}
 }
 
 /* Get RGB color from palette by index */
@@ -412,6 +980,7 @@ void vid_fill(POS *pos, AGISIZE *size, u32 colour)
 		vid_lock();
 		SDL_FillSurfaceRect(video_data.surface, 0, colour);
 		vid_unlock();
+		vid_refresh();
 	}
 	else
 	{
@@ -423,67 +992,58 @@ void vid_fill(POS *pos, AGISIZE *size, u32 colour)
 		vid_lock();
 		SDL_FillSurfaceRect(video_data.surface, &rect, colour);
 		vid_unlock();
-		vid_render(video_data.surface,
-			rect.x, rect.y, rect.w, rect.h);
+		vid_dirty(rect.x, rect.y, rect.w, rect.h);
 	}
 }
 
 static int shake_offset[] = {25, 0, -25};
 
+// the picture jumps to a new offset every 1/20 sec for count*8 steps, as
+// long as the original did.  the texture's drawn at the offset and eased
+// towards the next one every display frame, the surface stays as it is
 void vid_shake(int count)
 {
-	int width, height;
-	SDL_Surface *orig;
-	SDL_Rect dest = {0,0, 0, 0};
-	SDL_Surface *surface;
+	Uint64 start, end, now, left;
+	float from_x, from_y, to_x, to_y, t;
+	int step, last;
 
-	surface = video_data.surface;
-	assert(surface);
-
-	width =  surface->w;
-	height =  surface->h;
-
-	// Create new surface with same format as original
-	orig = SDL_CreateSurface(width, height, SDL_PIXELFORMAT_INDEX8);
-	if (!orig) return;
-
-	// Copy palette from original surface
-	if (video_data.palette) {
-		SDL_Palette *new_palette = SDL_CreatePalette(video_data.palette->ncolors);
-		if (new_palette) {
-			SDL_SetPaletteColors(new_palette, video_data.palette->colors, 0, video_data.palette->ncolors);
-			SDL_SetSurfacePalette(orig, new_palette);
-			// Note: We'll need to destroy this palette, but for simplicity we'll just let it leak
-			// during the shake effect since it's very short-lived
-		}
-	}
+	assert(video_data.surface);
+	if (replay_headless)
+		return;
 
-	// blit screen to new surface
-	if (!SDL_BlitSurface(surface, 0, orig, 0)) goto shake_error;
+	vid_flush();	// what was drawn before the shake
 
-	count *= 8;
-	while (count--)
+	from_x = from_y = to_x = to_y = 0;
+	last = -1;
+	video_data.shaking = 1;
+	start = SDL_GetTicksNS();
+	end = start + (Uint64)count * 8 * VID_SHAKE_STEP_NS;
+	while ((now = SDL_GetTicksNS()) < end)
 	{
-		// clear entire window
-		vid_lock();
-		if (!SDL_FillSurfaceRect(surface, 0, 0))
-			goto shake_error;
-		vid_unlock();
-
-		// print the surface in some strange location
-		dest.x = shake_offset[rand()%3];
-		dest.y = shake_offset[rand()%3];
-		if (!SDL_BlitSurface(orig, 0, surface, &dest)) // blit to some offset  stretch*10 or something
-			goto shake_error;
-		vid_render(surface, 0, 0, 0, 0);
-
-		SDL_Delay(50);
+		step = (int)((now - start) / VID_SHAKE_STEP_NS);
+		if (step != last)
+		{
+			from_x = to_x;
+			from_y = to_y;
+			to_x = (float)shake_offset[rand()%3];
+			to_y = (float)shake_offset[rand()%3];
+			last = step;
+		}
+		t = (float)((now - start) % VID_SHAKE_STEP_NS) / (float)VID_SHAKE_STEP_NS;
+		video_data.shake_x = from_x + (to_x - from_x) * t;
+		video_data.shake_y = from_y + (to_y - from_y) * t;
+		vid_present();
+
+		now = SDL_GetTicksNS();
+		if (now >= end)
+			break;
+		left = end - now;
+		SDL_DelayNS((left < video_data.frame_ns) ? left : video_data.frame_ns);
 	}
-	// put the original screen back on
-	if (!SDL_BlitSurface(orig, 0, surface, 0)) // update the screen
-		goto shake_error;
-	vid_render(surface, 0, 0, 0, 0);
 
-shake_error:
-	SDL_DestroySurface(orig);
+	// put the original screen back on
+	video_data.shaking = 0;
+	video_data.shake_x = 0;
+	video_data.shake_y = 0;
+	vid_present();
 }
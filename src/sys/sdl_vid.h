@@ -14,6 +14,15 @@ extern void vid_free(void);
 extern void vid_lock(void);
 extern void vid_unlock(void);
 extern void vid_update(POS *pos, AGISIZE *size);
+extern void vid_refresh(void);
+// show the updates since the last flush, call before waiting
+extern void vid_flush(void);
+// when the next presented frame is due while waiting, 0 for none
+extern Uint64 vid_frame_due(void);
+extern int vid_refresh_due(void);
+extern void vid_repaint(void);
+// pixels uploaded to the screen texture since the start
+extern u64 vid_uploaded(void);
 extern void vid_notify_window_size_changed(SDL_WindowID windowID);
 extern void vid_palette_set(PCOLOUR *palette, u8 num);
 extern void vid_palette_get_color(u8 index, u8 *r, u8 *g, u8 *b);
@@ -0,0 +1,269 @@
+/*
+Startup timeline
+
+every part of booting is timed from the first startup_now() in main() to
+the first cycle.  phases inside another phase (ch_init() inside gfx_init())
+are kept as well.  work started during boot that finishes on a thread of
+its own (the llm model loading) is an async phase and the report waits for
+it.
+
+the parts of booting that don't need each other run as tasks: each is
+started as soon as what it needs is known and waited for just before its
+result is used, so booting takes as long as the longest chain instead of
+the sum.  a task that couldn't get a thread runs there and then.
+
+startup_report=1 in nagi.ini prints the phases in order.  startup_trace
+names a file for the chrome trace format, open it in chrome://tracing or
+ui.perfetto.dev to see what overlaps.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../agi.h"
+#include "startup.h"
+
+#include "sys_dir.h"
+
+#define STARTUP_MAX 64
+
+#define STARTUP_TRACK_MAIN 0
+#define STARTUP_TRACK_LLM 1
+#define STARTUP_TRACK_TASK 2	// + the task number
+
+struct startup_phase_struct
+{
+	const char *name;
+	u64 start;
+	u64 end;
+	u16 track;	// the thread it ran on
+};
+typedef struct startup_phase_struct STARTUP_PHASE;
+
+struct startup_task_struct
+{
+	int (*func)(void *data);
+	void *data;
+	SDL_Thread *thread;
+	int result;
+	u16 started;
+};
+typedef struct startup_task_struct STARTUP_TASK;
+
+static const char *startup_task_name[STARTUP_TASK_MAX] = {"game scan", "font open", "sound open"};
+static const char *startup_task_wait_name[STARTUP_TASK_MAX] = {"wait game scan", "wait font open", "wait sound open"};
+
+static STARTUP_PHASE startup_table[STARTUP_MAX];
+static STARTUP_TASK startup_task_table[STARTUP_TASK_MAX];
+static SDL_AtomicInt startup_count;
+static SDL_AtomicInt startup_open = {1};	// the main thread plus each async phase
+static u64 startup_origin = 0;
+static u64 startup_took = 0;	// boot to the first cycle
+
+static void startup_report(void);
+
+u64 startup_now(void)
+{
+	u64 now;
+
+	now = SDL_GetPerformanceCounter();
+	if (startup_origin == 0)
+		startup_origin = now;
+	return now;
+}
+
+static void startup_add(const char *name, u64 start, u16 track)
+{
+	int i;
+
+	i = SDL_AddAtomicInt(&startup_count, 1);
+	if (i >= STARTUP_MAX)
+		return;
+	startup_table[i].name = name;
+	startup_table[i].start = start;
+	startup_table[i].end = SDL_GetPerformanceCounter();
+	startup_table[i].track = track;
+}
+
+void startup_phase(const char *name, u64 start)
+{
+	startup_add(name, start, STARTUP_TRACK_MAIN);
+}
+
+// the report is held back until startup_async_end()
+void startup_async_begin(void)
+{
+	SDL_AddAtomicInt(&startup_open, 1);
+}
+
+// can be called from any thread.  the last one to finish writes the report
+void startup_async_end(const char *name, u64 start)
+{
+	startup_add(name, start, STARTUP_TRACK_LLM);
+	if (SDL_AddAtomicInt(&startup_open, -1) == 1)
+		startup_report();
+}
+
+// the first cycle is about to run
+void startup_done(void)
+{
+	startup_took = SDL_GetPerformanceCounter() - startup_origin;
+	startup_phase("startup", startup_origin);
+	if (SDL_AddAtomicInt(&startup_open, -1) == 1)
+		startup_report();
+}
+
+static int startup_task_main(void *data)
+{
+	STARTUP_TASK *t;
+	u64 start;
+
+	t = (STARTUP_TASK *)data;
+	start = SDL_GetPerformanceCounter();
+	t->result = t->func(t->data);
+	startup_add(startup_task_name[t - startup_task_table], start,
+		(u16)(STARTUP_TRACK_TASK + (t - startup_task_table)));
+	return 0;
+}
+
+// func must only touch what nothing else does until startup_task_wait()
+// and use whole paths, the main thread changes the working directory
+void startup_task(u16 task, int (*func)(void *data), void *data)
+{
+	STARTUP_TASK *t;
+
+	if (task >= STARTUP_TASK_MAX)
+		return;
+	t = &startup_task_table[task];
+	t->func = func;
+	t->data = data;
+	t->started = 1;
+	t->thread = SDL_CreateThread(startup_task_main, "nagi_startup", t);
+	if (t->thread == 0)
+		startup_task_main(t);
+}
+
+// 0 if the task was never started (or already waited for), the caller
+// does the work itself then.  otherwise 1 with the task's result
+int startup_task_wait(u16 task, int *result)
+{
+	STARTUP_TASK *t;
+	u64 start;
+
+	if (task >= STARTUP_TASK_MAX)
+		return 0;
+	t = &startup_task_table[task];
+	if (!t->started)
+		return 0;
+	if (t->thread != 0)
+	{
+		start = startup_now();
+		SDL_WaitThread(t->thread, NULL);
+		startup_phase(startup_task_wait_name[task], start);
+	}
+	t->thread = 0;
+	t->started = 0;
+	if (result != 0)
+		*result = t->result;
+	return 1;
+}
+
+static double startup_ms(u64 ticks)
+{
+	u64 freq;
+
+	freq = SDL_GetPerformanceFrequency();
+	return (double)ticks * 1000.0 / (double)freq;
+}
+
+// how long booting took, 0 before the first cycle
+double startup_total_ms(void)
+{
+	return startup_ms(startup_took);
+}
+
+static int startup_cmp(const void *a, const void *b)
+{
+	const STARTUP_PHASE *pa = (const STARTUP_PHASE *)a;
+	const STARTUP_PHASE *pb = (const STARTUP_PHASE *)b;
+
+	if (pa->start != pb->start)
+		return (pa->start < pb->start) ? -1 : 1;
+	// the outer one first
+	if (pa->end != pb->end)
+		return (pa->end > pb->end) ? -1 : 1;
+	return 0;
+}
+
+// how many phases on the same thread this one is inside of
+static int startup_depth(const STARTUP_PHASE *table, int i)
+{
+	int j, depth;
+
+	depth = 0;
+	for (j = 0; j < i; j++)
+		if ( (table[j].track == table[i].track) && (table[j].end >= table[i].end) )
+			depth++;
+	return depth;
+}
+
+static void startup_trace_write(const STARTUP_PHASE *table, int total)
+{
+	char path[1024];
+	const char *dir;
+	FILE *f;
+	int i;
+
+	// this may be the loader thread, the working directory isn't ours to change
+	dir = dir_preset_get(DIR_PRESET_NAGI);
+	if ( (dir != 0) && (c_nagi_startup_trace[0] != '/') )
+		snprintf(path, sizeof(path), "%s/%s", dir, c_nagi_startup_trace);
+	else
+		snprintf(path, sizeof(path), "%s", c_nagi_startup_trace);
+
+	f = fopen(path, "w");
+	if (f == 0)
+	{
+		printf("Startup: can't write %s\n", path);
+		return;
+	}
+	fprintf(f, "{\"traceEvents\":[\n");
+	for (i = 0; i < total; i++)
+		fprintf(f, "{\"name\":\"%s\",\"cat\":\"startup\",\"ph\":\"X\",\"ts\":%.1f,\"dur\":%.1f,\"pid\":1,\"tid\":%d}%s\n",
+			table[i].name, startup_ms(table[i].start - startup_origin) * 1000.0,
+			startup_ms(table[i].end - table[i].start) * 1000.0, table[i].track + 1,
+			(i + 1 < total) ? "," : "");
+	fprintf(f, "],\n\"displayTimeUnit\":\"ms\"}\n");
+	fclose(f);
+}
+
+static void startup_report(void)
+{
+	STARTUP_PHASE table[STARTUP_MAX];
+	int i, total;
+
+	if ( !c_nagi_startup_report && ((c_nagi_startup_trace == 0) || (c_nagi_startup_trace[0] == 0)) )
+		return;
+
+	total = SDL_GetAtomicInt(&startup_count);
+	if (total > STARTUP_MAX)
+		total = STARTUP_MAX;
+	memcpy(table, startup_table, (size_t)total * sizeof(STARTUP_PHASE));
+	qsort(table, (size_t)total, sizeof(STARTUP_PHASE), startup_cmp);
+
+	if (c_nagi_startup_report)
+	{
+		printf("\n%-32s %10s %10s\n", "startup phase", "start ms", "ms");
+		for (i = 0; i < total; i++)
+			printf("%*s%-*s %10.1f %10.1f%s\n", startup_depth(table, i) * 2, "",
+				32 - startup_depth(table, i) * 2, table[i].name,
+				startup_ms(table[i].start - startup_origin),
+				startup_ms(table[i].end - table[i].start),
+				(table[i].track != STARTUP_TRACK_MAIN) ? "  (background)" : "");
+		fflush(stdout);
+	}
+
+	if ( (c_nagi_startup_trace != 0) && (c_nagi_startup_trace[0] != 0) )
+		startup_trace_write(table, total);
+}
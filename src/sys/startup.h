@@ -0,0 +1,19 @@
+#ifndef NAGI_SYS_STARTUP_H
+#define NAGI_SYS_STARTUP_H
+
+// work started early on a thread of its own and waited for where it's used
+#define STARTUP_TASK_SCAN 0		// game directories identified (standard.c)
+#define STARTUP_TASK_FONT 1		// ttf font opened (chargen.c)
+#define STARTUP_TASK_AUDIO 2	// sound output opened (sndgen_init)
+#define STARTUP_TASK_MAX 3
+
+extern u64 startup_now(void);
+extern void startup_phase(const char *name, u64 start);
+extern void startup_async_begin(void);
+extern void startup_async_end(const char *name, u64 start);
+extern void startup_done(void);
+extern double startup_total_ms(void);
+extern void startup_task(u16 task, int (*func)(void *data), void *data);
+extern int startup_task_wait(u16 task, int *result);
+
+#endif /* NAGI_SYS_STARTUP_H */
@@ -0,0 +1,109 @@
+/*
+Thread priorities and cpus
+
+the interpreter, the sound callback and the background workers each get
+a priority (priority_main, priority_audio, priority_worker in nagi.ini)
+and can be kept to one cpu (cpu_main, cpu_audio).  when the llm has every
+other core busy the sound callback still gets its turn on time, and the
+hud's late audio count says whether it does.
+
+priorities go through SDL, which asks rtkit on linux when the process
+may not raise its own.  sdl already runs its audio thread time critical,
+so "sdl" leaves a thread as it is.  cpus are set with sched_setaffinity()
+on linux and SetThreadAffinityMask() on windows, elsewhere the scheduler
+decides.
+*/
+
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include "../agi.h"
+#include "thread_attr.h"
+
+#ifdef _WIN32
+#include <Windows.h>
+#elif defined(__linux__)
+#include <sched.h>
+#endif
+
+static const char *thread_attr_name[THREAD_ROLES] = {"main", "audio", "worker"};
+static u8 thread_attr_warned[THREAD_ROLES];
+
+// the configured priority, 0 to leave it to sdl
+static int thread_attr_priority(const char *name, SDL_ThreadPriority *priority)
+{
+	if ( (name == 0) || (name[0] == 0) || (SDL_strcasecmp(name, "sdl") == 0) )
+		return 0;
+	if (SDL_strcasecmp(name, "low") == 0)
+		*priority = SDL_THREAD_PRIORITY_LOW;
+	else if (SDL_strcasecmp(name, "high") == 0)
+		*priority = SDL_THREAD_PRIORITY_HIGH;
+	else if (SDL_strcasecmp(name, "realtime") == 0)
+		*priority = SDL_THREAD_PRIORITY_TIME_CRITICAL;
+	else
+		*priority = SDL_THREAD_PRIORITY_NORMAL;
+	return 1;
+}
+
+// 1 if the calling thread now only runs on cpu
+static int thread_attr_cpu(int cpu)
+{
+#ifdef _WIN32
+	if (cpu >= (int)(8 * sizeof(DWORD_PTR)))
+		return 0;
+	return SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu) != 0;
+#elif defined(__linux__)
+	cpu_set_t set;
+
+	if (cpu >= CPU_SETSIZE)
+		return 0;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+	(void) cpu;
+	return 0;
+#endif
+}
+
+void thread_attr_apply(int role)
+{
+	SDL_ThreadPriority priority;
+	const char *name;
+	int cpu;
+
+	switch (role)
+	{
+		case THREAD_MAIN:
+			name = c_nagi_priority_main;
+			cpu = c_nagi_cpu_main;
+			break;
+		case THREAD_AUDIO:
+			name = c_nagi_priority_audio;
+			cpu = c_nagi_cpu_audio;
+			break;
+		case THREAD_WORKER:
+			name = c_nagi_priority_worker;
+			cpu = -1;
+			break;
+		default:
+			return;
+	}
+
+	if (thread_attr_priority(name, &priority) && !SDL_SetCurrentThreadPriority(priority) &&
+		!(thread_attr_warned[role] & 1))
+	{
+		thread_attr_warned[role] |= 1;
+		printf("Thread %s: priority %s not allowed: %s\n", thread_attr_name[role], name, SDL_GetError());
+	}
+
+	if ( (cpu >= 0) && !thread_attr_cpu(cpu) && !(thread_attr_warned[role] & 2) )
+	{
+		thread_attr_warned[role] |= 2;
+		printf("Thread %s: can't be kept to cpu %d\n", thread_attr_name[role], cpu);
+	}
+}
@@ -0,0 +1,14 @@
+#ifndef NAGI_SYS_THREAD_ATTR_H
+#define NAGI_SYS_THREAD_ATTR_H
+
+// what a thread does, for its priority and cpu in nagi.ini
+#define THREAD_MAIN 0		// the interpreter
+#define THREAD_AUDIO 1		// the sound device's callback
+#define THREAD_WORKER 2		// background jobs (sys/workers.c)
+#define THREAD_ROLES 3
+
+// give the calling thread its role's priority and cpu.  says once per
+// role when the system won't have it
+extern void thread_attr_apply(int role);
+
+#endif /* NAGI_SYS_THREAD_ATTR_H */
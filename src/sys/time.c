@@ -5,6 +5,8 @@
 #include "../base.h"
 
 #include "../sys/time.h"
+#include "../sys/delay.h"
+#include "../sys/replay.h"
 
 
 
@@ -13,68 +15,74 @@
 // 2 = turn off
 u16 clock_state = 0;
 
-static SDL_Thread *agi_clock_thread;
-
 #define SDL_TICK_SCALE 50
 
-// TODO: check base.c   disable clock and denit time
+// the clock vars are worked out from the game time (delay_game_ns(), the
+// real time unless turbo's been on) at the start of each cycle on the main
+// thread.  nothing reads them in between.
+static u64 clock_ns = 0;	// ns already counted
+static u32 time_counter = 0;	// ms into the current second
+static u32 tick_counter = 0;	// ms into the current tick
 
+// count ms of game time into the clock vars
+void clock_advance(u32 ms)
+{
+	tick_counter += ms;
+	state.ticks += tick_counter / SDL_TICK_SCALE;
+	tick_counter %= SDL_TICK_SCALE;
 
-static int clock_thread(void *unused)
-{	
-	u16 time_counter = 0;
-	u32 sdl_tick_prev = 0;
-	u32 sdl_tick = 0;
+	if (clock_state == 0)
+	{
+		// it's in 1/20's of seconds
+		time_counter += ms;
 	
-	(void) unused;
+		while (time_counter >= 20*SDL_TICK_SCALE)
+		{ 
+			time_counter -= 20*SDL_TICK_SCALE;
+			state.var[V11_SECONDS]++;
 	
-	sdl_tick_prev = SDL_GetTicks();
-	while (clock_state != 2)
-	{
-		sdl_tick = SDL_GetTicks();
-		state.ticks += (sdl_tick - sdl_tick_prev) / SDL_TICK_SCALE;
-
-		switch(clock_state)
-		{
-			case 0:
-				// it's in 1/20's of seconds
-				time_counter += (sdl_tick - sdl_tick_prev) ;
-			
-				while (time_counter >= 20*SDL_TICK_SCALE)
-				{ 
-					time_counter -= 20*SDL_TICK_SCALE;
-					state.var[V11_SECONDS]++;
-			
-					if (state.var[V11_SECONDS] >= 60)
-					{
-						state.var[V11_SECONDS] = 0;
-						state.var[V12_MINUTES]++;
-					}
-					if (state.var[V12_MINUTES] >= 60)
-					{
-						state.var[V12_MINUTES] = 0;
-						state.var[V13_HOURS]++;
-					}
-					if (state.var[V13_HOURS] >= 24)
-					{
-						state.var[V13_HOURS] = 0;
-						state.var[V14_DAYS]++;
-					}
-				}
-
-			case 1:
-				sdl_tick_prev = sdl_tick;
-				break;
+			if (state.var[V11_SECONDS] >= 60)
+			{
+				state.var[V11_SECONDS] = 0;
+				state.var[V12_MINUTES]++;
+			}
+			if (state.var[V12_MINUTES] >= 60)
+			{
+				state.var[V12_MINUTES] = 0;
+				state.var[V13_HOURS]++;
+			}
+			if (state.var[V13_HOURS] >= 24)
+			{
+				state.var[V13_HOURS] = 0;
+				state.var[V14_DAYS]++;
+			}
 		}
-
-		SDL_Delay(500);	// it won't update for a second anyways
-					// a bit less though to account for overhead
 	}
-
-	return 0;
 }
 
+// bring the clock up to now.  replay_cycle() keeps the time in a replay
+void clock_cycle()
+{
+	u64 ms;
+
+	if ( (replay_mode != REPLAY_OFF) || (clock_state == 2) )
+		return;
+	ms = (delay_game_ns() - clock_ns) / SDL_NS_PER_MS;
+	clock_ns += ms * SDL_NS_PER_MS;
+	while (ms > 0xFFFFFFFF)
+	{
+		clock_advance(0xFFFFFFFF);
+		ms -= 0xFFFFFFFF;
+	}
+	clock_advance((u32)ms);
+}
 
+// the time up to a pause still counts, the pause itself doesn't
+void clock_set_state(u16 new_state)
+{
+	clock_cycle();
+	clock_state = new_state;
+}
 
 void clock_init()
 {
@@ -83,20 +91,12 @@ void clock_init()
 	state.var[V13_HOURS] = 0;
 	state.var[V14_DAYS] = 0;
 	clock_state = 0;
-	agi_clock_thread = SDL_CreateThread(clock_thread, "nagi_clock", NULL);
-	if ( agi_clock_thread == NULL )
-	{
-		printf("Unable to create SDL thread!");
-		agi_exit();
-		// return;
-	}
+	time_counter = 0;
+	tick_counter = 0;
+	clock_ns = delay_game_ns();
 }
 
 void clock_denit()
 {
 	clock_state = 2; // turn off
-	printf("Waiting for clock thread to die...");
-	SDL_WaitThread(agi_clock_thread, NULL);
-	printf("done.\n");
 }
-
@@ -4,5 +4,8 @@
 extern u16 clock_state;
 extern void clock_init(void);
 extern void clock_denit(void);
+extern void clock_advance(u32 ms);
+extern void clock_cycle(void);
+extern void clock_set_state(u16 new_state);
 
 #endif /* NAGI_SYS_TIME_H */
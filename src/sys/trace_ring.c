@@ -0,0 +1,137 @@
+/*
+Bytecode trace ring
+
+every command and test the logics run goes into a ring of the last
+TRACE_RING_SIZE, one word each: the logic, the opcode, whether it's a
+test and where it is in the logic's code.  it's always on so writing one
+is a store and an increment, no test and no formatting.  each cycle
+starts with a marker holding its number.
+
+nothing reads the ring until it's dumped to TRACE_RING_FILE in the nagi
+directory, oldest first with the command names.  that happens on
+ctrl+f12, when a cycle's logic and objtable_update() take longer than
+trace_slow in nagi.ini (at most once every TRACE_RING_QUIET_MS), and on
+a crash.  so a slow room or a script that stalls can be looked at
+afterwards without a debug build or trace.on().
+
+the crash dump comes from the signal handler.  stdio isn't safe there,
+but by then there's nothing to lose.
+*/
+
+#include <stdio.h>
+#include <signal.h>
+
+#include "../agi.h"
+#include "trace_ring.h"
+
+#include "sys_dir.h"
+#include "../logic/cmd_table.h"
+
+#define TRACE_RING_FILE "nagi_trace.txt"
+#define TRACE_RING_QUIET_MS 10000
+#define TRACE_RING_EVAL_MAX 19	// the last test logic_eval() knows
+
+u32 trace_ring[TRACE_RING_SIZE];
+u32 trace_ring_pos = 0;
+
+static u32 trace_ring_cycles = 0;
+static Uint64 trace_ring_start = 0;
+static Uint64 trace_ring_dumped = 0;
+static volatile sig_atomic_t trace_ring_crashed = 0;
+
+static void trace_ring_signal(int sig)
+{
+	char why[32];
+
+	if (!trace_ring_crashed)
+	{
+		trace_ring_crashed = 1;
+		snprintf(why, sizeof(why), "signal %d", sig);
+		trace_ring_dump(why);
+	}
+	signal(sig, SIG_DFL);
+	raise(sig);
+}
+
+void trace_ring_init(void)
+{
+	signal(SIGSEGV, trace_ring_signal);
+	signal(SIGABRT, trace_ring_signal);
+	signal(SIGFPE, trace_ring_signal);
+	signal(SIGILL, trace_ring_signal);
+}
+
+// the marker is a command with opcode 0, return is never traced.  the
+// cycle number goes in the logic and offset
+void trace_ring_cycle_begin(void)
+{
+	trace_ring_cycles++;
+	trace_ring[trace_ring_pos++ & TRACE_RING_MASK] =
+		(((trace_ring_cycles >> 15) & 0xFF) << 24) | (trace_ring_cycles & 0x7FFF);
+	trace_ring_start = SDL_GetTicks();
+}
+
+void trace_ring_cycle_end(void)
+{
+	char why[48];
+	Uint64 now;
+
+	if (c_nagi_trace_slow == 0)
+		return;
+	now = SDL_GetTicks();
+	if (now - trace_ring_start < (Uint64)c_nagi_trace_slow)
+		return;
+	if ( (trace_ring_dumped != 0) && (now - trace_ring_dumped < TRACE_RING_QUIET_MS) )
+		return;
+	trace_ring_dumped = now;
+	snprintf(why, sizeof(why), "cycle %u took %u ms", (unsigned)(trace_ring_cycles & 0x7FFFFF),
+		(unsigned)(now - trace_ring_start));
+	trace_ring_dump(why);
+}
+
+// added to the end of the file, so earlier dumps are kept
+void trace_ring_dump(const char *why)
+{
+	char path[1024];
+	const char *dir;
+	const char *name;
+	FILE *f;
+	u32 first, pos, i, e;
+	u16 op, off;
+
+	dir = dir_preset_get(DIR_PRESET_NAGI);
+	if (dir != 0)
+		snprintf(path, sizeof(path), "%s/%s", dir, TRACE_RING_FILE);
+	else
+		snprintf(path, sizeof(path), "%s", TRACE_RING_FILE);
+	f = fopen(path, "a");
+	if (f == 0)
+	{
+		printf("Trace ring: can't write %s\n", path);
+		return;
+	}
+
+	pos = trace_ring_pos;
+	first = (pos > TRACE_RING_SIZE) ? pos - TRACE_RING_SIZE : 0;
+	fprintf(f, "---- %s, the last %u ops ----\n", why, (unsigned)(pos - first));
+	for (i = first; i != pos; i++)
+	{
+		e = trace_ring[i & TRACE_RING_MASK];
+		op = (e >> 16) & 0xFF;
+		off = e & 0x7FFF;
+		if ((e & TRACE_RING_TEST) != 0)
+			name = (op <= TRACE_RING_EVAL_MAX) ? eval_table[op].func_name : "?";
+		else if (op == 0)
+		{
+			fprintf(f, "cycle %u\n", (unsigned)(((e >> 24) << 15) | off));
+			continue;
+		}
+		else
+			name = (op <= CMD_MAX) ? cmd_table[op].func_name : "?";
+		fprintf(f, "  logic %3u  %04X  %s%s\n", (unsigned)(e >> 24), off,
+			((e & TRACE_RING_TEST) != 0) ? "if " : "", name);
+	}
+	fprintf(f, "\n");
+	fclose(f);
+	printf("Trace ring: %s, written to %s\n", why, path);
+}
@@ -0,0 +1,25 @@
+#ifndef NAGI_SYS_TRACE_RING_H
+#define NAGI_SYS_TRACE_RING_H
+
+// a power of two
+#define TRACE_RING_SIZE 4096
+#define TRACE_RING_MASK (TRACE_RING_SIZE - 1)
+
+#define TRACE_RING_CMD 0
+#define TRACE_RING_TEST 0x8000
+
+extern u32 trace_ring[TRACE_RING_SIZE];
+extern u32 trace_ring_pos;
+
+// logic number, opcode, kind and offset of the opcode in the logic's code
+// in one word, written over the oldest.  no test, no formatting
+#define TRACE_RING_ADD(log, op, at, kind) \
+	(trace_ring[trace_ring_pos++ & TRACE_RING_MASK] = ((u32)(log)->num << 24) | ((u32)(op) << 16) | \
+		(u32)(kind) | ((u32)((at) - (log)->code) & 0x7FFF))
+
+extern void trace_ring_init(void);
+extern void trace_ring_cycle_begin(void);
+extern void trace_ring_cycle_end(void);
+extern void trace_ring_dump(const char *why);
+
+#endif /* NAGI_SYS_TRACE_RING_H */
@@ -0,0 +1,86 @@
+/*
+LLM calibration
+
+nagi --tune-llm [game dir] times the llama.cpp backend on this machine with
+the game's dictionary and writes the fastest settings to llm_config.ini as
+a [llamacpp.auto] section for this cpu and gpu (see llm_tune.c in
+nagi-llm).  --tune-corpus <file> replays a nagi-llm-bench corpus instead of
+the built in one.  the game's own model is unloaded first, the trials load
+it again for every setting.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../agi.h"
+#include "tune_llm.h"
+
+#include "../res/res.h"
+#include "agi_file.h"
+#include "sys_dir.h"
+#include "mem_wrap.h"
+
+#ifdef NAGI_ENABLE_LLM
+#include "../llm_global.h"
+#endif
+
+// corpus is relative to where nagi was started
+int tune_llm_build(const char *corpus)
+{
+#ifdef NAGI_ENABLE_LLM
+	char corpus_path[1024];
+	char config_path[1024];
+	const char *model_path;
+	u8 *dict;
+	u32 dict_size;
+	int ok;
+
+#ifdef NAGI_DEFAULT_LLM_MODEL_PATH
+	model_path = NAGI_DEFAULT_LLM_MODEL_PATH;
+#else
+	model_path = getenv("NAGI_LLM_MODEL_PATH");
+#endif
+	if ((model_path == 0) || (model_path[0] == 0))
+	{
+		printf("tune-llm: no local model, set NAGI_LLM_MODEL_PATH\n");
+		return 1;
+	}
+
+	if (g_llm != 0)
+	{
+		nagi_llm_shutdown(g_llm);
+		nagi_llm_destroy(g_llm);
+		g_llm = 0;
+	}
+
+	dir_preset_change(DIR_PRESET_GAME);
+	dict = file_load("words.tok", 0);
+	dict_size = file_buf_size;
+	if (dict == 0)
+	{
+		printf("tune-llm: unable to load words.tok\n");
+		return 1;
+	}
+
+	if ( (corpus != 0) && (corpus[0] != '/') && (corpus[0] != '\\') &&
+		(strchr(corpus, ':') == 0) )
+	{
+		snprintf(corpus_path, sizeof(corpus_path), "%s/%s",
+				dir_preset_get(DIR_PRESET_ORIG), corpus);
+		corpus = corpus_path;
+	}
+
+	// the same llm_config.ini the game reads
+	dir_preset_change(DIR_PRESET_NAGI);
+	snprintf(config_path, sizeof(config_path), "%s/llm_config.ini",
+			dir_preset_get(DIR_PRESET_NAGI));
+	ok = nagi_llm_tune(config_path, model_path, dict, dict_size, corpus);
+	a_free(dict);
+	return ok ? 0 : 1;
+#else
+	(void)corpus;
+	printf("tune-llm: nagi was built without llm support\n");
+	return 1;
+#endif
+}
@@ -0,0 +1,6 @@
+#ifndef NAGI_SYS_TUNE_LLM_H
+#define NAGI_SYS_TUNE_LLM_H
+
+extern int tune_llm_build(const char *corpus);
+
+#endif /* NAGI_SYS_TUNE_LLM_H */
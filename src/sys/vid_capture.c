@@ -0,0 +1,476 @@
+/*
+Frame capture
+
+with capture set under [vid] every flush is recorded, without the game
+waiting on an encoder.  vid_flush() hands over the bands it found dirty and
+they're copied as they are (8 bit indices, plus the palette when it
+changed) into a ring the game writes and a thread reads.  that copy is all
+the game pays for.  the thread keeps its own copy of the screen, puts the
+bands on it and writes the frame out:
+
+	bmp	capture_file + _000001.bmp ... one 8 bit bmp per flush
+	ffmpeg	piped to ffmpeg as rgb at CAPTURE_RATE frames a second, each
+		frame repeated until the next flush's time comes.  written
+		lossless (ffv1) to capture_file.mkv
+
+if the ring's full the flush is dropped and the one after goes in whole, so
+a slow disk costs frames rather than game time.
+
+records in the ring (they never wrap, a skip record fills the end):
+	u32 size, u32 ms, u16 bands, u16 palette colours (0 if it didn't change)
+	palette r,g,b...
+	each band u16 x, y, w, h and its rows
+*/
+
+/* BASE headers	---	---	---	---	---	---	--- */
+#include "../agi.h"
+
+/* LIBRARY headers	---	---	---	---	---	---	--- */
+#include <stdio.h>
+#include <string.h>
+
+/* OTHER headers	---	---	---	---	---	---	--- */
+#include "mem_wrap.h"
+#include "vid_capture.h"
+
+/* VARIABLES	---	---	---	---	---	---	--- */
+
+#define CAPTURE_RING (8 << 20)
+#define CAPTURE_HEAD 12
+#define CAPTURE_SKIP 0xFFFF	// bands of a record that only fills the end of the ring
+#define CAPTURE_RATE 20
+
+#define CAPTURE_NONE 0
+#define CAPTURE_BMP 1
+#define CAPTURE_FFMPEG 2
+
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#endif
+
+static u8 capture_type = CAPTURE_NONE;
+static SDL_Thread *capture_thread = 0;
+static SDL_Semaphore *capture_wake = 0;
+static SDL_AtomicInt capture_quit;
+
+// the ring.  head and tail only grow, they're taken mod CAPTURE_RING
+static u8 *capture_ring = 0;
+static SDL_AtomicInt capture_head;	// next byte the game writes
+static SDL_AtomicInt capture_tail;	// next byte the thread reads
+
+// game side
+static int capture_w = 0;
+static int capture_h = 0;
+static u8 capture_pal[256 * 3];
+static u16 capture_pal_count = 0;
+static u8 capture_pal_new = 0;	// goes with the next frame
+static u8 capture_whole = 1;	// the thread missed something, send the whole screen
+static u32 capture_dropped = 0;
+
+// thread side
+static u8 *capture_screen = 0;
+static int capture_screen_w = 0;
+static int capture_screen_h = 0;
+static u8 capture_screen_pal[256 * 3];
+static u8 *capture_rgb = 0;
+static FILE *capture_pipe = 0;
+static u32 capture_count = 0;
+static u32 capture_first_ms = 0;
+static u32 capture_frames_out = 0;	// ffmpeg frames written
+
+/* CODE	---	---	---	---	---	---	---	--- */
+
+static void capture_put16(u8 *p, u32 v)
+{
+	p[0] = (u8)v;
+	p[1] = (u8)(v >> 8);
+}
+
+static void capture_put32(u8 *p, u32 v)
+{
+	p[0] = (u8)v;
+	p[1] = (u8)(v >> 8);
+	p[2] = (u8)(v >> 16);
+	p[3] = (u8)(v >> 24);
+}
+
+static u32 capture_get16(const u8 *p)
+{
+	return p[0] | (p[1] << 8);
+}
+
+static u32 capture_get32(const u8 *p)
+{
+	return p[0] | (p[1] << 8) | (p[2] << 16) | ((u32)p[3] << 24);
+}
+
+// 8 bit bmp, bottom up with the palette
+static void capture_bmp(const char *name, const u8 *screen, int w, int h, const u8 *pal)
+{
+	u8 head[54 + 256 * 4];
+	u32 row_size, image_size;
+	FILE *stream;
+	int i;
+
+	row_size = (w + 3) & ~3;
+	image_size = row_size * h;
+	memset(head, 0, sizeof(head));
+	head[0] = 'B';
+	head[1] = 'M';
+	capture_put32(head + 2, sizeof(head) + image_size);
+	capture_put32(head + 10, sizeof(head));
+	capture_put32(head + 14, 40);
+	capture_put32(head + 18, w);
+	capture_put32(head + 22, h);
+	capture_put16(head + 26, 1);
+	capture_put16(head + 28, 8);
+	capture_put32(head + 34, image_size);
+	capture_put32(head + 46, 256);
+	for (i = 0; i < 256; i++)
+	{
+		head[54 + i*4] = pal[i*3+2];
+		head[54 + i*4 + 1] = pal[i*3+1];
+		head[54 + i*4 + 2] = pal[i*3];
+	}
+
+	stream = fopen(name, "wb");
+	if (stream == 0)
+		return;
+	fwrite(head, 1, sizeof(head), stream);
+	for (i = h - 1; i >= 0; i--)
+	{
+		fwrite(screen + i * w, 1, w, stream);
+		if (row_size != (u32)w)
+			fwrite("\0\0\0", 1, row_size - w, stream);
+	}
+	fclose(stream);
+}
+
+// the screen as rgb, as many frames as it was up for
+static void capture_ffmpeg(u32 until)
+{
+	const u8 *pal;
+	u8 *rgb;
+	int i;
+
+	if (capture_pipe == 0)
+		return;
+	if (capture_frames_out * 1000 / CAPTURE_RATE > until)
+		return;
+
+	rgb = capture_rgb;
+	for (i = 0; i < capture_screen_w * capture_screen_h; i++)
+	{
+		pal = capture_screen_pal + capture_screen[i] * 3;
+		*(rgb++) = pal[0];
+		*(rgb++) = pal[1];
+		*(rgb++) = pal[2];
+	}
+	while (capture_frames_out * 1000 / CAPTURE_RATE <= until)
+	{
+		if (fwrite(capture_rgb, 3, capture_screen_w * capture_screen_h, capture_pipe) == 0)
+		{
+			printf("Capture: ffmpeg stopped taking frames\n");
+			pclose(capture_pipe);
+			capture_pipe = 0;
+			return;
+		}
+		capture_frames_out++;
+	}
+}
+
+static void capture_resize(int w, int h)
+{
+	char cmd[512];
+
+	if ( (capture_pipe != 0) && ((w != capture_screen_w) || (h != capture_screen_h)) )
+	{
+		printf("Capture: the screen changed size, ffmpeg output stops here\n");
+		pclose(capture_pipe);
+		capture_pipe = 0;
+	}
+	if (capture_screen != 0)
+	{
+		a_free(capture_screen);
+		a_free(capture_rgb);
+	}
+	capture_screen_w = w;
+	capture_screen_h = h;
+	capture_screen = a_malloc((size_t)w * h);
+	capture_rgb = a_malloc((size_t)w * h * 3);
+	memset(capture_screen, 0, (size_t)w * h);
+
+	// ffmpeg can't change size mid stream, the first one sticks
+	if ( (capture_type == CAPTURE_FFMPEG) && (capture_pipe == 0) && (capture_count == 0) )
+	{
+		snprintf(cmd, sizeof(cmd), "ffmpeg -loglevel error -y -f rawvideo -pix_fmt rgb24 "
+			"-s %dx%d -r %d -i - -c:v ffv1 \"%s.mkv\"", w, h, CAPTURE_RATE, c_vid_capture_file);
+		capture_pipe = popen(cmd, "w");
+		if (capture_pipe == 0)
+			printf("Capture: unable to start ffmpeg\n");
+	}
+}
+
+// one record off the ring onto the thread's screen, then out
+static void capture_apply(const u8 *rec)
+{
+	char name[300];
+	const u8 *p;
+	u32 ms, bands, colours, x, y, w, h, row;
+
+	ms = capture_get32(rec + 4);
+	bands = capture_get16(rec + 8);
+	colours = capture_get16(rec + 10);
+	p = rec + CAPTURE_HEAD;
+
+	if (colours != 0)
+	{
+		memcpy(capture_screen_pal, p, colours * 3);
+		p += colours * 3;
+	}
+	if (capture_count == 0)
+		capture_first_ms = ms;
+	ms -= capture_first_ms;
+
+	// up to now it was the screen before
+	if ( (capture_type == CAPTURE_FFMPEG) && (ms != 0) )
+		capture_ffmpeg(ms - 1);
+
+	while (bands-- != 0)
+	{
+		x = capture_get16(p);
+		y = capture_get16(p + 2);
+		w = capture_get16(p + 4);
+		h = capture_get16(p + 6);
+		p += 8;
+		if ( (x == 0) && (y == 0) && (w == 0) && (h == 0) )
+		{
+			// a new size, the whole screen follows
+			capture_resize(capture_get16(p), capture_get16(p + 2));
+			p += 4;
+			continue;
+		}
+		for (row = 0; row < h; row++, p += w)
+			if ( (y + row < (u32)capture_screen_h) && (x + w <= (u32)capture_screen_w) )
+				memcpy(capture_screen + (y + row) * capture_screen_w + x, p, w);
+	}
+
+	if (capture_screen == 0)
+		return;
+	capture_count++;
+	if (capture_type == CAPTURE_BMP)
+	{
+		snprintf(name, sizeof(name), "%s_%06u.bmp", c_vid_capture_file, (unsigned)capture_count);
+		capture_bmp(name, capture_screen, capture_screen_w, capture_screen_h, capture_screen_pal);
+	}
+	else
+		capture_ffmpeg(ms);
+}
+
+static int capture_main(void *unused)
+{
+	u32 tail, size;
+	const u8 *rec;
+
+	(void) unused;
+
+	for (;;)
+	{
+		tail = (u32)SDL_GetAtomicInt(&capture_tail);
+		if (tail == (u32)SDL_GetAtomicInt(&capture_head))
+		{
+			if (SDL_GetAtomicInt(&capture_quit))
+				break;
+			SDL_WaitSemaphoreTimeout(capture_wake, 100);
+			continue;
+		}
+
+		rec = capture_ring + (tail % CAPTURE_RING);
+		size = capture_get32(rec);
+		if (capture_get16(rec + 8) != CAPTURE_SKIP)
+			capture_apply(rec);
+		SDL_SetAtomicInt(&capture_tail, (int)(tail + size));	// hands the room back
+	}
+	return 0;
+}
+
+void vid_capture_open(void)
+{
+	if (capture_thread != 0)
+		return;
+	if (SDL_strcasecmp(c_vid_capture, "bmp") == 0)
+		capture_type = CAPTURE_BMP;
+	else if (SDL_strcasecmp(c_vid_capture, "ffmpeg") == 0)
+		capture_type = CAPTURE_FFMPEG;
+	else
+		return;
+
+	// room past the end for a skip record's header
+	capture_ring = a_malloc(CAPTURE_RING + CAPTURE_HEAD);
+	SDL_SetAtomicInt(&capture_head, 0);
+	SDL_SetAtomicInt(&capture_tail, 0);
+	SDL_SetAtomicInt(&capture_quit, 0);
+	capture_whole = 1;
+	capture_dropped = 0;
+	capture_count = 0;
+	capture_frames_out = 0;
+
+	capture_wake = SDL_CreateSemaphore(0);
+	if (capture_wake != 0)
+		capture_thread = SDL_CreateThread(capture_main, "nagi_capture", NULL);
+	if (capture_thread == 0)
+	{
+		printf("Capture: unable to create thread: %s\n", SDL_GetError());
+		vid_capture_close();
+		return;
+	}
+	printf("Capture: recording to %s (%s)\n", c_vid_capture_file, c_vid_capture);
+}
+
+void vid_capture_close(void)
+{
+	if (capture_thread != 0)
+	{
+		SDL_SetAtomicInt(&capture_quit, 1);
+		SDL_SignalSemaphore(capture_wake);
+		SDL_WaitThread(capture_thread, NULL);
+		capture_thread = 0;
+		if (capture_dropped != 0)
+			printf("Capture: %u frames dropped, the writer couldn't keep up\n", (unsigned)capture_dropped);
+	}
+	if (capture_pipe != 0)
+	{
+		pclose(capture_pipe);
+		capture_pipe = 0;
+	}
+	if (capture_wake != 0)
+	{
+		SDL_DestroySemaphore(capture_wake);
+		capture_wake = 0;
+	}
+	if (capture_ring != 0)
+	{
+		a_free(capture_ring);
+		capture_ring = 0;
+	}
+	if (capture_screen != 0)
+	{
+		a_free(capture_screen);
+		a_free(capture_rgb);
+		capture_screen = 0;
+		capture_rgb = 0;
+	}
+	capture_type = CAPTURE_NONE;
+}
+
+void vid_capture_size(int w, int h)
+{
+	capture_w = w;
+	capture_h = h;
+	capture_whole = 1;
+}
+
+void vid_capture_palette(PCOLOUR *palette, u8 num)
+{
+	int i;
+
+	for (i = 0; i < num; i++)
+	{
+		capture_pal[i*3] = palette[i].r;
+		capture_pal[i*3+1] = palette[i].g;
+		capture_pal[i*3+2] = palette[i].b;
+	}
+	capture_pal_count = num;
+	capture_pal_new = 1;
+}
+
+void vid_capture_frame(const u8 *pixels, int pitch, const SDL_Rect *band, int count)
+{
+	SDL_Rect whole;
+	u32 head, tail, size, at, room;
+	u8 *rec, *p;
+	int i, row;
+
+	if ( (capture_thread == 0) || (capture_w == 0) )
+		return;
+	if (capture_whole)
+	{
+		whole.x = 0;
+		whole.y = 0;
+		whole.w = capture_w;
+		whole.h = capture_h;
+		band = &whole;
+		count = 1;
+	}
+	if ( (count == 0) && !capture_pal_new )
+		return;
+
+	size = CAPTURE_HEAD + (capture_pal_new ? capture_pal_count * 3 : 0) + (capture_whole ? 12 : 0);
+	for (i = 0; i < count; i++)
+		size += 8 + band[i].w * band[i].h;
+	size = (size + 3) & ~3;
+
+	head = (u32)SDL_GetAtomicInt(&capture_head);
+	tail = (u32)SDL_GetAtomicInt(&capture_tail);
+	at = head % CAPTURE_RING;
+	room = CAPTURE_RING - (head - tail);
+	// doesn't fit before the end, the end's skipped
+	if (at + size > CAPTURE_RING)
+	{
+		if (room >= (CAPTURE_RING - at) + size)
+		{
+			rec = capture_ring + at;
+			capture_put32(rec, CAPTURE_RING - at);
+			capture_put16(rec + 8, CAPTURE_SKIP);
+			head += CAPTURE_RING - at;
+			room -= CAPTURE_RING - at;
+			at = 0;
+		}
+		else
+			room = 0;
+	}
+	if (room < size)
+	{
+		// the writer's behind, it'll need the whole screen when it catches up
+		SDL_SetAtomicInt(&capture_head, (int)head);
+		capture_dropped++;
+		capture_whole = 1;
+		return;
+	}
+
+	rec = capture_ring + at;
+	capture_put32(rec, size);
+	capture_put32(rec + 4, (u32)SDL_GetTicks());
+	capture_put16(rec + 8, count + (capture_whole ? 1 : 0));
+	capture_put16(rec + 10, capture_pal_new ? capture_pal_count : 0);
+	p = rec + CAPTURE_HEAD;
+	if (capture_pal_new)
+	{
+		memcpy(p, capture_pal, capture_pal_count * 3);
+		p += capture_pal_count * 3;
+	}
+	if (capture_whole)
+	{
+		// an empty band says the size
+		memset(p, 0, 8);
+		capture_put16(p + 8, capture_w);
+		capture_put16(p + 10, capture_h);
+		p += 12;
+	}
+	for (i = 0; i < count; i++)
+	{
+		capture_put16(p, band[i].x);
+		capture_put16(p + 2, band[i].y);
+		capture_put16(p + 4, band[i].w);
+		capture_put16(p + 6, band[i].h);
+		p += 8;
+		for (row = 0; row < band[i].h; row++, p += band[i].w)
+			memcpy(p, pixels + (band[i].y + row) * pitch + band[i].x, band[i].w);
+	}
+
+	SDL_SetAtomicInt(&capture_head, (int)(head + size));	// publishes it
+	SDL_SignalSemaphore(capture_wake);
+	capture_pal_new = 0;
+	capture_whole = 0;
+}
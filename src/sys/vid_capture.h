@@ -0,0 +1,19 @@
+#ifndef NAGI_SYS_VID_CAPTURE_H
+#define NAGI_SYS_VID_CAPTURE_H
+
+#include "drv_video.h"
+
+/* FUNCTIONS	---	---	---	---	---	---	--- */
+
+// starts the writer thread if [vid] capture asks for one
+extern void vid_capture_open(void);
+// writes out whatever's queued and stops
+extern void vid_capture_close(void);
+
+// the screen surface was (re)made, the next frame goes in whole
+extern void vid_capture_size(int w, int h);
+extern void vid_capture_palette(PCOLOUR *palette, u8 num);
+// the bands of the surface that changed at this flush
+extern void vid_capture_frame(const u8 *pixels, int pitch, const SDL_Rect *band, int count);
+
+#endif /* NAGI_SYS_VID_CAPTURE_H */
@@ -18,12 +18,17 @@
 #include "drv_video.h"
 #include "vid_render.h"
 #include "gfx.h"
+#include "gfx_scale.h"
+#include "profile.h"
+#include "replay.h"
 
 
 
 /* PROTOTYPES	---	---	---	---	---	---	--- */
 static void ega_update(int x, int y, int width, int height);
 static void cga_update(int x, int y, int width, int height);
+static void ega_row(u8 *dst, const u8 *src, u16 width, u16 scale);
+static void cga_row(u8 *dst, const u8 *src, u16 width, u16 scale);
 #if 0
 static void dummy_update(int x, int y, int width, int height);
 #endif
@@ -36,11 +41,21 @@ static void dummy_rect(int x, int y, int width, int height, u8 colour);
 
 static void dummy_view_dither(u8 *view_data);
 static void cga_view_dither(u8 *view_data);	// dither view
+static void render_batch_add(int x, int y, int width, int height);
+static void render_picbuff(int x, int y, int width, int height);
 
 
 
 /* VARIABLES	---	---	---	---	---	---	--- */
 
+// updates held back between render_batch_begin() and render_batch_end()
+// as a span of columns per picture row, [x0, x1)
+static int render_batch = 0;
+static s16 batch_x0[168];
+static s16 batch_x1[168];
+static int batch_top = 0;		// dirty rows are in [batch_top, batch_bottom)
+static int batch_bottom = 0;
+
 
 /* CODE	---	---	---	---	---	---	---	--- */
 
@@ -49,7 +64,8 @@ static RDRIVER render_drv_cga0 =
 	R_CGA0, 0, PAL_CGA0,
 	320, 168, 2,1, 
 	cga_update, cga_rect,
-	render_colour, cga_view_dither
+	render_colour, cga_view_dither,
+	cga_row
 };
 
 static RDRIVER render_drv_cga1 = 
@@ -57,7 +73,8 @@ static RDRIVER render_drv_cga1 =
 	R_CGA1, 1, PAL_CGA1,
 	320, 168, 2, 1, 
 	cga_update, cga_rect,
-	render_colour, cga_view_dither
+	render_colour, cga_view_dither,
+	cga_row
 };
 
 static RDRIVER render_drv_ega = 
@@ -65,7 +82,8 @@ static RDRIVER render_drv_ega =
 	R_EGA, 3, PAL_16,
 	320, 168, 2,1, 
 	ega_update, ega_rect,
-	render_colour, dummy_view_dither
+	render_colour, dummy_view_dither,
+	ega_row
 };
 
 #if 0
@@ -102,12 +120,9 @@ rend_x_scale
 rend_y_scale
 */
 
-// init or reread new settings
-void render_init()
+// the renderer render_init() will use, known as soon as the config is
+RDRIVER *render_pick(void)
 {
-	// free buffer if it already exists
-	render_shutdown();
-
 	if (drv_list_ptr == 0)
 	{
 		if (!strcasecmp(c_vid_renderer, "cga0"))
@@ -117,8 +132,16 @@ void render_init()
 		else //if (!strcasecmp(c_vid_renderer, "ega"))
 			drv_list_ptr = &drv_list[0];
 	}
-	
-	rend_drv = *drv_list_ptr;
+	return *drv_list_ptr;
+}
+
+// init or reread new settings
+void render_init()
+{
+	// free buffer if it already exists
+	render_shutdown();
+
+	rend_drv = render_pick();
 
 	rend_buf_size = rend_drv->w * rend_drv->h;
 	rend_buf = a_malloc(rend_buf_size);
@@ -196,54 +219,161 @@ static int render_clip(int *r_x, int *r_y, int *r_w, int *r_h)
 
 void render_update(int x, int y, int width, int height)
 {
+	u64 prof;
+
 	if (render_clip(&x, &y, &width, &height))
 		return;
-	rend_drv->func_update(x, y, width, height);
-	gfx_update(x, y, width, height);
+	if (render_batch != 0)
+	{
+		render_batch_add(x, y, width, height);
+		return;
+	}
+	prof = profile_now();
+	render_picbuff(x, y, width, height);
+	profile_sub(PROFILE_RENDER, prof);
+}
+
+// the picture goes straight to the screen in one pass.  rend_buf only
+// needs it for the replay's screen hash
+static void render_picbuff(int x, int y, int width, int height)
+{
+	if (replay_mode == REPLAY_PLAY)
+		rend_drv->func_update(x, y, width, height);
+	gfx_blit(x, y, width, height);
+}
+
+// hold render_update()s until the matching render_batch_end() so
+// overlapping objects are converted and scaled once.  they nest
+void render_batch_begin(void)
+{
+	render_batch++;
+}
+
+void render_batch_end(void)
+{
+	int row, x0, x1, first;
+	u64 prof;
+
+	if (render_batch == 0)
+		return;
+	render_batch--;
+	if (render_batch != 0)
+		return;
+	prof = profile_now();
+
+	// runs of dirty rows go out as one rect each
+	row = batch_top;
+	while (row < batch_bottom)
+	{
+		if (batch_x0[row] >= batch_x1[row])
+		{
+			row++;
+			continue;
+		}
+
+		first = row;
+		x0 = batch_x0[row];
+		x1 = batch_x1[row];
+		for (row++; (row < batch_bottom) && (batch_x0[row] < batch_x1[row]); row++)
+		{
+			if (batch_x0[row] < x0)
+				x0 = batch_x0[row];
+			if (batch_x1[row] > x1)
+				x1 = batch_x1[row];
+		}
+
+		// y is the bottom row
+		render_picbuff(x0, row - 1, x1 - x0, row - first);
+	}
+
+	for (row = batch_top; row < batch_bottom; row++)
+		batch_x0[row] = batch_x1[row] = 0;
+	batch_top = 0;
+	batch_bottom = 0;
+	profile_sub(PROFILE_RENDER, prof);
+}
+
+// the rect is clipped already.  y is its bottom row
+static void render_batch_add(int x, int y, int width, int height)
+{
+	int row, top;
+
+	top = y - height + 1;
+	for (row = top; row <= y; row++)
+	{
+		if (batch_x0[row] >= batch_x1[row])
+		{
+			batch_x0[row] = x;
+			batch_x1[row] = x + width;
+			continue;
+		}
+		if (x < batch_x0[row])
+			batch_x0[row] = x;
+		if (x + width > batch_x1[row])
+			batch_x1[row] = x + width;
+	}
+
+	if (batch_top >= batch_bottom)
+	{
+		batch_top = top;
+		batch_bottom = y + 1;
+		return;
+	}
+	if (top < batch_top)
+		batch_top = top;
+	if (y + 1 > batch_bottom)
+		batch_bottom = y + 1;
 }
 
 static void ega_update(int x, int y, int width, int height)
 {
 	u8 *pbuf, *rbuf;
-	int w, h;
+	GFX_SCALE_ROW row;
+	int h;
 	
 	pbuf = gfx_picbuff + 160*y + x;
 	rbuf = rend_buf + y*rend_drv->w + x*2;
+	row = gfx_scale_pick(2);
 	
 	for (h=height ; h!=0 ; h--)
 	{
-		for (w=width ; w!=0 ; w--)
-		{ 
-			*(rbuf++) = *(pbuf)&0xF;
-			*(rbuf++) = *(pbuf++)&0xF;
-		}
-		pbuf -= 160 + width;
-		rbuf -= rend_drv->w + width*2;
+		row(rbuf, pbuf, width, 2);
+		pbuf -= 160;
+		rbuf -= rend_drv->w;
 	}
-	
 }
 
 static void cga_update(int x, int y, int width, int height)
 {
 	u8 *pbuf, *rbuf;
-	int w, h;
+	GFX_SCALE_ROW row;
+	int h;
 	
 	pbuf = gfx_picbuff + 160*y + x;
 	rbuf = rend_buf + y*rend_drv->w + x*2;
+	row = gfx_scale_cga_pick(1);
 	
 	for (h=height ; h!=0 ; h--)
 	{
-		for (w=width ; w!=0 ; w--)
-		{ 
-			*(rbuf++) = (*pbuf & 0xC)>>2;
-			*(rbuf++) = *pbuf & 0x3;
-			pbuf++;
-		}
-		pbuf -= 160 + width;
-		rbuf -= rend_drv->w + width*2;
+		row(rbuf, pbuf, width, 1);
+		pbuf -= 160;
+		rbuf -= rend_drv->w;
 	}
 }
 
+// each pixel is doubled across, then scaled
+static void ega_row(u8 *dst, const u8 *src, u16 width, u16 scale)
+{
+	scale *= 2;
+	gfx_scale_pick(scale)(dst, src, width, scale);
+}
+
+// each pixel's high and low bit pairs side by side, then scaled
+static void cga_row(u8 *dst, const u8 *src, u16 width, u16 scale)
+{
+	gfx_scale_cga_pick(scale)(dst, src, width, scale);
+}
+
 #if 0
 static void dummy_update(int x, int y, int width, int height)
 {
@@ -285,47 +415,39 @@ static void ega_rect(int x, int y, int width, int height, u8 colour)
 
 static void cga_rect(int x, int y, int width, int height, u8 colour)
 {
-	u8 *rbuf;
+	u8 *rbuf, *first;
 	COLOUR rend_col;
 	u16 h_count, w_count;
 	
+	if (height <= 0)
+		return;
 	rbuf = rend_buf + y*rend_drv->w + x*2;
+	first = rbuf;
 	
 	// get cga colour!!
 	// uses odd AND even colours
 	render_colour(colour&0xF, &rend_col);
 	
+	// dither the first row, the rest are the same
 	if ((width & 1) != 0)
 	{
-		for (h_count=height; h_count!=0; h_count--)
-		{
-			*(rbuf++) = (rend_col.odd & 0xC)>>2;
-			*(rbuf++) = rend_col.odd & 0x3;
-			for (w_count=(width-1)/2; w_count!=0; w_count--)
-			{
-				*(rbuf++) = (rend_col.even& 0xC)>>2;
-				*(rbuf++) = rend_col.even & 0x3;
-				*(rbuf++) = (rend_col.odd & 0xC)>>2;
-				*(rbuf++) = rend_col.odd & 0x3;
-			}
-			rbuf -= rend_drv->w + width*2;
-		}
+		*(rbuf++) = (rend_col.odd & 0xC)>>2;
+		*(rbuf++) = rend_col.odd & 0x3;
 	}
-	else
+	for (w_count=width/2; w_count!=0; w_count--)
 	{
-		for (h_count=height; h_count!=0; h_count--)
-		{
-			for (w_count=width/2; w_count!=0; w_count--)
-			{
-				*(rbuf++) = (rend_col.even& 0xC)>>2;
-				*(rbuf++) = rend_col.even & 0x3;
-				*(rbuf++) = (rend_col.odd & 0xC)>>2;
-				*(rbuf++) = rend_col.odd & 0x3;
-			}
-			rbuf -= rend_drv->w + width*2;
-		}
+		*(rbuf++) = (rend_col.even& 0xC)>>2;
+		*(rbuf++) = rend_col.even & 0x3;
+		*(rbuf++) = (rend_col.odd & 0xC)>>2;
+		*(rbuf++) = rend_col.odd & 0x3;
+	}
+	
+	rbuf = first;
+	for (h_count=height-1; h_count!=0; h_count--)
+	{
+		rbuf -= rend_drv->w;
+		memcpy(rbuf, first, width*2);
 	}
-
 }
 
 #if 0
@@ -0,0 +1,697 @@
+/*
+Display streaming
+
+with stream_port set under [vid] the driver also serves the screen over
+WebSocket, so the game can run on a server and be watched from a browser
+(opening http://host:port/ gets a page that does it).  nothing is encoded
+as video.  the surface is 8 bit indices, so each flush sends only the
+bands vid_flush() found dirty, xor'd against the frame before and run
+length coded.. what didn't change is runs of zero and costs a couple of
+bytes a row.  palette changes go out as their own small message.
+
+messages are binary, the first byte says which:
+	'S'	u16 width, u16 height.  the client clears to colour 0
+	'P'	u8 first, u8 count, then r,g,b for each colour
+	'K'	the whole screen, rle
+	'D'	u16 bands, then for each u16 x, y, w, h and the rle of its rows
+		xor'd with what the client has
+all u16 are little endian.  rle is packbits style: a byte under 128 is
+that plus one literal bytes following, 128 and up repeats the next byte
+(byte - 125) times.
+
+a viewer that joins gets the size, the palette and a whole frame, then
+the deltas like everyone else.  one that can't keep up (STREAM_BACKLOG
+queued) is dropped and can reconnect.  it's only a display: the input
+still comes from the machine the game runs on.
+*/
+
+/* BASE headers	---	---	---	---	---	---	--- */
+#include "../agi.h"
+
+/* LIBRARY headers	---	---	---	---	---	---	--- */
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+/* OTHER headers	---	---	---	---	---	---	--- */
+#include "mem_wrap.h"
+#include "vid_stream.h"
+
+/* VARIABLES	---	---	---	---	---	---	--- */
+
+#define STREAM_CLIENTS 8
+#define STREAM_REQUEST 2048		// longest http request header taken
+#define STREAM_BACKLOG (2 << 20)	// bytes queued for a client before it's dropped
+#define STREAM_WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+#ifdef MSG_NOSIGNAL
+#define STREAM_SEND_FLAGS MSG_NOSIGNAL
+#else
+#define STREAM_SEND_FLAGS 0
+#endif
+
+struct stream_client_struct
+{
+	int fd;			// -1 if free
+	u8 open;		// websocket handshake done
+	u8 synced;		// has had a whole frame, takes the deltas
+	char request[STREAM_REQUEST];
+	u16 request_len;
+	u8 *out;		// queued to send
+	size_t out_len;
+	size_t out_sent;
+};
+typedef struct stream_client_struct STREAM_CLIENT;
+
+static int stream_fd = -1;
+static STREAM_CLIENT stream_client[STREAM_CLIENTS];
+
+static int stream_w = 0;
+static int stream_h = 0;
+static u8 *stream_prev = 0;	// the frame the clients have
+static u8 *stream_xor = 0;	// a band xor'd with it
+static u8 *stream_msg = 0;	// message being built
+static size_t stream_msg_size = 0;
+static u8 stream_pal[256 * 3];
+static u16 stream_pal_count = 0;
+
+// the viewer, served to anything that asks without upgrading
+static const char stream_page[] =
+	"<!DOCTYPE html><html><head><title>NAGI</title><style>"
+	"body{margin:0;background:#000}canvas{width:100vw;height:100vh;"
+	"object-fit:contain;image-rendering:pixelated}</style></head>"
+	"<body><canvas id=c></canvas><script>\n"
+	"var c=document.getElementById('c'),g=c.getContext('2d'),w=0,h=0,fb,img,px,pal=new Uint32Array(256);\n"
+	"function rle(d,p,t,n,x){var o=0,k,v;while(o<n){k=d[p++];if(k<128){for(k++;k--;o++)t[o]=x?t[o]^d[p++]:d[p++];}"
+	"else{v=d[p++];for(k-=125;k--;o++)t[o]=x?t[o]^v:v;}}return p;}\n"
+	"function draw(){for(var i=0;i<w*h;i++)px[i]=pal[fb[i]];g.putImageData(img,0,0);}\n"
+	"function go(){var s=new WebSocket('ws://'+location.host+'/');s.binaryType='arraybuffer';\n"
+	"s.onclose=function(){setTimeout(go,1000);};\n"
+	"s.onmessage=function(e){var d=new Uint8Array(e.data),v=new DataView(e.data),t=d[0],i,n,p,bx,by,bw,bh,r,b;\n"
+	"if(t==83){w=c.width=v.getUint16(1,true);h=c.height=v.getUint16(3,true);fb=new Uint8Array(w*h);"
+	"img=g.createImageData(w,h);px=new Uint32Array(img.data.buffer);}\n"
+	"else if(t==80){for(i=0;i<d[2];i++)pal[d[1]+i]=0xFF000000|(d[5+i*3]<<16)|(d[4+i*3]<<8)|d[3+i*3];}\n"
+	"else if(t==75){rle(d,1,fb,w*h,0);}\n"
+	"else if(t==68){n=v.getUint16(1,true);p=3;while(n--){bx=v.getUint16(p,true);by=v.getUint16(p+2,true);"
+	"bw=v.getUint16(p+4,true);bh=v.getUint16(p+6,true);b=new Uint8Array(bw*bh);"
+	"for(r=0;r<bh;r++)b.set(fb.subarray((by+r)*w+bx,(by+r)*w+bx+bw),r*bw);p=rle(d,p+8,b,bw*bh,1);"
+	"for(r=0;r<bh;r++)fb.set(b.subarray(r*bw,r*bw+bw),(by+r)*w+bx);}}\n"
+	"if(fb)draw();};}\ngo();\n"
+	"</script></body></html>";
+
+/* CODE	---	---	---	---	---	---	---	--- */
+
+#ifndef _WIN32
+
+static u32 sha1_rol(u32 x, int n)
+{
+	return (x << n) | (x >> (32 - n));
+}
+
+// only needed for the handshake, the key is short
+static void stream_sha1(const u8 *data, size_t size, u8 *digest)
+{
+	u32 h[5] = {0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0};
+	u32 w[80], a, b, c, d, e, f, k, t;
+	u8 block[64];
+	size_t pos, i, left;
+	int j, last;
+
+	for (pos = 0, last = 0; !last; pos += 64)
+	{
+		memset(block, 0, sizeof(block));
+		left = (pos < size) ? size - pos : 0;
+		if (left >= 64)
+			memcpy(block, data + pos, 64);
+		else
+		{
+			memcpy(block, data + pos, left);
+			if (pos <= size)
+				block[left] = 0x80;
+			// the length goes in the last 8 bytes of the last block
+			if (left < 56)
+			{
+				for (j = 0; j < 8; j++)
+					block[63 - j] = (u8)(((u64)size * 8) >> (j * 8));
+				last = 1;
+			}
+		}
+
+		for (i = 0; i < 16; i++)
+			w[i] = ((u32)block[i*4] << 24) | ((u32)block[i*4+1] << 16) |
+				((u32)block[i*4+2] << 8) | block[i*4+3];
+		for (i = 16; i < 80; i++)
+			w[i] = sha1_rol(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+
+		a = h[0]; b = h[1]; c = h[2]; d = h[3]; e = h[4];
+		for (i = 0; i < 80; i++)
+		{
+			if (i < 20) { f = (b & c) | (~b & d); k = 0x5A827999; }
+			else if (i < 40) { f = b ^ c ^ d; k = 0x6ED9EBA1; }
+			else if (i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+			else { f = b ^ c ^ d; k = 0xCA62C1D6; }
+			t = sha1_rol(a, 5) + f + e + k + w[i];
+			e = d; d = c; c = sha1_rol(b, 30); b = a; a = t;
+		}
+		h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+	}
+
+	for (i = 0; i < 20; i++)
+		digest[i] = (u8)(h[i >> 2] >> ((3 - (i & 3)) * 8));
+}
+
+static void stream_base64(const u8 *data, size_t size, char *out)
+{
+	static const char table[] =
+		"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	size_t i;
+	u32 v;
+
+	for (i = 0; i < size; i += 3)
+	{
+		v = (u32)data[i] << 16;
+		if (i + 1 < size) v |= (u32)data[i+1] << 8;
+		if (i + 2 < size) v |= data[i+2];
+		*(out++) = table[(v >> 18) & 63];
+		*(out++) = table[(v >> 12) & 63];
+		*(out++) = (i + 1 < size) ? table[(v >> 6) & 63] : '=';
+		*(out++) = (i + 2 < size) ? table[v & 63] : '=';
+	}
+	*out = 0;
+}
+
+// packbits, see the top
+static size_t stream_rle(const u8 *src, size_t size, u8 *dst)
+{
+	size_t i, o, run, start;
+
+	i = 0;
+	o = 0;
+	while (i < size)
+	{
+		run = 1;
+		while ( (i + run < size) && (run < 130) && (src[i + run] == src[i]) )
+			run++;
+		if (run >= 3)
+		{
+			dst[o++] = (u8)(run + 125);
+			dst[o++] = src[i];
+			i += run;
+			continue;
+		}
+
+		// literals up to the next run of three
+		start = i;
+		while ( (i < size) && (i - start < 128) )
+		{
+			if ( (i + 2 < size) && (src[i] == src[i+1]) && (src[i] == src[i+2]) )
+				break;
+			i++;
+		}
+		dst[o++] = (u8)(i - start - 1);
+		memcpy(dst + o, src + start, i - start);
+		o += i - start;
+	}
+	return o;
+}
+
+static void stream_put16(u8 *p, int v)
+{
+	p[0] = (u8)v;
+	p[1] = (u8)(v >> 8);
+}
+
+static void stream_drop(STREAM_CLIENT *cl)
+{
+	if (cl->fd < 0)
+		return;
+	close(cl->fd);
+	if (cl->out != 0)
+		a_free(cl->out);
+	memset(cl, 0, sizeof(STREAM_CLIENT));
+	cl->fd = -1;
+}
+
+// send what's queued, as much as the socket takes
+static void stream_send(STREAM_CLIENT *cl)
+{
+	ssize_t sent;
+
+	while (cl->out_sent < cl->out_len)
+	{
+		sent = send(cl->fd, cl->out + cl->out_sent, cl->out_len - cl->out_sent, STREAM_SEND_FLAGS);
+		if (sent > 0)
+		{
+			cl->out_sent += (size_t)sent;
+			continue;
+		}
+		if ( (sent < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) )
+			return;
+		stream_drop(cl);
+		return;
+	}
+	cl->out_len = 0;
+	cl->out_sent = 0;
+}
+
+static void stream_queue_raw(STREAM_CLIENT *cl, const void *data, size_t size)
+{
+	if (cl->out_sent != 0)
+	{
+		memmove(cl->out, cl->out + cl->out_sent, cl->out_len - cl->out_sent);
+		cl->out_len -= cl->out_sent;
+		cl->out_sent = 0;
+	}
+	if (cl->out_len + size > STREAM_BACKLOG)
+	{
+		printf("Stream: dropping a viewer that isn't keeping up\n");
+		stream_drop(cl);
+		return;
+	}
+	memcpy(cl->out + cl->out_len, data, size);
+	cl->out_len += size;
+}
+
+// one binary websocket message.  the server's frames aren't masked
+static void stream_queue(STREAM_CLIENT *cl, const u8 *msg, size_t size)
+{
+	u8 head[10];
+	int head_size, i;
+
+	head[0] = 0x82;
+	if (size < 126)
+	{
+		head[1] = (u8)size;
+		head_size = 2;
+	}
+	else if (size < 0x10000)
+	{
+		head[1] = 126;
+		head[2] = (u8)(size >> 8);
+		head[3] = (u8)size;
+		head_size = 4;
+	}
+	else
+	{
+		head[1] = 127;
+		for (i = 0; i < 8; i++)
+			head[9 - i] = (u8)((u64)size >> (i * 8));
+		head_size = 10;
+	}
+	stream_queue_raw(cl, head, head_size);
+	if (cl->fd >= 0)
+		stream_queue_raw(cl, msg, size);
+}
+
+// queued and sent straight away, the next poll is a whole wait off
+static void stream_queue_all(const u8 *msg, size_t size)
+{
+	int i;
+
+	for (i = 0; i < STREAM_CLIENTS; i++)
+		if ( (stream_client[i].fd >= 0) && stream_client[i].synced )
+		{
+			stream_queue(&stream_client[i], msg, size);
+			if (stream_client[i].fd >= 0)
+				stream_send(&stream_client[i]);
+		}
+}
+
+// size, palette and the whole frame for a viewer that's just joined
+static void stream_sync(STREAM_CLIENT *cl)
+{
+	size_t size;
+
+	if ( (stream_prev == 0) || (stream_msg == 0) )
+		return;
+
+	stream_msg[0] = 'S';
+	stream_put16(stream_msg + 1, stream_w);
+	stream_put16(stream_msg + 3, stream_h);
+	stream_queue(cl, stream_msg, 5);
+
+	if ( (cl->fd >= 0) && (stream_pal_count != 0) )
+	{
+		stream_msg[0] = 'P';
+		stream_msg[1] = 0;
+		stream_msg[2] = (u8)stream_pal_count;
+		memcpy(stream_msg + 3, stream_pal, stream_pal_count * 3);
+		stream_queue(cl, stream_msg, 3 + stream_pal_count * 3);
+	}
+
+	if (cl->fd >= 0)
+	{
+		stream_msg[0] = 'K';
+		size = 1 + stream_rle(stream_prev, (size_t)stream_w * stream_h, stream_msg + 1);
+		stream_queue(cl, stream_msg, size);
+	}
+	if (cl->fd >= 0)
+		cl->synced = 1;
+}
+
+// finds a header's value in the request, case doesn't matter for the name
+static const char *stream_header(const char *request, const char *name, char *value, size_t value_size)
+{
+	const char *line, *p;
+	size_t name_len, i;
+
+	name_len = strlen(name);
+	for (line = strstr(request, "\r\n"); line != 0; line = strstr(line, "\r\n"))
+	{
+		line += 2;
+		for (i = 0; i < name_len; i++)
+			if (tolower((unsigned char)line[i]) != tolower((unsigned char)name[i]))
+				break;
+		if ( (i != name_len) || (line[i] != ':') )
+			continue;
+		p = line + name_len + 1;
+		while (*p == ' ')
+			p++;
+		for (i = 0; (i + 1 < value_size) && (p[i] != '\r') && (p[i] != 0) && (p[i] != ' '); i++)
+			value[i] = p[i];
+		value[i] = 0;
+		return value;
+	}
+	return 0;
+}
+
+// a whole request has come in, upgrade it or hand out the page
+static void stream_handshake(STREAM_CLIENT *cl)
+{
+	char key[128], accept[32], reply[256];
+	char page_head[128];
+	u8 digest[20];
+
+	if (stream_header(cl->request, "Sec-WebSocket-Key", key, sizeof(key) - sizeof(STREAM_WS_GUID)) == 0)
+	{
+		sprintf(page_head, "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\n"
+			"Content-Length: %d\r\nConnection: close\r\n\r\n", (int)(sizeof(stream_page) - 1));
+		stream_queue_raw(cl, page_head, strlen(page_head));
+		if (cl->fd >= 0)
+			stream_queue_raw(cl, stream_page, sizeof(stream_page) - 1);
+		if (cl->fd >= 0)
+			stream_send(cl);
+		// the page is small enough to go in one go, or it's not worth waiting on
+		stream_drop(cl);
+		return;
+	}
+
+	strcat(key, STREAM_WS_GUID);
+	stream_sha1((const u8 *)key, strlen(key), digest);
+	stream_base64(digest, sizeof(digest), accept);
+	sprintf(reply, "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+		"Connection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n", accept);
+	stream_queue_raw(cl, reply, strlen(reply));
+	if (cl->fd < 0)
+		return;
+	cl->open = 1;
+	stream_sync(cl);
+}
+
+// what the client sends.. only the request matters, after that it's read and
+// thrown away so a close shows up as the end of the stream
+static void stream_read(STREAM_CLIENT *cl)
+{
+	char junk[512];
+	ssize_t got;
+
+	for (;;)
+	{
+		if (cl->open)
+			got = recv(cl->fd, junk, sizeof(junk), 0);
+		else
+		{
+			if (cl->request_len >= STREAM_REQUEST - 1)
+			{
+				stream_drop(cl);
+				return;
+			}
+			got = recv(cl->fd, cl->request + cl->request_len, STREAM_REQUEST - 1 - cl->request_len, 0);
+		}
+		if (got == 0)
+		{
+			stream_drop(cl);
+			return;
+		}
+		if (got < 0)
+		{
+			if ( (errno != EAGAIN) && (errno != EWOULDBLOCK) && (errno != EINTR) )
+				stream_drop(cl);
+			return;
+		}
+		if (!cl->open)
+		{
+			cl->request_len += (u16)got;
+			cl->request[cl->request_len] = 0;
+			if (strstr(cl->request, "\r\n\r\n") != 0)
+			{
+				stream_handshake(cl);
+				return;
+			}
+		}
+	}
+}
+
+static void stream_accept(void)
+{
+	STREAM_CLIENT *cl;
+	int fd, i;
+
+	for (;;)
+	{
+		fd = accept(stream_fd, 0, 0);
+		if (fd < 0)
+			return;
+		for (i = 0; (i < STREAM_CLIENTS) && (stream_client[i].fd >= 0); i++)
+			;
+		if (i == STREAM_CLIENTS)
+		{
+			close(fd);
+			continue;
+		}
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+		{
+			int on = 1;
+			setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+		}
+#endif
+		cl = &stream_client[i];
+		memset(cl, 0, sizeof(STREAM_CLIENT));
+		cl->fd = fd;
+		cl->out = a_malloc(STREAM_BACKLOG);
+	}
+}
+
+void vid_stream_open(int port)
+{
+	struct sockaddr_in addr;
+	int i, on;
+
+	if ( (port <= 0) || (stream_fd >= 0) )
+		return;
+
+	for (i = 0; i < STREAM_CLIENTS; i++)
+	{
+		memset(&stream_client[i], 0, sizeof(STREAM_CLIENT));
+		stream_client[i].fd = -1;
+	}
+
+	stream_fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (stream_fd < 0)
+	{
+		printf("Stream: unable to make a socket\n");
+		return;
+	}
+	on = 1;
+	setsockopt(stream_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_ANY);
+	addr.sin_port = htons((u16)port);
+	if ( (bind(stream_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) ||
+		(listen(stream_fd, STREAM_CLIENTS) != 0) )
+	{
+		printf("Stream: unable to listen on port %d\n", port);
+		close(stream_fd);
+		stream_fd = -1;
+		return;
+	}
+	fcntl(stream_fd, F_SETFL, fcntl(stream_fd, F_GETFL, 0) | O_NONBLOCK);
+	printf("Stream: serving the display on port %d\n", port);
+}
+
+void vid_stream_close(void)
+{
+	int i;
+
+	if (stream_fd < 0)
+		return;
+	for (i = 0; i < STREAM_CLIENTS; i++)
+		stream_drop(&stream_client[i]);
+	close(stream_fd);
+	stream_fd = -1;
+
+	if (stream_prev != 0)
+	{
+		a_free(stream_prev);
+		a_free(stream_xor);
+		a_free(stream_msg);
+	}
+	stream_prev = 0;
+	stream_xor = 0;
+	stream_msg = 0;
+	stream_msg_size = 0;
+	stream_w = 0;
+	stream_h = 0;
+}
+
+void vid_stream_size(int w, int h)
+{
+	size_t pixels;
+	int i;
+
+	if (stream_fd < 0)
+		return;
+	if (stream_prev != 0)
+	{
+		a_free(stream_prev);
+		a_free(stream_xor);
+		a_free(stream_msg);
+	}
+
+	stream_w = w;
+	stream_h = h;
+	pixels = (size_t)w * h;
+	stream_prev = a_malloc(pixels);
+	stream_xor = a_malloc(pixels);
+	memset(stream_prev, 0, pixels);
+	// rle's worst case is a byte in 128 more, plus a band header per row
+	stream_msg_size = 3 + pixels + pixels / 128 + (size_t)h * (8 + 2) + 256 * 3;
+	stream_msg = a_malloc(stream_msg_size);
+
+	for (i = 0; i < STREAM_CLIENTS; i++)
+		stream_client[i].synced = 0;
+}
+
+void vid_stream_palette(PCOLOUR *palette, u8 num)
+{
+	int i;
+
+	if (stream_fd < 0)
+		return;
+	for (i = 0; i < num; i++)
+	{
+		stream_pal[i*3] = palette[i].r;
+		stream_pal[i*3+1] = palette[i].g;
+		stream_pal[i*3+2] = palette[i].b;
+	}
+	stream_pal_count = num;
+	if ( (stream_msg == 0) || (num == 0) )
+		return;
+
+	stream_msg[0] = 'P';
+	stream_msg[1] = 0;
+	stream_msg[2] = num;
+	memcpy(stream_msg + 3, stream_pal, num * 3);
+	stream_queue_all(stream_msg, 3 + num * 3);
+}
+
+void vid_stream_frame(const u8 *pixels, int pitch, const SDL_Rect *band, int count)
+{
+	const SDL_Rect *b;
+	const u8 *src;
+	u8 *prev, *x, *msg;
+	int i, row, col, watched;
+
+	if ( (stream_prev == 0) || (count == 0) )
+		return;
+
+	watched = 0;
+	for (i = 0; i < STREAM_CLIENTS; i++)
+		if ( (stream_client[i].fd >= 0) && stream_client[i].synced )
+			watched = 1;
+
+	msg = stream_msg;
+	*(msg++) = 'D';
+	stream_put16(msg, count);
+	msg += 2;
+	for (b = band; b < band + count; b++)
+	{
+		// the bands are inside the surface, it made them
+		for (row = 0; row < b->h; row++)
+		{
+			src = pixels + (b->y + row) * pitch + b->x;
+			prev = stream_prev + (b->y + row) * stream_w + b->x;
+			if (watched)
+			{
+				x = stream_xor + row * b->w;
+				for (col = 0; col < b->w; col++)
+					x[col] = src[col] ^ prev[col];
+			}
+			memcpy(prev, src, b->w);
+		}
+		if (!watched)
+			continue;
+
+		stream_put16(msg, b->x);
+		stream_put16(msg + 2, b->y);
+		stream_put16(msg + 4, b->w);
+		stream_put16(msg + 6, b->h);
+		msg += 8;
+		msg += stream_rle(stream_xor, (size_t)b->w * b->h, msg);
+	}
+
+	if (watched)
+		stream_queue_all(stream_msg, msg - stream_msg);
+}
+
+void vid_stream_poll(void)
+{
+	STREAM_CLIENT *cl;
+	int i;
+
+	if (stream_fd < 0)
+		return;
+	stream_accept();
+	for (i = 0; i < STREAM_CLIENTS; i++)
+	{
+		cl = &stream_client[i];
+		if (cl->fd >= 0)
+			stream_read(cl);
+		if ( (cl->fd >= 0) && cl->open && !cl->synced )
+			stream_sync(cl);
+		if (cl->fd >= 0)
+			stream_send(cl);
+	}
+}
+
+#else
+
+// winsock would need its own setup.. not done yet
+void vid_stream_open(int port)
+{
+	if (port > 0)
+		printf("Stream: not supported on this platform\n");
+}
+
+void vid_stream_close(void) {}
+void vid_stream_size(int w, int h) { (void)w; (void)h; }
+void vid_stream_palette(PCOLOUR *palette, u8 num) { (void)palette; (void)num; }
+void vid_stream_frame(const u8 *pixels, int pitch, const SDL_Rect *band, int count)
+{
+	(void)pixels; (void)pitch; (void)band; (void)count;
+}
+void vid_stream_poll(void) {}
+
+#endif
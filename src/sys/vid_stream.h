@@ -0,0 +1,20 @@
+#ifndef NAGI_SYS_VID_STREAM_H
+#define NAGI_SYS_VID_STREAM_H
+
+#include "drv_video.h"
+
+/* FUNCTIONS	---	---	---	---	---	---	--- */
+
+// listen for viewers on the port, 0 leaves streaming off
+extern void vid_stream_open(int port);
+extern void vid_stream_close(void);
+
+// the screen surface was (re)made, every viewer starts over from a whole frame
+extern void vid_stream_size(int w, int h);
+extern void vid_stream_palette(PCOLOUR *palette, u8 num);
+// the bands of the surface that changed at this flush
+extern void vid_stream_frame(const u8 *pixels, int pitch, const SDL_Rect *band, int count);
+// take new viewers and send what's queued, every flush
+extern void vid_stream_poll(void);
+
+#endif /* NAGI_SYS_VID_STREAM_H */
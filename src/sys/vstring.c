@@ -18,6 +18,8 @@ shift characters a certain number left
 void vstring_shift(VSTRING *, shift_size)
 */
 
+#define MEM_TAG MEM_TEXT
+
 /* BASE headers	---	---	---	---	---	---	--- */
 #include "../agi.h"
 #include "../sys/vstring.h"
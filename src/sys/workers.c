@@ -0,0 +1,215 @@
+/*
+Shared background workers
+
+the jobs done ahead of the game (resources decoded by res_prefetch.c,
+pictures rendered by pic_prerender.c) run on one set of low priority
+threads instead of a thread each.  a module adds a function that takes one
+of its queued jobs and does it; the workers go round them all until none
+has anything left, then sleep until workers_wake().
+
+they run at priority_worker (low unless nagi.ini says otherwise).  how
+many there are comes from the core budget, cpu_budget in nagi.ini
+(the cores this process keeps busy, 0 for all of them).  one core is left
+to the interpreter and audio, the llm's decode threads get the rest (see
+workers_llm_threads()) and the workers share those at a lower priority.
+while the llm has interactive work, a message being translated or a
+command being extracted, they don't start anything new so every core it
+was given is its own.
+*/
+
+#include <string.h>
+
+#include "../agi.h"
+#include "workers.h"
+#include "thread_attr.h"
+
+#ifdef NAGI_ENABLE_LLM
+#include "../llm_global.h"
+#endif
+
+// kinds of job
+#define WORKERS_JOBS 4
+
+// how often a worker looks again while the llm has the cores
+#define WORKERS_YIELD_MS 5
+
+static SDL_Thread *workers_thread[WORKERS_MAX];
+static int workers_total = 0;
+static WORKER_JOB workers_job[WORKERS_JOBS];
+static int workers_job_total = 0;
+static SDL_Mutex *workers_mutex = 0;
+static SDL_Condition *workers_cond = 0;
+static u32 workers_signal = 0;		// bumped by each wake
+static SDL_AtomicInt workers_quit;
+
+// cores the budget allows, at least 1
+static int workers_budget(void)
+{
+	int cores;
+
+	cores = SDL_GetNumLogicalCPUCores();
+	if (cores < 1)
+		cores = 1;
+	if ( (c_nagi_cpu_budget > 0) && (c_nagi_cpu_budget < cores) )
+		cores = c_nagi_cpu_budget;
+	return cores;
+}
+
+int workers_llm_threads(void)
+{
+	if (c_nagi_cpu_budget <= 0)
+		return 0;
+	// the interpreter and audio keep a core when there's one to spare
+	if (workers_budget() < 2)
+		return 1;
+	return workers_budget() - 1;
+}
+
+// interactive llm work goes first
+static void workers_yield(void)
+{
+#ifdef NAGI_ENABLE_LLM
+	while ( (g_llm != 0) && nagi_llm_async_interactive(g_llm) &&
+		!SDL_GetAtomicInt(&workers_quit) )
+		SDL_Delay(WORKERS_YIELD_MS);
+#endif
+}
+
+static int workers_main(void *data)
+{
+	int worker;
+	u32 seen;
+	int i, jobs, did;
+
+	worker = (int)(intptr_t)data;
+	thread_attr_apply(THREAD_WORKER);
+
+	SDL_LockMutex(workers_mutex);
+	while (!SDL_GetAtomicInt(&workers_quit))
+	{
+		seen = workers_signal;
+		jobs = workers_job_total;
+		SDL_UnlockMutex(workers_mutex);
+
+		// round the kinds of job until nobody has any left
+		do
+		{
+			did = 0;
+			for (i = 0; i < jobs; i++)
+			{
+				workers_yield();
+				if (SDL_GetAtomicInt(&workers_quit))
+					break;
+				did |= workers_job[i](worker);
+			}
+		} while (did && !SDL_GetAtomicInt(&workers_quit));
+
+		SDL_LockMutex(workers_mutex);
+		// anything queued while going round woke us already
+		if ( (seen == workers_signal) && !SDL_GetAtomicInt(&workers_quit) )
+			SDL_WaitCondition(workers_cond, workers_mutex);
+	}
+	SDL_UnlockMutex(workers_mutex);
+
+	return 0;
+}
+
+void workers_init()
+{
+	int budget, total;
+
+	memset(workers_thread, 0, sizeof(workers_thread));
+	memset(workers_job, 0, sizeof(workers_job));
+	workers_total = 0;
+	workers_job_total = 0;
+	workers_signal = 0;
+	SDL_SetAtomicInt(&workers_quit, 0);
+
+	// a worker on the game's only core just takes turns away from it
+	budget = workers_budget();
+	if (budget < 2)
+	{
+		printf("Workers: off (core budget of %d)\n", budget);
+		return;
+	}
+	// one per four cores, the llm has the rest
+	total = budget / 4;
+	if (total < 1)
+		total = 1;
+	if (total > WORKERS_MAX)
+		total = WORKERS_MAX;
+
+	workers_mutex = SDL_CreateMutex();
+	workers_cond = SDL_CreateCondition();
+	if ( (workers_mutex == 0) || (workers_cond == 0) )
+	{
+		printf("Workers: unable to create lock: %s\n", SDL_GetError());
+		workers_denit();
+		return;
+	}
+
+	while (workers_total < total)
+	{
+		workers_thread[workers_total] = SDL_CreateThread(workers_main, "nagi_worker",
+							(void *)(intptr_t)workers_total);
+		if (workers_thread[workers_total] == 0)
+			break;
+		workers_total++;
+	}
+
+	if (workers_total == 0)
+	{
+		printf("Workers: unable to create thread: %s\n", SDL_GetError());
+		workers_denit();
+		return;
+	}
+	printf("Workers: %d of a %d core budget\n", workers_total, budget);
+}
+
+// the jobs' modules are shut down after this, nothing runs them any more
+void workers_denit()
+{
+	int i;
+
+	if (workers_total != 0)
+	{
+		SDL_LockMutex(workers_mutex);
+		SDL_SetAtomicInt(&workers_quit, 1);
+		SDL_BroadcastCondition(workers_cond);
+		SDL_UnlockMutex(workers_mutex);
+		for (i = 0; i < workers_total; i++)
+			SDL_WaitThread(workers_thread[i], NULL);
+		workers_total = 0;
+	}
+	memset(workers_thread, 0, sizeof(workers_thread));
+	workers_job_total = 0;
+
+	if (workers_cond != 0)
+		SDL_DestroyCondition(workers_cond);
+	if (workers_mutex != 0)
+		SDL_DestroyMutex(workers_mutex);
+	workers_cond = 0;
+	workers_mutex = 0;
+}
+
+int workers_add(WORKER_JOB job)
+{
+	if ( (workers_total == 0) || (workers_job_total >= WORKERS_JOBS) )
+		return 0;
+
+	SDL_LockMutex(workers_mutex);
+	workers_job[workers_job_total++] = job;
+	SDL_UnlockMutex(workers_mutex);
+	return 1;
+}
+
+void workers_wake()
+{
+	if (workers_total == 0)
+		return;
+
+	SDL_LockMutex(workers_mutex);
+	workers_signal++;
+	SDL_BroadcastCondition(workers_cond);
+	SDL_UnlockMutex(workers_mutex);
+}
@@ -0,0 +1,23 @@
+#ifndef NAGI_SYS_WORKERS_H
+#define NAGI_SYS_WORKERS_H
+
+// most threads the workers start
+#define WORKERS_MAX 4
+
+// does one queued job of its kind on worker number worker (for anything
+// it keeps per thread).  0 if there wasn't one
+typedef int (*WORKER_JOB)(int worker);
+
+extern void workers_init(void);
+extern void workers_denit(void);
+
+// add a kind of job.  0 when there are no workers, so do it on the main thread
+extern int workers_add(WORKER_JOB job);
+// after queueing a job
+extern void workers_wake(void);
+
+// decode threads the llm may have, the cores of the budget the
+// interpreter and audio don't keep.  0 if it isn't limited
+extern int workers_llm_threads(void);
+
+#endif /* NAGI_SYS_WORKERS_H */
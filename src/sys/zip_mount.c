@@ -0,0 +1,666 @@
+/*
+Games in zip archives
+
+a game can be left in the .zip it was downloaded in.  the archive is
+mapped and its central directory read once into a table hashed on each
+file's name, lowercase and without any folders in the archive, so
+"KQ1/VOL.0" is found as "vol.0".
+
+a file that's stored comes straight out of the mapping.  one that's
+deflated is inflated the first time it's asked for, checked against its
+crc32, and that copy is kept until the archive is closed.  either way the
+caller gets the same span for as long as the archive is open: the vols
+are used where they sit just like mapped files (res_vol.c).
+
+the game scan reads the crc32s from the central directory instead of
+hashing the files, they're the same crc (agi_crc.c).
+
+zip64 and encrypted archives aren't read.
+*/
+
+#define MEM_TAG MEM_RES
+
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "../agi.h"
+#include "zip_mount.h"
+
+#include "agi_file.h"
+#include "endian.h"
+#include "mem_wrap.h"
+#include "../version/agi_crc.h"
+
+#define ZIP_EOCD_SIG 0x06054B50
+#define ZIP_CENTRAL_SIG 0x02014B50
+#define ZIP_LOCAL_SIG 0x04034B50
+#define ZIP_EOCD_SIZE 22
+#define ZIP_CENTRAL_SIZE 46
+#define ZIP_LOCAL_SIZE 30
+#define ZIP_COMMENT_MAX 0xFFFF
+
+#define ZIP_STORED 0
+#define ZIP_DEFLATED 8
+
+struct zip_entry_struct
+{
+	const char *name;	// lowercase, in the name pool
+	u32 hash;
+	u32 crc;
+	u32 comp_size;
+	u32 size;
+	u32 local;	// offset of the local header
+	u16 method;
+	u16 flags;
+	u8 *inflated;	// the inflated copy once it's been asked for
+};
+typedef struct zip_entry_struct ZIP_ENTRY;
+
+struct zip_struct
+{
+	u8 *data;
+	size_t size;
+	u8 mapped;	// data is file_map()'d, otherwise a_malloc()'d
+	ZIP_ENTRY *entry;
+	int count;
+	u32 *slot;	// entry + 1 in each, 0 if free
+	u32 slot_mask;
+	char *names;
+};
+
+static ZIP *zip_game = 0;
+
+// ---------------------------------------- INFLATE ----------------------------------------
+
+// rfc 1951, decoded canonically a bit at a time.  the files are small and
+// each is only inflated once
+
+struct inflate_struct
+{
+	const u8 *in;
+	size_t in_size;
+	size_t in_pos;
+	u32 bits;
+	int bit_count;
+	u8 *out;
+	size_t out_size;
+	size_t out_pos;
+};
+typedef struct inflate_struct INFLATE;
+
+struct huffman_struct
+{
+	u16 count[16];	// codes of each length
+	u16 symbol[288];	// symbols in code order
+};
+typedef struct huffman_struct HUFFMAN;
+
+static const u16 inf_len_base[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+	35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+static const u8 inf_len_extra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+	3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+static const u16 inf_dist_base[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+	257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+static const u8 inf_dist_extra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+	7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+static const u8 inf_order[19] = {16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+// the next few bits, -1 if the input's run out
+static int inf_bits(INFLATE *s, int need)
+{
+	u32 val;
+
+	val = s->bits;
+	while (s->bit_count < need)
+	{
+		if (s->in_pos >= s->in_size)
+			return -1;
+		val |= (u32)s->in[s->in_pos++] << s->bit_count;
+		s->bit_count += 8;
+	}
+	s->bits = val >> need;
+	s->bit_count -= need;
+	return (int)(val & ((1u << need) - 1));
+}
+
+static int inf_decode(INFLATE *s, const HUFFMAN *h)
+{
+	int code, first, index, len, count, bit;
+
+	code = first = index = 0;
+	for (len = 1; len < 16; len++)
+	{
+		bit = inf_bits(s, 1);
+		if (bit < 0)
+			return -1;
+		code |= bit;
+		count = h->count[len];
+		if (code - count < first)
+			return h->symbol[index + (code - first)];
+		index += count;
+		first = (first + count) << 1;
+		code <<= 1;
+	}
+	return -1;
+}
+
+// 0 if the lengths make a code (an incomplete one decodes what it has)
+static int inf_build(HUFFMAN *h, const u8 *length, int n)
+{
+	u16 offs[16];
+	int len, sym, left;
+
+	memset(h->count, 0, sizeof(h->count));
+	for (sym = 0; sym < n; sym++)
+		h->count[length[sym]]++;
+	h->count[0] = 0;
+
+	left = 1;
+	for (len = 1; len < 16; len++)
+	{
+		left = (left << 1) - h->count[len];
+		if (left < 0)
+			return -1;
+	}
+
+	offs[1] = 0;
+	for (len = 1; len < 15; len++)
+		offs[len + 1] = offs[len] + h->count[len];
+	for (sym = 0; sym < n; sym++)
+		if (length[sym] != 0)
+			h->symbol[offs[length[sym]]++] = (u16)sym;
+	return 0;
+}
+
+static int inf_codes(INFLATE *s, const HUFFMAN *lencode, const HUFFMAN *distcode)
+{
+	int sym, extra;
+	size_t len, dist;
+
+	for (;;)
+	{
+		sym = inf_decode(s, lencode);
+		if (sym < 0)
+			return -1;
+		if (sym < 256)
+		{
+			if (s->out_pos >= s->out_size)
+				return -1;
+			s->out[s->out_pos++] = (u8)sym;
+			continue;
+		}
+		if (sym == 256)
+			return 0;
+
+		sym -= 257;
+		if (sym >= 29)
+			return -1;
+		extra = inf_bits(s, inf_len_extra[sym]);
+		if (extra < 0)
+			return -1;
+		len = inf_len_base[sym] + (size_t)extra;
+
+		sym = inf_decode(s, distcode);
+		if ( (sym < 0) || (sym >= 30) )
+			return -1;
+		extra = inf_bits(s, inf_dist_extra[sym]);
+		if (extra < 0)
+			return -1;
+		dist = inf_dist_base[sym] + (size_t)extra;
+
+		if ( (dist > s->out_pos) || (len > s->out_size - s->out_pos) )
+			return -1;
+		while (len-- != 0)
+		{
+			s->out[s->out_pos] = s->out[s->out_pos - dist];
+			s->out_pos++;
+		}
+	}
+}
+
+static int inf_stored(INFLATE *s)
+{
+	size_t len;
+
+	// the rest of the byte is padding
+	s->bits = 0;
+	s->bit_count = 0;
+	if (s->in_size - s->in_pos < 4)
+		return -1;
+	len = load_le_16(s->in + s->in_pos);
+	if ( (len ^ 0xFFFF) != load_le_16(s->in + s->in_pos + 2) )
+		return -1;
+	s->in_pos += 4;
+	if ( (len > s->in_size - s->in_pos) || (len > s->out_size - s->out_pos) )
+		return -1;
+	memcpy(s->out + s->out_pos, s->in + s->in_pos, len);
+	s->in_pos += len;
+	s->out_pos += len;
+	return 0;
+}
+
+static int inf_fixed(INFLATE *s)
+{
+	HUFFMAN lencode, distcode;
+	u8 length[288];
+	int sym;
+
+	for (sym = 0; sym < 144; sym++)
+		length[sym] = 8;
+	for (; sym < 256; sym++)
+		length[sym] = 9;
+	for (; sym < 280; sym++)
+		length[sym] = 7;
+	for (; sym < 288; sym++)
+		length[sym] = 8;
+	inf_build(&lencode, length, 288);
+	for (sym = 0; sym < 30; sym++)
+		length[sym] = 5;
+	inf_build(&distcode, length, 30);
+	return inf_codes(s, &lencode, &distcode);
+}
+
+static int inf_dynamic(INFLATE *s)
+{
+	HUFFMAN lencode, distcode;
+	u8 length[288 + 32];
+	int nlen, ndist, ncode, index, sym, len, repeat;
+
+	nlen = inf_bits(s, 5);
+	ndist = inf_bits(s, 5);
+	ncode = inf_bits(s, 4);
+	if ( (nlen < 0) || (ndist < 0) || (ncode < 0) )
+		return -1;
+	nlen += 257;
+	ndist += 1;
+	ncode += 4;
+	if ( (nlen > 286) || (ndist > 30) )
+		return -1;
+
+	memset(length, 0, sizeof(length));
+	for (index = 0; index < ncode; index++)
+	{
+		len = inf_bits(s, 3);
+		if (len < 0)
+			return -1;
+		length[inf_order[index]] = (u8)len;
+	}
+	if (inf_build(&lencode, length, 19) != 0)
+		return -1;
+
+	index = 0;
+	while (index < nlen + ndist)
+	{
+		sym = inf_decode(s, &lencode);
+		if (sym < 0)
+			return -1;
+		if (sym < 16)
+		{
+			length[index++] = (u8)sym;
+			continue;
+		}
+		len = 0;
+		repeat = -1;
+		if (sym == 16)
+		{
+			if (index == 0)
+				return -1;
+			len = length[index - 1];
+			if ( (repeat = inf_bits(s, 2)) >= 0 )
+				repeat += 3;
+		}
+		else if (sym == 17)
+		{
+			if ( (repeat = inf_bits(s, 3)) >= 0 )
+				repeat += 3;
+		}
+		else if ( (repeat = inf_bits(s, 7)) >= 0 )
+			repeat += 11;
+		if ( (repeat < 0) || (index + repeat > nlen + ndist) )
+			return -1;
+		while (repeat-- != 0)
+			length[index++] = (u8)len;
+	}
+
+	// no end of block code, nothing could end
+	if (length[256] == 0)
+		return -1;
+	if ( (inf_build(&lencode, length, nlen) != 0) ||
+		(inf_build(&distcode, length + nlen, ndist) != 0) )
+		return -1;
+	return inf_codes(s, &lencode, &distcode);
+}
+
+// 1 if the whole of out was filled
+static int inflate_raw(const u8 *in, size_t in_size, u8 *out, size_t out_size)
+{
+	INFLATE s;
+	int last, type, err;
+
+	memset(&s, 0, sizeof(s));
+	s.in = in;
+	s.in_size = in_size;
+	s.out = out;
+	s.out_size = out_size;
+
+	do
+	{
+		last = inf_bits(&s, 1);
+		type = inf_bits(&s, 2);
+		if ( (last < 0) || (type < 0) )
+			return 0;
+		switch (type)
+		{
+			case 0:
+				err = inf_stored(&s);
+				break;
+			case 1:
+				err = inf_fixed(&s);
+				break;
+			case 2:
+				err = inf_dynamic(&s);
+				break;
+			default:
+				err = -1;
+		}
+		if (err != 0)
+			return 0;
+	} while (!last);
+
+	return s.out_pos == out_size;
+}
+
+// ---------------------------------------- ARCHIVE ----------------------------------------
+
+// fnv-1a
+static u32 zip_hash(const char *name)
+{
+	u32 h;
+
+	h = 2166136261u;
+	while (*name != 0)
+		h = (h ^ (u8)*(name++)) * 16777619u;
+	return h;
+}
+
+static ZIP_ENTRY *zip_find(ZIP *zip, const char *name)
+{
+	char lower[NAME_MAX];
+	ZIP_ENTRY *e;
+	u32 h, i;
+	size_t n;
+
+	if ( (zip == 0) || (zip->count == 0) )
+		return 0;
+	for (n = 0; (name[n] != 0) && (n < sizeof(lower) - 1); n++)
+		lower[n] = (name[n] >= 'A' && name[n] <= 'Z') ? name[n] - 'A' + 'a' : name[n];
+	lower[n] = 0;
+
+	h = zip_hash(lower);
+	for (i = h & zip->slot_mask; zip->slot[i] != 0; i = (i + 1) & zip->slot_mask)
+	{
+		e = &zip->entry[zip->slot[i] - 1];
+		if ( (e->hash == h) && (strcmp(e->name, lower) == 0) )
+			return e;
+	}
+	return 0;
+}
+
+// the central directory into the table.  0 if it isn't a zip we can read
+static int zip_index(ZIP *zip)
+{
+	const u8 *eocd, *p, *end, *name_ptr;
+	const u8 *low;
+	u32 cd_off, cd_size, h, i;
+	u16 total, name_len, j, start;
+	char *pool;
+	ZIP_ENTRY *e;
+
+	if (zip->size < ZIP_EOCD_SIZE)
+		return 0;
+
+	// the end record is the last thing, after a comment of up to 64k
+	eocd = 0;
+	low = (zip->size > ZIP_EOCD_SIZE + ZIP_COMMENT_MAX) ?
+		zip->data + zip->size - ZIP_EOCD_SIZE - ZIP_COMMENT_MAX : zip->data;
+	for (p = zip->data + zip->size - ZIP_EOCD_SIZE; p >= low; p--)
+		if (load_le_32(p) == ZIP_EOCD_SIG)
+		{
+			eocd = p;
+			break;
+		}
+	if (eocd == 0)
+		return 0;
+
+	total = load_le_16(eocd + 10);
+	cd_size = load_le_32(eocd + 12);
+	cd_off = load_le_32(eocd + 16);
+	if ( (cd_off > zip->size) || (cd_size > zip->size - cd_off) )
+		return 0;
+
+	zip->entry = (ZIP_ENTRY *)a_malloc(((size_t)total + 1) * sizeof(ZIP_ENTRY));
+	memset(zip->entry, 0, ((size_t)total + 1) * sizeof(ZIP_ENTRY));
+	zip->names = (char *)a_malloc((size_t)cd_size + 1);
+	zip->slot_mask = 15;
+	while (zip->slot_mask < (u32)total * 2)
+		zip->slot_mask = (zip->slot_mask << 1) | 1;
+	zip->slot = (u32 *)a_malloc(((size_t)zip->slot_mask + 1) * sizeof(u32));
+	memset(zip->slot, 0, ((size_t)zip->slot_mask + 1) * sizeof(u32));
+
+	pool = zip->names;
+	p = zip->data + cd_off;
+	end = p + cd_size;
+	for (i = 0; i < total; i++)
+	{
+		if ( (end - p < ZIP_CENTRAL_SIZE) || (load_le_32(p) != ZIP_CENTRAL_SIG) )
+			break;
+		name_len = load_le_16(p + 28);
+		if (end - p - ZIP_CENTRAL_SIZE < (ptrdiff_t)name_len)
+			break;
+		name_ptr = p + ZIP_CENTRAL_SIZE;
+
+		// just the name, the game's files can be in a folder in the archive
+		start = 0;
+		for (j = 0; j < name_len; j++)
+			if ( (name_ptr[j] == '/') || (name_ptr[j] == '\\') )
+				start = j + 1;
+
+		e = &zip->entry[zip->count];
+		e->name = pool;
+		for (j = start; j < name_len; j++)
+			*(pool++) = (name_ptr[j] >= 'A' && name_ptr[j] <= 'Z') ? name_ptr[j] - 'A' + 'a' : (char)name_ptr[j];
+		*(pool++) = 0;
+		e->flags = load_le_16(p + 8);
+		e->method = load_le_16(p + 10);
+		e->crc = load_le_32(p + 16);
+		e->comp_size = load_le_32(p + 20);
+		e->size = load_le_32(p + 24);
+		e->local = load_le_32(p + 42);
+
+		p += ZIP_CENTRAL_SIZE + name_len + load_le_16(p + 30) + load_le_16(p + 32);
+
+		// folders, and the same name again further in
+		if ( (start == name_len) || (zip_find(zip, e->name) != 0) )
+			continue;
+		e->hash = zip_hash(e->name);
+		for (h = e->hash & zip->slot_mask; zip->slot[h] != 0; h = (h + 1) & zip->slot_mask)
+			;
+		zip->slot[h] = (u32)zip->count + 1;
+		zip->count++;
+	}
+	return 1;
+}
+
+ZIP *zip_open(const char *path)
+{
+	FILE *stream;
+	ZIP *zip;
+	long size;
+
+	stream = fopen(path, "rb");
+	if (stream == 0)
+		return 0;
+
+	zip = (ZIP *)a_malloc(sizeof(ZIP));
+	memset(zip, 0, sizeof(ZIP));
+	zip->data = file_map(stream, &zip->size);
+	if (zip->data != 0)
+		zip->mapped = 1;
+	else
+	{
+		fseek(stream, 0, SEEK_END);
+		size = ftell(stream);
+		fseek(stream, 0, SEEK_SET);
+		if (size > 0)
+		{
+			zip->size = (size_t)size;
+			zip->data = (u8 *)a_malloc(zip->size);
+			if (fread(zip->data, 1, zip->size, stream) != zip->size)
+				zip->size = 0;
+		}
+	}
+	fclose(stream);
+
+	if (!zip_index(zip))
+	{
+		zip_close(zip);
+		return 0;
+	}
+	return zip;
+}
+
+void zip_close(ZIP *zip)
+{
+	int i;
+
+	if (zip == 0)
+		return;
+	for (i = 0; i < zip->count; i++)
+		if (zip->entry[i].inflated != 0)
+			a_free(zip->entry[i].inflated);
+	if (zip->entry != 0)
+		a_free(zip->entry);
+	if (zip->slot != 0)
+		a_free(zip->slot);
+	if (zip->names != 0)
+		a_free(zip->names);
+	if (zip->mapped)
+		file_unmap(zip->data, zip->size);
+	else if (zip->data != 0)
+		a_free(zip->data);
+	a_free(zip);
+}
+
+int zip_count(ZIP *zip)
+{
+	return zip->count;
+}
+
+const char *zip_name(ZIP *zip, int index)
+{
+	if ( (index < 0) || (index >= zip->count) )
+		return 0;
+	return zip->entry[index].name;
+}
+
+int zip_crc(ZIP *zip, const char *name, u32 *crc)
+{
+	ZIP_ENTRY *e;
+
+	e = zip_find(zip, name);
+	if (e == 0)
+		return 0;
+	*crc = e->crc;
+	return 1;
+}
+
+const u8 *zip_span(ZIP *zip, const char *name, size_t *size)
+{
+	ZIP_ENTRY *e;
+	const u8 *local, *data;
+	size_t off;
+	u8 *out;
+
+	e = zip_find(zip, name);
+	if (e == 0)
+		return 0;
+	*size = e->size;
+	if (e->inflated != 0)
+		return e->inflated;
+
+	// bit 0 is encryption
+	if ( ((e->flags & 1) != 0) || (e->local > zip->size) || (zip->size - e->local < ZIP_LOCAL_SIZE) )
+		return 0;
+	local = zip->data + e->local;
+	if (load_le_32(local) != ZIP_LOCAL_SIG)
+		return 0;
+	off = (size_t)e->local + ZIP_LOCAL_SIZE + load_le_16(local + 26) + load_le_16(local + 28);
+	if ( (off > zip->size) || (e->comp_size > zip->size - off) )
+		return 0;
+	data = zip->data + off;
+
+	switch (e->method)
+	{
+		case ZIP_STORED:
+			if (e->comp_size != e->size)
+				return 0;
+			return data;
+
+		case ZIP_DEFLATED:
+			out = (u8 *)a_malloc(e->size + 1);
+			if ( !inflate_raw(data, e->comp_size, out, e->size) || (crc_generate(out, e->size) != e->crc) )
+			{
+				printf("zip: %s is damaged\n", e->name);
+				a_free(out);
+				return 0;
+			}
+			e->inflated = out;
+			return out;
+
+		default:
+			printf("zip: %s is compressed a way that can't be read (%d)\n", e->name, e->method);
+			return 0;
+	}
+}
+
+int zip_path(const char *path)
+{
+	size_t len;
+
+	len = strlen(path);
+	return (len > 4) && (strcasecmp(path + len - 4, ".zip") == 0);
+}
+
+// ---------------------------------------- GAME ----------------------------------------
+
+int zip_mount(const char *path)
+{
+	zip_unmount();
+	zip_game = zip_open(path);
+	if (zip_game == 0)
+	{
+		printf("zip: can't read %s\n", path);
+		return 0;
+	}
+	return 1;
+}
+
+void zip_unmount(void)
+{
+	zip_close(zip_game);
+	zip_game = 0;
+}
+
+int zip_mounted(void)
+{
+	return zip_game != 0;
+}
+
+// a file of the game's, 0 if no zip is mounted or it isn't in there
+const u8 *zip_game_file(const char *name, size_t *size)
+{
+	if (zip_game == 0)
+		return 0;
+	return zip_span(zip_game, name, size);
+}
@@ -0,0 +1,26 @@
+#ifndef NAGI_SYS_ZIP_MOUNT_H
+#define NAGI_SYS_ZIP_MOUNT_H
+
+struct zip_struct;
+typedef struct zip_struct ZIP;
+
+// an archive on its own, for looking at what's in one (the game scan)
+extern ZIP *zip_open(const char *path);
+extern void zip_close(ZIP *zip);
+extern int zip_count(ZIP *zip);
+extern const char *zip_name(ZIP *zip, int index);
+// the crc32 the archive holds for a file, 0 if it isn't there
+extern int zip_crc(ZIP *zip, const char *name, u32 *crc);
+// a file's bytes, 0 if it isn't there or can't be read.  good until zip_close()
+extern const u8 *zip_span(ZIP *zip, const char *name, size_t *size);
+
+// 1 if the path names a zip archive rather than a directory
+extern int zip_path(const char *path);
+
+// the game being played, when it came in a zip
+extern int zip_mount(const char *path);
+extern void zip_unmount(void);
+extern int zip_mounted(void);
+extern const u8 *zip_game_file(const char *name, size_t *size);
+
+#endif /* NAGI_SYS_ZIP_MOUNT_H */
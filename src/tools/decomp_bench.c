@@ -0,0 +1,507 @@
+/*
+Decompression benchmark
+
+"nagi-decomp-bench [-n passes] [-o results.csv] <dir file> ..." reads every
+compressed resource of one or more v3 games (KQ4DIR, GRDIR, ...) into
+memory and times lzw_decompress_mem() and pic_decompress_mem() against
+the decoders they replaced.  a resource that doesn't come out at the size
+in its vol header, or where the two outputs differ, is counted as a mismatch.
+
+a table goes to stdout and, with -o, one csv row per game, decoder and
+implementation so the numbers can be kept from release to release.
+
+built with -DNAGI_BUILD_DECOMP_BENCH=ON.
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../agi.h"
+
+#include "../res/res.h"
+#include "../sys/endian.h"
+
+#define BENCH_GAMES_MAX 16
+#define BENCH_VOLS 16
+#define BENCH_PAD 4		// the old lzw reads up to 3 bytes past a code
+
+enum
+{
+	BENCH_LZW = 0,
+	BENCH_PIC,
+	BENCH_DECODERS
+};
+
+enum
+{
+	BENCH_OLD = 0,
+	BENCH_NEW,
+	BENCH_IMPLS
+};
+
+static const char *bench_decoder_names[BENCH_DECODERS] = {"lzw", "pic"};
+static const char *bench_impl_names[BENCH_IMPLS] = {"old", "new"};
+
+struct bench_res_struct
+{
+	u8 *comp;		// compressed data followed by BENCH_PAD zeros
+	u16 comp_size;
+	u16 size;		// uncompressed, from the vol header
+	u16 pic;		// picture compression instead of lzw
+};
+typedef struct bench_res_struct BENCH_RES;
+
+struct bench_result_struct
+{
+	u32 count;
+	u64 comp_bytes;
+	u64 bytes;
+	double seconds;
+	u32 mismatches;
+};
+typedef struct bench_result_struct BENCH_RESULT;
+
+struct bench_game_struct
+{
+	const char *name;
+	BENCH_RES *res;
+	u32 res_count;
+	BENCH_RESULT result[BENCH_DECODERS][BENCH_IMPLS];
+};
+typedef struct bench_game_struct BENCH_GAME;
+
+static u8 bench_cbuff[0x400];
+
+static u8 *bench_file_read(const char *name, size_t *size)
+{
+	FILE *f;
+	u8 *data;
+	long len;
+
+	f = fopen(name, "rb");
+	if (f == 0)
+		return 0;
+	data = 0;
+	if ( (fseek(f, 0, SEEK_END) == 0) && ((len = ftell(f)) > 0) && (fseek(f, 0, SEEK_SET) == 0) )
+	{
+		data = malloc((size_t)len);
+		if ( (data != 0) && (fread(data, 1, (size_t)len, f) != (size_t)len) )
+		{
+			free(data);
+			data = 0;
+		}
+		*size = (size_t)len;
+	}
+	fclose(f);
+	return data;
+}
+
+// KQ4DIR -> KQ4VOL.3, keeping the case of the dir file's name
+static void bench_vol_name(char *name, size_t name_size, const char *dir_name, u16 vol)
+{
+	size_t len;
+	char *tail;
+
+	snprintf(name, name_size, "%s.%u", dir_name, vol);
+	len = strlen(dir_name);
+	tail = name + len - 3;
+	tail[0] = (tail[0] == 'd') ? 'v' : 'V';
+	tail[1] = (tail[1] == 'i') ? 'o' : 'O';
+	tail[2] = (tail[2] == 'r') ? 'l' : 'L';
+}
+
+// the baseline decoder.. the dictionary holds a back pointer and a byte per
+// code and every string is walked backwards onto a stack before being written.
+static u16 ref_lzw_decode(const u8 *src, u16 src_size, u8 *dst, u16 dst_size)
+{
+	struct
+	{
+		u16 prev;
+		u8 ascii;
+	} dict[0x800];
+	static const u16 code_mask[] = {0x1FF, 0x3FF, 0x7FF};
+	u8 code_string[0x800];
+	u8 *str_ptr;
+	u32 bit_cur, bit_max;
+	u16 width, code_read, code_cur, code_prev, code_next, code_max;
+	u16 di;
+	u8 ascii;
+
+	bit_cur = 0;
+	bit_max = (u32)src_size << 3;
+	width = 9;
+	code_next = 0x102;
+	code_max = 0x200;
+	code_prev = 0;
+	ascii = 0;
+	di = 0;
+
+	while (bit_cur + width <= bit_max)
+	{
+		code_read = (u16)((load_le_16(src + (bit_cur >> 3)) >> (bit_cur & 7)) |
+			(src[(bit_cur >> 3) + 2] << (16 - (bit_cur & 7))));
+		code_read &= code_mask[width - 9];
+		bit_cur += width;
+
+		if (code_read == 0x101)
+			break;
+		if (code_read == 0x100)
+		{
+			width = 9;
+			code_max = 0x200;
+			code_next = 0x102;
+			if (bit_cur + width > bit_max)
+				break;
+			code_read = (u16)((load_le_16(src + (bit_cur >> 3)) >> (bit_cur & 7)) |
+				(src[(bit_cur >> 3) + 2] << (16 - (bit_cur & 7))));
+			code_read &= code_mask[width - 9];
+			bit_cur += width;
+			if ( (code_read >= 0x100) || (di >= dst_size) )
+				break;
+			code_prev = code_read;
+			ascii = (u8)code_read;
+			dst[di++] = ascii;
+			continue;
+		}
+
+		code_cur = code_read;
+		str_ptr = code_string;
+		if (code_cur >= code_next)
+		{
+			code_cur = code_prev;
+			*(str_ptr++) = ascii;
+		}
+		while ( (code_cur >= 0x100) && (code_cur < code_next) && (code_cur < 0x800) &&
+			(str_ptr < code_string + sizeof(code_string) - 1) )
+		{
+			*(str_ptr++) = dict[code_cur].ascii;
+			code_cur = dict[code_cur].prev;
+		}
+		if (code_cur >= 0x100)
+			break;
+		ascii = (u8)code_cur;
+		*(str_ptr++) = ascii;
+
+		if (str_ptr - code_string > dst_size - di)
+			break;
+		while (str_ptr > code_string)
+			dst[di++] = *(--str_ptr);
+
+		if (code_next < 0x800)
+		{
+			dict[code_next].ascii = ascii;
+			dict[code_next].prev = code_prev;
+		}
+		code_next++;
+		code_prev = code_read;
+		if ( (code_next >= code_max) && (width != 11) )
+		{
+			width++;
+			code_max <<= 1;
+		}
+	}
+
+	return di;
+}
+
+// picture compression one nibble at a time, the way the format reads.
+// colour arguments of F0 and F2 are a single nibble, everything else a byte.
+static u16 ref_pic_decode(const u8 *src, u16 src_size, u8 *dst, u16 dst_size)
+{
+	u32 nib, nib_max;
+	u16 di;
+	u8 code, pad;
+
+	nib = 0;
+	nib_max = (u32)src_size << 1;
+	pad = 0;
+	di = 0;
+	do
+	{
+		if (pad)
+		{
+			if (nib >= nib_max)
+				break;
+			code = (src[nib >> 1] >> ((nib & 1) ? 0 : 4)) & 0x0F;
+			nib++;
+			pad = 0;
+		}
+		else
+		{
+			if (nib + 2 > nib_max)
+				break;
+			code = (u8)((((src[nib >> 1] >> ((nib & 1) ? 0 : 4)) & 0x0F) << 4) |
+				((src[(nib + 1) >> 1] >> ((nib & 1) ? 4 : 0)) & 0x0F));
+			nib += 2;
+			pad = (code == 0xF0) || (code == 0xF2);
+		}
+		if (di >= dst_size)
+			break;
+		dst[di++] = code;
+	} while (code != 0xFF);
+
+	return di;
+}
+
+static u16 bench_decode(u16 impl, const BENCH_RES *r, u8 *dst, u16 dst_size)
+{
+	if (r->pic)
+	{
+		if (impl == BENCH_OLD)
+			return ref_pic_decode(r->comp, r->comp_size, dst, dst_size);
+		return pic_decompress_mem(r->comp, bench_cbuff, r->comp_size, dst, sizeof(bench_cbuff));
+	}
+	if (impl == BENCH_OLD)
+		return ref_lzw_decode(r->comp, r->comp_size, dst, dst_size);
+	return lzw_decompress_mem(r->comp, r->comp_size, dst, dst_size);
+}
+
+// every compressed resource listed in the dir file, copied out of its vol
+static int bench_game_load(BENCH_GAME *game, const char *dir_name)
+{
+	u8 *vols[BENCH_VOLS];
+	size_t vol_sizes[BENCH_VOLS];
+	char vol_name[1024];
+	u8 *dir, *e, *head;
+	size_t dir_size, off, end;
+	u32 pos, cap;
+	u16 sect, i, vol, size, comp_size;
+	BENCH_RES *r;
+
+	if (strlen(dir_name) < 3)
+		return 0;
+	dir = bench_file_read(dir_name, &dir_size);
+	if ( (dir == 0) || (dir_size < 8) )
+	{
+		printf("decomp bench: can't read %s\n", dir_name);
+		free(dir);
+		return 0;
+	}
+
+	memset(vols, 0, sizeof(vols));
+	memset(vol_sizes, 0, sizeof(vol_sizes));
+	game->name = dir_name;
+	game->res = 0;
+	game->res_count = 0;
+	cap = 0;
+
+	for (sect = 0; sect < 4; sect++)
+	{
+		off = load_le_16(dir + sect * 2);
+		end = dir_size;
+		for (i = 0; i < 4; i++)
+			if ( (load_le_16(dir + i * 2) > off) && (load_le_16(dir + i * 2) < end) )
+				end = load_le_16(dir + i * 2);
+
+		for (; off + 3 <= end; off += 3)
+		{
+			e = dir + off;
+			if ( (e[0] == 0xFF) && (e[1] == 0xFF) && (e[2] == 0xFF) )
+				continue;
+			vol = e[0] >> 4;
+			pos = ((u32)(e[0] & 0x0F) << 16) | ((u32)e[1] << 8) | e[2];
+
+			if (vols[vol] == 0)
+			{
+				bench_vol_name(vol_name, sizeof(vol_name), dir_name, vol);
+				vols[vol] = bench_file_read(vol_name, &vol_sizes[vol]);
+				if (vols[vol] == 0)
+					continue;
+			}
+			if (pos + 7 > vol_sizes[vol])
+				continue;
+			head = vols[vol] + pos;
+			size = load_le_16(head + 3);
+			comp_size = load_le_16(head + 5);
+			if ( (head[0] != 0x12) || (head[1] != 0x34) || (pos + 7 + comp_size > vol_sizes[vol]) )
+				continue;
+			// stored as is
+			if ( ((head[2] & 0x80) == 0) && (comp_size == size) )
+				continue;
+
+			if (game->res_count == cap)
+			{
+				cap = cap ? cap * 2 : 256;
+				game->res = realloc(game->res, cap * sizeof(BENCH_RES));
+			}
+			r = &game->res[game->res_count++];
+			r->comp = calloc(comp_size + BENCH_PAD, 1);
+			memcpy(r->comp, head + 7, comp_size);
+			r->comp_size = comp_size;
+			r->size = size;
+			r->pic = (head[2] & 0x80) != 0;
+		}
+	}
+
+	for (i = 0; i < BENCH_VOLS; i++)
+		free(vols[i]);
+	free(dir);
+
+	if (game->res_count == 0)
+		printf("decomp bench: no compressed resources behind %s\n", dir_name);
+	return game->res_count != 0;
+}
+
+static void bench_game_run(BENCH_GAME *game, int passes)
+{
+	u8 *out[BENCH_IMPLS];
+	u16 len[BENCH_IMPLS];
+	BENCH_RESULT *res;
+	BENCH_RES *r;
+	u64 start, ticks, freq;
+	u32 i;
+	u16 impl, dec;
+	int p;
+
+	out[BENCH_OLD] = malloc(0x10000);
+	out[BENCH_NEW] = malloc(0x10000);
+	memset(game->result, 0, sizeof(game->result));
+
+	// outputs first so a broken decoder shows up before its speed does
+	for (i = 0; i < game->res_count; i++)
+	{
+		r = &game->res[i];
+		for (impl = 0; impl < BENCH_IMPLS; impl++)
+		{
+			memset(out[impl], 0, 0x10000);
+			len[impl] = bench_decode(impl, r, out[impl], 0xFFFF);
+		}
+		// short of the size in the vol header, or new not matching old
+		res = game->result[r->pic ? BENCH_PIC : BENCH_LZW];
+		if (len[BENCH_OLD] != r->size)
+			res[BENCH_OLD].mismatches++;
+		if ( (len[BENCH_NEW] != r->size) || (len[BENCH_OLD] != len[BENCH_NEW]) ||
+			(memcmp(out[BENCH_OLD], out[BENCH_NEW], len[BENCH_NEW]) != 0) )
+			res[BENCH_NEW].mismatches++;
+		for (impl = 0; impl < BENCH_IMPLS; impl++)
+		{
+			res[impl].count++;
+			res[impl].comp_bytes += r->comp_size;
+			res[impl].bytes += len[impl];
+		}
+	}
+
+	for (dec = 0; dec < BENCH_DECODERS; dec++)
+		for (impl = 0; impl < BENCH_IMPLS; impl++)
+		{
+			start = SDL_GetPerformanceCounter();
+			for (p = 0; p < passes; p++)
+				for (i = 0; i < game->res_count; i++)
+				{
+					r = &game->res[i];
+					if (r->pic == (dec == BENCH_PIC))
+						bench_decode(impl, r, out[impl], 0xFFFF);
+				}
+			ticks = SDL_GetPerformanceCounter() - start;
+			freq = SDL_GetPerformanceFrequency();
+			game->result[dec][impl].seconds = (double)ticks / (double)freq / passes;
+		}
+
+	free(out[BENCH_OLD]);
+	free(out[BENCH_NEW]);
+}
+
+static double bench_mbs(const BENCH_RESULT *res)
+{
+	return (res->seconds > 0.0) ? (double)res->bytes / res->seconds / 1e6 : 0.0;
+}
+
+static int bench_csv_write(const char *path, const BENCH_GAME *games, int game_count, int passes)
+{
+	const BENCH_RESULT *res;
+	FILE *f;
+	int g, dec, impl;
+
+	f = fopen(path, "w");
+	if (f == 0)
+	{
+		printf("decomp bench: can't write %s\n", path);
+		return 0;
+	}
+
+	fprintf(f, "version,game,decoder,impl,resources,compressed_bytes,bytes,passes,seconds,mb_per_s,mismatches\n");
+	for (g = 0; g < game_count; g++)
+		for (dec = 0; dec < BENCH_DECODERS; dec++)
+			for (impl = 0; impl < BENCH_IMPLS; impl++)
+			{
+				res = &games[g].result[dec][impl];
+				if (res->count == 0)
+					continue;
+				fprintf(f, "%s,%s,%s,%s,%u,%llu,%llu,%d,%.6f,%.1f,%u\n",
+					NAGI_VERSION, games[g].name, bench_decoder_names[dec], bench_impl_names[impl],
+					res->count, (unsigned long long)res->comp_bytes, (unsigned long long)res->bytes,
+					passes, res->seconds, bench_mbs(res), res->mismatches);
+			}
+	fclose(f);
+	return 1;
+}
+
+int main(int argc, char *argv[])
+{
+	BENCH_GAME games[BENCH_GAMES_MAX];
+	const BENCH_RESULT *res;
+	const char *csv;
+	int passes, game_count, mismatches;
+	int a, g, dec, impl;
+	u32 i;
+
+	passes = 20;
+	csv = 0;
+	game_count = 0;
+	for (a = 1; a < argc; a++)
+	{
+		if ( (strcmp(argv[a], "-n") == 0) && (a + 1 < argc) )
+			passes = atoi(argv[++a]);
+		else if ( (strcmp(argv[a], "-o") == 0) && (a + 1 < argc) )
+			csv = argv[++a];
+		else if (game_count < BENCH_GAMES_MAX)
+		{
+			if (bench_game_load(&games[game_count], argv[a]))
+				game_count++;
+		}
+	}
+	if (passes < 1)
+		passes = 1;
+	if (game_count == 0)
+	{
+		printf("usage: %s [-n passes] [-o results.csv] <dir file> ...\n", argv[0]);
+		return 1;
+	}
+
+	lzw_init();
+	mismatches = 0;
+	printf("%-24s %-4s %-4s %6s %10s %10s %9s %8s\n",
+		"game", "dec", "impl", "res", "in", "out", "MB/s", "differ");
+	for (g = 0; g < game_count; g++)
+	{
+		bench_game_run(&games[g], passes);
+		for (dec = 0; dec < BENCH_DECODERS; dec++)
+			for (impl = 0; impl < BENCH_IMPLS; impl++)
+			{
+				res = &games[g].result[dec][impl];
+				if (res->count == 0)
+					continue;
+				printf("%-24s %-4s %-4s %6u %10llu %10llu %9.1f %8u\n",
+					games[g].name, bench_decoder_names[dec], bench_impl_names[impl], res->count,
+					(unsigned long long)res->comp_bytes, (unsigned long long)res->bytes,
+					bench_mbs(res), res->mismatches);
+				mismatches += (int)res->mismatches;
+			}
+	}
+
+	if (csv != 0)
+		bench_csv_write(csv, games, game_count, passes);
+
+	for (g = 0; g < game_count; g++)
+	{
+		for (i = 0; i < games[g].res_count; i++)
+			free(games[g].res[i].comp);
+		free(games[g].res);
+	}
+	lzw_shutdown();
+
+	if (mismatches != 0)
+		printf("%d resources decoded differently\n", mismatches);
+	return mismatches != 0;
+}
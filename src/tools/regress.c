@@ -0,0 +1,610 @@
+/*
+Regression and performance runner
+
+"nagi-regress [options] <manifest>" replays a recorded session of every
+game in the manifest headless (nagi --headless --replay) and checks the
+screen hash it ends on.  the games run as separate processes, one per
+core by default, so a crash in one doesn't take the rest down, and one
+that runs past -w seconds is killed and reported as a timeout.
+
+each line of the manifest is a game, blank lines and # are skipped:
+	<name> <game dir> <replay log> <screen hash>
+the hash is the 8 hex digits nagi prints at the end of the replay, or -
+to only time it.
+
+with -r the render benchmark is run over each game too, and with -l the
+llm benchmark with the game's WORDS.TOK and the replay log as the player
+input.  the llm ones run one at a time after the rest, they use every
+core on their own.
+
+cycles/s, the startup time, the render times and the llm p95 latencies
+go into one table.  -b compares them with an earlier run's -o csv and
+marks everything that moved more than -t percent.  the exit code is 1 if
+a game failed or timed out, its screen didn't match or anything got
+slower.
+
+	-j jobs		processes at once (default the number of cores)
+	-n path		the nagi to run (default ./nagi)
+	-r path		nagi-render-bench, not run without it
+	-l path		nagi-llm-bench, not run without it
+	-b file		the baseline csv to compare with
+	-o file		write this run's csv
+	-t percent	how much a number has to move to count (default 5)
+	-w seconds	how long one run may take (default 600)
+
+built with -DNAGI_BUILD_REGRESS=ON.
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "../agi.h"
+
+#define REGRESS_GAMES_MAX 256
+#define REGRESS_LINE 1024
+#define REGRESS_NAME 64
+#define REGRESS_READ 4096		// output read at a time
+#define REGRESS_POLL_MS 10		// wait between reads while a run is quiet
+
+enum
+{
+	STAT_CYCLES = 0,	// cycles/s
+	STAT_STARTUP,		// ms
+	STAT_PIC,			// ms to render every picture
+	STAT_CEL,			// ms to draw every cel
+	STAT_EXTRACT,		// llm p95 ms
+	STAT_MATCH,
+	STAT_GENERATE,
+	STAT_MAX
+};
+
+enum
+{
+	RESULT_OK = 0,
+	RESULT_MISMATCH,	// the screen hash changed
+	RESULT_FAILED,		// didn't run or didn't finish the replay
+	RESULT_TIMEOUT,		// killed after -w seconds
+	RESULT_MAX
+};
+
+struct regress_game_struct
+{
+	char name[REGRESS_NAME];
+	char dir[REGRESS_LINE];
+	char log[REGRESS_LINE];
+	int want_hash;		// 0 with - in the manifest
+	u32 hash;
+	u32 got_hash;
+	u32 render_sum;
+	int result;
+	int has[STAT_MAX];
+	double stat[STAT_MAX];
+
+	// the baseline's
+	int base;
+	int base_result;
+	u32 base_render_sum;
+	int base_has[STAT_MAX];
+	double base_stat[STAT_MAX];
+};
+typedef struct regress_game_struct REGRESS_GAME;
+
+static const char *stat_name[STAT_MAX] = {"cycles_s", "startup_ms", "pic_ms", "cel_ms",
+	"extract_p95", "match_p95", "generate_p95"};
+static const char *stat_title[STAT_MAX] = {"cycles/s", "startup", "pics", "cels",
+	"extract", "match", "generate"};
+static const char *result_name[RESULT_MAX] = {"ok", "mismatch", "failed", "timeout"};
+
+static REGRESS_GAME games[REGRESS_GAMES_MAX];
+static int game_count = 0;
+static SDL_AtomicInt game_next;
+
+static const char *nagi_path = "./nagi";
+static const char *render_path = 0;
+static const char *llm_path = 0;
+static double threshold = 5.0;
+static Uint64 timeout_ms = 600 * 1000;
+
+// everything the command wrote to stdout, 0 if it couldn't be run or was
+// killed for running past timeout_ms (timed_out set then)
+static char *regress_run(const char * const *args, int *code, int *timed_out)
+{
+	SDL_Process *proc;
+	SDL_IOStream *io;
+	Uint64 deadline;
+	char *out, *grown;
+	size_t len, size, got;
+
+	*code = -1;
+	*timed_out = 0;
+	proc = SDL_CreateProcess(args, true);
+	if (proc == 0)
+	{
+		printf("regress: can't run %s: %s\n", args[0], SDL_GetError());
+		return 0;
+	}
+	io = SDL_GetProcessOutput(proc);
+	deadline = SDL_GetTicks() + timeout_ms;
+
+	// the pipe doesn't block, so a hung run is noticed while it's quiet
+	out = 0;
+	len = size = 0;
+	while (io != 0)
+	{
+		if (len + REGRESS_READ + 1 > size)
+		{
+			grown = (char *)SDL_realloc(out, size + REGRESS_READ * 16);
+			if (grown == 0)
+				break;
+			out = grown;
+			size += REGRESS_READ * 16;
+		}
+		got = SDL_ReadIO(io, out + len, REGRESS_READ);
+		len += got;
+		if (got != 0)
+			continue;
+		if (SDL_GetIOStatus(io) != SDL_IO_STATUS_NOT_READY)
+			break;
+		if (SDL_GetTicks() >= deadline)
+		{
+			*timed_out = 1;
+			break;
+		}
+		SDL_Delay(REGRESS_POLL_MS);
+	}
+
+	// it may hold on after closing its output
+	while ( !*timed_out && !SDL_WaitProcess(proc, false, code) )
+	{
+		if (SDL_GetTicks() >= deadline)
+			*timed_out = 1;
+		else
+			SDL_Delay(REGRESS_POLL_MS);
+	}
+	if (*timed_out)
+	{
+		printf("regress: %s ran past %u s, killed\n", args[0], (unsigned)(timeout_ms / 1000));
+		SDL_KillProcess(proc, true);
+		SDL_WaitProcess(proc, true, code);
+		SDL_free(out);
+		out = 0;
+	}
+	else if (out != 0)
+		out[len] = 0;
+	SDL_DestroyProcess(proc);
+	return out;
+}
+
+static void regress_replay(REGRESS_GAME *g)
+{
+	const char *args[6];
+	char *out, *line;
+	double cycles, startup;
+	unsigned hash;
+	int code, timed_out;
+
+	args[0] = nagi_path;
+	args[1] = "--headless";
+	args[2] = "--replay";
+	args[3] = g->log;
+	args[4] = g->dir;
+	args[5] = 0;
+
+	g->result = RESULT_FAILED;
+	out = regress_run(args, &code, &timed_out);
+	if (timed_out)
+		g->result = RESULT_TIMEOUT;
+	if (out == 0)
+		return;
+	// the last line it prints
+	for (line = strstr(out, "Replay: "); line != 0; line = strstr(line + 1, "Replay: "))
+		if (sscanf(line, "Replay: %*u cycles in %*fs, %lf cycles/s, screen %8x, startup %lf ms",
+			&cycles, &hash, &startup) == 3)
+		{
+			g->stat[STAT_CYCLES] = cycles;
+			g->stat[STAT_STARTUP] = startup;
+			g->has[STAT_CYCLES] = g->has[STAT_STARTUP] = 1;
+			g->got_hash = hash;
+			g->result = ( g->want_hash && (g->got_hash != g->hash) ) ? RESULT_MISMATCH : RESULT_OK;
+		}
+	if (g->result == RESULT_FAILED)
+		printf("regress: %s didn't finish its replay (exit %d)\n", g->name, code);
+	SDL_free(out);
+}
+
+static void regress_render(REGRESS_GAME *g)
+{
+	const char *args[4];
+	char *out, *line;
+	unsigned sum;
+	int code, timed_out;
+
+	args[0] = render_path;
+	args[1] = g->dir;
+	args[2] = "1";
+	args[3] = 0;
+
+	out = regress_run(args, &code, &timed_out);
+	if (out == 0)
+		return;
+	for (line = out; line != 0; line = strchr(line, '\n'))
+	{
+		while (*line == '\n')
+			line++;
+		if (sscanf(line, "%*d pictures: %lf ms", &g->stat[STAT_PIC]) == 1)
+			g->has[STAT_PIC] = 1;
+		else if (sscanf(line, "%*d cels: %lf ms", &g->stat[STAT_CEL]) == 1)
+			g->has[STAT_CEL] = 1;
+		else if (sscanf(line, "checksum %8x", &sum) == 1)
+			g->render_sum = sum;
+	}
+	if (code != 0)
+		printf("regress: the render bench failed on %s (exit %d)\n", g->name, code);
+	SDL_free(out);
+}
+
+// the first run's p95 for each operation
+static void regress_llm(REGRESS_GAME *g)
+{
+	const char *args[6];
+	char words[REGRESS_LINE];
+	char op[16];
+	char *out, *line;
+	double p95;
+	FILE *f;
+	int code, timed_out, i;
+
+	snprintf(words, sizeof(words), "%s/WORDS.TOK", g->dir);
+	f = fopen(words, "rb");
+	if (f == 0)
+		snprintf(words, sizeof(words), "%s/words.tok", g->dir);
+	else
+		fclose(f);
+
+	args[0] = llm_path;
+	args[1] = "-d";
+	args[2] = words;
+	args[3] = "-t";
+	args[4] = g->log;
+	args[5] = 0;
+
+	out = regress_run(args, &code, &timed_out);
+	if (out == 0)
+		return;
+	for (line = out; line != 0; line = strchr(line, '\n'))
+	{
+		while (*line == '\n')
+			line++;
+		if (sscanf(line, " %15s %*d %*f %lf", op, &p95) != 2)
+			continue;
+		for (i = STAT_EXTRACT; i <= STAT_GENERATE; i++)
+			if ( (strcmp(op, stat_title[i]) == 0) && !g->has[i] )
+			{
+				g->stat[i] = p95;
+				g->has[i] = 1;
+			}
+	}
+	if (code != 0)
+		printf("regress: the llm bench failed on %s (exit %d)\n", g->name, code);
+	SDL_free(out);
+}
+
+static int regress_worker(void *data)
+{
+	REGRESS_GAME *g;
+	int i;
+
+	(void)data;
+	while ( (i = SDL_AddAtomicInt(&game_next, 1)) < game_count )
+	{
+		g = &games[i];
+		regress_replay(g);
+		if (render_path != 0)
+			regress_render(g);
+	}
+	return 0;
+}
+
+static char *regress_trim(char *s)
+{
+	char *end;
+
+	while ( (*s == ' ') || (*s == '\t') )
+		s++;
+	end = s + strlen(s);
+	while ( (end > s) && ((end[-1] == '\n') || (end[-1] == '\r') || (end[-1] == ' ') || (end[-1] == '\t')) )
+		*(--end) = 0;
+	return s;
+}
+
+static int regress_manifest(const char *path)
+{
+	char line[REGRESS_LINE * 3];
+	char hash[16];
+	REGRESS_GAME *g;
+	char *s;
+	FILE *f;
+	int num;
+
+	f = fopen(path, "r");
+	if (f == 0)
+	{
+		printf("regress: can't open %s\n", path);
+		return 0;
+	}
+	num = 0;
+	while (fgets(line, sizeof(line), f) != 0)
+	{
+		num++;
+		s = regress_trim(line);
+		if ( (*s == 0) || (*s == '#') )
+			continue;
+		if (game_count >= REGRESS_GAMES_MAX)
+		{
+			printf("regress: at most %d games\n", REGRESS_GAMES_MAX);
+			break;
+		}
+		g = &games[game_count];
+		memset(g, 0, sizeof(REGRESS_GAME));
+		if (sscanf(s, "%63s %1023s %1023s %15s", g->name, g->dir, g->log, hash) != 4)
+		{
+			printf("regress: %s:%d isn't <name> <game dir> <replay log> <screen hash>\n", path, num);
+			continue;
+		}
+		g->want_hash = (strcmp(hash, "-") != 0);
+		if (g->want_hash)
+			g->hash = (u32)strtoul(hash, 0, 16);
+		game_count++;
+	}
+	fclose(f);
+	return 1;
+}
+
+static REGRESS_GAME *regress_find(const char *name)
+{
+	int i;
+
+	for (i = 0; i < game_count; i++)
+		if (strcmp(games[i].name, name) == 0)
+			return &games[i];
+	return 0;
+}
+
+// name,result,screen,render,then each stat with - for none
+static void regress_baseline(const char *path)
+{
+	char line[REGRESS_LINE];
+	char *field[STAT_MAX + 4];
+	REGRESS_GAME *g;
+	char *s;
+	FILE *f;
+	int i, n;
+
+	f = fopen(path, "r");
+	if (f == 0)
+	{
+		printf("regress: can't open the baseline %s\n", path);
+		return;
+	}
+	while (fgets(line, sizeof(line), f) != 0)
+	{
+		s = regress_trim(line);
+		n = 0;
+		field[n++] = s;
+		while ( (n < STAT_MAX + 4) && ((s = strchr(s, ',')) != 0) )
+		{
+			*(s++) = 0;
+			field[n++] = s;
+		}
+		if ( (n != STAT_MAX + 4) || ((g = regress_find(field[0])) == 0) )
+			continue;	// the header, or a game that's gone
+
+		g->base = 1;
+		g->base_result = RESULT_FAILED;
+		for (i = 0; i < RESULT_MAX; i++)
+			if (strcmp(field[1], result_name[i]) == 0)
+				g->base_result = i;
+		g->base_render_sum = (u32)strtoul(field[3], 0, 16);
+		for (i = 0; i < STAT_MAX; i++)
+		{
+			g->base_has[i] = (strcmp(field[4 + i], "-") != 0);
+			g->base_stat[i] = g->base_has[i] ? atof(field[4 + i]) : 0.0;
+		}
+	}
+	fclose(f);
+}
+
+static void regress_csv(const char *path)
+{
+	REGRESS_GAME *g;
+	FILE *f;
+	int i, j;
+
+	f = fopen(path, "w");
+	if (f == 0)
+	{
+		printf("regress: can't write %s\n", path);
+		return;
+	}
+	fprintf(f, "name,result,screen,render");
+	for (i = 0; i < STAT_MAX; i++)
+		fprintf(f, ",%s", stat_name[i]);
+	fprintf(f, "\n");
+	for (j = 0; j < game_count; j++)
+	{
+		g = &games[j];
+		fprintf(f, "%s,%s,%08X,%08X", g->name, result_name[g->result], g->got_hash, g->render_sum);
+		for (i = 0; i < STAT_MAX; i++)
+		{
+			if (g->has[i])
+				fprintf(f, ",%.3f", g->stat[i]);
+			else
+				fprintf(f, ",-");
+		}
+		fprintf(f, "\n");
+	}
+	fclose(f);
+}
+
+// percent better than the baseline, cycles/s is the only one where more is better
+static double regress_change(int stat, double now, double base)
+{
+	if ( (now <= 0) || (base <= 0) )
+		return 0.0;
+	if (stat == STAT_CYCLES)
+		return (now / base - 1.0) * 100.0;
+	return (base / now - 1.0) * 100.0;
+}
+
+// the table, and 1 if anything failed or got slower
+static int regress_report(void)
+{
+	REGRESS_GAME *g;
+	double change, log_sum[STAT_MAX];
+	int log_count[STAT_MAX];
+	int i, j, bad, slower, faster;
+
+	printf("\n%-16s %-8s", "game", "result");
+	for (i = 0; i < STAT_MAX; i++)
+		printf(" %16s", stat_title[i]);
+	printf("\n");
+
+	bad = slower = faster = 0;
+	memset(log_sum, 0, sizeof(log_sum));
+	memset(log_count, 0, sizeof(log_count));
+	for (j = 0; j < game_count; j++)
+	{
+		g = &games[j];
+		printf("%-16s %-8s", g->name, result_name[g->result]);
+		if (g->result != RESULT_OK)
+			bad++;
+		for (i = 0; i < STAT_MAX; i++)
+		{
+			if (!g->has[i])
+			{
+				printf(" %16s", "-");
+				continue;
+			}
+			if ( !g->base || !g->base_has[i] )
+			{
+				printf(" %9.1f       ", g->stat[i]);
+				continue;
+			}
+			change = regress_change(i, g->stat[i], g->base_stat[i]);
+			printf(" %9.1f %+5.0f%%", g->stat[i], change);
+			if (change <= -threshold)
+				slower++;
+			else if (change >= threshold)
+				faster++;
+			if (change > -100.0)
+			{
+				log_sum[i] += log(1.0 + change / 100.0);
+				log_count[i]++;
+			}
+		}
+		printf("\n");
+
+		if (g->result == RESULT_MISMATCH)
+			printf("  screen %08X, expected %08X\n", g->got_hash, g->hash);
+		if ( g->base && (g->base_result == RESULT_OK) && (g->result >= RESULT_FAILED) )
+			printf("  passed in the baseline\n");
+		if ( g->base && (render_path != 0) && (g->base_render_sum != 0) &&
+			(g->render_sum != g->base_render_sum) )
+		{
+			printf("  render checksum %08X, was %08X\n", g->render_sum, g->base_render_sum);
+			bad++;
+		}
+	}
+
+	// the geometric mean of the change over every game that has the number
+	printf("\n%-25s", "overall");
+	for (i = 0; i < STAT_MAX; i++)
+	{
+		if (log_count[i] == 0)
+			printf(" %16s", "-");
+		else
+			printf(" %15.1f%%", (exp(log_sum[i] / log_count[i]) - 1.0) * 100.0);
+	}
+	printf("\n\n%d games, %d failed, %d numbers faster and %d slower by %.0f%% or more\n",
+		game_count, bad, faster, slower, threshold);
+	if ( (bad == 0) && (slower == 0) )
+		printf("%s\n", (faster != 0) ? "faster" : "no change");
+	else
+		printf("%s\n", (bad != 0) ? "FAILED" : "slower");
+
+	return (bad != 0) || (slower != 0);
+}
+
+int main(int argc, char *argv[])
+{
+	SDL_Thread *thread[64];
+	const char *manifest, *base_path, *csv;
+	int a, jobs, i, started;
+
+	manifest = base_path = csv = 0;
+	jobs = 0;
+	for (a = 1; a < argc; a++)
+	{
+		if ( (strcmp(argv[a], "-j") == 0) && (a + 1 < argc) )
+			jobs = atoi(argv[++a]);
+		else if ( (strcmp(argv[a], "-n") == 0) && (a + 1 < argc) )
+			nagi_path = argv[++a];
+		else if ( (strcmp(argv[a], "-r") == 0) && (a + 1 < argc) )
+			render_path = argv[++a];
+		else if ( (strcmp(argv[a], "-l") == 0) && (a + 1 < argc) )
+			llm_path = argv[++a];
+		else if ( (strcmp(argv[a], "-b") == 0) && (a + 1 < argc) )
+			base_path = argv[++a];
+		else if ( (strcmp(argv[a], "-o") == 0) && (a + 1 < argc) )
+			csv = argv[++a];
+		else if ( (strcmp(argv[a], "-t") == 0) && (a + 1 < argc) )
+			threshold = atof(argv[++a]);
+		else if ( (strcmp(argv[a], "-w") == 0) && (a + 1 < argc) )
+			timeout_ms = (Uint64)strtoul(argv[++a], 0, 10) * 1000;
+		else
+			manifest = argv[a];
+	}
+	if (manifest == 0)
+	{
+		printf("usage: %s [-j jobs] [-n nagi] [-r nagi-render-bench] [-l nagi-llm-bench]\n"
+			"\t[-b baseline.csv] [-o results.csv] [-t percent] [-w seconds] <manifest>\n", argv[0]);
+		return 1;
+	}
+	if ( !regress_manifest(manifest) || (game_count == 0) )
+		return 1;
+	if (base_path != 0)
+		regress_baseline(base_path);
+
+	if (jobs <= 0)
+		jobs = SDL_GetNumLogicalCPUCores();
+	if (jobs > (int)(sizeof(thread) / sizeof(thread[0])))
+		jobs = (int)(sizeof(thread) / sizeof(thread[0]));
+	if (jobs > game_count)
+		jobs = game_count;
+	printf("regress: %d games, %d at a time\n", game_count, jobs);
+	fflush(stdout);
+
+	SDL_SetAtomicInt(&game_next, 0);
+	started = 0;
+	for (i = 0; i < jobs; i++)
+	{
+		thread[started] = SDL_CreateThread(regress_worker, "nagi_regress", 0);
+		if (thread[started] != 0)
+			started++;
+	}
+	if (started == 0)
+		regress_worker(0);
+	for (i = 0; i < started; i++)
+		SDL_WaitThread(thread[i], NULL);
+
+	if (llm_path != 0)
+		for (i = 0; i < game_count; i++)
+			if (games[i].result < RESULT_FAILED)
+				regress_llm(&games[i]);
+
+	if (csv != 0)
+		regress_csv(csv);
+	return regress_report();
+}
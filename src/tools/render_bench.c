@@ -0,0 +1,359 @@
+/*
+Rendering benchmark
+
+"nagi-render-bench <game dir> [passes]" loads the game's DIR/VOL files,
+renders every picture with render_pic() into an offscreen picture buffer
+and draws every cel of every view with obj_blit() at a few priorities over
+a backdrop with control lines.  no window is opened.
+
+each resource's time, the pixels per second and a checksum of everything
+drawn are printed.  the checksum must not change when the renderers are
+made faster.
+
+built with -DNAGI_BUILD_RENDER_BENCH=ON.
+*/
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "../agi.h"
+
+#include "../base.h"
+#include "../log.h"
+#include "../res/res.h"
+#include "../picture/pic_render.h"
+#include "../view/obj_base.h"
+#include "../view/obj_blit.h"
+#include "../view/obj_picbuff.h"
+#include "../view/obj_update.h"
+#include "../view/view_base.h"
+#include "../ui/msg.h"
+#include "../ui/string.h"
+#include "../logic/logic_base.h"
+#include "../sys/agi_file.h"
+#include "../sys/drv_video.h"
+#include "../sys/gfx.h"
+#include "../sys/mem_budget.h"
+#include "../sys/mem_wrap.h"
+#include "../sys/memory.h"
+#include "../sys/script.h"
+#include "../sys/sys_dir.h"
+#include "../sys/vid_render.h"
+
+#include <setjmp.h>
+#include "../sys/error.h"
+
+#define BENCH_PIXELS (PICBUFF_WIDTH * PICBUFF_HEIGHT)
+
+static const u8 bench_priority[] = {4, 8, 12, 15};
+
+// the game's globals these files use.  nothing else of the game is linked
+AGI_STATE state;
+MSGSTATE msgstate;
+VIEW *objtable = 0;
+OBJ_HOT obj_hot = {0};
+u8 *gfx_picbuff = 0;
+RDRIVER *rend_drv = 0;
+CONF_BOOL c_game_compression = 0;
+CONF_INT c_game_dir_type = DIR_SEP;
+char c_game_file_id[ID_SIZE+1] = "";
+
+static VIEW bench_obj[1];
+static u16 bench_flags[1];
+static s16 bench_x[1], bench_y[1];
+static u8 bench_hot[6][1];
+static u8 *bench_backdrop = 0;
+static u32 bench_sum = 2166136261u;
+
+void agi_exit(void)
+{
+	exit(1);
+}
+
+void set_agi_error(u16 err_type, u16 err_data)
+{
+	printf("render bench: agi error %d (%d)\n", err_type, err_data);
+	exit(1);
+}
+
+u16 print_err_code(void)
+{
+	return 0;
+}
+
+void beep_speaker(void)
+{
+}
+
+// the resource cache isn't trimmed here, only the size of what it takes matters
+size_t mem_budget_limit(void)
+{
+	return 8u << 20;
+}
+
+int message_box(const char *var8)
+{
+	printf("%s\n", var8);
+	return 1;
+}
+
+void log_close(void)
+{
+}
+
+void obj_ctl_invalidate(void)
+{
+}
+
+void blists_erase(void)
+{
+}
+
+void blists_draw(void)
+{
+}
+
+void script_write(u16 var8, u16 vara)
+{
+	(void)var8;
+	(void)vara;
+}
+
+// views are drawn in their own colours, there's no render driver to dither for
+void render_view_dither(u8 *view_data)
+{
+	(void)view_data;
+}
+
+void logic_scan(LOGIC *log, void (*func)(u8 code, const u8 *param, void *arg), void *arg)
+{
+	(void)log;
+	(void)func;
+	(void)arg;
+}
+
+// fnv-1a over the buffer, folded into the running checksum
+static u32 bench_hash(const u8 *buff, u32 size)
+{
+	u32 h;
+
+	h = 2166136261u;
+	while (size-- != 0)
+		h = (h ^ *(buff++)) * 16777619u;
+	bench_sum = (bench_sum ^ h) * 16777619u;
+	return h;
+}
+
+static double bench_ms(u64 ticks)
+{
+	u64 freq;
+
+	freq = SDL_GetPerformanceFrequency();
+	return (double)ticks * 1000.0 / (double)freq;
+}
+
+// v2 games have logdir, v3 ones a <id>dir holding all four
+static int bench_detect(void)
+{
+	struct dir_list_struct *d;
+	const char *name;
+	size_t len;
+	int found;
+	FILE *f;
+
+	f = fopen_nocase("logdir");
+	if (f != 0)
+	{
+		fclose(f);
+		c_game_dir_type = DIR_SEP;
+		c_game_compression = 0;
+		return 1;
+	}
+
+	found = 0;
+	d = agi_open_cwd();
+	while ( (d != 0) && (!found) && ((name = agi_read_dir(d)) != 0) )
+	{
+		len = strlen(name);
+		if ( (len > 3) && (len - 3 <= ID_SIZE) && (strcasecmp(name + len - 3, "dir") == 0) )
+		{
+			memcpy(c_game_file_id, name, len - 3);
+			c_game_file_id[len - 3] = 0;
+			string_lower(c_game_file_id);
+			found = 1;
+		}
+	}
+	if (d != 0)
+		agi_close_dir(d);
+
+	c_game_dir_type = DIR_COMB;
+	c_game_compression = 1;
+	return found;
+}
+
+// priority bands down the screen like a picture's, with a control line
+// every 16 rows so cels take the slow path over them too
+static void bench_backdrop_new(void)
+{
+	int y;
+	u8 pri;
+
+	bench_backdrop = a_malloc(BENCH_PIXELS);
+	for (y = 0; y < PICBUFF_HEIGHT; y++)
+	{
+		pri = 4 + y / 16;
+		if (pri > 15)
+			pri = 15;
+		if ((y & 15) == 15)
+			pri = 2;
+		memset(bench_backdrop + y * PICBUFF_WIDTH, (pri << 4) | (y & 0x0F), PICBUFF_WIDTH);
+	}
+}
+
+static void bench_pics(int passes, u64 *ticks, u64 *pixels, int *count)
+{
+	u8 *data;
+	u64 start, t;
+	u16 num;
+	int i;
+
+	for (num = 0; num < dir_count(RES_TYPE_PIC); num++)
+	{
+		if (dir_picture_find(num) == 0)
+			continue;
+		data = vol_res_load(dir_picture(num), 0);
+		if (data == 0)
+			continue;
+
+		start = SDL_GetPerformanceCounter();
+		for (i = 0; i < passes; i++)
+			render_pic(data);
+		t = SDL_GetPerformanceCounter() - start;
+
+		printf("pic  %3d  %9.3f ms  %08X\n", num, bench_ms(t) / passes,
+			bench_hash(gfx_picbuff, BENCH_PIXELS));
+		*ticks += t;
+		*pixels += (u64)BENCH_PIXELS * passes;
+		(*count)++;
+		a_free(data);
+	}
+}
+
+// every cel of the view at each priority, spread over the screen
+static void bench_view(u16 num, int passes, u64 *ticks, u64 *pixels, int *count)
+{
+	VIEW *v;
+	u64 start, t;
+	u32 area, h;
+	u16 loop, cel;
+	int i, p, cels;
+
+	if (view_load(num, 0) == 0)
+		return;
+
+	v = &bench_obj[0];
+	memset(v, 0, sizeof(VIEW));
+	OBJ_FLAGS(v) = 0;
+	v->num = 1;
+	obj_view_set(v, num);
+
+	t = 0;
+	area = 0;
+	cels = 0;
+	h = 2166136261u;
+	for (loop = 0; loop < v->loop_total; loop++)
+	{
+		obj_loop_set(v, loop);
+		for (cel = 0; cel < v->cel_total; cel++)
+		{
+			obj_cel_set(v, cel);
+			for (p = 0; p < (int)sizeof(bench_priority); p++)
+			{
+				v->priority = bench_priority[p];
+				OBJ_X(v) = (cel * 7 + p * 31) % (PICBUFF_WIDTH + 1 - v->x_size);
+				OBJ_Y(v) = v->y_size - 1 + (loop * 13 + p * 41) % (PICBUFF_HEIGHT + 1 - v->y_size);
+
+				memcpy(gfx_picbuff, bench_backdrop, BENCH_PIXELS);
+				start = SDL_GetPerformanceCounter();
+				for (i = 0; i < passes; i++)
+					obj_blit(v);
+				t += SDL_GetPerformanceCounter() - start;
+
+				h = (h ^ bench_hash(gfx_picbuff, BENCH_PIXELS)) * 16777619u;
+				area += v->x_size * v->y_size;
+				cels++;
+			}
+		}
+	}
+
+	printf("view %3d  %9.3f ms  %08X  (%d cels)\n", num, bench_ms(t) / passes, h, cels);
+	*ticks += t;
+	*pixels += (u64)area * passes;
+	*count += cels;
+
+	// views come off the room heap
+	view_list_new_room();
+	room_clear();
+}
+
+int main(int argc, char *argv[])
+{
+	u64 pic_ticks, pic_pixels, view_ticks, view_pixels;
+	int passes, pics, cels;
+	u16 num;
+
+	if (argc < 2)
+	{
+		printf("usage: %s <game dir> [passes]\n", argv[0]);
+		return 1;
+	}
+	passes = (argc >= 3) ? atoi(argv[2]) : 10;
+	if (passes < 1)
+		passes = 1;
+
+	dir_preset_set(DIR_PRESET_GAME, argv[1]);
+	if ( (dir_preset_change(DIR_PRESET_GAME) != 0) || !bench_detect() )
+	{
+		printf("render bench: no AGI game in %s\n", argv[1]);
+		return 1;
+	}
+
+	dir_load();
+	view_list_init();
+	gfx_picbuff = a_malloc_aligned(BENCH_PIXELS, PICBUFF_ALIGN);
+	objtable = bench_obj;
+	obj_hot.flags = bench_flags;
+	obj_hot.x = bench_x;
+	obj_hot.y = bench_y;
+	obj_hot.step_time = bench_hot[0];
+	obj_hot.step_count = bench_hot[1];
+	obj_hot.step_size = bench_hot[2];
+	obj_hot.cycle_time = bench_hot[3];
+	obj_hot.cycle_count = bench_hot[4];
+	obj_hot.direction = bench_hot[5];
+	bench_backdrop_new();
+
+	pic_ticks = pic_pixels = 0;
+	pics = 0;
+	bench_pics(passes, &pic_ticks, &pic_pixels, &pics);
+
+	view_ticks = view_pixels = 0;
+	cels = 0;
+	for (num = 0; num < dir_count(RES_TYPE_VIEW); num++)
+		if (dir_find(RES_TYPE_VIEW, num) != 0)
+			bench_view(num, passes, &view_ticks, &view_pixels, &cels);
+
+	printf("\n%d pictures: %.3f ms, %.1f Mpixels/s\n", pics, bench_ms(pic_ticks) / passes,
+		pic_ticks ? (double)pic_pixels / bench_ms(pic_ticks) / 1000.0 : 0.0);
+	printf("%d cels: %.3f ms, %.1f Mpixels/s\n", cels, bench_ms(view_ticks) / passes,
+		view_ticks ? (double)view_pixels / bench_ms(view_ticks) / 1000.0 : 0.0);
+	printf("checksum %08X\n", bench_sum);
+
+	view_list_free();
+	a_free(bench_backdrop);
+	a_free_aligned(gfx_picbuff);
+	volumes_close();
+	dir_unload();
+	return 0;
+}
@@ -27,6 +27,7 @@ _TraceScroll                     cseg     00008FAD 00000023
 #include "sys/drv_video.h"
 #include "sys/gfx.h"
 #include "sys/vid_render.h"
+#include "sys/sdl_vid.h"
 #include "sys/chargen.h"
 #include "ui/events.h"
 #include "sys/endian.h"
@@ -223,6 +224,7 @@ static void trace_add(u16 op, FUNC *table, u8 *log_data, u16 table_offset, u16 r
 	}
 
 	ch_update();
+	vid_flush();
 	while (trace_state != 0)
 	{
 		temp4 = event_read();
@@ -52,16 +52,34 @@ CmdCloseDialogu                  cseg     0000394B 00000012
 #include "../ui/mouse.h"
 
 #include "../sys/chargen.h"
+#include "../sys/replay.h"
+
+#ifdef NAGI_ENABLE_LLM
+#include "../llm_global.h"
+#include "../sound/voice.h"
+#endif
 
 
 static void input_put_char(u16 key_char);
 static void input_echo(void);
+static u16 input_max(void);
+static u16 input_width(void);
+static void input_draw(void);
+static u16 input_cursor_hide(void);
+static u16 input_cursor_show(void);
 
 
 static u16 input_edit_disabled = 0;
-static char input[42];
-char input_prev[42];  // used for logging
-static u16 input_cur = 0;
+static char input[INPUT_SIZE];
+char input_prev[INPUT_SIZE];  // used for logging
+static u16 input_cur = 0;	// bytes in input
+static u16 input_len = 0;	// characters in input
+static u16 input_col = 0;	// column after the prompt
+static u16 input_view = 0;	// first character on screen, once the line scrolls
+#ifdef NAGI_ENABLE_LLM
+static u64 input_typed_ms = 0;	// last change to the line
+static u16 input_spec_due = 0;	// the line changed since it was last extracted
+#endif
 
 
 
@@ -70,6 +88,10 @@ void input_poll(void)
 {
 	AGI_EVENT *si;
 	
+#ifdef NAGI_ENABLE_LLM
+	// a spoken command comes in as keys, read below
+	voice_poll();
+#endif
 	if (get_menu_requires_input_events())
 		menu_input();
 	si = control_key_map(event_read());
@@ -85,7 +107,7 @@ void input_poll(void)
 					input_put_char(si->data);
 				break;
 			case 2:	// direction
-				if (si->data == objtable->direction)
+				if (si->data == OBJ_DIRECTION(objtable))
 					state.var[V06_DIRECTION] = 0;
 				else
 					state.var[V06_DIRECTION] = si->data;
@@ -103,10 +125,25 @@ void input_poll(void)
 		}
 		si = control_key_map(  event_read()  );
 	}
+
+#ifdef NAGI_ENABLE_LLM
+	// the player paused, start on the extraction before enter
+	if ( (input_spec_due != 0) && (SDL_GetTicks() - input_typed_ms >= INPUT_SPEC_MS) )
+	{
+		input_spec_due = 0;
+		parse_speculate(input);
+	}
+#endif
 }
 
-// add to input string?
-static void input_put_char(u16 key_char)
+// the line the player is typing, before enter
+const char *input_line()
+{
+	return input;
+}
+
+// characters the line can hold
+static u16 input_max()
 {
 	u16 max;
 	
@@ -118,18 +155,72 @@ static void input_put_char(u16 key_char)
 		max--;
 	if ( state.var[V24_INPUTLEN] < max)
 		max = state.var[V24_INPUTLEN];
+#ifdef NAGI_ENABLE_LLM
+	// sentences for the model are longer than the screen, the line scrolls
+	if (g_llm != 0)
+		max = INPUT_LLM_CHARS;
+#endif
+	return max;
+}
+
+// characters shown after the prompt
+static u16 input_width()
+{
+	u16 width;
+
+	width = 39 - input_col;
+	if ( (state.cursor != 0) && (width != 0) )
+		width--;
+	return width;
+}
+
+// the visible part of the line, from the prompt on
+static void input_draw()
+{
+	const char *s;
+	u16 n;
+
+	s = input;
+	for (n = input_view; (n != 0) && (*s != 0); n--)
+		do
+			s++;
+		while ( (*s & 0xC0) == 0x80 );
+
+	goto_row_col(state.input_pos, input_col);
+	agi_printf("%s", s);
+}
+
+// add to input string?
+static void input_put_char(u16 key_char)
+{
+	u16 max;
+	u16 drawn;
+#ifdef NAGI_ENABLE_LLM
+	u16 cur_orig = input_cur;
+#endif
 	
-	input_edit_on();
+	max = input_max();
+	drawn = input_cursor_hide();
 
 	switch (key_char)
 	{
 		case 8:
 			if ( input_cur != 0) 
 			{
-				input_cur --;
+				do
+					input_cur --;
+				while ( (input_cur != 0) && ((input[input_cur] & 0xC0) == 0x80) );
 				input[input_cur] = 0;
-				window_put_char(key_char);
-				ch_update();
+				input_len --;
+				if (input_view != 0)
+				{
+					// the hidden start of the line comes back
+					input_view--;
+					input_draw();
+				}
+				else
+					window_put_char(key_char);
+				drawn = 1;
 			}
 			break;
 			
@@ -140,15 +231,18 @@ static void input_put_char(u16 key_char)
 			if ( input_cur != 0) 
 			{
 				strcpy(input_prev, input);
+				replay_line(input);
 				parse(input);
 				input_cur = 0;
+				input_len = 0;
+				input_view = 0;
 				input[0] = 0;
 				input_redraw();
 			}
 			break;
 			
 		default:
-			if (key_char != 0 && key_char < 0x10000 && max > input_cur)
+			if (key_char != 0 && key_char < 0x10000 && max > input_len + 1)
 			{
 				char utf8[5];
 				int len = 0;
@@ -164,24 +258,52 @@ static void input_put_char(u16 key_char)
 				}
 				utf8[len] = 0;
 				
-				if (input_cur + len < max)
+				if (input_cur + len < INPUT_SIZE)
 				{
 					for (int i = 0; i < len; i++)
 						input[input_cur++] = utf8[i];
 					input[input_cur] = 0;
-					window_put_char(key_char);
-					ch_update();
+					input_len ++;
+					if (input_len - input_view > input_width())
+					{
+						// only the end of the line fits, shift it along
+						input_view = input_len - input_width();
+						input_draw();
+					}
+					else
+						window_put_char(key_char);
+					drawn = 1;
 				}
 			}
 	}
 
-	input_edit_off();
+#ifdef NAGI_ENABLE_LLM
+	if ( (key_char != 13) && (input_cur != cur_orig) )
+	{
+		input_typed_ms = SDL_GetTicks();
+		input_spec_due = 1;
+	}
+#endif
+
+	// the whole keystroke goes out in one update
+	if ( (input_cursor_show() != 0) || (drawn != 0) )
+		ch_update();
 }
 
 u8 *cmd_cancel_line(u8 *c)
 {
-	while (input_cur != 0)
-		input_put_char(0x08);
+	if (input_cur != 0)
+	{
+		input_cursor_hide();
+		window_clear(state.input_pos, input_col, state.input_pos, input_col + input_len - input_view, state.text_bg);
+		goto_row_col(state.input_pos, input_col);
+		input_cur = 0;
+		input_len = 0;
+		input_view = 0;
+		input[0] = 0;
+		input_cursor_show();
+		ch_update();
+	}
 	return c;
 }
 
@@ -194,25 +316,27 @@ u8 *cmd_echo_line(u8 *c)
 
 static void input_echo()
 {
+	const char *s;
+
 	if ( input_cur < strlen(input_prev)) 
 	{
-		input_edit_on();
-		input[input_cur] = input_prev[input_cur];
-		
-		while (input[input_cur] != 0)
-		{
-			window_put_char(input[input_cur]);
-			input_cur ++;
-			input[input_cur] = input_prev[input_cur];
-		}
+		input_cursor_hide();
+		strcpy(input + input_cur, input_prev + input_cur);
+		input_cur = strlen(input);
+		input_len = 0;
+		for (s = input; *s != 0; s++)
+			if ( (*s & 0xC0) != 0x80 )
+				input_len++;
+		if (input_len > input_width())
+			input_view = input_len - input_width();
+		input_draw();
+		input_cursor_show();
 		ch_update();
-
-		input[input_cur] = 0;
-		input_edit_off();
 	}
 }
 
-void input_edit_off()
+// 1 if the cursor was drawn
+static u16 input_cursor_show()
 {
 	if (input_edit_disabled == 0) 
 	{
@@ -220,12 +344,14 @@ void input_edit_off()
 		if ( state.cursor != 0) 
 		{
 			window_put_char(state.cursor);
-			ch_update();
+			return 1;
 		}
 	}
+	return 0;
 }
 
-void input_edit_on()
+// 1 if the cursor was cleared
+static u16 input_cursor_hide()
 {
 	if (input_edit_disabled == 1)
 	{
@@ -233,9 +359,22 @@ void input_edit_on()
 		if ( state.cursor != 0) 
 		{
 			window_put_char(0x8);
-			ch_update();
+			return 1;
 		}
 	}
+	return 0;
+}
+
+void input_edit_off()
+{
+	if (input_cursor_show() != 0)
+		ch_update();
+}
+
+void input_edit_on()
+{
+	if (input_cursor_hide() != 0)
+		ch_update();
 }
 
 u16 input_edit_status()
@@ -271,15 +410,21 @@ u8 *cmd_set_cursor_char(u8 *c)
 void input_redraw()
 {
 	char msg[400];
+	TPOS pos;
 	
 	if (state.input_state != 0)
 	{
-		input_edit_on();
+		input_cursor_hide();
 		window_line_clear(state.input_pos, state.text_bg);
 		goto_row_col(state.input_pos, 0);
 		agi_printf(str_wordwrap(msg, state.string[0], 40) );
-		agi_printf(input);
-		input_edit_off();
+		ch_pos_get(&pos);
+		input_col = pos.col;
+		input_view = 0;
+		if (input_len > input_width())
+			input_view = input_len - input_width();
+		input_draw();
+		input_cursor_show();
 		ch_update();
 	}
 }
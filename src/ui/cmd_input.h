@@ -1,6 +1,17 @@
 #ifndef NAGI_UI_CMD_INPUT_H
 #define NAGI_UI_CMD_INPUT_H
 
+// bytes of the typed line, utf-8
+#ifdef NAGI_ENABLE_LLM
+#define INPUT_SIZE 256
+// characters typed for the model, the line scrolls past the screen
+#define INPUT_LLM_CHARS 80
+// ms without typing before the line is extracted in the background
+#define INPUT_SPEC_MS 300
+#else
+#define INPUT_SIZE 42
+#endif
+
 extern u8 *cmd_cancel_line(u8 *c);
 extern u8 *cmd_echo_line(u8 *c);
 extern u8 *cmd_prevent_input(u8 *c);
@@ -16,8 +27,9 @@ extern void input_edit_on(void);
 extern u16 input_edit_status(void);
 
 extern void input_redraw(void);
+extern const char *input_line(void);
 
 
-extern char input_prev[42];
+extern char input_prev[INPUT_SIZE];
 
 #endif /* NAGI_UI_CMD_INPUT_H */
@@ -6,9 +6,16 @@
 #include "../base.h"
 #include "events.h"
 
+#include "../sys/delay.h"
 #include "../sys/mem_wrap.h"
 #include "../sys/sdl_vid.h"
 #include "../trace.h"
+#include "../sys/hud.h"
+#include "../sys/metrics.h"
+#include "../sys/profile.h"
+#include "../sys/replay.h"
+#include "../sys/trace_ring.h"
+#include "../state_rewind.h"
 
 #include "../lib/utf8_decode.h"
 
@@ -17,6 +24,7 @@ static u16 dir_keymap(SDL_Keycode keycode);
 
 
 static AGI_EVENT passed_agi_event;
+static SDL_AtomicInt wake_pending;
 static AGI_EVENT stop_ego = {
 	.type = 2,
 	.data = 0,
@@ -247,7 +255,7 @@ static AGI_EVENT *event_key_down(SDL_Keycode keycode, SDL_Keymod mod)
 
 static AGI_EVENT *event_text_input(const char *text)
 {
-	utf8_decode_init((char *)text, strlen(text));
+	utf8_decode_init(text, strlen(text));
 	for(;;) {
 		int ch = utf8_decode_next();
 		if (ch == UTF8_END) { break; }
@@ -269,6 +277,10 @@ u16 event_write(u16 type, u16 data)
 	SDL_Event event;
 	AGI_EVENT *new_event;
 
+	// it's in the replay log when it's read
+	if (replay_mode == REPLAY_PLAY)
+		return 1;
+
 	event.type = SDL_EVENT_USER;
 
 	new_event = (AGI_EVENT *)a_malloc(sizeof(AGI_EVENT));
@@ -280,11 +292,32 @@ u16 event_write(u16 type, u16 data)
 	return SDL_PushEvent(&event) == 1;
 }
 
+// safe from any thread.  something a wait could be sleeping through has
+// happened (llm text came in) so event_idle() returns.  only one is ever
+// queued, it's an SDL_EVENT_USER with no agi event attached
+void event_wake(void)
+{
+	SDL_Event event;
+
+	if (!SDL_CompareAndSwapAtomicInt(&wake_pending, 0, 1))
+		return;
+	memset(&event, 0, sizeof(event));
+	event.type = SDL_EVENT_USER;
+	event.user.data1 = 0;
+	if (!SDL_PushEvent(&event))
+		SDL_SetAtomicInt(&wake_pending, 0);
+}
+
 static AGI_EVENT *user_event_decode(void *data)
 {
 	AGI_EVENT *old_event;
 	AGI_EVENT *agi_event = &passed_agi_event;
 
+	if (data == 0)
+	{
+		SDL_SetAtomicInt(&wake_pending, 0);
+		return 0;
+	}
 	old_event = (AGI_EVENT *)data;
 	agi_event->type = old_event->type;
 	agi_event->data = old_event->data;
@@ -329,6 +362,10 @@ AGI_EVENT *event_read(void)
 
 	agi_event = 0;
 	c = 0;
+	metrics_poll();
+
+	if (replay_mode == REPLAY_PLAY)
+		return replay_read();
 
 	while (SDL_PollEvent(&event) != 0)
 	{
@@ -339,6 +376,33 @@ AGI_EVENT *event_read(void)
 				break;
 
 			case SDL_EVENT_KEY_DOWN:
+				if ( (event.key.key == SDLK_F12) && ((event.key.mod & SDL_KMOD_SHIFT) != 0) )
+				{
+					hud_toggle();
+					break;
+				}
+				if ( (event.key.key == SDLK_F12) && ((event.key.mod & SDL_KMOD_CTRL) != 0) )
+				{
+					trace_ring_dump("ctrl+f12");
+					break;
+				}
+#ifdef NAGI_PROFILE
+				if (event.key.key == SDLK_F12)
+				{
+					profile_dump();
+					break;
+				}
+#endif
+				if ( (event.key.key == SDLK_F11) && ((event.key.mod & SDL_KMOD_SHIFT) != 0) )
+				{
+					delay_turbo_set(!delay_turbo);
+					break;
+				}
+				if (event.key.key == SDLK_F11)
+				{
+					state_rewind_request();
+					break;
+				}
 				agi_event = event_key_down(event.key.key, event.key.mod);
 				break;
 
@@ -362,6 +426,13 @@ AGI_EVENT *event_read(void)
 				vid_notify_window_size_changed(event.window.windowID);
 				break;
 
+			// the window or the texture lost what was shown
+			case SDL_EVENT_WINDOW_EXPOSED:
+			case SDL_EVENT_RENDER_TARGETS_RESET:
+			case SDL_EVENT_RENDER_DEVICE_RESET:
+				vid_refresh();
+				break;
+
 			case SDL_EVENT_WINDOW_CLOSE_REQUESTED:
 				window = vid_get_main_window();
 				if(SDL_GetWindowID(window) == event.window.windowID){
@@ -376,6 +447,8 @@ AGI_EVENT *event_read(void)
 		if (agi_event != 0) { break; }
 	}
 
+	if (replay_mode == REPLAY_RECORD)
+		replay_write(agi_event);
 	return agi_event;
 }
 
@@ -390,6 +463,8 @@ void events_clear(void)
 
 	while ( (x=SDL_PollEvent(&event)) != 0)
 	{
+		if ( (event.type == SDL_EVENT_USER) && (event.user.data1 == 0) )
+			SDL_SetAtomicInt(&wake_pending, 0);
 		if ( x == 1 )
 			one_count++;
 		if (one_count > 10)
@@ -479,7 +554,7 @@ u16 char_wait(void)
 	{
 		si = char_poll();
 		if  (  (si == 0) || (si == 0xFFFF)  )
-			SDL_Delay(10);
+			event_idle(EVENT_IDLE_MS);
 	} while (  si == 0 || (si == 0xFFFF)  );
 	return si;
 }
@@ -509,7 +584,7 @@ u16 user_bolean_poll(void)
 	events_clear();
 
 	while (  (di=has_user_reply()) == 0xFFFF  )
-		SDL_Delay(10);
+		event_idle(EVENT_IDLE_MS);
 
 	return di;
 }
@@ -527,6 +602,32 @@ u8 *cmd_unknown_181(u8 *c)
 	return c;
 }
 
+// no sleeping in fixed steps: input, or event_wake(), ends the wait as soon
+// as it arrives
+void event_idle(u32 ms)
+{
+	Uint64 frame, now;
+
+	if (replay_mode == REPLAY_PLAY)
+	{
+		replay_idle(ms);
+		return;
+	}
+	if (delay_turbo)
+	{
+		delay_turbo_idle(ms);
+		return;
+	}
+	vid_flush();
+
+	// an animating screen wants the next display frame presented
+	frame = vid_frame_due();
+	now = SDL_GetTicksNS();
+	if ( (frame != 0) && (frame < now + (Uint64)ms * 1000000ull) )
+		ms = (frame > now) ? (u32)((frame - now + 999999) / 1000000) : 0;
+	SDL_WaitEventTimeout(0, (Sint32)ms);
+}
+
 // event_wait.. waits for an event to happen.. if none.. it forces the joystick
 // to make a direction update
 AGI_EVENT *event_wait(void)
@@ -537,7 +638,7 @@ AGI_EVENT *event_wait(void)
 	{
 		si = event_read();
 		if ( si == 0)
-			SDL_Delay(10);
+			event_idle(EVENT_IDLE_MS);
 	} while (  si == 0  );
 	return si;
 }
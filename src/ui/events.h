@@ -41,6 +41,11 @@ extern u16 user_bolean_poll(void);
 
 extern void joy_button_map(AGI_EVENT *agi_event);
 extern AGI_EVENT *event_wait(void);
+// show the screen and sleep until input comes in, or ms pass.  whatever
+// else a wait needs wakes it with event_wake()
+#define EVENT_IDLE_MS 1000
+extern void event_idle(u32 ms);
+extern void event_wake(void);
 
 extern u16 event_write(u16 type, u16 data);
 
@@ -74,6 +74,8 @@ static void menu_name_invert(MENU *m);
 static void menu_item_name(MENU_ITEM *mi);
 static void menu_name(MENU *m);
 static void menu_calc_size(MENU *var8);
+static MENU *menu_select(MENU *m, MENU_ITEM *mi, MENU *m_new);
+static MENU_ITEM *menu_item_select(MENU_ITEM *mi, MENU_ITEM *mi_new);
 
 
 static int menu_next_input = 0;
@@ -339,63 +341,51 @@ menu_loop:
 			switch (temp2->data)
 			{
 				case 1:	// up
-					menu_item_name(di);
-					di = di->prev;
-					menu_item_name_invert(di);
+					di = menu_item_select(di, di->prev);
 					break;
 				
 				case 2:	// pgup // top of menu
-					menu_item_name(di);
-					di = si->head;
-					menu_item_name_invert(di);
+					di = menu_item_select(di, si->head);
 					break;
 				
 				case 3:	// right
-					menu_clear(si, di);
+					siTemp = si;
 					do
 					{
-						si = si->next;
+						siTemp = siTemp->next;
 					}
-					while (si->status == 0);
+					while (siTemp->status == 0);
+					si = menu_select(si, di, siTemp);
 					di = si->cur;
-					menu_draw(si);
 					break;
 					
 				case 4:	// pgdn // bottom of menu
-					menu_item_name(di);
-					di = (si->head)->prev;
-					menu_item_name_invert(di);
+					di = menu_item_select(di, (si->head)->prev);
 					break;
 				
 				case 5:	// down
-					menu_item_name(di);
-					di = di->next;
-					menu_item_name_invert(di);
+					di = menu_item_select(di, di->next);
 					break;
 				
 				case 6:	// home - last  menu
-					menu_clear(si, di);
-					si = menu_head->prev;
+					si = menu_select(si, di, menu_head->prev);
 					di = si->cur;
-					menu_draw(si);
 					break;
 				
 				case 7:	// left
-					menu_clear(si, di);
+					siTemp = si;
 					do
 					{
-						si = si->prev;
+						siTemp = siTemp->prev;
 					}
-					while (si->status == 0);
+					while (siTemp->status == 0);
+					si = menu_select(si, di, siTemp);
 					di = si->cur;
-					menu_draw(si);
 					break;
 				
 				case 8:	// end - last menu	
-					menu_clear(si, di);
-					si = menu_head;
+					si = menu_select(si, di, menu_head);
 					di = si->cur;
-					menu_draw(si);
 					break;
 				
 				default:	// NONE?
@@ -410,8 +400,7 @@ menu_loop:
 				//printf( "%s %d %d %d\n", siTemp->name, hitMenu, hitMenuNext, temp2->x );
 				if( temp2->x >= hitMenu &&
 					temp2->x < hitMenuNext && temp2->y < font_size.w ) {
-					menu_clear(si, di);
-					si = siTemp;
+					si = menu_select(si, di, siTemp);
 					di = si->cur;
 					break;
 				}
@@ -422,9 +411,7 @@ menu_loop:
 					break;
 				}
 			}
-			if( hitMenu != 0 ) {
-				menu_draw(si);
-			} else {
+			if( hitMenu == 0 ) {
 				menu_calc_size(si);
 				//printf( "%d %d %d\n", temp2->x, menu_pos_x << 2, ( menu_pos_x + menu_size_width ) << 2 );
 				if( temp2->x >= menu_pos_x << 2 &&
@@ -497,6 +484,29 @@ static void menu_draw(MENU *m)
 }
 
 
+// move to another menu, nothing's redrawn if it's the one already open
+static MENU *menu_select(MENU *m, MENU_ITEM *mi, MENU *m_new)
+{
+	m->cur = mi;
+	if (m_new != m)
+	{
+		menu_clear(m, mi);
+		menu_draw(m_new);
+	}
+	return m_new;
+}
+
+// move the highlight, only the two items that change are redrawn
+static MENU_ITEM *menu_item_select(MENU_ITEM *mi, MENU_ITEM *mi_new)
+{
+	if (mi_new != mi)
+	{
+		menu_item_name(mi);
+		menu_item_name_invert(mi_new);
+	}
+	return mi_new;
+}
+
 static void menu_clear(MENU *m, MENU_ITEM *mi)
 {
 	m->cur = mi;
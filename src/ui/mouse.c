@@ -47,6 +47,7 @@ set areas on the screen
 #include "../sys/vid_render.h"
 #include "../view/obj_motion.h"
 #include "../sys/chargen.h"
+#include "../sys/replay.h"
 
 /* PROTOTYPES	---	---	---	---	---	---	--- */
 //void test_function(void);
@@ -200,7 +201,7 @@ static u8 *cmd_brian_poll_mouse(u8 *c)
 		// if a button press isn't on stack then it's just a polled position
 		// get button state when polling as well.. for held down buttons
 		get_butt = SDL_GetMouseState(&get_x, &get_y);
-		
+		replay_mouse(&get_butt, &get_x, &get_y);
 	}
 
 	state.var[27] = get_butt;
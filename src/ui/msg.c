@@ -16,6 +16,8 @@ _StrToIntPtr                     cseg     00002316 00000038
 _DispNewLine                     cseg     0000234E 0000001F
 */
 
+#define MEM_TAG MEM_TEXT
+
 #include <string.h>
 
 #include "../agi.h"
@@ -46,21 +48,64 @@ _DispNewLine                     cseg     0000234E 0000001F
 #include "../sys/delay.h"
 #include <setjmp.h>
 #include "../sys/error.h"
+#include "msg_pretrans.h"
+#include "../sys/mem_wrap.h"
+#include "../lib/utf8_decode.h"
 
 #ifdef NAGI_ENABLE_LLM
 #include "../llm_global.h"
+#include "../sound/speech.h"
 #endif
 
 static u8 *print_at(u16 msg_num, u8 *c);
 static char *r_display1f93(const char *given_source, char *given_msg);
 static const char *str_to_int_ptr(const char *s, u16 *num);
 static void display_new_line(void);
+static void msg_box_layout(const char *str, u16 row, u16 w, u16 toggle);
+static u16 msg_box_width(u16 w);
+static char *msg_wrap(char *msg, const char *str, u16 w);
+static u16 msg_char_len(const char *s);
+static u16 msg_reply_poll(void);
 
 //u16 word_dseg_D09 = 20;	// row related ..   the MAX WIDTH???
 #define HEIGHT_MAX 20
 // size of a line in vertical pixels
 //this is related to the pic buff size.. not the screen
 #define LINE_SIZE 8
+#ifdef NAGI_ENABLE_LLM
+// translation request for the message box currently displayed
+static nagi_llm_request_t *msg_llm_request = 0;
+static u16 msg_llm_row = 0;
+static u16 msg_llm_w = 0;
+static u16 msg_llm_toggle = 0;
+static u16 msg_llm_wanted_width = 0xFFFF;
+static TPOS msg_llm_wanted_pos = {0xFFFF, 0xFFFF};
+static int msg_llm_drawn = 0;	// length of the streamed text on screen
+static char msg_box_shown[MSG_WRAP_SIZE];	// wrapped text of the box that's up
+
+static void msg_llm_redraw(const char *text);
+static u16 msg_box_extend(const char *str, u16 row, u16 w, u16 toggle);
+#endif
+
+// wrapped text of recent message boxes, for strings with no % codes (nothing
+// in them changes between showings).  translated text is wrapped again every
+// time it's shown otherwise
+#define MSG_LAYOUT_MAX 8
+
+struct msg_layout_struct
+{
+	u32 hash;		// of the string
+	u16 w;
+	char newline_char;
+	AGISIZE tsize;
+	char *str;		// 0 if free
+	char *msg;
+	u32 used;
+};
+typedef struct msg_layout_struct MSG_LAYOUT;
+
+static MSG_LAYOUT msg_layout[MSG_LAYOUT_MAX];
+static u32 msg_layout_stamp = 0;
 
 MSGSTATE msgstate = { 0xFFFF, {0xFFFF, 0xFFFF},
 				0, '\\', 0, 
@@ -124,7 +169,7 @@ u8 *cmd_close_window(u8 *c)
 u8 *cmd_display(u8 *c)
 {
 	u16 row, col;
-	char msg[1000];
+	char msg[MSG_WRAP_SIZE];
 	push_row_col();
 	row = *(c++);
 	col = *(c++);
@@ -137,7 +182,7 @@ u8 *cmd_display(u8 *c)
 u8 *cmd_display_v(u8 *c)
 {
 	u16 row, col;
-	char msg[1000];
+	char msg[MSG_WRAP_SIZE];
 
 	push_row_col();
 	row = state.var[*(c++)];
@@ -150,7 +195,7 @@ u8 *cmd_display_v(u8 *c)
 
 int message_box(const char *var8)
 {
-	u32 temp;
+	u32 temp, now;
 	int ret;
 
 	message_box_draw(var8, 0, 0, 0);
@@ -164,24 +209,45 @@ int message_box(const char *var8)
 	{
 		if ( state.var[V21_WINDOWTIMER] == 0)
 		{
-			ret = (user_bolean_poll() == 1);
+			ret = (msg_reply_poll() == 1);
 			// 1==enter 0==esc
 		}
 		else
 		{
+			// streaming text wakes the wait (event_wake), the timer is slept out
 			temp = calc_agi_tick() + state.var[V21_WINDOWTIMER] * 10;
-			while (  (calc_agi_tick() < temp) && (has_user_reply() == 0xFFFF) )
-				SDL_Delay(50);
+			while (  ((now = calc_agi_tick()) < temp) && (has_user_reply() == 0xFFFF) )
+			{
+				message_box_llm_poll();
+				event_idle((temp - now) * 50);
+			}
 			ret = 1;
 			state.var[V21_WINDOWTIMER] = 0;
 		}
 
+		message_box_llm_cancel();
 		cmd_close_window(0);
 
 		return ret;
 	}
 }
 
+// same as user_bolean_poll() but keeps the box translation going
+static u16 msg_reply_poll(void)
+{
+	u16 di;
+
+	events_clear();
+
+	while (  (di=has_user_reply()) == 0xFFFF  )
+	{
+		message_box_llm_poll();
+		event_idle(EVENT_IDLE_MS);
+	}
+
+	return di;
+}
+
 #define PARTIAL_STR_LEN 20
 
 // var8 is the string
@@ -190,35 +256,269 @@ int message_box(const char *var8)
 // vare is a toggle... if == 1 then force width and height
 void message_box_draw(const char *str, u16 row, u16 w, u16 toggle)
 {
+	const char *baked;
+#ifdef NAGI_ENABLE_LLM
+	char user_input[LLM_MAX_ENTRY_SIZE];
+
+	message_box_llm_cancel();
+	speech_stop();
+#endif
+
+	// scripted messages baked by --pretranslate don't need the llm
+	baked = pretrans_lookup(str);
+	if (baked != 0)
+	{
 #ifdef NAGI_ENABLE_LLM
-	// in message box, we translate previously the message using LLM since there are some size calculations to adapt the box to the text
-	static char translated_msg[600] = {0};
-
-	if (nagi_llm_ready(g_llm) && str && strlen(str) > 0) {
-		const char *user_input = llm_context_get_last_player_input();
-		printf("[DEBUG msg.c] Last player input: '%s'\n", user_input ? user_input : "(null)");
-		printf("[DEBUG msg.c] Game response to translate: '%s'\n", str);
-
-		/* Clear buffer before use to avoid stale data */
-		translated_msg[0] = '\0';
-
-		int len = nagi_llm_generate_response(g_llm, str, user_input ? user_input : "",
-		                                      translated_msg, sizeof(translated_msg));
-		if (len > 0 && translated_msg[0] != '\0') {
-			/* Store the translated message in context for language continuity */
-			llm_context_on_print(translated_msg);
-			str = translated_msg;
-
-			/* Clear the player input after using it, so automatic events get empty user_input */
-			if (user_input && user_input[0] != '\0') {
-				llm_context_clear_last_player_input();
+		llm_context_on_print(g_llm_session, baked);
+		llm_context_clear_last_player_input(g_llm_session);
+		speech_text(baked, (int)strlen(baked), 1);
+#endif
+		msg_box_layout(baked, row, w, toggle);
+		return;
+	}
+
+#ifdef NAGI_ENABLE_LLM
+	// an english player reads the game's own words, nothing to generate
+	if (nagi_llm_ready(g_llm) && !nagi_llm_wants_response(g_llm) && (str != 0))
+	{
+		llm_context_on_print(g_llm_session, str);
+		llm_context_clear_last_player_input(g_llm_session);
+		speech_text(str, (int)strlen(str), 1);
+	}
+	// the translation is generated on the llm worker thread.  the box shows
+	// the original text until message_box_llm_poll() re-lays it out with
+	// the streamed text.
+	else if (nagi_llm_ready(g_llm) && (str != 0) && (str[0] != 0))
+	{
+		llm_context_get_last_player_input(g_llm_session, user_input, sizeof(user_input));
+		msg_llm_request = nagi_llm_generate_response_async(g_llm, str, user_input);
+
+		if (msg_llm_request != 0)
+		{
+			msg_llm_drawn = 0;
+			msg_llm_row = row;
+			msg_llm_w = w;
+			msg_llm_toggle = toggle;
+			msg_llm_wanted_width = msgstate.wanted_width;
+			msg_llm_wanted_pos = msgstate.wanted_pos;
+
+			// clear the player input after using it, so automatic events get empty user_input
+			if (user_input[0] != '\0')
+				llm_context_clear_last_player_input(g_llm_session);
+		}
+	}
+#endif
+
+	msg_box_layout(str, row, w, toggle);
+}
+
+// poll the pending translation of the current message box (called each cycle
+// and while waiting for the player).  redraw the box when it's ready.
+void message_box_llm_poll(void)
+{
+#ifdef NAGI_ENABLE_LLM
+	char translated_msg[600];
+	int partial_len;
+
+	if (msg_llm_request == 0)
+		return;
+
+	switch (nagi_llm_request_poll(msg_llm_request))
+	{
+		case NAGI_LLM_REQUEST_PENDING:
+			// show the text streamed so far
+			partial_len = nagi_llm_request_partial(msg_llm_request,
+						translated_msg, sizeof(translated_msg));
+			if ( (partial_len > msg_llm_drawn) && (msgstate.active != 0) )
+			{
+				msg_llm_redraw(translated_msg);
+				msg_llm_drawn = partial_len;
+				// speak each sentence as soon as it's there
+				speech_text(translated_msg, partial_len, 0);
+			}
+			return;
+
+		case NAGI_LLM_REQUEST_DONE:
+			strncpy(translated_msg, nagi_llm_request_result(msg_llm_request), sizeof(translated_msg) - 1);
+			translated_msg[sizeof(translated_msg) - 1] = '\0';
+
+			// store the translated message in context for language continuity
+			llm_context_on_print(g_llm_session, translated_msg);
+
+			// only redraw if the box is still up
+			if (msgstate.active != 0)
+			{
+				msg_llm_redraw(translated_msg);
+				speech_text(translated_msg, (int)strlen(translated_msg), 1);
 			}
+			break;
+
+		default:
+			;
+	}
+
+	nagi_llm_request_free(msg_llm_request);
+	msg_llm_request = 0;
+#endif
+}
+
+// the box the translation was for is gone, stop generating it
+void message_box_llm_cancel(void)
+{
+#ifdef NAGI_ENABLE_LLM
+	if (msg_llm_request != 0)
+	{
+		nagi_llm_request_free(msg_llm_request);
+		msg_llm_request = 0;
+	}
+#endif
+}
+
+#ifdef NAGI_ENABLE_LLM
+// lay the current box out again with (partially) translated text
+static void msg_llm_redraw(const char *text)
+{
+	u16 width_orig;
+	TPOS pos_orig;
+
+	width_orig = msgstate.wanted_width;
+	pos_orig = msgstate.wanted_pos;
+	msgstate.wanted_width = msg_llm_wanted_width;
+	msgstate.wanted_pos = msg_llm_wanted_pos;
+	if ( (msgstate.active == 0) || (msg_box_extend(text, msg_llm_row, msg_llm_w, msg_llm_toggle) == 0) )
+		msg_box_layout(text, msg_llm_row, msg_llm_w, msg_llm_toggle);
+	msgstate.wanted_width = width_orig;
+	msgstate.wanted_pos = pos_orig;
+}
+
+// the streamed text grew.  if the box stays the same size and what's on
+// screen is still how the longer text starts, only the new part is printed
+static u16 msg_box_extend(const char *str, u16 row, u16 w, u16 toggle)
+{
+	char msg[MSG_WRAP_SIZE];
+	AGISIZE size_shown;
+	const char *s;
+	size_t len;
+	u16 line, col;
+
+	size_shown = msgstate.tsize;
+	str_wordwrap(msg, str, msg_box_width(w));	// partial text isn't worth caching
+	if (msgstate.tsize.h > (HEIGHT_MAX - 1))
+		return 0;
+	msgstate.printed_height = msgstate.tsize.h;
+	if (toggle != 0)
+	{
+		msgstate.tsize.w = msg_box_width(w);
+		if ( row != 0)
+			msgstate.tsize.h = row;
+	}
+	len = strlen(msg_box_shown);
+	if ( (msgstate.tsize.w != size_shown.w) || (msgstate.tsize.h != size_shown.h) ||
+		(strncmp(msg, msg_box_shown, len) != 0) )
+		return 0;
+
+	// where the text on screen ends
+	line = 0;
+	col = 0;
+	for (s = msg_box_shown; *s != 0; s += msg_char_len(s))
+	{
+		if (*s == 0x0A)
+		{
+			line++;
+			col = 0;
 		}
+		else
+			col++;
 	}
+
+	text_attrib_push();
+	push_row_col();
+	text_colour(0, 0x0F);
+	window_col = msgstate.tpos.col;
+	goto_row_col(msgstate.tpos.row + line, msgstate.tpos.col + col);
+	agi_printf(msg + len);
+	window_col = 0;
+	pop_row_col();
+	text_attrib_pop();
+
+	strcpy(msg_box_shown, msg);
+	return 1;
+}
 #endif
 
+// the box width msg_box_layout() wraps to
+static u16 msg_box_width(u16 w)
+{
+	if (  (msgstate.wanted_width == 0xFFFF) && (w == 0)  )
+		return 30;
+	if ( msgstate.wanted_width != 0xFFFF) 
+		return msgstate.wanted_width;
+	return w;
+}
+
+static u32 msg_layout_hash(const char *str)
+{
+	u32 hash;
+
+	hash = 2166136261u;	// fnv-1a
+	while (*str != 0)
+		hash = (hash ^ (u8)*(str++)) * 16777619u;
+	return hash;
+}
+
+// str_wordwrap() with the result kept for the next time the same string is
+// shown at the same width
+static char *msg_wrap(char *msg, const char *str, u16 w)
+{
+	MSG_LAYOUT *lay, *victim;
+	size_t msg_len;
+	u32 hash;
+	int i;
+
+	if ( (str == 0) || (strchr(str, '%') != 0) )
+		return str_wordwrap(msg, str, w);
+
+	hash = msg_layout_hash(str);
+	victim = &msg_layout[0];
+	for (i = 0; i < MSG_LAYOUT_MAX; i++)
+	{
+		lay = &msg_layout[i];
+		if ( (lay->str != 0) && (lay->hash == hash) && (lay->w == w) &&
+			(lay->newline_char == msgstate.newline_char) && (strcmp(lay->str, str) == 0) )
+		{
+			lay->used = ++msg_layout_stamp;
+			msgstate.tsize = lay->tsize;
+			strcpy(msg, lay->msg);
+			return msg;
+		}
+		if ( (victim->str != 0) && ((lay->str == 0) || (lay->used < victim->used)) )
+			victim = lay;
+	}
+
+	str_wordwrap(msg, str, w);
+
+	if (victim->str != 0)
+	{
+		a_free(victim->str);
+		a_free(victim->msg);
+	}
+	msg_len = strlen(msg) + 1;
+	victim->str = a_malloc(strlen(str) + 1);
+	victim->msg = a_malloc(msg_len);
+	strcpy(victim->str, str);
+	memcpy(victim->msg, msg, msg_len);
+	victim->hash = hash;
+	victim->w = w;
+	victim->newline_char = msgstate.newline_char;
+	victim->tsize = msgstate.tsize;
+	victim->used = ++msg_layout_stamp;
+	return msg;
+}
+
+static void msg_box_layout(const char *str, u16 row, u16 w, u16 toggle)
+{
 	char msg_err[100];	// 2bc
-	char msg[600];	// 258
+	char msg[MSG_WRAP_SIZE];	// 258
 	u16 ax;
 	
 	if ( msgstate.active != 0)
@@ -227,14 +527,11 @@ void message_box_draw(const char *str, u16 row, u16 w, u16 toggle)
 	push_row_col();
 	text_colour(0, 0x0F);
 	
-	if (  (msgstate.wanted_width == 0xFFFF) && (w == 0)  )
-		w = 30;
-	else if ( msgstate.wanted_width != 0xFFFF) 
-		w = msgstate.wanted_width;
+	w = msg_box_width(w);
 	
 	for(;;)
 	{
-		str_wordwrap(msg, str, w);	//split it up to fit in a msg box???
+		msg_wrap(msg, str, w);	//split it up to fit in a msg box???
 		msgstate.printed_height = msgstate.tsize.h;
 		
 		if (toggle != 0)
@@ -284,6 +581,9 @@ void message_box_draw(const char *str, u16 row, u16 w, u16 toggle)
 	gfx_msgbox(msgstate.bgpos.x, msgstate.bgpos.y, msgstate.bgsize.w, msgstate.bgsize.h, 0x0F, 0x04);
 	
 	msgstate.active = 1;
+#ifdef NAGI_ENABLE_LLM
+	strcpy(msg_box_shown, msg);
+#endif
 	agi_printf(msg);
 	window_col = 0;
 	
@@ -331,6 +631,8 @@ static char *r_display1f93(const char *given_source, char *given_msg)
 	const char *log_msg;	// logic msg data
 	const char *source;
 	char *msg;
+	char *word;
+	u16 char_len;	// bytes in a utf-8 character
 
 	
 	source = given_source;
@@ -425,8 +727,11 @@ static char *r_display1f93(const char *given_source, char *given_msg)
 					break;
 					
 					
-				default:			// normal character
-					*(msg++) = *(source++);
+				default:			// normal character, a utf-8 one is one cell
+					char_len = msg_char_len(source);
+					memcpy(msg, source, char_len);
+					msg += char_len;
+					source += char_len;
 					disp_char_cur++;
 			}
 		}
@@ -439,7 +744,8 @@ static char *r_display1f93(const char *given_source, char *given_msg)
 		else
 		{
 			*msg = 0;
-			disp_char_cur = disp_char_cur - (msg - disp_last_word);
+			for (word = disp_last_word; *word != 0; word += msg_char_len(word))
+				disp_char_cur--;
 			display_new_line();
 			msg = disp_last_word;
 			*msg = 0x0A;	// new line
@@ -450,7 +756,7 @@ static char *r_display1f93(const char *given_source, char *given_msg)
 			disp_last_word = 0;
 			while ( *msg != 0)
 			{
-				msg++;
+				msg += msg_char_len(msg);
 				disp_char_cur ++;
 			}
 		}
@@ -494,6 +800,24 @@ static const char *str_to_int_ptr(const char *s, u16 *num)
 	return s;
 }
 
+// bytes of the character at s as window_put_string() draws it, a whole
+// utf-8 sequence or a byte on its own if it isn't one
+static u16 msg_char_len(const char *s)
+{
+	u32 state_utf8 = UTF8_ACCEPT;
+	u32 codepoint;
+	u16 n;
+
+	for (n = 0; (n < 4) && (s[n] != 0); n++)
+	{
+		if (utf8_decode(&state_utf8, &codepoint, (u8)s[n]) == UTF8_ACCEPT)
+			return n + 1;
+		if (state_utf8 == UTF8_REJECT)
+			break;
+	}
+	return 1;
+}
+
 // new line?
 static void display_new_line()
 {
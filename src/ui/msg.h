@@ -11,6 +11,9 @@ extern u8 *cmd_display_v(u8 *c);
 
 extern int message_box(const char *var8);
 extern void message_box_draw(const char *str, u16 row, u16 w, u16 toggle);
+extern void message_box_llm_poll(void);
+extern void message_box_llm_cancel(void);
+// is a message box still waiting on its translation
 extern char *str_wordwrap(char *msg, const char *str, u16 w);
 extern const char *logic_msg(u16 msg_num);
 
@@ -49,6 +52,8 @@ typedef struct msgstate_struct MSGSTATE;
 
 #define HEIGHT_MAX 20
 #define LINE_SIZE 8
+// wrapped text of a screen, 40 utf-8 characters a line
+#define MSG_WRAP_SIZE (HEIGHT_MAX * (40 * 4 + 1) + 1)
 
 //extern u16 dialogue_open;
 //extern u8 newline_char ;	// 0x40 or 0x5c
@@ -0,0 +1,347 @@
+/*
+Pre-translated message table
+
+"nagi --pretranslate <language> [game dir]" runs every message of every
+logic through the llm and bakes the results into PRETRANS_FILE in the game
+directory.  at runtime message_box_draw() looks scripted messages up here
+first so they don't need the llm at all, as long as the player's language
+is still the one they were baked in.
+
+file layout (little endian):
+	0	"NPTR"
+	4	u16 version
+	6	u16 number of entries
+	8	u32 offset of the index
+	12	char language[32]
+	44	translated strings, nul terminated
+	index	entries of u8 logic, u8 msg, u32 string offset, sorted
+*/
+
+#define MEM_TAG MEM_LLM
+
+#include <string.h>
+#include <stdio.h>
+
+#include "../agi.h"
+#include "msg_pretrans.h"
+
+#include "../logic/logic_base.h"
+#include "../res/res.h"
+#include "../decrypt.h"
+#include "../sys/endian.h"
+#include "../sys/agi_file.h"
+#include "../sys/sys_dir.h"
+#include "../sys/mem_wrap.h"
+
+#ifdef NAGI_ENABLE_LLM
+#include "../llm_global.h"
+#endif
+
+#define PRETRANS_VERSION 1
+#define PRETRANS_HEAD_SIZE 44
+#define PRETRANS_LANG_SIZE 32
+#define PRETRANS_ENTRY_SIZE 6
+// longest translated message kept
+#define PRETRANS_MSG_SIZE 600
+
+static u8 *pretrans_data = 0;
+static u16 pretrans_count = 0;
+static u8 *pretrans_index = 0;
+
+void pretrans_load(void)
+{
+	u32 index_off, i;
+	u8 *data;
+
+	pretrans_unload();
+
+	dir_preset_change(DIR_PRESET_GAME);
+	data = file_to_buf(PRETRANS_FILE);
+	if (data == 0)
+		return;
+
+	// sanity check so the lookups can't run off the buffer
+	if ( (file_buf_size < PRETRANS_HEAD_SIZE) || (memcmp(data, "NPTR", 4) != 0) ||
+		(load_le_16(data + 4) != PRETRANS_VERSION) )
+		goto bad_file;
+
+	pretrans_count = load_le_16(data + 6);
+	index_off = load_le_32(data + 8);
+	if ( (index_off <= PRETRANS_HEAD_SIZE) || (index_off > file_buf_size) ||
+		((file_buf_size - index_off) / PRETRANS_ENTRY_SIZE < pretrans_count) ||
+		(data[index_off - 1] != 0) )
+		goto bad_file;
+
+	for (i = 0; i < pretrans_count; i++)
+	{
+		u32 off = load_le_32(data + index_off + i * PRETRANS_ENTRY_SIZE + 2);
+		if ( (off < PRETRANS_HEAD_SIZE) || (off >= index_off) )
+			goto bad_file;
+	}
+
+	data[12 + PRETRANS_LANG_SIZE - 1] = 0;
+	pretrans_data = data;
+	pretrans_index = data + index_off;
+	printf("Loaded %d pre-translated messages (%s)\n", pretrans_count, (char *)data + 12);
+
+#ifdef NAGI_ENABLE_LLM
+	// the language to start in, until the player writes in another
+	if (g_llm != 0)
+		nagi_llm_set_language(g_llm, (char *)data + 12);
+#endif
+	return;
+
+bad_file:
+	printf("Ignoring invalid %s\n", PRETRANS_FILE);
+	pretrans_count = 0;
+	a_free(data);
+}
+
+void pretrans_unload(void)
+{
+	if (pretrans_data != 0)
+		a_free(pretrans_data);
+	pretrans_data = 0;
+	pretrans_index = 0;
+	pretrans_count = 0;
+}
+
+// the baked messages are only any use to a player reading their language
+static int pretrans_usable(void)
+{
+	if (pretrans_data == 0)
+		return 0;
+#ifdef NAGI_ENABLE_LLM
+	// none known yet is the one set at load
+	if ( (g_llm != 0) && (nagi_llm_language_is(g_llm, (char *)pretrans_data + 12) == 0) )
+		return 0;
+#endif
+	return 1;
+}
+
+// baked translation of message msg_num of logic logic_num
+static const char *pretrans_find(u16 logic_num, u16 msg_num)
+{
+	u16 key;
+	int lo, hi, mid;
+	u8 *entry;
+
+	if (!pretrans_usable())
+		return 0;
+
+	key = (logic_num << 8) | msg_num;
+	lo = 0;
+	hi = pretrans_count - 1;
+	while (lo <= hi)
+	{
+		mid = (lo + hi) / 2;
+		entry = pretrans_index + mid * PRETRANS_ENTRY_SIZE;
+		if (load_be_16(entry) == key)
+			return (const char *)(pretrans_data + load_le_32(entry + 2));
+		if (load_be_16(entry) < key)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+	}
+
+	return 0;
+}
+
+// returns the baked translation of str, if str is a message of the current logic
+const char *pretrans_lookup(const char *str)
+{
+	u16 msg_num;
+
+	if ( !pretrans_usable() || (logic_cur == 0) || (str == 0) )
+		return 0;
+
+	// logic_msg() hands out pointers into the logic's message block
+	for (msg_num = 1; msg_num <= logic_cur->msg_total; msg_num++)
+	{
+		u16 off = load_le_16(logic_cur->msg + (msg_num<<1));
+		if ( (off != 0) && ((const char *)(logic_cur->msg + off) == str) )
+			break;
+	}
+	if (msg_num > logic_cur->msg_total)
+		return 0;
+
+	return pretrans_find(logic_cur->num, msg_num);
+}
+
+// the room's logic was just loaded.  its messages that aren't baked are
+// translated on the llm worker while the player looks around, so the
+// message boxes find them in the translation cache
+void pretrans_room(u16 logic_num)
+{
+#ifdef NAGI_ENABLE_LLM
+	LOGIC *log;
+	u16 msg_num, off;
+	int queued;
+
+	if (g_llm == 0)
+		return;
+	// the last room's are no use now
+	nagi_llm_pretranslate_cancel(g_llm);
+
+	log = logic_list_find(logic_num);
+	if (log == 0)
+		return;
+
+	queued = 0;
+	for (msg_num = 1; msg_num <= log->msg_total; msg_num++)
+	{
+		off = load_le_16(log->msg + (msg_num<<1));
+		if ( (off == 0) || (log->msg[off] == 0) || (pretrans_find(logic_num, msg_num) != 0) )
+			continue;
+		queued += nagi_llm_pretranslate_async(g_llm, (const char *)(log->msg + off));
+	}
+	if (queued != 0)
+		printf("logic %d: pre-translating %d messages\n", logic_num, queued);
+#else
+	(void)logic_num;
+#endif
+}
+
+#ifdef NAGI_ENABLE_LLM
+// add one logic's messages to the list to translate.  returns the new count
+static int pretrans_collect_logic(u16 logic_num, char **src, u16 *key, int n)
+{
+	u8 *log_data, *msg;
+	u16 msg_total, msg_num, off;
+
+	log_data = vol_res_load(dir_logic_find(logic_num), 0);
+	if (log_data == 0)
+		return n;
+
+	// same message setup as logic_load_2()
+	msg = log_data + 2 + load_le_16(log_data);
+	msg_total = msg[0];
+	msg++;
+	if ( (msg_total != 0) && ((!c_game_compression) || not_compressed) )
+		decrypt_string(msg + ((msg_total + 1)<<1), msg + load_le_16(msg));
+
+	for (msg_num = 1; msg_num <= msg_total; msg_num++)
+	{
+		off = load_le_16(msg + (msg_num<<1));
+		if ( (off == 0) || (msg[off] == 0) )
+			continue;
+		src[n] = a_malloc(strlen((char *)msg + off) + 1);
+		strcpy(src[n], (char *)msg + off);
+		key[n] = (logic_num << 8) | msg_num;
+		n++;
+	}
+
+	a_free(log_data);
+	return n;
+}
+#endif
+
+// bake every logic message into PRETRANS_FILE.  returns 0 on success
+int pretrans_build(const char *language)
+{
+#ifdef NAGI_ENABLE_LLM
+	FILE *stream;
+	u8 head[PRETRANS_HEAD_SIZE];
+	u8 *index, *entry;
+	char **src, **out;
+	const char **batch;
+	u16 *key;
+	u16 count, logic_num;
+	u32 pos;
+	int n, i;
+	size_t len;
+
+	// the model loads in the background, this needs all of it
+	if ((g_llm == 0) || !nagi_llm_wait_ready(g_llm))
+	{
+		printf("pretranslate: the llm is not available\n");
+		return 1;
+	}
+
+	nagi_llm_set_language(g_llm, language);
+
+	dir_preset_change(DIR_PRESET_GAME);
+	stream = fopen(PRETRANS_FILE, "wb");
+	if (stream == 0)
+	{
+		printf("pretranslate: unable to write %s\n", PRETRANS_FILE);
+		return 1;
+	}
+
+	// header is rewritten with the real count and index once done
+	memset(head, 0, sizeof(head));
+	fwrite(head, 1, sizeof(head), stream);
+
+	// every message goes to the llm in one call, so a backend that batches
+	// (the cloud batch api) gets them all at once
+	src = a_malloc(256 * 256 * sizeof(char *));
+	key = a_malloc(256 * 256 * sizeof(u16));
+	n = 0;
+	for (logic_num = 0; logic_num < dir_logic_count(); logic_num++)
+	{
+		if (dir_logic_find(logic_num) != 0)
+			n = pretrans_collect_logic(logic_num, src, key, n);
+	}
+
+	out = a_malloc((n + 1) * sizeof(char *));
+	for (i = 0; i < n; i++)
+	{
+		out[i] = a_malloc(PRETRANS_MSG_SIZE);
+		out[i][0] = 0;
+	}
+	if (n != 0)
+	{
+		printf("pretranslate: translating %d messages...\n", n);
+		// the llm only reads them, src still owns the copies
+		batch = a_malloc(n * sizeof(const char *));
+		for (i = 0; i < n; i++)
+			batch[i] = src[i];
+		nagi_llm_generate_response_batch(g_llm, batch, n, out, PRETRANS_MSG_SIZE);
+		a_free(batch);
+	}
+
+	// collected in logic and message order, so the index comes out sorted
+	index = a_malloc(256 * 256 * PRETRANS_ENTRY_SIZE);
+	entry = index;
+	count = 0;
+	pos = PRETRANS_HEAD_SIZE;
+	for (i = 0; i < n; i++)
+	{
+		len = strlen(out[i]);
+		if (len != 0)
+		{
+			entry[0] = key[i] >> 8;
+			entry[1] = key[i] & 0xFF;
+			store_le_32(entry + 2, pos);
+			entry += PRETRANS_ENTRY_SIZE;
+			count++;
+			fwrite(out[i], 1, len + 1, stream);
+			pos += len + 1;
+		}
+		a_free(out[i]);
+		a_free(src[i]);
+	}
+	a_free(out);
+	a_free(key);
+	a_free(src);
+
+	fwrite(index, PRETRANS_ENTRY_SIZE, count, stream);
+	a_free(index);
+
+	memcpy(head, "NPTR", 4);
+	store_le_16(head + 4, PRETRANS_VERSION);
+	store_le_16(head + 6, count);
+	store_le_32(head + 8, pos);
+	strncpy((char *)head + 12, language, PRETRANS_LANG_SIZE - 1);
+	fseek(stream, 0, SEEK_SET);
+	fwrite(head, 1, sizeof(head), stream);
+	fclose(stream);
+
+	printf("pretranslate: wrote %d %s messages to %s\n", count, language, PRETRANS_FILE);
+	return 0;
+#else
+	(void)language;
+	printf("pretranslate: nagi was built without llm support\n");
+	return 1;
+#endif
+}
@@ -0,0 +1,13 @@
+#ifndef NAGI_UI_MSG_PRETRANS_H
+#define NAGI_UI_MSG_PRETRANS_H
+
+// file written by --pretranslate, loaded from the game directory
+#define PRETRANS_FILE "nagi_pretrans.bin"
+
+extern void pretrans_load(void);
+extern void pretrans_unload(void);
+extern const char *pretrans_lookup(const char *str);
+extern void pretrans_room(u16 logic_num);
+extern int pretrans_build(const char *language);
+
+#endif /* NAGI_UI_MSG_PRETRANS_H */
@@ -5,17 +5,25 @@ _ParseClean                      cseg     0000199D 000000CE
 _WordFind                        cseg     00001A6B 0000015C
 _WordIsolate                     cseg     00001BC7 0000001D
 _WordNext                        cseg     00001BE4 00000020
+
+words.tok is decoded into a trie when it's loaded (first child, next
+sibling) so a word is found in one pass over the player's input, taking
+the longest dictionary word that ends on a word boundary.  dictionary
+words can hold spaces so that's a longest match over several of the
+player's words too.
 */
 
+#define MEM_TAG MEM_TEXT
+
 // for tolower()
 #include <ctype.h>
-// for strchr()
 #include <string.h>
 #include <assert.h>
 
 #include "../agi.h"
 
 #include "../ui/parse.h"
+#include "../ui/cmd_input.h"
 
 #include "../flags.h"
 
@@ -23,6 +31,8 @@ _WordNext                        cseg     00001BE4 00000020
 
 // byte-order support
 #include "../sys/endian.h"
+#include "../sys/profile.h"
+#include "../sys/mem_wrap.h"
 
 #define WORD_IGNORE 0
 #define WORD_ROL 9999
@@ -30,41 +40,127 @@ _WordNext                        cseg     00001BE4 00000020
 
 #define WORD_BUF_SIZE 10
 
+#define WORD_NONE 0xFFFF
+#define WORD_MAX 64
+
+// char_class[]
+#define CHAR_SEPARATOR 1
+#define CHAR_ILLEGAL 2
+
+struct word_node_struct
+{
+	s32 child;	// first, 0 if none (the root is never a child)
+	s32 next;	// sibling
+	u16 word;	// WORD_NONE if no word ends here
+	u8 ch;
+};
+typedef struct word_node_struct WORD_NODE;
+
 #ifdef NAGI_ENABLE_LLM
 #include "../llm_global.h"
+#include "../logic/said_index.h"
 #endif
 
 void parse(const char *string);
 u8 *cmd_parse(u8 *c);
+static void parse_words(const char *string);
 static void parse_read(const char *s);
 static u16 word_find(void);
+static char *word_trie_find(u16 *wordNum);
 static void playerWordIsolate(void);
-static u8 *dictWordNext(u8 *si);
+static int words_decode(const u8 *data, u32 size, u16 *count);
+static s32 word_insert(s32 node, char ch);
+#ifdef NAGI_ENABLE_LLM
+static int parse_retry(const char *string);
+static int parse_clean(const char *string);
+static void parse_llm(const char *string);
+static const char *parse_spec_take(const char *string);
+static void parse_vocab_room(void);
+static void parse_vocab_set(u8 room);
+
+// extraction started while the line was still being typed
+static nagi_llm_request_t *parse_spec = 0;
+static char parse_spec_input[INPUT_SIZE];
+static char parse_spec_result[NAGI_LLM_MAX_RESPONSE_SIZE];
+
+u32 parse_llm_ms = 0;
+
+// the said() words of the room the extraction prompt lists, most tested first
+#define PARSE_VOCAB_MAX 64
+static int parse_vocab_id[PARSE_VOCAB_MAX];
+static int parse_vocab_count = 0;
+static u16 parse_vocab_room_num = 0xFFFF;
+#endif
 
-static const char *char_separators = " ,.?!();:[]{}";
-static const char *char_illegal = "'`-\"";	// 0x27 is '
+// separators " ,.?!();:[]{}"  illegal "'`-\""
+static const u8 char_class[256] =
+{
+	[' '] = CHAR_SEPARATOR, [','] = CHAR_SEPARATOR, ['.'] = CHAR_SEPARATOR,
+	['?'] = CHAR_SEPARATOR, ['!'] = CHAR_SEPARATOR, ['('] = CHAR_SEPARATOR,
+	[')'] = CHAR_SEPARATOR, [';'] = CHAR_SEPARATOR, [':'] = CHAR_SEPARATOR,
+	['['] = CHAR_SEPARATOR, [']'] = CHAR_SEPARATOR, ['{'] = CHAR_SEPARATOR,
+	['}'] = CHAR_SEPARATOR,
+	['\''] = CHAR_ILLEGAL, ['`'] = CHAR_ILLEGAL, ['-'] = CHAR_ILLEGAL,
+	['"'] = CHAR_ILLEGAL,
+};
+
+static WORD_NODE *word_trie = 0;
+static s32 word_trie_size = 0;
+static s32 word_trie_max = 0;
 
 u16 word_num[WORD_BUF_SIZE];
 const char *word_string[WORD_BUF_SIZE];
 
 u16 word_total = 0;	// bad word
+u8 word_seen[32];
 u8 *words_tok_data = 0;
 
 // work area
-static char parse_string[42];
+static char parse_string[INPUT_SIZE];
 static char *strPtr;
 
 void parse(const char *string)
+{
+	#ifdef NAGI_ENABLE_LLM
+	llm_context_on_player_input(g_llm_session, string);
+	#endif
+
+	parse_words(string);
+
+	#ifdef NAGI_ENABLE_LLM
+	parse_llm_ms = 0;
+	if ((g_llm != 0) &&
+	    (g_llm_config.mode == NAGI_LLM_MODE_EXTRACTION || g_llm_config.mode == NAGI_LLM_MODE_HYBRID) &&
+	    (word_total == 0 || state.var[V09_BADWORD] > 0))
+	{
+		u64 prof = profile_now();
+		parse_llm(string);
+		profile_sub(PROFILE_LLM, prof);
+	}
+	#endif
+	
+	#ifdef NAGI_ENABLE_LLM
+	// whatever was guessed at belonged to this line or to one never entered
+	if (parse_spec != 0)
+	{
+		nagi_llm_request_free(parse_spec);
+		parse_spec = 0;
+	}
+	#endif
+
+	if (word_total > 0)
+		flag_set(F02_PLAYERCMD);
+}
+
+// split string into dictionary words, word_total/V09_BADWORD say how it went
+static void parse_words(const char *string)
 {
 	u16 wordNumber;
 	const char *wordString;	// the string data of the word
 
 	memset(word_string, 0, sizeof(word_string));
 	memset(word_num, 0, sizeof(word_num));
-
-	#ifdef NAGI_ENABLE_LLM
-	llm_context_on_player_input(string);
-	#endif
+	memset(word_seen, 0, sizeof(word_seen));
 
 	parse_read(string);
 	word_total = 0;
@@ -78,6 +174,7 @@ void parse(const char *string)
 		if (wordNumber == 0xFFFF)	// bad
 		{
 			word_string[word_total] = strPtr;
+			word_seen[0] |= 1;	// its word_num is left 0
 			state.var[V09_BADWORD] = word_total + 1;	// bad word
 			word_total++;
 			assert(word_total > 0); // we need flag 2 set
@@ -87,62 +184,266 @@ void parse(const char *string)
 		if (wordNumber != WORD_IGNORE)	// good
 		{
 			word_num[word_total] = wordNumber;
+			word_seen[(wordNumber >> 3) & 31] |= (u8)(1 << (wordNumber & 7));
 			word_string[word_total] = wordString;
 			word_total++;
 		}
 		// if WORD_IGNORE then skip it
 	}
+}
+
+#ifdef NAGI_ENABLE_LLM
+// parse a rewritten input in place of the player's, 1 if it parsed
+static int parse_retry(const char *string)
+{
+	state.var[V09_BADWORD] = 0;
+	parse_words(string);
+	if ((word_total > 0) && (state.var[V09_BADWORD] == 0))
+		return 1;
+	return 0;
+}
+
+// 1 if string is all dictionary words, without touching the last parse
+// (word_string points into parse_string and said() may still test it)
+static int parse_clean(const char *string)
+{
+	char saved[sizeof(parse_string)];
+	char *saved_ptr;
+	u16 wordNumber;
+	int words;
+
+	memcpy(saved, parse_string, sizeof(saved));
+	saved_ptr = strPtr;
+
+	parse_read(string);
+	strPtr = parse_string;
+	words = 0;
+	while (*strPtr != 0)
+	{
+		wordNumber = word_find();
+		if (wordNumber == 0xFFFF)
+		{
+			words = 0;
+			break;
+		}
+		if (wordNumber != WORD_IGNORE)
+			words++;
+	}
+
+	memcpy(parse_string, saved, sizeof(saved));
+	strPtr = saved_ptr;
+	return words > 0;
+}
+
+// the classic parser failed on string, rewrite it into dictionary words
+static void parse_llm(const char *string)
+{
+	char normalized[sizeof(parse_string)];
+	char memo[NAGI_LLM_MAX_RESPONSE_SIZE];
+	char words[NAGI_LLM_MAX_RESPONSE_SIZE];
+	const char *extracted;
+	u64 start;
+	int parsed;
+
+	/*
+	 * FAST PATH: typos, plurals and accents are fixed from the dictionary
+	 * alone in microseconds, even while the model is still loading.
+	 */
+	if (nagi_llm_normalize_input(g_llm, string, normalized, sizeof(normalized)))
+	{
+		if (parse_retry(normalized))
+			return;
+		// back to the player's words for the "I don't understand" message
+		parse_retry(string);
+	}
+
+	// phrases the model already extracted before, this game or an earlier session
+	if (nagi_llm_memo_lookup(g_llm, string, memo, sizeof(memo)))
+	{
+		if (parse_retry(memo))
+			return;
+		parse_retry(string);
+	}
+
+	if (!nagi_llm_ready(g_llm))
+		return;
+
+	// hybrid mode goes straight to semantic matching while extraction rarely helps
+	if ( (g_llm_config.mode == NAGI_LLM_MODE_HYBRID) &&
+		!nagi_llm_hybrid_try(g_llm, NAGI_LLM_MODE_EXTRACTION, 0) )
+		return;
 
-	#ifdef NAGI_ENABLE_LLM
 	/*
 	 * EXTRACTION MODE: If parsing failed (unknown words) or found no words,
 	 * extract verb+noun in English using LLM and re-parse.
 	 * This is faster than semantic matching: O(1) extraction vs O(N) comparisons.
 	 */
-	if (nagi_llm_ready(g_llm) && g_llm_config.mode == NAGI_LLM_MODE_EXTRACTION &&
-	    (word_total == 0 || state.var[V09_BADWORD] > 0)) {
-		const char *extracted = nagi_llm_extract_words(g_llm, string);
-
-		/* Only re-parse if extraction is different from original input */
-		if (extracted && strcmp(extracted, string) != 0) {
-			/* Reset parser state */
-			memset(word_string, 0, sizeof(word_string));
-			memset(word_num, 0, sizeof(word_num));
-			state.var[V09_BADWORD] = 0;
-			word_total = 0;
-
-			/* Re-run parsing on extracted English words */
-			parse_read(extracted);
-			strPtr = parse_string;
-
-			while ((*strPtr != 0) && (word_total < WORD_BUF_SIZE))
-			{
-				wordString = strPtr;
-				wordNumber = word_find();
+	start = SDL_GetTicks();
+	parse_vocab_room();
+	extracted = parse_spec_take(string);
+	if (extracted == 0)
+	{
+		nagi_llm_extract_words(g_llm, string, words, sizeof(words));
+		extracted = words;
+	}
 
-				if (wordNumber == 0xFFFF)	// bad
-				{
-					word_string[word_total] = strPtr;
-					state.var[V09_BADWORD] = word_total + 1;
-					word_total++;
-					break;
-				}
+	/* Only re-parse if extraction is different from original input */
+	parsed = 0;
+	if (extracted && strcmp(extracted, string) != 0)
+		parsed = parse_retry(extracted);
+
+	// the words may be ones this room doesn't test, ask again with them all
+	if (!parsed && (parse_vocab_count != 0))
+	{
+		parse_vocab_set(0);
+		nagi_llm_extract_words(g_llm, string, words, sizeof(words));
+		extracted = words;
+		parse_vocab_set(1);
+		if (extracted && strcmp(extracted, string) != 0)
+			parsed = parse_retry(extracted);
+	}
+
+	// the fast path and the memo can answer the next time
+	if (parsed)
+	{
+		nagi_llm_learn_extraction(g_llm, string, extracted);
+		nagi_llm_memo_store(g_llm, string, extracted);
+	}
+	parse_llm_ms = (u32)(SDL_GetTicks() - start);
+
+	if (g_llm_config.mode == NAGI_LLM_MODE_HYBRID)
+	{
+		nagi_llm_hybrid_record(g_llm, NAGI_LLM_MODE_EXTRACTION, parse_llm_ms, parsed);
+		// semantic matching goes by the player's own words
+		if (!parsed)
+			parse_retry(string);
+	}
+}
+#endif
+
+
+#ifdef NAGI_ENABLE_LLM
+// the player stopped typing for a moment, start extracting the line in the
+// background.  enter usually finds it done
+void parse_speculate(const char *line)
+{
+	char memo[NAGI_LLM_MAX_RESPONSE_SIZE];
+
+	if ( (g_llm == 0) ||
+		((g_llm_config.mode != NAGI_LLM_MODE_EXTRACTION) && (g_llm_config.mode != NAGI_LLM_MODE_HYBRID)) )
+		return;
+	if ( (parse_spec != 0) && (strcmp(parse_spec_input, line) == 0) )
+		return;
+	if (parse_spec != 0)
+	{
+		nagi_llm_request_free(parse_spec);
+		parse_spec = 0;
+	}
+	if ( (line[0] == 0) || !nagi_llm_ready(g_llm) )
+		return;
+	// parse() won't ask the model for a line the dictionary already knows
+	if (parse_clean(line))
+		return;
+	// answered without the model anyway
+	if (nagi_llm_memo_lookup(g_llm, line, memo, sizeof(memo)))
+		return;
+	parse_vocab_room();
+
+	parse_spec = nagi_llm_extract_words_async(g_llm, line);
+	if (parse_spec != 0)
+	{
+		strncpy(parse_spec_input, line, sizeof(parse_spec_input) - 1);
+		parse_spec_input[sizeof(parse_spec_input) - 1] = 0;
+	}
+}
+
+// the speculative extraction if it was of this very string, 0 otherwise
+static const char *parse_spec_take(const char *string)
+{
+	const char *result;
+
+	if ( (parse_spec == 0) || (strcmp(parse_spec_input, string) != 0) )
+		return 0;
+
+	// it's queued or under way, that's no slower than starting over
+	while (nagi_llm_request_poll(parse_spec) == NAGI_LLM_REQUEST_PENDING)
+		SDL_Delay(1);
 
-				if (wordNumber != WORD_IGNORE)	// good
+	result = nagi_llm_request_result(parse_spec);
+	if (result == 0)
+		return 0;
+	strncpy(parse_spec_result, result, sizeof(parse_spec_result) - 1);
+	parse_spec_result[sizeof(parse_spec_result) - 1] = 0;
+	return parse_spec_result;
+}
+
+// the extraction prompt lists the words the room's logics (and logic 0's)
+// test in said() instead of the whole dictionary.  worked out on a new room
+static void parse_vocab_room(void)
+{
+	const SAID_PHRASE *phrase;
+	int *id, *uses;
+	u16 room, i, w;
+	int n, j, k, best, t;
+
+	room = state.var[V00_ROOM0];
+	if (room == parse_vocab_room_num)
+		return;
+	parse_vocab_room_num = room;
+	parse_vocab_count = 0;
+
+	if (said_index_total() != 0)
+	{
+		id = a_malloc(said_index_total() * SAID_INDEX_WORDS * sizeof(int));
+		uses = a_malloc(said_index_total() * SAID_INDEX_WORDS * sizeof(int));
+		n = 0;
+		for (i = 0; i < said_index_total(); i++)
+		{
+			phrase = said_index_get(i);
+			if (!said_index_in_room(phrase, room))
+				continue;
+			for (w = 0; w < phrase->count; w++)
+			{
+				if ( (phrase->words[w] == WORD_IGNORE) || (phrase->words[w] == WORD_ANY) ||
+					(phrase->words[w] == WORD_ROL) )
+					continue;
+				j = 0;
+				while ( (j < n) && (id[j] != phrase->words[w]) )
+					j++;
+				if (j == n)
 				{
-					word_num[word_total] = wordNumber;
-					word_string[word_total] = wordString;
-					word_total++;
+					id[n] = phrase->words[w];
+					uses[n++] = 0;
 				}
+				uses[j]++;
 			}
 		}
+
+		// the most tested first
+		for (k = 0; (k < n) && (k < PARSE_VOCAB_MAX); k++)
+		{
+			best = k;
+			for (j = k + 1; j < n; j++)
+				if (uses[j] > uses[best])
+					best = j;
+			t = id[k]; id[k] = id[best]; id[best] = t;
+			t = uses[k]; uses[k] = uses[best]; uses[best] = t;
+			parse_vocab_id[k] = id[k];
+		}
+		parse_vocab_count = k;
+
+		a_free(uses);
+		a_free(id);
 	}
-	#endif
-	
-	if (word_total > 0)
-		flag_set(F02_PLAYERCMD);
+	parse_vocab_set(1);
 }
 
+// the room's words, or back to the whole dictionary
+static void parse_vocab_set(u8 room)
+{
+	nagi_llm_set_vocabulary(g_llm, parse_vocab_id, room ? parse_vocab_count : 0);
+}
+#endif
 
 u8 *cmd_parse(u8 *c)
 {
@@ -160,14 +461,14 @@ u8 *cmd_parse(u8 *c)
 static void parse_read(const char *str)
 {
 	char *buf;
+	u8 class;
 
 	buf = parse_string;	
 
 	while (*str)
 	{
 		// skip excess separators at start and inbetween words
-		if ( (strchr(char_separators, *str) != 0) ||
-			(strchr(char_illegal, *str) != 0) )
+		if (char_class[(u8)*str] != 0)
 		{
 			str++;
 		}
@@ -176,14 +477,15 @@ static void parse_read(const char *str)
 			assert(*str);
 			do
 			{
-				if (strchr(char_separators, *str) != 0)
+				class = char_class[(u8)*str];
+				if (class == CHAR_SEPARATOR)
 				{
 					*(buf++) = 0x20;	// space
 					break;
 				}
 				
 				// if not an illegal character add to buffer
-				if (strchr(char_illegal, *str) == 0)
+				if (class == 0)
 					*(buf++) = *str;
 				str++;
 			} while (*str != 0);
@@ -200,15 +502,12 @@ static void parse_read(const char *str)
 // accesses the words.tok file
 static u16 word_find()
 {
-	u16 indexOffset;	// offset to data for that letter
-	u16 chCount;		// count of characters already matched
 	u16 chFirst;		// lowercase version of the first character in the word.
 	u16 wordNum;
 	char *wordNext;		// the next word after the current on
-	u8 *wordData;
-	char *playerInput;
+	char *trieNext;
 	
-	wordNum = 0xFFFF;
+	wordNum = WORD_NONE;
 	wordNext = 0;
 	chFirst = tolower(strPtr[0]);
 	
@@ -225,66 +524,58 @@ static u16 word_find()
 					wordNext++;
 			}
 
-		// bug?.. shouldn't we jump?
-		// or do we check for words like "a bird" in the dictionary first?
-			
-		// lookup the first letter in the index
-		indexOffset = load_be_16(words_tok_data + (chFirst - 'a')*sizeof(u16));
-			
-		if (indexOffset == 0)	// if no words exist with that first letter..
+		// words like "a bird" in the dictionary come before that
+		trieNext = word_trie_find(&wordNum);
+		if (trieNext != 0)
+			wordNext = trieNext;
+		
+		// if we haven't defined wordNext, that means there's an error with the current one
+		if (wordNext == 0) 
 			playerWordIsolate();
 		else
 		{
-			wordData = words_tok_data + indexOffset;
-			playerInput = strPtr;
-			chCount = 0;
-			while ((wordData != 0) && (*wordData >= chCount))
-			{
-				if (*(wordData++) == chCount)
-				{
-					// this shows bits are inverted in the dictionary?
-					while ((*wordData&0x7F) == (tolower(*playerInput)^0x7F))
-					{
-						playerInput++;
-						chCount++;
-						
-						if (*wordData & 0x80)	// if msb set
-						{
-							// if we're at the end of the player's word anyway
-							if ((*playerInput==0)||(*playerInput==' '))
-							{
-								wordNum = load_be_16(wordData+1);
-								wordNext = playerInput;
-								if (*playerInput != 0)	// skip past space
-									wordNext++;
-							}
-							break;
-						}
-						
-						wordData++;
-					}					
-				}
-				// find longest match.
-				// we don't check for " " since it may appear in the word??
-				if (*playerInput == 0) 
-					break;
-				wordData = dictWordNext(wordData);	// next word??
-			}
-		
-			// if we haven't defined wordNext, that means there's an error with the current one
-			if (wordNext == 0) 
-				playerWordIsolate();
-			else
-			{
-				strPtr = wordNext;
-				if (*strPtr)
-					*(strPtr-1) = 0;
-			}
+			strPtr = wordNext;
+			if (*strPtr)
+				*(strPtr-1) = 0;
 		}
 	}
 	return wordNum;
 }
 
+// the longest dictionary word (which may hold spaces) ending at a word
+// boundary.  returns the next word or 0
+static char *word_trie_find(u16 *wordNum)
+{
+	char *str;
+	char *wordNext;
+	s32 node;
+	u8 ch;
+
+	wordNext = 0;
+	if (word_trie == 0)
+		return 0;
+	node = 0;
+	for (str = strPtr; ; str++)
+	{
+		if ( ((*str == ' ') || (*str == 0)) && (word_trie[node].word != WORD_NONE) )
+		{
+			*wordNum = word_trie[node].word;
+			wordNext = str;
+			if (*str != 0)	// skip past space
+				wordNext++;
+		}
+		if (*str == 0)
+			break;
+		ch = tolower(*str);
+		for (node = word_trie[node].child; node != 0; node = word_trie[node].next)
+			if (word_trie[node].ch == ch)
+				break;
+		if (node == 0)
+			break;
+	}
+	return wordNext;
+}
+
 // go through str until we reach a space or zero
 // then set it to zero.
 static void playerWordIsolate()
@@ -294,15 +585,110 @@ static void playerWordIsolate()
 	*str = 0;
 }
 
-// skip past current word in dictionary
-// return pointer to next word
-// return 0 if no word exists
-static u8 *dictWordNext(u8 *str)
+// the child of node for ch, added if it's not there
+static s32 word_insert(s32 node, char ch)
 {
-	while ((*str & 0x80) == 0)	// msb
-		str++;
-	// this is how it is implemented in agi.. 
-	// but it will never return zero.  how can it?  the first bit is set!
-	return (*str)?(str+3):(0);
+	s32 child;
+
+	for (child = word_trie[node].child; child != 0; child = word_trie[child].next)
+		if (word_trie[child].ch == (u8)ch)
+			return child;
+	if (word_trie_size >= word_trie_max)
+		return -1;
+	child = word_trie_size++;
+	word_trie[child].ch = ch;
+	word_trie[child].word = WORD_NONE;
+	word_trie[child].child = 0;
+	word_trie[child].next = word_trie[node].child;
+	word_trie[node].child = child;
+	return child;
 }
 
+// walk words.tok adding each word to the trie, or just count the
+// characters if there isn't one yet.  returns the count
+static int words_decode(const u8 *data, u32 size, u16 *count)
+{
+	char word[WORD_MAX];
+	const u8 *ptr, *end;
+	u16 offset;
+	int chars, len, i, j;
+	u8 prefix;
+	s32 node;
+
+	chars = 0;
+	*count = 0;
+	end = data + size;
+	if (size < 52)
+		return 0;
+	for (i = 0; i < 26; i++)
+	{
+		offset = load_be_16(data + i*sizeof(u16));
+		if ((offset == 0) || (offset >= size))
+			continue;
+		ptr = data + offset;
+		len = 0;
+		// each letter ends with a 0 prefix
+		while ( (ptr < end) && ((*ptr != 0) || (ptr == data + offset)) )
+		{
+			prefix = *(ptr++);
+			if (prefix < len)
+				len = prefix;
+			// the characters are inverted, the last one has the msb set
+			while (ptr < end)
+			{
+				if (len < WORD_MAX-1)
+					word[len++] = (*ptr & 0x7F) ^ 0x7F;
+				if (*(ptr++) & 0x80)
+					break;
+			}
+			if (ptr + 2 > end)
+				break;
+
+			chars += len;
+			(*count)++;
+			if (word_trie != 0)
+			{
+				node = 0;
+				for (j = 0; (j < len) && (node >= 0); j++)
+					node = word_insert(node, word[j]);
+				// the first of the same spelling wins, like the walk
+				if ((node > 0) && (word_trie[node].word == WORD_NONE))
+					word_trie[node].word = load_be_16(ptr);
+			}
+			ptr += 2;
+		}
+	}
+	return chars;
+}
+
+// decode words.tok into the trie
+void parse_dict_init(const u8 *data, u32 size)
+{
+	u16 count;
+	int chars;
+
+	parse_dict_free();
+	if (data == 0)
+		return;
+	chars = words_decode(data, size, &count);
+	if (count == 0)
+		return;
+	// the most it can take is a node for every character
+	word_trie_max = chars + 1;
+	word_trie = (WORD_NODE *)a_malloc(word_trie_max * sizeof(WORD_NODE));
+	word_trie_size = 1;
+	word_trie[0].ch = 0;
+	word_trie[0].word = WORD_NONE;
+	word_trie[0].child = 0;
+	word_trie[0].next = 0;
+	words_decode(data, size, &count);
+}
+
+void parse_dict_free()
+{
+	if (word_trie != 0)
+		a_free(word_trie);
+	word_trie = 0;
+	word_trie_size = 0;
+	word_trie_max = 0;
+}
@@ -3,11 +3,21 @@
 
 extern void parse(const char *string);
 extern u8 *cmd_parse(u8 *c);
+#ifdef NAGI_ENABLE_LLM
+extern void parse_speculate(const char *line);
+extern u32 parse_llm_ms;	// what extracting the current input took, ms
+#endif
+extern void parse_dict_init(const u8 *data, u32 size);
+extern void parse_dict_free(void);
 
 
 extern u16 word_num[10];
 extern const char *word_string[10];
 extern u16 word_total;	// bad word
+extern u8 word_seen[32];
+
+// could the word be in the input.. a bit per word number, folded to 256 bits
+#define WORD_SEEN(num) ((word_seen[((num) >> 3) & 31] >> ((num) & 7)) & 1)
 extern u8 *words_tok_data;
 
 #endif /* NAGI_UI_PARSE_H */
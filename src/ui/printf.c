@@ -85,7 +85,16 @@ void agi_printf(const char *var8, ...)
 
 	while (al != 0)
 	{
-		if ( al != '%')
+		if ( (al != '%') && (format_to_string == 0) && (format_char_utf8_state == UTF8_ACCEPT) )
+		{
+			// the text up to the next format goes out in one go
+			const char *run = si - 1;
+
+			while ( (*si != 0) && (*si != '%') )
+				si++;
+			window_put_string(run, si - run);
+		}
+		else if ( al != '%')
 			format_char(al);
 		else
 		{
@@ -143,9 +152,17 @@ void agi_printf(const char *var8, ...)
 
 static void format_string_ax(const char *str)
 {
+	const unsigned char *p;
+	int has_utf8;
+
+	if (format_to_string == 0) {
+		window_put_string(str, strlen(str));
+		return;
+	}
+
 	/* Check if string contains UTF-8 multibyte sequences */
-	const unsigned char *p = (const unsigned char *)str;
-	int has_utf8 = 0;
+	p = (const unsigned char *)str;
+	has_utf8 = 0;
 	while (*p) {
 		if (*p > 127) {
 			has_utf8 = 1;
@@ -9,6 +9,7 @@ CmdStatusLineOn                  cseg     00003547 00000015
 CmdStatusLneOff                  cseg     0000355C 0000001F
 */
 
+#include <stdio.h>
 #include <string.h>
 
 #include "../agi.h"
@@ -45,6 +46,18 @@ static INVENT *invent_swap_colour(INVENT *item_cur, INVENT *item_new);
 
 static u16 invent_state = 0;
 
+// what status_line_write() last put on the line, so a cycle only redraws
+// the field that changed
+static u16 status_drawn = 0;
+static u16 status_drawn_row = 0;
+static u8 status_drawn_score = 0;
+static u8 status_drawn_max = 0;
+static u8 status_drawn_sound = 0;
+static u16 status_score_len = 0;	// chars after "Score:" col
+
+static u16 status_score_put(u8 score, u8 max);
+static void status_sound_put(u8 sound);
+
 /*
 u8 *cmd_status(u8 *c)
 {
@@ -261,19 +274,68 @@ void status_line_write()
 	push_row_col();
 	text_attrib_push();
 
+	status_drawn = 0;
 	if (state.status_state != 0)
 	{
 		window_line_clear(state.status_line_row, 0xFF);	// clear the line at row word5db
 		text_colour(0, 0x0F);
 
-		goto_row_col(state.status_line_row, 1);
-		agi_printf("Score:%d of %d", state.var[V03_SCORE], state.var[V07_MAXSCORE]);
-		goto_row_col(state.status_line_row, 0x1E);
+		status_score_len = status_score_put(state.var[V03_SCORE], state.var[V07_MAXSCORE]);
+		status_sound_put(flag_test(F09_SOUND) != 0);
+
+		status_drawn = 1;
+		status_drawn_row = state.status_line_row;
+		status_drawn_score = state.var[V03_SCORE];
+		status_drawn_max = state.var[V07_MAXSCORE];
+		status_drawn_sound = flag_test(F09_SOUND) != 0;
+	}
+
+	text_attrib_pop();
+	pop_row_col();
+	ch_update();
+}
+
+// once a cycle.  redraws only what's different from the line on screen
+void status_line_update()
+{
+	u16 len;
+	u8 sound;
+
+	if (state.status_state == 0)
+		return;
+	if ( (status_drawn == 0) || (status_drawn_row != state.status_line_row) )
+	{
+		status_line_write();
+		return;
+	}
+
+	sound = flag_test(F09_SOUND) != 0;
+	if ( (status_drawn_score == state.var[V03_SCORE]) &&
+		(status_drawn_max == state.var[V07_MAXSCORE]) &&
+		(status_drawn_sound == sound) )
+		return;
 
-		if (flag_test(F09_SOUND) == 0)
-			agi_printf("Sound:%s", "off");
-		else
-			agi_printf("Sound:%s", "on");
+	push_row_col();
+	text_attrib_push();
+	text_colour(0, 0x0F);
+
+	if ( (status_drawn_score != state.var[V03_SCORE]) ||
+		(status_drawn_max != state.var[V07_MAXSCORE]) )
+	{
+		len = status_score_put(state.var[V03_SCORE], state.var[V07_MAXSCORE]);
+		if (len < status_score_len)	// a shorter score leaves old digits
+			window_clear(status_drawn_row, 1 + len, status_drawn_row, status_score_len, 0xFF);
+		status_score_len = len;
+		status_drawn_score = state.var[V03_SCORE];
+		status_drawn_max = state.var[V07_MAXSCORE];
+	}
+
+	if (status_drawn_sound != sound)
+	{
+		if (sound != 0)	// "on" is shorter than "off"
+			window_clear(status_drawn_row, 0x1E + 8, status_drawn_row, 0x1E + 8, 0xFF);
+		status_sound_put(sound);
+		status_drawn_sound = sound;
 	}
 
 	text_attrib_pop();
@@ -281,6 +343,26 @@ void status_line_write()
 	ch_update();
 }
 
+// returns the length printed
+static u16 status_score_put(u8 score, u8 max)
+{
+	char msg[40];
+
+	sprintf(msg, "Score:%d of %d", score, max);
+	goto_row_col(state.status_line_row, 1);
+	agi_printf("%s", msg);
+	return strlen(msg);
+}
+
+static void status_sound_put(u8 sound)
+{
+	goto_row_col(state.status_line_row, 0x1E);
+	if (sound == 0)
+		agi_printf("Sound:%s", "off");
+	else
+		agi_printf("Sound:%s", "on");
+}
+
 u8 *cmd_status_line_on(u8 *c)
 {
 	state.status_state = 1;
@@ -291,6 +373,7 @@ u8 *cmd_status_line_on(u8 *c)
 u8 *cmd_status_line_off(u8 *c)
 {
 	state.status_state = 0;
+	status_drawn = 0;
 	window_line_clear(state.status_line_row, 0);
 	ch_update();
 	return c;
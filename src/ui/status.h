@@ -4,6 +4,7 @@
 extern u8 *cmd_status(u8 *c);
 
 extern void status_line_write(void);
+extern void status_line_update(void);
 extern u8 *cmd_status_line_on(u8 *c);
 extern u8 *cmd_status_line_off(u8 *c); 
 
@@ -23,6 +23,8 @@ _Char0x80Read                    cseg     00002C55 00000025
 
 #include "../sys/chargen.h"
 
+#include "../lib/utf8_decode.h"
+
 u8 window_col = 0;	// set by messagebox so it wrap inside the window
 u8 window_row = 0;
 
@@ -34,6 +36,32 @@ u16 text_shade = 0;	// if set, text is shaded
 
 #define TEXT_INVERT 0x1
 #define TEXT_SHADE 0x2
+
+static void window_attrib(void)
+{
+	u8 conversion = 0;
+
+	if (chgen_textmode == 0)	// if not graphical
+	{
+		if ((state.text_comb & 0x80) != 0)	// invert character
+			conversion = conversion | TEXT_INVERT;
+		if (text_shade != 0)	// disabled item
+			conversion = conversion | TEXT_SHADE;
+	}
+
+	// TODO: fix this one day
+	/*
+	Bitfields for character's display attribute:
+	Bit(s)	Description	(Table 00014)
+	 7	foreground blink or (alternate) background bright (see also AX=1003h)
+	 6-4	background color (see #00015)
+	 3	foreground bright or (alternate) alternate character set (see AX=1103h)
+	 2-0	foreground color (see #00015)
+	*/
+
+	ch_attrib(state.text_comb, conversion);
+}
+
 // if char position isn't within window, move it there?
 // Now supports Unicode codepoints (> 255) when using TTF rendering
 void window_put_char(u32 given_char)
@@ -41,8 +69,6 @@ void window_put_char(u32 given_char)
 	//u16 temp;
 	TPOS char_pos;
 	//u8 x,  y;	
-	u8 bl;
-	u8 conversion = 0;
 
 	ch_pos_get(&char_pos);
 	
@@ -69,31 +95,7 @@ void window_put_char(u32 given_char)
 	else
 	{
 		// normal character
-		bl = state.text_comb;
-		
-		if (chgen_textmode == 0)	// if not graphical
-		{
-			if ((state.text_comb & 0x80) != 0)	// invert character
-				conversion = conversion | TEXT_INVERT;
-			if (text_shade != 0)	// disabled item
-				conversion = conversion | TEXT_SHADE;
-			
-			// load up an individual character
-			
-			bl = state.text_comb & 0x7F;	// turn off invert bit
-		}
-		
-		// TODO: fix this one day
-		/*
-		Bitfields for character's display attribute:
-		Bit(s)	Description	(Table 00014)
-		 7	foreground blink or (alternate) background bright (see also AX=1003h)
-		 6-4	background color (see #00015)
-		 3	foreground bright or (alternate) alternate character set (see AX=1103h)
-		 2-0	foreground color (see #00015)
-		*/
-
-		ch_attrib(state.text_comb, conversion);
+		window_attrib();
 		ch_put(given_char);
 	
 		char_pos.col++;
@@ -106,6 +108,84 @@ void window_put_char(u32 given_char)
 	}
 }
 
+// draw a run that's all on one row
+static void window_put_run(const u32 *run, u16 total)
+{
+	TPOS char_pos;
+
+	if (total == 0)
+		return;
+	ch_pos_get(&char_pos);
+	window_attrib();
+	ch_put_string(run, total);
+
+	char_pos.col += total;
+	if (char_pos.col <= 39)
+		ch_pos_set(&char_pos);
+	else
+		window_put_char(0xD);	// carriage return
+}
+
+// same as window_put_char for every character of a utf-8 string but
+// printable characters go out a row at a time
+void window_put_string(const char *str, u16 len)
+{
+	u32 run[40];
+	u16 run_len = 0;
+	u16 run_max = 0;
+	TPOS char_pos;
+	u32 state_utf8 = UTF8_ACCEPT;
+	u32 prev_state;
+	u32 codepoint = 0;
+	u32 byte;
+
+	while (len != 0)
+	{
+		byte = (u8)*(str++);
+		len--;
+		prev_state = state_utf8;
+
+		if (utf8_decode(&state_utf8, &codepoint, byte) != UTF8_ACCEPT)
+		{
+			if (state_utf8 != UTF8_REJECT)
+				continue;	// more to come
+			// not utf-8.  a bad lead byte goes out as it is
+			state_utf8 = UTF8_ACCEPT;
+			if (prev_state != UTF8_ACCEPT)
+			{
+				// a broken sequence, try the byte again on its own
+				str--;
+				len++;
+				continue;
+			}
+			codepoint = byte;
+		}
+
+		if ( (codepoint == 0x08) || (codepoint == 0x0D) || (codepoint == 0x0A) )
+		{
+			window_put_run(run, run_len);
+			run_len = 0;
+			window_put_char(codepoint);
+			continue;
+		}
+
+		if (run_len == 0)
+		{
+			ch_pos_get(&char_pos);
+			run_max = (char_pos.col <= 39) ? (40 - char_pos.col) : 1;
+		}
+		run[run_len++] = codepoint;
+		if (run_len >= run_max)
+		{
+			window_put_run(run, run_len);
+			run_len = 0;
+		}
+	}
+
+	if (run_len != 0)
+		window_put_run(run, run_len);
+}
+
 // dh = row / y
 // dl = col / x
 
@@ -1,8 +1,44 @@
+/*
+CRC32 of the game files for detection
+
+the byte at a time table is the reference.  every file of every game gets
+hashed so it goes 8 bytes a step with the slice-by-8 tables built from it,
+or with the cpu's own: the ARMv8 crc32 instructions use this polynomial,
+SSE4.2's crc32 doesn't (it's CRC32C) so x86 folds 64 bytes a step with
+PCLMULQDQ instead.  which one is picked when it's first used, and only if
+it agrees with the table.
+*/
+
 #include "../agi.h"
 #include "../res/res.h"
+#include "agi_crc.h"
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define CRC_PCLMUL 1
+#include <immintrin.h>
+#define CRC_PCLMUL_TARGET __attribute__((target("pclmul,sse4.1")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define CRC_PCLMUL 1
+#include <intrin.h>
+#include <immintrin.h>
+#define CRC_PCLMUL_TARGET
+#endif
+
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define CRC_ARM 1
+#include <arm_acle.h>
+#define CRC_ARM_TARGET
+#elif defined(__aarch64__) && defined(__linux__) && defined(__GNUC__)
+#define CRC_ARM 1
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#define CRC_ARM_TARGET __attribute__((target("+crc")))
+#endif
 
 
 static u32 crctable[256] =
@@ -76,14 +112,207 @@ static u32 crctable[256] =
 #define CRC_INIT_REFLECT 0xFFFFFFFF
 #define CRC_XOROT 0xFFFFFFFF
 
-u32 crc_generate(u8 *data, int size)
-{	
-	u32 crc = CRC_INIT_REFLECT;
+// crc register in, crc register out (not inverted)
+typedef u32 (*CRC_UPDATE)(u32 crc, const u8 *data, size_t size);
+
+static u32 crc_slice[8][256];
+static CRC_UPDATE crc_update = 0;
+
+static u32 crc_bytes(u32 crc, const u8 *data, size_t size)
+{
 	while (size--)
 		crc = crctable[(crc ^ *data++) & 0xFFL] ^ (crc >> 8);
-	return crc ^ CRC_XOROT;
+	return crc;
+}
+
+static u32 crc_slice8(u32 crc, const u8 *data, size_t size)
+{
+	u32 one, two;
+
+	while (size >= 8)
+	{
+		one = crc ^ ((u32)data[0] | ((u32)data[1] << 8) | ((u32)data[2] << 16) | ((u32)data[3] << 24));
+		two = (u32)data[4] | ((u32)data[5] << 8) | ((u32)data[6] << 16) | ((u32)data[7] << 24);
+		crc = crc_slice[7][one & 0xFF] ^ crc_slice[6][(one >> 8) & 0xFF] ^
+			crc_slice[5][(one >> 16) & 0xFF] ^ crc_slice[4][one >> 24] ^
+			crc_slice[3][two & 0xFF] ^ crc_slice[2][(two >> 8) & 0xFF] ^
+			crc_slice[1][(two >> 16) & 0xFF] ^ crc_slice[0][two >> 24];
+		data += 8;
+		size -= 8;
+	}
+	return crc_bytes(crc, data, size);
+}
+
+#ifdef CRC_ARM
+CRC_ARM_TARGET
+static u32 crc_arm(u32 crc, const u8 *data, size_t size)
+{
+	u64 word;
+
+	while ( (size != 0) && (((size_t)data & 7) != 0) )
+	{
+		crc = __crc32b(crc, *data++);
+		size--;
+	}
+	while (size >= 8)
+	{
+		memcpy(&word, data, 8);
+		crc = __crc32d(crc, word);
+		data += 8;
+		size -= 8;
+	}
+	while (size--)
+		crc = __crc32b(crc, *data++);
+	return crc;
+}
+
+static int crc_arm_has(void)
+{
+#ifdef __ARM_FEATURE_CRC32
+	return 1;
+#else
+	return (getauxval(AT_HWCAP) & HWCAP_CRC32) != 0;
+#endif
+}
+#endif
+
+#ifdef CRC_PCLMUL
+// folding constants for the reflected polynomial 0xEDB88320 (x^n mod P),
+// see Intel's "Fast CRC Computation for Generic Polynomials Using PCLMULQDQ"
+CRC_PCLMUL_TARGET
+static u32 crc_pclmul(u32 crc, const u8 *data, size_t size)
+{
+	__m128i x1, x2, x3, x4, x5, x6, x7, x8;
+	__m128i k1k2, k3k4, k5k0, poly, mask;
+	size_t done;
+
+	if (size < 64)
+		return crc_slice8(crc, data, size);
+
+	k1k2 = _mm_set_epi64x(0x01C6E41596LL, 0x0154442BD4LL);
+	k3k4 = _mm_set_epi64x(0x00CCAA009ELL, 0x01751997D0LL);
+	k5k0 = _mm_set_epi64x(0, 0x0163CD6124LL);
+	poly = _mm_set_epi64x(0x01F7011641LL, 0x01DB710641LL);
+	mask = _mm_setr_epi32(-1, 0, -1, 0);
+
+	x1 = _mm_loadu_si128((const __m128i *)(data + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(data + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(data + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(data + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+	done = 64;
+
+	// four lanes of 128 bits, 64 bytes a step
+	while (size - done >= 64)
+	{
+		x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)(data + done + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *)(data + done + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *)(data + done + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *)(data + done + 0x30)));
+		done += 64;
+	}
+
+	// the four into one
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+	x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+
+	while (size - done >= 16)
+	{
+		x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, _mm_loadu_si128((const __m128i *)(data + done))), x5);
+		done += 16;
+	}
+
+	// 128 bits down to 64
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, mask);
+	x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+
+	// barrett reduction to 32
+	x2 = _mm_and_si128(x1, mask);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+	x2 = _mm_and_si128(x2, mask);
+	x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+	x1 = _mm_xor_si128(x1, x2);
+	crc = (u32)_mm_extract_epi32(x1, 1);
+
+	return crc_bytes(crc, data + done, size - done);
+}
+
+static int crc_pclmul_has(void)
+{
+#ifdef _MSC_VER
+	int info[4];
+
+	__cpuid(info, 1);
+	return ((info[2] & (1 << 1)) != 0) && ((info[2] & (1 << 19)) != 0);
+#else
+	return __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1");
+#endif
 }
+#endif
 
+// the fastest that gives the same answer as the table, odd lengths and
+// alignments included
+static int crc_check(CRC_UPDATE update)
+{
+	u8 data[1024 + 7];
+	size_t i;
 
+	for (i = 0; i < sizeof(data); i++)
+		data[i] = (u8)(i * 167 + (i >> 3));
+	for (i = 0; i < 8; i++)
+		if (update(CRC_INIT_REFLECT, data + i, sizeof(data) - 7 - i * 13) !=
+				crc_bytes(CRC_INIT_REFLECT, data + i, sizeof(data) - 7 - i * 13))
+			return 0;
+	return 1;
+}
 
+static void crc_pick(void)
+{
+	int i, n;
 
+	for (n = 0; n < 256; n++)
+		crc_slice[0][n] = crctable[n];
+	for (i = 1; i < 8; i++)
+		for (n = 0; n < 256; n++)
+			crc_slice[i][n] = (crc_slice[i-1][n] >> 8) ^ crctable[crc_slice[i-1][n] & 0xFF];
+
+	crc_update = crc_bytes;
+	if (crc_check(crc_slice8))
+		crc_update = crc_slice8;
+#ifdef CRC_ARM
+	if (crc_arm_has() && crc_check(crc_arm))
+		crc_update = crc_arm;
+#endif
+#ifdef CRC_PCLMUL
+	if (crc_pclmul_has() && crc_check(crc_pclmul))
+		crc_update = crc_pclmul;
+#endif
+}
+
+u32 crc_generate(const u8 *data, size_t size)
+{	
+	if (crc_update == 0)
+		crc_pick();
+	return crc_update(CRC_INIT_REFLECT, data, size) ^ CRC_XOROT;
+}
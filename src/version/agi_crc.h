@@ -4,6 +4,6 @@
 /* STRUCTURES	---	---	---	---	---	---	--- */
 /* VARIABLES	---	---	---	---	---	---	--- */
 /* FUNCTIONS	---	---	---	---	---	---	--- */
-extern u32 crc_generate(u8 *data, int size);
+extern u32 crc_generate(const u8 *data, size_t size);
 
 #endif /* NAGI_VERSION_AGI_CRC_H */
@@ -22,6 +22,8 @@
 #ifdef _WIN32
 #include <Windows.h>
 #include <direct.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 #else
 #include <unistd.h>
 #include <dirent.h>
@@ -50,6 +52,8 @@
 
 #include "../sys/drv_video.h"
 #include "../sys/gfx.h"
+#include "../sys/startup.h"
+#include "../sys/zip_mount.h"
 
 /* PROTOTYPES	---	---	---	---	---	---	--- */
 //void test_function(void);
@@ -66,6 +70,7 @@ struct gameinfo_struct
 	
 	const char *standard;
 	char file_id[ID_SIZE+1];
+	u32 crc;	// all the file crc's folded, the same release gives the same one
 	u8 dir_type;
 	u8 ver_type;	// used to pick defaults
 };
@@ -93,37 +98,377 @@ struct agicrc_struct
 };
 typedef struct agicrc_struct AGICRC;
 
+// a file's crc from an earlier run.  it's good as long as the file's
+// size and modification time are still the same
+struct crc_cache_struct
+{
+	char *path;	// 0 if the slot's free
+	u32 hash;
+	u64 size;
+	s64 mtime;
+	u32 crc;
+	u8 valid;	// crc goes with that size and time
+	u8 used;	// looked up this run, so it's kept
+};
+typedef struct crc_cache_struct CRC_CACHE;
+
+#define CRC_CACHE_FILE "nagi_crc.cache"
+
+// a directory that might hold a game, identified on one of the scan threads.
+// nothing there depends on the current directory, they'd all share it
+struct gamedir_struct
+{
+	char *path;
+	char *dir_sub;	// its name in dir
+	const char *dir;	// the dir_list entry it's in
+	char **files;	// what's in it, read once
+	int file_count;
+	ZIP *zip;	// or it's a zip with the game in it
+	AGICRC agicrc;
+	GAMEINFO info;
+	int found;
+};
+typedef struct gamedir_struct GAMEDIR;
+
+// directories identified at once, mostly waiting on the disk (or network)
+#define SCAN_THREADS_MAX 8
+
 /* VARIABLES	---	---	---	---	---	---	--- */
 
+static CRC_CACHE *crc_cache = 0;
+static u32 crc_cache_size = 0;	// slots, a power of two
+static u32 crc_cache_count = 0;
+static u8 crc_cache_dirty = 0;
+static SDL_Mutex *crc_cache_lock = 0;	// the scan threads share it
+
+static GAMEDIR *scan_job = 0;
+static int scan_job_count = 0;
+static char *scan_dir_list = 0;
+static SDL_AtomicInt scan_next;
+static SDL_AtomicInt scan_done;
+static SDL_AtomicInt scan_found;
+
 
 /* CODE	---	---	---	---	---	---	---	--- */
 
 
+// ---------------------------------------- CRC CACHE ----------------------------------------
+
+// reading every file of every game on dir_list is what makes startup slow
+// with a big collection.  the crc's are kept in a file next to standard.ini:
+//   crc size mtime path
+// one per line.  only the files looked at this run are written back.
+
+static u32 crc_cache_hash(const char *path)
+{
+	u32 hash = 2166136261u;
+
+	while (*path != 0)
+		hash = (hash ^ (u8)*(path++)) * 16777619u;
+	return hash;
+}
+
+// the slot for a path.. either the one it's in or the free one it goes in
+static CRC_CACHE *crc_cache_slot(const char *path, u32 hash)
+{
+	CRC_CACHE *entry;
+	u32 i;
+
+	i = hash & (crc_cache_size - 1);
+	for (;;)
+	{
+		entry = &crc_cache[i];
+		if (entry->path == 0)
+			return entry;
+		if ( (entry->hash == hash) && (strcmp(entry->path, path) == 0) )
+			return entry;
+		i = (i + 1) & (crc_cache_size - 1);
+	}
+}
+
+// add a path if it's not there.  kept at most half full
+static CRC_CACHE *crc_cache_get(const char *path)
+{
+	CRC_CACHE *old, *entry;
+	u32 old_size, hash, i;
+
+	if (crc_cache_count * 2 >= crc_cache_size)
+	{
+		old = crc_cache;
+		old_size = crc_cache_size;
+		crc_cache_size = (old_size == 0) ? 256 : old_size * 2;
+		crc_cache = (CRC_CACHE *)a_malloc(crc_cache_size * sizeof(CRC_CACHE));
+		memset(crc_cache, 0, crc_cache_size * sizeof(CRC_CACHE));
+		for (i = 0; i < old_size; i++)
+			if (old[i].path != 0)
+				*crc_cache_slot(old[i].path, old[i].hash) = old[i];
+		if (old != 0)
+			a_free(old);
+	}
+
+	hash = crc_cache_hash(path);
+	entry = crc_cache_slot(path, hash);
+	if (entry->path == 0)
+	{
+		entry->path = (char *)a_malloc(strlen(path) + 1);
+		strcpy(entry->path, path);
+		entry->hash = hash;
+		crc_cache_count++;
+	}
+	return entry;
+}
+
+static void crc_cache_load(void)
+{
+	FILE *stream;
+	char line[4096];
+	char *path;
+	unsigned long crc;
+	unsigned long long size;
+	long long mtime;
+	int n;
+	CRC_CACHE *entry;
+
+	if (!c_nagi_crc_cache)
+		return;
+	// maybe on the startup task, so not relative to the working directory
+	snprintf(line, sizeof(line), "%s/%s", dir_preset_get(DIR_PRESET_NAGI), CRC_CACHE_FILE);
+	stream = fopen(line, "r");
+	if (stream == 0)
+		return;
+	while (fgets(line, sizeof(line), stream) != 0)
+	{
+		line[strcspn(line, "\r\n")] = 0;
+		n = 0;
+		if ( (sscanf(line, "%lx %llu %lld %n", &crc, &size, &mtime, &n) != 3) || (n == 0) )
+			continue;
+		path = line + n;
+		if (*path == 0)
+			continue;
+		entry = crc_cache_get(path);
+		entry->crc = (u32)crc;
+		entry->size = (u64)size;
+		entry->mtime = (s64)mtime;
+		entry->valid = 1;
+	}
+	fclose(stream);
+}
+
+static void crc_cache_save(void)
+{
+	FILE *stream;
+	u32 i;
+
+	if (crc_cache_dirty)
+	{
+		stream = fopen(CRC_CACHE_FILE, "w");
+		if (stream != 0)
+		{
+			for (i = 0; i < crc_cache_size; i++)
+				if ( (crc_cache[i].path != 0) && crc_cache[i].valid && crc_cache[i].used )
+					fprintf(stream, "%08X %llu %lld %s\n", (unsigned int)crc_cache[i].crc,
+						(unsigned long long)crc_cache[i].size,
+						(long long)crc_cache[i].mtime, crc_cache[i].path);
+			fclose(stream);
+		}
+	}
+
+	for (i = 0; i < crc_cache_size; i++)
+		if (crc_cache[i].path != 0)
+			a_free(crc_cache[i].path);
+	if (crc_cache != 0)
+		a_free(crc_cache);
+	crc_cache = 0;
+	crc_cache_size = 0;
+	crc_cache_count = 0;
+	crc_cache_dirty = 0;
+}
+
+// the crc of a file that hasn't changed since it was cached.  returns 0 if
+// it's not there or the file's changed
+static int crc_cache_lookup(const char *path, u64 size, s64 mtime, u32 *crc)
+{
+	CRC_CACHE *entry;
+	int found;
+
+	SDL_LockMutex(crc_cache_lock);
+	entry = crc_cache_get(path);
+	found = entry->valid && (entry->size == size) && (entry->mtime == mtime);
+	if (found)
+		*crc = entry->crc;
+	if (!entry->used)
+		crc_cache_dirty = 1;	// not used last time, or new
+	entry->used = 1;
+	SDL_UnlockMutex(crc_cache_lock);
+	return found;
+}
+
+static void crc_cache_store(const char *path, u64 size, s64 mtime, u32 crc)
+{
+	CRC_CACHE *entry;
+
+	SDL_LockMutex(crc_cache_lock);
+	entry = crc_cache_get(path);
+	entry->size = size;
+	entry->mtime = mtime;
+	entry->crc = crc;
+	entry->valid = 1;
+	entry->used = 1;
+	crc_cache_dirty = 1;
+	SDL_UnlockMutex(crc_cache_lock);
+}
+
 // ---------------------------------------- LIST INIT ----------------------------------------
 
-// generate a crc from a file
-static int file_crc_gen(const char *file_name, u32 *crc32)
+// read what's in a directory (or zip).  returns 0 if it's not one
+static int gamedir_list(GAMEDIR *gd)
+{
+	struct dir_list_struct *dir;
+	const char *name;
+	int size, i;
+
+	if (zip_path(gd->path))
+	{
+		gd->zip = zip_open(gd->path);
+		if (gd->zip == 0)
+			return 0;
+		gd->file_count = zip_count(gd->zip);
+		gd->files = (char **)realloc(gd->files, ((size_t)gd->file_count + 1) * sizeof(char *));
+		for (i = 0; i < gd->file_count; i++)
+			gd->files[i] = a_strdup(zip_name(gd->zip, i));
+		return 1;
+	}
+
+	dir = agi_open_dir(gd->path);
+	if (dir == 0)
+		return 0;
+	size = 0;
+	while ( (name = agi_read_dir(dir)) != 0 )
+	{
+		if (name[0] == '.')
+			continue;
+		if (gd->file_count == size)
+		{
+			size = (size == 0) ? 32 : size * 2;
+			gd->files = (char **)realloc(gd->files, (size_t)size * sizeof(char *));
+		}
+		gd->files[gd->file_count] = (char *)a_malloc(strlen(name) + 1);
+		strcpy(gd->files[gd->file_count++], name);
+	}
+	agi_close_dir(dir);
+	return 1;
+}
+
+static void gamedir_free(GAMEDIR *gd)
+{
+	int i;
+
+	for (i = 0; i < gd->file_count; i++)
+		a_free(gd->files[i]);
+	free(gd->files);
+	a_free(gd->path);
+	a_free(gd->dir_sub);
+	zip_close(gd->zip);
+	gd->files = 0;
+	gd->file_count = 0;
+	gd->zip = 0;
+}
+
+// open a file in the directory whatever the case of its name
+static FILE *gamedir_open(GAMEDIR *gd, const char *file_name, char **path)
+{
+	FILE *stream;
+	int i;
+
+	for (i = 0; i < gd->file_count; i++)
+		if (strcasecmp(gd->files[i], file_name) == 0)
+			break;
+	if (i == gd->file_count)
+		return 0;
+	*path = (char *)a_malloc(strlen(gd->path) + strlen(gd->files[i]) + 2);
+	sprintf(*path, "%s/%s", gd->path, gd->files[i]);
+	stream = fopen(*path, "rb");
+	if (stream == 0)
+	{
+		a_free(*path);
+		*path = 0;
+	}
+	return stream;
+}
+
+// generate a crc from a file, straight from the mapped file if it can be
+static int file_crc_gen(GAMEDIR *gd, const char *file_name, u32 *crc32)
 {
 	u8 *buf;
+	size_t size;
+	FILE *stream;
+	char *path;
+	u64 file_size;
+	s64 file_mtime;
+	int cache;
+#ifdef _WIN32
+	struct _stat64 st;
+#else
+	struct stat st;
+#endif
 	
+	assert(gd != 0);
 	assert(file_name != 0);
 	assert(crc32 != 0);
 	
-	buf = file_to_buf(file_name);
+	*crc32 = 0;
+	// the archive has them already
+	if (gd->zip != 0)
+		return zip_crc(gd->zip, file_name, crc32) ? 0 : 1;
+
+	stream = gamedir_open(gd, file_name, &path);
+	if (stream == 0)
+		return 1;
+
+#ifdef _WIN32
+	cache = c_nagi_crc_cache && (_fstat64(_fileno(stream), &st) == 0);
+#else
+	cache = c_nagi_crc_cache && (fstat(fileno(stream), &st) == 0);
+#endif
+	file_size = cache ? (u64)st.st_size : 0;
+	file_mtime = cache ? (s64)st.st_mtime : 0;
+	if (cache && crc_cache_lookup(path, file_size, file_mtime, crc32))
+	{
+		fclose(stream);
+		a_free(path);
+		return 0;
+	}
 	
-	if (buf == 0)
+	buf = file_map(stream, &size);
+	if (buf != 0)
 	{
-		*crc32 = 0;
-		return 1;
+		// generate crc	
+		*crc32 = crc_generate(buf, size);
+		file_unmap(buf, size);
 	}
 	else
 	{
-		// generate crc	
-		*crc32 = crc_generate(buf, file_buf_size);
-		
+		// empty, or it can't be mapped
+		fseek(stream, 0, SEEK_END);
+		size = (size_t)ftell(stream);
+		fseek(stream, 0, SEEK_SET);
+		buf = (u8 *)a_malloc(size + 1);
+		if (fread(buf, 1, size, stream) != size)
+		{
+			a_free(buf);
+			fclose(stream);
+			a_free(path);
+			return 1;
+		}
+		*crc32 = crc_generate(buf, size);
 		a_free(buf);
-		return 0;
 	}
+	fclose(stream);
+
+	if (cache)
+		crc_cache_store(path, file_size, file_mtime, *crc32);
+	a_free(path);
+	return 0;
 }
 
 
@@ -156,62 +501,56 @@ static void stand_rejoin(void)
 // read the crc/game type/directory type and determine if the game is a proper agi game
 // 0 = ok
 // anything else is a failure
-static int dir_get_info(AGICRC *agicrc, GAMEINFO *info)
+static int dir_get_info(GAMEDIR *gd)
 {
+	AGICRC *agicrc;
+	GAMEINFO *info;
 	int i;
 	char name[ID_SIZE + 20];
 	
-	assert(agicrc != 0);
-	assert(info != 0);
+	assert(gd != 0);
+	agicrc = &gd->agicrc;
+	info = &gd->info;
 	
 	// search for object
-	if (file_crc_gen("object", &agicrc->object) != 0)
+	if (file_crc_gen(gd, "object", &agicrc->object) != 0)
 		return 1;	// NO OBJECT
 	
 	// search for words.tok
-	if (file_crc_gen("words.tok", &agicrc->words) != 0)
+	if (file_crc_gen(gd, "words.tok", &agicrc->words) != 0)
 		return 2;	// NO WORDS.TOK
 	
 	// search for vol.0
-	if (file_crc_gen("vol.0", &agicrc->vol[0]) == 0)
+	if (file_crc_gen(gd, "vol.0", &agicrc->vol[0]) == 0)
 		info->file_id[0] = 0;	// if found then no file FILEID  
 	// else search for FILEIDvol.0
 	// if found set file_id (from func)
 	else
 	{
 		char fname[DOS_FILE_MAX + 1];
-		struct dir_list_struct *dir;
 		char *tail;
 		int ok = 0;
 		
-		dir = agi_open_cwd();
-		if (dir != 0) 
+		for (i = 0; i < gd->file_count; i++)
 		{
-			for (;;) 
-			{
-				const char *fname_orig = agi_read_dir(dir);
-
-				if (fname_orig == 0) { continue; }
-				if (strlen(fname_orig) > DOS_FILE_MAX) { continue; }
+			const char *fname_orig = gd->files[i];
 
-				strcpy(fname, fname_orig);
-				string_lower(fname);
+			if (strlen(fname_orig) > DOS_FILE_MAX) { continue; }
 
-				tail = strstr(fname, "vol.0");	// get id
+			strcpy(fname, fname_orig);
+			string_lower(fname);
 
-				if (tail == 0) { continue; }
-				if ((fname - tail) > ID_SIZE) { continue; }
+			tail = strstr(fname, "vol.0");	// get id
 
-				if (file_crc_gen(fname_orig, &agicrc->vol[0]) != 0) { continue; }
-				
-				tail[0] = 0;
-				strcpy(info->file_id, fname);
-				ok = 1;
-				break;
-			}
+			if (tail == 0) { continue; }
+			if ((fname - tail) > ID_SIZE) { continue; }
 
-			agi_close_dir(dir);
-			dir = 0;
+			if (file_crc_gen(gd, fname_orig, &agicrc->vol[0]) != 0) { continue; }
+			
+			tail[0] = 0;
+			strcpy(info->file_id, fname);
+			ok = 1;
+			break;
 		}
 
 		if (!ok)
@@ -219,17 +558,17 @@ static int dir_get_info(AGICRC *agicrc, GAMEINFO *info)
 	}
 	
 	// search for logdir, snddir, viewdir, picdir
-	if ( (file_crc_gen("logdir", &agicrc->dir.log) |
-		file_crc_gen("snddir", &agicrc->dir.snd) |
-		file_crc_gen("viewdir", &agicrc->dir.view) |
-		file_crc_gen("picdir", &agicrc->dir.pic)) == 0) 
+	if ( (file_crc_gen(gd, "logdir", &agicrc->dir.log) |
+		file_crc_gen(gd, "snddir", &agicrc->dir.snd) |
+		file_crc_gen(gd, "viewdir", &agicrc->dir.view) |
+		file_crc_gen(gd, "picdir", &agicrc->dir.pic)) == 0) 
 	{
 		// if found then 4 dirs
 			info->dir_type = DIR_SEP;
 			info->ver_type = 2;
 	}
 	// else search for dirs
-	else if (file_crc_gen("dirs", &agicrc->dir_comb) == 0)
+	else if (file_crc_gen(gd, "dirs", &agicrc->dir_comb) == 0)
 	{
 		info->dir_type = DIR_AMIGA; // if found then amiga v3 dir
 		info->ver_type = 3;
@@ -238,7 +577,7 @@ static int dir_get_info(AGICRC *agicrc, GAMEINFO *info)
 	{
 		// else search for FILEIDdir
 		sprintf(name, "%sdir", info->file_id);
-		if (file_crc_gen(name, &agicrc->dir_comb) == 0)
+		if (file_crc_gen(gd, name, &agicrc->dir_comb) == 0)
 		{
 			info->ver_type = 3;
 			info->dir_type = DIR_COMB;
@@ -252,7 +591,7 @@ static int dir_get_info(AGICRC *agicrc, GAMEINFO *info)
 	for (i=1; i<=15; i++)
 	{
 		sprintf(name, "%svol.%d", info->file_id, i);
-		file_crc_gen(name, &(agicrc->vol[i]));
+		file_crc_gen(gd, name, &(agicrc->vol[i]));
 	}
 	
 	return 0; 	// everything ok.
@@ -374,6 +713,18 @@ static int crc_compare(AGICRC *agicrc, GAMEINFO *info, INI *ini)
 
 #undef CRC_FUDGE
 
+// one number for the game's files, whether standard.ini knows them or not
+static u32 crc_fold(AGICRC *agicrc)
+{
+	const u32 *crc = (const u32 *)agicrc;
+	u32 fold = 2166136261u;
+	int i;
+	
+	for (i=0; i<(int)(sizeof(AGICRC)/sizeof(u32)); i++)
+		fold = (fold ^ crc[i]) * 16777619u;
+	return fold;
+}
+
 // open up each section on the list and compare available crc's with one's calculated before
 // return pointer to section in section list if a match is found.
 static const char *crc_search(AGICRC *agicrc, GAMEINFO *info, INI *ini)
@@ -456,75 +807,100 @@ static void gameinfo_namegen(GAMEINFO *info, INI *ini, const char *dir_sub, cons
 	stand_rejoin();
 }
 
-static int game_count = 0;
 
+// identify the directories on the list until there's none left
+static int scan_main(void *data)
+{
+	GAMEDIR *gd;
+	int i;
+
+	(void)data;
+	for (;;)
+	{
+		i = SDL_AddAtomicInt(&scan_next, 1);
+		if (i >= scan_job_count)
+			break;
+		gd = &scan_job[i];
+		if (gamedir_list(gd) && (dir_get_info(gd) == 0))
+		{
+			gd->found = 1;
+			SDL_AddAtomicInt(&scan_found, 1);
+		}
+		SDL_AddAtomicInt(&scan_done, 1);
+	}
+	return 0;
+}
 
-// create a new gameinfo struct for a given directory if a game exists in it.. 
-// called on for each dir
-static void gameinfo_add(LIST *list, INI *ini, const char *dir_sub, const char *dir)
+// join a dir_list entry to the directory it's relative to
+static char *scan_path(const char *base, const char *name)
+{
+	char *path;
+
+	if (base == 0)
+	{
+		path = (char *)a_malloc(strlen(name) + 1);
+		strcpy(path, name);
+		return path;
+	}
+	if (strcmp(name, ".") == 0)
+		return scan_path(0, base);
+	if ( (name[0] == '/') || (name[0] == '\\') || ((name[0] != 0) && (name[1] == ':')) )
+		return scan_path(0, name);
+	path = (char *)a_malloc(strlen(base) + strlen(name) + 2);
+	sprintf(path, "%s/%s", base, name);
+	return path;
+}
+
+// add a game that was found
+static void gameinfo_add(LIST *list, INI *ini, GAMEDIR *gd)
 {
-	AGICRC agicrc;
-	GAMEINFO info_new;
 	GAMEINFO *info;
-	char *msg = alloca(strlen("Games found: XXXXXXXXXXXX"));
 	
 	assert(list != 0);
 	
-	memset(&info_new, 0, sizeof(GAMEINFO) );
+	if (ini != 0)
+		gd->info.standard = crc_search(&gd->agicrc, &gd->info, ini);
+	gd->info.crc = crc_fold(&gd->agicrc);
 	
-	if (dir_get_info(&agicrc, &info_new) == 0)
-	{
-		if (ini != 0)
-			info_new.standard = crc_search(&agicrc, &info_new, ini);
-		
-		//if (standard == 0)
-		// don't worry... we'll just read the conf values.. don't have to dup strings all the time	
-		
-		// get directory
-		info_new.dir = vstring_new(0, 100);
-		vstring_getcwd(info_new.dir);
-		
-		// get name
-		gameinfo_namegen(&info_new, ini, dir_sub, dir);
+	//if (standard == 0)
+	// don't worry... we'll just read the conf values.. don't have to dup strings all the time	
+	
+	// get directory
+	gd->info.dir = vstring_new(gd->path, 100);
+	
+	// get name
+	gameinfo_namegen(&gd->info, ini, gd->dir_sub, gd->dir);
 
-		if (c_nagi_crc_print)
-		{
-			printf("%s\n-----------------------------------------\n", info_new.name);
-			crc_print(&agicrc, &info_new);
-			printf("\n");
-		}
-		
-		// if everything ok
-		// ADD TO LIST
-		info = list_add(list);
-		game_count++;
-		sprintf(msg, "Games found: %d", game_count);
-		message_box_draw(msg, 0, 0, 0);
-		memcpy( info, &info_new, sizeof(GAMEINFO) );
+	if (c_nagi_crc_print)
+	{
+		printf("%s\n-----------------------------------------\n", gd->info.name);
+		crc_print(&gd->agicrc, &gd->info);
+		printf("\n");
 	}
+	
+	// ADD TO LIST
+	info = list_add(list);
+	memcpy( info, &gd->info, sizeof(GAMEINFO) );
 }
 
-// create a list of game infos starting from gameinfo_head from the dirlist in standard.ini
-// search one level into it too if possible
-static void gi_list_init(LIST *list, INI *ini)
+// every directory in each dir on the dir_list is a job
+static void scan_jobs_collect(void)
 {
-	char *dir_list;
 	char *token, *running;
+	char *token_path;
 	struct dir_list_struct *dir; 
-	
-	assert(list != 0);
-
-	game_count = list_length(list);
-	
-	// for each dir
-	
-	dir_list = strdupa(c_nagi_dir_list);
-	token = strtok_r(dir_list, ";", (char**)&running);
+	int job_size;
+
+	scan_job = 0;
+	scan_job_count = 0;
+	job_size = 0;
+	// the jobs point into it until gi_list_init() is done with them
+	scan_dir_list = strdup(c_nagi_dir_list);
+	token = strtok_r(scan_dir_list, ";", (char**)&running);
 	while (token != 0)
 	{
-		dir_preset_change(DIR_PRESET_ORIG);
-		
-		dir = agi_open_cwd();
+		token_path = scan_path(dir_preset_get(DIR_PRESET_ORIG), token);
+		dir = agi_open_dir(token_path);
 		if (dir != 0)
 		{
 			for(;;)
@@ -534,23 +910,115 @@ static void gi_list_init(LIST *list, INI *ini)
 
 				if (strcmp(filename, "..") == 0) { continue; }
 
-				dir_preset_change(DIR_PRESET_ORIG);
-
-				if (chdir(token) != 0) { continue; }
-
-				if (!dir_exists(filename)) { continue; }
-				if (chdir(filename) != 0) { continue; }
-
-				//printf("trying %s\\%s...\n", token, ep->d_name);
-				gameinfo_add(list, ini, filename, token);
+				if (scan_job_count == job_size)
+				{
+					job_size = (job_size == 0) ? 64 : job_size * 2;
+					scan_job = (GAMEDIR *)realloc(scan_job, (size_t)job_size * sizeof(GAMEDIR));
+				}
+				memset(&scan_job[scan_job_count], 0, sizeof(GAMEDIR));
+				scan_job[scan_job_count].path = scan_path(token_path, filename);
+				scan_job[scan_job_count].dir_sub = scan_path(0, filename);
+				scan_job[scan_job_count].dir = token;
+				scan_job_count++;
 			} 
 			agi_close_dir(dir);
 		}
+		a_free(token_path);
 		
 		token = strtok_r(0, ";", (char**)&running);
 	}
-	
-	dir_preset_change(DIR_PRESET_ORIG);
+}
+
+// identify the jobs on a few threads.  with game_base >= 0 the number of
+// games found so far is shown while they work
+static void scan_run(int game_base)
+{
+	SDL_Thread *thread[SCAN_THREADS_MAX];
+	int thread_count, i, shown, found;
+	char *msg = alloca(strlen("Games found: XXXXXXXXXXXX"));
+
+	crc_cache_lock = SDL_CreateMutex();
+	SDL_SetAtomicInt(&scan_next, 0);
+	SDL_SetAtomicInt(&scan_done, 0);
+	SDL_SetAtomicInt(&scan_found, 0);
+	thread_count = 0;
+	while ( (thread_count < SCAN_THREADS_MAX) && (thread_count < scan_job_count) )
+	{
+		thread[thread_count] = SDL_CreateThread(scan_main, "nagi_scan", NULL);
+		if (thread[thread_count] == 0)
+			break;
+		thread_count++;
+	}
+	if (thread_count == 0)
+		scan_main(0);
+
+	shown = -1;
+	while (game_base >= 0)
+	{
+		found = SDL_GetAtomicInt(&scan_found);
+		if (found != shown)
+		{
+			if (found != 0)
+			{
+				sprintf(msg, "Games found: %d", game_base + found);
+				message_box_draw(msg, 0, 0, 0);
+			}
+			shown = found;
+		}
+		if (SDL_GetAtomicInt(&scan_done) >= scan_job_count)
+			break;
+		SDL_Delay(10);
+	}
+	for (i = 0; i < thread_count; i++)
+		SDL_WaitThread(thread[i], NULL);
+	SDL_DestroyMutex(crc_cache_lock);
+	crc_cache_lock = 0;
+}
+
+static int scan_task(void *data)
+{
+	(void)data;
+	crc_cache_load();
+	scan_jobs_collect();
+	scan_run(-1);
+	return 0;
+}
+
+// only needs nagi.ini's dir_list, the scan runs while the window and the
+// rest of nagi are set up.  standard_select_ng() waits for it
+void standard_scan_start(void)
+{
+	startup_task(STARTUP_TASK_SCAN, scan_task, 0);
+}
+
+// create a list of game infos starting from gameinfo_head from the dirlist in standard.ini
+// search one level into it too if possible.
+// every directory found is identified on a few threads, the list and the
+// ini are only touched here after
+static void gi_list_init(LIST *list, INI *ini)
+{
+	int i;
+
+	assert(list != 0);
+
+	if (!startup_task_wait(STARTUP_TASK_SCAN, 0))
+	{
+		crc_cache_load();
+		scan_jobs_collect();
+		scan_run(list_length(list));
+	}
+
+	for (i = 0; i < scan_job_count; i++)
+	{
+		if (scan_job[i].found)
+			gameinfo_add(list, ini, &scan_job[i]);
+		gamedir_free(&scan_job[i]);
+	}
+	free(scan_job);
+	scan_job = 0;
+	scan_job_count = 0;
+	free(scan_dir_list);
+	scan_dir_list = 0;
 }
 
 
@@ -717,10 +1185,31 @@ static void standard_init_ng(GAMEINFO *game, INI *ini)
 	
 	// read in file_id
 	strcpy(c_game_file_id, game->file_id);
+	c_game_crc = game->crc;
 	
 	// set up location
 	//c_game_location = vstring_new(game->dir->data, 10);
-	dir_preset_set(DIR_PRESET_GAME, game->dir->data);
+	if (zip_path(game->dir->data) && zip_mount(game->dir->data))
+	{
+		// saves and what's worked out about the game go next to the zip
+		char *slash;
+		char sep;
+
+		slash = strrchr(game->dir->data, '/');
+		if (slash == 0)
+			slash = strrchr(game->dir->data, '\\');
+		if (slash == 0)
+			dir_preset_set(DIR_PRESET_GAME, dir_preset_get(DIR_PRESET_ORIG));
+		else
+		{
+			sep = *slash;
+			*slash = 0;
+			dir_preset_set(DIR_PRESET_GAME, game->dir->data);
+			*slash = sep;
+		}
+	}
+	else
+		dir_preset_set(DIR_PRESET_GAME, game->dir->data);
 	
 	// need to setup game.id if you want to load up savegames before agi is init'd
 	// standard.ini, or the file_id, or the default ""
@@ -820,6 +1309,8 @@ void standard_select_ng(void)
 	
 	list_game = list_new(sizeof(GAMEINFO));
 	gi_list_init(list_game, ini_standard);
+	dir_preset_change(DIR_PRESET_NAGI);
+	crc_cache_save();
 	
 	if ( msgstate.active != 0)
 		cmd_close_window(0);
@@ -5,6 +5,7 @@
 /* VARIABLES	---	---	---	---	---	---	--- */
 /* FUNCTIONS	---	---	---	---	---	---	--- */
 
+extern void standard_scan_start(void);
 extern void standard_select_ng(void);
 
 #endif /* NAGI_VERSION_STANDARD_H */
@@ -16,6 +16,8 @@ _CheckBlockStat                  cseg     000006D9 000000CF
 
 // update graphics : a few functions incomplete
 
+#define MEM_TAG MEM_VIEW
+
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -48,6 +50,8 @@ _CheckBlockStat                  cseg     000006D9 000000CF
 // for flags
 #include "../flags.h"
 #include "../sys/mem_wrap.h"
+#include "../sys/drv_video.h"
+#include "../sys/vid_render.h"
 
 #include <stdlib.h>
 #include <assert.h>
@@ -55,11 +59,48 @@ _CheckBlockStat                  cseg     000006D9 000000CF
 VIEW *objtable = 0;
 VIEW *objtable_tail;
 u16 objtable_size;
+OBJ_HOT obj_hot = {0};
+
+// the objects objtable_update() found drawn, animated and updating, in table
+// order.  objs_step_update() walks these instead of the whole table
+VIEW **objtable_live = 0;
+u16 objtable_live_count = 0;
 
 static void blit_add(VIEW *v, BLIT *h);
+static void blit_set(BLIT *b, VIEW *v);
 static s16 gen_sort_pos(s16 var8);
 static void obj_animate(u8 num);
 
+// blit records for the two lists, one per object in each.  they're kept
+// with their save buffers from cycle to cycle instead of being allocated
+// every time a list is built.  [0..max) updated, [max..2*max) static
+static BLIT *blit_pool = 0;
+static u16 blit_pool_size = 0;
+
+// the hot arrays in one block, one slot per object and the loose ones after.
+// flags, x and y, then the six u8 ones
+static void obj_hot_new(u16 total)
+{
+	u8 *b;
+	size_t size;
+
+	size = total * (sizeof(u16) + 2*sizeof(s16) + 6*sizeof(u8));
+	b = (u8 *)a_malloc(size);
+	memset(b, 0, size);
+	obj_hot.flags = (u16 *)b;
+	b += total * sizeof(u16);
+	obj_hot.x = (s16 *)b;
+	b += total * sizeof(s16);
+	obj_hot.y = (s16 *)b;
+	b += total * sizeof(s16);
+	obj_hot.step_time = b;
+	obj_hot.step_count = b + total;
+	obj_hot.step_size = b + 2*total;
+	obj_hot.cycle_time = b + 3*total;
+	obj_hot.cycle_count = b + 4*total;
+	obj_hot.direction = b + 5*total;
+}
+
 void objtable_new(u16 max)
 {
 	int i;
@@ -67,9 +108,19 @@ void objtable_new(u16 max)
 	
 	if (objtable == 0)
 	{
+		// the loose objects go after the table, they're never saved
 		objtable_size = max * sizeof(VIEW);
-		objtable = (VIEW *)a_malloc(objtable_size);
+		objtable = (VIEW *)a_malloc((max + OBJ_LOOSE_TOTAL) * sizeof(VIEW));
+		memset(objtable, 0, (max + OBJ_LOOSE_TOTAL) * sizeof(VIEW));
+		obj_hot_new(max + OBJ_LOOSE_TOTAL);
+
+		blit_pool_size = max;
+		blit_pool = (BLIT *)a_malloc(2 * max * sizeof(BLIT));
+		memset(blit_pool, 0, 2 * max * sizeof(BLIT));
+
+		objtable_live = (VIEW **)a_malloc(max * sizeof(VIEW *));
 	}
+	objtable_live_count = 0;
 
 	memset(objtable, 0, objtable_size);
 	objtable_tail = objtable + max;
@@ -77,7 +128,63 @@ void objtable_new(u16 max)
 	//view_pic_add.0 = objtable_tail - 1;  
 
 	for (i=0, v=objtable ; i<max ; i++, v++)
+	{
 		v->num = i;
+		OBJ_FLAGS(v) = 0;
+		OBJ_X(v) = 0;
+		OBJ_Y(v) = 0;
+		OBJ_STEP_TIME(v) = 0;
+		OBJ_STEP_COUNT(v) = 0;
+		OBJ_STEP_SIZE(v) = 0;
+		OBJ_CYCLE_TIME(v) = 0;
+		OBJ_CYCLE_COUNT(v) = 0;
+		OBJ_DIRECTION(v) = 0;
+	}
+}
+
+// a VIEW past the table for show.obj and add.to.pic, so the hot fields
+// have somewhere to go.  it's whatever its last user left in it
+VIEW *obj_loose(u16 which)
+{
+	return objtable_tail + which;
+}
+
+// copy the hot fields into the VIEWs' save_ ones, before the table's saved
+void objtable_hot_store()
+{
+	VIEW *v;
+
+	for (v=objtable ; v<objtable_tail ; v++)
+	{
+		v->save_flags = OBJ_FLAGS(v);
+		v->save_x = OBJ_X(v);
+		v->save_y = OBJ_Y(v);
+		v->save_step_time = OBJ_STEP_TIME(v);
+		v->save_step_count = OBJ_STEP_COUNT(v);
+		v->save_step_size = OBJ_STEP_SIZE(v);
+		v->save_cycle_time = OBJ_CYCLE_TIME(v);
+		v->save_cycle_count = OBJ_CYCLE_COUNT(v);
+		v->save_direction = OBJ_DIRECTION(v);
+	}
+}
+
+// and back out again once a saved table's been read in
+void objtable_hot_load()
+{
+	VIEW *v;
+
+	for (v=objtable ; v<objtable_tail ; v++)
+	{
+		OBJ_FLAGS(v) = v->save_flags;
+		OBJ_X(v) = v->save_x;
+		OBJ_Y(v) = v->save_y;
+		OBJ_STEP_TIME(v) = v->save_step_time;
+		OBJ_STEP_COUNT(v) = v->save_step_count;
+		OBJ_STEP_SIZE(v) = v->save_step_size;
+		OBJ_CYCLE_TIME(v) = v->save_cycle_time;
+		OBJ_CYCLE_COUNT(v) = v->save_cycle_count;
+		OBJ_DIRECTION(v) = v->save_direction;
+	}
 }
 
 // pass a sprite list head
@@ -96,7 +203,7 @@ u16 blitlist_erase(BLIT *b)
 // set_memptr2() is the same as set_mem_ptr()
 // you can think of it as a weird free() command.. it frees up everything 
 // that had been allocated from that point.
-// NOT good if something else had been allocated after the sprite list head
+// the records belong to blit_pool now so the list is only unlinked
 u16 blitlist_free(BLIT *b)
 {
 	BLIT *s, *d;
@@ -104,10 +211,8 @@ u16 blitlist_free(BLIT *b)
 	for (s=b->prev ; s!=0 ; s = d)
 	{
 		d = s->prev;
-		if (s->buffer != 0)
-			a_free(s->buffer);
-		a_free(s);	// set_memptr2(si);
-		s = 0;
+		s->prev = 0;
+		s->next = 0;
 	}
 	
 	b->next = 0;	// prev
@@ -116,9 +221,9 @@ u16 blitlist_free(BLIT *b)
 }
 
 // head of all blit objects that are updated on each cycle
-BLIT blitlist_updated = {0,0,0,0,0,0,0,0};	// only used for these two addresses? next 'n prev
+BLIT blitlist_updated = {0,0,0,0,0,0,0,0,0};	// only used for these two addresses? next 'n prev
 // head of all blit objects are are not updated on each cycle
-BLIT blitlist_static = {0,0,0,0,0,0,0,0};
+BLIT blitlist_static = {0,0,0,0,0,0,0,0,0};
 
 // var a = head .. var 8 = function
 BLIT *blitlist_build( u16(*f)(VIEW *) , BLIT *head)	// function, spritelist
@@ -129,8 +234,7 @@ BLIT *blitlist_build( u16(*f)(VIEW *) , BLIT *head)	// function, spritelist
 	
 	u16 i;
 	u16 num = 0;
-	u16 d;	
-	u16 next = 256;
+	s16 d;
 	
 	VIEW *s;
 	
@@ -139,29 +243,31 @@ BLIT *blitlist_build( u16(*f)(VIEW *) , BLIT *head)	// function, spritelist
 		if (f(s) != 0)
 		{	
 			view[num] = s;
-			if ( (s->flags&O_PRIFIXED) != 0)
+			if ( (OBJ_FLAGS(s)&O_PRIFIXED) != 0)
 				sort_order[num] = gen_sort_pos(s->priority);	// sub4CBB
 			else
-				sort_order[num] = s->y;
+				sort_order[num] = OBJ_Y(s);
 			num++;
 		}
 	}
 	
-	for (i=0 ; i<num ; i++)
+	// insertion sort keeps equal positions in table order, same as
+	// the original picking the first lowest each time
+	for (i=1 ; i<num ; i++)
 	{
-		cur_pos = 255;
-		
-		for (d=0; d<num; d++)
-			if (sort_order[d] < cur_pos )
-			{
-				next = d;
-				cur_pos = sort_order[d];
-			}
-		
-		sort_order[next] = 255;
-		assert(next != 256);
-		blit_add( view[next], head );
+		cur_pos = sort_order[i];
+		s = view[i];
+		for (d=i-1 ; (d>=0) && (sort_order[d] > cur_pos) ; d--)
+		{
+			sort_order[d+1] = sort_order[d];
+			view[d+1] = view[d];
+		}
+		sort_order[d+1] = cur_pos;
+		view[d+1] = s;
 	}
+	
+	for (i=0 ; i<num ; i++)
+		blit_add( view[i], head );
 	return head;	// a passed parameter
 }
 
@@ -260,8 +366,22 @@ u8 *cmd_unknown_174(u8 *c)
 static void blit_add(VIEW *v, BLIT *h)  // var8 = v    vara = h
 {
 	BLIT *d, *c;
+	u16 size;
+	
+	// the object's record for this list, the buffer only grows
+	d = blit_pool + (v - objtable);
+	if (h == &blitlist_static)
+		d += blit_pool_size;
+	
+	size = (v->x_size) * (v->y_size);
+	if (size > d->buffer_size)
+	{
+		a_free(d->buffer);
+		d->buffer = a_malloc(size);
+		d->buffer_size = size;
+	}
+	blit_set(d, v);
 	
-	d = blit_new(v);
 	d->prev = h->prev;
 	
 	if (h->prev != 0)
@@ -286,11 +406,19 @@ BLIT *blit_new(VIEW *v)
 	BLIT *b;
 
 	b = a_malloc(sizeof(BLIT));
+	b->buffer_size = (v->x_size) * (v->y_size);
+	b->buffer = a_malloc(b->buffer_size);
+	blit_set(b, v);
+	return b;
+}
+
+static void blit_set(BLIT *b, VIEW *v)
+{
 	b->prev = 0;
 	b->next = 0;
 	b->v = v;
-	b->x = v->x;
-	b->y = (v->y) - (v->y_size) + 1;
+	b->x = OBJ_X(v);
+	b->y = (OBJ_Y(v)) - (v->y_size) + 1;
 	b->x_size = v->x_size;
 	/*if (display_type == 2)	// HGC man
 	{
@@ -299,9 +427,7 @@ BLIT *blit_new(VIEW *v)
 	}*/
 
 	b->y_size = v->y_size;
-	b->buffer = a_malloc( (v->x_size) * (v->y_size) );
 	v->blit = b;
-	return b;
 }
 
 
@@ -323,22 +449,24 @@ void blitlist_update(BLIT *h)
 	VIEW *v;
 	BLIT *b;
 	
+	render_batch_begin();
 	for ( b=h->prev ; b !=0 ; b=b->prev )
 	{
 		v = b->v;	// view table
 		obj_cel_update(v);
-		if (v->step_count == v->step_time)
+		if (OBJ_STEP_COUNT(v) == OBJ_STEP_TIME(v))
 		{
-			if ( (v->x == v->x_prev) && (v->y == v->y_prev) )
-				v->flags |= O_MOTIONLESS;	// bit 14
+			if ( (OBJ_X(v) == v->x_prev) && (OBJ_Y(v) == v->y_prev) )
+				OBJ_FLAGS(v) |= O_MOTIONLESS;	// bit 14
 			else
 			{
-				v->x_prev = v->x;
-				v->y_prev = v->y;
-				v->flags &= ~O_MOTIONLESS;
+				v->x_prev = OBJ_X(v);
+				v->y_prev = OBJ_Y(v);
+				OBJ_FLAGS(v) &= ~O_MOTIONLESS;
 			}
 		}
 	}
+	render_batch_end();
 }
 
 
@@ -356,12 +484,12 @@ static void obj_animate(u8 num)
 	
 	if (v >= objtable_tail)
 		set_agi_error(0x0D, num);
-	if (  (v->flags & O_ANIMATE) == 0)
+	if (  (OBJ_FLAGS(v) & O_ANIMATE) == 0)
 	{
-		v->flags = O_UPDATE|O_CYCLE|O_ANIMATE;
+		OBJ_FLAGS(v) = O_UPDATE|O_CYCLE|O_ANIMATE;
 		v->motion = MT_NORM;
 		v->cycle = CY_NORM;
-		v->direction = 0;
+		OBJ_DIRECTION(v) = 0;
 	}
 }
 
@@ -372,7 +500,7 @@ u8 *cmd_unanimate_all(u8 *c)
 	blists_erase();
 	
 	for (v=objtable ; v<objtable_tail ; v++)
-		v->flags &= ~(O_ANIMATE|O_DRAWN);
+		OBJ_FLAGS(v) &= ~(O_ANIMATE|O_DRAWN);
 	
 	return c;
 }
@@ -392,64 +520,63 @@ static u8 loop_large[] = {IGNORE,    UP,    RIGHT,RIGHT,RIGHT, DOWN, LEFT,LEFT,L
 void objtable_update()
 {
 	u8 new_loop;
-	u16 touched;
 	VIEW *v;
 		
-	touched = 0;
+	objtable_live_count = 0;
 
 	for (v=objtable ; v<objtable_tail ; v++)
 	{
-		if ((v->flags & (O_DRAWN|O_ANIMATE|O_UPDATE)) == (O_DRAWN|O_ANIMATE|O_UPDATE))	// 0, 4, 6
+		if ((OBJ_FLAGS(v) & (O_DRAWN|O_ANIMATE|O_UPDATE)) == (O_DRAWN|O_ANIMATE|O_UPDATE))	// 0, 4, 6
 		{
-			touched++;	// good for 65535 touchings
+			objtable_live[objtable_live_count++] = v;
 			new_loop = IGNORE;
 			
 			// if loop released (ie, agi picks the loop depending on direction)
-			if ( (v->flags & O_LOOPFIXED) == 0)	// flag 13
+			if ( (OBJ_FLAGS(v) & O_LOOPFIXED) == 0)	// flag 13
 			{
 				
 				if ( (v->loop_total==2)||(v->loop_total==3) )
-					new_loop =  loop_small[v->direction];
+					new_loop =  loop_small[OBJ_DIRECTION(v)];
 				else if (v->loop_total==4)
-					new_loop = loop_large[v->direction];
+					new_loop = loop_large[OBJ_DIRECTION(v)];
 				else if (c_game_loop_update!=L_FOUR)
 				{
 					if ((c_game_loop_update==L_ALL)&&(v->loop_total>4))
-						new_loop = loop_large[v->direction];
+						new_loop = loop_large[OBJ_DIRECTION(v)];
 					else if (c_game_loop_update==L_FLAG)
 					{
 						if ((flag_test(F20_LOCK_OBJ_LOOP)!=0)&&(v->loop_total>4))   // I think this was added for v3
-							new_loop = loop_large[v->direction];
+							new_loop = loop_large[OBJ_DIRECTION(v)];
 					}
 				}
 			}
-			if (v->step_count == 1)
+			if (OBJ_STEP_COUNT(v) == 1)
 				if (new_loop != IGNORE)
 					if (v->loop_cur != new_loop)
 					{
 						obj_loop_set(v, new_loop);
 					}
 					
-			if ((v->flags & O_CYCLE) != 0)	// if cycling (flag 5)
-				if (v->cycle_count != 0)
+			if ((OBJ_FLAGS(v) & O_CYCLE) != 0)	// if cycling (flag 5)
+				if (OBJ_CYCLE_COUNT(v) != 0)
 				{
-					v->cycle_count--;
-					if (v->cycle_count == 0)
+					OBJ_CYCLE_COUNT(v)--;
+					if (OBJ_CYCLE_COUNT(v) == 0)
 					{
 						obj_loop_update(v);
-						v->cycle_count = v->cycle_time;
+						OBJ_CYCLE_COUNT(v) = OBJ_CYCLE_TIME(v);
 					}
 				}
 		}
 	}
 
-	if (touched != 0) 
+	if (objtable_live_count != 0) 
 	{
 		blitlist_erase(&blitlist_updated);
 		objs_step_update();
 		blitlist_draw(build_updated_list());
 		blitlist_update(&blitlist_updated);
-		objtable->flags &= ~(O_LAND|O_WATER);
+		OBJ_FLAGS(objtable) &= ~(O_LAND|O_WATER);
 	}
 
 	
@@ -6,11 +6,21 @@
 extern u16 objtable_size;
 extern VIEW *objtable;
 extern VIEW *objtable_tail;
+extern VIEW **objtable_live;
+extern u16 objtable_live_count;
+
+// obj_loose() slots
+#define OBJ_LOOSE_SHOW 0
+#define OBJ_LOOSE_PIC_ADD 1
+#define OBJ_LOOSE_TOTAL 2
 
 extern BLIT blitlist_updated;
 extern BLIT blitlist_static;
 
 extern void objtable_new(u16 max);
+extern VIEW *obj_loose(u16 which);
+extern void objtable_hot_store(void);
+extern void objtable_hot_load(void);
 extern u16 blitlist_free(BLIT *b);
 extern u16 blitlist_erase(BLIT *b);
 extern BLIT *blitlist_build( u16(*f)(VIEW *) , BLIT *head);
@@ -10,11 +10,20 @@ _IBMBlitArea                     cseg     00009D75 000000D0
 #include <string.h>
 #include <stdlib.h>
 #include "../agi.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define OBJ_BLIT_SSE2 1
+#include <emmintrin.h>
+#elif defined(__ARM_NEON) || defined(__aarch64__)
+#define OBJ_BLIT_NEON 1
+#include <arm_neon.h>
+#endif
 #include "../flags.h"
 
 #include "obj_blit.h"
 #include "obj_base.h"
 #include "../view/obj_picbuff.h"
+#include "../view/view_base.h"
 
 #include "../sys/drv_video.h"
 #include "../sys/gfx.h"
@@ -60,83 +69,153 @@ void blit_restore(BLIT *b)
 	} while (y_count != 0);
 }
 
-void obj_blit(VIEW *v)
+// draw one cel pixel.  returns 1 if it went on the screen
+// pixels on control lines (priority 0-2) take the priority of the first
+// real priority below them and keep their control bits
+static u8 blit_pixel(u8 *pb, u8 col, u8 view_pri)
 {
-	u8 *init, *pb, *c, *temp;
-	u8 cel_height;		// height of graphic
-	u8 cel_invis;		// 1 invisible, 0 not
-	u8 chunk;
-	u8 pb_pri;
-	u8 col, chunk_len, cel_tran, view_pri, ch;
-		
-	c = v->cel_data;		// start of cel data!!
+	u8 *temp;
+	u8 pb_pri, ch;
 
-	if (  ( c[0x2] & 0x80) != 0  )	// 1000 0000
+	pb_pri = *pb & 0xF0;			// get priority from gfx_picbuff
+	
+	if (pb_pri <= 0x20)
 	{
-		obj_cel_mirror(v);	// mirror cell
-		//c = v->cel_data;
+		temp = pb;
+		ch = 0;
+		while ( ((temp-gfx_picbuff)<(0x6860)) && (ch<=0x20) )
+		{
+			temp += 160;
+			ch = *temp & 0xF0;
+		}
+		if (ch > view_pri) 
+			pb_pri = 0xFF;
 	}
+	else	
+		if (pb_pri > view_pri) 
+			pb_pri = 0xFF;
+		else
+			pb_pri = view_pri;
 	
-	c++;					// skip width of cell
-	cel_height = *(c++);		// height
-	cel_tran = *(c++) & 0x0F;	// transparency info
-	pb = gfx_picbuff + PBUF_MULT(v->y - cel_height+1) + v->x;
-	cel_invis = 1; 
-	view_pri = v->priority << 4;	// priority
-	init = pb;
-	chunk_len = 0;
+	if (pb_pri == 0xFF)
+		return 0;
 
-	while (cel_height != 0)
+	*pb = pb_pri|col;
+	return 1;
+}
+
+// draw one row of a cel.  16 pixels a step are tested and blended at once;
+// a step with an opaque pixel over a control line goes through blit_pixel
+// for the column search.  returns 1 if any pixel went on the screen
+static u8 blit_row(u8 *pb, const u8 *pix, const u8 *mask, int width, u8 view_pri)
+{
+	u8 shown = 0;
+	int x = 0;
+
+#if defined(OBJ_BLIT_SSE2)
+	const __m128i hi = _mm_set1_epi8((char)0xF0);
+	const __m128i ctrl = _mm_set1_epi8(0x20);
+	const __m128i pri = _mm_set1_epi8((char)view_pri);
+	__m128i any = _mm_setzero_si128();
+
+	for (; x + 16 <= width; x += 16)
 	{
-		chunk = *(c++);	// get next "chunk"
-		if (chunk == 0)		// eol
+		__m128i m = _mm_loadu_si128((const __m128i *)(mask + x));
+		__m128i b = _mm_loadu_si128((const __m128i *)(pb + x));
+		__m128i p = _mm_and_si128(b, hi);
+		__m128i on_ctrl, vis, out;
+
+		// unsigned p <= n is max(p, n) == n
+		on_ctrl = _mm_and_si128(m, _mm_cmpeq_epi8(_mm_max_epu8(p, ctrl), ctrl));
+		if (_mm_movemask_epi8(on_ctrl) != 0)
 		{
-			cel_height--;
-			init += 160;
-			pb = init;
+			int i;
+			for (i = x; i < x + 16; i++)
+				if (mask[i] != 0)
+					shown |= blit_pixel(pb + i, pix[i], view_pri);
+			continue;
 		}
-		else
+
+		vis = _mm_and_si128(m, _mm_cmpeq_epi8(_mm_max_epu8(p, pri), pri));
+		out = _mm_or_si128(pri, _mm_loadu_si128((const __m128i *)(pix + x)));
+		out = _mm_or_si128(_mm_and_si128(vis, out), _mm_andnot_si128(vis, b));
+		_mm_storeu_si128((__m128i *)(pb + x), out);
+		any = _mm_or_si128(any, vis);
+	}
+	if (_mm_movemask_epi8(any) != 0)
+		shown = 1;
+#elif defined(OBJ_BLIT_NEON)
+	const uint8x16_t hi = vdupq_n_u8(0xF0);
+	const uint8x16_t ctrl = vdupq_n_u8(0x20);
+	const uint8x16_t pri = vdupq_n_u8(view_pri);
+	uint8x16_t any = vdupq_n_u8(0);
+
+	for (; x + 16 <= width; x += 16)
+	{
+		uint8x16_t m = vld1q_u8(mask + x);
+		uint8x16_t b = vld1q_u8(pb + x);
+		uint8x16_t p = vandq_u8(b, hi);
+		uint8x16_t on_ctrl, vis, out;
+		uint64x2_t t;
+
+		on_ctrl = vandq_u8(m, vcleq_u8(p, ctrl));
+		t = vreinterpretq_u64_u8(on_ctrl);
+		if ((vgetq_lane_u64(t, 0) | vgetq_lane_u64(t, 1)) != 0)
 		{
-			col = chunk >> 4;	// colour	// ah
-			chunk_len = chunk & 0x0F;	// length 	// al
-		
-			if (col == cel_tran) 	// colour is transparent
-				pb += chunk_len;
-			else
-				do
-				{
-					pb_pri = *pb & 0xF0;			// get priority from gfx_picbuff
-					
-					if (pb_pri <= 0x20)
-					{
-						temp = pb;
-						ch = 0;
-						while ( ((temp-gfx_picbuff)<(0x6860)) && (ch<=0x20) )
-						{
-							temp += 160;
-							ch = *temp & 0xF0;
-						}
-						if (ch > view_pri) 
-							pb_pri = 0xFF;
-					}
-					else	
-						if (pb_pri > view_pri) 
-							pb_pri = 0xFF;
-						else
-							pb_pri = view_pri;
-					
-					if (pb_pri != 0xFF)
-					{	
-						*(pb++) = pb_pri|col;
-						cel_invis = 0;
-					}
-					else
-						pb++;
-					
-					chunk_len--;
-				}
-				while (chunk_len != 0);
+			int i;
+			for (i = x; i < x + 16; i++)
+				if (mask[i] != 0)
+					shown |= blit_pixel(pb + i, pix[i], view_pri);
+			continue;
 		}
+
+		vis = vandq_u8(m, vcleq_u8(p, pri));
+		out = vorrq_u8(pri, vld1q_u8(pix + x));
+		vst1q_u8(pb + x, vbslq_u8(vis, out, b));
+		any = vorrq_u8(any, vis);
+	}
+	{
+		uint64x2_t t = vreinterpretq_u64_u8(any);
+		if ((vgetq_lane_u64(t, 0) | vgetq_lane_u64(t, 1)) != 0)
+			shown = 1;
+	}
+#endif
+
+	for (; x < width; x++)
+		if (mask[x] != 0)
+			shown |= blit_pixel(pb + x, pix[x], view_pri);
+
+	return shown;
+}
+
+// draws the object's decoded cel into the picture buffer
+void obj_blit(VIEW *v)
+{
+	VIEW_CEL *cel;
+	const u8 *pix, *mask;
+	u8 *pb;
+	u8 cel_invis;		// 1 invisible, 0 not
+	u8 view_pri;
+	int y;
+
+	cel = view_cel_get(v);
+	if ( (cel->mirror) && (cel->loop != v->loop_cur) )
+		pix = cel->pix[1];	// mirror cell
+	else
+		pix = cel->pix[0];
+	mask = pix + cel->width * cel->height;
+
+	pb = gfx_picbuff + PBUF_MULT(OBJ_Y(v) - cel->height+1) + OBJ_X(v);
+	cel_invis = 1; 
+	view_pri = v->priority << 4;	// priority
+
+	for (y = 0; y < cel->height; y++)
+	{
+		if (blit_row(pb, pix, mask, cel->width, view_pri) != 0)
+			cel_invis = 0;
+		pix += cel->width;
+		mask += cel->width;
+		pb += 160;
 	}
 	
 // finish up
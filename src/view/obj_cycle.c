@@ -22,7 +22,7 @@ u8 *cmd_normal_cycle(u8 *c)
 	
 	v = &objtable[*(c++)];
 	v->cycle = CY_NORM;
-	v->flags |= O_CYCLE;
+	OBJ_FLAGS(v) |= O_CYCLE;
 	return c;
 }
 
@@ -31,7 +31,7 @@ u8 *cmd_end_of_loop(u8 *c)
 	VIEW *v;
 	v = &objtable[*(c++)];
 	v->cycle = CY_END;
-	v->flags |= (O_UPDATE|O_CYCLE|O_SKIPUPDATE);
+	OBJ_FLAGS(v) |= (O_UPDATE|O_CYCLE|O_SKIPUPDATE);
 	v->loop_flag = *(c++);
 	flag_reset(v->loop_flag);
 	return c;
@@ -42,7 +42,7 @@ u8 *cmd_reverse_cycle(u8 *c)
 	VIEW *v;
 	v = &objtable[*(c++)];
 	v->cycle = CY_REV;
-	v->flags |= O_CYCLE;
+	OBJ_FLAGS(v) |= O_CYCLE;
 	return c;
 }
 
@@ -51,7 +51,7 @@ u8 *cmd_reverse_loop(u8 *c)
 	VIEW *v;
 	v = &objtable[*(c++)];
 	v->cycle = CY_REVEND;
-	v->flags |= (O_UPDATE|O_CYCLE|O_SKIPUPDATE);
+	OBJ_FLAGS(v) |= (O_UPDATE|O_CYCLE|O_SKIPUPDATE);
 	v->loop_flag = *(c++);
 	flag_reset(v->loop_flag);
 	return c;
@@ -61,20 +61,20 @@ u8 *cmd_cycle_time(u8 *c)
 {
 	VIEW *v;
 	v = &objtable[*(c++)];
-	v->cycle_time = state.var[*(c++)];
-	v->cycle_count = v->cycle_time;
+	OBJ_CYCLE_TIME(v) = state.var[*(c++)];
+	OBJ_CYCLE_COUNT(v) = OBJ_CYCLE_TIME(v);
 	return c;
 }
 
 u8 *cmd_stop_cycling(u8 *c)
 {
-	objtable[*(c++)].flags &= ~O_CYCLE;
+	OBJ_FLAGS(&objtable[*(c++)]) &= ~O_CYCLE;
 	return c;
 }
 
 u8 *cmd_start_cycling(u8 *c)
 {
-	objtable[*(c++)].flags |= O_CYCLE;
+	OBJ_FLAGS(&objtable[*(c++)]) |= O_CYCLE;
 	return c;
 }
 
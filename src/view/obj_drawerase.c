@@ -38,20 +38,20 @@ void obj_draw(u16 num)
 		set_agi_error(0x13, num);
 	if (v->cel_data == 0)
 		set_agi_error(0x14, num);
-	if ( (v->flags & O_DRAWN) == 0)
+	if ( (OBJ_FLAGS(v) & O_DRAWN) == 0)
 	{
-		v->flags |= O_UPDATE;
+		OBJ_FLAGS(v) |= O_UPDATE;
 		obj_pos_shuffle(v);
 		v->cel_prev_height = v->cel_data[1];
 		v->cel_prev_width = v->cel_data[0];
 		//v->cel_data_prev = v->cel_data;
-		v->x_prev = v->x;
-		v->y_prev = v->y;
+		v->x_prev = OBJ_X(v);
+		v->y_prev = OBJ_Y(v);
 		blitlist_erase(&blitlist_updated);
-		v->flags |= O_DRAWN;
+		OBJ_FLAGS(v) |= O_DRAWN;
 		blitlist_draw(build_updated_list());
 		obj_cel_update(v);
-		v->flags &= ~O_SKIPUPDATE;
+		OBJ_FLAGS(v) &= ~O_SKIPUPDATE;
 	}
 }
 
@@ -71,10 +71,10 @@ static void obj_erase(u16 num)
 	v = &objtable[num];
 	if ( v > objtable_tail)
 		set_agi_error(0xC, num);
-	if ( (v->flags & O_DRAWN) != 0)
+	if ( (OBJ_FLAGS(v) & O_DRAWN) != 0)
 	{
 		blitlist_erase(&blitlist_updated);
-		if ( (v->flags & O_UPDATE) == 0)
+		if ( (OBJ_FLAGS(v) & O_UPDATE) == 0)
 			no_update_flag = 1;
 		else
 			no_update_flag = 0;
@@ -82,7 +82,7 @@ static void obj_erase(u16 num)
 		if (no_update_flag == 1 )
 			blitlist_erase(&blitlist_static);
 		
-		v->flags &= ~O_DRAWN;
+		OBJ_FLAGS(v) &= ~O_DRAWN;
 		
 		if (no_update_flag == 1)
 			blitlist_draw(build_static_list());
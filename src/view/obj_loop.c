@@ -17,8 +17,8 @@ void obj_loop_update(VIEW *v)
 	u8 c;	// bp-1 
 	u8 max; // bp-2
 
-	if ( (v->flags & O_SKIPUPDATE) != 0 )
-		v->flags &= ~O_SKIPUPDATE;
+	if ( (OBJ_FLAGS(v) & O_SKIPUPDATE) != 0 )
+		OBJ_FLAGS(v) &= ~O_SKIPUPDATE;
 	else
 	{
 		c = v->cel_cur;
@@ -39,8 +39,8 @@ void obj_loop_update(VIEW *v)
 						break;
 				}
 				flag_set(v->loop_flag);
-				v->flags &= ~O_CYCLE;
-				v->direction = 0;
+				OBJ_FLAGS(v) &= ~O_CYCLE;
+				OBJ_DIRECTION(v) = 0;
 				v->cycle = 0;
 				break;
 				
@@ -51,8 +51,8 @@ void obj_loop_update(VIEW *v)
 					if (c != 0) break;
 				}
 				flag_set(v->loop_flag);
-				v->flags &= ~O_CYCLE;
-				v->direction = 0;
+				OBJ_FLAGS(v) &= ~O_CYCLE;
+				OBJ_DIRECTION(v) = 0;
 				v->cycle = 0;
 				break;
 				
@@ -72,12 +72,12 @@ void obj_loop_update(VIEW *v)
 
 u8 *cmd_fix_loop(u8 *c)
 {
-	objtable[*(c++)].flags |= O_LOOPFIXED;	// 13	loop fixed
+	OBJ_FLAGS(&objtable[*(c++)]) |= O_LOOPFIXED;	// 13	loop fixed
 	return c;
 }
 
 u8 *cmd_release_loop(u8 *c)
 {
-	objtable[*(c++)].flags &= ~O_LOOPFIXED;	// 13	released
+	OBJ_FLAGS(&objtable[*(c++)]) &= ~O_LOOPFIXED;	// 13	released
 	return c;
 }
@@ -14,6 +14,7 @@ u16 get_rand_dir()
 void obj_wander_update(VIEW *v)
 
 void obj_follow_update(VIEW *v)
+void obj_follow_path(VIEW *v, u16 dir, s16 ego_x, s16 ego_y)
 */
 
 #include <stdlib.h>
@@ -36,18 +37,22 @@ static u16 move172d(s16 disp, s16 step);
 static u16 get_rand_dir(void);
 static void obj_wander_update(VIEW *v);
 static void obj_follow_update(VIEW *v);
+static void obj_follow_path(VIEW *v, u16 dir, s16 ego_x, s16 ego_y);
 
 static s16 x_dir_mult[] = {0,0,1,1,1,0,-1,-1,-1};
 static s16 y_dir_mult[] = {0,-1,-1,0,1,1,1,0,-1};
 
+// steps a way round a control line has to be clear for (follow_path)
+#define FOLLOW_AHEAD 4
+
 // called from the game loop to update the direction all all animated sprites
 void objs_dir_calc()
 {
 	VIEW *v;
 	
 	for (v=objtable; v<objtable_tail; v++)
-		if ((v->flags & (O_DRAWN|O_ANIMATE|O_UPDATE))==(O_DRAWN|O_ANIMATE|O_UPDATE))
-			if (v->step_count == 1)
+		if ((OBJ_FLAGS(v) & (O_DRAWN|O_ANIMATE|O_UPDATE))==(O_DRAWN|O_ANIMATE|O_UPDATE))
+			if (OBJ_STEP_COUNT(v) == 1)
 				obj_motion_update(v);
 } 
 
@@ -71,9 +76,9 @@ static void obj_motion_update(VIEW *v)
 	}
 
 	if (state.block_state == 0)
-		v->flags &= ~O_BLOCK;	// no block exists so why bother?
+		OBJ_FLAGS(v) &= ~O_BLOCK;	// no block exists so why bother?
 	else
-		if ( ((v->flags&O_BLOCKIGNORE)==0) && (v->direction!=0) )
+		if ( ((OBJ_FLAGS(v)&O_BLOCKIGNORE)==0) && (OBJ_DIRECTION(v)!=0) )
 			obj_chk_block(v);
 }
 
@@ -86,20 +91,20 @@ static void obj_chk_block(VIEW *v)
 	u16 x;
 	u16 y;
 
-	x = v->x;
-	y = v->y;
+	x = OBJ_X(v);
+	y = OBJ_Y(v);
 	
 	stat = block_chk_pos(x, y);
 	
-	x += v->step_size * x_dir_mult[v->direction];
-	y += v->step_size * y_dir_mult[v->direction];
+	x += OBJ_STEP_SIZE(v) * x_dir_mult[OBJ_DIRECTION(v)];
+	y += OBJ_STEP_SIZE(v) * y_dir_mult[OBJ_DIRECTION(v)];
 	
 	if (stat == block_chk_pos(x, y))
-		v->flags &= ~O_BLOCK;
+		OBJ_FLAGS(v) &= ~O_BLOCK;
 	else
 	{
-		v->flags |= O_BLOCK;
-		v->direction = 0;
+		OBJ_FLAGS(v) |= O_BLOCK;
+		OBJ_DIRECTION(v) = 0;
 		if (v == objtable)
 			state.var[V06_DIRECTION] = 0;
 	}
@@ -111,60 +116,63 @@ void objs_step_update()
 	u16 border_code;
 	s16 pos_y_orig;
 	s16 pos_x_orig;
+	VIEW **live;
 	VIEW *v;
 	
 	state.var[V05_OBJBORDER] = 0;
 	state.var[V04_OBJECT] = 0;
 	state.var[V02_BORDER] = 0;
 
-	for (v=objtable; v<objtable_tail; v++)
-		if ( (v->flags&(O_DRAWN|O_UPDATE|O_ANIMATE))==(O_DRAWN|O_UPDATE|O_ANIMATE))
+	obj_grid_build();
+	// objtable_update() has just picked out the drawn, updating, animated ones
+	for (live=objtable_live; live<objtable_live+objtable_live_count; live++)
 		{
-			if (v->step_count <= 1)
+			v = *live;
+			if (OBJ_STEP_COUNT(v) <= 1)
 			{
-				v->step_count = v->step_time;
+				OBJ_STEP_COUNT(v) = OBJ_STEP_TIME(v);
 				border_code = 0;			// touched nothing
-				pos_x_orig = v->x;		// in case something HORRIBLE goes wrong
-				pos_y_orig = v->y;
+				pos_x_orig = OBJ_X(v);		// in case something HORRIBLE goes wrong
+				pos_y_orig = OBJ_Y(v);
 	
-				if ((v->flags & O_REPOS) == 0) 	// flag 10
+				if ((OBJ_FLAGS(v) & O_REPOS) == 0) 	// flag 10
 				{
-					v->x += v->step_size * x_dir_mult[v->direction];
-					v->y += v->step_size * y_dir_mult[v->direction];
+					OBJ_X(v) += OBJ_STEP_SIZE(v) * x_dir_mult[OBJ_DIRECTION(v)];
+					OBJ_Y(v) += OBJ_STEP_SIZE(v) * y_dir_mult[OBJ_DIRECTION(v)];
 				}
 				
-				if (v->x < 0)
+				if (OBJ_X(v) < 0)
 				{
-					v->x = 0;
+					OBJ_X(v) = 0;
 					border_code = 4;		// left edge
 				}
-				else if ((v->x+v->x_size) > 0xa0) 
+				else if ((OBJ_X(v)+v->x_size) > 0xa0) 
 				{
-					v->x = 160 - v->x_size;
+					OBJ_X(v) = 160 - v->x_size;
 					border_code = 2;		// right edge
 				}
 				
-				if ((v->y-v->y_size) < -1)
+				if ((OBJ_Y(v)-v->y_size) < -1)
 				{
-					v->y = v->y_size - 1;
+					OBJ_Y(v) = v->y_size - 1;
 					border_code = 1;		// top/horizon edge			
 				}
-				else if (v->y > 167) 
+				else if (OBJ_Y(v) > 167) 
 				{
-					v->y = 167;
+					OBJ_Y(v) = 167;
 					border_code = 3;		// bottom edge
 				}
-				else if ( ((v->flags&O_HORIZONIGNORE)==0) && (state.horizon>=v->y) )
+				else if ( ((OBJ_FLAGS(v)&O_HORIZONIGNORE)==0) && (state.horizon>=OBJ_Y(v)) )
 				{
-					v->y = state.horizon + 1;
+					OBJ_Y(v) = state.horizon + 1;
 					border_code = 1;		// top/horizon edge
 				}
 				
 				// check if the new position doesn't contact anything else
 				if ( (obj_chk_contact(v)!=0) || (obj_chk_control(v)==0) )
 				{
-					v->x = pos_x_orig;
-					v->y = pos_y_orig;
+					OBJ_X(v) = pos_x_orig;
+					OBJ_Y(v) = pos_y_orig;
 					border_code = 0;		// no touch
 					obj_pos_shuffle(v);
 				}
@@ -183,11 +191,13 @@ void objs_step_update()
 						obj_move_stop(v);
 				}
 				
-				v->flags &= ~O_REPOS; 	// it's been repositioned so now we can update it's movement
+				OBJ_FLAGS(v) &= ~O_REPOS; 	// it's been repositioned so now we can update it's movement
+				obj_grid_move(v);
 			}
 			else
-				v->step_count--;
+				OBJ_STEP_COUNT(v)--;
 		}
+	obj_grid_done();
 }
 
 
@@ -197,17 +207,17 @@ void objs_step_update()
 
 void obj_move_update(VIEW *v)
 {
-	v->direction = move16ed(v->x, v->y, v->move.x, v->move.y, v->step_size);
+	OBJ_DIRECTION(v) = move16ed(OBJ_X(v), OBJ_Y(v), v->move.x, v->move.y, OBJ_STEP_SIZE(v));
 	if ( objtable == v)
-		state.var[V06_DIRECTION] = v->direction;
-	if (v->direction == 0)
+		state.var[V06_DIRECTION] = OBJ_DIRECTION(v);
+	if (OBJ_DIRECTION(v) == 0)
 		obj_move_stop(v);	// reached destination
 }
 
 // stop movement
 static void obj_move_stop(VIEW *v)
 {
-	v->step_size = v->move.step_size;
+	OBJ_STEP_SIZE(v) = v->move.step_size;
 	// VERSION THREE
 	if ( v->motion != MT_EGO)
 		flag_set(v->move.flag);
@@ -252,7 +262,7 @@ void ego_move(u16 ego_x, u16 ego_y)
 		else
 			objtable->move.x = ego_x - objtable->x_size/2;
 		objtable->move.y = ego_y;
-		objtable->move.step_size = objtable->step_size;
+		objtable->move.step_size = OBJ_STEP_SIZE(objtable);
 	}
 }
 
@@ -269,11 +279,11 @@ static void obj_wander_update(VIEW *v)
 	s16 ax;
 	ax = v->wander_count;
 	v->wander_count--;	// count down until next direction change
-	if ( (ax == 0) || ((v->flags & O_MOTIONLESS) != 0) )	// bit 14
+	if ( (ax == 0) || ((OBJ_FLAGS(v) & O_MOTIONLESS) != 0) )	// bit 14
 	{
-		v->direction = get_rand_dir();
+		OBJ_DIRECTION(v) = get_rand_dir();
 		if (objtable == v)
-			state.var[V06_DIRECTION] = v->direction;
+			state.var[V06_DIRECTION] = OBJ_DIRECTION(v);
 		while (v->wander_count < 0x6)
 			v->wander_count = agi_rand() % 0x33;			
 	}
@@ -288,36 +298,36 @@ static void obj_follow_update(VIEW *v)
 	s16 ego_x;
 	s16 dir_new;
 	
-	ego_x = objtable->x + objtable->x_size/2;
-	view_x = v->x + v->x_size/2;
-	dir_new = move16ed(view_x, v->y, ego_x, objtable->y, v->follow.step_size);
+	ego_x = OBJ_X(objtable) + objtable->x_size/2;
+	view_x = OBJ_X(v) + v->x_size/2;
+	dir_new = move16ed(view_x, OBJ_Y(v), ego_x, OBJ_Y(objtable), v->follow.step_size);
 	
 	if (dir_new == 0)
 	{
-		v->direction = 0;
+		OBJ_DIRECTION(v) = 0;
 		v->motion = MT_NORM;
 		flag_set(v->follow.flag);
 	}
 	else
 	{
-		if ( (v->follow.count!=0xFF) && ((v->flags&O_MOTIONLESS) != 0) )
+		if ( (v->follow.count!=0xFF) && ((OBJ_FLAGS(v)&O_MOTIONLESS) != 0) )
 		{
 			do
 			{
-				v->direction = get_rand_dir();
+				OBJ_DIRECTION(v) = get_rand_dir();
 			}
-			while (v->direction == 0);
+			while (OBJ_DIRECTION(v) == 0);
 
-			temp8 = ( (abs(v->y - objtable->y)+abs(view_x - ego_x)) >> 1) + 1;
+			temp8 = ( (abs(OBJ_Y(v) - OBJ_Y(objtable))+abs(view_x - ego_x)) >> 1) + 1;
 
-			if ( temp8 <= v->step_size)
-				v->follow.count = v->step_size;
+			if ( temp8 <= OBJ_STEP_SIZE(v))
+				v->follow.count = OBJ_STEP_SIZE(v);
 			else
 				do
 				{
 					v->follow.count = agi_rand() % 8; 
 				}
-				while ( v->follow.count < v->step_size);
+				while ( v->follow.count < OBJ_STEP_SIZE(v));
 		}
 		else
 		{
@@ -325,17 +335,61 @@ static void obj_follow_update(VIEW *v)
 				v->follow.count = 0;		
 			if (v->follow.count != 0)
 			{
-				if (v->follow.count > v->step_size)
-					v->follow.count -= v->step_size;
+				if (v->follow.count > OBJ_STEP_SIZE(v))
+					v->follow.count -= OBJ_STEP_SIZE(v);
 				else
 					v->follow.count = 0;
 			}
+			else if (c_game_follow_path != 0)
+				obj_follow_path(v, dir_new, ego_x, OBJ_Y(objtable));
 			else
-				v->direction = dir_new;
+				OBJ_DIRECTION(v) = dir_new;
 		}
 	}	
 }
 
+// follow_path: head for the ego unless a control line's in the way.  then
+// take the nearest turn that's clear for a few steps, the one ending up
+// closer to the ego.  boxed in, it walks into the line and the random
+// way out above takes over like it always did
+static void obj_follow_path(VIEW *v, u16 dir, s16 ego_x, s16 ego_y)
+{
+	s16 step, dist, best_dist;
+	u16 turn, side, d, best;
+
+	step = OBJ_STEP_SIZE(v);
+	OBJ_DIRECTION(v) = dir;
+	if (obj_ctl_clear(v, step*x_dir_mult[dir], step*y_dir_mult[dir], 1) != 0)
+		return;
+
+	best = 0;
+	best_dist = 0;
+	// turning right round is left to the random way out
+	for (turn=1; (turn<4) && (best==0); turn++)
+		for (side=0; side<2; side++)
+		{
+			d = (side == 0) ? ((dir-1+turn) & 7) + 1 : ((dir-1+8-turn) & 7) + 1;
+			if (obj_ctl_clear(v, step*x_dir_mult[d], step*y_dir_mult[d], FOLLOW_AHEAD) == 0)
+				continue;
+			dist = abs(ego_x - (OBJ_X(v) + v->x_size/2 + step*FOLLOW_AHEAD*x_dir_mult[d])) +
+				abs(ego_y - (OBJ_Y(v) + step*FOLLOW_AHEAD*y_dir_mult[d]));
+			if ( (best == 0) || (dist < best_dist) )
+			{
+				best = d;
+				best_dist = dist;
+			}
+		}
+	if (best == 0)
+		return;
+
+	OBJ_DIRECTION(v) = best;
+	// keep to it so the next step doesn't turn straight back into the line
+	if (step*(FOLLOW_AHEAD-1) < 0xFF)
+		v->follow.count = (u8)(step*(FOLLOW_AHEAD-1));
+	else
+		v->follow.count = 0xFE;
+}
+
 
 
 
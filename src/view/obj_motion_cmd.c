@@ -34,14 +34,14 @@ u8 *cmd_move_obj(u8 *c)
 	v->motion = MT_MOVE;
 	v->move.x = *(c++);
 	v->move.y = *(c++);
-	v->move.step_size= v->step_size;
+	v->move.step_size= OBJ_STEP_SIZE(v);
 	
 	if (*c != 0)
-		v->step_size = *c;
+		OBJ_STEP_SIZE(v) = *c;
 	c++;
 	v->move.flag = *(c++);
 	flag_reset(v->move.flag);
-	v->flags |= O_UPDATE;
+	OBJ_FLAGS(v) |= O_UPDATE;
 	if ( v == objtable )
 		state.ego_control_state = 0;
 	
@@ -58,14 +58,14 @@ u8 *cmd_move_obj_v(u8 *c)
 	v->motion = MT_MOVE;
 	v->move.x = state.var[*(c++)];	// x
 	v->move.y = state.var[*(c++)];	// y
-	v->move.step_size= v->step_size;		// old step_size
+	v->move.step_size= OBJ_STEP_SIZE(v);		// old step_size
 	
 	if (state.var[*c] != 0)
-		v->step_size = state.var[*c];
+		OBJ_STEP_SIZE(v) = state.var[*c];
 	c++;
 	v->move.flag = *(c++);			// flag
 	flag_reset(v->move.flag);
-	v->flags |= O_UPDATE;
+	OBJ_FLAGS(v) |= O_UPDATE;
 	if ( v == objtable )
 		state.ego_control_state = 0;
 	obj_move_update(v);
@@ -79,15 +79,15 @@ u8 *cmd_follow_ego(u8 *c)
 	v = &objtable[*(c++)];
 	
 	v->motion = MT_FOLLOW;
-	if (*c <= v->step_size)
-		v->follow.step_size = v->step_size;
+	if (*c <= OBJ_STEP_SIZE(v))
+		v->follow.step_size = OBJ_STEP_SIZE(v);
 	else
 		v->follow.step_size = *c;
 	c++;
 	v->follow.flag = *(c++);
 	flag_reset(v->follow.flag);
 	v->follow.count = 0xFF;
-	v->flags |= O_UPDATE;
+	OBJ_FLAGS(v) |= O_UPDATE;
 	return c;
 }
 
@@ -99,7 +99,7 @@ u8 *cmd_wander(u8 *c)
 	if ( v == objtable)
 		state.ego_control_state = 0;
 	v->motion = MT_WANDER;
-	v->flags |= O_UPDATE;
+	OBJ_FLAGS(v) |= O_UPDATE;
 	return c;
 }
 
@@ -115,7 +115,7 @@ u8 *cmd_stop_motion(u8 *c)
 {
 	VIEW *v;
 	v = &objtable[*(c++)];
-	v->direction = 0;
+	OBJ_DIRECTION(v) = 0;
 	v->motion = MT_NORM;
 	if ( v == objtable)
 	{
@@ -143,7 +143,7 @@ u8 *cmd_step_size(u8 *c)
 {
 	VIEW *temp;
 	temp = &objtable[*(c++)];
-	temp->step_size = state.var[*(c++)];
+	OBJ_STEP_SIZE(temp) = state.var[*(c++)];
 	return c;
 }
 
@@ -151,8 +151,8 @@ u8 *cmd_step_time(u8 *c)
 {
 	VIEW *v;
 	v = &objtable[*(c++)];
-	v->step_count = state.var[*(c++)];
-	v->step_time = v->step_count;
+	OBJ_STEP_COUNT(v) = state.var[*(c++)];
+	OBJ_STEP_TIME(v) = OBJ_STEP_COUNT(v);
 	return c;
 }
 
@@ -161,7 +161,7 @@ u8 *cmd_set_dir(u8 *c)
 {
 	VIEW *temp;
 	temp = &objtable[*(c++)];
-	temp->direction = state.var[*(c++)];
+	OBJ_DIRECTION(temp) = state.var[*(c++)];
 	return c;
 }
 
@@ -170,7 +170,7 @@ u8 *cmd_get_dir(u8 *c)
 {
 	VIEW *temp;
 	temp = &objtable[*(c++)];
-	state.var[*(c++)] = temp->direction;
+	state.var[*(c++)] = OBJ_DIRECTION(temp);
 	return c;
 }
 
@@ -18,6 +18,16 @@ _VidMode_Get                     cseg     000059AC 00000015
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define CTL_SSE2 1
+#include <emmintrin.h>
+#elif defined(__aarch64__)
+#define CTL_NEON 1
+#include <arm_neon.h>
+#endif
 
 /* OTHER headers	---	---	---	---	---	---	--- */
 //#include "view/crap.h"
@@ -32,9 +42,24 @@ _VidMode_Get                     cseg     000059AC 00000015
 
 /* PROTOTYPES	---	---	---	---	---	---	--- */
 static u16 obj_chk_walk_area(VIEW *v);
+static void ctl_build(void);
+static int ctl_first(const u64 *a, const u64 *b, int x0, int x1);
+static int ctl_all(const u64 *a, int x0, int x1);
+static int ctl_water(const u8 *pb, int len);
 
 
 /* VARIABLES	---	---	---	---	---	---	--- */
+// one bit per pixel for each of the control priorities 0-3, built from
+// gfx_picbuff the first time it's checked after the picture changes.
+// objects never change these pixels except for covering water so the
+// picture's copy stays good while the blit lists come and go.
+#define CTL_WORDS ((PICBUFF_WIDTH+63)/64)
+enum { CTL_OBSTACLE, CTL_BLOCK, CTL_SIGNAL, CTL_WATER, CTL_KINDS };
+
+static u64 ctl_bits[CTL_KINDS][PICBUFF_HEIGHT][CTL_WORDS];
+// obstacles and blocks together, what stops an object that observes blocks
+static u64 ctl_stop[PICBUFF_HEIGHT][CTL_WORDS];
+static u8 ctl_valid = 0;
 
 
 /* CODE	---	---	---	---	---	---	---	--- */
@@ -62,6 +87,137 @@ void table_init()
 	}
 }
 
+// the picture buffer's been redrawn.. the bitmaps get rebuilt on the next check
+void obj_ctl_invalidate(void)
+{
+	ctl_valid = 0;
+}
+
+#if defined(CTL_NEON)
+// a bit per byte of a compare result, like sse2's movemask
+static u16 ctl_movemask(uint8x16_t eq)
+{
+	static const u8 weight[16] = {1,2,4,8,16,32,64,128, 1,2,4,8,16,32,64,128};
+	uint8x16_t w = vandq_u8(eq, vld1q_u8(weight));
+
+	return (u16)(vaddv_u8(vget_low_u8(w)) | (vaddv_u8(vget_high_u8(w)) << 8));
+}
+#endif
+
+// 16 pixels at a time, a compare per control priority gives 16 of its bits.
+// rows are aligned and 16 pixels never straddle a word
+static void ctl_build(void)
+{
+	u8 *pb;
+	u8 pri;
+	int x, y;
+
+	memset(ctl_bits, 0, sizeof(ctl_bits));
+	pb = gfx_picbuff;
+	for (y=0; y<PICBUFF_HEIGHT; y++)
+	{
+		x = 0;
+#if defined(CTL_SSE2)
+		for (; x<PICBUFF_WIDTH; x+=16, pb+=16)
+		{
+			__m128i p = _mm_and_si128(_mm_load_si128((const __m128i *)pb), _mm_set1_epi8((char)0xF0));
+
+			for (pri=0; pri<CTL_KINDS; pri++)
+				ctl_bits[pri][y][x>>6] |= (u64)(u16)_mm_movemask_epi8(
+					_mm_cmpeq_epi8(p, _mm_set1_epi8((char)(pri<<4)))) << (x&63);
+		}
+#elif defined(CTL_NEON)
+		for (; x<PICBUFF_WIDTH; x+=16, pb+=16)
+		{
+			uint8x16_t p = vshrq_n_u8(vld1q_u8(pb), 4);
+
+			for (pri=0; pri<CTL_KINDS; pri++)
+				ctl_bits[pri][y][x>>6] |= (u64)ctl_movemask(vceqq_u8(p, vdupq_n_u8(pri))) << (x&63);
+		}
+#endif
+		for (; x<PICBUFF_WIDTH; x++)
+		{
+			pri = *(pb++) >> 4;
+			if (pri < CTL_KINDS)
+				ctl_bits[pri][y][x>>6] |= (u64)1 << (x&63);
+		}
+	}
+	for (y=0; y<PICBUFF_HEIGHT; y++)
+		for (x=0; x<CTL_WORDS; x++)
+			ctl_stop[y][x] = ctl_bits[CTL_OBSTACLE][y][x] | ctl_bits[CTL_BLOCK][y][x];
+	ctl_valid = 1;
+}
+
+static int ctl_ctz(u64 w)
+{
+#if defined(_MSC_VER)
+	unsigned long i;
+	_BitScanForward64(&i, w);
+	return (int)i;
+#else
+	return __builtin_ctzll(w);
+#endif
+}
+
+// mask of the bits in word i that fall inside x0..x1-1
+static u64 ctl_mask(int i, int x0, int x1)
+{
+	u64 m;
+
+	m = ~(u64)0;
+	if (i == (x0>>6))
+		m &= ~(u64)0 << (x0&63);
+	if (i == ((x1-1)>>6))
+		m &= ~(u64)0 >> (63 - ((x1-1)&63));
+	return m;
+}
+
+// first bit set in a or b between x0 and x1.  returns x1 if there's none
+static int ctl_first(const u64 *a, const u64 *b, int x0, int x1)
+{
+	u64 w;
+	int i;
+
+	if (x0 >= x1)
+		return x1;
+	for (i=x0>>6; i<=((x1-1)>>6); i++)
+	{
+		w = a[i];
+		if (b != 0)
+			w |= b[i];
+		w &= ctl_mask(i, x0, x1);
+		if (w != 0)
+			return (i<<6) + ctl_ctz(w);
+	}
+	return x1;
+}
+
+// every bit set between x0 and x1
+static int ctl_all(const u64 *a, int x0, int x1)
+{
+	u64 m;
+	int i;
+
+	if (x0 >= x1)
+		return 1;
+	for (i=x0>>6; i<=((x1-1)>>6); i++)
+	{
+		m = ctl_mask(i, x0, x1);
+		if ((a[i] & m) != m)
+			return 0;
+	}
+	return 1;
+}
+
+// the picture says it's all water but an object might be standing in it
+static int ctl_water(const u8 *pb, int len)
+{
+	while (len-- > 0)
+		if ( (*(pb++) & 0xF0) != 0x30)
+			return 0;
+	return 1;
+}
+
 // reads the base line of the obj and checks for water / alarms/ obstacles .. stuff like that
 // returns 1 if not on a control line
 // returns 0 if it is
@@ -70,57 +226,52 @@ void table_init()
 // be completely immersed in the stuff
 u16 obj_chk_control(VIEW *v)
 {
-	u8 *pb;
 	u16 flag_control, flag_water, flag_signal;	// flag_control = di;, flag_water = bl  flag_signal = bh;
-	u8 pri;
-	u16 cx;
+	int x0, x1, stop;
 	
-	if ( (v->flags & O_PRIFIXED) == 0)
-		v->priority = pri_table[v->y];
+	if ( (OBJ_FLAGS(v) & O_PRIFIXED) == 0)
+		v->priority = pri_table[OBJ_Y(v)];
 	
-	pb = gfx_picbuff + PBUF_MULT(v->y) + v->x;
 	flag_water = 0;
 	flag_signal = 0;
-
-	cx = v->cel_data[0];	// cel width
 	flag_control = 1;
 
 	if (v->priority != 0x0F)
 	{
-		flag_signal = 0;
-		flag_water = 1;
+		if (ctl_valid == 0)
+			ctl_build();
 
-		do
+		x0 = OBJ_X(v);
+		x1 = x0 + v->cel_data[0];	// cel width
+		if (x1 > PICBUFF_WIDTH)
+			x1 = PICBUFF_WIDTH;
+
+		// the first obstacle, or conditional if we observe blocks, ends the scan
+		stop = ctl_first(((OBJ_FLAGS(v)&O_BLOCKIGNORE) == 0) ? ctl_stop[OBJ_Y(v)] : ctl_bits[CTL_OBSTACLE][OBJ_Y(v)],
+				0, x0, x1);
+		flag_signal = ctl_first(ctl_bits[CTL_SIGNAL][OBJ_Y(v)], 0, x0, stop) != stop;	// alarm
+
+		if (stop != x1)
 		{
-			pri = *(pb++) & 0xF0;
-			if (pri == 0)	// obstacle
-			{
-				flag_control = 0;
-				goto check_finish;
-			}	
-			if ( pri != 0x30) 				// water
-			{
-				flag_water = 0;			// we're not on water sorry
-				if ( pri == 0x10)			// conditional 
-				{
-					if ( ( v->flags&O_BLOCKIGNORE) == 0) // observe blocks
-					{
-						flag_control = 0;
-						goto check_finish;
-					}
-				}
-				else if (pri == 0x20)
-					flag_signal = 1;	// alarm
-			}
-			cx--;
-		} while (cx != 0);
+			flag_control = 0;
+			// a conditional line isn't water.. an obstacle doesn't count
+			flag_water = 0;
+			if ((ctl_bits[CTL_OBSTACLE][OBJ_Y(v)][stop>>6] >> (stop&63)) & 1)
+				flag_water = ctl_all(ctl_bits[CTL_WATER][OBJ_Y(v)], x0, stop) &&
+					ctl_water(gfx_picbuff + PBUF_MULT(OBJ_Y(v)) + x0, stop - x0);
+			goto check_finish;
+		}
+
+		// we're only on water if it's the ONLY thing under us
+		flag_water = ctl_all(ctl_bits[CTL_WATER][OBJ_Y(v)], x0, x1) &&
+			ctl_water(gfx_picbuff + PBUF_MULT(OBJ_Y(v)) + x0, x1 - x0);
 		
 		if (flag_water != 1)
 		{
-			if ( (v->flags&O_WATER) != 0)	// view on water = 1
+			if ( (OBJ_FLAGS(v)&O_WATER) != 0)	// view on water = 1
 				flag_control = 0;
 		}
-		else if ( (v->flags&O_LAND) != 0) 
+		else if ( (OBJ_FLAGS(v)&O_LAND) != 0) 
 			flag_control = 0;	// view on land = 1
 	}
 
@@ -141,6 +292,45 @@ check_finish:
 	return flag_control;
 }
 
+// would the object's base line stay off obstacles (and blocks, unless it
+// ignores them) for steps steps of dx,dy?  the edges and horizon count too.
+// other objects don't, they'll have moved by then.  returns 1 if it would
+u16 obj_ctl_clear(VIEW *v, s16 dx, s16 dy, u16 steps)
+{
+	u64 (*stop)[CTL_WORDS];
+	s16 x, y;
+	int x1, water;
+
+	if ( ((OBJ_FLAGS(v) & O_PRIFIXED) != 0) && (v->priority == 0x0F) )
+		return 1;
+	if (ctl_valid == 0)
+		ctl_build();
+
+	stop = ((OBJ_FLAGS(v)&O_BLOCKIGNORE) == 0) ? ctl_stop : ctl_bits[CTL_OBSTACLE];
+	x = OBJ_X(v);
+	y = OBJ_Y(v);
+	while (steps-- > 0)
+	{
+		x += dx;
+		y += dy;
+		if ( (x < 0) || ((x+v->x_size) > PICBUFF_WIDTH) || (y > 167) || ((y-v->y_size) < -1) )
+			return 0;
+		if ( ((OBJ_FLAGS(v)&O_HORIZONIGNORE) == 0) && (state.horizon >= y) )
+			return 0;
+
+		x1 = x + v->x_size;
+		if (ctl_first(stop[y], 0, x, x1) != x1)
+			return 0;
+		if ( (OBJ_FLAGS(v) & (O_WATER|O_LAND)) != 0)
+		{
+			water = ctl_all(ctl_bits[CTL_WATER][y], x, x1);
+			if ( (((OBJ_FLAGS(v)&O_WATER) != 0) && !water) || (((OBJ_FLAGS(v)&O_LAND) != 0) && water) )
+				return 0;
+		}
+	}
+	return 1;
+}
+
 // updates the screen with new cel
 // determines the exact coordinates on the pbuff to remove old and draw new cel
 void obj_cel_update(VIEW *v)
@@ -164,17 +354,17 @@ void obj_cel_update(VIEW *v)
 	
 	{
 		s16 y2, h1, h2;
-		if (v->y < v->y_prev)
+		if (OBJ_Y(v) < v->y_prev)
 		{
 			y = v->y_prev;
-			y2 = v->y;
+			y2 = OBJ_Y(v);
 
 			h1 = c_prev_h;
 			h2 = c[1];	
 		}
 		else
 		{
-			y = v->y;
+			y = OBJ_Y(v);
 			y2 = v->y_prev;
 			h1 = c[1];		// height
 			h2 = c_prev_h;	 // height
@@ -189,16 +379,16 @@ void obj_cel_update(VIEW *v)
 	{
 		s16 x2, w1, w2;
 
-		if (v->x > v->x_prev)
+		if (OBJ_X(v) > v->x_prev)
 		{
 			x = v->x_prev;
-			x2 = v->x;
+			x2 = OBJ_X(v);
 			w1 = c_prev_w;
 			w2 = c[0];
 		}
 		else
 		{
-			x = v->x;
+			x = OBJ_X(v);
 			x2 = v->x_prev;
 			w1 = c[0];		// width
 			w2 = c_prev_w;	// width
@@ -229,15 +419,16 @@ void obj_add_pic_pri(VIEW *v)
 	u8 height;		// height of the box
 	
 	if ((v->priority & 0x0F) == 0)
-		v->priority = v->priority | pri_table[v->y];
+		v->priority = v->priority | pri_table[OBJ_Y(v)];
 	obj_blit(v);
+	obj_ctl_invalidate();
 	
 	if (v->priority > 0x3F)
 		return;	
 	
 	// count up from current priority to find the size of the box that is at the view's feet
 	// this prevents the ego from walking into a different priority or walking through the view.
-	cx = v->y;
+	cx = OBJ_Y(v);
 	pri_height = 0;
 	do
 	{
@@ -246,14 +437,14 @@ void obj_add_pic_pri(VIEW *v)
 			break;
 		cx--;
 	}
-	while (pri_table[cx] == pri_table[v->y]);
+	while (pri_table[cx] == pri_table[OBJ_Y(v)]);
 
 	height = (v->cel_data)[1];	// height
 	if ( (height > pri_height))
 		height = pri_height;
 	
 	// draw the box  -------------------------------
-	pb = gfx_picbuff + PBUF_MULT(v->y) + v->x;
+	pb = gfx_picbuff + PBUF_MULT(OBJ_Y(v)) + OBJ_X(v);
 	
 	// bottom line
 	cx = (v->cel_data)[0];
@@ -267,7 +458,7 @@ void obj_add_pic_pri(VIEW *v)
 	// if there's a height..we'll build it.. or something
 	if (height > 1) 
 	{
-		pb = gfx_picbuff + PBUF_MULT(v->y) + v->x;
+		pb = gfx_picbuff + PBUF_MULT(OBJ_Y(v)) + OBJ_X(v);
 		
 		// the sides
 		sideoff = (v->cel_data)[0] - 1;
@@ -294,91 +485,6 @@ void obj_add_pic_pri(VIEW *v)
 	}
 }
 
-// mirror the current cel in the view
-void obj_cel_mirror(VIEW *v)
-{
-	s8 tran_size;	// in pixels.. size of transparent start (veg) and other data (meat)
-	u8 meat_size;	// in pixels.. size of data (meat)
-	u8 al;
-	u16 h_count;
-	
-	u8 buff_in_stack[0x800];
-	u8 *buff;
-	u8 *cel;
-	u8 *cel_orig;
-	u8 width;
-	u8 trans;
-	
-	cel = v->cel_data;
-	// cel[2] = cel info
-	// number of loop NOT mirrored
-	if ( ((cel[2]&0x70)>>4) != v->loop_cur )
-	{
-		// change the loop contained in the cel info
-		cel[2] = (0x8F & cel[2]) | ( (v->loop_cur) << 4);	// ~ 0x70
-
-		buff = buff_in_stack;
-		width = *(cel++);	// width
-		h_count = *(cel++);	// height
-		trans = *(cel++) << 4;	// trans colour left shifted
-		
-		do
-		{
-			meat_size = 0;
-			tran_size = width;
-			
-			// read in the first couple of "assumed" transparent characters
-			// if you reach an end of line then it's an empty line.. so just put in a 0
-			al = *(cel++);
-			while (  (al != 0) && ((al&0xF0)==trans)  )
-			{
-				tran_size -= al&0x0F;
-				al = *(cel++);
-			}
-			
-			if (al != 0)
-			{
-				al &= 0x0F;	// size
-				// determine the length of the actual data
-				do
-				{
-					tran_size -= al;
-					meat_size++;
-					al = *(cel++)&0x0F;	// size
-				}
-				while (al != 0);
-				
-				// fill in a big bunch of transparent pixels
-				while (tran_size >= 0x0F)	// full 15 pixel transparency
-				{
-					*(buff++) = trans|0x0F;
-					tran_size -= 0x0F;
-				}
-				if (tran_size > 0)			// the bits left over
-					*(buff++) = trans|tran_size;
-				
-				// draw the meat in reverse
-				cel_orig = cel;
-				cel -= 2;	// skip the current chunk and the '0' chunk
-				while (meat_size > 0)
-				{
-					*(buff++) = *(cel--);
-					meat_size--;
-				}
-				cel = cel_orig;
-			}
-
-			// end of the line
-			*(buff++) = 0;
-			h_count--;
-		}
-		while (h_count != 0);
-		
-		// copy the buffer into the cel.
-		memcpy(v->cel_data+3, buff_in_stack, buff - buff_in_stack);
-	}
-}
-	
 // shifts the view around in a sprial under it's in a walkable area, not contacting anything and 
 // not on a control line
 // counter-clockwise
@@ -388,8 +494,8 @@ void obj_pos_shuffle(VIEW *v)
 	u16 shift_dir;	// shift direction
 	u16 shift_size;	// size of the shift until next time
 	
-	if (  (v->y <= state.horizon) && ((v->flags&O_HORIZONIGNORE) == 0)  )
-		v->y = state.horizon+1;
+	if (  (OBJ_Y(v) <= state.horizon) && ((OBJ_FLAGS(v)&O_HORIZONIGNORE) == 0)  )
+		OBJ_Y(v) = state.horizon+1;
 
 	if (obj_chk_walk_area(v) != 0)	// walkable
 		if (obj_chk_contact(v) == 0)	// no contact with other obj
@@ -404,7 +510,7 @@ void obj_pos_shuffle(VIEW *v)
 		switch(shift_dir)
 		{
 			case 0:		// left
-				v->x--;
+				OBJ_X(v)--;
 				shift_count--;
 				if (shift_count == 0)
 				{
@@ -413,7 +519,7 @@ void obj_pos_shuffle(VIEW *v)
 				}
 				break;
 			case 1:		// down
-				v->y++;
+				OBJ_Y(v)++;
 				shift_count--;
 				if (shift_count == 0)
 				{
@@ -423,7 +529,7 @@ void obj_pos_shuffle(VIEW *v)
 				}
 				break;
 			case 2:		// right
-				v->x++;
+				OBJ_X(v)++;
 				shift_count--;
 				if (shift_count == 0)
 				{
@@ -432,7 +538,7 @@ void obj_pos_shuffle(VIEW *v)
 				}
 				break;
 			case 3:		// up
-				v->y--;
+				OBJ_Y(v)--;
 				shift_count--;
 				if (shift_count == 0)
 				{
@@ -448,11 +554,11 @@ void obj_pos_shuffle(VIEW *v)
 // else return 0
 static u16 obj_chk_walk_area(VIEW *v)
 {
-	if (v->x < 0) return 0;
-	if ((v->x + v->x_size) > 160 ) return 0;
-	if ((v->y - v->y_size) < -1) return 0;
-	if (v->y > 167) return 0;
-	if ( ((v->flags&O_HORIZONIGNORE)==0) && (v->y<=state.horizon) )
+	if (OBJ_X(v) < 0) return 0;
+	if ((OBJ_X(v) + v->x_size) > 160 ) return 0;
+	if ((OBJ_Y(v) - v->y_size) < -1) return 0;
+	if (OBJ_Y(v) > 167) return 0;
+	if ( ((OBJ_FLAGS(v)&O_HORIZONIGNORE)==0) && (OBJ_Y(v)<=state.horizon) )
 		return 0;
 	
 	return 1;	// object is within walking area
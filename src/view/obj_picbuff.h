@@ -7,10 +7,11 @@ extern u8 pri_table[172];
 
 /* FUNCTIONS	---	---	---	---	---	---	--- */
 extern void table_init(void);
+extern void obj_ctl_invalidate(void);
 extern u16 obj_chk_control(VIEW *v);
+extern u16 obj_ctl_clear(VIEW *v, s16 dx, s16 dy, u16 steps);
 extern void obj_cel_update(VIEW *v);
 extern void obj_add_pic_pri(VIEW *v);
-extern void obj_cel_mirror(VIEW *v);
 extern void obj_pos_shuffle(VIEW *v);
 
 #endif /* NAGI_VIEW_OBJ_PICBUFF_H */
@@ -28,10 +28,10 @@ u8 *cmd_position(u8 *c)
 	
 	v = &objtable[*(c++)];
 	v->x_prev = *(c++);
-	v->x = v->x_prev;
+	OBJ_X(v) = v->x_prev;
 	
 	v->y_prev = *(c++);
-	v->y = v->y_prev;
+	OBJ_Y(v) = v->y_prev;
 	
 	return c;
 }
@@ -42,10 +42,10 @@ u8 *cmd_position_v(u8 *c)
 	
 	v = &objtable[*(c++)];
 	v->x_prev = state.var[*(c++)];
-	v->x = v->x_prev;
+	OBJ_X(v) = v->x_prev;
 	
 	v->y_prev = state.var[*(c++)];
-	v->y = v->y_prev;
+	OBJ_Y(v) = v->y_prev;
 	
 	return c;
 }
@@ -55,8 +55,8 @@ u8 *cmd_get_position(u8 *c)
 	VIEW *v;
 	
 	v = &objtable[*(c++)];
-	state.var[*(c++)] = v->x;
-	state.var[*(c++)] = v->y;	
+	state.var[*(c++)] = OBJ_X(v);
+	state.var[*(c++)] = OBJ_Y(v);	
 	return c;
 }
 
@@ -67,21 +67,21 @@ u8 *cmd_reposition(u8 *c)
 		
 	v = &objtable[*(c++)];
 	
-	v->flags |= O_REPOS;
+	OBJ_FLAGS(v) |= O_REPOS;
 	
 	offset = (s8)state.var[*(c++)];	// SIGNED
 	
-	if ( (offset<0) && (v->x<(-offset)) )
-		v->x = 0;
+	if ( (offset<0) && (OBJ_X(v)<(-offset)) )
+		OBJ_X(v) = 0;
 	else
-		v->x += offset;
+		OBJ_X(v) += offset;
 	
 	offset = (s8)state.var[*(c++)];	// SIGNED
 	
-	if ( (offset<0) && (v->y<(-offset)) )
-		v->y = 0;
+	if ( (offset<0) && (OBJ_Y(v)<(-offset)) )
+		OBJ_Y(v) = 0;
 	else
-		v->y += offset;
+		OBJ_Y(v) += offset;
 	
 	obj_pos_shuffle(v);		// make sure it's not on a control line ro something
 	return c; 
@@ -92,9 +92,9 @@ u8 *cmd_reposition_to(u8 *c)
 	VIEW *v;
 	
 	v = &objtable[*(c++)];
-	v->x = *(c++);
-	v->y = *(c++);
-	v->flags |= O_REPOS;
+	OBJ_X(v) = *(c++);
+	OBJ_Y(v) = *(c++);
+	OBJ_FLAGS(v) |= O_REPOS;
 	obj_pos_shuffle(v);	
 	return c;
 }
@@ -104,28 +104,28 @@ u8 *cmd_reposition_to_v(u8 *c)
 	VIEW *v;
 	
 	v = &objtable[*(c++)];
-	v->x = state.var[*(c++)];
-	v->y = state.var[*(c++)];
-	v->flags |= O_REPOS;
+	OBJ_X(v) = state.var[*(c++)];
+	OBJ_Y(v) = state.var[*(c++)];
+	OBJ_FLAGS(v) |= O_REPOS;
 	obj_pos_shuffle(v);	
 	return c;
 }
 
 u8 *cmd_obj_on_water(u8 *c)
 {
-	objtable[*(c++)].flags |= O_WATER;	//8
+	OBJ_FLAGS(&objtable[*(c++)]) |= O_WATER;	//8
 	return c;
 }
 
 u8 *cmd_obj_on_land(u8 *c)
 {
-	objtable[*(c++)].flags |= O_LAND;	//11
+	OBJ_FLAGS(&objtable[*(c++)]) |= O_LAND;	//11
 	return c;
 }
 
 u8 *cmd_obj_on_anything(u8 *c)
 {
-	objtable[*(c++)].flags &= ~(O_LAND|O_WATER);	// turn off 11, 8
+	OBJ_FLAGS(&objtable[*(c++)]) &= ~(O_LAND|O_WATER);	// turn off 11, 8
 	return c;
 }
 
@@ -137,13 +137,13 @@ u8 *cmd_set_horizon(u8 *c)
 
 u8 *cmd_ignore_horizon(u8 *c)
 {
-	objtable[*(c++)].flags |= O_HORIZONIGNORE;	// turn on bit 3
+	OBJ_FLAGS(&objtable[*(c++)]) |= O_HORIZONIGNORE;	// turn on bit 3
 	return c;
 }
 
 u8 *cmd_observe_horizon(u8 *c)
 {
-	objtable[*(c++)].flags &= ~O_HORIZONIGNORE;	// turn of bit 3
+	OBJ_FLAGS(&objtable[*(c++)]) &= ~O_HORIZONIGNORE;	// turn of bit 3
 	return c;
 }
 
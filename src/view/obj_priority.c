@@ -14,14 +14,14 @@ u8 *cmd_set_priority(u8 *c)
 {
 	VIEW *v;
 	v = &objtable[*(c++)];
-	v->flags |= O_PRIFIXED;
+	OBJ_FLAGS(v) |= O_PRIFIXED;
 	v->priority = *(c++);
 	return c;
 }
 
 u8 *cmd_release_priority(u8 *c)
 {
-	objtable[*(c++)].flags &= ~O_PRIFIXED;
+	OBJ_FLAGS(&objtable[*(c++)]) &= ~O_PRIFIXED;
 	return c;
 }
 
@@ -37,7 +37,7 @@ u8 *cmd_set_priority_v(u8 *c)
 {
 	VIEW *v;
 	v = &objtable[*(c++)];
-	v->flags |= O_PRIFIXED;
+	OBJ_FLAGS(v) |= O_PRIFIXED;
 	v->priority = state.var[*(c++)];
 	return c;
 }
@@ -5,12 +5,148 @@ CmdObserveObjs                   cseg     000047C7 00000028
 CmdDistance                      cseg     000047EF 000000C0
 */
 
+#define MEM_TAG MEM_VIEW
+
 #include <stdlib.h>
+#include <string.h>
 
 #include "../agi.h"
 
 #include "obj_base.h"
 #include "obj_proximity.h"
+#include "../sys/mem_wrap.h"
+
+static u16 obj_contact(VIEW *v, VIEW *c);
+
+// CONTACT GRID
+// while objs_step_update() runs, the objects that can be touched are kept
+// in columns of the screen so obj_chk_contact() only looks at the ones
+// that could overlap in x.  only x, since objects that swap y order
+// between steps are in contact however far apart they end up.
+// objects are re-filed by obj_grid_move() after they step.
+
+#define GRID_COL_W 8
+#define GRID_COLS (160/GRID_COL_W)
+
+static u16 grid_active = 0;
+static u16 grid_max = 0;		// objects per column
+static VIEW **grid_col[GRID_COLS];
+static u16 grid_count[GRID_COLS];
+static u8 *grid_first = 0;		// columns an object is filed in
+static u8 *grid_last = 0;
+static u8 *grid_filed = 0;
+static u16 *grid_seen = 0;		// last query that looked at an object
+static u16 grid_query = 0;
+
+#define GRID_ID(v) ((v) - objtable)
+
+static int grid_col_of(s16 x)
+{
+	if (x < 0)
+		return 0;
+	if (x / GRID_COL_W >= GRID_COLS)
+		return GRID_COLS - 1;
+	return x / GRID_COL_W;
+}
+
+static void grid_add(VIEW *v)
+{
+	int col;
+
+	grid_first[GRID_ID(v)] = grid_col_of(OBJ_X(v));
+	grid_last[GRID_ID(v)] = grid_col_of(OBJ_X(v) + v->x_size);
+	for (col = grid_first[GRID_ID(v)]; col <= grid_last[GRID_ID(v)]; col++)
+		grid_col[col][grid_count[col]++] = v;
+	grid_filed[GRID_ID(v)] = 1;
+}
+
+static void grid_remove(VIEW *v)
+{
+	int col;
+	u16 i;
+
+	if (grid_filed[GRID_ID(v)] == 0)
+		return;
+	for (col = grid_first[GRID_ID(v)]; col <= grid_last[GRID_ID(v)]; col++)
+		for (i = 0; i < grid_count[col]; i++)
+			if (grid_col[col][i] == v)
+			{
+				grid_col[col][i] = grid_col[col][--grid_count[col]];
+				break;
+			}
+	grid_filed[GRID_ID(v)] = 0;
+}
+
+// file every object that obj_chk_contact() could report
+void obj_grid_build(void)
+{
+	VIEW *v;
+	u16 total;
+	int col;
+
+	total = objtable_tail - objtable;
+	if (total > grid_max)
+	{
+		for (col = 0; col < GRID_COLS; col++)
+		{
+			a_free(grid_col[col]);
+			grid_col[col] = a_malloc(total * sizeof(VIEW *));
+		}
+		a_free(grid_first);
+		a_free(grid_last);
+		a_free(grid_filed);
+		a_free(grid_seen);
+		grid_first = a_malloc(total);
+		grid_last = a_malloc(total);
+		grid_filed = a_malloc(total);
+		grid_seen = a_malloc(total * sizeof(u16));
+		memset(grid_seen, 0, total * sizeof(u16));
+		grid_max = total;
+	}
+
+	memset(grid_count, 0, sizeof(grid_count));
+	memset(grid_filed, 0, grid_max);
+	for (v=objtable ; v<objtable_tail ; v++)
+		if ( ((OBJ_FLAGS(v) & (O_DRAWN|O_ANIMATE)) == (O_DRAWN|O_ANIMATE))
+			&& ((OBJ_FLAGS(v) & O_OBJIGNORE) == 0) )
+			grid_add(v);
+	grid_active = 1;
+}
+
+// the object's x or size changed
+void obj_grid_move(VIEW *v)
+{
+	if ( (grid_active == 0) || (grid_filed[GRID_ID(v)] == 0) )
+		return;
+	grid_remove(v);
+	grid_add(v);
+}
+
+void obj_grid_done(void)
+{
+	grid_active = 0;
+}
+
+// the baseline test between two objects
+static u16 obj_contact(VIEW *v, VIEW *c)
+{
+	if (v->num == c->num)
+		return 0;
+	if ( (OBJ_X(v) + v->x_size) < OBJ_X(c))
+		return 0;
+	if ( (OBJ_X(c) + c->x_size) < OBJ_X(v))
+		return 0;
+
+	if (OBJ_Y(v) == OBJ_Y(c))
+		return 1;
+	if (OBJ_Y(v) > OBJ_Y(c))
+		if ( v->y_prev < c->y_prev)
+			return 1;
+	if (OBJ_Y(v) < OBJ_Y(c))
+		if (v->y_prev > c->y_prev)
+			return 1;
+	return 0;
+}
 
 
 // returns 1 if the given view's baseline has touched another view's baseline
@@ -19,42 +155,57 @@ CmdDistance                      cseg     000047EF 000000C0
 u16 obj_chk_contact(VIEW *v)
 {
 	VIEW *c;	// current
+	int col, col_last;
+	u16 i;
 
-	if ( (v->flags & O_OBJIGNORE) == 0)	// if ignore objects.. return 0
+	if ( (OBJ_FLAGS(v) & O_OBJIGNORE) != 0)	// if ignore objects.. return 0
+		return 0;
+
+	if (grid_active != 0)
 	{
-		for (c=objtable ; c<objtable_tail ; c++)
+		// an object filed in more than one column is only tested once
+		grid_query++;
+		if (grid_query == 0)
 		{
-			if ((c->flags & (O_DRAWN|O_ANIMATE)) != (O_DRAWN|O_ANIMATE)) goto loc472e;	// 6 0
-			if ((c->flags & O_OBJIGNORE) != 0) goto loc472e;	// 9
-			if (v->num == c->num) goto loc472e;
-			if ( (v->x + v->x_size) < c->x) goto loc472e;
-			if ( (c->x + c->x_size) < v->x) goto loc472e;
-		
-			if (v->y == c->y)
-				return 1;
-			if (v->y > c->y)
-				if ( v->y_prev < c->y_prev)
-					return 1;
-			if (v->y < c->y)
-				if (v->y_prev > c->y_prev)
-					return 1;
-			
-			loc472e:
-				;
+			memset(grid_seen, 0, grid_max * sizeof(u16));
+			grid_query = 1;
 		}
+
+		col_last = grid_col_of(OBJ_X(v) + v->x_size);
+		for (col = grid_col_of(OBJ_X(v)) ; col <= col_last ; col++)
+			for (i = 0 ; i < grid_count[col] ; i++)
+			{
+				c = grid_col[col][i];
+				if (grid_seen[GRID_ID(c)] == grid_query)
+					continue;
+				grid_seen[GRID_ID(c)] = grid_query;
+				if (obj_contact(v, c) != 0)
+					return 1;
+			}
+		return 0;
+	}
+
+	for (c=objtable ; c<objtable_tail ; c++)
+	{
+		if ((OBJ_FLAGS(c) & (O_DRAWN|O_ANIMATE)) != (O_DRAWN|O_ANIMATE))	// 6 0
+			continue;
+		if ((OBJ_FLAGS(c) & O_OBJIGNORE) != 0)	// 9
+			continue;
+		if (obj_contact(v, c) != 0)
+			return 1;
 	}
 	return 0;
 }
 
 u8 *cmd_ignore_objects(u8 *c)
 {
-	objtable[*(c++)].flags |= O_OBJIGNORE;		// 9
+	OBJ_FLAGS(&objtable[*(c++)]) |= O_OBJIGNORE;		// 9
 	return c;
 }
 
 u8 *cmd_observe_objects(u8 *c)
 {
-	objtable[*(c++)].flags &= ~O_OBJIGNORE;	// 9
+	OBJ_FLAGS(&objtable[*(c++)]) &= ~O_OBJIGNORE;	// 9
 	return c;
 }
 
@@ -67,14 +218,14 @@ u8 *cmd_distance(u8 *c)
 	v1 = &objtable[*(c++)];
 	v2 = &objtable[*(c++)];
 	
-	if (  ((v1->flags & O_DRAWN) == 0) || ((v2->flags & O_DRAWN) == 0)  )
+	if (  ((OBJ_FLAGS(v1) & O_DRAWN) == 0) || ((OBJ_FLAGS(v2) & O_DRAWN) == 0)  )
 	{
 		state.var[*(c++)] = 255;
 	}
 	else
 	{
-		dis = abs(v1->y - v2->y);
-		dis += abs(v1->x + (v1->x_size/2) -  v2->x - (v2->x_size / 2) );
+		dis = abs(OBJ_Y(v1) - OBJ_Y(v2));
+		dis += abs(OBJ_X(v1) + (v1->x_size/2) -  OBJ_X(v2) - (v2->x_size / 2) );
 		if (dis > 0xFE)
 			state.var[*(c++)] = 0xFE;	// so you dun get confused with 255 (error) I guess
 		else
@@ -1,6 +1,9 @@
 #ifndef NAGI_VIEW_OBJ_PROXIMITY_H
 #define NAGI_VIEW_OBJ_PROXIMITY_H
 
+extern void obj_grid_build(void);
+extern void obj_grid_move(VIEW *v);
+extern void obj_grid_done(void);
 extern u16 obj_chk_contact(VIEW *v);
 extern u8 *cmd_ignore_objects(u8 *c);
 extern u8 *cmd_observe_objects(u8 *c);
@@ -18,17 +18,19 @@ _StartUpdate                     cseg     00006A9B 0000001E
 
 #include "obj_base.h"
 #include "obj_update.h"
+#include "../sys/drv_video.h"
+#include "../sys/vid_render.h"
 
 static void obj_start_update(VIEW *v);
 
 static u16 obj_updated(VIEW *v)
 {
-	return ((v->flags & (O_DRAWN|O_UPDATE|O_ANIMATE)) == (O_DRAWN|O_UPDATE|O_ANIMATE));
+	return ((OBJ_FLAGS(v) & (O_DRAWN|O_UPDATE|O_ANIMATE)) == (O_DRAWN|O_UPDATE|O_ANIMATE));
 }
 
 static u16 obj_static(VIEW *v)
 {
-	return ((v->flags & (O_DRAWN|O_UPDATE|O_ANIMATE)) == (O_DRAWN|O_ANIMATE));
+	return ((OBJ_FLAGS(v) & (O_DRAWN|O_UPDATE|O_ANIMATE)) == (O_DRAWN|O_ANIMATE));
 }
 
 
@@ -64,8 +66,10 @@ void blists_draw()
 
 void blists_update()
 {
+	render_batch_begin();
 	blitlist_update(&blitlist_static);
 	blitlist_update(&blitlist_updated);
+	render_batch_end();
 }
 
 u8 *cmd_stop_update(u8 *c)
@@ -93,20 +97,20 @@ u8 *cmd_force_update(u8 *c)
 
 void obj_stop_update(VIEW *v)
 {
-	if ((v->flags & O_UPDATE) != 0)
+	if ((OBJ_FLAGS(v) & O_UPDATE) != 0)
 	{
 		blists_erase();
-		v->flags &= ~O_UPDATE;
+		OBJ_FLAGS(v) &= ~O_UPDATE;
 		blists_draw();
 	}
 } 
 
 static void obj_start_update(VIEW *v)
 {
-	if ((v->flags & O_UPDATE) == 0)
+	if ((OBJ_FLAGS(v) & O_UPDATE) == 0)
 	{
 		blists_erase();
-		v->flags |= O_UPDATE;
+		OBJ_FLAGS(v) |= O_UPDATE;
 		blists_draw();
 	}
 }
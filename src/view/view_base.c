@@ -34,7 +34,10 @@ CmdDiscardViewV                  cseg     00003EE9 00000024
 _DiscardView                     cseg     00003F0D 0000004A
 */
 
+#define MEM_TAG MEM_VIEW
+
 #include <stdlib.h>
+#include <string.h>
 
 #include "../agi.h"
 #include "../list.h"
@@ -61,23 +64,34 @@ _DiscardView                     cseg     00003F0D 0000004A
 #include "../sys/vid_render.h"
 
 static LIST *view_list = 0;
+static VIEW_NODE *view_index[256];	// the list's nodes by number
 
 
 static void obj_loop_data(VIEW *v, u16 loop_num);
 static void obj_cel_data(VIEW *v, u16 cel_num);
+static void view_cels_new(VIEW_NODE *vn);
+static void view_cels_free(VIEW_NODE *vn);
 
 void view_list_init()
 {
+	VIEW_NODE *vn;
+
 	if (view_list)
+	{
+		for (vn = list_element_head(view_list); vn != 0; vn = node_next(vn))
+			view_cels_free(vn);
 		list_clear(view_list);
+	}
 	else
 		view_list = list_new(sizeof(VIEW_NODE));		
+	memset(view_index, 0, sizeof(view_index));
 }
 
 void view_list_free()
 {
 	if (view_list)
 	{
+		view_list_init();
 		list_free(view_list);
 		view_list = 0;
 	}
@@ -90,14 +104,9 @@ void view_list_new_room()
 
 VIEW_NODE *view_find(u16 num)
 {
-	VIEW_NODE *v;
-	
-	v = list_element_head(view_list);
-	
-	while ( (v) && (num != v->num) )
-		v = node_next(v);
-	
-	return v;
+	if (num >= 256)
+		return 0;
+	return view_index[num];
 }
 	
 	
@@ -129,19 +138,151 @@ VIEW_NODE *view_load(u16 num, u16 force_load)
 		script_write(1, num);
 		v = list_add(view_list);
 		v->num = num;
+		view_index[v->num] = v;
 		v->data = 0;
+		v->loop_first = 0;
+		v->cels = 0;
+		v->cel_total = 0;
 	}
+	else
+		view_cels_free(v);
 
-	v->data = vol_res_load(dir_view(v->num), v->data);
+	v->data = vol_res_room_load(dir_view(v->num), v->data);
 
 	if (v->data == 0)
 		return 0;
 
 	render_view_dither(v->data);
+	view_cels_new(v);
 	blists_draw();
 	return v;
 }
 
+// loops that are mirrors of each other point at the same loop data
+// so they get the same slots
+static void view_cels_new(VIEW_NODE *vn)
+{
+	u16 loop_total;
+	u16 loop_pos;
+	u16 l, prev;
+
+	loop_total = vn->data[2];
+	vn->loop_first = a_malloc((loop_total + 1) * sizeof(u16));
+	vn->cel_total = 0;
+
+	for (l = 0; l < loop_total; l++)
+	{
+		loop_pos = load_le_16(vn->data + 5 + (l << 1));
+		for (prev = 0; prev < l; prev++)
+			if (load_le_16(vn->data + 5 + (prev << 1)) == loop_pos)
+				break;
+
+		if (prev < l)
+			vn->loop_first[l] = vn->loop_first[prev];
+		else
+		{
+			vn->loop_first[l] = vn->cel_total;
+			vn->cel_total += vn->data[loop_pos];
+		}
+	}
+
+	vn->cels = a_malloc((vn->cel_total + 1) * sizeof(VIEW_CEL *));
+	memset(vn->cels, 0, (vn->cel_total + 1) * sizeof(VIEW_CEL *));
+}
+
+static void view_cels_free(VIEW_NODE *vn)
+{
+	u16 i;
+
+	if (vn->cels != 0)
+	{
+		for (i = 0; i < vn->cel_total; i++)
+			a_free(vn->cels[i]);
+		a_free(vn->cels);
+	}
+	a_free(vn->loop_first);
+	vn->cels = 0;
+	vn->loop_first = 0;
+	vn->cel_total = 0;
+}
+
+// unpack the chunks of a cel.  rows stop at the cel width even if the
+// chunks run past it
+static VIEW_CEL *view_cel_decode(const u8 *c)
+{
+	VIEW_CEL *cel;
+	u8 *pix, *mask, *flip;
+	u8 chunk, col, len, tran;
+	u16 size;
+	int x, y;
+
+	size = c[0] * c[1];
+	cel = a_malloc(sizeof(VIEW_CEL) + size * 4);
+	cel->width = c[0];
+	cel->height = c[1];
+	cel->loop = (c[2] & 0x70) >> 4;
+	cel->mirror = (c[2] & 0x80) != 0;
+	cel->pix[0] = (u8 *)(cel + 1);
+	cel->pix[1] = 0;
+	tran = c[2] & 0x0F;
+	c += 3;
+
+	pix = cel->pix[0];
+	mask = pix + size;
+	memset(pix, 0, size * 2);
+	for (y = 0; y < cel->height; y++)
+	{
+		x = 0;
+		while ((chunk = *(c++)) != 0)
+		{
+			col = chunk >> 4;
+			len = chunk & 0x0F;
+			for (; (len != 0) && (x < cel->width); len--, x++)
+			{
+				if (col != tran)
+				{
+					pix[x] = col;
+					mask[x] = 0xFF;
+				}
+			}
+		}
+		pix += cel->width;
+		mask += cel->width;
+	}
+
+	if (cel->mirror)
+	{
+		cel->pix[1] = cel->pix[0] + size * 2;
+		pix = cel->pix[0];
+		flip = cel->pix[1];
+		for (y = 0; y < cel->height * 2; y++)
+		{
+			for (x = 0; x < cel->width; x++)
+				flip[x] = pix[cel->width - 1 - x];
+			pix += cel->width;
+			flip += cel->width;
+		}
+	}
+
+	return cel;
+}
+
+// the decoded form of the object's current cel
+VIEW_CEL *view_cel_get(VIEW *v)
+{
+	VIEW_NODE *vn;
+	VIEW_CEL **slot;
+
+	vn = view_find(v->view_cur);
+	if ((vn == 0) || (vn->data != v->view_data))
+		set_agi_error(0xA, v - objtable);
+
+	slot = &vn->cels[vn->loop_first[v->loop_cur] + v->cel_cur];
+	if (*slot == 0)
+		*slot = view_cel_decode(v->cel_data);
+	return *slot;
+}
+
 u8 *cmd_set_view(u8 *c)
 {
 	u8 view, num;
@@ -259,7 +400,7 @@ u8 *cmd_set_cel(u8 *c)
 	num = *(c++);
 	
 	obj_cel_set(v, num);
-	v->flags &= ~O_SKIPUPDATE;
+	OBJ_FLAGS(v) &= ~O_SKIPUPDATE;
 	return c;
 }
 
@@ -271,7 +412,7 @@ u8 *cmd_set_cel_v(u8 *c)
 	v = &objtable[*(c++)]; // * sizeof(VIEW)
 	num = state.var[*(c++)];
 	obj_cel_set(v, num);
-	v->flags &= ~O_SKIPUPDATE;
+	OBJ_FLAGS(v) &= ~O_SKIPUPDATE;
 	return c;
 }
 
@@ -289,18 +430,18 @@ void obj_cel_set(VIEW *v, u16 cel_num)
 
 	obj_cel_data(v, cel_num);
 
-	if ((v->x + v->x_size) > 160 )
+	if ((OBJ_X(v) + v->x_size) > 160 )
 	{
-		v->flags |= O_REPOS;
-		v->x = 160 - v->x_size;
+		OBJ_FLAGS(v) |= O_REPOS;
+		OBJ_X(v) = 160 - v->x_size;
 	}
 	
-	if ((v->y - v->y_size) < -1)
+	if ((OBJ_Y(v) - v->y_size) < -1)
 	{
-		v->flags |= O_REPOS;
-		v->y = (v->y_size) - 1;
-		if (   (v->y <= state.horizon) && ((v->flags & O_HORIZONIGNORE) == 0)  )
-			v->y = state.horizon + 1;
+		OBJ_FLAGS(v) |= O_REPOS;
+		OBJ_Y(v) = (v->y_size) - 1;
+		if (   (OBJ_Y(v) <= state.horizon) && ((OBJ_FLAGS(v) & O_HORIZONIGNORE) == 0)  )
+			OBJ_Y(v) = state.horizon + 1;
 	}
 
 }
@@ -369,7 +510,7 @@ u8 *cmd_discard_view_v(u8 *c)
 
 void view_discard(u16 num)
 {
-	VIEW_NODE *v;
+	VIEW_NODE *v, *vn;
 	
 	v = view_find(num);
 	if (v == 0)
@@ -378,6 +519,11 @@ void view_discard(u16 num)
 	script_write(7, num);
 	blists_erase();
 	
+	for (vn = v; vn != 0; vn = node_next(vn))
+	{
+		view_cels_free(vn);
+		view_index[vn->num] = 0;
+	}
 	list_clear_past(view_list, v);	// standard behaviour for pc agi
 	list_remove(view_list, v);
 	//set_mem_ptr(si);
@@ -1,11 +1,29 @@
 #ifndef NAGI_VIEW_VIEW_BASE_H
 #define NAGI_VIEW_VIEW_BASE_H
 
+// a cel decoded out of its RLE chunks.  each variant is width*height
+// colour bytes followed by width*height mask bytes (0xFF opaque)
+struct view_cel_struct
+{
+	u8 width;
+	u8 height;
+	u8 loop;		// loop the cel data faces, from the cel info
+	u8 mirror;		// 1 if other loops draw it flipped
+	u8 *pix[2];		// [1] is the flipped copy if mirror is set
+};
+typedef struct view_cel_struct VIEW_CEL;
+
 struct view_node_struct
 {
 	//struct view_node_struct *next;	// 0
 	u8 num;					// 2 view_num
 	u8 *data;				// 3 data
+
+	// decoded cels, filled in as they're drawn.
+	// cel c of loop l is cels[loop_first[l] + c]. loops sharing data share cels
+	u16 *loop_first;
+	VIEW_CEL **cels;
+	u16 cel_total;
 };
 typedef struct view_node_struct VIEW_NODE;
 
@@ -17,6 +35,7 @@ extern VIEW_NODE *view_find(u16 num);
 extern u8 *cmd_load_view(u8 *c);
 extern u8 *cmd_load_view_v(u8 *c);
 extern VIEW_NODE *view_load(u16 num, u16 force_load);
+extern VIEW_CEL *view_cel_get(VIEW *v);
 extern u8 *cmd_set_view(u8 *c);
 extern u8 *cmd_set_view_v(u8 *c);
 extern void obj_view_set(VIEW *v, u16 num);